@@ -0,0 +1,57 @@
+#include <benchmark/benchmark.h>
+
+#include "amf0.h"
+#include "sstream.h"
+
+// FLV の onMetaData に近いオブジェクト。
+static amf0::Value metaData()
+{
+    return amf0::Value::object(
+        {
+            { "duration", 0.0 },
+            { "width", 1280.0 },
+            { "height", 720.0 },
+            { "videodatarate", 2500.0 },
+            { "framerate", 30.0 },
+            { "videocodecid", 7.0 },
+            { "audiodatarate", 128.0 },
+            { "audiosamplerate", 44100.0 },
+            { "audiocodecid", 10.0 },
+            { "encoder", "obs-output module (libobs version 29.1.3)" },
+        });
+}
+
+static void BM_amf0_serialize(benchmark::State& state)
+{
+    auto value = metaData();
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        auto s = value.serialize();
+        bytes += s.size();
+        benchmark::DoNotOptimize(s);
+    }
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_amf0_serialize);
+
+static void BM_amf0_deserialize(benchmark::State& state)
+{
+    const std::string data = metaData().serialize();
+    amf0::Deserializer d;
+    for (auto _ : state)
+    {
+        StringStream mem(data);
+        benchmark::DoNotOptimize(d.readValue(mem));
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_amf0_deserialize);
+
+static void BM_amf0_inspect(benchmark::State& state)
+{
+    auto value = metaData();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(value.inspect());
+}
+BENCHMARK(BM_amf0_inspect);
@@ -0,0 +1,68 @@
+#include <benchmark/benchmark.h>
+
+#include "atom.h"
+#include "pcp.h"
+#include "sstream.h"
+
+// 中継で流れる BCST に近い入れ子の atom を書く。
+static void writeBroadcast(AtomStream& atom)
+{
+    atom.writeParent(PCP_BCST, 3);
+        atom.writeChar(PCP_BCST_TTL, 7);
+        atom.writeChar(PCP_BCST_HOPS, 0);
+        atom.writeParent(PCP_HOST, 6);
+            atom.writeInt(PCP_HOST_IP, 0x7f000001);
+            atom.writeShort(PCP_HOST_PORT, 7144);
+            atom.writeInt(PCP_HOST_NUML, 10);
+            atom.writeInt(PCP_HOST_NUMR, 20);
+            atom.writeInt(PCP_HOST_UPTIME, 3600);
+            atom.writeString(PCP_HOST_VERSION_EX_PREFIX, "YT");
+}
+
+static void BM_AtomStream_encode(benchmark::State& state)
+{
+    StringStream mem;
+    AtomStream atom(mem);
+    for (auto _ : state)
+    {
+        mem.str("");
+        writeBroadcast(atom);
+    }
+    state.SetBytesProcessed(state.iterations() * mem.str().size());
+}
+BENCHMARK(BM_AtomStream_encode);
+
+static void BM_AtomStream_decode(benchmark::State& state)
+{
+    StringStream mem;
+    AtomStream writer(mem);
+    writeBroadcast(writer);
+    const std::string data = mem.str();
+
+    AtomStream atom(mem);
+    for (auto _ : state)
+    {
+        mem.str(data);
+        mem.rewind();
+
+        // 子を全部読んで捨てる。
+        int numc, dlen;
+        atom.read(numc, dlen);
+        for (int i = 0; i < numc; i++)
+        {
+            int c, d;
+            ID4 id = atom.read(c, d);
+            if (id == PCP_HOST)
+                for (int j = 0; j < c; j++)
+                {
+                    int c2, d2;
+                    atom.read(c2, d2);
+                    atom.skip(c2, d2);
+                }
+            else
+                atom.skip(c, d);
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_AtomStream_decode);
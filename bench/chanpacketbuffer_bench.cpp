@@ -0,0 +1,85 @@
+#include <benchmark/benchmark.h>
+
+#include "chanpacket.h"
+
+// 書き込みに使うパケット。ChanPacket は大きいので使い回す。
+static ChanPacket& dataPacket(unsigned int pos, unsigned int len)
+{
+    static thread_local ChanPacket pack;
+    pack.type = ChanPacket::T_DATA;
+    pack.pos = pos;
+    pack.len = len;
+    return pack;
+}
+
+static void BM_ChanPacketBuffer_writePacket(benchmark::State& state)
+{
+    const unsigned int len = state.range(0);
+    ChanPacketBuffer buf;
+    buf.init();
+
+    unsigned int pos = 0;
+    for (auto _ : state)
+    {
+        buf.writePacket(dataPacket(pos, len), true);
+        pos += len;
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_ChanPacketBuffer_writePacket)->Arg(1024)->Arg(8192);
+
+// 満杯のバッファーに対して、N スレッドがばらばらの位置を探す。
+static void BM_ChanPacketBuffer_findPacket(benchmark::State& state)
+{
+    static ChanPacketBuffer buf;
+    const unsigned int len = 4096;
+    static unsigned int total = 0;
+
+    if (state.thread_index() == 0)
+    {
+        buf.init();
+        for (unsigned int i = 0; i < ChanPacketBuffer::MAX_PACKETS; i++)
+            buf.writePacket(dataPacket(i * len, len), true);
+        total = ChanPacketBuffer::MAX_PACKETS * len;
+    }
+
+    unsigned int spos = state.thread_index() * 7919;
+    std::shared_ptr<const ChanPacketSlab> pack;
+    for (auto _ : state)
+    {
+        spos = (spos + 104729) % total;
+        benchmark::DoNotOptimize(buf.findPacket(spos, pack));
+    }
+}
+BENCHMARK(BM_ChanPacketBuffer_findPacket)->ThreadRange(1, 8);
+
+// スレッド 0 が書き続け、他のスレッドは最新のパケットを追いかける。
+static void BM_ChanPacketBuffer_writeWithReaders(benchmark::State& state)
+{
+    static ChanPacketBuffer buf;
+    static std::atomic<unsigned int> writePos(0);
+    const unsigned int len = 4096;
+
+    if (state.thread_index() == 0)
+    {
+        buf.init();
+        writePos = 0;
+        buf.writePacket(dataPacket(0, len), true);
+        writePos = len;
+    }
+
+    std::shared_ptr<const ChanPacketSlab> pack;
+    for (auto _ : state)
+    {
+        if (state.thread_index() == 0)
+        {
+            buf.writePacket(dataPacket(writePos, len), true);
+            writePos += len;
+        }else
+        {
+            unsigned int p = writePos.load();
+            benchmark::DoNotOptimize(buf.findPacket(p > len ? p - len : 0, pack));
+        }
+    }
+}
+BENCHMARK(BM_ChanPacketBuffer_writeWithReaders)->ThreadRange(2, 16);
@@ -0,0 +1,301 @@
+#include <benchmark/benchmark.h>
+
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "servent.h"
+#include "servmgr.h"
+#include "chanmgr.h"
+#include "channel.h"
+#include "jrpc.h"
+#include "metrics.h"
+
+#include "mockclientsocket.h"
+#include "mockpeercast.h"
+
+// 管理画面と JSON-RPC の負荷。ベンチマークのスレッドの一つ一つがダッシュ
+// ボードのように getStatus, getChannels, getChannelConnections, テンプ
+// レートのページ, viewxml を順に取り、その間、裏のスレッドがチャンネルに
+// パケットを書いて読み手が追いかける。一巡りの時間と、要求ごとの遅延、
+// パケットが書かれてから読み手に見えるまでの遅延を数える。引数は
+// jrpcSnapshotInterval (ミリ秒)。
+
+namespace
+{
+    double monotonicSeconds()
+    {
+        using namespace std::chrono;
+        return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    // スナップショットの期限などが効くように実時間で動き、ページのファ
+    // イルは PEERCAST_UI_DIR から読む。
+    class BenchSys : public MockSys
+    {
+    public:
+        unsigned int getTime() override { return (unsigned int) ::time(nullptr); }
+        double getDTime() override { return monotonicSeconds(); }
+        double getMonotonicTime() override { return monotonicSeconds(); }
+        std::string realPath(const std::string& path) override
+        {
+            return path.size() > 1 && path.back() == '/' ? path.substr(0, path.size() - 1) : path;
+        }
+    };
+
+    class BenchApplication : public MockPeercastApplication
+    {
+    public:
+        const char* APICALL getPath() override { return PEERCAST_UI_DIR; }
+    };
+
+    enum
+    {
+        NUM_CHANNELS        = 30,
+        HITS_PER_CHANNEL    = 8,
+        RELAYS_PER_CHANNEL  = 4,
+        DIRECTS_PER_CHANNEL = 4,
+        PACKET_INTERVAL_USEC = 2000,    // 1KB を 2ms ごと (4Mbps)
+        PACKET_LEN          = 1024,
+    };
+
+    std::vector<double> latencyBounds()
+    {
+        // 10µs から 1.25 倍ずつ、およそ 6 秒まで。
+        return Metrics::Histogram::exponentialBounds(0.00001, 1.25, 60);
+    }
+
+    // チャンネルとヒットと接続を並べ、配信中のチャンネルにパケットを流
+    // す。ベンチマークの間だけ sys と peercastApp を差し替える。
+    class ControlPlane
+    {
+    public:
+        ControlPlane(unsigned int snapshotInterval)
+            : delivery(latencyBounds())
+            , writeStall(latencyBounds())
+            , requests(latencyBounds())
+            , m_oldSys(sys)
+            , m_oldApp(peercastApp)
+            , m_oldSnapshotInterval(servMgr->jrpcSnapshotInterval)
+            , m_running(true)
+        {
+            sys = new BenchSys();
+            peercastApp = new BenchApplication();
+            servMgr->jrpcSnapshotInterval = snapshotInterval;
+            JrpcApi::clearSnapshots();
+
+            for (int i = 0; i < NUM_CHANNELS; i++)
+            {
+                ChanInfo info;
+                info.id = GnuID::random();
+                info.name = ("channel " + std::to_string(i)).c_str();
+                info.genre = "game";
+                info.desc = "control plane benchmark";
+                info.bitrate = 500;
+                info.contentType = ChanInfo::T_FLV;
+                info.track.title = "title";
+                info.track.artist = "artist";
+                auto ch = chanMgr->createChannel(info);
+                ch->setStatus(Channel::S_BROADCASTING);
+                m_channels.push_back(ch);
+
+                for (int j = 0; j < HITS_PER_CHANNEL; j++)
+                {
+                    ChanHit hit;
+                    hit.init();
+                    hit.chanID = info.id;
+                    hit.host.fromStrIP(("10.0." + std::to_string(i) + "." + std::to_string(j + 1)).c_str(), 7144);
+                    hit.rhost[0] = hit.host;
+                    hit.numListeners = j;
+                    hit.numRelays = j % 3;
+                    hit.relay = true;
+                    chanMgr->addHit(hit);
+                }
+
+                for (int j = 0; j < RELAYS_PER_CHANNEL + DIRECTS_PER_CHANNEL; j++)
+                {
+                    auto s = servMgr->allocServent();
+                    s->type = j < RELAYS_PER_CHANNEL ? Servent::T_RELAY : Servent::T_DIRECT;
+                    s->status = Servent::S_CONNECTED;
+                    s->chanID = info.id;
+                    m_servents.push_back(s);
+                }
+            }
+
+            m_writer = std::thread([this]() { writeLoop(); });
+            m_reader = std::thread([this]() { readLoop(); });
+        }
+
+        ~ControlPlane()
+        {
+            m_running = false;
+            m_writer.join();
+            m_reader.join();
+
+            for (auto s : m_servents)
+            {
+                s->type = Servent::T_NONE;
+                s->status = Servent::S_FREE;
+                s->chanID.clear();
+            }
+            for (auto& ch : m_channels)
+                chanMgr->deleteChannel(ch);
+            chanMgr->clearHitLists();
+            JrpcApi::clearSnapshots();
+            servMgr->jrpcSnapshotInterval = m_oldSnapshotInterval;
+
+            delete peercastApp;
+            peercastApp = m_oldApp;
+            delete sys;
+            sys = m_oldSys;
+        }
+
+        // 一つの要求を処理させて、応答の大きさを返す。
+        size_t request(const std::string& req)
+        {
+            auto mock = std::make_shared<MockClientSocket>();
+            mock->host = Host("127.0.0.1", 12345);
+            mock->incoming.str(req);
+
+            Servent s(0);
+            s.sock = mock;
+            double start = monotonicSeconds();
+            try
+            {
+                s.handshakeIncoming();
+            }catch (StreamException&)
+            {
+            }
+            requests.observe(monotonicSeconds() - start);
+            s.sock = nullptr;
+            return mock->outgoing.str().size();
+        }
+
+        static std::string post(const std::string& body)
+        {
+            return "POST /api/1 HTTP/1.0\r\n"
+                "Content-Type: application/json\r\n"
+                "X-Requested-With: XMLHttpRequest\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                "\r\n" + body;
+        }
+
+        // ダッシュボード一つの一巡り。
+        size_t poll(int n)
+        {
+            const std::string id = m_channels[n % m_channels.size()]->info.id.str();
+            size_t bytes = 0;
+            bytes += request(post(R"({"jsonrpc":"2.0","method":"getStatus","id":1})"));
+            bytes += request(post(R"({"jsonrpc":"2.0","method":"getChannels","id":2})"));
+            bytes += request(post(R"({"jsonrpc":"2.0","method":"getChannelConnections","params":[")" + id + R"("],"id":3})"));
+            bytes += request("GET /html/en/channels.html HTTP/1.0\r\n\r\n");
+            bytes += request("GET /admin?cmd=viewxml HTTP/1.0\r\n\r\n");
+            return bytes;
+        }
+
+        Metrics::Histogram delivery;    // 書いてから読み手に見えるまで
+        Metrics::Histogram writeStall;  // newPacket にかかった時間
+        Metrics::Histogram requests;
+        std::atomic<uint64_t> packetsRead { 0 };
+
+    private:
+        // パケットの先頭に書いた時刻を入れる。
+        void writeLoop()
+        {
+            static ChanPacket pack;
+            auto ch = m_channels[0];
+            unsigned int pos = 0;
+            auto next = std::chrono::steady_clock::now();
+            while (m_running)
+            {
+                pack.type = ChanPacket::T_DATA;
+                pack.pos = pos;
+                pack.len = PACKET_LEN;
+                pack.cont = false;
+                double start = monotonicSeconds();
+                memcpy(pack.data, &start, sizeof(start));
+                ch->newPacket(pack);
+                writeStall.observe(monotonicSeconds() - start);
+                pos += PACKET_LEN;
+
+                next += std::chrono::microseconds(PACKET_INTERVAL_USEC);
+                std::this_thread::sleep_until(next);
+            }
+        }
+
+        void readLoop()
+        {
+            auto ch = m_channels[0];
+            unsigned int pos = 0;
+            std::shared_ptr<const ChanPacketSlab> pack;
+            while (m_running)
+            {
+                if (!ch->rawData.findPacket(pos, pack))
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    continue;
+                }
+                double written;
+                memcpy(&written, pack->data, sizeof(written));
+                delivery.observe(monotonicSeconds() - written);
+                pos = pack->pos + pack->len;
+                packetsRead++;
+            }
+        }
+
+        Sys*            m_oldSys;
+        PeercastApplication* m_oldApp;
+        unsigned int    m_oldSnapshotInterval;
+        std::atomic<bool> m_running;
+        std::vector<std::shared_ptr<Channel>> m_channels;
+        std::vector<Servent*> m_servents;
+        std::thread     m_writer, m_reader;
+    };
+
+    ControlPlane* s_plane = nullptr;
+
+    void report(benchmark::State& state)
+    {
+        state.counters["req_p50_ms"] = s_plane->requests.quantile(0.5) * 1000;
+        state.counters["req_p99_ms"] = s_plane->requests.quantile(0.99) * 1000;
+        state.counters["pkt_p99_ms"] = s_plane->delivery.quantile(0.99) * 1000;
+        state.counters["pkt_p999_ms"] = s_plane->delivery.quantile(0.999) * 1000;
+        state.counters["write_p99_ms"] = s_plane->writeStall.quantile(0.99) * 1000;
+        state.counters["packets"] = s_plane->packetsRead.load();
+    }
+}
+
+static void BM_ControlPlane_poll(benchmark::State& state)
+{
+    if (state.thread_index() == 0)
+        s_plane = new ControlPlane((unsigned int) state.range(0));
+
+    size_t bytes = 0;
+    int n = state.thread_index();
+    for (auto _ : state)
+        bytes += s_plane->poll(n++);
+    state.SetBytesProcessed(bytes);
+
+    if (state.thread_index() == 0)
+    {
+        report(state);
+        delete s_plane;
+        s_plane = nullptr;
+    }
+}
+BENCHMARK(BM_ControlPlane_poll)->Arg(0)->Arg(1000)->Threads(1)->Threads(8)->Threads(32)->UseRealTime();
+
+// 問い合わせの無い時のパケットの遅延。比べるための基準。
+static void BM_ControlPlane_idle(benchmark::State& state)
+{
+    s_plane = new ControlPlane(0);
+    for (auto _ : state)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    report(state);
+    delete s_plane;
+    s_plane = nullptr;
+}
+BENCHMARK(BM_ControlPlane_idle)->UseRealTime();
@@ -0,0 +1,47 @@
+#include <benchmark/benchmark.h>
+
+#include "flv.h"
+#include "sstream.h"
+#include "channel.h"
+
+// type 型、ペイロード payload のタグ。
+static std::string flvTag(int type, const std::string& payload)
+{
+    int size = payload.size();
+    std::string tag = { (char) type, (char) (size >> 16), (char) (size >> 8), (char) size,
+                        0, 0, 0, 0, 0, 0, 0 };
+    int prevSize = 11 + size;
+    return tag + payload + std::string({ (char) (prevSize >> 24), (char) (prevSize >> 16),
+                                         (char) (prevSize >> 8), (char) prevSize });
+}
+
+// キーフレーム 1 つと続くフレームからなる 1 秒分ほどの映像。
+static void BM_FLVStream_readPacket(benchmark::State& state)
+{
+    const int frameSize = state.range(0);
+    const std::string fileHeader = { 'F','L','V',1,5,0,0,0,9,0,0,0,0 };
+    std::string body = flvTag(FLVTag::T_VIDEO, std::string({0x17,0x00}));
+    body += flvTag(FLVTag::T_VIDEO, std::string({0x17,0x01}) + std::string(frameSize * 4, 'K'));
+    for (int i = 0; i < 29; i++)
+        body += flvTag(FLVTag::T_VIDEO, std::string({0x27,0x01}) + std::string(frameSize, 'P'));
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        StringStream mem(fileHeader + body);
+        auto ch = std::make_shared<Channel>();
+        FLVStream flv;
+        flv.readHeader(mem, ch);
+        state.ResumeTiming();
+
+        try
+        {
+            while (true)
+                flv.readPacket(mem, ch);
+        }catch (StreamException&)
+        {
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * body.size());
+}
+BENCHMARK(BM_FLVStream_readPacket)->Arg(1000)->Arg(10000);
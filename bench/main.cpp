@@ -0,0 +1,31 @@
+#include <benchmark/benchmark.h>
+
+#include "servmgr.h"
+#include "chanmgr.h"
+#include "mockpeercast.h"
+
+#if WIN32
+#include "wsocket.h"
+#endif
+
+int main(int argc, char** argv)
+{
+    ::benchmark::Initialize(&argc, argv);
+    if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+
+#ifdef WIN32
+    WSAClientSocket::init();
+#endif
+
+    peercastApp = new MockPeercastApplication();
+    peercastInst = new MockPeercastInstance();
+    peercastInst->init();
+
+    // チャンネルにパケットを書く測定が使う。
+    if (!chanMgr)
+        chanMgr = new ChanMgr();
+
+    ::benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
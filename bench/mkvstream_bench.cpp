@@ -0,0 +1,36 @@
+#include <benchmark/benchmark.h>
+
+#include "mkv.h"
+#include "channel.h"
+
+// トラック 1 の SimpleBlock。size はペイロードの大きさ。
+static std::string simpleBlock(int size, bool key)
+{
+    std::string payload = { (char) 0x81, 0, 0, (char) (key ? 0x80 : 0) };
+    payload += std::string(size - payload.size(), '\0');
+    return std::string({ (char) 0xA3, (char) 0x20, (char) (size >> 8), (char) size }) + payload;
+}
+
+static std::string cluster(const std::string& body)
+{
+    int size = body.size();
+    return std::string({ 0x1F, 0x43, (char) 0xB6, 0x75,
+                         0x10, (char) (size >> 16), (char) (size >> 8), (char) size }) + body;
+}
+
+static void BM_MKVStream_sendCluster(benchmark::State& state)
+{
+    const int numBlocks = state.range(0);
+    std::string timecode = { (char) 0xE7, (char) 0x81, 0 };
+    std::string body = timecode + simpleBlock(8000, true);
+    for (int i = 1; i < numBlocks; i++)
+        body += simpleBlock(2000, false);
+    auto c = cluster(body);
+
+    auto ch = std::make_shared<Channel>();
+    MKVStream mkv;
+    for (auto _ : state)
+        mkv.sendCluster((const uint8_t*) c.data(), c.size(), ch);
+    state.SetBytesProcessed(state.iterations() * c.size());
+}
+BENCHMARK(BM_MKVStream_sendCluster)->Arg(10)->Arg(100);
@@ -0,0 +1,38 @@
+#include <benchmark/benchmark.h>
+
+#include "template.h"
+#include "sstream.h"
+
+// チャンネル一覧のページに近い、行の繰り返しと条件分岐。
+static void BM_Template_foreach(benchmark::State& state)
+{
+    const int numItems = state.range(0);
+    std::vector<amf0::Value> items;
+    for (int i = 0; i < numItems; i++)
+        items.push_back(amf0::Value::object(
+                            {
+                                { "name", "channel " + std::to_string(i) },
+                                { "listeners", i },
+                                { "playing", i % 2 == 0 },
+                            }));
+
+    GenericScope locals;
+    locals.vars["channels"] = items;
+
+    const std::string source =
+        "<table>{@foreach channels}"
+        "<tr><td>{$this.name}</td><td>{$this.listeners}</td>"
+        "<td>{@if this.playing}playing{@else}idle{@end}</td></tr>"
+        "{@end}</table>";
+
+    for (auto _ : state)
+    {
+        Template temp("");
+        temp.prependScope(locals);
+        StringStream in(source), out;
+        temp.readTemplate(in, &out);
+        benchmark::DoNotOptimize(out.str());
+    }
+    state.SetItemsProcessed(state.iterations() * numItems);
+}
+BENCHMARK(BM_Template_foreach)->Arg(10)->Arg(100);
@@ -18,6 +18,7 @@
 
 #define _POSIX_C_SOURCE 200809L // expose localtime_r on Windows
 #include <time.h>
+#include <algorithm>
 
 #include "_string.h"
 #include "jis.h"
@@ -187,16 +188,60 @@ void String::BASE642ASCII(const char *input)
     *out = 0;
 }
 
+// -----------------------------------
+// ASCII の続くところをまとめて out に足す。入りきらなくなったら false。
+static bool appendASCII(std::string& out, const char *in, size_t len, bool safe)
+{
+    if (!safe)
+    {
+        const size_t room = String::MAX_LEN - 1 - out.size();
+        out.append(in, std::min(len, room));
+        return len <= room;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        const char c = in[i];
+        const char *str = nullptr;
+        if (c == '&') str = "&amp;";
+        else if (c == '\"') str = "&quot;";
+        else if (c == '\'') str = "&#039;";
+        else if (c == '<') str = "&lt;";
+        else if (c == '>') str = "&gt;";
+
+        const size_t n = str ? strlen(str) : 1;
+        if (out.size() + n >= String::MAX_LEN)
+            return false;
+        if (str)
+            out += str;
+        else
+            out += c;
+    }
+    return true;
+}
+
 // -----------------------------------
 void String::UNKNOWN2UNICODE(const char *in, bool safe)
 {
     std::string utf8;
+    const char *end = in + strlen(in);
 
     unsigned char c;
     unsigned char d;
 
-    while ((c = *in++) != '\0')
+    while (in < end)
     {
+        // 多くは ASCII なので、そこは表を引かずにまとめて写す。
+        size_t run = str::ascii_span(in, end - in);
+        if (run)
+        {
+            if (!appendASCII(utf8, in, run, safe))
+                break;
+            in += run;
+            continue;
+        }
+
+        c = *in++;
         std::string buf;
         d = *in;
 
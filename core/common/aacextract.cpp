@@ -0,0 +1,259 @@
+// ------------------------------------------------
+// File : aacextract.cpp
+// Desc:
+//      FLV チャンネルの音声だけの出力。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <string.h>
+
+#include "aacextract.h"
+#include "channel.h"
+#include "flv.h"
+
+// ------------------------------------
+AACExtractor::AACExtractor()
+    : m_started(false)
+    , m_streamIndex(0)
+    , m_streamPos(0)
+    , m_skipContinuation(false)
+    , m_bufPos(0)
+    , m_needFileHeader(true)
+    , m_hasAudioConfig(false)
+    , m_aacProfile(1)
+    , m_aacFreqIndex(4)
+    , m_aacChannels(2)
+    , m_firstChunk(0)
+    , m_bytesProduced(0)
+{
+}
+
+// ------------------------------------
+void AACExtractor::update(std::shared_ptr<Channel> ch)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    if (!m_started || m_streamIndex != ch->streamIndex)
+    {
+        // 新しいソース。AudioSpecificConfig はヘッダーから取り直す。
+        breakStream();
+        m_needFileHeader = true;
+        m_hasAudioConfig = false;
+        m_started = true;
+        m_streamIndex = ch->streamIndex;
+        feed(ch->headPack.data, ch->headPack.len);
+
+        // 最新のキーフレームから始めれば、最初の聴取者にもすぐ何か送れる。
+        m_streamPos = ch->rawData.getLatestNonContinuationPos();
+        if (!m_streamPos)
+            m_streamPos = ch->headPack.pos + ch->headPack.len;
+        m_skipContinuation = true;
+    }
+
+    std::shared_ptr<const ChanPacketSlab> pack;
+    while (ch->rawData.findPacket(m_streamPos, pack))
+    {
+        // 取り込む前に上書きされた。
+        if (pack->pos > m_streamPos)
+        {
+            breakStream();
+            m_skipContinuation = true;
+        }
+        m_streamPos = pack->pos + pack->len;
+
+        if (m_skipContinuation && pack->cont)
+            continue;
+        m_skipContinuation = false;
+
+        if (pack->type == ChanPacket::T_HEAD)
+        {
+            m_buf.clear();
+            m_bufPos = 0;
+            m_needFileHeader = true;
+        }
+        if (pack->type == ChanPacket::T_HEAD || pack->type == ChanPacket::T_DATA)
+        {
+            feed(pack->data, pack->len);
+            commit();
+        }
+    }
+}
+
+// ------------------------------------
+void AACExtractor::put(const void* data, int len)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    feed(data, len);
+    commit();
+}
+
+// ------------------------------------
+void AACExtractor::discontinuity()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    breakStream();
+}
+
+// ------------------------------------
+void AACExtractor::breakStream()
+{
+    m_buf.clear();
+    m_bufPos = 0;
+    m_needFileHeader = false;
+}
+
+// ------------------------------------
+// バイト列からタグを切り出す。途中までのタグは次に持ち越す。
+void AACExtractor::feed(const void* data, int len)
+{
+    m_buf.append(static_cast<const char*>(data), len);
+
+    while (true)
+    {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(m_buf.data()) + m_bufPos;
+        size_t avail = m_buf.size() - m_bufPos;
+
+        if (m_needFileHeader)
+        {
+            if (avail < 13)
+                break;
+            if (memcmp(p, "FLV", 3) == 0)
+                m_bufPos += 13;
+            m_needFileHeader = false;
+            continue;
+        }
+
+        if (avail < 11)
+            break;
+
+        int type = p[0] & 0x1f;
+        size_t size = (p[1] << 16) | (p[2] << 8) | p[3];
+        if (type != FLVTag::T_AUDIO && type != FLVTag::T_VIDEO && type != FLVTag::T_SCRIPT)
+        {
+            // タグの境目を見失った。次のキーフレームのパケットまで捨てる。
+            breakStream();
+            m_skipContinuation = true;
+            return;
+        }
+        if (avail < 11 + size + 4)
+            break;
+
+        if (type == FLVTag::T_AUDIO)
+            putAudio(p + 11, (int) size);
+        m_bufPos += 11 + size + 4;
+    }
+
+    if (m_bufPos == m_buf.size())
+    {
+        m_buf.clear();
+        m_bufPos = 0;
+    }else if (m_bufPos > 64 * 1024)
+    {
+        m_buf.erase(0, m_bufPos);
+        m_bufPos = 0;
+    }
+}
+
+// ------------------------------------
+// AAC のフレームに ADTS のヘッダーを付けて m_pending に足す。AAC 以外
+// の音声は無視する。
+void AACExtractor::putAudio(const uint8_t* data, int size)
+{
+    if (size < 2 || (data[0] >> 4) != FLVTag::SOUND_AAC)
+        return;
+
+    if (data[1] == 0)
+    {
+        // AudioSpecificConfig
+        if (size < 4)
+            return;
+        int objectType = data[2] >> 3;
+        // ADTS で表せない HE-AAC などは LC として扱う。
+        m_aacProfile = (objectType >= 1 && objectType <= 4) ? objectType - 1 : 1;
+        m_aacFreqIndex = ((data[2] & 0x07) << 1) | (data[3] >> 7);
+        m_aacChannels = (data[3] >> 3) & 0x0f;
+        m_hasAudioConfig = true;
+        return;
+    }
+
+    if (!m_hasAudioConfig)
+        return;
+
+    int frameLength = 7 + size - 2;
+    m_pending.push_back((char) 0xff);
+    m_pending.push_back((char) 0xf1);
+    m_pending.push_back((char) ((m_aacProfile << 6) | (m_aacFreqIndex << 2) | (m_aacChannels >> 2)));
+    m_pending.push_back((char) (((m_aacChannels & 3) << 6) | (frameLength >> 11)));
+    m_pending.push_back((char) ((frameLength >> 3) & 0xff));
+    m_pending.push_back((char) (((frameLength & 7) << 5) | 0x1f));
+    m_pending.push_back((char) 0xfc);
+    m_pending.append(reinterpret_cast<const char*>(data + 2), size - 2);
+}
+
+// ------------------------------------
+// 溜まった ADTS を一つのチャンクにする。
+void AACExtractor::commit()
+{
+    if (m_pending.empty())
+        return;
+
+    m_bytesProduced += m_pending.size();
+    m_chunks.push_back(std::make_shared<const std::string>(std::move(m_pending)));
+    m_pending.clear();
+    while (m_chunks.size() > MAX_CHUNKS)
+    {
+        m_chunks.pop_front();
+        m_firstChunk++;
+    }
+}
+
+// ------------------------------------
+unsigned int AACExtractor::joinPosition()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    unsigned int end = m_firstChunk + m_chunks.size();
+    return (m_chunks.size() > JOIN_CHUNKS) ? end - JOIN_CHUNKS : m_firstChunk;
+}
+
+// ------------------------------------
+bool AACExtractor::read(unsigned int& pos, std::vector<Chunk>& out)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    // 遅れて消えた分は飛ばす。
+    if ((int) (pos - m_firstChunk) < 0)
+        pos = m_firstChunk;
+
+    bool added = false;
+    while (pos - m_firstChunk < m_chunks.size())
+    {
+        out.push_back(m_chunks[pos - m_firstChunk]);
+        pos++;
+        added = true;
+    }
+    return added;
+}
+
+// ------------------------------------
+bool AACExtractor::hasAudioConfig()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_hasAudioConfig;
+}
+
+// ------------------------------------
+uint64_t AACExtractor::bytesProduced()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_bytesProduced;
+}
@@ -0,0 +1,96 @@
+// ------------------------------------------------
+// File : aacextract.h
+// Desc:
+//      FLV チャンネルの音声だけの出力 (/stream/<ID>.aac)。チャンネルの
+//      パケットバッファーから FLV を読んで AAC を ADTS に直し、直近の
+//      ものをチャンネルに一つだけ置いて聴取者の間で共有する。
+//
+//      HLS と同じく、聴取者が居る間だけ update で新しいパケットを取り
+//      込む。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _AACEXTRACT_H
+#define _AACEXTRACT_H
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Channel;
+
+// ------------------------------------
+class AACExtractor
+{
+public:
+    enum
+    {
+        MAX_CHUNKS  = 256,  // 手元に置くチャンク (元のパケット一つ分の ADTS) の数
+        JOIN_CHUNKS = 10,   // 新しい聴取者に最初に送るチャンクの数
+    };
+
+    typedef std::shared_ptr<const std::string> Chunk;
+
+    AACExtractor();
+
+    // ch のパケットバッファーから新しいパケットを取り込む。
+    void    update(std::shared_ptr<Channel> ch);
+
+    // FLV のバイト列を取り込む。ファイルヘッダーから始まっても、タグ
+    // の途中で区切れていてもよい。溜まった ADTS は一つのチャンクになる。
+    void    put(const void* data, int len);
+    // パケットが飛んだ。作りかけのタグを捨てる。
+    void    discontinuity();
+
+    // 新しい聴取者の読み出し位置。
+    unsigned int joinPosition();
+    // pos 以降のチャンクを out に足して pos を進める。消えてしまった所
+    // は飛ばす。足したら true。
+    bool    read(unsigned int& pos, std::vector<Chunk>& out);
+
+    // AudioSpecificConfig を受け取ったか。
+    bool    hasAudioConfig();
+    uint64_t bytesProduced();
+
+private:
+    void    feed(const void* data, int len);
+    void    putAudio(const uint8_t* data, int size);
+    void    commit();
+    void    breakStream();
+
+    std::mutex          m_lock;
+
+    // 取り込み位置
+    bool                m_started;
+    unsigned int        m_streamIndex;
+    unsigned int        m_streamPos;
+    bool                m_skipContinuation;
+
+    // FLV の読み取り
+    std::string         m_buf;
+    size_t              m_bufPos;
+    bool                m_needFileHeader;
+
+    // AudioSpecificConfig から
+    bool                m_hasAudioConfig;
+    int                 m_aacProfile, m_aacFreqIndex, m_aacChannels;
+
+    std::string         m_pending;      // まだチャンクにしていない ADTS
+    std::deque<Chunk>   m_chunks;
+    unsigned int        m_firstChunk;   // m_chunks の先頭の番号
+    uint64_t            m_bytesProduced;
+};
+
+#endif
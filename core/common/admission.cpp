@@ -0,0 +1,171 @@
+// ------------------------------------------------
+// File : admission.cpp
+// Desc:
+//      受け付けた接続のふるい分け。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+
+#include "admission.h"
+#include "socket.h"
+#include "sstream.h"
+#include "atom.h"
+#include "pcp.h"
+#include "http.h"
+
+AdmissionControl g_admission;
+
+// ------------------------------------
+IP AdmissionControl::subnetOf(const IP& ip)
+{
+    auto a = ip.serialize();
+    if (ip.isIPv4Mapped())
+        a.s6_addr[15] = 0;
+    else
+        std::fill(a.s6_addr + 8, a.s6_addr + 16, 0);
+    return IP(a);
+}
+
+// ------------------------------------
+bool AdmissionControl::take(std::map<IP, Bucket>& buckets, const IP& key, double rate, double burst, double now)
+{
+    auto it = buckets.find(key);
+    if (it == buckets.end())
+    {
+        Bucket b;
+        b.tokens = burst;
+        b.updatedAt = now;
+        it = buckets.insert({key, b}).first;
+    }
+
+    auto& b = it->second;
+    b.tokens = std::min(burst, b.tokens + (now - b.updatedAt) * rate);
+    b.updatedAt = now;
+    if (b.tokens < 1)
+        return false;
+    b.tokens -= 1;
+    return true;
+}
+
+// ------------------------------------
+AdmissionControl::Decision AdmissionControl::admit(const IP& ip, unsigned int pending, double now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    if (!ip.isGlobal())
+    {
+        m_numAdmitted++;
+        return D_ADMIT;
+    }
+
+    if (pending >= MAX_PENDING)
+    {
+        m_numBusy++;
+        return D_BUSY;
+    }
+
+    // 送り元を変えながら来られても、覚える数は抑える。
+    if (m_ips.size() >= MAX_BUCKETS)
+        m_ips.clear();
+    if (m_subnets.size() >= MAX_BUCKETS)
+        m_subnets.clear();
+
+    if (!take(m_ips, ip, IP_RATE, IP_BURST, now))
+    {
+        m_numRateLimited++;
+        return D_RATE_IP;
+    }
+    if (!take(m_subnets, subnetOf(ip), SUBNET_RATE, SUBNET_BURST, now))
+    {
+        m_numRateLimited++;
+        return D_RATE_SUBNET;
+    }
+
+    m_numAdmitted++;
+    return D_ADMIT;
+}
+
+// ------------------------------------
+void AdmissionControl::expire(double now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    for (auto* buckets : { &m_ips, &m_subnets })
+    {
+        for (auto it = buckets->begin(); it != buckets->end(); )
+        {
+            if (now - it->second.updatedAt >= IDLE_SECONDS)
+                it = buckets->erase(it);
+            else
+                ++it;
+        }
+    }
+}
+
+// ------------------------------------
+void AdmissionControl::reject(ClientSocket& sock)
+{
+    try
+    {
+        // まだ何も来ていなければ待たずに閉じる。
+        if (!sock.readReady(0))
+            return;
+
+        StringStream mem;
+        if (sock.peekChar() == 'p')
+        {
+            // "pcp\n" で始まる PCP の接続。
+            AtomStream atom(mem);
+            atom.writeInt(PCP_QUIT, PCP_ERROR_QUIT + PCP_ERROR_UNAVAILABLE);
+        }else
+        {
+            mem.writeLine(HTTP_SC_UNAVAILABLE);
+            mem.writeLine("Content-Length: 0");
+            mem.writeLine("Connection: close");
+            mem.writeLine("");
+        }
+
+        auto data = mem.str();
+        sock.tryWrite(data.data(), data.size());
+    }catch (GeneralException& e)
+    {
+        LOG_TRACE("Admission reject: %s", e.msg);
+    }
+}
+
+// ------------------------------------
+const char* AdmissionControl::decisionStr(Decision d)
+{
+    switch (d)
+    {
+    case D_ADMIT:       return "admit";
+    case D_RATE_IP:     return "rate limited (address)";
+    case D_RATE_SUBNET: return "rate limited (subnet)";
+    case D_BUSY:        return "too many pending handshakes";
+    default:            return "unknown";
+    }
+}
+
+// ------------------------------------
+amf0::Value AdmissionControl::getState()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return amf0::Value::object(
+        {
+            {"numAddresses", (int) m_ips.size()},
+            {"numSubnets", (int) m_subnets.size()},
+            {"numAdmitted", m_numAdmitted},
+            {"numRateLimited", m_numRateLimited},
+            {"numBusy", m_numBusy},
+        });
+}
@@ -0,0 +1,94 @@
+// ------------------------------------------------
+// File : admission.h
+// Desc:
+//      受け付けた接続をサーバントに渡す前にふるいにかける
+//      (admissionControl フラグ)。IP アドレスとサブネットごとのトーク
+//      ンバケツで接続の頻度を抑え、ハンドシェイク中の接続の数に上限を
+//      設ける。断る接続にはスレッドもサーバントも使わず、その場で PCP
+//      の QUIT か HTTP の 503 を返して閉じる。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _ADMISSION_H
+#define _ADMISSION_H
+
+#include <map>
+#include <mutex>
+
+#include "ip.h"
+#include "amf0.h"
+
+class ClientSocket;
+
+// ------------------------------------
+class AdmissionControl
+{
+public:
+    enum Decision
+    {
+        D_ADMIT,
+        D_RATE_IP,      // IP アドレスの頻度を超えた
+        D_RATE_SUBNET,  // サブネットの頻度を超えた
+        D_BUSY,         // ハンドシェイク中の接続が多すぎる
+    };
+
+    enum
+    {
+        IP_BURST        = 20,       // IP アドレスごとに続けて受け付ける数
+        IP_RATE         = 5,        // その後の一秒あたりの数
+        SUBNET_BURST    = 60,       // IPv4 は /24、IPv6 は /64 ごと
+        SUBNET_RATE     = 20,
+        MAX_PENDING     = 64,       // ハンドシェイク中の接続の上限
+        IDLE_SECONDS    = 60,       // 使われないバケツを消すまでの秒数
+        MAX_BUCKETS     = 65536,    // これを超えたら全部忘れる
+    };
+
+    // ip からの接続を受け付けるかどうか。pending は今ハンドシェイク中
+    // の接続の数。LAN 内とループバックからの接続は常に受け付ける。
+    Decision    admit(const IP& ip, unsigned int pending, double now);
+
+    // 長く使われていないバケツを消す。
+    void        expire(double now);
+
+    // 断った接続に、最初のバイトを覗けた時はプロトコルに合わせた返事
+    // を書く。ブロックしない。閉じるのは呼び出し側。
+    static void reject(ClientSocket& sock);
+
+    // IPv4 は /24、IPv6 は /64 に丸める。
+    static IP   subnetOf(const IP& ip);
+
+    static const char* decisionStr(Decision d);
+
+    amf0::Value getState();
+
+private:
+    struct Bucket
+    {
+        double tokens = 0;
+        double updatedAt = 0;
+    };
+
+    // バケツから一つ取る。無ければ作る。
+    static bool take(std::map<IP, Bucket>& buckets, const IP& key, double rate, double burst, double now);
+
+    std::mutex              m_lock;
+    std::map<IP, Bucket>    m_ips;
+    std::map<IP, Bucket>    m_subnets;
+    unsigned int            m_numAdmitted = 0;
+    unsigned int            m_numRateLimited = 0;
+    unsigned int            m_numBusy = 0;
+};
+
+extern AdmissionControl g_admission;
+
+#endif
@@ -88,7 +88,7 @@ Value Deserializer::readValue(Stream &in)
         for (int i = 0; i < len; i++) {
             list.push_back(readValue(in));
         }
-        return Value::strictArray(list);
+        return Value::strictArray(std::move(list));
     }
     case AMF_NULL:
     {
@@ -120,7 +120,7 @@ std::string Value::inspect() const
     {
         std::string buf = "{";
         bool first = true;
-        for (auto pair : m_object)
+        for (const auto& pair : m_object)
         {
             if (!first)
                 buf += ",";
@@ -142,7 +142,7 @@ std::string Value::inspect() const
     {
         std::string buf = "[";
         bool first = true;
-        for (auto elt : m_strict_array)
+        for (const auto& elt : m_strict_array)
         {
             if (!first)
                 buf += ",";
@@ -21,6 +21,8 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <new>
 #include <string>
 #include <vector>
 #include <map>
@@ -65,6 +67,55 @@ namespace amf0
         uint16_t timezone;
     };
 
+    // オブジェクトのプロパティ。キーの順に並べた KeyValuePair の列で、
+    // std::map と同じように使える。getState() の木は小さなオブジェクト
+    // がほとんどなので、ノードを一つずつ確保する std::map より軽い。同
+    // じキーが重なれば後のものを残す。
+    class Object
+    {
+    public:
+        typedef std::vector<KeyValuePair>::iterator       iterator;
+        typedef std::vector<KeyValuePair>::const_iterator const_iterator;
+
+        Object() {}
+        Object(std::initializer_list<KeyValuePair> l);
+        explicit Object(std::vector<KeyValuePair>&& l);
+        explicit Object(const std::vector<KeyValuePair>& l);
+        explicit Object(const std::map<std::string,Value>& map);
+
+        operator std::map<std::string,Value>() const;
+
+        iterator       begin()       { return m_pairs.begin(); }
+        iterator       end()         { return m_pairs.end(); }
+        const_iterator begin() const { return m_pairs.begin(); }
+        const_iterator end() const   { return m_pairs.end(); }
+
+        size_t size() const  { return m_pairs.size(); }
+        bool   empty() const { return m_pairs.empty(); }
+
+        iterator       find(const std::string& key);
+        const_iterator find(const std::string& key) const;
+        size_t         count(const std::string& key) const;
+
+        // 無ければ std::out_of_range。
+        Value&         at(const std::string& key);
+        const Value&   at(const std::string& key) const;
+
+        Value&         operator[](const std::string& key);
+        size_t         erase(const std::string& key);
+
+        bool operator == (const Object& rhs) const;
+        bool operator != (const Object& rhs) const;
+
+    private:
+        const_iterator lowerBound(const std::string& key) const;
+        void           normalize();
+
+        std::vector<KeyValuePair> m_pairs;
+    };
+
+    // 型ごとの値は共用体に持つ。数や真偽値が文字列やコンテナの分の場所
+    // を取らないようにするため。
     class Value
     {
     public:
@@ -79,83 +130,93 @@ namespace amf0
             kDate,
         };
 
-        Value() : m_type(kNull), m_number(0.0), m_bool(false) {}
+        Value() : m_type(kNull), m_number(0.0) {}
         Value(std::nullptr_t p) : Value() {}
-        Value(double d) : m_type(kNumber), m_number(d), m_bool(false) {}
-        Value(const char* s) : m_type(kString), m_number(0.0), m_bool(false), m_string(s) {}
-        Value(const std::string& s) : m_type(kString), m_number(0.0), m_bool(false), m_string(s) {}
-        Value(bool b) : m_type(kBool), m_number(0.0), m_bool(b) {}
-        Value(int n) : m_type(kNumber), m_number(n), m_bool(false) {}
-        Value(unsigned int n) : m_type(kNumber), m_number(n), m_bool(false) {}
-        Value(long unsigned int n) : m_type(kNumber), m_number(n), m_bool(false) {}
-        Value(long long unsigned int n) : m_type(kNumber), m_number(n), m_bool(false) {} // can lose precision
-        Value(std::initializer_list<KeyValuePair> l) : m_type(kObject), m_number(0.0), m_bool(false)
+        Value(double d) : m_type(kNumber), m_number(d) {}
+        Value(const char* s) : m_type(kString) { new (&m_string) std::string(s); }
+        Value(const std::string& s) : m_type(kString) { new (&m_string) std::string(s); }
+        Value(std::string&& s) : m_type(kString) { new (&m_string) std::string(std::move(s)); }
+        Value(bool b) : m_type(kBool), m_bool(b) {}
+        Value(int n) : m_type(kNumber), m_number(n) {}
+        Value(unsigned int n) : m_type(kNumber), m_number(n) {}
+        Value(long unsigned int n) : m_type(kNumber), m_number(n) {}
+        Value(long long unsigned int n) : m_type(kNumber), m_number(n) {} // can lose precision
+        Value(std::initializer_list<KeyValuePair> l) : m_type(kObject) { new (&m_object) Object(l); }
+        Value(const Date& d) : m_type(kDate) { new (&m_date) Date(d); }
+        Value(const std::vector<Value>& arr) : m_type(kStrictArray) { new (&m_strict_array) std::vector<Value>(arr); }
+        Value(std::vector<Value>&& arr) : m_type(kStrictArray) { new (&m_strict_array) std::vector<Value>(std::move(arr)); }
+        Value(const std::map<std::string,Value>& map) : m_type(kObject) { new (&m_object) Object(map); }
+        Value(const Object& obj) : m_type(kObject) { new (&m_object) Object(obj); }
+        Value(Object&& obj) : m_type(kObject) { new (&m_object) Object(std::move(obj)); }
+
+        Value(const Value& rhs) : m_type(kNull) { construct(rhs); }
+        Value(Value&& rhs) noexcept : m_type(kNull) { construct(std::move(rhs)); rhs.destroy(); }
+        ~Value() { destroy(); }
+
+        // rhs が自分の子であってもよいように、先に写してから捨てる。
+        Value& operator = (const Value& rhs)
+        {
+            if (this != &rhs)
+            {
+                Value tmp(rhs);
+                destroy();
+                construct(std::move(tmp));
+            }
+            return *this;
+        }
+        Value& operator = (Value&& rhs) noexcept
         {
-            for (auto pair: l)
-                m_object[pair.first] = pair.second;
+            if (this != &rhs)
+            {
+                Value tmp(std::move(rhs));
+                destroy();
+                construct(std::move(tmp));
+            }
+            return *this;
         }
-        Value(const Date& d) : m_type(kDate), m_number(0.0), m_bool(false), m_date(d) {}
-        Value(const std::vector<Value>& arr) : m_type(kStrictArray), m_number(0.0), m_bool(false), m_strict_array(arr) {}
-        Value(const std::map<std::string,Value>& map) : m_type(kObject), m_number(0.0), m_bool(false), m_object(map) {}
 
         static Value null(std::nullptr_t)
         { return Value(); }
 
         static Value number(double d)
-        { Value v; v.m_type = kNumber; v.m_number = d; return v; }
+        { return Value(d); }
 
         static Value string(const std::string& s)
-        { Value v; v.m_type = kString; v.m_string = s; return v; }
+        { return Value(s); }
+        static Value string(std::string&& s)
+        { return Value(std::move(s)); }
 
         static Value boolean(bool b)
-        { Value v; v.m_type = kBool; v.m_bool = b; return v; }
+        { return Value(b); }
 
         // object
         static Value object(std::initializer_list<KeyValuePair> l)
-        {
-            Value v;
-            v.m_type = kObject;
-            for (auto pair: l)
-                v.m_object[pair.first] = pair.second;
-            return v;
-        }
+        { return Value(Object(l)); }
         static Value object(const std::vector<KeyValuePair>& l)
-        {
-            Value v;
-            v.m_type = kObject;
-            for (auto pair: l)
-                v.m_object[pair.first] = pair.second;
-            return v;
-        }
+        { return Value(Object(l)); }
+        static Value object(std::vector<KeyValuePair>&& l)
+        { return Value(Object(std::move(l))); }
 
         // ECMA array
         static Value array(std::initializer_list<KeyValuePair> l)
-        {
-            Value v;
-            v.m_type = kArray;
-            for (auto pair: l)
-                v.m_object[pair.first] = pair.second;
-            return v;
-        }
+        { Value v = object(l); v.m_type = kArray; return v; }
         static Value array(const std::vector<KeyValuePair>& l)
-        {
-            Value v;
-            v.m_type = kArray;
-            for (auto pair: l)
-                v.m_object[pair.first] = pair.second;
-            return v;
-        }
+        { Value v = object(l); v.m_type = kArray; return v; }
+        static Value array(std::vector<KeyValuePair>&& l)
+        { Value v = object(std::move(l)); v.m_type = kArray; return v; }
 
         // strict array
         static Value strictArray(std::initializer_list<Value> l)
-        { Value v; v.m_type = kStrictArray; v.m_strict_array = l; return v; }
+        { return Value(std::vector<Value>(l)); }
         static Value strictArray(const std::vector<Value>& l)
-        { Value v; v.m_type = kStrictArray; v.m_strict_array = l; return v; }
+        { return Value(l); }
+        static Value strictArray(std::vector<Value>&& l)
+        { return Value(std::move(l)); }
 
         static Value date(const Date& d)
         { return Value(d); }
         static Value date(double unixTime, uint16_t timezone = 0)
-        { Value v; v.m_type = kDate; v.m_date = Date(unixTime, timezone); return v; }
+        { return Value(Date(unixTime, timezone)); }
 
         bool isNumber() const { return m_type == kNumber; }
         bool isObject() const { return m_type == kObject; }
@@ -199,43 +260,52 @@ namespace amf0
         std::string serialize() const
         {
             std::string b;
+            serialize(b);
+            return b;
+        }
+
+        // b の後ろに書き足す。
+        void serialize(std::string& b) const
+        {
             switch (m_type)
             {
             case kNumber:
             {
                 b += AMF_NUMBER;
-                char* p = (char*) &m_number;
+                const char* p = (const char*) &m_number;
                 for (int i = 7; i >= 0; i--)
                     b += p[i];
-                return b;
+                return;
             }
             case kObject:
             {
                 b += AMF_OBJECT;
-                for (auto pair : m_object)
+                for (const auto& pair : m_object)
                 {
-                    b += string(pair.first).serialize().substr(1);
-                    b += pair.second.serialize();
+                    serializeKey(b, pair.first);
+                    pair.second.serialize(b);
                 }
                 b += '\0';
                 b += '\0';
                 b += AMF_OBJECT_END;
-                return b;
+                return;
             }
             case kString:
             {
                 b += AMF_STRING;
-                if (m_string.size() >= 65536)
-                    throw std::runtime_error("string too long");
-                b += (0xff00 & m_string.size()) >> 8;
-                b += 0xff & m_string.size();
-                b += m_string;
-                return b;
+                serializeKey(b, m_string);
+                return;
             }
             case kNull:
             {
                 b += AMF_NULL;
-                return b;
+                return;
+            }
+            case kBool:
+            {
+                b += AMF_BOOL;
+                b += m_bool ? 1 : 0;
+                return;
             }
             case kDate:
             {
@@ -246,7 +316,7 @@ namespace amf0
                 p = reinterpret_cast<const char*>(&m_date.timezone);
                 for (int i = 1; i >= 0; i--)
                     b += p[i];
-                return b;
+                return;
             }
             default:
                 throw std::runtime_error("serialize: unknown type");
@@ -273,7 +343,7 @@ namespace amf0
             return m_bool;
         }
 
-        const std::map<std::string,Value>& object() const
+        const Object& object() const
         {
             if (!isObject() && !isArray()) throw std::runtime_error("not an object or an array");
             return m_object;
@@ -330,15 +400,192 @@ namespace amf0
         }
 
 
-        int                         m_type;
-        double                      m_number;
-        bool                        m_bool;
-        std::string                 m_string;
-        std::map<std::string,Value> m_object;
-        std::vector<Value>          m_strict_array;
-        Date                        m_date;
+        int                             m_type;
+        union
+        {
+            double                      m_number;
+            bool                        m_bool;
+            Date                        m_date;
+            std::string                 m_string;
+            Object                      m_object;
+            std::vector<Value>          m_strict_array;
+        };
+
+    private:
+        static void serializeKey(std::string& b, const std::string& s)
+        {
+            if (s.size() >= 65536)
+                throw std::runtime_error("string too long");
+            b += (0xff00 & s.size()) >> 8;
+            b += 0xff & s.size();
+            b += s;
+        }
+
+        // m_type が kNull の状態から rhs と同じものを作る。
+        template <typename V>
+        void construct(V&& rhs)
+        {
+            switch (rhs.m_type)
+            {
+            case kNumber:
+                m_number = rhs.m_number;
+                break;
+            case kBool:
+                m_bool = rhs.m_bool;
+                break;
+            case kDate:
+                new (&m_date) Date(rhs.m_date);
+                break;
+            case kString:
+                new (&m_string) std::string(std::forward<V>(rhs).m_string);
+                break;
+            case kObject:
+            case kArray:
+                new (&m_object) Object(std::forward<V>(rhs).m_object);
+                break;
+            case kStrictArray:
+                new (&m_strict_array) std::vector<Value>(std::forward<V>(rhs).m_strict_array);
+                break;
+            default:
+                break;
+            }
+            m_type = rhs.m_type;
+        }
+
+        void destroy()
+        {
+            switch (m_type)
+            {
+            case kString:
+                m_string.~basic_string();
+                break;
+            case kObject:
+            case kArray:
+                m_object.~Object();
+                break;
+            case kStrictArray:
+                m_strict_array.~vector();
+                break;
+            default:
+                break;
+            }
+            m_type = kNull;
+        }
     };
 
+    // ------------------------------------
+    inline Object::Object(std::initializer_list<KeyValuePair> l)
+        : m_pairs(l)
+    {
+        normalize();
+    }
+
+    inline Object::Object(std::vector<KeyValuePair>&& l)
+        : m_pairs(std::move(l))
+    {
+        normalize();
+    }
+
+    inline Object::Object(const std::vector<KeyValuePair>& l)
+        : m_pairs(l)
+    {
+        normalize();
+    }
+
+    inline Object::Object(const std::map<std::string,Value>& map)
+        : m_pairs(map.begin(), map.end())
+    {
+    }
+
+    inline Object::operator std::map<std::string,Value>() const
+    {
+        return std::map<std::string,Value>(m_pairs.begin(), m_pairs.end());
+    }
+
+    inline Object::const_iterator Object::lowerBound(const std::string& key) const
+    {
+        return std::lower_bound(m_pairs.begin(), m_pairs.end(), key,
+                                [](const KeyValuePair& p, const std::string& k) { return p.first < k; });
+    }
+
+    inline Object::const_iterator Object::find(const std::string& key) const
+    {
+        auto it = lowerBound(key);
+        return (it != m_pairs.end() && it->first == key) ? it : m_pairs.end();
+    }
+
+    inline Object::iterator Object::find(const std::string& key)
+    {
+        return m_pairs.begin() + (static_cast<const Object*>(this)->find(key) - m_pairs.cbegin());
+    }
+
+    inline size_t Object::count(const std::string& key) const
+    {
+        return find(key) != m_pairs.end() ? 1 : 0;
+    }
+
+    inline const Value& Object::at(const std::string& key) const
+    {
+        auto it = find(key);
+        if (it == m_pairs.end())
+            throw std::out_of_range("amf0::Object::at: " + key);
+        return it->second;
+    }
+
+    inline Value& Object::at(const std::string& key)
+    {
+        return const_cast<Value&>(static_cast<const Object*>(this)->at(key));
+    }
+
+    inline Value& Object::operator[](const std::string& key)
+    {
+        auto pos = m_pairs.begin() + (lowerBound(key) - m_pairs.cbegin());
+        if (pos != m_pairs.end() && pos->first == key)
+            return pos->second;
+        return m_pairs.insert(pos, KeyValuePair(key, Value()))->second;
+    }
+
+    inline size_t Object::erase(const std::string& key)
+    {
+        auto it = find(key);
+        if (it == m_pairs.end())
+            return 0;
+        m_pairs.erase(it);
+        return 1;
+    }
+
+    inline bool Object::operator == (const Object& rhs) const
+    {
+        return m_pairs == rhs.m_pairs;
+    }
+
+    inline bool Object::operator != (const Object& rhs) const
+    {
+        return !(*this == rhs);
+    }
+
+    // キーの順に並べ、重なったキーは後のものを残す。
+    inline void Object::normalize()
+    {
+        auto less = [](const KeyValuePair& a, const KeyValuePair& b) { return a.first < b.first; };
+        if (std::is_sorted(m_pairs.begin(), m_pairs.end(), less) &&
+            std::adjacent_find(m_pairs.begin(), m_pairs.end(),
+                               [](const KeyValuePair& a, const KeyValuePair& b) { return a.first == b.first; }) == m_pairs.end())
+            return;
+
+        std::stable_sort(m_pairs.begin(), m_pairs.end(), less);
+        std::vector<KeyValuePair> out;
+        out.reserve(m_pairs.size());
+        for (auto& pair : m_pairs)
+        {
+            if (!out.empty() && out.back().first == pair.first)
+                out.back().second = std::move(pair.second);
+            else
+                out.push_back(std::move(pair));
+        }
+        m_pairs.swap(out);
+    }
+
     class Deserializer
     {
     public:
@@ -0,0 +1,135 @@
+// ------------------------------------------------
+// File : arena.cpp
+// Desc:
+//      要求ごとのアリーナ。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <stdlib.h>
+
+#include "arena.h"
+
+static thread_local Arena* t_current = nullptr;
+
+// チャンクの頭は Chunk、その後ろを切り出す。
+static const size_t CHUNK_HEADER = (sizeof(std::atomic<int>) + Arena::ALIGN - 1) / Arena::ALIGN * Arena::ALIGN;
+
+// ------------------------------------
+Arena::Arena()
+    : m_chunk(nullptr)
+    , m_used(0)
+    , m_numChunks(0)
+    , m_numReused(0)
+{
+}
+
+// ------------------------------------
+Arena::~Arena()
+{
+    retire();
+}
+
+// ------------------------------------
+Arena* Arena::current()
+{
+    return t_current;
+}
+
+// ------------------------------------
+void* Arena::allocate(size_t bytes)
+{
+    const size_t size = sizeof(Header) + (bytes + ALIGN - 1) / ALIGN * ALIGN;
+
+    if (t_current != this || bytes > MAX_SMALL)
+    {
+        auto h = static_cast<Header*>(::operator new(sizeof(Header) + bytes));
+        h->chunk = nullptr;
+        return h + 1;
+    }
+
+    if (!m_chunk || m_used + size > CHUNK_SIZE)
+    {
+        retire();
+        m_chunk = static_cast<Chunk*>(::operator new(CHUNK_SIZE));
+        new (&m_chunk->refs) std::atomic<int>(1);
+        m_used = CHUNK_HEADER;
+        m_numChunks++;
+    }
+
+    auto h = reinterpret_cast<Header*>(reinterpret_cast<char*>(m_chunk) + m_used);
+    m_used += size;
+    m_chunk->refs++;
+    h->chunk = m_chunk;
+    return h + 1;
+}
+
+// ------------------------------------
+void Arena::release(void* p)
+{
+    if (!p)
+        return;
+
+    auto h = static_cast<Header*>(p) - 1;
+    if (h->chunk)
+        unref(h->chunk);
+    else
+        ::operator delete(h);
+}
+
+// ------------------------------------
+void Arena::unref(Chunk* c)
+{
+    if (--c->refs == 0)
+    {
+        c->refs.~atomic<int>();
+        ::operator delete(c);
+    }
+}
+
+// ------------------------------------
+void Arena::retire()
+{
+    if (m_chunk)
+        unref(m_chunk);
+    m_chunk = nullptr;
+    m_used = 0;
+}
+
+// ------------------------------------
+void Arena::reset()
+{
+    if (!m_chunk)
+        return;
+
+    // 他に持っている者がいなければ、増えることも無いので使い直せる。
+    if (m_chunk->refs == 1)
+    {
+        m_used = CHUNK_HEADER;
+        m_numReused++;
+    }else
+        retire();
+}
+
+// ------------------------------------
+Arena::Scope::Scope(Arena& arena)
+    : m_prev(t_current)
+{
+    arena.reset();
+    t_current = &arena;
+}
+
+// ------------------------------------
+Arena::Scope::~Scope()
+{
+    t_current = m_prev;
+}
@@ -0,0 +1,149 @@
+// ------------------------------------------------
+// File : arena.h
+// Desc:
+//      要求ごとのアリーナ。サーバントが一つ持ち、一回の要求を処理する
+//      間 Arena::Scope でそのスレッドに据える。ArenaAllocator を使うコ
+//      ンテナ (HTTPHeaders、cgi::Query など) は、据えられているアリー
+//      ナから切り出して確保する。
+//
+//      アリーナはチャンクを前から切り出すだけで、個々の解放では再利用
+//      しない。チャンクは切り出した数を参照カウントで数え、アリーナが
+//      手放してから全部返されたチャンクを解放する。次の要求の始めに今
+//      のチャンクが全部返されていれば、そのまま頭から使い直す。要求を
+//      越えて生き残ったコンテナや、別のスレッドから解放されるコンテナ
+//      があっても壊れない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+// ------------------------------------
+class Arena
+{
+public:
+    enum
+    {
+        CHUNK_SIZE  = 16 * 1024,
+        MAX_SMALL   = 2 * 1024,    // これより大きいものはヒープから
+        ALIGN       = 16,
+    };
+
+    Arena();
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // bytes バイトを確保する。このスレッドに据えられていない時や、大
+    // きすぎる時はヒープから取る。どちらも release で返す。
+    void*       allocate(size_t bytes);
+    static void release(void* p);
+
+    // 次の要求のために空ける。今のチャンクが全部返されていれば使い直
+    // し、そうでなければ手放す。
+    void        reset();
+
+    // このスレッドに据えられているアリーナ。無ければ nullptr。
+    static Arena* current();
+
+    // 統計
+    size_t      numChunks() const { return m_numChunks; }
+    size_t      numReused() const { return m_numReused; }
+
+    // 生存期間の間 arena をこのスレッドに据え、始めに reset する。
+    class Scope
+    {
+    public:
+        Scope(Arena& arena);
+        ~Scope();
+
+    private:
+        Arena* m_prev;
+    };
+
+private:
+    struct Chunk
+    {
+        std::atomic<int> refs;  // 切り出したものの数 + アリーナが持っている分
+    };
+
+    // 切り出したものの前に置く。ヒープから取ったものは chunk が nullptr。
+    struct alignas(ALIGN) Header
+    {
+        Chunk* chunk;
+    };
+
+    void        retire();
+    static void unref(Chunk* c);
+
+    Chunk*      m_chunk;
+    size_t      m_used;
+    size_t      m_numChunks;
+    size_t      m_numReused;
+};
+
+// ------------------------------------
+// Arena から確保する C++11 のアロケーター。作った時のスレッドに据え
+// られているアリーナを使う。コンテナのコピーはヒープに作る。
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::true_type  propagate_on_container_move_assignment;
+    typedef std::true_type  propagate_on_container_swap;
+
+    ArenaAllocator() : m_arena(Arena::current()) {}
+    explicit ArenaAllocator(Arena* arena) : m_arena(arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : m_arena(other.arena()) {}
+
+    T* allocate(size_t n)
+    {
+        if (m_arena)
+            return static_cast<T*>(m_arena->allocate(n * sizeof(T)));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        if (m_arena)
+            Arena::release(p);
+        else
+            ::operator delete(p);
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const
+    {
+        return ArenaAllocator(nullptr);
+    }
+
+    Arena* arena() const { return m_arena; }
+
+private:
+    Arena* m_arena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() == b.arena(); }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() != b.arena(); }
+
+#endif
@@ -0,0 +1,234 @@
+// ------------------------------------------------
+// File : assetcache.cpp
+// Desc:
+//      エントリーは読み込んだ時の mtime と大きさを覚えていて、stat の
+//      結果が変わっていれば読み直す。ETag は内容の MD5 から作るので、
+//      同じ内容であれば再起動しても変わらない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "assetcache.h"
+#include "gzipencoder.h"
+#include "sstream.h"
+#include "md5.h"
+#include "cgi.h"
+#include "str.h"
+
+// global
+AssetCache g_assetCache;
+
+// ------------------------------------
+size_t AssetCache::Entry::memoryUsage() const
+{
+    size_t n = 0;
+    for (auto v : { &identity, &gzip, &brotli })
+        if (v->body)
+            n += v->body->size();
+    return n;
+}
+
+// ------------------------------------
+AssetCache::AssetCache()
+    : m_totalSize(0)
+{
+}
+
+// ------------------------------------
+static std::shared_ptr<const std::string> readFile(const std::string& path)
+{
+    FileStream file;
+    StringStream mem;
+    file.openReadOnly(path.c_str());
+    file.writeTo(mem, file.length());
+    file.close();
+    return std::make_shared<const std::string>(mem.str());
+}
+
+// ------------------------------------
+// path が元のファイル以降に作られていれば読む。無ければ nullptr。
+static std::shared_ptr<const std::string> readPrecompressed(const std::string& path, time_t origMtime)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1 || st.st_mtime < origMtime)
+        return nullptr;
+    if (st.st_size > AssetCache::MAX_ENTRY_SIZE)
+        return nullptr;
+
+    try
+    {
+        return readFile(path);
+    }catch (StreamException&)
+    {
+        return nullptr;
+    }
+}
+
+// ------------------------------------
+std::shared_ptr<const AssetCache::Entry> AssetCache::load(const std::string& path, time_t mtime, long long size)
+{
+    auto entry = std::make_shared<Entry>();
+    entry->mtime = mtime;
+    entry->size = size;
+    entry->identity.body = readFile(path);
+
+    auto tag = md5::hexdigest(*entry->identity.body).substr(0, 16);
+    entry->identity.etag = "\"" + tag + "\"";
+
+    entry->gzip.body = readPrecompressed(path + ".gz", mtime);
+    if (entry->gzip.body)
+        entry->gzip.etag = "\"" + tag + "-gz\"";
+
+    entry->brotli.body = readPrecompressed(path + ".br", mtime);
+    if (entry->brotli.body)
+        entry->brotli.etag = "\"" + tag + "-br\"";
+
+    return entry;
+}
+
+// ------------------------------------
+std::shared_ptr<const AssetCache::Entry> AssetCache::get(const std::string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1)
+        throw StreamException("Unable to open file");
+
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        auto it = m_entries.find(path);
+        if (it != m_entries.end() &&
+            it->second->mtime == st.st_mtime &&
+            it->second->size == st.st_size)
+            return it->second;
+    }
+
+    // 読むのはロックの外で。同時に読んだ時は後の方が残る。
+    auto entry = load(path, st.st_mtime, st.st_size);
+    if (st.st_size > MAX_ENTRY_SIZE)
+        return entry;
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_entries.find(path);
+    if (it != m_entries.end())
+    {
+        m_totalSize -= it->second->memoryUsage();
+        m_entries.erase(it);
+    }
+    if (m_totalSize + entry->memoryUsage() > MAX_TOTAL_SIZE)
+    {
+        m_entries.clear();
+        m_totalSize = 0;
+    }
+    m_entries[path] = entry;
+    m_totalSize += entry->memoryUsage();
+    return entry;
+}
+
+// ------------------------------------
+void AssetCache::clear()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_entries.clear();
+    m_totalSize = 0;
+}
+
+// ------------------------------------
+size_t AssetCache::numEntries()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_entries.size();
+}
+
+// ------------------------------------
+size_t AssetCache::totalSize()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_totalSize;
+}
+
+// ------------------------------------
+// Accept-Encoding に brotli か gzip があり、その変種があれば選ぶ。q=0
+// は断りとみなす。
+std::string AssetCache::chooseEncoding(const std::string& acceptEncoding, const Entry& entry)
+{
+    const bool br = GzipEncoder::accepts(acceptEncoding, "br");
+    const bool gzip = GzipEncoder::accepts(acceptEncoding, "gzip");
+
+    if (br && entry.brotli.body)
+        return "br";
+    if (gzip && entry.gzip.body)
+        return "gzip";
+    return "";
+}
+
+// ------------------------------------
+// If-None-Match の値のどれかが etag と同じなら true。弱い比較で W/ は
+// 無視する。
+bool AssetCache::etagMatches(const std::string& ifNoneMatch, const std::string& etag)
+{
+    for (auto& item : str::split(ifNoneMatch, ","))
+    {
+        auto tag = str::strip(item);
+        if (tag == "*")
+            return true;
+        if (str::has_prefix(tag, "W/"))
+            tag = tag.substr(2);
+        if (tag == etag)
+            return true;
+    }
+    return false;
+}
+
+// ------------------------------------
+HTTPResponse AssetCache::respond(const HTTPRequest& req, const std::string& path, const std::string& mimeType)
+{
+    std::shared_ptr<const Entry> entry;
+    try
+    {
+        entry = get(path);
+    }catch (StreamException&)
+    {
+        return HTTPResponse::notFound();
+    }
+
+    auto encoding = chooseEncoding(req.headers.get("Accept-Encoding"), *entry);
+    const Variant& v = (encoding == "br") ? entry->brotli
+        : (encoding == "gzip") ? entry->gzip
+        : entry->identity;
+
+    HTTPHeaders headers;
+    headers.set("ETag", v.etag);
+    headers.set("Last-Modified", cgi::rfc1123Time(entry->mtime));
+    if (entry->gzip.body || entry->brotli.body)
+        headers.set("Vary", "Accept-Encoding");
+
+    auto ifNoneMatch = req.headers.get("If-None-Match");
+    if (!ifNoneMatch.empty())
+    {
+        if (etagMatches(ifNoneMatch, v.etag))
+            return HTTPResponse::notModified(headers);
+    }else if (!req.headers.get("If-Modified-Since").empty())
+    {
+        time_t since = cgi::parseHttpDate(req.headers.get("If-Modified-Since"));
+        if (since != -1 && entry->mtime <= since)
+            return HTTPResponse::notModified(headers);
+    }
+
+    headers.set("Content-Type", mimeType);
+    headers.set("Content-Length", std::to_string(v.body->size()));
+    if (!encoding.empty())
+        headers.set("Content-Encoding", encoding);
+    return HTTPResponse::ok(headers, *v.body);
+}
@@ -0,0 +1,95 @@
+// ------------------------------------------------
+// File : assetcache.h
+// Desc:
+//      静的なファイルの内容をメモリーに持っておき、ETag 付きで返す。
+//      隣に同じか新しい path.gz, path.br があれば、それを
+//      Content-Encoding 付きで返す。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _ASSETCACHE_H
+#define _ASSETCACHE_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <time.h>
+
+#include "http.h"
+
+class AssetCache;
+
+// global
+extern AssetCache g_assetCache;
+
+// ------------------------------------
+class AssetCache
+{
+public:
+    enum
+    {
+        // これより大きいファイルは毎回読む。
+        MAX_ENTRY_SIZE = 4 * 1024 * 1024,
+        // 合計がこれを超えたら全部捨てて作り直す。
+        MAX_TOTAL_SIZE = 32 * 1024 * 1024,
+    };
+
+    // 一つの表現 (無圧縮、gzip、brotli のどれか)。
+    struct Variant
+    {
+        std::shared_ptr<const std::string> body;
+        std::string etag;
+    };
+
+    struct Entry
+    {
+        time_t      mtime;
+        long long   size;
+
+        Variant     identity;
+        Variant     gzip;       // body が nullptr なら無い
+        Variant     brotli;
+
+        size_t      memoryUsage() const;
+    };
+
+    AssetCache();
+
+    // path のファイルを返す。ファイルが変わっていれば読み直す。開けな
+    // ければ StreamException。
+    std::shared_ptr<const Entry> get(const std::string& path);
+
+    // req に対して path の内容を mimeType で返す応答を作る。
+    // If-None-Match が合えば 304、合わなければ If-Modified-Since を見
+    // る。Accept-Encoding に合う変種があればそれを返す。
+    HTTPResponse respond(const HTTPRequest& req, const std::string& path, const std::string& mimeType);
+
+    void    clear();
+
+    size_t  numEntries();
+    size_t  totalSize();
+
+    // "br", "gzip", "" のどれか。
+    static std::string chooseEncoding(const std::string& acceptEncoding, const Entry& entry);
+    static bool etagMatches(const std::string& ifNoneMatch, const std::string& etag);
+
+private:
+    std::shared_ptr<const Entry> load(const std::string& path, time_t mtime, long long size);
+
+    std::mutex  m_lock;
+    std::map<std::string, std::shared_ptr<const Entry>> m_entries;
+    size_t      m_totalSize;
+};
+
+#endif
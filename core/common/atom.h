@@ -109,9 +109,16 @@ public:
 
     ID4 read(int &numc, int &dlen)
     {
-        ID4 id = io.readID4();
-
-        unsigned int v = io.readInt();
+        // ソケットから読む時に read が一回で済むように、ヘッダーはま
+        // とめて読む。
+        char hdr[8];
+        io.read(hdr, 8);
+
+        ID4 id;
+        memcpy(id.getData(), hdr, 4);
+        unsigned int v;
+        memcpy(&v, hdr + 4, 4);
+        CHECK_ENDIAN4(v);
         if (v & 0x80000000)
         {
             numc = v&0x7fffffff;
@@ -226,6 +233,51 @@ public:
         return total;
     }
 
+    // ヘッダーを読み終えたアトムを、子アトムも含めてヘッダーごと buf
+    // にそのままコピーし、書き込んだバイト数を返す。子アトムのヘッダー
+    // は一回の read で buf に直接読み込むので、writeAtoms のように途中
+    // のバッファーを通らない。max を超える場合は StreamException。
+    int     copyAtom(ID4 id, int numc, int dlen, char *buf, int max)
+    {
+        if (max < 8)
+            throw StreamException("copyAtom: Atom too large");
+
+        unsigned int v = numc ? (numc | 0x80000000) : dlen;
+        CHECK_ENDIAN4(v);
+        memcpy(buf, id.getData(), 4);
+        memcpy(buf + 4, &v, 4);
+        int pos = 8;
+
+        if (numc)
+        {
+            for (int i = 0; i < numc; i++)
+            {
+                if (max - pos < 8)
+                    throw StreamException("copyAtom: Atom too large");
+                io.read(buf + pos, 8);
+
+                ID4 cid;
+                memcpy(cid.getData(), buf + pos, 4);
+                unsigned int cv;
+                memcpy(&cv, buf + pos + 4, 4);
+                CHECK_ENDIAN4(cv);
+                if (cv & 0x80000000)
+                    pos += copyAtom(cid, cv & 0x7fffffff, 0, buf + pos, max - pos);
+                else
+                    pos += copyAtom(cid, 0, cv, buf + pos, max - pos);
+            }
+        }else
+        {
+            if (dlen < 0 || dlen > max - pos)
+                throw StreamException("copyAtom: Atom too large");
+            if (dlen)
+                io.read(buf + pos, dlen);
+            pos += dlen;
+        }
+
+        return pos;
+    }
+
     bool    eof() { return io.eof(); }
 
     int     numChildren, numData;
@@ -0,0 +1,267 @@
+// ------------------------------------------------
+// File : bandwidth.cpp
+// Desc:
+//      送信帯域の割り振り。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#include "bandwidth.h"
+#include "servmgr.h"
+#include "sys.h"
+
+BandwidthScheduler g_bandwidth;
+
+// ------------------------------------
+// total を n 人で分けた取り分。他の人が others しか使っていなければ、
+// 残りを全部使ってよい。
+static double fairShare(double total, size_t n, double others)
+{
+    if (n == 0)
+        return 0;
+    return std::max(total / n, total - others);
+}
+
+// ------------------------------------
+BandwidthScheduler::BandwidthScheduler()
+    : m_lastUpdate(0)
+{
+    capacity = []() { return servMgr->effectiveMaxBitrateOut(); };
+
+    share[C_RELAY] = 70;
+    share[C_DIRECT] = 30;
+    share[C_LOCAL] = 0;
+
+    for (int i = 0; i < NUM_CLASSES; i++)
+        m_measured[i] = m_allowed[i] = 0;
+}
+
+// ------------------------------------
+const char* BandwidthScheduler::getClassName(CLASS c)
+{
+    switch (c)
+    {
+    case C_RELAY:  return "relay";
+    case C_DIRECT: return "direct";
+    case C_LOCAL:  return "local";
+    default:       return "unknown";
+    }
+}
+
+// ------------------------------------
+std::shared_ptr<BandwidthScheduler::Bucket> BandwidthScheduler::open(CLASS c, const GnuID& chanID)
+{
+    auto b = std::make_shared<Bucket>(c, chanID);
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    b->lastRefill = sys->getDTime();
+    m_buckets.push_back(b);
+    // 次に計り直すまでは、クラスの残りを使わせる。
+    if (c != C_LOCAL && m_allowed[c] > 0)
+        b->rate = b->tokens = m_allowed[c];
+    return b;
+}
+
+// ------------------------------------
+unsigned int BandwidthScheduler::consume(Bucket& b, size_t bytes)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    double now = sys->getDTime();
+    update(now);
+    refill(b, now);
+
+    b.sent += bytes;
+    if (b.rate <= 0)
+        return 0;
+
+    b.tokens -= bytes;
+    if (b.tokens >= 0)
+        return 0;
+
+    double ms = std::ceil(-b.tokens / b.rate * 1000);
+    return (unsigned int) std::min<double>(ms, MAX_WAIT);
+}
+
+// ------------------------------------
+bool BandwidthScheduler::ready(Bucket& b)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    double now = sys->getDTime();
+    update(now);
+    refill(b, now);
+    return b.rate <= 0 || b.tokens > 0;
+}
+
+// ------------------------------------
+bool BandwidthScheduler::canAdmit(CLASS c, unsigned int kbps)
+{
+    double cap = capacity() * 1000.0 / 8;
+    if (cap <= 0 || c == C_LOCAL)
+        return true;
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    update(sys->getDTime());
+    return m_measured[c] + kbps * 1000.0 / 8 <= classAllowance(c, cap);
+}
+
+// ------------------------------------
+// m_lock を取って呼ぶ。
+void BandwidthScheduler::refill(Bucket& b, double now)
+{
+    if (b.rate > 0)
+    {
+        double burst = b.rate * BURST / 1000;
+        b.tokens = std::min(b.tokens + (now - b.lastRefill) * b.rate, burst);
+    }
+    b.lastRefill = now;
+}
+
+// ------------------------------------
+// 保証された分か、他のクラスが使っていない分の多い方。m_lock を取って
+// 呼ぶ。
+double BandwidthScheduler::classAllowance(CLASS c, double cap)
+{
+    unsigned int total = 0;
+    for (int i = 0; i < NUM_CLASSES; i++)
+        if (i != C_LOCAL)
+            total += share[i];
+
+    double others = 0;
+    for (int i = 0; i < NUM_CLASSES; i++)
+        if (i != c && i != C_LOCAL)
+            others += m_measured[i];
+
+    double guaranteed = total ? cap * share[c] / total : 0;
+    return std::max(guaranteed, cap - others);
+}
+
+// ------------------------------------
+// 送った量を計り、バケツの割り当てを決め直す。m_lock を取って呼ぶ。
+void BandwidthScheduler::update(double now)
+{
+    double dt = now - m_lastUpdate;
+    if (dt < UPDATE_INTERVAL / 1000.0)
+        return;
+    m_lastUpdate = now;
+
+    std::vector<std::shared_ptr<Bucket>> live;
+    for (auto it = m_buckets.begin(); it != m_buckets.end(); )
+    {
+        auto b = it->lock();
+        if (b)
+        {
+            live.push_back(b);
+            ++it;
+        }else
+            it = m_buckets.erase(it);
+    }
+
+    for (int i = 0; i < NUM_CLASSES; i++)
+        m_measured[i] = 0;
+    for (auto& b : live)
+    {
+        // 暫く動いていなかったなら、その間の平均は当てにしない。
+        double r = b->sent / dt;
+        b->measured = (dt > 5) ? r : (b->measured + r) / 2;
+        b->sent = 0;
+        m_measured[b->cls] += b->measured;
+    }
+
+    double cap = capacity() * 1000.0 / 8;
+    if (cap <= 0)
+    {
+        for (auto& b : live)
+            b->rate = 0;
+        for (int i = 0; i < NUM_CLASSES; i++)
+            m_allowed[i] = 0;
+        return;
+    }
+
+    for (int c = 0; c < NUM_CLASSES; c++)
+    {
+        std::vector<std::shared_ptr<Bucket>> members;
+        for (auto& b : live)
+            if (b->cls == c)
+                members.push_back(b);
+
+        if (c == C_LOCAL)
+        {
+            for (auto& b : members)
+                b->rate = 0;
+            continue;
+        }
+
+        double allowed = classAllowance((CLASS) c, cap);
+        m_allowed[c] = allowed;
+        if (members.empty())
+            continue;
+
+        // チャンネルごとに分け、その中で接続ごとに分ける。
+        std::map<std::string, std::vector<std::shared_ptr<Bucket>>> byChannel;
+        std::map<std::string, double> channelMeasured;
+        for (auto& b : members)
+        {
+            byChannel[b->chanID.str()].push_back(b);
+            channelMeasured[b->chanID.str()] += b->measured;
+        }
+
+        for (auto& pair : byChannel)
+        {
+            double chOthers = m_measured[c] - channelMeasured[pair.first];
+            double chAllowed = fairShare(allowed, byChannel.size(), chOthers);
+
+            for (auto& b : pair.second)
+            {
+                double others = channelMeasured[pair.first] - b->measured;
+                b->rate = std::max(1.0, fairShare(chAllowed, pair.second.size(), others));
+            }
+        }
+    }
+}
+
+// ------------------------------------
+amf0::Value BandwidthScheduler::getState()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    std::vector<amf0::Value> classes;
+    for (int c = 0; c < NUM_CLASSES; c++)
+    {
+        int n = 0;
+        for (auto& w : m_buckets)
+        {
+            auto b = w.lock();
+            if (b && b->cls == c)
+                n++;
+        }
+        classes.push_back(amf0::Value::object(
+            {
+                {"name", getClassName((CLASS) c)},
+                {"share", share[c]},
+                {"numStreams", n},
+                {"measuredKbps", (int) (m_measured[c] * 8 / 1000)},
+                {"allowedKbps", (int) (m_allowed[c] * 8 / 1000)},
+            }));
+    }
+
+    return amf0::Value::object(
+        {
+            {"capacityKbps", capacity()},
+            {"classes", amf0::Value::strictArray(classes)},
+        });
+}
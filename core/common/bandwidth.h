@@ -0,0 +1,116 @@
+// ------------------------------------------------
+// File : bandwidth.h
+// Desc:
+//      送信帯域の割り振り。ストリームを送るサーバントごとにトークンバ
+//      ケツを持たせ、maxBitrateOut をリレー、直接視聴に分ける。LAN 内
+//      への送信は上りの帯域を使わないので制限しない。
+//
+//      各クラスには share の割合を保証し、他のクラスが使っていない分は
+//      借りてよい。クラスの中ではチャンネルごとに、チャンネルの中では
+//      接続ごとに同じ考えで分ける。割り当ては UPDATE_INTERVAL ごとに、
+//      実際に送った量から計り直す。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _BANDWIDTH_H
+#define _BANDWIDTH_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "amf0.h"
+#include "gnuid.h"
+
+// ------------------------------------
+class BandwidthScheduler
+{
+public:
+    enum CLASS
+    {
+        C_RELAY,
+        C_DIRECT,
+        C_LOCAL,
+        NUM_CLASSES
+    };
+
+    enum
+    {
+        UPDATE_INTERVAL = 500,  // 割り当てを計り直すミリ秒数
+        BURST           = 500,  // バケツに貯められる、割り当てのミリ秒分
+        MAX_WAIT        = 1000, // 一度に待たせる最長のミリ秒数
+    };
+
+    class Bucket
+    {
+    public:
+        Bucket(CLASS c, const GnuID& id)
+            : cls(c)
+            , chanID(id)
+            , rate(0)
+            , tokens(0)
+            , lastRefill(0)
+            , sent(0)
+            , measured(0)
+        {}
+
+        const CLASS cls;
+        const GnuID chanID;
+
+        // 以下は BandwidthScheduler::m_lock で保護する。
+        double  rate;       // 一秒あたりのバイト数。0 なら制限しない
+        double  tokens;     // 負なら借りている
+        double  lastRefill;
+        double  sent;       // 前に計ってから送ったバイト数
+        double  measured;   // 一秒あたりの送信量の移動平均
+    };
+
+    BandwidthScheduler();
+
+    std::shared_ptr<Bucket> open(CLASS c, const GnuID& chanID);
+
+    // bytes を送ったことにし、次に送るまで待つミリ秒数を返す。
+    unsigned int consume(Bucket& b, size_t bytes);
+
+    // 今送ってよいか。
+    bool    ready(Bucket& b);
+
+    // c にビットレート kbps のストリームを一本増やす余裕があるか。
+    bool    canAdmit(CLASS c, unsigned int kbps);
+
+    amf0::Value getState();
+
+    static const char* getClassName(CLASS c);
+
+    // 上りの帯域 (kbps)。0 なら制限しない。テストで差し替える。
+    std::function<unsigned int()> capacity;
+
+    // クラスごとに保証する割合 (%)。C_LOCAL は使わない。
+    unsigned int share[NUM_CLASSES];
+
+private:
+    void    update(double now);
+    void    refill(Bucket& b, double now);
+    double  classAllowance(CLASS c, double cap);
+
+    std::mutex  m_lock;
+    std::vector<std::weak_ptr<Bucket>> m_buckets;
+    double      m_lastUpdate;
+    double      m_measured[NUM_CLASSES];
+    double      m_allowed[NUM_CLASSES];
+};
+
+extern BandwidthScheduler g_bandwidth;
+
+#endif
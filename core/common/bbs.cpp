@@ -7,7 +7,7 @@ namespace bbs {
 
     shared_ptr<Board> Board::tryCreate(const std::string& url)
     {
-        Regexp NICHAN_THREAD_URL_PATTERN("^https?://[a-zA-z\\-\\.]+(?::\\d+)?/test/read\\.cgi\\/(\\w+)/(\\d+)/?$");
+        static const Regexp NICHAN_THREAD_URL_PATTERN("^https?://[a-zA-z\\-\\.]+(?::\\d+)?/test/read\\.cgi\\/(\\w+)/(\\d+)/?$");
         auto caps = NICHAN_THREAD_URL_PATTERN.exec(url);
         if (caps.size() == 0)
             return nullptr;
@@ -16,7 +16,7 @@ namespace bbs {
 
     Board::Board(const std::string& url, const std::string& boardName)
     {
-        Regexp NICHAN_THREAD_URL_PATTERN("^(https?)://([a-zA-z\\-\\.]+(?::\\d+)?)/test/read\\.cgi\\/(\\w+)/(\\d+)/?$");
+        static const Regexp NICHAN_THREAD_URL_PATTERN("^(https?)://([a-zA-z\\-\\.]+(?::\\d+)?)/test/read\\.cgi\\/(\\w+)/(\\d+)/?$");
 
         auto caps = NICHAN_THREAD_URL_PATTERN.exec(url);
         if (caps.size() != 5)
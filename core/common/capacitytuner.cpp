@@ -0,0 +1,184 @@
+// ------------------------------------------------
+// File : capacitytuner.cpp
+// Desc:
+//      上りの帯域の見積もりを AIMD で動かす。上限近くまで使っていて詰
+//      まっていなければ天井の INCREASE_PERCENT ずつ足し、詰まったら
+//      DECREASE_PERCENT を掛ける。リレーと直接視聴の数は見積もりをチャ
+//      ンネルのビットレートで割って決める。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "capacitytuner.h"
+#include "chanmgr.h"
+#include "channel.h"
+#include "servmgr.h"
+#include "servent.h"
+#include "uptest.h"
+
+CapacityTuner g_capacityTuner;
+
+// ------------------------------------
+CapacityTuner::CapacityTuner()
+    : m_capacity(0)
+    , m_lastSkipTotal(0)
+    , m_numDecreases(0)
+    , m_active(false)
+    , m_maxBitrateOut(0)
+    , m_maxRelays(0)
+    , m_maxDirect(0)
+{
+}
+
+// ------------------------------------
+void CapacityTuner::reset()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_active = false;
+    m_capacity = 0;
+    m_numDecreases = 0;
+    m_lastSample = Sample();
+}
+
+// ------------------------------------
+CapacityTuner::Limits CapacityTuner::step(const Sample& s)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_lastSample = s;
+
+    Limits limits;
+    limits.maxBitrateOut = s.configuredKbps;
+    limits.maxRelays = s.configuredRelays;
+    limits.maxDirect = s.configuredDirect;
+
+    const double ceiling = s.measuredKbps
+        ? s.measuredKbps * UPTEST_PERCENT / 100.0
+        : s.configuredKbps;
+    if (ceiling <= 0)
+    {
+        m_capacity = 0;
+        return limits;
+    }
+
+    // 初めは設定値から。設定が無ければ天井から。
+    if (m_capacity <= 0)
+        m_capacity = s.configuredKbps ? std::min<double>(s.configuredKbps, ceiling) : ceiling;
+
+    if (s.skips > 0 || s.lagMsec > LAG_LIMIT_MSEC)
+    {
+        m_capacity = m_capacity * DECREASE_PERCENT / 100.0;
+        m_numDecreases++;
+    } else if (s.outKbps >= m_capacity * BUSY_PERCENT / 100.0)
+        m_capacity += ceiling * INCREASE_PERCENT / 100.0;
+
+    m_capacity = std::min(std::max<double>(m_capacity, MIN_KBPS), ceiling);
+
+    const unsigned int cap = (unsigned int) m_capacity;
+    const unsigned int streamKbps = s.streamKbps ? s.streamKbps : DEFAULT_STREAM_KBPS;
+
+    limits.maxBitrateOut = cap;
+    limits.maxRelays = std::max<unsigned int>(ServMgr::MIN_RELAYS, cap * RELAY_PERCENT / 100 / streamKbps);
+    // 直接視聴を断る設定はそのままにする。
+    if (s.configuredDirect)
+        limits.maxDirect = std::max<unsigned int>(1, cap * (100 - RELAY_PERCENT) / 100 / streamKbps);
+    return limits;
+}
+
+// ------------------------------------
+void CapacityTuner::update()
+{
+    if (!servMgr->flags[ServMgr::F_autoTuneLimits])
+    {
+        if (m_active)
+            reset();
+        return;
+    }
+
+    Sample s;
+    s.configuredKbps    = servMgr->maxBitrateOut;
+    s.configuredRelays  = servMgr->maxRelays;
+    s.configuredDirect  = servMgr->maxDirect;
+    s.measuredKbps      = servMgr->uptestServiceRegistry->measuredUploadKbps();
+    s.outKbps           = BYTES_TO_KBPS(servMgr->totalOutput(false));
+
+    std::vector<std::shared_ptr<Channel>> chs;
+    {
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+        for (auto ch = chanMgr->channel; ch; ch = ch->next)
+            if (ch->isActive() && ch->getBitrate() > 0)
+                chs.push_back(ch);
+    }
+    if (!chs.empty())
+    {
+        unsigned int total = 0;
+        for (auto& ch : chs)
+            total += ch->getBitrate();
+        s.streamKbps = total / chs.size();
+    }
+
+    // 下流への送信の取りこぼしと遅れ。LAN 内の接続は上りを使わないの
+    // で見ない。
+    unsigned int skipTotal = 0;
+    {
+        std::lock_guard<std::mutex> st(servMgr->serventStatsLock);
+        for (auto sv : servMgr->connectedServents)
+        {
+            if (sv->countedPrivate ||
+                (sv->countedType != Servent::T_RELAY && sv->countedType != Servent::T_DIRECT))
+                continue;
+
+            skipTotal += sv->pacer.numSkips + sv->pacer.numCatchUps;
+            const unsigned int drain = sv->pacer.drainRate;
+            if (drain)
+                s.lagMsec = std::max(s.lagMsec, (unsigned int) ((uint64_t) sv->pacer.lagBytes * 1000 / drain));
+        }
+    }
+    {
+        // 接続が切れると合計は減るので、その時は数えない。
+        std::lock_guard<std::mutex> cs(m_lock);
+        s.skips = (skipTotal > m_lastSkipTotal) ? skipTotal - m_lastSkipTotal : 0;
+        m_lastSkipTotal = skipTotal;
+    }
+
+    auto limits = step(s);
+    if (limits.maxBitrateOut != m_maxBitrateOut || limits.maxRelays != m_maxRelays || limits.maxDirect != m_maxDirect)
+        LOG_DEBUG("Auto-tuned limits: %u kbps, %u relays, %u direct", limits.maxBitrateOut, limits.maxRelays, limits.maxDirect);
+
+    m_maxBitrateOut = limits.maxBitrateOut;
+    m_maxRelays = limits.maxRelays;
+    m_maxDirect = limits.maxDirect;
+    m_active = true;
+}
+
+// ------------------------------------
+amf0::Value CapacityTuner::getState()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return amf0::Value::object(
+        {
+            {"active", (bool) m_active},
+            {"capacityKbps", (int) m_capacity},
+            {"maxBitrateOut", (int) m_maxBitrateOut},
+            {"maxRelays", (int) m_maxRelays},
+            {"maxDirect", (int) m_maxDirect},
+            {"measuredKbps", (int) m_lastSample.measuredKbps},
+            {"outKbps", (int) m_lastSample.outKbps},
+            {"streamKbps", (int) m_lastSample.streamKbps},
+            {"skips", (int) m_lastSample.skips},
+            {"lagMsec", (int) m_lastSample.lagMsec},
+            {"numDecreases", (int) m_numDecreases},
+        });
+}
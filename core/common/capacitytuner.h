@@ -0,0 +1,100 @@
+// ------------------------------------------------
+// File : capacitytuner.h
+// Desc:
+//      上りの帯域とリレー・直接視聴の数の上限を、計った値から決め直す
+//      (autoTuneLimits フラグ)。スピードテストの結果を天井にして、下流
+//      が詰まっていなければ少しずつ上げ、取りこぼしや遅れが出たら大き
+//      く下げる。設定値 (maxBitrateOut など) は書き換えず、ServMgr の
+//      effectiveMax* がこちらの値を使う。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _CAPACITYTUNER_H
+#define _CAPACITYTUNER_H
+
+#include <atomic>
+#include <mutex>
+
+#include "amf0.h"
+
+// ------------------------------------
+class CapacityTuner
+{
+public:
+    enum
+    {
+        UPTEST_PERCENT      = 80,   // スピードテストの結果のうち使う割合
+        DECREASE_PERCENT    = 75,   // 詰まった時に残す割合
+        INCREASE_PERCENT    = 5,    // 余裕がある時に一度に増やす量 (天井に対する割合)
+        BUSY_PERCENT        = 80,   // 送信量が上限のこれを超えていれば増やす
+        LAG_LIMIT_MSEC      = 3000, // 下流の遅れがこれを超えたら詰まっている
+        MIN_KBPS            = 128,
+        DEFAULT_STREAM_KBPS = 500,  // チャンネルのビットレートが分からない時
+        RELAY_PERCENT       = 70,   // 帯域のうちリレーに充てる割合
+    };
+
+    // 一回分の観測。
+    struct Sample
+    {
+        unsigned int configuredKbps = 0;    // maxBitrateOut。0 なら制限なし
+        unsigned int configuredRelays = 0;
+        unsigned int configuredDirect = 0;
+        unsigned int measuredKbps = 0;      // スピードテストの結果。0 なら無し
+        unsigned int outKbps = 0;           // 今の送信量 (LAN 内を除く)
+        unsigned int streamKbps = 0;        // 送っているチャンネルの平均ビットレート
+        unsigned int skips = 0;             // 前回からの取りこぼしと追いつかせの数
+        unsigned int lagMsec = 0;           // 下流の遅れの最大
+    };
+
+    struct Limits
+    {
+        unsigned int maxBitrateOut = 0;
+        unsigned int maxRelays = 0;
+        unsigned int maxDirect = 0;
+    };
+
+    CapacityTuner();
+
+    // s から上限を決め直す。天井が分からない時 (設定が制限なしで、ス
+    // ピードテストの結果も無い) は設定値をそのまま返す。
+    Limits  step(const Sample& s);
+
+    // servMgr、chanMgr、スピードテストの結果から観測を集めて step し、
+    // 結果を公開する。フラグが切られていれば公開をやめる。
+    void    update();
+    void    reset();
+
+    // 公開している上限。active() が false なら使わない。
+    bool            active() { return m_active; }
+    unsigned int    maxBitrateOut() { return m_maxBitrateOut; }
+    unsigned int    maxRelays() { return m_maxRelays; }
+    unsigned int    maxDirect() { return m_maxDirect; }
+
+    amf0::Value getState();
+
+private:
+    std::mutex      m_lock;     // step と update
+    double          m_capacity; // 今の見積もり (kbps)。0 なら未定
+    unsigned int    m_lastSkipTotal;
+    Sample          m_lastSample;
+    unsigned int    m_numDecreases;
+
+    std::atomic<bool>         m_active;
+    std::atomic<unsigned int> m_maxBitrateOut;
+    std::atomic<unsigned int> m_maxRelays;
+    std::atomic<unsigned int> m_maxDirect;
+};
+
+extern CapacityTuner g_capacityTuner;
+
+#endif
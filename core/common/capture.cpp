@@ -0,0 +1,305 @@
+// ------------------------------------------------
+// File : capture.cpp
+// Desc:
+//      取り込みの記録は配信を止めないことを優先する。ファイルに書けな
+//      くなったら記録だけをやめる。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <string.h>
+#include <algorithm>
+
+#include "capture.h"
+#include "channel.h"
+#include "json.hpp"
+#include "peercast.h"
+#include "str.h"
+
+using json = nlohmann::json;
+
+static const char MAGIC_LINE[] = "PCCAPTURE 1";
+
+// ------------------------------------
+std::string SourceCapture::serializeHeader(const Header& header)
+{
+    json j = {
+        { "contentType", header.contentType },
+        { "protocol", header.protocol },
+        { "icyMetaInterval", header.icyMetaInterval },
+        { "name", header.name },
+        { "startTime", header.startTime },
+    };
+    return j.dump();
+}
+
+// ------------------------------------
+bool SourceCapture::parseHeader(const std::string& line, Header& header)
+{
+    header = Header();
+    try
+    {
+        auto j = json::parse(line);
+        header.contentType     = j.at("contentType").get<std::string>();
+        header.protocol        = j.at("protocol").get<std::string>();
+        header.icyMetaInterval = j.at("icyMetaInterval").get<int>();
+        header.name            = j.at("name").get<std::string>();
+        header.startTime       = j.at("startTime").get<unsigned int>();
+    }catch (std::exception&)
+    {
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------
+SourceCapture::Header SourceCapture::headerFor(std::shared_ptr<Channel> ch)
+{
+    Header h;
+    h.contentType     = ch->info.getTypeStr();
+    h.protocol        = ChanInfo::getProtocolStr(ch->info.srcProtocol);
+    h.icyMetaInterval = ch->icyMetaInterval;
+    h.name            = ch->info.name.c_str();
+    h.startTime       = sys->getTime();
+    return h;
+}
+
+// ------------------------------------
+std::shared_ptr<CaptureWriter> SourceCapture::openFor(std::shared_ptr<Channel> ch)
+{
+    auto header = headerFor(ch);
+    auto path = sys->joinPath({ peercastApp->getStateDirPath(),
+                                str::format("capture-%s-%u.cap", ch->info.id.str().c_str(), header.startTime) });
+
+    std::unique_ptr<FileStream> file(new FileStream());
+    try
+    {
+        file->openWriteReplace(path);
+    }catch (StreamException& e)
+    {
+        LOG_ERROR("Cannot capture to %s: %s", path.c_str(), e.what());
+        return nullptr;
+    }
+    LOG_INFO("Capturing source to %s", path.c_str());
+    return std::make_shared<CaptureWriter>(std::move(file), header);
+}
+
+// ------------------------------------
+CaptureWriter::CaptureWriter(std::unique_ptr<Stream> out, const SourceCapture::Header& header)
+    : m_out(std::move(out))
+    , m_failed(false)
+    , m_bytesWritten(0)
+{
+    try
+    {
+        m_out->writeString(std::string(MAGIC_LINE) + "\n" + SourceCapture::serializeHeader(header) + "\n");
+    }catch (StreamException& e)
+    {
+        LOG_ERROR("Capture stopped: %s", e.what());
+        m_failed = true;
+    }
+}
+
+// ------------------------------------
+void CaptureWriter::write(const void* p, int len, unsigned int msec)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    if (m_failed || len <= 0)
+        return;
+    if (m_bytesWritten + len > SourceCapture::MAX_BYTES)
+    {
+        LOG_WARN("Capture stopped: size limit reached");
+        m_failed = true;
+        return;
+    }
+
+    try
+    {
+        m_out->writeInt(msec);
+        m_out->writeInt(len);
+        m_out->write(p, len);
+        m_bytesWritten += len;
+    }catch (StreamException& e)
+    {
+        LOG_ERROR("Capture stopped: %s", e.what());
+        m_failed = true;
+    }
+}
+
+// ------------------------------------
+void CaptureWriter::close()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    m_out->close();
+    m_failed = true;
+}
+
+// ------------------------------------
+CaptureStream::CaptureStream(Stream& in, std::shared_ptr<CaptureWriter> writer)
+    : m_writer(writer)
+    , m_startTime(sys->getMonotonicTime())
+{
+    init(&in);
+}
+
+// ------------------------------------
+void CaptureStream::capture(const void* p, int len)
+{
+    m_writer->write(p, len, (unsigned int) ((sys->getMonotonicTime() - m_startTime) * 1000));
+}
+
+// ------------------------------------
+int CaptureStream::read(void* p, int len)
+{
+    int r = stream->read(p, len);
+    capture(p, r);
+    return r;
+}
+
+// ------------------------------------
+int CaptureStream::readSome(void* p, int len)
+{
+    int r = stream->readSome(p, len);
+    capture(p, r);
+    return r;
+}
+
+// ------------------------------------
+int CaptureStream::readUpto(void* p, int len)
+{
+    int r = stream->readUpto(p, len);
+    capture(p, r);
+    return r;
+}
+
+// ------------------------------------
+bool CaptureStream::readReady(int timeoutMilliseconds)
+{
+    return stream->readReady(timeoutMilliseconds);
+}
+
+// ------------------------------------
+bool CaptureReader::readLine(std::string& line)
+{
+    line.clear();
+    try
+    {
+        while (line.size() < SourceCapture::MAX_HEADER_LINE)
+        {
+            char c = m_in.readChar();
+            if (c == '\n')
+                return true;
+            line += c;
+        }
+    }catch (StreamException&)
+    {
+    }
+    return false;
+}
+
+// ------------------------------------
+bool CaptureReader::readHeader()
+{
+    std::string line;
+    if (!readLine(line) || line != MAGIC_LINE)
+        return false;
+    if (!readLine(line))
+        return false;
+    return SourceCapture::parseHeader(line, header);
+}
+
+// ------------------------------------
+bool CaptureReader::next(SourceCapture::Record& record)
+{
+    try
+    {
+        if (m_in.eof())
+            return false;
+        record.msec = m_in.readInt();
+        int len = m_in.readInt();
+        if (len < 0 || len > SourceCapture::MAX_RECORD)
+            return false;
+        record.data.resize(len);
+        int pos = 0;
+        while (pos < len)
+        {
+            int r = m_in.read(&record.data[pos], len - pos);
+            if (r <= 0)
+                return false;
+            pos += r;
+        }
+    }catch (StreamException&)
+    {
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------
+ReplayStream::ReplayStream(CaptureReader& reader, bool realTime)
+    : m_reader(reader)
+    , m_realTime(realTime)
+    , m_startTime(sys->getMonotonicTime())
+    , m_pos(0)
+    , m_end(false)
+    , m_bytesRead(0)
+{
+}
+
+// ------------------------------------
+// 今の記録を読み終えていたら次を読む。もう無ければ false。
+bool ReplayStream::fill()
+{
+    while (m_pos >= m_record.data.size())
+    {
+        if (m_end || !m_reader.next(m_record))
+        {
+            m_end = true;
+            return false;
+        }
+        m_pos = 0;
+        if (m_realTime)
+            sys->sleepUntil(m_startTime + m_record.msec / 1000.0);
+    }
+    return true;
+}
+
+// ------------------------------------
+int ReplayStream::readSome(void* p, int len)
+{
+    if (!fill())
+        throw EOFException("End of capture");
+
+    int n = std::min<size_t>(len, m_record.data.size() - m_pos);
+    memcpy(p, m_record.data.data() + m_pos, n);
+    m_pos += n;
+    m_bytesRead += n;
+    updateTotals(n, 0);
+    return n;
+}
+
+// ------------------------------------
+int ReplayStream::read(void* p, int len)
+{
+    int off = 0;
+    while (off < len)
+        off += readSome(static_cast<char*>(p) + off, len - off);
+    return len;
+}
+
+// ------------------------------------
+bool ReplayStream::eof()
+{
+    return !fill();
+}
@@ -0,0 +1,163 @@
+// ------------------------------------------------
+// File : capture.h
+// Desc:
+//      ソースの取り込みの記録と再生。sourceCapture フラグを立てると、
+//      放送するチャンネルがソースから読んだバイト列を、届いた時刻と一
+//      緒にファイルに書き出す。loadgen/source-replay はそれを同じ
+//      ChannelStream に読ませ直して、デマルチプレクサーの速さを測る。
+//
+//      ファイルは "PCCAPTURE 1\n"、ヘッダーの JSON 一行、続けて記録の
+//      並び。記録は取り込み開始からのミリ秒 (4 バイト)、長さ (4 バイト)
+//      とデータで、数はリトルエンディアン。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "stream.h"
+
+class Channel;
+
+// ------------------------------------
+class SourceCapture
+{
+public:
+    enum
+    {
+        MAX_BYTES       = 1024 * 1024 * 1024,   // これを超えたら記録をやめる
+        MAX_RECORD      = 16 * 1024 * 1024,     // 読み込める記録の大きさ
+        MAX_HEADER_LINE = 64 * 1024,
+    };
+
+    // 再生する時に ChannelStream を作り直すための情報。
+    struct Header
+    {
+        std::string     contentType;    // ChanInfo::getTypeStr
+        std::string     protocol;       // ChanInfo::getProtocolStr
+        int             icyMetaInterval = 0;
+        std::string     name;
+        unsigned int    startTime = 0;  // UNIX 時刻
+    };
+
+    struct Record
+    {
+        unsigned int    msec = 0;       // 取り込み開始からのミリ秒
+        std::string     data;
+    };
+
+    static std::string serializeHeader(const Header& header);
+    static bool        parseHeader(const std::string& line, Header& header);
+
+    // ch の今の情報からヘッダーを作る。
+    static Header      headerFor(std::shared_ptr<Channel> ch);
+    // 状態ディレクトリーに ch の記録のファイルを作る。作れなければ nullptr。
+    static std::shared_ptr<class CaptureWriter> openFor(std::shared_ptr<Channel> ch);
+};
+
+// ------------------------------------
+// 記録を out に書く。書けなくなったら、それ以降は黙って捨てる。
+class CaptureWriter
+{
+public:
+    CaptureWriter(std::unique_ptr<Stream> out, const SourceCapture::Header& header);
+
+    void    write(const void* p, int len, unsigned int msec);
+    void    close();
+
+    bool            failed() const { return m_failed; }
+    uint64_t        bytesWritten() const { return m_bytesWritten; }
+
+private:
+    std::mutex              m_lock;
+    std::unique_ptr<Stream> m_out;
+    bool                    m_failed;
+    uint64_t                m_bytesWritten;
+};
+
+// ------------------------------------
+// in から読んだ分を writer に書き写す。読み込みの待ちや終わりはそのま
+// ま in に任せる。
+class CaptureStream : public IndirectStream
+{
+public:
+    CaptureStream(Stream& in, std::shared_ptr<CaptureWriter> writer);
+
+    int     read(void* p, int len) override;
+    int     readSome(void* p, int len) override;
+    int     readUpto(void* p, int len) override;
+    bool    readReady(int timeoutMilliseconds) override;
+    void    setReadTimeout(unsigned int msec) override { stream->setReadTimeout(msec); }
+    void    setWriteTimeout(unsigned int msec) override { stream->setWriteTimeout(msec); }
+    void    setPollRead(bool b) override { stream->setPollRead(b); }
+
+private:
+    void    capture(const void* p, int len);
+
+    std::shared_ptr<CaptureWriter> m_writer;
+    double  m_startTime;
+};
+
+// ------------------------------------
+class CaptureReader
+{
+public:
+    CaptureReader(Stream& in) : m_in(in) {}
+
+    // 先頭の二行を読む。記録のファイルでなければ false。
+    bool    readHeader();
+    // 次の記録。終わりか壊れた所まで来たら false。
+    bool    next(SourceCapture::Record& record);
+
+    SourceCapture::Header header;
+
+private:
+    bool    readLine(std::string& line);
+
+    Stream& m_in;
+};
+
+// ------------------------------------
+// 記録を ChannelStream に読ませるストリーム。realTime なら記録した時刻
+// まで待ってから渡す。
+class ReplayStream : public Stream
+{
+public:
+    ReplayStream(CaptureReader& reader, bool realTime);
+
+    int     read(void* p, int len) override;
+    int     readSome(void* p, int len) override;
+    void    write(const void*, int) override { throw StreamException("ReplayStream can't write"); }
+    bool    eof() override;
+    bool    readReady(int) override { return true; }
+    void    setReadTimeout(unsigned int) override {}
+
+    uint64_t bytesRead() const { return m_bytesRead; }
+
+private:
+    bool    fill();
+
+    CaptureReader&  m_reader;
+    bool            m_realTime;
+    double          m_startTime;
+    SourceCapture::Record m_record;
+    size_t          m_pos;
+    bool            m_end;
+    uint64_t        m_bytesRead;
+};
+
+#endif
@@ -1,6 +1,9 @@
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+
 #include "cgi.h"
 #include "str.h"
-#include "regexp.h"
 
 namespace cgi {
 
@@ -26,46 +29,107 @@ std::string escape(const std::string& in)
     return res;
 }
 
-std::string unescape(const std::string& in)
+static int hexValue(char c)
 {
-    std::string res;
-    size_t i = 0;
-
-    while (i < in.size()) {
-        if (in[i] == '%') {
-            int c;
-            sscanf(in.substr(i + 1, 2).c_str(), "%x", &c);
-            res += (char) c;
-            i += 3;
-        } else if (in[i] == '+') {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// [begin, end) を復号して res に足す。
+static void unescapeRange(const char* begin, const char* end, std::string& res)
+{
+    const char* p = begin;
+
+    while (p < end) {
+        // 復号の要らない所はまとめて写す。
+        const char* q = p;
+        while (q < end && *q != '%' && *q != '+')
+            q++;
+        res.append(p, q);
+        if (q == end)
+            break;
+
+        if (*q == '+') {
             res += ' ';
-            i += 1;
+            p = q + 1;
+        } else if (end - q >= 3 && hexValue(q[1]) >= 0 && hexValue(q[2]) >= 0) {
+            res += (char) (hexValue(q[1]) * 16 + hexValue(q[2]));
+            p = q + 3;
         } else {
-            res += in[i];
-            i += 1;
+            // 壊れたエスケープはそのまま残す。
+            res += '%';
+            p = q + 1;
         }
     }
-    return res;
 }
 
-Query::Query(const std::string& queryString)
+std::string unescape(const std::string& in)
 {
-    auto assignments = str::split(queryString, "&");
-    for (auto& assignment : assignments)
-    {
-        if (assignment.empty())
-            continue;
+    if (in.find_first_of("%+") == std::string::npos)
+        return in;
 
-        auto sides = str::split(assignment, "=");
-        if (sides.size() == 1)
-            m_dict[sides[0]] = {};
-        else
-        {
-            m_dict[sides[0]].push_back(unescape(sides[1]));
+    std::string res;
+    res.reserve(in.size());
+    unescapeRange(in.data(), in.data() + in.size(), res);
+    return res;
+}
+
+// queryString の項目を順に f(名前の先頭, 終わり, 値の先頭, 終わり) に渡
+// す。値が無ければ値の先頭は nullptr。f が false を返したら止める。
+template <typename F>
+static void eachAssignment(const std::string& queryString, F f)
+{
+    const char* p = queryString.data();
+    const char* end = p + queryString.size();
+
+    while (p < end) {
+        const char* amp = std::find(p, end, '&');
+        if (amp != p) {
+            const char* eq = std::find(p, amp, '=');
+            bool cont = (eq == amp)
+                ? f(p, amp, (const char*) nullptr, (const char*) nullptr)
+                : f(p, eq, eq + 1, amp);
+            if (!cont)
+                return;
         }
+        p = (amp == end) ? end : amp + 1;
     }
 }
 
+Query::Query(const std::string& queryString)
+{
+    eachAssignment(queryString,
+                   [this](const char* kb, const char* ke, const char* vb, const char* ve)
+                   {
+                       auto& values = m_dict[std::string(kb, ke)];
+                       if (vb)
+                       {
+                           values.emplace_back();
+                           unescapeRange(vb, ve, values.back());
+                       }
+                       return true;
+                   });
+}
+
+bool Query::lookup(const std::string& queryString, const std::string& key, std::string& value)
+{
+    bool found = false;
+    eachAssignment(queryString,
+                   [&](const char* kb, const char* ke, const char* vb, const char* ve)
+                   {
+                       if ((size_t)(ke - kb) != key.size() || !std::equal(kb, ke, key.begin()))
+                           return true;
+                       value.clear();
+                       if (vb)
+                           unescapeRange(vb, ve, value);
+                       found = true;
+                       return false;
+                   });
+    return found;
+}
+
 bool Query::hasKey(const std::string& key)
 {
     return m_dict.find(key) != m_dict.end();
@@ -154,70 +218,123 @@ std::string rfc1123Time(time_t t)
     return buf;
 }
 
-static Regexp rfc1123("^([A-z]{3}), (\\d+) ([A-z]{3}) (\\d+) (\\d+):(\\d+):(\\d+) (GMT|UTC)$");
-static Regexp rfc1036("^([A-z]+)day, (\\d+)-([A-z]{3})-(\\d{2}) (\\d+):(\\d+):(\\d+) (GMT|UTC)$");
-static Regexp asctime("^([A-z]{3}) ([A-z]{3}) +(\\d+) (\\d+):(\\d+):(\\d+) (\\d+)$");
+static const char* fullDaysOfWeek[] = { "Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday", nullptr };
 
 #ifdef WIN32
 #define timegm _mkgmtime
 #endif
 
-time_t parseHttpDate(const std::string& str)
+namespace {
+// HTTP の日付を頭から読む。If-Modified-Since のたびに呼ばれるので正規
+// 表現は使わない。
+class DateScanner
 {
-    int sec = -1, min = -1, hour = -1, mday = -1, mon = -1, year = -1, wday = -1;
-    std::vector<std::string> match;
+public:
+    DateScanner(const std::string& str)
+        : m_p(str.c_str())
+        , m_end(str.c_str() + str.size())
+    {}
 
-    if ((match = rfc1123.exec(str)).size())
+    bool literal(const char* s)
     {
-        // Sun, 06 Nov 1994 08:49:37 GMT
-        for (int i = 0; daysOfWeek[i]; i++)
-            if (daysOfWeek[i] == match[1])
-                wday = i;
-        mday = std::stoi(match[2]);
-        for (int i = 0; monthNames[i]; i++)
-            if (monthNames[i] == match[3])
-                mon = i;
-        year = std::stoi(match[4]) - 1900;
-        hour = std::stoi(match[5]);
-        min = std::stoi(match[6]);
-        sec = std::stoi(match[7]);
-    }else if ((match = rfc1036.exec(str)).size())
+        size_t len = strlen(s);
+        if ((size_t)(m_end - m_p) < len || memcmp(m_p, s, len) != 0)
+            return false;
+        m_p += len;
+        return true;
+    }
+
+    // names のどれかに一致すればその添字を index に入れる。
+    bool oneOf(const char* names[], int& index)
+    {
+        for (int i = 0; names[i]; i++)
+        {
+            if (literal(names[i]))
+            {
+                index = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool number(int& value, int minDigits, int maxDigits)
     {
-        // Sunday, 06-Nov-94 08:49:37 GMT
-        for (int i = 0; daysOfWeek[i]; i++)
-            if (daysOfWeek[i] == match[1])
-                wday = i;
-        mday = std::stoi(match[2]);
-        for (int i = 0; monthNames[i]; i++)
-            if (monthNames[i] == match[3])
-                mon = i;
-        year = std::stoi(match[4]);
-        hour = std::stoi(match[5]);
-        min = std::stoi(match[6]);
-        sec = std::stoi(match[7]);
-    }else if ((match = asctime.exec(str)).size())
+        int n = 0;
+        value = 0;
+        while (m_p < m_end && n < maxDigits && isdigit((unsigned char) *m_p))
+        {
+            value = value * 10 + (*m_p++ - '0');
+            n++;
+        }
+        return n >= minDigits;
+    }
+
+    bool spaces()
     {
-        // Sun Nov  6 08:49:37 1994
-        for (int i = 0; daysOfWeek[i]; i++)
-            if (daysOfWeek[i] == match[1])
-                wday = i;
-        for (int i = 0; monthNames[i]; i++)
-            if (monthNames[i] == match[2])
-                mon = i;
-        mday = std::stoi(match[3]);
-        hour = std::stoi(match[4]);
-        min = std::stoi(match[5]);
-        sec = std::stoi(match[6]);
-        year = std::stoi(match[7]) - 1900;
+        if (m_p == m_end || *m_p != ' ')
+            return false;
+        while (m_p < m_end && *m_p == ' ')
+            m_p++;
+        return true;
     }
 
-    if (sec == -1 || min == -1 || hour == -1 || mday == -1 || mon == -1 || year == -1 || wday == -1)
-        return -1;
-    else
+    // HH:MM:SS
+    bool time(int& hour, int& min, int& sec)
+    {
+        return number(hour, 1, 2) && literal(":") &&
+            number(min, 1, 2) && literal(":") &&
+            number(sec, 1, 2);
+    }
+
+    bool zone()
     {
-        struct tm tm = { sec, min, hour, mday, mon, year, wday, };
-        return timegm(&tm);
+        return literal("GMT") || literal("UTC");
     }
+
+    bool atEnd() const { return m_p == m_end; }
+
+private:
+    const char* m_p;
+    const char* m_end;
+};
+}
+
+time_t parseHttpDate(const std::string& str)
+{
+    int sec, min, hour, mday, mon, year, wday;
+
+    DateScanner s1(str), s2(str), s3(str);
+    if (// Sun, 06 Nov 1994 08:49:37 GMT
+        s1.oneOf(daysOfWeek, wday) && s1.literal(", ") &&
+        s1.number(mday, 1, 2) && s1.literal(" ") &&
+        s1.oneOf(monthNames, mon) && s1.literal(" ") &&
+        s1.number(year, 4, 4) && s1.literal(" ") &&
+        s1.time(hour, min, sec) && s1.literal(" ") &&
+        s1.zone() && s1.atEnd())
+    {
+        year -= 1900;
+    }else if (// Sunday, 06-Nov-94 08:49:37 GMT
+        s2.oneOf(fullDaysOfWeek, wday) && s2.literal(", ") &&
+        s2.number(mday, 1, 2) && s2.literal("-") &&
+        s2.oneOf(monthNames, mon) && s2.literal("-") &&
+        s2.number(year, 2, 2) && s2.literal(" ") &&
+        s2.time(hour, min, sec) && s2.literal(" ") &&
+        s2.zone() && s2.atEnd())
+    {
+    }else if (// Sun Nov  6 08:49:37 1994
+        s3.oneOf(daysOfWeek, wday) && s3.literal(" ") &&
+        s3.oneOf(monthNames, mon) && s3.spaces() &&
+        s3.number(mday, 1, 2) && s3.literal(" ") &&
+        s3.time(hour, min, sec) && s3.literal(" ") &&
+        s3.number(year, 4, 4) && s3.atEnd())
+    {
+        year -= 1900;
+    }else
+        return -1;
+
+    struct tm tm = { sec, min, hour, mday, mon, year, wday, };
+    return timegm(&tm);
 }
 
 static const std::map<std::string,uint32_t> entities = {
@@ -6,6 +6,8 @@
 #include <map>
 #include <ctime>
 
+#include "arena.h"
+
 namespace cgi {
 
 std::string escape(const std::string&);
@@ -28,7 +30,14 @@ public:
     std::string str();
     std::vector<std::string> getKeys() const;
 
-    std::map<std::string,std::vector<std::string> > m_dict;
+    // 辞書を作らずに key の最初の値を探す。復号するのはその値だけ。値
+    // の無い key なら value は空。
+    static bool lookup(const std::string& queryString, const std::string& key, std::string& value);
+
+    // 要求を処理している間は、サーバントのアリーナから確保する。
+    typedef std::map<std::string, std::vector<std::string>, std::less<std::string>,
+                     ArenaAllocator<std::pair<const std::string, std::vector<std::string> > > > Dict;
+    Dict m_dict;
 };
 
 }
@@ -0,0 +1,292 @@
+// ------------------------------------------------
+// File : cgiworker.cpp
+// Desc:
+//      CGI スクリプトを続けて処理するワーカープロセスの集まり。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+
+#include "cgiworker.h"
+#include "subprog.h"
+#include "str.h"
+#include "sys.h"
+
+CGIWorkerPool g_cgiWorkers;
+
+// ------------------------------------
+CGIWorkerPool::CGIWorkerPool()
+    : m_size(0)
+    , m_nextID(1)
+    , m_numRequests(0)
+    , m_numStarted(0)
+    , m_numFailed(0)
+{
+}
+
+// ------------------------------------
+CGIWorkerPool::~CGIWorkerPool()
+{
+    stop();
+}
+
+// ------------------------------------
+void CGIWorkerPool::setProgram(const std::string& path, const Environment& env)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_program = path;
+    m_env = env.m_vars;
+}
+
+// ------------------------------------
+void CGIWorkerPool::setSize(int n)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_size = std::max(0, n);
+}
+
+// ------------------------------------
+int CGIWorkerPool::size()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_size;
+}
+
+// ------------------------------------
+// m_lock を取って呼ぶ。
+std::shared_ptr<CGIWorkerPool::Worker> CGIWorkerPool::startWorker()
+{
+    auto w = std::make_shared<Worker>();
+    Environment env;
+    env.m_vars = m_env;
+
+    w->proc = std::make_shared<Subprogram>(m_program);
+    if (!w->proc->start({}, env))
+    {
+        LOG_ERROR("Failed to start CGI worker `%s`", m_program.c_str());
+        return nullptr;
+    }
+    LOG_DEBUG("CGI worker started (pid = %d)", w->proc->pid());
+    m_numStarted++;
+
+    w->reader = std::thread([this, w]() { readerMain(w); });
+    m_workers.push_back(w);
+    return w;
+}
+
+// ------------------------------------
+// m_lock を取って呼ぶ。待っている要求の一番少ないワーカー。どれも
+// 要求を待たせていて、数に余裕があれば新しく起動する。
+std::shared_ptr<CGIWorkerPool::Worker> CGIWorkerPool::pickWorker()
+{
+    std::shared_ptr<Worker> best;
+    for (auto& w : m_workers)
+    {
+        if (!w->alive || w->pending.size() >= MAX_PIPELINE)
+            continue;
+        if (!best || w->pending.size() < best->pending.size())
+            best = w;
+    }
+
+    if ((!best || !best->pending.empty()) && (int) m_workers.size() < m_size)
+    {
+        auto w = startWorker();
+        if (w)
+            return w;
+    }
+    return best;
+}
+
+// ------------------------------------
+// m_lock を取って呼ぶ。
+void CGIWorkerPool::failWorker(Worker& w)
+{
+    w.alive = false;
+    for (auto& p : w.pending)
+    {
+        p.second->done = true;
+        p.second->ok = false;
+    }
+    w.pending.clear();
+    m_cond.notify_all();
+}
+
+// ------------------------------------
+void CGIWorkerPool::readerMain(std::shared_ptr<Worker> w)
+{
+    sys->setThreadName("CGI WORKER");
+
+    Stream& in = *w->proc->inputStream();
+    try
+    {
+        while (true)
+        {
+            auto head = str::split(in.readLine(64), " ");
+            if (head.size() != 2)
+                throw StreamException("Bad response header");
+            unsigned int id = std::stoul(head[0]);
+            int len = std::stoi(head[1]);
+            if (len < 0 || len > MAX_OUTPUT)
+                throw StreamException("Bad response length");
+
+            std::string data = in.read(len);
+            {
+                std::lock_guard<std::mutex> cs(m_lock);
+                auto it = w->pending.find(id);
+                if (it != w->pending.end())
+                {
+                    it->second->output = std::move(data);
+                    it->second->ok = true;
+                    it->second->done = true;
+                    w->pending.erase(it);
+                    m_cond.notify_all();
+                }
+            }
+
+            // 応答の後の改行。次の応答が来るまで待つ。
+            char c;
+            in.read(&c, 1);
+            if (c != '\n')
+                throw StreamException("Bad response trailer");
+        }
+    }catch (std::exception& e)
+    {
+        LOG_DEBUG("CGI worker (pid = %d) finished: %s", w->proc->pid(), e.what());
+    }
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    failWorker(*w);
+}
+
+// ------------------------------------
+// 終わったワーカーを片付ける。
+void CGIWorkerPool::reap()
+{
+    std::vector<std::shared_ptr<Worker>> dead;
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        for (auto it = m_workers.begin(); it != m_workers.end();)
+        {
+            if (!(*it)->alive)
+            {
+                m_dead.push_back(*it);
+                it = m_workers.erase(it);
+            }else
+                ++it;
+        }
+        dead.swap(m_dead);
+    }
+
+    for (auto& w : dead)
+    {
+        if (w->proc->isAlive())
+            w->proc->terminate();
+        if (w->reader.joinable())
+            w->reader.join();
+    }
+}
+
+// ------------------------------------
+bool CGIWorkerPool::run(const Environment& env, std::string& output)
+{
+    reap();
+
+    std::string payload;
+    for (auto& var : env.m_vars)
+    {
+        payload += var;
+        payload.push_back('\0');
+    }
+
+    std::unique_lock<std::mutex> cs(m_lock);
+    if (m_size == 0 || m_program.empty())
+        return false;
+
+    auto w = pickWorker();
+    if (!w)
+    {
+        m_numFailed++;
+        return false;
+    }
+
+    unsigned int id = m_nextID++;
+    auto call = std::make_shared<Call>();
+    w->pending[id] = call;
+    m_numRequests++;
+
+    try
+    {
+        auto out = w->proc->m_outputStream;
+        out->writeString(str::format("%u %d\n", id, (int) payload.size()));
+        out->write(payload.data(), payload.size());
+        out->flush();
+    }catch (std::exception& e)
+    {
+        LOG_ERROR("Failed to send request to CGI worker: %s", e.what());
+        failWorker(*w);
+    }
+
+    if (!m_cond.wait_for(cs, std::chrono::milliseconds(TIMEOUT_MSEC), [&]() { return call->done; }))
+    {
+        // 止まっているワーカーは終わらせる。待っている他の要求も失敗
+        // になる。
+        LOG_ERROR("CGI worker (pid = %d) did not respond", w->proc->pid());
+        failWorker(*w);
+        m_dead.push_back(w);
+        m_workers.erase(std::remove(m_workers.begin(), m_workers.end(), w), m_workers.end());
+        w->proc->terminate();
+    }
+
+    if (!call->ok)
+    {
+        m_numFailed++;
+        return false;
+    }
+    output = std::move(call->output);
+    return true;
+}
+
+// ------------------------------------
+void CGIWorkerPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        for (auto& w : m_workers)
+        {
+            failWorker(*w);
+            m_dead.push_back(w);
+        }
+        m_workers.clear();
+    }
+    reap();
+}
+
+// ------------------------------------
+amf0::Value CGIWorkerPool::getState()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    int pending = 0;
+    for (auto& w : m_workers)
+        pending += w->pending.size();
+
+    return amf0::Value::object(
+        {
+            {"size", m_size},
+            {"workers", (int) m_workers.size()},
+            {"pending", pending},
+            {"requests", (double) m_numRequests},
+            {"started", (double) m_numStarted},
+            {"failed", (double) m_numFailed},
+        });
+}
@@ -0,0 +1,110 @@
+// ------------------------------------------------
+// File : cgiworker.h
+// Desc:
+//      CGI スクリプトを続けて処理するワーカープロセスの集まり。要求ごと
+//      にプロセスを起動する代わりに、起動しておいたワーカーに要求を送
+//      る。一つのワーカーには MAX_PIPELINE 個まで要求を続けて送り、応答
+//      は要求の番号で対応付ける。
+//
+//      ワーカーとのやりとり。数字は 10 進。
+//
+//        要求: "<番号> <長さ>\n" に続けて "名前=値\0" を並べた環境変数
+//        応答: "<番号> <長さ>\n" に続けてスクリプトの出力と "\n"
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _CGIWORKER_H
+#define _CGIWORKER_H
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "amf0.h"
+#include "env.h"
+
+class Subprogram;
+
+// ------------------------------------
+class CGIWorkerPool
+{
+public:
+    enum
+    {
+        MAX_PIPELINE    = 4,                // 一つのワーカーに続けて送る要求の数
+        TIMEOUT_MSEC    = 30000,            // 応答を待つ時間
+        MAX_OUTPUT      = 16 * 1024 * 1024, // 応答の大きさの上限
+    };
+
+    CGIWorkerPool();
+    ~CGIWorkerPool();
+
+    // ワーカーとして起動するプログラムとその環境。
+    void    setProgram(const std::string& path, const Environment& env);
+    // ワーカーの数の上限。0 ならワーカーを使わない。
+    void    setSize(int n);
+    int     size();
+
+    // env を送ってスクリプトを実行させ、出力 (ヘッダーと本文) を
+    // output に入れる。ワーカーが起動できない、途中で終わった、時間内
+    // に応答しなかった時は false。
+    bool    run(const Environment& env, std::string& output);
+
+    // 全てのワーカーを終わらせる。
+    void    stop();
+
+    amf0::Value getState();
+
+private:
+    struct Call
+    {
+        bool        done = false;
+        bool        ok = false;
+        std::string output;
+    };
+
+    struct Worker
+    {
+        std::shared_ptr<Subprogram> proc;
+        std::thread                 reader;
+        std::map<unsigned int, std::shared_ptr<Call>> pending;
+        bool                        alive = true;
+    };
+
+    std::shared_ptr<Worker> pickWorker();
+    std::shared_ptr<Worker> startWorker();
+    void    readerMain(std::shared_ptr<Worker> w);
+    void    failWorker(Worker& w);
+    void    reap();
+
+    std::mutex              m_lock;
+    std::condition_variable m_cond;     // 応答が来た、ワーカーが終わった
+    std::string             m_program;
+    std::vector<std::string> m_env;     // ワーカーの環境変数 (名前=値)
+    int                     m_size;
+    std::vector<std::shared_ptr<Worker>> m_workers;
+    std::vector<std::shared_ptr<Worker>> m_dead;    // まだ join していないもの
+    unsigned int            m_nextID;
+
+    uint64_t                m_numRequests;
+    uint64_t                m_numStarted;
+    uint64_t                m_numFailed;
+};
+
+extern CGIWorkerPool g_cgiWorkers;
+
+#endif
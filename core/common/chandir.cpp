@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <functional>
 #include <sstream>
 #include <memory> // unique_ptr
 #include <stdexcept> // runtime_error
@@ -9,7 +10,6 @@
 #include "chandir.h"
 #include "uri.h"
 #include "servmgr.h"
-#include "regexp.h"
 
 using namespace std;
 
@@ -60,42 +60,69 @@ std::string ChannelEntry::statsUrl()
 
 ChannelDirectory::ChannelDirectory()
     : m_lastUpdate(0)
+    , m_indexValid(false)
+    , m_updating(false)
 {
 }
 
+ChannelDirectory::~ChannelDirectory()
+{
+    if (m_worker.joinable())
+        m_worker.join();
+}
+
 int ChannelDirectory::numChannels() const
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
     return m_channels.size();
 }
 
 int ChannelDirectory::numFeeds() const
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
     return m_feeds.size();
 }
 
-// index.txt を指す URL である url からチャンネルリストを読み込み、out
-// に格納する。成功した場合は true が返る。エラーが発生した場合は
-// false が返る。false を返した場合でも out に読み込めたチャンネル情報
-// が入っている場合がある。
-static bool getFeed(const std::string& url, std::vector<ChannelEntry>& out)
+// feed の index.txt を取得して out に格納する。前回の検証子があれば
+// 条件付きで取得し、304 なら out.notModified を立てる。成功した場合は
+// true が返る。エラーが発生した場合は false が返る。false を返した場
+// 合でも out.channels に読み込めたチャンネル情報が入っている場合がある。
+static bool getFeed(const ChannelFeed& feed, ChannelDirectory::FetchResult& out)
 {
-    out.clear();
-
     try {
         const int serverPort = servMgr->serverHost.port;
         cgi::Query query;
         query.add("host", str::STR("localhost:", serverPort));
-        auto body = http::get(url + "?" + query.str());
+
+        HTTPHeaders headers;
+        if (!feed.lastModified.empty())
+            headers.set("If-Modified-Since", feed.lastModified);
+        if (!feed.etag.empty())
+            headers.set("If-None-Match", feed.etag);
+
+        auto res = http::getResponse(feed.url + "?" + query.str(), headers);
+        if (res.statusCode == 304) {
+            out.notModified = true;
+            out.lastModified = feed.lastModified;
+            out.etag = feed.etag;
+            return true;
+        } else if (res.statusCode != 200) {
+            LOG_ERROR("%s: status code %d", feed.url.c_str(), res.statusCode);
+            return false;
+        }
 
         std::vector<std::string> errors;
-        out = ChannelEntry::textToChannelEntries(body, url, errors);
+        out.channels = ChannelEntry::textToChannelEntries(res.body, feed.url, errors);
 
         for (auto& message : errors) {
             LOG_ERROR("%s", message.c_str());
         }
 
+        // 全部読めた時だけ次回を条件付きにする。
+        if (errors.empty()) {
+            out.lastModified = res.headers.get("Last-Modified");
+            out.etag = res.headers.get("ETag");
+        }
         return errors.empty();
     } catch (GeneralException& e) {
         LOG_ERROR("%s", e.msg);
@@ -131,20 +158,46 @@ static std::string runProcess(std::function<void(Stream&)> action)
 
 bool ChannelDirectory::update(UpdateMode mode)
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::vector<ChannelFeed> feeds;
+    {
+        std::lock_guard<ProfiledMutex> cs(m_lock);
 
-    const unsigned int coolDownTime = (mode==kUpdateManual) ? 30 : 5 * 60;
-    if (sys->getTime() - m_lastUpdate < coolDownTime)
-        return false;
+        const unsigned int coolDownTime = (mode==kUpdateManual) ? 30 : 5 * 60;
+        if (m_updating || sys->getTime() - m_lastUpdate < coolDownTime)
+            return false;
 
+        m_updating = true;
+        m_lastUpdate = sys->getTime();
+        feeds = m_feeds;
+    }
+
+    if (mode == kUpdateManual)
+    {
+        fetchAll(feeds);
+        return true;
+    }
+
+    // 前の取得のスレッドは m_updating を下ろした後は終わるだけ。
+    if (m_worker.joinable())
+        m_worker.join();
+    m_worker = std::thread([this, feeds]() { fetchAll(feeds); });
+    return true;
+}
+
+// feeds を並列に取得して merge する。m_lock は merge の間しか持たな
+// い。
+void ChannelDirectory::fetchAll(std::vector<ChannelFeed> feeds)
+{
     double t0 = sys->getDTime();
     std::vector<std::thread> workers;
-    std::mutex mutex; // m_channels を保護するミューテックス。
-    m_channels.clear();
-    for (auto& feed : m_feeds)
+    std::vector<FetchResult> results(feeds.size());
+
+    for (size_t i = 0; i < feeds.size(); i++)
     {
+        const ChannelFeed& feed = feeds[i];
+        FetchResult& result = results[i];
         std::function<void(void)> getChannels =
-            [&feed, &mutex, this]
+            [&feed, &result]
             {
                 assert(AUX_LOG_FUNC_VECTOR == nullptr);
                 AUX_LOG_FUNC_VECTOR = new std::vector<std::function<void(LogBuffer::TYPE type, const char*)>>();
@@ -155,31 +208,23 @@ bool ChannelDirectory::update(UpdateMode mode)
                                 delete AUX_LOG_FUNC_VECTOR;
                             });
 
-                feed.log = runProcess([&feed, &mutex, this](Stream& s)
-                                      {
-                                          // print start time
-                                          String time;
-                                          time.setFromTime(sys->getTime());
-                                          s.writeStringF("Start time: %s\n", time.c_str()); // two newlines at the end
-
-                                          std::vector<ChannelEntry> channels;
-                                          bool success;
-                                          double t1 = sys->getDTime();
-                                          success = getFeed(feed.url, channels);
-                                          double t2 = sys->getDTime();
-
-                                          LOG_TRACE("Got %zu channels from %s (%.6f seconds)", channels.size(), feed.url.c_str(), t2 - t1);
-                                          if (success) {
-                                              feed.status = ChannelFeed::Status::kOk;
-                                          } else {
-                                              feed.status = ChannelFeed::Status::kError;
-                                          }
-
-                                          {
-                                              std::lock_guard<std::mutex> lock(mutex);
-                                              for (auto& c : channels) m_channels.push_back(c);
-                                          }
-                                      });
+                result.log = runProcess([&feed, &result](Stream& s)
+                                        {
+                                            // print start time
+                                            String time;
+                                            time.setFromTime(sys->getTime());
+                                            s.writeStringF("Start time: %s\n", time.c_str()); // two newlines at the end
+
+                                            double t1 = sys->getDTime();
+                                            bool success = getFeed(feed, result);
+                                            double t2 = sys->getDTime();
+
+                                            if (result.notModified)
+                                                LOG_TRACE("%s not modified (%.6f seconds)", feed.url.c_str(), t2 - t1);
+                                            else
+                                                LOG_TRACE("Got %zu channels from %s (%.6f seconds)", result.channels.size(), feed.url.c_str(), t2 - t1);
+                                            result.status = success ? ChannelFeed::Status::kOk : ChannelFeed::Status::kError;
+                                        });
             };
         workers.push_back(std::thread(getChannels));
     }
@@ -187,16 +232,58 @@ bool ChannelDirectory::update(UpdateMode mode)
     for (auto& t : workers)
         t.join();
 
-    sort(m_channels.begin(), m_channels.end(),
-         [](ChannelEntry& a, ChannelEntry& b)
-         {
-             return a.numDirects > b.numDirects;
-         });
-    m_lastUpdate = sys->getTime();
+    std::map<std::string, FetchResult> byUrl;
+    for (size_t i = 0; i < feeds.size(); i++)
+        byUrl[feeds[i].url] = std::move(results[i]);
+    merge(byUrl);
+
+    std::lock_guard<ProfiledMutex> cs(m_lock);
+    m_updating = false;
     LOG_INFO("Channel feed update: total of %zu channels in %f sec",
              m_channels.size(),
              sys->getDTime() - t0);
-    return true;
+}
+
+void ChannelDirectory::merge(const std::map<std::string, FetchResult>& results)
+{
+    std::lock_guard<ProfiledMutex> cs(m_lock);
+
+    // 取得している間にフィードが消えたり足されたりしていることがある
+    // ので、今のフィードの並びで組み立てる。
+    std::vector<ChannelEntry> channels;
+    for (auto& feed : m_feeds)
+    {
+        auto it = results.find(feed.url);
+        if (it == results.end())
+        {
+            for (auto& c : m_channels)
+                if (c.feedUrl == feed.url)
+                    channels.push_back(c);
+            continue;
+        }
+
+        const FetchResult& result = it->second;
+        feed.status = result.status;
+        feed.log = result.log;
+        feed.lastModified = result.lastModified;
+        feed.etag = result.etag;
+
+        if (result.notModified)
+        {
+            for (auto& c : m_channels)
+                if (c.feedUrl == feed.url)
+                    channels.push_back(c);
+        }else
+            channels.insert(channels.end(), result.channels.begin(), result.channels.end());
+    }
+
+    stable_sort(channels.begin(), channels.end(),
+                [](const ChannelEntry& a, const ChannelEntry& b)
+                {
+                    return a.numDirects > b.numDirects;
+                });
+    m_channels.swap(channels);
+    m_indexValid = false;
 }
 
 // index番目のチャンネル詳細のフィールドを出力する。成功したら true を返す。
@@ -204,7 +291,7 @@ bool ChannelDirectory::writeChannelVariable(Stream& out, const String& varName,
 {
     using namespace std;
 
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
 
     if (!(index >= 0 && (size_t)index < m_channels.size()))
         return false;
@@ -252,10 +339,10 @@ bool ChannelDirectory::writeChannelVariable(Stream& out, const String& varName,
 
 static std::string directoryUrlOf(const std::string& url)
 {
-    auto matches = Regexp("/[^/]*$").exec(url);
-        
-    if (matches.size() > 0) {
-        return str::replace_suffix(url, matches[0], "/");
+    auto pos = url.rfind('/');
+
+    if (pos != std::string::npos) {
+        return url.substr(0, pos + 1);
     } else {
         return url;
     }
@@ -330,7 +417,7 @@ amf0::Value ChannelDirectory::getState()
 
 int ChannelDirectory::totalListeners() const
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
     int res = 0;
 
     for (const ChannelEntry& e : m_channels) {
@@ -341,7 +428,7 @@ int ChannelDirectory::totalListeners() const
 
 int ChannelDirectory::totalRelays() const
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
     int res = 0;
 
     for (const ChannelEntry& e : m_channels) {
@@ -352,13 +439,13 @@ int ChannelDirectory::totalRelays() const
 
 std::vector<ChannelFeed> ChannelDirectory::feeds() const
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
     return m_feeds;
 }
 
 bool ChannelDirectory::addFeed(const std::string& url)
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
 
     auto iter = find_if(m_feeds.begin(), m_feeds.end(), [&](ChannelFeed& f) { return f.url == url;});
 
@@ -379,15 +466,18 @@ bool ChannelDirectory::addFeed(const std::string& url)
 
 void ChannelDirectory::clearFeeds()
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
 
     m_feeds.clear();
     m_channels.clear();
+    m_indexValid = false;
     m_lastUpdate = 0;
 }
 
 std::string ChannelDirectory::findTracker(const GnuID& id) const
 {
+    std::lock_guard<ProfiledMutex> cs(m_lock);
+
     for (const ChannelEntry& entry : m_channels)
     {
         if (entry.id.isSame(id))
@@ -398,6 +488,8 @@ std::string ChannelDirectory::findTracker(const GnuID& id) const
 
 std::shared_ptr<ChannelEntry> ChannelDirectory::findEntry(const GnuID& id) const
 {
+    std::lock_guard<ProfiledMutex> cs(m_lock);
+
     for (const ChannelEntry& entry : m_channels)
     {
         if (entry.id.isSame(id))
@@ -421,6 +513,117 @@ std::string ChannelFeed::statusToString(ChannelFeed::Status s)
 
 std::vector<ChannelEntry> ChannelDirectory::channels() const
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
     return m_channels;
 }
+
+static std::string toLower(const std::string& s)
+{
+    std::string r = s;
+    for (auto& c : r)
+        if (c >= 'A' && c <= 'Z')
+            c = c - 'A' + 'a';
+    return r;
+}
+
+// 「時:分」を分にする。
+static int uptimeMinutes(const std::string& uptime)
+{
+    auto vec = str::split(uptime, ":");
+    if (vec.size() != 2)
+        return 0;
+    return std::atoi(vec[0].c_str()) * 60 + std::atoi(vec[1].c_str());
+}
+
+void ChannelDirectory::buildIndex() const
+{
+    const int n = m_channels.size();
+
+    m_searchText.clear();
+    for (auto& c : m_channels)
+        m_searchText.push_back(toLower(c.name + "\n" + c.genre + "\n" + c.desc + "\n" + c.comment));
+
+    std::vector<int> base(n);
+    for (int i = 0; i < n; i++)
+        base[i] = i;
+
+    typedef std::function<bool(const ChannelEntry&, const ChannelEntry&)> Less;
+
+    // 同じ値の間は名前の順にする。
+    auto sortBy = [&](Less less)
+        {
+            auto v = base;
+            std::stable_sort(v.begin(), v.end(),
+                             [&](int a, int b)
+                             {
+                                 auto& x = m_channels[a];
+                                 auto& y = m_channels[b];
+                                 if (less(x, y)) return true;
+                                 if (less(y, x)) return false;
+                                 return x.name < y.name;
+                             });
+            return v;
+        };
+
+    const std::map<std::string, Less> keys = {
+        { "name",       [](const ChannelEntry& a, const ChannelEntry& b) { return a.name < b.name; } },
+        { "genre",      [](const ChannelEntry& a, const ChannelEntry& b) { return a.genre < b.genre; } },
+        { "listeners",  [](const ChannelEntry& a, const ChannelEntry& b) { return a.numDirects < b.numDirects; } },
+        { "relays",     [](const ChannelEntry& a, const ChannelEntry& b) { return a.numRelays < b.numRelays; } },
+        { "bitrate",    [](const ChannelEntry& a, const ChannelEntry& b) { return a.bitrate < b.bitrate; } },
+        { "uptime",     [](const ChannelEntry& a, const ChannelEntry& b) { return uptimeMinutes(a.uptime) < uptimeMinutes(b.uptime); } },
+        { "yellowPage", [](const ChannelEntry& a, const ChannelEntry& b) { return a.feedUrl < b.feedUrl; } },
+    };
+
+    m_orders.clear();
+    for (auto& pair : keys)
+    {
+        auto less = pair.second;
+        m_orders[pair.first] = sortBy(less);
+        m_orders["-" + pair.first] = sortBy([less](const ChannelEntry& a, const ChannelEntry& b) { return less(b, a); });
+    }
+
+    m_indexValid = true;
+}
+
+ChannelDirectory::Page ChannelDirectory::query(const Query& q) const
+{
+    std::vector<std::string> words;
+    for (auto& w : str::split(toLower(q.text), " "))
+        if (!w.empty())
+            words.push_back(w);
+
+    std::lock_guard<ProfiledMutex> cs(m_lock);
+
+    // テストなどで m_channels を直接入れ替えた時も作り直す。
+    if (!m_indexValid || m_searchText.size() != m_channels.size())
+        buildIndex();
+
+    auto it = m_orders.find(q.sort);
+    if (it == m_orders.end())
+        throw std::invalid_argument("unknown sort key: " + q.sort);
+    auto& order = it->second;
+
+    Page page;
+    for (int i : order)
+    {
+        auto& c = m_channels[i];
+
+        if (!q.yellowPage.empty() && c.feedUrl != q.yellowPage)
+            continue;
+        bool match = true;
+        for (auto& w : words)
+            if (m_searchText[i].find(w) == std::string::npos)
+            {
+                match = false;
+                break;
+            }
+        if (!match)
+            continue;
+
+        if (page.total >= q.offset && (q.limit <= 0 || page.total < q.offset + q.limit))
+            page.channels.push_back(c);
+        page.total++;
+    }
+    return page;
+}
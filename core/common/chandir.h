@@ -2,6 +2,7 @@
 #define _CHANDIR_H
 
 #include <cstdlib>
+#include <map>
 #include <vector>
 #include <stdexcept> // runtime_error
 
@@ -97,6 +98,10 @@ public:
     Status status;
 
     std::string log;
+
+    // 条件付き GET に使う前回の応答の検証子。
+    std::string lastModified;
+    std::string etag;
 };
 
 // 外部からチャンネルリストを取得して保持する。
@@ -109,7 +114,18 @@ public:
     };
 
     ChannelDirectory();
+    ~ChannelDirectory();
 
+    // 一つのフィードを取得した結果。
+    struct FetchResult
+    {
+        ChannelFeed::Status status = ChannelFeed::Status::kUnknown;
+        bool notModified = false;   // 304 が返った。前のチャンネルを使う。
+        std::vector<ChannelEntry> channels;
+        std::string lastModified;
+        std::string etag;
+        std::string log;
+    };
     int numChannels() const;
     int numFeeds() const;
     std::vector<ChannelFeed> feeds() const;
@@ -119,13 +135,42 @@ public:
     int totalListeners() const;
     int totalRelays() const;
 
+    // フィードを並列に取得して、揃ったらチャンネルリストを入れ替える。
+    // 取得中も読み手は前のリストを見る。kUpdateAuto は取得を裏のスレッ
+    // ドに任せてすぐ戻る。kUpdateManual は入れ替えまで待つ。取得を始め
+    // たら true。
     bool update(UpdateMode mode = kUpdateAuto);
 
+    // url ごとの取得結果を今のリストに混ぜて入れ替える。304 のフィード
+    // は前のチャンネルをそのまま使う。
+    void merge(const std::map<std::string, FetchResult>& results);
+
     bool writeChannelVariable(Stream& out, const String& varName, int index);
     bool writeFeedVariable(Stream& out, const String& varName, int index);
 
     std::vector<ChannelEntry> channels() const;
 
+    // チャンネル一覧を絞り込んで並べ替え、その一部を返す。
+    struct Query
+    {
+        // 空白で区切った語を、全て名前、ジャンル、詳細、コメントのど
+        // れかに含むもの。英字の大文字と小文字は区別しない。
+        std::string text;
+        std::string yellowPage;     // 空でなければこのフィードのものだけ
+        // name, genre, listeners, relays, bitrate, uptime, yellowPage
+        // のどれか。先頭に - を付けると降順。
+        std::string sort = "-listeners";
+        int         offset = 0;
+        int         limit = 0;      // 0 なら最後まで
+    };
+    struct Page
+    {
+        int         total = 0;      // 絞り込んだ後、ページに分ける前の数
+        std::vector<ChannelEntry> channels;
+    };
+    // sort が知らないキーなら std::invalid_argument を投げる。
+    Page query(const Query& q) const;
+
     std::string findTracker(const GnuID& id) const;
     std::shared_ptr<ChannelEntry> findEntry(const GnuID& id) const;
 
@@ -135,7 +180,21 @@ public:
     std::vector<ChannelFeed> m_feeds;
 
     unsigned int m_lastUpdate;
-    mutable std::recursive_mutex m_lock;
+    mutable ProfiledMutex m_lock { "ChannelDirectory::m_lock" };
+
+private:
+    void fetchAll(std::vector<ChannelFeed> feeds);
+    void buildIndex() const;    // m_lock を取って呼ぶ
+
+    // query の索引。リストが入れ替わった後、最初の query で作る。
+    // m_searchText はチャンネルごとの検索対象を小文字にしたもの、
+    // m_orders は Query::sort ごとに並べたチャンネルの添字。
+    mutable bool m_indexValid;
+    mutable std::vector<std::string> m_searchText;
+    mutable std::map<std::string, std::vector<int>> m_orders;
+
+    bool m_updating;        // 取得中。m_lock で保護される。
+    std::thread m_worker;   // kUpdateAuto の取得をするスレッド
 };
 
 #endif
@@ -0,0 +1,123 @@
+// ------------------------------------------------
+// File : changroup.cpp
+// Desc:
+//      サイマル配信のチャンネルグループ。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+
+#include "changroup.h"
+#include "chanmgr.h"
+#include "str.h"
+
+// ------------------------------------
+GnuID ChannelGroup::makeID(const GnuID& broadcastID, const std::string& name)
+{
+    GnuID id = broadcastID;
+    id.encode(nullptr, name.c_str(), "group", 0);
+    return id;
+}
+
+// ------------------------------------
+void ChannelGroup::assign(ChanInfo& info, const std::string& name, const std::string& rendition)
+{
+    if (name.empty())
+        return;
+    info.groupID = makeID(info.bcID, name);
+    info.rendition = str::truncate_utf8(str::valid_utf8(rendition), 255);
+}
+
+// ------------------------------------
+std::vector<ChannelGroup::Rendition> ChannelGroup::find(const GnuID& groupID)
+{
+    std::vector<Rendition> res;
+    if (!groupID.isSet())
+        return res;
+
+    auto add = [&](const ChanInfo& info, bool local)
+    {
+        if (!info.groupID.isSame(groupID))
+            return;
+        for (auto& r : res)
+            if (r.id.isSame(info.id))
+            {
+                r.local = r.local || local;
+                return;
+            }
+        res.push_back({ info.id, info.rendition.c_str(), info.bitrate, local });
+    };
+
+    {
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+        for (auto ch = chanMgr->channel; ch; ch = ch->next)
+            if (ch->isActive())
+                add(ch->info, true);
+    }
+
+    for (auto chl = chanMgr->hitlist; chl; chl = chl->next)
+    {
+        std::lock_guard<ProfiledMutex> lock(chl->lock);
+        if (chl->isUsed())
+            add(chl->info, false);
+    }
+
+    std::stable_sort(res.begin(), res.end(),
+                     [](const Rendition& a, const Rendition& b) { return a.bitrate > b.bitrate; });
+    return res;
+}
+
+// ------------------------------------
+int ChannelGroup::select(const std::vector<Rendition>& renditions, int availableKbps)
+{
+    if (renditions.empty())
+        return -1;
+
+    int lowest = 0;
+    int best = -1;
+    for (size_t i = 0; i < renditions.size(); i++)
+    {
+        auto& r = renditions[i];
+        if (r.bitrate < renditions[lowest].bitrate)
+            lowest = (int) i;
+
+        if (availableKbps >= 0 && r.bitrate > availableKbps)
+            continue;
+        // 同じビットレートなら既に受信しているものを選ぶ。
+        if (best < 0 ||
+            r.bitrate > renditions[best].bitrate ||
+            (r.bitrate == renditions[best].bitrate && r.local && !renditions[best].local))
+            best = (int) i;
+    }
+    return (best >= 0) ? best : lowest;
+}
+
+// ------------------------------------
+std::string ChannelGroup::masterPlaylist(const std::vector<Rendition>& renditions, const std::string& query)
+{
+    std::string s = "#EXTM3U\n";
+    for (auto& r : renditions)
+    {
+        std::string name = r.name.empty() ? str::format("%dk", r.bitrate) : r.name;
+        // NAME は引用符で囲むので、引用符と改行は落とす。
+        name.erase(std::remove_if(name.begin(), name.end(),
+                                  [](char c) { return c == '"' || c == '\r' || c == '\n'; }),
+                   name.end());
+        s += str::format("#EXT-X-STREAM-INF:BANDWIDTH=%d,NAME=\"%s\"\n", std::max(r.bitrate, 1) * 1000, name.c_str());
+        s += "/hls/" + r.id.str() + "/index.m3u8";
+        if (!query.empty())
+            s += "?" + query;
+        s += "\n";
+    }
+    return s;
+}
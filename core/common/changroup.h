@@ -0,0 +1,68 @@
+// ------------------------------------------------
+// File : changroup.h
+// Desc:
+//      サイマル配信のチャンネルグループ。同じ番組を画質を変えて別々の
+//      チャンネルとして配信し、ChanInfo の groupID でまとめる。グルー
+//      プの情報はチャンネル情報のアトムでリレー先にも伝わるので、リレー
+//      も自分の持っている画質とヒットリストから選べる。
+//
+//      /group/<グループID> は上りの余裕と視聴者の求める上限に収まる一
+//      番良い画質のチャンネルに転送し、/hls/<グループID>/master.m3u8 は
+//      全部の画質を載せたマスタープレイリストを返す。HLS のプレイヤー
+//      は詰まるとセグメント (キーフレーム) の境目で下の画質に移る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _CHANGROUP_H
+#define _CHANGROUP_H
+
+#include <string>
+#include <vector>
+
+#include "gnuid.h"
+
+class ChanInfo;
+
+// ------------------------------------
+class ChannelGroup
+{
+public:
+    struct Rendition
+    {
+        GnuID       id;
+        std::string name;       // "720p" など。空ならビットレートから作る
+        int         bitrate;    // kbps
+        bool        local;      // このノードが既に受信している
+    };
+
+    // 配信者のブロードキャスト ID とグループ名から決まるグループ ID。
+    static GnuID makeID(const GnuID& broadcastID, const std::string& name);
+
+    // info をグループ name の rendition にする。info.bcID は設定済みの
+    // こと。name が空なら何もしない。
+    static void assign(ChanInfo& info, const std::string& name, const std::string& rendition);
+
+    // groupID のチャンネルを、受信中のものとヒットリストから集めてビッ
+    // トレートの高い順に並べる。
+    static std::vector<Rendition> find(const GnuID& groupID);
+
+    // availableKbps (負なら無制限) に収まる一番高い画質。どれも収まら
+    // なければ一番低いもの。空なら -1。
+    static int select(const std::vector<Rendition>& renditions, int availableKbps);
+
+    // renditions を載せた HLS のマスタープレイリスト。query は各プレ
+    // イリストの URI の後ろに付ける。
+    static std::string masterPlaylist(const std::vector<Rendition>& renditions, const std::string& query);
+};
+
+#endif
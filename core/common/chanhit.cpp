@@ -19,7 +19,11 @@
 
 #include "chanhit.h"
 
+#include <algorithm>
+
 #include "pcp.h"
+#include "relaypolicy.h"
+#include "locality.h"
 #include "servmgr.h"
 #include "version2.h"
 
@@ -29,6 +33,14 @@ ChanHitList::ChanHitList()
     , hit(nullptr)
     , lastHitTime(0)
     , next(nullptr)
+    , maxHits(0)
+    , m_numHits(0)
+    , m_numListeners(0)
+    , m_numRelays(0)
+    , m_numFirewalled(0)
+    , m_numTrackers(0)
+    , m_generation(0)
+    , m_alternatesGeneration(0)
 {
 }
 
@@ -83,6 +95,11 @@ void ChanHit::init()
     uphost.init();
     uphostHops = 0;
 
+    headroom = -1;
+
+    hub = false;
+    hubListeners = hubRelays = 0;
+
     versionVP = 0;
     memcpy(versionExPrefix, "  ", 2);
     versionExNumber = 0;
@@ -101,7 +118,7 @@ void ChanHit::initLocal(
     const Host& sourceHost,
     bool ipv6)
 {
-    std::lock_guard<std::recursive_mutex> cs(servMgr->lock);
+    std::lock_guard<ProfiledMutex> cs(servMgr->lock);
 
     init();
 
@@ -116,6 +133,7 @@ void ChanHit::initLocal(
     direct = !servMgr->directFull();
     relay = canAddRelay;
     cin = !servMgr->controlInFull();
+    headroom = servMgr->uploadHeadroom();
 
     if (ipv6)
         host = servMgr->serverHostIPv6;
@@ -153,45 +171,190 @@ static int flags1(ChanHit* hit)
     if (hit->cin)        fl1 |= PCP_HOST_FLAGS1_CIN;
     if (hit->tracker)    fl1 |= PCP_HOST_FLAGS1_TRACKER;
     if (hit->firewalled) fl1 |= PCP_HOST_FLAGS1_PUSH;
+    if (hit->hub)        fl1 |= PCP_HOST_FLAGS1_HUB;
     return fl1;
 }
 
 // -----------------------------------
-void ChanHit::writeAtoms(AtomStream &atom, const GnuID &chanID)
+// writeAtoms の子アトムの内容を決める値を key に並べる。
+static void atomKey(ChanHit* hit, unsigned char* key)
 {
-    bool addChan = chanID.isSet();
+    unsigned char* p = key;
+    auto put = [&](const void* v, size_t n) { memcpy(p, v, n); p += n; };
+    int fl1 = flags1(hit);
+
+    memset(key, 0, ChanHit::ATOM_KEY_SIZE);
+    put(hit->sessionID.id, 16);
+    for (int i = 0; i < 2; i++)
+    {
+        put(hit->rhost[i].ip.addr, 16);
+        put(&hit->rhost[i].port, sizeof(hit->rhost[i].port));
+    }
+    put(&hit->numListeners, sizeof(hit->numListeners));
+    put(&hit->numRelays, sizeof(hit->numRelays));
+    put(&hit->upTime, sizeof(hit->upTime));
+    put(&hit->version, sizeof(hit->version));
+    put(&hit->versionVP, sizeof(hit->versionVP));
+    put(hit->versionExPrefix, 2);
+    put(&hit->versionExNumber, sizeof(hit->versionExNumber));
+    put(&fl1, sizeof(fl1));
+    put(&hit->oldestPos, sizeof(hit->oldestPos));
+    put(&hit->newestPos, sizeof(hit->newestPos));
+    put(hit->uphost.ip.addr, 16);
+    put(&hit->uphost.port, sizeof(hit->uphost.port));
+    put(&hit->uphostHops, sizeof(hit->uphostHops));
+    put(&hit->headroom, sizeof(hit->headroom));
+    put(&hit->hubListeners, sizeof(hit->hubListeners));
+    put(&hit->hubRelays, sizeof(hit->hubRelays));
+}
 
-    atom.writeParent(PCP_HOST,
-                     13  +
-                     (addChan ? 1 : 0) +
+// -----------------------------------
+std::shared_ptr<const ChanHit::AtomCache> ChanHit::prepareAtoms()
+{
+    unsigned char key[ATOM_KEY_SIZE];
+    atomKey(this, key);
+
+    auto cache = std::atomic_load(&atomCache);
+    if (cache && memcmp(cache->key, key, ATOM_KEY_SIZE) == 0)
+        return cache;
+
+    char buf[512];
+    MemoryStream mem(buf, sizeof(buf));
+    AtomStream atom(mem);
+
+    auto c = std::make_shared<AtomCache>();
+    memcpy(c->key, key, ATOM_KEY_SIZE);
+    c->numChildren = 13 +
                      (uphost.ip ? 3 : 0) +
-                     (versionExNumber != 0 ? 2 : 0));
+                     (versionExNumber != 0 ? 2 : 0) +
+                     (headroom >= 0 ? 1 : 0) +
+                     (hub ? 2 : 0);
+
+    atom.writeBytes(PCP_HOST_ID, sessionID.id, 16);
+    atom.writeAddress(PCP_HOST_IP, rhost[0].ip);
+    atom.writeShort(PCP_HOST_PORT, rhost[0].port);
+    atom.writeAddress(PCP_HOST_IP, rhost[1].ip);
+    atom.writeShort(PCP_HOST_PORT, rhost[1].port);
+    atom.writeInt(PCP_HOST_NUML, numListeners);
+    atom.writeInt(PCP_HOST_NUMR, numRelays);
+    atom.writeInt(PCP_HOST_UPTIME, upTime);
+    atom.writeInt(PCP_HOST_VERSION, version);
+    atom.writeInt(PCP_HOST_VERSION_VP, versionVP);
+    if (versionExNumber)
+    {
+        atom.writeBytes(PCP_HOST_VERSION_EX_PREFIX, versionExPrefix, 2);
+        atom.writeShort(PCP_HOST_VERSION_EX_NUMBER, versionExNumber);
+    }
+    atom.writeChar(PCP_HOST_FLAGS1, flags1(this));
+    atom.writeInt(PCP_HOST_OLDPOS, oldestPos);
+    atom.writeInt(PCP_HOST_NEWPOS, newestPos);
+    if (uphost.ip)
+    {
+        atom.writeAddress(PCP_HOST_UPHOST_IP, uphost.ip);
+        atom.writeInt(PCP_HOST_UPHOST_PORT, uphost.port);
+        atom.writeInt(PCP_HOST_UPHOST_HOPS, uphostHops);
+    }
+    if (headroom >= 0)
+        atom.writeInt(PCP_HOST_HEADROOM, headroom);
+    if (hub)
+    {
+        atom.writeInt(PCP_HOST_HUB_NUML, hubListeners);
+        atom.writeInt(PCP_HOST_HUB_NUMR, hubRelays);
+    }
+
+    c->data.assign(buf, mem.pos);
+    std::atomic_store(&atomCache, std::shared_ptr<const AtomCache>(c));
+    return c;
+}
+
+// -----------------------------------
+void ChanHit::writeAtoms(AtomStream &atom, const GnuID &chanID, int numExtra)
+{
+    bool addChan = chanID.isSet();
+    auto cache = prepareAtoms();
+
+    atom.writeParent(PCP_HOST, cache->numChildren + numExtra + (addChan ? 1 : 0));
         if (addChan)
             atom.writeBytes(PCP_HOST_CHANID, chanID.id, 16);
-        atom.writeBytes(PCP_HOST_ID, sessionID.id, 16);
-        atom.writeAddress(PCP_HOST_IP, rhost[0].ip);
-        atom.writeShort(PCP_HOST_PORT, rhost[0].port);
-        atom.writeAddress(PCP_HOST_IP, rhost[1].ip);
-        atom.writeShort(PCP_HOST_PORT, rhost[1].port);
-        atom.writeInt(PCP_HOST_NUML, numListeners);
-        atom.writeInt(PCP_HOST_NUMR, numRelays);
-        atom.writeInt(PCP_HOST_UPTIME, upTime);
-        atom.writeInt(PCP_HOST_VERSION, version);
-        atom.writeInt(PCP_HOST_VERSION_VP, versionVP);
-        if (versionExNumber)
+        atom.io.write(cache->data.data(), cache->data.size());
+}
+
+// -----------------------------------
+void ChanHit::readAtoms(AtomStream &atom, int numc, GnuID &chanID, bool &move, unsigned int &hubLease)
+{
+    unsigned int ipNum=0;
+
+    for (int i=0; i<numc; i++)
+    {
+        int c, d;
+        ID4 id = atom.read(c, d);
+
+        if (id == PCP_HOST_IP)
+        {
+            rhost[ipNum].ip = atom.readAddress();
+        }else if (id == PCP_HOST_PORT)
         {
-            atom.writeBytes(PCP_HOST_VERSION_EX_PREFIX, versionExPrefix, 2);
-            atom.writeShort(PCP_HOST_VERSION_EX_NUMBER, versionExNumber);
+            int port = atom.readShort();
+            rhost[ipNum++].port = port;
+
+            if (ipNum > 1)
+                ipNum = 1;
         }
-        atom.writeChar(PCP_HOST_FLAGS1, flags1(this));
-        atom.writeInt(PCP_HOST_OLDPOS, oldestPos);
-        atom.writeInt(PCP_HOST_NEWPOS, newestPos);
-        if (uphost.ip)
+        else if (id == PCP_HOST_NUML)
+            numListeners = atom.readInt();
+        else if (id == PCP_HOST_NUMR)
+            numRelays = atom.readInt();
+        else if (id == PCP_HOST_UPTIME)
+            upTime = atom.readInt();
+        else if (id == PCP_HOST_OLDPOS)
+            oldestPos = atom.readInt();
+        else if (id == PCP_HOST_NEWPOS)
+            newestPos = atom.readInt();
+        else if (id == PCP_HOST_VERSION)
+            version = atom.readInt();
+        else if (id == PCP_HOST_VERSION_VP)
+            versionVP = atom.readInt();
+        else if (id == PCP_HOST_VERSION_EX_PREFIX)
+            atom.readBytes(versionExPrefix, 2);
+        else if (id == PCP_HOST_VERSION_EX_NUMBER)
+            versionExNumber = atom.readShort();
+        else if (id == PCP_HOST_FLAGS1)
+        {
+            int fl1 = atom.readChar();
+
+            recv = (fl1 & PCP_HOST_FLAGS1_RECV) !=0;
+            relay = (fl1 & PCP_HOST_FLAGS1_RELAY) !=0;
+            direct = (fl1 & PCP_HOST_FLAGS1_DIRECT) !=0;
+            cin = (fl1 & PCP_HOST_FLAGS1_CIN) !=0;
+            tracker = (fl1 & PCP_HOST_FLAGS1_TRACKER) !=0;
+            firewalled = (fl1 & PCP_HOST_FLAGS1_PUSH) !=0;
+            hub = (fl1 & PCP_HOST_FLAGS1_HUB) !=0;
+        }else if (id == PCP_HOST_ID)
+            atom.readBytes(sessionID.id, 16);
+        else if (id == PCP_HOST_CHANID)
+            atom.readBytes(chanID.id, 16);
+        else if (id == PCP_HOST_UPHOST_IP)
+            uphost.ip = atom.readAddress();
+        else if (id == PCP_HOST_UPHOST_PORT)
+            uphost.port = atom.readInt();
+        else if (id == PCP_HOST_UPHOST_HOPS)
+            uphostHops = atom.readInt();
+        else if (id == PCP_HOST_HEADROOM)
+            headroom = atom.readInt();
+        else if (id == PCP_HOST_MOVE)
+            move = atom.readChar() != 0;
+        else if (id == PCP_HOST_HUB)
+            hubLease = atom.readInt();
+        else if (id == PCP_HOST_HUB_NUML)
+            hubListeners = atom.readInt();
+        else if (id == PCP_HOST_HUB_NUMR)
+            hubRelays = atom.readInt();
+        else
         {
-            atom.writeAddress(PCP_HOST_UPHOST_IP, uphost.ip);
-            atom.writeInt(PCP_HOST_UPHOST_PORT, uphost.port);
-            atom.writeInt(PCP_HOST_UPHOST_HOPS, uphostHops);
+            LOG_DEBUG("PCP skip: %s, %d, %d", id.getString().str(), c, d);
+            atom.skip(c, d);
         }
+    }
 }
 
 // -----------------------------------
@@ -210,11 +373,13 @@ amf0::Value    ChanHit::getState()
         {"isFirewalled", firewalled ? "1" : "0"},
         {"version", ver.empty() ? std::string("-") : ver},
         {"tracker", std::to_string(tracker)},
+        {"headroom", std::to_string(headroom)},
+        {"hub", std::to_string(hub)},
     };
 }
 
 // -----------------------------------
-std::string ChanHit::versionString()
+std::string ChanHit::versionString() const
 {
     using namespace std;
     if (!version)
@@ -276,7 +441,7 @@ int ChanHitList::getTotalListeners()
     while (h)
     {
         if (h->host.ip)
-            cnt += h->numListeners;
+            cnt += h->numListeners + (h->hub ? h->hubListeners : 0);
         h = h->next;
     }
     return cnt;
@@ -290,7 +455,7 @@ int ChanHitList::getTotalRelays()
     while (h)
     {
         if (h->host.ip)
-            cnt += h->numRelays;
+            cnt += h->numRelays + (h->hub ? h->hubRelays : 0);
         h = h->next;
     }
     return cnt;
@@ -333,6 +498,7 @@ std::shared_ptr<ChanHit> ChanHitList::deleteHit(std::shared_ptr<ChanHit> ch)
             else
                 hit = next;
 
+            unindexHit(c);
             return next;
         }
         prev = c;
@@ -354,24 +520,8 @@ std::shared_ptr<ChanHit> ChanHitList::addHit(ChanHit &h)
     lastHitTime = sys->getTime();
     h.time = lastHitTime;
 
-    auto ch = hit;
-    while (ch)
-    {
-        if ((ch->rhost[0].ip == h.rhost[0].ip) &&
-            (ch->rhost[0].port == h.rhost[0].port))
-            if (((ch->rhost[1].ip == h.rhost[1].ip) && (ch->rhost[1].port == h.rhost[1].port)) ||
-                (!ch->rhost[1].isValid()))
-            {
-                if (!ch->dead)
-                {
-                    auto next = ch->next;
-                    *ch = h;
-                    ch->next = next;
-                    return ch;
-                }
-            }
-        ch = ch->next;
-    }
+    if (auto ch = replaceHit(h))
+        return ch;
 
     // clear hits with same session ID (IP may have changed)
     if (h.sessionID.isSet())
@@ -390,42 +540,158 @@ std::shared_ptr<ChanHit> ChanHitList::addHit(ChanHit &h)
     }
 
     // else add new hit
+    return insertHit(h);
+}
+
+// -----------------------------------
+// 同じホストの生きているヒットがあれば h で置き換えて返す。
+std::shared_ptr<ChanHit> ChanHitList::replaceHit(const ChanHit &h)
+{
+    auto range = m_byHost.equal_range(h.rhost[0]);
+    for (auto it = range.first; it != range.second; ++it)
     {
-        auto ch = std::make_shared<ChanHit>();
-        *ch = h;
-        ch->chanID = info.id;
-        ch->next = hit;
-        hit = ch;
-        return ch;
+        auto ch = it->second;
+        if (((ch->rhost[1].ip == h.rhost[1].ip) && (ch->rhost[1].port == h.rhost[1].port)) ||
+            (!ch->rhost[1].isValid()))
+        {
+            if (!ch->dead)
+            {
+                countHit(*ch, -1);
+                auto next = ch->next;
+                *ch = h;
+                ch->next = next;
+                countHit(*ch, +1);
+                touchHit(ch);
+                return ch;
+            }
+        }
     }
-
     return nullptr;
 }
 
+// -----------------------------------
+std::shared_ptr<ChanHit> ChanHitList::insertHit(const ChanHit &h)
+{
+    auto ch = std::make_shared<ChanHit>();
+    *ch = h;
+    ch->chanID = info.id;
+    ch->next = hit;
+    hit = ch;
+    indexHit(ch);
+    evictHits();
+    return ch;
+}
+
+// -----------------------------------
+// addHit を [first, last) の順に呼んだのと同じ結果にする。同じセッ
+// ション ID の古いヒットは、ヒット毎ではなくまとめて一度で消す。
+int ChanHitList::addHits(std::vector<ChanHit>::iterator first, std::vector<ChanHit>::iterator last)
+{
+    const unsigned int ctime = sys->getTime();
+
+    // 同じセッション ID が二度あれば後のものだけを使う。
+    std::unordered_set<GnuID, GnuIDHash, GnuIDEqual> sessions;
+    std::vector<ChanHit*> hits;
+    for (auto it = last; it != first; )
+    {
+        --it;
+        if (servMgr->sessionID.isSame(it->sessionID))
+            continue;
+        if (it->sessionID.isSet() && !sessions.insert(it->sessionID).second)
+            continue;
+        hits.push_back(&*it);
+    }
+    if (hits.empty())
+        return 0;
+    std::reverse(hits.begin(), hits.end());
+
+    lastHitTime = ctime;
+    std::vector<ChanHit*> fresh;
+    for (auto h : hits)
+    {
+        h->time = ctime;
+        if (!replaceHit(*h))
+            fresh.push_back(h);
+    }
+    if (fresh.empty())
+        return 0;
+
+    LOG_DEBUG("Add %d hits", (int) fresh.size());
+
+    // clear hits with same session ID (IP may have changed)
+    std::unordered_set<GnuID, GnuIDHash, GnuIDEqual> freshSessions;
+    for (auto h : fresh)
+        if (h->sessionID.isSet())
+            freshSessions.insert(h->sessionID);
+    if (!freshSessions.empty())
+    {
+        std::unordered_set<ChanHit*> victims;
+        for (auto c = hit; c; c = c->next)
+            if (c->host.ip && freshSessions.count(c->sessionID))
+                victims.insert(c.get());
+        if (!victims.empty())
+            deleteHits(victims);
+    }
+
+    // セッション ID の無い同じホストが二度あれば、後のものが前のもの
+    // を置き換える。
+    for (auto h : fresh)
+        if (!replaceHit(*h))
+            insertHit(*h);
+
+    return (int) fresh.size();
+}
+
 // -----------------------------------
 // 古いヒットを削除し、リストに残ったヒットの数を返す。
+// m_lru は更新時刻の順に並んでいるので、後ろから古いものだけを見る。
+// 何も消さない時はリストをたどらない。
 int ChanHitList::clearDeadHits(unsigned int timeout, bool clearTrackers)
 {
-    int cnt = 0;
     unsigned int ctime = sys->getTime();
 
-    auto ch = hit;
-    while (ch)
+    std::unordered_set<ChanHit*> victims;
+    for (auto it = m_lru.rbegin(); it != m_lru.rend(); ++it)
     {
-        if (ch->host.ip)
+        auto& ch = *it;
+        if (!ch->host.ip)
+            continue;
+        if ((ctime - ch->time) <= timeout)
+            break;
+        if (clearTrackers || !ch->tracker)
+            victims.insert(ch.get());
+    }
+
+    for (auto& ch : m_dead)
+        if (m_lruPos.count(ch.get()))
+            victims.insert(ch.get());
+    m_dead.clear();
+
+    if (!victims.empty())
+        deleteHits(victims);
+
+    return m_numHits;
+}
+
+// -----------------------------------
+// victims に入っているヒットをまとめて削除する。
+void ChanHitList::deleteHits(const std::unordered_set<ChanHit*>& victims)
+{
+    std::shared_ptr<ChanHit> c = hit, prev = nullptr;
+    while (c)
+    {
+        auto next = c->next;
+        if (victims.count(c.get()))
         {
-            bool oldEnough = (ctime - ch->time) > timeout;
-            if (ch->dead ||
-                (oldEnough && (clearTrackers || !ch->tracker)))
-            {
-                ch = deleteHit(ch);
-                continue;
-            }else
-                cnt++;
-        }
-        ch = ch->next;
+            if (prev)
+                prev->next = next;
+            else
+                hit = next;
+            unindexHit(c);
+        }else
+            prev = c;
+        c = next;
     }
-    return cnt;
 }
 
 // -----------------------------------
@@ -433,15 +699,18 @@ void    ChanHitList::deadHit(ChanHit &h)
 {
     LOG_DEBUG("Dead hit: %s/%s", h.rhost[0].str().c_str(), h.rhost[1].str().c_str());
 
-    auto ch = hit;
-    while (ch)
+    auto range = m_byHost.equal_range(h.rhost[0]);
+    for (auto it = range.first; it != range.second; ++it)
     {
+        auto& ch = it->second;
         if (ch->host.ip)
-            if (ch->rhost[0].isSame(h.rhost[0]) && ch->rhost[1].isSame(h.rhost[1]))
+            if (ch->rhost[1].isSame(h.rhost[1]))
             {
+                if (!ch->dead)
+                    m_dead.push_back(ch);
+                countHit(*ch, -1);
                 ch->dead = true;
             }
-        ch = ch->next;
     }
 }
 
@@ -450,90 +719,147 @@ void    ChanHitList::delHit(ChanHit &h)
 {
     LOG_DEBUG("Del hit: %s/%s", h.rhost[0].str().c_str(), h.rhost[1].str().c_str());
 
-    auto ch = hit;
-    while (ch)
+    // deleteHit が索引を書き換えるので、先に集めておく。
+    std::vector<std::shared_ptr<ChanHit>> victims;
+    auto range = m_byHost.equal_range(h.rhost[0]);
+    for (auto it = range.first; it != range.second; ++it)
     {
+        auto& ch = it->second;
         if (ch->host.ip)
-            if (ch->rhost[0].isSame(h.rhost[0]) && ch->rhost[1].isSame(h.rhost[1]))
-            {
-                ch = deleteHit(ch);
-                continue;
-            }
-        ch = ch->next;
+            if (ch->rhost[1].isSame(h.rhost[1]))
+                victims.push_back(ch);
     }
+
+    for (auto& ch : victims)
+        deleteHit(ch);
 }
 
 // -----------------------------------
 int ChanHitList::numHits()
 {
-    int cnt = 0;
-    auto ch = hit;
-    while (ch)
-    {
-        if (ch->host.ip && !ch->dead)
-            cnt++;
-        ch = ch->next;
-    }
-
-    return cnt;
+    return m_numHits;
 }
 
 // -----------------------------------
 int ChanHitList::numListeners()
 {
-    int cnt = 0;
-    auto ch = hit;
-    while (ch)
-    {
-        if (ch->host.ip && !ch->dead)
-            cnt += ch->numListeners;
-        ch = ch->next;
-    }
-
-    return cnt;
+    return m_numListeners;
 }
 
 // -----------------------------------
 int ChanHitList::numRelays()
 {
-    int cnt = 0;
-    auto ch = hit;
-    while (ch)
-    {
-        if (ch->host.ip && !ch->dead)
-            cnt += ch->numRelays;
-        ch = ch->next;
-    }
-
-    return cnt;
+    return m_numRelays;
 }
 
 // -----------------------------------
 int ChanHitList::numTrackers()
 {
-    int cnt = 0;
-    auto ch = hit;
-    while (ch)
+    return m_numTrackers;
+}
+
+// -----------------------------------
+int ChanHitList::numFirewalled()
+{
+    return m_numFirewalled;
+}
+
+// -----------------------------------
+size_t ChanHitList::HostHash::operator()(const Host& h) const
+{
+    size_t v = h.port;
+    for (auto b : h.ip.addr)
+        v = v * 31 + b;
+    return v;
+}
+
+// -----------------------------------
+// 新しく加えたヒットを索引に入れて数える。
+void ChanHitList::indexHit(const std::shared_ptr<ChanHit>& ch)
+{
+    m_byHost.insert(std::make_pair(ch->rhost[0], ch));
+    m_lru.push_front(ch);
+    m_lruPos[ch.get()] = m_lru.begin();
+    countHit(*ch, +1);
+}
+
+// -----------------------------------
+// リストから外したヒットを索引からも外す。
+void ChanHitList::unindexHit(const std::shared_ptr<ChanHit>& ch)
+{
+    auto range = m_byHost.equal_range(ch->rhost[0]);
+    for (auto it = range.first; it != range.second; ++it)
     {
-        if ((ch->host.ip && !ch->dead) && (ch->tracker))
-            cnt++;
-        ch = ch->next;
+        if (it->second == ch)
+        {
+            m_byHost.erase(it);
+            break;
+        }
     }
-    return cnt;
+
+    auto pos = m_lruPos.find(ch.get());
+    if (pos != m_lruPos.end())
+    {
+        m_lru.erase(pos->second);
+        m_lruPos.erase(pos);
+    }
+
+    countHit(*ch, -1);
 }
 
 // -----------------------------------
-int ChanHitList::numFirewalled()
+void ChanHitList::touchHit(const std::shared_ptr<ChanHit>& ch)
 {
-    int cnt = 0;
-    auto ch = hit;
-    while (ch)
+    auto pos = m_lruPos.find(ch.get());
+    if (pos != m_lruPos.end())
+        m_lru.splice(m_lru.begin(), m_lru, pos->second);
+}
+
+// -----------------------------------
+// 生きているヒットなら集計に sign 倍して足す。
+void ChanHitList::countHit(const ChanHit& h, int sign)
+{
+    // ヒットが変わる時は必ずここを通る。
+    m_generation++;
+
+    if (!h.host.ip || h.dead)
+        return;
+
+    m_numHits += sign;
+    m_numListeners += sign * (int) h.numListeners;
+    m_numRelays += sign * (int) h.numRelays;
+    m_numFirewalled += sign * (h.firewalled ? 1 : 0);
+    m_numTrackers += sign * (h.tracker ? 1 : 0);
+}
+
+// -----------------------------------
+void ChanHitList::evictHits()
+{
+    if (maxHits == 0)
+        return;
+
+    trimHits(maxHits);
+}
+
+// -----------------------------------
+int ChanHitList::trimHits(unsigned int max)
+{
+    int n = 0;
+    while (m_lru.size() > max)
     {
-        if (ch->host.ip && !ch->dead)
-            cnt += ch->firewalled?1:0;
-        ch = ch->next;
+        auto victim = m_lru.back();
+        LOG_DEBUG("Evict hit: %s", victim->rhost[0].str().c_str());
+        deleteHit(victim);
+        n++;
     }
-    return cnt;
+    return n;
+}
+
+// -----------------------------------
+size_t ChanHitList::memoryUsage()
+{
+    // 連結リスト、LRU、索引のノードの分を一つ 64 バイトと見積もる。
+    return sizeof(ChanHitList) + (m_lru.size() + m_dead.size()) * (sizeof(ChanHit) + 64);
 }
 
 // -----------------------------------
@@ -609,9 +935,7 @@ int ChanHitList::pickHits(ChanHitSearch &chs)
 {
     ChanHit best;
     std::shared_ptr<ChanHit> bestP = nullptr;
-    best.init();
-    best.numHops = 255;
-    best.time = 0;
+    double bestCost = 0;
 
     unsigned int ctime = sys->getTime();
 
@@ -622,41 +946,30 @@ int ChanHitList::pickHits(ChanHitSearch &chs)
         {
             if (!chs.excludeID.isSame(c->sessionID))
             if ((chs.waitDelay == 0) || ((ctime - c->lastContact) >= chs.waitDelay))
-            if (c->numHops < best.numHops)
+            if (c->numHops < 255)
             if (c->relay || (!c->relay && chs.useBusyRelays))
             if (c->cin || (!c->cin && chs.useBusyControls))
+            if (chs.trackersOnly == c->tracker)
             {
-                if (chs.trackersOnly && c->tracker)
+                Host host;
+                if (chs.matchHost.ip)
                 {
-                    if (chs.matchHost.ip)
-                    {
-                        if ((c->rhost[0].ip == chs.matchHost.ip) && c->rhost[1].isValid())
-                        {
-                            bestP = c;
-                            best = *c;
-                            best.host = best.rhost[1];  // use lan ip
-                        }
-                    }else if (c->firewalled == chs.useFirewalled)
-                    {
-                        bestP = c;
-                        best = *c;
-                        best.host = best.rhost[0];          // use wan ip
-                    }
-                }else if (!chs.trackersOnly && !c->tracker)
+                    if ((c->rhost[0].ip == chs.matchHost.ip) && c->rhost[1].isValid())
+                        host = c->rhost[1];     // use lan ip
+                }else if (c->firewalled == chs.useFirewalled)
                 {
-                    if (chs.matchHost.ip)
-                    {
-                        if ((c->rhost[0].ip == chs.matchHost.ip) && c->rhost[1].isValid())
-                        {
-                            bestP = c;
-                            best = *c;
-                            best.host = best.rhost[1];  // use lan ip
-                        }
-                    }else if (c->firewalled == chs.useFirewalled)
+                    host = c->rhost[0];         // use wan ip
+                }
+
+                if (host.ip)
+                {
+                    double cost = chs.policy ? chs.policy->cost(*c, host) : c->numHops;
+                    if (!bestP || cost < bestCost)
                     {
                         bestP = c;
+                        bestCost = cost;
                         best = *c;
-                        best.host = best.rhost[0];          // use wan ip
+                        best.host = host;
                     }
                 }
             }
@@ -678,6 +991,177 @@ int ChanHitList::pickHits(ChanHitSearch &chs)
     return 0;
 }
 
+// -----------------------------------
+// m_alternatesLock を取って呼ぶ。
+void ChanHitList::updateAlternates()
+{
+    if (m_alternatesGeneration == m_generation)
+        return;
+
+    m_alternates.clear();
+    for (auto c = hit; c; c = c->next)
+    {
+        // pickHits の既定の条件 (混んでいるリレーとトラッカーを除く)。
+        if (c->host.ip && !c->dead && c->numHops < 255 && c->relay && c->cin && !c->tracker)
+            m_alternates.push_back(c);
+    }
+    // ホップ数が同じならリストの前にあるものを先にする。
+    std::stable_sort(m_alternates.begin(), m_alternates.end(),
+                     [](const std::shared_ptr<ChanHit>& a, const std::shared_ptr<ChanHit>& b)
+                     { return a->numHops < b->numHops; });
+    m_alternatesGeneration = m_generation;
+}
+
+// -----------------------------------
+int ChanHitList::pickAlternates(const Host &rhost, const Host &serverHost, const GnuID &excludeID,
+                                unsigned int waitDelay, ChanHit *out, int max, Locality *locality)
+{
+    std::lock_guard<std::mutex> cs(m_alternatesLock);
+    updateAlternates();
+
+    unsigned int ctime = sys->getTime();
+
+    // matchHost と同じ WAN アドレスのものは LAN のアドレスで、
+    // matchHost が無ければファイアウォール越しでないものを WAN のア
+    // ドレスで。nearOnly なら rhost と同じ地域のものだけ。
+    auto pick = [&](const Host& matchHost, ChanHit& best, bool nearOnly = false) -> bool
+    {
+        for (auto& c : m_alternates)
+        {
+            if (c->dead || excludeID.isSame(c->sessionID))
+                continue;
+            if (waitDelay && (ctime - c->lastContact) < waitDelay)
+                continue;
+
+            Host host;
+            if (matchHost.ip)
+            {
+                if ((c->rhost[0].ip == matchHost.ip) && c->rhost[1].isValid())
+                    host = c->rhost[1];
+            }else if (!c->firewalled)
+                host = c->rhost[0];
+            if (!host.ip)
+                continue;
+            if (nearOnly && !locality->sameRegion(rhost.ip, host.ip))
+                continue;
+
+            if (waitDelay)
+                c->lastContact = ctime;
+            // 書いたものをリストのヒットに残し、次に断る時に使う。
+            c->prepareAtoms();
+            best = *c;
+            best.host = host;
+            best.next = nullptr;
+            return true;
+        }
+        return false;
+    };
+
+    int cnt = 0;
+    while (cnt < max)
+    {
+        ChanHit& best = out[cnt];
+        if (!rhost.globalIP() && pick(serverHost, best))
+            cnt++;
+        else if (pick(rhost, best))
+            cnt++;
+        else if (locality && pick(Host(), best, true))
+            cnt++;
+        else if (pick(Host(), best))
+            cnt++;
+        else
+            break;
+    }
+    return cnt;
+}
+
+// -----------------------------------
+std::vector<ChanHit> ChanHitList::goodRelayHits(int max, RelayStats &stats)
+{
+    WeightedRelayPolicy policy(stats);
+    ChanHitRanking r;
+    r.policy = &policy;
+    r.excludeID = servMgr->sessionID;
+    r.maxPerCategory = ChanHitSearch::MAX_RESULTS * 4;
+    rankHits(r);
+
+    std::vector<ChanHit> res;
+    for (auto& cand : r.candidates[ChanHitRanking::GLOBAL_RELAY])
+    {
+        if ((int) res.size() >= max)
+            break;
+
+        RelayStats::Entry e;
+        if (stats.get(cand.hit.host, e) && e.failures &&
+            sys->getDTime() - e.lastFailure < WeightedRelayPolicy::FAILURE_WINDOW)
+            continue;
+        res.push_back(cand.hit);
+    }
+    return res;
+}
+
+// -----------------------------------
+int ChanHitList::rankHits(ChanHitRanking &r)
+{
+    for (auto& list : r.candidates)
+        list.clear();
+
+    unsigned int ctime = sys->getTime();
+
+    auto add = [&](int category, const std::shared_ptr<ChanHit>& c, const Host& host)
+    {
+        ChanHitRanking::Candidate cand;
+        cand.hit = *c;
+        cand.hit.host = host;
+        cand.hit.next = nullptr;
+        cand.cost = r.policy ? r.policy->cost(*c, host) : c->numHops;
+        cand.entry = c;
+        r.candidates[category].push_back(cand);
+    };
+
+    for (auto c = hit; c; c = c->next)
+    {
+        if (!c->host.ip || c->dead || c->numHops >= 255)
+            continue;
+        if (r.excludeID.isSame(c->sessionID))
+            continue;
+
+        unsigned int wait = c->tracker ? r.trackerWait : r.relayWait;
+        if (wait && (ctime - c->lastContact) < wait)
+            continue;
+
+        int local = c->tracker ? ChanHitRanking::LOCAL_TRACKER : ChanHitRanking::LOCAL_RELAY;
+        int global = c->tracker ? ChanHitRanking::GLOBAL_TRACKER : ChanHitRanking::GLOBAL_RELAY;
+
+        if (r.matchHost.ip && (c->rhost[0].ip == r.matchHost.ip) && c->rhost[1].isValid())
+            add(local, c, c->rhost[1]);     // use lan ip
+        if (!c->firewalled && c->rhost[0].ip)
+            add(global, c, c->rhost[0]);    // use wan ip
+    }
+
+    int total = 0;
+    for (auto& list : r.candidates)
+    {
+        // 評価が同じならリストの前にあるものを先にする。
+        std::stable_sort(list.begin(), list.end(),
+                         [](const ChanHitRanking::Candidate& a, const ChanHitRanking::Candidate& b)
+                         { return a.cost < b.cost; });
+        if ((int) list.size() > r.maxPerCategory)
+            list.resize(r.maxPerCategory);
+        total += list.size();
+    }
+    return total;
+}
+
+// -----------------------------------
+std::vector<ChanHitRanking::Candidate> ChanHitRanking::ordered() const
+{
+    std::vector<Candidate> res;
+    for (auto& list : candidates)
+        res.insert(res.end(), list.begin(), list.end());
+    return res;
+}
+
 // -----------------------------------
 void ChanHitSearch::init()
 {
@@ -689,4 +1173,5 @@ void ChanHitSearch::init()
     useBusyControls = true;
     excludeID.clear();
     numResults = 0;
+    policy = nullptr;
 }
@@ -20,13 +20,23 @@
 #define _CHANHIT_H
 
 #include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "host.h"
 #include "chaninfo.h"
 #include "xml.h"
+#include "lockprof.h"
 
 class AtomStream;
 class ChanHitSearch;
+class ChanHitRanking;
+class RelayPolicy;
+class RelayStats;
+class Locality;
 
 // ----------------------------------
 class ChanHit : public VariableWriter
@@ -37,8 +47,27 @@ public:
     void    init();
     void    initLocal(int numl, int numr, int nums, int uptm, bool, unsigned int, unsigned int, bool canAddRelay, const Host& = Host(), bool ipv6 = false);
     XML::Node *createXML();
+    // createXML() の名前と属性を buf に書く。
+    void    getXMLTag(char *buf, size_t size);
 
-    void    writeAtoms(AtomStream &, const GnuID &);
+    // numExtra は呼び出し側が続けて書く子アトムの数。
+    void    writeAtoms(AtomStream &, const GnuID &, int numExtra = 0);
+    // PCP_HOST の numc 個の子アトムを読む。PCP_HOST_CHANID があれば
+    // chanID に、移動の指示とハブの任期はそれぞれ move と hubLease に
+    // 入れる。知らないアトムは読み飛ばす。
+    void    readAtoms(AtomStream &, int numc, GnuID &chanID, bool &move, unsigned int &hubLease);
+
+    // writeAtoms が書く子アトム (PCP_HOST_CHANID を除く) を書いておいた
+    // もの。書いた時の値を key に持ち、値が変わっていなければ次からは
+    // そのまま写す。ヒットをコピーすると共有される。
+    enum { ATOM_KEY_SIZE = 128 };
+    struct AtomCache
+    {
+        unsigned char key[ATOM_KEY_SIZE];
+        std::string   data;
+        int           numChildren;
+    };
+    std::shared_ptr<const AtomCache> prepareAtoms();
     amf0::Value getState() override;
 
     void    pickNearestIP(Host &);
@@ -65,11 +94,20 @@ public:
     Host            uphost;
     unsigned int    uphostHops;
 
+    // 上りの帯域の残り (kbps)。分からなければ -1。
+    int             headroom;
+
+    // トラッカーからヒットの集約を任されたハブなら、まとめた下流の数。
+    bool            hub;
+    unsigned int    hubListeners, hubRelays;
+
     unsigned int    versionVP;
     char            versionExPrefix[2];
     unsigned int    versionExNumber;
 
-    std::string versionString();
+    std::shared_ptr<const AtomCache> atomCache;
+
+    std::string versionString() const;
     std::string str(bool withPort = false);
 
     bool canGiv();
@@ -113,6 +151,8 @@ public:
     int          contactTrackers(bool, int, int, int);
 
     std::shared_ptr<ChanHit> addHit(ChanHit &);
+    // まとめて届いたヒットを一度に加える。新しく加えた数を返す。
+    int          addHits(std::vector<ChanHit>::iterator first, std::vector<ChanHit>::iterator last);
     void         delHit(ChanHit &);
     void         deadHit(ChanHit &);
     int          numHits();
@@ -125,10 +165,23 @@ public:
     unsigned int newestHit();
 
     int          pickHits(ChanHitSearch &);
+    int          rankHits(ChanHitRanking &);
+    // 再起動した後に上流の候補にするヒット。直接接続できるリレーのう
+    // ち、最近失敗していないものを評価の良い順に max 個まで。
+    std::vector<ChanHit> goodRelayHits(int max, RelayStats &stats);
+    // 接続を断った rhost に教えるリレーを out に max 個まで入れて数を
+    // 返す。順番に LAN 内 (rhost が LAN の時)、rhost と同じネットワー
+    // ク、その他のネットワークから探す。pickHits をこの順に繰り返した
+    // のと同じ結果になるが、ヒットのリストはヒットが変わった時にだけ
+    // たどる。locality があれば、その他のネットワークの前に rhost と
+    // 同じ地域のものを探す。
+    int          pickAlternates(const Host &rhost, const Host &serverHost, const GnuID &excludeID,
+                                unsigned int waitDelay, ChanHit *out, int max, Locality *locality = nullptr);
 
     bool         isUsed() { return used; }
     int          clearDeadHits(unsigned int, bool);
     XML::Node    *createXML(bool addHits = true);
+    void         getXMLTag(char *buf, size_t size);
 
     std::shared_ptr<ChanHit> deleteHit(std::shared_ptr<ChanHit>);
 
@@ -138,13 +191,69 @@ public:
 
     void         forEachHit(std::function<void(ChanHit*)> block);
 
-    std::recursive_mutex lock;
+    // 一番長く更新されていないものから、ヒットを max 個まで減らす。
+    // 捨てた数を返す。
+    int          trimHits(unsigned int max);
+    // ヒットが使っているおよそのバイト数。
+    size_t       memoryUsage();
+
+    // ヒットが追加・更新・削除される度に進む数。
+    unsigned int generation() const { return m_generation; }
+
+    ProfiledMutex lock { "ChanHitList::lock" };
 
     bool         used;
     ChanInfo     info;
     std::shared_ptr<ChanHit> hit;
     unsigned int lastHitTime;
     std::shared_ptr<ChanHitList> next;
+
+    // ヒットの数の上限。0 なら制限しない。超えた時は一番長く更新され
+    // ていないヒットを捨てる。
+    unsigned int maxHits;
+
+private:
+    struct HostHash
+    {
+        size_t operator()(const Host& h) const;
+    };
+
+    typedef std::list<std::shared_ptr<ChanHit>> LRUList;
+
+    std::shared_ptr<ChanHit> replaceHit(const ChanHit&);
+    std::shared_ptr<ChanHit> insertHit(const ChanHit&);
+    void         indexHit(const std::shared_ptr<ChanHit>&);
+    void         unindexHit(const std::shared_ptr<ChanHit>&);
+    void         touchHit(const std::shared_ptr<ChanHit>&);
+    void         countHit(const ChanHit&, int sign);
+    void         evictHits();
+    void         deleteHits(const std::unordered_set<ChanHit*>&);
+    void         updateAlternates();
+
+    // rhost[0] からヒットを引く索引。
+    std::unordered_multimap<Host, std::shared_ptr<ChanHit>, HostHash> m_byHost;
+
+    // 前にあるほど最近更新されたヒット。
+    LRUList      m_lru;
+    std::unordered_map<ChanHit*, LRUList::iterator> m_lruPos;
+
+    // deadHit で死んだ印を付けられ、まだ削除していないヒット。
+    std::vector<std::shared_ptr<ChanHit>> m_dead;
+
+    // 生きているヒット (host.ip があり dead でない) についての集計。
+    int          m_numHits;
+    int          m_numListeners;
+    int          m_numRelays;
+    int          m_numFirewalled;
+    int          m_numTrackers;
+
+    unsigned int m_generation;
+
+    // pickAlternates の候補。リレーできるヒットをホップ数の順に並べた
+    // もの。m_alternatesGeneration が m_generation と違えば作り直す。
+    std::mutex   m_alternatesLock;
+    std::vector<std::shared_ptr<ChanHit>> m_alternates;
+    unsigned int m_alternatesGeneration;
 };
 
 // ----------------------------------
@@ -167,6 +276,53 @@ public:
     bool            useBusyRelays, useBusyControls;
     GnuID           excludeID;
     int             numResults;
+
+    // 候補の評価。nullptr ならホップ数の一番少ないものを選ぶ。
+    const RelayPolicy* policy;
+};
+
+// ----------------------------------
+// ChanHitList::rankHits の条件と結果。pickHits を条件を変えて何度も呼
+// ぶ代わりに、ヒットのリストを一度だけ見て、LAN 内のリレー、WAN のリ
+// レー、LAN 内のトラッカー、WAN のトラッカーの候補をまとめて作る。
+class ChanHitRanking
+{
+public:
+    enum Category
+    {
+        LOCAL_RELAY,
+        GLOBAL_RELAY,
+        LOCAL_TRACKER,
+        GLOBAL_TRACKER,
+        NUM_CATEGORIES
+    };
+
+    struct Candidate
+    {
+        ChanHit                  hit;   // host は接続に使うアドレス
+        double                   cost;
+        std::shared_ptr<ChanHit> entry; // リストの中のヒット
+    };
+
+    ChanHitRanking()
+        : relayWait(0)
+        , trackerWait(0)
+        , maxPerCategory(ChanHitSearch::MAX_RESULTS)
+        , policy(nullptr)
+    {}
+
+    // 全ての種類の候補を上の順に繋げたもの。
+    std::vector<Candidate> ordered() const;
+
+    Host            matchHost;      // 自分の WAN アドレス。LAN の候補を探す
+    GnuID           excludeID;
+    unsigned int    relayWait;      // リレーに最後に接続してから空ける秒数
+    unsigned int    trackerWait;    // トラッカーに最後に接続してから空ける秒数
+    int             maxPerCategory;
+    const RelayPolicy* policy;      // nullptr ならホップ数の順
+
+    // 種類ごとに評価の低い順。
+    std::vector<Candidate> candidates[NUM_CATEGORIES];
 };
 
 #endif
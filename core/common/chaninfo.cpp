@@ -22,6 +22,7 @@
 #include "chanmgr.h"
 #include "playlist.h"
 #include "cgi.h"
+#include "sstream.h"
 
 const ::String ChanInfo::T_UNKNOWN = "UNKNOWN";
 const ::String ChanInfo::T_RAW = "RAW";
@@ -362,6 +363,24 @@ bool ChanInfo::update(const ChanInfo &info)
         changed = true;
     }
 
+    if (lowLatency != info.lowLatency)
+    {
+        lowLatency = info.lowLatency;
+        changed = true;
+    }
+
+    if (!groupID.isSame(info.groupID))
+    {
+        groupID = info.groupID;
+        changed = true;
+    }
+
+    if (!rendition.isSame(info.rendition))
+    {
+        rendition = info.rendition;
+        changed = true;
+    }
+
     if (!desc.isSame(info.desc))
     {
         desc = info.desc;
@@ -416,6 +435,9 @@ void ChanInfo::init()
     contentType = T_UNKNOWN;
     MIMEType.clear();
     streamExt.clear();
+    lowLatency = false;
+    groupID.clear();
+    rendition.clear();
     srcProtocol = SP_UNKNOWN;
     id.clear();
     url.clear();
@@ -447,6 +469,15 @@ unsigned int ChanInfo::getAge()
     return sys->getTime()-createdTime;
 }
 
+// ------------------------------------------
+// 文字列のアトムを s に読む。s の種類は変えない。
+static void readString(AtomStream &atom, CompactString &s, int d)
+{
+    char buf[CompactString::MAX_LEN];
+    atom.readString(buf, sizeof(buf), d);
+    s.set(buf, s.type);
+}
+
 // ------------------------------------------
 void ChanInfo::readTrackAtoms(AtomStream &atom, int numc)
 {
@@ -456,16 +487,16 @@ void ChanInfo::readTrackAtoms(AtomStream &atom, int numc)
         ID4 id = atom.read(c, d);
         if (id == PCP_CHAN_TRACK_TITLE)
         {
-            atom.readString(track.title.data, sizeof(track.title.data), d);
+            readString(atom, track.title, d);
         }else if (id == PCP_CHAN_TRACK_CREATOR)
         {
-            atom.readString(track.artist.data, sizeof(track.artist.data), d);
+            readString(atom, track.artist, d);
         }else if (id == PCP_CHAN_TRACK_URL)
         {
-            atom.readString(track.contact.data, sizeof(track.contact.data), d);
+            readString(atom, track.contact, d);
         }else if (id == PCP_CHAN_TRACK_ALBUM)
         {
-            atom.readString(track.album.data, sizeof(track.album.data), d);
+            readString(atom, track.album, d);
         }else
             atom.skip(c, d);
     }
@@ -480,31 +511,40 @@ void ChanInfo::readInfoAtoms(AtomStream &atom, int numc)
         ID4 id = atom.read(c, d);
         if (id == PCP_CHAN_INFO_NAME)
         {
-            atom.readString(name.data, sizeof(name.data), d);
+            readString(atom, name, d);
         }else if (id == PCP_CHAN_INFO_BITRATE)
         {
             bitrate = atom.readInt();
         }else if (id == PCP_CHAN_INFO_GENRE)
         {
-            atom.readString(genre.data, sizeof(genre.data), d);
+            readString(atom, genre, d);
         }else if (id == PCP_CHAN_INFO_URL)
         {
-            atom.readString(url.data, sizeof(url.data), d);
+            readString(atom, url, d);
         }else if (id == PCP_CHAN_INFO_DESC)
         {
-            atom.readString(desc.data, sizeof(desc.data), d);
+            readString(atom, desc, d);
         }else if (id == PCP_CHAN_INFO_COMMENT)
         {
-            atom.readString(comment.data, sizeof(comment.data), d);
+            readString(atom, comment, d);
         }else if (id == PCP_CHAN_INFO_TYPE)
         {
             atom.readString(contentType.data, sizeof(contentType.data), d);
         }else if (id == PCP_CHAN_INFO_STREAMTYPE)
         {
-            atom.readString(MIMEType.data, sizeof(MIMEType.data), d);
+            readString(atom, MIMEType, d);
         }else if (id == PCP_CHAN_INFO_STREAMEXT)
         {
-            atom.readString(streamExt.data, sizeof(streamExt.data), d);
+            readString(atom, streamExt, d);
+        }else if (id == PCP_CHAN_INFO_LOWLATENCY)
+        {
+            lowLatency = atom.readChar() != 0;
+        }else if (id == PCP_CHAN_INFO_GROUP && d == 16)
+        {
+            atom.readBytes(groupID.id, 16);
+        }else if (id == PCP_CHAN_INFO_RENDITION)
+        {
+            readString(atom, rendition, d);
         }else
             atom.skip(c, d);
     }
@@ -517,6 +557,8 @@ void ChanInfo::writeInfoAtoms(AtomStream &atom)
 
     natoms += !MIMEType.isEmpty();
     natoms += !streamExt.isEmpty();
+    natoms += lowLatency;
+    natoms += groupID.isSet() ? 2 : 0;
 
     atom.writeParent(PCP_CHAN_INFO, natoms);
         atom.writeString(PCP_CHAN_INFO_NAME, name.cstr());
@@ -530,6 +572,13 @@ void ChanInfo::writeInfoAtoms(AtomStream &atom)
             atom.writeString(PCP_CHAN_INFO_STREAMTYPE, MIMEType.cstr());
         if (!streamExt.isEmpty())
             atom.writeString(PCP_CHAN_INFO_STREAMEXT, streamExt.cstr());
+        if (lowLatency)
+            atom.writeChar(PCP_CHAN_INFO_LOWLATENCY, 1);
+        if (groupID.isSet())
+        {
+            atom.writeBytes(PCP_CHAN_INFO_GROUP, groupID.id, 16);
+            atom.writeString(PCP_CHAN_INFO_RENDITION, rendition.cstr());
+        }
 }
 
 // -----------------------------------
@@ -542,25 +591,100 @@ void ChanInfo::writeTrackAtoms(AtomStream &atom)
         atom.writeString(PCP_CHAN_TRACK_ALBUM, track.album.cstr());
 }
 
+// -----------------------------------
+int ChanInfo::writeDeltaAtoms(AtomStream &atom, const ChanInfo &prev)
+{
+    // 子の数が先に要るので、一度別に書いてから写す。
+    StringStream infoMem, trackMem;
+    AtomStream infoAtom(infoMem), trackAtom(trackMem);
+    int ninfo = 0, ntrack = 0;
+
+    auto diff = [](AtomStream &a, int &n, ID4 id, const CompactString &cur, const CompactString &old)
+    {
+        if (!cur.isSame(old))
+        {
+            a.writeString(id, cur.cstr());
+            n++;
+        }
+    };
+
+    diff(infoAtom, ninfo, PCP_CHAN_INFO_NAME, name, prev.name);
+    if (bitrate != prev.bitrate)
+    {
+        infoAtom.writeInt(PCP_CHAN_INFO_BITRATE, bitrate);
+        ninfo++;
+    }
+    diff(infoAtom, ninfo, PCP_CHAN_INFO_GENRE, genre, prev.genre);
+    diff(infoAtom, ninfo, PCP_CHAN_INFO_URL, url, prev.url);
+    diff(infoAtom, ninfo, PCP_CHAN_INFO_DESC, desc, prev.desc);
+    diff(infoAtom, ninfo, PCP_CHAN_INFO_COMMENT, comment, prev.comment);
+    if (!contentType.isSame(prev.contentType.c_str()))
+    {
+        infoAtom.writeString(PCP_CHAN_INFO_TYPE, getTypeStr());
+        ninfo++;
+    }
+    diff(infoAtom, ninfo, PCP_CHAN_INFO_STREAMTYPE, MIMEType, prev.MIMEType);
+    diff(infoAtom, ninfo, PCP_CHAN_INFO_STREAMEXT, streamExt, prev.streamExt);
+    // 全部を書く時と違って、無くなったことも伝える。
+    if (lowLatency != prev.lowLatency)
+    {
+        infoAtom.writeChar(PCP_CHAN_INFO_LOWLATENCY, lowLatency);
+        ninfo++;
+    }
+    if (!groupID.isSame(prev.groupID))
+    {
+        infoAtom.writeBytes(PCP_CHAN_INFO_GROUP, groupID.id, 16);
+        ninfo++;
+    }
+    diff(infoAtom, ninfo, PCP_CHAN_INFO_RENDITION, rendition, prev.rendition);
+
+    diff(trackAtom, ntrack, PCP_CHAN_TRACK_TITLE, track.title, prev.track.title);
+    diff(trackAtom, ntrack, PCP_CHAN_TRACK_CREATOR, track.artist, prev.track.artist);
+    diff(trackAtom, ntrack, PCP_CHAN_TRACK_URL, track.contact, prev.track.contact);
+    diff(trackAtom, ntrack, PCP_CHAN_TRACK_ALBUM, track.album, prev.track.album);
+
+    if (ninfo)
+    {
+        atom.writeParent(PCP_CHAN_INFO, ninfo);
+        auto s = infoMem.str();
+        atom.io.write(s.data(), s.size());
+    }
+    if (ntrack)
+    {
+        atom.writeParent(PCP_CHAN_TRACK, ntrack);
+        auto s = trackMem.str();
+        atom.io.write(s.data(), s.size());
+    }
+    return (ninfo > 0) + (ntrack > 0);
+}
+
 // -----------------------------------
 XML::Node *ChanInfo::createChannelXML()
 {
-    String nameUNI = name;
+    char tag[XML::MAX_TAGLEN];
+    getChannelXMLTag(tag, sizeof(tag));
+    return new XML::Node("%s", tag);
+}
+
+// -----------------------------------
+void ChanInfo::getChannelXMLTag(char *buf, size_t size)
+{
+    String nameUNI = name.toString();
     nameUNI.convertTo(String::T_UNICODESAFE);
 
-    String urlUNI = url;
+    String urlUNI = url.toString();
     urlUNI.convertTo(String::T_UNICODESAFE);
 
-    String genreUNI = genre;
+    String genreUNI = genre.toString();
     genreUNI.convertTo(String::T_UNICODESAFE);
 
-    String descUNI = desc;
+    String descUNI = desc.toString();
     descUNI.convertTo(String::T_UNICODESAFE);
 
-    String commentUNI = comment;
+    String commentUNI = comment.toString();
     commentUNI.convertTo(String::T_UNICODESAFE);
 
-    return new XML::Node("channel name=\"%s\" id=\"%s\" bitrate=\"%d\" type=\"%s\" genre=\"%s\" desc=\"%s\" url=\"%s\" uptime=\"%d\" comment=\"%s\" skips=\"%d\" age=\"%d\" bcflags=\"%d\"",
+    snprintf(buf, size, "channel name=\"%s\" id=\"%s\" bitrate=\"%d\" type=\"%s\" genre=\"%s\" desc=\"%s\" url=\"%s\" uptime=\"%d\" comment=\"%s\" skips=\"%d\" age=\"%d\" bcflags=\"%d\"",
         nameUNI.cstr(),
         id.str().c_str(),
         bitrate,
@@ -590,22 +714,30 @@ XML::Node *ChanInfo::createRelayChannelXML()
 // -----------------------------------
 XML::Node *ChanInfo::createTrackXML()
 {
-    String titleUNI = track.title;
+    char tag[XML::MAX_TAGLEN];
+    getTrackXMLTag(tag, sizeof(tag));
+    return new XML::Node("%s", tag);
+}
+
+// -----------------------------------
+void ChanInfo::getTrackXMLTag(char *buf, size_t size)
+{
+    String titleUNI = track.title.toString();
     titleUNI.convertTo(String::T_UNICODESAFE);
 
-    String artistUNI = track.artist;
+    String artistUNI = track.artist.toString();
     artistUNI.convertTo(String::T_UNICODESAFE);
 
-    String albumUNI = track.album;
+    String albumUNI = track.album.toString();
     albumUNI.convertTo(String::T_UNICODESAFE);
 
-    String genreUNI = track.genre;
+    String genreUNI = track.genre.toString();
     genreUNI.convertTo(String::T_UNICODESAFE);
 
-    String contactUNI = track.contact;
+    String contactUNI = track.contact.toString();
     contactUNI.convertTo(String::T_UNICODESAFE);
 
-    return new XML::Node("track title=\"%s\" artist=\"%s\" album=\"%s\" genre=\"%s\" contact=\"%s\"",
+    snprintf(buf, size, "track title=\"%s\" artist=\"%s\" album=\"%s\" genre=\"%s\" contact=\"%s\"",
         titleUNI.cstr(),
         artistUNI.cstr(),
         albumUNI.cstr(),
@@ -709,6 +841,9 @@ amf0::Value ChanInfo::getState()
             {"genre", genre.c_str()},
             {"url", url.c_str()},
             {"comment", comment.c_str()},
+            {"lowLatency", lowLatency},
+            {"groupID", groupID.isSet() ? groupID.str() : ""},
+            {"rendition", rendition.c_str()},
         });
 }
 
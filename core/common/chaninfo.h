@@ -27,6 +27,7 @@
 #include "atom.h"
 #include "http.h"
 #include "varwriter.h"
+#include "compactstring.h"
 
 // ----------------------------------
 class TrackInfo
@@ -52,7 +53,7 @@ public:
 
     bool    update(const TrackInfo &);
 
-    ::String    contact, title, artist, album, genre;
+    CompactString   contact, title, artist, album, genre;
 };
 
 // ----------------------------------
@@ -107,12 +108,18 @@ public:
     XML::Node   *createChannelXML();
     XML::Node   *createRelayChannelXML();
     XML::Node   *createTrackXML();
+    // create*XML() の名前と属性を buf に書く。
+    void        getChannelXMLTag(char *buf, size_t size);
+    void        getTrackXMLTag(char *buf, size_t size);
     bool        match(XML::Node *);
     bool        match(ChanInfo &);
     bool        matchNameID(ChanInfo &);
 
     void    writeInfoAtoms(AtomStream &atom);
     void    writeTrackAtoms(AtomStream &atom);
+    // prev から変わった項目だけの PCP_CHAN_INFO と PCP_CHAN_TRACK を書
+    // き、書いた親アトムの数を返す。受け手は今の情報に重ねて読む。
+    int     writeDeltaAtoms(AtomStream &atom, const ChanInfo &prev);
 
     void    readInfoAtoms(AtomStream &, int);
     void    readTrackAtoms(AtomStream &, int);
@@ -138,7 +145,7 @@ public:
 
     void setContentType(TYPE type);
 
-    ::String        name;
+    CompactString   name;
     GnuID           id, bcID;
     int             bitrate;
 
@@ -146,8 +153,17 @@ public:
     // とりするので、冗長な気がする。
 
     ::String        contentType;
-    ::String        MIMEType;       // MIME タイプ
-    String          streamExt;      // "." で始まる拡張子
+    CompactString   MIMEType;       // MIME タイプ
+    CompactString   streamExt;      // "." で始まる拡張子
+
+    // 低遅延モード。パケットをまとめずにすぐに中継する。PCP でリレー
+    // 先にも伝わる。
+    bool            lowLatency;
+
+    // サイマル配信のグループ。同じグループのチャンネルは同じ番組の別
+    // の画質で、PCP でリレー先にも伝わる (changroup.h)。
+    GnuID           groupID;
+    CompactString   rendition;      // "720p" などの画質の名前
 
     PROTOCOL        srcProtocol;
     unsigned int    lastPlayStart, lastPlayEnd;
@@ -157,7 +173,7 @@ public:
     STATUS          status;
 
     TrackInfo       track;
-    ::String        desc, genre, url, comment;
+    CompactString   desc, genre, url, comment;
 };
 
 #endif
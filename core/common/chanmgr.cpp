@@ -1,9 +1,15 @@
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
 #include "chanmgr.h"
 
 #include "playlist.h"
 #include "peercast.h"
 #include "version2.h" // PCP_BROADCAST_FLAGS
 #include "md5.h"
+#include "str.h"
+#include "eventbus.h"
+#include "coldchan.h"
 
 // -----------------------------------
 void ChanMgr::quit()
@@ -15,13 +21,13 @@ void ChanMgr::quit()
 // -----------------------------------
 int ChanMgr::numIdleChannels()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     int cnt = 0;
     auto ch = channel;
     while (ch)
     {
-        std::lock_guard<std::recursive_mutex> cs(ch->lock);
+        std::lock_guard<ProfiledMutex> cs(ch->lock);
 
         if (ch->isActive())
             if (ch->thread.active())
@@ -41,7 +47,7 @@ void ChanMgr::closeIdles()
     // チャンネルリストをコピーする。
     std::vector<std::shared_ptr<Channel>> channels;
     {
-        std::lock_guard<std::recursive_mutex> cs(lock);
+        std::lock_guard<ProfiledMutex> cs(lock);
         for (auto ch = channel; ch; ch = ch->next)
             channels.push_back(ch);
     }
@@ -50,6 +56,8 @@ void ChanMgr::closeIdles()
     {
         if (ch->isIdle())
         {
+            if (servMgr->flags[ServMgr::F_warmResume])
+                g_coldChannels.store(*ch);
             ch->thread.shutdown();
             sys->waitThread(&ch->thread);
         }
@@ -57,7 +65,7 @@ void ChanMgr::closeIdles()
 }
 
 // -----------------------------------
-void ChanMgr::closeOldestIdle()
+bool ChanMgr::closeOldestIdle()
 {
     unsigned int idleTime = (unsigned int)-1;
     std::shared_ptr<Channel> ch = channel, oldest = nullptr;
@@ -75,8 +83,12 @@ void ChanMgr::closeOldestIdle()
         ch = ch->next;
     }
 
-    if (oldest)
-        oldest->thread.shutdown();
+    if (!oldest)
+        return false;
+    if (servMgr->flags[ServMgr::F_warmResume])
+        g_coldChannels.store(*oldest);
+    oldest->thread.shutdown();
+    return true;
 }
 
 // -----------------------------------
@@ -94,11 +106,11 @@ void ChanMgr::closeAll()
 // -----------------------------------
 std::shared_ptr<Channel>ChanMgr::findChannelByNameID(ChanInfo &info)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
     auto ch = channel;
     while (ch)
     {
-        std::lock_guard<std::recursive_mutex> cs1(ch->lock);
+        std::lock_guard<ProfiledMutex> cs1(ch->lock);
         if (ch->isActive())
             if (ch->info.matchNameID(info))
                 return ch;
@@ -146,7 +158,7 @@ std::shared_ptr<Channel> ChanMgr::findChannelByMount(const char *str)
     auto ch = channel;
     while (ch)
     {
-        std::lock_guard<std::recursive_mutex> lock(ch->lock);
+        std::lock_guard<ProfiledMutex> lock(ch->lock);
         if (ch->isActive())
             if (strcmp(ch->mount, str) == 0)
                 return ch;
@@ -159,13 +171,25 @@ std::shared_ptr<Channel> ChanMgr::findChannelByMount(const char *str)
 // -----------------------------------
 std::shared_ptr<Channel> ChanMgr::findChannelByID(const GnuID &id)
 {
-    auto ch = channel;
+    auto ch = channelIndex.find(id);
+    if (ch)
+    {
+        std::lock_guard<ProfiledMutex> lock(ch->lock);
+        if (ch->isActive() && ch->info.id.isSame(id))
+            return ch;
+    }
+
+    // 索引に無いか古くなっている。
+    ch = channel;
     while (ch)
     {
-        std::lock_guard<std::recursive_mutex> lock(ch->lock);
+        std::lock_guard<ProfiledMutex> lock(ch->lock);
         if (ch->isActive())
             if (ch->info.id.isSame(id))
+            {
+                channelIndex.insert(id, ch);
                 return ch;
+            }
         ch = ch->next;
     }
     return nullptr;
@@ -215,6 +239,8 @@ std::shared_ptr<Channel> ChanMgr::createRelay(ChanInfo &info, bool stayConnected
     auto c = chanMgr->createChannel(info);
     if (c)
     {
+        if (servMgr->flags[ServMgr::F_warmResume])
+            g_coldChannels.restore(*c);
         c->stayConnected = stayConnected;
         c->startGet();
         return c;
@@ -244,6 +270,8 @@ std::shared_ptr<Channel> ChanMgr::findAndRelay(ChanInfo &info)
         c = chanMgr->createChannel(info);
         if (c)
         {
+            if (servMgr->flags[ServMgr::F_warmResume])
+                g_coldChannels.restore(*c);
             c->setStatus(Channel::S_SEARCHING);
             c->startGet();
         }
@@ -303,6 +331,13 @@ ChanMgr::ChanMgr()
     hostUpdateInterval = 120; // 2 minutes
 
     bufferTime = 5;
+    packetBufferDuration = 0;
+    joinKeyFramesBack = 0;
+    maxHitsPerChannel = 1000;
+    dvrSize = 0;
+    recordSegmentSeconds = 3600;
+    memoryBudget = 0;
+    ingestJitterMsec = 0;
 
     lastYPConnect = 0;
 }
@@ -329,6 +364,12 @@ amf0::Value ChanMgr::getState()
             { "icyMetaInterval",icyMetaInterval},
             { "maxRelaysPerChannel",maxRelaysPerChannel},
             { "hostUpdateInterval",hostUpdateInterval},
+            { "packetBufferDuration",packetBufferDuration},
+            { "joinKeyFramesBack",joinKeyFramesBack},
+            { "maxHitsPerChannel",maxHitsPerChannel},
+            { "dvrSize",dvrSize},
+            { "memoryBudget",memoryBudget},
+            { "ingestJitterMsec",ingestJitterMsec},
             { "broadcastID",         broadcastID.str() },
         });
 }
@@ -345,6 +386,19 @@ void ChanMgr::broadcastTrackerUpdate(const GnuID &svID, bool force)
     }
 }
 
+// -----------------------------------
+// 配信中の全チャンネルのトラッカー更新を続けて送る。
+void ChanMgr::sendTrackerUpdates()
+{
+    auto c = channel;
+    while (c)
+    {
+        if ( c->isActive() && c->isBroadcasting() )
+            c->sendTrackerUpdate(GnuID());
+        c = c->next;
+    }
+}
+
 // -----------------------------------
 int ChanMgr::broadcastPacketUp(ChanPacket &pack, const GnuID &chanID, const GnuID &srcID, const GnuID &destID)
 {
@@ -399,12 +453,13 @@ void ChanMgr::clearHitLists()
 
         hitlist = next;
     }
+    hitlistIndex.clear();
 }
 
 // -----------------------------------
 void ChanMgr::deleteChannel(std::shared_ptr<Channel> delchan)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     std::shared_ptr<Channel> ch = channel, prev = nullptr;
 
@@ -417,6 +472,9 @@ void ChanMgr::deleteChannel(std::shared_ptr<Channel> delchan)
                 prev->next = next;
             else
                 channel = next;
+            channelIndex.erase(ch->info.id, ch);
+            ch->closed = true;
+            g_eventBus.publish("channelRemoved", amf0::Value::object({{"channelId", ch->info.id.str()}}));
             break;
         }
         prev = ch;
@@ -427,7 +485,7 @@ void ChanMgr::deleteChannel(std::shared_ptr<Channel> delchan)
 // -----------------------------------
 std::shared_ptr<Channel> ChanMgr::createChannel(ChanInfo &info, const char *mount)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     auto nc = std::make_shared<Channel>();
 
@@ -435,6 +493,8 @@ std::shared_ptr<Channel> ChanMgr::createChannel(ChanInfo &info, const char *moun
     channel = nc;
 
     nc->info = info;
+    if (nc->info.id.isSet())
+        channelIndex.insert(nc->info.id, nc);
     nc->info.lastPlayStart = 0;
     nc->info.lastPlayEnd = 0;
     nc->info.status = ChanInfo::S_UNKNOWN;
@@ -447,6 +507,7 @@ std::shared_ptr<Channel> ChanMgr::createChannel(ChanInfo &info, const char *moun
     nc->rootHost = servMgr->rootHost.c_str();
 
     LOG_INFO("New channel created");
+    g_eventBus.publish("channelAdded", amf0::Value::object({{"channelId", nc->info.id.str()}}));
 
     return nc;
 }
@@ -473,7 +534,7 @@ std::shared_ptr<ChanHitList> ChanMgr::findHitList(ChanInfo &info)
     auto chl = hitlist;
     while (chl)
     {
-        std::lock_guard<std::recursive_mutex> lock(chl->lock);
+        std::lock_guard<ProfiledMutex> lock(chl->lock);
         if (chl->isUsed())
             if (chl->info.matchNameID(info))
                 return chl;
@@ -486,13 +547,25 @@ std::shared_ptr<ChanHitList> ChanMgr::findHitList(ChanInfo &info)
 // -----------------------------------
 std::shared_ptr<ChanHitList> ChanMgr::findHitListByID(const GnuID &id)
 {
-    auto chl = hitlist;
+    auto chl = hitlistIndex.find(id);
+    if (chl)
+    {
+        std::lock_guard<ProfiledMutex> lock(chl->lock);
+        if (chl->isUsed() && chl->info.id.isSame(id))
+            return chl;
+    }
+
+    // 索引に無いか古くなっている。
+    chl = hitlist;
     while (chl)
     {
-        std::lock_guard<std::recursive_mutex> lock(chl->lock);
+        std::lock_guard<ProfiledMutex> lock(chl->lock);
         if (chl->isUsed())
             if (chl->info.id.isSame(id))
+            {
+                hitlistIndex.insert(id, chl);
                 return chl;
+            }
         chl = chl->next;
     }
     return nullptr;
@@ -521,8 +594,10 @@ std::shared_ptr<ChanHitList> ChanMgr::addHitList(ChanInfo &info)
     hitlist = chl;
 
     chl->used = true;
+    chl->maxHits = maxHitsPerChannel;
     chl->info = info;
     chl->info.createdTime = sys->getTime();
+    hitlistIndex.insert(chl->info.id, chl);
     peercastApp->addChannel(&chl->info);
 
     return chl;
@@ -531,7 +606,7 @@ std::shared_ptr<ChanHitList> ChanMgr::addHitList(ChanInfo &info)
 // -----------------------------------
 void ChanMgr::clearDeadHits(bool clearTrackers)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
     constexpr unsigned int interval = 180;
 
     std::shared_ptr<ChanHitList> chl = hitlist, prev = nullptr;
@@ -552,6 +627,7 @@ void ChanMgr::clearDeadHits(bool clearTrackers)
                             prev->next = next;
                         else
                             hitlist = next;
+                        hitlistIndex.erase(chl->info.id, chl);
 
                         chl = next;
                         continue;
@@ -577,7 +653,7 @@ bool    ChanMgr::isBroadcasting(const GnuID &id)
 // -----------------------------------
 bool    ChanMgr::isBroadcasting()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     auto ch = channel;
     while (ch)
@@ -594,7 +670,7 @@ bool    ChanMgr::isBroadcasting()
 // -----------------------------------
 int ChanMgr::numChannels()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     int tot = 0;
     auto ch = channel;
@@ -642,7 +718,7 @@ void ChanMgr::addHit(Host &h, const GnuID &id, bool tracker)
 // -----------------------------------
 std::shared_ptr<ChanHit> ChanMgr::addHit(ChanHit &h)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     auto hl = findHitListByID(h.chanID);
 
@@ -655,11 +731,54 @@ std::shared_ptr<ChanHit> ChanMgr::addHit(ChanHit &h)
 
     if (hl)
     {
+        hl->maxHits = maxHitsPerChannel;
         return hl->addHit(h);
     }else
         return nullptr;
 }
 
+// -----------------------------------
+// hits を先頭から順に addHit (recv でなければ delHit) したのと同じ結
+// 果にする。ロックは一度だけ取り、同じチャンネルに続けて加えるヒット
+// はまとめてヒットリストに渡す。
+void ChanMgr::applyHits(std::vector<ChanHit> &hits)
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+
+    std::shared_ptr<ChanHitList> hl;
+    auto it = hits.begin();
+    while (it != hits.end())
+    {
+        if (!hl || !hl->info.id.isSame(it->chanID))
+            hl = findHitListByID(it->chanID);
+
+        if (!it->recv)
+        {
+            if (hl)
+                hl->delHit(*it);
+            ++it;
+            continue;
+        }
+
+        auto end = it;
+        while (end != hits.end() && end->recv && end->chanID.isSame(it->chanID))
+            ++end;
+
+        if (!hl)
+        {
+            ChanInfo info;
+            info.id = it->chanID;
+            hl = addHitList(info);
+        }
+        if (hl)
+        {
+            hl->maxHits = maxHitsPerChannel;
+            hl->addHits(it, end);
+        }
+        it = end;
+    }
+}
+
 // -----------------------------------
 class ChanFindInfo : public ThreadInfo
 {
@@ -753,7 +872,58 @@ std::string ChanMgr::authSecret(const GnuID& id)
 }
 
 // --------------------------------------------------
+// ID はリクエストから来るので、覚えておく数には上限を設ける。
+static const size_t MAX_AUTH_TOKENS = 1024;
+
 std::string ChanMgr::authToken(const GnuID& id)
 {
-    return md5::hexdigest(authSecret(id));
+    std::lock_guard<std::mutex> cs(m_authTokenLock);
+
+    if (!m_authTokenBroadcastID.isSame(broadcastID))
+    {
+        m_authTokens.clear();
+        m_authTokenBroadcastID = broadcastID;
+    }
+
+    auto it = m_authTokens.find(id);
+    if (it != m_authTokens.end())
+        return it->second;
+
+    if (m_authTokens.size() >= MAX_AUTH_TOKENS)
+        m_authTokens.clear();
+    auto token = md5::hexdigest(authSecret(id));
+    m_authTokens[id] = token;
+    return token;
+}
+
+// --------------------------------------------------
+std::string ChanMgr::expiringAuthToken(const GnuID& id, unsigned int expires)
+{
+    const std::string key = broadcastID.str();
+    const std::string message = id.str() + ":" + std::to_string(expires);
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    HMAC(EVP_sha256(), key.data(), (int) key.size(),
+         (const unsigned char*) message.data(), message.size(),
+         digest, &len);
+
+    std::string hex;
+    for (unsigned int i = 0; i < len; i++)
+        hex += str::format("%02x", digest[i]);
+    return hex;
+}
+
+// --------------------------------------------------
+bool ChanMgr::isValidAuthToken(const GnuID& id, const std::string& token, const std::string& expires)
+{
+    if (expires.empty())
+        return str::secure_equals(authToken(id), token);
+
+    char* end;
+    unsigned long t = strtoul(expires.c_str(), &end, 10);
+    if (*end != '\0' || t < sys->getTime())
+        return false;
+
+    return str::secure_equals(expiringAuthToken(id, (unsigned int) t), token);
 }
@@ -21,6 +21,11 @@
 
 #include "channel.h"
 #include "varwriter.h"
+#include "idmap.h"
+#include "lockprof.h"
+
+#include <mutex>
+#include <unordered_map>
 
 class Servent;
 
@@ -52,6 +57,7 @@ public:
 
     int     broadcastPacketUp(ChanPacket &, const GnuID &, const GnuID &, const GnuID &);
     void    broadcastTrackerUpdate(const GnuID &, bool = false);
+    void    sendTrackerUpdates();
 
     int     findChannels(ChanInfo &, std::shared_ptr<Channel> *, int);
     int     findChannelsByStatus(std::shared_ptr<Channel> *, int, Channel::STATUS);
@@ -60,13 +66,16 @@ public:
     int     numChannels();
 
     void    closeIdles();
-    void    closeOldestIdle();
+    // 一番長くアイドルなチャンネルを閉じる。無ければ false。
+    bool    closeOldestIdle();
     void    closeAll();
     void    quit();
 
     void    addHit(Host &, const GnuID &, bool);
     virtual std::shared_ptr<ChanHit> addHit(ChanHit &);
     void    delHit(ChanHit &);
+    // まとめて届いたヒットの追加と削除を、届いた順に行う。
+    void    applyHits(std::vector<ChanHit> &);
     void    deadHit(ChanHit &);
     void    setFirewalled(Host &);
 
@@ -92,13 +101,25 @@ public:
     int         pickHits(ChanHitSearch &);
 
     std::string authSecret(const GnuID& id);
+    // 一度計算したものは broadcastID が変わるまで覚えておく。
     std::string authToken(const GnuID& id);
+    // expires (UNIX 時刻) まで使えるトークン。CDN などに渡す用。
+    std::string expiringAuthToken(const GnuID& id, unsigned int expires);
+    // expires が空なら authToken、そうでなければ expiringAuthToken と
+    // 比べる。
+    bool        isValidAuthToken(const GnuID& id, const std::string& token, const std::string& expires);
 
     amf0::Value getState() override;
 
     std::shared_ptr<Channel> channel;
     std::shared_ptr<ChanHitList> hitlist;
 
+    // ID による検索用の索引。リストに加える時と外す時に更新する。作
+    // った後で ID が変わった要素は、リストをたどって見付けた時に登録
+    // し直す。
+    ShardedIDMap<Channel>     channelIndex;
+    ShardedIDMap<ChanHitList> hitlistIndex;
+
     GnuID           broadcastID;
 
     ::String        broadcastMsg;
@@ -107,7 +128,7 @@ public:
     unsigned int    deadHitAge;
     int             icyMetaInterval;
     int             maxRelaysPerChannel;
-    std::recursive_mutex lock;
+    ProfiledMutex lock { "ChanMgr::lock" };
     int             minBroadcastTTL, maxBroadcastTTL;
     int             pushTimeout, pushTries, maxPushHops;
     unsigned int    prefetchTime;
@@ -116,8 +137,22 @@ public:
 
     unsigned int    hostUpdateInterval;
     unsigned int    bufferTime;
+    unsigned int    packetBufferDuration; // 秒。0 の場合はパケット数固定のバッファーを使う。チャンネルごとに上書きできる。
+    unsigned int    joinKeyFramesBack;    // DIRECT 接続を最新から何個前のキーフレームから始めるか。
+    unsigned int    maxHitsPerChannel;    // 1 チャンネルで覚えておくヒットの数の上限。0 なら制限しない。
+    unsigned int    dvrSize;              // タイムシフト用のディスクのリングの MB 数。0 なら使わない。
+    std::string     dvrDirectory;         // ディスクのリングを置くディレクトリ。空なら作業ディレクトリ。
+    std::string     recordDirectory;      // 録画ファイルを置くディレクトリ。空なら作業ディレクトリ。
+    unsigned int    recordSegmentSeconds; // 録画ファイルを区切る秒数。0 なら区切らない。
+    unsigned int    memoryBudget;         // メモリーの予算の MB 数。超えるとアイドルなチャンネルやヒットを捨てる。0 なら制限しない。
+    unsigned int    ingestJitterMsec;     // 配信の取り込みでタイムスタンプに合わせて待つ時間の上限。0 なら待たない。
 
     GnuID           currFindAndPlayChannel;
+
+private:
+    std::mutex      m_authTokenLock;
+    GnuID           m_authTokenBroadcastID; // m_authTokens を作った時の broadcastID
+    std::unordered_map<GnuID, std::string, GnuIDHash, GnuIDEqual> m_authTokens;
 };
 
 // ----------------------------------
@@ -36,19 +36,35 @@
 #include "atom.h"
 #include "pcp.h"
 #include "chandir.h"
+#include "threadacct.h"
+#include "pkttrace.h"
+#include "relaypolicy.h"
+#include "connectrace.h"
+#include "hostgraph.h"
+#include "pcpmux.h"
+#include "capture.h"
+#include "reactor.h"
 
 #include "mp3.h"
 #include "ogg.h"
 #include "mms.h"
 #include "nsv.h"
 #include "flv.h"
+#include "dvr.h"
+#include "recorder.h"
 #include "mkv.h"
 #include "wmhttp.h"
 #include "mp4.h"
+#include "rtmpingest.h"
 
 #include "icy.h"
 #include "url.h"
 #include "httppush.h"
+#include "shmring.h"
+#include "hls.h"
+#include "aacextract.h"
+#include "thumbnail.h"
+#include "sstream.h"
 
 #include "str.h"
 
@@ -57,6 +73,10 @@
 #include "defer.h"
 
 #include "yplist.h"
+#include "eventbus.h"
+#include "ypsession.h"
+#include "trackerhub.h"
+#include "locality.h"
 
 // -----------------------------------
 const char *Channel::srcTypes[] =
@@ -67,6 +87,7 @@ const char *Channel::srcTypes[] =
     "ICECAST",
     "URL",
     "HTTPPUSH",
+    "RTMP",
 };
 
 // -----------------------------------
@@ -91,6 +112,7 @@ const char *Channel::statusMsgs[] =
 // Initialise the channel to its default settings of unallocated and reset.
 // -----------------------------------------------------------------------------
 Channel::Channel()
+    : closed(false)
 {
     next = nullptr;
     reset();
@@ -99,6 +121,9 @@ Channel::Channel()
 // -----------------------------------------------------------------------------
 void Channel::endThread()
 {
+    // 中身を消す前に送信側に知らせる。
+    closed = true;
+
     if (pushSock)
     {
         pushSock->close();
@@ -130,7 +155,7 @@ void Channel::resetPlayTime()
 // -----------------------------------------------------------------------------
 void Channel::setStatus(STATUS s)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     if (s != status)
     {
@@ -157,6 +182,14 @@ void Channel::setStatus(STATUS s)
         }
 
         peercastApp->channelUpdate(&info);
+
+        // 公開ページの作り置きもこれで古くなるので、購読者がいなくても
+        // 知らせる。
+        g_eventBus.publish("channelStatus", amf0::Value::object(
+            {
+                {"channelId", info.id.str()},
+                {"status", getStatusStr()},
+            }));
     }
 }
 
@@ -167,8 +200,11 @@ void Channel::reset()
 {
     sourceHost.init();
     remoteID.clear();
+    muxUpstream = false;
 
     streamIndex = 0;
+    lastTraceSample = 0;
+    archiveTried = false;
 
     lastIdleTime = 0;
 
@@ -177,6 +213,7 @@ void Channel::reset()
     mount.clear();
     bump = false;
     stayConnected = false;
+    packetBufferDuration = 0;
 
     icyMetaInterval = 0;
     streamPos = 0;
@@ -188,6 +225,8 @@ void Channel::reset()
     sourceStream = nullptr;
 
     rawData.init();
+    rawData.setArchive(nullptr);
+    stopRecording();
     rawData.accept = ChanPacket::T_HEAD | ChanPacket::T_DATA;
 
     status = S_NONE;
@@ -200,12 +239,31 @@ void Channel::reset()
     sourceURL.clear();
     sourceData = nullptr;
 
+    {
+        std::lock_guard<std::mutex> cs(backupLock);
+        if (backupSock)
+            backupSock->close();
+        backupSock = nullptr;
+        backupSource = nullptr;
+    }
+    takeOverRequested = false;
+    lastSourceStream = nullptr;
+
     lastTrackerUpdate = 0;
-    lastMetaUpdate = 0;
+    metaPending = false;
+    metaPendingSince = 0;
+    metaChangedAt = 0;
+
+    moving = false;
+    numSkips = 0;
+    lastMoveTime = 0;
+    lastRebalance = 0;
+    lastHubAssign = 0;
 
     srcType = SRC_NONE;
 
     startTime = 0;
+    readDelayDeadline = 0;
 
     ipVersion = IP_V4;
 }
@@ -216,7 +274,32 @@ void    Channel::newPacket(ChanPacket &pack)
     if (pack.type == ChanPacket::T_PCP)
         return;
 
-    rawData.writePacket(pack, true);
+    // ビットレートが分かっていれば、effectiveBufferDuration() 秒分の
+    // データが入るようにバッファーの大きさを調整する。
+    unsigned int targetBytes = 0;
+    const unsigned int duration = effectiveBufferDuration();
+    if (duration && info.bitrate > 0)
+        targetBytes = duration * (info.bitrate * 1000 / 8);
+    rawData.adjustCapacity(targetBytes);
+
+    if (servMgr->flags[ServMgr::F_packetTracing])
+        g_packetTracer.sample(info.id, pack, lastTraceSample);
+
+    if (!archiveTried)
+        openArchive();
+
+    if (rawData.writePacket(pack, true))
+    {
+        auto rec = std::atomic_load(&recorder);
+        if (rec)
+            rec->put(rawData.packetAt(pack.sync));
+    }
+}
+
+// -----------------------------------
+unsigned int Channel::effectiveBufferDuration()
+{
+    return packetBufferDuration ? packetBufferDuration : chanMgr->packetBufferDuration;
 }
 
 // -----------------------------------
@@ -315,33 +398,167 @@ void Channel::startStream()
 {
     thread.channel = shared_from_this();
     thread.func = stream;
+    thread.threadClass = ThreadClass::T_INGEST;
     if (!sys->startWaitableThread(&thread))
         reset();
 }
 
 // -----------------------------------
+// ストリームの先頭から time 秒の位置まで読んだので、その時刻まで待つ。
 void Channel::sleepUntil(double time)
 {
-    double sleepTime = time - (sys->getDTime()-startTime);
+    if (!readDelay)
+        return;
+
+    double now = sys->getMonotonicTime();
+    // 最初の呼び出しか、ファイルが変わるなどして時刻が大きく戻った。
+    if (startTime == 0 || startTime + time < now - 10)
+        startTime = now - time;
+
+    double deadline = startTime + time;
+    if (deadline > now + 60)
+        deadline = now + 60;
+
+    sys->sleepUntil(deadline);
+}
+
+// -----------------------------------
+std::shared_ptr<const std::string> Channel::getIcyMetaBlock(const CompactString& title, const CompactString& url)
+{
+    std::string key = title.str() + '\0' + url.str();
+
+    std::lock_guard<std::mutex> cs(icyMetaLock);
+    for (auto it = icyMetaCache.begin(); it != icyMetaCache.end(); ++it)
+    {
+        if (it->first == key)
+        {
+            auto block = it->second;
+            if (it != icyMetaCache.begin())
+            {
+                icyMetaCache.erase(it);
+                icyMetaCache.emplace_front(key, block);
+            }
+            return block;
+        }
+    }
+
+    CompactString t = title, u = url;
+    t.convertTo(String::T_META);
+    u.convertTo(String::T_META);
+
+    std::string body = str::format("StreamTitle='%s';StreamUrl='%s';", t.cstr(), u.cstr());
+    // 長さは 1 バイトで 16 バイト単位なので、それを超える分は切り捨てる。
+    size_t n = std::min<size_t>((body.size() + 16) / 16, 255);
+    body.resize(n * 16, '\0');
+
+    auto block = std::make_shared<std::string>(1, (char) n);
+    *block += body;
+
+    icyMetaCache.emplace_front(key, block);
+    if (icyMetaCache.size() > 4)
+        icyMetaCache.pop_back();
+    return block;
+}
+
+// -----------------------------------
+std::shared_ptr<HLSSegmenter> Channel::getHLSSegmenter()
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+    if (!hlsSegmenter)
+        hlsSegmenter = std::make_shared<HLSSegmenter>();
+    return hlsSegmenter;
+}
+
+// -----------------------------------
+std::shared_ptr<AACExtractor> Channel::getAACExtractor()
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+    if (!aacExtractor)
+        aacExtractor = std::make_shared<AACExtractor>();
+    return aacExtractor;
+}
+
+// -----------------------------------
+std::shared_ptr<ThumbnailCache> Channel::getThumbnailCache()
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+    if (!thumbnailCache)
+        thumbnailCache = std::make_shared<ThumbnailCache>();
+    return thumbnailCache;
+}
+
+// -----------------------------------
+std::string Channel::startRecording()
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+
+    auto rec = std::atomic_load(&recorder);
+    if (rec)
+        return rec->segmentPath(std::max(1u, rec->numSegments()));
+
+    std::string dir = chanMgr->recordDirectory;
+    if (dir.empty())
+        dir = sys->getCurrentWorkingDirectory();
+    std::string prefix = str::format("%s%s%s-%u", dir.c_str(), sys->getDirectorySeparator().c_str(),
+                                     info.id.str().c_str(), sys->getTime());
+
+    rec = std::make_shared<ChannelRecorder>(prefix, info.streamExt.c_str(), chanMgr->recordSegmentSeconds);
+    rec->setHeader(headPack);
+    rec->start();
+    std::atomic_store(&recorder, rec);
+    LOG_INFO("Channel %s recording started", info.name.cstr());
+    return rec->segmentPath(1);
+}
 
-//  LOG("sleep %g", sleepTime);
-    if (sleepTime > 0)
+// -----------------------------------
+void Channel::stopRecording()
+{
+    auto rec = std::atomic_exchange(&recorder, std::shared_ptr<ChannelRecorder>());
+    if (rec)
     {
-        if (sleepTime > 60) sleepTime = 60;
+        rec->stop();
+        LOG_INFO("Recording stopped: %llu bytes, %llu packets dropped",
+                 (unsigned long long) rec->bytesWritten(), (unsigned long long) rec->numDropped());
+    }
+}
 
-        double sleepMS = sleepTime*1000;
+// -----------------------------------
+void Channel::openArchive()
+{
+    archiveTried = true;
+    if (chanMgr->dvrSize == 0)
+        return;
+
+    std::string dir = chanMgr->dvrDirectory;
+    if (dir.empty())
+        dir = sys->getCurrentWorkingDirectory();
+    std::string path = dir + sys->getDirectorySeparator() + info.id.str() + ".dvr";
 
-        sys->sleep((int)sleepMS);
+    try
+    {
+        auto a = std::make_shared<ChanPacketArchive>();
+        a->open(path, (size_t) chanMgr->dvrSize * 1024 * 1024);
+        rawData.setArchive(a);
+        LOG_INFO("Channel %s archived to %s (%u MB)", info.name.cstr(), path.c_str(), chanMgr->dvrSize);
+    }catch (GeneralException& e)
+    {
+        LOG_ERROR("Cannot open archive %s: %s", path.c_str(), e.what());
     }
 }
 
 // -----------------------------------
+// 読んだ長さの分だけ期限を進めて、そこまで待つ。処理にかかった時間が
+// 遅れとして積み重ならない。
 void Channel::checkReadDelay(unsigned int len)
 {
     if (readDelay && info.bitrate > 0)
     {
-        unsigned int time = (len*1000)/((info.bitrate*1024)/8);
-        sys->sleep(time);
+        double now = sys->getMonotonicTime();
+        if (readDelayDeadline < now - 1)
+            readDelayDeadline = now;    // 大きく遅れたら追い付こうとしない
+
+        readDelayDeadline += (double) len / ((info.bitrate*1024)/8);
+        sys->sleepUntil(readDelayDeadline);
     }
 }
 
@@ -353,11 +570,17 @@ THREAD_PROC Channel::stream(ThreadInfo *thread)
     assert(thread->channel != nullptr);
     thread->channel = nullptr; // make sure to not leave the reference behind
 
-    Defer defer([=](){ ch->endThread(); });
+    // 受信をリアクターに任せた場合は、受信を終えたハンドラーが続きのス
+    // レッドを立てる。
+    bool handedOver = false;
+    Defer defer([&](){ if (!handedOver) ch->endThread(); });
 
     sys->setThreadName("CHANNEL");
 
-    while (thread->active() && !peercastInst->isQuitting)
+    // リアクターでの受信から戻った時は、止められていても後始末のために
+    // 一度はソースに戻す。thread は続きのスレッドの時は resumeThread な
+    // ので、止められたかは ch->thread で見る。
+    while ((ch->thread.active() && !peercastInst->isQuitting) || ch->reactorSource)
     {
         LOG_INFO("Channel started");
 
@@ -373,6 +596,23 @@ THREAD_PROC Channel::stream(ThreadInfo *thread)
             LOG_ERROR("std::exception: %s", e.what());
         }
 
+        if (ch->reactorSource)
+        {
+            if (ch->startReactorSource())
+            {
+                handedOver = true;
+                break;
+            }
+            // 始める前に止められた。
+            continue;
+        }
+
+        if (ch->thread.active() && !peercastInst->isQuitting && ch->switchToBackup())
+        {
+            LOG_INFO("Channel switched to backup source %s", ch->sock->host.str().c_str());
+            continue;
+        }
+
         LOG_INFO("Channel stopped");
 
         if (!ch->stayConnected)
@@ -387,7 +627,7 @@ THREAD_PROC Channel::stream(ThreadInfo *thread)
 
             for (unsigned int i=0; i<diff; i++)
             {
-                if (!thread->active() || peercastInst->isQuitting)
+                if (!ch->thread.active() || peercastInst->isQuitting)
                     break;
 
                 if (i == 0)
@@ -412,28 +652,41 @@ bool Channel::acceptGIV(std::shared_ptr<ClientSocket> givSock)
 }
 
 // -----------------------------------
-void Channel::connectFetch()
+// sourceHost と alternates に同時に接続し、最初に繋がったものを
+// sourceHost にする。返り値はそれが alternates の何番目か (sourceHost
+// なら -1)。
+int Channel::connectFetch(const std::vector<ChanHit>& alternates)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
-
-    sock = sys->createSocket();
+    std::vector<ChanHit> candidates = { sourceHost };
+    candidates.insert(candidates.end(), alternates.begin(), alternates.end());
 
-    if (!sock)
-        throw StreamException("Can`t create socket");
+    std::vector<Host> hosts;
+    for (auto& c : candidates)
+        hosts.push_back(c.host);
 
-    if (sourceHost.tracker || sourceHost.yp)
+    ConnectRace race;
+    race.prepare = [candidates](ClientSocket& s, int i)
     {
-        sock->setReadTimeout(30000);
-        sock->setWriteTimeout(30000);
-        LOG_INFO("Channel using longer timeouts");
-    }
+        if (candidates[i].tracker || candidates[i].yp)
+        {
+            s.setReadTimeout(30000);
+            s.setWriteTimeout(30000);
+            LOG_INFO("Channel using longer timeouts");
+        }
+    };
+
+    int winner;
+    auto s = race.connect(hosts, winner);
+
+    std::lock_guard<ProfiledMutex> cs(lock);
+
+    sock = s;
+    sourceHost = candidates[winner];
 
     if (!sourceHost.host.ip.isIPv4Mapped())
         this->ipVersion = IP_V6;
 
-    sock->open(sourceHost.host);
-
-    sock->connect();
+    return winner - 1;
 }
 
 // -----------------------------------
@@ -442,6 +695,8 @@ int Channel::handshakeFetch()
     sock->writeLineF("GET /channel/%s HTTP/1.0", info.id.str().c_str());
     sock->writeLineF("%s %d", PCX_HS_POS, streamPos);
     sock->writeLineF("%s %d", PCX_HS_PCP, (this->ipVersion == IP_V4) ? 1 : 100);
+    if (servMgr->flags[ServMgr::F_pcpMultiplex])
+        sock->writeLineF("%s 1", PCX_HS_MUX);
 
     sock->writeLine("");
 
@@ -451,6 +706,8 @@ int Channel::handshakeFetch()
 
     LOG_INFO("Got response: %d", r);
 
+    unsigned int upstreamPos = streamPos;
+    muxUpstream = false;
     while (http.nextHeader())
     {
         char *arg = http.getArgStr();
@@ -458,11 +715,13 @@ int Channel::handshakeFetch()
             continue;
 
         if (http.isHeader(PCX_HS_POS))
-            streamPos = atoi(arg);
+            upstreamPos = atoi(arg);
+        else if (http.isHeader(PCX_HS_MUX))
+            muxUpstream = atoi(arg) != 0;
         else
         {
             // info の為。ロックする範囲が狭すぎるか。
-            std::lock_guard<std::recursive_mutex> cs(lock);
+            std::lock_guard<ProfiledMutex> cs(lock);
             Servent::readICYHeader(http, info, nullptr, 0);
         }
 
@@ -472,8 +731,18 @@ int Channel::handshakeFetch()
     if ((r != 200) && (r != 503))
         return r;
 
-    if (rawData.getLatestPos() > streamPos)
-        rawData.init();
+    if (info.srcProtocol == ChanInfo::SP_PCP)
+    {
+        // PCP のパケットには位置が付いているので、上流がどこから送って
+        // きても持っているバッファーに続けられる。
+        if (upstreamPos != streamPos)
+            LOG_INFO("Upstream resumes at %u (requested %u)", upstreamPos, streamPos);
+    }else
+    {
+        streamPos = upstreamPos;
+        if (rawData.getLatestPos() > streamPos)
+            rawData.init();
+    }
 
     AtomStream atom(*sock);
 
@@ -519,54 +788,226 @@ int PeercastSource::getSourceRateAvg()
 }
 
 // -----------------------------------
-ChanHit PeercastSource::pickFromHitList(std::shared_ptr<Channel> ch, ChanHit &oldHit)
+PeercastSource::~PeercastSource()
 {
-    ChanHit res = oldHit;
+    m_standby = nullptr;
+    if (m_promotedSock)
+        m_promotedSock->close();
+    closeMuxSession();
+}
 
-    auto chl = chanMgr->findHitList(ch->info);
-    if (chl)
+// -----------------------------------
+// 今の上流とは別の、一番良い候補に控えの接続を張り続ける。
+void PeercastSource::startStandby(std::shared_ptr<Channel> ch)
+{
+    if (!servMgr->flags[ServMgr::F_standbyUpstream] || ch->sourceHost.yp)
+        return;
+
+    ChanHit current = ch->sourceHost;
+    m_standby.reset(new StandbyUpstream([ch, current](ChanHit& hit)
+    {
+        auto chl = chanMgr->findHitList(ch->info);
+        if (!chl)
+            return false;
+
+        ChanHitRanking ranking;
+        ranking.matchHost = servMgr->serverHost;
+        ranking.excludeID = servMgr->sessionID;
+        ranking.maxPerCategory = 2;
+
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+        chl->rankHits(ranking);
+        for (auto& c : ranking.ordered())
+        {
+            if (c.hit.host == current.host ||
+                (current.sessionID.isSet() && c.hit.sessionID.isSame(current.sessionID)))
+                continue;
+            hit = c.hit;
+            return true;
+        }
+        return false;
+    }));
+    m_standby->start();
+}
+
+// -----------------------------------
+// 上流が切れた。控えの接続があれば次に使う。
+void PeercastSource::stopStandby(std::shared_ptr<Channel> ch)
+{
+    if (!m_standby)
+        return;
+
+    if (ch->thread.active() && !ch->checkIdle() && !ch->moving)
+        m_standby->take(m_promotedHit, m_promotedSock);
+    m_standby = nullptr;
+}
+
+// -----------------------------------
+// 上流との接続を、同じ上流から受け取る他のチャンネルに貸す。上流に断ら
+// れたチャンネルは自分で接続する。
+void PeercastSource::openMuxSession(std::shared_ptr<Channel> ch)
+{
+    auto pcp = std::dynamic_pointer_cast<PCPStream>(ch->sourceStream);
+    if (!pcp)
+        return;
+
+    m_muxSession = std::make_shared<PCPMuxSession>(ch->sourceHost.host, ch->info.id, ch->remoteID, pcp);
+
+    std::weak_ptr<PCPMuxSession> weak = m_muxSession;
+    pcp->muxHandler = [weak](bool subscribe, const GnuID& chanID, unsigned int)
+    {
+        auto session = weak.lock();
+        if (session && !subscribe)
+        {
+            LOG_INFO("PCP mux: upstream refused %s", chanID.str().c_str());
+            session->rejected(chanID);
+        }
+    };
+    g_pcpMux.add(m_muxSession);
+}
+
+// -----------------------------------
+void PeercastSource::closeMuxSession()
+{
+    if (!m_muxSession)
+        return;
+
+    g_pcpMux.remove(m_muxSession);
+    m_muxSession->close();
+    m_muxSession = nullptr;
+}
+
+// -----------------------------------
+// ch を mux の接続で受け取る。パケットは接続を持つチャンネルのスレッド
+// が PCP_CHAN_ID を見て ch のバッファーに書くので、ここでは様子を見る
+// だけ。上りのパケットは ch->sourceStream から同じ接続に乗る。
+int PeercastSource::streamMux(std::shared_ptr<Channel> ch, std::shared_ptr<PCPMuxSession> mux)
+{
+    ch->remoteID = mux->remoteID;
+    ch->sourceStream = mux->stream;
+    mux->subscribe(ch->info.id, ch->streamPos);
+
+    // 状態の変化を覚えておくのは、接続を持つチャンネルのものとは別に
+    // する。
+    PCPStream status(mux->remoteID);
+
+    peercastApp->channelStart(&ch->info);
+    ch->rawData.lastWriteTime = 0;
+
+    const unsigned int startTime = sys->getTime();
+    int error = 0;
+
+    while (ch->thread.active() && !peercastInst->isQuitting)
     {
-        ChanHitSearch chs;
+        if (ch->checkIdle())
+        {
+            LOG_DEBUG("Channel idle");
+            break;
+        }
+
+        if (ch->moving)
+        {
+            LOG_INFO("Channel moving to %s", ch->designatedHost.host.str().c_str());
+            break;
+        }
 
-        // find local hit
-        chs.init();
-        chs.matchHost = servMgr->serverHost;
-        chs.waitDelay = MIN_RELAY_RETRY;
-        chs.excludeID = servMgr->sessionID;
-        if (chl->pickHits(chs))
-            res = chs.best[0];
+        if (ch->checkBump())
+        {
+            LOG_DEBUG("Channel bumped");
+            error = -1;
+            break;
+        }
+
+        if (!mux->isAlive())
+        {
+            LOG_INFO("Shared upstream connection closed");
+            break;
+        }
 
-        // else find global hit
-        if (!res.host.ip)
+        if (mux->isRejected(ch->info.id))
         {
-            chs.init();
-            chs.waitDelay = MIN_RELAY_RETRY;
-            chs.excludeID = servMgr->sessionID;
-            if (chl->pickHits(chs))
-                res = chs.best[0];
+            error = 503;
+            break;
         }
 
-        // else find local tracker
-        if (!res.host.ip)
+        if (ch->rawData.lastWriteTime)
         {
-            chs.init();
-            chs.matchHost = servMgr->serverHost;
-            chs.waitDelay = MIN_TRACKER_RETRY;
-            chs.excludeID = servMgr->sessionID;
-            chs.trackersOnly = true;
-            if (chl->pickHits(chs))
-                res = chs.best[0];
+            if (!ch->isReceiving())
+                peercast::notifyMessage(ServMgr::NT_PEERCAST, ch->info.name.str() + "を受信中です。");
+            ch->setStatus(Channel::S_RECEIVING);
+            status.updateStatus(ch);
+        }else if (sys->getTime() - startTime > MUX_START_TIMEOUT)
+        {
+            LOG_ERROR("No packets on the shared upstream connection");
+            error = -1;
+            break;
         }
 
-        // else find global tracker
-        if (!res.host.ip)
+        sys->sleepIdle();
+    }
+
+    mux->unsubscribe(ch->info.id);
+    ch->sourceStream = nullptr;
+
+    peercastApp->channelStop(&ch->info);
+
+    return error;
+}
+
+// -----------------------------------
+// LAN 内のリレー、WAN のリレー、LAN 内のトラッカー、WAN のトラッカーの
+// 順に探す。選ばなかった候補は覚えておき、繋がらなければ探し直さずに
+// 次を試す。
+ChanHit PeercastSource::pickFromHitList(std::shared_ptr<Channel> ch, ChanHit &oldHit)
+{
+    static const HopCountPolicy hopCount;
+    WeightedRelayPolicy weighted;
+    weighted.bitrate = ch->info.bitrate;
+    const RelayPolicy* policy = servMgr->flags[ServMgr::F_weightedRelaySelection] ? (const RelayPolicy*) &weighted : &hopCount;
+    // 同じ地域の候補を先にする。
+    LocalityPolicy local(*policy, servMgr->serverHost.ip);
+    if (servMgr->flags[ServMgr::F_preferLocalPeers])
+        policy = &local;
+
+    unsigned int ctime = sys->getTime();
+
+    if (ctime - m_alternatesTime > ALTERNATE_LIFETIME)
+        m_alternates.clear();
+
+    while (!m_alternates.empty())
+    {
+        auto cand = m_alternates.front();
+        m_alternates.pop_front();
+
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+        if (cand.entry->dead)
+            continue;
+        cand.entry->lastContact = ctime;
+        LOG_DEBUG("Trying alternate hit %s", cand.hit.host.str().c_str());
+        return cand.hit;
+    }
+
+    ChanHit res = oldHit;
+
+    auto chl = chanMgr->findHitList(ch->info);
+    if (chl)
+    {
+        ChanHitRanking ranking;
+        ranking.matchHost = servMgr->serverHost;
+        ranking.excludeID = servMgr->sessionID;
+        ranking.relayWait = MIN_RELAY_RETRY;
+        ranking.trackerWait = MIN_TRACKER_RETRY;
+        ranking.policy = policy;
+
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+        if (chl->rankHits(ranking))
         {
-            chs.init();
-            chs.waitDelay = MIN_TRACKER_RETRY;
-            chs.excludeID = servMgr->sessionID;
-            chs.trackersOnly = true;
-            if (chl->pickHits(chs))
-                res = chs.best[0];
+            auto list = ranking.ordered();
+            list[0].entry->lastContact = ctime;
+            res = list[0].hit;
+
+            m_alternates.assign(list.begin() + 1, list.end());
+            m_alternatesTime = ctime;
         }
     }
     return res;
@@ -610,7 +1051,7 @@ void PeercastSource::stream(std::shared_ptr<Channel> ch)
                          };
     if (!servMgr->serverHost.ip.isGlobal()) {
         LOG_INFO("Checking own global IP ...");
-        servMgr->checkFirewall();
+        servMgr->checkGlobalIP();
         if (!servMgr->serverHost.ip.isGlobal()) {
             LOG_ERROR("Could not determine own global IP. LAN relaying may not work.");
         }
@@ -618,6 +1059,9 @@ void PeercastSource::stream(std::shared_ptr<Channel> ch)
 
     m_channel = ch;
 
+    if (ch->reactorSource)
+        endReactorStream(ch);
+
     int numYPTries = 0;
     while (ch->thread.active())
     {
@@ -642,6 +1086,15 @@ void PeercastSource::stream(std::shared_ptr<Channel> ch)
                 break;
             }
 
+            if (m_promotedSock)
+            {
+                LOG_INFO("Channel switching to standby upstream %s", m_promotedHit.host.str().c_str());
+                ch->sock = m_promotedSock;
+                ch->sourceHost = m_promotedHit;
+                m_promotedSock = nullptr;
+                break;
+            }
+
             ch->sourceHost = pickFromHitList(ch, ch->sourceHost);
 
             // consult channel directory
@@ -750,25 +1203,87 @@ void PeercastSource::stream(std::shared_ptr<Channel> ch)
                 type = "(YP)";
 
             int error=-1;
+            double streamStart = 0;
             try
             {
                 ch->setStatus(Channel::S_CONNECTING);
 
-                if (!ch->sock)
+                std::shared_ptr<PCPMuxSession> mux;
+                if (!ch->sock && servMgr->flags[ServMgr::F_pcpMultiplex])
+                    mux = g_pcpMux.find(ch->sourceHost.host, ch->info.id);
+
+                if (mux)
                 {
-                    LOG_INFO("Channel connecting to %s %s", ipstr, type);
-                    ch->connectFetch();
-                }
+                    LOG_INFO("Channel joining the connection to %s for %s", ipstr, mux->parentID.str().c_str());
+                    streamStart = sys->getDTime();
+                    m_alternates.clear();
+
+                    error = streamMux(ch, mux);
+                    if (error)
+                        throw StreamException("Multiplexed stream error");
+                }else
+                {
+                    if (!ch->sock)
+                    {
+                        // 残りの候補にも少し遅れて接続し、先に繋がった方を使う。
+                        std::vector<ChanHit> alternates;
+                        if (!ch->sourceHost.yp)
+                            for (int i = 0; i < (int) m_alternates.size() && i < RACE_WIDTH - 1; i++)
+                                alternates.push_back(m_alternates[i].hit);
+
+                        LOG_INFO("Channel connecting to %s %s (%d alternates)", ipstr, type, (int) alternates.size());
+                        double connectStart = sys->getDTime();
+                        int winner;
+                        try
+                        {
+                            winner = ch->connectFetch(alternates);
+                        }catch (StreamException&)
+                        {
+                            // どれにも繋がらなかった。
+                            for (auto& a : alternates)
+                                g_relayStats.recordFailure(a.host);
+                            m_alternates.erase(m_alternates.begin(), m_alternates.begin() + alternates.size());
+                            throw;
+                        }
 
-                error = ch->handshakeFetch();
-                if (error)
-                    throw StreamException("Handshake error");
+                        if (winner >= 0)
+                        {
+                            {
+                                std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+                                m_alternates[winner].entry->lastContact = sys->getTime();
+                            }
+                            m_alternates.erase(m_alternates.begin() + winner);
+                            strcpy(ipstr, ch->sourceHost.host.str().c_str());
+                            LOG_INFO("Channel connected to alternate %s", ipstr);
+                        }
+                        g_relayStats.recordConnect(ch->sourceHost.host, sys->getDTime() - connectStart);
+                    }
 
-                ch->sourceStream = ch->createSource();
+                    error = ch->handshakeFetch();
+                    if (error)
+                        throw StreamException("Handshake error");
 
-                error = ch->readStream(*ch->sock, ch->sourceStream);
-                if (error)
-                    throw StreamException("Stream error");
+                    g_relayStats.recordSuccess(ch->sourceHost.host);
+                    streamStart = sys->getDTime();
+                    m_alternates.clear();
+                    startStandby(ch);
+
+                    ch->sourceStream = ch->createSource();
+                    if (ch->muxUpstream)
+                        openMuxSession(ch);
+
+                    // リアクターに任せたら、このスレッドは抜ける。受信を
+                    // 終えると続きのスレッドが endReactorStream から戻る。
+                    if (ch->prepareReactorSource())
+                    {
+                        m_streamStart = streamStart;
+                        return;
+                    }
+
+                    error = ch->readStream(*ch->sock, ch->sourceStream);
+                    if (error)
+                        throw StreamException("Stream error");
+                }
 
                 error = 0;      // no errors, closing normally.
                 ch->setStatus(Channel::S_CLOSING);
@@ -780,83 +1295,208 @@ void PeercastSource::stream(std::shared_ptr<Channel> ch)
                 LOG_ERROR("Channel to %s %s : %s", ipstr, type, e.msg);
                 if (!ch->sourceHost.tracker || ((error != 503) && ch->sourceHost.tracker))
                     chanMgr->deadHit(ch->sourceHost);
+                if (!streamStart)
+                    g_relayStats.recordFailure(ch->sourceHost.host);
             }
 
-            // broadcast quit to any connected downstream servents
-            {
-                ChanPacket pack;
-                MemoryStream mem(pack.data, sizeof(pack.data));
-                AtomStream atom(mem);
-                atom.writeInt(PCP_QUIT, PCP_ERROR_QUIT+PCP_ERROR_OFFAIR);
-                pack.len = mem.pos;
-                pack.type = ChanPacket::T_PCP;
-                servMgr->broadcastPacket(pack, ch->info.id, ch->remoteID, GnuID(), Servent::T_RELAY);
-            }
-
-            if (ch->sourceStream)
-            {
-                try
-                {
-                    if (!error)
-                    {
-                        ch->sourceStream->updateStatus(ch);
-                        ch->sourceStream->flush(*ch->sock);
-                    }
-                }catch (StreamException &)
-                {}
-                auto cs = ch->sourceStream;
-                ch->sourceStream = nullptr;
-                cs->kill();
-            }
-
-            if (ch->sock)
-            {
-                ch->sock->close();
-                ch->sock = nullptr;
-            }
+            endStream(ch, error, streamStart);
 
             if (error == 404)
             {
                 LOG_ERROR("Channel not found");
+                if (m_promotedSock)
+                {
+                    m_promotedSock->close();
+                    m_promotedSock = nullptr;
+                }
                 return;
             }
         }
 
-        ch->lastIdleTime = sys->getTime();
-        ch->setStatus(Channel::S_IDLE);
-        while ((ch->checkIdle()) && (ch->thread.active()))
-        {
-            sys->sleep(200);
-        }
-
-        sys->sleepIdle();
+        waitIdle(ch);
     }
 }
 
 // -----------------------------------
-void    Channel::startHTTPPush(std::shared_ptr<ClientSocket> cs, bool isChunked)
+// 上流から受け取り終えた後始末。
+void PeercastSource::endStream(std::shared_ptr<Channel> ch, int error, double streamStart)
 {
-    srcType = SRC_HTTPPUSH;
-    type    = T_BROADCAST;
+    stopStandby(ch);
+    closeMuxSession();
+    const bool moving = ch->moving.exchange(false);
 
-    sock = cs;
-    info.srcProtocol = ChanInfo::SP_HTTP;
+    // ある程度受信したら、ビットレートに対して受け取れた割合を覚える。
+    if (ch->sock && streamStart && ch->info.bitrate &&
+        (sys->getDTime() - streamStart) >= MIN_THROUGHPUT_SAMPLE)
+    {
+        double ratio = ch->sock->stat.bytesInPerSecAvg() / (ch->info.bitrate * 1000.0 / 8);
+        g_relayStats.recordThroughput(ch->sourceHost.host, ratio);
+    }
 
-    sourceData = std::make_shared<HTTPPushSource>(isChunked);
-    startStream();
+    // broadcast quit to any connected downstream servents
+    if (!moving)
+    {
+        ChanPacket pack;
+        MemoryStream mem(pack.data, sizeof(pack.data));
+        AtomStream atom(mem);
+        atom.writeInt(PCP_QUIT, PCP_ERROR_QUIT+PCP_ERROR_OFFAIR);
+        pack.len = mem.pos;
+        pack.type = ChanPacket::T_PCP;
+        servMgr->broadcastPacket(pack, ch->info.id, ch->remoteID, GnuID(), Servent::T_RELAY);
+    }
+
+    if (ch->sourceStream)
+    {
+        try
+        {
+            if (!error)
+            {
+                ch->sourceStream->updateStatus(ch);
+                ch->sourceStream->flush(*ch->sock);
+            }
+        }catch (StreamException &)
+        {}
+        auto cs = ch->sourceStream;
+        ch->sourceStream = nullptr;
+        cs->kill();
+    }
+
+    if (ch->sock)
+    {
+        ch->sock->close();
+        ch->sock = nullptr;
+    }
 }
 
 // -----------------------------------
-void    Channel::startWMHTTPPush(std::shared_ptr<ClientSocket> cs)
+// 受信をリアクターに任せていたチャンネルの後始末をする。
+void PeercastSource::endReactorStream(std::shared_ptr<Channel> ch)
 {
-    srcType = SRC_HTTPPUSH;
-    type    = T_BROADCAST;
+    auto rs = std::move(ch->reactorSource);
 
-    sock = cs;
-    info.srcProtocol = ChanInfo::SP_WMHTTP;
+    if (rs->error)
+    {
+        ch->setStatus(Channel::S_ERROR);
+        LOG_ERROR("Channel to %s : Stream error", ch->sourceHost.host.str().c_str());
+        chanMgr->deadHit(ch->sourceHost);
+    }else
+    {
+        ch->setStatus(Channel::S_CLOSING);
+        LOG_INFO("Channel closed normally");
+    }
 
-    sourceData = std::make_shared<HTTPPushSource>(false);
-    startStream();
+    endStream(ch, rs->error, m_streamStart);
+    waitIdle(ch);
+}
+
+// -----------------------------------
+// 次の上流を探す前に、見ている人がいる間は待つ。
+void PeercastSource::waitIdle(std::shared_ptr<Channel> ch)
+{
+    ch->lastIdleTime = sys->getTime();
+    ch->setStatus(Channel::S_IDLE);
+    while ((ch->checkIdle()) && (ch->thread.active()))
+    {
+        sys->sleep(200);
+    }
+
+    sys->sleepIdle();
+}
+
+// -----------------------------------
+bool    Channel::addBackupSource(std::shared_ptr<ClientSocket> cs, std::shared_ptr<ChannelSource> source,
+                                 SRC_TYPE st, ChanInfo::TYPE contentType)
+{
+    if (!isBroadcasting() || srcType != st || info.contentType != contentType)
+        return false;
+
+    std::lock_guard<std::mutex> lk(backupLock);
+    if (backupSock)
+    {
+        LOG_INFO("Replacing backup source %s", backupSock->host.str().c_str());
+        backupSock->close();
+    }
+    backupSock = cs;
+    backupSource = source;
+
+    // 今のソースが止まっていれば、切れるのを待たずに替える。
+    unsigned int last = rawData.lastWriteTime;
+    if (last && sys->getTime() - last >= BACKUP_TAKEOVER_SEC)
+        takeOverRequested = true;
+
+    LOG_INFO("Backup source %s added to %s%s", cs->host.str().c_str(), info.name.cstr(),
+             takeOverRequested ? " (taking over)" : "");
+    return true;
+}
+
+// -----------------------------------
+// 予備のソースがあれば、それを今のソースにする。
+bool    Channel::switchToBackup()
+{
+    std::lock_guard<std::mutex> lk(backupLock);
+    takeOverRequested = false;
+    if (!backupSock)
+        return false;
+
+    sock = backupSock;
+    sourceData = backupSource;
+    backupSock = nullptr;
+    backupSource = nullptr;
+    return true;
+}
+
+// -----------------------------------
+void    Channel::startHTTPPush(std::shared_ptr<ClientSocket> cs, bool isChunked)
+{
+    srcType = SRC_HTTPPUSH;
+    type    = T_BROADCAST;
+
+    sock = cs;
+    info.srcProtocol = ChanInfo::SP_HTTP;
+
+    sourceData = std::make_shared<HTTPPushSource>(isChunked);
+    startStream();
+}
+
+// -----------------------------------
+void    Channel::startWMHTTPPush(std::shared_ptr<ClientSocket> cs)
+{
+    srcType = SRC_HTTPPUSH;
+    type    = T_BROADCAST;
+
+    sock = cs;
+    info.srcProtocol = ChanInfo::SP_WMHTTP;
+
+    sourceData = std::make_shared<HTTPPushSource>(false);
+    startStream();
+}
+
+// -----------------------------------
+// エンコーダーからの RTMP 接続。session は publish まで済んでいる。
+void    Channel::startRTMP(std::shared_ptr<ClientSocket> cs, std::shared_ptr<RTMPSession> session)
+{
+    srcType = SRC_RTMP;
+    type    = T_BROADCAST;
+
+    sock = cs;
+    info.srcProtocol = ChanInfo::SP_RTMP;
+    info.setContentType(ChanInfo::T_FLV);
+
+    sourceData = std::make_shared<RTMPSource>(session);
+    startStream();
+}
+
+// -----------------------------------
+void    Channel::startShm(std::shared_ptr<ShmRing> ring)
+{
+    srcType = SRC_RTMP;
+    type    = T_BROADCAST;
+
+    info.srcProtocol = ChanInfo::SP_RTMP;
+    info.setContentType(ChanInfo::T_FLV);
+
+    sourceData = std::make_shared<ShmRingSource>(ring);
+    startStream();
 }
 
 // -----------------------------------
@@ -922,7 +1562,15 @@ void Channel::processMp3Metadata(char *str)
 // -----------------------------------
 XML::Node *ChanHit::createXML()
 {
-    return new XML::Node("host ip=\"%s\" hops=\"%d\" listeners=\"%d\" relays=\"%d\" uptime=\"%d\" push=\"%d\" relay=\"%d\" direct=\"%d\" cin=\"%d\" stable=\"%d\" version=\"%d\" update=\"%d\" tracker=\"%d\"",
+    char tag[XML::MAX_TAGLEN];
+    getXMLTag(tag, sizeof(tag));
+    return new XML::Node("%s", tag);
+}
+
+// -----------------------------------
+void ChanHit::getXMLTag(char *buf, size_t size)
+{
+    snprintf(buf, size, "host ip=\"%s\" hops=\"%d\" listeners=\"%d\" relays=\"%d\" uptime=\"%d\" push=\"%d\" relay=\"%d\" direct=\"%d\" cin=\"%d\" stable=\"%d\" version=\"%d\" update=\"%d\" tracker=\"%d\"",
         host.str().c_str(),
         numHops,
         numListeners,
@@ -942,15 +1590,9 @@ XML::Node *ChanHit::createXML()
 // -----------------------------------
 XML::Node *ChanHitList::createXML(bool addHits)
 {
-    XML::Node *hn = new XML::Node("hits hosts=\"%d\" listeners=\"%d\" relays=\"%d\" firewalled=\"%d\" closest=\"%d\" furthest=\"%d\" newest=\"%d\"",
-        numHits(),
-        numListeners(),
-        numRelays(),
-        numFirewalled(),
-        closestHit(),
-        furthestHit(),
-        sys->getTime()-newestHit()
-        );
+    char tag[XML::MAX_TAGLEN];
+    getXMLTag(tag, sizeof(tag));
+    XML::Node *hn = new XML::Node("%s", tag);
 
     if (addHits)
     {
@@ -966,8 +1608,30 @@ XML::Node *ChanHitList::createXML(bool addHits)
     return hn;
 }
 
+// -----------------------------------
+void ChanHitList::getXMLTag(char *buf, size_t size)
+{
+    snprintf(buf, size, "hits hosts=\"%d\" listeners=\"%d\" relays=\"%d\" firewalled=\"%d\" closest=\"%d\" furthest=\"%d\" newest=\"%d\"",
+        numHits(),
+        numListeners(),
+        numRelays(),
+        numFirewalled(),
+        closestHit(),
+        furthestHit(),
+        sys->getTime()-newestHit()
+        );
+}
+
 // -----------------------------------
 XML::Node *Channel::createRelayXML(bool showStat)
+{
+    char tag[XML::MAX_TAGLEN];
+    getRelayXMLTag(tag, sizeof(tag), showStat);
+    return new XML::Node("%s", tag);
+}
+
+// -----------------------------------
+void Channel::getRelayXMLTag(char *buf, size_t size, bool showStat)
 {
     const char *ststr;
     ststr = getStatusStr();
@@ -977,7 +1641,7 @@ XML::Node *Channel::createRelayXML(bool showStat)
 
     auto chl = chanMgr->findHitList(info);
 
-    return new XML::Node("relay listeners=\"%d\" relays=\"%d\" hosts=\"%d\" status=\"%s\"",
+    snprintf(buf, size, "relay listeners=\"%d\" relays=\"%d\" hosts=\"%d\" status=\"%s\"",
         localListeners(),
         localRelays(),
         (chl!=nullptr)?chl->numHits():0,
@@ -1047,30 +1711,207 @@ void Channel::writeTrackerUpdateAtom(AtomStream& atom)
 }
 
 // -----------------------------------
-// トラッカーである自分からYPへの通知。
-void Channel::broadcastTrackerUpdate(const GnuID &svID, bool force /* = false */)
+void Channel::writeMoveHintAtom(AtomStream& atom, const ChanHit& dest, ChanHit& parent, int ttl)
 {
-    unsigned int ctime = sys->getTime();
+    atom.writeParent(PCP_BCST, 11);
+        atom.writeChar(PCP_BCST_GROUP, PCP_BCST_GROUP_RELAYS);
+        atom.writeChar(PCP_BCST_HOPS, 0);
+        atom.writeChar(PCP_BCST_TTL, ttl);
+        atom.writeBytes(PCP_BCST_DEST, dest.sessionID.id, 16);
+        atom.writeBytes(PCP_BCST_FROM, servMgr->sessionID.id, 16);
+        atom.writeBytes(PCP_BCST_CHANID, info.id.id, 16);
+        atom.writeInt(PCP_BCST_VERSION, PCP_CLIENT_VERSION);
+        atom.writeInt(PCP_BCST_VERSION_VP, PCP_CLIENT_VERSION_VP);
+        atom.writeBytes(PCP_BCST_VERSION_EX_PREFIX, PCP_CLIENT_VERSION_EX_PREFIX, 2);
+        atom.writeShort(PCP_BCST_VERSION_EX_NUMBER, PCP_CLIENT_VERSION_EX_NUMBER);
+        // 知らないクライアントも host の子アトムは読み飛ばす。
+        parent.writeAtoms(atom, info.id, 1);
+            atom.writeChar(PCP_HOST_MOVE, 1);
+}
 
-    if (((ctime-lastTrackerUpdate) > 30) || (force))
+// -----------------------------------
+// 配信している自分を根とするリレーの木で、深い所にいるリレーに浅い親
+// を勧める。勧めは木を下って宛先に届く。
+void Channel::rebalanceRelayTree()
+{
+    lastRebalance = sys->getTime();
+
+    auto chl = chanMgr->findHitListByID(info.id);
+    if (!chl)
+        return;
+
+    ChanHit self;
+    self.initLocal(localListeners(), localRelays(), info.numSkips, info.getUptime(), isPlaying(),
+                   rawData.getOldestPos(), rawData.getLatestPos(), canAddRelay(), Host(), (ipVersion == IP_V6));
+    self.tracker = true;
+
+    std::vector<HostGraph::Move> moves;
+    {
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+        HostGraph graph(self, chl.get());
+        moves = graph.findShallowerParents(REBALANCE_DEPTH, MAX_REBALANCE_MOVES);
+    }
+
+    for (auto& m : moves)
     {
         ChanPacket pack;
+        MemoryStream mem(pack.data, sizeof(pack.data));
+        AtomStream atom(mem);
+
+        // 木が古くても届くよう一段余分に。
+        writeMoveHintAtom(atom, m.hit, m.parent, m.depth + 1);
+
+        pack.len = mem.pos;
+        pack.type = ChanPacket::T_PCP;
+
+        int cnt = servMgr->broadcastPacket(pack, info.id, servMgr->sessionID, m.hit.sessionID, Servent::T_RELAY);
+        LOG_INFO("Suggested %s (depth %d) to move under %s (depth %d), sent to %d relay(s)",
+                 m.hit.rhost[0].str().c_str(), m.depth,
+                 m.parent.rhost[0].str().c_str(), m.parentDepth, cnt);
+    }
+}
+
+// -----------------------------------
+void Channel::writeHubAssignAtom(AtomStream& atom, const ChanHit& dest, ChanHit& self, int lease)
+{
+    atom.writeParent(PCP_BCST, 11);
+        atom.writeChar(PCP_BCST_GROUP, PCP_BCST_GROUP_RELAYS);
+        atom.writeChar(PCP_BCST_HOPS, 0);
+        atom.writeChar(PCP_BCST_TTL, 1);
+        atom.writeBytes(PCP_BCST_DEST, dest.sessionID.id, 16);
+        atom.writeBytes(PCP_BCST_FROM, servMgr->sessionID.id, 16);
+        atom.writeBytes(PCP_BCST_CHANID, info.id.id, 16);
+        atom.writeInt(PCP_BCST_VERSION, PCP_CLIENT_VERSION);
+        atom.writeInt(PCP_BCST_VERSION_VP, PCP_CLIENT_VERSION_VP);
+        atom.writeBytes(PCP_BCST_VERSION_EX_PREFIX, PCP_CLIENT_VERSION_EX_PREFIX, 2);
+        atom.writeShort(PCP_BCST_VERSION_EX_NUMBER, PCP_CLIENT_VERSION_EX_NUMBER);
+        self.writeAtoms(atom, info.id, 1);
+            atom.writeInt(PCP_HOST_HUB, lease);
+}
+
+// -----------------------------------
+// ヒットが多くなったら、直下のリレーのいくつかにヒットの集約を任せる。
+// 任されたハブは下流の報告をまとめてから送ってくる。
+void Channel::assignTrackerHubs()
+{
+    lastHubAssign = sys->getTime();
+
+    auto chl = chanMgr->findHitListByID(info.id);
+    if (!chl)
+        return;
+
+    std::vector<ChanHit> hubs;
+    {
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+        hubs = TrackerHubs::pickHubs(*chl, TrackerHubs::MAX_HUBS);
+    }
+    if (hubs.empty())
+        return;
+
+    ChanHit self;
+    self.initLocal(localListeners(), localRelays(), info.numSkips, info.getUptime(), isPlaying(),
+                   rawData.getOldestPos(), rawData.getLatestPos(), canAddRelay(), Host(), (ipVersion == IP_V6));
+    self.tracker = true;
 
+    for (auto& hub : hubs)
+    {
+        ChanPacket pack;
         MemoryStream mem(pack.data, sizeof(pack.data));
         AtomStream atom(mem);
 
-        writeTrackerUpdateAtom(atom);
+        writeHubAssignAtom(atom, hub, self, TrackerHubs::LEASE);
 
         pack.len = mem.pos;
         pack.type = ChanPacket::T_PCP;
 
-        int cnt = servMgr->broadcastPacket(pack, GnuID(), servMgr->sessionID, svID, Servent::T_COUT);
+        int cnt = servMgr->broadcastPacket(pack, info.id, servMgr->sessionID, hub.sessionID, Servent::T_RELAY);
+        LOG_DEBUG("Assigned %s as tracker hub, sent to %d relay(s)", hub.rhost[0].str().c_str(), cnt);
+    }
+}
+
+// -----------------------------------
+bool Channel::suggestUpstream(const ChanHit& parent, const GnuID& from)
+{
+    if (isBroadcasting() || !isReceiving() || sourceHost.yp)
+        return false;
 
-        if (cnt)
-        {
-            LOG_DEBUG("Sent tracker update for %s to %d client(s)", info.name.cstr(), cnt);
-            lastTrackerUpdate = ctime;
-        }
+    if (!parent.rhost[0].ip || !parent.rhost[0].port || parent.firewalled)
+        return false;
+
+    if (parent.sessionID.isSet() && parent.sessionID.isSame(sourceHost.sessionID))
+        return false;
+
+    // このチャンネルのトラッカーからの勧めしか聞かない。
+    auto chl = chanMgr->findHitListByID(info.id);
+    if (!chl || !from.isSet())
+        return false;
+    bool fromTracker = false;
+    {
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+        for (auto h = chl->hit; h; h = h->next)
+            if (h->tracker && h->sessionID.isSame(from))
+                fromTracker = true;
+    }
+    if (!fromTracker)
+    {
+        LOG_DEBUG("Ignoring upstream suggestion from non-tracker %s", from.str().c_str());
+        return false;
+    }
+
+    std::lock_guard<ProfiledMutex> cs(lock);
+
+    unsigned int ctime = sys->getTime();
+    if (lastMoveTime && (ctime - lastMoveTime) < MIN_MOVE_INTERVAL)
+        return false;
+    lastMoveTime = ctime;
+
+    designatedHost = parent;
+    designatedHost.host = parent.rhost[0];
+    if (parent.rhost[0].ip == servMgr->serverHost.ip && parent.rhost[1].isValid())
+        designatedHost.host = parent.rhost[1];  // 同じ LAN にいる
+    designatedHost.next = nullptr;
+    moving = true;
+
+    LOG_INFO("Tracker suggested moving upstream to %s", designatedHost.host.str().c_str());
+    return true;
+}
+
+// -----------------------------------
+// トラッカーである自分からYPへの通知。
+void Channel::broadcastTrackerUpdate(const GnuID &svID, bool force /* = false */)
+{
+    unsigned int ctime = sys->getTime();
+
+    if (((ctime-lastTrackerUpdate) > 30) || (force))
+    {
+        // YP とのセッションに任せる時は頼むだけにして、全チャンネルの
+        // 分をまとめて送ってもらう。
+        if (servMgr->flags[ServMgr::F_ypSession] && !svID.isSet())
+            g_ypSession.requestUpdate(force, ctime);
+        else
+            sendTrackerUpdate(svID);
+    }
+}
+
+// -----------------------------------
+void Channel::sendTrackerUpdate(const GnuID &svID)
+{
+    ChanPacket pack;
+
+    MemoryStream mem(pack.data, sizeof(pack.data));
+    AtomStream atom(mem);
+
+    writeTrackerUpdateAtom(atom);
+
+    pack.len = mem.pos;
+    pack.type = ChanPacket::T_PCP;
+
+    int cnt = servMgr->broadcastPacket(pack, GnuID(), servMgr->sessionID, svID, Servent::T_COUT);
+
+    if (cnt)
+    {
+        LOG_DEBUG("Sent tracker update for %s to %d client(s)", info.name.cstr(), cnt);
+        lastTrackerUpdate = sys->getTime();
     }
 }
 
@@ -1092,7 +1933,8 @@ bool    Channel::sendPacketUp(ChanPacket &pack, const GnuID &cid, const GnuID &s
 // -----------------------------------
 bool Channel::updateInfo(const ChanInfo &newInfo)
 {
-    String oldComment = info.comment;
+    String oldComment = info.comment.toString();
+    ChanInfo oldInfo = info;
 
     if (!info.update(newInfo))
         return false; // チャンネル情報は更新されなかった。
@@ -1101,49 +1943,30 @@ bool Channel::updateInfo(const ChanInfo &newInfo)
     if (!oldComment.isSame(info.comment))
     {
         // Shift_JIS かも知れない文字列を UTF8 に変換したい。
-        String newComment = info.comment;
+        String newComment = info.comment.toString();
         newComment.convertTo(String::T_UNICODE);
 
         peercast::notifyMessage(ServMgr::NT_PEERCAST, info.name.str() + "「" + newComment.str() + "」");
     }
 
+    // ICY のタイトルのように続けて変わるものは、落ち着くまで溜めて
+    // flushMetadata でまとめて送る。
     if (isBroadcasting())
     {
+        std::lock_guard<std::mutex> cs(metaLock);
         unsigned int ctime = sys->getTime();
-        if ((ctime - lastMetaUpdate) > 30)
+        if (!metaPending)
         {
-            lastMetaUpdate = ctime;
-
-            ChanPacket pack;
-            MemoryStream mem(pack.data, sizeof(pack.data));
-            AtomStream atom(mem);
-
-            atom.writeParent(PCP_BCST, 10);
-                atom.writeChar(PCP_BCST_HOPS, 0);
-                atom.writeChar(PCP_BCST_TTL, 7);
-                atom.writeChar(PCP_BCST_GROUP, PCP_BCST_GROUP_RELAYS);
-                atom.writeBytes(PCP_BCST_FROM, servMgr->sessionID.id, 16);
-                atom.writeInt(PCP_BCST_VERSION, PCP_CLIENT_VERSION);
-                atom.writeInt(PCP_BCST_VERSION_VP, PCP_CLIENT_VERSION_VP);
-                atom.writeBytes(PCP_BCST_VERSION_EX_PREFIX, PCP_CLIENT_VERSION_EX_PREFIX, 2);
-                atom.writeShort(PCP_BCST_VERSION_EX_NUMBER, PCP_CLIENT_VERSION_EX_NUMBER);
-                atom.writeBytes(PCP_BCST_CHANID, info.id.id, 16);
-                atom.writeParent(PCP_CHAN, 3);
-                    atom.writeBytes(PCP_CHAN_ID, info.id.id, 16);
-                    info.writeInfoAtoms(atom);
-                    info.writeTrackAtoms(atom);
-
-            pack.len = mem.pos;
-            pack.type = ChanPacket::T_PCP;
-            servMgr->broadcastPacket(pack, info.id, servMgr->sessionID, GnuID(), Servent::T_RELAY);
-
-            broadcastTrackerUpdate(GnuID());
+            metaSentInfo = oldInfo;
+            metaPending = true;
+            metaPendingSince = ctime;
         }
+        metaChangedAt = ctime;
     }
 
     auto chl = chanMgr->findHitList(info);
     if (chl) {
-        std::lock_guard<std::recursive_mutex> lock(chl->lock);
+        std::lock_guard<ProfiledMutex> lock(chl->lock);
         chl->info = info;
     }
 
@@ -1151,6 +1974,73 @@ bool Channel::updateInfo(const ChanInfo &newInfo)
     return true;
 }
 
+// -----------------------------------
+void Channel::flushMetadata(bool force)
+{
+    ChanInfo prev;
+    {
+        std::lock_guard<std::mutex> cs(metaLock);
+        if (!metaPending)
+            return;
+
+        unsigned int ctime = sys->getTime();
+        if (!force &&
+            (ctime - metaChangedAt) < META_QUIET_SEC &&
+            (ctime - metaPendingSince) < META_MAX_DELAY_SEC)
+            return;
+
+        metaPending = false;
+        prev = metaSentInfo;
+    }
+
+    ChanInfo cur = info;
+    StringStream delta;
+    AtomStream deltaAtom(delta);
+    int n = cur.writeDeltaAtoms(deltaAtom, prev);
+    if (!n)
+        return; // 元に戻った。
+
+    ChanPacket pack;
+    MemoryStream mem(pack.data, sizeof(pack.data));
+    AtomStream atom(mem);
+
+    atom.writeParent(PCP_BCST, 10);
+        atom.writeChar(PCP_BCST_HOPS, 0);
+        atom.writeChar(PCP_BCST_TTL, 7);
+        atom.writeChar(PCP_BCST_GROUP, PCP_BCST_GROUP_RELAYS);
+        atom.writeBytes(PCP_BCST_FROM, servMgr->sessionID.id, 16);
+        atom.writeInt(PCP_BCST_VERSION, PCP_CLIENT_VERSION);
+        atom.writeInt(PCP_BCST_VERSION_VP, PCP_CLIENT_VERSION_VP);
+        atom.writeBytes(PCP_BCST_VERSION_EX_PREFIX, PCP_CLIENT_VERSION_EX_PREFIX, 2);
+        atom.writeShort(PCP_BCST_VERSION_EX_NUMBER, PCP_CLIENT_VERSION_EX_NUMBER);
+        atom.writeBytes(PCP_BCST_CHANID, cur.id.id, 16);
+        atom.writeParent(PCP_CHAN, 1 + n);
+            atom.writeBytes(PCP_CHAN_ID, cur.id.id, 16);
+            auto s = delta.str();
+            mem.write(s.data(), s.size());
+
+    pack.len = mem.pos;
+    pack.type = ChanPacket::T_PCP;
+    servMgr->broadcastPacket(pack, cur.id, servMgr->sessionID, GnuID(), Servent::T_RELAY);
+    LOG_DEBUG("Sent channel info update for %s (%d bytes)", cur.name.cstr(), (int) s.size());
+
+    broadcastTrackerUpdate(GnuID());
+}
+
+// -----------------------------------
+// ストリームを読むたびに呼ばれるので、変わらない時は ChanInfo を写さ
+// ない。
+// -----------------------------------
+bool Channel::updateBitrate(int bitrate)
+{
+    if (info.bitrate == bitrate)
+        return false;
+
+    ChanInfo newInfo = info;
+    newInfo.bitrate = bitrate;
+    return updateInfo(newInfo);
+}
+
 // -----------------------------------
 std::shared_ptr<ChannelStream> Channel::createSource()
 {
@@ -1236,69 +2126,39 @@ bool    Channel::checkBump()
 }
 
 // -----------------------------------
-int Channel::readStream(Stream &in, std::shared_ptr<ChannelStream> source)
+int Channel::readStream(Stream &src, std::shared_ptr<ChannelStream> source)
 {
     int error = 0;
 
-    info.numSkips = 0;
+    // 取り込みを記録する (capture.h)。リレーの PCP は記録しない。
+    std::shared_ptr<CaptureWriter> capture;
+    if (servMgr->flags[ServMgr::F_sourceCapture] && info.srcProtocol != ChanInfo::SP_PCP)
+        capture = SourceCapture::openFor(shared_from_this());
+    std::unique_ptr<CaptureStream> captureStream;
+    if (capture)
+        captureStream.reset(new CaptureStream(src, capture));
+    Stream &in = captureStream ? static_cast<Stream&>(*captureStream) : src;
 
-    source->readHeader(in, shared_from_this());
-
-    peercastApp->channelStart(&info);
-
-    rawData.lastWriteTime = 0;
+    beginReadStream(in, source);
 
     bool wasBroadcasting=false;
 
     try
     {
-        while (thread.active() && !peercastInst->isQuitting)
+        while (continueReadStream(in, error))
         {
-            if (checkIdle())
-            {
-                LOG_DEBUG("Channel idle");
-                //peercast::notifyMessage(ServMgr::NT_PEERCAST, "チャンネル "+chName(info)+" がアイドル状態になりました。");
-                break;
-            }
-
-            if (checkBump())
-            {
-                LOG_DEBUG("Channel bumped");
-                //peercast::notifyMessage(ServMgr::NT_PEERCAST, "チャンネル "+chName(info)+" をバンプしました。");
-                error = -1;
-                break;
-            }
-
-            if (in.eof())
-            {
-                LOG_DEBUG("Channel eof");
-                break;
-            }
-
-            if (in.readReady(sys->idleSleepTime))
+            // データが届けばすぐ戻るので、長く待っても遅れない。短い間
+            // 隔で起きると、チャンネルが多い時に待つだけのスレッドが
+            // CPU を使う。
+            int wait = source->hasUpstreamOutput() ? sys->idleSleepTime : SOURCE_READ_WAIT;
+            if (in.readReady(wait))
             {
                 error = source->readPacket(in, shared_from_this());
 
                 if (error)
                     break;
 
-                if (rawData.writePos > 0)
-                {
-                    if (isBroadcasting())
-                    {
-                        if ((sys->getTime() - lastTrackerUpdate) >= 120)
-                        {
-                            broadcastTrackerUpdate(GnuID());
-                        }
-                        wasBroadcasting = true;
-                    }else
-                    {
-                        if (!isReceiving())
-                            peercast::notifyMessage(ServMgr::NT_PEERCAST, info.name.str() + "を受信中です。");
-                        setStatus(Channel::S_RECEIVING);
-                    }
-                    source->updateStatus(shared_from_this());
-                }
+                afterReadPacket(source, wasBroadcasting);
             }
         }
     }catch (StreamException &e)
@@ -1307,18 +2167,242 @@ int Channel::readStream(Stream &in, std::shared_ptr<ChannelStream> source)
         error = -1;
     }
 
+    endReadStream(in, source, wasBroadcasting);
+
+    if (capture)
+        capture->close();
+
+    return error;
+}
+
+// -----------------------------------
+void Channel::beginReadStream(Stream &in, std::shared_ptr<ChannelStream> source)
+{
+    info.numSkips = 0;
+
+    source->readHeader(in, shared_from_this());
+
+    peercastApp->channelStart(&info);
+
+    rawData.lastWriteTime = 0;
+}
+
+// -----------------------------------
+void Channel::endReadStream(Stream &in, std::shared_ptr<ChannelStream> source, bool wasBroadcasting)
+{
     setStatus(S_CLOSING);
 
     if (wasBroadcasting)
     {
-        broadcastTrackerUpdate(GnuID(), true);
+        // 閉じた後ではまとめて送る時に漏れるので、すぐに送る。
+        sendTrackerUpdate(GnuID());
     }
 
     peercastApp->channelStop(&info);
 
     source->readEnd(in, shared_from_this());
+}
 
-    return error;
+// -----------------------------------
+bool Channel::continueReadStream(Stream &in, int &error)
+{
+    if (!thread.active() || peercastInst->isQuitting)
+        return false;
+
+    if (checkIdle())
+    {
+        LOG_DEBUG("Channel idle");
+        //peercast::notifyMessage(ServMgr::NT_PEERCAST, "チャンネル "+chName(info)+" がアイドル状態になりました。");
+        return false;
+    }
+
+    if (moving)
+    {
+        LOG_INFO("Channel moving to %s", designatedHost.host.str().c_str());
+        return false;
+    }
+
+    if (takeOverRequested)
+    {
+        LOG_INFO("Channel source stalled, handing over to backup");
+        return false;
+    }
+
+    if (checkBump())
+    {
+        LOG_DEBUG("Channel bumped");
+        //peercast::notifyMessage(ServMgr::NT_PEERCAST, "チャンネル "+chName(info)+" をバンプしました。");
+        error = -1;
+        return false;
+    }
+
+    if (in.eof())
+    {
+        LOG_DEBUG("Channel eof");
+        return false;
+    }
+
+    return true;
+}
+
+// -----------------------------------
+void Channel::afterReadPacket(std::shared_ptr<ChannelStream> source, bool &wasBroadcasting)
+{
+    if (rawData.writePos == 0)
+        return;
+
+    if (isBroadcasting())
+    {
+        if ((sys->getTime() - lastTrackerUpdate) >= 120)
+        {
+            broadcastTrackerUpdate(GnuID());
+        }
+        flushMetadata();
+        if (servMgr->flags[ServMgr::F_rebalanceRelayTree] &&
+            (sys->getTime() - lastRebalance) >= REBALANCE_INTERVAL)
+        {
+            rebalanceRelayTree();
+        }
+        if (servMgr->flags[ServMgr::F_trackerHubs] &&
+            (sys->getTime() - lastHubAssign) >= TrackerHubs::ASSIGN_INTERVAL)
+        {
+            assignTrackerHubs();
+        }
+        wasBroadcasting = true;
+    }else
+    {
+        if (!isReceiving())
+            peercast::notifyMessage(ServMgr::NT_PEERCAST, info.name.str() + "を受信中です。");
+        setStatus(Channel::S_RECEIVING);
+    }
+    source->updateStatus(shared_from_this());
+}
+
+// -----------------------------------
+// ソースが PCP で、リアクターとソケットの記述子が使えれば、受信をリア
+// クターに任せる準備をして true を返す。
+bool Channel::prepareReactorSource()
+{
+    auto pcp = std::dynamic_pointer_cast<PCPStream>(sourceStream);
+    if (!pcp)
+        return false;
+
+    auto reactor = servMgr->getReactor();
+    if (!reactor)
+        return false;
+
+    try
+    {
+        sock->getDescriptor();
+    }catch (NotImplementedException&)
+    {
+        return false;
+    }
+
+    LOG_DEBUG("Channel reading %s on the reactor", info.name.cstr());
+
+    reactorSource.reset(new ReactorSource());
+    reactorSource->reactor = reactor;
+    reactorSource->stream = pcp;
+    return true;
+}
+
+// -----------------------------------
+// prepareReactorSource で準備した受信をリアクターに登録する。以後この
+// チャンネルの受信はリアクターのハンドラーが受け持つ。
+bool Channel::startReactorSource()
+{
+    auto& rs = *reactorSource;
+
+    if (!thread.active() || peercastInst->isQuitting || !sock || !sock->active())
+        return false;
+
+    beginReadStream(*sock, rs.stream);
+    rs.lastReadTime = sys->getTime();
+
+    auto self = shared_from_this();
+    rs.id = rs.reactor->add(sock->getDescriptor(), Reactor::EV_READ,
+                            [self](int events) { self->onReactorSource(events); });
+    return true;
+}
+
+// -----------------------------------
+void Channel::onReactorSource(int events)
+{
+    auto& rs = *reactorSource;
+    int error = 0;
+
+    try
+    {
+        if (continueReadStream(*sock, error))
+        {
+            if (rs.stream->hasUpstreamOutput())
+            {
+                WriteBufferedStream bsock(sock.get());
+                error = rs.stream->writeOutput(bsock);
+                bsock.flush();
+            }
+
+            // 他のチャンネルを待たせないよう、一度に読む回数は限る。残り
+            // はもう一度呼ばれて読む。
+            int reads = 0;
+            while (!error && reads < MAX_REACTOR_READS && sock->readReady(0))
+            {
+                BroadcastState bcs;
+                error = rs.stream->readAvailable(*sock, rs.buf, bcs);
+                if (!error)
+                    afterReadPacket(rs.stream, rs.wasBroadcasting);
+                rs.lastReadTime = sys->getTime();
+                reads++;
+            }
+
+            if (!error)
+            {
+                if ((events & Reactor::EV_ERROR) && !reads)
+                    throw SockException("Closed on read");
+
+                // アトムの途中で止まったままなら、スレッドで読んでいた時
+                // と同じく読み込みタイムアウトで切る。
+                if (!rs.buf.empty() && sock->readTimeout &&
+                    (sys->getTime() - rs.lastReadTime) * 1000 > sock->readTimeout)
+                    throw TimeoutException();
+
+                // ソケットのバッファーに残っている分は、記述子が読めるよ
+                // うにならないので自分で呼び直す。
+                if (reads == MAX_REACTOR_READS && sock->readReady(0))
+                    rs.reactor->post(rs.id);
+                return;
+            }
+        }
+    }catch (StreamException &e)
+    {
+        LOG_ERROR("readStream: %s", e.msg);
+        error = -1;
+    }
+
+    finishReactorSource(error);
+}
+
+// -----------------------------------
+// リアクターでの受信を終えて、ソースの後始末を続きのスレッドに任せる。
+void Channel::finishReactorSource(int error)
+{
+    auto& rs = *reactorSource;
+
+    rs.reactor->remove(rs.id);
+    rs.error = error;
+    endReadStream(*sock, rs.stream, rs.wasBroadcasting);
+
+    // これ以後 reactorSource は続きのスレッドのもの。
+    resumeThread.channel = shared_from_this();
+    resumeThread.func = stream;
+    resumeThread.threadClass = ThreadClass::T_INGEST;
+    if (!sys->startThread(&resumeThread))
+    {
+        resumeThread.channel = nullptr;
+        reactorSource = nullptr;
+        endThread();
+    }
 }
 
 // ------------------------------------------
@@ -1364,8 +2448,8 @@ std::string Channel::getSourceString()
 
     if (sourceURL.isEmpty())
     {
-        if (srcType == SRC_HTTPPUSH)
-            buf = sock->host.str();
+        if (srcType == SRC_HTTPPUSH || srcType == SRC_RTMP)
+            buf = sock ? sock->host.str() : "localhost (shared memory)";
         else
         {
             buf = sourceHost.str(true);
@@ -1395,7 +2479,7 @@ std::string Channel::getBufferString()
 
     // 統計情報と齟齬しない lastWriteTime を呼び出すために rawData を
     // ロックする。
-    std::lock_guard<std::recursive_mutex> cs(rawData.lock);
+    std::lock_guard<ProfiledMutex> cs(rawData.lock);
     auto lastWritten = (double)sys->getTime() - rawData.lastWriteTime;
 
     if (lastWritten < 5)
@@ -1444,12 +2528,12 @@ amf0::Value Channel::getState()
 
     return amf0::Value::object(
         {
-            {"name", String(info.name).convertTo(String::T_UNICODE).c_str()},
+            {"name", info.name.toString().convertTo(String::T_UNICODE).c_str()},
             {"bitrate", to_string(info.bitrate)},
             {"srcrate", (sourceData) ? str::format("%.0f", BYTES_TO_KBPS(sourceData->getSourceRate())) : "0"},
-            {"genre", String(info.genre).convertTo(String::T_UNICODE).c_str()},
-            {"desc", String(info.desc).convertTo(String::T_UNICODE).c_str()},
-            {"comment", String(info.comment).convertTo(String::T_UNICODE).c_str()},
+            {"genre", info.genre.toString().convertTo(String::T_UNICODE).c_str()},
+            {"desc", info.desc.toString().convertTo(String::T_UNICODE).c_str()},
+            {"comment", info.comment.toString().convertTo(String::T_UNICODE).c_str()},
             {"uptime", (info.lastPlayStart) ? String().setFromStopwatch(sys->getTime()-info.lastPlayStart).c_str() : "-"},
             {"type", info.getTypeStr()},
             {"typeLong", info.getTypeStringLong()},
@@ -1464,11 +2548,11 @@ amf0::Value Channel::getState()
 
             {"track",
              {
-                 {"title", String(info.track.title).convertTo(String::T_UNICODE).c_str()},
-                 {"artist", String(info.track.artist).convertTo(String::T_UNICODE).c_str()},
-                 {"album", String(info.track.album).convertTo(String::T_UNICODE).c_str()},
-                 {"genre", String(info.track.genre).convertTo(String::T_UNICODE).c_str()},
-                 {"contactURL", String(info.track.contact).convertTo(String::T_UNICODE).c_str()},
+                 {"title", info.track.title.toString().convertTo(String::T_UNICODE).c_str()},
+                 {"artist", info.track.artist.toString().convertTo(String::T_UNICODE).c_str()},
+                 {"album", info.track.album.toString().convertTo(String::T_UNICODE).c_str()},
+                 {"genre", info.track.genre.toString().convertTo(String::T_UNICODE).c_str()},
+                 {"contactURL", info.track.contact.toString().convertTo(String::T_UNICODE).c_str()},
              }},
             {"contactURL", info.url.cstr()},
             {"streamPos", str::group_digits(std::to_string(streamPos), ",")},
@@ -1478,13 +2562,16 @@ amf0::Value Channel::getState()
             {"headPos", str::group_digits(std::to_string(headPack.pos), ",")},
             {"headLen", str::group_digits(std::to_string(headPack.len), ",")},
             {"buffer", getBufferString()},
+            {"memoryBytes", (double) memoryUsage()},
             {"headDump", renderHexDump(std::string(headPack.data, headPack.data + headPack.len))},
             {"numHits", to_string((chl) ? chl->numHits() : 0)},
             {"hits", hits},
             {"authToken", chanMgr->authToken(info.id).c_str()},
             {"plsExt", info.getPlayListExt()},
             {"ipVersion", std::to_string((int)ipVersion)},
+            {"packetBufferDuration", std::to_string(packetBufferDuration)},
             {"rootHost", rootHost},
+            {"thread", ThreadAccount::stateOf(thread)},
         });
 }
 
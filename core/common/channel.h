@@ -19,6 +19,8 @@
 #ifndef _CHANNEL_H
 #define _CHANNEL_H
 
+#include <deque>
+
 #include "sys.h"
 #include "stream.h"
 #include "xml.h"
@@ -26,6 +28,11 @@
 #include "cstream.h"
 #include "chanpacket.h"
 #include "varwriter.h"
+#include "lockprof.h"
+
+class PCPMuxSession;
+class PCPStream;
+class Reactor;
 
 // --------------------------------------------------
 struct MP3Header
@@ -48,6 +55,7 @@ struct MP3Header
 // ----------------------------------
 #include "chaninfo.h"
 #include "chanhit.h"
+#include "standby.h"
 
 // ----------------------------------
 class ChanMeta
@@ -97,14 +105,49 @@ public:
 class PeercastSource : public ChannelSource
 {
 public:
+    enum
+    {
+        MIN_THROUGHPUT_SAMPLE = 10, // 受信速度を記録するのに要る受信秒数
+        ALTERNATE_LIFETIME    = 30, // 選ばなかった候補を使い回す秒数
+        RACE_WIDTH            = 3,  // 同時に接続を試みる候補の数
+        MUX_START_TIMEOUT     = 30, // 相乗りを頼んでから最初のパケットを待つ秒数
+    };
 
-    PeercastSource() : m_channel(nullptr) {}
+    PeercastSource() : m_channel(nullptr), m_alternatesTime(0), m_streamStart(0) {}
+    ~PeercastSource();
     void    stream(std::shared_ptr<Channel>) override;
     int     getSourceRate() override;
     int     getSourceRateAvg() override;
     ChanHit pickFromHitList(std::shared_ptr<Channel> ch, ChanHit &oldHit);
 
     std::shared_ptr<Channel> m_channel;
+
+    // 前に選んだ時の残りの候補。
+    std::deque<ChanHitRanking::Candidate> m_alternates;
+    unsigned int m_alternatesTime;
+
+    // 受信中に張っておく控えの上流接続と、上流が切れた時に取り出したもの。
+    std::unique_ptr<StandbyUpstream> m_standby;
+    std::shared_ptr<ClientSocket> m_promotedSock;
+    ChanHit      m_promotedHit;
+
+    // 上流と x-peercast-mux を交わした時に、他のチャンネルに貸している
+    // 接続。
+    std::shared_ptr<PCPMuxSession> m_muxSession;
+
+    // 受信をリアクターに任せた時の、受信を始めた時刻。
+    double       m_streamStart;
+
+private:
+    void    startStandby(std::shared_ptr<Channel> ch);
+    void    stopStandby(std::shared_ptr<Channel> ch);
+    void    openMuxSession(std::shared_ptr<Channel> ch);
+    void    closeMuxSession();
+    // 他のチャンネルの接続に相乗りして受け取る。
+    int     streamMux(std::shared_ptr<Channel> ch, std::shared_ptr<PCPMuxSession> mux);
+    void    endStream(std::shared_ptr<Channel> ch, int error, double streamStart);
+    void    endReactorStream(std::shared_ptr<Channel> ch);
+    void    waitIdle(std::shared_ptr<Channel> ch);
 };
 
 // ----------------------------------
@@ -145,7 +188,8 @@ public:
         SRC_SHOUTCAST,
         SRC_ICECAST,
         SRC_URL,
-        SRC_HTTPPUSH
+        SRC_HTTPPUSH,
+        SRC_RTMP
     };
 
     enum IP_VERSION
@@ -154,6 +198,19 @@ public:
         IP_V6 = 6
     };
 
+    enum
+    {
+        REBALANCE_INTERVAL  = 60,   // 配信中にリレーの木を見直す秒数
+        REBALANCE_DEPTH     = 3,    // これより深いリレーに付け替えを勧める
+        MAX_REBALANCE_MOVES = 4,    // 一度に勧める付け替えの数
+        MIN_MOVE_INTERVAL   = 300,  // 勧められて付け替えてから次に応じるまでの秒数
+        BACKUP_TAKEOVER_SEC = 3,    // 今のソースがこの秒数止まっていれば予備にすぐ切り替える
+        SOURCE_READ_WAIT    = 200,  // ソースからの受信を待つミリ秒数。上流に送るものがある時は idleSleepTime
+        MAX_REACTOR_READS   = 16,   // リアクターで受信する時に一度のイベントで読む回数
+        META_QUIET_SEC      = 2,    // 情報の変更がこの秒数止んだら、まとめて下流に送る
+        META_MAX_DELAY_SEC  = 10,   // 変わり続けていても、これより長くは溜めない
+    };
+
     Channel();
     void    reset();
     void    endThread();
@@ -164,9 +221,19 @@ public:
     void    startURL(const char *);
     void    startHTTPPush(std::shared_ptr<ClientSocket>, bool isChunked);
     void    startWMHTTPPush(std::shared_ptr<ClientSocket> cs);
+    void    startRTMP(std::shared_ptr<ClientSocket> cs, std::shared_ptr<class RTMPSession> session);
+    // 外部の rtmp-server が共有メモリーに書く FLV を放送する (shmring.h)。
+    void    startShm(std::shared_ptr<class ShmRing> ring);
 
     std::shared_ptr<ChannelStream> createSource();
 
+    // 放送中のチャンネルに同じ ID で来た取り込み接続を予備として置く。
+    // 今のソースが終わるか止まっていれば、チャンネルを作り直さずにこち
+    // らで続ける。受け付けなければ false。
+    bool    addBackupSource(std::shared_ptr<ClientSocket> cs, std::shared_ptr<ChannelSource> source,
+                            SRC_TYPE st, ChanInfo::TYPE contentType);
+    bool    switchToBackup();
+
     void    resetPlayTime();
 
     bool    notFound()
@@ -176,7 +243,7 @@ public:
 
     bool    isPlaying()
     {
-        std::lock_guard<std::recursive_mutex> cs(lock);
+        std::lock_guard<ProfiledMutex> cs(lock);
         return (status == S_RECEIVING) || (status == S_BROADCASTING);
     }
 
@@ -187,7 +254,7 @@ public:
 
     bool    isBroadcasting()
     {
-        std::lock_guard<std::recursive_mutex> cs(lock);
+        std::lock_guard<ProfiledMutex> cs(lock);
         return (status == S_BROADCASTING);
     }
 
@@ -199,12 +266,35 @@ public:
     bool    checkIdle();
     void    sleepUntil(double);
 
+    // ICY のメタデータブロック (16 バイト単位の長さの 1 バイトと、0 で
+    // 埋めた本体) を返す。同じ題名と URL のブロックは聴取者の間で使い
+    // 回す。
+    std::shared_ptr<const std::string> getIcyMetaBlock(const CompactString& title, const CompactString& url);
+
+    // HLS 出力のセグメンター。最初に要求された時に作る。
+    std::shared_ptr<class HLSSegmenter> getHLSSegmenter();
+
+    // 音声だけの出力の取り出し器。最初に要求された時に作る。
+    std::shared_ptr<class AACExtractor> getAACExtractor();
+
+    // プレビュー用の最新のキーフレーム。最初に要求された時に作る。
+    std::shared_ptr<class ThumbnailCache> getThumbnailCache();
+
+    // chanMgr->dvrSize が設定されていれば、タイムシフト用のディスクの
+    // リングを作って rawData に付ける。
+    void    openArchive();
+
+    // 録画を始めて最初のファイルのパスを返す。録画中なら何もしない。
+    std::string startRecording();
+    void    stopRecording();
+    std::shared_ptr<class ChannelRecorder> getRecorder() { return std::atomic_load(&recorder); }
+
     bool    isActive()
     {
         return type != T_NONE;
     }
 
-    void    connectFetch();
+    int     connectFetch(const std::vector<ChanHit>& alternates = {});
     int     handshakeFetch();
 
     bool    isIdle() { return isActive() && (status==S_IDLE); }
@@ -219,21 +309,55 @@ public:
     int          getBitrate() { return info.bitrate; }
     std::string  getSourceString();
     std::string  getBufferString();
+    // このチャンネルが使っているおよそのバイト数。
+    uint64_t     memoryUsage() { return sizeof(Channel) + rawData.memoryUsage(); }
 
     void         writeTrackerUpdateAtom(AtomStream& atom);
+
+    // トラッカーから dest へ、parent を上流にするよう勧める。
+    void         writeMoveHintAtom(AtomStream& atom, const ChanHit& dest, ChanHit& parent, int ttl);
+    void         rebalanceRelayTree();
+    // トラッカーから dest に、lease 秒だけヒットの集約を任せる。
+    void         writeHubAssignAtom(AtomStream& atom, const ChanHit& dest, ChanHit& self, int lease);
+    void         assignTrackerHubs();
+    // 勧めに応じるなら、今の上流から読むのを止めて parent に繋ぎ直す。
+    bool         suggestUpstream(const ChanHit& parent, const GnuID& from);
     void         broadcastTrackerUpdate(const GnuID &, bool = false);
+    // 間隔を見ずに、すぐにトラッカー更新を送る。
+    void         sendTrackerUpdate(const GnuID &);
     bool         sendPacketUp(ChanPacket &, const GnuID &, const GnuID &, const GnuID &);
 
     amf0::Value  getState() override;
     bool         acceptGIV(std::shared_ptr<ClientSocket>);
     bool         updateInfo(const ChanInfo &);
+    // 配信中に溜まった情報の変更が落ち着いていれば、変わった項目だけ
+    // をリレーに送る。force なら待たない。
+    void         flushMetadata(bool force = false);
+    // ビットレートだけを変える。変わらなければ info を写さずに false。
+    bool         updateBitrate(int bitrate);
     int          readStream(Stream &, std::shared_ptr<ChannelStream>);
+    void         beginReadStream(Stream &, std::shared_ptr<ChannelStream>);
+    void         endReadStream(Stream &, std::shared_ptr<ChannelStream>, bool wasBroadcasting);
+    // 受信を続けるか。やめる時は理由をログに出し、エラーなら error を
+    // 設定する。
+    bool         continueReadStream(Stream &, int &error);
+    void         afterReadPacket(std::shared_ptr<ChannelStream>, bool &wasBroadcasting);
+
+    // PCP のソースの受信をリアクターに任せる。prepare はソースが受信を
+    // 始める所で呼び、true ならスレッドを抜ける。start はスレッドの最後
+    // にハンドラーを登録する。受信を終えたハンドラーは resumeThread で
+    // 続きを立て、ソースは reactorSource の error を見て後始末をする。
+    bool         prepareReactorSource();
+    bool         startReactorSource();
+    void         onReactorSource(int events);
+    void         finishReactorSource(int error);
     void         checkReadDelay(unsigned int);
     void         processMp3Metadata(char *);
     void         readHeader();
     void         startStream();
 
     XML::Node    *createRelayXML(bool);
+    void         getRelayXMLTag(char *buf, size_t size, bool showStat);
 
     void         newPacket(ChanPacket &);
 
@@ -254,16 +378,33 @@ public:
 
     std::shared_ptr<ChannelStream> sourceStream;
     unsigned int        streamIndex;
+    unsigned int        lastTraceSample;    // 最後に追跡の印を付けた時刻 (pkttrace.h)
+    bool                archiveTried;       // openArchive を試した
 
     ChanInfo            info;
     ChanHit             sourceHost;
     ChanHit             designatedHost;
 
     GnuID               remoteID;
+    bool                muxUpstream;        // 上流と x-peercast-mux を交わした (pcpmux.h)
 
     ::String            sourceURL;
 
     bool                bump, stayConnected;
+
+    // このチャンネルのバッファーの秒数。0 なら chanMgr の設定に従う。
+    // キープしたリレーと一緒に保存する。
+    unsigned int        packetBufferDuration;
+    unsigned int        effectiveBufferDuration();
+
+    // 上流の付け替えのために今の上流から読むのを止める。下流には切断
+    // を伝えず、繋ぎ直したら続きから流す。
+    std::atomic<bool>   moving;
+    // 下流への送信でパケットを飛ばした回数の通算 (statshist.h)。
+    std::atomic<unsigned int> numSkips;
+    unsigned int        lastMoveTime;
+    unsigned int        lastRebalance;
+    unsigned int        lastHubAssign;
     int                 icyMetaInterval;
     unsigned int        streamPos;
     bool                readDelay;
@@ -275,6 +416,22 @@ public:
 
     MP3Header           mp3Head;
     ThreadInfo          thread;
+    // リアクターでの受信を終えた後の続きのスレッド。止めるのは thread
+    // の shutdown で行う。
+    ThreadInfo          resumeThread;
+
+    // リアクターで受信している時の状態。
+    struct ReactorSource
+    {
+        std::shared_ptr<Reactor>    reactor;
+        uint64_t                    id = 0;
+        std::shared_ptr<PCPStream>  stream;
+        std::string                 buf;            // 途中まで届いたアトム
+        unsigned int                lastReadTime = 0;
+        bool                        wasBroadcasting = false;
+        int                         error = 0;
+    };
+    std::unique_ptr<ReactorSource> reactorSource;
 
     unsigned int        lastIdleTime;
     STATUS              status;
@@ -283,16 +440,47 @@ public:
     std::shared_ptr<ClientSocket> sock;
     std::shared_ptr<ClientSocket> pushSock;
 
+    // 予備の取り込み接続 (addBackupSource)。
+    std::mutex                      backupLock;
+    std::shared_ptr<ClientSocket>   backupSock;
+    std::shared_ptr<ChannelSource>  backupSource;
+    std::atomic<bool>               takeOverRequested;  // 今のソースを止めて予備に替える
+    // 予備に切り替えた時に、新しいソースが続きとして読むもの。
+    std::shared_ptr<ChannelStream>  lastSourceStream;
+
     unsigned int        lastTrackerUpdate;
-    unsigned int        lastMetaUpdate;
 
+    // 下流にまだ送っていない情報の変更。metaSentInfo は下流が知ってい
+    // る情報、metaPendingSince は最初の変更の時刻。
+    std::mutex          metaLock;
+    bool                metaPending;
+    ChanInfo            metaSentInfo;
+    unsigned int        metaPendingSince;
+    unsigned int        metaChangedAt;
+
+    // readDelay で読み込みを律速する時の、単調時計での基準時刻と次の
+    // 期限。
     double              startTime;
+    double              readDelayDeadline;
 
     IP_VERSION          ipVersion;
 
     std::string         rootHost;
 
-    mutable std::recursive_mutex lock;
+    mutable ProfiledMutex lock { "Channel::lock" };
+
+    // チャンネルが終了して ChanMgr から外されると真になる。送信側はチャ
+    // ンネルへの参照を持ち続け、これが立った時だけ探し直す。
+    std::atomic<bool>   closed;
+
+    // 最近作った ICY メタデータブロック。新しいものが先頭。
+    std::mutex          icyMetaLock;
+    std::deque<std::pair<std::string, std::shared_ptr<const std::string>>> icyMetaCache;
+
+    std::shared_ptr<class HLSSegmenter> hlsSegmenter;
+    std::shared_ptr<class AACExtractor> aacExtractor;
+    std::shared_ptr<class ThumbnailCache> thumbnailCache;
+    std::shared_ptr<class ChannelRecorder> recorder;
 
     std::shared_ptr<Channel> next;
 };
@@ -19,8 +19,14 @@
 // ------------------------------------------------
 
 #include "chanpacket.h"
+#include "dvr.h"
 #include "sys.h"
 #include "stream.h"
+#include "atom.h"
+#include "pcp.h"
+
+#include <algorithm>
+#include <new>
 
 // -----------------------------------
 void ChanPacket::init(TYPE t, const void *p, unsigned int l, unsigned int _pos)
@@ -31,10 +37,11 @@ void ChanPacket::init(TYPE t, const void *p, unsigned int l, unsigned int _pos)
     len = l;
     memcpy(data, p, len);
     pos = _pos;
+    trace = {};
 }
 
 // -----------------------------------
-void ChanPacket::writeRaw(Stream &out)
+void ChanPacket::writeRaw(Stream &out) const
 {
     out.write(data, len);
 }
@@ -47,78 +54,333 @@ ChanPacket& ChanPacket::operator=(const ChanPacket& other)
     this->pos  = other.pos;
     this->sync = other.sync;
     this->cont = other.cont;
+    this->trace = other.trace;
     memcpy(this->data, other.data, this->len);
 
     return *this;
 }
 
+// -----------------------------------
+void ChanPacketSlab::writeRaw(Stream &out) const
+{
+    out.write(data, len);
+}
+
+// -----------------------------------
+void ChanPacketSlab::copyTo(ChanPacket &pack) const
+{
+    pack.type = type;
+    pack.len  = len;
+    pack.pos  = pos;
+    pack.sync = sync;
+    pack.cont = cont;
+    pack.trace = trace;
+    memcpy(pack.data, data, len);
+}
+
+// -----------------------------------
+bool ChanPacketSlab::pcpFrame(const GnuID &chanID, const char *&frame, int &flen) const
+{
+    static_assert(offsetof(ChanPacketSlab, pcpHead) + PCP_HEADER_MAX == sizeof(ChanPacketSlab),
+                  "pcpHead must be immediately followed by the packet data");
+
+    if (type != ChanPacket::T_HEAD && type != ChanPacket::T_DATA)
+        return false;
+    // 印は送り先ごとに書き直すので共有できない。
+    if (trace.id)
+        return false;
+
+    int state = pcpState.load(std::memory_order_acquire);
+    if (state == 0)
+    {
+        // 最初に来たスレッドだけが作る。作っている間に来たスレッドは諦
+        // めて自分で組み立てる。
+        if (!pcpState.compare_exchange_strong(state, 1, std::memory_order_acquire))
+            return false;
+
+        const bool withCont = (type == ChanPacket::T_DATA && cont);
+        char tmp[PCP_HEADER_MAX];
+        MemoryStream mem(tmp, sizeof(tmp));
+        AtomStream atom(mem);
+        atom.writeParent(PCP_CHAN, 2);
+            atom.writeBytes(PCP_CHAN_ID, chanID.id, 16);
+            atom.writeParent(PCP_CHAN_PKT, withCont ? 4 : 3);
+                atom.writeID4(PCP_CHAN_PKT_TYPE, (type == ChanPacket::T_HEAD) ? PCP_CHAN_PKT_HEAD : PCP_CHAN_PKT_DATA);
+                atom.writeInt(PCP_CHAN_PKT_POS, pos);
+                if (withCont)
+                    atom.writeChar(PCP_CHAN_PKT_CONTINUATION, true);
+                // PCP_CHAN_PKT_DATA はアトムヘッダーだけ。
+                mem.writeID4(PCP_CHAN_PKT_DATA);
+                mem.writeInt(len);
+
+        pcpHeadLen = mem.getPosition();
+        memcpy(pcpHead + PCP_HEADER_MAX - pcpHeadLen, tmp, pcpHeadLen);
+        pcpState.store(2, std::memory_order_release);
+    }else if (state == 1)
+    {
+        return false;
+    }
+
+    // 別のチャンネル ID で作られたものは使えない。ID は PCP_CHAN と
+    // PCP_CHAN_ID のアトムヘッダーの後にある。
+    const char *head = pcpHead + PCP_HEADER_MAX - pcpHeadLen;
+    if (memcmp(head + 16, chanID.id, 16) != 0)
+        return false;
+
+    frame = head;
+    flen = pcpHeadLen + len;
+    return true;
+}
+
+// -----------------------------------
+// pack のコピーを現在のチャンクの末尾に置く。入りきらない場合は新しい
+// チャンクを確保する。
+std::shared_ptr<ChanPacketSlab> ChanPacketArena::allocate(const ChanPacket &pack)
+{
+    const size_t align = alignof(ChanPacketSlab);
+    size_t need = (sizeof(ChanPacketSlab) + pack.len + align - 1) / align * align;
+
+    std::shared_ptr<char> chunk;
+    char *p;
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+
+        if (!m_chunk || m_used + need > m_size)
+        {
+            m_size = std::max<size_t>(CHUNK_SIZE, need);
+            m_chunk = std::shared_ptr<char>(new char[m_size], std::default_delete<char[]>());
+            m_used = 0;
+        }
+        chunk = m_chunk;
+        p = chunk.get() + m_used;
+        m_used += need;
+    }
+
+    auto slab = new (p) ChanPacketSlab;
+    char *d = p + sizeof(ChanPacketSlab);
+    memcpy(d, pack.data, pack.len);
+
+    slab->type = pack.type;
+    slab->len  = pack.len;
+    slab->pos  = pack.pos;
+    slab->sync = pack.sync;
+    slab->cont = pack.cont;
+    slab->data = d;
+    slab->time = sys->getDTime();
+    slab->trace = pack.trace;
+    slab->pcpState = 0;
+    slab->pcpHeadLen = 0;
+
+    // チャンクの参照カウントを共有するハンドルを返す。
+    return std::shared_ptr<ChanPacketSlab>(chunk, slab);
+}
+
 // -----------------------------------
 // (使われていないようだ。)
 int ChanPacketBuffer::copyFrom(ChanPacketBuffer &buf, unsigned int reqPos)
 {
-    lock.lock();
-    buf.lock.lock();
+    std::lock_guard<ProfiledMutex> cs1(lock);
+    std::lock_guard<ProfiledMutex> cs2(buf.lock);
 
-    firstPos = 0;
-    lastPos = 0;
-    safePos = 0;
-    readPos = 0;
+    unsigned int a = accept;
+    init();
+    accept = a;
 
+    if (buf.writePos == 0)
+        return 0;
+
+    ChanPacket pack;
     for (unsigned int i = buf.firstPos; i <= buf.lastPos; i++)
     {
-        ChanPacket *src = &buf.packets[i%MAX_PACKETS];
-        if (src->type & accept)
+        auto src = buf.packetAt(i);
+        if (src && (src->type & accept) && src->pos >= reqPos)
         {
-            if (src->pos >= reqPos)
-            {
-                lastPos = writePos;
-                packets[writePos++] = *src;
-            }
+            src->copyTo(pack);
+            writePacket(pack);
         }
     }
 
-    buf.lock.unlock();
-    lock.unlock();
     return lastPos - firstPos;
 }
 
+// ------------------------------------------------------------------
+// リング r のインデックス index のスロットを読む。パケットの sync が
+// index と一致しなければ上書きされたか、まだ書き込まれていない。
+std::shared_ptr<const ChanPacketSlab> ChanPacketBuffer::slotAt(const Ring &r, unsigned int index)
+{
+    auto p = std::atomic_load(&r.slots[index % r.capacity]);
+    if (p && p->sync == index)
+        return p;
+    else
+        return nullptr;
+}
+
+// ------------------------------------------------------------------
+std::shared_ptr<const ChanPacketSlab> ChanPacketBuffer::packetAt(unsigned int index)
+{
+    auto r = std::atomic_load(&ring);
+    return slotAt(*r, index);
+}
+
 // ------------------------------------------------------------------
 // ストリームポジションが spos か、それよりも新しいパケットが見付かれ
 // ば pack に代入する。見付かった場合は true, そうでなければ false を
 // 返す。
 bool ChanPacketBuffer::findPacket(unsigned int spos, ChanPacket &pack)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::shared_ptr<const ChanPacketSlab> p;
+
+    if (findPacket(spos, p))
+    {
+        p->copyTo(pack);
+        return true;
+    }else
+    {
+        return false;
+    }
+}
+
+// ------------------------------------------------------------------
+// findPacket のコピーしない版。パケットのハンドルを pack に代入する。
+bool ChanPacketBuffer::findPacket(unsigned int spos, std::shared_ptr<const ChanPacketSlab> &pack)
+{
+    for (int retry = 0; retry < FIND_RETRIES; retry++)
+    {
+        auto r = std::atomic_load(&ring);
+
+        if (writePos == 0)
+            return false;
+
+        // インデックスを読んでから減少点を読む。書き込み側は逆の順番で
+        // 更新するので、窓の中の減少点は必ず見える。
+        unsigned int last = lastPos;
+        unsigned int first = firstPos;
+        unsigned int ld = lastDescent;
+        unsigned int pd = prevDescent;
+
+        int res = findIndex(*r, spos, first, last, ld, pd, pack);
+        if (res >= 0)
+            return res == 1;
+    }
+
+    // 探している間に何度も上書きされた。書き込みを止めて探す。
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     if (writePos == 0)
         return false;
 
-    // unsigned int fpos = getStreamPos(firstPos);
-    // if (spos < fpos)
-    //     spos = fpos;
+    return findIndex(*ring, spos, firstPos, lastPos, lastDescent, prevDescent, pack) == 1;
+}
+
+// ------------------------------------------------------------------
+// インデックスの区間 [first, last] から findPacket の条件に合うパケッ
+// トを探す。見付かれば 1、見付からなければ 0、探している間にスロット
+// が上書きされた場合は -1 を返す。
+int ChanPacketBuffer::findIndex(const Ring &r, unsigned int spos, unsigned int first, unsigned int last,
+                                unsigned int ld, unsigned int pd, std::shared_ptr<const ChanPacketSlab> &pack)
+{
+    if (first > last)
+        return -1;
 
-    // このループ、lastPos == UINT_MAX の時終了しないのでは？ …4G パ
-    // ケットも送らないか。
-    ChanPacket* candidate = nullptr;
-    for (unsigned int i = firstPos; i <= lastPos; i++)
+    // 窓の中にポジションの減少が 2 回以上あるか、窓より新しい減少点が
+    // 見えている場合は整列した区間が分からないので、全体を走査する。
+    if ((pd && pd - 1 > first) || (ld && ld - 1 > last))
     {
-        ChanPacket& p = packets[i%MAX_PACKETS];
-        if (p.pos >= spos)
+        std::shared_ptr<const ChanPacketSlab> candidate;
+        for (unsigned int i = first; i <= last; i++)
         {
-            if (!candidate)
-                candidate = &p;
-            else if (p.pos < candidate->pos)
-                candidate = &p;
+            auto p = slotAt(r, i);
+            if (!p)
+                return -1;
+
+            if (p->pos >= spos)
+            {
+                if (!candidate)
+                    candidate = p;
+                else if (p->pos < candidate->pos)
+                    candidate = p;
+            }
         }
+
+        if (!candidate)
+            return 0;
+        pack = candidate;
+        return 1;
     }
 
-    if (candidate)
+    // 整列した区間は高々 2 つ。それぞれを二分探索して小さい方を取る。
+    unsigned int split = first;
+    if (ld && ld - 1 > first)
+        split = ld - 1;
+
+    std::shared_ptr<const ChanPacketSlab> best;
+    unsigned int i;
+
+    if (split > first)
     {
-        pack = *candidate;
-        return true;
-    }else
+        if (!lowerBound(r, first, split, spos, i))
+            return -1;
+        if (i < split)
+        {
+            best = slotAt(r, i);
+            if (!best)
+                return -1;
+        }
+    }
+
+    if (!lowerBound(r, split, last + 1, spos, i))
+        return -1;
+    if (i <= last)
     {
-        return false;
+        auto p = slotAt(r, i);
+        if (!p)
+            return -1;
+        if (!best || p->pos < best->pos)
+            best = p;
+    }
+
+    if (!best)
+        return 0;
+    pack = best;
+    return 1;
+}
+
+// ------------------------------------------------------------------
+// ポジションが整列しているインデックスの区間 [first, last) から、ス
+// トリームポジションが spos 以上の最初のパケットのインデックスを
+// result に代入する。無ければ last。途中のスロットが上書きされていた
+// 場合は false を返す。
+bool ChanPacketBuffer::lowerBound(const Ring &r, unsigned int first, unsigned int last, unsigned int spos, unsigned int &result)
+{
+    while (first < last)
+    {
+        unsigned int mid = first + (last - first) / 2;
+        auto p = slotAt(r, mid);
+        if (!p)
+            return false;
+
+        if (p->pos < spos)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+    result = first;
+    return true;
+}
+
+// ------------------------------------------------------------------
+// インデックス index に書き込むパケットのポジション pos が直前のパケッ
+// トより小さければ記録する。
+void ChanPacketBuffer::noteDescent(const Ring &r, unsigned int index, unsigned int pos)
+{
+    if (index == 0)
+        return;
+
+    auto prev = slotAt(r, index - 1);
+    if (prev && pos < prev->pos)
+    {
+        prevDescent = lastDescent.load();
+        lastDescent = index + 1;
     }
 }
 
@@ -127,7 +389,17 @@ bool ChanPacketBuffer::findPacket(unsigned int spos, ChanPacket &pack)
 // パケットがない場合は 0 を返す。
 unsigned int    ChanPacketBuffer::getLatestPos()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    for (int retry = 0; retry < FIND_RETRIES; retry++)
+    {
+        if (writePos == 0)
+            return 0;
+
+        auto p = packetAt(lastPos);
+        if (p)
+            return p->pos;
+    }
+
+    std::lock_guard<ProfiledMutex> cs(lock);
     if (!writePos)
         return 0;
     else
@@ -135,47 +407,96 @@ unsigned int    ChanPacketBuffer::getLatestPos()
 }
 
 // ------------------------------------------------------------------
-unsigned int    ChanPacketBuffer::getLatestNonContinuationPos()
+// キーフレームのインデックスから n 個前のものを探す。見つかったパケッ
+// トが既に上書きされていた場合は false。
+bool    ChanPacketBuffer::findKey(const Ring &r, unsigned int n, unsigned int nk, unsigned int first, unsigned int &pos)
 {
-    if (writePos == 0)
-        return 0;
-
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    // バッファー内に残っている最初のキーフレームを二分探索する。
+    unsigned int lo = (nk > MAX_CAPACITY) ? nk - MAX_CAPACITY : 0;
+    unsigned int hi = nk;
+    while (lo < hi)
+    {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (keyIndex[mid % MAX_CAPACITY] < first)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
 
-    for (int64_t i = lastPos; i >= firstPos; i--)
+    if (lo == nk)
     {
-        ChanPacket &p = packets[i%MAX_PACKETS];
-        if (!p.cont)
-            return p.pos;
+        pos = 0;
+        return true;
     }
 
-    return 0;
+    unsigned int k = (nk - 1 - lo >= n) ? nk - 1 - n : lo;
+    auto p = slotAt(r, keyIndex[k % MAX_CAPACITY]);
+    if (!p)
+        return false;
+
+    pos = p->pos;
+    return true;
 }
 
 // ------------------------------------------------------------------
-unsigned int    ChanPacketBuffer::getOldestNonContinuationPos()
+unsigned int    ChanPacketBuffer::getNonContinuationPos(unsigned int n)
 {
-    if (writePos == 0)
-        return 0;
+    unsigned int pos;
 
-    std::lock_guard<std::recursive_mutex> cs(lock);
-
-    for (int64_t i = firstPos; i <= lastPos; i++)
+    for (int retry = 0; retry < FIND_RETRIES; retry++)
     {
-        ChanPacket &p = packets[i%MAX_PACKETS];
-        if (!p.cont)
-            return p.pos;
+        auto r = std::atomic_load(&ring);
+        unsigned int nk = numKeys;
+        if (findKey(*r, n, nk, firstPos, pos))
+            return pos;
     }
 
+    std::lock_guard<ProfiledMutex> cs(lock);
+    if (findKey(*ring, n, numKeys, firstPos, pos))
+        return pos;
     return 0;
 }
 
+// ------------------------------------------------------------------
+void ChanPacketBuffer::setArchive(std::shared_ptr<ChanPacketArchive> a)
+{
+    std::atomic_store(&archive, a);
+}
+
+// ------------------------------------------------------------------
+bool ChanPacketBuffer::findArchivedPacket(unsigned int spos, ChanPacket &pack)
+{
+    auto a = std::atomic_load(&archive);
+    if (!a)
+        return false;
+
+    unsigned int oldest = getOldestPos();
+    if (writePos && (int) (spos - oldest) >= 0)
+        return false;
+
+    if (!a->read(spos, pack))
+        return false;
+
+    // バッファーに追い付いたらそちらから読む。
+    return !writePos || (int) (pack.pos - oldest) < 0;
+}
+
 // ------------------------------------------------------------------
 // バッファー内の一番古いパケットのストリームポジションを返す。まだパ
 // ケットが無い場合は 0 を返す。
 unsigned int    ChanPacketBuffer::getOldestPos()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    for (int retry = 0; retry < FIND_RETRIES; retry++)
+    {
+        if (writePos == 0)
+            return 0;
+
+        auto p = packetAt(firstPos);
+        if (p)
+            return p->pos;
+    }
+
+    std::lock_guard<ProfiledMutex> cs(lock);
     if (!writePos)
         return 0;
     else
@@ -201,7 +522,8 @@ unsigned int    ChanPacketBuffer::findOldestPos(unsigned int spos)
 // パケットインデックス index のパケットのストリームポジションを返す。
 unsigned int    ChanPacketBuffer::getStreamPos(unsigned int index)
 {
-    return packets[index%MAX_PACKETS].pos;
+    auto p = packetAt(index);
+    return p ? p->pos : 0;
 }
 
 // -------------------------------------------------------------------
@@ -209,7 +531,8 @@ unsigned int    ChanPacketBuffer::getStreamPos(unsigned int index)
 // ションを計算する。
 unsigned int    ChanPacketBuffer::getStreamPosEnd(unsigned int index)
 {
-    return packets[index%MAX_PACKETS].pos + packets[index%MAX_PACKETS].len;
+    auto p = packetAt(index);
+    return p ? p->pos + p->len : 0;
 }
 
 // -----------------------------------
@@ -220,29 +543,54 @@ bool ChanPacketBuffer::writePacket(ChanPacket &pack, bool updateReadPos)
         if (willSkip()) // too far behind
             return false;
 
-        lock.lock();
+        // ペイロードのコピーはロックの外で一度だけ行う。
+        auto slab = arena.allocate(pack);
+
+        auto a = std::atomic_load(&archive);
+        if (a)
+            a->put(*slab);
+
+        std::lock_guard<ProfiledMutex> cs(lock);
 
-        pack.sync = writePos;
-        packets[writePos%MAX_PACKETS] = pack;
-        lastPos = writePos;
+        Ring& r = *ring;
+        auto& slot = r.slots[writePos % r.capacity];
+        auto old = std::atomic_load(&slot);
+        if (old && writePos >= r.capacity)
+            totalBytes -= old->len;
+        totalBytes += slab->len;
+
+        pack.sync = slab->sync = writePos;
+        noteDescent(r, writePos, slab->pos);
+
+        // スロットを書き換えてからインデックスを進める。
+        bool key = !slab->cont;
+        std::atomic_store(&slot, std::shared_ptr<const ChanPacketSlab>(std::move(slab)));
+        lastPos = writePos.load();
+        if (key)
+        {
+            keyIndex[numKeys % MAX_CAPACITY] = writePos.load();
+            numKeys++;
+        }
         writePos++;
 
-        if (writePos >= MAX_PACKETS)
-            firstPos = writePos-MAX_PACKETS;
-        else
-            firstPos = 0;
+        // スロット数を増やした直後は、既に捨てたパケットの分だけ
+        // firstPos が進んでいる。
+        if (writePos >= capacity && writePos - capacity > firstPos)
+            firstPos = writePos - capacity;
 
-        if (writePos >= NUM_SAFEPACKETS)
-            safePos = writePos - NUM_SAFEPACKETS;
+        if (writePos >= numSafePackets())
+            safePos = writePos - numSafePackets();
         else
             safePos = 0;
+        if (safePos < firstPos)
+            safePos = firstPos.load();
 
         if (updateReadPos)
-            readPos = writePos;
+            readPos = writePos.load();
 
         lastWriteTime = sys->getTime();
 
-        lock.unlock();
+        notifyWaiters();
         return true;
     }
 
@@ -251,6 +599,14 @@ bool ChanPacketBuffer::writePacket(ChanPacket &pack, bool updateReadPos)
 
 // -----------------------------------
 void    ChanPacketBuffer::readPacket(ChanPacket &pack)
+{
+    std::shared_ptr<const ChanPacketSlab> p;
+    readPacket(p);
+    p->copyTo(pack);
+}
+
+// -----------------------------------
+void    ChanPacketBuffer::readPacket(std::shared_ptr<const ChanPacketSlab> &pack)
 {
     unsigned int tim = sys->getTime();
 
@@ -273,7 +629,7 @@ void    ChanPacketBuffer::readPacket(ChanPacket &pack)
         lock.lock();
     }
 
-    pack = packets[readPos%MAX_PACKETS];
+    pack = slotAt(*ring, readPos);
     readPos++;
     lock.unlock();
 
@@ -284,6 +640,142 @@ void    ChanPacketBuffer::readPacket(ChanPacket &pack)
 // バッファーがいっぱいなら true を返す。そうでなければ false。
 bool    ChanPacketBuffer::willSkip()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
-    return ((writePos - readPos) >= MAX_PACKETS);
+    return ((writePos - readPos) >= capacity);
+}
+
+// ------------------------------------------------------------
+void    ChanPacketBuffer::notifyWaiters()
+{
+    writeSerial++;
+
+    // 待っているスレッドが無ければシステムコールを避ける。
+    if (numWaiters > 0)
+    {
+        // 待つ側が条件を確かめてから wait に入るまでの間に通知しないよ
+        // うに、一度ロックを取る。
+        { std::lock_guard<std::mutex> cs(waitLock); }
+        written.notify_all();
+    }
+
+    if (numListeners > 0)
+    {
+        std::lock_guard<std::mutex> cs(listenerLock);
+        for (auto& it : listeners)
+            it.second();
+    }
+}
+
+// ------------------------------------------------------------
+int     ChanPacketBuffer::addWriteListener(std::function<void()> func)
+{
+    std::lock_guard<std::mutex> cs(listenerLock);
+    int id = nextListenerID++;
+    listeners[id] = func;
+    numListeners = listeners.size();
+    return id;
+}
+
+// ------------------------------------------------------------
+void    ChanPacketBuffer::removeWriteListener(int id)
+{
+    std::lock_guard<std::mutex> cs(listenerLock);
+    listeners.erase(id);
+    numListeners = listeners.size();
+}
+
+// ------------------------------------------------------------
+bool    ChanPacketBuffer::waitForWrite(unsigned int serial, int ms)
+{
+    std::unique_lock<std::mutex> cs(waitLock);
+
+    numWaiters++;
+    bool res = written.wait_for(cs, std::chrono::milliseconds(ms),
+                                [&]() { return writeSerial != serial; });
+    numWaiters--;
+
+    return res;
+}
+
+// ------------------------------------------------------------
+// スロット数を n に変更する。古いパケットが入りきらない場合は捨てら
+// れる。
+void    ChanPacketBuffer::setCapacity(unsigned int n)
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+
+    if (n < 1)
+        n = 1;
+    if (n > MAX_CAPACITY)
+        n = MAX_CAPACITY;
+    if (n == capacity)
+        return;
+
+    auto newRing = std::make_shared<Ring>(n);
+    if (writePos)
+    {
+        unsigned int first = firstPos;
+        if (lastPos - first + 1 > n)
+            first = lastPos + 1 - n;
+
+        for (unsigned int i = firstPos; i < first; i++)
+            totalBytes -= slotAt(*ring, i)->len;
+        for (unsigned int i = first; i <= lastPos; i++)
+            newRing->slots[i%n] = slotAt(*ring, i);
+
+        firstPos = first;
+    }
+    std::atomic_store(&ring, newRing);
+    capacity = n;
+
+    if (writePos >= numSafePackets())
+        safePos = writePos - numSafePackets();
+    else
+        safePos = 0;
+    if (safePos < firstPos)
+        safePos = firstPos.load();
+}
+
+// ------------------------------------------------------------
+uint64_t ChanPacketBuffer::memoryUsage()
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+
+    uint64_t bytes = (uint64_t) capacity * sizeof(std::shared_ptr<const ChanPacketSlab>)
+        + MAX_CAPACITY * sizeof(std::atomic<unsigned int>);
+    if (writePos)
+        bytes += (uint64_t) (lastPos - firstPos + 1) * sizeof(ChanPacketSlab) + totalBytes;
+    return bytes;
+}
+
+// ------------------------------------------------------------
+// バッファー内のデータ長の合計がおよそ targetBytes になるようにスロッ
+// ト数を調整する。targetBytes が 0 の場合はデフォルトのスロット数に戻
+// す。
+void    ChanPacketBuffer::adjustCapacity(unsigned int targetBytes)
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+
+    if (targetBytes == 0)
+    {
+        setCapacity(MAX_PACKETS);
+        return;
+    }
+
+    if (writePos == 0)
+        return;
+
+    uint64_t avgLen = totalBytes / (lastPos - firstPos + 1);
+    if (avgLen == 0)
+        return;
+
+    uint64_t desired = (targetBytes + avgLen - 1) / avgLen;
+    if (desired < MAX_PACKETS)
+        desired = MAX_PACKETS;
+
+    // 頻繁に付け替えないように、足りなくなった時は 1/4 余分に確保し、
+    // 半分以下しか使わなくなった時に縮める。
+    if (desired > capacity)
+        setCapacity(desired + desired / 4);
+    else if (desired < capacity / 2)
+        setCapacity(desired);
 }
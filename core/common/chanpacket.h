@@ -21,9 +21,30 @@
 
 #include <vector>
 #include <mutex>
+#include <memory>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <climits>
+
+#include "lockprof.h"
 
 // ----------------------------------
 class Stream;
+class GnuID;
+class ChanPacketArchive;
+
+// ----------------------------------
+// 追跡のために選ばれたパケットに付く印 (pkttrace.h)。id が 0 なら追跡
+// しない。
+struct PacketTrace
+{
+    unsigned int    id;
+    unsigned int    originTime; // 配信元で印を付けた時刻 (UNIX 時刻のミリ秒、下位 32 ビット)
+    unsigned int    hops;       // 配信元からの中継の段数
+    unsigned int    residence;  // 上流の各ノードのバッファーに居たマイクロ秒の合計
+};
 
 // ----------------------------------
 class ChanPacket
@@ -49,6 +70,12 @@ public:
         init();
     }
 
+    // data[] のうち len バイトだけをコピーする。
+    ChanPacket(const ChanPacket& other)
+    {
+        *this = other;
+    }
+
     void    init()
     {
         type = T_UNKNOWN;
@@ -56,11 +83,12 @@ public:
         pos  = 0;
         sync = 0;
         cont = false;
+        trace = {};
     }
 
     void    init(TYPE type, const void *data, unsigned int length, unsigned int position);
 
-    void    writeRaw(Stream &);
+    void    writeRaw(Stream &) const;
 
     ChanPacket& operator=(const ChanPacket& other);
 
@@ -69,50 +97,183 @@ public:
     unsigned int    pos; // パケットのストリーム中でのバイト位置
     unsigned int    sync;
     bool            cont; // true if this is a continuation packet
+    PacketTrace     trace;
     char            data[MAX_DATALEN];
 };
 
 // ----------------------------------
+// ChanPacketBuffer に格納される不変の可変長パケット。ChanPacketArena
+// のチャンク内で、ヘッダーの直後に len バイトのデータが続く。
+class ChanPacketSlab
+{
+public:
+    enum {
+        // PCP_CHAN アトムのペイロードより前の部分の最大長。
+        PCP_HEADER_MAX = 88
+    };
+
+    void    writeRaw(Stream &) const;
+    void    copyTo(ChanPacket &) const;
+
+    // このパケットを chanID のチャンネルの PCP_CHAN アトムにしたバ
+    // イト列を frame, len に返す。アトムのヘッダーは最初に呼ばれた時
+    // にデータの直前に書き込まれ、以後は全ての PCP 送信者で共有され
+    // る。作れなかった時や T_HEAD, T_DATA 以外のパケット、追跡の印が
+    // 付いたパケットでは false。
+    bool    pcpFrame(const GnuID &chanID, const char *&frame, int &len) const;
+
+    ChanPacket::TYPE type;
+    unsigned int    len;
+    unsigned int    pos;
+    unsigned int    sync;
+    bool            cont;
+    const char*     data;
+    double          time;   // バッファーに書き込まれた時刻 (sys->getDTime())
+    PacketTrace     trace;
+
+    // pcpHead の状態。0: 未作成, 1: 作成中, 2: 作成済み。
+    mutable std::atomic<int> pcpState;
+    mutable int     pcpHeadLen;
+    // ヘッダーは後ろ詰めで書き込まれ、data と連続する。
+    mutable char    pcpHead[PCP_HEADER_MAX];
+};
+
+// ----------------------------------
+// パケットを詰めて格納するバイトアリーナ。チャンクは参照カウントされ
+// ていて、その中のパケットへのハンドルが全て無くなった時に解放される。
+class ChanPacketArena
+{
+public:
+    enum {
+        CHUNK_SIZE = 64 * 1024
+    };
+
+    ChanPacketArena()
+        : m_size(0)
+        , m_used(0)
+    {
+    }
+
+    std::shared_ptr<ChanPacketSlab> allocate(const ChanPacket &);
+
+private:
+    std::shared_ptr<char>   m_chunk;
+    size_t                  m_size, m_used;
+    std::mutex              m_lock;
+};
+
+// ----------------------------------
+// 一つのチャンネルリーダースレッドが書き込み、多数のサーバントスレッ
+// ドが読み出すパケットのリングバッファ。
+//
+// 読み出し側 (findPacket, getLatestPos など) はロックを取らない。ス
+// ロットは std::atomic_load で読み、パケットの sync がスロットのイン
+// デックスと一致するかで上書きされていないことを確かめる。書き込み側
+// は lock を取るが、これは書き込み側同士と init, setCapacity の排他の
+// ためなので、読み出し側に待たされることはない。
 class ChanPacketBuffer
 {
 public:
     enum {
-        MAX_PACKETS = 64,
-        NUM_SAFEPACKETS = 56
+        MAX_PACKETS = 64,       // デフォルトのスロット数
+        NUM_SAFEPACKETS = 56,
+        MAX_CAPACITY = 4096     // setCapacity で設定できる最大のスロット数
+    };
+
+    // スロットの配列。setCapacity で差し替えられるが、読み出し中のス
+    // レッドは古い配列への参照を持ち続けるので解放されない。
+    struct Ring
+    {
+        explicit Ring(unsigned int n)
+            : capacity(n)
+            , slots(new std::shared_ptr<const ChanPacketSlab>[n])
+        {
+        }
+
+        const unsigned int capacity;
+        std::unique_ptr<std::shared_ptr<const ChanPacketSlab>[]> slots;
     };
 
     ChanPacketBuffer()
+        : capacity(MAX_PACKETS)
+        , keyIndex(new std::atomic<unsigned int>[MAX_CAPACITY]())
+        , numKeys(0)
+        , writeSerial(0)
+        , numWaiters(0)
+        , numListeners(0)
+        , nextListenerID(1)
     {
         init();
     }
 
     void    init()
     {
-        std::lock_guard<std::recursive_mutex> cs(lock);
+        std::lock_guard<ProfiledMutex> cs(lock);
+        std::atomic_store(&ring, std::make_shared<Ring>(capacity));
         lastPos = firstPos = safePos = 0;
         readPos = writePos = 0;
         accept = 0;
         lastWriteTime = 0;
+        lastDescent = prevDescent = 0;
+        numKeys = 0;
+        totalBytes = 0;
+        notifyWaiters();
     }
 
+    void    setCapacity(unsigned int);
+    void    adjustCapacity(unsigned int targetBytes);
+    // スロット、パケットとその索引が使っているおよそのバイト数。
+    uint64_t memoryUsage();
+    unsigned int numSafePackets() { return capacity - capacity / 8; }
+
     int     copyFrom(ChanPacketBuffer &, unsigned in);
 
     bool    writePacket(ChanPacket &, bool = false);
     void    readPacket(ChanPacket &);
+    void    readPacket(std::shared_ptr<const ChanPacketSlab> &);
 
     bool    willSkip();
 
+    // 書き込みがある度に増える通し番号。init でリセットされない。
+    unsigned int getWriteSerial() { return writeSerial; }
+    // 通し番号が serial から変わるまで最大 ms ミリ秒待つ。変わった場合
+    // は true を返す。
+    bool    waitForWrite(unsigned int serial, int ms);
+
+    // 書き込みがある度に呼ばれる関数を登録する。書き込んだスレッドか
+    // ら呼ばれるので、すぐに戻ること。返された ID で登録を解除する。
+    int     addWriteListener(std::function<void()>);
+    void    removeWriteListener(int id);
+
     int     numPending() { return writePos - readPos; }
 
     unsigned int    getLatestPos();
     unsigned int    getOldestPos();
     unsigned int    findOldestPos(unsigned int);
     bool            findPacket(unsigned int, ChanPacket &);
+    bool            findPacket(unsigned int, std::shared_ptr<const ChanPacketSlab> &);
     unsigned int    getStreamPos(unsigned int);
     unsigned int    getStreamPosEnd(unsigned int);
     unsigned int    getLastSync();
-    unsigned int    getLatestNonContinuationPos();
-    unsigned int    getOldestNonContinuationPos();
+    unsigned int    getLatestNonContinuationPos() { return getNonContinuationPos(0); }
+    unsigned int    getOldestNonContinuationPos() { return getNonContinuationPos(UINT_MAX); }
+    // 最新から n 個前の継続パケットでないパケット (キーフレーム) のス
+    // トリームポジション。n がバッファー中のキーフレームの数以上なら一
+    // 番古いもの。一つも無ければ 0 を返す。
+    unsigned int    getNonContinuationPos(unsigned int n);
+
+    // インデックス index のパケットを返す。既に上書きされているか、ま
+    // だ書き込まれていない場合は nullptr。
+    std::shared_ptr<const ChanPacketSlab> packetAt(unsigned int index);
+
+    // 書き込んだパケットを写しておくディスクのリング (dvr.h)。nullptr
+    // で外す。init では外れない。
+    void    setArchive(std::shared_ptr<ChanPacketArchive>);
+    std::shared_ptr<ChanPacketArchive> getArchive() { return std::atomic_load(&archive); }
+    // spos がバッファーより古ければ、アーカイブからポジションが spos
+    // 以降の最初のパケットを pack に読む。バッファーにあるパケットや
+    // アーカイブに無いパケットなら false。
+    bool    findArchivedPacket(unsigned int spos, ChanPacket &pack);
 
     struct Stat
     {
@@ -123,7 +284,7 @@ public:
 
     Stat getStatistics()
     {
-        std::lock_guard<std::recursive_mutex> cs_(lock);
+        std::lock_guard<ProfiledMutex> cs_(lock);
 
         if (writePos == 0)
             return { {}, 0, 0 };
@@ -132,8 +293,9 @@ public:
         int cs = 0, ncs = 0;
         for (unsigned int i = firstPos; i <= lastPos; i++)
         {
-            lens.push_back(packets[i % MAX_PACKETS].len);
-            if (packets[i % MAX_PACKETS].cont)
+            auto p = packetAt(i);
+            lens.push_back(p->len);
+            if (p->cont)
                 cs++;
             else
                 ncs++;
@@ -141,12 +303,54 @@ public:
         return { lens, cs, ncs };
     }
 
-    ChanPacket              packets[MAX_PACKETS];
-    volatile unsigned int   lastPos, firstPos, safePos;
-    volatile unsigned int   readPos, writePos;
+private:
+    enum { FIND_RETRIES = 3 };
+
+    static std::shared_ptr<const ChanPacketSlab> slotAt(const Ring &, unsigned int index);
+    int     findIndex(const Ring &, unsigned int spos, unsigned int first, unsigned int last,
+                      unsigned int ld, unsigned int pd, std::shared_ptr<const ChanPacketSlab> &);
+    bool    lowerBound(const Ring &, unsigned int first, unsigned int last, unsigned int spos, unsigned int &result);
+    void    noteDescent(const Ring &, unsigned int index, unsigned int pos);
+    bool    findKey(const Ring &, unsigned int n, unsigned int nk, unsigned int first, unsigned int &pos);
+    void    notifyWaiters();
+
+public:
+    // 書き込まれたパケットは arena 上の不変のスラブとして保持され、読
+    // み出し側とは参照カウントで共有される。
+    // スロット数 capacity は setCapacity で変更できる。パケットの実体は
+    // 移動しないので、付け替えはポインターの移動だけで済む。
+    std::shared_ptr<Ring>   ring;
+    ChanPacketArena         arena;
+    std::shared_ptr<ChanPacketArchive> archive;
+    std::atomic<unsigned int> capacity;
+    std::atomic<unsigned int> lastPos, firstPos, safePos;
+    std::atomic<unsigned int> readPos, writePos;
     unsigned int            accept;
-    unsigned int            lastWriteTime;
-    std::recursive_mutex    lock;
+    std::atomic<unsigned int> lastWriteTime;
+    uint64_t                totalBytes; // firstPos から lastPos までのデータ長の合計
+
+    // ストリームポジションが前のパケットより小さくなったパケットのイン
+    // デックス+1 (0 はなし)。ポジションはオーバーフローする場合を除い
+    // て単調増加なので、これを覚えておけば findPacket で二分探索できる。
+    std::atomic<unsigned int> lastDescent, prevDescent;
+
+    // 継続パケットでないパケットのインデックスを書き込み順に覚えておく。
+    // k 番目のものが keyIndex[k % MAX_CAPACITY] に入り、numKeys は書き
+    // 込んだ総数。インデックスは単調増加なので二分探索できる。
+    std::unique_ptr<std::atomic<unsigned int>[]> keyIndex;
+    std::atomic<unsigned int> numKeys;
+    ProfiledMutex           lock { "ChanPacketBuffer::lock" };
+
+    // waitForWrite で待っているスレッドを起こすためのもの。
+    std::atomic<unsigned int> writeSerial;
+    std::atomic<int>        numWaiters;
+    std::mutex              waitLock;
+    std::condition_variable written;
+
+    std::atomic<int>        numListeners;
+    std::mutex              listenerLock;
+    std::map<int, std::function<void()>> listeners;
+    int                     nextListenerID;
 };
 
 #endif
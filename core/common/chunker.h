@@ -1,6 +1,9 @@
 #ifndef _CHUNKER_H
 #define _CHUNKER_H
 
+#include <chrono>
+#include <string>
+
 #include "stream.h"
 
 // HTTP chunked transfer encoding にエンコードするクラス。
@@ -38,4 +41,60 @@ public:
     Stream&          m_stream;
 };
 
+// 書いたものを溜めて、threshold バイト溜まるか、前に送ってから
+// intervalMsec ミリ秒過ぎたら一つのチャンクにして送る。細かく書かれる
+// ものを、頭から少しずつ届けるのに使う。
+class BufferedChunker : public Stream
+{
+public:
+    BufferedChunker(Stream& aStream, size_t threshold = 8192, int intervalMsec = 50)
+        : m_chunker(aStream)
+        , m_threshold(threshold)
+        , m_interval(intervalMsec)
+        , m_lastFlush(std::chrono::steady_clock::now())
+        , m_numChunks(0)
+    {
+    }
+
+    int read(void *buf, int size) override
+    {
+        throw StreamException("Stream can`t read");
+    }
+
+    void write(const void *buf, int size) override
+    {
+        m_buffer.append(static_cast<const char*>(buf), size);
+        if (m_buffer.size() >= m_threshold ||
+            std::chrono::steady_clock::now() - m_lastFlush >= m_interval)
+            flush();
+    }
+
+    void flush()
+    {
+        m_lastFlush = std::chrono::steady_clock::now();
+        if (m_buffer.empty())
+            return;
+        m_chunker.write(m_buffer.data(), m_buffer.size());
+        m_buffer.clear();
+        m_numChunks++;
+    }
+
+    // 残りを送って終わりのチャンクを付ける。
+    void close() override
+    {
+        flush();
+        m_chunker.close();
+    }
+
+    int numChunks() const { return m_numChunks; }
+
+private:
+    Chunker                     m_chunker;
+    std::string                 m_buffer;
+    const size_t                m_threshold;
+    const std::chrono::milliseconds m_interval;
+    std::chrono::steady_clock::time_point m_lastFlush;
+    int                         m_numChunks;
+};
+
 #endif
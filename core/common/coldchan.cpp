@@ -0,0 +1,243 @@
+// ------------------------------------------------
+// File : coldchan.cpp
+// Desc:
+//      アイドルで閉じたリレーチャンネルの冷えた状態。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+
+#include "coldchan.h"
+#include "channel.h"
+#include "chanmgr.h"
+
+ColdChannels g_coldChannels;
+
+// ------------------------------------
+size_t ColdChannels::Entry::memoryUsage() const
+{
+    return sizeof(Entry) + head.capacity() + hits.capacity() * sizeof(ChanHit);
+}
+
+// ------------------------------------
+std::vector<ChanHit> ColdChannels::bestHits(std::vector<ChanHit> hits, size_t max)
+{
+    hits.erase(std::remove_if(hits.begin(), hits.end(),
+                              [](const ChanHit& h) { return h.dead || !h.host.isValid(); }),
+               hits.end());
+
+    // 繋げてリレーできるもの、最近連絡のあったもの、近いものの順。
+    std::stable_sort(hits.begin(), hits.end(),
+                     [](const ChanHit& a, const ChanHit& b)
+                     {
+                         const bool ua = !a.firewalled && a.relay;
+                         const bool ub = !b.firewalled && b.relay;
+                         if (ua != ub)
+                             return ua;
+                         if (a.lastContact != b.lastContact)
+                             return a.lastContact > b.lastContact;
+                         return a.numHops < b.numHops;
+                     });
+    if (hits.size() > max)
+        hits.resize(max);
+    return hits;
+}
+
+// ------------------------------------
+void ColdChannels::store(Channel& ch)
+{
+    Entry e;
+    ChanHit source;
+    {
+        std::lock_guard<ProfiledMutex> cs(ch.lock);
+        if (ch.type != Channel::T_RELAY || !ch.info.id.isSet() || ch.headPack.len == 0)
+            return;
+
+        e.info = ch.info;
+        e.headType = ch.headPack.type;
+        e.headPos = ch.headPack.pos;
+        e.head.assign(ch.headPack.data, ch.headPack.len);
+        e.lastPos = ch.streamPos;
+        source = ch.sourceHost;
+    }
+
+    std::vector<ChanHit> hits;
+    auto chl = chanMgr->findHitListByID(e.info.id);
+    if (chl)
+    {
+        std::lock_guard<ProfiledMutex> cs(chl->lock);
+        for (auto h = chl->hit; h; h = h->next)
+            hits.push_back(*h);
+    }
+    for (auto& h : hits)
+        h.next = nullptr;
+
+    // 最後の上流は先頭に。
+    if (source.host.isValid())
+    {
+        source.next = nullptr;
+        source.chanID = e.info.id;
+        e.hits.push_back(source);
+        hits.erase(std::remove_if(hits.begin(), hits.end(),
+                                  [&](const ChanHit& h) { return h.host.isSame(source.host); }),
+                   hits.end());
+    }
+    for (auto& h : bestHits(hits, MAX_HITS - e.hits.size()))
+        e.hits.push_back(h);
+
+    e.storedAt = sys->getTime();
+    store(e);
+    LOG_INFO("Keeping cold state of %s (%zu hits)", e.info.id.str().c_str(), e.hits.size());
+}
+
+// ------------------------------------
+void ColdChannels::store(const Entry& entry)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_entries[entry.info.id.str()] = entry;
+    m_numStored++;
+
+    while (m_entries.size() > MAX_ENTRIES)
+    {
+        auto oldest = std::min_element(m_entries.begin(), m_entries.end(),
+                                       [](const std::pair<const std::string, Entry>& a,
+                                          const std::pair<const std::string, Entry>& b)
+                                       { return a.second.storedAt < b.second.storedAt; });
+        m_entries.erase(oldest);
+    }
+}
+
+// ------------------------------------
+bool ColdChannels::take(const GnuID& id, Entry& entry)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_entries.find(id.str());
+    if (it == m_entries.end())
+        return false;
+    entry = std::move(it->second);
+    m_entries.erase(it);
+    return true;
+}
+
+// ------------------------------------
+bool ColdChannels::restore(Channel& ch)
+{
+    Entry e;
+    if (!ch.info.id.isSet() || !take(ch.info.id, e))
+        return false;
+
+    {
+        std::lock_guard<ProfiledMutex> cs(ch.lock);
+
+        // 要求に名前が無ければ、覚えていた情報を使う。
+        if (ch.info.name.isEmpty())
+        {
+            auto id = ch.info.id;
+            ch.info = e.info;
+            ch.info.id = id;
+            ch.info.lastPlayStart = 0;
+            ch.info.lastPlayEnd = 0;
+            ch.info.status = ChanInfo::S_UNKNOWN;
+            ch.info.createdTime = sys->getTime();
+        }
+
+        ch.headPack.init(e.headType, e.head.data(), e.head.size(), e.headPos);
+        ch.streamPos = e.lastPos;
+    }
+
+    // 前の上流から順に試させる。
+    for (auto it = e.hits.rbegin(); it != e.hits.rend(); ++it)
+    {
+        ChanHit h = *it;
+        h.chanID = ch.info.id;
+        chanMgr->addHit(h);
+    }
+
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        m_numRestored++;
+    }
+    LOG_INFO("Warm resume of %s (%zu hits)", ch.info.id.str().c_str(), e.hits.size());
+    return true;
+}
+
+// ------------------------------------
+void ColdChannels::expire(unsigned int now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    for (auto it = m_entries.begin(); it != m_entries.end(); )
+    {
+        if (now - it->second.storedAt >= TTL)
+            it = m_entries.erase(it);
+        else
+            ++it;
+    }
+}
+
+// ------------------------------------
+bool ColdChannels::evictOldest()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    if (m_entries.empty())
+        return false;
+
+    auto oldest = std::min_element(m_entries.begin(), m_entries.end(),
+                                   [](const std::pair<const std::string, Entry>& a,
+                                      const std::pair<const std::string, Entry>& b)
+                                   { return a.second.storedAt < b.second.storedAt; });
+    m_entries.erase(oldest);
+    return true;
+}
+
+// ------------------------------------
+size_t ColdChannels::size()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_entries.size();
+}
+
+// ------------------------------------
+uint64_t ColdChannels::memoryUsage()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    uint64_t bytes = 0;
+    for (auto& pair : m_entries)
+        bytes += pair.second.memoryUsage();
+    return bytes;
+}
+
+// ------------------------------------
+amf0::Value ColdChannels::getState()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    std::vector<amf0::Value> entries;
+    for (auto& pair : m_entries)
+    {
+        auto& e = pair.second;
+        entries.push_back(amf0::Value::object(
+            {
+                {"id", pair.first},
+                {"name", e.info.name.str()},
+                {"headerBytes", (int) e.head.size()},
+                {"lastPos", e.lastPos},
+                {"numHits", (int) e.hits.size()},
+                {"storedAt", e.storedAt},
+            }));
+    }
+    return amf0::Value::object(
+        {
+            {"entries", entries},
+            {"numStored", m_numStored},
+            {"numRestored", m_numRestored},
+        });
+}
@@ -0,0 +1,93 @@
+// ------------------------------------------------
+// File : coldchan.h
+// Desc:
+//      アイドルで閉じたリレーチャンネルの「冷えた」状態 (warmResume フ
+//      ラグ)。チャンネル情報、ヘッダーパケット、最後の位置、上流と良さ
+//      そうなヒットだけを覚えておき、しばらくして視聴者が来た時に作り
+//      直すチャンネルへ戻す。検索せずにすぐ上流に繋ぎ直せる。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _COLDCHAN_H
+#define _COLDCHAN_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "amf0.h"
+#include "chaninfo.h"
+#include "chanhit.h"
+#include "chanpacket.h"
+#include "gnuid.h"
+
+class Channel;
+
+// ------------------------------------
+class ColdChannels
+{
+public:
+    enum
+    {
+        MAX_ENTRIES = 16,
+        MAX_HITS    = 4,        // 上流を含めて覚えておくヒットの数
+        TTL         = 600,      // 秒
+    };
+
+    struct Entry
+    {
+        ChanInfo            info;
+        ChanPacket::TYPE    headType = ChanPacket::T_UNKNOWN;
+        unsigned int        headPos = 0;
+        std::string         head;       // ヘッダーパケットのデータ
+        unsigned int        lastPos = 0;
+        std::vector<ChanHit> hits;
+        unsigned int        storedAt = 0;
+
+        size_t memoryUsage() const;
+    };
+
+    // 閉じるリレーチャンネルの状態を覚える。ヘッダーが無ければ何もし
+    // ない。
+    void        store(Channel& ch);
+    // MAX_ENTRIES を超えたら古いものから忘れる。
+    void        store(const Entry& entry);
+    // id の状態を取り出して消す。無ければ false。
+    bool        take(const GnuID& id, Entry& entry);
+    // 作り直したチャンネルに状態を戻す。ヒットは chanMgr に加える。
+    // 戻したら true。
+    bool        restore(Channel& ch);
+
+    // TTL を過ぎたものを消す。
+    void        expire(unsigned int now);
+    // 一番古いものを消す。無ければ false。
+    bool        evictOldest();
+
+    size_t      size();
+    uint64_t    memoryUsage();
+    amf0::Value getState();
+
+    // hits から上流の候補として良いものを max 個選ぶ。
+    static std::vector<ChanHit> bestHits(std::vector<ChanHit> hits, size_t max);
+
+private:
+    std::mutex                  m_lock;
+    std::map<std::string, Entry> m_entries;  // ID の文字列から
+    unsigned int                m_numStored = 0;
+    unsigned int                m_numRestored = 0;
+};
+
+extern ColdChannels g_coldChannels;
+
+#endif
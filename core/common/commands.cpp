@@ -481,7 +481,7 @@ void Commands::chan(Stream& stream, const std::vector<std::string>& argv, std::f
             }
         } else {
             auto it = channels[0];
-            std::lock_guard<std::recursive_mutex>(it->lock);
+            std::lock_guard<ProfiledMutex>(it->lock);
 
             if (it->type != Channel::T_BROADCAST) {
                 stream.writeLineF("Error: %s is not a broadcasting channel.", it->getID().str().c_str());
@@ -636,7 +636,7 @@ void Commands::filter(Stream& stream, const std::vector<std::string>& argv, std:
     }
 
     if (positionals[0] == "show") {//
-        std::lock_guard<std::recursive_mutex> cs(servMgr->lock);
+        std::lock_guard<ProfiledMutex> cs(servMgr->lock);
 
         for (int i = 0; i < servMgr->numFilters; i++) {
             ServFilter* filter = &servMgr->filters[i];
@@ -678,13 +678,13 @@ void Commands::log(Stream& stream, const std::vector<std::string>& argv, std::fu
         return;
     }
 
-    std::recursive_mutex lock;
+    ProfiledMutex lock { "Commands::log" };
 
     std::queue<std::string> queue;
     auto id = sys->logBuf->addListener([&](unsigned int time, LogBuffer::TYPE type, const char* msg) -> void
                                        {
                                            auto chunk = str::format("[%s] %s\n", LogBuffer::getTypeStr(type), msg);
-                                           std::lock_guard<std::recursive_mutex> cs(lock);
+                                           std::lock_guard<ProfiledMutex> cs(lock);
                                            queue.push(chunk);
                                        });
     Defer defer([=]() { sys->logBuf->removeListener(id); });
@@ -692,7 +692,7 @@ void Commands::log(Stream& stream, const std::vector<std::string>& argv, std::fu
     while (!cancel())
     {
         {
-            std::lock_guard<std::recursive_mutex> cs(lock);
+            std::lock_guard<ProfiledMutex> cs(lock);
             while (!queue.empty())
                 {
                     auto chunk = queue.front();
@@ -862,7 +862,7 @@ void Commands::ssl(Stream& stream, const std::vector<std::string>& argv, std::fu
             stream.writeLineF("       Status: %s", isReadable(sys->realPath(path)) ? "OK, Readable" : "Cannot open!");
         };
 
-    stream.writeLineF("SSL server: %s", (servMgr->flags.get("enableSSLServer")) ? "Enabled" : "Disabled");
+    stream.writeLineF("SSL server: %s", (servMgr->flags[ServMgr::F_enableSSLServer]) ? "Enabled" : "Disabled");
 
     stream.writeLine("\nCertificate File");
     showInfo(crt);
@@ -128,13 +128,33 @@ const char  *getCGIarg(const char *str, const char *arg);
 bool        hasCGIarg(const char *str, const char *arg);
 
 // ----------------------------------
-extern void LOG(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
-extern void LOG_TRACE(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
-extern void LOG_DEBUG(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
-extern void LOG_INFO(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
-extern void LOG_WARN(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
-extern void LOG_ERROR(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
-extern void LOG_FATAL(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+// ログ。引数はそのレベルのログが出る時にだけ評価する。type は
+// LogBuffer::TYPE の値。
+namespace peercast {
+extern bool isLogEnabled(int type);
+extern void writeLog(int type, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+}
+
+#define PEERCAST_LOG(type, ...) \
+    do { if (peercast::isLogEnabled(type)) peercast::writeLog(type, __VA_ARGS__); } while (0)
+
+// NO_DEBUG_LOG を定義してビルドすると LOG_TRACE と LOG_DEBUG は何も
+// しない。書式の検査だけは残す。
+#ifdef NO_DEBUG_LOG
+#define PEERCAST_NO_LOG(type, ...) \
+    do { if (false) peercast::writeLog(type, __VA_ARGS__); } while (0)
+#define LOG(...)        PEERCAST_NO_LOG(2, __VA_ARGS__)
+#define LOG_TRACE(...)  PEERCAST_NO_LOG(1, __VA_ARGS__)
+#define LOG_DEBUG(...)  PEERCAST_NO_LOG(2, __VA_ARGS__)
+#else
+#define LOG(...)        PEERCAST_LOG(2, __VA_ARGS__)
+#define LOG_TRACE(...)  PEERCAST_LOG(1, __VA_ARGS__)
+#define LOG_DEBUG(...)  PEERCAST_LOG(2, __VA_ARGS__)
+#endif
+#define LOG_INFO(...)   PEERCAST_LOG(3, __VA_ARGS__)
+#define LOG_WARN(...)   PEERCAST_LOG(4, __VA_ARGS__)
+#define LOG_ERROR(...)  PEERCAST_LOG(5, __VA_ARGS__)
+#define LOG_FATAL(...)  PEERCAST_LOG(6, __VA_ARGS__)
 
 // ----------------------------------
 #define ASSERT(expr) do{if(!(expr))LOG_WARN("Assertion failed: " #expr " at " __FILE__ ":%d", __LINE__);}while(0)
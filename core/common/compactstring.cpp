@@ -0,0 +1,129 @@
+// ------------------------------------------------
+// File : compactstring.cpp
+// Desc:
+//      引用符の外し方やエンコーディングの変換は ::String に写してから
+//      行い、結果を戻す。どれも設定やメタデータを読む時だけの処理。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <stdarg.h>
+
+#include "compactstring.h"
+
+// -----------------------------------
+void CompactString::assign(const char *p, size_t len)
+{
+    if (len > MAX_LEN - 1)
+        len = MAX_LEN - 1;
+    m_str.assign(p, len);
+}
+
+// -----------------------------------
+CompactString& CompactString::set(const char *p, TYPE t)
+{
+    assign(p, strlen(p));
+    type = t;
+    return *this;
+}
+
+// -----------------------------------
+CompactString& CompactString::setFromString(const char *str, TYPE t)
+{
+    ::String tmp;
+    tmp.setFromString(str, t);
+    return *this = tmp;
+}
+
+// -----------------------------------
+CompactString& CompactString::setUnquote(const char *p, TYPE t)
+{
+    ::String tmp;
+    tmp.setUnquote(p, t);
+    return *this = tmp;
+}
+
+// -----------------------------------
+CompactString& CompactString::convertTo(TYPE t)
+{
+    if (t == type)
+        return *this;
+
+    ::String tmp = toString();
+    tmp.convertTo(t);
+    return *this = tmp;
+}
+
+// -----------------------------------
+// ::String と同じく、入りきらなければ何もしない。
+void CompactString::append(const char *s)
+{
+    const size_t len = strlen(s);
+    if (len + m_str.size() < MAX_LEN - 1)
+        m_str.append(s, len);
+}
+
+// -----------------------------------
+void CompactString::append(char c)
+{
+    if (m_str.size() + 1 < MAX_LEN - 1)
+        m_str += c;
+}
+
+// -----------------------------------
+void CompactString::prepend(const char *s)
+{
+    std::string tmp = s;
+    tmp += m_str;
+    assign(tmp.data(), tmp.size());
+}
+
+// -----------------------------------
+void CompactString::sprintf(const char* fmt, ...)
+{
+    char buf[MAX_LEN];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    assign(buf, strlen(buf));
+}
+
+// -----------------------------------
+::String CompactString::toString() const
+{
+    ::String s(m_str.c_str(), type);
+    return s;
+}
+
+// -----------------------------------
+CompactString& CompactString::operator = (const char* cstr)
+{
+    assign(cstr, strlen(cstr));
+    type = ::String::T_ASCII;
+    return *this;
+}
+
+// -----------------------------------
+CompactString& CompactString::operator = (const std::string& rhs)
+{
+    assign(rhs.c_str(), strlen(rhs.c_str()));
+    type = ::String::T_ASCII;
+    return *this;
+}
+
+// -----------------------------------
+CompactString& CompactString::operator = (const ::String& rhs)
+{
+    set(rhs.c_str(), rhs.type);
+    return *this;
+}
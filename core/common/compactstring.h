@@ -0,0 +1,106 @@
+// ------------------------------------------------
+// File : compactstring.h
+// Desc:
+//      ::String と同じように使える、長さを覚えている文字列。::String
+//      は MAX_LEN バイトの配列を抱えているので、文字列をたくさん持つ
+//      ChanInfo や TrackInfo を写すたびに数 KB 動く。こちらは短い文字
+//      列をオブジェクトの中に置き (std::string の small buffer)、長い
+//      ものだけ確保する。ムーブは安い。
+//
+//      長さの上限は ::String と同じく MAX_LEN - 1 で、超えた分は切り捨
+//      てる。エンコーディングの変換などは ::String に任せる。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _COMPACTSTRING_H
+#define _COMPACTSTRING_H
+
+#include <string>
+
+#include "_string.h"
+
+// ------------------------------------
+class CompactString
+{
+public:
+    enum {
+        MAX_LEN = ::String::MAX_LEN
+    };
+
+    typedef ::String::TYPE TYPE;
+
+    CompactString()
+        : type(::String::T_UNKNOWN)
+    {
+    }
+
+    CompactString(const char *p, TYPE t = ::String::T_ASCII)
+    {
+        set(p, t);
+    }
+
+    CompactString(const ::String& s)
+        : type(s.type)
+        , m_str(s.c_str())
+    {
+    }
+
+    CompactString& set(const char *p, TYPE t = ::String::T_ASCII);
+    CompactString& setFromString(const char *str, TYPE t = ::String::T_ASCII);
+    CompactString& setUnquote(const char *p, TYPE t = ::String::T_ASCII);
+    CompactString& convertTo(TYPE t);
+
+    void clear()
+    {
+        m_str.clear();
+        type = ::String::T_UNKNOWN;
+    }
+
+    bool startsWith(const char *s) const { return m_str.compare(0, strlen(s), s) == 0; }
+    bool isEmpty() const { return m_str.empty(); }
+    bool isSame(const CompactString& s) const { return m_str == s.m_str; }
+    bool isSame(const char *s) const { return m_str == s; }
+    bool isSame(const ::String& s) const { return m_str == s.c_str(); }
+    bool contains(const char *s) const { return stristr(m_str.c_str(), s) != nullptr; }
+    void append(const char *s);
+    void append(char c);
+    void prepend(const char *s);
+
+    void sprintf(const char* fmt, ...) __attribute__ ((format (printf, 2, 3)));
+
+    operator const char *() const { return m_str.c_str(); }
+
+    bool operator == (const char *s) const { return isSame(s); }
+    bool operator != (const char *s) const { return !isSame(s); }
+
+    CompactString& operator = (const char* cstr);
+    CompactString& operator = (const std::string& rhs);
+    CompactString& operator = (const ::String& rhs);
+
+    const char* cstr() const { return m_str.c_str(); }
+    const char* c_str() const { return m_str.c_str(); }
+    const std::string& str() const { return m_str; }
+    // 種類を保ったまま ::String にする。
+    ::String toString() const;
+
+    size_t size() const { return m_str.size(); }
+
+    TYPE    type;
+
+private:
+    void    assign(const char *p, size_t len);
+
+    std::string m_str;
+};
+
+#endif
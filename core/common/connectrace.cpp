@@ -0,0 +1,134 @@
+// ------------------------------------------------
+// File : connectrace.cpp
+// Desc:
+//      複数の接続先に、少しずつ時間をずらして同時に接続する。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "connectrace.h"
+#include "sys.h"
+#include "transport.h"
+
+// 試みの間で共有する。最後のスレッドが終わるまで残る。
+struct ConnectRace::State
+{
+    std::mutex              lock;
+    std::condition_variable changed;
+
+    std::vector<Host>       hosts;
+    std::function<std::shared_ptr<ClientSocket>(const Host&)> createSocket;
+    std::function<void(ClientSocket&, int)> prepare;
+    std::chrono::steady_clock::time_point start;
+    unsigned int            stagger;
+
+    bool                    done = false;   // 勝者が決まった
+    int                     failures = 0;
+    std::shared_ptr<ClientSocket> winner;
+    int                     winnerIndex = -1;
+    std::string             lastError;
+};
+
+// ------------------------------------
+ConnectRace::ConnectRace()
+    : createSocket([](const Host& host) { return g_transports.createSocket(host); })
+    , stagger(STAGGER_MS)
+{
+}
+
+// ------------------------------------
+void ConnectRace::attempt(std::shared_ptr<State> state, int index)
+{
+    {
+        std::unique_lock<std::mutex> cs(state->lock);
+        auto due = state->start + std::chrono::milliseconds(state->stagger * index);
+        state->changed.wait_until(cs, due,
+                                  [&]() { return state->done || state->failures >= index; });
+        if (state->done)
+            return;
+    }
+
+    std::shared_ptr<ClientSocket> sock;
+    try
+    {
+        sock = state->createSocket(state->hosts[index]);
+        if (!sock)
+            throw StreamException("Can`t create socket");
+        if (state->prepare)
+            state->prepare(*sock, index);
+        sock->open(state->hosts[index]);
+        sock->connect();
+    }catch (StreamException& e)
+    {
+        LOG_DEBUG("Connect to %s failed: %s", state->hosts[index].str().c_str(), e.msg);
+        if (sock)
+            sock->close();
+        // TCP 以外で繋がらなければ、次は TCP で繋ぐ。
+        g_transports.forget(state->hosts[index]);
+
+        std::lock_guard<std::mutex> cs(state->lock);
+        state->failures++;
+        state->lastError = e.msg;
+        state->changed.notify_all();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> cs(state->lock);
+        if (!state->done)
+        {
+            state->done = true;
+            state->winner = sock;
+            state->winnerIndex = index;
+            state->changed.notify_all();
+            return;
+        }
+    }
+
+    // 遅れて繋がった。
+    sock->close();
+}
+
+// ------------------------------------
+std::shared_ptr<ClientSocket> ConnectRace::connect(const std::vector<Host>& hosts, int& winner)
+{
+    if (hosts.empty())
+        throw ArgumentException("ConnectRace::connect: no hosts");
+
+    auto state = std::make_shared<State>();
+    state->hosts = hosts;
+    state->createSocket = createSocket;
+    state->prepare = prepare;
+    state->stagger = stagger;
+    state->start = std::chrono::steady_clock::now();
+
+    // 一つだけならこのスレッドで繋ぐ。
+    if (hosts.size() == 1)
+        attempt(state, 0);
+    else
+        for (int i = 0; i < (int) hosts.size(); i++)
+            std::thread(attempt, state, i).detach();
+
+    std::unique_lock<std::mutex> cs(state->lock);
+    state->changed.wait(cs, [&]() { return state->done || state->failures == (int) hosts.size(); });
+
+    if (!state->done)
+        throw StreamException(state->lastError.c_str());
+
+    winner = state->winnerIndex;
+    return state->winner;
+}
@@ -0,0 +1,60 @@
+// ------------------------------------------------
+// File : connectrace.h
+// Desc:
+//      複数の接続先に、少しずつ時間をずらして同時に接続する。最初に繋
+//      がったソケットを使い、残りは繋がり次第閉じる。前の試みが全て失
+//      敗していれば、待たずに次を始める (Happy Eyeballs と同じ考え方)。
+//
+//      試みはそれぞれ別のスレッドで行う。呼び出し側は勝者が決まった所
+//      で戻り、負けたスレッドはその後で自分で片付ける。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _CONNECTRACE_H
+#define _CONNECTRACE_H
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "socket.h"
+
+// ------------------------------------
+class ConnectRace
+{
+public:
+    enum
+    {
+        STAGGER_MS = 250,   // 次の接続を始めるまでの時間
+    };
+
+    ConnectRace();
+
+    // hosts に接続して、最初に繋がったソケットを返す。winner にはその
+    // 添字が入る。全て失敗すれば最後のエラーで StreamException。
+    std::shared_ptr<ClientSocket> connect(const std::vector<Host>& hosts, int& winner);
+
+    // 接続先に使うソケットを作る関数。テストで差し替える。
+    std::function<std::shared_ptr<ClientSocket>(const Host&)> createSocket;
+
+    // open の前にソケットを設定する。引数は hosts の添字。
+    std::function<void(ClientSocket&, int)> prepare;
+
+    unsigned int stagger;   // ミリ秒
+
+private:
+    struct State;
+    static void attempt(std::shared_ptr<State> state, int index);
+};
+
+#endif
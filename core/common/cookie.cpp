@@ -18,46 +18,168 @@
 // GNU General Public License for more details.
 // ------------------------------------------------
 
+#include <algorithm>
+
 #include "cookie.h"
 #include "host.h"
 #include "sys.h"
+#include "str.h"
 
 // -----------------------------------
 void    CookieList::init()
 {
-    list.clear();
+    std::lock_guard<std::mutex> cs(m_lock);
 
+    m_sessions.clear();
+    m_count = 0;
+    m_useSerial = 0;
     neverExpire = false;
 }
 
 // -----------------------------------
-bool    CookieList::contains(Cookie &c)
+bool    CookieList::expired(const Entry& e, unsigned int now) const
+{
+    unsigned int t = timeout;
+    return t != 0 && now - e.lastUsed > t;
+}
+
+// -----------------------------------
+void    CookieList::purge(unsigned int now)
 {
-    if ((c.id[0]) && (c.ip)) {
-        auto it = std::find(list.begin(), list.end(), c);
-        return (it != list.end());
+    for (auto it = m_sessions.begin(); it != m_sessions.end(); )
+    {
+        auto& entries = it->second;
+        for (auto e = entries.begin(); e != entries.end(); )
+        {
+            if (expired(*e, now))
+            {
+                e = entries.erase(e);
+                m_count--;
+            }else
+                ++e;
+        }
+        it = entries.empty() ? m_sessions.erase(it) : std::next(it);
     }
+}
+
+// -----------------------------------
+// 追加する時にしか呼ばないので、全部見て探す。
+void    CookieList::evictLeastRecentlyUsed()
+{
+    auto oldest = m_sessions.end();
+    size_t oldestIndex = 0;
+
+    for (auto it = m_sessions.begin(); it != m_sessions.end(); ++it)
+    {
+        for (size_t i = 0; i < it->second.size(); i++)
+        {
+            if (oldest == m_sessions.end() ||
+                it->second[i].useSerial < oldest->second[oldestIndex].useSerial)
+            {
+                oldest = it;
+                oldestIndex = i;
+            }
+        }
+    }
+
+    if (oldest == m_sessions.end())
+        return;
+
+    oldest->second.erase(oldest->second.begin() + oldestIndex);
+    m_count--;
+    if (oldest->second.empty())
+        m_sessions.erase(oldest);
+}
+
+// -----------------------------------
+bool    CookieList::contains(Cookie &c)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return containsLocked(c);
+}
+
+// -----------------------------------
+bool    CookieList::containsLocked(Cookie &c)
+{
+    if (!c.id[0] || !c.ip)
+        return false;
 
+    auto it = m_sessions.find(c.ip.str());
+    if (it == m_sessions.end())
+        return false;
+
+    const unsigned int now = sys->getTime();
+    const std::string id = c.id;
+    auto& entries = it->second;
+    for (auto e = entries.begin(); e != entries.end(); ++e)
+    {
+        if (!str::secure_equals(e->id, id))
+            continue;
+
+        if (expired(*e, now))
+        {
+            entries.erase(e);
+            m_count--;
+            if (entries.empty())
+                m_sessions.erase(it);
+            return false;
+        }
+        e->lastUsed = now;
+        e->useSerial = m_useSerial++;
+        return true;
+    }
     return false;
 }
 
 // -----------------------------------
 bool    CookieList::add(Cookie &c)
 {
-    if (contains(c))
+    // 二つのログインが同時に来ても重ならないように、調べるのと入れるの
+    // を一つのロックの中で行う。
+    std::lock_guard<std::mutex> cs(m_lock);
+    if (containsLocked(c))
         return false;
 
-    list.push_back(c);
-    while (list.size() > MAX_COOKIES)
-        list.pop_front();
-    
+    const unsigned int now = sys->getTime();
+    purge(now);
+
+    const size_t max = std::max(1u, (unsigned int) maxCookies);
+    while (m_count >= max)
+        evictLeastRecentlyUsed();
+
+    m_sessions[c.ip.str()].push_back({ c.id, now, m_useSerial++ });
+    m_count++;
     return true;
 }
 
 // -----------------------------------
 void    CookieList::remove(Cookie &c)
 {
-    list.remove(c);
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    auto it = m_sessions.find(c.ip.str());
+    if (it == m_sessions.end())
+        return;
+
+    auto& entries = it->second;
+    for (auto e = entries.begin(); e != entries.end(); ++e)
+    {
+        if (str::secure_equals(e->id, c.id))
+        {
+            entries.erase(e);
+            m_count--;
+            break;
+        }
+    }
+    if (entries.empty())
+        m_sessions.erase(it);
+}
+
+// -----------------------------------
+size_t  CookieList::size()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_count;
 }
 
 // -----------------------------------
@@ -90,11 +212,14 @@ Cookie::Cookie()
 // -----------------------------------
 amf0::Value CookieList::getState()
 {
+    std::lock_guard<std::mutex> cs(m_lock);
+
     std::vector<amf0::Value> arr;
 
-    for (auto& cookie : list)
+    for (auto& pair : m_sessions)
     {
-        arr.push_back(amf0::Value::object({ { "ip", cookie.ip.str() }, { "id", cookie.id } }));
+        for (auto& e : pair.second)
+            arr.push_back(amf0::Value::object({ { "ip", pair.first }, { "id", e.id } }));
     }
     return arr;
 }
@@ -21,7 +21,12 @@
 #ifndef _COOKIE_H
 #define _COOKIE_H
 
-#include <list>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include "ip.h"
 #include "varwriter.h"
 
@@ -40,24 +45,56 @@ public:
 };
 
 // --------------------------------------------
+// ログイン中のセッション。送り元のアドレスで引き、ID は時間一定で比べ
+// る。アドレスは秘密ではないので、ハッシュで引いても ID を推測する手
+// 掛かりにはならない。
 class CookieList : public VariableWriter
 {
 public:
     enum {
-        MAX_COOKIES = 32
+        DEFAULT_MAX_COOKIES = 256,
     };
 
-    CookieList() { init(); }
+    CookieList()
+        : maxCookies(DEFAULT_MAX_COOKIES)
+        , timeout(0)
+    {
+        init();
+    }
 
     void    init();
     bool    add(Cookie &);
     void    remove(Cookie &);
+    // 見付かれば最後に使った時刻を今にする。
     bool    contains(Cookie &);
+    size_t  size();
 
     amf0::Value getState();
 
-    std::list<Cookie> list;
     bool    neverExpire;
+    // これを超えたら一番長く使われていないものを捨てる。
+    std::atomic<unsigned int> maxCookies;
+    // この秒数使われなければ捨てる。0 なら捨てない。
+    std::atomic<unsigned int> timeout;
+
+private:
+    struct Entry
+    {
+        std::string     id;
+        unsigned int    lastUsed;   // 時刻
+        uint64_t        useSerial;  // 使った順。同じ秒の中の前後を決める
+    };
+
+    bool    expired(const Entry& e, unsigned int now) const;
+    void    purge(unsigned int now);
+    void    evictLeastRecentlyUsed();
+    // m_lock を取った中で呼ぶ。
+    bool    containsLocked(Cookie &c);
+
+    std::mutex  m_lock;
+    std::unordered_map<std::string, std::vector<Entry>> m_sessions;
+    size_t      m_count;
+    uint64_t    m_useSerial;
 };
 
 #endif
@@ -26,6 +26,7 @@
 #include "servmgr.h"
 #include "version2.h"
 #include "chanmgr.h"
+#include "trackerhub.h"
 
 // ------------------------------------------
 bool ChannelStream::getStatus(std::shared_ptr<Channel> ch, ChanPacket &pack)
@@ -40,12 +41,20 @@ bool ChannelStream::getStatus(std::shared_ptr<Channel> ch, ChanPacket &pack)
     int newLocalListeners = ch->localListeners();
     int newLocalRelays = ch->localRelays();
 
+    bool newIsHub = servMgr->flags[ServMgr::F_trackerHubs] && g_trackerHubs.isHub(ch->info.id, ctime);
+    TrackerHubs::Summary hubSummary;
+    if (newIsHub)
+        hubSummary = g_trackerHubs.summary(ch->info.id, ctime);
+
     if (
         (
         (numListeners != newLocalListeners)
         || (numRelays != newLocalRelays)
         || (ch->isPlaying() != isPlaying)
         || (servMgr->getFirewall(ch->ipVersion) != fwState)
+        || (newIsHub != isHub)
+        || (hubSummary.numListeners != hubListeners)
+        || (hubSummary.numRelays != hubRelays)
         || ((ctime - lastUpdate) > 120)
         )
         && ((ctime - lastUpdate) > 10)
@@ -56,6 +65,9 @@ bool ChannelStream::getStatus(std::shared_ptr<Channel> ch, ChanPacket &pack)
         isPlaying = ch->isPlaying();
         fwState = servMgr->getFirewall(ch->ipVersion);
         lastUpdate = ctime;
+        isHub = newIsHub;
+        hubListeners = hubSummary.numListeners;
+        hubRelays = hubSummary.numRelays;
 
         ChanHit hit;
 
@@ -64,6 +76,9 @@ bool ChannelStream::getStatus(std::shared_ptr<Channel> ch, ChanPacket &pack)
 
         hit.initLocal(numListeners, numRelays, ch->info.numSkips, ch->info.getUptime(), isPlaying, oldp, newp, ch->canAddRelay(), ch->sourceHost.host, (ch->ipVersion == Channel::IP_V6));
         hit.tracker = ch->isBroadcasting();
+        hit.hub = isHub;
+        hit.hubListeners = hubListeners;
+        hit.hubRelays = hubRelays;
 
         MemoryStream pmem(pack.data, sizeof(pack.data));
         AtomStream atom(pmem);
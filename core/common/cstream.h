@@ -41,6 +41,9 @@ public:
     , isPlaying(false)
     , fwState(0)
     , lastUpdate(0)
+    , isHub(false)
+    , hubListeners(0)
+    , hubRelays(0)
     {}
 
     virtual ~ChannelStream() {}
@@ -55,6 +58,14 @@ public:
     virtual int  readPacket(Stream &, std::shared_ptr<Channel>) = 0;
     virtual void readEnd(Stream &, std::shared_ptr<Channel>) = 0;
 
+    // 別の接続から読んでいた prev の続きとして読む。ヘッダーを引き継いで
+    // ストリームを作り直さずに済むなら true。
+    virtual bool continueFrom(ChannelStream& prev) { return false; }
+
+    // readPacket の中で上流に送るものが残っていれば true。その間は
+    // Channel::readStream が短い間隔で readPacket を呼ぶ。
+    virtual bool hasUpstreamOutput() { return false; }
+
     void    readRaw(Stream &, std::shared_ptr<Channel>);
 
     int             numRelays;
@@ -62,6 +73,11 @@ public:
     bool            isPlaying;
     int             fwState;
     unsigned int    lastUpdate;
+
+    // トラッカーのハブを任されていれば、まとめた下流の数も報告する。
+    bool            isHub;
+    unsigned int    hubListeners;
+    unsigned int    hubRelays;
 };
 
 #endif
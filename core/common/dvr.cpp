@@ -0,0 +1,242 @@
+// ------------------------------------------------
+// File : dvr.cpp
+// Desc:
+//      タイムシフト用のディスクのリング。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "strerror.h"
+#endif
+
+#include "dvr.h"
+#include "common.h"
+#include "str.h"
+
+// ------------------------------------
+ChanPacketArchive::ChanPacketArchive()
+    : m_map(nullptr)
+    , m_size(0)
+#ifdef WIN32
+    , m_file(INVALID_HANDLE_VALUE)
+    , m_mapping(nullptr)
+#else
+    , m_fd(-1)
+#endif
+    , m_head(0)
+    , m_firstSerial(0)
+{
+}
+
+// ------------------------------------
+ChanPacketArchive::~ChanPacketArchive()
+{
+#ifdef WIN32
+    if (m_map)
+        UnmapViewOfFile(m_map);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+    if (!m_path.empty())
+        DeleteFileA(m_path.c_str());
+#else
+    if (m_map)
+        munmap(m_map, m_size);
+    if (m_fd != -1)
+        close(m_fd);
+    if (!m_path.empty())
+        unlink(m_path.c_str());
+#endif
+}
+
+// ------------------------------------
+void ChanPacketArchive::open(const std::string& path, size_t size)
+{
+    if (m_map)
+        throw GeneralException("Archive already open");
+    if (size == 0)
+        throw GeneralException("Archive size is zero");
+
+#ifdef WIN32
+    m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                         CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+        throw GeneralException(str::format("CreateFile: error %lu", GetLastError()));
+    m_path = path;
+
+    uint64_t s = size;
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE, (DWORD) (s >> 32), (DWORD) s, nullptr);
+    if (!m_mapping)
+        throw GeneralException(str::format("CreateFileMapping: error %lu", GetLastError()));
+
+    m_map = static_cast<char*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+    if (!m_map)
+        throw GeneralException(str::format("MapViewOfFile: error %lu", GetLastError()));
+#else
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (m_fd == -1)
+        throw GeneralException(str::format("open: %s", str::strerror(errno).c_str()));
+    m_path = path;
+
+    if (ftruncate(m_fd, size) == -1)
+        throw GeneralException(str::format("ftruncate: %s", str::strerror(errno).c_str()));
+
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (p == MAP_FAILED)
+        throw GeneralException(str::format("mmap: %s", str::strerror(errno).c_str()));
+    m_map = static_cast<char*>(p);
+#endif
+
+    m_size = size;
+}
+
+// ------------------------------------
+void ChanPacketArchive::clear()
+{
+    m_firstSerial += m_entries.size();
+    m_entries.clear();
+    m_keys.clear();
+}
+
+// ------------------------------------
+void ChanPacketArchive::put(const ChanPacketSlab& pack)
+{
+    if (pack.type != ChanPacket::T_HEAD && pack.type != ChanPacket::T_DATA)
+        return;
+    if (!m_map || pack.len == 0 || pack.len > m_size)
+        return;
+
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    if (!m_entries.empty())
+    {
+        auto& last = m_entries.back();
+        if ((int) (pack.pos - (last.pos + last.len)) < 0)
+            clear();
+    }
+
+    // ファイルの終わりを跨ぐなら先頭から書く。
+    size_t offset = m_head % m_size;
+    if (offset + pack.len > m_size)
+    {
+        m_head += m_size - offset;
+        offset = 0;
+    }
+
+    // 上書きされる範囲にあるパケットを捨てる。
+    uint64_t end = m_head + pack.len;
+    while (!m_entries.empty() && m_entries.front().at + m_size < end)
+    {
+        m_entries.pop_front();
+        m_firstSerial++;
+    }
+    while (!m_keys.empty() && m_keys.front() < m_firstSerial)
+        m_keys.pop_front();
+
+    memcpy(m_map + offset, pack.data, pack.len);
+
+    if (!pack.cont)
+        m_keys.push_back(m_firstSerial + m_entries.size());
+    m_entries.push_back({ m_head, pack.pos, pack.len, pack.time, pack.type, pack.cont });
+    m_head = end;
+}
+
+// ------------------------------------
+size_t ChanPacketArchive::lowerBound(unsigned int spos)
+{
+    auto it = std::lower_bound(m_entries.begin(), m_entries.end(), spos,
+                               [](const Entry& e, unsigned int pos)
+                               {
+                                   return (int) (e.pos - pos) < 0;
+                               });
+    return it - m_entries.begin();
+}
+
+// ------------------------------------
+bool ChanPacketArchive::read(unsigned int spos, ChanPacket& pack)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    size_t i = lowerBound(spos);
+    if (i == m_entries.size())
+        return false;
+
+    auto& e = m_entries[i];
+    pack.init();
+    pack.type = e.type;
+    pack.len = e.len;
+    pack.pos = e.pos;
+    pack.cont = e.cont;
+    memcpy(pack.data, m_map + e.at % m_size, std::min(e.len, (unsigned int) ChanPacket::MAX_DATALEN));
+    return true;
+}
+
+// ------------------------------------
+bool ChanPacketArchive::contains(unsigned int spos)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    if (m_entries.empty())
+        return false;
+
+    auto& first = m_entries.front();
+    auto& last = m_entries.back();
+    return (int) (spos - first.pos) >= 0 && (int) (spos - (last.pos + last.len)) < 0;
+}
+
+// ------------------------------------
+bool ChanPacketArchive::findKeyPos(double time, unsigned int& pos)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    if (m_keys.empty())
+        return false;
+
+    // 時刻が time より後の最初のキーフレームの一つ前。
+    auto it = std::upper_bound(m_keys.begin(), m_keys.end(), time,
+                               [this](double t, uint64_t serial)
+                               {
+                                   return t < m_entries[serial - m_firstSerial].time;
+                               });
+    if (it != m_keys.begin())
+        --it;
+
+    pos = m_entries[*it - m_firstSerial].pos;
+    return true;
+}
+
+// ------------------------------------
+size_t ChanPacketArchive::numPackets()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_entries.size();
+}
+
+// ------------------------------------
+double ChanPacketArchive::getDuration()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    if (m_entries.empty())
+        return 0;
+    return m_entries.back().time - m_entries.front().time;
+}
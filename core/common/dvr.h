@@ -0,0 +1,93 @@
+// ------------------------------------------------
+// File : dvr.h
+// Desc:
+//      タイムシフト用のディスクのリング。チャンネルのパケットを固定長
+//      のファイルに書き続け、メモリーに置いたインデックスで過去のスト
+//      リームポジションや時刻から引けるようにする。ファイルはメモリー
+//      マップするので、読み出しはページキャッシュから行われる。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _DVR_H
+#define _DVR_H
+
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "chanpacket.h"
+
+// ------------------------------------
+class ChanPacketArchive
+{
+public:
+    ChanPacketArchive();
+    // マップを解除してファイルを消す。
+    ~ChanPacketArchive();
+
+    // path に size バイトのファイルを作ってマップする。失敗したら
+    // GeneralException を投げる。
+    void    open(const std::string& path, size_t size);
+
+    // T_HEAD, T_DATA のパケットを書き足す。溢れた分は古いものから捨て
+    // る。ポジションが戻ったら新しいストリームとして全て捨てる。
+    void    put(const ChanPacketSlab& pack);
+
+    // ポジションが spos 以降の最初のパケットを pack に読む。
+    bool    read(unsigned int spos, ChanPacket& pack);
+
+    // spos がアーカイブの範囲に入っているか。
+    bool    contains(unsigned int spos);
+
+    // 書き込まれた時刻が time 以前で最も新しいキーフレームのポジション。
+    // そこまで古いものが無ければ一番古いキーフレーム。
+    bool    findKeyPos(double time, unsigned int& pos);
+
+    size_t  numPackets();
+    // 一番古いパケットから一番新しいパケットまでの秒数。
+    double  getDuration();
+
+private:
+    struct Entry
+    {
+        uint64_t        at;     // 書き込んだ論理オフセット。ファイル上は at % m_size
+        unsigned int    pos;
+        unsigned int    len;
+        double          time;
+        ChanPacket::TYPE type;
+        bool            cont;
+    };
+
+    void    clear();
+    // spos 以降の最初のパケットのインデックス。無ければ m_entries.size()。
+    size_t  lowerBound(unsigned int spos);
+
+    std::string         m_path;
+    char*               m_map;
+    size_t              m_size;
+#ifdef WIN32
+    void*               m_file;
+    void*               m_mapping;
+#else
+    int                 m_fd;
+#endif
+
+    std::mutex          m_lock;
+    uint64_t            m_head;         // 次に書き込む論理オフセット
+    std::deque<Entry>   m_entries;
+    uint64_t            m_firstSerial;  // m_entries.front() の通し番号
+    std::deque<uint64_t> m_keys;        // キーフレームの通し番号
+};
+
+#endif
@@ -0,0 +1,124 @@
+// ------------------------------------------------
+// File : eventbus.cpp
+// Desc:
+//      publish は EventBus::m_lock の下で各購読者の m_lock を取る。購読
+//      者の側から EventBus::m_lock を取るのは購読をやめる時だけで、そ
+//      の時は自分の m_lock を持っていない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <chrono>
+
+#include "eventbus.h"
+
+// global
+EventBus g_eventBus;
+
+// ------------------------------------
+EventBus::Subscription::Subscription(EventBus* bus)
+    : m_bus(bus)
+    , m_overflowed(false)
+{
+}
+
+// ------------------------------------
+EventBus::Subscription::~Subscription()
+{
+    std::lock_guard<std::mutex> cs(m_bus->m_lock);
+    m_bus->m_subscribers.erase(this);
+    m_bus->m_numSubscribers--;
+}
+
+// ------------------------------------
+void EventBus::Subscription::push(const Event& ev)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    if (m_queue.size() >= MAX_QUEUED)
+    {
+        m_queue.pop_front();
+        m_overflowed = true;
+    }
+    m_queue.push_back(ev);
+    m_cv.notify_one();
+}
+
+// ------------------------------------
+bool EventBus::Subscription::wait(Event& ev, int timeoutMs)
+{
+    std::unique_lock<std::mutex> cs(m_lock);
+
+    if (!m_cv.wait_for(cs, std::chrono::milliseconds(timeoutMs),
+                       [this]() { return !m_queue.empty(); }))
+        return false;
+
+    if (m_overflowed)
+    {
+        // 取りこぼしがあるので、差分ではなく全体を取り直してもらう。
+        m_overflowed = false;
+        m_queue.clear();
+        ev = m_bus->makeEvent("resync", amf0::Value::object({}));
+        return true;
+    }
+
+    ev = m_queue.front();
+    m_queue.pop_front();
+    return true;
+}
+
+// ------------------------------------
+size_t EventBus::Subscription::numQueued()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_queue.size();
+}
+
+// ------------------------------------
+EventBus::EventBus()
+    : m_numSubscribers(0)
+    , m_nextID(1)
+    , m_generation(0)
+{
+}
+
+// ------------------------------------
+std::shared_ptr<EventBus::Subscription> EventBus::subscribe()
+{
+    auto sub = std::make_shared<Subscription>(this);
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_subscribers.insert(sub.get());
+    m_numSubscribers++;
+    return sub;
+}
+
+// ------------------------------------
+EventBus::Event EventBus::makeEvent(const std::string& type, const amf0::Value& data)
+{
+    return { m_nextID++, type, data.inspect() };
+}
+
+// ------------------------------------
+void EventBus::publish(const std::string& type, const amf0::Value& data)
+{
+    m_generation++;
+
+    if (!hasSubscribers())
+        return;
+
+    auto ev = makeEvent(type, data);
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    for (auto sub : m_subscribers)
+        sub->push(ev);
+}
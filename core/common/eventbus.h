@@ -0,0 +1,104 @@
+// ------------------------------------------------
+// File : eventbus.h
+// Desc:
+//      状態の変化を購読者に配る。/api/1/events の Server-Sent Events
+//      はこれを読んで、ポーリングの代わりに差分をブラウザに送る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _EVENTBUS_H
+#define _EVENTBUS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "amf0.h"
+
+class EventBus;
+
+// global
+extern EventBus g_eventBus;
+
+// ------------------------------------
+class EventBus
+{
+public:
+    struct Event
+    {
+        unsigned int    id;
+        std::string     type;
+        std::string     data;   // JSON
+    };
+
+    // 一人の購読者に届いたイベントの待ち行列。捨てられると購読をやめる。
+    class Subscription
+    {
+    public:
+        enum
+        {
+            // 読まれずにこれを超えたら古い方から捨て、"resync" を一つ
+            // 入れて全体を取り直してもらう。
+            MAX_QUEUED = 256,
+        };
+
+        Subscription(EventBus* bus);
+        ~Subscription();
+
+        void    push(const Event& ev);
+
+        // イベントを一つ取り出す。timeoutMs ミリ秒待っても無ければ false。
+        bool    wait(Event& ev, int timeoutMs);
+
+        size_t  numQueued();
+
+    private:
+        EventBus*               m_bus;
+        std::mutex              m_lock;
+        std::condition_variable m_cv;
+        std::deque<Event>       m_queue;
+        bool                    m_overflowed;
+    };
+
+    EventBus();
+
+    std::shared_ptr<Subscription> subscribe();
+
+    // 購読者が一人もいなければ generation() を進めるだけ。データを作
+    // るのが重い呼び出し元は先に hasSubscribers() を見る。
+    void    publish(const std::string& type, const amf0::Value& data);
+
+    bool    hasSubscribers() { return m_numSubscribers.load() > 0; }
+
+    // publish される度に増える。購読者がいなくても増えるので、作り置
+    // きしたものが古くなったかどうかを見るのに使える。
+    unsigned int generation() { return m_generation.load(); }
+
+    // 通し番号を振ったイベントを作る。
+    Event   makeEvent(const std::string& type, const amf0::Value& data);
+
+private:
+    friend class Subscription;
+
+    std::mutex                  m_lock;
+    std::set<Subscription*>     m_subscribers;
+    std::atomic<int>            m_numSubscribers;
+    std::atomic<unsigned int>   m_nextID;
+    std::atomic<unsigned int>   m_generation;
+};
+
+#endif
@@ -0,0 +1,193 @@
+// ------------------------------------------------
+// File : filterengine.cpp
+// Desc:
+//      ServMgr のフィルター表を組み直したもの。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "filterengine.h"
+#include "sys.h"
+
+// ------------------------------------
+void FilterEngine::Trie::insert(const unsigned char* addr, int bits, unsigned int flags)
+{
+    if (m_nodes.empty())
+        m_nodes.emplace_back();
+
+    int node = 0;
+    for (int i = 0; i < bits; i++)
+    {
+        int b = (addr[i / 8] >> (7 - i % 8)) & 1;
+        if (m_nodes[node].child[b] == 0)
+        {
+            m_nodes[node].child[b] = (int) m_nodes.size();
+            m_nodes.emplace_back();
+        }
+        node = m_nodes[node].child[b];
+    }
+    m_nodes[node].flags |= flags;
+}
+
+// ------------------------------------
+unsigned int FilterEngine::Trie::lookup(const unsigned char* addr, int bits) const
+{
+    if (m_nodes.empty())
+        return 0;
+
+    int node = 0;
+    unsigned int flags = m_nodes[0].flags;
+    for (int i = 0; i < bits; i++)
+    {
+        node = m_nodes[node].child[(addr[i / 8] >> (7 - i % 8)) & 1];
+        if (node == 0)
+            break;
+        flags |= m_nodes[node].flags;
+    }
+    return flags;
+}
+
+// ------------------------------------
+bool FilterEngine::isCurrent(const ServFilter* filters, int n) const
+{
+    if ((int) m_source.size() != n)
+        return false;
+    for (int i = 0; i < n; i++)
+        if (!(m_source[i] == filters[i]))
+            return false;
+    return true;
+}
+
+// ------------------------------------
+// f をプレフィックス木に入れる。入らなければ false。
+bool FilterEngine::addPrefix(const ServFilter& f)
+{
+    const unsigned char* addr = f.host.ip.addr;
+
+    switch (f.type)
+    {
+    case ServFilter::T_IP:
+        {
+            // 0.0.0.0 は何にも当たらない。
+            if (!f.host.ip)
+                return true;
+
+            // 255 のフィールドが末尾に続くものだけがプレフィックスになる。
+            int len = 0;
+            while (len < 4 && addr[12 + len] != 255)
+                len++;
+            for (int i = len; i < 4; i++)
+                if (addr[12 + i] != 255)
+                    return false;
+            m_ipv4.insert(addr + 12, len * 8, f.flags);
+            return true;
+        }
+    case ServFilter::T_IPV6:
+        if (f.host.ip.isIPv4Mapped())
+            m_ipv4.insert(addr + 12, 32, f.flags);
+        else
+            m_ipv6.insert(addr, 128, f.flags);
+        return true;
+    case ServFilter::T_IPV4_WITH_NETMASK:
+        m_ipv4.insert(addr + 12, f.netmask, f.flags);
+        return true;
+    case ServFilter::T_IPV6_WITH_NETMASK:
+        // IPv4 アドレスにはマッチしないので IPv6 の木だけに入れる。
+        m_ipv6.insert(addr, f.netmask, f.flags);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// ------------------------------------
+void FilterEngine::compile(const ServFilter* filters, int n)
+{
+    m_source.assign(filters, filters + n);
+    m_ipv4.clear();
+    m_ipv6.clear();
+    m_slow.clear();
+    m_slowFlags = 0;
+    m_cache.clear();
+    m_generation++;
+
+    for (int i = 0; i < n; i++)
+    {
+        const ServFilter& f = filters[i];
+        if (f.flags == 0 || addPrefix(f))
+            continue;
+        m_slow.push_back(f);
+        m_slowFlags |= f.flags;
+    }
+}
+
+// ------------------------------------
+bool FilterEngine::matches(int fl, const Host& h, const ServFilter* filters, int n)
+{
+    std::vector<ServFilter> slow;
+    unsigned int generation;
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+
+        if (!isCurrent(filters, n))
+            compile(filters, n);
+
+        const IP& ip = h.ip;
+        unsigned int flags = ip.isIPv4Mapped()
+            ? m_ipv4.lookup(ip.addr + 12, 32)
+            : m_ipv6.lookup(ip.addr, 128);
+        if (flags & fl)
+            return true;
+
+        if ((m_slowFlags & fl) == 0)
+            return false;
+
+        auto it = m_cache.find(ip);
+        if (it != m_cache.end() && it->second.expires > sys->getDTime()
+            && (it->second.checked & fl) == (unsigned int) fl)
+            return (it->second.matched & fl) != 0;
+
+        for (auto& f : m_slow)
+            if (f.flags & fl)
+                slow.push_back(f);
+        generation = m_generation;
+    }
+
+    // 名前を引くかもしれないのでロックを離して試す。
+    unsigned int matched = 0;
+    for (auto& f : slow)
+        if (f.matches(fl, h))
+            matched |= f.flags;
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    if (generation != m_generation)
+        return (matched & fl) != 0; // 試している間に組み直された。
+
+    if (m_cache.size() >= MAX_CACHE)
+        m_cache.clear();
+
+    const double now = sys->getDTime();
+    auto& d = m_cache[h.ip];
+    if (d.expires <= now)
+        d = { 0, 0, now + CACHE_TTL };
+    d.matched |= matched;
+    d.checked |= fl;
+
+    return (matched & fl) != 0;
+}
+
+// ------------------------------------
+void FilterEngine::clearCache()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_cache.clear();
+}
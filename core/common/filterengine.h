@@ -0,0 +1,97 @@
+// ------------------------------------------------
+// File : filterengine.h
+// Desc:
+//      ServMgr のフィルター表を組み直したもの。接続のたびに全てのフィル
+//      ターを順に試す代わりに、アドレスのルールは IPv4 と IPv6 のプレ
+//      フィックス木にまとめ、一度引くだけで当たったフィルターのフラグ
+//      の和が分かるようにする。
+//
+//      名前解決が要るルール (ホスト名とサフィックス) と、プレフィック
+//      スにならないワイルドカードはそのまま試すが、その結果はホストご
+//      とにしばらく覚えておく。名前の解決自体は g_resolver のキャッシュ
+//      を通る。
+//
+//      フィルター表は色々な所から直接書き換えられるので、組み直した時
+//      の写しと比べて変わっていれば組み直す。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _FILTERENGINE_H
+#define _FILTERENGINE_H
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "servfilter.h"
+
+// ------------------------------------
+class FilterEngine
+{
+public:
+    enum
+    {
+        CACHE_TTL   = 60,   // 遅いルールの結果を覚えておく秒数
+        MAX_CACHE   = 4096, // これを超えたら覚えた結果を全て捨てる
+    };
+
+    FilterEngine() : m_slowFlags(0), m_generation(0) {}
+
+    // filters[0..n) のうちフラグ fl を持つものに h が当たるか。
+    // ServFilter::matches を順に試すのと同じ結果になる。
+    bool    matches(int fl, const Host& h, const ServFilter* filters, int n);
+
+    void    clearCache();
+
+private:
+    // 二分木。ノードにはそこで終わるプレフィックスのフラグの和を持つ。
+    class Trie
+    {
+    public:
+        void    clear() { m_nodes.clear(); }
+        void    insert(const unsigned char* addr, int bits, unsigned int flags);
+        // addr を含む全てのプレフィックスのフラグの和。
+        unsigned int lookup(const unsigned char* addr, int bits) const;
+
+    private:
+        struct Node
+        {
+            Node() : flags(0), child{0, 0} {}
+            unsigned int flags;
+            int          child[2];  // 0 は子無し (根には戻らない)
+        };
+        std::vector<Node> m_nodes;
+    };
+
+    struct Decision
+    {
+        unsigned int matched;   // 当たった遅いルールのフラグの和
+        unsigned int checked;   // 試し終えたフラグ
+        double       expires;
+    };
+
+    bool    isCurrent(const ServFilter* filters, int n) const;
+    void    compile(const ServFilter* filters, int n);
+    bool    addPrefix(const ServFilter& f);
+
+    std::mutex              m_lock;
+    std::vector<ServFilter> m_source;   // 組み直した時のフィルター表
+    Trie                    m_ipv4;
+    Trie                    m_ipv6;
+    std::vector<ServFilter> m_slow;     // 木に入らないルール
+    unsigned int            m_slowFlags;
+    unsigned int            m_generation;   // 組み直した回数
+    std::map<IP, Decision>  m_cache;
+};
+
+#endif
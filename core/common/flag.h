@@ -30,8 +30,8 @@ public:
          bool defaultValue);
     Flag(const Flag& other);
 
-    operator bool () const { return currentValue.load(); }
-    Flag& operator = (bool v) { currentValue.store(v); return *this; }
+    operator bool () const { return currentValue.load(std::memory_order_acquire); }
+    Flag& operator = (bool v) { currentValue.store(v, std::memory_order_release); return *this; }
 
     const std::string name, desc;
     const bool defaultValue;
@@ -43,8 +43,13 @@ class FlagRegistory : public VariableWriter
 public:
     FlagRegistory(std::vector<Flag>&& flags);
 
+    // 名前で探す。設定の読み書きなど、速さの要らない所で使う。
     Flag& get(const std::string&);
 
+    // 登録した順の番号で引く。名前を探さないので、パケットごとに呼ん
+    // でよい。番号は ServMgr::FLAG のような列挙型で持つ。
+    Flag& operator [] (size_t index) { return m_flags[index]; }
+
     void forEachFlag(std::function<void(Flag&)> func);
 
     amf0::Value getState() override;
@@ -0,0 +1,164 @@
+// ------------------------------------------------
+// File : flatmap.h
+// Desc:
+//      開番地法のハッシュ表。要素を一つの配列に並べて線形探査するので、
+//      std::map や std::unordered_map のようにノードをたどらない。
+//      消した時は後ろの要素を詰めるので、墓標は残らない。
+//
+//      キーと値は既定構築できるもの。要素を足すと表が作り直されること
+//      があり、その時は find や [] で得たポインタ・参照は無効になる。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+#ifndef _FLATMAP_H
+#define _FLATMAP_H
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "gnuid.h"
+
+// ------------------------------------
+template <typename K, typename V, typename Hash, typename Equal>
+class FlatHashMap
+{
+public:
+    enum { MIN_CAPACITY = 8 };
+
+    FlatHashMap() : m_size(0) {}
+
+    // key の値へのポインタ。無ければ nullptr。
+    V* find(const K& key)
+    {
+        if (m_slots.empty())
+            return nullptr;
+
+        for (size_t i = home(key); m_slots[i].used; i = (i + 1) & mask())
+            if (m_equal(m_slots[i].key, key))
+                return &m_slots[i].value;
+        return nullptr;
+    }
+
+    // key の値。無ければ既定値で作る。
+    V& operator[](const K& key)
+    {
+        if ((m_size + 1) * 4 > m_slots.size() * 3)
+            rehash(m_slots.empty() ? MIN_CAPACITY : m_slots.size() * 2);
+
+        size_t i = home(key);
+        for (; m_slots[i].used; i = (i + 1) & mask())
+            if (m_equal(m_slots[i].key, key))
+                return m_slots[i].value;
+
+        m_slots[i].used = true;
+        m_slots[i].key = key;
+        m_slots[i].value = V();
+        m_size++;
+        return m_slots[i].value;
+    }
+
+    // key を消す。あれば true。
+    bool erase(const K& key)
+    {
+        if (m_slots.empty())
+            return false;
+
+        size_t i = home(key);
+        for (; m_slots[i].used; i = (i + 1) & mask())
+            if (m_equal(m_slots[i].key, key))
+                break;
+        if (!m_slots[i].used)
+            return false;
+
+        // 探査の列が途切れないように、後ろの要素を空いた所へ移す。
+        size_t j = i;
+        while (true)
+        {
+            j = (j + 1) & mask();
+            if (!m_slots[j].used)
+                break;
+            size_t h = home(m_slots[j].key);
+            // h が (i, j] の外にあれば i に移せる。
+            if (((j - h) & mask()) >= ((j - i) & mask()))
+            {
+                m_slots[i].key = std::move(m_slots[j].key);
+                m_slots[i].value = std::move(m_slots[j].value);
+                i = j;
+            }
+        }
+        m_slots[i].used = false;
+        m_slots[i].key = K();
+        m_slots[i].value = V();
+        m_size--;
+        return true;
+    }
+
+    void clear()
+    {
+        m_slots.clear();
+        m_size = 0;
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    // 全ての要素について block(key, value) を呼ぶ。順番は決まっていな
+    // い。block の中で要素を足したり消したりしてはならない。
+    template <typename F>
+    void forEach(F block)
+    {
+        for (auto& s : m_slots)
+            if (s.used)
+                block(s.key, s.value);
+    }
+
+private:
+    struct Slot
+    {
+        Slot() : used(false) {}
+        bool used;
+        K    key;
+        V    value;
+    };
+
+    size_t mask() const { return m_slots.size() - 1; }
+
+    // ハッシュ値の上位ビットで位置を決める。下位ビットしか変わらない
+    // ハッシュでも散らばるようにする。
+    size_t home(const K& key) const
+    {
+        uint64_t h = static_cast<uint64_t>(m_hash(key)) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(h >> 32) & mask();
+    }
+
+    void rehash(size_t capacity)
+    {
+        std::vector<Slot> old(capacity);
+        old.swap(m_slots);
+        m_size = 0;
+        for (auto& s : old)
+            if (s.used)
+                (*this)[s.key] = std::move(s.value);
+    }
+
+    std::vector<Slot> m_slots;  // 大きさは 2 のべき
+    size_t            m_size;
+    Hash              m_hash;
+    Equal             m_equal;
+};
+
+// ------------------------------------
+template <typename V>
+using GnuIDFlatMap = FlatHashMap<GnuID, V, GnuIDHash, GnuIDEqual>;
+
+#endif
@@ -19,6 +19,7 @@
 #include "channel.h"
 #include "flv.h"
 #include "amf0.h"
+#include "chanmgr.h"
 #include <math.h> // ceil
 
 // static String timestampToString(uint32_t timestamp)
@@ -38,9 +39,28 @@ void FLVStream::readEnd(Stream &, std::shared_ptr<Channel>)
 // ------------------------------------------
 void FLVStream::readHeader(Stream &in, std::shared_ptr<Channel> ch)
 {
-    metaBitrate = 0;
+    if (!m_resuming)
+        metaBitrate = 0;
     fileHeader.read(in);
-    m_buffer.startTime = sys->getDTime();
+    m_buffer.startTime = sys->getMonotonicTime();
+}
+
+// ------------------------------------------
+bool FLVStream::continueFrom(ChannelStream& prev)
+{
+    auto p = dynamic_cast<FLVStream*>(&prev);
+    if (!p || p->fileHeader.size == 0)
+        return false;
+
+    fileHeader = p->fileHeader;
+    metaData = p->metaData;
+    audioHeader = p->audioHeader;
+    videoHeader = p->videoHeader;
+    metaBitrate = p->metaBitrate;
+    m_buffer.m_streamHasKeyFrames = p->m_buffer.m_streamHasKeyFrames;
+    m_lastTimestamp = p->m_lastTimestamp;
+    m_resuming = true;
+    return true;
 }
 
 // ----------------------------------------------------------
@@ -78,10 +98,25 @@ std::pair<bool,int> FLVStream::readMetaData(void* data, int size)
 // ------------------------------------------
 int FLVStream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
 {
-    bool headerUpdate = false;
+    // パケットを送り出すか、読めるデータが無くなるまでタグを読む。
+    while (!readTag(in, ch) && in.readReady())
+        ;
 
-    FLVTag flvTag;
-    flvTag.read(in);
+    return 0;
+}
+
+// ------------------------------------------
+// タグを一つ読んで処理する。パケットを送り出した場合 true を返す。
+bool FLVStream::readTag(Stream &in, std::shared_ptr<Channel> ch)
+{
+    m_tag.read(in);
+    return putTag(m_tag, in, ch);
+}
+
+// ------------------------------------------
+bool FLVStream::putTag(FLVTag& flvTag, Stream &in, std::shared_ptr<Channel> ch)
+{
+    bool headerUpdate = false;
 
     // LOG_DEBUG("%s: %s: %d byte %s tag",
     //           static_cast<std::string>(ch->info.id).c_str(),
@@ -101,35 +136,25 @@ int FLVStream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
             {
                 metaBitrate = bitrate;
                 metaData = flvTag;
+                // 前のソースの続きなら、ヘッダーは作り直さない。
+                if (m_resuming)
+                {
+                    ch->updateBitrate(metaBitrate);
+                    return false;
+                }
                 headerUpdate = true;
             }
         }
         break;
     case FLVTag::T_VIDEO:
-        // AVC Header
-        if (avcHeader.type == FLVTag::T_UNKNOWN) {
-            LOG_DEBUG("Got AVC header");
-            avcHeader = flvTag;
-            if (avcHeader.getTimestamp() != 0)
-            {
-                LOG_INFO("AVC header has non-zero timestamp. Cleared to zero.");
-                avcHeader.setTimestamp(0);
-            }
-            headerUpdate = true;
-        }
+        if (flvTag.isSequenceHeader() ||
+            (!flvTag.hasSequenceHeaders() && videoHeader.type == FLVTag::T_UNKNOWN))
+            headerUpdate = updateHeader(videoHeader, flvTag);
         break;
     case FLVTag::T_AUDIO:
-        // AAC Header
-        if (aacHeader.type == FLVTag::T_UNKNOWN) {
-            LOG_DEBUG("Got AAC header");
-            aacHeader = flvTag;
-            if (aacHeader.getTimestamp() != 0)
-            {
-                LOG_INFO("AAC header has non-zero timestamp. Cleared to zero.");
-                aacHeader.setTimestamp(0);
-            }
-            headerUpdate = true;
-        }
+        if (flvTag.isSequenceHeader() ||
+            (!flvTag.hasSequenceHeaders() && audioHeader.type == FLVTag::T_UNKNOWN))
+            headerUpdate = updateHeader(audioHeader, flvTag);
         break;
     default:
         LOG_ERROR("Invalid FLV tag!");
@@ -138,32 +163,26 @@ int FLVStream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
     // メタ情報からのビットレートが無い場合、ストリームからの実測値が
     // 現在の公称値を超えていれば公称値を更新する。
     if (metaBitrate == 0) {
-        ChanInfo info = ch->info;
-
         int newBitrate = in.stat.bytesInPerSecAvg() / 1000 * 8;
-        if (newBitrate > info.bitrate) {
-            info.bitrate = newBitrate;
-            ch->updateInfo(info);
-        }
+        if (newBitrate > ch->info.bitrate)
+            ch->updateBitrate(newBitrate);
     }
 
     if (headerUpdate && fileHeader.size>0) {
         int len = fileHeader.size;
         if (metaData.type == FLVTag::T_SCRIPT) len += metaData.packetSize;
-        if (avcHeader.type == FLVTag::T_VIDEO) len += avcHeader.packetSize;
-        if (aacHeader.type == FLVTag::T_AUDIO) len += aacHeader.packetSize;
+        if (videoHeader.type == FLVTag::T_VIDEO) len += videoHeader.packetSize;
+        if (audioHeader.type == FLVTag::T_AUDIO) len += audioHeader.packetSize;
         MemoryStream mem(ch->headPack.data, len);
         mem.write(fileHeader.data, fileHeader.size);
         if (metaData.type == FLVTag::T_SCRIPT) mem.write(metaData.packet, metaData.packetSize);
-        if (avcHeader.type == FLVTag::T_VIDEO) mem.write(avcHeader.packet, avcHeader.packetSize);
-        if (aacHeader.type == FLVTag::T_AUDIO) mem.write(aacHeader.packet, aacHeader.packetSize);
+        if (videoHeader.type == FLVTag::T_VIDEO) mem.write(videoHeader.packet, videoHeader.packetSize);
+        if (audioHeader.type == FLVTag::T_AUDIO) mem.write(audioHeader.packet, audioHeader.packetSize);
 
         // メタ情報からのビットレートがあればその値を設定。無ければ、
         // 前回のエンコードセッションからの値をクリアするために 0 を設
         // 定する。
-        ChanInfo info = ch->info;
-        info.bitrate = metaBitrate;
-        ch->updateInfo(info);
+        ch->updateBitrate(metaBitrate);
 
         m_buffer.flush(ch);
 
@@ -176,78 +195,161 @@ int FLVStream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
         ch->newPacket(ch->headPack);
 
         ch->streamPos = 0 + ch->headPack.len;
-    }
-    else {
-        bool packet_sent;
 
-        packet_sent = m_buffer.put(flvTag, ch);
+        // コーデックが変わったので、新しいストリームとして送る。
+        m_resuming = false;
+        m_timestampOffset = 0;
+        return true;
+    }
 
-        if (!packet_sent && in.readReady())
-            return readPacket(in, ch);
+    if (m_resuming)
+    {
+        // 前のソースの続きはキーフレームから始め、タイムスタンプがその
+        // 後になるようにずらす。
+        if (m_buffer.m_streamHasKeyFrames &&
+            !(flvTag.isKeyFrame() && !flvTag.isSequenceHeader()))
+            return false;
+        m_timestampOffset = m_lastTimestamp + 1 - flvTag.getTimestamp();
+        m_resuming = false;
     }
+    if (m_timestampOffset)
+        flvTag.setTimestamp(flvTag.getTimestamp() + m_timestampOffset);
+    m_lastTimestamp = flvTag.getTimestamp();
 
-    return 0;
+    return m_buffer.put(flvTag, ch);
 }
 
-bool FLVTagBuffer::put(FLVTag& tag, std::shared_ptr<Channel> ch)
+// ------------------------------------------
+// シーケンスヘッダーを取っておく。前と同じなら何もせず false を返す。
+bool FLVStream::updateHeader(FLVTag& header, FLVTag& tag)
 {
-    if (tag.isKeyFrame())
+    if (header.type == tag.type && header.size == tag.size &&
+        memcmp(header.data, tag.data, tag.size) == 0)
+        return false;
+
+    LOG_DEBUG("Got %s %s header", tag.getCodecName().c_str(), tag.getTagType());
+    header = tag;
+    if (header.getTimestamp() != 0)
     {
-        m_streamHasKeyFrames = true;
+        LOG_INFO("%s header has non-zero timestamp. Cleared to zero.", header.getTagType());
+        header.setTimestamp(0);
+    }
+    return true;
+}
+
+// ------------------------------------------
+std::string FLVTag::getCodecName()
+{
+    if (!data || size < 1)
+        return "unknown";
 
-        if (m_mem.pos > 0)
+    if (type == T_VIDEO)
+    {
+        if (isExVideo(data, size))
+            return std::string(reinterpret_cast<char*>(data) + 1, 4);
+        switch (data[0] & 0x0f)
         {
-            flush(ch);
+        case CODEC_AVC:  return "AVC";
+        case CODEC_HEVC: return "HEVC";
+        default:         return "codec " + std::to_string(data[0] & 0x0f);
         }
-        sendImmediately(tag, ch);
-        return true;
-    } else if (m_mem.pos + tag.packetSize > MAX_OUTGOING_PACKET_SIZE)
+    }else if (type == T_AUDIO)
+    {
+        int format = data[0] >> 4;
+        if (format == SOUND_EX_HEADER && size >= 5)
+            return std::string(reinterpret_cast<char*>(data) + 1, 4);
+        if (format == SOUND_AAC)
+            return "AAC";
+        return "format " + std::to_string(format);
+    }
+    return "";
+}
+
+// ------------------------------------------
+bool FLVTagBuffer::put(FLVTag& tag, std::shared_ptr<Channel> ch)
+{
+    // 低遅延モードではタグを溜めずに一つずつパケットにする。
+    if (ch->info.lowLatency)
     {
+        if (tag.isKeyFrame())
+            m_streamHasKeyFrames = true;
         flush(ch);
         sendImmediately(tag, ch);
         return true;
-    } else if (m_mem.pos + tag.packetSize > FLUSH_THRESHOLD)
+    }
+
+    // キーフレームは溜めずに、新しいパケットの先頭にして送る。
+    if (tag.isKeyFrame())
     {
-        flush(ch);
+        m_streamHasKeyFrames = true;
 
-        m_mem.write(tag.packet, tag.packetSize);
+        flush(ch);
+        sendImmediately(tag, ch);
+        return true;
+    }
 
-        if (m_mem.pos > FLUSH_THRESHOLD)
+    // 溜めているタグから TARGET_PACKET_MSEC 経ったか、入りきらなければ
+    // 先に送り出す。タイムスタンプが戻った時も区切る。
+    bool flushed = false;
+    if (m_mem.pos > 0)
+    {
+        int32_t span = tag.getTimestamp() - m_firstTimestamp;
+        if (span >= TARGET_PACKET_MSEC || span < 0 ||
+            m_mem.pos + tag.packetSize > MAX_OUTGOING_PACKET_SIZE)
+        {
             flush(ch);
-        return true;
-    } else
+            flushed = true;
+        }
+    }
+
+    if (tag.packetSize > MAX_OUTGOING_PACKET_SIZE)
     {
-        m_mem.write(tag.packet, tag.packetSize);
-        return false;
+        sendImmediately(tag, ch);
+        return true;
     }
+
+    if (m_mem.pos == 0)
+        m_firstTimestamp = tag.getTimestamp();
+    m_mem.write(tag.packet, tag.packetSize);
+    return flushed;
 }
 
 void FLVTagBuffer::rateLimit(uint32_t timestamp)
 {
-    double diff = (startTime + timestamp/1000.0) - sys->getDTime();
+    double now = sys->getMonotonicTime();
+    double deadline = startTime + timestamp/1000.0;
+    double diff = deadline - now;
     if (diff > 10)
     {
         // 10秒は長すぎるので、タイムスタンプがジャンプしてるっぽい。
         // 基準時刻をリセット。
         LOG_DEBUG("Timestamp way into the future. Resetting referece point.");
-        startTime = sys->getDTime();
+        startTime = now;
     }else if (diff < -10)
     {
         LOG_DEBUG("Timestamp way back in the past. Resetting referece point.");
-        startTime = sys->getDTime();
+        startTime = now;
     }else if (diff > 0)
     {
         LOG_TRACE("Sleeping %.2f s", diff);
-        sys->sleep(diff * 1000);
+        sys->sleepUntil(deadline);
     }
 }
 
-void FLVTagBuffer::sendImmediately(FLVTag& tag, std::shared_ptr<Channel> ch)
+void FLVTagBuffer::pace(uint32_t timestamp, std::shared_ptr<Channel> ch)
 {
     if (ch->readDelay)
-        rateLimit(tag.getTimestamp());
+        rateLimit(timestamp);
+    else if (chanMgr->ingestJitterMsec && ch->type == Channel::T_BROADCAST)
+        m_pacer.wait(timestamp / 1000.0, chanMgr->ingestJitterMsec / 1000.0);
+}
+
+void FLVTagBuffer::sendImmediately(FLVTag& tag, std::shared_ptr<Channel> ch)
+{
+    pace(tag.getTimestamp(), ch);
 
-    ChanPacket pack;
+    // 呼ばれる時にはバッファは空なので、m_pack をそのまま使う。
+    ChanPacket& pack = m_pack;
     MemoryStream mem(tag.packet, tag.packetSize);
 
     int rlen = tag.packetSize;
@@ -286,26 +388,19 @@ void FLVTagBuffer::flush(std::shared_ptr<Channel> ch)
     if (m_mem.pos == 0)
         return;
 
-    int length = m_mem.pos;
-
-    m_mem.rewind();
-    {
-        FLVTag flvTag;
-        flvTag.read(m_mem);
-        if (ch->readDelay)
-            rateLimit(flvTag.getTimestamp());
-        m_mem.rewind();
-    }
+    // 先頭のタグのタイムスタンプ。
+    auto p = reinterpret_cast<unsigned char*>(m_pack.data);
+    pace((p[7] << 24) | (p[4] << 16) | (p[5] << 8) | (p[6]), ch);
 
-    ChanPacket pack;
+    // タグは m_pack.data に溜めてあるので、そのまま送る。
+    ChanPacket& pack = m_pack;
 
     pack.type = ChanPacket::T_DATA;
     pack.pos = ch->streamPos;
-    pack.len = length;
+    pack.len = m_mem.pos;
     // キーフレームでないタグだけがバッファリングされる。
     if (m_streamHasKeyFrames)
         pack.cont = true;
-    m_mem.read(pack.data, length);
 
     ch->newPacket(pack);
     //ch->checkReadDelay(pack.len);
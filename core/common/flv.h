@@ -19,11 +19,14 @@
 #ifndef _FLV_H
 #define _FLV_H
 
+#include <algorithm>
+#include <memory>
 #include <stdexcept>
 #include <stdint.h>
 #include <string.h> // memcpy
 
 #include "channel.h"
+#include "pacer.h"
 
 // -----------------------------------
 class FLVFileHeader
@@ -42,6 +45,16 @@ public:
             version = data[3];
         }
     }
+
+    // RTMP のように FLV ファイルでないソースのために組み立てる。
+    void set(bool hasAudio, bool hasVideo)
+    {
+        static const unsigned char header[13] = { 'F', 'L', 'V', 1, 0, 0, 0, 0, 9, 0, 0, 0, 0 };
+        memcpy(data, header, 13);
+        data[4] = (hasAudio ? 0x04 : 0) | (hasVideo ? 0x01 : 0);
+        size = 13;
+        version = 1;
+    }
     int size;
     int version;
     unsigned char data[13];
@@ -63,58 +76,20 @@ public:
     {
         size = 0;
         packetSize = 0;
+        capacity = 0;
         type = T_UNKNOWN;
         data = nullptr;
         packet = nullptr;
     }
 
-    ~FLVTag()
-    {
-        if (packet)
-            delete [] packet;
-    }
-
-    FLVTag& operator=(const FLVTag& other)
-    {
-        size = other.size;
-        packetSize = other.packetSize;
-        type = other.type;
-
-        if (packet)
-            delete [] packet;
-        if (other.packet) {
-            packet = new unsigned char[other.packetSize];
-            memcpy(packet, other.packet, other.packetSize);
-        } else
-            packet = nullptr;
-
-        if (packet)
-            data = packet + 11;
-
-        return *this;
-    }
-
-    FLVTag(const FLVTag& other)
-    {
-        size = other.size;
-        packetSize = other.packetSize;
-        type = other.type;
-
-        if (other.packet) {
-            packet = new unsigned char[other.packetSize];
-            memcpy(packet, other.packet, other.packetSize);
-        } else
-            packet = nullptr;
-
-        if (packet)
-            data = packet + 11;
-    }
+    // コピーはバッファを共有する。ヘッダータグを取っておくのに使うの
+    // で中身は複製しない。共有中のタグに read() すると新しいバッファ
+    // に読み込むので、取っておいた方は書き換わらない。
+    FLVTag& operator=(const FLVTag& other) = default;
+    FLVTag(const FLVTag& other) = default;
 
     void read(Stream &in)
     {
-        if (packet != nullptr)
-            delete [] packet;
-
         unsigned char binary[11];
         in.read(binary, 11);
 
@@ -123,12 +98,39 @@ public:
         //int timestamp = (binary[7] << 24) | (binary[4] << 16) | (binary[5] << 8) | (binary[6]);
         //int streamID = (binary[8] << 16) | (binary[9] << 8) | (binary[10]);
 
-        packet = new unsigned char[11 + size + 4];
+        packetSize = 11 + size + 4;
+
+        reserve();
         memcpy(packet, binary, 11);
         in.read(packet + 11, size + 4);
 
         data = packet + 11;
+    }
+
+    // ペイロードからタグを組み立てる。ストリーム ID は 0。
+    void set(TYPE aType, int32_t timestamp, const void* payload, int len)
+    {
+        type = aType;
+        size = len;
         packetSize = 11 + size + 4;
+
+        reserve();
+        memset(packet, 0, 11);
+        packet[0] = type;
+        packet[1] = (size >> 16) & 0xff;
+        packet[2] = (size >> 8) & 0xff;
+        packet[3] = size & 0xff;
+        setTimestamp(timestamp);
+        memcpy(packet + 11, payload, size);
+
+        // PreviousTagSize
+        const int tagSize = 11 + size;
+        packet[11 + size + 0] = (tagSize >> 24) & 0xff;
+        packet[11 + size + 1] = (tagSize >> 16) & 0xff;
+        packet[11 + size + 2] = (tagSize >> 8) & 0xff;
+        packet[11 + size + 3] = tagSize & 0xff;
+
+        data = packet + 11;
     }
 
     int32_t getTimestamp() const
@@ -170,15 +172,100 @@ public:
         if (!data) return false;
         if (type != T_VIDEO) return false;
 
-        uint8_t frameType = data[0] >> 4;
+        return isVideoKeyFrame(data, size);
+    }
+
+    // AVC/AAC のシーケンスヘッダーか、Enhanced RTMP の SequenceStart。
+    bool isSequenceHeader()
+    {
+        if (!data) return false;
+        if (type == T_VIDEO) return isVideoSequenceHeader(data, size);
+        if (type == T_AUDIO) return isAudioSequenceHeader(data, size);
+        return false;
+    }
+
+    // デコードにシーケンスヘッダーが要るコーデックか。要らないものは
+    // 最初のタグをヘッダーとして取っておく。
+    bool hasSequenceHeaders()
+    {
+        if (!data || size < 1) return false;
+        if (type == T_VIDEO)
+            return isExVideo(data, size) || (data[0] & 0x0f) == CODEC_AVC || (data[0] & 0x0f) == CODEC_HEVC;
+        if (type == T_AUDIO)
+            return (data[0] >> 4) == SOUND_AAC || (data[0] >> 4) == SOUND_EX_HEADER;
+        return false;
+    }
+
+    // ログ用のコーデック名。Enhanced RTMP なら FourCC。
+    std::string getCodecName();
+
+    // 映像タグのペイロードの解釈。Enhanced RTMP のタグは最上位ビット
+    // が立ち、下位 4 ビットがコーデック ID でなくパケットの種類になって、
+    // 後ろに FourCC が続く。
+    enum
+    {
+        CODEC_AVC       = 7,
+        CODEC_HEVC      = 12,   // 非公式の拡張
+        SOUND_EX_HEADER = 9,
+        SOUND_AAC       = 10,
+
+        EX_SEQUENCE_START       = 0,
+        EX_MPEG2TS_SEQUENCE_START = 5,
+    };
+
+    static bool isExVideo(const unsigned char* p, int len)
+    {
+        return len >= 5 && (p[0] & 0x80);
+    }
+
+    static bool isVideoKeyFrame(const unsigned char* p, int len)
+    {
+        if (len < 1) return false;
+        uint8_t frameType = (p[0] >> 4) & 0x07;
         return frameType == 1 || frameType == 4;  // key frame or generated key frame
     }
 
+    static bool isVideoSequenceHeader(const unsigned char* p, int len)
+    {
+        if (isExVideo(p, len))
+        {
+            int packetType = p[0] & 0x0f;
+            return packetType == EX_SEQUENCE_START || packetType == EX_MPEG2TS_SEQUENCE_START;
+        }
+        int codec = len >= 1 ? (p[0] & 0x0f) : 0;
+        return (codec == CODEC_AVC || codec == CODEC_HEVC) && len >= 2 && p[1] == 0;
+    }
+
+    static bool isAudioSequenceHeader(const unsigned char* p, int len)
+    {
+        if (len < 1) return false;
+        int format = p[0] >> 4;
+        if (format == SOUND_EX_HEADER)
+            return len >= 5 && (p[0] & 0x0f) == EX_SEQUENCE_START;
+        return format == SOUND_AAC && len >= 2 && p[1] == 0;
+    }
+
     int size;
     int packetSize;
+    int capacity;
     TYPE type;
     unsigned char *data;
     unsigned char *packet;
+
+private:
+    // packetSize 分のバッファを用意して packet に置く。前のタグのバッ
+    // ファに収まり、他と共有していなければ使い回す。
+    void reserve()
+    {
+        if (!m_storage || m_storage.use_count() > 1 || capacity < packetSize)
+        {
+            capacity = (m_storage.use_count() > 1) ? packetSize : std::max(capacity, packetSize);
+            m_storage.reset(new unsigned char[capacity], std::default_delete<unsigned char[]>());
+        }
+        packet = m_storage.get();
+    }
+
+    std::shared_ptr<unsigned char> m_storage;
 };
 
 // ----------------------------------------------
@@ -186,12 +273,15 @@ class FLVTagBuffer
 {
 public:
     static const int MAX_OUTGOING_PACKET_SIZE = 15 * 1024;
-    static const int FLUSH_THRESHOLD          =  4 * 1024;
+    // 一つのパケットに入れるタグの時間の幅 (ミリ秒)。ビットレートによら
+    // ず、1 秒あたりのパケットの数がおよそ一定になる。
+    static const int TARGET_PACKET_MSEC       = 100;
 
     FLVTagBuffer()
-        : m_mem(ChanPacket::MAX_DATALEN)
+        : m_mem(m_pack.data, ChanPacket::MAX_DATALEN)
         , m_streamHasKeyFrames(false)
         , startTime(0)
+        , m_firstTimestamp(0)
     {}
 
     ~FLVTagBuffer()
@@ -201,13 +291,21 @@ public:
     bool put(FLVTag& tag, std::shared_ptr<Channel> ch);
     void flush(std::shared_ptr<Channel> ch);
     void rateLimit(uint32_t timestamp);
+    // 配信の取り込みで、タイムスタンプに合わせて送り出す。
+    void pace(uint32_t timestamp, std::shared_ptr<Channel> ch);
 
+    // 送出するパケット。溜めたタグは m_mem を通して直接 m_pack.data
+    // に書き込むので、送る時に写し直さない。
+    ChanPacket m_pack;
     MemoryStream m_mem;
     bool m_streamHasKeyFrames;
     double startTime;
 
 private:
     void sendImmediately(FLVTag& tag, std::shared_ptr<Channel> ch);
+
+    int32_t m_firstTimestamp;   // 溜めている先頭のタグのタイムスタンプ
+    IngestPacer m_pacer;
 };
 
 // ----------------------------------------------
@@ -217,18 +315,45 @@ public:
     int metaBitrate;
     FLVFileHeader fileHeader;
     FLVTag metaData;
-    FLVTag aacHeader;
-    FLVTag avcHeader;
-    FLVStream() : metaBitrate(0)
+    // 参加したリスナーに最初に送るシーケンスヘッダー。AVC/AAC に限らず、
+    // Enhanced RTMP の HEVC や AV1 などのものも入る。
+    FLVTag audioHeader;
+    FLVTag videoHeader;
+    FLVStream()
+        : metaBitrate(0)
+        , m_resuming(false)
+        , m_timestampOffset(0)
+        , m_lastTimestamp(0)
     {
     }
     void readHeader(Stream &, std::shared_ptr<Channel>) override;
     int  readPacket(Stream &, std::shared_ptr<Channel>) override;
     void readEnd(Stream &, std::shared_ptr<Channel>) override;
 
+    // prev のヘッダーを引き継ぐ。シーケンスヘッダーが同じならヘッダー
+    // パケットを送り直さず、最初のキーフレームからタイムスタンプを前の
+    // 続きにして送る。
+    bool continueFrom(ChannelStream& prev) override;
+
     static std::pair<bool,int> readMetaData(void* data, int size);
 
+    // タグを一つ処理する。パケットを送り出した場合 true を返す。in
+    // はソースのビットレートを測るのに使う。
+    bool putTag(FLVTag& tag, Stream& in, std::shared_ptr<Channel> ch);
+
     FLVTagBuffer m_buffer;
+
+private:
+    bool readTag(Stream &, std::shared_ptr<Channel>);
+    bool updateHeader(FLVTag& header, FLVTag& tag);
+
+    // 読み込み用のタグ。バッファを使い回す。
+    FLVTag m_tag;
+
+protected:
+    bool    m_resuming;         // continueFrom の後、最初のキーフレームを待っている
+    int32_t m_timestampOffset;  // 前のソースの続きになるようにタイムスタンプに足す値
+    int32_t m_lastTimestamp;    // 最後に送ったタグのタイムスタンプ
 };
 
 #endif
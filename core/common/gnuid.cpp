@@ -68,15 +68,30 @@ void GnuID::encode(Host *h, const char *salt1, const char *salt2, unsigned char
 // ---------------------------
 void GnuID::toStr(char *str) const
 {
-    str[0] = 0;
+    static const char digits[] = "0123456789ABCDEF";
+
     for (int i=0; i<16; i++)
     {
-        char tmp[8];
-        unsigned char ipb = id[i];
-
-        sprintf(tmp, "%02X", ipb);
-        strcat(str, tmp);
+        str[i*2]   = digits[id[i] >> 4];
+        str[i*2+1] = digits[id[i] & 0xf];
     }
+    str[32] = 0;
+}
+
+// ---------------------------
+// 16 進数字の値。数字でなければ -1。
+static const signed char* hexTable()
+{
+    static signed char table[256];
+    static bool ready = [](){
+        memset(table, -1, sizeof(table));
+        for (int c = '0'; c <= '9'; c++) table[c] = c - '0';
+        for (int c = 'a'; c <= 'f'; c++) table[c] = c - 'a' + 10;
+        for (int c = 'A'; c <= 'F'; c++) table[c] = c - 'A' + 10;
+        return true;
+    }();
+    (void) ready;
+    return table;
 }
 
 // ---------------------------
@@ -84,18 +99,21 @@ void GnuID::fromStr(const char *str)
 {
     clear();
 
-    if (strlen(str) < 32)
+    if (strnlen(str, 32) < 32)
         return;
 
-    char buf[8];
-
-    buf[2] = 0;
-
+    const signed char* table = hexTable();
     for (int i=0; i<16; i++)
     {
-        buf[0] = str[i*2];
-        buf[1] = str[i*2+1];
-        id[i] = (unsigned char)strtoul(buf, nullptr, 16);
+        // 以前の strtoul と同じく、数字でない所で読むのをやめる。
+        int hi = table[(unsigned char) str[i*2]];
+        int lo = table[(unsigned char) str[i*2+1]];
+        if (hi < 0)
+            id[i] = 0;
+        else if (lo < 0)
+            id[i] = hi;
+        else
+            id[i] = (hi << 4) | lo;
     }
 }
 
@@ -133,77 +151,70 @@ unsigned char GnuID::getFlags()
 
 // ---------------------------
 GnuIDList::GnuIDList(int max)
-:ids(new GnuID[max])
+    : maxID(max)
 {
-    maxID = max;
-    for (int i=0; i<maxID; i++)
-        ids[i].clear();
 }
 
 // ---------------------------
 GnuIDList::~GnuIDList()
 {
-    delete [] ids;
 }
 
 // ---------------------------
 bool GnuIDList::contains(const GnuID &id)
 {
-    for (int i=0; i<maxID; i++)
-        if (ids[i].isSame(id))
-            return true;
-    return false;
+    std::lock_guard<std::mutex> cs(lock);
+    return index.count(id) != 0;
 }
 
 // ---------------------------
 int GnuIDList::numUsed()
 {
-    int cnt=0;
-    for (int i=0; i<maxID; i++)
-        if (ids[i].storeTime)
-            cnt++;
-    return cnt;
+    std::lock_guard<std::mutex> cs(lock);
+    return ids.size();
 }
 
 // ---------------------------
 unsigned int GnuIDList::getOldest()
 {
-    unsigned int t=(unsigned int)-1;
-    for (int i=0; i<maxID; i++)
-        if (ids[i].storeTime)
-            if (ids[i].storeTime < t)
-                t = ids[i].storeTime;
-    return t;
+    std::lock_guard<std::mutex> cs(lock);
+    if (ids.empty())
+        return (unsigned int)-1;
+    return ids.back().storeTime;
 }
 
 // ---------------------------
 void GnuIDList::add(const GnuID &id)
 {
-    unsigned int minTime = (unsigned int) -1;
-    int minIndex = 0;
+    std::lock_guard<std::mutex> cs(lock);
 
-    // find same or oldest
-    for (int i=0; i<maxID; i++)
+    auto it = index.find(id);
+    if (it != index.end())
     {
-        if (ids[i].isSame(id))
-        {
-            ids[i].storeTime = sys->getTime();
-            return;
-        }
-        if (ids[i].storeTime <= minTime)
-        {
-            minTime = ids[i].storeTime;
-            minIndex = i;
-        }
+        it->second->storeTime = sys->getTime();
+        ids.splice(ids.begin(), ids, it->second);
+        return;
+    }
+
+    if (maxID <= 0)
+        return;
+
+    // 一番古いものを忘れる。
+    if ((int) ids.size() >= maxID)
+    {
+        index.erase(ids.back());
+        ids.pop_back();
     }
 
-    ids[minIndex] = id;
-    ids[minIndex].storeTime = sys->getTime();
+    ids.push_front(id);
+    ids.front().storeTime = sys->getTime();
+    index[id] = ids.begin();
 }
 
 // ---------------------------
 void GnuIDList::clear()
 {
-    for (int i=0; i<maxID; i++)
-        ids[i].clear();
+    std::lock_guard<std::mutex> cs(lock);
+    ids.clear();
+    index.clear();
 }
@@ -20,6 +20,9 @@
 
 #include "common.h"
 #include <string.h>
+#include <list>
+#include <mutex>
+#include <unordered_map>
 
 // --------------------------------
 class GnuID
@@ -42,9 +45,13 @@ public:
         fromStr(str);
     }
 
+    // 8 バイトずつ 2 回で比べる。
     bool    isSame(const GnuID &gid) const
     {
-        return memcmp(id, gid.id, 16) == 0;
+        uint64_t a[2], b[2];
+        memcpy(a, id, 16);
+        memcpy(b, gid.id, 16);
+        return ((a[0] ^ b[0]) | (a[1] ^ b[1])) == 0;
     }
 
     bool    isSet() const
@@ -88,6 +95,39 @@ public:
 };
 
 // --------------------------------
+struct GnuIDHash
+{
+    // ID はほぼ一様にばらけているので先頭 8 バイトをそのまま使う。
+    size_t operator()(const GnuID& id) const
+    {
+        uint64_t h;
+        memcpy(&h, id.id, sizeof(h));
+        return static_cast<size_t>(h);
+    }
+};
+
+// --------------------------------
+struct GnuIDEqual
+{
+    bool operator()(const GnuID& a, const GnuID& b) const
+    {
+        return a.isSame(b);
+    }
+};
+
+// --------------------------------
+namespace std
+{
+    template <>
+    struct hash<GnuID>
+    {
+        size_t operator()(const GnuID& id) const { return GnuIDHash()(id); }
+    };
+}
+
+// --------------------------------
+// 最近見た ID を最大 maxID 個覚えておく。いっぱいになると一番古いも
+// のを忘れる。別々のスレッドから使ってよい。
 class GnuIDList
 {
 public:
@@ -100,8 +140,15 @@ public:
     int             numUsed();
     unsigned int    getOldest();
 
-    GnuID   *ids;
     int     maxID;
+
+private:
+    // 前にあるほど新しい。storeTime に覚えた時刻が入る。
+    typedef std::list<GnuID> List;
+
+    std::mutex  lock;
+    List        ids;
+    std::unordered_map<GnuID, List::iterator, GnuIDHash, GnuIDEqual> index;
 };
 
 #endif
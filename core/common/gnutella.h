@@ -59,6 +59,7 @@ extern const char *GNU_FUNC_STR(int);
 #define PCX_HS_PORT      "x-peercast-port:"
 #define PCX_HS_REMOTEIP  "x-peercast-remoteip:"
 #define PCX_HS_POS       "x-peercast-pos:"
+#define PCX_HS_MUX       "x-peercast-mux:"   // peercast-yt 拡張。pcpmux.h
 #define PCX_HS_SESSIONID "x-peercast-sessionid:"
 
 // official version number sent to relay to check for updates
@@ -0,0 +1,154 @@
+// ------------------------------------------------
+// File : gzipencoder.cpp
+// Desc:
+//      動的な応答の gzip 圧縮。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "gzipencoder.h"
+#include "str.h"
+
+GzipEncoder g_gzipEncoder;
+
+#ifdef HAVE_ZLIB
+namespace {
+    // 一度作った圧縮器は deflateReset で使い回す。
+    struct Deflater
+    {
+        Deflater()
+        {
+            memset(&z, 0, sizeof(z));
+            // 15 + 16 で gzip のヘッダーを付ける。
+            ok = (deflateInit2(&z, GzipEncoder::LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+        }
+
+        ~Deflater()
+        {
+            if (ok)
+                deflateEnd(&z);
+        }
+
+        z_stream z;
+        bool     ok;
+    };
+
+    thread_local Deflater t_deflater;
+}
+#endif
+
+// ------------------------------------
+GzipEncoder::GzipEncoder()
+    : m_numCompressed(0)
+    , m_bytesIn(0)
+    , m_bytesOut(0)
+{
+}
+
+// ------------------------------------
+bool GzipEncoder::available()
+{
+#ifdef HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+// ------------------------------------
+bool GzipEncoder::accepts(const std::string& acceptEncoding, const std::string& coding)
+{
+    for (auto& item : str::split(acceptEncoding, ","))
+    {
+        auto params = str::split(item, ";");
+        if (params.empty() || str::downcase(str::strip(params[0])) != coding)
+            continue;
+
+        bool refused = false;
+        for (size_t i = 1; i < params.size(); i++)
+        {
+            auto p = str::strip(params[i]);
+            if (str::has_prefix(p, "q=") && atof(p.c_str() + 2) == 0.0)
+                refused = true;
+        }
+        if (!refused)
+            return true;
+    }
+    return false;
+}
+
+// ------------------------------------
+std::string GzipEncoder::encode(const std::string& data)
+{
+#ifdef HAVE_ZLIB
+    auto& d = t_deflater;
+    if (!d.ok)
+        throw StreamException("deflateInit2 failed");
+    deflateReset(&d.z);
+
+    std::string out;
+    out.resize(deflateBound(&d.z, data.size()));
+    d.z.next_in = (Bytef*) data.data();
+    d.z.avail_in = data.size();
+    d.z.next_out = (Bytef*) &out[0];
+    d.z.avail_out = out.size();
+
+    if (deflate(&d.z, Z_FINISH) != Z_STREAM_END)
+        throw StreamException(str::format("deflate: %s", d.z.msg ? d.z.msg : "buffer too small"));
+    out.resize(out.size() - d.z.avail_out);
+    return out;
+#else
+    throw StreamException("gzip is not supported");
+#endif
+}
+
+// ------------------------------------
+bool GzipEncoder::compress(const HTTPRequest& req, HTTPResponse& res)
+{
+    if (!available() || res.stream || res.body.size() < MIN_SIZE)
+        return false;
+    if (!res.headers.get("Content-Encoding").empty())
+        return false;
+
+    res.headers.set("Vary", "Accept-Encoding");
+    if (!accepts(req.headers.get("Accept-Encoding"), "gzip"))
+        return false;
+
+    const size_t size = res.body.size();
+    res.body = encode(res.body);
+    res.headers.set("Content-Encoding", "gzip");
+    if (!res.headers.get("Content-Length").empty())
+        res.headers.set("Content-Length", std::to_string(res.body.size()));
+
+    m_numCompressed++;
+    m_bytesIn += size;
+    m_bytesOut += res.body.size();
+    return true;
+}
+
+// ------------------------------------
+amf0::Value GzipEncoder::getState()
+{
+    return amf0::Value::object(
+        {
+            {"available", available()},
+            {"numCompressed", (int) m_numCompressed},
+            {"bytesIn", (double) m_bytesIn},
+            {"bytesOut", (double) m_bytesOut},
+        });
+}
@@ -0,0 +1,67 @@
+// ------------------------------------------------
+// File : gzipencoder.h
+// Desc:
+//      動的に作った応答の gzip 圧縮 (gzipResponses フラグ)。JSON-RPC、
+//      XML、テンプレートのページは、要求の Accept-Encoding が gzip を受
+//      け付けていて本体が MIN_SIZE 以上なら圧縮して返す。速さを優先し
+//      た LEVEL で、圧縮器はスレッドごとに一つを使い回す。zlib が無け
+//      れば何もしない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _GZIPENCODER_H
+#define _GZIPENCODER_H
+
+#include <atomic>
+#include <string>
+
+#include "amf0.h"
+#include "http.h"
+
+// ------------------------------------
+class GzipEncoder
+{
+public:
+    enum
+    {
+        MIN_SIZE = 1024,    // これより小さい本体は圧縮しない
+        LEVEL    = 1,       // Z_BEST_SPEED
+    };
+
+    GzipEncoder();
+
+    // zlib を使って作られていれば true。
+    static bool available();
+
+    // Accept-Encoding の値が coding を受け付けているか。q=0 は断りと
+    // みなす。
+    static bool accepts(const std::string& acceptEncoding, const std::string& coding);
+
+    // data を gzip 形式にする。呼んだスレッドの圧縮器を使う。
+    static std::string encode(const std::string& data);
+
+    // req が gzip を受け付けていて、res の本体が MIN_SIZE 以上なら本体
+    // を圧縮して Content-Encoding を付ける。圧縮したら true。
+    bool compress(const HTTPRequest& req, HTTPResponse& res);
+
+    amf0::Value getState();
+
+private:
+    std::atomic<unsigned int> m_numCompressed;
+    std::atomic<unsigned long long> m_bytesIn;
+    std::atomic<unsigned long long> m_bytesOut;
+};
+
+extern GzipEncoder g_gzipEncoder;
+
+#endif
@@ -0,0 +1,493 @@
+// ------------------------------------------------
+// File : handoff.cpp
+// Desc:
+//      再起動の時の接続の引き継ぎ。どの接続を引き継ぐかを決めて状態を
+//      まとめる所と、新しいプロセスでの再開。ソケットの送受信はプラッ
+//      トフォームごとのファイルにある。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+
+#include "handoff.h"
+#include "json.hpp"
+#include "prefork.h"
+#include "servent.h"
+#include "servmgr.h"
+#include "chanmgr.h"
+#include "peercast.h"
+
+using json = nlohmann::json;
+
+RestartHandoff g_restartHandoff;
+
+// ------------------------------------
+RestartHandoff::RestartHandoff()
+    : numSent(0)
+    , numResumed(0)
+    , m_listenFd(-1)
+    , m_stop(false)
+    , m_releasing(false)
+    , m_handedOver(false)
+    , m_finished(0)
+    , m_collecting(false)
+{
+}
+
+// ------------------------------------
+std::string RestartHandoff::serialize(const State& state)
+{
+    json conns = json::array();
+    for (auto& c : state.connections)
+    {
+        conns.push_back({
+                {"listener", c.listener},
+                {"port", c.port},
+                {"type", c.type},
+                {"protocol", c.protocol},
+                {"chanID", c.chanID.str()},
+                {"remoteID", c.remoteID.str()},
+                {"streamPos", c.streamPos},
+            });
+    }
+
+    json chans = json::array();
+    for (auto& ch : state.channels)
+    {
+        chans.push_back({
+                {"id", ch.id.str()},
+                {"name", ch.name},
+                {"genre", ch.genre},
+                {"url", ch.url},
+                {"desc", ch.desc},
+                {"contentType", ch.contentType},
+                {"MIMEType", ch.MIMEType},
+                {"streamExt", ch.streamExt},
+                {"bitrate", ch.bitrate},
+                {"upstreamIP", ch.upstream.ip.str()},
+                {"upstreamPort", ch.upstream.port},
+            });
+    }
+
+    return json({ {"connections", conns}, {"channels", chans} }).dump();
+}
+
+// ------------------------------------
+bool RestartHandoff::deserialize(const std::string& data, State& state)
+{
+    state = State();
+    try
+    {
+        auto j = json::parse(data);
+        for (auto& v : j.at("connections"))
+        {
+            Connection c;
+            c.listener  = v.at("listener").get<bool>();
+            c.port      = v.at("port").get<uint16_t>();
+            c.type      = v.at("type").get<int>();
+            c.protocol  = v.at("protocol").get<int>();
+            c.chanID    = GnuID(v.at("chanID").get<std::string>());
+            c.remoteID  = GnuID(v.at("remoteID").get<std::string>());
+            c.streamPos = v.at("streamPos").get<unsigned int>();
+            state.connections.push_back(c);
+        }
+        for (auto& v : j.at("channels"))
+        {
+            ChannelState ch;
+            ch.id           = GnuID(v.at("id").get<std::string>());
+            ch.name         = v.at("name").get<std::string>();
+            ch.genre        = v.at("genre").get<std::string>();
+            ch.url          = v.at("url").get<std::string>();
+            ch.desc         = v.at("desc").get<std::string>();
+            ch.contentType  = v.at("contentType").get<std::string>();
+            ch.MIMEType     = v.at("MIMEType").get<std::string>();
+            ch.streamExt    = v.at("streamExt").get<std::string>();
+            ch.bitrate      = v.at("bitrate").get<int>();
+            if (!IP::tryParse(v.at("upstreamIP").get<std::string>(), ch.upstream.ip))
+                return false;
+            ch.upstream.port = v.at("upstreamPort").get<uint16_t>();
+            state.channels.push_back(ch);
+        }
+    }catch (std::exception&)
+    {
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------
+void RestartHandoff::start(const std::string& path)
+{
+    m_listenFd = listenPath(path);
+    if (m_listenFd < 0)
+    {
+        LOG_ERROR("Restart handoff: cannot listen on %s", path.c_str());
+        return;
+    }
+    m_path = path;
+    LOG_INFO("Restart handoff: waiting on %s", path.c_str());
+
+    m_thread = std::thread([this]()
+    {
+        sys->setThreadName("HANDOFF");
+        while (!m_stop && !m_handedOver)
+        {
+            int conn = acceptPath(m_listenFd, 100);
+            if (conn < 0)
+                continue;
+            handOver(conn);
+            closeFd(conn);
+        }
+    });
+}
+
+// ------------------------------------
+void RestartHandoff::stop()
+{
+    m_stop = true;
+    if (m_thread.joinable())
+        m_thread.join();
+    if (m_listenFd >= 0)
+    {
+        closeFd(m_listenFd);
+        m_listenFd = -1;
+        // 引き継いだ後は、新しいプロセスが同じパスで待っている。
+        if (!m_handedOver)
+            remove(m_path.c_str());
+    }
+}
+
+// ------------------------------------
+// 引き継げる接続か。状態を読むだけで、印は付けない。
+static bool isCandidate(Servent* sv, RestartHandoff::ChannelState& chState)
+{
+    std::lock_guard<ProfiledMutex> cs(sv->lock);
+
+    if (!sv->sock)
+        return false;
+    try
+    {
+        sv->sock->getDescriptor();
+    }catch (GeneralException&)
+    {
+        return false;   // SSL など
+    }
+
+    if (sv->type == Servent::T_SERVER)
+        return sv->status == Servent::S_LISTENING;
+
+    if (sv->type != Servent::T_RELAY && sv->type != Servent::T_DIRECT)
+        return false;
+    if (sv->status != Servent::S_CONNECTED)
+        return false;
+
+    // 出力の途中の状態を持ち越せないものは引き継がない。
+    if (sv->outputProtocol == ChanInfo::SP_PCP)
+    {
+        if (sv->muxOutput)
+            return false;
+    }else if (sv->outputProtocol == ChanInfo::SP_HTTP)
+    {
+        if (sv->chunkedOutput || sv->webSocketOutput || sv->addMetadata || sv->timeShift ||
+            sv->audioOnlyOutput)
+            return false;
+    }else
+        return false;
+
+    // 上流からリレーしているチャンネルだけ、同じ上流から同じポジショ
+    // ンで受け直せる。
+    auto ch = chanMgr->findChannelByID(sv->chanID);
+    if (!ch || ch->srcType != Channel::SRC_PEERCAST || !ch->sourceHost.host.ip)
+        return false;
+
+    chState.id          = ch->info.id;
+    chState.name        = ch->info.name.c_str();
+    chState.genre       = ch->info.genre.c_str();
+    chState.url         = ch->info.url.c_str();
+    chState.desc        = ch->info.desc.c_str();
+    chState.contentType = ch->info.contentType.c_str();
+    chState.MIMEType    = ch->info.MIMEType.c_str();
+    chState.streamExt   = ch->info.streamExt.c_str();
+    chState.bitrate     = ch->info.bitrate;
+    chState.upstream    = ch->sourceHost.host;
+    return true;
+}
+
+// ------------------------------------
+void RestartHandoff::handOver(int conn)
+{
+    LOG_INFO("Restart handoff: new process connected");
+
+    std::vector<Servent*> marked;
+    std::map<std::string, ChannelState> channels;
+    {
+        std::lock_guard<ProfiledMutex> cs(servMgr->lock);
+        for (Servent* sv = servMgr->servents; sv; sv = sv->next)
+        {
+            ChannelState chState;
+            if (!isCandidate(sv, chState))
+                continue;
+            marked.push_back(sv);
+            if (chState.id.isSet())
+                channels[chState.id.str()] = chState;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        m_state = State();
+        m_finished = 0;
+        m_collecting = true;
+    }
+
+    // ここから先は、止めた待ち受けを ServMgr に立て直させない。
+    m_releasing = true;
+    for (auto sv : marked)
+        sv->beginHandoff();
+
+    State state;
+    {
+        std::unique_lock<std::mutex> cs(m_lock);
+        m_cond.wait_for(cs, std::chrono::milliseconds(COLLECT_TIMEOUT_MSEC),
+                        [&]() { return m_finished >= marked.size(); });
+        // 間に合わなかったサーバントは普通に閉じる。
+        m_collecting = false;
+        state = std::move(m_state);
+    }
+
+    for (auto& it : channels)
+        state.channels.push_back(it.second);
+
+    // 新しいプロセスが設定を読む前に書いておく。
+    peercastInst->saveSettings();
+
+    bool ok = sendMessage(conn, serialize(state));
+    for (auto& c : state.connections)
+    {
+        // 送れたら fd は閉じられている。
+        bool sent = false;
+        for (int i = 0; ok && i < 100 && !sent; i++)
+        {
+            sent = Prefork::sendSocket(conn, c.fd);
+            if (!sent)
+                sys->sleep(10);
+        }
+        if (!sent)
+        {
+            closeFd(c.fd);
+            ok = false;
+        }else
+            numSent++;
+    }
+
+    if (!ok)
+    {
+        // 待ち受けは立て直すが、止めたストリームは戻らない。
+        LOG_ERROR("Restart handoff failed");
+        m_releasing = false;
+        return;
+    }
+
+    LOG_INFO("Restart handoff: handed over %zu connections", state.connections.size());
+    m_handedOver = true;
+    if (onComplete)
+        onComplete();
+}
+
+// ------------------------------------
+bool RestartHandoff::collect(Servent* sv)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    m_finished++;
+    m_cond.notify_all();
+
+    if (!m_collecting || !sv->sock)
+        return false;
+
+    int fd;
+    try
+    {
+        fd = sv->sock->getDescriptor();
+    }catch (GeneralException&)
+    {
+        return false;
+    }
+
+    Connection c;
+    if (sv->type == Servent::T_SERVER)
+    {
+        c.listener = true;
+        c.port = sv->sock->host.port;
+    }else
+    {
+        // ヘッダーを送り終えていなければ、続きからは送れない。
+        if (sv->streamPos == 0)
+            return false;
+
+        c.streamPos = sv->streamPos;
+        if (sv->reactorStream)
+        {
+            auto& rs = *sv->reactorStream;
+            // パケットの途中までしか送れていなければ、続きから送れない。
+            if (!rs.head.empty() || rs.offset > 0)
+                return false;
+            // 送っていないパケットは新しいプロセスが送り直す。
+            if (!rs.packets.empty())
+                c.streamPos = rs.packets.front()->pos;
+        }
+
+        c.type      = sv->type;
+        c.protocol  = sv->outputProtocol;
+        c.chanID    = sv->chanID;
+        c.remoteID  = sv->remoteID;
+    }
+
+    c.fd = fd;
+    sv->sock->detach();
+    m_state.connections.push_back(c);
+    return true;
+}
+
+// ------------------------------------
+bool RestartHandoff::takeover(const std::string& path)
+{
+    int conn = connectPath(path);
+    if (conn < 0)
+        return false;
+
+    std::string data;
+    State state;
+    if (!recvMessage(conn, data, RECV_TIMEOUT_MSEC) || !deserialize(data, state))
+    {
+        closeFd(conn);
+        return false;
+    }
+
+    for (auto& c : state.connections)
+        c.fd = Prefork::recvSocket(conn, RECV_TIMEOUT_MSEC);
+    closeFd(conn);
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_state = std::move(state);
+    return true;
+}
+
+// ------------------------------------
+int RestartHandoff::takeListener(uint16_t port)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    for (auto& c : m_state.connections)
+    {
+        if (c.listener && c.port == port && c.fd >= 0)
+        {
+            int fd = c.fd;
+            c.fd = -1;
+            return fd;
+        }
+    }
+    return -1;
+}
+
+// ------------------------------------
+void RestartHandoff::resume()
+{
+    // 待ち受けのソケットは ServMgr のサーバースレッドが takeListener
+    // で取るので残しておく。
+    State state;
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        state = m_state;
+        auto& conns = m_state.connections;
+        conns.erase(std::remove_if(conns.begin(), conns.end(),
+                                   [](const Connection& c) { return !c.listener; }),
+                    conns.end());
+        m_state.channels.clear();
+    }
+
+    for (auto& chState : state.channels)
+    {
+        // 受け直す位置は、引き継いだ接続のうち一番遅れているもの。
+        unsigned int pos = 0;
+        bool found = false;
+        for (auto& c : state.connections)
+        {
+            if (c.listener || c.fd < 0 || !c.chanID.isSame(chState.id))
+                continue;
+            if (!found || c.streamPos < pos)
+                pos = c.streamPos;
+            found = true;
+        }
+        if (!found || chanMgr->findChannelByID(chState.id))
+            continue;
+
+        ChanInfo info;
+        info.id = chState.id;
+        info.name = chState.name;
+        info.genre = chState.genre;
+        info.url = chState.url;
+        info.desc = chState.desc;
+        info.contentType = chState.contentType.c_str();
+        info.MIMEType = chState.MIMEType;
+        info.streamExt = chState.streamExt;
+        info.bitrate = chState.bitrate;
+
+        auto ch = chanMgr->createChannel(info);
+        if (!ch)
+            continue;
+        ch->designatedHost.init();
+        ch->designatedHost.host = chState.upstream;
+        ch->streamPos = pos;
+        ch->startGet();
+        LOG_INFO("Restart handoff: resuming %s from %s at %u",
+                 chState.name.c_str(), chState.upstream.str().c_str(), pos);
+    }
+
+    for (auto& c : state.connections)
+    {
+        if (c.listener || c.fd < 0)
+            continue;
+
+        auto sock = Prefork::adoptSocket(c.fd);
+        if (!sock)
+            continue;
+
+        Servent *sv = servMgr->allocServent();
+        if (!sv)
+        {
+            LOG_ERROR("Out of servents");
+            sock->close();
+            continue;
+        }
+        sv->setServPort(servMgr->serverHost.port);
+        sv->networkID = servMgr->networkID;
+        sv->initResumed(sock, (Servent::TYPE) c.type, (ChanInfo::PROTOCOL) c.protocol,
+                        c.chanID, c.remoteID, c.streamPos);
+        numResumed++;
+    }
+}
+
+// ------------------------------------
+amf0::Value RestartHandoff::getState()
+{
+    return amf0::Value::object(
+        {
+            {"listening", m_listenFd >= 0},
+            {"handedOver", m_handedOver.load()},
+            {"numSent", (int) numSent.load()},
+            {"numResumed", (int) numResumed.load()},
+        });
+}
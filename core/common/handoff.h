@@ -0,0 +1,145 @@
+// ------------------------------------------------
+// File : handoff.h
+// Desc:
+//      再起動の時に、待ち受けのソケットとストリームを送っている接続を
+//      新しいプロセスに引き継ぐ。古いプロセスは状態ディレクトリーの
+//      handoff.sock で待ち、--takeover で起動した新しいプロセスがそこ
+//      につなぐと、接続の状態を JSON で、ソケットを SCM_RIGHTS で送っ
+//      て終わる。新しいプロセスはチャンネルを同じ上流からストリームポ
+//      ジションを指定して受け直し、ハンドシェイクを飛ばして続きから送
+//      る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _HANDOFF_H
+#define _HANDOFF_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "amf0.h"
+#include "gnuid.h"
+#include "host.h"
+
+class ClientSocket;
+class Servent;
+
+// ------------------------------------
+class RestartHandoff
+{
+public:
+    enum
+    {
+        COLLECT_TIMEOUT_MSEC = 3000,    // サーバントが送信を止めるのを待つ時間
+        RECV_TIMEOUT_MSEC    = 5000,    // 新しいプロセスが状態を待つ時間
+    };
+
+    // 引き継ぐ接続。
+    struct Connection
+    {
+        int             fd = -1;
+        bool            listener = false;   // 待ち受けのソケット
+        uint16_t        port = 0;           // listener の時のポート
+        int             type = 0;           // Servent::TYPE
+        int             protocol = 0;       // ChanInfo::PROTOCOL
+        GnuID           chanID, remoteID;
+        unsigned int    streamPos = 0;      // 次に送るストリームポジション
+    };
+
+    // 受け直すチャンネル。
+    struct ChannelState
+    {
+        GnuID           id;
+        std::string     name, genre, url, desc;
+        std::string     contentType, MIMEType, streamExt;
+        int             bitrate = 0;
+        Host            upstream;
+    };
+
+    struct State
+    {
+        std::vector<Connection>     connections;
+        std::vector<ChannelState>   channels;
+    };
+
+    RestartHandoff();
+
+    // 古いプロセスで、path で新しいプロセスを待つスレッドを始める。引
+    // き継ぎが済んだら onComplete を呼ぶので、UI はそこでプロセスを終
+    // わらせる。
+    void    start(const std::string& path);
+    void    stop();
+    std::function<void()> onComplete;
+
+    // 引き継ぎを始めてから、待ち受けを立て直さないように。
+    bool    releasing() const { return m_releasing; }
+    bool    handedOver() const { return m_handedOver; }
+
+    // 引き継ぐよう印を付けたサーバントの kill から、ソケットを閉じる代
+    // わりに呼ばれる。受け取ったら sock を切り離して true を返す。
+    bool    collect(Servent* sv);
+
+    // 新しいプロセスで、ServMgr を作る前に呼ぶ。path につないで状態と
+    // ソケットを受け取る。
+    bool    takeover(const std::string& path);
+    // port の待ち受けのソケットを受け取っていれば返す。無ければ -1。
+    int     takeListener(uint16_t port);
+    // 受け取ったチャンネルとストリームの接続を再開する。
+    void    resume();
+
+    amf0::Value getState();
+
+    static std::string serialize(const State& state);
+    static bool        deserialize(const std::string& data, State& state);
+
+    // プラットフォームごとの実装。
+    static int  listenPath(const std::string& path);
+    static int  acceptPath(int fd, int timeoutMsec);
+    static int  connectPath(const std::string& path);
+    static void closeFd(int fd);
+    // "<長さ>\n" に続けて data を送る。
+    static bool sendMessage(int fd, const std::string& data);
+    static bool recvMessage(int fd, std::string& data, int timeoutMsec);
+    // 待ち受けのソケットの fd をソケットにする。
+    static std::shared_ptr<ClientSocket> adoptListener(int fd, const Host& host);
+
+    std::atomic<unsigned int> numSent;
+    std::atomic<unsigned int> numResumed;
+
+private:
+    void    handOver(int conn);
+
+    std::string         m_path;
+    int                 m_listenFd;
+    std::thread         m_thread;
+    std::atomic<bool>   m_stop;
+    std::atomic<bool>   m_releasing;
+    std::atomic<bool>   m_handedOver;
+
+    // collect で集めた接続。m_lock で保護する。
+    std::mutex              m_lock;
+    std::condition_variable m_cond;
+    State                   m_state;
+    size_t                  m_finished;
+    bool                    m_collecting;
+};
+
+extern RestartHandoff g_restartHandoff;
+
+#endif
@@ -0,0 +1,540 @@
+// ------------------------------------------------
+// File : hls.cpp
+// Desc:
+//      FLV チャンネルの HLS 出力。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#include "hls.h"
+#include "channel.h"
+#include "flv.h"
+#include "str.h"
+
+// ------------------------------------
+HLSSegmenter::HLSSegmenter()
+    : m_started(false)
+    , m_streamIndex(0)
+    , m_streamPos(0)
+    , m_skipContinuation(false)
+    , m_bufPos(0)
+    , m_needFileHeader(true)
+    , m_nalLengthSize(4)
+    , m_hasAudioConfig(false)
+    , m_aacProfile(1)
+    , m_aacFreqIndex(4)
+    , m_aacChannels(2)
+    , m_nextMSN(0)
+    , m_discontinuitySequence(0)
+    , m_pendingDiscontinuity(false)
+    , m_lastDTS(-1)
+    , m_lastInterval(0)
+    , m_targetDuration(TARGET_DURATION / 1000)
+{
+}
+
+// ------------------------------------
+void HLSSegmenter::update(std::shared_ptr<Channel> ch)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    if (!m_started || m_streamIndex != ch->streamIndex)
+    {
+        resetStream();
+        m_started = true;
+        m_streamIndex = ch->streamIndex;
+        feed(ch->headPack.data, ch->headPack.len);
+
+        // バッファーにある一番古いキーフレームから始めれば、すぐにいく
+        // つかのセグメントが出来る。
+        m_streamPos = ch->rawData.getOldestNonContinuationPos();
+        if (!m_streamPos)
+            m_streamPos = ch->headPack.pos + ch->headPack.len;
+        m_skipContinuation = true;
+    }
+
+    std::shared_ptr<const ChanPacketSlab> pack;
+    while (ch->rawData.findPacket(m_streamPos, pack))
+    {
+        // 取り込む前に上書きされた。
+        if (pack->pos > m_streamPos)
+        {
+            breakStream();
+            m_skipContinuation = true;
+        }
+        m_streamPos = pack->pos + pack->len;
+
+        if (m_skipContinuation && pack->cont)
+            continue;
+        m_skipContinuation = false;
+
+        if (pack->type == ChanPacket::T_HEAD)
+        {
+            m_buf.clear();
+            m_bufPos = 0;
+            m_needFileHeader = true;
+        }
+        if (pack->type == ChanPacket::T_HEAD || pack->type == ChanPacket::T_DATA)
+            feed(pack->data, pack->len);
+    }
+}
+
+// ------------------------------------
+void HLSSegmenter::put(const void* data, int len)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    feed(data, len);
+}
+
+// ------------------------------------
+void HLSSegmenter::discontinuity()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    breakStream();
+}
+
+// ------------------------------------
+// バイト列からタグを切り出す。途中までのタグは次に持ち越す。
+void HLSSegmenter::feed(const void* data, int len)
+{
+    m_buf.append(static_cast<const char*>(data), len);
+
+    while (true)
+    {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(m_buf.data()) + m_bufPos;
+        size_t avail = m_buf.size() - m_bufPos;
+
+        if (m_needFileHeader)
+        {
+            if (avail < 13)
+                break;
+            if (memcmp(p, "FLV", 3) == 0)
+                m_bufPos += 13;
+            m_needFileHeader = false;
+            continue;
+        }
+
+        if (avail < 11)
+            break;
+
+        int type = p[0] & 0x1f;
+        size_t size = (p[1] << 16) | (p[2] << 8) | p[3];
+        if (type != FLVTag::T_AUDIO && type != FLVTag::T_VIDEO && type != FLVTag::T_SCRIPT)
+        {
+            // タグの境目を見失った。次のキーフレームのパケットまで捨てる。
+            breakStream();
+            m_skipContinuation = true;
+            return;
+        }
+        if (avail < 11 + size + 4)
+            break;
+
+        int32_t timestamp = (int32_t) (((uint32_t) p[7] << 24) | (p[4] << 16) | (p[5] << 8) | p[6]);
+        putTag(type, timestamp, p + 11, (int) size);
+        m_bufPos += 11 + size + 4;
+    }
+
+    if (m_bufPos == m_buf.size())
+    {
+        m_buf.clear();
+        m_bufPos = 0;
+    }else if (m_bufPos > 64 * 1024)
+    {
+        m_buf.erase(0, m_bufPos);
+        m_bufPos = 0;
+    }
+}
+
+// ------------------------------------
+void HLSSegmenter::putTag(int type, int64_t timestamp, const uint8_t* data, int size)
+{
+    if (type == FLVTag::T_VIDEO)
+        putVideo(timestamp, data, size);
+    else if (type == FLVTag::T_AUDIO)
+        putAudio(timestamp, data, size);
+}
+
+// ------------------------------------
+// AVC の NAL ユニットを Annex B に直す。キーフレームの前には SPS と PPS
+// を置く。Enhanced RTMP のタグや AVC 以外のコーデックは無視する。
+void HLSSegmenter::putVideo(int64_t timestamp, const uint8_t* data, int size)
+{
+    if (size < 5 || FLVTag::isExVideo(data, size) || (data[0] & 0x0f) != FLVTag::CODEC_AVC)
+        return;
+
+    bool keyFrame = FLVTag::isVideoKeyFrame(data, size);
+    int packetType = data[1];
+
+    if (packetType == 0)
+    {
+        // AVCDecoderConfigurationRecord
+        const uint8_t* p = data + 5;
+        int len = size - 5;
+        if (len < 7)
+            return;
+
+        std::vector<std::string> sps, pps;
+        int pos = 6;
+        for (int i = 0; i < (p[5] & 0x1f); i++)
+        {
+            if (pos + 2 > len)
+                return;
+            int n = (p[pos] << 8) | p[pos + 1];
+            if (pos + 2 + n > len)
+                return;
+            sps.push_back(std::string(reinterpret_cast<const char*>(p + pos + 2), n));
+            pos += 2 + n;
+        }
+        if (pos >= len)
+            return;
+        int numPPS = p[pos++];
+        for (int i = 0; i < numPPS; i++)
+        {
+            if (pos + 2 > len)
+                return;
+            int n = (p[pos] << 8) | p[pos + 1];
+            if (pos + 2 + n > len)
+                return;
+            pps.push_back(std::string(reinterpret_cast<const char*>(p + pos + 2), n));
+            pos += 2 + n;
+        }
+
+        m_nalLengthSize = (p[4] & 3) + 1;
+        m_sps = sps;
+        m_pps = pps;
+        updateStreams();
+        return;
+    }
+
+    if (packetType != 1 || m_sps.empty())
+        return;
+
+    int32_t cts = (data[2] << 16) | (data[3] << 8) | data[4];
+    if (cts & 0x800000)
+        cts -= 0x1000000;
+
+    static const char startCode[] = { 0, 0, 0, 1 };
+    std::string es("\x00\x00\x00\x01\x09\xf0", 6);  // アクセスユニットデリミター
+    if (keyFrame)
+    {
+        for (auto& s : m_sps)
+            es.append(startCode, 4).append(s);
+        for (auto& s : m_pps)
+            es.append(startCode, 4).append(s);
+    }
+
+    const uint8_t* p = data + 5;
+    const uint8_t* end = data + size;
+    while (end - p >= m_nalLengthSize)
+    {
+        uint32_t n = 0;
+        for (int i = 0; i < m_nalLengthSize; i++)
+            n = (n << 8) | p[i];
+        p += m_nalLengthSize;
+        if (n == 0 || n > (uint32_t) (end - p))
+            break;
+        if ((p[0] & 0x1f) != 9)
+            es.append(startCode, 4).append(reinterpret_cast<const char*>(p), n);
+        p += n;
+    }
+
+    int64_t dts = timestamp * 90;
+    int64_t pts = (timestamp + cts) * 90;
+    Segment* seg = prepareFrame(true, keyFrame, dts);
+    if (seg)
+        m_ts.writeVideo(seg->data, pts, dts, keyFrame, es);
+}
+
+// ------------------------------------
+// AAC の生のフレームに ADTS ヘッダーを付ける。
+void HLSSegmenter::putAudio(int64_t timestamp, const uint8_t* data, int size)
+{
+    if (size < 2 || (data[0] >> 4) != FLVTag::SOUND_AAC)
+        return;
+
+    if (data[1] == 0)
+    {
+        // AudioSpecificConfig
+        if (size < 4)
+            return;
+        int objectType = data[2] >> 3;
+        // ADTS で表せない HE-AAC などは LC として扱う。
+        m_aacProfile = (objectType >= 1 && objectType <= 4) ? objectType - 1 : 1;
+        m_aacFreqIndex = ((data[2] & 0x07) << 1) | (data[3] >> 7);
+        m_aacChannels = (data[3] >> 3) & 0x0f;
+        m_hasAudioConfig = true;
+        updateStreams();
+        return;
+    }
+
+    if (!m_hasAudioConfig)
+        return;
+
+    int frameLength = 7 + size - 2;
+    std::string adts;
+    adts.push_back((char) 0xff);
+    adts.push_back((char) 0xf1);
+    adts.push_back((char) ((m_aacProfile << 6) | (m_aacFreqIndex << 2) | (m_aacChannels >> 2)));
+    adts.push_back((char) (((m_aacChannels & 3) << 6) | (frameLength >> 11)));
+    adts.push_back((char) ((frameLength >> 3) & 0xff));
+    adts.push_back((char) (((frameLength & 7) << 5) | 0x1f));
+    adts.push_back((char) 0xfc);
+    adts.append(reinterpret_cast<const char*>(data + 2), size - 2);
+
+    int64_t pts = timestamp * 90;
+    Segment* seg = prepareFrame(false, false, pts);
+    if (seg)
+        m_ts.writeAudio(seg->data, pts, adts);
+}
+
+// ------------------------------------
+// PMT に載せるストリームが変わったら作りかけのセグメントを閉じる。
+void HLSSegmenter::updateStreams()
+{
+    bool video = !m_sps.empty();
+    bool audio = m_hasAudioConfig;
+    if (video == m_ts.hasVideo() && audio == m_ts.hasAudio())
+        return;
+
+    if (current())
+        breakStream();
+    m_ts.setStreams(video, audio);
+}
+
+// ------------------------------------
+HLSSegmenter::Segment* HLSSegmenter::current()
+{
+    if (m_segments.empty() || m_segments.back().complete)
+        return nullptr;
+    return &m_segments.back();
+}
+
+// ------------------------------------
+// 映像があれば映像のフレームで、無ければ音声のフレームで区切る。セグ
+// メントは映像のキーフレームから始める。
+HLSSegmenter::Segment* HLSSegmenter::prepareFrame(bool video, bool keyFrame, int64_t dts)
+{
+    bool boundary = m_ts.hasVideo() ? video : true;
+    bool independent = m_ts.hasVideo() ? keyFrame : true;
+
+    Segment* seg = current();
+    if (seg && boundary)
+    {
+        int64_t interval = (m_lastDTS >= 0 && dts > m_lastDTS) ? dts - m_lastDTS : m_lastInterval;
+
+        if (independent && dts - seg->start >= TARGET_DURATION * 90)
+        {
+            closeSegment(*seg, dts);
+            seg = nullptr;
+        }else if (dts > seg->partStart && dts - seg->partStart + interval > PART_TARGET * 90)
+        {
+            // 次のフレームまで待つとパートが長くなりすぎる。
+            closePart(*seg, dts);
+            seg->partStart = dts;
+            seg->partIndependent = independent;
+        }
+        m_lastDTS = dts;
+        m_lastInterval = interval;
+    }
+
+    if (seg)
+        return seg;
+
+    if (!boundary || !independent)
+        return nullptr;
+
+    Segment s;
+    s.msn = m_nextMSN++;
+    s.start = s.partStart = dts;
+    s.partIndependent = true;
+    s.duration = 0;
+    s.complete = false;
+    s.discontinuity = m_pendingDiscontinuity;
+    m_pendingDiscontinuity = false;
+    m_ts.writeTables(s.data);
+    m_segments.push_back(std::move(s));
+
+    while (m_segments.size() > MAX_SEGMENTS)
+    {
+        if (m_segments.front().discontinuity)
+            m_discontinuitySequence++;
+        m_segments.pop_front();
+    }
+
+    m_lastDTS = dts;
+    return &m_segments.back();
+}
+
+// ------------------------------------
+void HLSSegmenter::closePart(Segment& seg, int64_t end)
+{
+    size_t offset = seg.parts.empty() ? 0 : seg.parts.back().offset + seg.parts.back().length;
+    if (offset == seg.data.size())
+        return;
+
+    Part part;
+    part.offset = offset;
+    part.length = seg.data.size() - offset;
+    part.duration = std::max<int64_t>(end - seg.partStart, 1) / 90000.0;
+    part.independent = seg.partIndependent;
+    seg.parts.push_back(part);
+}
+
+// ------------------------------------
+void HLSSegmenter::closeSegment(Segment& seg, int64_t end)
+{
+    closePart(seg, end);
+    seg.duration = std::max<int64_t>(end - seg.start, 1) / 90000.0;
+    seg.complete = true;
+    m_targetDuration = std::max(m_targetDuration, (int) std::lround(seg.duration));
+}
+
+// ------------------------------------
+void HLSSegmenter::breakStream()
+{
+    Segment* seg = current();
+    if (seg)
+        closeSegment(*seg, (m_lastDTS >= 0) ? m_lastDTS + m_lastInterval : seg->start);
+
+    m_pendingDiscontinuity = !m_segments.empty();
+    m_lastDTS = -1;
+    m_lastInterval = 0;
+    m_buf.clear();
+    m_bufPos = 0;
+    m_needFileHeader = false;
+}
+
+// ------------------------------------
+// 新しいストリームが始まった。コーデックの設定も読み直す。
+void HLSSegmenter::resetStream()
+{
+    breakStream();
+    m_needFileHeader = true;
+    m_sps.clear();
+    m_pps.clear();
+    m_hasAudioConfig = false;
+    m_ts.setStreams(false, false);
+}
+
+// ------------------------------------
+std::string HLSSegmenter::playlist(const std::string& query)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    size_t numComplete = std::count_if(m_segments.begin(), m_segments.end(),
+                                       [](const Segment& s) { return s.complete; });
+    if (numComplete == 0)
+        return "";
+
+    std::string q = query.empty() ? "" : "?" + query;
+    std::string out = "#EXTM3U\n#EXT-X-VERSION:6\n";
+    out += str::format("#EXT-X-TARGETDURATION:%d\n", m_targetDuration);
+    out += str::format("#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\n", PART_TARGET * 3 / 1000.0);
+    out += str::format("#EXT-X-PART-INF:PART-TARGET=%.3f\n", PART_TARGET / 1000.0);
+    out += str::format("#EXT-X-MEDIA-SEQUENCE:%u\n", m_segments.front().msn);
+    out += str::format("#EXT-X-DISCONTINUITY-SEQUENCE:%u\n", m_discontinuitySequence);
+
+    size_t index = 0;
+    for (auto& seg : m_segments)
+    {
+        if (seg.discontinuity)
+            out += "#EXT-X-DISCONTINUITY\n";
+
+        // パートは最後の方のセグメントにだけ載せる。
+        if (!seg.complete || index + PART_SEGMENTS >= numComplete)
+        {
+            for (size_t i = 0; i < seg.parts.size(); i++)
+            {
+                out += str::format("#EXT-X-PART:DURATION=%.3f,URI=\"part%u.%u.ts%s\"%s\n",
+                                   seg.parts[i].duration, seg.msn, (unsigned) i, q.c_str(),
+                                   seg.parts[i].independent ? ",INDEPENDENT=YES" : "");
+            }
+        }
+
+        if (seg.complete)
+        {
+            out += str::format("#EXTINF:%.3f,\nseg%u.ts%s\n", seg.duration, seg.msn, q.c_str());
+            index++;
+        }
+    }
+
+    auto seg = current();
+    if (seg)
+        out += str::format("#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part%u.%u.ts%s\"\n",
+                           seg->msn, (unsigned) seg->parts.size(), q.c_str());
+    else
+        out += str::format("#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part%u.0.ts%s\"\n", m_nextMSN, q.c_str());
+
+    return out;
+}
+
+// ------------------------------------
+bool HLSSegmenter::getSegment(unsigned int msn, std::string& out)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    for (auto& seg : m_segments)
+    {
+        if (seg.msn == msn && seg.complete)
+        {
+            out = seg.data;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ------------------------------------
+bool HLSSegmenter::getPart(unsigned int msn, unsigned int part, std::string& out)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    for (auto& seg : m_segments)
+    {
+        if (seg.msn == msn && part < seg.parts.size())
+        {
+            out = seg.data.substr(seg.parts[part].offset, seg.parts[part].length);
+            return true;
+        }
+    }
+    return false;
+}
+
+// ------------------------------------
+bool HLSSegmenter::isReady(unsigned int msn, int part)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    // 既に捨てたものは待っても出来ない。
+    if (!m_segments.empty() && msn < m_segments.front().msn)
+        return true;
+
+    for (auto& seg : m_segments)
+    {
+        if (seg.msn == msn)
+            return seg.complete || (part >= 0 && (size_t) part < seg.parts.size());
+    }
+    return msn < m_nextMSN;
+}
+
+// ------------------------------------
+bool HLSSegmenter::hasSegments()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    return std::any_of(m_segments.begin(), m_segments.end(),
+                       [](const Segment& s) { return s.complete; });
+}
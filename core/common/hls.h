@@ -0,0 +1,138 @@
+// ------------------------------------------------
+// File : hls.h
+// Desc:
+//      FLV チャンネルの HLS 出力。チャンネルのパケットバッファーから
+//      FLV を読んで H.264/AAC を MPEG-TS のセグメントに詰め直し、直近
+//      のものをメモリーに置く。LL-HLS のパートも作る。
+//
+//      視聴者が居なければ何もしないように、HTTP の要求が来た時に update
+//      で新しいパケットを取り込む。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _HLS_H
+#define _HLS_H
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mpegts.h"
+
+class Channel;
+
+// ------------------------------------
+class HLSSegmenter
+{
+public:
+    enum
+    {
+        TARGET_DURATION = 2000, // セグメントを区切る長さ (ms)。キーフレームで区切る
+        PART_TARGET     = 500,  // パートの長さの上限 (ms)
+        MAX_SEGMENTS    = 8,    // 手元に置くセグメントの数
+        PART_SEGMENTS   = 2,    // プレイリストにパートを載せる完成したセグメントの数
+    };
+
+    HLSSegmenter();
+
+    // ch のパケットバッファーから新しいパケットを取り込む。
+    void    update(std::shared_ptr<Channel> ch);
+
+    // FLV のバイト列を取り込む。ファイルヘッダーから始まっても、タグ
+    // の途中で区切れていてもよい。
+    void    put(const void* data, int len);
+    // パケットが飛んだ。作りかけのセグメントを閉じて次のキーフレーム
+    // から始め直す。
+    void    discontinuity();
+
+    // プレイリスト。query はセグメントの URI の後ろに付ける。セグメン
+    // トが一つも無ければ空文字列。
+    std::string playlist(const std::string& query = "");
+
+    bool    getSegment(unsigned int msn, std::string& out);
+    bool    getPart(unsigned int msn, unsigned int part, std::string& out);
+
+    // msn 番のセグメントの part 番のパート (part が負ならセグメント全
+    // 体) が出来ているか。
+    bool    isReady(unsigned int msn, int part);
+    // 一つでもセグメントが完成しているか。
+    bool    hasSegments();
+
+private:
+    struct Part
+    {
+        size_t  offset;
+        size_t  length;
+        double  duration;
+        bool    independent;
+    };
+
+    struct Segment
+    {
+        unsigned int msn;
+        std::string data;
+        std::vector<Part> parts;
+        int64_t start;          // 最初のフレームの DTS (90kHz)
+        int64_t partStart;      // 作りかけのパートの最初のフレームの DTS
+        bool    partIndependent;
+        double  duration;
+        bool    complete;
+        bool    discontinuity;
+    };
+
+    void    feed(const void* data, int len);
+    void    putTag(int type, int64_t timestamp, const uint8_t* data, int size);
+    void    putVideo(int64_t timestamp, const uint8_t* data, int size);
+    void    putAudio(int64_t timestamp, const uint8_t* data, int size);
+    // 新しいフレームの前でセグメントやパートを区切る。フレームを入れる
+    // セグメントを返す。入れられなければ nullptr。
+    Segment* prepareFrame(bool video, bool keyFrame, int64_t dts);
+    void    closePart(Segment& seg, int64_t end);
+    void    closeSegment(Segment& seg, int64_t end);
+    Segment* current();
+    void    updateStreams();
+    void    breakStream();
+    void    resetStream();
+
+    std::mutex          m_lock;
+
+    // 取り込み位置
+    bool                m_started;
+    unsigned int        m_streamIndex;
+    unsigned int        m_streamPos;
+    bool                m_skipContinuation;
+
+    // FLV の読み取り
+    std::string         m_buf;
+    size_t              m_bufPos;
+    bool                m_needFileHeader;
+
+    // コーデックの設定
+    std::vector<std::string> m_sps, m_pps;
+    int                 m_nalLengthSize;
+    bool                m_hasAudioConfig;
+    int                 m_aacProfile, m_aacFreqIndex, m_aacChannels;
+
+    MPEGTSWriter        m_ts;
+    std::deque<Segment> m_segments;
+    unsigned int        m_nextMSN;
+    unsigned int        m_discontinuitySequence;
+    bool                m_pendingDiscontinuity;
+    int64_t             m_lastDTS;
+    int64_t             m_lastInterval;
+    int                 m_targetDuration;
+};
+
+#endif
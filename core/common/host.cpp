@@ -20,6 +20,7 @@
 #include "socket.h"
 #include "str.h"
 #include "regexp.h"
+#include "resolver.h"
 
 // ------------------------------------------
 bool Host::isLocalhost()
@@ -102,8 +103,8 @@ void Host::fromStrName(const char *str, int p)
         if (v.size() <= 2) {
             if (!IP::tryParse(v[0], ip)) {
                 ip = IP();
-                for (std::string& s : sys->getIPAddresses(v[0])) {
-                    ip = IP::parse(s);
+                for (auto& addr : g_resolver.resolve(v[0])) {
+                    ip = addr;
                     break;
                 }
             }
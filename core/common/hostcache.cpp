@@ -0,0 +1,205 @@
+// ------------------------------------------------
+// File : hostcache.cpp
+// Desc:
+//      ServMgr のホストキャッシュ。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+
+#include "hostcache.h"
+
+// ------------------------------------
+static size_t hashIP(const IP& ip)
+{
+    size_t v = 0;
+    for (auto b : ip.addr)
+        v = v * 31 + b;
+    return v;
+}
+
+// ------------------------------------
+size_t HostCache::KeyHash::operator()(const Key& k) const
+{
+    return (hashIP(k.host.ip) * 31 + k.host.port) * 31 + k.type;
+}
+
+// ------------------------------------
+size_t HostCache::IPKeyHash::operator()(const std::pair<ServHost::TYPE, IP>& k) const
+{
+    return hashIP(k.second) * 31 + k.first;
+}
+
+// ------------------------------------
+HostCache::HostCache(size_t capacity)
+    : m_capacity(capacity)
+{
+}
+
+// ------------------------------------
+void HostCache::add(Host& h, ServHost::TYPE type, unsigned int time)
+{
+    if (!h.isValid())
+        return;
+
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    auto it = m_byHost.find({ type, h });
+    if (it != m_byHost.end())
+    {
+        LOG_DEBUG("Old host: %s - %s", h.str().c_str(), ServHost::getTypeStr(type));
+        erase(it->second);
+    }else
+        LOG_DEBUG("New host: %s - %s", h.str().c_str(), ServHost::getTypeStr(type));
+
+    ServHost sh;
+    sh.init(h, type, time);
+    m_lru.push_front(sh);
+    m_byHost[{ type, h }] = m_lru.begin();
+    m_byIP.insert(std::make_pair(std::make_pair(type, h.ip), m_lru.begin()));
+
+    evict();
+}
+
+// ------------------------------------
+void HostCache::remove(const Host& h, ServHost::TYPE type)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    auto it = m_byHost.find({ type, h });
+    if (it != m_byHost.end())
+        erase(it->second);
+}
+
+// ------------------------------------
+bool HostCache::seen(const IP& ip, ServHost::TYPE type, unsigned int since)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    auto range = m_byIP.equal_range(std::make_pair(type, ip));
+    for (auto it = range.first; it != range.second; ++it)
+        if (it->second->time >= since)
+            return true;
+    return false;
+}
+
+// ------------------------------------
+void HostCache::clear(ServHost::TYPE type)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    if (type == ServHost::T_NONE)
+    {
+        m_lru.clear();
+        m_byHost.clear();
+        m_byIP.clear();
+        return;
+    }
+
+    for (auto it = m_lru.begin(); it != m_lru.end(); )
+    {
+        auto next = std::next(it);
+        if (it->type == type)
+            erase(it);
+        it = next;
+    }
+}
+
+// ------------------------------------
+unsigned int HostCache::count(ServHost::TYPE type)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    if (type == ServHost::T_NONE)
+        return m_lru.size();
+
+    unsigned int cnt = 0;
+    for (auto& sh : m_lru)
+        if (sh.type == type)
+            cnt++;
+    return cnt;
+}
+
+// ------------------------------------
+std::vector<Host> HostCache::newest(ServHost::TYPE type, int max, std::function<bool(const ServHost&)> accept)
+{
+    std::vector<const ServHost*> found;
+    std::vector<Host> res;
+
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    for (auto& sh : m_lru)
+        if (sh.type == type && accept(sh))
+            found.push_back(&sh);
+
+    std::stable_sort(found.begin(), found.end(),
+                     [](const ServHost* a, const ServHost* b) { return a->time > b->time; });
+
+    for (auto sh : found)
+    {
+        if ((int) res.size() >= max)
+            break;
+        res.push_back(sh->host);
+    }
+    return res;
+}
+
+// ------------------------------------
+void HostCache::forEach(std::function<void(const ServHost&)> block)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    for (auto& sh : m_lru)
+        block(sh);
+}
+
+// ------------------------------------
+void HostCache::setCapacity(size_t capacity)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    m_capacity = capacity;
+    evict();
+}
+
+// ------------------------------------
+size_t HostCache::capacity()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_capacity;
+}
+
+// ------------------------------------
+// m_lock を取って呼ぶ。
+void HostCache::erase(LRUList::iterator it)
+{
+    auto range = m_byIP.equal_range(std::make_pair(it->type, it->host.ip));
+    for (auto i = range.first; i != range.second; ++i)
+    {
+        if (i->second == it)
+        {
+            m_byIP.erase(i);
+            break;
+        }
+    }
+    m_byHost.erase({ it->type, it->host });
+    m_lru.erase(it);
+}
+
+// ------------------------------------
+// m_lock を取って呼ぶ。
+void HostCache::evict()
+{
+    while (m_lru.size() > m_capacity && !m_lru.empty())
+        erase(std::prev(m_lru.end()));
+}
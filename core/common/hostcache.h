@@ -0,0 +1,142 @@
+// ------------------------------------------------
+// File : hostcache.h
+// Desc:
+//      見聞きしたホストを種類ごとに覚えておく表。種類とアドレスで引く
+//      索引と、最近加えた順のリストを持ち、上限を超えたら一番長く加え
+//      られていないものから捨てる。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _HOSTCACHE_H
+#define _HOSTCACHE_H
+
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "host.h"
+#include "sys.h"
+
+// ----------------------------------
+class ServHost
+{
+public:
+    enum TYPE
+    {
+        T_NONE,
+        T_STREAM,
+        T_CHANNEL,
+        T_SERVENT,
+        T_TRACKER
+    };
+
+    ServHost() { init(); }
+    void init()
+    {
+        host.init();
+        time = 0;
+        type = T_NONE;
+    }
+    void init(Host &h, TYPE tp, unsigned int tim)
+    {
+        init();
+        host = h;
+        type = tp;
+        if (tim)
+            time = tim;
+        else
+            time = sys->getTime();
+    }
+
+    static const char   *getTypeStr(TYPE);
+    static TYPE         getTypeFromStr(const char *);
+
+    TYPE            type;
+    Host            host;
+    unsigned int    time;
+};
+
+// ----------------------------------
+class HostCache
+{
+public:
+    enum
+    {
+        DEFAULT_CAPACITY = 1000,
+    };
+
+    HostCache(size_t capacity = DEFAULT_CAPACITY);
+
+    // 同じ種類とアドレスのものがあれば置き換える。time が 0 なら今の
+    // 時刻。
+    void            add(Host& h, ServHost::TYPE type, unsigned int time);
+
+    // type の h を消す。
+    void            remove(const Host& h, ServHost::TYPE type);
+
+    // ip の type のホストを since 以降に加えたか。ポートは見ない。
+    bool            seen(const IP& ip, ServHost::TYPE type, unsigned int since);
+
+    // type が T_NONE なら全て。
+    void            clear(ServHost::TYPE type);
+    unsigned int    count(ServHost::TYPE type);
+
+    // type のホストを時刻の新しい順に max 個まで。accept が偽を返すも
+    // のは除く。
+    std::vector<Host> newest(ServHost::TYPE type, int max, std::function<bool(const ServHost&)> accept);
+
+    // 最近加えた順に。
+    void            forEach(std::function<void(const ServHost&)> block);
+
+    void            setCapacity(size_t capacity);
+    size_t          capacity();
+
+private:
+    typedef std::list<ServHost> LRUList;
+
+    struct Key
+    {
+        ServHost::TYPE  type;
+        Host            host;
+
+        bool operator == (const Key& other) const
+        {
+            return type == other.type && host == other.host;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& k) const;
+    };
+
+    struct IPKeyHash
+    {
+        size_t operator()(const std::pair<ServHost::TYPE, IP>& k) const;
+    };
+
+    void            erase(LRUList::iterator it);
+    void            evict();
+
+    std::mutex      m_lock;
+    size_t          m_capacity;
+
+    // 前にあるほど最近加えたもの。
+    LRUList         m_lru;
+    std::unordered_map<Key, LRUList::iterator, KeyHash> m_byHost;
+    std::unordered_multimap<std::pair<ServHost::TYPE, IP>, LRUList::iterator, IPKeyHash> m_byIP;
+};
+
+#endif
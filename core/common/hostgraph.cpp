@@ -12,6 +12,8 @@
 // GNU General Public License for more details.
 // ------------------------------------------------
 
+#include <mutex>
+
 #include "hostgraph.h"
 
 #include "host.h"
@@ -24,7 +26,8 @@ HostGraph::HostGraph(const ChanHit& self, ChanHitList *hitList)
     if (hitList == nullptr)
         throw std::invalid_argument("hitList");
 
-    m_hit[id(self)] = self;
+    m_self = id(self);
+    m_hit[m_self] = self;
 
     for (auto p = hitList->hit;
          p;
@@ -36,57 +39,50 @@ HostGraph::HostGraph(const ChanHit& self, ChanHitList *hitList)
         m_hit[id(*p)].next = nullptr;
     }
 
+    // 親を探す索引。元は節ごとに m_hit を端から舐めていたので、同じ
+    // 結果になるよう m_hit の順で最初に見つかったものを覚える。
+    std::map<Host, ID> byHost;
+    std::map<IP, ID> byIP;
+    std::map<std::pair<IP, Host>, ID> byLocal;
+    for (auto& pair : m_hit) {
+        auto& id1 = pair.first;
+        byHost.emplace(id1.first, id1);
+        byIP.emplace(id1.first.ip, id1);
+        byLocal.emplace(std::make_pair(id1.first.ip, id1.second), id1);
+    }
+
     for (auto& pair : m_hit) {
         auto& id0 = pair.first;
         auto& hit = pair.second;
-        bool found = false;
 
         // tracker
         if (hit.uphost == Host()) {
             m_roots.push_back(id0);
-            found = true;
+            continue;
         }
 
         // wan relay (fetch)
-        if (!found) {
-            for (const auto& entry : m_hit) {
-                auto& id1 = entry.first;
-                if (id1.first == hit.uphost) {
-                    found = true;
-                    m_children[id1].push_back(id0);
-                    break;
-                }
-            }
+        auto it = byHost.find(hit.uphost);
+        if (it != byHost.end()) {
+            m_children[it->second].push_back(id0);
+            continue;
         }
 
         // wan relay (push)
-        if (!found) {
-            for (const auto& entry : m_hit) {
-                auto& id1 = entry.first;
-                if (id1.first.ip == hit.uphost.ip) {
-                    found = true;
-                    m_children[id1].push_back(id0);
-                    break;
-                }
-            }
+        auto it2 = byIP.find(hit.uphost.ip);
+        if (it2 != byIP.end()) {
+            m_children[it2->second].push_back(id0);
+            continue;
         }
 
         // lan relay (fetch)
-        if (!found) {
-            for (const auto& entry : m_hit) {
-                auto& id1 = entry.first;
-                if (id1.first.ip == hit.rhost[0].ip &&
-                    id1.second == hit.uphost) {
-                    found = true;
-                    m_children[id1].push_back(id0);
-                    break;
-                }
-            }
+        auto it3 = byLocal.find(std::make_pair(hit.rhost[0].ip, hit.uphost));
+        if (it3 != byLocal.end()) {
+            m_children[it3->second].push_back(id0);
+            continue;
         }
 
-        if (!found) {
-            m_roots.push_back(id0);
-        }
+        m_roots.push_back(id0);
     }
 }
 
@@ -95,25 +91,33 @@ std::pair<Host, Host> HostGraph::id(const ChanHit& hit)
     return { hit.rhost[0], hit.rhost[1] };
 }
 
-json HostGraph::toRelayTree(ID& endpoint, const std::vector<ID> path)
+// path は根から endpoint までの節。子を辿る間だけ endpoint を入れて
+// おき、戻る時に外す。
+json HostGraph::toRelayTree(const ID& endpoint, std::set<ID>& path)
 {
-    ChanHit& hit = m_hit[endpoint];
+    json node = nodeInfo(m_hit[endpoint]);
     json::array_t children;
 
-    for (ID& child : m_children[endpoint])
+    path.insert(endpoint);
+    auto it = m_children.find(endpoint);
+    if (it != m_children.end())
     {
-        if (find(path.begin(), path.end(), child) == path.end())
-        {
-            std::vector<ID> p = path;
-            p.push_back(endpoint);
-            children.push_back(toRelayTree(child, p));
-        }
-        else
+        for (const ID& child : it->second)
         {
-            LOG_WARN("toRelayTree: circularity detected.");
+            if (path.count(child) == 0)
+                children.push_back(toRelayTree(child, path));
+            else
+                LOG_WARN("toRelayTree: circularity detected.");
         }
     }
+    path.erase(endpoint);
+
+    node["children"] = children;
+    return node;
+}
 
+json HostGraph::nodeInfo(const ChanHit& hit)
+{
     return {
         { "sessionId", (std::string) hit.sessionID },
         { "address", hit.rhost[0].ip.str() },
@@ -128,17 +132,134 @@ json HostGraph::toRelayTree(ID& endpoint, const std::vector<ID> path)
         { "isControlFull", !hit.cin },
         { "version", hit.version },
         { "versionString", hit.versionString() },
-        { "children", children }
     };
 }
 
 json::array_t HostGraph::getRelayTree()
 {
     json::array_t result;
+    std::set<ID> path;
 
     for (ID& root : m_roots)
     {
-        result.push_back(toRelayTree(root, {root}));
+        result.push_back(toRelayTree(root, path));
     }
     return result;
 }
+
+// ------------------------------------------------
+std::vector<HostGraph::Move> HostGraph::findShallowerParents(int maxDepth, int maxMoves)
+{
+    // 自分から辿れる節の深さ。循環していても一度しか数えない。
+    std::map<ID, int> depth;
+    std::vector<ID> queue = { m_self };
+    depth[m_self] = 0;
+    for (size_t i = 0; i < queue.size(); i++)
+    {
+        auto it = m_children.find(queue[i]);
+        if (it == m_children.end())
+            continue;
+        for (const ID& child : it->second)
+        {
+            if (depth.count(child))
+                continue;
+            depth[child] = depth[queue[i]] + 1;
+            queue.push_back(child);
+        }
+    }
+
+    // 幅優先なので queue は浅い順に並んでいる。
+    std::vector<ID> parents;
+    for (const ID& n : queue)
+    {
+        const ChanHit& hit = m_hit[n];
+        if (hit.relay && !hit.firewalled && !hit.dead && hit.rhost[0].port)
+            parents.push_back(n);
+    }
+
+    std::vector<Move> moves;
+    std::set<ID> used;
+    for (auto it = queue.rbegin(); it != queue.rend() && (int) moves.size() < maxMoves; ++it)
+    {
+        const ID& n = *it;
+        const ChanHit& hit = m_hit[n];
+        int d = depth[n];
+        if (d <= maxDepth)
+            break;
+        if (hit.tracker || hit.dead || !hit.sessionID.isSet())
+            continue;
+
+        for (const ID& p : parents)
+        {
+            if (depth[p] + 1 > d - 2)
+                break;
+            if (used.count(p))
+                continue;
+
+            used.insert(p);
+            moves.push_back({ hit, m_hit[p], d, depth[p] });
+            break;
+        }
+    }
+    return moves;
+}
+
+// ------------------------------------------------
+namespace
+{
+    struct CacheEntry
+    {
+        std::weak_ptr<ChanHitList> hitList;
+        unsigned int generation;
+        json self;
+        json::array_t tree;
+    };
+
+    std::mutex s_cacheLock;
+    std::map<ChanHitList*, CacheEntry> s_cache;
+}
+
+json::array_t HostGraph::getCachedRelayTree(const ChanHit& self, std::shared_ptr<ChanHitList> hitList)
+{
+    if (hitList == nullptr)
+        throw std::invalid_argument("hitList");
+
+    // 木の形は self の rhost と uphost にもよる。
+    json key = nodeInfo(self);
+    key["rhost1"] = self.rhost[1].str();
+    key["uphost"] = self.uphost.str();
+
+    std::lock_guard<std::mutex> cs(s_cacheLock);
+
+    // 消えたチャンネルの分を捨てる。
+    for (auto it = s_cache.begin(); it != s_cache.end(); )
+    {
+        if (it->second.hitList.expired())
+            it = s_cache.erase(it);
+        else
+            ++it;
+    }
+
+    auto it = s_cache.find(hitList.get());
+    if (it != s_cache.end() &&
+        it->second.hitList.lock() == hitList &&
+        it->second.generation == hitList->generation() &&
+        it->second.self == key)
+    {
+        return it->second.tree;
+    }
+
+    HostGraph graph(self, hitList.get());
+    CacheEntry& entry = s_cache[hitList.get()];
+    entry.hitList = hitList;
+    entry.generation = hitList->generation();
+    entry.self = key;
+    entry.tree = graph.getRelayTree();
+    return entry.tree;
+}
+
+void HostGraph::clearCache()
+{
+    std::lock_guard<std::mutex> cs(s_cacheLock);
+    s_cache.clear();
+}
@@ -16,6 +16,10 @@
 #ifndef _HOSTGRAPH_H
 #define _HOSTGRAPH_H
 
+#include <map>
+#include <memory>
+#include <set>
+
 #include "json.hpp"
 
 class Host;
@@ -37,12 +41,38 @@ public:
 
     json::array_t getRelayTree();
 
+    // hitList が前回から変わっておらず、self の状態も同じなら前回作っ
+    // た木を返す。ヒットの追加・削除の度に hitList の generation が進
+    // むので、それで古くなったかを見る。hitList を書き換えるスレッド
+    // と競わないよう chanMgr->lock を取って呼ぶ。
+    static json::array_t getCachedRelayTree(const ChanHit& self, std::shared_ptr<ChanHitList> hitList);
+
+    static void clearCache();
+
+    // 木を浅くするための付け替え案。hit を parent の下に付け替えれば
+    // depth から parentDepth + 1 になる。
+    struct Move
+    {
+        ChanHit hit;
+        ChanHit parent;
+        int     depth;
+        int     parentDepth;
+    };
+
+    // 自分を根とする木で maxDepth より深いリレーを深い順に選び、二段
+    // 以上浅くなる、リレーに空きのある親を見付ける。一つの親に勧めるの
+    // は一回につき一つまで。
+    std::vector<Move> findShallowerParents(int maxDepth, int maxMoves);
+
     ID id(const ChanHit& hit);
-    json toRelayTree(ID& endpoint, const std::vector<ID> path);
+    json toRelayTree(const ID& endpoint, std::set<ID>& path);
+
+    static json nodeInfo(const ChanHit& hit);
 
     std::map<ID, ChanHit> m_hit;
     std::map<ID, std::vector<ID> > m_children;
     std::vector<ID> m_roots;
+    ID m_self;
 };
 
 #endif
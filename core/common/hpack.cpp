@@ -0,0 +1,389 @@
+// ------------------------------------------------
+// File : hpack.cpp
+// Desc:
+//      HTTP/2 のヘッダー圧縮 (RFC 7541)。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+
+#include "hpack.h"
+
+namespace hpack
+{
+
+// ------------------------------------
+// 付録 A の静的表。添字 1 から。
+static const Header s_staticTable[] =
+{
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+static const size_t STATIC_TABLE_SIZE = sizeof(s_staticTable) / sizeof(s_staticTable[0]);
+
+// ------------------------------------
+// 付録 B のハフマン符号の長さ。符号そのものは長さと記号の順に振った
+// 正準符号なので、長さだけから作れる。256 は EOS。
+static const unsigned char s_codeLengths[257] =
+{
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+     6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+     5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+    13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+     7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+    15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+     6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+static const int MAX_CODE_LENGTH = 30;
+static const int EOS = 256;
+
+// ------------------------------------
+// 正準符号の復号表。長さごとに最初の符号と、その長さの記号が
+// symbols のどこから並ぶか。
+struct HuffmanTable
+{
+    HuffmanTable()
+    {
+        for (int sym = 0; sym <= EOS; sym++)
+            symbols.push_back(sym);
+        std::stable_sort(symbols.begin(), symbols.end(),
+                         [](int a, int b) { return s_codeLengths[a] < s_codeLengths[b]; });
+
+        std::fill(count, count + MAX_CODE_LENGTH + 1, 0);
+        for (int sym = 0; sym <= EOS; sym++)
+            count[s_codeLengths[sym]]++;
+
+        unsigned int code = 0;
+        int index = 0;
+        for (int len = 1; len <= MAX_CODE_LENGTH; len++)
+        {
+            first[len] = code;
+            offset[len] = index;
+            code = (code + count[len]) << 1;
+            index += count[len];
+        }
+    }
+
+    std::vector<int> symbols;
+    int             count[MAX_CODE_LENGTH + 1];
+    unsigned int    first[MAX_CODE_LENGTH + 1];
+    int             offset[MAX_CODE_LENGTH + 1];
+};
+
+// ------------------------------------
+std::string huffmanDecode(const std::string& data)
+{
+    static const HuffmanTable table;
+
+    std::string out;
+    unsigned int code = 0;
+    int len = 0;
+    for (unsigned char c : data)
+    {
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            code = (code << 1) | ((c >> bit) & 1);
+            len++;
+            if (len > MAX_CODE_LENGTH)
+                throw Error("Invalid Huffman code");
+
+            if (code >= table.first[len] && code - table.first[len] < (unsigned int) table.count[len])
+            {
+                int sym = table.symbols[table.offset[len] + code - table.first[len]];
+                if (sym == EOS)
+                    throw Error("EOS in Huffman string");
+                out += (char) sym;
+                code = 0;
+                len = 0;
+            }
+        }
+    }
+
+    // 詰め物は 7 ビットまでの EOS の頭 (全部 1)。
+    if (len > 7 || code != (1u << len) - 1)
+        throw Error("Invalid Huffman padding");
+    return out;
+}
+
+// ------------------------------------
+// 下位 prefix ビットから始まる整数 (5.1 節)。
+static size_t readInt(const std::string& s, size_t& pos, int prefix)
+{
+    if (pos >= s.size())
+        throw Error("Truncated integer");
+
+    const size_t max = (1 << prefix) - 1;
+    size_t value = (unsigned char) s[pos++] & max;
+    if (value < max)
+        return value;
+
+    for (int shift = 0; ; shift += 7)
+    {
+        if (pos >= s.size())
+            throw Error("Truncated integer");
+        if (shift > 28)
+            throw Error("Integer too large");
+        unsigned char b = s[pos++];
+        value += (size_t) (b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return value;
+    }
+}
+
+// ------------------------------------
+static std::string readString(const std::string& s, size_t& pos)
+{
+    if (pos >= s.size())
+        throw Error("Truncated string");
+
+    const bool huffman = (s[pos] & 0x80) != 0;
+    size_t len = readInt(s, pos, 7);
+    if (len > s.size() - pos)
+        throw Error("Truncated string");
+
+    auto str = s.substr(pos, len);
+    pos += len;
+    return huffman ? huffmanDecode(str) : str;
+}
+
+// ------------------------------------
+static void writeInt(std::string& out, size_t value, int prefix, unsigned char flags)
+{
+    const size_t max = (1 << prefix) - 1;
+    if (value < max)
+    {
+        out += (char) (flags | value);
+        return;
+    }
+
+    out += (char) (flags | max);
+    value -= max;
+    while (value >= 0x80)
+    {
+        out += (char) ((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += (char) value;
+}
+
+// ------------------------------------
+static void writeString(std::string& out, const std::string& str)
+{
+    writeInt(out, str.size(), 7, 0x00);
+    out += str;
+}
+
+// ------------------------------------
+static size_t entrySize(const Header& h)
+{
+    return h.first.size() + h.second.size() + 32;
+}
+
+// ------------------------------------
+Decoder::Decoder(size_t maxTableSize)
+    : m_size(0)
+    , m_capacity(maxTableSize)
+    , m_maxCapacity(maxTableSize)
+{
+}
+
+// ------------------------------------
+const Header& Decoder::lookup(size_t index) const
+{
+    if (index == 0)
+        throw Error("Index 0");
+    if (index <= STATIC_TABLE_SIZE)
+        return s_staticTable[index - 1];
+
+    index -= STATIC_TABLE_SIZE + 1;
+    if (index >= m_table.size())
+        throw Error("Index out of range");
+    return m_table[index];
+}
+
+// ------------------------------------
+void Decoder::evict(size_t maxSize)
+{
+    while (m_size > maxSize)
+    {
+        m_size -= entrySize(m_table.back());
+        m_table.pop_back();
+    }
+}
+
+// ------------------------------------
+void Decoder::insert(const Header& header)
+{
+    // 表より大きいものを入れると表は空になる (4.4 節)。
+    const size_t size = entrySize(header);
+    if (size > m_capacity)
+    {
+        evict(0);
+        return;
+    }
+
+    evict(m_capacity - size);
+    m_table.push_front(header);
+    m_size += size;
+}
+
+// ------------------------------------
+HeaderList Decoder::decode(const std::string& block)
+{
+    HeaderList headers;
+    size_t pos = 0;
+    while (pos < block.size())
+    {
+        const unsigned char b = block[pos];
+        if (b & 0x80)
+        {
+            // 索引
+            headers.push_back(lookup(readInt(block, pos, 7)));
+        }else if (b & 0x40)
+        {
+            // 表に入れるリテラル
+            size_t index = readInt(block, pos, 6);
+            Header h;
+            h.first = index ? lookup(index).first : readString(block, pos);
+            h.second = readString(block, pos);
+            headers.push_back(h);
+            insert(h);
+        }else if (b & 0x20)
+        {
+            // 表の大きさの更新。ブロックの頭でしか許されない。
+            if (!headers.empty())
+                throw Error("Table size update after header field");
+            size_t size = readInt(block, pos, 5);
+            if (size > m_maxCapacity)
+                throw Error("Table size update too large");
+            m_capacity = size;
+            evict(m_capacity);
+        }else
+        {
+            // 表に入れない (0000) か、決して入れない (0001) リテラル
+            size_t index = readInt(block, pos, 4);
+            Header h;
+            h.first = index ? lookup(index).first : readString(block, pos);
+            h.second = readString(block, pos);
+            headers.push_back(h);
+        }
+    }
+    return headers;
+}
+
+// ------------------------------------
+std::string Encoder::encode(const HeaderList& headers)
+{
+    std::string out;
+    for (auto& h : headers)
+    {
+        size_t nameIndex = 0, pairIndex = 0;
+        for (size_t i = 0; i < STATIC_TABLE_SIZE; i++)
+        {
+            if (s_staticTable[i].first != h.first)
+                continue;
+            if (!nameIndex)
+                nameIndex = i + 1;
+            if (s_staticTable[i].second == h.second)
+            {
+                pairIndex = i + 1;
+                break;
+            }
+        }
+
+        if (pairIndex)
+            writeInt(out, pairIndex, 7, 0x80);
+        else
+        {
+            // 表に入れないリテラル
+            writeInt(out, nameIndex, 4, 0x00);
+            if (!nameIndex)
+                writeString(out, h.first);
+            writeString(out, h.second);
+        }
+    }
+    return out;
+}
+
+} // namespace hpack
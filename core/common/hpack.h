@@ -0,0 +1,82 @@
+// ------------------------------------------------
+// File : hpack.h
+// Desc:
+//      HTTP/2 のヘッダー圧縮 (RFC 7541)。復号器は静的表、動的表、ハフ
+//      マン符号をすべて扱う。符号器は応答にしか使わないので、静的表に
+//      ある名前と組を引くだけで、動的表にもハフマン符号にも載せない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _HPACK_H
+#define _HPACK_H
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+
+namespace hpack
+{
+    typedef std::pair<std::string, std::string> Header;
+    typedef std::vector<Header> HeaderList;
+
+    // 壊れたヘッダーブロック。接続ごと COMPRESSION_ERROR で閉じる。
+    class Error : public GeneralException
+    {
+    public:
+        Error(const std::string& m) : GeneralException(m) {}
+    };
+
+    // ハフマン符号の文字列を戻す。詰め物が正しくなければ Error。
+    std::string huffmanDecode(const std::string& data);
+
+    // ------------------------------------
+    class Decoder
+    {
+    public:
+        enum
+        {
+            DEFAULT_TABLE_SIZE = 4096,  // SETTINGS_HEADER_TABLE_SIZE の既定値
+        };
+
+        Decoder(size_t maxTableSize = DEFAULT_TABLE_SIZE);
+
+        // ヘッダーブロックを一つ読む。ブロックは届いた順に全部渡すこと。
+        HeaderList  decode(const std::string& block);
+
+        size_t      tableSize() const { return m_size; }
+        size_t      numEntries() const { return m_table.size(); }
+
+    private:
+        const Header& lookup(size_t index) const;
+        void        insert(const Header& header);
+        void        evict(size_t maxSize);
+
+        std::deque<Header> m_table;     // 新しいものが前
+        size_t      m_size;             // エントリーの大きさの合計
+        size_t      m_capacity;         // 表の大きさの更新で決まった上限
+        size_t      m_maxCapacity;      // こちらが SETTINGS で知らせた上限
+    };
+
+    // ------------------------------------
+    class Encoder
+    {
+    public:
+        // 名前は小文字で渡す。
+        std::string encode(const HeaderList& headers);
+    };
+}
+
+#endif
@@ -65,15 +65,12 @@ void HTML::writeOK(const char *content, const std::map<std::string,std::string>&
 
 void HTML::writeTemplate(const char *fileName, const char *args, const std::vector<Template::Scope*>& scopes)
 {
-    FileStream file;
     try
     {
-        StringStream mem;
-        file.openReadOnly(fileName);
-        file.writeTo(mem, file.length());
-        mem.rewind();
+        StringStream mem(*Template::loadTemplate(fileName));
 
-        StringStream bufferedOut;
+        // ページ全体を溜めずに out へ描く。途中で失敗すればそこまでの
+        // 出力の後に誤りを書く。
         Template temp(args);
         RootObjectScope globals;
         temp.prependScope(globals);
@@ -85,8 +82,7 @@ void HTML::writeTemplate(const char *fileName, const char *args, const std::vect
             cgi::Query query(args);
             temp.selectedFragment = query.get("fragment");
         }
-        temp.readTemplate(mem, &bufferedOut);
-        out->writeString(bufferedOut.str());
+        temp.readTemplate(mem, out);
     }catch (StreamException &e)
     {
         out->writeString(e.msg);
@@ -103,50 +99,31 @@ void HTML::writeTemplate(const char *fileName, const char *args, const std::vect
         out->writeString(" : ");
         out->writeString(fileName);
     }
-    file.close();
 }
 
 // --------------------------------------
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <unistd.h>
+#include "assetcache.h"
 
-static time_t mtime(const char *path)
-{
-    struct stat st;
-    if (stat(path, &st) == -1)
-        return -1;
-    else
-        return st.st_mtime;
-}
-
-// --------------------------------------
+// 内容は g_assetCache から取る。条件付きの要求に答えるには
+// AssetCache::respond を使う。
 void HTML::writeRawFile(const char *fileName, const char *mimeType)
 {
-    FileStream file;
     std::map<std::string,std::string> additionalHeaders;
 
     try
     {
-        file.openReadOnly(fileName);
-        time_t t = mtime(fileName);
+        auto entry = g_assetCache.get(fileName);
+        const auto& body = *entry->identity.body;
 
-        if (t != -1)
-        {
-            additionalHeaders["Last-Modified"] = cgi::rfc1123Time(t);
-        }else
-        {
-            LOG_ERROR("Failed to get mtime of %s", fileName);
-        }
-        additionalHeaders["Content-Length"] = str::STR(file.length());
+        additionalHeaders["Last-Modified"] = cgi::rfc1123Time(entry->mtime);
+        additionalHeaders["ETag"] = entry->identity.etag;
+        additionalHeaders["Content-Length"] = str::STR(body.size());
 
         writeOK(mimeType, additionalHeaders);
-        file.writeTo(*out, file.length());
+        out->write(body.data(), body.size());
     }catch (StreamException &)
     {
     }
-
-    file.close();
 }
 
 // --------------------------------------
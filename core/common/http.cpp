@@ -29,6 +29,7 @@
 #include "version2.h" // PCX_AGENT
 #include "defer.h"
 #include "dechunker.h"
+#include "httpparser.h"
 
 static const char* statusMessage(int statusCode);
 
@@ -103,19 +104,9 @@ bool    HTTP::nextHeader()
                     break;
         arg = ap;
 
-        if (ap)
-        {
-            string name(cmdLine, strchr(cmdLine, ':'));
-            string value;
-            char *end;
-            if (!(end = strchr(ap, '\r')))
-                if (!(end = strchr(ap, '\n')))
-                    end = ap + strlen(ap);
-            value = string(ap, end);
-            for (size_t i = 0; i < name.size(); ++i)
-                name[i] = toupper(name[i]);
-            headers.set(name, value);
-        }
+        HTTPHeadParser::Field field;
+        if (ap && HTTPHeadParser::parseField(cmdLine, strlen(cmdLine), field))
+            headers.set(field.name.str(), field.value.str());
         return true;
     }else
     {
@@ -125,6 +116,43 @@ bool    HTTP::nextHeader()
     }
 }
 
+//-----------------------------------------
+void    HTTP::readHeaders()
+{
+    if (m_headersRead)
+        return;
+
+    // ヘッダーの後ろは呼び出し元が読むので、一文字ずつ読んで空行で止
+    // める。行もフィールドも解釈器のバッファーの中で切り分け、
+    // headers に入れるまで確保はしない。
+    HTTPHeadParser parser(false);
+    char c;
+    while (parser.state() == HTTPHeadParser::S_INCOMPLETE)
+    {
+        read(&c, 1);
+        parser.feed(&c, 1);
+    }
+
+    if (parser.state() == HTTPHeadParser::S_ERROR)
+    {
+        LOG_DEBUG("Bad request header: %s", parser.error());
+        if (parser.tooLarge())
+            throw HTTPException(HTTP_SC_HEADERTOOLARGE, 431);
+        else
+            throw HTTPException(HTTP_SC_BADREQUEST, 400);
+    }
+
+    for (int i = 0; i < parser.numFields(); i++)
+    {
+        auto& f = parser.field(i);
+        headers.set(f.name.str(), f.value.str());
+    }
+
+    cmdLine[0] = '\0';
+    arg = nullptr;
+    m_headersRead = true;
+}
+
 //-----------------------------------------
 bool    HTTP::isHeader(const char *hs)
 {
@@ -240,6 +268,8 @@ static const char* statusMessage(int statusCode)
     case 401: return "Unauthorized";
     case 403: return "Forbidden";
     case 404: return "Not Found";
+    case 414: return "URI Too Long";
+    case 431: return "Request Header Fields Too Large";
     case 500: return "Internal Server Error";
     case 501: return "Not Implemented";
     case 502: return "Bad Gateway";
@@ -281,14 +311,14 @@ HTTPRequest HTTP::getRequest()
 }
 
 // -----------------------------------
-void HTTP::send(const HTTPResponse& response)
+void HTTP::sendHead(const char* protocolVersion, const HTTPResponse& response)
 {
     bool crlf = writeCRLF;
     Defer cb([=]() { writeCRLF = crlf; });
 
     writeCRLF = true;
 
-    writeResponseStatus("HTTP/1.0", response.statusCode);
+    writeResponseStatus(protocolVersion, response.statusCode);
 
     std::map<std::string,std::string> headers = {
         {"Server", PCX_AGENT},
@@ -296,10 +326,10 @@ void HTTP::send(const HTTPResponse& response)
         {"Date", cgi::rfc1123Time(sys->getTime())}
     };
 
-    const bool bodyIsStream = (response.stream != nullptr);
-
     // Content-Length が設定されておらず、値が決定できる場合は設定する。
-    if (response.headers.get("Content-Length").empty() && !bodyIsStream) {
+    if (response.headers.get("Content-Length").empty() &&
+        response.headers.get("Transfer-Encoding").empty() &&
+        response.stream == nullptr) {
         headers["Content-Length"] = std::to_string(response.body.size());
     }
 
@@ -310,8 +340,14 @@ void HTTP::send(const HTTPResponse& response)
         writeLineF("%s: %s", pair.first.c_str(), pair.second.c_str());
 
     writeLine("");
+}
+
+// -----------------------------------
+void HTTP::send(const HTTPResponse& response)
+{
+    sendHead("HTTP/1.0", response);
 
-    if (bodyIsStream)
+    if (response.stream)
     {
         try
         {
@@ -377,7 +413,7 @@ HTTPResponse HTTP::getResponse()
     }else
     {
         std::string contentLengthStr = headers.get("Content-Length");
-        if (contentLengthStr.empty()) {
+        if (!contentLengthStr.empty()) {
             int length = atoi(contentLengthStr.c_str());
             if (length < 0)
                 throw StreamException("invalid Content-Length value");
@@ -396,72 +432,15 @@ HTTPResponse HTTP::getResponse()
     return response;
 }
 
-#include "sslclientsocket.h" // SslClientSocket
+#include "httpclient.h"
 #include "uri.h"
 namespace http {
 
-std::string get(const std::string& _url)
+std::string get(const std::string& url)
 {
-    std::string url = _url;
-    const std::string originalUrl = url;
-    int retryCount = 0;
-
-Retry:
-    if (retryCount > 1) {
-        throw StreamException("Too many redirections. Giving up ...");
-    }
-
-    URI feed(url);
-    if (!feed.isValid()) {
-        throw ArgumentException(str::format("invalid URL (%s)", url.c_str()));
-    }
-    if (feed.scheme() != "http" && feed.scheme() != "https") {
-        throw ArgumentException(str::format("unsupported protocol (%s)", url.c_str()));
-    }
-
-    Host host;
-    host.fromStrName(feed.host().c_str(), feed.port());
-    if (!host.ip) {
-        throw StreamException(str::format("Could not resolve %s", feed.host().c_str()));
-    }
-
-    std::shared_ptr<ClientSocket> rsock;
-    if (feed.scheme() == "https") {
-        rsock = std::make_shared<SslClientSocket>();
-    } else {
-        rsock = sys->createSocket();
-    }
-
-    LOG_TRACE("Connecting to %s (%s) port %d ...", feed.host().c_str(), host.ip.str().c_str(), feed.port());
-    rsock->open(host);
-    rsock->connect();
-    LOG_TRACE("Connected to %s", host.str().c_str());
-
-    HTTP rhttp(*rsock);
-    const std::string reqPath =  feed.query().size() ? feed.path() + "?" + feed.query() : feed.path();
-    LOG_TRACE("GET %s HTTP/1.1", reqPath.c_str());
-
-    HTTPRequest req("GET", reqPath, "HTTP/1.1",
-                    {
-                     { "Host", feed.host() },
-                     { "Connection", "close" },
-                     { "User-Agent", PCX_AGENT }
-                    });
-
-    HTTPResponse res = rhttp.send(req);
-    if (res.statusCode == 301 || res.statusCode == 302 || res.statusCode == 307 || res.statusCode == 308) {
-        const auto loc = res.headers.get("Location");
-        /* redirect */
-        if (loc != "") {
-            LOG_TRACE("Status code %d. Redirecting to %s ...", res.statusCode, loc.c_str());
-            url = loc;
-            retryCount++;
-            goto Retry;
-        }else {
-            LOG_ERROR("Status code %d. No Location header. Giving up ...", res.statusCode);
-            throw StreamException("No Location header");
-        }
-    }else if (res.statusCode != 200) {
+    HTTPResponse res = getResponse(url, {});
+    if (res.statusCode != 200) {
+        URI feed(url);
         LOG_ERROR("%s: status code %d", feed.host().c_str(), res.statusCode);
         throw StreamException(str::format("status code %d", res.statusCode));
     }
@@ -469,4 +448,9 @@ Retry:
     return res.body;
 }
 
+HTTPResponse getResponse(const std::string& url, const HTTPHeaders& headers)
+{
+    return g_httpClient.get(url, headers);
+}
+
 } // namespace http
@@ -25,6 +25,7 @@
 #include "host.h"
 #include "stream.h"
 #include "str.h"
+#include "arena.h"
 
 // -------------------------------------
 class HTTPException : public StreamException
@@ -52,6 +53,7 @@ public:
 #define HTTP_SC_BADGATEWAY   "HTTP/1.0 502 Bad Gateway"
 #define HTTP_SC_SERVERERROR  "HTTP/1.0 500 Internal Server Error"
 #define HTTP_SC_URITOOLONG   "HTTP/1.0 414 URI Too Long"
+#define HTTP_SC_HEADERTOOLARGE "HTTP/1.0 431 Request Header Fields Too Large"
 
 #define HTTP_PROTO1          "HTTP/1."
 
@@ -67,6 +69,7 @@ public:
 #define HTTP_HS_LENGTH       "Content-Length:"
 
 #define MIME_MP3             "audio/mpeg"
+#define MIME_AAC             "audio/aac"
 #define MIME_XMP3            "audio/x-mpeg"
 #define MIME_OGG             "application/ogg"
 #define MIME_XOGG            "application/x-ogg"
@@ -110,6 +113,10 @@ public:
 class HTTPHeaders
 {
 public:
+    // 要求を処理している間は、サーバントのアリーナから確保する。
+    typedef std::map<std::string, std::string, std::less<std::string>,
+                     ArenaAllocator<std::pair<const std::string, std::string> > > Map;
+
     HTTPHeaders() {}
 
     HTTPHeaders(const std::initializer_list<std::pair<std::string,std::string> >& aHeaders)
@@ -119,12 +126,12 @@ public:
     }
 
     HTTPHeaders(const std::map<std::string,std::string>& aHeaders)
-        : m_headers(aHeaders)
+        : m_headers(aHeaders.begin(), aHeaders.end())
     {
     }
 
-    std::map<std::string,std::string>::const_iterator begin() const { return m_headers.cbegin(); }
-    std::map<std::string,std::string>::const_iterator end() const { return m_headers.cend(); }
+    Map::const_iterator begin() const { return m_headers.cbegin(); }
+    Map::const_iterator end() const { return m_headers.cend(); }
 
     void set(const std::string& name, const std::string& value)
     {
@@ -168,7 +175,7 @@ public:
         return m_headers.clear();
     }
 
-    std::map<std::string,std::string> m_headers;
+    Map m_headers;
 };
 
 // --------------------------------------------
@@ -192,11 +199,11 @@ public:
         , protocolVersion(aProtocolVersion)
         , headers(aHeaders)
     {
-        auto vec = str::split(url, "?");
-        if (vec.size() >= 2)
+        auto pos = url.find('?');
+        if (pos != std::string::npos)
         {
-            path = vec[0];
-            queryString = vec[1];
+            path = url.substr(0, pos);
+            queryString = url.substr(pos + 1);
         }else
             path = url;
     }
@@ -300,10 +307,9 @@ public:
     static void parseAuthorizationHeader(const char* arg, char* user, char* pass, size_t ulen, size_t plen);
     static void parseAuthorizationHeader(const std::string& arg, std::string& user, std::string& pass);
 
-    void    readHeaders()
-    {
-        while(nextHeader());
-    }
+    // 残りのヘッダーを空行まで読んで headers に入れる。大きすぎるか
+    // 形が崩れていれば HTTPException。
+    void    readHeaders();
 
     void writeResponseHeaders(const HTTPHeaders&);
 
@@ -323,6 +329,8 @@ public:
     HTTPRequest getRequest();
 
     void send(const HTTPResponse& response);
+    // 状態行とヘッダーだけを送る。本体は呼び出し側が続けて書く。
+    void sendHead(const char* protocolVersion, const HTTPResponse& response);
     HTTPResponse send(const HTTPRequest& request);
     HTTPResponse getResponse();
 
@@ -341,6 +349,10 @@ namespace http {
 
 std::string get(const std::string& url);
 
+// url を GET して、リダイレクトを辿った後の応答を返す。headers は要求
+// に加える (If-Modified-Since など)。接続は g_httpClient のプールから。
+HTTPResponse getResponse(const std::string& url, const HTTPHeaders& headers);
+
 }
 
 #endif
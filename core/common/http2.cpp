@@ -0,0 +1,704 @@
+// ------------------------------------------------
+// File : http2.cpp
+// Desc:
+//      管理画面と API のための HTTP/2 (RFC 7540)。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <string.h>
+#include <algorithm>
+
+#include "http2.h"
+#include "str.h"
+#include "sys.h"
+
+std::atomic<int> HTTP2Connection::s_numConnections(0);
+std::atomic<unsigned int> HTTP2Connection::s_numStreams(0);
+
+static const long long MAX_WINDOW = 0x7fffffff;
+
+// ------------------------------------
+// 接続ごと閉じるエラー。GOAWAY で code を知らせる。
+class HTTP2Error : public StreamException
+{
+public:
+    HTTP2Error(int c, const std::string& m) : StreamException(m), code(c) {}
+    int code;
+};
+
+// ------------------------------------
+static unsigned int get32(const std::string& s, size_t pos)
+{
+    return ((unsigned char) s[pos] << 24) | ((unsigned char) s[pos + 1] << 16) |
+        ((unsigned char) s[pos + 2] << 8) | (unsigned char) s[pos + 3];
+}
+
+// ------------------------------------
+static void put32(std::string& s, unsigned int v)
+{
+    s += (char) (v >> 24);
+    s += (char) (v >> 16);
+    s += (char) (v >> 8);
+    s += (char) v;
+}
+
+// ------------------------------------
+// 前置きや優先度を除いた中身の範囲。
+static std::string unpad(const std::string& payload, int flags, bool priority)
+{
+    size_t pos = 0, end = payload.size();
+    if (flags & HTTP2Connection::FLAG_PADDED)
+    {
+        if (payload.empty())
+            throw HTTP2Error(HTTP2Connection::ERR_PROTOCOL, "Missing pad length");
+        const size_t pad = (unsigned char) payload[0];
+        pos = 1;
+        if (pad > end - pos)
+            throw HTTP2Error(HTTP2Connection::ERR_PROTOCOL, "Padding too long");
+        end -= pad;
+    }
+    if (priority && (flags & HTTP2Connection::FLAG_PRIORITY))
+    {
+        pos += 5;
+        if (pos > end)
+            throw HTTP2Error(HTTP2Connection::ERR_FRAME_SIZE, "HEADERS too short");
+    }
+    return payload.substr(pos, end - pos);
+}
+
+// ------------------------------------
+HTTP2Connection::HTTP2Connection(Stream& stream, Handler handler, Executor executor)
+    : m_stream(stream)
+    , m_handler(handler)
+    , m_executor(executor)
+    , m_lastStreamId(0)
+    , m_peerGoaway(false)
+    , m_numResets(0)
+    , m_resetWindowStart(0)
+    , m_continuing(false)
+    , m_headerStream(0)
+    , m_headerFlags(0)
+    , m_sendWindow(DEFAULT_WINDOW)
+    , m_initialWindow(DEFAULT_WINDOW)
+    , m_peerMaxFrame(MAX_FRAME_SIZE)
+    , m_numRunning(0)
+{
+}
+
+// ------------------------------------
+bool HTTP2Connection::isPrefaceLine(const char* line)
+{
+    return strcmp(line, "PRI * HTTP/2.0") == 0;
+}
+
+// ------------------------------------
+HTTPResponse HTTP2Connection::http11Required()
+{
+    return HTTPResponse(0, {});
+}
+
+// ------------------------------------
+void HTTP2Connection::run()
+{
+    s_numConnections++;
+    try
+    {
+        // 最初の行の後は "\r\nSM\r\n\r\n"。
+        char rest[8];
+        m_stream.read(rest, sizeof(rest));
+        if (memcmp(rest, "\r\nSM\r\n\r\n", sizeof(rest)) != 0)
+            throw HTTP2Error(ERR_PROTOCOL, "Bad connection preface");
+
+        writeSettings();
+
+        while (!(m_peerGoaway && m_streams.empty()))
+        {
+            sendResponses();
+            const bool busy = isBusy();
+            if (!m_stream.readReady(busy ? POLL_INTERVAL : IDLE_TIMEOUT))
+            {
+                if (busy)
+                    continue;
+                LOG_DEBUG("HTTP/2: idle timeout");
+                writeGoaway(ERR_NONE);
+                break;
+            }
+            readFrame();
+        }
+    }catch (HTTP2Error& e)
+    {
+        LOG_ERROR("HTTP/2: %s", e.msg);
+        try { writeGoaway(e.code); } catch (StreamException&) {}
+    }catch (hpack::Error& e)
+    {
+        LOG_ERROR("HTTP/2: %s", e.msg);
+        try { writeGoaway(ERR_COMPRESSION); } catch (StreamException&) {}
+    }catch (StreamException& e)
+    {
+        LOG_DEBUG("HTTP/2: %s", e.msg);
+    }
+
+    // ワーカーが this を使い終わるまで待ち、出来た応答は送れるだけ送る。
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_cond.wait(lock, [this]() { return m_numRunning == 0; });
+    }
+    try
+    {
+        sendResponses();
+    }catch (StreamException&)
+    {
+    }
+    s_numConnections--;
+}
+
+// ------------------------------------
+void HTTP2Connection::readFrame()
+{
+    unsigned char h[9];
+    m_stream.read(h, sizeof(h));
+    const size_t len = (h[0] << 16) | (h[1] << 8) | h[2];
+    const int type = h[3];
+    const int flags = h[4];
+    const unsigned int id = ((h[5] & 0x7f) << 24) | (h[6] << 16) | (h[7] << 8) | h[8];
+
+    if (len > MAX_FRAME_SIZE)
+        throw HTTP2Error(ERR_FRAME_SIZE, str::format("Frame too large (%zu)", len));
+
+    std::string payload(len, '\0');
+    if (len)
+        m_stream.read(&payload[0], len);
+
+    if (m_continuing && type != FRAME_CONTINUATION)
+        throw HTTP2Error(ERR_PROTOCOL, "CONTINUATION expected");
+
+    switch (type)
+    {
+    case FRAME_DATA:
+        onData(id, flags, payload);
+        break;
+    case FRAME_HEADERS:
+        onHeaders(id, flags, payload);
+        break;
+    case FRAME_CONTINUATION:
+        onContinuation(id, flags, payload);
+        break;
+    case FRAME_PRIORITY:
+        if (len != 5)
+            throw HTTP2Error(ERR_FRAME_SIZE, "Bad PRIORITY");
+        break;
+    case FRAME_RST_STREAM:
+        if (len != 4)
+            throw HTTP2Error(ERR_FRAME_SIZE, "Bad RST_STREAM");
+        if (id == 0)
+            throw HTTP2Error(ERR_PROTOCOL, "RST_STREAM on stream 0");
+        onReset(id);
+        break;
+    case FRAME_SETTINGS:
+        if (id != 0)
+            throw HTTP2Error(ERR_PROTOCOL, "SETTINGS on a stream");
+        onSettings(flags, payload);
+        break;
+    case FRAME_PUSH_PROMISE:
+        throw HTTP2Error(ERR_PROTOCOL, "PUSH_PROMISE from client");
+    case FRAME_PING:
+        if (len != 8)
+            throw HTTP2Error(ERR_FRAME_SIZE, "Bad PING");
+        if (id != 0)
+            throw HTTP2Error(ERR_PROTOCOL, "PING on a stream");
+        if (!(flags & FLAG_ACK))
+            writeFrame(FRAME_PING, FLAG_ACK, 0, payload);
+        break;
+    case FRAME_GOAWAY:
+        LOG_DEBUG("HTTP/2: GOAWAY received");
+        m_peerGoaway = true;
+        break;
+    case FRAME_WINDOW_UPDATE:
+        onWindowUpdate(id, payload);
+        break;
+    default:
+        // 知らない種類は無視する。
+        break;
+    }
+}
+
+// ------------------------------------
+void HTTP2Connection::onHeaders(unsigned int id, int flags, const std::string& payload)
+{
+    if (id == 0 || id % 2 == 0)
+        throw HTTP2Error(ERR_PROTOCOL, "Bad stream ID for HEADERS");
+
+    m_headerStream = id;
+    m_headerFlags = flags;
+    m_headerBlock = unpad(payload, flags, true);
+    if (flags & FLAG_END_HEADERS)
+        onHeaderBlock();
+    else
+        m_continuing = true;
+}
+
+// ------------------------------------
+void HTTP2Connection::onContinuation(unsigned int id, int flags, const std::string& payload)
+{
+    if (!m_continuing || id != m_headerStream)
+        throw HTTP2Error(ERR_PROTOCOL, "Unexpected CONTINUATION");
+
+    m_headerBlock += payload;
+    if (m_headerBlock.size() > MAX_HEADER_BLOCK)
+        throw HTTP2Error(ERR_ENHANCE_YOUR_CALM, "Header block too large");
+
+    if (flags & FLAG_END_HEADERS)
+    {
+        m_continuing = false;
+        onHeaderBlock();
+    }
+}
+
+// ------------------------------------
+void HTTP2Connection::onHeaderBlock()
+{
+    // 断るストリームのものでも、表を揃えるために必ず復号する。
+    auto headers = m_decoder.decode(m_headerBlock);
+    m_headerBlock.clear();
+
+    const unsigned int id = m_headerStream;
+    const bool endStream = (m_headerFlags & FLAG_END_STREAM) != 0;
+
+    auto it = m_streams.find(id);
+    if (it != m_streams.end())
+    {
+        // トレーラー。中身は使わない。
+        if (it->second.dispatched || !endStream)
+        {
+            writeReset(id, ERR_PROTOCOL);
+            closeStream(it);
+        }else
+            dispatch(id, it->second);
+        return;
+    }
+
+    if (id <= m_lastStreamId)
+        throw HTTP2Error(ERR_STREAM_CLOSED, "HEADERS on a closed stream");
+    m_lastStreamId = id;
+
+    if (m_streams.size() >= MAX_STREAMS)
+    {
+        writeReset(id, ERR_REFUSED_STREAM);
+        return;
+    }
+
+    auto& st = m_streams[id];
+    st.headers = std::move(headers);
+    st.sendWindow = m_initialWindow;
+    if (endStream)
+        dispatch(id, st);
+}
+
+// ------------------------------------
+void HTTP2Connection::onData(unsigned int id, int flags, const std::string& payload)
+{
+    if (id == 0)
+        throw HTTP2Error(ERR_PROTOCOL, "DATA on stream 0");
+
+    // 受信ウィンドウは使った分をすぐに戻す。本体の上限は MAX_BODY で抑える。
+    if (!payload.empty())
+        writeWindowUpdate(0, payload.size());
+
+    auto it = m_streams.find(id);
+    if (it == m_streams.end() || it->second.dispatched)
+    {
+        writeReset(id, ERR_STREAM_CLOSED);
+        return;
+    }
+
+    auto& st = it->second;
+    st.body += unpad(payload, flags, false);
+    if (st.body.size() > MAX_BODY)
+    {
+        writeReset(id, ERR_CANCEL);
+        m_streams.erase(it);
+        return;
+    }
+
+    if (flags & FLAG_END_STREAM)
+        dispatch(id, st);
+    else if (!payload.empty())
+        writeWindowUpdate(id, payload.size());
+}
+
+// ------------------------------------
+void HTTP2Connection::onSettings(int flags, const std::string& payload)
+{
+    if (flags & FLAG_ACK)
+    {
+        if (!payload.empty())
+            throw HTTP2Error(ERR_FRAME_SIZE, "SETTINGS ACK with payload");
+        return;
+    }
+    if (payload.size() % 6 != 0)
+        throw HTTP2Error(ERR_FRAME_SIZE, "Bad SETTINGS");
+
+    for (size_t pos = 0; pos < payload.size(); pos += 6)
+    {
+        const int key = ((unsigned char) payload[pos] << 8) | (unsigned char) payload[pos + 1];
+        const unsigned int value = get32(payload, pos + 2);
+        switch (key)
+        {
+        case SETTINGS_ENABLE_PUSH:
+            if (value > 1)
+                throw HTTP2Error(ERR_PROTOCOL, "Bad SETTINGS_ENABLE_PUSH");
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE:
+            if (value > MAX_WINDOW)
+                throw HTTP2Error(ERR_FLOW_CONTROL, "Bad SETTINGS_INITIAL_WINDOW_SIZE");
+            // 開いているストリームのウィンドウも差の分だけずらす。
+            for (auto& pair : m_streams)
+                pair.second.sendWindow += (long long) value - m_initialWindow;
+            m_initialWindow = value;
+            break;
+        case SETTINGS_MAX_FRAME_SIZE:
+            if (value < MAX_FRAME_SIZE || value > 0xffffff)
+                throw HTTP2Error(ERR_PROTOCOL, "Bad SETTINGS_MAX_FRAME_SIZE");
+            m_peerMaxFrame = value;
+            break;
+        default:
+            // 応答のヘッダーは動的表を使わないので HEADER_TABLE_SIZE も
+            // 気にしなくてよい。
+            break;
+        }
+    }
+    writeFrame(FRAME_SETTINGS, FLAG_ACK, 0, "");
+}
+
+// ------------------------------------
+void HTTP2Connection::onWindowUpdate(unsigned int id, const std::string& payload)
+{
+    if (payload.size() != 4)
+        throw HTTP2Error(ERR_FRAME_SIZE, "Bad WINDOW_UPDATE");
+    const unsigned int increment = get32(payload, 0) & 0x7fffffff;
+    if (increment == 0)
+        throw HTTP2Error(ERR_PROTOCOL, "WINDOW_UPDATE with zero increment");
+
+    if (id == 0)
+    {
+        m_sendWindow += increment;
+        if (m_sendWindow > MAX_WINDOW)
+            throw HTTP2Error(ERR_FLOW_CONTROL, "Connection window overflow");
+        return;
+    }
+
+    auto it = m_streams.find(id);
+    if (it == m_streams.end() || it->second.reset)
+        return;
+    it->second.sendWindow += increment;
+    if (it->second.sendWindow > MAX_WINDOW)
+    {
+        writeReset(id, ERR_FLOW_CONTROL);
+        closeStream(it);
+    }
+}
+
+// ------------------------------------
+// HEADERS と RST_STREAM を繰り返して、応答を待たずにワーカープールに要
+// 求を積ませる相手 (rapid reset, CVE-2023-44487) を止める。
+void HTTP2Connection::onReset(unsigned int id)
+{
+    const double now = sys->getDTime();
+    if (now - m_resetWindowStart >= RESET_WINDOW)
+    {
+        m_resetWindowStart = now;
+        m_numResets = 0;
+    }
+    if (++m_numResets > MAX_RESETS)
+        throw HTTP2Error(ERR_ENHANCE_YOUR_CALM, "Too many RST_STREAM");
+
+    auto it = m_streams.find(id);
+    if (it != m_streams.end())
+        closeStream(it);
+}
+
+// ------------------------------------
+// 要求がまだ走っていれば、終わるまで MAX_STREAMS の枠を空けない。応答
+// は届いても捨てる。
+void HTTP2Connection::closeStream(std::map<unsigned int, StreamState>::iterator it)
+{
+    if (it->second.dispatched && !it->second.responded)
+        it->second.reset = true;
+    else
+        m_streams.erase(it);
+}
+
+// ------------------------------------
+void HTTP2Connection::dispatch(unsigned int id, StreamState& st)
+{
+    st.dispatched = true;
+
+    std::string method, path, authority;
+    HTTPHeaders headers;
+    for (auto& h : st.headers)
+    {
+        if (!h.first.empty() && h.first[0] == ':')
+        {
+            if (h.first == ":method")
+                method = h.second;
+            else if (h.first == ":path")
+                path = h.second;
+            else if (h.first == ":authority")
+                authority = h.second;
+            continue;
+        }
+
+        // 分けて送られた Cookie はつなぎ直す (8.1.2.5 節)。
+        auto prev = headers.get(h.first);
+        if (prev.empty())
+            headers.set(h.first, h.second);
+        else
+            headers.set(h.first, prev + (h.first == "cookie" ? "; " : ", ") + h.second);
+    }
+    st.headers.clear();
+
+    if (method.empty() || path.empty())
+    {
+        writeReset(id, ERR_PROTOCOL);
+        m_streams.erase(id);
+        return;
+    }
+    if (!authority.empty() && headers.get("Host").empty())
+        headers.set("Host", authority);
+
+    HTTPRequest req(method, path, "HTTP/2.0", headers);
+    req.body = std::move(st.body);
+    st.isHead = (method == "HEAD");
+    s_numStreams++;
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_numRunning++;
+    }
+    auto task = [this, id, req]()
+    {
+        auto res = respond(req);
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_done.push_back({ id, res });
+        m_numRunning--;
+        m_cond.notify_all();
+    };
+    if (!m_executor(task))
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_numRunning--;
+        HTTPResponse res(503, {{"Content-Type", "text/plain"}});
+        res.body = "Service unavailable";
+        m_done.push_back({ id, res });
+    }
+}
+
+// ------------------------------------
+HTTPResponse HTTP2Connection::respond(const HTTPRequest& req)
+{
+    try
+    {
+        auto res = m_handler(req);
+        // 本体がストリームなら読み切って長さを付ける。
+        if (res.stream)
+        {
+            char buf[8192];
+            try
+            {
+                while (true)
+                {
+                    int r = res.stream->readSome(buf, sizeof(buf));
+                    if (r <= 0)
+                        break;
+                    res.body.append(buf, r);
+                }
+            }catch (EOFException&)
+            {
+            }
+            res.stream = nullptr;
+        }
+        return res;
+    }catch (HTTPException& e)
+    {
+        HTTPResponse res(e.code, {{"Content-Type", "text/plain"}});
+        res.body = e.msg;
+        return res;
+    }catch (std::exception& e)
+    {
+        LOG_ERROR("HTTP/2: %s %s: %s", req.method.c_str(), req.path.c_str(), e.what());
+        return HTTPResponse::serverError();
+    }
+}
+
+// ------------------------------------
+bool HTTP2Connection::isBusy()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_numRunning > 0 || !m_done.empty();
+}
+
+// ------------------------------------
+void HTTP2Connection::sendResponses()
+{
+    std::deque<std::pair<unsigned int, HTTPResponse>> done;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        done.swap(m_done);
+    }
+
+    for (auto& pair : done)
+    {
+        auto it = m_streams.find(pair.first);
+        if (it == m_streams.end())
+            continue;
+        if (it->second.reset)
+        {
+            m_streams.erase(it);
+            continue;
+        }
+        if (pair.second.statusCode == 0)
+        {
+            writeReset(pair.first, ERR_HTTP_1_1_REQUIRED);
+            m_streams.erase(it);
+            continue;
+        }
+        startResponse(pair.first, it->second, pair.second);
+    }
+
+    // ウィンドウの空いている分だけ本体を送る。
+    for (auto it = m_streams.begin(); it != m_streams.end(); )
+    {
+        if (it->second.responded && sendData(it->first, it->second))
+            it = m_streams.erase(it);
+        else
+            ++it;
+    }
+}
+
+// ------------------------------------
+void HTTP2Connection::startResponse(unsigned int id, StreamState& st, const HTTPResponse& res)
+{
+    hpack::HeaderList headers;
+    headers.push_back({ ":status", std::to_string(res.statusCode) });
+    bool hasLength = false;
+    for (auto& pair : res.headers)
+    {
+        auto name = str::downcase(pair.first);
+        // 接続についてのヘッダーは HTTP/2 では送れない (8.1.2.2 節)。
+        if (name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+            name == "transfer-encoding" || name == "upgrade")
+            continue;
+        if (name == "content-length")
+            hasLength = true;
+        headers.push_back({ name, pair.second });
+    }
+    if (!hasLength && res.statusCode != 204 && res.statusCode != 304)
+        headers.push_back({ "content-length", std::to_string(res.body.size()) });
+
+    if (!st.isHead)
+        st.out = res.body;
+    st.responded = true;
+
+    // 大きなヘッダーブロックは CONTINUATION に分ける。
+    const auto block = m_encoder.encode(headers);
+    const int endStream = st.out.empty() ? FLAG_END_STREAM : 0;
+    size_t pos = 0;
+    do
+    {
+        const size_t n = std::min(block.size() - pos, m_peerMaxFrame);
+        const bool last = (pos + n == block.size());
+        writeFrame(pos == 0 ? FRAME_HEADERS : FRAME_CONTINUATION,
+                   (pos == 0 ? endStream : 0) | (last ? FLAG_END_HEADERS : 0),
+                   id, block.substr(pos, n));
+        pos += n;
+    } while (pos < block.size());
+}
+
+// ------------------------------------
+bool HTTP2Connection::sendData(unsigned int id, StreamState& st)
+{
+    while (st.outPos < st.out.size())
+    {
+        const long long n = std::min({ (long long) (st.out.size() - st.outPos),
+                                       (long long) m_peerMaxFrame, m_sendWindow, st.sendWindow });
+        if (n <= 0)
+            return false;   // WINDOW_UPDATE を待つ
+
+        const bool last = (st.outPos + n == st.out.size());
+        writeFrame(FRAME_DATA, last ? FLAG_END_STREAM : 0, id, st.out.substr(st.outPos, n));
+        st.outPos += n;
+        m_sendWindow -= n;
+        st.sendWindow -= n;
+    }
+    return true;
+}
+
+// ------------------------------------
+void HTTP2Connection::writeFrame(int type, int flags, unsigned int id, const std::string& payload)
+{
+    std::string frame;
+    frame.reserve(9 + payload.size());
+    frame += (char) (payload.size() >> 16);
+    frame += (char) (payload.size() >> 8);
+    frame += (char) payload.size();
+    frame += (char) type;
+    frame += (char) flags;
+    put32(frame, id & 0x7fffffff);
+    frame += payload;
+    m_stream.write(frame.data(), frame.size());
+}
+
+// ------------------------------------
+void HTTP2Connection::writeSettings()
+{
+    std::string payload;
+    payload += (char) 0;
+    payload += (char) SETTINGS_MAX_CONCURRENT_STREAMS;
+    put32(payload, MAX_STREAMS);
+    writeFrame(FRAME_SETTINGS, 0, 0, payload);
+}
+
+// ------------------------------------
+void HTTP2Connection::writeWindowUpdate(unsigned int id, unsigned int increment)
+{
+    std::string payload;
+    put32(payload, increment);
+    writeFrame(FRAME_WINDOW_UPDATE, 0, id, payload);
+}
+
+// ------------------------------------
+void HTTP2Connection::writeReset(unsigned int id, int code)
+{
+    std::string payload;
+    put32(payload, code);
+    writeFrame(FRAME_RST_STREAM, 0, id, payload);
+}
+
+// ------------------------------------
+void HTTP2Connection::writeGoaway(int code)
+{
+    std::string payload;
+    put32(payload, m_lastStreamId);
+    put32(payload, code);
+    writeFrame(FRAME_GOAWAY, 0, 0, payload);
+}
+
+// ------------------------------------
+amf0::Value HTTP2Connection::getState()
+{
+    return amf0::Value::object(
+        {
+            {"numConnections", (int) s_numConnections},
+            {"numStreams", (int) s_numStreams},
+        });
+}
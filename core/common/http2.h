@@ -0,0 +1,194 @@
+// ------------------------------------------------
+// File : http2.h
+// Desc:
+//      管理画面と API のための HTTP/2 (http2 フラグ)。一つの接続で来る
+//      要求をそれぞれハンドシェイクのワーカープールで処理する。TLS で
+//      は ALPN の h2 で、平文では前置き (prior knowledge) で始まる。
+//      ソケットの読み書きは接続のスレッドだけが行い、ワーカーは出来た
+//      応答をキューに置くだけにする (SSL の読み書きを別々のスレッドか
+//      らしないため)。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _HTTP2_H
+#define _HTTP2_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+
+#include "amf0.h"
+#include "hpack.h"
+#include "http.h"
+
+// ------------------------------------
+class HTTP2Connection
+{
+public:
+    enum
+    {
+        MAX_FRAME_SIZE      = 16384,        // 受け付けるフレームの大きさ (既定値のまま)
+        MAX_STREAMS         = 32,           // 同時に処理する要求の数。リセットされても走っている間は数える
+        MAX_RESETS          = 100,          // RESET_WINDOW 秒の間に受け付ける RST_STREAM の数
+        RESET_WINDOW        = 10,
+        MAX_BODY            = 1024 * 1024,  // 要求の本体の上限
+        MAX_HEADER_BLOCK    = 64 * 1024,
+        DEFAULT_WINDOW      = 65535,
+        IDLE_TIMEOUT        = 60 * 1000,    // 要求が無いままこのミリ秒過ぎたら閉じる
+        POLL_INTERVAL       = 5,            // 応答を待つ間、読み込みを見るミリ秒
+    };
+
+    enum FrameType
+    {
+        FRAME_DATA          = 0x0,
+        FRAME_HEADERS       = 0x1,
+        FRAME_PRIORITY      = 0x2,
+        FRAME_RST_STREAM    = 0x3,
+        FRAME_SETTINGS      = 0x4,
+        FRAME_PUSH_PROMISE  = 0x5,
+        FRAME_PING          = 0x6,
+        FRAME_GOAWAY        = 0x7,
+        FRAME_WINDOW_UPDATE = 0x8,
+        FRAME_CONTINUATION  = 0x9,
+    };
+
+    enum FrameFlag
+    {
+        FLAG_END_STREAM     = 0x1,
+        FLAG_ACK            = 0x1,
+        FLAG_END_HEADERS    = 0x4,
+        FLAG_PADDED         = 0x8,
+        FLAG_PRIORITY       = 0x20,
+    };
+
+    enum ErrorCode
+    {
+        ERR_NONE            = 0x0,
+        ERR_PROTOCOL        = 0x1,
+        ERR_INTERNAL        = 0x2,
+        ERR_FLOW_CONTROL    = 0x3,
+        ERR_STREAM_CLOSED   = 0x5,
+        ERR_FRAME_SIZE      = 0x6,
+        ERR_REFUSED_STREAM  = 0x7,
+        ERR_CANCEL          = 0x8,
+        ERR_COMPRESSION     = 0x9,
+        ERR_ENHANCE_YOUR_CALM = 0xb,
+        ERR_HTTP_1_1_REQUIRED = 0xd,
+    };
+
+    enum Setting
+    {
+        SETTINGS_HEADER_TABLE_SIZE      = 0x1,
+        SETTINGS_ENABLE_PUSH            = 0x2,
+        SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+        SETTINGS_INITIAL_WINDOW_SIZE    = 0x4,
+        SETTINGS_MAX_FRAME_SIZE         = 0x5,
+    };
+
+    // 要求から応答を作る。ワーカーのスレッドで呼ばれる。
+    typedef std::function<HTTPResponse(const HTTPRequest&)> Handler;
+    // task をどこかのスレッドで走らせる。走らせられなければ false。
+    typedef std::function<bool(std::function<void()>)> Executor;
+
+    HTTP2Connection(Stream& stream, Handler handler, Executor executor);
+
+    // 前置きの最初の行 ("PRI * HTTP/2.0") か。
+    static bool isPrefaceLine(const char* line);
+
+    // ハンドラーが HTTP/2 で扱えない要求に返す応答。ストリームを
+    // HTTP_1_1_REQUIRED でリセットし、クライアントに HTTP/1.1 でやり直
+    // させる。
+    static HTTPResponse http11Required();
+
+    // 前置きの最初の行を読んだ後から、相手が閉じるか GOAWAY で終わる
+    // まで処理する。戻る時には走らせた要求は全部終わっている。
+    void        run();
+
+    static amf0::Value getState();
+
+private:
+    struct StreamState
+    {
+        hpack::HeaderList headers;
+        std::string body;
+        bool        dispatched = false;
+        bool        isHead = false;
+        bool        responded = false;
+        bool        reset = false;          // 要求が走っている間にリセットされた
+        std::string out;                // 送る本体
+        size_t      outPos = 0;
+        long long   sendWindow = DEFAULT_WINDOW;
+    };
+
+    void        readFrame();
+    void        onHeaders(unsigned int id, int flags, const std::string& payload);
+    void        onContinuation(unsigned int id, int flags, const std::string& payload);
+    void        onHeaderBlock();
+    void        onData(unsigned int id, int flags, const std::string& payload);
+    void        onSettings(int flags, const std::string& payload);
+    void        onWindowUpdate(unsigned int id, const std::string& payload);
+    void        onReset(unsigned int id);
+    void        closeStream(std::map<unsigned int, StreamState>::iterator it);
+    void        dispatch(unsigned int id, StreamState& st);
+    HTTPResponse respond(const HTTPRequest& req);
+
+    bool        isBusy();
+    void        sendResponses();
+    void        startResponse(unsigned int id, StreamState& st, const HTTPResponse& res);
+    bool        sendData(unsigned int id, StreamState& st);   // 送り終えたら true
+
+    void        writeFrame(int type, int flags, unsigned int id, const std::string& payload);
+    void        writeSettings();
+    void        writeWindowUpdate(unsigned int id, unsigned int increment);
+    void        writeReset(unsigned int id, int code);
+    void        writeGoaway(int code);
+
+    Stream&     m_stream;
+    Handler     m_handler;
+    Executor    m_executor;
+
+    hpack::Decoder m_decoder;
+    hpack::Encoder m_encoder;
+
+    std::map<unsigned int, StreamState> m_streams;
+    unsigned int m_lastStreamId;
+    bool        m_peerGoaway;
+
+    // 受け取った RST_STREAM の数。m_resetWindowStart から数える。
+    int         m_numResets;
+    double      m_resetWindowStart;
+
+    // CONTINUATION で続いているヘッダーブロック
+    bool        m_continuing;
+    unsigned int m_headerStream;
+    int         m_headerFlags;
+    std::string m_headerBlock;
+
+    long long   m_sendWindow;           // 接続の送信ウィンドウ
+    long long   m_initialWindow;        // 相手の SETTINGS_INITIAL_WINDOW_SIZE
+    size_t      m_peerMaxFrame;
+
+    // ワーカーとの受け渡し。m_lock で守る。
+    std::mutex  m_lock;
+    std::condition_variable m_cond;
+    std::deque<std::pair<unsigned int, HTTPResponse>> m_done;
+    int         m_numRunning;
+
+    static std::atomic<int> s_numConnections;
+    static std::atomic<unsigned int> s_numStreams;
+};
+
+#endif
@@ -0,0 +1,421 @@
+// ------------------------------------------------
+// File : httpclient.cpp
+// Desc:
+//      プールした接続は、使う前に読めるデータが無いか確かめる。読め
+//      るなら相手が閉じたか余計なものを送ってきたので捨てる。それでも
+//      使い回した接続で失敗した時は、新しい接続で一度だけやり直す。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "httpclient.h"
+#include "sys.h"
+#include "socket.h"
+#include "sslclientsocket.h"
+#include "uri.h"
+#include "str.h"
+#include "defer.h"
+#include "version2.h" // PCX_AGENT
+
+HTTPClient g_httpClient;
+
+// ------------------------------------
+std::string HTTPClient::poolKey(URI& uri)
+{
+    return str::format("%s://%s:%d", uri.scheme().c_str(), str::downcase(uri.host()).c_str(), uri.port());
+}
+
+// ------------------------------------
+HTTPResponse HTTPClient::get(const std::string& _url, const HTTPHeaders& headers)
+{
+    std::string url = _url;
+
+    for (int redirects = 0; ; redirects++)
+    {
+        URI uri(url);
+        if (!uri.isValid())
+            throw ArgumentException(str::format("invalid URL (%s)", url.c_str()));
+        if (uri.scheme() != "http" && uri.scheme() != "https")
+            throw ArgumentException(str::format("unsupported protocol (%s)", url.c_str()));
+
+        HTTPResponse res = fetch(uri, headers);
+        if (res.statusCode != 301 && res.statusCode != 302 && res.statusCode != 307 && res.statusCode != 308)
+            return res;
+
+        const auto loc = res.headers.get("Location");
+        if (loc.empty())
+        {
+            LOG_ERROR("Status code %d. No Location header. Giving up ...", res.statusCode);
+            throw StreamException("No Location header");
+        }
+        if (redirects >= MAX_REDIRECTS)
+            throw StreamException("Too many redirections. Giving up ...");
+
+        LOG_TRACE("Status code %d. Redirecting to %s ...", res.statusCode, loc.c_str());
+        url = loc;
+    }
+}
+
+// ------------------------------------
+std::future<HTTPResponse> HTTPClient::getAsync(const std::string& url, const HTTPHeaders& headers)
+{
+    return std::async(std::launch::async, [this, url, headers]() { return get(url, headers); });
+}
+
+// ------------------------------------
+HTTPResponse HTTPClient::fetch(URI& uri, const HTTPHeaders& headers)
+{
+    const std::string key = poolKey(uri);
+    const std::string path = uri.query().size() ? uri.path() + "?" + uri.query() : uri.path();
+
+    // 一つの write で送れるように、要求をまとめて文字列にする。
+    HTTPHeaders reqHeaders = {
+        { "Host", (uri.port() == URI::defaultPort(uri.scheme())) ? uri.host() : str::format("%s:%d", uri.host().c_str(), uri.port()) },
+        { "Connection", "keep-alive" },
+        { "User-Agent", PCX_AGENT },
+    };
+    if (!acceptEncoding().empty())
+        reqHeaders.set("Accept-Encoding", acceptEncoding());
+    for (const auto& pair : headers)
+        reqHeaders.set(pair.first, pair.second);
+
+    std::string request = str::format("GET %s HTTP/1.1\r\n", path.c_str());
+    for (const auto& pair : reqHeaders)
+        request += str::capitalize(pair.first) + ": " + pair.second + "\r\n";
+    request += "\r\n";
+
+    HTTPResponse res(0, {});
+    for (int attempt = 0; ; attempt++)
+    {
+        bool reused = false;
+        auto sock = acquire(uri, key, reused);
+
+        try
+        {
+            LOG_TRACE("GET %s HTTP/1.1 (%s%s)", path.c_str(), key.c_str(), reused ? ", reused" : "");
+            sock->writeString(request);
+
+            bool keepAlive = false;
+            res = readResponse(*sock, keepAlive);
+            release(key, sock, keepAlive);
+            break;
+        } catch (GeneralException& e)
+        {
+            release(key, sock, false);
+            if (!reused || attempt > 0)
+                throw;
+            LOG_DEBUG("%s: reused connection failed (%s). Retrying ...", key.c_str(), e.msg);
+        }
+    }
+
+    res.body = decode(res.body, res.headers.get("Content-Encoding"));
+    res.headers.m_headers.erase("CONTENT-ENCODING");
+    return res;
+}
+
+// ------------------------------------
+std::shared_ptr<ClientSocket> HTTPClient::acquire(URI& uri, const std::string& key, bool& reused)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+
+        auto& pool = m_pools[key];
+        if (!m_cond.wait_for(lock, std::chrono::milliseconds(READ_TIMEOUT),
+                             [&]() { return pool.active < MAX_ACTIVE_PER_HOST; }))
+            throw StreamException(str::format("%s: too many connections", key.c_str()));
+        pool.active++;
+
+        const unsigned int now = sys->getTime();
+        while (!pool.idle.empty())
+        {
+            auto conn = pool.idle.back();
+            pool.idle.pop_back();
+            if (now - conn.lastUsed >= IDLE_TIMEOUT || conn.sock->readReady(0))
+            {
+                conn.sock->close();
+                continue;
+            }
+            reused = true;
+            return conn.sock;
+        }
+    }
+
+    // 名前の解決と接続はロックの外で。
+    try
+    {
+        Host host;
+        host.fromStrName(uri.host().c_str(), uri.port());
+        if (!host.ip)
+            throw StreamException(str::format("Could not resolve %s", uri.host().c_str()));
+
+        std::shared_ptr<ClientSocket> sock;
+        if (uri.scheme() == "https")
+        {
+            auto ssock = std::make_shared<SslClientSocket>();
+            ssock->setServerName(uri.host());
+            sock = ssock;
+        } else
+            sock = sys->createSocket();
+
+        LOG_TRACE("Connecting to %s (%s) port %d ...", uri.host().c_str(), host.ip.str().c_str(), uri.port());
+        sock->open(host);
+        sock->connect();
+        sock->setReadTimeout(READ_TIMEOUT);
+        sock->setWriteTimeout(WRITE_TIMEOUT);
+        reused = false;
+        return sock;
+    } catch (GeneralException&)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_pools[key].active--;
+        m_cond.notify_all();
+        throw;
+    }
+}
+
+// ------------------------------------
+void HTTPClient::release(const std::string& key, std::shared_ptr<ClientSocket> sock, bool reusable)
+{
+    std::shared_ptr<ClientSocket> dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto& pool = m_pools[key];
+        pool.active--;
+
+        if (reusable)
+        {
+            pool.idle.push_back({ sock, sys->getTime() });
+            if (pool.idle.size() > MAX_IDLE_PER_HOST)
+            {
+                dropped = pool.idle.front().sock;
+                pool.idle.erase(pool.idle.begin());
+            }
+        } else
+            dropped = sock;
+        m_cond.notify_all();
+    }
+
+    if (dropped)
+        dropped->close();
+}
+
+// ------------------------------------
+void HTTPClient::closeIdle(unsigned int now)
+{
+    std::vector<std::shared_ptr<ClientSocket>> dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (auto it = m_pools.begin(); it != m_pools.end(); )
+        {
+            auto& idle = it->second.idle;
+            for (auto c = idle.begin(); c != idle.end(); )
+            {
+                if (now - c->lastUsed >= IDLE_TIMEOUT)
+                {
+                    dropped.push_back(c->sock);
+                    c = idle.erase(c);
+                } else
+                    ++c;
+            }
+
+            if (idle.empty() && it->second.active == 0)
+                it = m_pools.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    for (auto& sock : dropped)
+        sock->close();
+}
+
+// ------------------------------------
+void HTTPClient::closeAll()
+{
+    closeIdle(sys->getTime() + IDLE_TIMEOUT);
+}
+
+// ------------------------------------
+size_t HTTPClient::numIdle()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    size_t n = 0;
+    for (auto& pair : m_pools)
+        n += pair.second.idle.size();
+    return n;
+}
+
+// ------------------------------------
+static std::string readChunked(Stream& s)
+{
+    std::string body;
+    while (true)
+    {
+        // 拡張 (";" 以降) は読み捨てる。
+        auto line = s.readLine(1024);
+        auto size = strtoul(line.c_str(), nullptr, 16);
+        if (line.empty() || !isxdigit((unsigned char) line[0]))
+            throw StreamException("Protocol error: bad chunk size");
+        if (size == 0)
+            break;
+        if (body.size() + size > HTTPClient::MAX_BODY_SIZE)
+            throw StreamException("Response too large");
+
+        body += s.read(size);
+        if (!s.readLine(0).empty())
+            throw StreamException("Protocol error: missing CRLF after chunk");
+    }
+
+    // トレーラーも空行まで読んで捨てる。
+    while (!s.readLine(8192).empty())
+        ;
+    return body;
+}
+
+// ------------------------------------
+HTTPResponse HTTPClient::readResponse(Stream& s, bool& keepAlive)
+{
+    HTTP http(s);
+
+    int status;
+    bool http10;
+    while (true)
+    {
+        status = http.readResponse();
+        // cmdLine はヘッダーを読むと上書きされる。
+        http10 = strncmp(http.cmdLine, "HTTP/1.0", 8) == 0;
+        http.readHeaders();
+        // 100 Continue などの中間応答は飛ばす。
+        if (status < 100 || status >= 200 || status == 101)
+            break;
+        http.reset();
+    }
+
+    keepAlive = http10
+        ? http.headers.hasKeyWithValue("Connection", "keep-alive")
+        : !http.headers.hasKeyWithValue("Connection", "close");
+
+    HTTPResponse res(status, http.headers);
+
+    if (status == 204 || status == 304)
+        return res;
+
+    if (http.headers.hasKeyWithValue("Transfer-Encoding", "chunked"))
+    {
+        res.body = readChunked(s);
+    } else if (!http.headers.get("Content-Length").empty())
+    {
+        long long length = atoll(http.headers.get("Content-Length").c_str());
+        if (length < 0)
+            throw StreamException("invalid Content-Length value");
+        if (length > MAX_BODY_SIZE)
+            throw StreamException("Response too large");
+        res.body = s.read((int) length);
+    } else
+    {
+        // 長さが分からないので、閉じられるまで読む。
+        keepAlive = false;
+        try
+        {
+            char buf[4096];
+            while (true)
+            {
+                int r = s.readSome(buf, sizeof(buf));
+                res.body.append(buf, r);
+                if (res.body.size() > MAX_BODY_SIZE)
+                    break;
+            }
+        } catch (StreamException&)
+        {
+        }
+        if (res.body.size() > MAX_BODY_SIZE)
+            throw StreamException("Response too large");
+    }
+
+    return res;
+}
+
+#ifdef HAVE_ZLIB
+// ------------------------------------
+static std::string inflateBody(const std::string& in, int windowBits)
+{
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, windowBits) != Z_OK)
+        throw StreamException("inflateInit2 failed");
+    Defer cleanup([&]() { inflateEnd(&z); });
+
+    z.next_in = (Bytef*) in.data();
+    z.avail_in = in.size();
+
+    std::string out;
+    char buf[16384];
+    while (true)
+    {
+        z.next_out = (Bytef*) buf;
+        z.avail_out = sizeof(buf);
+
+        int r = inflate(&z, Z_NO_FLUSH);
+        if (r != Z_OK && r != Z_STREAM_END)
+            throw StreamException(str::format("inflate: %s", z.msg ? z.msg : "truncated data"));
+
+        out.append(buf, sizeof(buf) - z.avail_out);
+        if (out.size() > HTTPClient::MAX_BODY_SIZE)
+            throw StreamException("Response too large");
+        if (r == Z_STREAM_END)
+            return out;
+    }
+}
+#endif
+
+// ------------------------------------
+std::string HTTPClient::decode(const std::string& body, const std::string& _encoding)
+{
+    const std::string encoding = str::downcase(str::strip(_encoding));
+    if (encoding.empty() || encoding == "identity")
+        return body;
+
+#ifdef HAVE_ZLIB
+    // 15 + 32 で zlib と gzip のヘッダーを自動で見分ける。
+    if (encoding == "gzip" || encoding == "x-gzip")
+        return inflateBody(body, 15 + 32);
+    if (encoding == "deflate")
+    {
+        // zlib のヘッダーを付けずに送ってくるサーバーもある。
+        try
+        {
+            return inflateBody(body, 15 + 32);
+        } catch (StreamException&)
+        {
+            return inflateBody(body, -15);
+        }
+    }
+#endif
+
+    throw StreamException(str::format("unsupported Content-Encoding (%s)", encoding.c_str()));
+}
+
+// ------------------------------------
+std::string HTTPClient::acceptEncoding()
+{
+#ifdef HAVE_ZLIB
+    return "gzip, deflate";
+#else
+    return "";
+#endif
+}
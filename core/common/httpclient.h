@@ -0,0 +1,101 @@
+// ------------------------------------------------
+// File : httpclient.h
+// Desc:
+//      外へ出て行く GET (YP の index.txt、バージョン確認など) に使う
+//      HTTP/1.1 クライアント。接続はホストごとにプールして使い回し、
+//      同じホストへ同時に張る接続の数を抑える。zlib があれば gzip と
+//      deflate で圧縮された応答を受け付ける。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _HTTPCLIENT_H
+#define _HTTPCLIENT_H
+
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "http.h"
+
+class ClientSocket;
+class URI;
+
+// ------------------------------------
+class HTTPClient
+{
+public:
+    enum
+    {
+        MAX_IDLE_PER_HOST   = 2,        // プールに残す接続の数
+        MAX_ACTIVE_PER_HOST = 4,        // 同じホストへ同時に使う接続の数
+        IDLE_TIMEOUT        = 30,       // 秒。これより古い接続は閉じる
+        READ_TIMEOUT        = 15000,    // ミリ秒
+        WRITE_TIMEOUT       = 15000,
+        MAX_REDIRECTS       = 1,
+        MAX_BODY_SIZE       = 16 * 1024 * 1024, // 展開した後の大きさも
+    };
+
+    // url を GET して、リダイレクトを辿った後の応答を返す。本文は展開
+    // 済みで、Content-Encoding は取り除いてある。
+    HTTPResponse get(const std::string& url, const HTTPHeaders& headers = {});
+
+    // get を別のスレッドで行う。例外は future の get で投げ直される。
+    std::future<HTTPResponse> getAsync(const std::string& url, const HTTPHeaders& headers = {});
+
+    // now より IDLE_TIMEOUT 秒以上前に使った接続を閉じる。
+    void    closeIdle(unsigned int now);
+    void    closeAll();
+    size_t  numIdle();
+
+    // s から応答を一つ読む。本文は Content-Length、chunked、接続が閉
+    // じるまでのいずれか。keepAlive にはこの後も接続を使えるかが入る。
+    static HTTPResponse readResponse(Stream& s, bool& keepAlive);
+
+    // Content-Encoding の値に従って本文を展開する。扱えない符号化なら
+    // StreamException。
+    static std::string  decode(const std::string& body, const std::string& encoding);
+
+    // 要求に付ける Accept-Encoding。zlib が無ければ空。
+    static std::string  acceptEncoding();
+
+private:
+    struct Connection
+    {
+        std::shared_ptr<ClientSocket> sock;
+        unsigned int lastUsed;
+    };
+
+    struct Pool
+    {
+        std::vector<Connection> idle;   // 後ろが新しい
+        int active = 0;
+    };
+
+    HTTPResponse    fetch(URI& uri, const HTTPHeaders& headers);
+    std::shared_ptr<ClientSocket> acquire(URI& uri, const std::string& key, bool& reused);
+    void            release(const std::string& key, std::shared_ptr<ClientSocket> sock, bool reusable);
+
+    static std::string poolKey(URI& uri);
+
+    std::mutex              m_lock;
+    std::condition_variable m_cond;
+    std::map<std::string, Pool> m_pools;
+};
+
+extern HTTPClient g_httpClient;
+
+#endif
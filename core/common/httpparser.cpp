@@ -0,0 +1,196 @@
+// ------------------------------------------------
+// File : httpparser.cpp
+// Desc:
+//      feed は '\n' を探して一行ずつ片付ける。行の末尾の '\r' は落と
+//      す。これまでの HTTP::nextHeader と同じく、フィールドとして読め
+//      ない行 (行の継続も含む) は飛ばす。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <ctype.h>
+#include <string.h>
+
+#include "httpparser.h"
+
+// ------------------------------------
+bool HTTPHeadParser::Slice::equals(const char* s) const
+{
+    return strlen(s) == size && memcmp(data, s, size) == 0;
+}
+
+// ------------------------------------
+bool HTTPHeadParser::Slice::equalsIgnoreCase(const char* s) const
+{
+    if (strlen(s) != size)
+        return false;
+    for (size_t i = 0; i < size; i++)
+        if (tolower((unsigned char) data[i]) != tolower((unsigned char) s[i]))
+            return false;
+    return true;
+}
+
+// ------------------------------------
+HTTPHeadParser::HTTPHeadParser(bool hasStartLine)
+    : m_hasStartLine(hasStartLine)
+{
+    reset();
+}
+
+// ------------------------------------
+void HTTPHeadParser::reset()
+{
+    m_len = 0;
+    m_lineBegin = 0;
+    m_inStartLine = m_hasStartLine;
+    m_state = S_INCOMPLETE;
+    m_error = nullptr;
+    m_tooLarge = false;
+    m_startLine = { m_buf, 0 };
+    for (auto& p : m_parts)
+        p = { m_buf, 0 };
+    m_numFields = 0;
+}
+
+// ------------------------------------
+void HTTPHeadParser::fail(const char* error, bool tooLarge)
+{
+    m_state = S_ERROR;
+    m_error = error;
+    m_tooLarge = tooLarge;
+}
+
+// ------------------------------------
+size_t HTTPHeadParser::feed(const char* data, size_t len)
+{
+    size_t used = 0;
+
+    while (m_state == S_INCOMPLETE && used < len)
+    {
+        if (m_len == MAX_HEAD_SIZE)
+        {
+            fail("Header too large", true);
+            break;
+        }
+
+        // 空きに入る分だけ写して、その中で行の終わりを探す。
+        size_t n = len - used;
+        if (n > MAX_HEAD_SIZE - m_len)
+            n = MAX_HEAD_SIZE - m_len;
+
+        auto nl = static_cast<const char*>(memchr(data + used, '\n', n));
+        if (nl)
+            n = nl - (data + used) + 1;
+
+        memcpy(m_buf + m_len, data + used, n);
+        m_len += n;
+        used += n;
+
+        if (nl)
+        {
+            size_t end = m_len - 1;
+            if (end > m_lineBegin && m_buf[end - 1] == '\r')
+                end--;
+            if (!endOfLine(m_lineBegin, end))
+                break;
+            m_lineBegin = m_len;
+        }
+    }
+
+    return used;
+}
+
+// ------------------------------------
+// [begin, end) の一行を片付ける。続けて読むなら true。
+bool HTTPHeadParser::endOfLine(size_t begin, size_t end)
+{
+    const char* line = m_buf + begin;
+    const size_t len = end - begin;
+
+    if (m_inStartLine)
+    {
+        m_inStartLine = false;
+        if (len == 0)
+        {
+            fail("Empty start line");
+            return false;
+        }
+        m_startLine = { line, len };
+
+        // 空白で三つに分ける。三つ目は残り全部 (理由句には空白がある)。
+        size_t pos = 0;
+        for (int i = 0; i < 3 && pos < len; i++)
+        {
+            size_t b = pos;
+            if (i < 2)
+                while (pos < len && line[pos] != ' ')
+                    pos++;
+            else
+                pos = len;
+            m_parts[i] = { line + b, pos - b };
+            while (pos < len && line[pos] == ' ')
+                pos++;
+        }
+        return true;
+    }
+
+    if (len == 0)
+    {
+        m_state = S_DONE;
+        return false;
+    }
+
+    if (m_numFields == MAX_FIELDS)
+    {
+        fail("Too many header fields", true);
+        return false;
+    }
+
+    // 行の継続 (obs-fold) も飛ばす。
+    if (line[0] != ' ' && line[0] != '\t' &&
+        parseField(line, len, m_fields[m_numFields]))
+        m_numFields++;
+    return true;
+}
+
+// ------------------------------------
+bool HTTPHeadParser::parseField(const char* line, size_t len, Field& out)
+{
+    auto colon = static_cast<const char*>(memchr(line, ':', len));
+    if (!colon || colon == line)
+        return false;
+
+    const size_t nameLen = colon - line;
+    for (size_t i = 0; i < nameLen; i++)
+        if (line[i] == ' ' || line[i] == '\t')
+            return false;
+
+    const char* v = colon + 1;
+    const char* end = line + len;
+    while (v < end && (*v == ' ' || *v == '\t'))
+        v++;
+    while (end > v && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+        end--;
+
+    out.name = { line, nameLen };
+    out.value = { v, static_cast<size_t>(end - v) };
+    return true;
+}
+
+// ------------------------------------
+HTTPHeadParser::Slice HTTPHeadParser::get(const char* name) const
+{
+    for (int i = 0; i < m_numFields; i++)
+        if (m_fields[i].name.equalsIgnoreCase(name))
+            return m_fields[i].value;
+    return { m_buf, 0 };
+}
@@ -0,0 +1,111 @@
+// ------------------------------------------------
+// File : httpparser.h
+// Desc:
+//      HTTP の開始行とヘッダーを一つの固定長バッファーの上で解釈する。
+//      少しずつ与えてよく、ヘッダーの終わりを越えては読まない。名前と
+//      値はバッファーの中を指す Slice で返すので、解釈の途中で確保は
+//      しない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _HTTPPARSER_H
+#define _HTTPPARSER_H
+
+#include <stddef.h>
+#include <string>
+
+// ------------------------------------
+class HTTPHeadParser
+{
+public:
+    enum
+    {
+        MAX_HEAD_SIZE = 8192,   // 開始行とヘッダーと空行を合わせた大きさ
+        MAX_FIELDS = 64,
+    };
+
+    enum State
+    {
+        S_INCOMPLETE,
+        S_DONE,
+        S_ERROR,
+    };
+
+    // バッファーの中の文字列。次の reset() か feed() まで有効。
+    struct Slice
+    {
+        const char* data;
+        size_t      size;
+
+        bool        empty() const { return size == 0; }
+        std::string str() const { return std::string(data, size); }
+        bool        equals(const char* s) const;
+        bool        equalsIgnoreCase(const char* s) const;
+    };
+
+    struct Field
+    {
+        Slice name;
+        Slice value;
+    };
+
+    // hasStartLine が false なら最初の行からヘッダーとして読む。
+    HTTPHeadParser(bool hasStartLine = true);
+
+    void        reset();
+
+    // len バイトを読ませて、使ったバイト数を返す。ヘッダーの終わりの空
+    // 行に着くか、エラーになったら残りは使わない。
+    size_t      feed(const char* data, size_t len);
+
+    State       state() const { return m_state; }
+    const char* error() const { return m_error; }
+    // 大きさかフィールドの数の制限でエラーになった。
+    bool        tooLarge() const { return m_tooLarge; }
+
+    // 開始行。リクエストなら method target version、レスポンスなら
+    // version status reason の三つに分ける。
+    Slice       startLine() const { return m_startLine; }
+    Slice       startLinePart(int i) const { return m_parts[i]; }
+
+    int         numFields() const { return m_numFields; }
+    const Field& field(int i) const { return m_fields[i]; }
+
+    // 名前が name (大文字小文字は区別しない) の最初のフィールドの値。
+    // 無ければ空。
+    Slice       get(const char* name) const;
+
+    // "Name: value" の一行を解釈する。名前が無いか、名前に空白があれば
+    // false。値の前後の空白は除く。
+    static bool parseField(const char* line, size_t len, Field& out);
+
+private:
+    bool        endOfLine(size_t begin, size_t end);
+    void        fail(const char* error, bool tooLarge = false);
+
+    char        m_buf[MAX_HEAD_SIZE];
+    size_t      m_len;
+    size_t      m_lineBegin;
+    bool        m_hasStartLine;
+    bool        m_inStartLine;
+    State       m_state;
+    const char* m_error;
+    bool        m_tooLarge;
+
+    Slice       m_startLine;
+    Slice       m_parts[3];
+    Field       m_fields[MAX_FIELDS];
+    int         m_numFields;
+};
+
+#endif
@@ -18,6 +18,10 @@ void HTTPPushSource::stream(std::shared_ptr<Channel> ch)
         ch->setStatus(Channel::S_BROADCASTING);
 
         std::shared_ptr<ChannelStream> source = ch->createSource();
+        // 予備に切り替えたのなら、前のソースのヘッダーを引き継ぐ。
+        if (ch->lastSourceStream && source->continueFrom(*ch->lastSourceStream))
+            LOG_INFO("Continuing the stream from the previous source");
+        ch->lastSourceStream = source;
 
         if (m_isChunked)
         {
@@ -0,0 +1,101 @@
+// ------------------------------------------------
+// File : idmap.h
+// Desc:
+//      GnuID をキーにしてオブジェクトを引くための索引。キーのハッシュ
+//      でシャードに分け、シャードごとのロックで守るので、別々の ID
+//      の検索が互いに待たされることがない。シャードの中は FlatHashMap。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+#ifndef _IDMAP_H
+#define _IDMAP_H
+
+#include <memory>
+#include <mutex>
+
+#include "flatmap.h"
+
+// ------------------------------------
+template <typename T>
+class ShardedIDMap
+{
+public:
+    enum { NUM_SHARDS = 16 };
+
+    // id の要素を返す。無ければ nullptr。
+    std::shared_ptr<T> find(const GnuID& id)
+    {
+        auto& s = shard(id);
+        std::lock_guard<std::mutex> cs(s.lock);
+        auto p = s.map.find(id);
+        if (!p)
+            return nullptr;
+        return *p;
+    }
+
+    // id の要素を p にする。既にあれば置き換える。
+    void insert(const GnuID& id, const std::shared_ptr<T>& p)
+    {
+        auto& s = shard(id);
+        std::lock_guard<std::mutex> cs(s.lock);
+        s.map[id] = p;
+    }
+
+    // id の要素が p であれば取り除く。別の要素に置き換わっていれば
+    // そのままにする。
+    void erase(const GnuID& id, const std::shared_ptr<T>& p)
+    {
+        auto& s = shard(id);
+        std::lock_guard<std::mutex> cs(s.lock);
+        auto q = s.map.find(id);
+        if (q && *q == p)
+            s.map.erase(id);
+    }
+
+    void clear()
+    {
+        for (auto& s : m_shards)
+        {
+            std::lock_guard<std::mutex> cs(s.lock);
+            s.map.clear();
+        }
+    }
+
+    size_t size()
+    {
+        size_t n = 0;
+        for (auto& s : m_shards)
+        {
+            std::lock_guard<std::mutex> cs(s.lock);
+            n += s.map.size();
+        }
+        return n;
+    }
+
+private:
+    struct Shard
+    {
+        std::mutex lock;
+        GnuIDFlatMap<std::shared_ptr<T>> map;
+    };
+
+    Shard& shard(const GnuID& id)
+    {
+        // ハッシュ表の中の位置 (先頭 8 バイトから決まる) とかぶらない
+        // ように最後のバイトで分ける。
+        return m_shards[id.id[15] % NUM_SHARDS];
+    }
+
+    Shard m_shards[NUM_SHARDS];
+};
+
+#endif
@@ -1,9 +1,23 @@
+#include <cmath>
+#include <fstream>
 #include <iostream>
 #include <string>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
 
 #include "jrpc.h"
 #include "str.h"
 #include "hostgraph.h"
+#include "metrics.h"
+#include "lockprof.h"
+#include "threadacct.h"
+#include "threadclass.h"
+#include "sampleprof.h"
+#include "pkttrace.h"
+#include "statshist.h"
+#include "prefork.h"
 
 using namespace std;
 using json = nlohmann::json;
@@ -23,18 +37,124 @@ static json error_object(int code, const char* message, json id = nullptr, json
     return j;
 }
 
-json JrpcApi::call_internal(const string& input)
+// ------------------------------------
+// 視聴ソフトやダッシュボードが毎秒問い合わせてくる一覧系のメソッドは、
+// 結果を直列化した文字列を一定時間共有して、ロックを取って JSON を組
+// み立て直す回数を間隔あたり一回に抑える。状態を変えるメソッドが呼ば
+// れたら捨てる。
+static const std::set<std::string> s_snapshotMethods = {
+    "getChannels", "getChannelsFound", "getYPChannels", "getChannelConnections",
+    "searchYPChannels", "getConnections",
+};
+
+static const std::set<std::string> s_mutatingMethods = {
+    "bumpChannel", "playChannel", "removeYellowPage", "setChannelInfo",
+    "setPacketBufferDuration", "setSettings", "startRecording", "stopChannel",
+    "stopChannelConnection", "stopRecording",
+};
+
+namespace {
+    struct Snapshot
+    {
+        double time;
+        std::shared_ptr<const std::string> body;
+    };
+
+    // getChannelConnections の引数で際限なく増えないように。
+    enum { MAX_SNAPSHOTS = 64 };
+
+    std::mutex s_snapshotLock;
+    std::map<std::string, Snapshot> s_snapshots;
+}
+
+void JrpcApi::clearSnapshots()
 {
-    json j, id, method, params, result;
+    std::lock_guard<std::mutex> cs(s_snapshotLock);
+    s_snapshots.clear();
+}
+
+std::shared_ptr<const std::string> JrpcApi::snapshot(const std::string& method, const json& params)
+{
+    const double interval = servMgr->jrpcSnapshotInterval / 1000.0;
+    if (interval <= 0)
+        return std::make_shared<std::string>(render(method, params));
+
+    const auto key = method + params.dump();
 
+    // 作り直している間に来た問い合わせは、待ってその結果を使う。
+    std::lock_guard<std::mutex> cs(s_snapshotLock);
+    const double now = sys->getDTime();
+    auto it = s_snapshots.find(key);
+    if (it != s_snapshots.end() && now - it->second.time < interval)
+        return it->second.body;
+
+    auto body = std::make_shared<const std::string>(render(method, params));
+
+    if (it == s_snapshots.end() && s_snapshots.size() >= MAX_SNAPSHOTS)
+    {
+        for (auto jt = s_snapshots.begin(); jt != s_snapshots.end(); )
+        {
+            if (now - jt->second.time >= interval)
+                jt = s_snapshots.erase(jt);
+            else
+                ++jt;
+        }
+        if (s_snapshots.size() >= MAX_SNAPSHOTS)
+            s_snapshots.clear();
+    }
+    s_snapshots[key] = { now, body };
+    return body;
+}
+
+std::string JrpcApi::call(const std::string& input)
+{
     LOG_DEBUG("jrpc request: %s", input.c_str());
 
+    std::string result;
     try {
-        j = json::parse(input);
+        json j = json::parse(input);
+
+        if (j.is_array() && !j.empty())
+        {
+            // バッチ。要求の順に応答を並べる。
+            result = "[";
+            for (size_t i = 0; i < j.size(); i++)
+            {
+                if (i > 0)
+                    result += ",";
+                result += respond(j[i]);
+            }
+            result += "]";
+        }else
+            result = respond(j);
     } catch (json::parse_error&) {
-        return error_object(kParseError, "Parse error");
+        result = error_object(kParseError, "Parse error").dump();
     }
 
+    LOG_DEBUG("jrpc response: %s", str::truncate_utf8(result, 60).c_str());
+
+    return result;
+}
+
+std::string JrpcApi::respond(const json& request)
+{
+    m_snapshot = nullptr;
+    json response = call_internal(request);
+
+    if (!m_snapshot)
+        return response.dump();
+
+    // 直列化済みの結果を埋め込む。キーの並びは dump() と同じ。
+    auto result = "{\"id\":" + response.at("id").dump()
+        + ",\"jsonrpc\":\"2.0\",\"result\":" + *m_snapshot + "}";
+    m_snapshot = nullptr;
+    return result;
+}
+
+json JrpcApi::call_internal(const json& j)
+{
+    json id, method, params, result;
+
     if (!j.is_object() ||
         j.count("jsonrpc") == 0 ||
         j.at("jsonrpc") != "2.0")
@@ -66,8 +186,21 @@ json JrpcApi::call_internal(const string& input)
     }
 
     try {
+        if (method.is_string() && s_snapshotMethods.count(method.get<std::string>()))
+        {
+            m_snapshot = snapshot(method.get<std::string>(), params);
+            return {
+                { "jsonrpc", "2.0" },
+                { "result", nullptr },
+                { "id", id }
+            };
+        }
+
         result = dispatch(method, params);
 
+        if (method.is_string() && s_mutatingMethods.count(method.get<std::string>()))
+            clearSnapshots();
+
         result.dump(); // Check if it can properly be serialized (!).
 
         return {
@@ -100,39 +233,73 @@ json JrpcApi::getLog(json::array_t args)
     if (!from.is_null() && from.get<int>() < 0)     throw invalid_params("from must be non negative");
     if (!from.is_null() && maxLines.get<int>() < 0) throw invalid_params("maxLines must be non negative");
 
-    std::vector<string> lines =
-        sys->logBuf->toLines([](unsigned int time, LogBuffer::TYPE type, const char* line)
-                             {
-                                 std::string buf;
-
-                                 if (type != LogBuffer::T_NONE)
-                                 {
-                                     buf += str::rstrip(String().setFromTime(time));
-                                     buf += " [";
-                                     buf += LogBuffer::getTypeStr(type);
-                                     buf += "] ";
-                                 }
-
-                                 buf += line;
-
-                                 return buf;
-                             });
-    lines.push_back("");
+    // 残っている行のうち from 番目から。末尾の空行は log を改行で終わ
+    // らせるためのもの。
+    uint64_t first, end;
+    sys->logBuf->range(first, end);
 
     if (from == nullptr)
         from = 0;
-    lines.erase(lines.begin(), lines.begin() + (std::min)(from.get<size_t>(), lines.size()));
+    const size_t n = end - first;
+    const size_t max = (maxLines == nullptr) ? n + 1 : maxLines.get<size_t>();
 
-    if (maxLines == nullptr)
-        maxLines = lines.size();
-    while (lines.size() > (size_t)maxLines)
-        lines.pop_back();
+    std::vector<string> lines;
+    for (auto& l : sys->logBuf->linesFrom(first + from.get<size_t>(), max))
+        lines.push_back(LogBuffer::lineRendererText(l.time, l.type, l.text.c_str()));
+    if (from.get<size_t>() <= n && lines.size() < max)
+        lines.push_back("");
 
     auto log = str::join("\n", lines);
 
     return { { "from", from.get<int>() }, { "lines", lines.size() }, { "log", log} };
 }
 
+// cursor より新しいログの行を、整形して最大 maxLines 行返す。cursor
+// が null なら残っている全部。返した cursor を次に渡すと続きが得られ
+// る。dropped は取りに来るまでに消えた行の数。
+json JrpcApi::getLogLines(json::array_t args)
+{
+    json cursor = args[0];
+    json maxLines = args[1];
+
+    if (!cursor.is_null() && cursor.get<int64_t>() < 0)     throw invalid_params("cursor must be non negative");
+    if (!maxLines.is_null() && maxLines.get<int64_t>() < 0) throw invalid_params("maxLines must be non negative");
+
+    uint64_t first, end;
+    sys->logBuf->range(first, end);
+
+    uint64_t seq = cursor.is_null() ? first : cursor.get<uint64_t>();
+    // 再起動などで cursor が先に進みすぎていれば最初から。
+    if (seq > end)
+        seq = first;
+    const uint64_t dropped = (seq < first) ? first - seq : 0;
+    const size_t max = maxLines.is_null() ? SIZE_MAX : maxLines.get<size_t>();
+
+    json lines = json::array();
+    uint64_t next = std::max(seq, first);
+    for (auto& l : sys->logBuf->linesFrom(seq, max))
+    {
+        lines.push_back(LogBuffer::lineRendererText(l.time, l.type, l.text.c_str()));
+        next = l.seq + 1;
+    }
+
+    return { { "cursor", next }, { "dropped", dropped }, { "lines", lines } };
+}
+
+// lifetime 秒の間だけ使える視聴用のトークン。ストリームの URL に
+// ?auth=<auth>&expires=<expires> を付けて使う。
+json JrpcApi::createAuthToken(json::array_t args)
+{
+    GnuID id(args[0].get<std::string>());
+    json lifetime = args[1];
+
+    if (!lifetime.is_number_integer() || lifetime.get<int64_t>() <= 0)
+        throw invalid_params("lifetime must be a positive integer");
+
+    const unsigned int expires = sys->getTime() + (unsigned int) std::min<int64_t>(lifetime.get<int64_t>(), 365 * 24 * 3600);
+    return { { "auth", chanMgr->expiringAuthToken(id, expires) }, { "expires", expires } };
+}
+
 json JrpcApi::clearLog(json::array_t args)
 {
     sys->logBuf->clear();
@@ -185,28 +352,49 @@ json JrpcApi::toPositionalArguments(json named_params, std::vector<std::string>
 // invalid_params 例外、メソッドが存在しない場合は
 // method_not_found 例外を上げる。
 json JrpcApi::dispatch(const json& m, const json& p)
+{
+    const entry& info = findMethod(m);
+    return (this->*(info.method))(positionalArguments(info, p));
+}
+
+const JrpcApi::entry& JrpcApi::findMethod(const json& m)
 {
     for (size_t i = 0; i < m_methods.size(); i++)
     {
-        entry& info = m_methods[i];
+        if (m == m_methods[i].name)
+            return m_methods[i];
+    }
+    throw method_not_found(m.get<std::string>());
+}
 
-        if (m != info.name)
-            continue;
+json JrpcApi::positionalArguments(const entry& info, const json& p)
+{
+    json arguments;
+    if (p.is_array())
+        arguments = p;
+    else if (p.is_object())
+        arguments = toPositionalArguments(p, info.parameter_names);
+    else if (info.parameter_names.size() == 0 && p.is_null())
+        arguments = json::array();
+
+    if (arguments.size() != info.parameter_names.size())
+        throw invalid_params("Wrong number of arguments");
+
+    return arguments;
+}
 
-        json arguments;
-        if (p.is_array())
-            arguments = p;
-        else if (p.is_object())
-            arguments = toPositionalArguments(p, info.parameter_names);
-        else if (info.parameter_names.size() == 0 && p.is_null())
-            arguments = json::array();
+std::string JrpcApi::render(const std::string& method, const json& params)
+{
+    auto it = m_writerMethods.find(method);
+    if (it == m_writerMethods.end())
+        return dispatch(method, params).dump();
 
-        if (arguments.size() != info.parameter_names.size())
-            throw invalid_params("Wrong number of arguments");
+    json arguments = positionalArguments(findMethod(method), params);
 
-        return (this->*(info.method))(arguments);
-    }
-    throw method_not_found(m.get<std::string>());
+    std::string out;
+    JsonWriter w(out);
+    (this->*(it->second))(w, arguments);
+    return out;
 }
 
 json JrpcApi::fetch(json::array_t params)
@@ -256,6 +444,215 @@ json JrpcApi::fetch(json::array_t params)
     }
 }
 
+// 遅延のヒストグラム。値はどれも秒。
+json JrpcApi::getLatencyHistograms(json::array_t)
+{
+    json result = json::object();
+
+    for (auto& h : g_metrics.histograms())
+    {
+        auto& hist = *h.histogram;
+        result[h.key] = {
+            { "bounds", hist.bounds() },
+            { "counts", hist.counts() },
+            { "count", hist.count() },
+            { "sum", hist.sum() },
+            { "p50", hist.quantile(0.5) },
+            { "p90", hist.quantile(0.9) },
+            { "p99", hist.quantile(0.99) },
+        };
+    }
+
+    return result;
+}
+
+// lockProfiling フラグを立てている間に数えたロックの待ち時間。待ち時間
+// の長い順。
+json JrpcApi::getLockProfile(json::array_t)
+{
+    json locks = json::array();
+
+    for (auto& r : LockProfiler::report())
+    {
+        json sites = json::array();
+        for (auto& s : r.sites)
+            sites.push_back({
+                    { "function", s.function },
+                    { "count", s.count },
+                    { "waitSeconds", s.waitSeconds },
+                });
+
+        locks.push_back({
+                { "name", r.name },
+                { "acquisitions", r.acquisitions },
+                { "contended", r.contended },
+                { "waitSeconds", r.waitSeconds },
+                { "maxWaitSeconds", r.maxWaitSeconds },
+                { "holdSeconds", r.holdSeconds },
+                { "maxHoldSeconds", r.maxHoldSeconds },
+                { "sites", sites },
+            });
+    }
+
+    return {
+        { "available", LockProfiler::available() },
+        { "enabled", LockProfiler::enabled() },
+        { "locks", locks },
+    };
+}
+
+json JrpcApi::resetLockProfile(json::array_t)
+{
+    LockProfiler::reset();
+    return nullptr;
+}
+
+// seconds 秒 (既定 30)、CPU 時間 1 秒あたり hz 回 (既定 99) スタック
+// の標本を取る。結果は終わってから getProfile で読む。
+json JrpcApi::startProfiler(json::array_t args)
+{
+    int seconds = args[0].is_null() ? 30 : args[0].get<int>();
+    int hz = args[1].is_null() ? (int) SamplingProfiler::DEFAULT_HZ : args[1].get<int>();
+
+    std::string error;
+    if (!g_samplingProfiler.start(seconds, hz, error))
+        throw application_error(kUnknownError, error);
+    return nullptr;
+}
+
+json JrpcApi::stopProfiler(json::array_t)
+{
+    g_samplingProfiler.stop();
+    return nullptr;
+}
+
+// 最後に取った標本。collapsed は flamegraph.pl などに渡せる畳んだスタッ
+// クで、動いている間は空。
+json JrpcApi::getProfile(json::array_t)
+{
+    auto s = g_samplingProfiler.status();
+    return {
+        { "available", SamplingProfiler::available() },
+        { "running", s.running },
+        { "hz", s.hz },
+        { "seconds", s.seconds },
+        { "elapsed", s.elapsed },
+        { "samples", s.samples },
+        { "dropped", s.dropped },
+        { "collapsed", g_samplingProfiler.collapsed() },
+    };
+}
+
+// packetTracing で印を付けたパケットの、このノードでの記録。古い順。
+// time は UNIX 時刻のミリ秒の下位 32 ビット、age はミリ秒、residence
+// と upstreamResidence はマイクロ秒。
+json JrpcApi::getPacketTraces(json::array_t)
+{
+    json events = json::array();
+
+    for (auto& e : g_packetTracer.events(GnuID()))
+    {
+        events.push_back({
+                { "kind", PacketTracer::kindName(e.kind) },
+                { "channelId", e.chanID.str() },
+                { "traceId", e.traceID },
+                { "pos", e.pos },
+                { "hops", e.hops },
+                { "time", e.time },
+                { "age", e.age },
+                { "upstreamResidence", e.upstreamResidence },
+                { "residence", e.residence },
+                { "peer", e.peer },
+            });
+    }
+
+    return {
+        { "enabled", static_cast<bool>(servMgr->flags[ServMgr::F_packetTracing]) },
+        { "events", events },
+    };
+}
+
+// 統計の履歴。channelId が null ならノードの帯域。resolution は
+// "second" (10 分) か "minute" (24 時間)。値は start から interval
+// 秒おきで、記録の無い時刻は null。
+json JrpcApi::getStatsHistory(json::array_t args)
+{
+    GnuID id;
+    if (!args[0].is_null())
+        id = GnuID(args[0].get<std::string>());
+
+    TimeSeries::Resolution res;
+    if (args[1].is_null() || args[1] == "second")
+        res = TimeSeries::R_SECOND;
+    else if (args[1] == "minute")
+        res = TimeSeries::R_MINUTE;
+    else
+        throw invalid_params("resolution must be either \"second\" or \"minute\"");
+
+    auto series = g_statsHistory.query(id, res);
+    if (series.empty())
+        throw application_error(kChannelNotFound, "Channel not found");
+
+    json result = json::object();
+    for (auto& s : series)
+    {
+        json values = json::array();
+        for (float v : s.second.values)
+        {
+            if (std::isnan(v))
+                values.push_back(nullptr);
+            else
+                values.push_back(v);
+        }
+
+        result[s.first] = {
+            { "start", s.second.start },
+            { "interval", s.second.interval },
+            { "values", values },
+        };
+    }
+    return result;
+}
+
+// 動いているスレッドの CPU 時間と確保したメモリの量。CPU 時間の長い順。
+// cpuSeconds が負ならそのプラットフォームでは分からない。classes はスレッ
+// ドの種類ごとの優先度と CPU の設定。
+json JrpcApi::getThreadStats(json::array_t)
+{
+    json threads = json::array();
+    const unsigned int now = sys->getTime();
+
+    for (auto& s : ThreadAccount::all())
+    {
+        threads.push_back({
+                { "name", s.name },
+                { "id", s.id },
+                { "class", s.threadClass },
+                { "cpuSeconds", s.cpuSeconds },
+                { "allocations", s.allocations },
+                { "allocatedBytes", s.allocatedBytes },
+                { "uptime", now - s.startTime },
+            });
+    }
+
+    json classes = json::object();
+    for (int i = 0; i < ThreadClass::NUM_TYPES; i++)
+    {
+        auto t = (ThreadClass::TYPE) i;
+        auto s = ThreadClass::setting(t);
+        classes[ThreadClass::name(t)] = {
+            { "priority", s.priority },
+            { "affinity", s.affinity },
+        };
+    }
+
+    return {
+        { "allocationCounting", ThreadAccount::allocationCountingAvailable() },
+        { "classes", classes },
+        { "threads", threads },
+    };
+}
+
 json JrpcApi::getVersionInfo(json::array_t)
 {
     return {
@@ -276,28 +673,60 @@ json JrpcApi::to_json(GnuID id)
 json JrpcApi::to_json(ChanInfo& info)
 {
     return {
-        {"name", valid_utf8(info.name)},
-        {"url", valid_utf8(info.url)},
-        {"genre", valid_utf8(info.genre)},
-        {"desc", valid_utf8(info.desc)},
-        {"comment", valid_utf8(info.comment)},
+        {"name", valid_utf8(info.name.str())},
+        {"url", valid_utf8(info.url.str())},
+        {"genre", valid_utf8(info.genre.str())},
+        {"desc", valid_utf8(info.desc.str())},
+        {"comment", valid_utf8(info.comment.str())},
         {"bitrate", info.bitrate},
         {"contentType", info.getTypeStr()}, //?
-        {"mimeType", info.getMIMEType()}
+        {"mimeType", info.getMIMEType()},
+        {"lowLatency", info.lowLatency},
+        {"groupId", info.groupID.isSet() ? info.groupID.str() : ""},
+        {"rendition", valid_utf8(info.rendition.str())}
     };
 }
 
 json JrpcApi::to_json(TrackInfo& track)
 {
     return {
-        {"name", valid_utf8(track.title)},
-        {"genre", valid_utf8(track.genre)},
-        {"album", valid_utf8(track.album)},
-        {"creator", valid_utf8(track.artist)},
-        {"url", valid_utf8(track.contact)}
+        {"name", valid_utf8(track.title.str())},
+        {"genre", valid_utf8(track.genre.str())},
+        {"album", valid_utf8(track.album.str())},
+        {"creator", valid_utf8(track.artist.str())},
+        {"url", valid_utf8(track.contact.str())}
     };
 }
 
+// JsonWriter に書く版。キーは dump() と同じくキーの順に並べる。
+void JrpcApi::write(JsonWriter& w, ChanInfo& info)
+{
+    w.beginObject()
+        .member("bitrate", info.bitrate)
+        .member("comment", valid_utf8(info.comment.str()))
+        .member("contentType", info.getTypeStr())
+        .member("desc", valid_utf8(info.desc.str()))
+        .member("genre", valid_utf8(info.genre.str()))
+        .member("groupId", info.groupID.isSet() ? info.groupID.str() : "")
+        .member("lowLatency", info.lowLatency)
+        .member("mimeType", info.getMIMEType())
+        .member("name", valid_utf8(info.name.str()))
+        .member("rendition", valid_utf8(info.rendition.str()))
+        .member("url", valid_utf8(info.url.str()))
+        .endObject();
+}
+
+void JrpcApi::write(JsonWriter& w, TrackInfo& track)
+{
+    w.beginObject()
+        .member("album", valid_utf8(track.album.str()))
+        .member("creator", valid_utf8(track.artist.str()))
+        .member("genre", valid_utf8(track.genre.str()))
+        .member("name", valid_utf8(track.title.str()))
+        .member("url", valid_utf8(track.contact.str()))
+        .endObject();
+}
+
 json JrpcApi::to_json(Channel::IP_VERSION ipVersion)
 {
     switch (ipVersion)
@@ -369,6 +798,38 @@ json JrpcApi::channelStatus(std::shared_ptr<Channel> c)
     };
 }
 
+void JrpcApi::writeChannelStatus(JsonWriter& w, std::shared_ptr<Channel> c)
+{
+    w.beginObject()
+        .member("isBroadcasting", c->isBroadcasting())
+        .member("isDirectFull", nullptr)
+        .member("isReceiving", c->isReceiving())
+        .member("isRelayFull", c->isFull())
+        .member("localDirects", c->localListeners())
+        .member("localRelays", c->localRelays())
+        .member("network", to_json(c->ipVersion))
+        .member("source", sourceUri(c))
+        .member("status", to_json(c->status))
+        .member("totalDirects", c->totalListeners())
+        .member("totalRelays", c->totalRelays())
+        .member("uptime", c->info.getUptime())
+        .endObject();
+}
+
+void JrpcApi::write(JsonWriter& w, std::shared_ptr<Channel> c)
+{
+    w.beginObject()
+        .member("channelId", c->info.id.str());
+    w.key("info");
+    write(w, c->info);
+    w.key("status");
+    writeChannelStatus(w, c);
+    w.key("track");
+    write(w, c->info.track);
+    w.key("yellowPages").beginArray().endArray();
+    w.endObject();
+}
+
 json JrpcApi::to_json(std::shared_ptr<Channel> c)
 {
     return {
@@ -388,7 +849,7 @@ json JrpcApi::stopChannelConnection(json::array_t params)
     int connectionId = params[1].get<int>();
     bool success = false;
 
-    std::lock_guard<std::recursive_mutex> cs(servMgr->lock);
+    std::lock_guard<ProfiledMutex> cs(servMgr->lock);
     for (Servent* s = servMgr->servents; s != nullptr; s = s->next)
     {
          if (s->serventIndex == connectionId &&
@@ -471,7 +932,7 @@ json JrpcApi::getChannelConnections(json::array_t params)
 
     result.push_back(toSourceConnection(c));
 
-    std::lock_guard<std::recursive_mutex> cs(servMgr->lock);
+    std::lock_guard<ProfiledMutex> cs(servMgr->lock);
     for (Servent* s = servMgr->servents; s != nullptr; s = s->next)
     {
         if (!s->chanID.isSame(id))
@@ -483,6 +944,197 @@ json JrpcApi::getChannelConnections(json::array_t params)
     return result;
 }
 
+namespace {
+    // servMgr->lock を取っている間に写し取る接続の情報。JSON にするの
+    // はロックを放してから。
+    struct ConnectionRow
+    {
+        int          connectionId;
+        GnuID        chanID;
+        std::string  type;
+        std::string  status;
+        std::string  protocolName;
+        std::string  agentName;
+        std::string  remoteEndPoint;    // 空ならソケットが無い
+        unsigned int sendRate;
+        unsigned int recvRate;
+    };
+
+    json toJson(const ConnectionRow& r)
+    {
+        json remoteEndPoint = r.remoteEndPoint.empty() ? json(nullptr) : json(r.remoteEndPoint);
+        return {
+            { "connectionId", r.connectionId },
+            { "channelId", r.chanID.isSet() ? json(r.chanID.str()) : json(nullptr) },
+            { "type", r.type },
+            { "status", r.status },
+            { "sendRate", r.sendRate },
+            { "recvRate", r.recvRate },
+            { "protocolName", r.protocolName },
+            { "agentName", r.agentName },
+            { "remoteEndPoint", remoteEndPoint },
+            { "remoteName", remoteEndPoint },
+        };
+    }
+}
+
+// 全ての接続から絞り込んだ一部、または数と速度の集計。引数は全て省
+// 略できる。ロックの間は条件に合うかを見て、返す範囲の分だけを写す。
+json JrpcApi::getConnections(json::array_t params)
+{
+    GnuID chanID;
+    std::string type, status;
+    int offset = 0, limit = 0;
+    bool summary = false;
+    try
+    {
+        if (!params[0].is_null()) chanID  = params[0].get<std::string>();
+        if (!params[1].is_null()) type    = params[1].get<std::string>();
+        if (!params[2].is_null()) status  = params[2].get<std::string>();
+        if (!params[3].is_null()) offset  = params[3].get<int>();
+        if (!params[4].is_null()) limit   = params[4].get<int>();
+        if (!params[5].is_null()) summary = params[5].get<bool>();
+    } catch (std::exception& e)
+    {
+        throw invalid_params(e.what());
+    }
+    if (offset < 0) throw invalid_params("offset must be non negative");
+    if (limit < 0)  throw invalid_params("limit must be non negative");
+
+    int total = 0;
+    std::vector<ConnectionRow> rows;
+    std::map<std::string, int> types, statuses;
+    unsigned int sendRate = 0, recvRate = 0;
+    {
+        std::lock_guard<ProfiledMutex> cs(servMgr->lock);
+        for (Servent* s = servMgr->servents; s != nullptr; s = s->next)
+        {
+            if (s->status == Servent::S_FREE)
+                continue;
+            if (chanID.isSet() && !s->chanID.isSame(chanID))
+                continue;
+            const std::string t = str::downcase(s->getTypeStr());
+            if (!type.empty() && t != type)
+                continue;
+            if (!status.empty() && status != s->getStatusStr())
+                continue;
+
+            const unsigned int in = s->sock ? s->sock->bytesInPerSec() : 0;
+            const unsigned int out = s->sock ? s->sock->bytesOutPerSec() : 0;
+            if (summary)
+            {
+                types[t]++;
+                statuses[s->getStatusStr()]++;
+                sendRate += out;
+                recvRate += in;
+            }else if (total >= offset && (limit == 0 || total < offset + limit))
+            {
+                rows.push_back({ s->serventIndex, s->chanID, t, s->getStatusStr(),
+                                 ChanInfo::getProtocolStr(s->outputProtocol), s->agent.cstr(),
+                                 s->sock ? (std::string) s->sock->host : "",
+                                 out, in });
+            }
+            total++;
+        }
+    }
+
+    if (summary)
+        return {
+            { "total", total },
+            { "types", types },
+            { "statuses", statuses },
+            { "sendRate", sendRate },
+            { "recvRate", recvRate },
+        };
+
+    json connections = json::array();
+    for (auto& r : rows)
+        connections.push_back(toJson(r));
+    return {
+        { "total", total },
+        { "offset", offset },
+        { "connections", connections },
+    };
+}
+
+void JrpcApi::writeConnection(JsonWriter& w, Servent* s)
+{
+    unsigned int bytesInPerSec = s->sock ? s->sock->bytesInPerSec() : 0;
+    unsigned int bytesOutPerSec = s->sock ? s->sock->bytesOutPerSec() : 0;
+
+    w.beginObject()
+        .member("agentName", s->agent.cstr())
+        .member("connectionId", s->serventIndex)
+        .member("contentPosition", nullptr)
+        .member("localDirects", nullptr)
+        .member("localRelays", nullptr)
+        .member("protocolName", ChanInfo::getProtocolStr(s->outputProtocol));
+    w.member("recvRate", bytesInPerSec);
+    w.key("remoteEndPoint");
+    if (s->sock)
+        w.value((std::string) s->sock->host);
+    else
+        w.value(nullptr);
+    w.key("remoteHostStatus").beginArray().endArray();
+    w.key("remoteName");
+    if (s->sock)
+        w.value((std::string) s->sock->host);
+    else
+        w.value(nullptr);
+    w.member("sendRate", bytesOutPerSec)
+        .member("status", s->getStatusStr())
+        .member("type", str::downcase(s->getTypeStr()))
+        .endObject();
+}
+
+void JrpcApi::writeSourceConnection(JsonWriter& w, std::shared_ptr<Channel> c)
+{
+    w.beginObject()
+        .member("agentName", nullptr)
+        .member("connectionId", -1)
+        .member("contentPosition", c->streamPos)
+        .member("localDirects", nullptr)
+        .member("localRelays", nullptr)
+        .member("protocolName", ChanInfo::getProtocolStr(c->info.srcProtocol))
+        .member("recvRate", c->sourceData ? c->sourceData->getSourceRate() : 0);
+    w.key("remoteEndPoint");
+    if (c->sock)
+        w.value((std::string) c->sock->host);
+    else
+        w.value(nullptr);
+    w.key("remoteHostStatus").beginArray().endArray();
+    if (c->sourceURL.isEmpty())
+        w.member("remoteName", (std::string) c->sourceHost.host);
+    else
+        w.member("remoteName", c->sourceURL.cstr());
+    w.member("sendRate", 0.0)
+        .member("status", to_json(c->status))
+        .member("type", "source")
+        .endObject();
+}
+
+void JrpcApi::writeChannelConnections(JsonWriter& w, json::array_t params)
+{
+    GnuID id = params[0].get<std::string>();
+
+    auto c = chanMgr->findChannelByID(id);
+    if (!c)
+        throw application_error(kChannelNotFound, "Channel not found");
+
+    w.beginArray();
+    writeSourceConnection(w, c);
+
+    std::lock_guard<ProfiledMutex> cs(servMgr->lock);
+    for (Servent* s = servMgr->servents; s != nullptr; s = s->next)
+    {
+        if (!s->chanID.isSame(id))
+            continue;
+
+        writeConnection(w, s);
+    }
+    w.endArray();
+}
+
 json JrpcApi::getChannelInfo(json::array_t params)
 {
     GnuID id(params[0].get<std::string>());
@@ -512,19 +1164,73 @@ json JrpcApi::getChannelStatus(json::array_t params)
     return channelStatus(c);
 }
 
+// ワーカーのモードで、ワーカー 0 が他のワーカーの報告から読むチャン
+// ネル。どのワーカーのものかを "worker" に入れる。
+static json workerChannels()
+{
+    json result = json::array();
+    if (!g_prefork.enabled() || !g_prefork.isPrimary())
+        return result;
+
+    for (int i = 1; i < g_prefork.numWorkers(); i++)
+    {
+        auto path = servMgr->workerReportPath(i, "json");
+        std::ifstream input(path);
+        if (input.fail())
+            continue;
+        std::stringstream buf;
+        buf << input.rdbuf();
+        try
+        {
+            for (auto& c : json::parse(buf.str()))
+            {
+                c["worker"] = i;
+                result.push_back(c);
+            }
+        } catch (std::exception& e)
+        {
+            LOG_ERROR("Cannot read %s: %s", path.c_str(), e.what());
+        }
+    }
+    return result;
+}
+
 json JrpcApi::getChannels(json::array_t)
 {
     json result = json::array();
 
-    std::lock_guard<std::recursive_mutex> cs(chanMgr->lock);
-    for (auto c = chanMgr->channel; c != nullptr; c = c->next)
     {
-        result.push_back(to_json(c));
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+        for (auto c = chanMgr->channel; c != nullptr; c = c->next)
+        {
+            result.push_back(to_json(c));
+        }
     }
 
+    for (auto& c : workerChannels())
+        result.push_back(c);
+
     return result;
 }
 
+void JrpcApi::writeChannels(JsonWriter& w, json::array_t)
+{
+    w.beginArray();
+
+    {
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+        for (auto c = chanMgr->channel; c != nullptr; c = c->next)
+        {
+            write(w, c);
+        }
+    }
+
+    for (auto& c : workerChannels())
+        w.value(c);
+
+    w.endArray();
+}
+
 json JrpcApi::to_json(std::shared_ptr<ChanHit> h)
 {
     return {
@@ -563,15 +1269,15 @@ json JrpcApi::to_json(std::shared_ptr<ChanHitList> hitList)
 {
     ChanInfo info = hitList->info;
     return {
-        { "name", valid_utf8(info.name) },
+        { "name", valid_utf8(info.name.str()) },
         { "id",  (std::string) info.id },
         { "bitrate", info.bitrate },
         { "type", info.getTypeStr() },
-        { "genre", valid_utf8(info.genre) },
-        { "desc", valid_utf8(info.desc) },
+        { "genre", valid_utf8(info.genre.str()) },
+        { "desc", valid_utf8(info.desc.str()) },
         { "url", info.url },
         { "uptime", info.getUptime() },
-        { "comment", valid_utf8(info.comment) },
+        { "comment", valid_utf8(info.comment.str()) },
         { "skips", info.numSkips },
         { "age", info.getAge() },
         { "bcflags", info.bcID.getFlags() },
@@ -619,7 +1325,7 @@ json::array_t JrpcApi::announcingChannels()
 {
     json::array_t result;
 
-    std::lock_guard<std::recursive_mutex> cs(chanMgr->lock);
+    std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
     for (auto c = chanMgr->channel; c != nullptr; c = c->next)
     {
         if (!c->isBroadcasting())
@@ -678,6 +1384,12 @@ json JrpcApi::setSettings(json::array_t args)
     // maxDirectsPerChannel は無視。
     servMgr->maxBitrateOut = (int) settings["maxUpstreamRate"];
     // maxUpstreamRatePerChannel は無視。
+    if (settings.count("packetBufferDuration"))
+        chanMgr->packetBufferDuration = (int) settings["packetBufferDuration"];
+    if (settings.count("joinKeyFramesBack"))
+        chanMgr->joinKeyFramesBack = (int) settings["joinKeyFramesBack"];
+    if (settings.count("maxHitsPerChannel"))
+        chanMgr->maxHitsPerChannel = (int) settings["maxHitsPerChannel"];
     // channelCleaner, portMapper は無視。
     return nullptr;
 }
@@ -691,6 +1403,9 @@ json JrpcApi::getSettings(json::array_t)
         { "maxDirectsPerChannel", 0 },
         { "maxUpstreamRate", servMgr->maxBitrateOut },
         { "maxUpstreamRatePerChannel", 0 },
+        { "packetBufferDuration", chanMgr->packetBufferDuration },
+        { "joinKeyFramesBack", chanMgr->joinKeyFramesBack },
+        { "maxHitsPerChannel", chanMgr->maxHitsPerChannel },
         // channelCleaner は無視。
     };
 
@@ -783,6 +1498,8 @@ ChanInfo JrpcApi::mergeChanInfo(const ChanInfo& orig, json::object_t info, json:
     i.genre   = info.at("genre").get<std::string>().c_str();
     i.url     = info.at("url").get<std::string>().c_str();
     i.comment = info.at("comment").get<std::string>().c_str();
+    if (info.count("lowLatency"))
+        i.lowLatency = info.at("lowLatency").get<bool>();
 
     i.track.contact = track.at("url").get<std::string>().c_str();
     i.track.title   = track.at("name").get<std::string>().c_str();
@@ -824,6 +1541,48 @@ json JrpcApi::stopChannel(json::array_t args)
     return nullptr;
 }
 
+// チャンネルのバッファーの秒数を変える。0 なら全体の設定に戻す。キー
+// プしたリレーなら設定と一緒に保存される。
+json JrpcApi::setPacketBufferDuration(json::array_t args)
+{
+    GnuID id = args[0].get<std::string>();
+    int seconds = args[1];
+    if (seconds < 0)
+        throw invalid_params("seconds must not be negative");
+
+    auto ch = chanMgr->findChannelByID(id);
+    if (!ch)
+        throw application_error(kChannelNotFound, "Channel not found");
+
+    ch->packetBufferDuration = seconds;
+    peercastInst->saveSettings();
+
+    return nullptr;
+}
+
+json JrpcApi::startRecording(json::array_t args)
+{
+    GnuID id = args[0].get<std::string>();
+
+    auto ch = chanMgr->findChannelByID(id);
+    if (!ch)
+        throw application_error(kChannelNotFound, "Channel not found");
+
+    return ch->startRecording();
+}
+
+json JrpcApi::stopRecording(json::array_t args)
+{
+    GnuID id = args[0].get<std::string>();
+
+    auto ch = chanMgr->findChannelByID(id);
+    if (!ch)
+        throw application_error(kChannelNotFound, "Channel not found");
+
+    ch->stopRecording();
+    return nullptr;
+}
+
 json JrpcApi::getChannelRelayTree(json::array_t args)
 {
     GnuID id = args[0].get<std::string>();
@@ -855,9 +1614,8 @@ json JrpcApi::getChannelRelayTree(json::array_t args)
                    (ch->ipVersion == 6));
     self.tracker = isTracker;
 
-    HostGraph graph(self, hitList.get());
-
-    return graph.getRelayTree();
+    std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+    return HostGraph::getCachedRelayTree(self, hitList);
 }
 
 json JrpcApi::bumpChannel(json::array_t args)
@@ -890,7 +1648,7 @@ json JrpcApi::playChannel(json::array_t args)
 json JrpcApi::removeYellowPage(json::array_t args)
 {
     if (args[0].get<int>() == 0) {
-        std::lock_guard<std::recursive_mutex> cs(servMgr->lock);
+        std::lock_guard<ProfiledMutex> cs(servMgr->lock);
         servMgr->rootHost.clear();
         return nullptr;
     } else {
@@ -898,33 +1656,103 @@ json JrpcApi::removeYellowPage(json::array_t args)
     }
 }
 
+static json ypChannelToJson(const ChannelEntry& c)
+{
+    return {
+        { "yellowPage",  c.feedUrl },
+        { "name",        c.name },
+        { "channelId",   c.id.str() },
+        { "tracker",     c.tip },
+        { "contactUrl",  c.url },
+        { "genre",       c.genre },
+        { "description", c.desc },
+        { "comment",     c.comment },
+        { "bitrate",     c.bitrate },
+        { "contentType", c.contentTypeStr },
+        { "trackTitle",  c.trackName },
+        { "album",       c.trackAlbum },
+        { "creator",     c.trackArtist },
+        { "trackUrl",    c.trackContact },
+        { "listeners",   c.numDirects },
+        { "relays",      c.numRelays }
+    };
+}
+
 json JrpcApi::getYPChannels(json::array_t args)
 {
     auto channels = servMgr->channelDirectory->channels();
     json::array_t res;
 
     for (auto& c : channels)
+        res.push_back(ypChannelToJson(c));
+    return res;
+}
+
+// 絞り込んで並べ替えた一覧の一部。引数は全て省略できる。
+json JrpcApi::searchYPChannels(json::array_t args)
+{
+    ChannelDirectory::Query q;
+    try
     {
-        res.push_back({
-                { "yellowPage",  c.feedUrl },
-                { "name",        c.name },
-                { "channelId",   c.id.str() },
-                { "tracker",     c.tip },
-                { "contactUrl",  c.url },
-                { "genre",       c.genre },
-                { "description", c.desc },
-                { "comment",     c.comment },
-                { "bitrate",     c.bitrate },
-                { "contentType", c.contentTypeStr },
-                { "trackTitle",  c.trackName },
-                { "album",       c.trackAlbum },
-                { "creator",     c.trackArtist },
-                { "trackUrl",    c.trackContact },
-                { "listeners",   c.numDirects },
-                { "relays",      c.numRelays }
-            });
+        if (!args[0].is_null()) q.text       = args[0].get<std::string>();
+        if (!args[1].is_null()) q.yellowPage = args[1].get<std::string>();
+        if (!args[2].is_null()) q.sort       = args[2].get<std::string>();
+        if (!args[3].is_null()) q.offset     = args[3].get<int>();
+        if (!args[4].is_null()) q.limit      = args[4].get<int>();
+    } catch (json::type_error& e)
+    {
+        throw invalid_params(e.what());
     }
-    return res;
+    if (q.offset < 0) throw invalid_params("offset must be non negative");
+    if (q.limit < 0)  throw invalid_params("limit must be non negative");
+
+    ChannelDirectory::Page page;
+    try
+    {
+        page = servMgr->channelDirectory->query(q);
+    } catch (std::invalid_argument& e)
+    {
+        throw invalid_params(e.what());
+    }
+
+    json::array_t channels;
+    for (auto& c : page.channels)
+        channels.push_back(ypChannelToJson(c));
+
+    return {
+        { "total",    page.total },
+        { "offset",   q.offset },
+        { "channels", channels },
+    };
+}
+
+void JrpcApi::writeYPChannels(JsonWriter& w, json::array_t)
+{
+    auto channels = servMgr->channelDirectory->channels();
+
+    w.beginArray();
+    for (auto& c : channels)
+    {
+        w.beginObject()
+            .member("album",       c.trackAlbum)
+            .member("bitrate",     c.bitrate)
+            .member("channelId",   c.id.str())
+            .member("comment",     c.comment)
+            .member("contactUrl",  c.url)
+            .member("contentType", c.contentTypeStr)
+            .member("creator",     c.trackArtist)
+            .member("description", c.desc)
+            .member("genre",       c.genre)
+            .member("listeners",   c.numDirects)
+            .member("name",        c.name)
+            .member("relays",      c.numRelays)
+            .member("trackTitle",  c.trackName)
+            .member("trackUrl",    c.trackContact)
+            .member("tracker",     c.tip)
+            .member("yellowPage",  c.feedUrl)
+            .endObject();
+    }
+    w.endArray();
 }
 
 json JrpcApi::getYPChannelsInternal(json::array_t args)
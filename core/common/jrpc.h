@@ -6,10 +6,12 @@
 #include "version2.h"
 
 #include <stdarg.h>
+#include <map>
 #include <string>
 #include <vector>
 #include <tuple>
 #include "json.hpp"
+#include "jsonwriter.h"
 #include "chandir.h"
 
 class JrpcApi
@@ -48,19 +50,28 @@ public:
         int m_errno;
     };
 
-    std::string call(const std::string& request)
-    {
-        std::string result = call_internal(request).dump();
-
-        LOG_DEBUG("jrpc response: %s", str::truncate_utf8(result, 60).c_str());
+    // request は要求オブジェクトか、その配列 (バッチ)。バッチには応答
+    // の配列を返す。
+    std::string call(const std::string& request);
 
-        return result;
-    }
+    // スナップショットを全て捨てる。状態を変えるメソッドの後に呼ばれる。
+    static void clearSnapshots();
 
 private:
-    json call_internal(const std::string&);
+    json call_internal(const json& request);
+
+    // 要求オブジェクト一つを処理して、直列化した応答を返す。
+    std::string respond(const json& request);
+
+    // ポーリングされるメソッドの結果を直列化したものを返す。
+    // servMgr->jrpcSnapshotInterval ミリ秒の間は作り直さない。
+    std::shared_ptr<const std::string> snapshot(const std::string& method, const json& params);
+
+    // call_internal がスナップショットを返した時に立つ。
+    std::shared_ptr<const std::string> m_snapshot;
 
     typedef json (JrpcApi::*JrpcMethod)(json::array_t);
+    typedef void (JrpcApi::*JrpcWriterMethod)(JsonWriter&, json::array_t);
 
 public:
     JrpcApi() :
@@ -68,33 +79,55 @@ public:
         ({
             { "bumpChannel",             &JrpcApi::bumpChannel,             { "channelId" } },
             { "clearLog",                &JrpcApi::clearLog,                {} },
+            { "createAuthToken",         &JrpcApi::createAuthToken,         { "channelId", "lifetime" } },
             { "fetch",                   &JrpcApi::fetch,                   { "url", "name", "desc", "genre", "contact", "bitrate", "type", "network" } },
             { "getChannelConnections",   &JrpcApi::getChannelConnections,   { "channelId" } },
             { "getChannelInfo",          &JrpcApi::getChannelInfo,          { "channelId" } },
             { "getChannelRelayTree",     &JrpcApi::getChannelRelayTree,     { "channelId" } },
             { "getChannelStatus",        &JrpcApi::getChannelStatus,        { "channelId" } },
             { "getChannels",             &JrpcApi::getChannels,             {} },
+            { "getConnections",          &JrpcApi::getConnections,          { "channelId", "type", "status", "offset", "limit", "summary" } },
+            { "getLatencyHistograms",    &JrpcApi::getLatencyHistograms,    {} },
+            { "getLockProfile",          &JrpcApi::getLockProfile,          {} },
             { "getLog",                  &JrpcApi::getLog,                  { "from", "maxLines" } },
+            { "getLogLines",             &JrpcApi::getLogLines,             { "cursor", "maxLines" } },
             { "getLogSettings",          &JrpcApi::getLogSettings,          {} },
             { "getNewVersions",          &JrpcApi::getNewVersions,          {} },
             { "getNotificationMessages", &JrpcApi::getNotificationMessages, {} },
+            { "getPacketTraces",         &JrpcApi::getPacketTraces,         {} },
             { "getPlugins",              &JrpcApi::getPlugins,              {} },
+            { "getProfile",              &JrpcApi::getProfile,              {} },
             { "getServerStorageItem",    &JrpcApi::getServerStorageItem,    { "key" } },
             { "getSettings",             &JrpcApi::getSettings,             {} },
             { "getState",                &JrpcApi::getState,                { "objectNames" } },
+            { "getStatsHistory",         &JrpcApi::getStatsHistory,         { "channelId", "resolution" } },
             { "getStatus",               &JrpcApi::getStatus,               {} },
+            { "getThreadStats",          &JrpcApi::getThreadStats,          {} },
             { "getVersionInfo",          &JrpcApi::getVersionInfo,          {} },
             { "getYPChannels",           &JrpcApi::getYPChannels,           {} },
             { "getYellowPageProtocols",  &JrpcApi::getYellowPageProtocols,  {} },
             { "getYellowPages",          &JrpcApi::getYellowPages,          {} },
             { "playChannel",             &JrpcApi::playChannel,   { "channelId" } },
             { "removeYellowPage",        &JrpcApi::removeYellowPage,        { "yellowPageId" } },
+            { "resetLockProfile",        &JrpcApi::resetLockProfile,        {} },
+            { "searchYPChannels",        &JrpcApi::searchYPChannels,        { "text", "yellowPage", "sort", "offset", "limit" } },
             { "setChannelInfo",          &JrpcApi::setChannelInfo,          { "channelId", "info", "track" } },
             { "setLogSettings",          &JrpcApi::setLogSettings,          { "settings" } },
+            { "setPacketBufferDuration", &JrpcApi::setPacketBufferDuration, { "channelId", "seconds" } },
             { "setServerStorageItem",    &JrpcApi::setServerStorageItem,    { "key", "value" } },
             { "setSettings",             &JrpcApi::setSettings,             { "settings" } },
+            { "startProfiler",           &JrpcApi::startProfiler,           { "seconds", "hz" } },
+            { "startRecording",          &JrpcApi::startRecording,          { "channelId" } },
             { "stopChannel",             &JrpcApi::stopChannel,             { "channelId" } },
             { "stopChannelConnection",   &JrpcApi::stopChannelConnection,   { "channelId", "connectionId" } },
+            { "stopProfiler",            &JrpcApi::stopProfiler,            {} },
+            { "stopRecording",           &JrpcApi::stopRecording,           { "channelId" } },
+        }),
+        m_writerMethods
+        ({
+            { "getChannelConnections",   &JrpcApi::writeChannelConnections },
+            { "getChannels",             &JrpcApi::writeChannels },
+            { "getYPChannels",           &JrpcApi::writeYPChannels },
         })
     {
     }
@@ -106,12 +139,23 @@ public:
     } entry;
     std::vector<entry > m_methods;
 
+    // 結果が大きくなる一覧系のメソッドは、木を作らずに JsonWriter で
+    // 書き出す版も持つ。出力は m_methods の版を dump() したものと同じ。
+    std::map<std::string, JrpcWriterMethod> m_writerMethods;
+
+    // method を呼んで結果を直列化する。m_writerMethods にあればそちら
+    // を使う。
+    std::string render(const std::string& method, const json& params);
+
     json::string_t announcingChannelStatus(std::shared_ptr<Channel> c);
     json::array_t announcingChannels();
     json bumpChannel(json::array_t args);
     json channelStatus(std::shared_ptr<Channel> c);
     json clearLog(json::array_t args);
+    json createAuthToken(json::array_t args);
     json dispatch(const json& m, const json& p);
+    const entry& findMethod(const json& m);
+    json positionalArguments(const entry& info, const json& p);
     json fetch(json::array_t params);
     json getChannelConnections(json::array_t params);
     json getChannelInfo(json::array_t params);
@@ -119,14 +163,22 @@ public:
     json getChannelStatus(json::array_t params);
     json getChannels(json::array_t);
     json getChannelsFound(json::array_t);
+    json getConnections(json::array_t params);
+    json getLatencyHistograms(json::array_t);
+    json getLockProfile(json::array_t);
     json getLog(json::array_t args);
+    json getLogLines(json::array_t args);
     json getLogSettings(json::array_t args);
     json getNewVersions(json::array_t);
     json getNotificationMessages(json::array_t);
+    json getPacketTraces(json::array_t);
     json getPlugins(json::array_t);
+    json getProfile(json::array_t);
     json getSettings(json::array_t);
+    json getStatsHistory(json::array_t args);
     json getStatus(json::array_t);
     json getState(json::array_t);
+    json getThreadStats(json::array_t);
     json getServerStorageItem(json::array_t);
     json setServerStorageItem(json::array_t);
     json getVersionInfo(json::array_t);
@@ -138,10 +190,17 @@ public:
     ChanInfo mergeChanInfo(const ChanInfo& orig, json::object_t info, json::object_t track);
     json playChannel(json::array_t);
     json removeYellowPage(json::array_t args);
+    json resetLockProfile(json::array_t);
+    json searchYPChannels(json::array_t args);
     json setChannelInfo(json::array_t args);
     json setLogSettings(json::array_t args);
+    json setPacketBufferDuration(json::array_t args);
     json setSettings(json::array_t args);
+    json startProfiler(json::array_t args);
+    json startRecording(json::array_t args);
     json stopChannel(json::array_t args);
+    json stopProfiler(json::array_t);
+    json stopRecording(json::array_t args);
     json stopChannelConnection(json::array_t params);
     json toConnection(Servent* s);
     json toPositionalArguments(json named_params, std::vector<std::string> names);
@@ -155,6 +214,16 @@ public:
     json to_json(TrackInfo& track);
     json to_json(std::shared_ptr<Channel> c);
     json to_json(Channel::IP_VERSION ipVersion);
+
+    void write(JsonWriter& w, ChanInfo& info);
+    void write(JsonWriter& w, TrackInfo& track);
+    void write(JsonWriter& w, std::shared_ptr<Channel> c);
+    void writeChannelStatus(JsonWriter& w, std::shared_ptr<Channel> c);
+    void writeConnection(JsonWriter& w, Servent* s);
+    void writeSourceConnection(JsonWriter& w, std::shared_ptr<Channel> c);
+    void writeChannelConnections(JsonWriter& w, json::array_t params);
+    void writeChannels(JsonWriter& w, json::array_t);
+    void writeYPChannels(JsonWriter& w, json::array_t);
 };
 
 #endif
@@ -0,0 +1,225 @@
+// ------------------------------------------------
+// File : jsonwriter.cpp
+// Desc:
+//      文字列のエスケープは nlohmann::json の dump() に合わせている。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <cstring>
+#include <stdexcept>
+
+#include "jsonwriter.h"
+#include "str.h"
+
+// ------------------------------------
+JsonWriter::JsonWriter(std::string& out)
+    : m_out(out)
+    , m_afterKey(false)
+{
+}
+
+// ------------------------------------
+// 配列の二つ目からの要素の前にカンマを置く。
+void JsonWriter::separate()
+{
+    if (m_afterKey)
+    {
+        m_afterKey = false;
+        return;
+    }
+    if (m_levels.empty())
+        return;
+    if (m_levels.back())
+        m_levels.back() = false;
+    else
+        m_out += ',';
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::beginObject()
+{
+    separate();
+    m_out += '{';
+    m_levels.push_back(true);
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::endObject()
+{
+    if (m_levels.empty())
+        throw std::logic_error("JsonWriter: unbalanced endObject");
+    m_levels.pop_back();
+    m_out += '}';
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::beginArray()
+{
+    separate();
+    m_out += '[';
+    m_levels.push_back(true);
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::endArray()
+{
+    if (m_levels.empty())
+        throw std::logic_error("JsonWriter: unbalanced endArray");
+    m_levels.pop_back();
+    m_out += ']';
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::key(const char* name)
+{
+    separate();
+    writeString(name, strlen(name));
+    m_out += ':';
+    m_afterKey = true;
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::value(std::nullptr_t)
+{
+    separate();
+    m_out += "null";
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::value(bool b)
+{
+    separate();
+    m_out += b ? "true" : "false";
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::value(int n)
+{
+    separate();
+    m_out += std::to_string(n);
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::value(unsigned int n)
+{
+    separate();
+    m_out += std::to_string(n);
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::value(long n)
+{
+    separate();
+    m_out += std::to_string(n);
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::value(unsigned long n)
+{
+    separate();
+    m_out += std::to_string(n);
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::value(long long n)
+{
+    separate();
+    m_out += std::to_string(n);
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::value(unsigned long long n)
+{
+    separate();
+    m_out += std::to_string(n);
+    return *this;
+}
+
+// ------------------------------------
+// 浮動小数点数の書式は dump() に任せる。
+JsonWriter& JsonWriter::value(double d)
+{
+    separate();
+    m_out += nlohmann::json(d).dump();
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::value(const char* s)
+{
+    separate();
+    writeString(s, strlen(s));
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::value(const std::string& s)
+{
+    separate();
+    writeString(s.data(), s.size());
+    return *this;
+}
+
+// ------------------------------------
+JsonWriter& JsonWriter::value(const nlohmann::json& j)
+{
+    separate();
+    m_out += j.dump();
+    return *this;
+}
+
+// ------------------------------------
+void JsonWriter::writeString(const char* s, size_t len)
+{
+    static const char* hex = "0123456789abcdef";
+
+    if (!str::validate_utf8(s, len))
+        throw std::invalid_argument("JsonWriter: invalid UTF-8 string");
+
+    m_out += '"';
+    for (size_t i = 0; i < len; i++)
+    {
+        const unsigned char c = s[i];
+        switch (c)
+        {
+        case '"':  m_out += "\\\""; break;
+        case '\\': m_out += "\\\\"; break;
+        case '\b': m_out += "\\b"; break;
+        case '\f': m_out += "\\f"; break;
+        case '\n': m_out += "\\n"; break;
+        case '\r': m_out += "\\r"; break;
+        case '\t': m_out += "\\t"; break;
+        default:
+            if (c < 0x20)
+            {
+                m_out += "\\u00";
+                m_out += hex[c >> 4];
+                m_out += hex[c & 0xf];
+            }else
+                m_out += (char) c;
+        }
+    }
+    m_out += '"';
+}
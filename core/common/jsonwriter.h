@@ -0,0 +1,80 @@
+// ------------------------------------------------
+// File : jsonwriter.h
+// Desc:
+//      JSON を文字列に直接書き出す。nlohmann::json の木を組み立ててか
+//      ら dump() する代わりに使う。出力は dump() と同じ書式になるが、
+//      オブジェクトのキーは書いた順に出るので、同じにしたければ呼ぶ側
+//      がキーの順に書く。
+//
+//      文字列が UTF-8 として正しくなければ、dump() と同じく例外を投げ
+//      る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _JSONWRITER_H
+#define _JSONWRITER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+
+// ------------------------------------
+class JsonWriter
+{
+public:
+    JsonWriter(std::string& out);
+
+    JsonWriter& beginObject();
+    JsonWriter& endObject();
+    JsonWriter& beginArray();
+    JsonWriter& endArray();
+
+    // オブジェクトの中で、次の値のキーを書く。
+    JsonWriter& key(const char* name);
+
+    JsonWriter& value(std::nullptr_t);
+    JsonWriter& value(bool b);
+    JsonWriter& value(int n);
+    JsonWriter& value(unsigned int n);
+    JsonWriter& value(long n);
+    JsonWriter& value(unsigned long n);
+    JsonWriter& value(long long n);
+    JsonWriter& value(unsigned long long n);
+    JsonWriter& value(double d);
+    JsonWriter& value(const char* s);
+    JsonWriter& value(const std::string& s);
+
+    // 小さな部分は nlohmann::json のまま埋め込む。
+    JsonWriter& value(const nlohmann::json& j);
+
+    template <typename T>
+    JsonWriter& member(const char* name, const T& v)
+    {
+        return key(name).value(v);
+    }
+
+    // 全ての入れ物を閉じた。
+    bool        done() const { return m_levels.empty(); }
+
+private:
+    void        separate();
+    void        writeString(const char* s, size_t len);
+
+    std::string&        m_out;
+    std::vector<bool>   m_levels;   // 入れ物ごとに、まだ要素を書いていないか
+    bool                m_afterKey;
+};
+
+#endif
@@ -0,0 +1,311 @@
+// ------------------------------------------------
+// File : landisco.cpp
+// Desc:
+//      LAN 内のリレーの発見。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "landisco.h"
+#include "atom.h"
+#include "chanmgr.h"
+#include "pcp.h"
+#include "prefork.h"
+#include "servmgr.h"
+#include "sstream.h"
+
+LANDiscovery g_lanDiscovery;
+
+const char* LANDiscovery::GROUP = "239.255.71.45";
+
+// ------------------------------------
+LANDiscovery::LANDiscovery()
+    : m_fd(-1)
+    , m_lastAnnounce(0)
+    , m_numSent(0)
+    , m_numReceived(0)
+    , m_numRejected(0)
+{
+}
+
+// ------------------------------------
+LANDiscovery::~LANDiscovery()
+{
+    close();
+}
+
+// ------------------------------------
+void LANDiscovery::close()
+{
+    if (m_fd >= 0)
+    {
+        closeSocket(m_fd);
+        m_fd = -1;
+    }
+    m_peers.clear();
+}
+
+// ------------------------------------
+void LANDiscovery::update()
+{
+    IP wanIP;
+    {
+        std::lock_guard<ProfiledMutex> cs(servMgr->lock);
+        wanIP = servMgr->serverHost.ip;
+    }
+
+    unsigned int ctime = sys->getTime();
+    std::vector<ChanHit> received;
+    bool announce = false;
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+
+        // 同じポートで何度も待ち受けないように、一つのプロセスだけが
+        // 受け持つ。
+        if (!servMgr->flags[ServMgr::F_lanDiscovery] || !g_prefork.isPrimary())
+        {
+            close();
+            return;
+        }
+
+        if (m_fd < 0)
+        {
+            // 開けなければ次の告知の時にやり直す。
+            if (m_lastAnnounce && (ctime - m_lastAnnounce) < ANNOUNCE_INTERVAL)
+                return;
+            m_lastAnnounce = ctime;
+            m_fd = openSocket();
+            if (m_fd < 0)
+            {
+                LOG_ERROR("LAN discovery: cannot join %s:%d", GROUP, PORT);
+                return;
+            }
+            LOG_INFO("LAN discovery: joined %s:%d", GROUP, PORT);
+            announce = true;
+        }
+
+        std::string data;
+        IP from;
+        for (int i = 0; i < MAX_RECEIVE && receive(m_fd, data, from); i++)
+        {
+            auto hits = from.isGlobal() ? std::vector<ChanHit>() : decode(data, from, wanIP);
+            if (hits.empty())
+            {
+                m_numRejected++;
+                continue;
+            }
+            // ループバックで戻ってきた自分の告知。
+            if (hits[0].sessionID.isSame(servMgr->sessionID))
+                continue;
+
+            m_numReceived++;
+            auto& peer = m_peers[hits[0].sessionID.str()];
+            peer.ip = from;
+            peer.lastSeen = ctime;
+            peer.numChannels = hits.size();
+            received.insert(received.end(), hits.begin(), hits.end());
+        }
+
+        for (auto it = m_peers.begin(); it != m_peers.end(); )
+        {
+            if ((ctime - it->second.lastSeen) > PEER_TIMEOUT)
+                it = m_peers.erase(it);
+            else
+                ++it;
+        }
+
+        if ((ctime - m_lastAnnounce) >= ANNOUNCE_INTERVAL)
+        {
+            m_lastAnnounce = ctime;
+            announce = true;
+        }
+    }
+
+    if (!received.empty())
+        chanMgr->applyHits(received);
+
+    if (announce)
+    {
+        auto hits = localHits();
+        if (hits.empty())
+            return;
+
+        auto datagrams = encode(hits);
+        std::lock_guard<std::mutex> cs(m_lock);
+        for (auto& d : datagrams)
+            if (m_fd >= 0 && send(m_fd, d))
+                m_numSent++;
+    }
+}
+
+// ------------------------------------
+// 受信中の IPv4 のチャンネルの自分のヒット。
+std::vector<ChanHit> LANDiscovery::localHits()
+{
+    std::vector<std::shared_ptr<Channel>> chs;
+    {
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+        for (auto ch = chanMgr->channel; ch; ch = ch->next)
+            if (ch->isActive() && ch->isPlaying() && ch->ipVersion != Channel::IP_V6)
+                chs.push_back(ch);
+    }
+
+    std::vector<ChanHit> hits;
+    for (auto& ch : chs)
+    {
+        ChanHit hit;
+        hit.initLocal(ch->localListeners(), ch->localRelays(), ch->info.numSkips, ch->info.getUptime(), true,
+                      ch->rawData.getOldestPos(), ch->rawData.getLatestPos(), ch->canAddRelay(), ch->sourceHost.host);
+        hit.tracker = ch->isBroadcasting();
+        hit.chanID = ch->info.id;
+        hits.push_back(hit);
+    }
+    return hits;
+}
+
+// ------------------------------------
+std::vector<std::string> LANDiscovery::encode(std::vector<ChanHit>& hits)
+{
+    std::vector<std::string> res;
+    size_t i = 0;
+    while (i < hits.size())
+    {
+        // 親のアトムの分を空けて、入る所まで詰める。一つも入らなくても
+        // 一つは送る。
+        std::vector<std::string> parts;
+        size_t total = 8;
+        for (; i < hits.size(); i++)
+        {
+            StringStream mem;
+            AtomStream atom(mem);
+            hits[i].writeAtoms(atom, hits[i].chanID);
+            std::string s = mem.str();
+            if (!parts.empty() && total + s.size() > MAX_DATAGRAM)
+                break;
+            total += s.size();
+            parts.push_back(std::move(s));
+        }
+
+        StringStream mem;
+        AtomStream atom(mem);
+        atom.writeParent(PCP_LAN, parts.size());
+        for (auto& p : parts)
+            mem.write(p.data(), p.size());
+        res.push_back(mem.str());
+    }
+    return res;
+}
+
+// ------------------------------------
+// 途中で切れたデータグラムを読み違えないように、足りなければ例外を投げる。
+class DatagramStream : public StringStream
+{
+public:
+    DatagramStream(const std::string& data) : StringStream(data) {}
+
+    int read(void *p, int l) override
+    {
+        if (l < 0 || m_pos + l > m_buffer.size())
+            throw StreamException("Short datagram");
+        return StringStream::read(p, l);
+    }
+};
+
+// ------------------------------------
+std::vector<ChanHit> LANDiscovery::decode(const std::string& data, const IP& from, const IP& wanIP)
+{
+    std::vector<ChanHit> hits;
+    try
+    {
+        DatagramStream mem(data);
+        AtomStream atom(mem);
+
+        int numc, d;
+        if (atom.read(numc, d) != PCP_LAN)
+            return {};
+
+        for (int i = 0; i < numc; i++)
+        {
+            int c;
+            ID4 id = atom.read(c, d);
+            if (id != PCP_HOST)
+            {
+                atom.skip(c, d);
+                continue;
+            }
+
+            ChanHit hit;
+            GnuID chanID;
+            bool move = false;
+            unsigned int hubLease = 0;
+            hit.readAtoms(atom, c, chanID, move, hubLease);
+
+            // ファイアウォール越しのノードは rhost[0] のポートが 0 になっ
+            // ている。
+            int port = hit.rhost[1].port ? hit.rhost[1].port : hit.rhost[0].port;
+            if (!chanID.isSet() || !hit.sessionID.isSet() || !port)
+                continue;
+
+            hit.rhost[1] = Host(from, port);
+            if (!hit.rhost[0].ip)
+            {
+                // WAN のアドレスを知らないノード。同じ LAN なら WAN のア
+                // ドレスも同じはずだが、外から繋がるかは分からない。
+                if (wanIP)
+                {
+                    hit.rhost[0] = Host(wanIP, 0);
+                    hit.firewalled = true;
+                }else
+                    hit.rhost[0] = hit.rhost[1];
+            }
+            hit.host = hit.rhost[1];
+            hit.chanID = chanID;
+            hit.numHops = 1;
+            hit.hub = false;
+            hits.push_back(hit);
+        }
+        if (mem.getPosition() != (int) data.size())
+            return {};
+    }catch (StreamException&)
+    {
+        return {};
+    }
+    return hits;
+}
+
+// ------------------------------------
+amf0::Value LANDiscovery::getState()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    unsigned int ctime = sys->getTime();
+    std::vector<amf0::Value> peers;
+    for (auto& pair : m_peers)
+    {
+        peers.push_back(amf0::Value::object(
+            {
+                {"sessionId", pair.first},
+                {"ip", pair.second.ip.str()},
+                {"numChannels", (int) pair.second.numChannels},
+                {"age", (int) (ctime - pair.second.lastSeen)},
+            }));
+    }
+
+    return amf0::Value::object(
+        {
+            {"active", m_fd >= 0},
+            {"numSent", (int) m_numSent},
+            {"numReceived", (int) m_numReceived},
+            {"numRejected", (int) m_numRejected},
+            {"peers", peers},
+        });
+}
@@ -0,0 +1,97 @@
+// ------------------------------------------------
+// File : landisco.h
+// Desc:
+//      LAN 内のリレーの発見 (lanDiscovery フラグ)。受信中のチャンネル
+//      のヒットを PCP_HOST のアトムにして、決まったマルチキャストのグ
+//      ループに定期的に流す。他のノードの告知は、送り元のアドレスを
+//      LAN のアドレス (rhost[1]) にしたヒットとして加える。上流を選ぶ
+//      時は WAN のアドレスが自分と同じヒットの LAN のアドレスを先に使
+//      うので、同じ家やオフィスの視聴者は外に出ずに既にあるリレーから
+//      受信する。
+//
+//      マルチキャストは TTL 1 で送り、グローバルなアドレスからの告知
+//      は受け取らない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _LANDISCO_H
+#define _LANDISCO_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "amf0.h"
+#include "chanhit.h"
+
+// ------------------------------------
+class LANDiscovery
+{
+public:
+    enum
+    {
+        PORT                = 7145,
+        ANNOUNCE_INTERVAL   = 10,   // 告知の間隔 (秒)
+        PEER_TIMEOUT        = 60,   // これより長く告知の無いノードは一覧から消す (秒)
+        MAX_DATAGRAM        = 1200, // 一つのデータグラムの大きさの上限
+        MAX_RECEIVE         = 64,   // 一度の update で読むデータグラムの数
+    };
+    static const char* GROUP;       // IPv4 の組織内のマルチキャストアドレス
+
+    LANDiscovery();
+    ~LANDiscovery();
+
+    // フラグに従ってソケットを開け閉めし、届いた告知をヒットに加え、
+    // 間隔が来ていれば告知する。housekeeping から毎秒呼ぶ。
+    void    update();
+
+    // hits (chanID を設定したもの) を MAX_DATAGRAM に収まるように分け
+    // てデータグラムにする。
+    static std::vector<std::string> encode(std::vector<ChanHit>& hits);
+    // from から届いたデータグラムのヒット。rhost[1] を from にし、WAN
+    // のアドレスが分からなければ wanIP (自分の WAN のアドレス) を使う。
+    // 読めなければ空。
+    static std::vector<ChanHit> decode(const std::string& data, const IP& from, const IP& wanIP);
+
+    amf0::Value getState();
+
+    // プラットフォームごとの実装。ソケットは待たないようにしておく。
+    static int  openSocket();       // 失敗なら -1
+    static void closeSocket(int fd);
+    static bool send(int fd, const std::string& data);
+    static bool receive(int fd, std::string& data, IP& from);  // 届いていなければ false
+
+private:
+    struct Peer
+    {
+        IP              ip;
+        unsigned int    lastSeen;
+        unsigned int    numChannels;
+    };
+
+    std::vector<ChanHit> localHits();
+    void    close();
+
+    std::mutex      m_lock;
+    int             m_fd;
+    unsigned int    m_lastAnnounce;
+    unsigned int    m_numSent;
+    unsigned int    m_numReceived;
+    unsigned int    m_numRejected;
+    std::map<std::string, Peer> m_peers;    // セッション ID から
+};
+
+extern LANDiscovery g_lanDiscovery;
+
+#endif
@@ -0,0 +1,191 @@
+// ------------------------------------------------
+// File : locality.cpp
+// Desc:
+//      プレフィックスの表と測った接続時間によるネットワーク上の近さ。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <fstream>
+#include <sstream>
+
+#include "locality.h"
+#include "chanhit.h"
+#include "str.h"
+
+Locality g_locality;
+
+// ------------------------------------
+// ip の先頭 len ビットだけを残す。
+static IP maskIP(const IP& ip, int len)
+{
+    auto a = ip.serialize();
+    for (int i = 0; i < 16; i++)
+    {
+        const int bits = std::min(std::max(len - i * 8, 0), 8);
+        a.s6_addr[i] &= (unsigned char) (0xff00 >> bits);
+    }
+    return IP(a);
+}
+
+// ------------------------------------
+Locality::Locality()
+    : m_numPrefixes(0)
+    , m_numLookups(0)
+    , m_numNear(0)
+{
+}
+
+// ------------------------------------
+int Locality::load(const std::string& text)
+{
+    std::map<int, std::map<IP, std::string>, std::greater<int>> prefixes;
+    int n = 0;
+
+    std::istringstream is(text);
+    std::string line;
+    while (std::getline(is, line))
+    {
+        line = str::strip(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+
+        // 「203.0.113.0/24 AS64500」や「2001:db8::/32 tokyo」。
+        auto words = str::split(line, " ");
+        if (words.size() < 2)
+            continue;
+        auto vec = str::split(words[0], "/", 2);
+        IP ip;
+        if (vec.size() != 2 || !IP::tryParse(vec[0], ip))
+            continue;
+
+        const bool v4 = ip.isIPv4Mapped();
+        int len = atoi(vec[1].c_str());
+        if (len < 0 || len > (v4 ? 32 : 128))
+            continue;
+        if (v4)
+            len += 96;
+
+        prefixes[len][maskIP(ip, len)] = str::strip(words.back());
+        n++;
+    }
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_prefixes.swap(prefixes);
+    m_numPrefixes = n;
+    return n;
+}
+
+// ------------------------------------
+bool Locality::loadFile(const std::string& path)
+{
+    std::ifstream ifs(path);
+    if (!ifs)
+    {
+        load("");
+        return false;
+    }
+
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    load(ss.str());
+    return true;
+}
+
+// ------------------------------------
+std::string Locality::lookup(const IP& ip)
+{
+    for (auto& level : m_prefixes)
+    {
+        auto it = level.second.find(maskIP(ip, level.first));
+        if (it != level.second.end())
+            return it->second;
+    }
+    return "";
+}
+
+// ------------------------------------
+std::string Locality::regionOf(const IP& ip)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return lookup(ip);
+}
+
+// ------------------------------------
+bool Locality::sameRegion(const IP& a, const IP& b)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto ra = lookup(a);
+    return !ra.empty() && ra == lookup(b);
+}
+
+// ------------------------------------
+bool Locality::isNear(const IP& self, const Host& host, RelayStats& stats)
+{
+    bool near = false;
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        m_numLookups++;
+
+        auto mine = lookup(self);
+        auto theirs = lookup(host.ip);
+        if (!mine.empty() && !theirs.empty())
+            near = (mine == theirs);
+        else
+        {
+            RelayStats::Entry e;
+            near = stats.get(host, e) && e.rtt >= 0 && e.rtt * 1000 < NEAR_RTT_MSEC;
+        }
+
+        if (near)
+            m_numNear++;
+    }
+    return near;
+}
+
+// ------------------------------------
+int Locality::numPrefixes()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_numPrefixes;
+}
+
+// ------------------------------------
+amf0::Value Locality::getState()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return amf0::Value::object(
+        {
+            {"numPrefixes", m_numPrefixes},
+            {"numLookups", (int) m_numLookups},
+            {"numNear", (int) m_numNear},
+        });
+}
+
+// ------------------------------------
+LocalityPolicy::LocalityPolicy(const RelayPolicy& base, const IP& self, Locality& locality)
+    : remoteCost(1)
+    , m_base(base)
+    , m_self(self)
+    , m_locality(locality)
+{
+}
+
+// ------------------------------------
+double LocalityPolicy::cost(const ChanHit& hit, const Host& host) const
+{
+    double cost = m_base.cost(hit, host);
+    // LAN 内の相手は近い。
+    if (host.ip.isGlobal() && !m_locality.isNear(m_self, host))
+        cost += remoteCost;
+    return cost;
+}
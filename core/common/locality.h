@@ -0,0 +1,98 @@
+// ------------------------------------------------
+// File : locality.h
+// Desc:
+//      ネットワーク上の近さ (preferLocalPeers フラグ)。状態ディレクト
+//      リーの locality.txt に「プレフィックス ラベル」の行を並べておく
+//      と (ラベルは AS 番号や地域名など)、同じラベルの相手を近いとみな
+//      す。表に無い相手は、こちらから繋いだ時の接続時間が NEAR_RTT_MSEC
+//      より短ければ近いとみなす。
+//
+//      上流を選ぶ時は遠い候補に LocalityPolicy で評価を足し、リレーを
+//      断る時に教える代わりの候補は相手と同じラベルのものを先にする。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _LOCALITY_H
+#define _LOCALITY_H
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "amf0.h"
+#include "ip.h"
+#include "relaypolicy.h"
+
+// ------------------------------------
+class Locality
+{
+public:
+    enum
+    {
+        NEAR_RTT_MSEC   = 20,
+        RELOAD_INTERVAL = 300,  // 表を読み直す秒数
+    };
+
+    Locality();
+
+    // 表を text で置き換える。読めた行の数を返す。読めない行は飛ばす。
+    int         load(const std::string& text);
+    // path から読む。ファイルが無ければ表を空にして false。
+    bool        loadFile(const std::string& path);
+
+    // ip の属するラベル。一番長く一致したプレフィックスのもの。無けれ
+    // ば空。
+    std::string regionOf(const IP& ip);
+
+    // a と b がどちらも表にあって同じラベルなら true。
+    bool        sameRegion(const IP& a, const IP& b);
+
+    // self から見て host が近いか。表で決まらなければ stats の接続時
+    // 間を見る。
+    bool        isNear(const IP& self, const Host& host, RelayStats& stats = g_relayStats);
+
+    int         numPrefixes();
+    amf0::Value getState();
+
+private:
+    std::string lookup(const IP& ip);   // m_lock を取って呼ぶ
+
+    std::mutex  m_lock;
+    // プレフィックス長 (IPv4 は IPv4 射影アドレスとしての長さ) ごとに、
+    // ネットワークアドレスからラベル。長い順にたどる。
+    std::map<int, std::map<IP, std::string>, std::greater<int>> m_prefixes;
+    int         m_numPrefixes;
+    unsigned int m_numLookups;
+    unsigned int m_numNear;
+};
+
+extern Locality g_locality;
+
+// ------------------------------------
+// base の評価に、遠い候補なら remoteCost を足す。
+class LocalityPolicy : public RelayPolicy
+{
+public:
+    LocalityPolicy(const RelayPolicy& base, const IP& self, Locality& locality = g_locality);
+
+    double cost(const ChanHit& hit, const Host& host) const override;
+
+    double remoteCost;          // ホップ数を単位にする
+
+private:
+    const RelayPolicy& m_base;
+    IP          m_self;
+    Locality&   m_locality;
+};
+
+#endif
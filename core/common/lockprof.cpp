@@ -0,0 +1,275 @@
+// ------------------------------------------------
+// File : lockprof.cpp
+// Desc:
+//      待たされなかったロックは try_lock 一回で済ませ、時刻は保持時間
+//      のために一度だけ読む。呼び出し元のスタックは待たされた時だけ取る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+#if !defined(NO_LOCK_PROFILING) && (defined(__GLIBC__) || defined(__APPLE__))
+#define HAVE_BACKTRACE
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#endif
+
+#include "lockprof.h"
+#include "str.h"
+
+std::atomic<bool> LockProfiler::s_enabled(false);
+
+namespace
+{
+    struct Registry
+    {
+        std::mutex lock;
+        std::vector<std::unique_ptr<LockProfiler::Entry>> entries;
+    };
+
+    // 静的なミューテックスの初期化からも呼ばれるので、関数の中に置く。
+    Registry& registry()
+    {
+        static Registry* r = new Registry();
+        return *r;
+    }
+
+    void updateMax(std::atomic<uint64_t>& max, uint64_t v)
+    {
+        uint64_t cur = max.load(std::memory_order_relaxed);
+        while (v > cur && !max.compare_exchange_weak(cur, v, std::memory_order_relaxed))
+            ;
+    }
+}
+
+// ------------------------------------
+LockProfiler::Entry::Entry(const char* aName)
+    : name(aName)
+    , acquisitions(0)
+    , contended(0)
+    , waitNanos(0)
+    , maxWaitNanos(0)
+    , holdNanos(0)
+    , maxHoldNanos(0)
+{
+}
+
+// ------------------------------------
+void LockProfiler::Entry::addWait(uint64_t nanos, const Frames& site)
+{
+    contended.fetch_add(1, std::memory_order_relaxed);
+    waitNanos.fetch_add(nanos, std::memory_order_relaxed);
+    updateMax(maxWaitNanos, nanos);
+
+    std::lock_guard<std::mutex> cs(siteLock);
+    auto& s = sites[site];
+    s.count++;
+    s.waitNanos += nanos;
+}
+
+// ------------------------------------
+void LockProfiler::Entry::addHold(uint64_t nanos)
+{
+    holdNanos.fetch_add(nanos, std::memory_order_relaxed);
+    updateMax(maxHoldNanos, nanos);
+}
+
+// ------------------------------------
+bool LockProfiler::available()
+{
+#ifdef NO_LOCK_PROFILING
+    return false;
+#else
+    return true;
+#endif
+}
+
+// ------------------------------------
+uint64_t LockProfiler::nowNanos()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// ------------------------------------
+LockProfiler::Entry* LockProfiler::entry(const char* name)
+{
+    auto& r = registry();
+    std::lock_guard<std::mutex> cs(r.lock);
+    for (auto& e : r.entries)
+        if (strcmp(e->name, name) == 0)
+            return e.get();
+    r.entries.emplace_back(new Entry(name));
+    return r.entries.back().get();
+}
+
+// ------------------------------------
+void LockProfiler::reset()
+{
+    auto& r = registry();
+    std::lock_guard<std::mutex> cs(r.lock);
+    for (auto& e : r.entries)
+    {
+        e->acquisitions = 0;
+        e->contended = 0;
+        e->waitNanos = 0;
+        e->maxWaitNanos = 0;
+        e->holdNanos = 0;
+        e->maxHoldNanos = 0;
+        std::lock_guard<std::mutex> cs2(e->siteLock);
+        e->sites.clear();
+    }
+}
+
+// ------------------------------------
+std::string LockProfiler::symbolize(void* addr)
+{
+#ifdef HAVE_BACKTRACE
+    Dl_info info;
+    if (dladdr(addr, &info) && info.dli_fname)
+    {
+        if (info.dli_sname)
+        {
+            int status;
+            std::unique_ptr<char, void(*)(void*)> demangled(
+                abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status), free);
+            return status == 0 ? demangled.get() : info.dli_sname;
+        }
+        const char* base = strrchr(info.dli_fname, '/');
+        return str::format("%s+0x%lx", base ? base + 1 : info.dli_fname,
+                           (unsigned long) ((char*) addr - (char*) info.dli_fbase));
+    }
+#endif
+    return str::format("%p", addr);
+}
+
+// ------------------------------------
+std::vector<LockProfiler::Report> LockProfiler::report(size_t maxSites)
+{
+    std::vector<Report> reports;
+
+    auto& r = registry();
+    std::lock_guard<std::mutex> cs(r.lock);
+    for (auto& e : r.entries)
+    {
+        Report rep;
+        rep.name           = e->name;
+        rep.acquisitions   = e->acquisitions;
+        rep.contended      = e->contended;
+        rep.waitSeconds    = e->waitNanos / 1e9;
+        rep.maxWaitSeconds = e->maxWaitNanos / 1e9;
+        rep.holdSeconds    = e->holdNanos / 1e9;
+        rep.maxHoldSeconds = e->maxHoldNanos / 1e9;
+        if (rep.acquisitions == 0 && rep.contended == 0)
+            continue;
+
+        // 同じ関数から来たスタックはまとめる。ミューテックスと標準ライ
+        // ブラリのフレームは飛ばす。
+        std::map<std::string, Site> byFunction;
+        {
+            std::lock_guard<std::mutex> cs2(e->siteLock);
+            for (auto& s : e->sites)
+            {
+                std::string function;
+                for (auto addr : s.first)
+                {
+                    if (!addr)
+                        break;
+                    function = symbolize(addr);
+                    if (!str::has_prefix(function, "ProfiledMutex::") &&
+                        !str::has_prefix(function, "std::"))
+                        break;
+                }
+                auto& site = byFunction[function];
+                site.function = function;
+                site.count += s.second.count;
+                site.waitSeconds += s.second.waitNanos / 1e9;
+            }
+        }
+        for (auto& pair : byFunction)
+            rep.sites.push_back(pair.second);
+        std::sort(rep.sites.begin(), rep.sites.end(),
+                  [](const Site& a, const Site& b) { return a.waitSeconds > b.waitSeconds; });
+        if (rep.sites.size() > maxSites)
+            rep.sites.resize(maxSites);
+
+        reports.push_back(rep);
+    }
+
+    std::sort(reports.begin(), reports.end(),
+              [](const Report& a, const Report& b) { return a.waitSeconds > b.waitSeconds; });
+    return reports;
+}
+
+// ------------------------------------
+#ifdef NO_LOCK_PROFILING
+ProfiledMutex::ProfiledMutex(const char* name)
+    : m_name(name)
+{
+}
+
+const char* ProfiledMutex::name() const
+{
+    return m_name;
+}
+#else
+ProfiledMutex::ProfiledMutex(const char* name)
+    : m_entry(LockProfiler::entry(name))
+    , m_depth(0)
+    , m_holdStart(0)
+{
+}
+
+// ------------------------------------
+const char* ProfiledMutex::name() const
+{
+    return m_entry->name;
+}
+
+// ------------------------------------
+void ProfiledMutex::lockProfiled()
+{
+    if (!m_mutex.try_lock())
+    {
+        LockProfiler::Frames site = {};
+#ifdef HAVE_BACKTRACE
+        // 自分と ProfiledMutex::lock の分を余分に取って、後で飛ばす。
+        void* frames[LockProfiler::SITE_DEPTH + 1];
+        int n = backtrace(frames, LockProfiler::SITE_DEPTH + 1);
+        for (int i = 1; i < n; i++)
+            site[i - 1] = frames[i];
+#endif
+        uint64_t t0 = LockProfiler::nowNanos();
+        m_mutex.lock();
+        m_entry->addWait(LockProfiler::nowNanos() - t0, site);
+    }
+
+    if (m_depth++ == 0)
+    {
+        m_holdStart = LockProfiler::nowNanos();
+        m_entry->acquisitions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// ------------------------------------
+void ProfiledMutex::unlockProfiled()
+{
+    m_entry->addHold(LockProfiler::nowNanos() - m_holdStart);
+    m_holdStart = 0;
+}
+#endif
@@ -0,0 +1,176 @@
+// ------------------------------------------------
+// File : lockprof.h
+// Desc:
+//      計測できる再帰ミューテックス。std::recursive_mutex の代わりに使
+//      う。LockProfiler が有効な間、名前ごとに待ち時間と保持時間を、
+//      待たされた呼び出し元ごとにその回数と待ち時間を数える。無効な間
+//      は再帰の深さを数えるだけ。
+//
+//      NO_LOCK_PROFILING を定義してビルドすると計測のコードは無くなる。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _LOCKPROF_H
+#define _LOCKPROF_H
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// ------------------------------------
+class LockProfiler
+{
+public:
+    enum
+    {
+        SITE_DEPTH = 4,     // 呼び出し元として覚えるフレーム数
+    };
+
+    typedef std::array<void*, SITE_DEPTH> Frames;
+
+    struct SiteCounts
+    {
+        uint64_t    count;
+        uint64_t    waitNanos;
+    };
+
+    // 同じ名前のミューテックス全部の集計。Channel::lock なら全チャン
+    // ネルの分が一つになる。
+    struct Entry
+    {
+        Entry(const char* aName);
+
+        void        addWait(uint64_t nanos, const Frames& site);
+        void        addHold(uint64_t nanos);
+
+        const char*             name;
+        std::atomic<uint64_t>   acquisitions;
+        std::atomic<uint64_t>   contended;
+        std::atomic<uint64_t>   waitNanos;
+        std::atomic<uint64_t>   maxWaitNanos;
+        std::atomic<uint64_t>   holdNanos;
+        std::atomic<uint64_t>   maxHoldNanos;
+
+        std::mutex                      siteLock;
+        std::map<Frames, SiteCounts>    sites;
+    };
+
+    struct Site
+    {
+        std::string function;
+        uint64_t    count;
+        double      waitSeconds;
+    };
+
+    struct Report
+    {
+        std::string         name;
+        uint64_t            acquisitions;
+        uint64_t            contended;
+        double              waitSeconds;
+        double              maxWaitSeconds;
+        double              holdSeconds;
+        double              maxHoldSeconds;
+        std::vector<Site>   sites;  // 待ち時間の長い順
+    };
+
+    static bool available();
+    static bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+    static void setEnabled(bool b) { s_enabled.store(b); }
+
+    // 名前ごとの集計を返す。無ければ作る。返したものは捨てない。
+    static Entry* entry(const char* name);
+
+    // 待ち時間の長い順。呼び出し元は一つのロックにつき maxSites まで。
+    static std::vector<Report> report(size_t maxSites = 10);
+    static void reset();
+
+    // 呼び出し元のアドレスを関数名にする。名前が分からなければモジュー
+    // ルからのオフセット。
+    static std::string symbolize(void* addr);
+
+    static uint64_t nowNanos();
+
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+// ------------------------------------
+class ProfiledMutex
+{
+public:
+    explicit ProfiledMutex(const char* name = "(unnamed)");
+    ProfiledMutex(const ProfiledMutex&) = delete;
+    ProfiledMutex& operator=(const ProfiledMutex&) = delete;
+
+#ifdef NO_LOCK_PROFILING
+    void    lock() { m_mutex.lock(); }
+    bool    try_lock() { return m_mutex.try_lock(); }
+    void    unlock() { m_mutex.unlock(); }
+#else
+    void    lock()
+    {
+        if (LockProfiler::enabled())
+        {
+            lockProfiled();
+            return;
+        }
+        m_mutex.lock();
+        if (m_depth++ == 0)
+            m_holdStart = 0;
+    }
+
+    bool    try_lock()
+    {
+        if (!m_mutex.try_lock())
+            return false;
+        if (m_depth++ == 0)
+        {
+            m_holdStart = LockProfiler::enabled() ? LockProfiler::nowNanos() : 0;
+            if (m_holdStart)
+                m_entry->acquisitions++;
+        }
+        return true;
+    }
+
+    void    unlock()
+    {
+        if (--m_depth == 0 && m_holdStart)
+            unlockProfiled();
+        m_mutex.unlock();
+    }
+#endif
+
+    const char* name() const;
+
+private:
+    std::recursive_mutex    m_mutex;
+#ifndef NO_LOCK_PROFILING
+    void    lockProfiled();
+    void    unlockProfiled();
+
+    LockProfiler::Entry*    m_entry;
+    // 以下は保持しているスレッドだけが触る。
+    int                     m_depth;
+    uint64_t                m_holdStart;    // 0 なら保持時間を計らない
+#else
+    const char*             m_name;
+#endif
+};
+
+#endif
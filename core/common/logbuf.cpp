@@ -17,9 +17,12 @@
 // GNU General Public License for more details.
 // ------------------------------------------------
 
+#include <algorithm>
+
 #include "logbuf.h"
 #include "stream.h"
 #include "cgi.h"
+#include "str.h"
 
 // -----------------------------------
 const char *LogBuffer::logTypes[]=
@@ -70,7 +73,7 @@ size_t LogBuffer::copy_utf8(char* dest, const char* src, size_t buflen)
 // -----------------------------------
 unsigned int LogBuffer::addListener(std::function<void(unsigned int, TYPE, const char*)> listener)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
     unsigned int id = listenerID++;
     listeners[id] = listener;
     return id;
@@ -79,16 +82,16 @@ unsigned int LogBuffer::addListener(std::function<void(unsigned int, TYPE, const
 // -----------------------------------
 void LogBuffer::removeListener(unsigned int id)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
     listeners.erase(id);
 }
 
 // -----------------------------------
-void LogBuffer::write(const char *str, TYPE t)
+void LogBuffer::write(const char *str, TYPE t, unsigned int time)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
-    const auto now = sys->getTime();
+    const auto now = time ? time : sys->getTime();
 
     for (auto pair : listeners) {
         pair.second(now, t, str);
@@ -148,28 +151,62 @@ std::string LogBuffer::lineRendererHTML(unsigned int time, TYPE type, const char
 }
 
 // ---------------------------
-void LogBuffer::eachLine(std::function<void(unsigned int, TYPE, const char*)> block)
+std::string LogBuffer::lineRendererText(unsigned int time, TYPE type, const char* line)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::string buf;
 
-    unsigned int nlines;
-    unsigned int sp;
-    if (currLine < maxLines)
-    {
-        nlines = currLine;
-        sp = 0;
-    }else
+    if (type != LogBuffer::T_NONE)
     {
-        nlines = maxLines;
-        sp = currLine % maxLines;
+        buf += str::rstrip(String().setFromTime(time));
+        buf += " [";
+        buf += getTypeStr(type);
+        buf += "] ";
     }
 
-    for (unsigned int i = 0; i < nlines; i++)
+    buf += line;
+
+    return buf;
+}
+
+// ---------------------------
+void LogBuffer::range(uint64_t& first, uint64_t& end)
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+
+    end = currLine;
+    first = std::max(firstLine, currLine > maxLines ? currLine - maxLines : 0);
+}
+
+// ---------------------------
+void LogBuffer::eachLine(std::function<void(unsigned int, TYPE, const char*)> block)
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+
+    uint64_t first, end;
+    range(first, end);
+
+    for (uint64_t seq = first; seq < end; seq++)
     {
-        block(times[sp], types[sp], &buf[sp*lineLen]);
+        unsigned int i = seq % maxLines;
+        block(times[i], types[i], &buf[i*lineLen]);
+    }
+}
+
+// ---------------------------
+std::vector<LogBuffer::Line> LogBuffer::linesFrom(uint64_t seq, size_t max)
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
 
-        sp = (sp+1) % maxLines;
+    uint64_t first, end;
+    range(first, end);
+
+    std::vector<Line> res;
+    for (uint64_t s = std::max(seq, first); s < end && res.size() < max; s++)
+    {
+        unsigned int i = s % maxLines;
+        res.push_back({ s, times[i], types[i], &buf[i*lineLen] });
     }
+    return res;
 }
 
 // ---------------------------
@@ -197,15 +234,15 @@ std::vector<std::string> LogBuffer::toLines(std::function<std::string(unsigned i
 // ---------------------------
 void    LogBuffer::clear()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
-    currLine = 0;
+    std::lock_guard<ProfiledMutex> cs(lock);
+    firstLine = currLine;
 }
 
 // ---------------------------
 #include "sstream.h"
 amf0::Value LogBuffer::getState()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     StringStream s;
     this->dumpHTML(s);
@@ -218,6 +255,7 @@ amf0::Value LogBuffer::getState()
     return amf0::Value::object(
         {
             {"dumpHTML", s.str()},
+            {"cursor", currLine},
             {"logListeners", ids},
         });
 }
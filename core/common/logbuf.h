@@ -21,10 +21,13 @@
 #define _LOGBUF_H
 
 #include "threading.h"
+#include <stdint.h>
+#include <string>
 #include <vector>
 #include <functional>
 #include <map>
 #include "varwriter.h"
+#include "lockprof.h"
 
 class Stream;
 
@@ -45,12 +48,22 @@ public:
         T_OFF   = 7,
     };
 
+    // 一行。seq は書いた順の通し番号で、clear しても戻らない。
+    struct Line
+    {
+        uint64_t        seq;
+        unsigned int    time;
+        TYPE            type;
+        std::string     text;
+    };
+
     LogBuffer(int aMaxLines, int aLineLen)
         : lineLen(aLineLen)
         , maxLines(aMaxLines)
         , listenerID(0)
     {
         currLine = 0;
+        firstLine = 0;
         buf = new char[lineLen*maxLines];
         times = new unsigned int [maxLines];
         types = new TYPE [maxLines];
@@ -65,13 +78,22 @@ public:
 
     void    clear();
 
-    void                write(const char *, TYPE);
+    // time が 0 なら今の時刻。
+    void                write(const char *, TYPE, unsigned int time = 0);
     static const char   *getTypeStr(TYPE t) { return logTypes[t]; }
     void                eachLine(std::function<void(unsigned int, TYPE, const char*)> block);
     std::vector<std::string> toLines(std::function<std::string(unsigned int, TYPE, const char*)> renderer);
     void                dumpHTML(Stream &);
 
+    // 残っている行の通し番号の範囲 [first, end)。
+    void                range(uint64_t& first, uint64_t& end);
+    // 通し番号が seq 以上の行を、古い順に最大 max 行。ロックしている
+    // 間は写すだけなので、整形は呼び出し側で行う。
+    std::vector<Line>   linesFrom(uint64_t seq, size_t max);
+
     static std::string  lineRendererHTML(unsigned int time, TYPE type, const char* line);
+    // "時刻 [種類] 本文" の形。続きの行は本文だけ。
+    static std::string  lineRendererText(unsigned int time, TYPE type, const char* line);
     static size_t copy_utf8(char* dest, const char* src, size_t buflen);
 
     unsigned int        addListener(std::function<void(unsigned int, TYPE, const char*)> listener);
@@ -81,11 +103,12 @@ public:
 
     char                *buf;
     unsigned int        *times;
-    unsigned int        currLine;
+    uint64_t            currLine;   // 次に書く行の通し番号
+    uint64_t            firstLine;  // clear した時の currLine
     const unsigned int  lineLen;
     const unsigned int  maxLines;
     TYPE                *types;
-    std::recursive_mutex lock;
+    ProfiledMutex lock { "LogBuffer::lock" };
     static const char   *logTypes[];
 
     unsigned int listenerID;
@@ -0,0 +1,309 @@
+// ------------------------------------------------
+// File : logpipe.cpp
+// Desc:
+//      ログを出すスレッドがするのは、キューへの連結一回とカウンターの
+//      更新だけ。書き込みスレッドは眠っている時だけ起こす。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <chrono>
+
+#include "logpipe.h"
+#include "peercast.h"
+#include "str.h"
+
+LogPipeline g_logPipeline(LogPipeline::defaultSink);
+
+// ------------------------------------
+LogPipeline::LogPipeline(Sink sink)
+    : m_sink(sink)
+    , m_head(&m_stub)
+    , m_tail(&m_stub)
+    , m_queued(0)
+    , m_pushed(0)
+    , m_delivered(0)
+    , m_dropped(0)
+    , m_totalDropped(0)
+    , m_totalSuppressed(0)
+    , m_running(false)
+    , m_quit(false)
+    , m_waiting(false)
+{
+    m_stub.next = nullptr;
+    for (auto& slot : m_rate)
+    {
+        slot.site = nullptr;
+        slot.second = 0;
+        slot.count = 0;
+        slot.suppressed = 0;
+    }
+}
+
+// ------------------------------------
+LogPipeline::~LogPipeline()
+{
+    stop();
+
+    // stop の後で繋がれた分。配送先はもう無いかもしれないので捨てる。
+    while (Node* n = dequeue())
+        delete n;
+}
+
+// ------------------------------------
+void LogPipeline::defaultSink(unsigned int time, LogBuffer::TYPE type, const char* line)
+{
+    if (!sys)
+        return;
+
+    if (type != LogBuffer::T_NONE)
+        sys->logBuf->write(line, type, time);
+
+    if (peercastApp)
+        peercastApp->printLog(type, line);
+}
+
+// ------------------------------------
+void LogPipeline::start()
+{
+    std::lock_guard<std::mutex> cs(m_controlLock);
+    if (m_running)
+        return;
+
+    m_quit = false;
+    m_writer = std::thread([this]() { writerMain(); });
+    m_running = true;
+}
+
+// ------------------------------------
+void LogPipeline::stop()
+{
+    std::lock_guard<std::mutex> cs(m_controlLock);
+    if (!m_running)
+        return;
+
+    m_running = false;
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_quit = true;
+        m_cond.notify_one();
+    }
+    m_writer.join();
+
+    // m_running を下ろす前に繋がれていた分。
+    drain();
+}
+
+// ------------------------------------
+void LogPipeline::push(unsigned int time, LogBuffer::TYPE type, std::string&& line)
+{
+    if (!m_running.load())
+    {
+        m_sink(time, type, line.c_str());
+        return;
+    }
+
+    int before = m_queued.fetch_add(1);
+    if (before >= MAX_QUEUED)
+    {
+        m_queued.fetch_sub(1);
+        m_dropped.fetch_add(1);
+        m_totalDropped.fetch_add(1);
+        return;
+    }
+
+    Node* n = new Node;
+    n->next.store(nullptr, std::memory_order_relaxed);
+    n->time = time;
+    n->type = type;
+    n->line = std::move(line);
+
+    m_pushed.fetch_add(1);
+    enqueue(n);
+
+    // 空のキューに入れた時だけ、眠っている書き込みスレッドを起こす。
+    // 書き込みスレッドは m_waiting を立ててから m_queued を見るので、
+    // どちらかが必ず相手に気付く。
+    if (before == 0 && m_waiting.load())
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_cond.notify_one();
+    }
+}
+
+// ------------------------------------
+void LogPipeline::flush()
+{
+    if (!m_running.load() || std::this_thread::get_id() == m_writer.get_id())
+        return;
+
+    const uint64_t target = m_pushed.load();
+    while (m_delivered.load() < target && m_running.load())
+    {
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            m_cond.notify_one();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+// ------------------------------------
+bool LogPipeline::admit(const char* site, unsigned int limit, unsigned int now)
+{
+    if (limit == 0)
+        return true;
+
+    size_t h = reinterpret_cast<size_t>(site);
+    h ^= h >> 7;
+    h ^= h >> 13;
+    RateSlot& slot = m_rate[h % RATE_SLOTS];
+
+    // 別の呼び出し元に取られた枠も、新しい秒として数え直す。
+    if (slot.site.load(std::memory_order_relaxed) != site ||
+        slot.second.load(std::memory_order_relaxed) != now)
+    {
+        reportSuppressed(slot, now);
+        slot.site.store(site, std::memory_order_relaxed);
+        slot.second.store(now, std::memory_order_relaxed);
+        slot.count.store(0, std::memory_order_relaxed);
+    }
+
+    if (slot.count.fetch_add(1, std::memory_order_relaxed) < limit)
+        return true;
+
+    slot.suppressed.fetch_add(1);
+    m_totalSuppressed.fetch_add(1);
+    return false;
+}
+
+// ------------------------------------
+void LogPipeline::reportSuppressed(RateSlot& slot, unsigned int now)
+{
+    const char* site = slot.site.load();
+    unsigned int n = slot.suppressed.exchange(0);
+    if (n && site)
+        push(now, LogBuffer::T_WARN, str::format("%u similar log lines suppressed: %s", n, site));
+}
+
+// ------------------------------------
+void LogPipeline::sweepRates(unsigned int now)
+{
+    for (auto& slot : m_rate)
+    {
+        if (slot.second.load(std::memory_order_relaxed) != now &&
+            slot.suppressed.load(std::memory_order_relaxed))
+            reportSuppressed(slot, now);
+    }
+}
+
+// ------------------------------------
+void LogPipeline::enqueue(Node* n)
+{
+    Node* prev = m_head.exchange(n, std::memory_order_acq_rel);
+    prev->next.store(n, std::memory_order_release);
+}
+
+// ------------------------------------
+// 書き込みスレッド (止まっていれば stop を呼んだスレッド) だけが呼ぶ。
+// 繋ぎかけのノードがあれば、繋ぎ終わるまで nullptr を返す。
+LogPipeline::Node* LogPipeline::dequeue()
+{
+    Node* tail = m_tail;
+    Node* next = tail->next.load(std::memory_order_acquire);
+
+    if (tail == &m_stub)
+    {
+        if (!next)
+            return nullptr;
+        m_tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next)
+    {
+        m_tail = next;
+        return tail;
+    }
+
+    if (tail != m_head.load(std::memory_order_acquire))
+        return nullptr;
+
+    // 最後の一つを取り出すために、スタブを後ろに繋ぎ直す。
+    m_stub.next.store(nullptr, std::memory_order_relaxed);
+    enqueue(&m_stub);
+
+    next = tail->next.load(std::memory_order_acquire);
+    if (next)
+    {
+        m_tail = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+// ------------------------------------
+size_t LogPipeline::drain()
+{
+    size_t count = 0;
+    while (Node* n = dequeue())
+    {
+        m_sink(n->time, n->type, n->line.c_str());
+        delete n;
+        m_queued.fetch_sub(1);
+        m_delivered.fetch_add(1);
+        count++;
+    }
+
+    unsigned int dropped = m_dropped.exchange(0);
+    if (dropped)
+    {
+        m_sink(sys ? sys->getTime() : 0, LogBuffer::T_WARN,
+               str::format("Log queue full, %u lines dropped", dropped).c_str());
+    }
+    return count;
+}
+
+// ------------------------------------
+void LogPipeline::writerMain()
+{
+    sys->setThreadName("LOG WRITER");
+
+    unsigned int lastSweep = 0;
+    while (!m_quit.load())
+    {
+        drain();
+
+        unsigned int now = sys->getTime();
+        if (now != lastSweep)
+        {
+            sweepRates(now);
+            lastSweep = now;
+        }
+
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_waiting = true;
+        if (m_queued.load() == 0 && !m_quit.load())
+        {
+            m_cond.wait_for(lk, std::chrono::seconds(1));
+            m_waiting = false;
+        }else
+        {
+            // 繋ぎかけのノードを待つ。
+            m_waiting = false;
+            lk.unlock();
+            std::this_thread::yield();
+        }
+    }
+    drain();
+}
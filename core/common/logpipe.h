@@ -0,0 +1,127 @@
+// ------------------------------------------------
+// File : logpipe.h
+// Desc:
+//      ログの非同期配送。ログを出すスレッドは整形した行をロックの無い
+//      キューに入れるだけで、LogBuffer やリスナー、コンソールへの書き
+//      込みは専用のスレッドが行う。呼び出し元ごとの一秒あたりの行数
+//      も制限する。
+//
+//      start() する前と stop() した後は、呼び出したスレッドでそのまま
+//      配送する。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _LOGPIPE_H
+#define _LOGPIPE_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "logbuf.h"
+
+// ------------------------------------
+class LogPipeline
+{
+public:
+    enum
+    {
+        MAX_QUEUED = 10000,     // これを超えた行は捨てて数だけ数える
+        RATE_SLOTS = 1024,      // 呼び出し元を覚える枠の数
+    };
+
+    typedef std::function<void(unsigned int time, LogBuffer::TYPE type, const char* line)> Sink;
+
+    LogPipeline(Sink sink);
+    ~LogPipeline();
+
+    void    start();
+    void    stop();
+    bool    running() const { return m_running.load(); }
+
+    // 行を配送する。書き込みスレッドが動いていなければ、その場で sink
+    // を呼ぶ。
+    void    push(unsigned int time, LogBuffer::TYPE type, std::string&& line);
+
+    // それまでに push した行が配送されるのを待つ。
+    void    flush();
+
+    // site からの行を now の秒に出してよいか。一秒に limit 行を超えた
+    // 分は false を返し、次の秒になってから抑えた数を一行で知らせる。
+    // site にはフォーマット文字列を渡す。limit が 0 なら制限しない。
+    bool    admit(const char* site, unsigned int limit, unsigned int now);
+
+    uint64_t    numDropped() const { return m_totalDropped.load(); }
+    uint64_t    numSuppressed() const { return m_totalSuppressed.load(); }
+
+    // LogBuffer とアプリケーションのコンソールに書く。
+    static void defaultSink(unsigned int time, LogBuffer::TYPE type, const char* line);
+
+private:
+    struct Node
+    {
+        std::atomic<Node*>  next;
+        unsigned int        time;
+        LogBuffer::TYPE     type;
+        std::string         line;
+    };
+
+    struct RateSlot
+    {
+        std::atomic<const char*>    site;
+        std::atomic<unsigned int>   second;
+        std::atomic<unsigned int>   count;
+        std::atomic<unsigned int>   suppressed;
+    };
+
+    void    enqueue(Node* n);
+    Node*   dequeue();
+    size_t  drain();
+    void    reportSuppressed(RateSlot& slot, unsigned int now);
+    void    sweepRates(unsigned int now);
+    void    writerMain();
+
+    Sink                    m_sink;
+
+    // Vyukov の MPSC キュー。m_head には何本ものスレッドが繋ぎ、m_tail
+    // は書き込みスレッドだけが触る。
+    std::atomic<Node*>      m_head;
+    Node*                   m_tail;
+    Node                    m_stub;
+
+    std::atomic<int>        m_queued;
+    std::atomic<uint64_t>   m_pushed;
+    std::atomic<uint64_t>   m_delivered;
+    std::atomic<unsigned int> m_dropped;
+    std::atomic<uint64_t>   m_totalDropped;
+    std::atomic<uint64_t>   m_totalSuppressed;
+
+    RateSlot                m_rate[RATE_SLOTS];
+
+    std::atomic<bool>       m_running;
+    std::atomic<bool>       m_quit;
+    std::atomic<bool>       m_waiting;
+    std::mutex              m_mutex;
+    std::condition_variable m_cond;
+    std::thread             m_writer;
+    std::mutex              m_controlLock;  // start と stop
+};
+
+extern LogPipeline g_logPipeline;
+
+#endif
@@ -2,8 +2,8 @@
 #define _MATROSKA_H
 
 #include <stdint.h>
+#include <stdexcept>
 #include <string>
-#include <map>
 
 #include "stream.h"
 
@@ -12,74 +12,133 @@ namespace matroska
 
 typedef std::basic_string<uint8_t> byte_string;
 
-const std::map<std::basic_string<uint8_t>, std::string>
-ID_TO_NAME = {
-    { {0x1A,0x45,0xDF,0xA3}, "EBML" },
-    { {0x18,0x53,0x80,0x67}, "Segment" },
-    { {0x1F,0x43,0xB6,0x75}, "Cluster" },
-    { {0xA3}, "SimpleBlock" },
-    { {0x42,0x86}, "EBMLVersion" },
-    { {0x42,0xF7}, "EBMLReadVersion" },
-    { {0x42,0xF2}, "EBMLMaxIDLength" },
-    { {0x42,0xF3}, "EBMLMaxSizeLength" },
-    { {0x42,0x82}, "DocType" },
-    { {0x42,0x87}, "DocTypeVersion" },
-    { {0x42,0x85}, "DocTypeReadVersion" },
-    { {0x11,0x4D,0x9B,0x74}, "SeekHead" },
-    { {0xEC}, "Void" },
-    { {0x16,0x54,0xAE,0x6B}, "Tracks" },
-    { {0xAE}, "TrackEntry" },
-    { {0xD7}, "TrackNumber" },
-    { {0x73,0xC5}, "TrackUID" },
-    { {0x83}, "TrackType" },
-    { {0x12,0x54,0xC3,0x67}, "Tags" },
-    { {0x15,0x49,0xA9,0x66}, "Info" },
-    { {0xE7}, "Timecode" },
-    { {0x1C,0x53,0xBB,0x6B}, "Cues" },
-    { {0x2A,0xD7,0xB1}, "TimecodeScale" },
-    { {0x4D,0x80}, "MuxingApp" },
-    { {0x44,0x89}, "Duration" },
-    { {0x57,0x41}, "WritingApp" },
-    { {0x73,0xA4}, "SegmentUID" },
-    { {0x73,0x73}, "Tag" },
-    { {0x63,0xC0}, "Targets" },
-    { {0x67,0xC8}, "SimpleTag" },
-    { {0x63,0xC5}, "TagTrackUID" },
-    { {0x44,0x87}, "TagString" },
-    { {0x45,0xA3}, "TagName" },
-    { {0x4D,0xBB}, "Seek" },
-    { {0x53,0xAB}, "SeekID" },
-    { {0x53,0xAC}, "SeekPosition" },
-    { {0xBF}, "CRC-32" },
+// 要素 ID。長さを表す先頭のビットも含めた値。
+enum : uint32_t
+{
+    ID_EBML                 = 0x1A45DFA3,
+    ID_EBMLVERSION          = 0x4286,
+    ID_EBMLREADVERSION      = 0x42F7,
+    ID_EBMLMAXIDLENGTH      = 0x42F2,
+    ID_EBMLMAXSIZELENGTH    = 0x42F3,
+    ID_DOCTYPE              = 0x4282,
+    ID_DOCTYPEVERSION       = 0x4287,
+    ID_DOCTYPEREADVERSION   = 0x4285,
+    ID_SEGMENT              = 0x18538067,
+    ID_SEEKHEAD             = 0x114D9B74,
+    ID_SEEK                 = 0x4DBB,
+    ID_SEEKID               = 0x53AB,
+    ID_SEEKPOSITION         = 0x53AC,
+    ID_VOID                 = 0xEC,
+    ID_CRC32                = 0xBF,
+    ID_INFO                 = 0x1549A966,
+    ID_SEGMENTUID           = 0x73A4,
+    ID_TIMECODESCALE        = 0x2AD7B1,
+    ID_DURATION             = 0x4489,
+    ID_MUXINGAPP            = 0x4D80,
+    ID_WRITINGAPP           = 0x5741,
+    ID_CLUSTER              = 0x1F43B675,
+    ID_TIMECODE             = 0xE7,
+    ID_SIMPLEBLOCK          = 0xA3,
+    ID_TRACKS               = 0x1654AE6B,
+    ID_TRACKENTRY           = 0xAE,
+    ID_TRACKNUMBER          = 0xD7,
+    ID_TRACKUID             = 0x73C5,
+    ID_TRACKTYPE            = 0x83,
+    ID_CUES                 = 0x1C53BB6B,
+    ID_TAGS                 = 0x1254C367,
+    ID_TAG                  = 0x7373,
+    ID_TARGETS              = 0x63C0,
+    ID_TAGTRACKUID          = 0x63C5,
+    ID_SIMPLETAG            = 0x67C8,
+    ID_TAGNAME              = 0x45A3,
+    ID_TAGSTRING            = 0x4487,
 };
 
+// 要素 ID の名前。知らない ID なら "Unknown"。
+inline const char* idToName(uint64_t id)
+{
+    switch (id)
+    {
+    case ID_EBML:               return "EBML";
+    case ID_EBMLVERSION:        return "EBMLVersion";
+    case ID_EBMLREADVERSION:    return "EBMLReadVersion";
+    case ID_EBMLMAXIDLENGTH:    return "EBMLMaxIDLength";
+    case ID_EBMLMAXSIZELENGTH:  return "EBMLMaxSizeLength";
+    case ID_DOCTYPE:            return "DocType";
+    case ID_DOCTYPEVERSION:     return "DocTypeVersion";
+    case ID_DOCTYPEREADVERSION: return "DocTypeReadVersion";
+    case ID_SEGMENT:            return "Segment";
+    case ID_SEEKHEAD:           return "SeekHead";
+    case ID_SEEK:               return "Seek";
+    case ID_SEEKID:             return "SeekID";
+    case ID_SEEKPOSITION:       return "SeekPosition";
+    case ID_VOID:               return "Void";
+    case ID_CRC32:              return "CRC-32";
+    case ID_INFO:               return "Info";
+    case ID_SEGMENTUID:         return "SegmentUID";
+    case ID_TIMECODESCALE:      return "TimecodeScale";
+    case ID_DURATION:           return "Duration";
+    case ID_MUXINGAPP:          return "MuxingApp";
+    case ID_WRITINGAPP:         return "WritingApp";
+    case ID_CLUSTER:            return "Cluster";
+    case ID_TIMECODE:           return "Timecode";
+    case ID_SIMPLEBLOCK:        return "SimpleBlock";
+    case ID_TRACKS:             return "Tracks";
+    case ID_TRACKENTRY:         return "TrackEntry";
+    case ID_TRACKNUMBER:        return "TrackNumber";
+    case ID_TRACKUID:           return "TrackUID";
+    case ID_TRACKTYPE:          return "TrackType";
+    case ID_CUES:               return "Cues";
+    case ID_TAGS:               return "Tags";
+    case ID_TAG:                return "Tag";
+    case ID_TARGETS:            return "Targets";
+    case ID_TAGTRACKUID:        return "TagTrackUID";
+    case ID_SIMPLETAG:          return "SimpleTag";
+    case ID_TAGNAME:            return "TagName";
+    case ID_TAGSTRING:          return "TagString";
+    default:                    return "Unknown";
+    }
+}
+
+// 可変長整数。バイト列をそのまま持ち、値は作る時に求めておく。
 // UNKNOWN 値の対応要る？
 class VInt
 {
 public:
-    VInt(const std::basic_string<uint8_t>& aBytes)
-        : bytes(aBytes)
+    enum { MAX_LENGTH = 8 };
+
+    VInt(const byte_string& aBytes)
+        : VInt(aBytes.data(), aBytes.size())
     {
-        if (bytes[0] == 0xff)
+    }
+
+    // p から始まる len バイトの先頭の VInt。
+    VInt(const uint8_t* p, size_t len)
+    {
+        if (len == 0)
+            throw std::runtime_error("bad data");
+        if (p[0] == 0xff)
             throw std::runtime_error("UNKNOWN value not supported");
-        auto nzeroes = numLeadingZeroes(bytes[0]);
+        auto nzeroes = numLeadingZeroes(p[0]);
         if (nzeroes > 7)
             throw std::runtime_error("bad data");
-    }
+        m_length = nzeroes + 1;
+        if ((size_t) m_length > len)
+            throw std::runtime_error("bad data");
 
-    uint64_t uint()
-    {
-        auto zeroes = numLeadingZeroes(bytes[0]);
-        auto len = zeroes + 1;
-        uint64_t value = ((bytes[0] << len) & 0xff) >> len;
-        for (int i = 0; i < zeroes; i++)
+        m_raw = p[0];
+        m_value = p[0] & (0xff >> m_length);
+        m_bytes[0] = p[0];
+        for (int i = 1; i < m_length; i++)
         {
-            value <<= 8;
-            value |= bytes[i+1];
+            m_bytes[i] = p[i];
+            m_raw = (m_raw << 8) | p[i];
+            m_value = (m_value << 8) | p[i];
         }
-        return value;
     }
 
+    uint64_t uint() const { return m_value; }
+
     static int numLeadingZeroes(uint8_t byte)
     {
         if (byte >= 0x80) return 0;
@@ -95,29 +154,78 @@ public:
 
     static VInt read(Stream& is)
     {
-        uint8_t b = is.readChar();
-        int nzeroes = numLeadingZeroes(b);
+        uint8_t buf[MAX_LENGTH];
+        buf[0] = is.readChar();
+        int nzeroes = numLeadingZeroes(buf[0]);
         if (nzeroes > 7)
             throw std::runtime_error("bad data");
-        std::basic_string<uint8_t> bytes;
-        bytes += b;
-        for (int i = 0; i < nzeroes; i++)
-            bytes += is.readChar();
-        return VInt(bytes);
+        for (int pos = 1; pos <= nzeroes; )
+            pos += is.read(buf + pos, nzeroes + 1 - pos);
+        return VInt(buf, nzeroes + 1);
     }
 
-    std::string toName()
-    {
-        auto it = ID_TO_NAME.find(bytes);
-        if (it != ID_TO_NAME.end())
-            return it->second;
-        else
-            return "Unknown";
-    }
+    // 要素 ID として見た値。ID_* と比べる。
+    uint64_t id() const { return m_raw; }
+
+    const char* toName() const { return idToName(m_raw); }
 
-    const std::basic_string<uint8_t> bytes;
+    // 符号化されたバイト列。
+    const uint8_t* data() const { return m_bytes; }
+    int size() const { return m_length; }
+    byte_string bytes() const { return byte_string(m_bytes, m_length); }
+
+private:
+    uint8_t  m_bytes[MAX_LENGTH];
+    int      m_length;
+    uint64_t m_value;
+    uint64_t m_raw;
 };
 
+// p から始まる avail バイトのデータから VInt を読んで value に入れ、
+// 読んだバイト数を返す。データが足りなければ 0 を返す。raw が真なら
+// 長さのビットを残す (要素 ID 用)。
+inline int readVInt(const uint8_t* p, size_t avail, uint64_t& value, bool raw)
+{
+    if (avail == 0)
+        return 0;
+    if (p[0] == 0xff)
+        throw std::runtime_error("UNKNOWN value not supported");
+    int zeroes = VInt::numLeadingZeroes(p[0]);
+    if (zeroes > 7)
+        throw std::runtime_error("bad data");
+    int len = zeroes + 1;
+    if ((size_t) len > avail)
+        return 0;
+
+    value = raw ? p[0] : (p[0] & (0xff >> len));
+    for (int i = 1; i < len; i++)
+        value = (value << 8) | p[i];
+    return len;
+}
+
+// 要素の ID とサイズ。length は ID とサイズのバイト数の合計。
+struct ElementHeader
+{
+    uint64_t id;
+    uint64_t size;
+    int      length;
+};
+
+// メモリー上の要素のヘッダーを読む。要素の中身がすべて avail に収まっ
+// ていなければ例外を投げる。
+inline ElementHeader readElementHeader(const uint8_t* p, size_t avail)
+{
+    ElementHeader h;
+    int n = readVInt(p, avail, h.id, true);
+    int m = n ? readVInt(p + n, avail - n, h.size, false) : 0;
+    if (m == 0)
+        throw std::runtime_error("truncated element");
+    h.length = n + m;
+    if (h.size > avail - h.length)
+        throw std::runtime_error("truncated element");
+    return h;
+}
+
 } // namespace matroska
 
 #endif
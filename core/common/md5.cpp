@@ -78,7 +78,8 @@ namespace md5
  * link-time optimizations.  For the time being, keeping these MD5 routines in
  * their own translation unit avoids the problem.
  */
-#if defined(__i386__) || defined(__x86_64__) || defined(__vax__)
+#if defined(__i386__) || defined(__x86_64__) || defined(__vax__) || \
+    (defined(__aarch64__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
 #define SET(n) \
     (*(MD5_u32plus *)&ptr[(n) * 4])
 #define GET(n) \
@@ -291,12 +292,12 @@ void MD5_Final(unsigned char *result, MD5_CTX *ctx)
 
 } // namespace md5
 
-#include <cstdio>
-
 namespace md5 {
 
-std::string hexdigest(std::string str)
+std::string hexdigest(const std::string& str)
 {
+    static const char digits[] = "0123456789abcdef";
+
     MD5_CTX ctx;
     unsigned char outbuf[16];
 
@@ -304,13 +305,14 @@ std::string hexdigest(std::string str)
     MD5_Update(&ctx, str.data(), str.size());
     MD5_Final(outbuf, &ctx);
 
-    char charbuf[33];
+    char charbuf[32];
     for (int i = 0; i < 16; i++)
     {
-        std::sprintf(charbuf + i*2, "%02x", outbuf[i]);
+        charbuf[i*2]   = digits[outbuf[i] >> 4];
+        charbuf[i*2+1] = digits[outbuf[i] & 0xf];
     }
 
-    return charbuf;
+    return std::string(charbuf, sizeof(charbuf));
 }
 
 }
@@ -44,7 +44,7 @@ extern void MD5_Init(MD5_CTX *ctx);
 extern void MD5_Update(MD5_CTX *ctx, const void *data, unsigned long size);
 extern void MD5_Final(unsigned char *result, MD5_CTX *ctx);
 
-std::string hexdigest(std::string str);
+std::string hexdigest(const std::string& str);
 
 } // namespace md5
 
@@ -0,0 +1,182 @@
+// ------------------------------------------------
+// File : membudget.cpp
+// Desc:
+//      見積もりは sizeof とバッファーの中のデータ長から計算する。アリー
+//      ナのチャンクの余りやヒープの断片化は数えない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+
+#include "membudget.h"
+#include "chanmgr.h"
+#include "channel.h"
+#include "logbuf.h"
+#include "notif.h"
+#include "servent.h"
+#include "servmgr.h"
+#include "coldchan.h"
+
+MemoryBudget g_memoryBudget;
+
+// ------------------------------------
+MemoryBudget::MemoryBudget()
+    : numShrunk(0)
+    , numEvicted(0)
+    , numHitsTrimmed(0)
+{
+}
+
+// ------------------------------------
+MemoryBudget::Usage MemoryBudget::measure()
+{
+    Usage u;
+
+    if (chanMgr)
+    {
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+        for (auto ch = chanMgr->channel; ch; ch = ch->next)
+        {
+            auto bytes = ch->memoryUsage();
+            u.channels += bytes;
+            if (!ch->thread.active())
+                u.closing += bytes;
+        }
+        for (auto chl = chanMgr->hitlist; chl; chl = chl->next)
+            u.hitLists += chl->memoryUsage();
+    }
+
+    if (servMgr)
+    {
+        std::lock_guard<ProfiledMutex> cs(servMgr->lock);
+        for (Servent* s = servMgr->servents; s; s = s->next)
+            u.servents += sizeof(Servent);
+    }
+
+    if (sys && sys->logBuf)
+    {
+        auto lb = sys->logBuf;
+        u.logs += (uint64_t) lb->maxLines * (lb->lineLen + sizeof(unsigned int) + sizeof(LogBuffer::TYPE));
+    }
+    {
+        std::lock_guard<ProfiledMutex> cs(g_notificationBuffer.lock);
+        for (auto& e : g_notificationBuffer.notifications)
+            u.logs += sizeof(e) + e.notif.message.size();
+    }
+
+    u.cold = g_coldChannels.memoryUsage();
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_lastUsage = u;
+    return u;
+}
+
+// ------------------------------------
+// アイドルなチャンネルのバッファーをデフォルトのスロット数に戻す。縮
+// めたものがあれば true。
+bool MemoryBudget::shrinkIdleBuffers()
+{
+    bool shrunk = false;
+
+    std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+    for (auto ch = chanMgr->channel; ch; ch = ch->next)
+    {
+        if (ch->status != Channel::S_IDLE || !ch->thread.active())
+            continue;
+        if (ch->rawData.capacity <= ChanPacketBuffer::MAX_PACKETS)
+            continue;
+
+        LOG_INFO("Memory budget: shrinking buffer of idle channel %s", ch->info.id.str().c_str());
+        ch->rawData.setCapacity(ChanPacketBuffer::MAX_PACKETS);
+        numShrunk++;
+        shrunk = true;
+    }
+    return shrunk;
+}
+
+// ------------------------------------
+// 長いヒットのリストを半分にする。捨てたヒットの数を返す。
+int MemoryBudget::trimHitLists()
+{
+    int n = 0;
+
+    std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+    for (auto chl = chanMgr->hitlist; chl; chl = chl->next)
+    {
+        std::lock_guard<ProfiledMutex> cs1(chl->lock);
+        unsigned int size = chl->numHits();
+        if (size <= MIN_HITS_PER_CHANNEL)
+            continue;
+        n += chl->trimHits(std::max<unsigned int>(MIN_HITS_PER_CHANNEL, size / 2));
+    }
+
+    if (n)
+        LOG_INFO("Memory budget: trimmed %d hits", n);
+    numHitsTrimmed += n;
+    return n;
+}
+
+// ------------------------------------
+void MemoryBudget::enforce(uint64_t budget)
+{
+    auto u = measure();
+    if (budget == 0)
+        return;
+
+    // 閉じている途中のチャンネルの分はじきに空くので数えない。
+    if (u.total() - u.closing <= budget)
+        return;
+
+    if (shrinkIdleBuffers())
+        return;
+
+    if (chanMgr->closeOldestIdle())
+    {
+        LOG_INFO("Memory budget: closed oldest idle channel");
+        numEvicted++;
+        return;
+    }
+
+    if (g_coldChannels.evictOldest())
+    {
+        LOG_INFO("Memory budget: dropped oldest cold channel");
+        return;
+    }
+
+    trimHitLists();
+}
+
+// ------------------------------------
+amf0::Value MemoryBudget::getState()
+{
+    Usage u;
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        u = m_lastUsage;
+    }
+
+    return amf0::Value::object(
+        {
+            {"budget", chanMgr ? (double) chanMgr->memoryBudget * 1024 * 1024 : 0.0},
+            {"total", (double) u.total()},
+            {"channels", (double) u.channels},
+            {"closing", (double) u.closing},
+            {"hitLists", (double) u.hitLists},
+            {"servents", (double) u.servents},
+            {"logs", (double) u.logs},
+            {"cold", (double) u.cold},
+            {"numShrunk", (int) numShrunk.load()},
+            {"numEvicted", (int) numEvicted.load()},
+            {"numHitsTrimmed", (int) numHitsTrimmed.load()},
+        });
+}
@@ -0,0 +1,74 @@
+// ------------------------------------------------
+// File : membudget.h
+// Desc:
+//      サブシステムごとのメモリーの使用量を見積もり、chanMgr->memoryBudget
+//      を超えた時はアイドルなチャンネルのバッファーを縮め、アイドルなチ
+//      ャンネルを閉じ、ヒットのリストを短くする。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _MEMBUDGET_H
+#define _MEMBUDGET_H
+
+#include <atomic>
+#include <mutex>
+
+#include "amf0.h"
+
+// ------------------------------------
+class MemoryBudget
+{
+public:
+    enum
+    {
+        MIN_HITS_PER_CHANNEL = 50,  // ヒットのリストをこれより短くはしない
+    };
+
+    // 見積もったバイト数。
+    struct Usage
+    {
+        uint64_t channels = 0;  // チャンネルとそのパケットバッファー
+        uint64_t closing = 0;   // channels のうち、閉じている途中のもの
+        uint64_t hitLists = 0;
+        uint64_t servents = 0;
+        uint64_t logs = 0;      // ログと通知
+        uint64_t cold = 0;      // 閉じたチャンネルの冷えた状態
+
+        uint64_t total() const { return channels + hitLists + servents + logs + cold; }
+    };
+
+    MemoryBudget();
+
+    Usage   measure();
+
+    // 使用量が budget バイトを超えていれば減らす。一回に一段階ずつ進
+    // めるので、定期的に呼ぶ。
+    void    enforce(uint64_t budget);
+
+    amf0::Value getState();
+
+    std::atomic<unsigned int> numShrunk;        // バッファーを縮めたチャンネルの数
+    std::atomic<unsigned int> numEvicted;       // 閉じたアイドルなチャンネルの数
+    std::atomic<unsigned int> numHitsTrimmed;   // 捨てたヒットの数
+
+private:
+    bool    shrinkIdleBuffers();
+    int     trimHitLists();
+
+    std::mutex  m_lock;
+    Usage       m_lastUsage;
+};
+
+extern MemoryBudget g_memoryBudget;
+
+#endif
@@ -0,0 +1,320 @@
+// ------------------------------------------------
+// File : metrics.cpp
+// Desc:
+//      render は chanMgr->lock と servMgr->lock を順に短く取る。チャン
+//      ネルや接続が多くても一回の要求で作るのは文字列一つだけ。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "metrics.h"
+#include "stats.h"
+#include "str.h"
+#include "servmgr.h"
+#include "chanmgr.h"
+#include "channel.h"
+#include "servent.h"
+#include "membudget.h"
+
+// global
+Metrics g_metrics;
+
+// ------------------------------------
+Metrics::Histogram::Histogram(const std::vector<double>& bounds)
+    : m_bounds(bounds)
+    , m_buckets(new std::atomic<uint64_t>[bounds.size() + 1])
+    , m_count(0)
+    , m_sumMicros(0)
+{
+    for (size_t i = 0; i <= m_bounds.size(); i++)
+        m_buckets[i] = 0;
+}
+
+// ------------------------------------
+std::vector<double> Metrics::Histogram::exponentialBounds(double first, double factor, int n)
+{
+    std::vector<double> bounds;
+    double b = first;
+    for (int i = 0; i < n; i++)
+    {
+        bounds.push_back(b);
+        b *= factor;
+    }
+    return bounds;
+}
+
+// ------------------------------------
+std::vector<uint64_t> Metrics::Histogram::counts() const
+{
+    std::vector<uint64_t> res;
+    for (size_t i = 0; i <= m_bounds.size(); i++)
+        res.push_back(m_buckets[i].load());
+    return res;
+}
+
+// ------------------------------------
+double Metrics::Histogram::quantile(double q) const
+{
+    auto c = counts();
+    uint64_t total = 0;
+    for (auto n : c)
+        total += n;
+    if (total == 0 || m_bounds.empty())
+        return 0;
+
+    uint64_t rank = (uint64_t) (q * total);
+    if (rank >= total)
+        rank = total - 1;
+
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < m_bounds.size(); i++)
+    {
+        cumulative += c[i];
+        if (cumulative > rank)
+            return m_bounds[i];
+    }
+    return m_bounds.back();
+}
+
+// ------------------------------------
+void Metrics::Histogram::observe(double value)
+{
+    size_t i = 0;
+    while (i < m_bounds.size() && value > m_bounds[i])
+        i++;
+    m_buckets[i]++;
+    m_count++;
+    if (value > 0)
+        m_sumMicros += (uint64_t) (value * 1000000);
+}
+
+// ------------------------------------
+void Metrics::Histogram::write(std::string& out, const std::string& name, const std::string& help) const
+{
+    out += str::format("# HELP %s %s\n", name.c_str(), help.c_str());
+    out += str::format("# TYPE %s histogram\n", name.c_str());
+
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < m_bounds.size(); i++)
+    {
+        cumulative += m_buckets[i].load();
+        out += str::format("%s_bucket{le=\"%g\"} %llu\n", name.c_str(), m_bounds[i], (unsigned long long) cumulative);
+    }
+    cumulative += m_buckets[m_bounds.size()].load();
+    out += str::format("%s_bucket{le=\"+Inf\"} %llu\n", name.c_str(), (unsigned long long) cumulative);
+    out += str::format("%s_sum %.6f\n", name.c_str(), m_sumMicros.load() / 1000000.0);
+    out += str::format("%s_count %llu\n", name.c_str(), (unsigned long long) cumulative);
+}
+
+// ------------------------------------
+Metrics::Metrics()
+    : handshakeLatency({ 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 })
+    // 1ms から約 16 秒まで。
+    , incomingRequestLatency(Histogram::exponentialBounds(0.001, 2, 15))
+    , streamHandshakeLatency(Histogram::exponentialBounds(0.001, 2, 15))
+    , outgoingPCPHandshakeLatency(Histogram::exponentialBounds(0.001, 2, 15))
+    // 1ms から約 32 秒まで。中継の段数が深いとここが伸びる。
+    , packetAge(Histogram::exponentialBounds(0.001, 2, 16))
+    , traceAge(Histogram::exponentialBounds(0.001, 2, 16))
+{
+}
+
+// ------------------------------------
+std::vector<Metrics::NamedHistogram> Metrics::histograms() const
+{
+    return {
+        { "peercast_handshake_duration_seconds", "handshake",
+          "Time from the start of a handshake until the connection is established.", &handshakeLatency },
+        { "peercast_incoming_request_duration_seconds", "incomingRequest",
+          "Time to serve an incoming request that did not become a stream.", &incomingRequestLatency },
+        { "peercast_stream_handshake_duration_seconds", "streamHandshake",
+          "Time spent in the stream handshake of a relay or direct connection.", &streamHandshakeLatency },
+        { "peercast_outgoing_pcp_handshake_duration_seconds", "outgoingPCPHandshake",
+          "Time spent in an outgoing PCP handshake.", &outgoingPCPHandshakeLatency },
+        { "peercast_packet_age_seconds", "packetAge",
+          "Age of a packet when it is written to a downstream connection.", &packetAge },
+        { "peercast_trace_age_seconds", "traceAge",
+          "Time since a traced packet left its origin, measured when it arrives.", &traceAge },
+    };
+}
+
+// ------------------------------------
+std::string Metrics::escapeLabelValue(const std::string& value)
+{
+    std::string res;
+    for (char c : value)
+    {
+        if (c == '\\')
+            res += "\\\\";
+        else if (c == '"')
+            res += "\\\"";
+        else if (c == '\n')
+            res += "\\n";
+        else
+            res += c;
+    }
+    return res;
+}
+
+// ------------------------------------
+// 同じ名前の行の前に HELP と TYPE を一度だけ書く。
+static void header(std::string& out, const char* name, const char* type, const char* help)
+{
+    out += str::format("# HELP %s %s\n", name, help);
+    out += str::format("# TYPE %s %s\n", name, type);
+}
+
+// ------------------------------------
+std::string Metrics::render()
+{
+    std::string out;
+
+    const struct { const char* name; Stats::STAT stat; const char* help; } counters[] = {
+        { "peercast_bytes_in_total",          Stats::BYTESIN,       "Bytes received on all sockets." },
+        { "peercast_bytes_out_total",         Stats::BYTESOUT,      "Bytes sent on all sockets." },
+        { "peercast_local_bytes_in_total",    Stats::LOCALBYTESIN,  "Bytes received from local hosts." },
+        { "peercast_local_bytes_out_total",   Stats::LOCALBYTESOUT, "Bytes sent to local hosts." },
+        { "peercast_packets_in_total",        Stats::NUMPACKETSIN,  "PCP packets received." },
+        { "peercast_packets_out_total",       Stats::NUMPACKETSOUT, "PCP packets sent." },
+    };
+    for (auto& c : counters)
+    {
+        header(out, c.name, "counter", c.help);
+        out += str::format("%s %u\n", c.name, stats.getCurrent(c.stat));
+    }
+
+    header(out, "peercast_bytes_in_per_second", "gauge", "Receive rate over the last stats interval.");
+    out += str::format("peercast_bytes_in_per_second %u\n", stats.getPerSecond(Stats::BYTESIN));
+    header(out, "peercast_bytes_out_per_second", "gauge", "Send rate over the last stats interval.");
+    out += str::format("peercast_bytes_out_per_second %u\n", stats.getPerSecond(Stats::BYTESOUT));
+
+    for (auto& h : histograms())
+        h.histogram->write(out, h.name, h.help);
+
+    {
+        auto u = g_memoryBudget.measure();
+        const struct { const char* subsystem; uint64_t bytes; } subsystems[] = {
+            { "channels",  u.channels },
+            { "hit_lists", u.hitLists },
+            { "servents",  u.servents },
+            { "logs",      u.logs },
+        };
+        header(out, "peercast_memory_bytes", "gauge", "Estimated memory used by each subsystem.");
+        for (auto& s : subsystems)
+            out += str::format("peercast_memory_bytes{subsystem=\"%s\"} %llu\n", s.subsystem, (unsigned long long) s.bytes);
+        header(out, "peercast_memory_budget_bytes", "gauge", "Configured memory budget. 0 if unlimited.");
+        out += str::format("peercast_memory_budget_bytes %llu\n",
+                           chanMgr ? (unsigned long long) chanMgr->memoryBudget * 1024 * 1024 : 0ULL);
+        header(out, "peercast_memory_evicted_channels_total", "counter", "Idle channels closed to stay within the memory budget.");
+        out += str::format("peercast_memory_evicted_channels_total %u\n", g_memoryBudget.numEvicted.load());
+        header(out, "peercast_memory_trimmed_hits_total", "counter", "Hits dropped to stay within the memory budget.");
+        out += str::format("peercast_memory_trimmed_hits_total %u\n", g_memoryBudget.numHitsTrimmed.load());
+    }
+
+    if (chanMgr)
+    {
+        std::string listeners, relays, totalListeners, bitrate, sourceRate, bufferBytes, bufferPackets, streamPos, memory;
+
+        {
+            std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+            for (auto c = chanMgr->channel; c != nullptr; c = c->next)
+            {
+                uint64_t buffered;
+                {
+                    std::lock_guard<ProfiledMutex> cs1(c->rawData.lock);
+                    buffered = c->rawData.totalBytes;
+                }
+
+                auto labels = str::format("{channel_id=\"%s\",name=\"%s\",status=\"%s\"}",
+                                          c->info.id.str().c_str(),
+                                          escapeLabelValue(c->info.name.cstr()).c_str(),
+                                          c->getStatusStr());
+                listeners      += str::format("peercast_channel_listeners%s %d\n", labels.c_str(), c->localListeners());
+                relays         += str::format("peercast_channel_relays%s %d\n", labels.c_str(), c->localRelays());
+                totalListeners += str::format("peercast_channel_total_listeners%s %d\n", labels.c_str(), c->totalListeners());
+                bitrate        += str::format("peercast_channel_bitrate_kbps%s %d\n", labels.c_str(), c->info.bitrate);
+                sourceRate     += str::format("peercast_channel_source_bytes_per_second%s %d\n", labels.c_str(),
+                                              c->sourceData ? c->sourceData->getSourceRate() : 0);
+                bufferBytes    += str::format("peercast_channel_buffer_bytes%s %llu\n", labels.c_str(),
+                                              (unsigned long long) buffered);
+                bufferPackets  += str::format("peercast_channel_buffer_packets%s %u\n", labels.c_str(),
+                                              c->rawData.writePos ? c->rawData.lastPos - c->rawData.firstPos + 1 : 0);
+                streamPos      += str::format("peercast_channel_stream_position_bytes%s %u\n", labels.c_str(), (unsigned int) c->streamPos);
+                memory         += str::format("peercast_channel_memory_bytes%s %llu\n", labels.c_str(),
+                                              (unsigned long long) c->memoryUsage());
+            }
+        }
+
+        header(out, "peercast_channel_listeners", "gauge", "Direct listeners on this node.");
+        out += listeners;
+        header(out, "peercast_channel_relays", "gauge", "Relays served by this node.");
+        out += relays;
+        header(out, "peercast_channel_total_listeners", "gauge", "Listeners reported by the whole network.");
+        out += totalListeners;
+        header(out, "peercast_channel_bitrate_kbps", "gauge", "Announced bitrate.");
+        out += bitrate;
+        header(out, "peercast_channel_source_bytes_per_second", "gauge", "Rate received from the source.");
+        out += sourceRate;
+        header(out, "peercast_channel_buffer_bytes", "gauge", "Bytes held in the packet buffer.");
+        out += bufferBytes;
+        header(out, "peercast_channel_buffer_packets", "gauge", "Packets held in the packet buffer.");
+        out += bufferPackets;
+        header(out, "peercast_channel_stream_position_bytes", "counter", "Stream position of the newest packet.");
+        out += streamPos;
+        header(out, "peercast_channel_memory_bytes", "gauge", "Estimated memory used by the channel and its buffer.");
+        out += memory;
+    }
+
+    if (servMgr)
+    {
+        std::string lag, maxLag, skips, skippedBytes, catchUps, hopLatency, bytesOut;
+
+        {
+            std::lock_guard<ProfiledMutex> cs(servMgr->lock);
+            for (Servent* s = servMgr->servents; s != nullptr; s = s->next)
+            {
+                if (s->type != Servent::T_DIRECT && s->type != Servent::T_RELAY)
+                    continue;
+                if (!s->isConnected())
+                    continue;
+
+                auto labels = str::format("{connection_id=\"%d\",type=\"%s\",channel_id=\"%s\"}",
+                                          s->serventIndex, s->getTypeStr(), s->chanID.str().c_str());
+                lag          += str::format("peercast_connection_lag_bytes%s %u\n", labels.c_str(), s->pacer.lagBytes.load());
+                maxLag       += str::format("peercast_connection_max_lag_bytes%s %u\n", labels.c_str(), s->pacer.maxLagBytes.load());
+                skips        += str::format("peercast_connection_skips_total%s %u\n", labels.c_str(), s->pacer.numSkips.load());
+                skippedBytes += str::format("peercast_connection_skipped_bytes_total%s %u\n", labels.c_str(), s->pacer.skippedBytes.load());
+                catchUps     += str::format("peercast_connection_catch_ups_total%s %u\n", labels.c_str(), s->pacer.numCatchUps.load());
+                hopLatency   += str::format("peercast_connection_hop_latency_seconds%s %.3f\n", labels.c_str(), s->pacer.hopLatency.load() / 1000.0);
+                bytesOut     += str::format("peercast_connection_bytes_out_per_second%s %u\n", labels.c_str(),
+                                            s->sock ? s->sock->bytesOutPerSec() : 0);
+            }
+        }
+
+        header(out, "peercast_connection_lag_bytes", "gauge", "Distance from the newest packet in the channel buffer.");
+        out += lag;
+        header(out, "peercast_connection_max_lag_bytes", "gauge", "Largest lag seen on this connection.");
+        out += maxLag;
+        header(out, "peercast_connection_skips_total", "counter", "Packets the sender missed.");
+        out += skips;
+        header(out, "peercast_connection_skipped_bytes_total", "counter", "Bytes skipped to catch up.");
+        out += skippedBytes;
+        header(out, "peercast_connection_catch_ups_total", "counter", "Times the sender was moved to a newer key frame.");
+        out += catchUps;
+        header(out, "peercast_connection_hop_latency_seconds", "gauge", "Moving average of the time a packet waits on this node.");
+        out += hopLatency;
+        header(out, "peercast_connection_bytes_out_per_second", "gauge", "Send rate of this connection.");
+        out += bytesOut;
+    }
+
+    return out;
+}
@@ -0,0 +1,100 @@
+// ------------------------------------------------
+// File : metrics.h
+// Desc:
+//      /metrics で返す Prometheus のテキスト形式の計測値を作る。全体の
+//      通信量のほか、チャンネルごとと接続ごとの値を出す。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Metrics;
+
+// global
+extern Metrics g_metrics;
+
+// ------------------------------------
+class Metrics
+{
+public:
+    // 上限ごとの度数を atomic で数えるヒストグラム。observe はロック
+    // を取らない。
+    class Histogram
+    {
+    public:
+        Histogram(const std::vector<double>& bounds);
+
+        // first から factor 倍ずつ n 個の上限。桁をまたぐ値を一定の相
+        // 対誤差で数える (HDR ヒストグラムと同じ考え方)。
+        static std::vector<double> exponentialBounds(double first, double factor, int n);
+
+        void    observe(double value);
+
+        // name_bucket, name_sum, name_count を out に書き足す。
+        void    write(std::string& out, const std::string& name, const std::string& help) const;
+
+        uint64_t count() const { return m_count.load(); }
+        double   sum() const { return m_sumMicros.load() / 1000000.0; }
+        const std::vector<double>& bounds() const { return m_bounds; }
+        // 上限ごとの度数 (累積しない)。最後の要素は上限を超えた分。
+        std::vector<uint64_t> counts() const;
+
+        // q (0〜1) 分位点を含む区間の上限。上限を超えた区間なら最後
+        // の上限。一つも無ければ 0。
+        double  quantile(double q) const;
+
+    private:
+        std::vector<double>                     m_bounds;
+        std::unique_ptr<std::atomic<uint64_t>[]> m_buckets; // 累積しない度数
+        std::atomic<uint64_t>                   m_count;
+        std::atomic<uint64_t>                   m_sumMicros;
+    };
+
+    Metrics();
+
+    // ハンドシェイクを始めてから接続するまでの秒数。
+    Histogram handshakeLatency;
+    // ストリームにならなかった受信要求 (UI や API) の処理にかかった秒数。
+    Histogram incomingRequestLatency;
+    // handshakeStream にかかった秒数。
+    Histogram streamHandshakeLatency;
+    // handshakeOutgoingPCP にかかった秒数。
+    Histogram outgoingPCPHandshakeLatency;
+    // パケットがバッファーに書かれてから下流へ送られるまでの秒数。
+    Histogram packetAge;
+    // 追跡の印が付いたパケットが配信元を出てから届くまでの秒数。
+    Histogram traceAge;
+
+    struct NamedHistogram
+    {
+        const char*      name;   // Prometheus の名前
+        const char*      key;    // JSON-RPC のキー
+        const char*      help;
+        const Histogram* histogram;
+    };
+    std::vector<NamedHistogram> histograms() const;
+
+    // テキスト形式 (text/plain; version=0.0.4) で全部を書き出す。
+    std::string render();
+
+    // ラベルの値の \ " 改行をエスケープする。
+    static std::string escapeLabelValue(const std::string& value);
+};
+
+#endif
@@ -1,17 +1,25 @@
 #include <limits.h> // INT_MAX
+#include <algorithm>
 
 #include "mkv.h"
 #include "channel.h"
 #include "stream.h"
 #include "matroska.h"
 #include "sstream.h"
+#include "chanmgr.h"
 
 using namespace matroska;
 
 // data を type パケットとして送信する
 void MKVStream::sendPacket(ChanPacket::TYPE type, const byte_string& data, bool continuation, std::shared_ptr<Channel> ch)
 {
-    if (data.size() > ChanPacket::MAX_DATALEN)
+    sendPacket(type, data.data(), data.size(), continuation, ch);
+}
+
+// data から len バイトを type パケットとして送信する
+void MKVStream::sendPacket(ChanPacket::TYPE type, const uint8_t* data, size_t len, bool continuation, std::shared_ptr<Channel> ch)
+{
+    if (len > ChanPacket::MAX_DATALEN)
         throw StreamException("MKV packet too big");
 
     if (type == ChanPacket::T_HEAD)
@@ -24,9 +32,9 @@ void MKVStream::sendPacket(ChanPacket::TYPE type, const byte_string& data, bool
     ChanPacket pack;
     pack.type = type;
     pack.pos  = ch->streamPos;
-    pack.len  = data.size();
+    pack.len  = len;
     pack.cont = continuation;
-    memcpy(pack.data, data.data(), data.size());
+    memcpy(pack.data, data, len);
 
     if (type == ChanPacket::T_HEAD)
         ch->headPack = pack;
@@ -37,54 +45,51 @@ void MKVStream::sendPacket(ChanPacket::TYPE type, const byte_string& data, bool
     ch->streamPos += pack.len;
 }
 
-bool MKVStream::hasKeyFrame(const byte_string& cluster)
+bool MKVStream::hasKeyFrame(const uint8_t* cluster, size_t len)
 {
-    MemoryStream in(const_cast<unsigned char*>(cluster.data()), cluster.size());
-
-    VInt id   = VInt::read(in);
-    VInt size = VInt::read(in);
+    auto header = readElementHeader(cluster, len);
+    const uint8_t* p   = cluster + header.length;
+    const uint8_t* end = p + header.size;
 
-    int64_t payloadRemaining = (int64_t) size.uint(); // 負数が取れるように signed にする
-    if (payloadRemaining < 0)
-        throw StreamException("MKV Parse error");
-    while (payloadRemaining > 0) // for each element in Cluster
+    while (p < end) // for each element in Cluster
     {
-        VInt id   = VInt::read(in);
-        VInt size = VInt::read(in);
-        std::string blockData = static_cast<Stream*>(&in)->read((int) size.uint());
+        auto elem = readElementHeader(p, end - p);
 
-        if (id.toName() == "SimpleBlock")
+        if (elem.id == ID_SIMPLEBLOCK)
         {
-            MemoryStream mem((void*)blockData.data(), blockData.size());
-
-            VInt trackno = VInt::read(mem);
-            if (trackno.uint() == m_videoTrackNumber)
+            const uint8_t* block = p + elem.length;
+            uint64_t trackno;
+            int n = readVInt(block, elem.size, trackno, false);
+            if (n && trackno == m_videoTrackNumber && elem.size > (uint64_t) n + 2)
             {
-                if (((uint8_t)blockData[trackno.bytes.size() + 2] & 0x80) != 0)
+                if ((block[n + 2] & 0x80) != 0)
                 {
                     m_hasKeyFrame = true;
                     return true; // キーフレームがある
                 }
             }
         }
-        payloadRemaining -= id.bytes.size() + size.bytes.size() + size.uint();
+        p += elem.length + elem.size;
     }
-    if (payloadRemaining != 0)
-        throw StreamException("MKV Parse error");
     return false;
 }
 
 uint64_t MKVStream::unpackUnsignedInt(const std::string& bytes)
 {
-    if (bytes.size() == 0)
+    return unpackUnsignedInt(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+}
+
+uint64_t MKVStream::unpackUnsignedInt(const uint8_t* bytes, size_t len)
+{
+    if (len == 0)
         throw std::runtime_error("empty string");
 
     uint64_t res = 0;
 
-    for (size_t i = 0; i < bytes.size(); i++)
+    for (size_t i = 0; i < len; i++)
     {
         res <<= 8;
-        res |= (uint8_t) bytes[i];
+        res |= bytes[i];
     }
 
     return res;
@@ -95,24 +100,24 @@ void MKVStream::rateLimit(uint64_t timecode)
     // Timecode は単調増加ではないが、少しのジッターはバッファーが吸収
     // してくれるだろう。
 
-    unsigned int secondsFromStart = timecode * m_timecodeScale / 1000000000;
-    unsigned int ctime = sys->getTime();
+    double secondsFromStart = (double) timecode * m_timecodeScale / 1000000000;
+    double deadline = m_startTime + secondsFromStart;
+    double diff = deadline - sys->getMonotonicTime();
 
-    if (m_startTime + secondsFromStart > ctime) // if this is into the future
+    if (diff > 0) // if this is into the future
     {
-        int diff = (m_startTime + secondsFromStart) - ctime;
-        LOG_DEBUG("rateLimit: diff = %d sec", diff);
-        sys->sleep(diff * 1000);
+        LOG_TRACE("rateLimit: diff = %.2f sec", diff);
+        sys->sleepUntil(deadline);
     }
 }
 
 // 非継続パケットの頭出しができないクライアントのために、なるべく要素
 // をパケットの先頭にして送信する
-void MKVStream::sendCluster(const byte_string& cluster, std::shared_ptr<Channel> ch)
+void MKVStream::sendCluster(const uint8_t* cluster, size_t len, std::shared_ptr<Channel> ch)
 {
     bool continuation;
 
-    if (hasKeyFrame(cluster))
+    if (hasKeyFrame(cluster, len))
         continuation = false;
     else
     {
@@ -122,71 +127,101 @@ void MKVStream::sendCluster(const byte_string& cluster, std::shared_ptr<Channel>
             continuation = false;
     }
 
-    MemoryStream in((void*) cluster.data(), cluster.size());
-
-    VInt id   = VInt::read(in);
-    VInt size = VInt::read(in);
-
-    byte_string buffer = id.bytes + size.bytes;
-
-    int64_t payloadRemaining = (int64_t) size.uint(); // 負数が取れるように signed にする
-
-    if (payloadRemaining < 0)
-        throw StreamException("MKV Parse error");
-
-    while (payloadRemaining > 0) // for each element in Cluster
+    // 要素は連続して並んでいるので、まだ送っていない範囲 [start, p)
+    // をそのままパケットにする。パケットは TARGET_PACKET_MSEC 分の
+    // SimpleBlock か、MAX_PACKET_SIZE までにする。
+    auto header = readElementHeader(cluster, len);
+    const uint8_t* start = cluster;
+    const uint8_t* p     = cluster + header.length;
+    const uint8_t* end   = p + header.size;
+    bool   hasStartTime = false;
+    double startTime = 0; // パケットの先頭の SimpleBlock の時刻 (ミリ秒)
+
+    while (p < end) // for each element in Cluster
     {
-        VInt id = VInt::read(in);
-        VInt size = VInt::read(in);
+        auto elem = readElementHeader(p, end - p);
+        size_t elemLen = elem.length + elem.size;
 
-        LOG_DEBUG("Got %s size=%s", id.toName().c_str(), std::to_string(size.uint()).c_str());
+        bool isBlock = false;
+        double blockTime = 0;
+        if (elem.id == ID_SIMPLEBLOCK)
+        {
+            const uint8_t* block = p + elem.length;
+            uint64_t trackno;
+            int n = readVInt(block, elem.size, trackno, false);
+            if (n && elem.size >= (uint64_t) n + 2)
+            {
+                int16_t rel = (int16_t) ((block[n] << 8) | block[n + 1]);
+                blockTime = (double) rel * m_timecodeScale / 1000000;
+                isBlock = true;
+            }
+        }
 
-        if (buffer.size() > 0 &&
-            buffer.size() + id.bytes.size() + size.bytes.size() + size.uint() > 15*1024)
+        // 低遅延モードでは要素ごとにパケットにする。
+        if (p > start &&
+            (ch->info.lowLatency ||
+             (p - start) + elemLen > MAX_PACKET_SIZE ||
+             (isBlock && hasStartTime && blockTime - startTime >= TARGET_PACKET_MSEC)))
         {
-            sendPacket(ChanPacket::T_DATA, buffer, continuation, ch);
+            sendPacket(ChanPacket::T_DATA, start, p - start, continuation, ch);
             continuation = true;
-            buffer.clear();
+            start = p;
+            hasStartTime = false;
         }
 
-        std::string payload = in.Stream::read((int) size.uint());
+        if (isBlock && !hasStartTime)
+        {
+            startTime = blockTime;
+            hasStartTime = true;
+        }
 
-        if (id.toName() == "Timecode")
+        if (elem.id == ID_TIMECODE)
         {
+            uint64_t timecode = unpackUnsignedInt(p + elem.length, elem.size);
             if (ch->readDelay)
-                rateLimit(unpackUnsignedInt(payload));
+                rateLimit(timecode);
+            else if (chanMgr->ingestJitterMsec && ch->type == Channel::T_BROADCAST)
+                m_pacer.wait((double) timecode * m_timecodeScale / 1000000000,
+                             chanMgr->ingestJitterMsec / 1000.0);
         }
 
-        if (id.bytes.size() + size.bytes.size() + size.uint() > 15*1024)
+        if (elemLen > MAX_PACKET_SIZE)
         {
-            if (buffer.size() != 0) throw StreamException("Logic error");
-            buffer = id.bytes + size.bytes;
-            buffer.append(payload.begin(), payload.end());
-            size_t pos = 0;
-            while (pos < buffer.size())
+            // 大きな要素は分割して送る。
+            for (const uint8_t* q = p; q < p + elemLen; )
             {
-                int next = std::min(pos + 15*1024, buffer.size());
-                sendPacket(ChanPacket::T_DATA, buffer.substr(pos, next-pos), continuation, ch);
+                size_t n = std::min((size_t) MAX_PACKET_SIZE, (size_t) (p + elemLen - q));
+                sendPacket(ChanPacket::T_DATA, q, n, continuation, ch);
                 continuation = true;
-                pos = next;
+                q += n;
             }
-            buffer.clear();
-        } else {
-            buffer += id.bytes + size.bytes;
-            buffer.append(payload.begin(), payload.end());
-            MemoryStream mem((void*)buffer.c_str(), buffer.size());
-            mem.rewind();
-            VInt id = VInt::read(mem);
+            start = p + elemLen;
+            hasStartTime = false;
         }
-        payloadRemaining -= id.bytes.size() + size.bytes.size() + size.uint();
+        p += elemLen;
     }
 
-    if (buffer.size() > 0)
+    if (p > start)
     {
-        sendPacket(ChanPacket::T_DATA, buffer, continuation, ch);
+        sendPacket(ChanPacket::T_DATA, start, p - start, continuation, ch);
     }
 }
 
+void MKVStream::readElement(Stream &in, const VInt& id, const VInt& size)
+{
+    size_t hlen = id.size() + size.size();
+    if (size.uint() > INT_MAX - hlen)
+        throw StreamException("MKV element too big");
+
+    m_cluster.resize(hlen + size.uint());
+    std::copy(id.data(), id.data() + id.size(), &m_cluster[0]);
+    std::copy(size.data(), size.data() + size.size(), &m_cluster[id.size()]);
+
+    size_t pos = hlen;
+    while (pos < m_cluster.size())
+        pos += in.read(&m_cluster[pos], (int) (m_cluster.size() - pos));
+}
+
 // Tracks 要素からビデオトラックのトラック番号を調べる。
 void MKVStream::readTracks(const std::string& data)
 {
@@ -197,9 +232,9 @@ void MKVStream::readTracks(const std::string& data)
     {
         VInt id   = VInt::read(mem);
         VInt size = VInt::read(mem);
-        LOG_DEBUG("Got LEVEL2 %s size=%s", id.toName().c_str(), std::to_string(size.uint()).c_str());
+        LOG_DEBUG("Got LEVEL2 %s size=%s", id.toName(), std::to_string(size.uint()).c_str());
 
-        if (id.toName() == "TrackEntry")
+        if (id.id() == ID_TRACKENTRY)
         {
             int end = mem.getPosition() + size.uint();
             int trackno = -1;
@@ -210,12 +245,17 @@ void MKVStream::readTracks(const std::string& data)
                 VInt id   = VInt::read(mem);
                 VInt size = VInt::read(mem);
 
-                if (id.toName() == "TrackNumber")
+                switch (id.id())
+                {
+                case ID_TRACKNUMBER:
                     trackno = (uint8_t) mem.readChar();
-                else if (id.toName() == "TrackType")
+                    break;
+                case ID_TRACKTYPE:
                     tracktype = (uint8_t) mem.readChar();
-                else
+                    break;
+                default:
                     mem.skip(size.uint());
+                }
             }
 
             if (tracktype == 1)
@@ -246,14 +286,14 @@ void MKVStream::readInfo(const std::string& data)
             VInt size = VInt::read(in);
 
             LOG_TRACE("readInfo: Got %s 0x%lX with size=%d at pos %d",
-                      id.toName().c_str(),
+                      id.toName(),
                       (unsigned long int) id.uint(),
                       (int) size.uint(),
                       pos);
 
             auto data = in.Stream::read((int) size.uint());
 
-            if (id.toName() == "TimecodeScale")
+            if (id.id() == ID_TIMECODESCALE)
             {
                 auto scale = unpackUnsignedInt(data);
                 LOG_DEBUG("TimecodeScale = %d nanoseconds", (int) scale);
@@ -274,12 +314,12 @@ void MKVStream::readHeader(Stream &in, std::shared_ptr<Channel> ch)
         {
             VInt id   = VInt::read(in);
             VInt size = VInt::read(in);
-            LOG_DEBUG("Got LEVEL0 %s size=%s", id.toName().c_str(), std::to_string(size.uint()).c_str());
+            LOG_DEBUG("Got LEVEL0 %s size=%s", id.toName(), std::to_string(size.uint()).c_str());
 
-            header += id.bytes;
-            header += size.bytes;
+            header.append(id.data(), id.size());
+            header.append(size.data(), size.size());
 
-            if (id.toName() != "Segment")
+            if (id.id() != ID_SEGMENT)
             {
                 // Segment 以外のレベル 0 要素は単にヘッドパケットに追加す
                 // る
@@ -292,37 +332,35 @@ void MKVStream::readHeader(Stream &in, std::shared_ptr<Channel> ch)
                 {
                     VInt id = VInt::read(in);
                     VInt size = VInt::read(in);
-                    LOG_DEBUG("Got LEVEL1 %s size=%s", id.toName().c_str(), std::to_string(size.uint()).c_str());
+                    LOG_DEBUG("Got LEVEL1 %s size=%s", id.toName(), std::to_string(size.uint()).c_str());
 
-                    if (id.toName() != "Cluster")
+                    if (id.id() != ID_CLUSTER)
                     {
                         // Cluster 以外の要素はヘッドパケットに追加する
-                        header += id.bytes;
-                        header += size.bytes;
+                        header.append(id.data(), id.size());
+                        header.append(size.data(), size.size());
 
                         auto data = in.read((int) size.uint());
 
-                        if (id.toName() == "Tracks")
+                        if (id.id() == ID_TRACKS)
                             readTracks(data);
 
                         header.append(data.begin(), data.end());
 
-                        if (id.toName() == "Info")
+                        if (id.id() == ID_INFO)
                             readInfo(data);
                     } else
                     {
                         // ヘッダーパケットを送信
                         sendPacket(ChanPacket::T_HEAD, header, false, ch);
 
-                        m_startTime = sys->getTime();
+                        m_startTime = sys->getMonotonicTime();
 
                         // もうIDとサイズを読んでしまったので、最初のクラ
                         // スターを送信
 
-                        byte_string cluster = id.bytes + size.bytes;
-                        auto data = in.read((int) size.uint());
-                        cluster.append(data.begin(), data.end());
-                        sendCluster(cluster, ch);
+                        readElement(in, id, size);
+                        sendCluster(m_cluster.data(), m_cluster.size(), ch);
                         return;
                     }
                 }
@@ -337,12 +375,9 @@ void MKVStream::readHeader(Stream &in, std::shared_ptr<Channel> ch)
 // ビットレートの計測、更新
 void MKVStream::checkBitrate(Stream &in, std::shared_ptr<Channel> ch)
 {
-    ChanInfo info = ch->info;
     int newBitrate = in.stat.bytesInPerSecAvg() / 1000 * 8;
-    if (newBitrate > info.bitrate) {
-        info.bitrate = newBitrate;
-        ch->updateInfo(info);
-    }
+    if (newBitrate > ch->info.bitrate)
+        ch->updateBitrate(newBitrate);
 }
 
 // Cluster 要素を読む
@@ -354,16 +389,14 @@ int MKVStream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
         VInt id = VInt::read(in);
         VInt size = VInt::read(in);
 
-        if (id.toName() != "Cluster")
+        if (id.id() != ID_CLUSTER)
         {
-            LOG_ERROR("Cluster expected, but got %s", id.toName().c_str());
+            LOG_ERROR("Cluster expected, but got %s", id.toName());
             throw StreamException("Logic error");
         }
 
-        byte_string cluster = id.bytes + size.bytes;
-        auto data = in.read((int) size.uint());
-        cluster.append(data.begin(), data.end());
-        sendCluster(cluster, ch);
+        readElement(in, id, size);
+        sendCluster(m_cluster.data(), m_cluster.size(), ch);
 
         return 0; // no error
     }catch (std::runtime_error& e)
@@ -3,6 +3,7 @@
 
 #include "stream.h"
 #include "channel.h"
+#include "pacer.h"
 #include "matroska.h"
 
 // ----------------------------------------------
@@ -20,23 +21,38 @@ public:
     int  readPacket(Stream &, std::shared_ptr<Channel>) override;
     void readEnd(Stream &, std::shared_ptr<Channel>) override;
 
+    enum
+    {
+        MAX_PACKET_SIZE     = 15 * 1024,
+        TARGET_PACKET_MSEC  = 100,  // 一つのパケットに入れる SimpleBlock の時間の幅
+    };
+
     void sendPacket(ChanPacket::TYPE, const matroska::byte_string& data, bool continuation, std::shared_ptr<Channel>);
-    bool hasKeyFrame(const matroska::byte_string& cluster);
-    void sendCluster(const matroska::byte_string& cluster, std::shared_ptr<Channel> ch);
+    void sendPacket(ChanPacket::TYPE, const uint8_t* data, size_t len, bool continuation, std::shared_ptr<Channel>);
+    bool hasKeyFrame(const uint8_t* cluster, size_t len);
+    void sendCluster(const uint8_t* cluster, size_t len, std::shared_ptr<Channel> ch);
     void checkBitrate(Stream &in, std::shared_ptr<Channel> ch);
     void readTracks(const std::string& data);
     void readInfo(const std::string& data);
 
     void rateLimit(uint64_t timecode);
     static uint64_t unpackUnsignedInt(const std::string& bytes);
+    static uint64_t unpackUnsignedInt(const uint8_t* bytes, size_t len);
 
     uint64_t     m_videoTrackNumber;
     bool         m_hasKeyFrame;
     uint64_t     m_timecodeScale; // ナノ秒
-    unsigned int m_startTime;
+    double       m_startTime;     // 単調時計での先頭クラスターの時刻
+    IngestPacer  m_pacer;
 
 private:
     using ChannelStream::sendPacket;
+
+    // 要素全体を m_cluster に読む。ID とサイズは読み終わっているもの。
+    void readElement(Stream &in, const matroska::VInt& id, const matroska::VInt& size);
+
+    // 読み込んだクラスター。バッファはクラスター間で使い回す。
+    matroska::byte_string m_cluster;
 };
 
 #endif
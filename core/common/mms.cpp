@@ -34,17 +34,46 @@ void MMSStream::readHeader(Stream &, std::shared_ptr<Channel>)
 }
 
 // ------------------------------------------
-void MMSStream::processChunk(Stream &in, std::shared_ptr<Channel> ch, ASFChunk& chunk)
+static unsigned int readLE(const char *p, int n)
 {
-    switch (chunk.type)
+    unsigned int v = 0;
+    for (int i = n - 1; i >= 0; i--)
+        v = (v << 8) | (unsigned char) p[i];
+    return v;
+}
+
+// ------------------------------------------
+static void writeLE(char *p, unsigned int v, int n)
+{
+    for (int i = 0; i < n; i++, v >>= 8)
+        p[i] = v & 0xff;
+}
+
+// ------------------------------------------
+void MMSStream::writeChunkHeader(char *data, unsigned short type, unsigned short len,
+                                 unsigned int seq, unsigned short v1, unsigned short v2)
+{
+    writeLE(data + 0, type, 2);
+    writeLE(data + 2, len, 2);
+    writeLE(data + 4, seq, 4);
+    writeLE(data + 8, v1, 2);
+    writeLE(data + 10, v2, 2);
+}
+
+// ------------------------------------------
+void MMSStream::processChunk(std::shared_ptr<Channel> ch, ChanPacket& pack)
+{
+    unsigned short type = readLE(pack.data, 2);
+
+    switch (type)
     {
         case 0x4824:        // asf header
         {
-            MemoryStream mem(ch->headPack.data, sizeof(ch->headPack.data));
-
-            chunk.write(mem);
+            if (pack.len > sizeof(ch->headPack.data))
+                throw StreamException("ASF header too big");
+            memcpy(ch->headPack.data, pack.data, pack.len);
 
-            MemoryStream asfm(chunk.data, chunk.dataLen);
+            MemoryStream asfm(pack.data + CHUNK_HEADER_LEN, pack.len - CHUNK_HEADER_LEN);
             ASFObject asfHead;
             asfHead.readHead(asfm);
 
@@ -60,7 +89,7 @@ void MMSStream::processChunk(Stream &in, std::shared_ptr<Channel> ch, ASFChunk&
             ch->info.bitrate = asf.bitrate/1000;
 
             ch->headPack.type = ChanPacket::T_HEAD;
-            ch->headPack.len = mem.pos;
+            ch->headPack.len = pack.len;
             ch->headPack.pos = ch->streamPos;
             ch->newPacket(ch->headPack);
 
@@ -70,14 +99,7 @@ void MMSStream::processChunk(Stream &in, std::shared_ptr<Channel> ch, ASFChunk&
         }
         case 0x4424:        // asf data
         {
-            ChanPacket pack;
-
-            MemoryStream mem(pack.data, sizeof(pack.data));
-
-            chunk.write(mem);
-
             pack.type = ChanPacket::T_DATA;
-            pack.len = mem.pos;
             pack.pos = ch->streamPos;
 
             ch->newPacket(pack);
@@ -93,11 +115,18 @@ void MMSStream::processChunk(Stream &in, std::shared_ptr<Channel> ch, ASFChunk&
 // ------------------------------------------
 int MMSStream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
 {
-    ASFChunk chunk;
+    // チャンクはヘッダーごとパケットのデータ領域に直接読み込む。
+    in.read(m_pack.data, CHUNK_HEADER_LEN);
+
+    unsigned int len = readLE(m_pack.data + 2, 2);
+    if (len < 8 || len - 8 > sizeof(m_pack.data) - CHUNK_HEADER_LEN)
+        throw StreamException("ASF chunk too big");
 
-    chunk.read(in);
+    m_pack.len = CHUNK_HEADER_LEN + (len - 8);
+    if (len > 8)
+        in.read(m_pack.data + CHUNK_HEADER_LEN, len - 8);
 
-    processChunk(in, ch, chunk);
+    processChunk(ch, m_pack);
     return 0;
 }
 
@@ -25,12 +25,26 @@
 class MMSStream : public ChannelStream
 {
 public:
+    enum
+    {
+        CHUNK_HEADER_LEN = 12,  // type, len, seq, v1, v2
+    };
 
     void    readHeader(Stream &, std::shared_ptr<Channel>) override;
     int     readPacket(Stream &, std::shared_ptr<Channel>) override;
     void    readEnd(Stream &, std::shared_ptr<Channel>) override;
 
-    static void processChunk(Stream &in, std::shared_ptr<Channel> ch, ASFChunk& chunk);
+    // pack.data の先頭 pack.len バイトに入っている ASF チャンクを処理
+    // する。データチャンクは pack をそのままチャンネルに流す。
+    static void processChunk(std::shared_ptr<Channel> ch, ChanPacket& pack);
+
+    // ASF チャンクのヘッダーを data に書く。
+    static void writeChunkHeader(char *data, unsigned short type, unsigned short len,
+                                 unsigned int seq, unsigned short v1, unsigned short v2);
+
+private:
+    // チャンクを読み込むバッファ。使い回す。
+    ChanPacket  m_pack;
 };
 
 #endif
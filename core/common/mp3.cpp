@@ -21,38 +21,159 @@
 #include "chanmgr.h"
 
 // ------------------------------------------
-void MP3Stream::readEnd(Stream &, std::shared_ptr<Channel>)
+void MP3Stream::readEnd(Stream &, std::shared_ptr<Channel> ch)
 {
+    if (m_pending)
+        sendPending(m_pending, ch);
 }
 
 // ------------------------------------------
 void MP3Stream::readHeader(Stream &, std::shared_ptr<Channel>)
 {
+    m_pending = 0;
 }
 
 // ------------------------------------------
-int MP3Stream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
+int MP3Stream::frameLength(const unsigned char *p, int len)
 {
-    ChanPacket pack;
+    // ビットレート (kbps)。[MPEG-1 か][レイヤー - 1][インデックス]
+    static const int bitrates[2][3][15] = {
+        {
+            { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+            { 0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160 },
+            { 0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160 },
+        },
+        {
+            { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+            { 0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384 },
+            { 0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320 },
+        },
+    };
+    // サンプリング周波数。[バージョン][インデックス]
+    static const int rates[4][3] = {
+        { 11025, 12000,  8000 },    // MPEG-2.5
+        {     0,     0,     0 },    // 予約
+        { 22050, 24000, 16000 },    // MPEG-2
+        { 44100, 48000, 32000 },    // MPEG-1
+    };
 
-    if (ch->icyMetaInterval)
+    if (len < 4)
+        return 0;
+    if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0)
+        return 0;
+
+    int version = (p[1] >> 3) & 3;
+    int layer   = 4 - ((p[1] >> 1) & 3);    // 1..3、4 は予約
+    int brIndex = p[2] >> 4;
+    int srIndex = (p[2] >> 2) & 3;
+    int padding = (p[2] >> 1) & 1;
+
+    // フリーフォーマットや予約値は受け付けない。
+    if (version == 1 || layer == 4 || brIndex == 0 || brIndex == 15 || srIndex == 3)
+        return 0;
+
+    bool mpeg1 = (version == 3);
+    int bitrate = bitrates[mpeg1][layer - 1][brIndex] * 1000;
+    int rate = rates[version][srIndex];
+
+    if (layer == 1)
+        return (12 * bitrate / rate + padding) * 4;
+    else if (layer == 3 && !mpeg1)
+        return 72 * bitrate / rate + padding;
+    else
+        return 144 * bitrate / rate + padding;
+}
+
+// ------------------------------------------
+int MP3Stream::findFrame(const unsigned char *p, int len)
+{
+    // 同期ワードの先頭の 0xff は memchr でまとめて探す。
+    const unsigned char *q = p;
+    const unsigned char *end = p + len;
+    while (q < end)
     {
-        int rlen = ch->icyMetaInterval;
+        q = static_cast<const unsigned char*>(memchr(q, 0xff, end - q));
+        if (!q)
+            break;
+        if (frameLength(q, end - q))
+            return q - p;
+        q++;
+    }
+    return -1;
+}
 
-        while (rlen)
-        {
-            int rl = rlen;
-            if (rl > ChanMgr::MAX_METAINT)
-                rl = ChanMgr::MAX_METAINT;
+// ------------------------------------------
+int MP3Stream::findCutPoint(const unsigned char *p, int len)
+{
+    int pos = findFrame(p, len);
+    if (pos < 0)
+        return len;
 
-            pack.init(ChanPacket::T_DATA, pack.data, rl, ch->streamPos);
-            in.read(pack.data, pack.len);
-            ch->newPacket(pack);
-            ch->checkReadDelay(pack.len);
-            ch->streamPos+=pack.len;
+    while (true)
+    {
+        int flen = frameLength(p + pos, len - pos);
+        if (pos + flen >= len)
+            return (pos + flen == len) ? len : pos;
 
-            rlen-=rl;
+        // 次のフレームが続いていなければ同期を取り直す。
+        if (frameLength(p + pos + flen, len - pos - flen))
+            pos += flen;
+        else
+        {
+            int next = findFrame(p + pos + 1, len - pos - 1);
+            if (next < 0)
+                return len;
+            pos += 1 + next;
         }
+    }
+}
+
+// ------------------------------------------
+void MP3Stream::sendPending(int len, std::shared_ptr<Channel> ch)
+{
+    m_pack.type = ChanPacket::T_DATA;
+    m_pack.len  = len;
+    m_pack.pos  = ch->streamPos;
+    ch->newPacket(m_pack);
+    ch->checkReadDelay(m_pack.len);
+    ch->streamPos += m_pack.len;
+
+    m_pending -= len;
+    if (m_pending)
+        memmove(m_pack.data, m_pack.data + len, m_pending);
+}
+
+// ------------------------------------------
+void MP3Stream::readAudio(Stream &in, int len, std::shared_ptr<Channel> ch)
+{
+    while (len)
+    {
+        int rl = len;
+        if (rl > ChanMgr::MAX_METAINT)
+            rl = ChanMgr::MAX_METAINT;
+
+        in.read(m_pack.data + m_pending, rl);
+        m_pending += rl;
+        len -= rl;
+
+        // 新しく来るリスナーがフレームの途中から受け取らないように、
+        // パケットはフレームの頭で切る。未送信分は 1 フレームに満たな
+        // いので、MAX_METAINT を足しても data に収まる。
+        auto data = reinterpret_cast<const unsigned char*>(m_pack.data);
+        int cut = findCutPoint(data, m_pending);
+        if (cut == 0 && m_pending > MAX_PENDING)
+            cut = m_pending;
+        if (cut > 0)
+            sendPending(cut, ch);
+    }
+}
+
+// ------------------------------------------
+int MP3Stream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
+{
+    if (ch->icyMetaInterval)
+    {
+        readAudio(in, ch->icyMetaInterval, ch);
 
         unsigned char len;
         in.read(&len, 1);
@@ -64,12 +185,7 @@ int MP3Stream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
             ch->processMp3Metadata(buf);
         }
     }else{
-        pack.init(ChanPacket::T_DATA, pack.data, ChanMgr::MAX_METAINT, ch->streamPos);
-        in.read(pack.data, pack.len);
-        ch->newPacket(pack);
-        ch->checkReadDelay(pack.len);
-
-        ch->streamPos += pack.len;
+        readAudio(in, ChanMgr::MAX_METAINT, ch);
     }
     return 0;
 }
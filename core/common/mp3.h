@@ -20,14 +20,39 @@
 #define _MP3_H
 
 #include "channel.h"
+#include "chanmgr.h"
 
 // ----------------------------------------------
 class MP3Stream : public ChannelStream
 {
 public:
+    MP3Stream() : m_pending(0) {}
+
     void    readHeader(Stream &, std::shared_ptr<Channel>) override;
     int     readPacket(Stream &, std::shared_ptr<Channel>) override;
     void    readEnd(Stream &, std::shared_ptr<Channel>) override;
+
+    // p が MPEG オーディオのフレームヘッダーならフレームの長さを返す。
+    // そうでなければ 0。len は p から読めるバイト数。
+    static int  frameLength(const unsigned char *p, int len);
+    // p[0..len) の中で最初のフレームヘッダーの位置。無ければ -1。
+    static int  findFrame(const unsigned char *p, int len);
+    // p[0..len) をパケットにする時の切れ目。最後の不完全なフレームの
+    // 先頭を返す。フレームが途切れずに終わっていれば len。
+    static int  findCutPoint(const unsigned char *p, int len);
+
+    // 未送信分がこれを超えたら、フレームの途中でも送る。
+    enum { MAX_PENDING = ChanPacket::MAX_DATALEN - ChanMgr::MAX_METAINT };
+
+private:
+    // 音声データを len バイト読んで、なるべくフレームの頭で切ってパケッ
+    // トにする。切れ目より後ろは次に回す。
+    void    readAudio(Stream &, int len, std::shared_ptr<Channel>);
+    void    sendPending(int len, std::shared_ptr<Channel>);
+
+    // m_pack.data の先頭 m_pending バイトがまだ送っていないデータ。
+    ChanPacket  m_pack;
+    int         m_pending;
 };
 
 #endif
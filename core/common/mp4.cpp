@@ -154,11 +154,8 @@ int MP4Stream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
 
     // ストリームからの実測値が現在の公称値を超えていれば公称値を更新する。
     int newBitrate = in.stat.bytesInPerSecAvg() / 1000 * 8;
-    if (newBitrate > ch->info.bitrate) {
-        ChanInfo info = ch->info;
-        info.bitrate = newBitrate;
-        ch->updateInfo(info);
-    }
+    if (newBitrate > ch->info.bitrate)
+        ch->updateBitrate(newBitrate);
 
     return 0;
 }
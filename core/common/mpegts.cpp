@@ -0,0 +1,225 @@
+// ------------------------------------------------
+// File : mpegts.cpp
+// Desc:
+//      MPEG-2 TS の多重化。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+
+#include "mpegts.h"
+
+// ------------------------------------
+MPEGTSWriter::MPEGTSWriter()
+    : m_hasVideo(false)
+    , m_hasAudio(false)
+    , m_ccPAT(0)
+    , m_ccPMT(0)
+    , m_ccVideo(0)
+    , m_ccAudio(0)
+{
+}
+
+// ------------------------------------
+void MPEGTSWriter::setStreams(bool hasVideo, bool hasAudio)
+{
+    m_hasVideo = hasVideo;
+    m_hasAudio = hasAudio;
+}
+
+// ------------------------------------
+// MPEG-2 のセクションで使う CRC-32 (反転しない、初期値 0xffffffff)。
+uint32_t MPEGTSWriter::crc32(const uint8_t* data, size_t len)
+{
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= (uint32_t) data[i] << 24;
+        for (int j = 0; j < 8; j++)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : (crc << 1);
+    }
+    return crc;
+}
+
+// ------------------------------------
+uint8_t MPEGTSWriter::nextCC(int pid)
+{
+    uint8_t* cc;
+    switch (pid)
+    {
+    case PID_PAT:   cc = &m_ccPAT; break;
+    case PID_PMT:   cc = &m_ccPMT; break;
+    case PID_VIDEO: cc = &m_ccVideo; break;
+    default:        cc = &m_ccAudio; break;
+    }
+    uint8_t r = *cc;
+    *cc = (*cc + 1) & 0x0f;
+    return r;
+}
+
+// ------------------------------------
+// セクションに CRC を付けて 1 パケットに収める。
+void MPEGTSWriter::writeSection(std::string& out, int pid, const std::string& section)
+{
+    uint32_t crc = crc32(reinterpret_cast<const uint8_t*>(section.data()), section.size());
+
+    std::string pkt;
+    pkt.push_back((char) 0x47);
+    pkt.push_back((char) (0x40 | ((pid >> 8) & 0x1f)));
+    pkt.push_back((char) (pid & 0xff));
+    pkt.push_back((char) (0x10 | nextCC(pid)));
+    pkt.push_back(0);   // pointer_field
+    pkt += section;
+    pkt.push_back((char) (crc >> 24));
+    pkt.push_back((char) (crc >> 16));
+    pkt.push_back((char) (crc >> 8));
+    pkt.push_back((char) crc);
+    pkt.resize(PACKET_SIZE, (char) 0xff);
+
+    out += pkt;
+}
+
+// ------------------------------------
+void MPEGTSWriter::writeTables(std::string& out)
+{
+    // PAT: 番組 1 の PMT の PID。
+    const char pat[] = {
+        0x00, (char) 0xb0, 0x0d, 0x00, 0x01, (char) 0xc1, 0x00, 0x00,
+        0x00, 0x01, (char) (0xe0 | (PID_PMT >> 8)), (char) (PID_PMT & 0xff),
+    };
+    writeSection(out, PID_PAT, std::string(pat, sizeof(pat)));
+
+    // PMT
+    int numStreams = (m_hasVideo ? 1 : 0) + (m_hasAudio ? 1 : 0);
+    int length = 13 + 5 * numStreams;
+    int pcrPID = m_hasVideo ? PID_VIDEO : PID_AUDIO;
+
+    std::string pmt;
+    pmt.push_back(0x02);
+    pmt.push_back((char) (0xb0 | (length >> 8)));
+    pmt.push_back((char) (length & 0xff));
+    pmt.append({ 0x00, 0x01, (char) 0xc1, 0x00, 0x00 });
+    pmt.push_back((char) (0xe0 | (pcrPID >> 8)));
+    pmt.push_back((char) (pcrPID & 0xff));
+    pmt.append({ (char) 0xf0, 0x00 });
+    if (m_hasVideo)
+        pmt.append({ STREAM_TYPE_H264, (char) (0xe0 | (PID_VIDEO >> 8)), (char) (PID_VIDEO & 0xff), (char) 0xf0, 0x00 });
+    if (m_hasAudio)
+        pmt.append({ STREAM_TYPE_AAC, (char) (0xe0 | (PID_AUDIO >> 8)), (char) (PID_AUDIO & 0xff), (char) 0xf0, 0x00 });
+    writeSection(out, PID_PMT, pmt);
+}
+
+// ------------------------------------
+// PES ヘッダーの 5 バイトの時刻。prefix は PTS のみなら 2、PTS と DTS
+// の PTS なら 3、DTS なら 1。
+static void putTimestamp(std::string& out, int prefix, int64_t t)
+{
+    t &= 0x1ffffffffLL;
+    out.push_back((char) ((prefix << 4) | (((t >> 30) & 0x07) << 1) | 1));
+    out.push_back((char) ((t >> 22) & 0xff));
+    out.push_back((char) ((((t >> 15) & 0x7f) << 1) | 1));
+    out.push_back((char) ((t >> 7) & 0xff));
+    out.push_back((char) (((t & 0x7f) << 1) | 1));
+}
+
+// ------------------------------------
+// PES を組み立てて TS パケットに分ける。最後のパケットの余りはアダプテー
+// ションフィールドで詰める。
+void MPEGTSWriter::writePES(std::string& out, int pid, int streamID, int64_t pts, int64_t dts,
+                            bool pcr, bool randomAccess, const std::string& payload)
+{
+    bool hasDTS = (dts != pts);
+
+    std::string pes = { 0x00, 0x00, 0x01, (char) streamID };
+    size_t pesLength = 3 + (hasDTS ? 10 : 5) + payload.size();
+    // 映像は長さを 0 (不定) にしてよい。
+    if (pesLength > 0xffff || pid == PID_VIDEO)
+        pesLength = 0;
+    pes.push_back((char) (pesLength >> 8));
+    pes.push_back((char) (pesLength & 0xff));
+    pes.push_back((char) 0x80);
+    pes.push_back((char) (hasDTS ? 0xc0 : 0x80));
+    pes.push_back((char) (hasDTS ? 10 : 5));
+    putTimestamp(pes, hasDTS ? 3 : 2, pts);
+    if (hasDTS)
+        putTimestamp(pes, 1, dts);
+    pes += payload;
+
+    size_t pos = 0;
+    bool first = true;
+    while (pos < pes.size())
+    {
+        // アダプテーションフィールドの、長さのバイトより後ろ。
+        std::string af;
+        if (first && (pcr || randomAccess))
+        {
+            af.push_back((char) ((randomAccess ? 0x40 : 0) | (pcr ? 0x10 : 0)));
+            if (pcr)
+            {
+                int64_t base = dts & 0x1ffffffffLL;
+                af.push_back((char) (base >> 25));
+                af.push_back((char) (base >> 17));
+                af.push_back((char) (base >> 9));
+                af.push_back((char) (base >> 1));
+                af.push_back((char) (((base & 1) << 7) | 0x7e));
+                af.push_back(0);
+            }
+        }
+        bool hasAF = !af.empty();
+
+        size_t space = PACKET_SIZE - 4 - (hasAF ? 1 + af.size() : 0);
+        size_t n = std::min(space, pes.size() - pos);
+        if (n < space)
+        {
+            size_t stuffing = space - n;
+            if (!hasAF)
+            {
+                hasAF = true;
+                stuffing -= 1;  // 長さのバイト
+                if (stuffing > 0)
+                {
+                    af.push_back(0x00);
+                    stuffing -= 1;
+                }
+            }
+            af.append(stuffing, (char) 0xff);
+        }
+
+        out.push_back((char) 0x47);
+        out.push_back((char) ((first ? 0x40 : 0) | ((pid >> 8) & 0x1f)));
+        out.push_back((char) (pid & 0xff));
+        out.push_back((char) ((hasAF ? 0x30 : 0x10) | nextCC(pid)));
+        if (hasAF)
+        {
+            out.push_back((char) af.size());
+            out += af;
+        }
+        out.append(pes, pos, n);
+
+        pos += n;
+        first = false;
+    }
+}
+
+// ------------------------------------
+void MPEGTSWriter::writeVideo(std::string& out, int64_t pts, int64_t dts, bool keyFrame, const std::string& annexB)
+{
+    writePES(out, PID_VIDEO, 0xe0, pts, dts, true, keyFrame, annexB);
+}
+
+// ------------------------------------
+void MPEGTSWriter::writeAudio(std::string& out, int64_t pts, const std::string& adts)
+{
+    // 映像が無ければ音声に PCR を載せる。
+    writePES(out, PID_AUDIO, 0xc0, pts, pts, !m_hasVideo, !m_hasVideo, adts);
+}
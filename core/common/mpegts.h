@@ -0,0 +1,70 @@
+// ------------------------------------------------
+// File : mpegts.h
+// Desc:
+//      MPEG-2 TS の多重化。HLS のセグメントを作るのに使う。映像は
+//      H.264 (Annex B)、音声は AAC (ADTS) の 1 本ずつに限る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _MPEGTS_H
+#define _MPEGTS_H
+
+#include <stdint.h>
+#include <string>
+
+// ------------------------------------
+class MPEGTSWriter
+{
+public:
+    enum
+    {
+        PACKET_SIZE = 188,
+
+        PID_PAT     = 0x0000,
+        PID_PMT     = 0x1000,
+        PID_VIDEO   = 0x0100,
+        PID_AUDIO   = 0x0101,
+
+        STREAM_TYPE_AAC  = 0x0f,
+        STREAM_TYPE_H264 = 0x1b,
+    };
+
+    MPEGTSWriter();
+
+    // 番組に含めるストリームを決める。次の writeTables から反映される。
+    void    setStreams(bool hasVideo, bool hasAudio);
+
+    // PAT と PMT を out に追加する。セグメントの先頭で呼ぶ。
+    void    writeTables(std::string& out);
+
+    // 1 フレームを PES にして out に追加する。時刻は 90kHz 単位。
+    void    writeVideo(std::string& out, int64_t pts, int64_t dts, bool keyFrame, const std::string& annexB);
+    void    writeAudio(std::string& out, int64_t pts, const std::string& adts);
+
+    static uint32_t crc32(const uint8_t* data, size_t len);
+
+    bool    hasVideo() const { return m_hasVideo; }
+    bool    hasAudio() const { return m_hasAudio; }
+
+private:
+    void    writeSection(std::string& out, int pid, const std::string& section);
+    void    writePES(std::string& out, int pid, int streamID, int64_t pts, int64_t dts,
+                     bool pcr, bool randomAccess, const std::string& payload);
+    uint8_t nextCC(int pid);
+
+    bool    m_hasVideo;
+    bool    m_hasAudio;
+    uint8_t m_ccPAT, m_ccPMT, m_ccVideo, m_ccAudio;
+};
+
+#endif
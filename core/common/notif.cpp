@@ -1,5 +1,6 @@
 #include "notif.h"
 #include "str.h"
+#include "eventbus.h"
 
 // global
 NotificationBuffer g_notificationBuffer;
@@ -27,7 +28,7 @@ NotificationBuffer::NotificationBuffer()
 
 int NotificationBuffer::numUnread()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     int count = 0;
     for (auto& e : notifications)
@@ -39,7 +40,7 @@ int NotificationBuffer::numUnread()
 
 void NotificationBuffer::markAsRead(unsigned int ctime)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     for (auto& e : notifications)
     {
@@ -50,14 +51,14 @@ void NotificationBuffer::markAsRead(unsigned int ctime)
 
 int NotificationBuffer::numNotifications()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     return notifications.size();
 }
 
 NotificationBuffer::Entry NotificationBuffer::getNotification(int index)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     try
     {
@@ -70,12 +71,19 @@ NotificationBuffer::Entry NotificationBuffer::getNotification(int index)
 
 void NotificationBuffer::addNotification(const Notification& notif)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     while (notifications.size() >= MAX_NOTIFS)
         notifications.pop_back();
 
     notifications.push_front(Entry(notif, false));
+
+    g_eventBus.publish("notification", amf0::Value::object(
+        {
+            {"time", notif.time},
+            {"type", Notification::getTypeStr(notif.type)},
+            {"message", notif.message},
+        }));
 }
 
 amf0::Value NotificationBuffer::getState()
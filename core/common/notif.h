@@ -4,6 +4,7 @@
 #include "common.h"
 #include "servmgr.h"
 #include "varwriter.h"
+#include "lockprof.h"
 #include <deque>
 
 class NotificationBuffer;
@@ -70,7 +71,7 @@ public:
     amf0::Value getState() override;
 
     std::deque<Entry> notifications;
-    std::recursive_mutex lock;
+    ProfiledMutex lock { "NotificationBuffer::lock" };
 };
 
 #endif
@@ -16,6 +16,8 @@
 // GNU General Public License for more details.
 // ------------------------------------------------
 
+#include <algorithm>
+
 #include "channel.h"
 #include "ogg.h"
 
@@ -35,14 +37,14 @@ void OGGStream::readEnd(Stream &, std::shared_ptr<Channel>)
 // ------------------------------------------
 int OGGStream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
 {
-    OggPage ogg;
-    ChanPacket pack;
+    OggPage& ogg = m_page;
+    ChanPacket& pack = m_pack;
 
     ogg.read(in);
 
     if (ogg.isBOS())
     {
-        if (!vorbis.needHeader() && !theora.needHeader())
+        if (!vorbis.needHeader() && !theora.needHeader() && !opus.needHeader())
         {
             ch->headPack.len = 0;
         }
@@ -51,6 +53,8 @@ int OGGStream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
             vorbis.bos(ogg.getSerialNo());
         if (ogg.detectTheora())
             theora.bos(ogg.getSerialNo());
+        if (ogg.detectOpus())
+            opus.bos(ogg.getSerialNo());
     }
 
     if (ogg.isEOS())
@@ -65,24 +69,34 @@ int OGGStream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
             LOG_INFO("Theora stream: EOS");
             theora.eos();
         }
+        if (ogg.getSerialNo() == opus.serialNo)
+        {
+            LOG_INFO("Opus stream: EOS");
+            opus.eos();
+        }
     }
 
-    if (vorbis.needHeader() || theora.needHeader())
+    if (vorbis.needHeader() || theora.needHeader() || opus.needHeader())
     {
         if (ogg.getSerialNo() == vorbis.serialNo)
             vorbis.readHeader(ch, ogg);
         else if (ogg.getSerialNo() == theora.serialNo)
             theora.readHeader(ch, ogg);
+        else if (ogg.getSerialNo() == opus.serialNo)
+            opus.readHeader(ch, ogg);
         else
             throw StreamException("Bad OGG serial no.");
 
-        if (!vorbis.needHeader() && !theora.needHeader())
+        if (!vorbis.needHeader() && !theora.needHeader() && !opus.needHeader())
         {
             ch->info.bitrate = 0;
 
             if (vorbis.isActive())
                 ch->info.bitrate += vorbis.bitrate;
 
+            if (opus.isActive())
+                ch->info.bitrate += opus.bitrate;
+
             if (theora.isActive())
             {
                 ch->info.bitrate += theora.bitrate;
@@ -101,10 +115,19 @@ int OGGStream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
         }
     }else
     {
-        pack.init(ChanPacket::T_DATA, ogg.data, ogg.headLen+ogg.bodyLen, ch->streamPos);
-        ch->newPacket(pack);
+        // ページの頭がパケットの頭になるようにし、収まらない分は継続
+        // パケットにする。
+        int len = ogg.headLen+ogg.bodyLen;
+        bool join = isJoinPoint(ogg);
+        for (int off = 0; off < len; off += pack.len)
+        {
+            int rl = std::min(len - off, (int) ChanPacket::MAX_DATALEN);
+            pack.init(ChanPacket::T_DATA, ogg.data + off, rl, ch->streamPos);
+            pack.cont = (off > 0) || !join;
+            ch->newPacket(pack);
 
-        ch->streamPos+=pack.len;
+            ch->streamPos+=pack.len;
+        }
 
         if (theora.isActive())
         {
@@ -118,11 +141,35 @@ int OGGStream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
             {
                 ch->sleepUntil(vorbis.getTime(ogg));
             }
+        }else if (opus.isActive())
+        {
+            if (ogg.getSerialNo() == opus.serialNo)
+            {
+                ch->sleepUntil(opus.getTime(ogg));
+            }
         }
     }
     return 0;
 }
 
+// -----------------------------------
+bool OGGStream::isJoinPoint(OggPage &ogg)
+{
+    // 途中のパケットの続きから始まるページからは再生できない。
+    if (!ogg.isNewPacket())
+        return false;
+
+    if (theora.isActive())
+    {
+        // Theora のデータパケットは先頭の 2 ビットが 0 ならキーフレーム。
+        return ogg.getSerialNo() == theora.serialNo &&
+               ogg.bodyLen > 0 &&
+               (ogg.data[ogg.headLen] & 0xc0) == 0;
+    }
+
+    return true;
+}
+
 // -----------------------------------
 void OggSubStream::readHeader(std::shared_ptr<Channel> ch, OggPage &ogg)
 {
@@ -297,6 +344,18 @@ void OggVorbisSubStream::readSetup(Stream &in)
 
 // -----------------------------------
 void OggVorbisSubStream::readComment(Stream &in, ChanInfo &info)
+{
+    OggSubStream::readComment(in, info);
+
+    char frame = in.readChar();     // framing bit
+    if (!frame)
+        throw StreamException("Bad Comment frame");
+
+//  updateMeta();
+}
+
+// -----------------------------------
+void OggSubStream::readComment(Stream &in, ChanInfo &info)
 {
     int vLen = in.readLong();   // vendor len
 
@@ -339,12 +398,58 @@ void OggVorbisSubStream::readComment(Stream &in, ChanInfo &info)
             info.track.album.convertTo(String::T_UNICODE);
         }
     }
+}
 
-    char frame = in.readChar();     // framing bit
-    if (!frame)
-        throw StreamException("Bad Comment frame");
+// -----------------------------------
+void OggOpusSubStream::procHeaders(std::shared_ptr<Channel> ch)
+{
+    unsigned int packPtr=0;
 
-//  updateMeta();
+    for (int i=0; i<pack.numPackets; i++)
+    {
+        MemoryStream vin(&pack.body[packPtr], pack.packetSizes[i]);
+
+        packPtr += pack.packetSizes[i];
+
+        char id[9];
+
+        vin.read(id, 8);
+        id[8]=0;
+
+        if (strcmp(id, "OpusHead") == 0)
+        {
+            LOG_INFO("OGG Opus Header: Head (%d bytes)", vin.len);
+            readHead(vin);
+        }else if (strcmp(id, "OpusTags") == 0)
+        {
+            LOG_INFO("OGG Opus Header: Tags (%d bytes)", vin.len);
+            ChanInfo newInfo = ch->info;
+            readComment(vin, newInfo);
+            ch->updateInfo(newInfo);
+        }else
+            throw StreamException("Unknown Opus packet header type");
+    }
+}
+
+// -----------------------------------
+void OggOpusSubStream::readHead(Stream &in)
+{
+    int ver = in.readChar();
+    int chans = in.readChar();
+    preSkip = (unsigned short) in.readShort();
+    unsigned int rate = in.readLong();    // 元の入力のサンプリング周波数
+
+    LOG_INFO("OGG Opus Head: ver=%d, chans=%d, preSkip=%d, rate=%u", ver, chans, preSkip, rate);
+
+    // ヘッダーにはビットレートが無い。
+    bitrate = 0;
+}
+
+// -----------------------------------
+double OggOpusSubStream::getTime(OggPage &ogg)
+{
+    // グラニュール位置は常に 48kHz のサンプル数。
+    return (double)(ogg.granPos - preSkip) / 48000.0;
 }
 
 // -----------------------------------
@@ -378,42 +483,121 @@ unsigned int OggPage::getSerialNo()
 }
 
 // -----------------------------------
-void OggPage::read(Stream &in)
+// slicing-by-8 用のテーブル。crcTable[0] が普通の 1 バイトずつのテーブル。
+static unsigned int crcTable[8][256];
+
+static bool initCRCTable()
 {
-    // skip until we get OGG capture pattern
-    bool gotOgg=false;
-    while (!gotOgg)
+    for (unsigned int i = 0; i < 256; i++)
     {
-        if (in.readChar() == 'O')
-            if (in.readChar() == 'g')
-                if (in.readChar() == 'g')
-                    if (in.readChar() == 'S')
-                        gotOgg = true;
-        if (!gotOgg)
-            LOG_INFO("Skipping OGG packet");
+        unsigned int r = i << 24;
+        for (int j = 0; j < 8; j++)
+            r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : (r << 1);
+        crcTable[0][i] = r;
     }
+    for (unsigned int i = 0; i < 256; i++)
+        for (int k = 1; k < 8; k++)
+            crcTable[k][i] = (crcTable[k-1][i] << 8) ^ crcTable[0][crcTable[k-1][i] >> 24];
+    return true;
+}
 
-    memcpy(&data[0], "OggS", 4);
+static bool crcTableReady = initCRCTable();
 
-    in.read(&data[4], 27-4);
+// -----------------------------------
+unsigned int OggPage::calcCRC(const unsigned char *p, int len, unsigned int crc)
+{
+    // 8 バイトずつ処理する。
+    while (len >= 8)
+    {
+        crc ^= (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+        crc = crcTable[7][crc >> 24] ^
+              crcTable[6][(crc >> 16) & 0xff] ^
+              crcTable[5][(crc >> 8) & 0xff] ^
+              crcTable[4][crc & 0xff] ^
+              crcTable[3][p[4]] ^
+              crcTable[2][p[5]] ^
+              crcTable[1][p[6]] ^
+              crcTable[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = (crc << 8) ^ crcTable[0][(crc >> 24) ^ *p++];
+    return crc;
+}
 
-    int numSegs = data[26];
-    bodyLen = 0;
+// -----------------------------------
+bool OggPage::checkCRC()
+{
+    // CRC フィールドを 0 として計算する。
+    static const unsigned char zeroes[4] = {};
+    unsigned int crc = calcCRC(data, 22);
+    crc = calcCRC(zeroes, 4, crc);
+    crc = calcCRC(&data[26], headLen + bodyLen - 26, crc);
+
+    unsigned int stored = data[22] | (data[23] << 8) | (data[24] << 16) | (data[25] << 24);
+    return crc == stored;
+}
 
-    // read segment table
-    in.read(&data[27], numSegs);
-    for (int i=0; i<numSegs; i++)
-        bodyLen += data[27+i];
+// -----------------------------------
+// data の先頭 27 バイトに、キャプチャーパターンから始まるページヘッダー
+// を読み込む。
+void OggPage::readCapture(Stream &in)
+{
+    int have = 0;
+    while (true)
+    {
+        in.read(&data[have], 27 - have);
 
-    if (bodyLen >= MAX_BODYLEN)
-        throw StreamException("OGG body too big");
+        // "OggS" か、その前半で終わる位置を探す。
+        int skip = 27;
+        const unsigned char *end = data + 27;
+        for (const unsigned char *q = data; (q = static_cast<const unsigned char*>(memchr(q, 'O', end - q))); q++)
+        {
+            if (memcmp(q, "OggS", std::min(4, (int) (end - q))) == 0)
+            {
+                skip = q - data;
+                break;
+            }
+        }
+        if (skip == 0)
+            return;
 
-    headLen = 27+numSegs;
+        LOG_INFO("Skipping %d bytes of OGG data", skip);
+        have = 27 - skip;
+        memmove(data, data + skip, have);
+    }
+}
 
-    if (headLen > MAX_HEADERLEN)
-        throw StreamException("OGG header too big");
+// -----------------------------------
+void OggPage::read(Stream &in)
+{
+    while (true)
+    {
+        readCapture(in);
 
-    in.read(&data[headLen], bodyLen);
+        int numSegs = data[26];
+        bodyLen = 0;
+
+        // read segment table
+        in.read(&data[27], numSegs);
+        for (int i=0; i<numSegs; i++)
+            bodyLen += data[27+i];
+
+        if (bodyLen >= MAX_BODYLEN)
+            throw StreamException("OGG body too big");
+
+        headLen = 27+numSegs;
+
+        if (headLen > MAX_HEADERLEN)
+            throw StreamException("OGG header too big");
+
+        in.read(&data[headLen], bodyLen);
+
+        if (checkCRC())
+            break;
+        LOG_ERROR("OGG page CRC mismatch. Skipping");
+    }
 
     granPos = *(unsigned int *)&data[10];
     granPos <<= 32;
@@ -440,6 +624,12 @@ bool OggPage::detectVorbis()
     return memcmp(&data[headLen+1], "vorbis", 6) == 0;
 }
 
+// -----------------------------------
+bool OggPage::detectOpus()
+{
+    return memcmp(&data[headLen], "OpusHead", 8) == 0;
+}
+
 // -----------------------------------
 bool OggPage::detectTheora()
 {
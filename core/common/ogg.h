@@ -22,8 +22,40 @@
 #include <sys/types.h>
 #include "channel.h"
 
-// ----------------------------------------------
-class OggPage;
+// ----------------------------------
+class OggPage
+{
+public:
+    enum
+    {
+        MAX_BODYLEN = 65536,
+        MAX_HEADERLEN = 27+256
+    };
+
+    // 次のページを読む。キャプチャーパターンまでのデータと、CRC が合
+    // わないページは読み飛ばす。
+    void            read(Stream &);
+    bool            checkCRC();
+    bool            isBOS();
+    bool            isEOS();
+    bool            isNewPacket();
+    bool            isHeader();
+    unsigned int    getSerialNo();
+
+    bool            detectVorbis();
+    bool            detectTheora();
+    bool            detectOpus();
+
+    // Ogg の CRC32 (多項式 0x04c11db7、初期値 0、反転無し)。
+    static unsigned int calcCRC(const unsigned char *p, int len, unsigned int crc = 0);
+
+    int64_t         granPos;
+    int             headLen, bodyLen;
+    unsigned char   data[MAX_HEADERLEN+MAX_BODYLEN];
+
+private:
+    void            readCapture(Stream &);
+};
 
 // ----------------------------------
 class OggPacket
@@ -63,9 +95,9 @@ public:
         serialNo=0;
     }
 
-    void    bos(unsigned int ser)
+    void    bos(unsigned int ser, int numHeaders = 3)
     {
-        maxHeaders = 3;
+        maxHeaders = numHeaders;
         pack.numPackets=0;
         pack.packetSizes[0]=0;
         pack.bodyLen = 0;
@@ -79,6 +111,9 @@ public:
 
     virtual void procHeaders(std::shared_ptr<Channel>) = 0;
 
+    // Vorbis 形式のコメントからトラック情報を読む。
+    static void readComment(Stream &, ChanInfo &);
+
     int             bitrate;
 
     OggPacket       pack;
@@ -105,6 +140,26 @@ public:
     int samplerate;
 };
 
+// ----------------------------------------------
+class OggOpusSubStream : public OggSubStream
+{
+public:
+    OggOpusSubStream()
+    :preSkip(0)
+    {}
+
+    // OpusHead と OpusTags の二つ。
+    void    bos(unsigned int ser) { OggSubStream::bos(ser, 2); }
+
+    void    procHeaders(std::shared_ptr<Channel>) override;
+
+    void    readHead(Stream &);
+
+    double  getTime(OggPage &);
+
+    int preSkip;
+};
+
 // ----------------------------------------------
 class OggTheoraSubStream : public OggSubStream
 {
@@ -134,33 +189,18 @@ public:
 
     void    readHeaders(Stream &, std::shared_ptr<Channel>, OggPage &);
 
+    // ページからリスナーが再生を始められるか。映像があればキーフレーム
+    // から、音声だけならパケットの頭から始まるページ。
+    bool    isJoinPoint(OggPage &);
+
     OggVorbisSubStream  vorbis;
     OggTheoraSubStream  theora;
-};
+    OggOpusSubStream    opus;
 
-// ----------------------------------
-class OggPage
-{
-public:
-    enum
-    {
-        MAX_BODYLEN = 65536,
-        MAX_HEADERLEN = 27+256
-    };
-
-    void            read(Stream &);
-    bool            isBOS();
-    bool            isEOS();
-    bool            isNewPacket();
-    bool            isHeader();
-    unsigned int    getSerialNo();
-
-    bool            detectVorbis();
-    bool            detectTheora();
-
-    int64_t         granPos;
-    int             headLen, bodyLen;
-    unsigned char   data[MAX_HEADERLEN+MAX_BODYLEN];
+private:
+    // 大きいので使い回す。
+    OggPage             m_page;
+    ChanPacket          m_pack;
 };
 
 #endif
@@ -0,0 +1,179 @@
+// ------------------------------------------------
+// File : pacer.cpp
+// Desc:
+//      サーバントの出力の遅れを測る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "pacer.h"
+#include "chanpacket.h"
+#include "sys.h"
+#include "metrics.h"
+
+// ------------------------------------
+OutputPacer::OutputPacer()
+{
+    reset();
+}
+
+// ------------------------------------
+void OutputPacer::reset()
+{
+    lagBytes = 0;
+    maxLagBytes = 0;
+    drainRate = 0;
+    skippedBytes = 0;
+    numCatchUps = 0;
+    numSkips = 0;
+    hopLatency = 0;
+    maxHopLatency = 0;
+    m_lastTime = 0;
+    m_lastPos = 0;
+    // 最初のパケットは飛びとして数えない。
+    m_resync = true;
+}
+
+// ------------------------------------
+unsigned int OutputPacer::update(ChanPacketBuffer &buf, unsigned int streamPos, bool catchUp)
+{
+    // 進む速さは 1 秒ごとに指数移動平均を取る。
+    double now = sys->getDTime();
+    if (m_lastTime == 0)
+    {
+        m_lastTime = now;
+        m_lastPos = streamPos;
+    }else if (now - m_lastTime >= 1.0)
+    {
+        double rate = (streamPos - m_lastPos) / (now - m_lastTime);
+        drainRate = (unsigned int) (0.7 * drainRate + 0.3 * rate);
+        m_lastTime = now;
+        m_lastPos = streamPos;
+    }
+
+    unsigned int latest = buf.getLatestPos();
+    unsigned int oldest = buf.getOldestPos();
+
+    // ポジションは 32 ビットで一周するので差で比べる。
+    unsigned int lag = latest - streamPos;
+    if ((int) lag < 0)
+        lag = 0;
+    lagBytes = lag;
+    if (lag > maxLagBytes)
+        maxLagBytes = lag;
+
+    unsigned int span = latest - oldest;
+    if (!catchUp || span == 0 || (uint64_t) lag * 100 <= (uint64_t) span * CATCHUP_PERCENT)
+        return streamPos;
+
+    unsigned int key = buf.getLatestNonContinuationPos();
+    if ((int) (key - streamPos) <= 0)
+        return streamPos;
+
+    skippedBytes += key - streamPos;
+    numCatchUps++;
+    lagBytes = latest - key;
+    m_resync = true;
+    return key;
+}
+
+// ------------------------------------
+bool OutputPacer::checkSync(unsigned int &syncPos, unsigned int sync)
+{
+    bool skipped = (syncPos != sync) && !m_resync;
+    if (skipped)
+        numSkips++;
+    m_resync = false;
+    syncPos = sync + 1;
+    return skipped;
+}
+
+// ------------------------------------
+void OutputPacer::sent(double time)
+{
+    double ms = (sys->getDTime() - time) * 1000;
+    if (ms < 0)
+        ms = 0;
+    g_metrics.packetAge.observe(ms / 1000);
+    if (ms > maxHopLatency)
+        maxHopLatency = (unsigned int) ms;
+    hopLatency = (unsigned int) (0.9 * hopLatency + 0.1 * ms);
+}
+
+// ------------------------------------
+amf0::Value OutputPacer::getState()
+{
+    return amf0::Value::object(
+        {
+            {"lagBytes", lagBytes.load()},
+            {"maxLagBytes", maxLagBytes.load()},
+            {"drainRate", drainRate.load()},
+            {"skippedBytes", skippedBytes.load()},
+            {"numCatchUps", numCatchUps.load()},
+            {"numSkips", numSkips.load()},
+            {"hopLatency", hopLatency.load()},
+            {"maxHopLatency", maxHopLatency.load()},
+        });
+}
+
+// ------------------------------------
+IngestPacer::IngestPacer()
+{
+    reset();
+}
+
+// ------------------------------------
+void IngestPacer::reset()
+{
+    numDelayed = 0;
+    delayMsec = 0;
+    m_started = false;
+    m_base = 0;
+}
+
+// ------------------------------------
+double IngestPacer::delay(double time, double maxDelay, double now)
+{
+    double deadline = m_base + time;
+    double diff = deadline - now;
+
+    if (!m_started || diff < 0 || diff > maxDelay + 10)
+    {
+        // 最初のデータか、遅れて届いた。タイムスタンプが飛んだ時も基
+        // 準を取り直す。
+        m_base = now - time;
+        m_started = true;
+        delayMsec = 0;
+        return 0;
+    }
+
+    if (diff > maxDelay)
+    {
+        // 溜めすぎないように基準を早める。
+        m_base -= diff - maxDelay;
+        diff = maxDelay;
+    }
+
+    if (diff > 0)
+        numDelayed++;
+    delayMsec = (unsigned int) (diff * 1000);
+    return diff;
+}
+
+// ------------------------------------
+void IngestPacer::wait(double time, double maxDelay)
+{
+    double now = sys->getMonotonicTime();
+    double diff = delay(time, maxDelay, now);
+    if (diff > 0)
+        sys->sleepUntil(now + diff);
+}
@@ -0,0 +1,99 @@
+// ------------------------------------------------
+// File : pacer.h
+// Desc:
+//      サーバントの出力がチャンネルからどれだけ遅れているかを測り、遅
+//      れすぎたクライアントを最新のキーフレームまで進める。また、取り
+//      込んだデータをタイムスタンプに合わせて送り出す。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _PACER_H
+#define _PACER_H
+
+#include <atomic>
+
+#include "amf0.h"
+
+class ChanPacketBuffer;
+
+// ------------------------------------
+class OutputPacer
+{
+public:
+    enum
+    {
+        // 遅れがバッファー中のデータの何 % を超えたら追いつかせるか。
+        CATCHUP_PERCENT = 75,
+    };
+
+    OutputPacer();
+
+    void    reset();
+
+    // streamPos から buf の最新のパケットまでの遅れを記録する。catchUp
+    // が true で、遅れすぎていてより新しいキーフレームがあれば、その
+    // 位置を返す。そうでなければ streamPos をそのまま返す。
+    unsigned int update(ChanPacketBuffer &buf, unsigned int streamPos, bool catchUp);
+
+    // パケットの sync で syncPos を進める。取りこぼしていれば数えて
+    // true を返す。update で追いつかせた直後の飛びは数えない。
+    bool    checkSync(unsigned int &syncPos, unsigned int sync);
+
+    // バッファーに time に書き込まれたパケットを今送ったことを記録す
+    // る。このノードでの滞留時間が中継 1 ホップ分の遅延になる。
+    void    sent(double time);
+
+    amf0::Value getState();
+
+    std::atomic<unsigned int> lagBytes;     // 最新のパケットからの遅れ
+    std::atomic<unsigned int> maxLagBytes;
+    std::atomic<unsigned int> drainRate;    // ストリーム位置が進む速さ (バイト/秒)
+    std::atomic<unsigned int> skippedBytes; // 追いつかせるために飛ばしたバイト数
+    std::atomic<unsigned int> numCatchUps;
+    std::atomic<unsigned int> numSkips;
+    std::atomic<unsigned int> hopLatency;   // 滞留時間の移動平均 (ミリ秒)
+    std::atomic<unsigned int> maxHopLatency;
+
+private:
+    double          m_lastTime;
+    unsigned int    m_lastPos;
+    bool            m_resync;
+};
+
+// ------------------------------------
+// 取り込みのジッターバッファー。エンコーダーからまとめて届いたデータを、
+// メディアのタイムスタンプどおりの間隔で送り出す。遅れて届いたデータ
+// はすぐに送り、それを基準にする。
+class IngestPacer
+{
+public:
+    IngestPacer();
+
+    void    reset();
+
+    // タイムスタンプ time (秒) のデータを送るまで待つ。maxDelay 秒より
+    // 長くは待たない。
+    void    wait(double time, double maxDelay);
+
+    // 今の時刻が now の時に待つ秒数。基準を更新する。
+    double  delay(double time, double maxDelay, double now);
+
+    std::atomic<unsigned int> numDelayed;   // 待たせたデータの数
+    std::atomic<unsigned int> delayMsec;    // 最後に待った時間 (ミリ秒)
+
+private:
+    bool    m_started;
+    double  m_base;     // タイムスタンプ 0 のデータを送る時刻
+};
+
+#endif
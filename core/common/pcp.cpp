@@ -23,6 +23,8 @@
 #include "pcp.h"
 #include "peercast.h"
 #include "version2.h"
+#include "pkttrace.h"
+#include "trackerhub.h"
 
 // ------------------------------------------
 void PCPStream::init(const GnuID &rid)
@@ -38,6 +40,15 @@ void PCPStream::init(const GnuID &rid)
 
     outData.init();
     outData.accept = ChanPacket::T_PCP;
+    outPriority.init();
+    outPriority.accept = ChanPacket::T_PCP;
+    outBytes = 0;
+
+    std::lock_guard<std::mutex> cs(hostUpdateLock);
+    hostUpdates.clear();
+    hostUpdateIndex.clear();
+    hostUpdateTime = 0;
+    numHostUpdatesDropped = 0;
 }
 
 // ------------------------------------------
@@ -72,19 +83,220 @@ bool PCPStream::sendPacket(ChanPacket &pack, const GnuID &destID)
             if (!routeList.contains(destID))
                 return false;
 
-    return outData.writePacket(pack);
+    std::string key;
+    if (servMgr->flags[ServMgr::F_coalesceHostUpdates] && hostUpdateKey(pack, key))
+    {
+        std::lock_guard<std::mutex> cs(hostUpdateLock);
+
+        std::string data(pack.data, pack.len);
+        auto it = hostUpdateIndex.find(key);
+        if (it != hostUpdateIndex.end())
+        {
+            // まだ送っていない古い更新は要らない。
+            hostUpdates[it->second] = data;
+            numHostUpdatesDropped++;
+        }else
+        {
+            if (hostUpdates.empty())
+                hostUpdateTime = sys->getDTime();
+            hostUpdateIndex[key] = hostUpdates.size();
+            hostUpdates.push_back(data);
+        }
+        return true;
+    }
+
+    return queuePacket(pack);
 }
 
 // ------------------------------------------
-void PCPStream::flush(Stream &in)
+// 制御用のアトムは優先レーンに、それ以外は通常のレーンに入れる。
+bool PCPStream::queuePacket(ChanPacket &pack)
+{
+    if (isPriorityPacket(pack))
+        return outPriority.writePacket(pack);
+
+    if (!outData.writePacket(pack))
+        return false;
+    outBytes += pack.len;
+    return true;
+}
+
+// ------------------------------------------
+bool PCPStream::isPriorityPacket(const ChanPacket &pack)
+{
+    if (pack.len < 4)
+        return false;
+
+    ID4 id;
+    memcpy(id.getData(), pack.data, 4);
+    return id == PCP_QUIT || id == PCP_HOST || id == PCP_OLEH ||
+        id == PCP_OK || id == PCP_PUSH || id == PCP_MUX_SUB || id == PCP_MUX_UNSUB;
+}
+
+// ------------------------------------------
+bool PCPStream::hasPendingOutput()
+{
+    return outPriority.numPending() || outData.numPending();
+}
+
+// ------------------------------------------
+bool PCPStream::hasUpstreamOutput()
+{
+    if (hasPendingOutput())
+        return true;
+
+    std::lock_guard<std::mutex> cs(hostUpdateLock);
+    return !hostUpdates.empty();
+}
+
+// ------------------------------------------
+// 送り先が読んでくれずに貯まりすぎている。
+bool PCPStream::outputOverflow()
+{
+    return outPriority.willSkip() || outData.willSkip() || outBytes > MAX_OUT_BYTES;
+}
+
+// ------------------------------------------
+// 貯まっているパケットを優先レーンから順に maxBytes 程度まで out に書
+// き、書いたバイト数を返す。まとめて一度に書けるように、パケットはコ
+// ピーせずに一時的なバッファーに並べる。
+int PCPStream::writePending(Stream &out, int maxBytes)
+{
+    WriteBufferedStream bout(&out);
+    int total = writePending(bout, maxBytes);
+    bout.flush();
+    return total;
+}
+
+// ------------------------------------------
+// 呼び出し側のバッファーに並べるだけで flush はしない。
+int PCPStream::writePending(WriteBufferedStream &bout, int maxBytes)
+{
+    int total = 0;
+
+    while (total < maxBytes)
+    {
+        std::shared_ptr<const ChanPacketSlab> pack;
+        if (outPriority.numPending())
+            outPriority.readPacket(pack);
+        else if (outData.numPending())
+        {
+            outData.readPacket(pack);
+            outBytes -= pack->len;
+        }else
+            break;
+
+        bout.writeRef(pack->data, pack->len, pack);
+        total += pack->len;
+    }
+
+    return total;
+}
+
+// ------------------------------------------
+bool PCPStream::hostUpdateKey(const ChanPacket &pack, std::string &key)
+{
+    if (pack.type != ChanPacket::T_PCP || pack.len < 8)
+        return false;
+
+    MemoryStream mem(const_cast<char*>(pack.data), pack.len);
+    AtomStream atom(mem);
+
+    int numc, dlen;
+    if (atom.read(numc, dlen) != PCP_BCST)
+        return false;
+
+    char group = 0;
+    GnuID chanID, destID, hostID;
+    for (int i = 0; i < numc; i++)
+    {
+        if (mem.eof())
+            return false;
+
+        int c, d;
+        ID4 id = atom.read(c, d);
+        if (d > mem.len - mem.pos)
+            return false;
+
+        if (id == PCP_BCST_GROUP && d == 1)
+            group = atom.readChar();
+        else if (id == PCP_BCST_CHANID && d == 16)
+            atom.readBytes(chanID.id, 16);
+        else if (id == PCP_BCST_DEST && d == 16)
+            atom.readBytes(destID.id, 16);
+        else if (id == PCP_HOST)
+        {
+            for (int j = 0; j < c; j++)
+            {
+                if (mem.eof())
+                    return false;
+
+                int hc, hd;
+                ID4 hid = atom.read(hc, hd);
+                if (hd > mem.len - mem.pos)
+                    return false;
+
+                if (hid == PCP_HOST_ID && hd == 16)
+                    atom.readBytes(hostID.id, 16);
+                else if (hid == PCP_HOST_CHANID && hd == 16 && !chanID.isSet())
+                    atom.readBytes(chanID.id, 16);
+                else
+                    atom.skip(hc, hd);
+            }
+        }else
+            atom.skip(c, d);
+    }
+
+    if (!hostID.isSet())
+        return false;
+
+    key.assign(1, group);
+    key.append(reinterpret_cast<char*>(chanID.id), 16);
+    key.append(reinterpret_cast<char*>(destID.id), 16);
+    key.append(reinterpret_cast<char*>(hostID.id), 16);
+    return true;
+}
+
+// ------------------------------------------
+void PCPStream::releaseHostUpdates(bool force)
 {
+    std::vector<std::string> updates;
+    {
+        std::lock_guard<std::mutex> cs(hostUpdateLock);
+        if (hostUpdates.empty())
+            return;
+        if (!force && (sys->getDTime() - hostUpdateTime) * 1000 < HOST_UPDATE_WINDOW)
+            return;
+        updates.swap(hostUpdates);
+        hostUpdateIndex.clear();
+    }
+
+    // アトムは続けて書けばそのまま続けて読めるので、入るだけ一つのパ
+    // ケットに詰める。
     ChanPacket pack;
-    // send outward packets
-    while (outData.numPending())
+    pack.type = ChanPacket::T_PCP;
+    pack.len = 0;
+    for (auto& data : updates)
     {
-        outData.readPacket(pack);
-        pack.writeRaw(in);
+        if (pack.len + data.size() > ChanPacket::MAX_DATALEN)
+        {
+            queuePacket(pack);
+            pack.len = 0;
+        }
+        memcpy(pack.data + pack.len, data.data(), data.size());
+        pack.len += data.size();
     }
+    if (pack.len)
+        queuePacket(pack);
+}
+
+// ------------------------------------------
+void PCPStream::flush(Stream &in)
+{
+    releaseHostUpdates(true);
+    // send outward packets
+    while (hasPendingOutput())
+        writePending(in, MAX_WRITE_BATCH);
 }
 
 // ------------------------------------------
@@ -108,14 +320,12 @@ int PCPStream::readPacket(Stream &in, BroadcastState &bcs)
 
         // send outward packets
         error = PCP_ERROR_WRITE;
-        if (outData.numPending())
-        {
-            outData.readPacket(pack);
-            pack.writeRaw(in);
-        }
+        releaseHostUpdates(false);
+        if (hasPendingOutput())
+            writePending(in, MAX_WRITE_BATCH);
         error = PCP_ERROR_GENERAL;
 
-        if (outData.willSkip())
+        if (outputOverflow())
         {
             error = PCP_ERROR_WRITE+PCP_ERROR_SKIP;
             throw StreamException("Send too slow");
@@ -130,8 +340,7 @@ int PCPStream::readPacket(Stream &in, BroadcastState &bcs)
 
             id = atom.read(numc, numd);
 
-            mem.rewind();
-            pack.len = patom.writeAtoms(id, in, numc, numd);
+            pack.len = atom.copyAtom(id, numc, numd, pack.data, sizeof(pack.data));
             pack.type = ChanPacket::T_PCP;
 
             inData.writePacket(pack);
@@ -159,6 +368,111 @@ int PCPStream::readPacket(Stream &in, BroadcastState &bcs)
     {
         LOG_ERROR("PCP readPacket: %s (%d)", e.msg, error);
     }
+    flushHits();
+
+    return error;
+}
+
+// ------------------------------------------
+static size_t atomSize(const char *data, size_t len, size_t max, int depth)
+{
+    if (max < 8)
+        throw StreamException("Atom too large");
+    if (len < 8)
+        return 0;
+    if (depth > 16)
+        throw StreamException("Atom nested too deeply");
+
+    uint32_t v = (uint8_t) data[4] | (uint8_t) data[5] << 8 | (uint8_t) data[6] << 16 | (uint32_t) (uint8_t) data[7] << 24;
+    size_t size = 8;
+    if (v & 0x80000000)
+    {
+        for (uint32_t i = 0; i < (v & 0x7fffffff); i++)
+        {
+            size_t n = atomSize(data + size, len - size, max - size, depth + 1);
+            if (n == 0)
+                return 0;
+            size += n;
+        }
+    }else
+    {
+        if (v > max - size)
+            throw StreamException("Atom too large");
+        if (len - size < v)
+            return 0;
+        size += v;
+    }
+
+    if (size > max)
+        throw StreamException("Atom too large");
+    return size;
+}
+
+// ------------------------------------------
+size_t PCPStream::completeAtomSize(const char *data, size_t len)
+{
+    return atomSize(data, len, ChanPacket::MAX_DATALEN, 0);
+}
+
+// ------------------------------------------
+int PCPStream::readAvailable(Stream &in, std::string &buf, BroadcastState &bcs)
+{
+    int error = PCP_ERROR_READ;
+    try
+    {
+        char tmp[8192];
+        int r = in.readSome(tmp, sizeof(tmp));
+        buf.append(tmp, r);
+
+        // 揃ったものは溜めずに全て処理する。途中まで届いたアトムは次
+        // に読んだ分と合わせる。
+        size_t pos = 0;
+        while (size_t n = completeAtomSize(buf.data() + pos, buf.size() - pos))
+        {
+            MemoryStream mem(&buf[pos], (int) n);
+            AtomStream patom(mem);
+            pos += n;
+
+            int numc, numd;
+            ID4 id = patom.read(numc, numd);
+            error = PCPStream::procAtom(patom, id, numc, numd, bcs);
+            if (error)
+                throw StreamException("PCP exception");
+            error = PCP_ERROR_READ;
+        }
+        buf.erase(0, pos);
+
+        error = 0;
+    }catch (StreamException &e)
+    {
+        LOG_ERROR("PCP readAvailable: %s (%d)", e.msg, error);
+    }
+    flushHits();
+
+    return error;
+}
+
+// ------------------------------------------
+int PCPStream::writeOutput(WriteBufferedStream &out)
+{
+    int error = PCP_ERROR_WRITE;
+    try
+    {
+        releaseHostUpdates(false);
+        if (hasPendingOutput())
+            writePending(out, MAX_WRITE_BATCH);
+
+        if (outputOverflow())
+        {
+            error = PCP_ERROR_WRITE+PCP_ERROR_SKIP;
+            throw StreamException("Send too slow");
+        }
+
+        error = 0;
+    }catch (StreamException &e)
+    {
+        LOG_ERROR("PCP writeOutput: %s (%d)", e.msg, error);
+    }
 
     return error;
 }
@@ -286,6 +600,12 @@ void PCPStream::readRootAtoms(AtomStream &atom, int numc, BroadcastState &bcs)
     }
 }
 
+// ------------------------------------------
+static bool isSamePacket(const ChanPacket& a, const ChanPacket& b)
+{
+    return a.pos == b.pos && a.len == b.len && memcmp(a.data, b.data, a.len) == 0;
+}
+
 // ------------------------------------------
 void PCPStream::readPktAtoms(std::shared_ptr<Channel> ch, AtomStream &atom, int numc, BroadcastState &bcs)
 {
@@ -313,6 +633,9 @@ void PCPStream::readPktAtoms(std::shared_ptr<Channel> ch, AtomStream &atom, int
         }else if (id == PCP_CHAN_PKT_CONTINUATION)
         {
             pack.cont = atom.readChar();
+        }else if (id == PCP_CHAN_PKT_TRACE)
+        {
+            PacketTracer::readTraceAtoms(atom, c, pack.trace);
         }else if (id == PCP_CHAN_PKT_DATA)
         {
             if (d > ChanPacket::MAX_DATALEN)
@@ -331,7 +654,7 @@ void PCPStream::readPktAtoms(std::shared_ptr<Channel> ch, AtomStream &atom, int
 
     if (ch)
     {
-        std::lock_guard<std::recursive_mutex> cs(ch->lock);
+        std::lock_guard<ProfiledMutex> cs(ch->lock);
 
         // stream positions (= byte offsets) are unsigned ints
         std::int64_t diff = (std::int64_t) pack.pos - ch->streamPos;
@@ -345,24 +668,38 @@ void PCPStream::readPktAtoms(std::shared_ptr<Channel> ch, AtomStream &atom, int
 
         if (pack.type == ChanPacket::T_HEAD)
         {
-            LOG_DEBUG("New head packet at %u", pack.pos);
-
-            // check for stream restart
-            if (pack.pos == 0)
+            // 繋ぎ直した上流はまずヘッダーを送ってくる。持っているものと
+            // 同じなら、ストリームをそのまま続ける。
+            if (ch->headPack.len && isSamePacket(ch->headPack, pack))
             {
-                LOG_INFO("PCP resetting stream");
-                ch->streamIndex++;
-                ch->rawData.init();
-            }
+                LOG_DEBUG("Resuming stream at %u", ch->streamPos);
+            }else
+            {
+                LOG_DEBUG("New head packet at %u", pack.pos);
+
+                // check for stream restart
+                if (pack.pos == 0)
+                {
+                    LOG_INFO("PCP resetting stream");
+                    ch->streamIndex++;
+                    ch->rawData.init();
+                }
 
-            ch->headPack = pack;
+                ch->headPack = pack;
 
-            ch->rawData.writePacket(pack, true);
-            ch->streamPos = pack.pos+pack.len;
+                ch->rawData.writePacket(pack, true);
+                ch->streamPos = pack.pos+pack.len;
+            }
         }else if (pack.type == ChanPacket::T_DATA)
         {
-            ch->rawData.writePacket(pack, true);
-            ch->streamPos = pack.pos+pack.len;
+            // 上流が古い所から送ってきた時は、持っているパケットを捨てる。
+            if ((int) (pack.pos - ch->streamPos) >= 0)
+            {
+                if (pack.trace.id)
+                    g_packetTracer.received(ch->info.id, pack, ch->sourceHost.host.str());
+                ch->rawData.writePacket(pack, true);
+                ch->streamPos = pack.pos+pack.len;
+            }
         }
     }
 
@@ -375,83 +712,53 @@ void PCPStream::readPktAtoms(std::shared_ptr<Channel> ch, AtomStream &atom, int
 void PCPStream::readHostAtoms(AtomStream &atom, int numc, BroadcastState &bcs)
 {
     ChanHit hit;
-    hit.init();
     GnuID chanID = bcs.chanID;  //use default
+    bool move = false;
+    unsigned int hubLease = 0;
+
+    hit.readAtoms(atom, numc, chanID, move, hubLease);
 
-    //bool busy = false;
+    hit.host = hit.rhost[0];
+    hit.chanID = chanID;
 
-    unsigned int ipNum=0;
+    hit.numHops = bcs.numHops;
 
-    for (int i=0; i<numc; i++)
+    // 一度に読んだ分をまとめて chanMgr に渡す。
+    pendingHits.push_back(hit);
+
+    if (move && bcs.forMe)
     {
-        int c, d;
-        ID4 id = atom.read(c, d);
+        auto ch = chanMgr->findChannelByID(chanID);
+        if (ch)
+            ch->suggestUpstream(hit, bcs.fromID);
+    }
 
-        if (id == PCP_HOST_IP)
-        {
-            hit.rhost[ipNum].ip = atom.readAddress();
-        }else if (id == PCP_HOST_PORT)
-        {
-            int port = atom.readShort();
-            hit.rhost[ipNum++].port = port;
+    if (servMgr->flags[ServMgr::F_trackerHubs])
+    {
+        unsigned int ctime = sys->getTime();
 
-            if (ipNum > 1)
-                ipNum = 1;
+        // トラッカー自身からの指名だけを受ける。
+        if (hubLease && bcs.forMe && hit.tracker && hit.sessionID.isSame(bcs.fromID))
+        {
+            auto ch = chanMgr->findChannelByID(chanID);
+            if (ch && ch->isReceiving() && !ch->isBroadcasting())
+            {
+                if (!g_trackerHubs.isHub(chanID, ctime))
+                    LOG_INFO("Assigned as tracker hub for %s", chanID.str().c_str());
+                g_trackerHubs.assign(chanID, hubLease, ctime);
+            }
         }
-        else if (id == PCP_HOST_NUML)
-            hit.numListeners = atom.readInt();
-        else if (id == PCP_HOST_NUMR)
-            hit.numRelays = atom.readInt();
-        else if (id == PCP_HOST_UPTIME)
-            hit.upTime = atom.readInt();
-        else if (id == PCP_HOST_OLDPOS)
-            hit.oldestPos = atom.readInt();
-        else if (id == PCP_HOST_NEWPOS)
-            hit.newestPos = atom.readInt();
-        else if (id == PCP_HOST_VERSION)
-            hit.version = atom.readInt();
-        else if (id == PCP_HOST_VERSION_VP)
-            hit.versionVP = atom.readInt();
-        else if (id == PCP_HOST_VERSION_EX_PREFIX)
-            atom.readBytes(hit.versionExPrefix, 2);
-        else if (id == PCP_HOST_VERSION_EX_NUMBER)
-            hit.versionExNumber = atom.readShort();
-        else if (id == PCP_HOST_FLAGS1)
-        {
-            int fl1 = atom.readChar();
-
-            hit.recv = (fl1 & PCP_HOST_FLAGS1_RECV) !=0;
-            hit.relay = (fl1 & PCP_HOST_FLAGS1_RELAY) !=0;
-            hit.direct = (fl1 & PCP_HOST_FLAGS1_DIRECT) !=0;
-            hit.cin = (fl1 & PCP_HOST_FLAGS1_CIN) !=0;
-            hit.tracker = (fl1 & PCP_HOST_FLAGS1_TRACKER) !=0;
-            hit.firewalled = (fl1 & PCP_HOST_FLAGS1_PUSH) !=0;
-        }else if (id == PCP_HOST_ID)
-            atom.readBytes(hit.sessionID.id, 16);
-        else if (id == PCP_HOST_CHANID)
-            atom.readBytes(chanID.id, 16);
-        else if (id == PCP_HOST_UPHOST_IP)
-            hit.uphost.ip = atom.readAddress();
-        else if (id == PCP_HOST_UPHOST_PORT)
-            hit.uphost.port = atom.readInt();
-        else if (id == PCP_HOST_UPHOST_HOPS)
-            hit.uphostHops = atom.readInt();
-        else
+
+        // ハブなら、下流から上がってきたヒットは取り込んで自分の報告に
+        // まとめる。
+        if ((bcs.group & PCP_BCST_GROUP_TRACKERS) && !bcs.forMe && !hit.tracker &&
+            hit.sessionID.isSet() && !hit.sessionID.isSame(servMgr->sessionID) &&
+            g_trackerHubs.isHub(chanID, ctime))
         {
-            LOG_DEBUG("PCP skip: %s, %d, %d", id.getString().str(), c, d);
-            atom.skip(c, d);
+            g_trackerHubs.absorb(chanID, hit, ctime);
+            bcs.absorbed = true;
         }
     }
-
-    hit.host = hit.rhost[0];
-    hit.chanID = chanID;
-
-    hit.numHops = bcs.numHops;
-
-    if (hit.recv)
-        chanMgr->addHit(hit);
-    else
-        chanMgr->delHit(hit);
 }
 
 // ------------------------------------------
@@ -574,6 +881,7 @@ int PCPStream::readBroadcastAtoms(AtomStream &atom, int numc, BroadcastState &bc
         {
             atom.readBytes(fromID.id, 16);
             patom.writeBytes(id, fromID.id, 16);
+            bcs.fromID = fromID;
 
             routeList.add(fromID);
         }else if (id == PCP_BCST_GROUP)
@@ -615,8 +923,7 @@ int PCPStream::readBroadcastAtoms(AtomStream &atom, int numc, BroadcastState &bc
         {
             // copy and process atoms
             int oldPos = pmem.pos;
-            patom.writeAtoms(id, atom.io, c, d);
-            pmem.pos = oldPos;
+            atom.copyAtom(id, c, d, pmem.buf + oldPos, pmem.len - oldPos);
             readAtom(patom, bcs);
         }
     }
@@ -630,7 +937,7 @@ int PCPStream::readBroadcastAtoms(AtomStream &atom, int numc, BroadcastState &bc
         }
 
     // broadcast back out if ttl > 0
-    if ((ttl>0) && (!bcs.forMe))
+    if ((ttl>0) && (!bcs.forMe) && (!bcs.absorbed))
     {
         pack.len = pmem.pos;
         pack.type = ChanPacket::T_PCP;
@@ -658,6 +965,37 @@ int PCPStream::readBroadcastAtoms(AtomStream &atom, int numc, BroadcastState &bc
     return 0;
 }
 
+// ------------------------------------------
+void PCPStream::readMuxAtoms(AtomStream &atom, bool subscribe, int numc)
+{
+    GnuID chanID;
+    unsigned int pos = 0;
+
+    for (int i=0; i<numc; i++)
+    {
+        int c, d;
+        ID4 id = atom.read(c, d);
+
+        if (id == PCP_CHAN_ID)
+            atom.readBytes(chanID.id, 16);
+        else if (id == PCP_CHAN_PKT_POS)
+            pos = atom.readInt();
+        else
+        {
+            LOG_DEBUG("PCP skip: %s, %d, %d", id.getString().str(), c, d);
+            atom.skip(c, d);
+        }
+    }
+
+    if (!chanID.isSet())
+        return;
+
+    if (muxHandler)
+        muxHandler(subscribe, chanID, pos);
+    else
+        LOG_DEBUG("PCP ignoring %s for %s", subscribe ? "msub" : "muns", chanID.str().c_str());
+}
+
 // ------------------------------------------
 int PCPStream::procAtom(AtomStream &atom, ID4 id, int numc, int dlen, BroadcastState &bcs)
 {
@@ -699,6 +1037,9 @@ int PCPStream::procAtom(AtomStream &atom, ID4 id, int numc, int dlen, BroadcastS
         r = atom.readInt();
         if (!r)
             r = PCP_ERROR_QUIT;
+    }else if ((id == PCP_MUX_SUB) || (id == PCP_MUX_UNSUB))
+    {
+        readMuxAtoms(atom, id == PCP_MUX_SUB, numc);
     }else if (id == PCP_ATOM)
     {
         for (int i=0; i<numc; i++)
@@ -720,6 +1061,15 @@ int PCPStream::procAtom(AtomStream &atom, ID4 id, int numc, int dlen, BroadcastS
     return r;
 }
 
+// ------------------------------------------
+void PCPStream::flushHits()
+{
+    if (pendingHits.empty())
+        return;
+    chanMgr->applyHits(pendingHits);
+    pendingHits.clear();
+}
+
 // ------------------------------------------
 int PCPStream::readAtom(AtomStream &atom, BroadcastState &bcs)
 {
@@ -24,6 +24,12 @@
 #include "id.h"
 #include "cstream.h"
 #include "chanpacket.h"
+#include "chanhit.h"
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
 
 // ------------------------------------------------
 
@@ -88,9 +94,16 @@ static const ID4 PCP_HOST_NEWPOS    = "newp";
 static const ID4 PCP_HOST_UPHOST_IP = "upip";
 static const ID4 PCP_HOST_UPHOST_PORT = "uppt";
 static const ID4 PCP_HOST_UPHOST_HOPS = "uphp";
+static const ID4 PCP_HOST_HEADROOM  = "hdrm";   // peercast-yt 拡張。上りの帯域の残り (kbps)
+static const ID4 PCP_HOST_MOVE      = "move";   // peercast-yt 拡張。宛先にこのホストを上流にするよう勧める
+static const ID4 PCP_HOST_HUB       = "hub";    // peercast-yt 拡張。宛先にこの秒数だけハブを任せる
+static const ID4 PCP_HOST_HUB_NUML  = "hbnl";   // peercast-yt 拡張。ハブがまとめた下流の視聴者数
+static const ID4 PCP_HOST_HUB_NUMR  = "hbnr";   // peercast-yt 拡張。ハブがまとめた下流のリレー数
 
 static const ID4 PCP_QUIT           = "quit";
 
+static const ID4 PCP_LAN            = "lan";    // peercast-yt 拡張。LAN 内のマルチキャストの告知
+
 static const ID4 PCP_CHAN           = "chan";
 static const ID4 PCP_CHAN_ID        = "id";
 static const ID4 PCP_CHAN_BCID      = "bcid";
@@ -103,11 +116,20 @@ static const ID4 PCP_CHAN_PKT_HEAD  = "head";
 static const ID4 PCP_CHAN_PKT_DATA  = "data";
 static const ID4 PCP_CHAN_PKT_META  = "meta";
 static const ID4 PCP_CHAN_PKT_CONTINUATION = "cont";
+static const ID4 PCP_CHAN_PKT_TRACE = "trac";   // peercast-yt 拡張。pkttrace.h
+
+static const ID4 PCP_TRACE_ID           = "id";
+static const ID4 PCP_TRACE_TIME         = "time";
+static const ID4 PCP_TRACE_HOPS         = "hops";
+static const ID4 PCP_TRACE_RESIDENCE    = "resi";
 
 static const ID4 PCP_CHAN_INFO          = "info";
 static const ID4 PCP_CHAN_INFO_TYPE     = "type";
 static const ID4 PCP_CHAN_INFO_STREAMTYPE       = "styp";
 static const ID4 PCP_CHAN_INFO_STREAMEXT        = "sext";
+static const ID4 PCP_CHAN_INFO_LOWLATENCY       = "lowl";   // peercast-yt 拡張
+static const ID4 PCP_CHAN_INFO_GROUP            = "grup";   // peercast-yt 拡張
+static const ID4 PCP_CHAN_INFO_RENDITION        = "rend";   // peercast-yt 拡張
 static const ID4 PCP_CHAN_INFO_BITRATE  = "bitr";
 static const ID4 PCP_CHAN_INFO_GENRE    = "gnre";
 static const ID4 PCP_CHAN_INFO_NAME     = "name";
@@ -146,6 +168,10 @@ static const ID4 PCP_SPKT               = "spkt";
 
 static const ID4 PCP_ATOM               = "atom";
 
+// peercast-yt 拡張。一つの接続で複数のチャンネルを送る (pcpmux.h)。
+static const ID4 PCP_MUX_SUB            = "msub";   // 子に PCP_CHAN_ID、PCP_CHAN_PKT_POS
+static const ID4 PCP_MUX_UNSUB          = "muns";   // 子に PCP_CHAN_ID
+
 static const ID4 PCP_SESSIONID          = "sid";
 
 static const int PCP_BCST_GROUP_ALL         = (char)0xff;
@@ -178,6 +204,7 @@ static const int PCP_HOST_FLAGS1_PUSH       = 0x08;
 static const int PCP_HOST_FLAGS1_RECV       = 0x10;
 static const int PCP_HOST_FLAGS1_CIN        = 0x20;
 static const int PCP_HOST_FLAGS1_PRIVATE    = 0x40;
+static const int PCP_HOST_FLAGS1_HUB        = 0x80;   // peercast-yt 拡張。トラッカーからヒットの集約を任されている
 
 // ----------------------------------------------
 class BroadcastState
@@ -188,6 +215,7 @@ public:
     , forMe(false)
     , streamPos(0)
     , group(0)
+    , absorbed(false)
     {
     }
 
@@ -196,15 +224,18 @@ public:
         forMe = false;
         group = 0;
         numHops = 0;
+        absorbed = false;
         bcID.clear();
         chanID.clear();
+        fromID.clear();
     }
 
-    GnuID           chanID, bcID;
+    GnuID           chanID, bcID, fromID;
     int             numHops;
     bool            forMe;
     unsigned int    streamPos;
     int             group;
+    bool            absorbed;   // ハブとして取り込んだので上流に流さない
 };
 
 // ----------------------------------------------
@@ -230,6 +261,16 @@ public:
     void    readEnd(Stream &, std::shared_ptr<Channel>) override;
 
     int             readPacket(Stream &, BroadcastState &);
+
+    // 受信と送信を別のスレッドで行う時に使う。readAvailable は in から
+    // 読めるだけ読んで buf に足し、揃ったアトムを全て処理する。読める
+    // ものが無いと待つので、先に readReady で確かめる。writeOutput は
+    // 貯まっているパケットを out に並べる。どちらもエラーコードを返す。
+    int             readAvailable(Stream &in, std::string &buf, BroadcastState &);
+    int             writeOutput(WriteBufferedStream &out);
+    // data の先頭のアトムが揃っていればその長さを、まだなら 0 を返す。
+    // ChanPacket に収まらない大きさなら例外を投げる。
+    static size_t   completeAtomSize(const char *data, size_t len);
     void            flushOutput(Stream &in, BroadcastState &);
     static void     readVersion(Stream &);
 
@@ -238,16 +279,64 @@ public:
     void            readChanAtoms(AtomStream &, int, BroadcastState &);
     void            readHostAtoms(AtomStream &, int, BroadcastState &);
     void            readPushAtoms(AtomStream &, int, BroadcastState &);
+    void            readMuxAtoms(AtomStream &, bool subscribe, int);
 
     void            readPktAtoms(std::shared_ptr<Channel>, AtomStream &, int, BroadcastState &);
     void            readRootAtoms(AtomStream &, int, BroadcastState &);
 
     int             readBroadcastAtoms(AtomStream &, int, BroadcastState &);
 
-    ChanPacketBuffer inData, outData;
+    // readHostAtoms が貯めたヒットを chanMgr にまとめて渡す。
+    void            flushHits();
+
+    // ホスト情報を運ぶ BCST であれば、同じホストの更新を見分けるため
+    // のキーを key に入れて true を返す。
+    static bool     hostUpdateKey(const ChanPacket &, std::string &key);
+    // 貯めておいたホスト情報を、なるべく少ないパケットにまとめて
+    // outData に移す。force が偽なら HOST_UPDATE_WINDOW 経つまで待つ。
+    void            releaseHostUpdates(bool force);
+
+    // 送信待ちのパケット。QUIT や HOST などの制御用のアトムは
+    // outPriority に入れ、outData より先に送る。
+    bool            queuePacket(ChanPacket &);
+    static bool     isPriorityPacket(const ChanPacket &);
+    bool            hasPendingOutput();
+    // hasPendingOutput に加えて、まだ outData に移していないホスト情報
+    // があれば true。
+    bool            hasUpstreamOutput() override;
+    bool            outputOverflow();
+    int             writePending(Stream &, int maxBytes);
+    int             writePending(WriteBufferedStream &, int maxBytes);
+
+    enum
+    {
+        // ホスト情報の BCST を貯めておく時間 (ミリ秒)。
+        HOST_UPDATE_WINDOW = 500,
+        // 通常のレーンに貯めておける量。超えたら送信が遅すぎるとみなす。
+        MAX_OUT_BYTES = 512 * 1024,
+        // 一度にソケットに書き出す量の目安。
+        MAX_WRITE_BATCH = 64 * 1024,
+    };
+
+    ChanPacketBuffer inData, outData, outPriority;
+    std::atomic<int> outBytes;  // outData にあってまだ送っていないバイト数
+
+    // 送信待ちのホスト情報。同じキーの更新は後から来たもので置き換える。
+    std::mutex      hostUpdateLock;
+    std::vector<std::string> hostUpdates;
+    std::map<std::string, size_t> hostUpdateIndex;
+    double          hostUpdateTime;     // 最初に貯めた時刻
+    unsigned int    numHostUpdatesDropped;
     unsigned int    lastPacketTime;
     unsigned int    nextRootPacket;
 
+    // PCP_MUX_SUB、PCP_MUX_UNSUB を受け取った時に呼ばれる。設定され
+    // ていなければ読み捨てる。
+    std::function<void(bool subscribe, const GnuID &chanID, unsigned int pos)> muxHandler;
+
+    // 読んだアトムのうち、まだ chanMgr に渡していないヒット。
+    std::vector<ChanHit> pendingHits;
+
     //int   error;
     GnuIDList   routeList;
     GnuID       remoteID;
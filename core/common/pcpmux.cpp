@@ -0,0 +1,166 @@
+// ------------------------------------------------
+// File : pcpmux.cpp
+// Desc:
+//      一つの PCP 接続で複数のチャンネルを受け取る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+
+#include "pcpmux.h"
+#include "pcp.h"
+#include "atom.h"
+
+PCPMuxRegistry g_pcpMux;
+
+// ------------------------------------
+PCPMuxSession::PCPMuxSession(const Host& host, const GnuID& parentID, const GnuID& remoteID,
+                             std::shared_ptr<PCPStream> stream)
+    : host(host)
+    , parentID(parentID)
+    , remoteID(remoteID)
+    , stream(stream)
+    , m_alive(true)
+{
+}
+
+// ------------------------------------
+// 要求は制御用のアトムなので、親のストリームの送信待ちに入れて親のス
+// レッドに送ってもらう。
+void PCPMuxSession::send(bool subscribe, const GnuID& chanID, unsigned int pos)
+{
+    ChanPacket pack;
+    MemoryStream mem(pack.data, sizeof(pack.data));
+    AtomStream atom(mem);
+
+    if (subscribe)
+    {
+        atom.writeParent(PCP_MUX_SUB, 2);
+            atom.writeBytes(PCP_CHAN_ID, chanID.id, 16);
+            atom.writeInt(PCP_CHAN_PKT_POS, pos);
+    }else
+    {
+        atom.writeParent(PCP_MUX_UNSUB, 1);
+            atom.writeBytes(PCP_CHAN_ID, chanID.id, 16);
+    }
+    pack.len = mem.pos;
+    pack.type = ChanPacket::T_PCP;
+
+    stream->sendPacket(pack, GnuID());
+}
+
+// ------------------------------------
+void PCPMuxSession::subscribe(const GnuID& chanID, unsigned int pos)
+{
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        if (!m_alive)
+            return;
+        m_subscribed.insert(chanID);
+        m_rejected.erase(chanID);
+    }
+    send(true, chanID, pos);
+}
+
+// ------------------------------------
+void PCPMuxSession::unsubscribe(const GnuID& chanID)
+{
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        if (!m_subscribed.erase(chanID) || !m_alive)
+            return;
+    }
+    send(false, chanID, 0);
+}
+
+// ------------------------------------
+void PCPMuxSession::rejected(const GnuID& chanID)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_subscribed.erase(chanID);
+    m_rejected.insert(chanID);
+}
+
+// ------------------------------------
+bool PCPMuxSession::isSubscribed(const GnuID& chanID)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_subscribed.count(chanID) > 0;
+}
+
+// ------------------------------------
+bool PCPMuxSession::isRejected(const GnuID& chanID)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_rejected.count(chanID) > 0;
+}
+
+// ------------------------------------
+int PCPMuxSession::numSubscribed()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_subscribed.size();
+}
+
+// ------------------------------------
+void PCPMuxSession::close()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_alive = false;
+    m_subscribed.clear();
+}
+
+// ------------------------------------
+bool PCPMuxSession::isAlive()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_alive;
+}
+
+// ------------------------------------
+void PCPMuxRegistry::add(std::shared_ptr<PCPMuxSession> session)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_sessions.push_back(session);
+}
+
+// ------------------------------------
+void PCPMuxRegistry::remove(std::shared_ptr<PCPMuxSession> session)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_sessions.erase(std::remove(m_sessions.begin(), m_sessions.end(), session), m_sessions.end());
+}
+
+// ------------------------------------
+std::shared_ptr<PCPMuxSession> PCPMuxRegistry::find(const Host& host, const GnuID& chanID)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    for (auto& s : m_sessions)
+    {
+        if (!(s->host.ip == host.ip) || s->host.port != host.port)
+            continue;
+        if (s->parentID.isSame(chanID))
+            continue;
+        if (!s->isAlive() || s->isRejected(chanID))
+            continue;
+        return s;
+    }
+    return nullptr;
+}
+
+// ------------------------------------
+int PCPMuxRegistry::numSessions()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_sessions.size();
+}
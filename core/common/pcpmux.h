@@ -0,0 +1,96 @@
+// ------------------------------------------------
+// File : pcpmux.h
+// Desc:
+//      一つの PCP 接続で複数のチャンネルを受け取る。
+//
+//      上流との接続のハンドシェイクで x-peercast-mux を交わしておくと、
+//      同じ上流から受け取りたい他のチャンネルを PCP_MUX_SUB で頼める。
+//      パケットにはもともと PCP_CHAN_ID が付いているので、受け取る側は
+//      PCPStream::readChanAtoms がそのままチャンネルに振り分ける。上流
+//      は送れない時には PCP_MUX_UNSUB で断る。
+//
+//      PCPMuxSession は接続を持つチャンネル (親) の PCPStream を、それ
+//      に相乗りするチャンネル (子) に貸す。親が接続を閉じると子も終わ
+//      る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _PCPMUX_H
+#define _PCPMUX_H
+
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "gnuid.h"
+#include "host.h"
+
+class PCPStream;
+
+// ------------------------------------
+class PCPMuxSession
+{
+public:
+    PCPMuxSession(const Host& host, const GnuID& parentID, const GnuID& remoteID,
+                  std::shared_ptr<PCPStream> stream);
+
+    // 上流に chanID を pos から送るよう頼む。
+    void    subscribe(const GnuID& chanID, unsigned int pos);
+    void    unsubscribe(const GnuID& chanID);
+    // 上流から PCP_MUX_UNSUB が来た。
+    void    rejected(const GnuID& chanID);
+
+    bool    isSubscribed(const GnuID& chanID);
+    bool    isRejected(const GnuID& chanID);
+    int     numSubscribed();
+
+    // 親の接続が閉じた。
+    void    close();
+    bool    isAlive();
+
+    const Host      host;
+    const GnuID     parentID;   // 接続を持つチャンネル
+    const GnuID     remoteID;
+    const std::shared_ptr<PCPStream> stream;
+
+private:
+    void    send(bool subscribe, const GnuID& chanID, unsigned int pos);
+
+    std::mutex      m_lock;
+    bool            m_alive;
+    std::unordered_set<GnuID, GnuIDHash, GnuIDEqual> m_subscribed;
+    std::unordered_set<GnuID, GnuIDHash, GnuIDEqual> m_rejected;
+};
+
+// ------------------------------------
+class PCPMuxRegistry
+{
+public:
+    void    add(std::shared_ptr<PCPMuxSession> session);
+    void    remove(std::shared_ptr<PCPMuxSession> session);
+
+    // host に繋がっていて chanID を頼めるセッション。chanID を断られ
+    // たものや、chanID 自身の接続は除く。無ければ nullptr。
+    std::shared_ptr<PCPMuxSession> find(const Host& host, const GnuID& chanID);
+
+    int     numSessions();
+
+private:
+    std::mutex      m_lock;
+    std::vector<std::shared_ptr<PCPMuxSession>> m_sessions;
+};
+
+extern PCPMuxRegistry g_pcpMux;
+
+#endif
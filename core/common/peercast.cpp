@@ -5,6 +5,8 @@
 #include "str.h"
 #include "sslclientsocket.h"
 #include "yplist.h"
+#include "logpipe.h"
+#include "prefork.h"
 
 // ---------------------------------
 // globals
@@ -32,6 +34,11 @@ void APICALL PeercastInstance::init()
 
     servMgr->loadTokenList();
 
+    if (servMgr->flags[ServMgr::F_asyncLog])
+        g_logPipeline.start();
+    if (servMgr->flags[ServMgr::F_asyncSettingsSave])
+        servMgr->settingsWriter.start();
+
     servMgr->start();
 }
 
@@ -120,8 +127,14 @@ bool    APICALL PeercastInstance::getActive()
 // --------------------------------------------------
 void    APICALL PeercastInstance::saveSettings()
 {
-    if (servMgr)
+    // ワーカーのモードでは設定ファイルはワーカー 0 だけが書く。他のワー
+    // カーは受け持ちのリレーを報告し、ワーカー 0 がそれを含めて書く。
+    if (!servMgr)
+        return;
+    if (g_prefork.isPrimary())
         servMgr->saveSettings(peercastApp->getIniFilename());
+    else
+        servMgr->saveWorkerReport();
 }
 
 // --------------------------------------------------
@@ -134,6 +147,7 @@ void    APICALL PeercastInstance::quit()
         servMgr->quit();
     // Give threads time to run all the deconstructors.
     sys->sleep(1000);
+    g_logPipeline.stop();
 }
 
 // --------------------------------------------------
@@ -208,6 +222,14 @@ void ADDLOG(const char *fmt, va_list ap, LogBuffer::TYPE type)
     if (servMgr->pauseLog) return;
     if (!sys) return;
 
+    // 出さない行は整形しない。呼び出し元ごとの制限も整形の前に掛ける。
+    // FATAL は制限しない。
+    bool enabled = servMgr->logLevel() <= type;
+    if (enabled && type != LogBuffer::T_FATAL &&
+        !g_logPipeline.admit(fmt, servMgr->logRateLimit, sys->getTime()))
+        enabled = false;
+    if (!enabled && !AUX_LOG_FUNC_VECTOR) return;
+
     // 1024バイトに切り詰める。[バグ]std::stringクラスを使っているので、
     // シグナルハンドラーからのログ出力に使われるとメモリアロケーター
     // を危険に使用する。
@@ -236,83 +258,43 @@ void ADDLOG(const char *fmt, va_list ap, LogBuffer::TYPE type)
         tmp = str::truncate_utf8(tmp, MAX_LINELEN);
     }
 
-    const char* str = tmp.c_str();
-
     // ログレベルに関わらず出力する。
     if (AUX_LOG_FUNC_VECTOR) {
         for (auto func : *AUX_LOG_FUNC_VECTOR) {
-            func(type, str);
+            func(type, tmp.c_str());
         }
     }
 
-    if (servMgr->logLevel() > type) return;
-
-    if (type != LogBuffer::T_NONE)
-        sys->logBuf->write(str, type);
+    if (!enabled) return;
 
-    peercastApp->printLog(type, str);
-}
-
-// --------------------------------------------------
-void LOG(const char *fmt, ...)
-{
-    va_list ap;
-    va_start(ap, fmt);
-    ADDLOG(fmt, ap, LogBuffer::T_DEBUG);
-    va_end(ap);
+    // LogBuffer とコンソールへは書き込みスレッドが書く。
+    g_logPipeline.push(sys->getTime(), type, std::move(tmp));
+    if (type == LogBuffer::T_FATAL)
+        g_logPipeline.flush();
 }
 
 // --------------------------------------------------
-void LOG_TRACE(const char *fmt, ...)
-{
-    va_list ap;
-    va_start(ap, fmt);
-    ADDLOG(fmt, ap, LogBuffer::T_TRACE);
-    va_end(ap);
-}
+static_assert(LogBuffer::T_TRACE == 1 && LogBuffer::T_DEBUG == 2 && LogBuffer::T_INFO == 3 &&
+              LogBuffer::T_WARN == 4 && LogBuffer::T_ERROR == 5 && LogBuffer::T_FATAL == 6,
+              "common.h の LOG_* マクロの値と合わせる");
 
 // --------------------------------------------------
-void LOG_DEBUG(const char *fmt, ...)
+bool peercast::isLogEnabled(int type)
 {
-    va_list ap;
-    va_start(ap, fmt);
-    ADDLOG(fmt, ap, LogBuffer::T_DEBUG);
-    va_end(ap);
-}
-
-// --------------------------------------------------
-void LOG_INFO(const char *fmt, ...)
-{
-    va_list ap;
-    va_start(ap, fmt);
-    ADDLOG(fmt, ap, LogBuffer::T_INFO);
-    va_end(ap);
-}
-
-// --------------------------------------------------
-void LOG_WARN(const char *fmt, ...)
-{
-    va_list ap;
-    va_start(ap, fmt);
-    ADDLOG(fmt, ap, LogBuffer::T_WARN);
-    va_end(ap);
-}
-
-// --------------------------------------------------
-void LOG_ERROR(const char *fmt, ...)
-{
-    va_list ap;
-    va_start(ap, fmt);
-    ADDLOG(fmt, ap, LogBuffer::T_ERROR);
-    va_end(ap);
+    // AUX_LOG_FUNC_VECTOR はレベルに関わらず全て受け取る。
+    if (AUX_LOG_FUNC_VECTOR)
+        return true;
+    if (!servMgr || servMgr->pauseLog)
+        return false;
+    return servMgr->logLevel() <= type;
 }
 
 // --------------------------------------------------
-void LOG_FATAL(const char *fmt, ...)
+void peercast::writeLog(int type, const char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
-    ADDLOG(fmt, ap, LogBuffer::T_FATAL);
+    ADDLOG(fmt, ap, static_cast<LogBuffer::TYPE>(type));
     va_end(ap);
 }
 
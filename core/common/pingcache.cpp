@@ -0,0 +1,210 @@
+// ------------------------------------------------
+// File : pingcache.cpp
+// Desc:
+//      ping の結果の記憶と、ping を行うワーカー。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+
+#include "pingcache.h"
+#include "servent.h"
+#include "sys.h"
+
+PingCache g_pingCache([](const Host& host, const GnuID& sid)
+                      {
+                          Host h = host;
+                          return Servent::pingHost(h, sid);
+                      });
+
+// ------------------------------------
+PingCache::PingCache(PingFunc ping)
+    : m_ping(ping)
+    , m_idle(0)
+    , m_quit(false)
+    , m_numPings(0)
+    , m_numHits(0)
+    , m_numDropped(0)
+{
+}
+
+// ------------------------------------
+PingCache::~PingCache()
+{
+    stop();
+}
+
+// ------------------------------------
+void PingCache::stop()
+{
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        m_quit = true;
+        for (auto& req : m_queue)
+        {
+            req->done = true;
+            m_inFlight.erase(req->host);
+        }
+        m_queue.clear();
+        m_cond.notify_all();
+        workers.swap(m_workers);
+    }
+    for (auto& t : workers)
+        t.join();
+}
+
+// ------------------------------------
+// m_lock を取って呼ぶ。
+bool PingCache::lookupLocked(const Host& host, const GnuID& sid, bool& ok)
+{
+    auto it = m_entries.find(host);
+    if (it == m_entries.end())
+        return false;
+
+    const Entry& e = it->second;
+    const unsigned int ttl = e.ok ? OK_TTL : FAIL_TTL;
+    if (sys->getTime() - e.time > ttl)
+    {
+        m_entries.erase(it);
+        return false;
+    }
+    // 同じアドレスに別のノードが来た。
+    if (!e.sid.isSame(sid))
+        return false;
+
+    ok = e.ok;
+    return true;
+}
+
+// ------------------------------------
+bool PingCache::lookup(const Host& host, const GnuID& sid, bool& ok)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return lookupLocked(host, sid, ok);
+}
+
+// ------------------------------------
+bool PingCache::verify(const Host& host, const GnuID& sid)
+{
+    std::unique_lock<std::mutex> cs(m_lock);
+
+    bool ok;
+    if (lookupLocked(host, sid, ok))
+    {
+        m_numHits++;
+        return ok;
+    }
+
+    if (m_quit)
+        return false;
+
+    std::shared_ptr<Request> req;
+    auto it = m_inFlight.find(host);
+    if (it != m_inFlight.end() && it->second->sid.isSame(sid))
+    {
+        // 同じホストへの ping が既に出ている。
+        req = it->second;
+        m_numHits++;
+    }else
+    {
+        if (m_queue.size() >= MAX_QUEUED)
+        {
+            LOG_DEBUG("Ping host %s: too many pings queued", host.str().c_str());
+            m_numDropped++;
+            return false;
+        }
+
+        req = std::make_shared<Request>();
+        req->host = host;
+        req->sid = sid;
+        m_inFlight[host] = req;
+        m_queue.push_back(req);
+
+        if (m_idle == 0 && m_workers.size() < MAX_WORKERS)
+            m_workers.emplace_back([this]() { workerMain(); });
+        m_cond.notify_all();
+    }
+
+    if (!m_cond.wait_for(cs, std::chrono::milliseconds(WAIT_MSEC), [&]() { return req->done; }))
+    {
+        LOG_DEBUG("Ping host %s: timed out waiting for result", host.str().c_str());
+        return false;
+    }
+    return req->ok;
+}
+
+// ------------------------------------
+void PingCache::workerMain()
+{
+    sys->setThreadName("PING");
+
+    std::unique_lock<std::mutex> cs(m_lock);
+    while (!m_quit)
+    {
+        if (m_queue.empty())
+        {
+            m_idle++;
+            m_cond.wait(cs);
+            m_idle--;
+            continue;
+        }
+
+        auto req = m_queue.front();
+        m_queue.pop_front();
+
+        cs.unlock();
+        m_numPings++;
+        bool ok = m_ping(req->host, req->sid);
+        cs.lock();
+
+        if (m_entries.size() >= MAX_ENTRIES && !m_entries.count(req->host))
+        {
+            auto oldest = std::min_element(m_entries.begin(), m_entries.end(),
+                                           [](const std::pair<const Host, Entry>& a, const std::pair<const Host, Entry>& b)
+                                           { return a.second.time < b.second.time; });
+            m_entries.erase(oldest);
+        }
+        m_entries[req->host] = { req->sid, ok, sys->getTime() };
+
+        req->ok = ok;
+        req->done = true;
+        auto it = m_inFlight.find(req->host);
+        if (it != m_inFlight.end() && it->second == req)
+            m_inFlight.erase(it);
+        m_cond.notify_all();
+    }
+}
+
+// ------------------------------------
+void PingCache::clear()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_entries.clear();
+}
+
+// ------------------------------------
+amf0::Value PingCache::getState()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return amf0::Value::object(
+        {
+            {"entries", (int) m_entries.size()},
+            {"queued", (int) m_queue.size()},
+            {"workers", (int) m_workers.size()},
+            {"pings", (double) m_numPings},
+            {"hits", (double) m_numHits},
+            {"dropped", (double) m_numDropped},
+        });
+}
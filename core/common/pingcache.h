@@ -0,0 +1,115 @@
+// ------------------------------------------------
+// File : pingcache.h
+// Desc:
+//      接続してきたノードのポートが外から開いているかの確認 (ping) の
+//      結果をホストごとに覚えておく。確かめたばかりのホストにはもう一
+//      度接続しない。
+//
+//      ping は決まった数のワーカースレッドで行い、同じホストへの要求は
+//      一つにまとめる。待ちが MAX_QUEUED を超えたら ping せずに失敗と
+//      する。ネットワークが一時切れた後にトラッカーへ接続し直してくる
+//      ノードが、一度にたくさんの接続を張らせないようにする。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _PINGCACHE_H
+#define _PINGCACHE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gnuid.h"
+#include "host.h"
+#include "amf0.h"
+
+// ------------------------------------
+class PingCache
+{
+public:
+    enum
+    {
+        OK_TTL      = 600,      // 成功を覚えておく秒数
+        FAIL_TTL    = 60,       // 失敗を覚えておく秒数
+        MAX_ENTRIES = 4096,     // これを超えたら一番古いものを捨てる
+        MAX_WORKERS = 8,        // 同時に行う ping の数
+        MAX_QUEUED  = 256,      // これより多くは待たせない
+        WAIT_MSEC   = 20000,    // 結果を待つ時間
+    };
+
+    typedef std::function<bool(const Host&, const GnuID&)> PingFunc;
+
+    PingCache(PingFunc ping);
+    ~PingCache();
+
+    // host に sid のノードが居て、接続を受けられるか。覚えていなければ
+    // ワーカーに ping させて結果を待つ。
+    bool    verify(const Host& host, const GnuID& sid);
+
+    // 覚えている結果があれば ok に入れて true を返す。
+    bool    lookup(const Host& host, const GnuID& sid, bool& ok);
+
+    void    clear();
+    // ワーカーを止める。待っている要求は失敗になる。
+    void    stop();
+
+    uint64_t    numPings() const { return m_numPings; }
+    uint64_t    numHits() const { return m_numHits; }
+    uint64_t    numDropped() const { return m_numDropped; }
+
+    amf0::Value getState();
+
+private:
+    struct Entry
+    {
+        GnuID        sid;
+        bool         ok;
+        unsigned int time;
+    };
+
+    struct Request
+    {
+        Host    host;
+        GnuID   sid;
+        bool    done = false;
+        bool    ok = false;
+    };
+
+    bool    lookupLocked(const Host& host, const GnuID& sid, bool& ok);
+    void    workerMain();
+
+    PingFunc                m_ping;
+
+    std::mutex              m_lock;
+    std::condition_variable m_cond;     // 要求が来た、結果が出た
+    std::map<Host, Entry>   m_entries;
+    std::map<Host, std::shared_ptr<Request>> m_inFlight;    // 待ちか実行中の要求
+    std::deque<std::shared_ptr<Request>> m_queue;
+    std::vector<std::thread> m_workers;
+    int                     m_idle;     // 仕事を待っているワーカーの数
+    bool                    m_quit;
+
+    std::atomic<uint64_t>   m_numPings;
+    std::atomic<uint64_t>   m_numHits;
+    std::atomic<uint64_t>   m_numDropped;
+};
+
+extern PingCache g_pingCache;
+
+#endif
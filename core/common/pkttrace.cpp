@@ -0,0 +1,174 @@
+// ------------------------------------------------
+// File : pkttrace.cpp
+// Desc:
+//      印の付くパケットはチャンネルごとに一秒に一つなので、記録はロッ
+//      クを取って普通に行う。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "pkttrace.h"
+#include "atom.h"
+#include "pcp.h"
+#include "sys.h"
+#include "metrics.h"
+
+PacketTracer g_packetTracer;
+
+// ------------------------------------
+unsigned int PacketTracer::nowMillis()
+{
+    return (unsigned int) (uint64_t) (sys->getDTime() * 1000);
+}
+
+// ------------------------------------
+const char* PacketTracer::kindName(Kind k)
+{
+    switch (k)
+    {
+    case K_INGEST: return "ingest";
+    case K_RECV:   return "recv";
+    case K_SEND:   return "send";
+    default:       return "unknown";
+    }
+}
+
+// ------------------------------------
+void PacketTracer::sample(const GnuID& chanID, ChanPacket& pack, unsigned int& lastSample)
+{
+    if (pack.type != ChanPacket::T_DATA)
+        return;
+
+    const unsigned int now = nowMillis();
+    if (lastSample && (int) (now - lastSample) < SAMPLE_INTERVAL)
+        return;
+    lastSample = now;
+
+    unsigned int id;
+    while ((id = sys->rnd()) == 0)
+        ;
+    pack.trace.id         = id;
+    pack.trace.originTime = now;
+    pack.trace.hops       = 0;
+    pack.trace.residence  = 0;
+
+    Event e = {};
+    e.kind    = K_INGEST;
+    e.chanID  = chanID;
+    e.traceID = id;
+    e.pos     = pack.pos;
+    e.time    = now;
+    record(e);
+}
+
+// ------------------------------------
+void PacketTracer::received(const GnuID& chanID, ChanPacket& pack, const std::string& upstream)
+{
+    pack.trace.hops++;
+
+    const unsigned int now = nowMillis();
+    Event e = {};
+    e.kind              = K_RECV;
+    e.chanID            = chanID;
+    e.traceID           = pack.trace.id;
+    e.pos               = pack.pos;
+    e.hops              = pack.trace.hops;
+    e.time              = now;
+    e.age               = (int) (now - pack.trace.originTime);
+    e.upstreamResidence = pack.trace.residence;
+    e.peer              = upstream;
+    record(e);
+
+    g_metrics.traceAge.observe(e.age > 0 ? e.age / 1000.0 : 0);
+}
+
+// ------------------------------------
+void PacketTracer::sent(const GnuID& chanID, const ChanPacketSlab& pack, const std::string& dest)
+{
+    const unsigned int now = nowMillis();
+    Event e = {};
+    e.kind              = K_SEND;
+    e.chanID            = chanID;
+    e.traceID           = pack.trace.id;
+    e.pos               = pack.pos;
+    e.hops              = pack.trace.hops;
+    e.time              = now;
+    e.age               = (int) (now - pack.trace.originTime);
+    e.upstreamResidence = pack.trace.residence;
+    e.residence         = (unsigned int) std::max(0.0, (sys->getDTime() - pack.time) * 1e6);
+    e.peer              = dest;
+    record(e);
+}
+
+// ------------------------------------
+void PacketTracer::writeTraceAtom(AtomStream& atom, const ChanPacketSlab& pack)
+{
+    unsigned int local = (unsigned int) std::max(0.0, (sys->getDTime() - pack.time) * 1e6);
+
+    atom.writeParent(PCP_CHAN_PKT_TRACE, 4);
+        atom.writeInt(PCP_TRACE_ID, pack.trace.id);
+        atom.writeInt(PCP_TRACE_TIME, pack.trace.originTime);
+        atom.writeInt(PCP_TRACE_HOPS, pack.trace.hops);
+        atom.writeInt(PCP_TRACE_RESIDENCE, pack.trace.residence + local);
+}
+
+// ------------------------------------
+void PacketTracer::readTraceAtoms(AtomStream& atom, int numc, PacketTrace& trace)
+{
+    for (int i = 0; i < numc; i++)
+    {
+        int c, d;
+        ID4 id = atom.read(c, d);
+
+        if (id == PCP_TRACE_ID)
+            trace.id = atom.readInt();
+        else if (id == PCP_TRACE_TIME)
+            trace.originTime = atom.readInt();
+        else if (id == PCP_TRACE_HOPS)
+            trace.hops = atom.readInt();
+        else if (id == PCP_TRACE_RESIDENCE)
+            trace.residence = atom.readInt();
+        else
+            atom.skip(c, d);
+    }
+}
+
+// ------------------------------------
+void PacketTracer::record(const Event& e)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_events.push_back(e);
+    while (m_events.size() > MAX_EVENTS)
+        m_events.pop_front();
+}
+
+// ------------------------------------
+std::vector<PacketTracer::Event> PacketTracer::events(const GnuID& chanID)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    std::vector<Event> res;
+    for (auto& e : m_events)
+        if (!chanID.isSet() || e.chanID.isSame(chanID))
+            res.push_back(e);
+    return res;
+}
+
+// ------------------------------------
+void PacketTracer::clear()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_events.clear();
+}
@@ -0,0 +1,103 @@
+// ------------------------------------------------
+// File : pkttrace.h
+// Desc:
+//      パケットの追跡。packetTracing フラグを立てた配信元は、チャンネ
+//      ルのデータパケットを一秒に一つ選んで印 (PacketTrace) を付ける。
+//      印は PCP_CHAN_PKT の PCP_CHAN_PKT_TRACE アトムで中継先へ伝わり、
+//      途中の各ノードは受け取った時と送り出した時の時刻を記録する。フ
+//      ラグを立てていないノードも、印の付いたパケットは記録して伝える。
+//
+//      配信元からの経過時間はノードの時計が合っていることを前提にする
+//      が、各ノードのバッファーに居た時間 (residence) は時計に依らない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _PKTTRACE_H
+#define _PKTTRACE_H
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "chanpacket.h"
+#include "gnuid.h"
+#include "host.h"
+
+class AtomStream;
+
+// ------------------------------------
+class PacketTracer
+{
+public:
+    enum
+    {
+        MAX_EVENTS      = 1000,     // 覚えておく記録の数
+        SAMPLE_INTERVAL = 1000,     // 配信元で印を付ける間隔 (ミリ秒)
+    };
+
+    enum Kind
+    {
+        K_INGEST,   // 配信元がソースから受け取った
+        K_RECV,     // 上流から受け取った
+        K_SEND,     // 下流へ送った
+    };
+
+    struct Event
+    {
+        Kind            kind;
+        GnuID           chanID;
+        unsigned int    traceID;
+        unsigned int    pos;
+        unsigned int    hops;
+        unsigned int    time;       // 記録した時刻 (UNIX 時刻のミリ秒、下位 32 ビット)
+        int             age;        // 配信元で印を付けてからのミリ秒
+        unsigned int    upstreamResidence;  // 上流のノードに居たマイクロ秒の合計
+        unsigned int    residence;  // K_SEND の時、このノードに居たマイクロ秒
+        std::string     peer;       // K_RECV なら上流、K_SEND なら下流
+    };
+
+    // 今の時刻を PacketTrace::originTime と同じ単位で。
+    static unsigned int nowMillis();
+
+    // 配信元で pack に印を付けるかどうかを決め、付けたら記録する。
+    // lastSample は前に印を付けた時刻で、チャンネルごとに持つ。
+    void    sample(const GnuID& chanID, ChanPacket& pack, unsigned int& lastSample);
+
+    // PCP で受け取った印の付いたパケット。段数はここで一つ増やす。
+    void    received(const GnuID& chanID, ChanPacket& pack, const std::string& upstream);
+
+    // 印の付いたパケットを dest へ送った。
+    void    sent(const GnuID& chanID, const ChanPacketSlab& pack, const std::string& dest);
+
+    // 下流へ送る PCP_CHAN_PKT_TRACE アトム。このノードに居た時間を足す。
+    static void writeTraceAtom(AtomStream& atom, const ChanPacketSlab& pack);
+    // PCP_CHAN_PKT_TRACE の子アトムを読む。
+    static void readTraceAtoms(AtomStream& atom, int numc, PacketTrace& trace);
+
+    // 古い順。chanID が空なら全てのチャンネル。
+    std::vector<Event> events(const GnuID& chanID);
+    void    clear();
+
+    static const char* kindName(Kind k);
+
+private:
+    void    record(const Event& e);
+
+    std::mutex          m_lock;
+    std::deque<Event>   m_events;
+};
+
+extern PacketTracer g_packetTracer;
+
+#endif
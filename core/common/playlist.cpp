@@ -129,7 +129,7 @@ void PlayList::writeASX(Stream &out)
 void PlayList::addChannel(const char *path, ChanInfo &info)
 {
     std::string url;
-    std::string nid = info.id.isSet() ? info.id.str() : info.name;
+    std::string nid = info.id.isSet() ? info.id.str() : info.name.str();
 
     url = str::format("%s/stream/%s%s?auth=%s",
                       path,
@@ -5,6 +5,8 @@
 #include "servmgr.h"
 #include "str.h"
 #include "version2.h"
+#include "resolver.h"
+#include "sys.h"
 
 IPv6PortChecker::IPv6PortChecker(const URI& uri)
     : m_uri(uri)
@@ -19,10 +21,9 @@ PortCheckResult IPv6PortChecker::run(const std::vector<int>& ports)
     if (!sock)
         throw StreamException("Unable to create socket");
 
-    auto ips = sys->getIPAddresses(m_uri.host());
     IP ip;
-    for (auto& str : ips) {
-        ip = IP::parse(str);
+    for (auto& addr : g_resolver.resolve(m_uri.host())) {
+        ip = addr;
         if (!ip.isIPv4Mapped()) // IPv6 アドレスを見つけた。
             break;
     }
@@ -60,3 +61,128 @@ PortCheckResult IPv6PortChecker::run(const std::vector<int>& ports)
 
     return result;
 }
+
+// ------------------------------------
+PortCheckJobs g_portChecks;
+
+// ------------------------------------
+static std::string checkFirewall(int ipv)
+{
+    servMgr->setFirewall(ipv, ServMgr::FW_UNKNOWN);
+    if (ipv == 4)
+        servMgr->checkFirewall();
+    else
+        servMgr->checkFirewallIPv6();
+    return ServMgr::getFirewallStateString(servMgr->getFirewall(ipv));
+}
+
+// ------------------------------------
+PortCheckJobs::PortCheckJobs()
+    : m_check(checkFirewall)
+{
+}
+
+// ------------------------------------
+PortCheckJobs::PortCheckJobs(Check check)
+    : m_check(check)
+{
+}
+
+// ------------------------------------
+PortCheckJobs::~PortCheckJobs()
+{
+    wait();
+}
+
+// ------------------------------------
+int PortCheckJobs::index(int ipv)
+{
+    if (ipv != 4 && ipv != 6)
+        throw ArgumentException("PortCheckJobs: Invalid IP version");
+    return (ipv == 4) ? 0 : 1;
+}
+
+// ------------------------------------
+bool PortCheckJobs::start(int ipv)
+{
+    const int i = index(ipv);
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    if (m_status[i].running)
+        return false;
+
+    // 前のスレッドは running を下ろした後は終わるだけ。
+    if (m_threads[i].joinable())
+        m_threads[i].join();
+
+    m_status[i].running = true;
+    m_status[i].startedAt = sys->getTime();
+    m_threads[i] = std::thread([this, i, ipv]()
+    {
+        std::string result, error;
+        try
+        {
+            result = m_check(ipv);
+        } catch (std::exception& e)
+        {
+            LOG_ERROR("Port check (IPv%d): %s", ipv, e.what());
+            error = e.what();
+        }
+
+        std::lock_guard<std::mutex> cs(m_lock);
+        auto& st = m_status[i];
+        st.running = false;
+        st.finishedAt = sys->getTime();
+        if (error.empty())
+            st.result = result;
+        st.error = error;
+    });
+    return true;
+}
+
+// ------------------------------------
+PortCheckJobs::Status PortCheckJobs::status(int ipv)
+{
+    const int i = index(ipv);
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_status[i];
+}
+
+// ------------------------------------
+void PortCheckJobs::wait()
+{
+    for (auto& t : m_threads)
+    {
+        std::thread thread;
+        {
+            std::lock_guard<std::mutex> cs(m_lock);
+            thread = std::move(t);
+        }
+        if (thread.joinable())
+            thread.join();
+    }
+}
+
+// ------------------------------------
+amf0::Value PortCheckJobs::getState()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    auto toValue = [](const Status& st)
+    {
+        return amf0::Value::object(
+            {
+                {"running", std::to_string(st.running)},
+                {"startedAt", std::to_string(st.startedAt)},
+                {"finishedAt", std::to_string(st.finishedAt)},
+                {"result", st.result},
+                {"error", st.error},
+            });
+    };
+
+    return amf0::Value::object(
+        {
+            {"ipv4", toValue(m_status[0])},
+            {"ipv6", toValue(m_status[1])},
+        });
+}
@@ -1,10 +1,15 @@
-#ifndef _TEMPLATE_H
-#define _TEMPLATE_H
+#ifndef _PORTCHECK_H
+#define _PORTCHECK_H
 
 #include <vector>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <stdint.h>
 #include "uri.h"
 #include "ip.h"
+#include "amf0.h"
 
 struct PortCheckResult
 {
@@ -21,4 +26,45 @@ public:
     URI m_uri;
 };
 
+// ファイアウォールの確認 (IPv4 と IPv6) を別のスレッドで走らせ、最後の
+// 結果を時刻付きで持っておく。要求を受けたスレッドは待たない。
+class PortCheckJobs
+{
+public:
+    // ipv (4 か 6) を確かめて、ファイアウォールの状態を表す文字列
+    // ("ON" など) を返す。失敗したら例外。
+    typedef std::function<std::string(int ipv)> Check;
+
+    struct Status
+    {
+        bool            running = false;
+        unsigned int    startedAt = 0;
+        unsigned int    finishedAt = 0;     // 0 ならまだ一度も終わっていない
+        std::string     result;             // 最後に得た状態
+        std::string     error;              // 最後の確認が失敗した時の理由
+    };
+
+    PortCheckJobs();
+    PortCheckJobs(Check check);
+    ~PortCheckJobs();
+
+    // 確認を始める。既に走っていれば何もせずに false。
+    bool    start(int ipv);
+    Status  status(int ipv);
+    // 走っている確認が終わるのを待つ。
+    void    wait();
+
+    amf0::Value getState();
+
+private:
+    static int  index(int ipv);
+
+    Check       m_check;
+    std::mutex  m_lock;
+    Status      m_status[2];
+    std::thread m_threads[2];
+};
+
+extern PortCheckJobs g_portChecks;
+
 #endif
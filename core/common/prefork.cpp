@@ -0,0 +1,162 @@
+// ------------------------------------------------
+// File : prefork.cpp
+// Desc:
+//      振り分けの規則と、ワーカー間のソケットの受け渡し。fork とソケッ
+//      トの送受信はプラットフォームごとのファイルにある。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <ctype.h>
+
+#include "prefork.h"
+#include "socket.h"
+#include "str.h"
+#include "sys.h"
+
+Prefork g_prefork;
+
+// ------------------------------------
+Prefork::Prefork()
+    : numHandedOff(0)
+    , numReceived(0)
+    , m_index(-1)
+    , m_numWorkers(0)
+    , m_stop(false)
+{
+}
+
+// ------------------------------------
+int Prefork::shardOf(const GnuID& id, int n)
+{
+    if (n <= 1)
+        return 0;
+
+    unsigned int h = 0;
+    for (int i = 0; i < 16; i++)
+        h = h * 31 + id.id[i];
+    return h % n;
+}
+
+// ------------------------------------
+int Prefork::ownerOf(const std::string& requestLine, int n)
+{
+    auto words = str::split(requestLine, " ");
+    if (words.size() < 2 || words[1].empty() || words[1][0] != '/')
+        return -1;  // PCP など
+
+    const std::string& path = words[1];
+    for (auto prefix : { "/stream/", "/channel/", "/pls/", "/hls/" })
+    {
+        if (!str::has_prefix(path, prefix))
+            continue;
+
+        std::string hex = path.substr(strlen(prefix), 32);
+        if (hex.size() != 32)
+            break;
+        for (char c : hex)
+            if (!isxdigit((unsigned char) c))
+                return 0;
+        return shardOf(GnuID(hex), n);
+    }
+
+    return 0;
+}
+
+// ------------------------------------
+void Prefork::claimID(GnuID& id) const
+{
+    if (!enabled())
+        return;
+
+    // 最後のバイトを 1 増やすと shardOf の値も 1 ずつ変わるので、
+    // m_numWorkers 回以内に見付かる。
+    for (int i = 0; i < 256 && shardOf(id, m_numWorkers) != m_index; i++)
+        id.id[15]++;
+}
+
+// ------------------------------------
+bool Prefork::handOff(std::shared_ptr<ClientSocket> sock)
+{
+    if (!enabled())
+        return false;
+
+    int fd;
+    try
+    {
+        fd = sock->getDescriptor();
+    }catch (GeneralException&)
+    {
+        return false;
+    }
+
+    int owner = ownerOf(peekLine(fd, PEEK_TIMEOUT_MSEC), m_numWorkers);
+    if (owner < 0 || owner == m_index)
+        return false;
+
+    // 送れたら fd は閉じられている。
+    if (!sendSocket(m_send[owner], fd))
+    {
+        LOG_ERROR("Failed to hand off connection from %s to worker %d", sock->host.str().c_str(), owner);
+        return false;
+    }
+    sock->detach();
+    numHandedOff++;
+    LOG_DEBUG("Handed off connection from %s to worker %d", sock->host.str().c_str(), owner);
+    return true;
+}
+
+// ------------------------------------
+void Prefork::startReceiver(std::function<void(std::shared_ptr<ClientSocket>)> accept)
+{
+    if (!enabled())
+        return;
+
+    int chan = m_recv[m_index];
+    m_receiver = std::thread([this, chan, accept]()
+    {
+        sys->setThreadName("PREFORK RECV");
+        while (!m_stop)
+        {
+            int fd = recvSocket(chan, 100);
+            if (fd < 0)
+                continue;
+
+            auto sock = adoptSocket(fd);
+            if (!sock)
+                continue;
+            numReceived++;
+            accept(sock);
+        }
+    });
+}
+
+// ------------------------------------
+void Prefork::stop()
+{
+    m_stop = true;
+    if (m_receiver.joinable())
+        m_receiver.join();
+}
+
+// ------------------------------------
+amf0::Value Prefork::getState()
+{
+    return amf0::Value::object(
+        {
+            {"enabled", enabled()},
+            {"index", m_index},
+            {"numWorkers", m_numWorkers},
+            {"numHandedOff", (int) numHandedOff.load()},
+            {"numReceived", (int) numReceived.load()},
+        });
+}
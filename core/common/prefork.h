@@ -0,0 +1,112 @@
+// ------------------------------------------------
+// File : prefork.h
+// Desc:
+//      複数のワーカープロセスで同じポートを待ち受けるモード。制御プロ
+//      セスはワーカーを fork して見張るだけで、接続は全てワーカーが受
+//      ける。チャンネルは ID でワーカーに振り分け、受けた接続の要求が
+//      他のワーカーのチャンネルなら、ソケットをそのワーカーに渡す。
+//      チャンネルを含まない HTTP の要求 (UI、API、配信の受け付け) は
+//      ワーカー 0 が受け持つ。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _PREFORK_H
+#define _PREFORK_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "amf0.h"
+#include "gnuid.h"
+
+class ClientSocket;
+
+// ------------------------------------
+class Prefork
+{
+public:
+    enum
+    {
+        MAX_WORKERS     = 16,
+        PEEK_TIMEOUT_MSEC = 500,    // 要求の最初の行を待つ時間
+        PEEK_MAX        = 1024,     // 最初の行として覗く長さの上限
+    };
+
+    Prefork();
+
+    // 制御プロセスで、スレッドを起こす前に呼ぶ。n 個のワーカーを fork
+    // し、ワーカーではその番号を返す。制御プロセスでは quitRequested
+    // が true になるまで、終わったワーカーを起動し直す。全てのワーカー
+    // を終わらせてから -1 を返す。fork できない環境でも -1。n が 1 以
+    // 下なら fork せずに 0 を返す。
+    int     run(int n, std::function<bool()> quitRequested);
+
+    bool    enabled() const { return m_numWorkers > 1; }
+    int     index() const { return m_index; }
+    int     numWorkers() const { return m_numWorkers; }
+    // 設定の保存や UI、RTMP サーバーなど、一つだけあればよい仕事をす
+    // るプロセスか。このモードでなければ常に true。
+    bool    isPrimary() const { return m_index <= 0; }
+    // id のチャンネルをこのプロセスで扱うか。
+    bool    isLocal(const GnuID& id) const { return !enabled() || shardOf(id, m_numWorkers) == m_index; }
+
+    // id のチャンネルを受け持つワーカーの番号。
+    static int shardOf(const GnuID& id, int n);
+    // 要求の最初の行から、接続を受け持つワーカーの番号を決める。どの
+    // ワーカーでもよければ -1。
+    static int ownerOf(const std::string& requestLine, int n);
+
+    // このワーカーで作るチャンネルの ID を、このワーカーの受け持ちに
+    // なるよう最後のバイトを変える。同じ ID からは同じ ID ができる。
+    void    claimID(GnuID& id) const;
+
+    // 受けた接続を他のワーカーが受け持つなら渡して true を返す。sock
+    // は読み始める前のもの。
+    bool    handOff(std::shared_ptr<ClientSocket> sock);
+
+    // 他のワーカーから渡された接続を受け付けるスレッドを始める。
+    void    startReceiver(std::function<void(std::shared_ptr<ClientSocket>)> accept);
+    void    stop();
+
+    amf0::Value getState();
+
+    // プラットフォームごとの実装。
+    // fd を chan で送る。送れたら fd は閉じる。
+    static bool sendSocket(int chan, int fd);
+    // chan から fd を受け取る。timeoutMsec 以内に来なければ -1。
+    static int  recvSocket(int chan, int timeoutMsec);
+    // fd の最初の行を読まずに覗く。
+    static std::string peekLine(int fd, int timeoutMsec);
+    // fd をソケットにする。
+    static std::shared_ptr<ClientSocket> adoptSocket(int fd);
+
+    std::atomic<unsigned int> numHandedOff;
+    std::atomic<unsigned int> numReceived;
+
+private:
+    int     m_index;
+    int     m_numWorkers;
+    // ワーカーごとの受け渡し用のソケット。m_recv[i] はワーカー i だけ
+    // が読み、m_send[i] には誰でも書く。
+    std::vector<int> m_recv, m_send;
+    std::thread      m_receiver;
+    std::atomic<bool> m_stop;
+};
+
+extern Prefork g_prefork;
+
+#endif
@@ -6,6 +6,10 @@
 #include "sstream.h"
 #include "template.h"
 #include "jrpc.h"
+#include "assetcache.h"
+#include "eventbus.h"
+
+#include <mutex>
 
 using namespace std;
 
@@ -39,6 +43,84 @@ amf0::Value jsonToAmf(const json& j)
     }
 }
 
+// ------------------------------------------------------------
+// 描いたページを、テンプレートのパスと要求の queryString と Host ごと
+// に持っておく。servMgr->publicPageCacheInterval 秒経つか、チャンネル
+// の状態が変わって g_eventBus の generation が進んだら描き直す。
+namespace {
+    struct RenderedPage
+    {
+        unsigned int    time;
+        unsigned int    generation;
+        std::shared_ptr<const std::string> body;
+    };
+
+    // queryString で際限なく増えないように。
+    enum { MAX_CACHED_PAGES = 64 };
+
+    std::mutex s_pageLock;
+    std::map<std::string, RenderedPage> s_pages;
+}
+
+// ------------------------------------------------------------
+void PublicController::clearPageCache()
+{
+    std::lock_guard<std::mutex> cs(s_pageLock);
+    s_pages.clear();
+}
+
+// ------------------------------------------------------------
+HTTPResponse PublicController::renderPage(const HTTPRequest& req, const string& path, const string& lang,
+                                          std::function<void(Stream&)> render)
+{
+    const auto key = path + "?" + req.queryString + "@" + req.headers.get("Host");
+    const auto now = sys->getTime();
+    const auto generation = g_eventBus.generation();
+    const unsigned int interval = servMgr->publicPageCacheInterval;
+
+    std::shared_ptr<const std::string> body;
+    if (interval > 0)
+    {
+        std::lock_guard<std::mutex> cs(s_pageLock);
+        auto it = s_pages.find(key);
+        if (it != s_pages.end() &&
+            it->second.generation == generation &&
+            now - it->second.time < interval)
+            body = it->second.body;
+    }
+
+    if (!body)
+    {
+        StringStream mem;
+        bool complete = true;
+        try
+        {
+            render(mem);
+        }catch (StreamException &)
+        {
+            // 途中まで描けた分を返すが、作り置きはしない。
+            LOG_DEBUG("StreamException in %s", __FUNCTION__);
+            complete = false;
+        }
+        body = std::make_shared<const std::string>(mem.str());
+
+        if (complete && interval > 0)
+        {
+            std::lock_guard<std::mutex> cs(s_pageLock);
+            if (s_pages.size() >= MAX_CACHED_PAGES && !s_pages.count(key))
+                s_pages.clear();
+            s_pages[key] = { now, generation, body };
+        }
+    }
+
+    HTTPHeaders headers;
+    headers.set("Content-Type", "text/html");
+    if (lang != "")
+        headers.set("Content-Language", lang);
+    headers.set("Content-Length", to_string(body->size()));
+    return HTTPResponse::ok(headers, *body);
+}
+
 // ------------------------------------------------------------
 PublicController::PublicController(const string& documentRoot)
     : mapper("/public", documentRoot)
@@ -235,24 +317,19 @@ HTTPResponse PublicController::operator()(const HTTPRequest& req, Stream& stream
         string path, lang;
         tie(path, lang) = mapper.toLocalFilePath(req.path, langs);
 
-        FileStream file;
-        StringStream mem;
-        HTTPRequestScope scope(req);
-        GenericScope locals;
-        locals.vars["channel"] = ch->getState();
-
-        file.openReadOnly(path.c_str());
-        Template engine(req.queryString);
-        engine.prependScope(scope);
-        engine.prependScope(locals);
-        engine.readTemplate(file, &mem);
-
-        map<string,string> headers;
-        headers["Content-Type"]     = "text/html";
-        if (lang != "")
-            headers["Content-Language"] = lang;
-        headers["Content-Length"]   = to_string(mem.getLength());
-        return HTTPResponse::ok(headers, mem.str());
+        return renderPage(req, path, lang,
+                          [&](Stream& mem)
+                          {
+                              StringStream file(*Template::loadTemplate(path));
+                              HTTPRequestScope scope(req);
+                              GenericScope locals;
+                              locals.vars["channel"] = ch->getState();
+
+                              Template engine(req.queryString);
+                              engine.prependScope(scope);
+                              engine.prependScope(locals);
+                              engine.readTemplate(file, &mem);
+                          });
     }else
     {
         string path, lang;
@@ -266,56 +343,42 @@ HTTPResponse PublicController::operator()(const HTTPRequest& req, Stream& stream
 
             auto type = MIMEType(path);
 
-            StringStream mem;
-            FileStream file;
-            HTTPRequestScope reqscope(req);
-
-            try
+            if (type != "text/html")
             {
-                if (type == "text/html")
-                {
-                    file.openReadOnly(path.c_str());
-                    Template engine(req.queryString);
-                    RootObjectScope globals;
-                    GenericScope locals;
-                    JrpcApi api;
-                    {
-                        json::array_t channels = api.getChannels({});
-                        auto newend = std::remove_if(channels.begin(), channels.end(),
-                                                     [] (json channel)
-                                                         { return !channel["status"]["isBroadcasting"]; });
-                        std::sort(channels.begin(), newend,
-                                  [] (json a, json b)
-                                      {
-                                          return a["status"]["totalDirects"] < b["status"]["totalDirects"];
-                                      });
-
-                        locals.vars["broadcastingChannels"] = jsonToAmf(json::array_t(channels.begin(), newend));
-                    }
-                    locals.vars["channelsFound"] = jsonToAmf(api.getChannelsFound({}));
-                    engine.prependScope(globals);
-                    engine.prependScope(reqscope);
-                    engine.prependScope(locals);
-                    engine.readTemplate(file, &mem);
-                }else
-                {
-                    file.openReadOnly(path.c_str());
-                    file.writeTo(mem, file.length());
-                }
-            }catch (StreamException &)
-            {
-                LOG_DEBUG("StreamException in %s", __FUNCTION__);
+                auto res = g_assetCache.respond(req, path, type);
+                if (lang != "")
+                    res.headers.set("Content-Language", lang);
+                return res;
             }
-            file.close();
-
-            string body = mem.str();
-            map<string,string> headers = {
-                {"Content-Type",type},
-                {"Content-Length",to_string(body.size())}
-            };
-            if (lang != "")
-                headers["Content-Language"] = lang;
-            return HTTPResponse::ok(headers, body);
+
+            return renderPage(req, path, lang,
+                              [&](Stream& mem)
+                              {
+                                  StringStream file(*Template::loadTemplate(path));
+                                  HTTPRequestScope reqscope(req);
+                                  Template engine(req.queryString);
+                                  RootObjectScope globals;
+                                  GenericScope locals;
+                                  JrpcApi api;
+                                  {
+                                      json::array_t channels = api.getChannels({});
+                                      auto newend = std::remove_if(channels.begin(), channels.end(),
+                                                                   [] (json channel)
+                                                                       { return !channel["status"]["isBroadcasting"]; });
+                                      std::sort(channels.begin(), newend,
+                                                [] (json a, json b)
+                                                    {
+                                                        return a["status"]["totalDirects"] < b["status"]["totalDirects"];
+                                                    });
+
+                                      locals.vars["broadcastingChannels"] = jsonToAmf(json::array_t(channels.begin(), newend));
+                                  }
+                                  locals.vars["channelsFound"] = jsonToAmf(api.getChannelsFound({}));
+                                  engine.prependScope(globals);
+                                  engine.prependScope(reqscope);
+                                  engine.prependScope(locals);
+                                  engine.readTemplate(file, &mem);
+                              });
         }
     }
 }
@@ -1,6 +1,8 @@
 #ifndef _PUBLIC_H
 #define _PUBLIC_H
 
+#include <functional>
+
 #include "mapper.h"
 #include "http.h"
 
@@ -13,6 +15,13 @@ public:
     static std::string formatUptime(unsigned int totalSeconds);
     static std::vector<std::string> acceptableLanguages(const std::string& acceptLanguage);
 
+    // 作り置きした公開ページを全て捨てる。
+    static void clearPageCache();
+
+    // render で描いたページを返す。作り置きが新しければ描かずにそれを返す。
+    static HTTPResponse renderPage(const HTTPRequest& req, const std::string& path, const std::string& lang,
+                                   std::function<void(Stream&)> render);
+
     FileSystemMapper mapper;
 };
 
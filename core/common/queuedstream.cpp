@@ -0,0 +1,165 @@
+// ------------------------------------------------
+// File : queuedstream.cpp
+// Desc:
+//      書き込みをキューに積んで専用のスレッドで出力先に書くストリーム。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "queuedstream.h"
+#include "sys.h"
+
+// ------------------------------------
+QueuedStream::QueuedStream(std::shared_ptr<Stream> stream, Policy policy, size_t maxQueued)
+    : m_stream(stream)
+    , m_policy(policy)
+    , m_maxQueued(maxQueued)
+    , m_queuedBytes(0)
+    , m_quit(false)
+    , m_disconnected(false)
+    , m_bytesWritten(0)
+    , m_numDropped(0)
+{
+    m_writer = std::thread([this]() { writerMain(); });
+}
+
+// ------------------------------------
+QueuedStream::~QueuedStream()
+{
+    close();
+}
+
+// ------------------------------------
+QueuedStream::Policy QueuedStream::policyFromString(const std::string& str)
+{
+    if (str == "disconnect")
+        return P_DISCONNECT;
+    else if (str == "drop")
+        return P_DROP;
+    else
+        throw ArgumentException("Unknown policy " + str);
+}
+
+// ------------------------------------
+void QueuedStream::write(const void *data, int len)
+{
+    enqueue(std::string(static_cast<const char*>(data), len));
+}
+
+// ------------------------------------
+void QueuedStream::writeVector(const IOVec *vec, int n)
+{
+    std::string unit;
+    for (int i = 0; i < n; i++)
+        unit.append(static_cast<const char*>(vec[i].data), vec[i].len);
+    enqueue(std::move(unit));
+}
+
+// ------------------------------------
+void QueuedStream::enqueue(std::string&& unit)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_quit || m_disconnected)
+        return;
+
+    // 空の時は大きくても受け付ける (ヘッダーなどを捨てないように)。
+    if (!m_queue.empty() && m_queuedBytes + unit.size() > m_maxQueued)
+    {
+        m_numDropped++;
+        if (m_policy == P_DISCONNECT)
+        {
+            // 出力先は書き手のスレッドが閉じる。
+            m_disconnected = true;
+            m_queue.clear();
+            m_queuedBytes = 0;
+            m_cond.notify_one();
+        }
+        return;
+    }
+
+    m_queuedBytes += unit.size();
+    m_queue.push_back(std::move(unit));
+    m_cond.notify_one();
+}
+
+// ------------------------------------
+size_t QueuedStream::queuedBytes()
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_queuedBytes;
+}
+
+// ------------------------------------
+void QueuedStream::writerMain()
+{
+    sys->setThreadName("QUEUED");
+
+    std::unique_lock<std::mutex> lk(m_mutex);
+    while (true)
+    {
+        m_cond.wait(lk, [this]() { return !m_queue.empty() || m_quit || m_disconnected; });
+        if (m_disconnected || (m_queue.empty() && m_quit))
+            break;
+
+        std::deque<std::string> batch;
+        batch.swap(m_queue);
+        m_queuedBytes = 0;
+        lk.unlock();
+
+        try
+        {
+            for (auto& unit : batch)
+            {
+                if (m_disconnected)
+                    break;
+                m_stream->write(unit.data(), (int) unit.size());
+                m_bytesWritten += unit.size();
+            }
+        }catch (StreamException& e)
+        {
+            LOG_ERROR("QueuedStream: %s", e.what());
+            m_disconnected = true;
+        }
+        lk.lock();
+    }
+    lk.unlock();
+
+    if (m_disconnected)
+    {
+        LOG_INFO("QueuedStream: output disconnected (%u dropped)", (unsigned int) m_numDropped);
+        try
+        {
+            m_stream->close();
+        }catch (StreamException& e)
+        {
+            LOG_ERROR("QueuedStream: %s", e.what());
+        }
+    }
+}
+
+// ------------------------------------
+void QueuedStream::close()
+{
+    std::lock_guard<std::mutex> cs(m_controlLock);
+    if (!m_writer.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_quit = true;
+        m_cond.notify_all();
+    }
+    m_writer.join();
+
+    // 切った時は書き手のスレッドが閉じている。
+    if (!m_disconnected)
+        m_stream->close();
+}
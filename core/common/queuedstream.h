@@ -0,0 +1,95 @@
+// ------------------------------------------------
+// File : queuedstream.h
+// Desc:
+//      書き込みをキューに積んで専用のスレッドで出力先に書くストリーム。
+//      StreamSplitter の出力ごとに挟むと、遅い出力先が他の出力先と書
+//      き手を待たせなくなる。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _QUEUEDSTREAM_H
+#define _QUEUEDSTREAM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "stream.h"
+
+// ------------------------------------
+// 一度の write/writeVector を一つの単位としてキューに積む (FLV のタグ
+// が途中で切れないように)。キューが maxQueued バイトを超える時は、
+// policy に従って新しい単位を捨てるか、出力先を切る。出力先への書き
+// 込みが失敗した時も切る。切った後の書き込みは黙って捨てる。
+class QueuedStream : public Stream
+{
+public:
+    enum Policy
+    {
+        P_DISCONNECT,       // 溢れたら出力先を閉じて以後書かない
+        P_DROP,             // 溢れている間は単位ごと捨てる
+    };
+
+    enum
+    {
+        MAX_QUEUED = 8 * 1024 * 1024,
+    };
+
+    QueuedStream(std::shared_ptr<Stream> stream, Policy policy = P_DISCONNECT,
+                 size_t maxQueued = MAX_QUEUED);
+    ~QueuedStream();
+
+    int         read(void *buf, int len) override
+    {
+        throw StreamException("Stream can`t read");
+    }
+
+    void        write(const void *data, int len) override;
+    void        writeVector(const IOVec *vec, int n) override;
+
+    // 溜まっている分を書き終えてから出力先を閉じる。
+    void        close() override;
+
+    bool        isDisconnected() const { return m_disconnected; }
+    size_t      queuedBytes();
+    uint64_t    bytesWritten() const { return m_bytesWritten; }
+    unsigned int numDropped() const { return m_numDropped; }
+
+    static Policy policyFromString(const std::string& str);
+
+private:
+    void        enqueue(std::string&& unit);
+    void        writerMain();
+
+    std::shared_ptr<Stream> m_stream;
+    const Policy m_policy;
+    const size_t m_maxQueued;
+
+    std::mutex  m_mutex;
+    std::condition_variable m_cond;
+    std::deque<std::string> m_queue;
+    size_t      m_queuedBytes;
+    bool        m_quit;
+
+    std::mutex  m_controlLock;
+    std::thread m_writer;
+
+    std::atomic<bool> m_disconnected;
+    std::atomic<uint64_t> m_bytesWritten;
+    std::atomic<unsigned int> m_numDropped;
+};
+
+#endif
@@ -0,0 +1,64 @@
+// ------------------------------------------------
+// File : reactor.h
+// Desc:
+//      ソケットの準備完了イベントを少数のワーカースレッドで多重化する
+//      イベントループのインターフェース。実装は sys->createReactor()
+//      で得る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _REACTOR_H
+#define _REACTOR_H
+
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+// --------------------------------------------------
+class Reactor
+{
+public:
+    enum
+    {
+        EV_READ     = 1,
+        EV_WRITE    = 2,
+        EV_ERROR    = 4,    // エラーまたは切断
+        EV_WAKE     = 8,    // post() による呼び出し
+        EV_TICK     = 16,   // 約 1 秒ごとの呼び出し
+    };
+
+    // ハンドラーには発生したイベントのビット和が渡される。同じハンド
+    // ルのハンドラーが複数のスレッドで同時に実行されることはない。
+    typedef std::function<void(int events)> Handler;
+
+    virtual ~Reactor() {}
+
+    // ファイル記述子 fd を events (EV_READ|EV_WRITE) で監視する。返さ
+    // れるハンドルは 0 にならず、再利用されない。
+    virtual uint64_t    add(int fd, int events, Handler handler) = 0;
+
+    // 監視するイベントを変更する。0 の場合も EV_ERROR は通知される。
+    virtual void        modify(uint64_t id, int events) = 0;
+
+    // 監視をやめる。ハンドラーの中から呼ぶこと。
+    virtual void        remove(uint64_t id) = 0;
+
+    // ハンドラーを EV_WAKE で呼び出すよう要求する。どのスレッドから呼
+    // んでもよく、既に削除されたハンドルに対しては何もしない。
+    virtual void        post(uint64_t id) = 0;
+
+    virtual size_t      numHandlers() = 0;
+    virtual int         numWorkers() = 0;
+};
+
+#endif
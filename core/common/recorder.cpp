@@ -0,0 +1,236 @@
+// ------------------------------------------------
+// File : recorder.cpp
+// Desc:
+//      チャンネルの録画。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+
+#include "recorder.h"
+#include "sys.h"
+#include "str.h"
+
+// ------------------------------------
+ChannelRecorder::ChannelRecorder(const std::string& prefix, const std::string& ext,
+                                 unsigned int segmentSeconds, size_t maxQueued)
+    : m_prefix(prefix)
+    , m_ext(ext)
+    , m_segmentSeconds(segmentSeconds)
+    , m_maxQueued(maxQueued)
+    , m_queuedBytes(0)
+    , m_waitKey(true)
+    , m_quit(false)
+    , m_fileOffset(0)
+    , m_segmentStart(0)
+    , m_failed(false)
+    , m_bytesWritten(0)
+    , m_numDropped(0)
+    , m_numSegments(0)
+{
+}
+
+// ------------------------------------
+ChannelRecorder::~ChannelRecorder()
+{
+    stop();
+}
+
+// ------------------------------------
+void ChannelRecorder::start()
+{
+    std::lock_guard<std::mutex> cs(m_controlLock);
+    if (m_writer.joinable())
+        return;
+    m_writer = std::thread([this]() { writerMain(); });
+}
+
+// ------------------------------------
+void ChannelRecorder::stop()
+{
+    std::lock_guard<std::mutex> cs(m_controlLock);
+    if (!m_writer.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_quit = true;
+        m_cond.notify_all();
+    }
+    m_writer.join();
+}
+
+// ------------------------------------
+std::string ChannelRecorder::segmentPath(unsigned int n) const
+{
+    return str::format("%s-%03u%s", m_prefix.c_str(), n, m_ext.c_str());
+}
+
+// ------------------------------------
+void ChannelRecorder::setHeader(const ChanPacket& head)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_header.assign(head.data, head.len);
+}
+
+// ------------------------------------
+void ChannelRecorder::put(std::shared_ptr<const ChanPacketSlab> pack)
+{
+    if (!pack || (pack->type != ChanPacket::T_HEAD && pack->type != ChanPacket::T_DATA))
+        return;
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_quit)
+        return;
+
+    // 捨て始めたら、再生できるようにキーフレームから再開する。
+    if ((m_waitKey && pack->cont) || m_queuedBytes + pack->len > m_maxQueued)
+    {
+        m_numDropped++;
+        m_waitKey = true;
+        return;
+    }
+    m_waitKey = false;
+
+    m_queuedBytes += pack->len;
+    m_queue.push_back(std::move(pack));
+    m_cond.notify_one();
+}
+
+// ------------------------------------
+void ChannelRecorder::writerMain()
+{
+    sys->setThreadName("RECORD");
+
+    std::unique_lock<std::mutex> lk(m_mutex);
+    while (true)
+    {
+        if (m_queue.empty())
+        {
+            if (m_quit)
+                break;
+            if (m_cond.wait_for(lk, std::chrono::milliseconds(FLUSH_MSEC),
+                                [this]() { return !m_queue.empty() || m_quit; }))
+                continue;
+
+            // しばらく来ないので端数も書いておく。
+            lk.unlock();
+            drain(true);
+            lk.lock();
+            continue;
+        }
+
+        std::deque<std::shared_ptr<const ChanPacketSlab>> batch;
+        batch.swap(m_queue);
+        m_queuedBytes = 0;
+        lk.unlock();
+
+        for (auto& pack : batch)
+            append(*pack);
+        drain(false);
+
+        lk.lock();
+    }
+    lk.unlock();
+
+    drain(true);
+    closeSegment();
+}
+
+// ------------------------------------
+void ChannelRecorder::append(const ChanPacketSlab& pack)
+{
+    if (m_failed)
+        return;
+
+    if (pack.type == ChanPacket::T_HEAD)
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_header.assign(pack.data, pack.len);
+    }
+
+    if (!m_file.isOpen())
+    {
+        m_segmentStart = pack.time;
+        openSegment(pack.type != ChanPacket::T_HEAD);
+    }else if (m_segmentSeconds && pack.type == ChanPacket::T_DATA && !pack.cont &&
+              pack.time - m_segmentStart >= m_segmentSeconds)
+    {
+        drain(true);
+        closeSegment();
+        m_segmentStart = pack.time;
+        openSegment(true);
+    }
+
+    m_buf.append(pack.data, pack.len);
+}
+
+// ------------------------------------
+void ChannelRecorder::drain(bool all)
+{
+    if (!m_file.isOpen() || m_failed)
+        return;
+
+    size_t pos = 0;
+    try
+    {
+        while (pos < m_buf.size())
+        {
+            size_t chunk = WRITE_BLOCK - m_fileOffset % WRITE_BLOCK;
+            if (m_buf.size() - pos < chunk && !all)
+                break;
+            size_t n = std::min(chunk, m_buf.size() - pos);
+            m_file.write(m_buf.data() + pos, (int) n);
+            pos += n;
+            m_fileOffset += n;
+            m_bytesWritten += n;
+        }
+        if (pos)
+            m_file.flush();
+    }catch (StreamException& e)
+    {
+        LOG_ERROR("Recording stopped: %s", e.what());
+        m_failed = true;
+    }
+    m_buf.erase(0, pos);
+}
+
+// ------------------------------------
+void ChannelRecorder::openSegment(bool writeHeader)
+{
+    auto path = segmentPath(m_numSegments + 1);
+    try
+    {
+        m_file.openWriteReplace(path);
+    }catch (StreamException& e)
+    {
+        LOG_ERROR("Cannot record to %s: %s", path.c_str(), e.what());
+        m_failed = true;
+        return;
+    }
+    m_numSegments++;
+    m_fileOffset = 0;
+    LOG_INFO("Recording to %s", path.c_str());
+
+    if (writeHeader)
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_buf += m_header;
+    }
+}
+
+// ------------------------------------
+void ChannelRecorder::closeSegment()
+{
+    m_buf.clear();
+    m_file.close();
+}
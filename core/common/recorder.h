@@ -0,0 +1,109 @@
+// ------------------------------------------------
+// File : recorder.h
+// Desc:
+//      チャンネルの録画。チャンネルのパケットをキューに積むだけで、フ
+//      ァイルへの書き込みは専用のスレッドで行う。書き込みはまとめて、
+//      ファイル上の WRITE_BLOCK の境界に揃えて行う。キューが溢れたら
+//      次のキーフレームまで捨てるので、ディスクが遅くてもチャンネルの
+//      スレッドは待たされない。
+//
+//      ファイルは <prefix>-001<ext> のように連番で、segmentSeconds 秒
+//      を過ぎた後のキーフレームで次のファイルに切り替える。各ファイル
+//      はストリームヘッダーから始まる。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _RECORDER_H
+#define _RECORDER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "chanpacket.h"
+#include "stream.h"
+
+// ------------------------------------
+class ChannelRecorder
+{
+public:
+    enum
+    {
+        WRITE_BLOCK     = 256 * 1024,       // 書き込みの単位
+        MAX_QUEUED      = 32 * 1024 * 1024, // キューに溜められるバイト数
+        FLUSH_MSEC      = 2000,             // パケットが来なければ端数もこれだけ待って書く
+    };
+
+    ChannelRecorder(const std::string& prefix, const std::string& ext,
+                    unsigned int segmentSeconds, size_t maxQueued = MAX_QUEUED);
+    ~ChannelRecorder();
+
+    void    start();
+    void    stop();     // 溜まっている分を書いてから止める
+
+    // 各ファイルの先頭に書くヘッダー。T_HEAD のパケットが来れば置き換
+    // わる。
+    void    setHeader(const ChanPacket& head);
+
+    // チャンネルのパケットを積む。待たずに戻る。
+    void    put(std::shared_ptr<const ChanPacketSlab> pack);
+
+    std::string segmentPath(unsigned int n) const;
+
+    uint64_t    bytesWritten() const { return m_bytesWritten; }
+    // 捨てたパケットの数。録画を始めた直後のキーフレーム待ちも数える。
+    uint64_t    numDropped() const { return m_numDropped; }
+    unsigned int numSegments() const { return m_numSegments; }
+
+private:
+    void    writerMain();
+    void    append(const ChanPacketSlab& pack);
+    // 溜まった分を WRITE_BLOCK の境界まで書く。all なら端数も書く。
+    void    drain(bool all);
+    void    openSegment(bool writeHeader);
+    void    closeSegment();
+
+    const std::string   m_prefix, m_ext;
+    const unsigned int  m_segmentSeconds;
+    const size_t        m_maxQueued;
+
+    std::mutex          m_mutex;
+    std::condition_variable m_cond;
+    std::deque<std::shared_ptr<const ChanPacketSlab>> m_queue;
+    size_t              m_queuedBytes;
+    bool                m_waitKey;      // キーフレームまで捨てる
+    bool                m_quit;
+    std::string         m_header;
+
+    // 書き込みスレッドだけが触る。
+    FileStream          m_file;
+    std::string         m_buf;
+    uint64_t            m_fileOffset;
+    double              m_segmentStart;
+    bool                m_failed;
+
+    std::atomic<uint64_t>   m_bytesWritten;
+    std::atomic<uint64_t>   m_numDropped;
+    std::atomic<unsigned int> m_numSegments;
+
+    std::thread         m_writer;
+    std::mutex          m_controlLock;  // start と stop
+};
+
+#endif
@@ -1,5 +1,7 @@
 #include "regexp.h"
 
+#include <map>
+#include <mutex>
 #include <stdexcept>
 
 Regexp::Regexp(const std::string& exp)
@@ -78,3 +80,27 @@ std::vector<std::string> Regexp::grep(const Regexp& reg, const std::vector<std::
     }
     return result;
 }
+
+std::shared_ptr<const Regexp> Regexp::cached(const std::string& exp)
+{
+    static std::mutex lock;
+    static std::map<std::string, std::shared_ptr<const Regexp>> cache;
+
+    {
+        std::lock_guard<std::mutex> cs(lock);
+        auto it = cache.find(exp);
+        if (it != cache.end())
+            return it->second;
+    }
+
+    // コンパイルはロックの外で行う。
+    auto reg = std::make_shared<const Regexp>(exp);
+
+    std::lock_guard<std::mutex> cs(lock);
+    // パターンがいくらでも増えることはないはずだが、念のため上限を超え
+    // たら全部捨てる。
+    if (cache.size() >= MAX_CACHED)
+        cache.clear();
+    cache[exp] = reg;
+    return reg;
+}
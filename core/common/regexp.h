@@ -1,6 +1,7 @@
 #ifndef _REGEXP_H
 #define _REGEXP_H
 
+#include <memory>
 #include <vector>
 #include <string>
 #include <regex>
@@ -15,6 +16,12 @@ public:
     static std::string escape(const std::string&);
     static std::vector<std::string> grep(const Regexp&, const std::vector<std::string>&);
 
+    // 実行時に決まるパターン用。同じ exp に対しては一度だけコンパイ
+    // ルしたものを返す。パターンが不正なら std::regex_error を投げる。
+    static std::shared_ptr<const Regexp> cached(const std::string& exp);
+
+    enum { MAX_CACHED = 64 };
+
     std::vector<std::string> exec(const std::string& str) const;
     bool matches(const std::string& str) const;
 
@@ -0,0 +1,163 @@
+// ------------------------------------------------
+// File : relaypolicy.cpp
+// Desc:
+//      上流に選ぶリレーの評価。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "relaypolicy.h"
+#include "chanhit.h"
+#include "sys.h"
+
+RelayStats g_relayStats;
+
+// 移動平均で新しい値に掛ける重み。
+static const double kSmoothing = 0.3;
+
+static void smooth(double& avg, double value)
+{
+    if (avg < 0)
+        avg = value;
+    else
+        avg = (1 - kSmoothing) * avg + kSmoothing * value;
+}
+
+// ------------------------------------
+// m_lock を取って呼ぶ。
+RelayStats::Entry& RelayStats::entry(const Host& host)
+{
+    if (m_entries.size() >= MAX_ENTRIES && !m_entries.count(host))
+    {
+        auto oldest = m_entries.begin();
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+            if (it->second.updated < oldest->second.updated)
+                oldest = it;
+        m_entries.erase(oldest);
+    }
+
+    Entry& e = m_entries[host];
+    e.updated = sys->getDTime();
+    return e;
+}
+
+// ------------------------------------
+void RelayStats::recordConnect(const Host& host, double seconds)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    smooth(entry(host).rtt, seconds);
+}
+
+// ------------------------------------
+void RelayStats::recordThroughput(const Host& host, double ratio)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    smooth(entry(host).throughput, std::min(1.0, ratio));
+}
+
+// ------------------------------------
+void RelayStats::recordFailure(const Host& host)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    Entry& e = entry(host);
+    e.failures++;
+    e.lastFailure = e.updated;
+}
+
+// ------------------------------------
+void RelayStats::recordSuccess(const Host& host)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    entry(host).failures = 0;
+}
+
+// ------------------------------------
+bool RelayStats::get(const Host& host, Entry& out)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_entries.find(host);
+    if (it == m_entries.end())
+        return false;
+    out = it->second;
+    return true;
+}
+
+// ------------------------------------
+void RelayStats::clear()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_entries.clear();
+}
+
+// ------------------------------------
+amf0::Value RelayStats::getState()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    std::vector<amf0::Value> hosts;
+    for (auto& pair : m_entries)
+    {
+        const Entry& e = pair.second;
+        hosts.push_back(amf0::Value::object(
+            {
+                {"host", pair.first.str()},
+                {"rtt", e.rtt},
+                {"throughput", e.throughput},
+                {"failures", e.failures},
+            }));
+    }
+    return amf0::Value::strictArray(hosts);
+}
+
+// ------------------------------------
+double HopCountPolicy::cost(const ChanHit& hit, const Host&) const
+{
+    return hit.numHops;
+}
+
+// ------------------------------------
+WeightedRelayPolicy::WeightedRelayPolicy(RelayStats& stats)
+    : rttPerHop(0.1)
+    , costPerRelay(0.25)
+    , costPerListener(0.05)
+    , busyCost(4)
+    , failureCost(2)
+    , slowCost(4)
+    , headroomCost(4)
+    , bitrate(0)
+    , m_stats(stats)
+{
+}
+
+// ------------------------------------
+double WeightedRelayPolicy::cost(const ChanHit& hit, const Host& host) const
+{
+    double cost = hit.numHops;
+
+    cost += hit.numRelays * costPerRelay + hit.numListeners * costPerListener;
+    if (!hit.relay)
+        cost += busyCost;
+    if (bitrate && hit.headroom >= 0 && (unsigned int) hit.headroom < bitrate)
+        cost += (1 - (double) hit.headroom / bitrate) * headroomCost;
+
+    RelayStats::Entry e;
+    if (m_stats.get(host, e))
+    {
+        if (e.rtt >= 0)
+            cost += e.rtt / rttPerHop;
+        if (e.throughput >= 0)
+            cost += (1 - e.throughput) * slowCost;
+        if (e.failures && sys->getDTime() - e.lastFailure < FAILURE_WINDOW)
+            cost += e.failures * failureCost;
+    }
+
+    return cost;
+}
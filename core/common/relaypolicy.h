@@ -0,0 +1,128 @@
+// ------------------------------------------------
+// File : relaypolicy.h
+// Desc:
+//      上流に選ぶリレーの評価。ChanHitList::pickHits は ChanHitSearch
+//      に RelayPolicy があれば、ホップ数の代わりにその評価が一番低い
+//      ヒットを選ぶ。
+//
+//      RelayStats はこちらから接続した時の測定値をホストごとに覚えてお
+//      く。接続にかかった時間、チャンネルのビットレートに対して実際に
+//      受け取れた割合、続けて失敗した回数。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _RELAYPOLICY_H
+#define _RELAYPOLICY_H
+
+#include <map>
+#include <mutex>
+
+#include "amf0.h"
+#include "host.h"
+
+class ChanHit;
+
+// ------------------------------------
+class RelayStats
+{
+public:
+    enum
+    {
+        MAX_ENTRIES = 1024, // これを超えたら一番古いものを捨てる
+    };
+
+    struct Entry
+    {
+        Entry()
+            : rtt(-1)
+            , throughput(-1)
+            , failures(0)
+            , lastFailure(0)
+            , updated(0)
+        {}
+
+        double       rtt;           // 接続にかかった秒数の移動平均。未測定なら負
+        double       throughput;    // 受信速度 / ビットレートの移動平均。未測定なら負
+        unsigned int failures;      // 続けて失敗した回数
+        double       lastFailure;
+        double       updated;
+    };
+
+    void    recordConnect(const Host& host, double seconds);
+    void    recordThroughput(const Host& host, double ratio);
+    void    recordFailure(const Host& host);
+    void    recordSuccess(const Host& host);
+
+    bool    get(const Host& host, Entry& out);
+    void    clear();
+
+    amf0::Value getState();
+
+private:
+    Entry&  entry(const Host& host);
+
+    std::mutex              m_lock;
+    std::map<Host, Entry>   m_entries;
+};
+
+extern RelayStats g_relayStats;
+
+// ------------------------------------
+class RelayPolicy
+{
+public:
+    virtual ~RelayPolicy() {}
+
+    // host を使って hit に繋いだ時の評価。低いほど良い。
+    virtual double cost(const ChanHit& hit, const Host& host) const = 0;
+};
+
+// ------------------------------------
+// 元々の選び方。ホップ数だけを見る。
+class HopCountPolicy : public RelayPolicy
+{
+public:
+    double cost(const ChanHit& hit, const Host& host) const override;
+};
+
+// ------------------------------------
+// ホップ数に、測った遅延と速度、リレーの負荷、失敗の記録を足す。重み
+// はホップ数を単位にしている。bitrate を設定すると、相手が知らせてき
+// た上りの残りがそれに足りない分も足す。
+class WeightedRelayPolicy : public RelayPolicy
+{
+public:
+    enum
+    {
+        FAILURE_WINDOW = 600,   // 失敗を数える秒数
+    };
+
+    WeightedRelayPolicy(RelayStats& stats = g_relayStats);
+
+    double cost(const ChanHit& hit, const Host& host) const override;
+
+    double rttPerHop;           // 1 ホップ相当の接続時間 (秒)
+    double costPerRelay;        // 相手が既に持っているリレー 1 つ当たり
+    double costPerListener;     // 相手が既に持っている視聴者 1 人当たり
+    double busyCost;            // リレーの空きが無い
+    double failureCost;         // 続けた失敗 1 回当たり
+    double slowCost;            // ビットレートに全く届かなかった時
+    double headroomCost;        // 上りの残りが全く無い時
+
+    unsigned int bitrate;       // チャンネルのビットレート (kbps)。0 なら上りの残りは見ない
+
+private:
+    RelayStats& m_stats;
+};
+
+#endif
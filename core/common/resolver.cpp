@@ -0,0 +1,247 @@
+// ------------------------------------------------
+// File : resolver.cpp
+// Desc:
+//      getaddrinfo は TTL を返さないので、キャッシュの期限は固定にする。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "resolver.h"
+#include "sys.h"
+
+Resolver g_resolver;
+
+// 裏で引き直す仕事。プールはタスクが返った後に触れないので自分を消す。
+struct RefreshTask
+{
+    ThreadInfo thread;
+    std::function<void()> run;
+};
+
+static int refreshProc(ThreadInfo* thread)
+{
+    std::unique_ptr<RefreshTask> task(static_cast<RefreshTask*>(thread->data));
+    sys->setThreadName("RESOLVER");
+    task->run();
+    return 0;
+}
+
+// ------------------------------------
+Resolver::Resolver()
+    : m_pool(MAX_WORKERS)
+    , m_hits(0)
+    , m_misses(0)
+{
+    forwardLookup = [](const std::string& name)
+    {
+        std::vector<IP> addrs;
+        for (auto& s : sys->getIPAddresses(name))
+        {
+            IP ip;
+            if (IP::tryParse(s, ip))
+                addrs.push_back(ip);
+        }
+        return addrs;
+    };
+    reverseLookup = [](const IP& ip, std::string& out)
+    {
+        return sys->getHostnameByAddress(ip, out);
+    };
+}
+
+// ------------------------------------
+std::vector<IP> Resolver::resolve(const std::string& name)
+{
+    IP ip;
+    if (IP::tryParse(name, ip))
+        return { ip };
+
+    Entry e = lookup(m_forward, name,
+                     [this, name](Entry& entry) { fetchForward(name, entry); });
+    if (!e.error.empty())
+        throw GeneralException(e.error);
+    return e.addrs;
+}
+
+// ------------------------------------
+unsigned int Resolver::resolveIPv4(const std::string& name)
+{
+    try
+    {
+        for (auto& ip : resolve(name))
+            if (ip.isIPv4Mapped())
+                return ip.ipv4();
+    }catch (GeneralException& e)
+    {
+        LOG_DEBUG("resolve %s: %s", name.c_str(), e.what());
+    }
+    return 0;
+}
+
+// ------------------------------------
+bool Resolver::reverse(const IP& ip, std::string& out)
+{
+    Entry e = lookup(m_reverse, ip.str(),
+                     [this, ip](Entry& entry) { fetchReverse(ip, entry); });
+    out = e.found ? e.name : "";
+    return e.found;
+}
+
+// ------------------------------------
+void Resolver::fetchForward(const std::string& name, Entry& entry)
+{
+    try
+    {
+        entry.addrs = forwardLookup(name);
+        entry.found = !entry.addrs.empty();
+    }catch (GeneralException& e)
+    {
+        entry.error = e.what();
+        entry.found = false;
+    }
+}
+
+// ------------------------------------
+void Resolver::fetchReverse(const IP& ip, Entry& entry)
+{
+    entry.found = reverseLookup(ip, entry.name);
+}
+
+// ------------------------------------
+// 結果を表に入れて、待っているスレッドを起こす。m_lock を取って呼ぶ。
+void Resolver::store(Table& table, const std::string& key, Entry& entry)
+{
+    entry.expires = sys->getDTime() + (entry.found ? POSITIVE_TTL : NEGATIVE_TTL);
+    entry.resolving = false;
+
+    if (table.size() >= MAX_ENTRIES && !table.count(key))
+    {
+        const double now = sys->getDTime();
+        for (auto it = table.begin(); it != table.end(); )
+        {
+            if (!it->second.resolving && it->second.expires <= now)
+                it = table.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    table[key] = entry;
+    m_resolved.notify_all();
+}
+
+// ------------------------------------
+// 古い結果を裏で引き直す。ワーカーを起こせなければ false。m_lock を
+// 取って呼ぶ。
+bool Resolver::refreshInBackground(Table& table, const std::string& key, std::function<void(Entry&)> fetch)
+{
+    auto task = new RefreshTask();
+    task->thread.func = refreshProc;
+    task->thread.data = task;
+    task->run = [this, &table, key, fetch]()
+    {
+        Entry entry;
+        fetch(entry);
+        std::lock_guard<std::mutex> cs(m_lock);
+        store(table, key, entry);
+    };
+
+    if (!m_pool.submit(&task->thread))
+    {
+        delete task;
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------
+Resolver::Entry Resolver::lookup(Table& table, const std::string& key, std::function<void(Entry&)> fetch)
+{
+    std::unique_lock<std::mutex> cs(m_lock);
+
+    while (true)
+    {
+        auto it = table.find(key);
+        if (it == table.end())
+            break;
+
+        Entry& e = it->second;
+        if (e.expires > sys->getDTime())
+        {
+            m_hits++;
+            return e;
+        }
+
+        if (e.resolving)
+        {
+            // 引き直している間は古い結果を使う。初めて引いている
+            // 最中なら待つ。
+            if (e.expires > 0)
+            {
+                m_hits++;
+                return e;
+            }
+            m_resolved.wait(cs);
+            continue;
+        }
+
+        // 期限切れ。
+        e.resolving = true;
+        if (refreshInBackground(table, key, fetch))
+        {
+            m_hits++;
+            return e;
+        }
+        break;
+    }
+
+    // 初めて引く。同じ名前を引きに来たスレッドは待たせる。
+    m_misses++;
+    table[key].resolving = true;
+    cs.unlock();
+
+    Entry entry;
+    fetch(entry);
+
+    cs.lock();
+    store(table, key, entry);
+    return entry;
+}
+
+// ------------------------------------
+void Resolver::clear()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    for (auto* table : { &m_forward, &m_reverse })
+    {
+        for (auto it = table->begin(); it != table->end(); )
+        {
+            if (!it->second.resolving)
+                it = table->erase(it);
+            else
+                ++it;
+        }
+    }
+}
+
+// ------------------------------------
+amf0::Value Resolver::getState()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return amf0::Value::object(
+        {
+            {"numForward", m_forward.size()},
+            {"numReverse", m_reverse.size()},
+            {"hits", m_hits},
+            {"misses", m_misses},
+        });
+}
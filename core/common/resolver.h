@@ -0,0 +1,106 @@
+// ------------------------------------------------
+// File : resolver.h
+// Desc:
+//      名前解決のキャッシュ。正引きは sys->getIPAddresses、逆引きは
+//      sys->getHostnameByAddress で行い、結果を TTL の間覚えておく。
+//      見つからなかったことも短い間覚える。
+//
+//      一つのロックで全ての名前解決を直列にしないよう、引いている間は
+//      ロックを離す。同じ名前を同時に引こうとしたスレッドは、最初の結
+//      果を待って共有する。期限の切れた結果はそのまま返し、裏で引き直
+//      す。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _RESOLVER_H
+#define _RESOLVER_H
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ip.h"
+#include "threadpool.h"
+
+// ------------------------------------
+class Resolver
+{
+public:
+    enum
+    {
+        POSITIVE_TTL    = 300,  // 見つかった結果を覚えておく秒数
+        NEGATIVE_TTL    = 30,   // 見つからなかったことを覚えておく秒数
+        MAX_ENTRIES     = 1024, // これを超えたら期限切れのものを捨てる
+        MAX_WORKERS     = 2,    // 裏で引き直すスレッドの数
+    };
+
+    Resolver();
+
+    // name のアドレス。IP アドレスの文字列ならそのまま返す。名前解決
+    // がエラーになれば GeneralException。
+    std::vector<IP> resolve(const std::string& name);
+
+    // 最初の IPv4 アドレス。無ければ 0。
+    unsigned int    resolveIPv4(const std::string& name);
+
+    // ip のホスト名。見つからなければ false。
+    bool            reverse(const IP& ip, std::string& out);
+
+    void            clear();
+
+    amf0::Value     getState();
+
+    // 実際に名前を引く関数。テストで差し替える。エラーは例外で返す。
+    std::function<std::vector<IP>(const std::string&)> forwardLookup;
+    std::function<bool(const IP&, std::string&)>      reverseLookup;
+
+private:
+    struct Entry
+    {
+        Entry() : found(false), expires(0), resolving(false) {}
+
+        std::vector<IP> addrs;      // 正引きの結果
+        std::string     name;       // 逆引きの結果
+        std::string     error;      // 正引きのエラー
+        bool            found;
+        double          expires;
+        bool            resolving;  // 誰かが引いている
+    };
+
+    typedef std::map<std::string, Entry> Table;
+
+    // key を table から探し、無いか古ければ fetch で引く。
+    Entry   lookup(Table& table, const std::string& key, std::function<void(Entry&)> fetch);
+    void    store(Table& table, const std::string& key, Entry& entry);
+    bool    refreshInBackground(Table& table, const std::string& key, std::function<void(Entry&)> fetch);
+    void    fetchForward(const std::string& name, Entry& entry);
+    void    fetchReverse(const IP& ip, Entry& entry);
+
+    std::mutex              m_lock;
+    std::condition_variable m_resolved;
+    Table                   m_forward;
+    Table                   m_reverse;
+
+    ThreadPool              m_pool;
+
+    // getState 用
+    unsigned int            m_hits;
+    unsigned int            m_misses;
+};
+
+extern Resolver g_resolver;
+
+#endif
@@ -0,0 +1,744 @@
+// ------------------------------------------------
+// File : rtmpingest.cpp
+// Desc:
+//      チャンクの読み方は rtmp-server/session.h と同じ。拡張タイムスタ
+//      ンプには対応しない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <string.h>
+
+#include "rtmpingest.h"
+#include "sstream.h"
+#include "channel.h"
+#include "sys.h"
+#include "socket.h"
+
+using amf0::Value;
+
+// ------------------------------------------
+static int getBigEndian(const std::string& bytes)
+{
+    int res = 0;
+    for (auto b : bytes)
+        res = res * 0x100 + (uint8_t) b;
+    return res;
+}
+
+// ------------------------------------------
+static std::string toBigEndian(int value, int nbytes)
+{
+    std::string res(nbytes, '\0');
+    for (int i = nbytes - 1; i >= 0; i--)
+    {
+        res[i] = value & 0xff;
+        value >>= 8;
+    }
+    return res;
+}
+
+// ------------------------------------------
+static std::string toLittleEndian(int value, int nbytes)
+{
+    std::string res(nbytes, '\0');
+    for (int i = 0; i < nbytes; i++)
+    {
+        res[i] = value & 0xff;
+        value >>= 8;
+    }
+    return res;
+}
+
+// ------------------------------------------
+static std::string basicHeader(int fmt, int csID)
+{
+    return std::string(1, (char) ((fmt << 6) | csID));
+}
+
+// ------------------------------------------
+std::string RTMPSession::Message::toChunks(int chunkSize, int csID) const
+{
+    std::string res;
+
+    res += basicHeader(0, csID);
+    res += toBigEndian(timestamp, 3);
+    res += toBigEndian(data.size(), 3);
+    res += (char) type;
+    res += toLittleEndian(streamID, 4);
+
+    for (size_t pos = 0; pos < data.size(); pos += chunkSize)
+    {
+        if (pos > 0)
+            res += basicHeader(3, csID);
+        res += data.substr(pos, chunkSize);
+    }
+    return res;
+}
+
+// ------------------------------------------
+RTMPSession::RTMPSession(Stream& io, Listener* listener)
+    : m_io(io)
+    , m_listener(listener)
+    , m_readBuffer(READ_BUFFER_SIZE)
+    , m_readPos(0)
+    , m_readEnd(0)
+    , m_incomingChunkSize(DEFAULT_CHUNK_SIZE)
+    , m_outgoingChunkSize(DEFAULT_CHUNK_SIZE)
+    , m_publishing(false)
+    , m_playing(false)
+    , m_closed(false)
+    , m_pendingTransaction(0)
+    , m_resultError(false)
+    , m_windowAckSize(0)
+    , m_bytesReceived(0)
+    , m_lastAck(0)
+{
+}
+
+// ------------------------------------------
+void RTMPSession::fill(size_t n)
+{
+    // 残りを先頭に詰めてから、空いている所へ読めるだけ読む。
+    if (m_readPos > 0)
+    {
+        memmove(m_readBuffer.data(), m_readBuffer.data() + m_readPos, m_readEnd - m_readPos);
+        m_readEnd -= m_readPos;
+        m_readPos = 0;
+    }
+    if (m_readBuffer.size() < n)
+        m_readBuffer.resize(n);
+
+    while (m_readEnd < n)
+    {
+        int r = m_io.readSome(m_readBuffer.data() + m_readEnd, m_readBuffer.size() - m_readEnd);
+        m_readEnd += r;
+        m_bytesReceived += r;
+    }
+}
+
+// ------------------------------------------
+// チャンクのペイロード len バイトを data に足す。バッファーに入りきら
+// ない大きさなら、溜まっている分の残りは data に直接読む。
+void RTMPSession::readPayload(std::string& data, int len)
+{
+    if (len <= READ_BUFFER_SIZE / 2)
+    {
+        const uint8_t* p = take(len);
+        data.append(reinterpret_cast<const char*>(p), len);
+        return;
+    }
+
+    size_t avail = std::min<size_t>(len, m_readEnd - m_readPos);
+    data.append(reinterpret_cast<const char*>(m_readBuffer.data() + m_readPos), avail);
+    m_readPos += avail;
+
+    size_t pos = data.size();
+    data.resize(pos + (len - avail));
+    while (pos < data.size())
+    {
+        int r = m_io.readSome(&data[pos], data.size() - pos);
+        pos += r;
+        m_bytesReceived += r;
+    }
+}
+
+// ------------------------------------------
+void RTMPSession::handshake()
+{
+    // C0
+    uint8_t c0 = *take(1);
+    if (c0 != 3 && c0 >= 32)
+        throw StreamException("RTMP: invalid C0");
+
+    // S0 + S1。乱数部は毎回同じでよい。
+    std::string s1 = toBigEndian(0, 4) + toBigEndian(0x0d0e0a0d, 4);
+    for (int i = 0; i < 1528; i++)
+        s1 += (char) (i * 7);
+    m_io.writeChar(3);
+    m_io.writeString(s1);
+
+    // C1 を受けて S2 で返す。
+    const uint8_t* c1 = take(1536);
+    std::string s2(reinterpret_cast<const char*>(c1), 1536);
+    memset(&s2[4], 0, 4);
+    m_io.writeString(s2);
+
+    // C2 は読み捨てる。
+    take(1536);
+}
+
+// ------------------------------------------
+void RTMPSession::clientHandshake()
+{
+    // C0 + C1
+    std::string c1 = toBigEndian(0, 4) + toBigEndian(0, 4);
+    for (int i = 0; i < 1528; i++)
+        c1 += (char) (i * 11);
+    m_io.writeChar(3);
+    m_io.writeString(c1);
+
+    // S0
+    if (*take(1) != 3)
+        throw StreamException("RTMP: invalid S0");
+
+    // S1 を受けて C2 で返す。
+    std::string c2(reinterpret_cast<const char*>(take(1536)), 1536);
+    m_io.writeString(c2);
+
+    // S2 は読み捨てる。
+    take(1536);
+}
+
+// ------------------------------------------
+bool RTMPSession::splitURL(const std::string& path, std::string& host, std::string& app, std::string& streamName)
+{
+    size_t slash1 = path.find('/');
+    if (slash1 == std::string::npos || slash1 == 0)
+        return false;
+    size_t slash2 = path.find('/', slash1 + 1);
+    if (slash2 == std::string::npos || slash2 == slash1 + 1 || slash2 + 1 == path.size())
+        return false;
+
+    host       = path.substr(0, slash1);
+    app        = path.substr(slash1 + 1, slash2 - slash1 - 1);
+    streamName = path.substr(slash2 + 1);
+    return true;
+}
+
+// ------------------------------------------
+std::vector<Value> RTMPSession::call(const std::vector<Value>& values, int streamID)
+{
+    const std::string name = values[0].string();
+    m_pendingTransaction = (int) values[1].number();
+    sendCommand(values, streamID, 3);
+
+    while (m_pendingTransaction && !m_closed)
+        readChunk();
+    if (m_closed)
+        throw StreamException("RTMP: closed while waiting for " + name);
+    if (m_resultError)
+        throw StreamException("RTMP: " + name + " failed");
+    return m_result;
+}
+
+// ------------------------------------------
+void RTMPSession::play(const std::string& app, const std::string& tcUrl, const std::string& streamName)
+{
+    m_streamName = streamName;
+
+    call({
+            Value("connect"),
+            Value(1),
+            Value::object(
+                {
+                    {"app", app},
+                    {"flashVer", "LNX 9,0,124,2"},
+                    {"tcUrl", tcUrl},
+                    {"fpad", false},
+                    {"capabilities", 15},
+                    {"audioCodecs", 0x0fff},
+                    {"videoCodecs", 0x00ff},
+                    {"videoFunction", 1},
+                    {"objectEncoding", 0}
+                }),
+        }, 0);
+
+    auto result = call({ Value("createStream"), Value(2), Value(nullptr) }, 0);
+    if (result.size() < 2 || !result[1].isNumber())
+        throw StreamException("RTMP: bad createStream result");
+    int streamID = (int) result[1].number();
+
+    LOG_INFO("RTMP: play %s/%s", app.c_str(), streamName.c_str());
+    sendCommand({ Value("play"), Value(0), Value(nullptr), Value(streamName), Value(-2) }, streamID, 8);
+
+    while (!m_playing && !m_closed)
+        readChunk();
+    if (m_closed)
+        throw StreamException("RTMP: stream closed before play started");
+}
+
+static inline int get24(const uint8_t* p)
+{
+    return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+// ------------------------------------------
+// 基本ヘッダーを読んでチャンクストリーム ID を返す。
+int RTMPSession::readBasicHeader(int& fmt)
+{
+    uint8_t b = *take(1);
+    fmt = b >> 6;
+
+    int csID = b & 0x3f;
+    if (csID == 0)
+        csID = 64 + *take(1);
+    else if (csID == 1)
+    {
+        const uint8_t* p = take(2);
+        csID = 64 + p[0] + p[1] * 256;
+    }
+    return csID;
+}
+
+// ------------------------------------------
+void RTMPSession::readChunk()
+{
+    int fmt;
+    int csID = readBasicHeader(fmt);
+
+    auto it = m_chunkStreams.find(csID);
+    if (it == m_chunkStreams.end())
+    {
+        if (fmt != 0)
+            throw StreamException("RTMP: chunk stream not started");
+        it = m_chunkStreams.emplace(csID, Message()).first;
+    }
+    Message& message = it->second;
+
+    switch (fmt)
+    {
+    case 0:
+        {
+            const uint8_t* p = take(11);
+            int timestamp = get24(p);
+            int length    = get24(p + 3);
+            int type      = p[6];
+            int streamID  = p[7] | (p[8] << 8) | (p[9] << 16) | (p[10] << 24);
+            if (timestamp == 0xffffff)
+                throw StreamException("RTMP: extended timestamp not implemented");
+            message.start(timestamp, 0, length, type, streamID);
+        }
+        break;
+    case 1:
+        {
+            const uint8_t* p = take(7);
+            int delta  = get24(p);
+            int length = get24(p + 3);
+            int type   = p[6];
+            if (delta == 0xffffff)
+                throw StreamException("RTMP: extended timestamp not implemented");
+            message.start(message.timestamp + delta, delta, length, type, message.streamID);
+        }
+        break;
+    case 2:
+        {
+            int delta = get24(take(3));
+            if (delta == 0xffffff)
+                throw StreamException("RTMP: extended timestamp not implemented");
+            message.start(message.timestamp + delta, delta, message.length, message.type, message.streamID);
+        }
+        break;
+    case 3:
+        // 前のメッセージが完成していれば、同じヘッダーで次のメッセー
+        // ジが始まる。
+        if (message.remaining() == 0)
+            message.start(message.timestamp + message.delta, message.delta, message.length, message.type, message.streamID);
+        break;
+    }
+
+    readPayload(message.data, std::min(message.remaining(), m_incomingChunkSize));
+
+    if (message.remaining() == 0)
+        onMessage(message);
+
+    if (m_windowAckSize && m_bytesReceived - m_lastAck >= m_windowAckSize)
+        acknowledge();
+}
+
+// ------------------------------------------
+void RTMPSession::acknowledge()
+{
+    Message ack(0, 0, 4, MT_ACK, 0);
+    ack.data = toBigEndian(m_bytesReceived, 4);
+    sendMessage(ack, 2);
+    m_lastAck = m_bytesReceived;
+}
+
+// ------------------------------------------
+void RTMPSession::readUntilPublish()
+{
+    while (!m_publishing && !m_closed)
+        readChunk();
+}
+
+// ------------------------------------------
+void RTMPSession::onMessage(Message& message)
+{
+    switch (message.type)
+    {
+    case MT_SET_CHUNK_SIZE:
+        {
+            if (message.data.size() < 4)
+                throw StreamException("RTMP: bad Set Chunk Size");
+            int size = getBigEndian(message.data.substr(0, 4)) & MAX_CHUNK_SIZE;
+            if (size == 0)
+                throw StreamException("RTMP: bad Set Chunk Size");
+            LOG_DEBUG("RTMP: incoming chunk size is now %d (was %d)", size, m_incomingChunkSize);
+            m_incomingChunkSize = size;
+        }
+        break;
+    case MT_COMMAND_AMF0:
+        onCommand(message);
+        break;
+    case MT_DATA_AMF0:
+        onData(message);
+        break;
+    case MT_AUDIO:
+        if (m_listener)
+            m_listener->onAudio(message.timestamp, message.data);
+        break;
+    case MT_VIDEO:
+        if (m_listener)
+            m_listener->onVideo(message.timestamp, message.data);
+        break;
+    case MT_WINDOW_ACK_SIZE:
+        if (message.data.size() >= 4)
+            m_windowAckSize = getBigEndian(message.data.substr(0, 4));
+        break;
+    case MT_USER_CONTROL:
+        onUserControl(message);
+        break;
+    case MT_ACK:
+        break;
+    default:
+        LOG_DEBUG("RTMP: ignoring message type %d", message.type);
+    }
+}
+
+// ------------------------------------------
+void RTMPSession::onUserControl(Message& message)
+{
+    enum { PING_REQUEST = 6, PING_RESPONSE = 7 };
+
+    if (message.data.size() < 2)
+        throw StreamException("RTMP: bad User Control message");
+
+    int event = getBigEndian(message.data.substr(0, 2));
+    if (event == PING_REQUEST)
+    {
+        Message pong(0, 0, message.data.size(), MT_USER_CONTROL, 0);
+        pong.data = toBigEndian(PING_RESPONSE, 2) + message.data.substr(2);
+        sendMessage(pong, 2);
+    }
+}
+
+// ------------------------------------------
+void RTMPSession::sendMessage(const Message& message, int csID)
+{
+    m_io.writeString(message.toChunks(m_outgoingChunkSize, csID));
+}
+
+// ------------------------------------------
+void RTMPSession::sendCommand(const std::vector<Value>& values, int streamID, int csID)
+{
+    std::string data;
+    for (auto& v : values)
+        data += v.serialize();
+
+    Message message(0, 0, data.size(), MT_COMMAND_AMF0, streamID);
+    message.data = data;
+    sendMessage(message, csID);
+}
+
+// ------------------------------------------
+void RTMPSession::onCommand(Message& message)
+{
+    Value command, transactionID;
+    std::vector<Value> params;
+    try
+    {
+        StringStream mem(message.data);
+        amf0::Deserializer d;
+        command = d.readValue(mem);
+        transactionID = d.readValue(mem);
+        while (!mem.eof())
+            params.push_back(d.readValue(mem));
+    }catch (std::runtime_error& e)
+    {
+        throw StreamException(std::string("RTMP: bad command: ") + e.what());
+    }
+
+    const std::string name = command.isString() ? command.string() : "";
+    LOG_DEBUG("RTMP: command %s", name.c_str());
+
+    if (name == "connect")
+    {
+        Message bw(0, 0, 4, MT_WINDOW_ACK_SIZE, 0);
+        bw.data = toBigEndian(5000 * 1000, 4);
+        sendMessage(bw, 2);
+
+        Message peer(0, 0, 5, MT_SET_PEER_BANDWIDTH, 0);
+        peer.data = toBigEndian(5000 * 1000, 4) + "\x01"; // Soft
+        sendMessage(peer, 2);
+
+        Message chunkSize(0, 0, 4, MT_SET_CHUNK_SIZE, 0);
+        chunkSize.data = toBigEndian(OUTGOING_CHUNK_SIZE, 4);
+        sendMessage(chunkSize, 2);
+        m_outgoingChunkSize = OUTGOING_CHUNK_SIZE;
+
+        sendCommand({
+                Value("_result"),
+                transactionID,
+                Value::object({ {"fmsVer", "FMS/3,0,1,123"}, {"capabilities", 31} }),
+                Value::object(
+                    {
+                        {"level", "status"},
+                        {"code", "NetConnection.Connect.Success"},
+                        {"description", "Connection succeeded."},
+                        {"objectEncoding", 0}
+                    }),
+            }, 0, 3);
+    }else if (name == "FCPublish")
+    {
+        sendCommand({ Value("_result"), transactionID, params.size() > 1 ? params[1] : Value(nullptr) }, 0, 3);
+    }else if (name == "createStream")
+    {
+        sendCommand({ Value("_result"), transactionID, Value(nullptr), Value(1) }, 0, 3);
+    }else if (name == "publish")
+    {
+        if (params.size() > 1 && params[1].isString())
+            m_streamName = params[1].string();
+        LOG_INFO("RTMP: publish %s", m_streamName.c_str());
+        m_publishing = true;
+
+        sendCommand({
+                Value("onStatus"),
+                Value(0),
+                Value(nullptr),
+                Value::object(
+                    {
+                        {"level", "status"},
+                        {"code", "NetStream.Publish.Start"},
+                        {"description", "Start publishing"}
+                    }),
+            }, 1, 8);
+    }else if (name == "deleteStream" || name == "FCUnpublish")
+    {
+        m_closed = true;
+    }else if (name == "_result" || name == "_error")
+    {
+        if (m_pendingTransaction && transactionID.isNumber() &&
+            (int) transactionID.number() == m_pendingTransaction)
+        {
+            m_pendingTransaction = 0;
+            m_resultError = (name == "_error");
+            m_result = params;
+        }
+    }else if (name == "onStatus")
+    {
+        if (params.size() > 1 && params[1].isObject())
+            onStatus(params[1]);
+    }else
+    {
+        LOG_DEBUG("RTMP: ignoring command %s", name.c_str());
+    }
+}
+
+// ------------------------------------------
+// play した時にサーバーから来る NetStream の状態。
+void RTMPSession::onStatus(const Value& info)
+{
+    auto& obj = info.object();
+    std::string code  = (obj.count("code") && obj.at("code").isString()) ? obj.at("code").string() : "";
+    std::string level = (obj.count("level") && obj.at("level").isString()) ? obj.at("level").string() : "";
+    LOG_DEBUG("RTMP: onStatus %s", code.c_str());
+
+    if (level == "error")
+        throw StreamException("RTMP: " + code);
+
+    if (code == "NetStream.Play.Start")
+        m_playing = true;
+    else if (code == "NetStream.Play.Stop" ||
+             code == "NetStream.Play.UnpublishNotify" ||
+             code == "NetStream.Play.Complete")
+        m_closed = true;
+}
+
+// ------------------------------------------
+void RTMPSession::onData(Message& message)
+{
+    // "@setDataFrame", "onMetaData", { ... } か、先頭の
+    // "@setDataFrame" の無いもの。
+    try
+    {
+        StringStream mem(message.data);
+        amf0::Deserializer d;
+
+        Value first = d.readValue(mem);
+        int pos = 0;
+        if (first.isString() && first.string() == "@setDataFrame")
+        {
+            pos = mem.getPosition();
+            first = d.readValue(mem);
+        }
+        if (!first.isString() || first.string() != "onMetaData")
+        {
+            LOG_DEBUG("RTMP: ignoring data message %s", first.inspect().c_str());
+            return;
+        }
+
+        Value meta = d.readValue(mem);
+        bool hasAudio = meta.object().count("audiocodecid") > 0;
+        bool hasVideo = meta.object().count("videocodecid") > 0;
+        if (m_listener)
+            m_listener->onMetaData(message.timestamp, message.data.substr(pos), hasAudio, hasVideo);
+    }catch (std::runtime_error& e)
+    {
+        LOG_ERROR("RTMP: bad metadata: %s", e.what());
+    }
+}
+
+// ------------------------------------------
+void RTMPStream::readHeader(Stream &in, std::shared_ptr<Channel> ch)
+{
+    if (!m_resuming)
+        metaBitrate = 0;
+    m_waitKeyFrame = true;
+    if (m_session)
+        m_session->setListener(this);
+    else
+    {
+        m_session = std::make_shared<RTMPSession>(in, this);
+        m_session->handshake();
+    }
+    m_buffer.startTime = sys->getDTime();
+}
+
+// ------------------------------------------
+int RTMPStream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
+{
+    m_in = &in;
+    m_ch = ch;
+    m_sent = false;
+
+    // パケットを送り出すか、読めるデータが無くなるまでチャンクを読む。
+    // バッファーに溜まっている分はソケットに関係なく読める。
+    do
+    {
+        m_session->readChunk();
+    } while (!m_sent && !m_session->isClosed() &&
+             (m_session->hasBufferedInput() || in.readReady()));
+
+    m_in = nullptr;
+    m_ch = nullptr;
+
+    if (m_session->isClosed())
+    {
+        LOG_INFO("RTMP: stream closed by peer");
+        return 1;
+    }
+    return 0;
+}
+
+// ------------------------------------------
+void RTMPStream::readEnd(Stream &, std::shared_ptr<Channel>)
+{
+    if (m_session)
+        m_session->setListener(nullptr);
+}
+
+// ------------------------------------------
+void RTMPStream::putTag(FLVTag::TYPE type, int32_t timestamp, const std::string& data)
+{
+    // メタデータを送らないエンコーダーもあるので、その時は音声と映像
+    // があることにする。
+    if (fileHeader.size == 0)
+        fileHeader.set(true, true);
+
+    m_tag.set(type, timestamp, data.data(), data.size());
+    if (FLVStream::putTag(m_tag, *m_in, m_ch))
+        m_sent = true;
+}
+
+// ------------------------------------------
+void RTMPStream::onMetaData(int32_t timestamp, const std::string& data, bool hasAudio, bool hasVideo)
+{
+    if (fileHeader.size == 0)
+        fileHeader.set(hasAudio, hasVideo);
+    putTag(FLVTag::T_SCRIPT, timestamp, data);
+}
+
+// ------------------------------------------
+void RTMPStream::onAudio(int32_t timestamp, const std::string& data)
+{
+    putTag(FLVTag::T_AUDIO, timestamp, data);
+}
+
+// ------------------------------------------
+void RTMPStream::onVideo(int32_t timestamp, const std::string& data)
+{
+    if (m_waitKeyFrame)
+    {
+        // シーケンスヘッダーもキーフレームの印が付いているので、これは
+        // 通すが待つのはやめない。
+        auto p = reinterpret_cast<const unsigned char*>(data.data());
+        if (!FLVTag::isVideoKeyFrame(p, data.size()))
+            return;
+        if (!FLVTag::isVideoSequenceHeader(p, data.size()))
+            m_waitKeyFrame = false;
+    }
+    putTag(FLVTag::T_VIDEO, timestamp, data);
+}
+
+// ------------------------------------------
+void RTMPSource::stream(std::shared_ptr<Channel> ch)
+{
+    try
+    {
+        if (!ch->sock)
+            throw StreamException("RTMP channel has no socket");
+        m_sock = ch->sock;
+
+        ch->resetPlayTime();
+
+        ch->setStatus(Channel::S_BROADCASTING);
+
+        auto source = std::make_shared<RTMPStream>(m_session);
+        // 予備に切り替えたのなら、前のソースのヘッダーを引き継ぐ。
+        if (ch->lastSourceStream && source->continueFrom(*ch->lastSourceStream))
+            LOG_INFO("Continuing the stream from the previous source");
+        ch->lastSourceStream = source;
+
+        ch->readStream(*ch->sock, source);
+    }catch (StreamException &e)
+    {
+        LOG_ERROR("Channel aborted: %s", e.msg);
+    }
+
+    ch->setStatus(Channel::S_CLOSING);
+
+    if (ch->sock)
+    {
+        m_sock = nullptr;
+        ch->sock->close();
+        ch->sock = nullptr;
+    }
+}
+
+// ------------------------------------------
+int RTMPSource::getSourceRate()
+{
+    if (m_sock != nullptr)
+        return m_sock->bytesInPerSec();
+    else
+        return 0;
+}
+
+// ------------------------------------------
+int RTMPSource::getSourceRateAvg()
+{
+    if (m_sock != nullptr)
+        return m_sock->stat.bytesInPerSecAvg();
+    else
+        return 0;
+}
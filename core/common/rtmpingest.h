@@ -0,0 +1,262 @@
+// ------------------------------------------------
+// File : rtmpingest.h
+// Desc:
+//      RTMP の受け口。エンコーダーからの publish を受け付けて、音声・映
+//      像・メタデータのメッセージを取り出す。rtmp:// の URL をソースにし
+//      たチャンネルでは、同じセッションでクライアントとして play する。
+//
+//      以前は rtmp-server を別プロセスで起動し、FLV に組み直したもの
+//      を HTTP Push で受け取っていた。RTMPStream はメッセージを直接
+//      FLVTag にして FLVStream に渡すので、HTTP を経由せず、FLV の書き
+//      出しと読み直しもしない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _RTMPINGEST_H
+#define _RTMPINGEST_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "flv.h"
+#include "amf0.h"
+
+class Stream;
+
+// ----------------------------------------------
+// RTMP のチャンクストリームを読み、publish に必要な分だけコマンドに応
+// 答する。読み書きは io に対して行う。
+//
+// RTMPServerMonitor は publish までをプールのワーカーで済ませ、ストリー
+// ム名からチャンネルを決めてから、セッションをチャンネルのスレッドに
+// 引き渡す。
+//
+// 既定のチャンクは 128 バイトと小さいので、ソケットからは readSome で
+// 届いている分をまとめて読み込みバッファーに溜め、ヘッダーはそこから
+// 切り出す。メッセージのバッファーはチャンクストリームごとに使い回す。
+class RTMPSession
+{
+public:
+    enum
+    {
+        MAX_CHUNK_SIZE      = 0x7fffffff,
+        DEFAULT_CHUNK_SIZE  = 128,
+        OUTGOING_CHUNK_SIZE = 4096,
+        READ_BUFFER_SIZE    = 64 * 1024,
+    };
+
+    enum MessageType
+    {
+        MT_SET_CHUNK_SIZE    = 0x01,
+        MT_ACK               = 0x03,
+        MT_USER_CONTROL      = 0x04,
+        MT_WINDOW_ACK_SIZE   = 0x05,
+        MT_SET_PEER_BANDWIDTH = 0x06,
+        MT_AUDIO             = 0x08,
+        MT_VIDEO             = 0x09,
+        MT_DATA_AMF0         = 0x12,
+        MT_COMMAND_AMF0      = 0x14,
+    };
+
+    // 取り出したメッセージの受け取り手。
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+
+        // data は onMetaData から始まるスクリプトタグのペイロード。
+        virtual void onMetaData(int32_t timestamp, const std::string& data, bool hasAudio, bool hasVideo) = 0;
+        virtual void onAudio(int32_t timestamp, const std::string& data) = 0;
+        virtual void onVideo(int32_t timestamp, const std::string& data) = 0;
+    };
+
+    struct Message
+    {
+        Message()
+            : timestamp(0), delta(0), length(0), type(0), streamID(0) {}
+        Message(int32_t aTimestamp, int32_t aDelta, int aLength, int aType, int aStreamID)
+            : timestamp(aTimestamp), delta(aDelta), length(aLength), type(aType), streamID(aStreamID) {}
+
+        // 完成するまでに要るバイト数。
+        int remaining() const { return length - (int) data.size(); }
+
+        // 次のメッセージを始める。data の領域は取っておく。
+        void start(int32_t aTimestamp, int32_t aDelta, int aLength, int aType, int aStreamID)
+        {
+            timestamp = aTimestamp;
+            delta     = aDelta;
+            length    = aLength;
+            type      = aType;
+            streamID  = aStreamID;
+            data.clear();
+            data.reserve(length);
+        }
+
+        // io に書き出すチャンク列。
+        std::string toChunks(int chunkSize, int csID) const;
+
+        int32_t     timestamp;
+        int32_t     delta;
+        int         length;
+        int         type;
+        int         streamID;
+        std::string data;
+    };
+
+    RTMPSession(Stream& io, Listener* listener = nullptr);
+
+    // 音声・映像・メタデータの受け取り手。居なければ捨てる。
+    void    setListener(Listener* listener) { m_listener = listener; }
+
+    // C0 から C2 までを読み、S0 から S2 を返す。
+    void    handshake();
+
+    // チャンクを一つ読む。メッセージが完成したら処理する。
+    void    readChunk();
+
+    // publish を受け取るか、配信が終わるまでチャンクを読む。
+    void    readUntilPublish();
+
+    // クライアントとして C0 から C2 を送り、S0 から S2 を読む。
+    void    clientHandshake();
+
+    // connect, createStream, play を順に送り、NetStream.Play.Start
+    // を受け取るまで読む。失敗すれば StreamException。
+    void    play(const std::string& app, const std::string& tcUrl, const std::string& streamName);
+
+    // "host[:port]/app/stream" を分ける。stream には / を含んでよい。
+    static bool splitURL(const std::string& path, std::string& host, std::string& app, std::string& streamName);
+
+    bool    isPlaying() const { return m_playing; }
+
+    bool    isPublishing() const { return m_publishing; }
+
+    // エンコーダーが deleteStream などで配信を終えた。
+    bool    isClosed() const { return m_closed; }
+
+    // publish か play で指定されたストリーム名。
+    const std::string& streamName() const { return m_streamName; }
+
+    // 読み込みバッファーにまだ処理していないデータがある。
+    bool    hasBufferedInput() const { return m_readEnd > m_readPos; }
+
+private:
+    // 読み込みバッファーに n バイト以上を溜める。
+    void    fill(size_t n);
+    // n バイトを切り出す。ポインターは次に読むまで有効。
+    const uint8_t* take(size_t n)
+    {
+        if (m_readEnd - m_readPos < n)
+            fill(n);
+        const uint8_t* p = m_readBuffer.data() + m_readPos;
+        m_readPos += n;
+        return p;
+    }
+    void    readPayload(std::string& data, int len);
+
+    int     readBasicHeader(int& fmt);
+    void    onMessage(Message& message);
+    void    onCommand(Message& message);
+    void    onData(Message& message);
+    void    sendMessage(const Message& message, int csID);
+    void    sendCommand(const std::vector<amf0::Value>& values, int streamID, int csID);
+    // 命令を送って _result か _error を待つ。結果の引数を返す。
+    std::vector<amf0::Value> call(const std::vector<amf0::Value>& values, int streamID);
+    void    onUserControl(Message& message);
+    void    onStatus(const amf0::Value& info);
+    void    acknowledge();
+
+    Stream&     m_io;
+    Listener*   m_listener;
+
+    std::vector<uint8_t> m_readBuffer;
+    size_t      m_readPos;
+    size_t      m_readEnd;
+
+    // チャンクストリーム ID ごとの最後のメッセージ。
+    std::map<int,Message> m_chunkStreams;
+
+    int         m_incomingChunkSize;
+    int         m_outgoingChunkSize;
+    bool        m_publishing;
+    bool        m_playing;
+    bool        m_closed;
+    std::string m_streamName;
+
+    // 応答を待っている命令のトランザクション ID と、その結果。
+    int         m_pendingTransaction;
+    bool        m_resultError;
+    std::vector<amf0::Value> m_result;
+
+    // 相手から Window Acknowledgement Size を受けたら、その分を読む
+    // ごとに Acknowledgement を返す。
+    uint32_t    m_windowAckSize;
+    uint32_t    m_bytesReceived;
+    uint32_t    m_lastAck;
+};
+
+// ----------------------------------------------
+// RTMP で受け取る FLV チャンネル。session を渡さなければ readHeader
+// でハンドシェイクから始める。
+//
+// 受け始めや再接続の後は、最初のキーフレームより前の映像を捨てる。
+class RTMPStream : public FLVStream, public RTMPSession::Listener
+{
+public:
+    RTMPStream(std::shared_ptr<RTMPSession> session = nullptr)
+        : m_session(session), m_in(nullptr), m_sent(false), m_waitKeyFrame(true) {}
+
+    void readHeader(Stream &, std::shared_ptr<Channel>) override;
+    int  readPacket(Stream &, std::shared_ptr<Channel>) override;
+    void readEnd(Stream &, std::shared_ptr<Channel>) override;
+
+    void onMetaData(int32_t timestamp, const std::string& data, bool hasAudio, bool hasVideo) override;
+    void onAudio(int32_t timestamp, const std::string& data) override;
+    void onVideo(int32_t timestamp, const std::string& data) override;
+
+private:
+    void    putTag(FLVTag::TYPE type, int32_t timestamp, const std::string& data);
+
+    std::shared_ptr<RTMPSession> m_session;
+
+    // readPacket の間だけ有効。
+    Stream*                  m_in;
+    std::shared_ptr<Channel> m_ch;
+    bool                     m_sent;
+
+    bool   m_waitKeyFrame;
+    FLVTag m_tag;
+};
+
+// ----------------------------------------------
+// Channel::startRTMP のソース。publish まで済んだセッションを
+// RTMPStream で読む。
+class RTMPSource : public ChannelSource
+{
+public:
+    RTMPSource(std::shared_ptr<RTMPSession> session)
+        : m_session(session)
+    {
+    }
+
+    void stream(std::shared_ptr<Channel>) override;
+    int getSourceRate() override;
+    int getSourceRateAvg() override;
+
+    std::shared_ptr<RTMPSession>  m_session;
+    std::shared_ptr<ClientSocket> m_sock;
+};
+
+#endif
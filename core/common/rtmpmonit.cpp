@@ -1,16 +1,34 @@
 #include "rtmpmonit.h"
 #include "servmgr.h"
+#include "chanmgr.h"
+#include "servent.h"
+#include "socket.h"
+#include "rtmpingest.h"
+#include "cgi.h"
+#include "str.h"
+#include "changroup.h"
+#include "prefork.h"
+#include "shmring.h"
+
+// publish 待ちの接続。プールのタスクとして自分を消す。
+struct RTMPConnection
+{
+    ThreadInfo thread;
+    RTMPServerMonitor* monitor;
+    std::shared_ptr<ClientSocket> sock;
+};
 
 RTMPServerMonitor::RTMPServerMonitor(const std::string& aPath)
     : m_rtmpServer(aPath, false, false)
     , ipVersion(4)
     , m_enabled(false)
+    , m_external(false)
 {
 }
 
 std::string RTMPServerMonitor::status()
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
     if (m_enabled)
         return "UP";
     else
@@ -19,16 +37,19 @@ std::string RTMPServerMonitor::status()
 
 bool RTMPServerMonitor::isEnabled()
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
     return m_enabled;
 }
 
 void RTMPServerMonitor::update()
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
 
     if (!m_enabled) return;
 
+    // 組み込みのサーバーは enable で起動している。
+    if (!m_external) return;
+
     // RTMP server の死活を監視する。
     if (!m_rtmpServer.isAlive())
     {
@@ -39,26 +60,37 @@ void RTMPServerMonitor::update()
 
 void RTMPServerMonitor::enable()
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
-    m_enabled = true;
+    std::lock_guard<ProfiledMutex> cs(m_lock);
+
+    if (m_enabled) return;
+
+    m_external = servMgr->flags[ServMgr::F_externalRTMPServer];
+    if (m_external)
+        m_enabled = true;   // update で起動する。
+    else
+        m_enabled = startListener();
 }
 
 void RTMPServerMonitor::disable()
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
     m_enabled = false;
     if (m_rtmpServer.isAlive())
         m_rtmpServer.terminate();
+    stopListener();
+    stopShm();
 }
 
 amf0::Value RTMPServerMonitor::getState()
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
     return amf0::Value(
         {
             {"status", status()},
-            {"processID", std::to_string( m_rtmpServer.pid() )},
+            {"processID", std::to_string( m_external ? m_rtmpServer.pid() : -1 )},
             {"ipVersion", std::to_string(ipVersion)},
+            {"external", m_external},
+            {"sharedMemory", m_ring != nullptr},
         });
 }
 
@@ -70,16 +102,131 @@ void RTMPServerMonitor::start()
 
     uint16_t port;
     {
-        std::lock_guard<std::recursive_mutex> cs(servMgr->lock);
+        std::lock_guard<ProfiledMutex> cs(servMgr->lock);
         port = servMgr->rtmpPort;
     }
 
-    m_rtmpServer.start({"-p", std::to_string(port), makeEndpointURL()}, env);
+    // 共有メモリーが使えなければ HTTP Push で受け取る。
+    std::string url;
+    if (servMgr->flags[ServMgr::F_rtmpSharedMemory] && startShm())
+        url = "shm:" + m_ring->name();
+    else
+        url = makeEndpointURL();
+
+    m_rtmpServer.start({"-p", std::to_string(port), url}, env);
+}
+
+// rtmp-server が書く共有メモリーのリングを作り、見張るスレッドを始め
+// る。再起動した rtmp-server にも同じリングを渡す。
+bool RTMPServerMonitor::startShm()
+{
+    if (m_ring)
+        return true;
+
+    std::string name;
+    {
+        std::lock_guard<ProfiledMutex> cs(servMgr->lock);
+        name = "/peercast-rtmp-" + std::to_string(servMgr->serverHost.port);
+    }
+
+    auto ring = ShmRing::create(name);
+    if (!ring)
+    {
+        LOG_ERROR("RTMP server: cannot create shared memory %s", name.c_str());
+        return false;
+    }
+
+    m_ring = ring;
+    m_shmThread.data = this;
+    m_shmThread.func = shmProc;
+    m_shmThread.threadClass = ThreadClass::T_INGEST;
+    if (!sys->startWaitableThread(&m_shmThread))
+    {
+        LOG_ERROR("RTMP server: cannot start thread");
+        m_ring = nullptr;
+        return false;
+    }
+    LOG_INFO("RTMP server: receiving through shared memory %s", name.c_str());
+    return true;
+}
+
+void RTMPServerMonitor::stopShm()
+{
+    if (!m_ring)
+        return;
+
+    m_shmThread.shutdown();
+    sys->waitThread(&m_shmThread);
+    m_ring = nullptr;
+}
+
+int RTMPServerMonitor::shmProc(ThreadInfo* thread)
+{
+    auto self = static_cast<RTMPServerMonitor*>(thread->data);
+    auto ring = self->m_ring;
+
+    sys->setThreadName("RTMP SHM");
+
+    while (thread->active())
+    {
+        if (!ring->inUse)
+        {
+            switch (ring->state())
+            {
+            case ShmRing::S_OPEN:
+                if (ring->available() > 0)
+                    self->startShmChannel();
+                break;
+            case ShmRing::S_CLOSED:
+                // 読み終わったセッション。次のセッションを書かせる。
+                ring->drain();
+                ring->setState(ShmRing::S_IDLE);
+                break;
+            case ShmRing::S_DISCARD:
+                ring->drain();
+                break;
+            default:
+                break;
+            }
+        }
+        sys->sleep(100);
+    }
+    return 0;
+}
+
+// rtmp-server が書き始めたセッションを放送する。チャンネル情報は HTTP
+// Push の URL に載せていたのと同じ既定のもの。
+void RTMPServerMonitor::startShmChannel()
+{
+    ChanInfo info = channelInfoFor("");
+
+    auto c = chanMgr->findChannelByID(info.id);
+    if (c)
+    {
+        LOG_INFO("RTMP channel already active, closing old one");
+        c->thread.shutdown();
+    }
+
+    c = chanMgr->createChannel(info);
+    if (!c)
+    {
+        LOG_ERROR("RTMP server: cannot create channel");
+        m_ring->compareAndSetState(ShmRing::S_OPEN, ShmRing::S_DISCARD);
+        return;
+    }
+
+    if (ipVersion == 6)
+    {
+        c->ipVersion = Channel::IP_V6;
+        servMgr->checkFirewallIPv6();
+    }
+    m_ring->inUse = true;
+    c->startShm(m_ring);
 }
 
 std::string RTMPServerMonitor::makeEndpointURL()
 {
-    std::lock_guard<std::recursive_mutex> cs(servMgr->lock);
+    std::lock_guard<ProfiledMutex> cs(servMgr->lock);
 
     ChanInfo info = servMgr->defaultChannelInfo;
     cgi::Query query;
@@ -93,3 +240,204 @@ std::string RTMPServerMonitor::makeEndpointURL()
 
     return "http://localhost:" + std::to_string(servMgr->serverHost.port) + "/?" + query.str();
 }
+
+// 組み込みの RTMP サーバーを rtmpPort で起動する。
+bool RTMPServerMonitor::startListener()
+{
+    uint16_t port;
+    {
+        std::lock_guard<ProfiledMutex> cs(servMgr->lock);
+        port = servMgr->rtmpPort;
+    }
+
+    try
+    {
+        auto sock = sys->createSocket();
+        sock->bind(Host(0 /* IGNORED */, port));
+        m_listenSock = sock;
+    }catch (StreamException& e)
+    {
+        LOG_ERROR("RTMP server: cannot listen on port %hu: %s", port, e.msg);
+        return false;
+    }
+
+    m_listenThread.data = this;
+    m_listenThread.func = listenProc;
+    m_listenThread.threadClass = ThreadClass::T_INGEST;
+    if (!sys->startWaitableThread(&m_listenThread))
+    {
+        LOG_ERROR("RTMP server: cannot start thread");
+        m_listenSock->close();
+        m_listenSock = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void RTMPServerMonitor::stopListener()
+{
+    if (!m_listenSock)
+        return;
+
+    m_listenThread.shutdown();
+    sys->waitThread(&m_listenThread);
+    m_listenSock->close();
+    m_listenSock = nullptr;
+}
+
+int RTMPServerMonitor::listenProc(ThreadInfo* thread)
+{
+    auto self = static_cast<RTMPServerMonitor*>(thread->data);
+    auto sock = self->m_listenSock;
+
+    sys->setThreadName(String::format("RTMP %hu", sock->host.port));
+    LOG_INFO("RTMP server started on port %d", (int) sock->host.port);
+
+    try
+    {
+        while (thread->active() && sock->active())
+        {
+            if (!sock->readReady(100))
+                continue;
+
+            auto cs = sock->accept();
+            if (!cs)
+            {
+                LOG_ERROR("RTMP server: accept failed");
+                continue;
+            }
+
+            LOG_INFO("RTMP server: connection from %s", cs->host.str().c_str());
+
+            auto conn = new RTMPConnection();
+            conn->monitor = self;
+            conn->sock = cs;
+            conn->thread.func = connectionProc;
+            conn->thread.data = conn;
+            if (!servMgr->incomingPool.submit(&conn->thread))
+            {
+                LOG_ERROR("RTMP server: cannot start session");
+                cs->close();
+                delete conn;
+            }
+        }
+    }catch (StreamException& e)
+    {
+        LOG_ERROR("RTMP server: %s", e.msg);
+    }
+
+    LOG_INFO("RTMP server stopped");
+    return 0;
+}
+
+int RTMPServerMonitor::connectionProc(ThreadInfo* thread)
+{
+    std::unique_ptr<RTMPConnection> conn(static_cast<RTMPConnection*>(thread->data));
+    auto cs = conn->sock;
+
+    sys->setThreadName("RTMP HANDSHAKE");
+
+    try
+    {
+        cs->setReadTimeout(HANDSHAKE_TIMEOUT);
+
+        auto session = std::make_shared<RTMPSession>(*cs);
+        session->handshake();
+        session->readUntilPublish();
+        if (!session->isPublishing())
+        {
+            LOG_INFO("RTMP server: %s closed before publishing", cs->host.str().c_str());
+            cs->close();
+            return 0;
+        }
+
+        cs->setReadTimeout(30000);
+        conn->monitor->startChannel(cs, session);
+    }catch (StreamException& e)
+    {
+        LOG_ERROR("RTMP server: %s: %s", cs->host.str().c_str(), e.msg);
+        cs->close();
+    }
+    return 0;
+}
+
+ChanInfo RTMPServerMonitor::channelInfoFor(const std::string& streamKey)
+{
+    ChanInfo info;
+    {
+        std::lock_guard<ProfiledMutex> lk(servMgr->lock);
+        info = servMgr->defaultChannelInfo;
+    }
+
+    const bool isQuery = (streamKey.find('=') != std::string::npos);
+    std::string group, rendition;
+    if (isQuery)
+    {
+        cgi::Query query(streamKey);
+        group = query.get("group");
+        rendition = query.get("rendition");
+        auto field = [&](const char* key, CompactString& value)
+        {
+            if (!query.get(key).empty())
+                value = str::truncate_utf8(str::valid_utf8(query.get(key)), 255);
+        };
+        field("name", info.name);
+        field("genre", info.genre);
+        field("desc", info.desc);
+        field("url", info.url);
+        field("comment", info.comment);
+        if (!query.get("bitrate").empty())
+            info.bitrate = atoi(query.get("bitrate").c_str());
+        if (!query.get("lowlatency").empty())
+            info.lowLatency = (query.get("lowlatency") == "1");
+    }
+
+    info.setContentType(ChanInfo::T_FLV);
+    if (info.comment.isEmpty())
+        info.comment = chanMgr->broadcastMsg;
+    Servent::setBroadcastIdChannelId(info, chanMgr->broadcastID);
+    ChannelGroup::assign(info, group, rendition);
+
+    // 同じ名前で別々のキーを使うエンコーダーが、互いを追い出さないよ
+    // うにする。
+    if (!isQuery && !streamKey.empty())
+    {
+        info.id.encode(nullptr, streamKey.c_str(), nullptr, 0);
+        g_prefork.claimID(info.id);
+    }
+
+    return info;
+}
+
+// publish を済ませた接続を放送する。同じストリームキーのチャンネルが
+// あれば、その予備にするか、再接続とみなして置き換える。
+void RTMPServerMonitor::startChannel(std::shared_ptr<ClientSocket> cs, std::shared_ptr<RTMPSession> session)
+{
+    ChanInfo info = channelInfoFor(session->streamName());
+
+    auto c = chanMgr->findChannelByID(info.id);
+    if (c)
+    {
+        if (servMgr->flags[ServMgr::F_backupIngest] &&
+            c->addBackupSource(cs, std::make_shared<RTMPSource>(session),
+                               Channel::SRC_RTMP, ChanInfo::T_FLV))
+            return;
+        LOG_INFO("RTMP channel already active, closing old one");
+        c->thread.shutdown();
+    }
+
+    c = chanMgr->createChannel(info);
+    if (!c)
+    {
+        LOG_ERROR("RTMP server: cannot create channel");
+        cs->close();
+        return;
+    }
+
+    if (ipVersion == 6)
+    {
+        c->ipVersion = Channel::IP_V6;
+        servMgr->checkFirewallIPv6();
+    }
+    c->startRTMP(cs, session);
+}
@@ -3,10 +3,31 @@
 
 #include "subprog.h"
 #include "varwriter.h"
+#include "lockprof.h"
+#include "threading.h"
+#include "chaninfo.h"
 
+class ClientSocket;
+
+// RTMP サーバーの管理。普段はポートを自分で開き、受け付けた接続を
+// RTMPStream のチャンネルにする。externalRTMPServer フラグが立ってい
+// れば、以前のように rtmp-server を子プロセスとして起動して見張る。
+//
+// rtmpSharedMemory フラグも立っていれば、rtmp-server には HTTP Push の
+// URL の代わりに共有メモリーのリング (shmring.h) を渡し、書かれた FLV
+// をそこから読む。
+//
+// 組み込みのサーバーは複数のエンコーダーを同時に受け付ける。ハンド
+// シェイクから publish までは incomingPool のワーカーで行い、publish
+// のストリーム名 (ストリームキー) ごとに別のチャンネルにする。
 class RTMPServerMonitor : public VariableWriter
 {
 public:
+    enum
+    {
+        HANDSHAKE_TIMEOUT = 10000,  // publish までの読み込みタイムアウト (ミリ秒)
+    };
+
     RTMPServerMonitor(const std::string& aPath);
 
     std::string status();
@@ -21,11 +42,37 @@ public:
     void start();
     std::string makeEndpointURL();
 
+    bool startListener();
+    void stopListener();
+    static int listenProc(ThreadInfo*);
+    static int connectionProc(ThreadInfo*);
+    void startChannel(std::shared_ptr<ClientSocket> cs, std::shared_ptr<class RTMPSession> session);
+
+    // 共有メモリーのリングを見張り、セッションが始まったらチャンネルに
+    // する。
+    bool startShm();
+    void stopShm();
+    static int shmProc(ThreadInfo*);
+    void startShmChannel();
+
+    // ストリームキーからチャンネル情報を作る。キーが name=...&genre=...
+    // の形なら HTTP Push と同じように読み、足りない項目は既定のチャン
+    // ネル情報で補う。そうでなければ既定のチャンネル情報を使い、チャ
+    // ンネル ID にキーを混ぜる。
+    static ChanInfo channelInfoFor(const std::string& streamKey);
+
     Subprogram m_rtmpServer;
     int ipVersion;
     bool m_enabled;
+    bool m_external;
+
+    ThreadInfo m_listenThread;
+    std::shared_ptr<ClientSocket> m_listenSock;
+
+    ThreadInfo m_shmThread;
+    std::shared_ptr<class ShmRing> m_ring;
 
-    std::recursive_mutex m_lock;
+    ProfiledMutex m_lock { "RTMPServerMonitor::m_lock" };
 };
 
 #endif
@@ -0,0 +1,322 @@
+// ------------------------------------------------
+// File : sampleprof.cpp
+// Desc:
+//      標本を取るプロファイラー。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#define HAVE_SIGPROF
+#include <signal.h>
+#include <sys/time.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#endif
+
+#include "sampleprof.h"
+#include "str.h"
+#include "sys.h"
+
+SamplingProfiler g_samplingProfiler;
+
+namespace
+{
+    // シグナルハンドラーから読むので、固定の大きさで持つ。
+    thread_local char t_threadName[SamplingProfiler::THREAD_NAME_LEN] = "";
+
+#ifdef HAVE_SIGPROF
+    void onSIGPROF(int, siginfo_t*, void*)
+    {
+        int savedErrno = errno;
+        void* pcs[SamplingProfiler::MAX_DEPTH + 2];
+        int n = backtrace(pcs, SamplingProfiler::MAX_DEPTH + 2);
+        // ハンドラー自身とシグナルのトランポリンを飛ばす。
+        if (n > 2)
+            g_samplingProfiler.record(pcs + 2, n - 2);
+        errno = savedErrno;
+    }
+
+    bool s_handlerInstalled = false;
+#endif
+}
+
+// ------------------------------------
+SamplingProfiler::SamplingProfiler()
+    : m_running(false)
+    , m_hz(0)
+    , m_seconds(0)
+    , m_numRecorded(0)
+{
+}
+
+// ------------------------------------
+bool SamplingProfiler::available()
+{
+#ifdef HAVE_SIGPROF
+    return true;
+#else
+    return false;
+#endif
+}
+
+// ------------------------------------
+bool SamplingProfiler::start(int seconds, int hz, std::string& error)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    if (!available())
+    {
+        error = "Not supported on this platform";
+        return false;
+    }
+    if (m_running)
+    {
+        error = "Already running";
+        return false;
+    }
+    if (seconds < 1 || seconds > MAX_SECONDS)
+    {
+        error = str::format("seconds must be between 1 and %d", (int) MAX_SECONDS);
+        return false;
+    }
+    if (hz < 1 || hz > MAX_HZ)
+    {
+        error = str::format("hz must be between 1 and %d", (int) MAX_HZ);
+        return false;
+    }
+
+    if (!m_samples)
+        m_samples.reset(new Sample[MAX_SAMPLES]);
+    for (int i = 0; i < MAX_SAMPLES; i++)
+        m_samples[i].ready = false;
+    m_numRecorded = 0;
+    m_collapsed.clear();
+    m_hz = hz;
+    m_seconds = seconds;
+    m_start = m_end = std::chrono::steady_clock::now();
+
+    m_running = true;
+    if (!startTimer(hz))
+    {
+        m_running = false;
+        error = "Cannot start the profiling timer";
+        return false;
+    }
+    LOG_INFO("Profiler: started for %d seconds at %d Hz", seconds, hz);
+    return true;
+}
+
+// ------------------------------------
+void SamplingProfiler::stop()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    if (!m_running)
+        return;
+
+    stopTimer();
+    m_running = false;
+    m_end = std::chrono::steady_clock::now();
+
+    // 同じアドレスは何度も出てくるので、変換した名前を使い回す。
+    std::map<void*, std::string> names;
+    auto name = [&](void* pc)
+    {
+        auto it = names.find(pc);
+        if (it != names.end())
+            return it->second;
+        std::string s = symbolize(pc);
+        std::replace(s.begin(), s.end(), ';', ':');
+        return names[pc] = s;
+    };
+
+    std::vector<Stack> stacks;
+    uint64_t n = std::min<uint64_t>(m_numRecorded, MAX_SAMPLES);
+    for (uint64_t i = 0; i < n; i++)
+    {
+        Sample& s = m_samples[i];
+        if (!s.ready.load(std::memory_order_acquire))
+            continue;
+
+        Stack stack;
+        stack.thread = s.thread[0] ? std::string(s.thread, strnlen(s.thread, THREAD_NAME_LEN)) : "(unnamed)";
+        for (int d = s.depth - 1; d >= 0; d--)
+        {
+            // 内側以外は戻り先なので、呼び出した命令の中を指すように戻す。
+            void* pc = d == 0 ? s.pcs[d] : (void*) ((char*) s.pcs[d] - 1);
+            stack.frames.push_back(name(pc));
+        }
+        stacks.push_back(std::move(stack));
+    }
+    m_collapsed = collapse(stacks);
+    LOG_INFO("Profiler: stopped with %u samples", (unsigned int) stacks.size());
+}
+
+// ------------------------------------
+void SamplingProfiler::update()
+{
+    bool expired;
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        expired = m_running &&
+            std::chrono::steady_clock::now() >= m_start + std::chrono::seconds(m_seconds);
+    }
+    if (expired)
+        stop();
+}
+
+// ------------------------------------
+SamplingProfiler::Status SamplingProfiler::status()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    Status s;
+    s.running = m_running;
+    s.hz = m_hz;
+    s.seconds = m_seconds;
+    auto end = m_running ? std::chrono::steady_clock::now() : m_end;
+    s.elapsed = std::chrono::duration<double>(end - m_start).count();
+    uint64_t recorded = m_numRecorded;
+    s.samples = std::min<uint64_t>(recorded, MAX_SAMPLES);
+    s.dropped = recorded - s.samples;
+    return s;
+}
+
+// ------------------------------------
+std::string SamplingProfiler::collapsed()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_running ? "" : m_collapsed;
+}
+
+// ------------------------------------
+std::string SamplingProfiler::collapse(const std::vector<Stack>& stacks)
+{
+    std::map<std::string, uint64_t> counts;
+    for (auto& s : stacks)
+    {
+        std::string line = s.thread;
+        for (auto& f : s.frames)
+            line += ";" + f;
+        counts[line]++;
+    }
+
+    std::vector<std::pair<std::string, uint64_t>> lines(counts.begin(), counts.end());
+    std::stable_sort(lines.begin(), lines.end(),
+                     [](const std::pair<std::string, uint64_t>& a, const std::pair<std::string, uint64_t>& b)
+                     {
+                         return a.second > b.second;
+                     });
+
+    std::string out;
+    for (auto& l : lines)
+        out += str::format("%s %llu\n", l.first.c_str(), (unsigned long long) l.second);
+    return out;
+}
+
+// ------------------------------------
+void SamplingProfiler::setThreadName(const char* name)
+{
+    snprintf(t_threadName, sizeof(t_threadName), "%s", name);
+}
+
+// ------------------------------------
+// シグナルハンドラーの中なので、確保もロックもしない。
+void SamplingProfiler::record(void* const* pcs, int depth)
+{
+    if (!m_running.load(std::memory_order_relaxed))
+        return;
+
+    uint64_t i = m_numRecorded.fetch_add(1, std::memory_order_relaxed);
+    if (i >= MAX_SAMPLES)
+        return;
+
+    Sample& s = m_samples[i];
+    s.depth = std::min<int>(depth, MAX_DEPTH);
+    memcpy(s.pcs, pcs, s.depth * sizeof(void*));
+    memcpy(s.thread, t_threadName, THREAD_NAME_LEN);
+    s.ready.store(true, std::memory_order_release);
+}
+
+// ------------------------------------
+bool SamplingProfiler::startTimer(int hz)
+{
+#ifdef HAVE_SIGPROF
+    // 最初の backtrace は libgcc を読み込むので、ハンドラーの外で済ませ
+    // ておく。
+    void* dummy[1];
+    backtrace(dummy, 1);
+
+    // 止めた後に遅れて届いた SIGPROF でプロセスが終わらないように、ハ
+    // ンドラーは一度付けたら外さない。
+    if (!s_handlerInstalled)
+    {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = onSIGPROF;
+        sa.sa_flags = SA_RESTART | SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGPROF, &sa, nullptr) != 0)
+            return false;
+        s_handlerInstalled = true;
+    }
+
+    long usec = 1000000 / hz;
+    struct itimerval tv;
+    memset(&tv, 0, sizeof(tv));
+    tv.it_interval.tv_sec = usec / 1000000;
+    tv.it_interval.tv_usec = usec % 1000000;
+    tv.it_value = tv.it_interval;
+    return setitimer(ITIMER_PROF, &tv, nullptr) == 0;
+#else
+    return false;
+#endif
+}
+
+// ------------------------------------
+void SamplingProfiler::stopTimer()
+{
+#ifdef HAVE_SIGPROF
+    struct itimerval tv;
+    memset(&tv, 0, sizeof(tv));
+    setitimer(ITIMER_PROF, &tv, nullptr);
+#endif
+}
+
+// ------------------------------------
+std::string SamplingProfiler::symbolize(void* pc)
+{
+#ifdef HAVE_SIGPROF
+    Dl_info info;
+    if (dladdr(pc, &info) && info.dli_fname)
+    {
+        if (info.dli_sname)
+        {
+            int status;
+            std::unique_ptr<char, void(*)(void*)> demangled(
+                abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status), free);
+            return status == 0 ? demangled.get() : info.dli_sname;
+        }
+        const char* base = strrchr(info.dli_fname, '/');
+        return str::format("%s+0x%lx", base ? base + 1 : info.dli_fname,
+                           (unsigned long) ((char*) pc - (char*) info.dli_fbase));
+    }
+#endif
+    return str::format("%p", pc);
+}
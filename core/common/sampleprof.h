@@ -0,0 +1,121 @@
+// ------------------------------------------------
+// File : sampleprof.h
+// Desc:
+//      標本を取るプロファイラー。JSON-RPC の startProfiler で指定した秒
+//      数だけ、CPU 時間の一定の間隔でスタックを記録し、スレッドの名前
+//      を根にした flame graph 用の畳んだスタック ("名前;外;...;内 回数")
+//      にして返す。
+//
+//      glibc と macOS では ITIMER_PROF の SIGPROF で取る。シグナルハン
+//      ドラーは前もって確保した場所に書くだけで、記号への変換は止めた後
+//      に行う。それ以外 (Windows など) では使えない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _SAMPLEPROF_H
+#define _SAMPLEPROF_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// ------------------------------------
+class SamplingProfiler
+{
+public:
+    enum
+    {
+        MAX_DEPTH       = 48,       // 一つのスタックの深さの上限
+        MAX_SAMPLES     = 20000,    // これを超えた標本は捨てて数える
+        MAX_SECONDS     = 300,
+        DEFAULT_HZ      = 99,
+        MAX_HZ          = 1000,
+        THREAD_NAME_LEN = 16,
+    };
+
+    struct Status
+    {
+        bool        running;
+        int         hz;
+        int         seconds;        // 指定された長さ
+        double      elapsed;        // 実際に取った長さ
+        uint64_t    samples;
+        uint64_t    dropped;
+    };
+
+    // 畳む前のスタック。frames は外側から。
+    struct Stack
+    {
+        std::string thread;
+        std::vector<std::string> frames;
+    };
+
+    SamplingProfiler();
+
+    // seconds 秒、CPU 時間 1 秒あたり hz 回の標本取りを始める。前の結
+    // 果は捨てる。出来なければ error に理由を入れて false。
+    bool    start(int seconds, int hz, std::string& error);
+    void    stop();
+
+    // 指定の秒数が過ぎていれば止める。housekeeping から毎秒呼ぶ。
+    void    update();
+
+    Status  status();
+
+    // 止まっていれば畳んだスタックを回数の多い順に。動いている間は空。
+    std::string collapsed();
+
+    // stacks を "thread;外;...;内 回数" の行にする。
+    static std::string collapse(const std::vector<Stack>& stacks);
+
+    // 呼び出したスレッドの名前を覚える。Sys::setThreadName から呼ぶ。
+    static void setThreadName(const char* name);
+
+    // シグナルハンドラーから呼ぶ。pcs は内側から。
+    void    record(void* const* pcs, int depth);
+
+    // このプラットフォームで使えるか。
+    static bool available();
+
+private:
+    static bool startTimer(int hz);
+    static void stopTimer();
+    static std::string symbolize(void* pc);
+
+    struct Sample
+    {
+        std::atomic<bool> ready;
+        int         depth;
+        void*       pcs[MAX_DEPTH];
+        char        thread[THREAD_NAME_LEN];
+    };
+
+    std::mutex      m_lock;
+    std::atomic<bool> m_running;
+    int             m_hz;
+    int             m_seconds;
+    std::chrono::steady_clock::time_point m_start, m_end;
+    std::unique_ptr<Sample[]> m_samples;    // 一度確保したら解放しない
+    std::atomic<uint64_t> m_numRecorded;    // 捨てた分も含む
+    std::string     m_collapsed;
+};
+
+extern SamplingProfiler g_samplingProfiler;
+
+#endif
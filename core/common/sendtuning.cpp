@@ -0,0 +1,41 @@
+// ------------------------------------------------
+// File : sendtuning.cpp
+// Desc:
+//      送信バッファーの大きさの計算。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+#include <stdint.h>
+
+#include "sendtuning.h"
+
+// ------------------------------------
+SendTuning SendTuning::compute(Class c, unsigned int bitrateKbps, unsigned int rttUsec, bool lowLatency)
+{
+    const uint64_t bytesPerSec = (uint64_t) (bitrateKbps ? bitrateKbps : DEFAULT_BITRATE_KBPS) * 1000 / 8;
+    const uint64_t rttMsec = (rttUsec ? rttUsec : DEFAULT_RTT_USEC) / 1000;
+
+    uint64_t slack;
+    if (lowLatency)
+        slack = LOW_LATENCY_SLACK_MSEC;
+    else if (c == C_RELAY)
+        slack = RELAY_SLACK_MSEC;
+    else
+        slack = DIRECT_SLACK_MSEC;
+
+    SendTuning t;
+    t.sendBufferSize = (int) std::min<uint64_t>(std::max<uint64_t>(bytesPerSec * (rttMsec + slack) / 1000, MIN_SNDBUF), MAX_SNDBUF);
+    t.notSentLowat = (int) std::min<uint64_t>(std::max<uint64_t>(bytesPerSec * LOWAT_MSEC / 1000, MIN_LOWAT), t.sendBufferSize / 2);
+    return t;
+}
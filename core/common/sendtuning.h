@@ -0,0 +1,56 @@
+// ------------------------------------------------
+// File : sendtuning.h
+// Desc:
+//      ストリームを送るソケットの送信バッファーの大きさを決める
+//      (tuneSendBuffers フラグ)。カーネルの既定のままだと、遅い相手に
+//      何 MB も溜まって遅れが秒単位になり、ユーザー空間のキーフレーム
+//      への読み飛ばしや送信の調整が効かない。チャンネルのビットレート
+//      と RTT から必要な分だけにして、詰まりをユーザー空間に残す。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _SENDTUNING_H
+#define _SENDTUNING_H
+
+// ------------------------------------
+struct SendTuning
+{
+    // 接続の種類
+    enum Class
+    {
+        C_RELAY,    // PCP リレー。下流がさらに配るので少し余裕を持たせる
+        C_DIRECT,   // 直接視聴
+    };
+
+    enum
+    {
+        MIN_SNDBUF              = 32 * 1024,
+        MAX_SNDBUF              = 4 * 1024 * 1024,
+        MIN_LOWAT               = 16 * 1024,
+        DEFAULT_RTT_USEC        = 100000,   // RTT が分からない時
+        DEFAULT_BITRATE_KBPS    = 1000,     // ビットレートが分からない時
+        RELAY_SLACK_MSEC        = 500,      // RTT に足すバッファーの長さ
+        DIRECT_SLACK_MSEC       = 250,
+        LOW_LATENCY_SLACK_MSEC  = 100,
+        LOWAT_MSEC              = 50,       // 未送信のまま置いておく長さ
+    };
+
+    int sendBufferSize = 0; // SO_SNDBUF
+    int notSentLowat = 0;   // TCP_NOTSENT_LOWAT
+
+    // バッファーは RTT と余裕の分のストリーム。未送信の分はその半分ま
+    // でにする。
+    static SendTuning compute(Class c, unsigned int bitrateKbps, unsigned int rttUsec, bool lowLatency);
+};
+
+#endif
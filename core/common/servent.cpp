@@ -21,7 +21,15 @@
 // ------------------------------------------------
 // todo: make lan->yp not check firewall
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <thread>
+#include <tuple>
+
 #include "servent.h"
+#include "websocket.h"
+#include "dvr.h"
 #include "sys.h"
 #include "xml.h"
 #include "html.h"
@@ -36,9 +44,28 @@
 #include "gnutella.h"
 #include "chanmgr.h"
 #include "regexp.h"
+#include "threadpool.h"
+#include "eventbus.h"
+#include "chunker.h"
+#include "aacextract.h"
+#include "metrics.h"
+#include "threadacct.h"
+#include "pkttrace.h"
+#include "pingcache.h"
+#include "handoff.h"
+#include "sslclientsocket.h"
+#include "sendtuning.h"
+#include "admission.h"
+#include "ypsession.h"
+#include "locality.h"
 
 const int DIRECT_WRITE_TIMEOUT = 60;
 
+// リアクターで送信する時に溜めておく未送信データの上限 (バイト)。
+const size_t REACTOR_MAX_PENDING = 256 * 1024;
+// リアクターで一度に送るバッファーの数。
+const size_t REACTOR_MAX_IOVECS = 64;
+
 // -----------------------------------
 const char *Servent::statusMsgs[] =
 {
@@ -122,6 +149,15 @@ bool Servent::canStream(std::shared_ptr<Channel> ch, Servent::StreamRequestDenia
             return false;
         }
 
+        if (servMgr->flags[ServMgr::F_bandwidthScheduling] &&
+            !g_bandwidth.canAdmit(bandwidthClass(), ch->getBitrate()))
+        {
+            LOG_DEBUG("Unable to stream because there is not enough bandwidth left for %s",
+                      BandwidthScheduler::getClassName(bandwidthClass()));
+            *reason = StreamRequestDenialReason::InsufficientBandwidth;
+            return false;
+        }
+
         if ((type == T_RELAY) && servMgr->relaysFull())
         {
             LOG_DEBUG("Unable to stream because server already has max. number of relays");
@@ -155,11 +191,21 @@ bool Servent::canStream(std::shared_ptr<Channel> ch, Servent::StreamRequestDenia
 }
 
 // -----------------------------------
-Servent::Servent(int index)
+Servent::Servent(int index, ServMgr* mgr)
     : serventIndex(index)
     , sock(nullptr)
     , next(nullptr)
+    , mgr(mgr)
+    , counted(false)
+    , countedType(T_NONE)
+    , countedPrivate(false)
+    , connectedSlot(-1)
+    , routeSlot(-1)
+    , inFreeList(false)
 {
+    status = S_NONE;
+    type = T_NONE;
+    servPort = 0;
     reset();
 }
 
@@ -171,7 +217,7 @@ Servent::~Servent()
 // -----------------------------------
 void    Servent::kill()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     thread.shutdown();
 
@@ -187,9 +233,12 @@ void    Servent::kill()
 
     if (sock)
     {
-        sock->close();
+        // 新しいプロセスに渡したソケットは閉じない。
+        if (!handingOff || !g_restartHandoff.collect(this))
+            sock->close();
         sock = nullptr;
     }
+    handingOff = false;
 
     if (pushSock)
     {
@@ -207,24 +256,41 @@ void    Servent::kill()
 // -----------------------------------
 void    Servent::abort()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
     thread.shutdown();
+    if (reactorStream && reactorStream->id)
+    {
+        // ソケットはリアクターに登録されているので、ハンドラーに閉じさせる。
+        reactorStream->reactor->post(reactorStream->id);
+        return;
+    }
     if (sock)
     {
         sock->close();
     }
 }
 
+// -----------------------------------
+void Servent::beginHandoff()
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+    handingOff = true;
+    thread.shutdown();
+    if (reactorStream && reactorStream->id)
+        reactorStream->reactor->post(reactorStream->id);
+}
+
 // -----------------------------------
 void Servent::reset()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     remoteID.clear();
 
-    servPort = 0;
+    setServPort(0);
 
     pcpStream = nullptr;
+    bandwidth = nullptr;
 
     networkID.clear();
 
@@ -235,9 +301,22 @@ void Servent::reset()
     agent.clear();
     sock = nullptr;
     allow = ALLOW_ALL;
+    handingOff = false;
     syncPos = 0;
     addMetadata = false;
     nsSwitchNum = 0;
+    handshakeStart = 0;
+    keepAlive = false;
+    numRequests = 0;
+    chunkedOutput = false;
+    webSocketOutput = false;
+    webSocketKey.clear();
+    timeShiftPos = 0;
+    timeShiftSeconds = 0;
+    timeShift = false;
+    audioOnlyOutput = false;
+    muxOutput = false;
+    muxChannels.clear();
     lastConnect = lastPing = lastPacket = 0;
 
     loginPassword.clear();
@@ -247,22 +326,34 @@ void Servent::reset()
     pushSock = nullptr;
     sendHeader = true;
 
-    status = S_NONE;
-    type = T_NONE;
+    setStatus(S_NONE);
+    setType(T_NONE);
 
     streamPos = 0;
 
     cookie.clear();
+
+    pacer.reset();
+
+    reactorStream = nullptr;
 }
 
 // -----------------------------------
 bool Servent::sendPacket(ChanPacket &pack, const GnuID &cid, const GnuID &sid, const GnuID &did, Servent::TYPE t)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
+
+    auto isMuxChannel = [&]()
+    {
+        for (auto& id : muxChannels)
+            if (id.isSame(cid))
+                return true;
+        return false;
+    };
 
     if  (      (type == t)
             && (isConnected())
-            && (!cid.isSet() || chanID.isSame(cid))
+            && (!cid.isSet() || chanID.isSame(cid) || isMuxChannel())
             && (!sid.isSet() || !sid.isSame(remoteID))
             && (pcpStream != nullptr)
         )
@@ -296,27 +387,45 @@ Host Servent::getHost()
 
 // ------------------------------------------------------------------
 // ソケットでの待ち受けを行う SERVER サーバントを開始する。成功すれば
-// true を返す。
-bool Servent::initServer(Host &h)
+// true を返す。reusePort なら SO_REUSEPORT を付けて待ち受ける。
+bool Servent::initServer(Host &h, bool reusePort)
 {
     try
     {
         checkFree();
 
-        status = S_WAIT;
+        setStatus(S_WAIT);
 
-        createSocket();
+        // 再起動前のプロセスから受け取った待ち受けがあれば使う。
+        int fd = g_restartHandoff.takeListener(h.port);
+        if (fd >= 0)
+        {
+            sock = RestartHandoff::adoptListener(fd, h);
+            LOG_INFO("Took over server socket on port %d", (int) h.port);
+        }else
+        {
+            createSocket();
 
-        sock->bind(h);
+            if (reusePort)
+                sock->bindReusePort(h);
+            else
+                sock->bind(h);
+        }
 
         thread.data = this;
         thread.func = serverProc;
+        thread.threadClass = ThreadClass::T_CONTROL;
 
-        type = T_SERVER;
+        setType(T_SERVER);
 
         if (!sys->startThread(&thread))
             throw StreamException("Can`t start thread");
     }catch (StreamException &e)
+    {
+        LOG_ERROR("Bad server: %s", e.msg);
+        kill();
+        return false;
+    }catch (NotImplementedException &e)
     {
         LOG_ERROR("Bad server: %s", e.msg);
         kill();
@@ -342,17 +451,24 @@ void Servent::initIncoming(std::shared_ptr<ClientSocket> s, unsigned int a)
     try{
         checkFree();
 
-        type = T_INCOMING;
+        setType(T_INCOMING);
         sock = s;
         allow = a;
         thread.data = this;
         thread.func = incomingProc;
+        thread.threadClass = ThreadClass::T_CONTROL;
 
         setStatus(S_PROTOCOL);
 
         LOG_DEBUG("Incoming from %s", sock->host.str().c_str());
 
-        if (!sys->startThread(&thread))
+        // ほとんどの要求はすぐに終わるので、スレッドを使い回す。
+        bool started;
+        if (servMgr->flags[ServMgr::F_threadPool])
+            started = servMgr->incomingPool.submit(&thread);
+        else
+            started = sys->startThread(&thread);
+        if (!started)
             throw StreamException("Can`t start thread");
     }catch (StreamException &e)
     {
@@ -362,10 +478,44 @@ void Servent::initIncoming(std::shared_ptr<ClientSocket> s, unsigned int a)
     }
 }
 
+// -----------------------------------
+void Servent::initResumed(std::shared_ptr<ClientSocket> s, TYPE t, ChanInfo::PROTOCOL protocol,
+                          const GnuID& cid, const GnuID& rid, unsigned int pos)
+{
+    try{
+        checkFree();
+
+        sock = s;
+        chanID = cid;
+        remoteID = rid;
+        outputProtocol = protocol;
+        streamPos = pos;
+        // 下流はもうヘッダーを受け取っている。
+        sendHeader = false;
+        setType(t);
+        thread.data = this;
+        thread.func = resumedProc;
+        thread.threadClass = ThreadClass::T_DATA;
+
+        setStatus(S_CONNECTED);
+
+        LOG_INFO("Resumed %s stream to %s at %u", ChanInfo::getProtocolStr(protocol),
+                 sock->host.str().c_str(), pos);
+
+        if (!sys->startThread(&thread))
+            throw StreamException("Can`t start thread");
+    }catch (StreamException &e)
+    {
+        kill();
+
+        LOG_ERROR("RESUME FAILED: %s", e.msg);
+    }
+}
+
 // -----------------------------------
 void Servent::initOutgoing(TYPE ty)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
     try
     {
         checkFree();
@@ -374,6 +524,7 @@ void Servent::initOutgoing(TYPE ty)
 
         thread.data = this;
         thread.func = outgoingProc;
+        thread.threadClass = ThreadClass::T_CONTROL;
 
         if (!sys->startThread(&thread))
             throw StreamException("Can`t start thread");
@@ -393,7 +544,7 @@ void Servent::initPCP(const Host &rh)
 
         createSocket();
 
-        type = T_COUT;
+        setType(T_COUT);
 
         sock->open(rh);
 
@@ -402,6 +553,7 @@ void Servent::initPCP(const Host &rh)
 
         thread.data = this;
         thread.func = outgoingProc;
+        thread.threadClass = ThreadClass::T_CONTROL;
 
         LOG_DEBUG("Outgoing to %s", rh.str().c_str());
 
@@ -434,8 +586,9 @@ void Servent::initGIV(const Host &h, const GnuID &id)
 
         thread.data = this;
         thread.func = givProc;
+        thread.threadClass = ThreadClass::T_DATA;
 
-        type = T_RELAY;
+        setType(T_RELAY);
 
         if (!sys->startThread(&thread))
             throw StreamException("Can`t start thread");
@@ -458,14 +611,65 @@ void Servent::createSocket()
 // -----------------------------------
 void Servent::setStatus(STATUS s)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     if (s != status)
     {
+        bool wasConnected = (status == S_CONNECTED);
         status = s;
 
         if ((s == S_HANDSHAKE) || (s == S_CONNECTED) || (s == S_LISTENING))
             lastConnect = sys->getTime();
+
+        if (s == S_HANDSHAKE)
+            handshakeStart = sys->getDTime();
+        else if (s == S_CONNECTED && handshakeStart != 0)
+        {
+            g_metrics.handshakeLatency.observe(sys->getDTime() - handshakeStart);
+            handshakeStart = 0;
+        }
+
+        if (mgr)
+        {
+            if (s == S_CONNECTED || wasConnected)
+                mgr->countServent(this, s == S_CONNECTED);
+            if (s == S_FREE)
+                mgr->releaseServent(this);
+        }
+
+        if (g_eventBus.hasSubscribers())
+            g_eventBus.publish("serventStatus", amf0::Value::object(
+                {
+                    {"connectionId", serventIndex},
+                    {"type", getTypeStr()},
+                    {"status", getStatusStr()},
+                }));
+    }
+}
+
+// -----------------------------------
+void Servent::setType(TYPE t)
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+
+    if (t != type)
+    {
+        if (mgr)
+            mgr->changeServentType(this, type, t);
+        type = t;
+    }
+}
+
+// -----------------------------------
+void Servent::setServPort(int port)
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+
+    if (port != servPort)
+    {
+        if (mgr)
+            mgr->changeServentPort(this, servPort, port);
+        servPort = port;
     }
 }
 
@@ -559,10 +763,16 @@ void Servent::handshakeStream_readHeaders(bool& gotPCP, unsigned int& reqPos, in
             gotPCP = atoi(arg)!=0;
         else if (http.isHeader(PCX_HS_POS))
             reqPos = atoi(arg);
+        else if (http.isHeader(PCX_HS_MUX))
+            muxOutput = atoi(arg) != 0;
         else if (http.isHeader("icy-metadata"))
             addMetadata = atoi(arg) > 0;
         else if (http.isHeader(HTTP_HS_AGENT))
             agent = arg;
+        else if (http.isHeader("Upgrade"))
+            webSocketOutput = str::downcase(arg) == "websocket";
+        else if (http.isHeader("Sec-WebSocket-Key"))
+            webSocketKey = arg;
         else if (http.isHeader("Pragma"))
         {
             char *ssc = stristr(arg, "stream-switch-count=");
@@ -604,6 +814,30 @@ void Servent::handshakeStream_returnStreamHeaders(AtomStream& atom,
     if (chanInfo.contentType != ChanInfo::T_MP3)
         addMetadata = false;
 
+    // WebSocket で送れるのも素の HTTP の時だけ。
+    if (outputProtocol != ChanInfo::SP_HTTP || webSocketKey.empty() ||
+        chanInfo.contentType == ChanInfo::T_MOV || audioOnlyOutput)
+        webSocketOutput = false;
+
+    if (webSocketOutput)
+    {
+        addMetadata = false;
+        chunkedOutput = false;
+
+        sock->writeLine("HTTP/1.1 101 Switching Protocols");
+        sock->writeLineF("%s %s", HTTP_HS_SERVER, PCX_AGENT);
+        sock->writeLine("Upgrade: websocket");
+        sock->writeLine("Connection: Upgrade");
+        sock->writeLineF("Sec-WebSocket-Accept: %s", WebSocketFramer::acceptKey(webSocketKey).c_str());
+        sock->writeLine("");
+        return;
+    }
+
+    // chunked で送れるのは素の HTTP で長さを偽らない時だけ。
+    if (addMetadata || outputProtocol != ChanInfo::SP_HTTP ||
+        chanInfo.contentType == ChanInfo::T_MOV)
+        chunkedOutput = false;
+
     if (addMetadata && (outputProtocol == ChanInfo::SP_HTTP))       // winamp mp3 metadata check
     {
         sock->writeLine(ICY_OK);
@@ -619,7 +853,12 @@ void Servent::handshakeStream_returnStreamHeaders(AtomStream& atom,
         sock->writeLineF("%s %s", HTTP_HS_CONTENT, MIME_MP3);
     }else
     {
-        sock->writeLine(HTTP_SC_OK);
+        if (chunkedOutput)
+        {
+            sock->writeLine("HTTP/1.1 200 OK");
+            sock->writeLine("Transfer-Encoding: chunked");
+        }else
+            sock->writeLine(HTTP_SC_OK);
 
         if ((chanInfo.contentType != ChanInfo::T_ASX) &&
             (chanInfo.contentType != ChanInfo::T_WMV) &&
@@ -645,7 +884,7 @@ void Servent::handshakeStream_returnStreamHeaders(AtomStream& atom,
                 sock->writeLine("Content-Length: 10000000");
             }
             sock->writeLine("Access-Control-Allow-Origin: *");
-            sock->writeLineF("%s %s", HTTP_HS_CONTENT, chanInfo.getMIMEType());
+            sock->writeLineF("%s %s", HTTP_HS_CONTENT, audioOnlyOutput ? MIME_AAC : chanInfo.getMIMEType());
         }else if (outputProtocol == ChanInfo::SP_MMS)
         {
             sock->writeLine("Server: Rex/9.0.0.2980");
@@ -666,7 +905,10 @@ void Servent::handshakeStream_returnStreamHeaders(AtomStream& atom,
             }
         }else if (outputProtocol == ChanInfo::SP_PCP)
         {
+            muxOutput = muxOutput && servMgr->flags[ServMgr::F_pcpMultiplex];
             sock->writeLineF("%s %d", PCX_HS_POS, streamPos);
+            if (muxOutput)
+                sock->writeLineF("%s 1", PCX_HS_MUX);
             sock->writeLineF("%s %s", HTTP_HS_CONTENT, MIME_XPCP);
         }
     }
@@ -687,49 +929,15 @@ void Servent::handshakeStream_returnHits(AtomStream& atom,
         ChanHit best;
 
         // search for up to 8 other hits
-        int cnt = 0;
-        for (int i = 0; i < 8; i++)
-        {
-            best.init();
-
-            // find best hit this network if local IP
-            if (!rhost.globalIP())
-            {
-                chs.init();
-                chs.matchHost = servMgr->serverHost;
-                chs.waitDelay = 2;
-                chs.excludeID = remoteID;
-                if (chl->pickHits(chs))
-                    best = chs.best[0];
-            }
-
-            // find best hit on same network
-            if (!best.host.ip)
-            {
-                chs.init();
-                chs.matchHost = rhost;
-                chs.waitDelay = 2;
-                chs.excludeID = remoteID;
-                if (chl->pickHits(chs))
-                    best = chs.best[0];
-            }
-
-            // find best hit on other networks
-            if (!best.host.ip)
-            {
-                chs.init();
-                chs.waitDelay = 2;
-                chs.excludeID = remoteID;
-                if (chl->pickHits(chs))
-                    best = chs.best[0];
-            }
-
-            if (!best.host.ip)
-                break;
-
-            best.writeAtoms(atom, channelID);
-            cnt++;
-        }
+        ChanHit alternates[ChanHitSearch::MAX_RESULTS];
+        int cnt = chl->pickAlternates(rhost, servMgr->serverHost, remoteID, 2,
+                                      alternates, ChanHitSearch::MAX_RESULTS,
+                                      servMgr->flags[ServMgr::F_preferLocalPeers] ? &g_locality : nullptr);
+        for (int i = 0; i < cnt; i++)
+            alternates[i].writeAtoms(atom, channelID);
+        // 候補が足りなければ下でトラッカーも教える。
+        if (cnt == ChanHitSearch::MAX_RESULTS)
+            best = alternates[cnt - 1];
 
         if (cnt)
         {
@@ -885,6 +1093,12 @@ bool Servent::handshakeStream(ChanInfo &chanInfo)
     bool chanReady = false;
 
     auto ch = chanMgr->findChannelByID(chanInfo.id);
+
+    // 音声だけを取り出せるのは FLV だけ。
+    if (audioOnlyOutput && (outputProtocol != ChanInfo::SP_HTTP ||
+                            (ch && ch->info.contentType != ChanInfo::T_UNKNOWN &&
+                             ch->info.contentType != ChanInfo::T_FLV)))
+        throw HTTPException(HTTP_SC_NOTFOUND, 404);
     if (ch)
     {
         sendHeader = true;
@@ -896,6 +1110,24 @@ bool Servent::handshakeStream(ChanInfo &chanInfo)
             streamPos = ch->rawData.getLatestPos();
         }
 
+        // タイムシフト。求められた位置がアーカイブにあればそこから送る。
+        auto archive = ch->rawData.getArchive();
+        if (archive && outputProtocol == ChanInfo::SP_HTTP)
+        {
+            unsigned int pos;
+            if (timeShiftSeconds && archive->findKeyPos(sys->getDTime() - timeShiftSeconds, pos))
+            {
+                streamPos = pos;
+                timeShift = true;
+            }else if (timeShiftPos && archive->contains(timeShiftPos))
+            {
+                streamPos = timeShiftPos;
+                timeShift = true;
+            }
+            if (timeShift)
+                LOG_INFO("Time-shifted stream from %u", streamPos);
+        }
+
         // 自動リレー管理。
         bool autoManageTried = false;
         do
@@ -945,7 +1177,7 @@ bool Servent::handshakeStream(ChanInfo &chanInfo)
                     };
 
                 // リレー自動管理。
-                std::lock_guard<std::recursive_mutex> cs(servMgr->lock);
+                std::lock_guard<ProfiledMutex> cs(servMgr->lock);
                 for (Servent* s = servMgr->servents; s != nullptr; s = s->next)
                 {
                     if (s == this) continue;
@@ -1034,8 +1266,9 @@ void Servent::writeHeloAtom(AtomStream &atom, bool sendPort, bool sendPing, bool
 // -----------------------------------
 void Servent::handshakeOutgoingPCP(AtomStream &atom, const Host &rhost, /*out*/ GnuID &rid, /*out*/ String &agent, bool isTrusted)
 {
+    const double t0 = sys->getDTime();
     int ipv = rhost.ip.isIPv4Mapped() ? 4 : 6;
-    if (servMgr->flags.get("sendPortAtomWhenFirewallUnknown"))
+    if (servMgr->flags[ServMgr::F_sendPortAtomWhenFirewallUnknown])
     {
         bool sendPort = (servMgr->getFirewall(ipv) != ServMgr::FW_ON);
         bool testFW   = (servMgr->getFirewall(ipv) == ServMgr::FW_UNKNOWN);
@@ -1141,6 +1374,7 @@ void Servent::handshakeOutgoingPCP(AtomStream &atom, const Host &rhost, /*out*/
         throw StreamException("Remote host not identified");
     }
 
+    g_metrics.outgoingPCPHandshakeLatency.observe(sys->getDTime() - t0);
     LOG_DEBUG("PCP Outgoing handshake complete.");
 }
 
@@ -1295,7 +1529,14 @@ void Servent::handshakeIncomingPCP(AtomStream &atom, Host &rhost, GnuID &rid, St
     {
         LOG_DEBUG("Incoming firewalled test request: %s ", rhost.str().c_str());
         rhost.port = pingPort;
-        if (!rhost.globalIP() || !pingHost(rhost, rid))
+        bool reachable;
+        if (!rhost.globalIP())
+            reachable = false;
+        else if (servMgr->flags[ServMgr::F_cachePingResults])
+            reachable = g_pingCache.verify(rhost, rid);
+        else
+            reachable = pingHost(rhost, rid);
+        if (!reachable)
             rhost.port = 0;
     }
 
@@ -1315,7 +1556,7 @@ void Servent::handshakeIncomingPCP(AtomStream &atom, Host &rhost, GnuID &rid, St
         }
     }
 
-    if (servMgr->flags.get("requireContinuationPacketSupportFromPeer"))
+    if (servMgr->flags[ServMgr::F_requireContinuationPacketSupportFromPeer])
     {
         SupportStatus status = continuationPacketSupportStatus(agent);
         if (status == SupportStatus::Unsupported)
@@ -1467,8 +1708,9 @@ void Servent::processIncomingPCP(bool suggestOthers)
         return;
     }
 
-    type = T_CIN;
+    setType(T_CIN);
     setStatus(S_CONNECTED);
+    ThreadPool::promote();
 
     atom.writeInt(PCP_OK, 0);
 
@@ -1562,11 +1804,17 @@ int Servent::outgoingProc(ThreadInfo *thread)
 
                 unsigned int ctime = sys->getTime();
 
-                if ((!bestHit.host.ip) && ((ctime-chanMgr->lastYPConnect) > MIN_YP_RETRY))
+                // YP とのセッションを張りっぱなしにする時は、失敗が続く
+                // ほど間を空けて繋ぎ直す。
+                const bool ypSession = servMgr->flags[ServMgr::F_ypSession];
+                if ((!bestHit.host.ip) &&
+                    (ypSession ? g_ypSession.canConnect(ctime) : ((ctime-chanMgr->lastYPConnect) > MIN_YP_RETRY)))
                 {
                     bestHit.host.fromStrName(servMgr->rootHost.cstr(), DEFAULT_PORT);
                     bestHit.yp = true;
                     chanMgr->lastYPConnect = ctime;
+                    if (ypSession)
+                        g_ypSession.onConnecting(ctime);
                 }
                 sys->sleepIdle();
             }while (!bestHit.host.ip && (sv->thread.active()));
@@ -1582,6 +1830,15 @@ int Servent::outgoingProc(ThreadInfo *thread)
             int error=0;
             try
             {
+                // 繋がらなかった時も切れた時も知らせる。すぐに切れたの
+                // なら失敗に数えられる。
+                const bool ypSession = bestHit.yp && servMgr->flags[ServMgr::F_ypSession];
+                Defer disconnected([ypSession]()
+                                   {
+                                       if (ypSession)
+                                           g_ypSession.onDisconnected(sys->getTime());
+                                   });
+
                 LOG_DEBUG("COUT to %s: Connecting..", ipStr.c_str());
 
                 if (!sv->sock)
@@ -1609,12 +1866,21 @@ int Servent::outgoingProc(ThreadInfo *thread)
 
                 sv->pcpStream->init(sv->remoteID);
 
+                if (ypSession)
+                    g_ypSession.onConnected(sys->getTime());
+
                 BroadcastState bcs;
                 error = 0;
                 while (!error && sv->thread.active() && !sv->sock->eof() && servMgr->autoServe)
                 {
                     error = sv->pcpStream->readPacket(*sv->sock, bcs);
 
+                    // 頼まれていたトラッカー更新を全チャンネル分まとめて
+                    // 送る。書き出しは次の readPacket でまとめて行われる。
+                    if (servMgr->flags[ServMgr::F_ypSession] &&
+                        g_ypSession.takeUpdate(sys->getTime()))
+                        chanMgr->sendTrackerUpdates();
+
                     sys->sleepIdle();
 
                     if (!chanMgr->isBroadcasting())
@@ -1671,7 +1937,13 @@ int Servent::outgoingProc(ThreadInfo *thread)
 int Servent::incomingProc(ThreadInfo *thread)
 {
     Servent *sv = (Servent*)thread->data;
-    Defer cb([sv]() { sv->kill(); });
+    Defer cb([sv]()
+             {
+                 // ストリームの送信をリアクターに引き継いだ場合は、リアク
+                 // ターのハンドラーが後始末をする。
+                 if (!sv->startReactorStream())
+                     sv->kill();
+             });
 
     std::string ipStr = sv->sock->host.str(true);
     sys->setThreadName(String::format("INCOMING %s", ipStr.c_str()));
@@ -1703,13 +1975,47 @@ int Servent::incomingProc(ThreadInfo *thread)
     return 0;
 }
 
+// -----------------------------------
+// initResumed で引き継いだ接続に、チャンネルを受け直すのを待ってから
+// 続きを送る。
+int Servent::resumedProc(ThreadInfo *thread)
+{
+    Servent *sv = (Servent*)thread->data;
+    Defer cb([sv]() { sv->kill(); });
+
+    sys->setThreadName(String::format("RESUMED %s", sv->sock->host.str(true).c_str()));
+
+    try
+    {
+        ChanInfo info;
+        info.id = sv->chanID;
+        if (!sv->waitForChannelHeader(info))
+            throw StreamException("Channel not ready");
+
+        if (sv->outputProtocol == ChanInfo::SP_PCP)
+            sv->sendPCPChannel();
+        else
+            sv->sendRawChannel(false, true);
+    }catch (StreamException &e)
+    {
+        LOG_ERROR("Resumed stream: %s", e.msg);
+    }
+
+    return 0;
+}
+
 // -----------------------------------
 void Servent::processStream(ChanInfo &chanInfo)
 {
+    // ここからは配信のスレッド。
+    ThreadClass::apply(ThreadClass::T_DATA);
+
     setStatus(S_HANDSHAKE);
 
+    const double t0 = sys->getDTime();
     if (!handshakeStream(chanInfo))
         return;
+    g_metrics.streamHandshakeLatency.observe(sys->getDTime() - t0);
 
     ASSERT(chanID.isSet());
     ASSERT(this->status == S_CONNECTED);
@@ -1731,8 +2037,12 @@ void Servent::processStream(ChanInfo &chanInfo)
 
         if (outputProtocol == ChanInfo::SP_HTTP)
         {
-            if ((addMetadata) && (chanMgr->icyMetaInterval))
+            if (audioOnlyOutput)
+                sendAudioOnlyChannel();
+            else if ((addMetadata) && (chanMgr->icyMetaInterval))
                 sendRawMetaChannel(chanMgr->icyMetaInterval);
+            else if (!chunkedOutput && !webSocketOutput && !timeShift && prepareReactorStream())
+                return;
             else
                 sendRawChannel(true, true);
         }else if (outputProtocol == ChanInfo::SP_MMS)
@@ -1767,6 +2077,8 @@ bool Servent::waitForChannelHeader(ChanInfo &info)
 
         if (!thread.active() || !sock->active())
             break;
+        // 待たされるならプールのスレッドを塞がない。
+        ThreadPool::promote();
         sys->sleep(100);
     }
     return false;
@@ -1775,7 +2087,16 @@ bool Servent::waitForChannelHeader(ChanInfo &info)
 // -----------------------------------
 void Servent::sendRawChannel(bool sendHead, bool sendData)
 {
+    // 接続が続く間このスレッドを占有するので、プールから外す。
+    ThreadPool::promote();
+
     WriteBufferedStream bsock(sock.get());
+    // chunkedOutput なら書いた分ずつチャンクに、webSocketOutput ならメッ
+    // セージにする。
+    Chunker chunker(bsock);
+    WebSocketFramer framer(bsock);
+    Stream& out = chunkedOutput ? static_cast<Stream&>(chunker) :
+        webSocketOutput ? static_cast<Stream&>(framer) : bsock;
 
     try
     {
@@ -1786,14 +2107,25 @@ void Servent::sendRawChannel(bool sendHead, bool sendData)
             throw StreamException("Channel not found");
 
         LOG_DEBUG("Starting Raw stream of %s at %d", ch->info.name.cstr(), streamPos);
+        setLowLatency(ch);
+        tuneSendBuffer(ch);
+        openBandwidth();
 
-        if (sendHead)
+        bool skipContinuation = servMgr->flags[ServMgr::F_startPlayingFromKeyFrame];
+
+        if (sendHead && sendData && !chunkedOutput && !webSocketOutput && !timeShift)
+        {
+            sendJoinBurst(ch, skipContinuation);
+        }else if (sendHead)
         {
-            ch->headPack.writeRaw(bsock);
-            streamPos = ch->headPack.pos + ch->headPack.len;
-            auto ncpos = ch->rawData.getLatestNonContinuationPos();
-            if (ncpos && streamPos < ncpos)
-                streamPos = ncpos;
+            ch->headPack.writeRaw(out);
+            if (!timeShift)
+            {
+                streamPos = ch->headPack.pos + ch->headPack.len;
+                auto ncpos = ch->rawData.getNonContinuationPos(chanMgr->joinKeyFramesBack);
+                if (ncpos && streamPos < ncpos)
+                    streamPos = ncpos;
+            }
             LOG_DEBUG("Sent %d bytes header ", ch->headPack.len);
         }
 
@@ -1802,11 +2134,12 @@ void Servent::sendRawChannel(bool sendHead, bool sendData)
             unsigned int streamIndex = ch->streamIndex;
             unsigned int connectTime = sys->getTime();
             unsigned int lastWriteTime = connectTime;
-            bool         skipContinuation = servMgr->flags.get("startPlayingFromKeyFrame");
+            // タイムシフト中は遅れているのが当たり前なので追い付かせない。
+            bool         catchUp = !timeShift && servMgr->flags[ServMgr::F_catchUpLaggingListeners];
 
             while ((thread.active()) && sock->active())
             {
-                ch = chanMgr->findChannelByID(chanID);
+                ch = refreshChannel(ch);
                 if (!ch)
                 {
                     throw StreamException("Channel not found");
@@ -1819,50 +2152,518 @@ void Servent::sendRawChannel(bool sendHead, bool sendData)
                     LOG_DEBUG("sendRaw got new stream index %u", streamIndex);
                 }
 
-                ChanPacket rawPack;
+                catchUpStream(ch, catchUp);
+
+                // バッファーより古い所はアーカイブから読む。
+                ChanPacket archived;
+                while (timeShift && thread.active() && sock->active() &&
+                       ch->rawData.findArchivedPacket(streamPos, archived))
+                {
+                    out.write(archived.data, archived.len);
+                    lastWriteTime = sys->getTime();
+                    throttle(bsock, archived.len);
+                    streamPos = archived.pos + archived.len;
+                }
+
+                unsigned int serial = ch->rawData.getWriteSerial();
+                std::shared_ptr<const ChanPacketSlab> rawPack;
                 while (ch->rawData.findPacket(streamPos, rawPack))
                 {
-                    if (syncPos != rawPack.sync)
-                        LOG_ERROR("Send skip: %d", rawPack.sync-syncPos);
-                    syncPos = rawPack.sync + 1;
+                    unsigned int expected = syncPos;
+                    if (pacer.checkSync(syncPos, rawPack->sync))
+                    {
+                        LOG_ERROR("Send skip: %d", rawPack->sync-expected);
+                        ch->numSkips++;
+                    }
 
-                    if ((rawPack.type == ChanPacket::T_DATA) || (rawPack.type == ChanPacket::T_HEAD))
+                    if ((rawPack->type == ChanPacket::T_DATA) || (rawPack->type == ChanPacket::T_HEAD))
                     {
-                        if (!skipContinuation || !rawPack.cont)
+                        if (!skipContinuation || !rawPack->cont)
                         {
                             skipContinuation = false;
-                            rawPack.writeRaw(bsock);
+                            if (chunkedOutput)
+                                chunker.write(rawPack->data, rawPack->len);
+                            else if (webSocketOutput)
+                                framer.writeRef(rawPack->data, rawPack->len, rawPack);
+                            else
+                                bsock.writeRef(rawPack->data, rawPack->len, rawPack);
                             lastWriteTime = sys->getTime();
+                            packetSent(*rawPack);
+                            // 低遅延モードではパケットごとに送り出す。
+                            if (ch->info.lowLatency)
+                                bsock.flush();
+                            throttle(bsock, rawPack->len);
                         }else
                         {
                             LOG_DEBUG("raw: skip continuation %s packet pos=%u",
-                                      (rawPack.type == ChanPacket::T_DATA) ? "DATA" : "HEAD",
-                                      rawPack.pos);
+                                      (rawPack->type == ChanPacket::T_DATA) ? "DATA" : "HEAD",
+                                      rawPack->pos);
                         }
                     }
 
-                    if (rawPack.pos < streamPos)
-                        LOG_DEBUG("raw: skip back %d", rawPack.pos - streamPos);
-                    streamPos = rawPack.pos + rawPack.len;
+                    if (rawPack->pos < streamPos)
+                        LOG_DEBUG("raw: skip back %d", rawPack->pos - streamPos);
+                    streamPos = rawPack->pos + rawPack->len;
                 }
 
                 if ((sys->getTime() - lastWriteTime) > DIRECT_WRITE_TIMEOUT)
                     throw TimeoutException();
 
                 bsock.flush();
-                sys->sleep(200);
-                //sys->sleepIdle();
+                // 次のパケットが書き込まれるまで待つ。
+                ch->rawData.waitForWrite(serial, 200);
+            }
+
+            if (chunkedOutput)
+            {
+                chunker.close();
+                bsock.flush();
+            }else if (webSocketOutput)
+            {
+                framer.close();
+                bsock.flush();
+            }
+        }
+    }catch (StreamException &e)
+    {
+        LOG_ERROR("Stream channel: %s", e.msg);
+    }
+}
+
+// -----------------------------------
+// チャンネルに一つある AACExtractor が作った ADTS を送る。取り込みは
+// 聴取者のうち誰かが update した時に一度だけ行われ、他の聴取者は出来た
+// チャンクを読むだけになる。
+void Servent::sendAudioOnlyChannel()
+{
+    ThreadPool::promote();
+
+    WriteBufferedStream bsock(sock.get());
+    Chunker chunker(bsock);
+    Stream& out = chunkedOutput ? static_cast<Stream&>(chunker) : bsock;
+
+    try
+    {
+        sock->setWriteTimeout(DIRECT_WRITE_TIMEOUT*1000);
+
+        auto ch = chanMgr->findChannelByID(chanID);
+        if (!ch)
+            throw StreamException("Channel not found");
+        if (ch->info.contentType != ChanInfo::T_FLV)
+            throw StreamException("Not an FLV channel");
+
+        LOG_DEBUG("Starting audio-only stream of %s", ch->info.name.cstr());
+        setLowLatency(ch);
+        openBandwidth();
+
+        auto aac = ch->getAACExtractor();
+        aac->update(ch);
+        unsigned int pos = aac->joinPosition();
+        unsigned int lastWriteTime = sys->getTime();
+
+        std::vector<AACExtractor::Chunk> chunks;
+        while (thread.active() && sock->active())
+        {
+            ch = refreshChannel(ch);
+            if (!ch)
+                throw StreamException("Channel not found");
+
+            unsigned int serial = ch->rawData.getWriteSerial();
+            aac->update(ch);
+
+            chunks.clear();
+            aac->read(pos, chunks);
+            for (auto& chunk : chunks)
+            {
+                out.write(chunk->data(), (int) chunk->size());
+                lastWriteTime = sys->getTime();
+                throttle(bsock, chunk->size());
+            }
+
+            if ((sys->getTime() - lastWriteTime) > DIRECT_WRITE_TIMEOUT)
+                throw TimeoutException();
+
+            bsock.flush();
+            ch->rawData.waitForWrite(serial, 200);
+        }
+
+        if (chunkedOutput)
+        {
+            chunker.close();
+            bsock.flush();
+        }
+    }catch (StreamException &e)
+    {
+        LOG_ERROR("Stream channel: %s", e.msg);
+    }
+}
+
+// -----------------------------------
+// 新しい視聴者に、ヘッダーとキーフレームからの手持ちのパケットを一度の
+// ベクター書き込みで送る。帯域の割り当ては送った後で待つ。
+void Servent::sendJoinBurst(std::shared_ptr<Channel> ch, bool& skipContinuation)
+{
+    WriteBufferedStream burst(sock.get(), INT_MAX);
+
+    auto head = std::make_shared<std::string>(ch->headPack.data, ch->headPack.len);
+    burst.writeRef(head->data(), (int) head->size(), head);
+    streamPos = ch->headPack.pos + ch->headPack.len;
+    auto ncpos = ch->rawData.getNonContinuationPos(chanMgr->joinKeyFramesBack);
+    if (ncpos && streamPos < ncpos)
+        streamPos = ncpos;
+
+    size_t bytes = 0;
+    std::shared_ptr<const ChanPacketSlab> rawPack;
+    while (burst.pendingBytes() < MAX_JOIN_BURST && ch->rawData.findPacket(streamPos, rawPack))
+    {
+        pacer.checkSync(syncPos, rawPack->sync);
+
+        if ((rawPack->type == ChanPacket::T_DATA) || (rawPack->type == ChanPacket::T_HEAD))
+        {
+            if (!skipContinuation || !rawPack->cont)
+            {
+                skipContinuation = false;
+                burst.writeRef(rawPack->data, rawPack->len, rawPack);
+                packetSent(*rawPack);
+                bytes += rawPack->len;
             }
         }
+        streamPos = rawPack->pos + rawPack->len;
+    }
+
+    burst.flush();
+    LOG_DEBUG("Sent %d bytes header and %d bytes join burst", ch->headPack.len, (int) bytes);
+    throttle(burst, bytes);
+}
+
+// -----------------------------------
+// リアクターが使えれば、ストリームの送信をリアクターに任せる準備をし
+// て true を返す。
+bool Servent::prepareReactorStream()
+{
+    auto reactor = servMgr->getReactor(chanID);
+    if (!reactor)
+        return false;
+
+    try
+    {
+        sock->getDescriptor();
+    }catch (NotImplementedException&)
+    {
+        return false;
+    }
+
+    auto ch = chanMgr->findChannelByID(chanID);
+    if (!ch)
+        throw StreamException("Channel not found");
+
+    LOG_DEBUG("Starting Raw stream of %s at %d (reactor)", ch->info.name.cstr(), streamPos);
+
+    std::unique_ptr<ReactorStream> rs(new ReactorStream());
+    rs->reactor = reactor;
+    rs->head.assign(ch->headPack.data, ch->headPack.len);
+    streamPos = ch->headPack.pos + ch->headPack.len;
+    auto ncpos = ch->rawData.getNonContinuationPos(chanMgr->joinKeyFramesBack);
+    if (ncpos && streamPos < ncpos)
+        streamPos = ncpos;
+    rs->streamIndex = ch->streamIndex;
+    rs->skipContinuation = servMgr->flags[ServMgr::F_startPlayingFromKeyFrame];
+    rs->catchUp = servMgr->flags[ServMgr::F_catchUpLaggingListeners];
+
+    std::lock_guard<ProfiledMutex> cs(lock);
+    reactorStream = std::move(rs);
+    openBandwidth();
+    return true;
+}
+
+// -----------------------------------
+// prepareReactorStream で準備したストリームをリアクターに登録する。以
+// 後このサーバントはリアクターのハンドラーが受け持つ。
+bool Servent::startReactorStream()
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+
+    if (!reactorStream)
+        return false;
+
+    auto ch = chanMgr->findChannelByID(chanID);
+    if (!ch || !thread.active() || !sock || !sock->active())
+    {
+        reactorStream = nullptr;
+        return false;
+    }
+
+    auto& rs = *reactorStream;
+    setLowLatency(ch);
+    tuneSendBuffer(ch);
+    rs.lastWriteTime = sys->getTime();
+    rs.events = Reactor::EV_WRITE;
+    rs.id = rs.reactor->add(sock->getDescriptor(), rs.events,
+                            [this](int events) { onReactorEvent(events); });
+    listenReactorStream(ch);
+    return true;
+}
+
+// -----------------------------------
+// チャンネルにパケットが書き込まれたらハンドラーが呼ばれるようにする。
+void Servent::listenReactorStream(std::shared_ptr<Channel> ch)
+{
+    auto& rs = *reactorStream;
+
+    if (rs.channel)
+        rs.channel->rawData.removeWriteListener(rs.listener);
+
+    std::weak_ptr<Reactor> weak = rs.reactor;
+    uint64_t id = rs.id;
+    rs.channel = ch;
+    rs.listener = ch->rawData.addWriteListener([weak, id]()
+                                               {
+                                                   auto reactor = weak.lock();
+                                                   if (reactor)
+                                                       reactor->post(id);
+                                               });
+}
+
+// -----------------------------------
+void Servent::onReactorEvent(int events)
+{
+    std::lock_guard<ProfiledMutex> cs(lock);
+
+    if (!reactorStream)
+        return;
+    auto& rs = *reactorStream;
+
+    try
+    {
+        if (!thread.active() || !sock || !sock->active())
+            throw StreamException("Stream aborted");
+
+        if (events & Reactor::EV_ERROR)
+            throw SockException("Closed on write");
+
+        auto ch = refreshChannel(rs.channel);
+        if (!ch)
+            throw StreamException("Channel not found");
+        if (ch != rs.channel)
+            listenReactorStream(ch);
+
+        fillReactorStream(ch);
+        flushReactorStream();
+
+        if ((sys->getTime() - rs.lastWriteTime) > DIRECT_WRITE_TIMEOUT)
+            throw TimeoutException();
+
+        // 送り切れなかった時だけ書き込み可能になるのを待つ。帯域を使い
+        // 切った時は、次のパケットが来るのを待つ。
+        int want = (!rs.throttled && (rs.pending || !rs.head.empty())) ? Reactor::EV_WRITE : 0;
+        if (want != rs.events)
+        {
+            rs.events = want;
+            rs.reactor->modify(rs.id, want);
+        }
     }catch (StreamException &e)
     {
         LOG_ERROR("Stream channel: %s", e.msg);
+        finishReactorStream();
+    }
+}
+
+// -----------------------------------
+// 低遅延モードのチャンネルでは、小さなパケットの送信が遅れないように
+// Nagle アルゴリズムを止める。
+void Servent::setLowLatency(std::shared_ptr<Channel> ch)
+{
+    if (!ch->info.lowLatency)
+        return;
+
+    try
+    {
+        sock->setNagle(false);
+    }catch (GeneralException &e)
+    {
+        LOG_DEBUG("setNagle: %s", e.msg);
+    }
+}
+
+// -----------------------------------
+// 送信バッファーをビットレートと RTT に見合った大きさにして、詰まった
+// 分がカーネルでなくこちらに残るようにする。
+void Servent::tuneSendBuffer(std::shared_ptr<Channel> ch)
+{
+    if (servMgr->flags[ServMgr::F_bbrCongestion])
+    {
+        try
+        {
+            sock->setCongestionControl("bbr");
+        }catch (GeneralException &e)
+        {
+            LOG_DEBUG("setCongestionControl: %s", e.msg);
+        }
+    }
+
+    if (!servMgr->flags[ServMgr::F_tuneSendBuffers])
+        return;
+
+    ClientSocket::TransportInfo info;
+    sock->getTransportInfo(info);
+
+    auto t = SendTuning::compute((outputProtocol == ChanInfo::SP_PCP) ? SendTuning::C_RELAY : SendTuning::C_DIRECT,
+                                 ch->getBitrate(), info.rttUsec, ch->info.lowLatency);
+    try
+    {
+        sock->setSendBufferSize(t.sendBufferSize);
+        sock->setNotSentLowWatermark(t.notSentLowat);
+        LOG_DEBUG("Send buffer %d, not-sent low watermark %d (rtt %u us)", t.sendBufferSize, t.notSentLowat, info.rttUsec);
+    }catch (GeneralException &e)
+    {
+        LOG_DEBUG("tuneSendBuffer: %s", e.msg);
+    }
+}
+
+// -----------------------------------
+// ch がまだ生きていればそのまま返し、終了していれば chanID で探し直
+// す。送信ループで毎回 ChanMgr を引かないようにするため。
+std::shared_ptr<Channel> Servent::refreshChannel(std::shared_ptr<Channel> ch)
+{
+    if (ch && !ch->closed)
+        return ch;
+    return chanMgr->findChannelByID(chanID);
+}
+
+// -----------------------------------
+// 遅れを記録し、遅れすぎていれば最新のキーフレームまで進める。
+void Servent::catchUpStream(std::shared_ptr<Channel> ch, bool catchUp)
+{
+    unsigned int pos = pacer.update(ch->rawData, streamPos, catchUp);
+    if (pos != streamPos)
+    {
+        LOG_INFO("Listener lagging, skipping %u bytes to keyframe at %u", pos - streamPos, pos);
+        streamPos = pos;
+    }
+}
+
+// -----------------------------------
+// sendRawChannel と同じ規則で送信するパケットをキューに積む。
+void Servent::fillReactorStream(std::shared_ptr<Channel> ch)
+{
+    auto& rs = *reactorStream;
+
+    if (rs.streamIndex != ch->streamIndex)
+    {
+        rs.streamIndex = ch->streamIndex;
+        streamPos = ch->headPack.pos;
+        LOG_DEBUG("sendRaw got new stream index %u", rs.streamIndex);
+    }
+
+    // 送信待ちが残っている間は、まだ遅れを判断しない。
+    if (rs.pending == 0)
+        catchUpStream(ch, rs.catchUp);
+
+    std::shared_ptr<const ChanPacketSlab> rawPack;
+    while (rs.pending < REACTOR_MAX_PENDING && ch->rawData.findPacket(streamPos, rawPack))
+    {
+        unsigned int expected = syncPos;
+        if (pacer.checkSync(syncPos, rawPack->sync))
+            LOG_ERROR("Send skip: %d", rawPack->sync-expected);
+
+        if ((rawPack->type == ChanPacket::T_DATA) || (rawPack->type == ChanPacket::T_HEAD))
+        {
+            if (!rs.skipContinuation || !rawPack->cont)
+            {
+                rs.skipContinuation = false;
+                if (rawPack->len > 0)
+                {
+                    rs.pending += rawPack->len;
+                    rs.packets.push_back(rawPack);
+                }
+            }else
+            {
+                LOG_DEBUG("raw: skip continuation %s packet pos=%u",
+                          (rawPack->type == ChanPacket::T_DATA) ? "DATA" : "HEAD",
+                          rawPack->pos);
+            }
+        }
+
+        if (rawPack->pos < streamPos)
+            LOG_DEBUG("raw: skip back %d", rawPack->pos - streamPos);
+        streamPos = rawPack->pos + rawPack->len;
+    }
+}
+
+// -----------------------------------
+// ブロックせずに書ける分だけ送る。
+void Servent::flushReactorStream()
+{
+    auto& rs = *reactorStream;
+
+    rs.throttled = false;
+    while (!rs.head.empty() || !rs.packets.empty())
+    {
+        if (bandwidth && !g_bandwidth.ready(*bandwidth))
+        {
+            rs.throttled = true;
+            return;
+        }
+
+        std::vector<Stream::IOVec> vec;
+        if (!rs.head.empty())
+            vec.push_back({ rs.head.data(), (int) rs.head.size() });
+        for (size_t i = 0; i < rs.packets.size() && vec.size() < REACTOR_MAX_IOVECS; i++)
+        {
+            auto& pack = rs.packets[i];
+            size_t off = (i == 0) ? rs.offset : 0;
+            vec.push_back({ pack->data + off, (int) (pack->len - off) });
+        }
+
+        size_t n = sock->tryWriteVector(vec.data(), vec.size());
+        if (n == 0)
+            return;
+        rs.lastWriteTime = sys->getTime();
+        if (bandwidth)
+            g_bandwidth.consume(*bandwidth, n);
+
+        // 送った分を取り除く。
+        size_t h = std::min(n, rs.head.size());
+        rs.head.erase(0, h);
+        n -= h;
+        while (n > 0)
+        {
+            size_t rest = rs.packets.front()->len - rs.offset;
+            if (n >= rest)
+            {
+                n -= rest;
+                rs.pending -= rest;
+                packetSent(*rs.packets.front());
+                rs.packets.pop_front();
+                rs.offset = 0;
+            }else
+            {
+                rs.offset += n;
+                rs.pending -= n;
+                n = 0;
+            }
+        }
     }
 }
 
+// -----------------------------------
+void Servent::finishReactorStream()
+{
+    auto& rs = *reactorStream;
+
+    rs.reactor->remove(rs.id);
+    if (rs.channel)
+        rs.channel->rawData.removeWriteListener(rs.listener);
+
+    // reset() で reactorStream も消える。
+    kill();
+}
+
 // -----------------------------------
 void Servent::sendRawMetaChannel(int interval)
 {
+    ThreadPool::promote();
+
     try
     {
         auto ch = chanMgr->findChannelByID(chanID);
@@ -1873,15 +2674,17 @@ void Servent::sendRawMetaChannel(int interval)
 
         LOG_DEBUG("Starting Raw Meta stream of %s (metaint: %d) at %d", ch->info.name.cstr(), interval, streamPos);
 
-        String lastTitle, lastURL;
+        CompactString lastTitle, lastURL;
 
         int     lastMsgTime=sys->getTime();
         bool    showMsg=true;
 
-        char buf[16384];
-        int bufPos=0;
+        WriteBufferedStream bsock(sock.get());
+        int bufPos=0;   // 前のメタデータから送ったバイト数
 
-        if ((interval > (int) sizeof(buf)) || (interval < 1))
+        openBandwidth();
+
+        if ((interval > ChanPacket::MAX_DATALEN) || (interval < 1))
             throw StreamException("Bad ICY Meta Interval value");
 
         unsigned int connectTime = sys->getTime();
@@ -1891,31 +2694,30 @@ void Servent::sendRawMetaChannel(int interval)
 
         while ((thread.active()) && sock->active())
         {
-            ch = chanMgr->findChannelByID(chanID);
+            ch = refreshChannel(ch);
             if (!ch)
             {
                 throw StreamException("Channel not found");
             }
 
-            ChanPacket rawPack;
+            unsigned int serial = ch->rawData.getWriteSerial();
+            std::shared_ptr<const ChanPacketSlab> rawPack;
             if (ch->rawData.findPacket(streamPos, rawPack))
             {
-                if (syncPos != rawPack.sync)
-                    LOG_ERROR("Send skip: %d", rawPack.sync-syncPos);
-                syncPos = rawPack.sync+1;
-
-                MemoryStream mem(rawPack.data, rawPack.len);
+                if (syncPos != rawPack->sync)
+                    LOG_ERROR("Send skip: %d", rawPack->sync-syncPos);
+                syncPos = rawPack->sync+1;
 
-                if (rawPack.type == ChanPacket::T_DATA)
+                if (rawPack->type == ChanPacket::T_DATA)
                 {
-                    int len = rawPack.len;
-                    char *p = rawPack.data;
+                    int len = rawPack->len;
+                    const char *p = rawPack->data;
                     while (len)
                     {
                         int rl = len;
                         if ((bufPos+rl) > interval)
                             rl = interval-bufPos;
-                        memcpy(&buf[bufPos], p, rl);
+                        bsock.writeRef(p, rl, rawPack);
                         bufPos+=rl;
                         p+=rl;
                         len-=rl;
@@ -1923,7 +2725,6 @@ void Servent::sendRawMetaChannel(int interval)
                         if (bufPos >= interval)
                         {
                             bufPos = 0;
-                            sock->write(buf, interval);
                             lastWriteTime = sys->getTime();
 
                             if (chanMgr->broadcastMsgInterval)
@@ -1933,25 +2734,14 @@ void Servent::sendRawMetaChannel(int interval)
                                     lastMsgTime = sys->getTime();
                                 }
 
-                            String *metaTitle = &ch->info.track.title;
+                            CompactString *metaTitle = &ch->info.track.title;
                             if (!ch->info.comment.isEmpty() && (showMsg))
                                 metaTitle = &ch->info.comment;
 
                             if (!metaTitle->isSame(lastTitle) || !ch->info.url.isSame(lastURL))
                             {
-                                char tmp[1024];
-                                String title, url;
-
-                                title = *metaTitle;
-                                url = ch->info.url;
-
-                                title.convertTo(String::T_META);
-                                url.convertTo(String::T_META);
-
-                                sprintf(tmp, "StreamTitle='%s';StreamUrl='%s';", title.cstr(), url.cstr());
-                                int len = ((strlen(tmp) + 15+1) / 16);
-                                sock->writeChar(len);
-                                sock->write(tmp, len*16);
+                                auto block = ch->getIcyMetaBlock(*metaTitle, ch->info.url);
+                                bsock.writeRef(block->data(), (int) block->size(), block);
 
                                 lastTitle = *metaTitle;
                                 lastURL = ch->info.url;
@@ -1959,18 +2749,21 @@ void Servent::sendRawMetaChannel(int interval)
                                 LOG_DEBUG("StreamTitle: %s, StreamURL: %s", lastTitle.cstr(), lastURL.cstr());
                             }else
                             {
-                                sock->writeChar(0);
+                                bsock.writeChar(0);
                             }
                         }
                     }
+                    throttle(bsock, rawPack->len);
                 }
-                streamPos = rawPack.pos + rawPack.len;
+                streamPos = rawPack->pos + rawPack->len;
             }
 
             if ((sys->getTime()-lastWriteTime) > DIRECT_WRITE_TIMEOUT)
                 throw TimeoutException();
 
-            sys->sleepIdle();
+            bsock.flush();
+            if (!rawPack)
+                ch->rawData.waitForWrite(serial, 200);
         }
     }catch (StreamException &e)
     {
@@ -1978,9 +2771,202 @@ void Servent::sendRawMetaChannel(int interval)
     }
 }
 
+// -----------------------------------
+// PCP_CHAN_PKT_DATA アトムを書き込む。ペイロードはコピーせずに送る。
+static void writePacketDataAtom(WriteBufferedStream &out, const std::shared_ptr<const ChanPacketSlab> &pack)
+{
+    out.writeID4(PCP_CHAN_PKT_DATA);
+    out.writeInt(pack->len);
+    out.writeRef(pack->data, pack->len, pack);
+}
+
+// -----------------------------------
+BandwidthScheduler::CLASS Servent::bandwidthClass()
+{
+    if (isPrivate())
+        return BandwidthScheduler::C_LOCAL;
+    else if (type == T_RELAY)
+        return BandwidthScheduler::C_RELAY;
+    else
+        return BandwidthScheduler::C_DIRECT;
+}
+
+// -----------------------------------
+void Servent::openBandwidth()
+{
+    if (servMgr->flags[ServMgr::F_bandwidthScheduling])
+        bandwidth = g_bandwidth.open(bandwidthClass(), chanID);
+    else
+        bandwidth = nullptr;
+}
+
+// -----------------------------------
+void Servent::throttle(WriteBufferedStream& out, size_t bytes)
+{
+    if (!bandwidth)
+        return;
+
+    unsigned int ms = g_bandwidth.consume(*bandwidth, bytes);
+    if (ms)
+    {
+        out.flush();
+        sys->sleep(ms);
+    }
+}
+
+// -----------------------------------
+void Servent::packetSent(const ChanPacketSlab& pack)
+{
+    pacer.sent(pack.time);
+    if (pack.trace.id)
+        g_packetTracer.sent(chanID, pack, getHost().str());
+}
+
+// -----------------------------------
+void Servent::writePCPChannelHeader(AtomStream& atom, std::shared_ptr<Channel> ch, bool withHead, unsigned int& pos)
+{
+    atom.writeParent(PCP_CHAN, 3 + ((withHead)?1:0));
+        atom.writeBytes(PCP_CHAN_ID, ch->info.id.id, 16);
+        ch->info.writeInfoAtoms(atom);
+        ch->info.writeTrackAtoms(atom);
+        if (withHead)
+        {
+            atom.writeParent(PCP_CHAN_PKT, 3);
+                atom.writeID4(PCP_CHAN_PKT_TYPE, PCP_CHAN_PKT_HEAD);
+                atom.writeInt(PCP_CHAN_PKT_POS, ch->headPack.pos);
+                atom.writeBytes(PCP_CHAN_PKT_DATA, ch->headPack.data, ch->headPack.len);
+
+            pos = ch->headPack.pos+ch->headPack.len;
+            LOG_DEBUG("Sent %d bytes header", ch->headPack.len);
+        }
+}
+
+// -----------------------------------
+int Servent::sendPCPPackets(WriteBufferedStream& bsock, AtomStream& atom, std::shared_ptr<Channel> ch,
+                            unsigned int& pos, int maxBytes)
+{
+    const GnuID& id = ch->info.id;
+    const bool primary = id.isSame(chanID);
+    int sent = 0;
+    std::shared_ptr<const ChanPacketSlab> rawPack;
+
+    // FIXME: ストリームインデックスの変更を確かめずにどんどん読み出して大丈夫？
+    while (sent < maxBytes && ch->rawData.findPacket(pos, rawPack))
+    {
+        const char *frame;
+        int frameLen;
+        if (rawPack->pcpFrame(id, frame, frameLen))
+        {
+            // チャンネルで一度だけ組み立てたアトムをそのまま送る。
+            bsock.writeRef(frame, frameLen, rawPack);
+        }else if (rawPack->type == ChanPacket::T_HEAD)
+        {
+            atom.writeParent(PCP_CHAN, 2);
+                atom.writeBytes(PCP_CHAN_ID, id.id, 16);
+                atom.writeParent(PCP_CHAN_PKT, 3);
+                    atom.writeID4(PCP_CHAN_PKT_TYPE, PCP_CHAN_PKT_HEAD);
+                    atom.writeInt(PCP_CHAN_PKT_POS, rawPack->pos);
+                    writePacketDataAtom(bsock, rawPack);
+        }else if (rawPack->type == ChanPacket::T_DATA)
+        {
+            const bool traced = rawPack->trace.id != 0;
+            atom.writeParent(PCP_CHAN, 2);
+                atom.writeBytes(PCP_CHAN_ID, id.id, 16);
+                atom.writeParent(PCP_CHAN_PKT, 3 + (rawPack->cont ? 1 : 0) + (traced ? 1 : 0));
+                    atom.writeID4(PCP_CHAN_PKT_TYPE, PCP_CHAN_PKT_DATA);
+                    atom.writeInt(PCP_CHAN_PKT_POS, rawPack->pos);
+                    if (rawPack->cont)
+                        atom.writeChar(PCP_CHAN_PKT_CONTINUATION, true);
+                    if (traced)
+                        PacketTracer::writeTraceAtom(atom, *rawPack);
+                    writePacketDataAtom(bsock, rawPack);
+        }
+
+        if (rawPack->pos < pos)
+            LOG_DEBUG("pcp: skip back %d", rawPack->pos-pos);
+
+        //LOG_DEBUG("Sending %d-%d (%d, %d, %d)", rawPack->pos, rawPack->pos+rawPack->len, ch->streamPos, ch->rawData.getLatestPos(), ch->rawData.getOldestPos());
+
+        pos = rawPack->pos + rawPack->len;
+        sent += rawPack->len;
+        if (primary)
+            packetSent(*rawPack);
+        if (ch->info.lowLatency)
+            bsock.flush();
+        throttle(bsock, rawPack->len);
+
+        // 溜まったストリームを送り切るまで制御用のパケットを待た
+        // せない。
+        if (pcpStream->hasPendingOutput())
+            pcpStream->writePending(bsock, PCPStream::MAX_WRITE_BATCH);
+    }
+    return sent;
+}
+
+// -----------------------------------
+void Servent::handleMuxRequest(std::vector<MuxChannel>& subs, bool subscribe, const GnuID& id, unsigned int pos)
+{
+    if (!subscribe)
+    {
+        LOG_INFO("PCP mux: %s unsubscribed", id.str().c_str());
+        removeMuxChannel(subs, id, false);
+        return;
+    }
+
+    for (auto& sub : subs)
+        if (sub.id.isSame(id))
+            return;
+
+    StreamRequestDenialReason reason;
+    auto ch = chanMgr->findChannelByID(id);
+    if (id.isSame(chanID) || !canStream(ch, &reason))
+    {
+        LOG_INFO("PCP mux: refusing %s", id.str().c_str());
+        removeMuxChannel(subs, id, true);
+        return;
+    }
+
+    LOG_INFO("PCP mux: %s subscribed at %u", id.str().c_str(), pos);
+    subs.push_back({ id, pos, ch->streamIndex, false });
+    {
+        std::lock_guard<ProfiledMutex> cs(lock);
+        muxChannels.push_back(id);
+    }
+    servMgr->addMuxRoute(this, id);
+}
+
+// -----------------------------------
+void Servent::removeMuxChannel(std::vector<MuxChannel>& subs, const GnuID& id, bool notify)
+{
+    subs.erase(std::remove_if(subs.begin(), subs.end(),
+                              [&](const MuxChannel& sub) { return sub.id.isSame(id); }),
+               subs.end());
+    {
+        std::lock_guard<ProfiledMutex> cs(lock);
+        muxChannels.erase(std::remove_if(muxChannels.begin(), muxChannels.end(),
+                                         [&](const GnuID& c) { return c.isSame(id); }),
+                          muxChannels.end());
+    }
+    servMgr->removeMuxRoute(this, id);
+
+    if (notify)
+    {
+        ChanPacket pack;
+        MemoryStream mem(pack.data, sizeof(pack.data));
+        AtomStream atom(mem);
+        atom.writeParent(PCP_MUX_UNSUB, 1);
+            atom.writeBytes(PCP_CHAN_ID, id.id, 16);
+        pack.len = mem.pos;
+        pack.type = ChanPacket::T_PCP;
+        pcpStream->sendPacket(pack, GnuID());
+    }
+}
+
 // -----------------------------------
 void Servent::sendPCPChannel()
 {
+    ThreadPool::promote();
+
     auto ch = chanMgr->findChannelByID(chanID);
     if (!ch)
         throw StreamException("Channel not found");
@@ -1991,30 +2977,82 @@ void Servent::sendPCPChannel()
     pcpStream = new PCPStream(remoteID);
     int error=0;
 
+    // 下流からのアトムは別のスレッドで読み、このスレッドは送信だけを
+    // 行う。SSL のソケットは読み書きを同時にできないので分けない。
+    const bool split = servMgr->flags[ServMgr::F_splitPCPRelays] &&
+        !std::dynamic_pointer_cast<SslClientSocket>(sock);
+
+    // 相乗りしているチャンネル。このスレッドからしか触らない。受信を分
+    // けている時は、要求を muxRequests に積んでもらって送信の合間に受
+    // け付ける。
+    std::vector<MuxChannel> muxSubs;
+    std::mutex muxLock;
+    std::vector<std::tuple<bool, GnuID, unsigned int>> muxRequests;
+    if (muxOutput)
+        pcpStream->muxHandler = [this, split, &muxSubs, &muxLock, &muxRequests](bool subscribe, const GnuID& id, unsigned int pos)
+        {
+            if (split)
+            {
+                std::lock_guard<std::mutex> cs(muxLock);
+                muxRequests.emplace_back(subscribe, id, pos);
+            }else
+                handleMuxRequest(muxSubs, subscribe, id, pos);
+        };
+    Defer muxCleanup([this, &muxSubs]()
+    {
+        while (!muxSubs.empty())
+            removeMuxChannel(muxSubs, muxSubs.back().id, false);
+    });
+
+    std::atomic<bool> stopReading(false);
+    std::atomic<int> readError(0);
+    std::thread reader;
+    if (split)
+        reader = std::thread([this, &stopReading, &readError]()
+        {
+            sys->setThreadName(String::format("PCP READ %s", sock->host.str(true).c_str()));
+            BroadcastState bcs;
+            std::string buf;
+            try
+            {
+                while (!stopReading && thread.active())
+                {
+                    if (!sock->readReady(100))
+                        continue;
+                    int e = pcpStream->readAvailable(*sock, buf, bcs);
+                    if (e)
+                    {
+                        readError = e;
+                        break;
+                    }
+                }
+            }catch (StreamException &e)
+            {
+                LOG_ERROR("PCP reader: %s", e.msg);
+                readError = PCP_ERROR_READ;
+            }
+        });
+    Defer stopReader([&stopReading, &reader]()
+    {
+        stopReading = true;
+        if (reader.joinable())
+            reader.join();
+    });
+
     try
     {
         LOG_DEBUG("Starting PCP stream of channel at %d", streamPos);
+        setLowLatency(ch);
+        tuneSendBuffer(ch);
+        openBandwidth();
 
-        atom.writeParent(PCP_CHAN, 3 + ((sendHeader)?1:0));
-            atom.writeBytes(PCP_CHAN_ID, chanID.id, 16);
-            ch->info.writeInfoAtoms(atom);
-            ch->info.writeTrackAtoms(atom);
-            if (sendHeader)
-            {
-                atom.writeParent(PCP_CHAN_PKT, 3);
-                    atom.writeID4(PCP_CHAN_PKT_TYPE, PCP_CHAN_PKT_HEAD);
-                    atom.writeInt(PCP_CHAN_PKT_POS, ch->headPack.pos);
-                    atom.writeBytes(PCP_CHAN_PKT_DATA, ch->headPack.data, ch->headPack.len);
-
-                streamPos = ch->headPack.pos+ch->headPack.len;
-                LOG_DEBUG("Sent %d bytes header", ch->headPack.len);
-            }
+        writePCPChannelHeader(atom, ch, sendHeader, streamPos);
 
         unsigned int streamIndex = ch->streamIndex;
 
         while (thread.active())
         {
-            auto ch = chanMgr->findChannelByID(chanID);
+            ch = refreshChannel(ch);
 
             if (!ch)
             {
@@ -2029,58 +3067,78 @@ void Servent::sendPCPChannel()
                 LOG_DEBUG("sendPCPStream got new stream index %u", streamIndex);
             }
 
-            ChanPacket rawPack;
+            unsigned int serial = ch->rawData.getWriteSerial();
 
-            // FIXME: ストリームインデックスの変更を確かめずにどんどん読み出して大丈夫？
-            while (ch->rawData.findPacket(streamPos, rawPack))
+            if (split)
             {
-                if (rawPack.type == ChanPacket::T_HEAD)
+                if (readError)
                 {
-                    atom.writeParent(PCP_CHAN, 2);
-                        atom.writeBytes(PCP_CHAN_ID, chanID.id, 16);
-                        atom.writeParent(PCP_CHAN_PKT, 3);
-                            atom.writeID4(PCP_CHAN_PKT_TYPE, PCP_CHAN_PKT_HEAD);
-                            atom.writeInt(PCP_CHAN_PKT_POS, rawPack.pos);
-                            atom.writeBytes(PCP_CHAN_PKT_DATA, rawPack.data, rawPack.len);
-                }else if (rawPack.type == ChanPacket::T_DATA)
+                    error = readError;
+                    throw StreamException("PCP exception");
+                }
+
+                decltype(muxRequests) requests;
                 {
-                    if (rawPack.cont)
-                    {
-                        atom.writeParent(PCP_CHAN, 2);
-                            atom.writeBytes(PCP_CHAN_ID, chanID.id, 16);
-                            atom.writeParent(PCP_CHAN_PKT, 4);
-                                atom.writeID4(PCP_CHAN_PKT_TYPE, PCP_CHAN_PKT_DATA);
-                                atom.writeInt(PCP_CHAN_PKT_POS, rawPack.pos);
-                                atom.writeChar(PCP_CHAN_PKT_CONTINUATION, true);
-                                atom.writeBytes(PCP_CHAN_PKT_DATA, rawPack.data, rawPack.len);
-                    }else
-                    {
-                        atom.writeParent(PCP_CHAN, 2);
-                            atom.writeBytes(PCP_CHAN_ID, chanID.id, 16);
-                            atom.writeParent(PCP_CHAN_PKT, 3);
-                                atom.writeID4(PCP_CHAN_PKT_TYPE, PCP_CHAN_PKT_DATA);
-                                atom.writeInt(PCP_CHAN_PKT_POS, rawPack.pos);
-                                atom.writeBytes(PCP_CHAN_PKT_DATA, rawPack.data, rawPack.len);
-                    }
+                    std::lock_guard<std::mutex> cs(muxLock);
+                    requests.swap(muxRequests);
                 }
+                for (auto& r : requests)
+                    handleMuxRequest(muxSubs, std::get<0>(r), std::get<1>(r), std::get<2>(r));
+            }
 
-                if (rawPack.pos < streamPos)
-                    LOG_DEBUG("pcp: skip back %d", rawPack.pos-streamPos);
+            // 相乗りしているチャンネルがあれば、どのチャンネルも一巡り
+            // に MUX_QUANTUM までにして順に送る。
+            const int quantum = muxSubs.empty() ? INT_MAX : MUX_QUANTUM;
+            bool more = sendPCPPackets(bsock, atom, ch, streamPos, quantum) >= quantum;
+
+            for (size_t i = 0; i < muxSubs.size(); )
+            {
+                auto& sub = muxSubs[i];
+                auto sch = chanMgr->findChannelByID(sub.id);
+                if (!sch || !sch->isPlaying())
+                {
+                    LOG_INFO("PCP mux: %s is no longer playing", sub.id.str().c_str());
+                    removeMuxChannel(muxSubs, sub.id, true);
+                    continue;
+                }
 
-                //LOG_DEBUG("Sending %d-%d (%d, %d, %d)", rawPack.pos, rawPack.pos+rawPack.len, ch->streamPos, ch->rawData.getLatestPos(), ch->rawData.getOldestPos());
+                if (!sub.started)
+                {
+                    writePCPChannelHeader(atom, sch, sch->headPack.len > 0, sub.pos);
+                    sub.streamIndex = sch->streamIndex;
+                    sub.started = true;
+                }else if (sub.streamIndex != sch->streamIndex)
+                {
+                    sub.streamIndex = sch->streamIndex;
+                    sub.pos = sch->headPack.pos;
+                }
 
-                streamPos = rawPack.pos + rawPack.len;
+                if (sendPCPPackets(bsock, atom, sch, sub.pos, MUX_QUANTUM) >= MUX_QUANTUM)
+                    more = true;
+                i++;
             }
-            bsock.flush();
+            if (split)
+            {
+                // 下流に送る制御用のパケットも同じバッファーに並べる。
+                error = pcpStream->writeOutput(bsock);
+                bsock.flush();
+                if (error)
+                    throw StreamException("PCP exception");
+            }else
+            {
+                bsock.flush();
 
-            BroadcastState bcs;
-            // どうしてここで bsock を使ったら動かないのか理解していない。
-            error = pcpStream->readPacket(*sock, bcs);
-            if (error)
-                throw StreamException("PCP exception");
+                BroadcastState bcs;
+                // どうしてここで bsock を使ったら動かないのか理解していない。
+                error = pcpStream->readPacket(*sock, bcs);
+                if (error)
+                    throw StreamException("PCP exception");
+            }
 
-            sys->sleep(200);
-            //sys->sleepIdle();
+            // 相乗りしているチャンネルのパケットはこのチャンネルの書き込
+            // みを待つ間にも届くので、あまり長く待たない。
+            if (!more)
+                ch->rawData.waitForWrite(serial, muxSubs.empty() ? 200 : 50);
         }
 
         LOG_DEBUG("PCP channel stream closed normally.");
@@ -2089,6 +3147,10 @@ void Servent::sendPCPChannel()
         LOG_ERROR("Stream channel: %s", e.msg);
     }
 
+    // 引き継ぐ接続は新しいプロセスがそのまま続ける。
+    if (handingOff)
+        return;
+
     try
     {
         atom.writeInt(PCP_QUIT, error);
@@ -2135,6 +3197,20 @@ int Servent::serverProc(ThreadInfo *thread)
             }
 
             LOG_TRACE("accepted incoming");
+
+            // 多すぎる接続はサーバントを割り当てずに断る。
+            if (servMgr->flags[ServMgr::F_admissionControl])
+            {
+                auto d = g_admission.admit(cs->host.ip, servMgr->numUsed(T_INCOMING), sys->getMonotonicTime());
+                if (d != AdmissionControl::D_ADMIT)
+                {
+                    LOG_DEBUG("Rejected %s: %s", cs->host.ip.str().c_str(), AdmissionControl::decisionStr(d));
+                    AdmissionControl::reject(*cs);
+                    cs->close();
+                    continue;
+                }
+            }
+
             Servent *ns = servMgr->allocServent();
             if (!ns)
             {
@@ -2144,7 +3220,7 @@ int Servent::serverProc(ThreadInfo *thread)
             }
 
             servMgr->lastIncoming = sys->getTime();
-            ns->servPort = sv->sock->host.port;
+            ns->setServPort(sv->sock->host.port);
             ns->networkID = servMgr->networkID;
             ns->initIncoming(cs, sv->allow);
         }
@@ -2158,11 +3234,10 @@ int Servent::serverProc(ThreadInfo *thread)
     return 0;
 }
 
-#include "sslclientsocket.h"
 // -----------------------------------
 amf0::Value    Servent::getState()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     bool ssl = static_cast<bool>( std::dynamic_pointer_cast<SslClientSocket>(sock) );
 
@@ -2181,6 +3256,8 @@ amf0::Value    Servent::getState()
             {"remoteID", remoteID.str()},
             {"isPrivate", std::to_string(isPrivate())},
             {"ssl", ssl},
+            {"backpressure", pacer.getState()},
+            {"thread", ThreadAccount::stateOf(thread)},
         });
 }
 
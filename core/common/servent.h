@@ -21,6 +21,7 @@
 #define _SERVENT_H
 
 // ----------------------------------
+#include <functional>
 #include <stdint.h>
 
 #include "socket.h"
@@ -32,9 +33,16 @@
 #include "cgi.h" // Query
 #include "playlist.h"
 #include "varwriter.h"
+#include "reactor.h"
+#include "pacer.h"
+#include "bandwidth.h"
+#include "lockprof.h"
+
+#include <deque>
 
 class HTML;
 class AtomStream;
+class Environment;
 
 // ----------------------------------
 // Servent handles the actual connection between clients
@@ -45,7 +53,12 @@ public:
     enum
     {
         MAX_HASH = 500,     // max. amount of packet hashes Servents can store
-        MAX_OUTPACKETS = 32 // max. output packets per queue (normal/priority)
+        MAX_OUTPACKETS = 32, // max. output packets per queue (normal/priority)
+
+        KEEPALIVE_TIMEOUT = 15 * 1000,  // keep-alive で次の要求を待つミリ秒
+        MAX_KEEPALIVE_REQUESTS = 100,   // 一つの接続で処理する要求の数
+        MAX_JOIN_BURST = 4 * 1024 * 1024, // 接続直後にまとめて送るバイト数の上限
+        EVENT_HEARTBEAT_INTERVAL = 15 * 1000, // イベントが無い時にコメントを送るミリ秒
     };
 
     enum TYPE
@@ -139,13 +152,17 @@ public:
 
     static const char* fileNameToMimeType(const String& fileName);
 
-    Servent(int);
+    Servent(int, class ServMgr* mgr = nullptr);
     ~Servent();
 
     void    reset();
-    bool    initServer(Host &);
+    bool    initServer(Host &, bool reusePort = false);
     void    initIncoming(std::shared_ptr<ClientSocket>, unsigned int);
     void    initOutgoing(TYPE);
+    // 再起動前のプロセスから引き継いだストリームの接続を pos から送り
+    // 続ける (handoff.h)。
+    void    initResumed(std::shared_ptr<ClientSocket>, TYPE, ChanInfo::PROTOCOL,
+                        const GnuID& chanID, const GnuID& remoteID, unsigned int pos);
     void    initGIV(const Host &, const GnuID &);
     void    initPCP(const Host &);
 
@@ -153,6 +170,10 @@ public:
 
     //  funcs for handling status/type
     void                setStatus(STATUS);
+    // type, servPort を変える時はこれらを使うこと。ServMgr の集計に反
+    // 映される。
+    void                setType(TYPE);
+    void                setServPort(int);
     static const char   *getTypeStr(Servent::TYPE t) { return typeMsgs[t]; }
     const char          *getTypeStr() { return getTypeStr(type); }
     const char          *getStatusStr() { return statusMsgs[status]; }
@@ -173,6 +194,7 @@ public:
     static THREAD_PROC  outgoingProc(ThreadInfo *);
     static THREAD_PROC  incomingProc(ThreadInfo *);
     static THREAD_PROC  givProc(ThreadInfo *);
+    static THREAD_PROC  resumedProc(ThreadInfo *);
 
     static bool pingHost(Host &, const GnuID &);
 
@@ -180,11 +202,17 @@ public:
 
     // various types of handshaking are needed
     void handshakePLS(ChanInfo &info, HTTP& http);
+    void handshakeHLS(HTTP &http, const std::string& path);
+    void handshakeThumbnail(HTTP &http, const std::string& path);
+    void handshakeGroup(HTTP &http, const std::string& path);
  
     void    handshakeHTML(char *);
-    void    handshakeXML();
+    void    handshakeXML(HTTP &http);
     void    handshakeCMD(HTTP&, const std::string&);
     bool    handshakeAuth(HTTP &, const char *);
+    // headers と args (クエリー) が管理者のものか。Cookie 認証で読んだ
+    // クッキーは gotCookie に入れる。
+    bool    isAuthorized(const HTTPHeaders& headers, const char* args, Cookie& gotCookie);
 
     bool    handshakeHTTPBasicAuth(HTTP &http);
 
@@ -202,6 +230,17 @@ public:
     void    handshakeICY(Channel::SRC_TYPE, bool);
     void    handshakeIncoming();
     void    handshakeHTTP(HTTP &, bool);
+    // 前置きの最初の行を読んだ接続を HTTP/2 で処理する。
+    void    handshakeHTTP2();
+    // HTTP/2 の要求への応答を作る。ワーカーのスレッドで呼ばれる。
+    HTTPResponse respondHTTP2(const HTTPRequest& req);
+
+    // 応答で接続を続けると伝えるかを決めて keepAlive に入れる。
+    bool    decideKeepAlive(HTTP &http);
+    // 長さの決まった応答を送る。クライアントが望めば接続を続ける。
+    void    sendResponse(HTTP &http, const HTTPResponse& response);
+    // keep-alive の接続で次の要求行を待って http に読み込む。
+    bool    readNextRequest(HTTP &http);
     void    handshakeGET(HTTP &http);
     void    handshakePOST(HTTP &http);
     void    handshakeGIV(const char*);
@@ -211,9 +250,15 @@ public:
     void    handshakeWMHTTPPush(HTTP& http, const std::string& path);
 
     void    handshakeJRPC(HTTP &http);
+    void    handshakeEvents(HTTP &http, const char *args);
 
     void    handshakeLocalFile(const char *, HTTP& http);
+    HTTPResponse localFileResponse(const char *, const HTTPRequest& req);
+    // テンプレートのページを描く関数を返す。チャンネルを探すなどの下準
+    // 備は先に済ませ、要求が誤っていれば HTTPException。
+    std::function<void(Stream&)> prepareTemplate(const char *, const HTTPRequest& req);
     void    invokeCGIScript(HTTP &http, const char* fn);
+    bool    invokeCGIWorker(HTTP &http, const HTTPRequest& req, Environment& env);
 
     static void handshakeOutgoingPCP(AtomStream &, const Host &, GnuID &, String &, bool);
     static void handshakeIncomingPCP(AtomStream &, Host &, GnuID &, String &);
@@ -230,8 +275,58 @@ public:
 
     void    triggerChannel(char *, ChanInfo::PROTOCOL, bool);
     void    sendRawChannel(bool, bool);
+    // FLV チャンネルの AAC だけを ADTS で送る (audioOnlyOutput)。
+    void    sendAudioOnlyChannel();
+    void    sendJoinBurst(std::shared_ptr<Channel> ch, bool& skipContinuation);
     void    sendRawMetaChannel(int);
     void    sendPCPChannel();
+    // パケットを下流へ書いた後に呼ぶ。
+    void    packetSent(const ChanPacketSlab& pack);
+
+    // PCP 接続に相乗りして送っているチャンネル (pcpmux.h)。
+    struct MuxChannel
+    {
+        GnuID           id;
+        unsigned int    pos;
+        unsigned int    streamIndex;
+        bool            started;    // チャンネルの情報とヘッダーを送った
+    };
+    enum
+    {
+        // 一巡りで一つのチャンネルに送る量の上限。一つのチャンネルの遅
+        // れが他のチャンネルを待たせないようにする。
+        MUX_QUANTUM = 64 * 1024,
+    };
+    // ch のチャンネル情報とヘッダーパケットの PCP_CHAN アトムを書く。
+    // ヘッダーを送ったら pos をその後ろにする。
+    void    writePCPChannelHeader(AtomStream& atom, std::shared_ptr<Channel> ch, bool withHead, unsigned int& pos);
+    // ch のパケットを pos から maxBytes ほど送る。送ったバイト数を返す。
+    int     sendPCPPackets(WriteBufferedStream& bsock, AtomStream& atom, std::shared_ptr<Channel> ch,
+                           unsigned int& pos, int maxBytes);
+    // 相乗りの要求を受け付ける。断る時は PCP_MUX_UNSUB を返す。
+    void    handleMuxRequest(std::vector<MuxChannel>& subs, bool subscribe, const GnuID& id, unsigned int pos);
+    void    removeMuxChannel(std::vector<MuxChannel>& subs, const GnuID& id, bool notify);
+
+    // 送信帯域の割り当て。bandwidthScheduling フラグが立っていれば、ス
+    // トリームを送り始める時に開く。
+    BandwidthScheduler::CLASS bandwidthClass();
+    void    openBandwidth();
+    // bytes を送った。割り当てを超えていれば out を送り出してから待つ。
+    void    throttle(WriteBufferedStream& out, size_t bytes);
+
+    // DIRECT 接続のストリームをリアクターで送る。processStream で準備し
+    // て、incomingProc のスレッドが終わる時に引き継ぐ。
+    bool    prepareReactorStream();
+    bool    startReactorStream();
+    void    onReactorEvent(int events);
+    void    fillReactorStream(std::shared_ptr<Channel> ch);
+    void    flushReactorStream();
+    void    listenReactorStream(std::shared_ptr<Channel> ch);
+    void    catchUpStream(std::shared_ptr<Channel> ch, bool catchUp);
+    void    setLowLatency(std::shared_ptr<Channel> ch);
+    void    tuneSendBuffer(std::shared_ptr<Channel> ch);
+    std::shared_ptr<Channel> refreshChannel(std::shared_ptr<Channel> ch);
+    void    finishReactorStream();
 
     static void readICYHeader(HTTP &, ChanInfo &, char *, size_t);
     bool    canStream(std::shared_ptr<Channel>, StreamRequestDenialReason *);
@@ -246,6 +341,8 @@ public:
     void    createSocket();
     void    kill();
     void    abort();
+    // 送信を止めさせ、kill でソケットを閉じずに RestartHandoff に渡す。
+    void    beginHandoff();
     bool    isPrivate();
     bool    isLocal();
 
@@ -289,11 +386,26 @@ public:
     bool                addMetadata;
     int                 nsSwitchNum;
 
+    double              handshakeStart; // S_HANDSHAKE になった時刻
+    bool                keepAlive;      // 今の応答の後も接続を続ける
+    int                 numRequests;    // この接続で受けた要求の数
+    Arena               requestArena;   // 要求の処理中に HTTPHeaders などが確保する
+    bool                chunkedOutput;  // DIRECT 接続を chunked で送る
+    bool                webSocketOutput;// DIRECT 接続を WebSocket のメッセージで送る
+    std::string         webSocketKey;   // Sec-WebSocket-Key
+    unsigned int        timeShiftPos;   // ?pos= で求められたストリームポジション。0 は指定なし
+    unsigned int        timeShiftSeconds; // ?t= で求められた秒数。0 は指定なし
+    bool                timeShift;      // バッファーより古い所をアーカイブから送る
+    bool                audioOnlyOutput;// DIRECT 接続で FLV の音声だけを送る (/stream/<ID>.aac)
+    bool                muxOutput;      // PCP 接続で他のチャンネルも送る (pcpmux.h)
+    std::vector<GnuID>  muxChannels;    // muxOutput で相乗りしているチャンネル。lock で保護する
+
     std::atomic<unsigned int> allow;
+    std::atomic<bool>   handingOff;     // 新しいプロセスに引き継ぐ
 
     std::shared_ptr<ClientSocket> sock, pushSock;
 
-    std::recursive_mutex lock;
+    ProfiledMutex lock { "Servent::lock" };
 
     bool                sendHeader;
     unsigned int        syncPos, streamPos;
@@ -303,9 +415,48 @@ public:
 
     Servent             *next;
 
+    // このサーバントを割り当てた ServMgr。状態が変わると接続数の集計
+    // と空きリストを更新する。
+    class ServMgr       *mgr;
+
+    // 接続数の集計に入れた時の種類、チャンネル、プライベートかどうか。
+    // ServMgr::serventStatsLock で保護される。
+    bool                counted;
+    TYPE                countedType;
+    GnuID               countedChanID;
+    bool                countedPrivate;
+    int                 connectedSlot;  // ServMgr::connectedServents での位置
+    int                 routeSlot;      // ServMgr::serventRoutes での位置
+    bool                inFreeList;
+
     PCPStream           *pcpStream;
     Cookie              cookie;
 
+    // DIRECT 接続の出力の遅れ。
+    OutputPacer         pacer;
+
+    std::shared_ptr<BandwidthScheduler::Bucket> bandwidth;
+
+    // リアクターで送信している時の状態。
+    struct ReactorStream
+    {
+        std::shared_ptr<Reactor>    reactor;
+        uint64_t                    id = 0;
+        int                         events = 0;
+        std::shared_ptr<Channel>    channel;        // リスナーを登録したチャンネル
+        int                         listener = 0;
+        std::string                 head;           // 未送信のヘッダー
+        std::deque<std::shared_ptr<const ChanPacketSlab>> packets;
+        size_t                      offset = 0;     // packets.front() の送信済みバイト数
+        size_t                      pending = 0;    // packets の未送信バイト数の合計
+        unsigned int                streamIndex = 0;
+        unsigned int                lastWriteTime = 0;
+        bool                        skipContinuation = false;
+        bool                        catchUp = false;
+        bool                        throttled = false;  // 帯域の割り当てを使い切った
+    };
+    std::unique_ptr<ReactorStream> reactorStream;
+
 private:
     void CMD_add_speedtest(const char* cmd, HTTP& http, String& jumpStr);
     void CMD_apply(const char* cmd, HTTP& http, String& jumpStr);
@@ -22,6 +22,7 @@
 #include "regexp.h"
 #include "str.h"
 #include "socket.h"
+#include "resolver.h"
 
 static const Regexp IPV4_PATTERN("^\\d+\\.\\d+\\.\\d+\\.\\d+$");
 static const Regexp IPV6_PATTERN("^(([0-9a-fA-F]{1,4}:){7,7}[0-9a-fA-F]{1,4}|([0-9a-fA-F]{1,4}:){1,7}:|([0-9a-fA-F]{1,4}:){1,6}:[0-9a-fA-F]{1,4}|([0-9a-fA-F]{1,4}:){1,5}(:[0-9a-fA-F]{1,4}){1,2}|([0-9a-fA-F]{1,4}:){1,4}(:[0-9a-fA-F]{1,4}){1,3}|([0-9a-fA-F]{1,4}:){1,3}(:[0-9a-fA-F]{1,4}){1,4}|([0-9a-fA-F]{1,4}:){1,2}(:[0-9a-fA-F]{1,4}){1,5}|[0-9a-fA-F]{1,4}:((:[0-9a-fA-F]{1,4}){1,6})|:((:[0-9a-fA-F]{1,4}){1,7}|:)|[fF][eE]80:(:[0-9a-fA-F]{0,4}){0,4}%[0-9a-zA-Z]{1,}|::([fF][fF][fF][fF](:0{1,4}){0,1}:){0,1}((25[0-5]|(2[0-4]|1{0,1}[0-9]){0,1}[0-9])\\.){3,3}(25[0-5]|(2[0-4]|1{0,1}[0-9]){0,1}[0-9])|([0-9a-fA-F]{1,4}:){1,4}:((25[0-5]|(2[0-4]|1{0,1}[0-9]){0,1}[0-9])\\.){3,3}(25[0-5]|(2[0-4]|1{0,1}[0-9]){0,1}[0-9]))$");
@@ -58,7 +59,7 @@ bool ServFilter::matches(int fl, const Host& h) const
     case T_SUFFIX:
         {
             std::string str;
-            if (sys->getHostnameByAddress(h.ip, str)) {
+            if (g_resolver.reverse(h.ip, str)) {
                 return str::has_suffix(str, pattern);
             } else {
                 return false;
@@ -69,7 +70,7 @@ bool ServFilter::matches(int fl, const Host& h) const
             if (!h.ip.isIPv4Mapped())
                 return false;
 
-            uint32_t mask = (uint32_t) -1 << (32 - netmask);
+            uint32_t mask = netmask ? (uint32_t) -1 << (32 - netmask) : 0;
 
             return (host.ip.ipv4() & mask) == (h.ip.ipv4() & mask);
         }
@@ -17,6 +17,9 @@
 // GNU General Public License for more details.
 // ------------------------------------------------
 
+#ifndef _SERVFILTER_H
+#define _SERVFILTER_H
+
 #include "varwriter.h"
 #include "host.h"
 
@@ -63,6 +66,13 @@ public:
         pattern = "";
         netmask = -1;
     }
+    bool    operator ==(const ServFilter& other) const
+    {
+        return type == other.type && flags == other.flags &&
+            host.ip == other.host.ip && netmask == other.netmask &&
+            pattern == other.pattern;
+    }
+
     amf0::Value getState() override;
     bool    matches(int fl, const Host& h) const;
 
@@ -74,7 +84,11 @@ public:
     Type type;
     unsigned int flags;
 private:
+    friend class FilterEngine;
+
     Host host;
     std::string pattern;
     int netmask;
 };
+
+#endif
@@ -33,9 +33,12 @@
 #include "public.h"
 #include "assets.h"
 #include "uptest.h"
+#include "portcheck.h"
+#include "speedtest.h"
 #include "gnutella.h"
 
 #include "sstream.h"
+#include "xmlwriter.h"
 #include "defer.h"
 #include <assert.h>
 
@@ -43,6 +46,17 @@
 
 #include "chunker.h"
 #include "commands.h"
+#include "threadpool.h"
+#include "eventbus.h"
+#include "assetcache.h"
+#include "gzipencoder.h"
+#include "http2.h"
+#include "metrics.h"
+#include "hls.h"
+#include "thumbnail.h"
+#include "changroup.h"
+#include "httppush.h"
+#include "prefork.h"
 
 using namespace std;
 
@@ -114,6 +128,19 @@ int getCGIargINT(char *a)
 }
 
 // -----------------------------------
+// HTTP/1.1 なら Connection: close が無い限り、HTTP/1.0 なら
+// Connection: keep-alive がある時に接続を続ける。
+static bool wantsKeepAlive(HTTP &http)
+{
+    auto conn = str::downcase(http.headers.get("Connection"));
+    if (http.protocolVersion == "HTTP/1.1")
+        return conn != "close";
+    else
+        return conn == "keep-alive";
+}
+
+// -----------------------------------
+// /api/1 への POST を処理する。
 void Servent::handshakeJRPC(HTTP &http)
 {
     int content_length = -1;
@@ -128,7 +155,7 @@ void Servent::handshakeJRPC(HTTP &http)
     if (content_length == 0)
         throw HTTPException(HTTP_SC_BADREQUEST, 400);
 
-    unique_ptr<char> body(new char[content_length + 1]);
+    unique_ptr<char[]> body(new char[content_length + 1]);
     try {
         http.stream->read(body.get(), content_length);
         body.get()[content_length] = '\0';
@@ -139,43 +166,164 @@ void Servent::handshakeJRPC(HTTP &http)
     }
 
     JrpcApi api;
-    std::string response = api.call(body.get());
+    auto res = HTTPResponse::ok({{"Content-Type", "application/json"}}, api.call(body.get()));
+    if (servMgr->flags[ServMgr::F_gzipResponses])
+        g_gzipEncoder.compress(http.getRequest(), res);
+    sendResponse(http, res);
+}
 
-    http.writeLine(HTTP_SC_OK);
-    http.writeLineF("%s %s", HTTP_HS_SERVER, PCX_AGENT);
-    http.writeLineF("%s %zu", HTTP_HS_LENGTH, response.size());
-    http.writeLineF("%s %s", HTTP_HS_CONTENT, "application/json");
-    http.writeLine("");
+// -----------------------------------
+// g_eventBus のイベントを text/event-stream で送り続ける。args に log=1
+// があればログの行も送る。クライアントが切断するまで戻らない。
+void Servent::handshakeEvents(HTTP &http, const char *args)
+{
+    // 接続が続く間このスレッドを占有するので、プールから外す。
+    ThreadPool::promote();
+    setType(T_COMMAND);
 
-    http.write(response.c_str(), response.size());
+    cgi::Query query(args);
+    auto sub = g_eventBus.subscribe();
+
+    const bool withLog = (query.get("log") == "1");
+    unsigned int listenerID = 0;
+    if (withLog)
+    {
+        // ここで送る度にログを書くと自分に返ってくるので、このループ
+        // の中ではログを出さない。
+        listenerID = sys->logBuf->addListener(
+            [sub](unsigned int time, LogBuffer::TYPE type, const char* msg)
+            {
+                sub->push(g_eventBus.makeEvent("log", amf0::Value::object(
+                    {
+                        {"time", time},
+                        {"type", LogBuffer::getTypeStr(type)},
+                        {"message", str::valid_utf8(msg)},
+                    })));
+            });
+    }
+    Defer defer([=]() { if (withLog) sys->logBuf->removeListener(listenerID); });
+
+    http.writeResponseStatus("HTTP/1.0", 200);
+    http.writeResponseHeaders
+        ({
+            {"Content-Type", "text/event-stream; charset=utf-8"},
+            {"Cache-Control", "no-cache"},
+        });
+    // 接続が切れた時はクライアントがすぐにつなぎ直して全体を取り直す。
+    http.writeString("retry: 3000\n\n");
+
+    EventBus::Event ev;
+    while (thread.active() && sock->active())
+    {
+        if (!sub->wait(ev, EVENT_HEARTBEAT_INTERVAL))
+        {
+            // 何も無い間も書いてみて、切断を見付ける。
+            http.writeString(": ping\n\n");
+            continue;
+        }
+
+        http.writeString(str::format("id: %u\nevent: %s\ndata: %s\n\n",
+                                     ev.id, ev.type.c_str(), ev.data.c_str()));
+    }
 }
 
 // -----------------------------------
 bool Servent::hasValidAuthToken(const std::string& requestFilename)
 {
-    auto vec = str::split(requestFilename, "?");
+    auto pos = requestFilename.find('?');
+    if (pos == std::string::npos)
+        return false;
 
-    if (vec.size() != 2)
+    const std::string queryString = requestFilename.substr(pos + 1);
+    std::string token, expires;
+    if (!cgi::Query::lookup(queryString, "auth", token))
         return false;
+    cgi::Query::lookup(queryString, "expires", expires);
 
-    cgi::Query query(vec[1]);
+    auto chanid = str::upcase(requestFilename.substr(0, std::min<size_t>(pos, 32)));
+    return chanMgr->isValidAuthToken(chanid, token, expires);
+}
 
-    auto token = query.get("auth");
-    auto chanid = str::upcase(vec[0].substr(0, 32));
-    auto validToken = chanMgr->authToken(chanid);
+// -----------------------------------
+#include "subprog.h"
+#include "env.h"
+#include "regexp.h"
+#include "cgiworker.h"
 
-    if (validToken == token)
+// -----------------------------------
+// CGI スクリプトの出力のヘッダー部分を読んで headers に入れ、ステータス
+// コードを返す。
+static int readCGIHeaders(Stream& stream, HTTPHeaders& headers)
+{
+    int statusCode = 200;
+    try {
+        static const Regexp headerPattern("^([A-Za-z\\-]+):\\s*(.*)$");
+        std::string line;
+        while ((line = stream.readLine(8192)) != "")
+        {
+            LOG_DEBUG("Line: %s", line.c_str());
+            auto caps = headerPattern.exec(line);
+            if (caps.size() == 0)
+            {
+                LOG_ERROR("Invalid header: \"%s\"", line.c_str());
+                continue;
+            }
+            if (str::capitalize(caps[1]) == "Status")
+                statusCode = atoi(caps[2].c_str());
+            else
+                headers.set(caps[1], caps[2]);
+        }
+        if (headers.get("Location") != "")
+            statusCode = 302; // Found
+    } catch (StreamException&)
     {
-        return true;
+        LOG_ERROR("CGI script did not finish the headers");
+        throw HTTPException(HTTP_SC_SERVERERROR, 500);
     }
-
-    return false;
+    return statusCode;
 }
 
 // -----------------------------------
-#include "subprog.h"
-#include "env.h"
-#include "regexp.h"
+// スクリプトが cgiWorkerScripts にあれば、起動しておいたワーカーで実行
+// して応答を送る。ワーカーを使わない、使えなかった時は false。
+bool Servent::invokeCGIWorker(HTTP &http, const HTTPRequest& req, Environment& env)
+{
+    std::string name = req.path.substr(req.path.rfind('/') + 1);
+    unsigned int size;
+    {
+        std::lock_guard<ProfiledMutex> cs(servMgr->lock);
+        size = servMgr->cgiWorkers;
+        auto scripts = str::split(servMgr->cgiWorkerScripts, ",");
+        if (size == 0 || std::find(scripts.begin(), scripts.end(), name) == scripts.end())
+            return false;
+    }
+
+    if (g_cgiWorkers.size() != (int) size)
+    {
+        Environment workerEnv;
+        workerEnv.set("PATH", env.get("PATH"));
+        if (env.hasKey("SYSTEMROOT"))
+            workerEnv.set("SYSTEMROOT", env.get("SYSTEMROOT"));
+        g_cgiWorkers.setProgram((std::string) peercastApp->getPath() + "cgi-bin/worker.cgi", workerEnv);
+        g_cgiWorkers.setSize(size);
+    }
+
+    std::string output;
+    if (!g_cgiWorkers.run(env, output))
+    {
+        LOG_ERROR("CGI worker failed for `%s`; starting the script directly", name.c_str());
+        return false;
+    }
+
+    StringStream stream(output);
+    HTTPHeaders headers;
+    int statusCode = readCGIHeaders(stream, headers);
+
+    HTTPResponse res(statusCode, headers);
+    res.stream = &stream;
+    http.send(res);
+    return true;
+}
 
 void Servent::invokeCGIScript(HTTP &http, const char* fn)
 {
@@ -199,7 +347,8 @@ void Servent::invokeCGIScript(HTTP &http, const char* fn)
     env.set("REQUEST_URI", req.url);
     env.set("SERVER_PROTOCOL", "HTTP/1.0");
     env.set("SERVER_SOFTWARE", PCX_AGENT);
-    if (!Regexp("[A-Za-z0-9\\-_.]+:\\d+").exec(req.headers.get("Host")).empty())
+    static const Regexp HOST_PORT_PATTERN("[A-Za-z0-9\\-_.]+:\\d+");
+    if (HOST_PORT_PATTERN.matches(req.headers.get("Host")))
     {
         auto v = str::split(req.headers.get("Host"), ":");
         env.set("SERVER_NAME", v[0]);
@@ -219,6 +368,9 @@ void Servent::invokeCGIScript(HTTP &http, const char* fn)
     if (filePath.empty())
         throw HTTPException(HTTP_SC_NOTFOUND, 404);
 
+    if (invokeCGIWorker(http, req, env))
+        return;
+
     Subprogram script(filePath);
 
     bool success = script.start({}, env);
@@ -235,31 +387,7 @@ void Servent::invokeCGIScript(HTTP &http, const char* fn)
     Stream& stream = *script.inputStream();
 
     HTTPHeaders headers;
-    int statusCode = 200;
-    try {
-        Regexp headerPattern("^([A-Za-z\\-]+):\\s*(.*)$");
-        std::string line;
-        while ((line = stream.readLine(8192)) != "")
-        {
-            LOG_DEBUG("Line: %s", line.c_str());
-            auto caps = headerPattern.exec(line);
-            if (caps.size() == 0)
-            {
-                LOG_ERROR("Invalid header: \"%s\"", line.c_str());
-                continue;
-            }
-            if (str::capitalize(caps[1]) == "Status")
-                statusCode = atoi(caps[2].c_str());
-            else
-                headers.set(caps[1], caps[2]);
-        }
-        if (headers.get("Location") != "")
-            statusCode = 302; // Found
-    } catch (StreamException&)
-    {
-        LOG_ERROR("CGI script did not finish the headers");
-        throw HTTPException(HTTP_SC_SERVERERROR, 500);
-    }
+    int statusCode = readCGIHeaders(stream, headers);
 
     HTTPResponse res(statusCode, headers);
 
@@ -400,7 +528,52 @@ void Servent::handshakeGET(HTTP &http)
             if (!isAllowed(ALLOW_DIRECT) || !isFiltered(ServFilter::F_DIRECT))
                 throw HTTPException(HTTP_SC_UNAVAILABLE, 503);
 
+        chunkedOutput = servMgr->flags[ServMgr::F_chunkedDirectStream] &&
+            http.protocolVersion == "HTTP/1.1";
+
+        // ?pos= (ストリームポジション) か ?t= (何秒前) でタイムシフト。
+        auto args = strchr(fn, '?');
+        if (args)
+        {
+            cgi::Query query(args + 1);
+            timeShiftPos = strtoul(query.get("pos").c_str(), nullptr, 10);
+            timeShiftSeconds = strtoul(query.get("t").c_str(), nullptr, 10);
+            audioOnlyOutput = query.hasKey("audioonly");
+        }
+        // <ID>.aac か ?audioonly で FLV の音声だけを送る。
+        std::string name(fn + 8, args ? args - (fn + 8) : strlen(fn + 8));
+        if (str::has_suffix(name, ".aac"))
+            audioOnlyOutput = true;
+        if (audioOnlyOutput)
+            timeShiftPos = timeShiftSeconds = 0;
         triggerChannel(fn+8, ChanInfo::SP_HTTP, isPrivate() || hasValidAuthToken(fn+8));
+    }else if (strncmp(fn, "/hls/", 5) == 0)
+    {
+        // HLS のプレイリストとセグメント
+
+        if (!sock->host.isLocalhost())
+            if (!isAllowed(ALLOW_DIRECT) || !isFiltered(ServFilter::F_DIRECT))
+                throw HTTPException(HTTP_SC_UNAVAILABLE, 503);
+
+        handshakeHLS(http, fn+5);
+    }else if (strncmp(fn, "/thumb/", 7) == 0)
+    {
+        // 最新のキーフレームのプレビュー
+
+        if (!sock->host.isLocalhost())
+            if (!isAllowed(ALLOW_DIRECT) || !isFiltered(ServFilter::F_DIRECT))
+                throw HTTPException(HTTP_SC_UNAVAILABLE, 503);
+
+        handshakeThumbnail(http, fn+7);
+    }else if (strncmp(fn, "/group/", 7) == 0)
+    {
+        // サイマル配信のグループから画質を選ぶ
+
+        if (!sock->host.isLocalhost())
+            if (!isAllowed(ALLOW_DIRECT) || !isFiltered(ServFilter::F_DIRECT))
+                throw HTTPException(HTTP_SC_UNAVAILABLE, 503);
+
+        handshakeGroup(http, fn+7);
     }else if (strncmp(fn, "/channel/", 9) == 0)
     {
         if (!sock->host.isLocalhost())
@@ -408,6 +581,29 @@ void Servent::handshakeGET(HTTP &http)
                 throw HTTPException(HTTP_SC_UNAVAILABLE, 503);
 
         triggerChannel(fn+9, ChanInfo::SP_PCP, false);
+    }else if (strcmp(fn, "/metrics") == 0 ||
+              str::has_prefix(fn, "/metrics?"))
+    {
+        // Prometheus 形式の計測値
+
+        if (!isAllowed(ALLOW_HTML))
+            throw HTTPException(HTTP_SC_UNAVAILABLE, 503);
+
+        auto args = strchr(fn, '?');
+        if (handshakeAuth(http, args ? args + 1 : ""))
+            sendResponse(http, HTTPResponse::ok({{"Content-Type", "text/plain; version=0.0.4; charset=utf-8"}},
+                                                g_metrics.render()));
+    }else if (strcmp(fn, "/api/1/events") == 0 ||
+              str::has_prefix(fn, "/api/1/events?"))
+    {
+        // 状態の変化を Server-Sent Events で流す。
+
+        if (!isAllowed(ALLOW_HTML))
+            throw HTTPException(HTTP_SC_UNAVAILABLE, 503);
+
+        auto args = strchr(fn, '?');
+        if (handshakeAuth(http, args ? args + 1 : ""))
+            handshakeEvents(http, args ? args + 1 : "");
     }else if (strcmp(fn, "/api/1") == 0)
     {
         // JSON RPC バージョン情報取得用
@@ -419,10 +615,7 @@ void Servent::handshakeGET(HTTP &http)
         JrpcApi api;
         std::string response = api.getVersionInfo(nlohmann::json::array_t()).dump();
 
-        http.writeLine(HTTP_SC_OK);
-        http.writeLineF("%s %zu", HTTP_HS_LENGTH, response.size());
-        http.writeLine("");
-        http.writeString(response.c_str());
+        sendResponse(http, HTTPResponse::ok({{"Content-Type", "application/json"}}, response));
     }else if (strcmp(fn, "/public")== 0 ||
               strncmp(fn, "/public/", strlen("/public/"))==0)
     {
@@ -438,7 +631,7 @@ void Servent::handshakeGET(HTTP &http)
         try
         {
             PublicController controller(peercastApp->getPath() + std::string("public"));
-            http.send(controller(http.getRequest(), *sock, sock->host));
+            sendResponse(http, controller(http.getRequest(), *sock, sock->host));
         } catch (GeneralException& e)
         {
             LOG_ERROR("Error: %s", e.msg);
@@ -452,7 +645,7 @@ void Servent::handshakeGET(HTTP &http)
         try
         {
             AssetsController controller(peercastApp->getPath() + std::string("assets"));
-            http.send(controller(http.getRequest(), *sock, sock->host));
+            sendResponse(http, controller(http.getRequest(), *sock, sock->host));
         } catch (GeneralException& e)
         {
             LOG_ERROR("Error: %s", e.msg);
@@ -492,7 +685,7 @@ void Servent::handshakeGET(HTTP &http)
         {
             if (handshakeAuth(http, fn))
             {
-                this->type = T_COMMAND;
+                this->setType(T_COMMAND);
 
                 http.readHeaders();
 #if 1
@@ -534,40 +727,61 @@ void Servent::handshakeGET(HTTP &http)
                 }
             }
         }
-#if 0
-    }else if (strcmp("/speedtest", fn) == 0)
+    }else if (str::is_prefix_of("/speedtest/result", fn))
     {
-        //getSpeedTest();
-        
+        // 並べて張った接続の結果のまとめ
+
+        if (!servMgr->flags[ServMgr::F_speedtestServer])
+            throw HTTPException(HTTP_SC_NOTFOUND, 404);
+
         http.readHeaders();
-        http.writeLine("HTTP/1.1 200 OK");
-        http.writeLine("Content-Type: application/binary");
-        http.writeLine("Server: " PCX_AGENT);
-        http.writeLine("Connection: close");
-        http.writeLine("Transfer-Encoding: chunked");
-        http.writeLine("");
+        const char* q = strchr(fn, '?');
+        cgi::Query query(q ? q + 1 : "");
+        auto result = g_speedtest.result(query.get("id"));
+        if (result.is_null())
+            throw HTTPException(HTTP_SC_NOTFOUND, 404);
 
-        auto generateRandomBytes = [](size_t size) -> std::string {
-                                       std::string buf;
-                                       peercast::Random r;
-
-                                       for (size_t i = 0; i < size; ++i)
-                                           buf += (char) (r.next() & 0xff);
-                                       return buf;
-                                   };
-        auto block = generateRandomBytes(1024);
-        const auto startTime = sys->getDTime();
-        size_t sent = 0;
-        Chunker stream(http);
-
-        while (sys->getDTime() - startTime < 15.0) {
-            stream.write(block.data(), block.size());
-            sent += 1024;
-        }
-        auto t = sys->getDTime();
-        stream.close();
-        LOG_INFO("[Speedtest] client %s downloaded at %.0f bps", sock->host.ip.str().c_str(), (sent * 8) / (t - startTime));
-#endif
+        http.send(HTTPResponse::ok({{"Content-Type", "application/json"},
+                                    {"Cache-Control", "no-store"}},
+                                   result.dump()));
+    }else if (strcmp("/speedtest", fn) == 0 || str::is_prefix_of("/speedtest?", fn))
+    {
+        // スピードテスト (ダウンロード)
+
+        if (!servMgr->flags[ServMgr::F_speedtestServer])
+            throw HTTPException(HTTP_SC_NOTFOUND, 404);
+
+        http.readHeaders();
+        const char* q = strchr(fn, '?');
+        cgi::Query query(q ? q + 1 : "");
+
+        double seconds = Speedtest::DEFAULT_SECONDS;
+        if (query.get("seconds") != "")
+            seconds = std::min<double>(std::max(1.0, atof(query.get("seconds").c_str())), Speedtest::MAX_SECONDS);
+
+        const auto id = query.get("id");
+        if (id != "" && !g_speedtest.begin(id))
+            throw HTTPException(HTTP_SC_UNAVAILABLE, 503);
+
+        Speedtest::Result result;
+        Defer defer([&]() { if (id != "") g_speedtest.end(id, result); });
+
+        // 長さを決めずに、閉じて終わりを知らせる。
+        http.writeResponseStatus("HTTP/1.0", 200);
+        http.writeResponseHeaders
+            ({
+                {"Content-Type", "application/octet-stream"},
+                {"Cache-Control", "no-store"},
+                {"Connection", "close"},
+            });
+
+        result = Speedtest::send(*sock, seconds);
+        LOG_INFO("[Speedtest] client %s downloaded %llu bytes in %.3f seconds (%.0f bps, rtt %u us)",
+                 sock->host.ip.str().c_str(),
+                 (unsigned long long) result.bytes,
+                 result.seconds,
+                 result.bps(),
+                 result.rttUsec);
     }else
     {
         // GET マッチなし
@@ -625,60 +839,43 @@ void Servent::handshakePOST(HTTP &http)
         auto req = http.getRequest();
         LOG_DEBUG("Admin (POST)");
         handshakeCMD(http, req.body);
-#if 0
     }else if (path == "/speedtest")
     {
-        // postSpeedtest();
+        // スピードテスト (アップロード)
+
+        if (!servMgr->flags[ServMgr::F_speedtestServer])
+            throw HTTPException(HTTP_SC_NOTFOUND, 404);
+
         http.readHeaders();
+        if (http.headers.get("Transfer-Encoding") != "")
+            throw HTTPException(HTTP_SC_BADREQUEST, 400, "Chunked upload is not supported");
 
-        std::shared_ptr<Stream> stream;
-        if (http.headers.get("Transfer-Encoding") == "chunked") {
-            stream = std::make_shared<Dechunker>(http);
-        } else {
-            auto tmp = std::make_shared<IndirectStream>();
-            tmp->init(&http);
-            stream = tmp;
-        }
+        int64_t length = -1;
+        if (http.headers.get("Content-Length") != "")
+            length = std::atoll(http.headers.get("Content-Length").c_str());
 
-        int remaining = std::numeric_limits<int>::max();
-        bool bounded = false;
-        if (http.headers.get("Content-Length") != "") {
-            remaining = std::atoi(http.headers.get("Content-Length").c_str());
-            bounded = true;
-        }
+        cgi::Query query(args);
+        const auto id = query.get("id");
+        if (id != "" && !g_speedtest.begin(id))
+            throw HTTPException(HTTP_SC_UNAVAILABLE, 503);
 
-        const auto startTime = sys->getDTime();
-        size_t received = 0;
-        char buffer[1024];
+        Speedtest::Result result;
+        Defer defer([&]() { if (id != "") g_speedtest.end(id, result); });
 
-        while (sys->getDTime() - startTime <= 20.0 && remaining > 0) {
-            int r;
-            try {
-                r = stream->read(buffer, std::min(1024, remaining));
-            } catch (StreamException& e) {
-                break;
-            }
-            received += r;
-            if (bounded)
-                remaining -= r;
-        }
-        auto t = sys->getDTime();
+        if (strcasecmp(http.headers.get("Expect").c_str(), "100-continue") == 0)
+            http.writeString("HTTP/1.1 100 Continue\r\n\r\n");
 
-        if ((t - startTime) < 15.0) {
-            auto res = HTTPResponse::badRequest("Time less than 15 seconds. Need more data.");
-            http.send(res);
-        } else {
-            double bps = (received * 8) / (t - startTime);
-            LOG_INFO("[Speedtest] client %s uploaded %d bytes in %.3f seconds (%.0f bps)",
-                     sock->host.ip.str().c_str(),
-                     (int) received,
-                     t - startTime,
-                     (received * 8) / (t - startTime));
-
-            auto res = HTTPResponse::ok({{"Content-Type", "text/plain"}}, str::format("%.0f bps", bps));
-            http.send(res);
-        }
-#endif
+        result = Speedtest::receive(*sock, length, Speedtest::MAX_SECONDS);
+        if (result.bytes == 0)
+            throw HTTPException(HTTP_SC_BADREQUEST, 400, "No data");
+
+        LOG_INFO("[Speedtest] client %s uploaded %llu bytes in %.3f seconds (%.0f bps)",
+                 sock->host.ip.str().c_str(),
+                 (unsigned long long) result.bytes,
+                 result.seconds,
+                 result.bps());
+
+        http.send(HTTPResponse::ok({{"Content-Type", "text/plain"}}, str::format("%.0f bps", result.bps())));
     }else
     {
         http.readHeaders();
@@ -836,7 +1033,7 @@ void Servent::handshakeIncoming()
 {
     setStatus(S_HANDSHAKE);
 
-    if (servMgr->flags.get("enableSSLServer")) {
+    if (servMgr->flags[ServMgr::F_enableSSLServer]) {
         if (sock->readReady(sock->readTimeout)) {
             char c = sock->peekChar();
             LOG_TRACE("peekChar -> %d", (unsigned char) c);
@@ -846,6 +1043,17 @@ void Servent::handshakeIncoming()
         }
     }
 
+    // ワーカーのモードでは、他のワーカーのチャンネルへの要求をそちら
+    // に渡す。
+    if (g_prefork.handOff(sock))
+    {
+        sock = nullptr;
+        return;
+    }
+
+    // 要求の処理で作るヘッダーやクエリーの辞書はアリーナから取る。
+    Arena::Scope arenaScope(requestArena);
+
     char buf[8192];
 
     if ((size_t)sock->readLine(buf, sizeof(buf)) >= sizeof(buf)-1)
@@ -853,6 +1061,12 @@ void Servent::handshakeIncoming()
         throw HTTPException(HTTP_SC_URITOOLONG, 414);
     }
 
+    if (servMgr->flags[ServMgr::F_http2] && HTTP2Connection::isPrefaceLine(buf))
+    {
+        handshakeHTTP2();
+        return;
+    }
+
     bool isHTTP = (stristr(buf, HTTP_PROTO1) != nullptr);
 
     if (isHTTP)
@@ -862,7 +1076,170 @@ void Servent::handshakeIncoming()
 
     HTTP http(*sock);
     http.initRequest(buf);
-    handshakeHTTP(http, isHTTP);
+
+    // 応答が keep-alive を伝えた時だけ、同じ接続で次の要求を受ける。
+    for (numRequests = 1; ; numRequests++)
+    {
+        keepAlive = false;
+        const double t0 = sys->getDTime();
+        handshakeHTTP(http, isHTTP);
+        // ストリームやコマンドになった接続は、ここに戻るまでが長いので数えない。
+        if (type == T_NONE)
+            g_metrics.incomingRequestLatency.observe(sys->getDTime() - t0);
+
+        if (!keepAlive || !sock)
+            return;
+        if (!readNextRequest(http))
+            return;
+    }
+}
+
+// -----------------------------------
+// HTTP/2 の要求をハンドシェイクのワーカープールで走らせる。
+struct HTTP2Task
+{
+    ThreadInfo              thread;
+    std::function<void()>   fn;
+};
+
+static int http2TaskProc(ThreadInfo* thread)
+{
+    std::unique_ptr<HTTP2Task> task(static_cast<HTTP2Task*>(thread->data));
+    sys->setThreadName("HTTP/2");
+    task->fn();
+    return 0;
+}
+
+// -----------------------------------
+void Servent::handshakeHTTP2()
+{
+    if (!isAllowed(ALLOW_HTML))
+    {
+        LOG_DEBUG("HTTP/2 from %s refused", sock->host.str().c_str());
+        return;
+    }
+
+    // 接続が続く間このスレッドを占有するので、プールから外す。
+    ThreadPool::promote();
+    setType(T_COMMAND);
+    LOG_DEBUG("HTTP/2 from %s", sock->host.str().c_str());
+
+    HTTP2Connection conn(*sock,
+                         [this](const HTTPRequest& req)
+                         {
+                             return respondHTTP2(req);
+                         },
+                         [](std::function<void()> fn)
+                         {
+                             auto task = new HTTP2Task;
+                             task->fn = fn;
+                             task->thread.func = http2TaskProc;
+                             task->thread.data = task;
+                             if (servMgr->incomingPool.submit(&task->thread))
+                                 return true;
+                             delete task;
+                             return false;
+                         });
+    conn.run();
+}
+
+// -----------------------------------
+// 管理画面と API だけを扱う。ストリームやコマンドは HTTP/1.1 でやり直
+// させる。
+HTTPResponse Servent::respondHTTP2(const HTTPRequest& req)
+{
+    const bool get = (req.method == "GET" || req.method == "HEAD");
+    const bool api = (req.path == "/api/1");
+    const bool html = get && str::is_prefix_of("/html/", req.path) && req.path != "/html/index.html";
+
+    if (api || html)
+    {
+        if (!isAllowed(ALLOW_HTML))
+            throw HTTPException(HTTP_SC_UNAVAILABLE, 503);
+
+        // JSON RPC バージョン情報取得用
+        if (api && get)
+        {
+            JrpcApi jrpc;
+            return HTTPResponse::ok({{"Content-Type", "application/json"}},
+                                    jrpc.getVersionInfo(nlohmann::json::array_t()).dump());
+        }
+        if (api && req.method != "POST")
+            throw HTTPException(HTTP_SC_BADREQUEST, 400);
+
+        Cookie gotCookie;
+        if (!isAuthorized(req.headers, req.queryString.c_str(), gotCookie))
+        {
+            if (servMgr->authType == ServMgr::AUTH_HTTPBASIC)
+                return HTTPResponse(401, {{"WWW-Authenticate", "Basic realm=\"PeerCast Admin\""}});
+            if (req.headers.get("X-Requested-With") == "XMLHttpRequest")
+                throw HTTPException(HTTP_SC_FORBIDDEN, 403);
+            String file = servMgr->htmlPath;
+            file.append("/login.html");
+            return localFileResponse(file, req);
+        }
+
+        if (html)
+            return localFileResponse(req.url.c_str() + 1, req);
+
+        if (req.body.empty())
+            throw HTTPException(HTTP_SC_BADREQUEST, 400);
+        JrpcApi jrpc;
+        auto res = HTTPResponse::ok({{"Content-Type", "application/json"}}, jrpc.call(req.body));
+        if (servMgr->flags[ServMgr::F_gzipResponses])
+            g_gzipEncoder.compress(req, res);
+        return res;
+    }
+
+    if (get && str::is_prefix_of("/assets/", req.path))
+    {
+        AssetsController controller(peercastApp->getPath() + std::string("assets"));
+        return controller(req, *sock, sock->host);
+    }
+
+    return HTTP2Connection::http11Required();
+}
+
+// -----------------------------------
+bool Servent::decideKeepAlive(HTTP &http)
+{
+    keepAlive = wantsKeepAlive(http) && numRequests < MAX_KEEPALIVE_REQUESTS;
+    return keepAlive;
+}
+
+// -----------------------------------
+void Servent::sendResponse(HTTP &http, const HTTPResponse& response)
+{
+    HTTPResponse res = response;
+
+    // 本体がストリームで長さも無ければ、閉じて終わりを知らせるしかない。
+    if (res.stream && res.headers.get("Content-Length").empty())
+        keepAlive = false;
+    else
+        decideKeepAlive(http);
+    res.headers.set("Connection", keepAlive ? "keep-alive" : "close");
+    http.send(res);
+}
+
+// -----------------------------------
+bool Servent::readNextRequest(HTTP &http)
+{
+    // 次の要求を待つ間プールのスレッドを塞がない。
+    if (!sock->readReady(0))
+        ThreadPool::promote();
+    if (!sock->readReady(KEEPALIVE_TIMEOUT))
+        return false;
+
+    char buf[8192];
+    if ((size_t)sock->readLine(buf, sizeof(buf)) >= sizeof(buf)-1)
+        throw HTTPException(HTTP_SC_URITOOLONG, 414);
+
+    http.reset();
+    // 前の要求の分が返されていれば、アリーナを頭から使い直す。
+    requestArena.reset();
+    http.initRequest(buf);
+    LOG_DEBUG("%s \"%s\" (keep-alive %d)", sock->host.ip.str().c_str(), http.cmdLine, numRequests + 1);
+    return true;
 }
 
 // -----------------------------------
@@ -876,9 +1253,9 @@ void Servent::triggerChannel(char *str, ChanInfo::PROTOCOL proto, bool relay)
     servMgr->getChannel(str, info, relay);
 
     if (proto == ChanInfo::SP_PCP)
-        type = T_RELAY;
+        setType(T_RELAY);
     else
-        type = T_DIRECT;
+        setType(T_DIRECT);
 
     outputProtocol = proto;
 
@@ -932,6 +1309,192 @@ void Servent::handshakePLS(ChanInfo &info, HTTP& http)
     pls.write(*sock);
 }
 
+// -----------------------------------
+// /hls/<チャンネルID>/ 以下の要求に答える。index.m3u8 がプレイリスト、
+// seg<N>.ts がセグメント、part<N>.<M>.ts がパート。まだ出来ていないも
+// のは少し待つ。
+void Servent::handshakeHLS(HTTP &http, const std::string& path)
+{
+    http.readHeaders();
+
+    auto vec = str::split(path, "?");
+    std::string args = (vec.size() > 1) ? vec[1] : "";
+    auto slash = vec[0].find('/');
+    if (slash == std::string::npos)
+        throw HTTPException(HTTP_SC_NOTFOUND, 404);
+    std::string id = vec[0].substr(0, slash);
+    std::string name = vec[0].substr(slash + 1);
+
+    // /hls/<グループID>/master.m3u8 は各画質のプレイリストをまとめたもの。
+    if (name == "master.m3u8")
+    {
+        auto renditions = ChannelGroup::find(GnuID(id));
+        if (renditions.empty())
+            throw HTTPException(HTTP_SC_NOTFOUND, 404);
+
+        sendResponse(http, HTTPResponse::ok({{"Content-Type", "application/vnd.apple.mpegurl"},
+                                             {"Cache-Control", "max-age=1"},
+                                             {"Access-Control-Allow-Origin", "*"}},
+                                            ChannelGroup::masterPlaylist(renditions, args)));
+        return;
+    }
+
+    ChanInfo info;
+    std::string idbuf = id;
+    if (!servMgr->getChannel(&idbuf[0], info, isPrivate() || hasValidAuthToken(id + "?" + args)))
+        throw HTTPException(HTTP_SC_NOTFOUND, 404);
+
+    auto ch = chanMgr->findChannelByID(info.id);
+    if (!ch || ch->info.contentType != ChanInfo::T_FLV)
+        throw HTTPException(HTTP_SC_NOTFOUND, 404);
+
+    auto hls = ch->getHLSSegmenter();
+    cgi::Query query(args);
+    std::string auth = query.hasKey("auth") ? "auth=" + query.get("auth") : "";
+
+    // ready が真になるまでパケットを取り込みながら待つ。
+    auto waitFor = [&](std::function<bool()> ready)
+    {
+        double deadline = sys->getDTime() + HLSSegmenter::TARGET_DURATION * 3 / 1000.0;
+        for (int i = 0; i < HLSSegmenter::TARGET_DURATION * 3 / 200; i++)
+        {
+            unsigned int serial = ch->rawData.getWriteSerial();
+            hls->update(ch);
+            if (ready() || sys->getDTime() >= deadline || !thread.active())
+                return;
+            ThreadPool::promote();
+            ch->rawData.waitForWrite(serial, 200);
+        }
+    };
+
+    unsigned int msn, part;
+    int n = 0;
+    std::string body;
+    if (name == "index.m3u8")
+    {
+        if (query.hasKey("_HLS_msn"))
+        {
+            // ブロックするプレイリストの再読み込み
+            msn = std::atoi(query.get("_HLS_msn").c_str());
+            int p = query.hasKey("_HLS_part") ? std::atoi(query.get("_HLS_part").c_str()) : -1;
+            waitFor([&]() { return hls->isReady(msn, p); });
+        }else
+            waitFor([&]() { return hls->hasSegments(); });
+
+        body = hls->playlist(auth);
+        if (body.empty())
+            throw HTTPException(HTTP_SC_NOTFOUND, 404);
+
+        sendResponse(http, HTTPResponse::ok({{"Content-Type", "application/vnd.apple.mpegurl"},
+                                             {"Cache-Control", "max-age=1"},
+                                             {"Access-Control-Allow-Origin", "*"}}, body));
+        return;
+    }else if (sscanf(name.c_str(), "seg%u.ts%n", &msn, &n) == 1 && n == (int) name.size())
+    {
+        waitFor([&]() { return hls->isReady(msn, -1); });
+        if (!hls->getSegment(msn, body))
+            throw HTTPException(HTTP_SC_NOTFOUND, 404);
+    }else if (sscanf(name.c_str(), "part%u.%u.ts%n", &msn, &part, &n) == 2 && n == (int) name.size())
+    {
+        waitFor([&]() { return hls->isReady(msn, part); });
+        if (!hls->getPart(msn, part, body))
+            throw HTTPException(HTTP_SC_NOTFOUND, 404);
+    }else
+        throw HTTPException(HTTP_SC_NOTFOUND, 404);
+
+    // セグメントとパートは中身が変わらないので長くキャッシュさせてよい。
+    sendResponse(http, HTTPResponse::ok({{"Content-Type", "video/mp2t"},
+                                         {"Cache-Control", "max-age=3600"},
+                                         {"Access-Control-Allow-Origin", "*"}}, body));
+}
+
+// -----------------------------------
+// /group/<グループID>[.拡張子] はグループの中から、上りの余裕と
+// ?maxbitrate= (kbps) に収まる一番良い画質の /stream/ に転送する。
+void Servent::handshakeGroup(HTTP &http, const std::string& path)
+{
+    http.readHeaders();
+
+    auto vec = str::split(path, "?");
+    cgi::Query query((vec.size() > 1) ? vec[1] : "");
+    std::string id = vec[0], ext;
+    auto dot = id.find('.');
+    if (dot != std::string::npos)
+    {
+        ext = id.substr(dot);
+        id = id.substr(0, dot);
+    }
+
+    auto renditions = ChannelGroup::find(GnuID(id));
+    int available = servMgr->uploadHeadroom();
+    if (query.hasKey("maxbitrate"))
+    {
+        int max = std::atoi(query.get("maxbitrate").c_str());
+        available = (available < 0) ? max : std::min(available, max);
+    }
+    int i = ChannelGroup::select(renditions, available);
+    if (i < 0)
+        throw HTTPException(HTTP_SC_NOTFOUND, 404);
+
+    LOG_DEBUG("Group %s: chose %s (%d kbps, available %d)",
+              id.c_str(), renditions[i].id.str().c_str(), renditions[i].bitrate, available);
+
+    query.m_dict.erase("maxbitrate");
+    std::string url = "/stream/" + renditions[i].id.str() + ext;
+    if (!query.str().empty())
+        url += "?" + query.str();
+    sendResponse(http, HTTPResponse::redirectTo(url));
+}
+
+// -----------------------------------
+// /thumb/<チャンネルID>.flv はヘッダーと最新のキーフレームだけの FLV、
+// .jpg はそれを JPEG にしたもの。キーフレームが変わるまでは同じものを
+// 返すので、ETag で確かめさせる。
+void Servent::handshakeThumbnail(HTTP &http, const std::string& path)
+{
+    http.readHeaders();
+
+    auto vec = str::split(path, "?");
+    std::string args = (vec.size() > 1) ? vec[1] : "";
+    auto dot = vec[0].rfind('.');
+    if (dot == std::string::npos)
+        throw HTTPException(HTTP_SC_NOTFOUND, 404);
+    std::string id = vec[0].substr(0, dot);
+    std::string ext = vec[0].substr(dot + 1);
+    if (ext != "flv" && !(ext == "jpg" && servMgr->flags[ServMgr::F_jpegThumbnails]))
+        throw HTTPException(HTTP_SC_NOTFOUND, 404);
+
+    ChanInfo info;
+    std::string idbuf = id;
+    if (!servMgr->getChannel(&idbuf[0], info, isPrivate() || hasValidAuthToken(id + "?" + args)))
+        throw HTTPException(HTTP_SC_NOTFOUND, 404);
+
+    auto ch = chanMgr->findChannelByID(info.id);
+    if (!ch || ch->info.contentType != ChanInfo::T_FLV)
+        throw HTTPException(HTTP_SC_NOTFOUND, 404);
+
+    auto thumbs = ch->getThumbnailCache();
+    if (ext == "jpg")
+        ThreadPool::promote();  // 変換を待つかもしれない
+    auto image = (ext == "jpg") ? thumbs->jpeg(ch) : thumbs->keyFrame(ch);
+    if (!image)
+        throw HTTPException(HTTP_SC_NOTFOUND, 404);
+
+    std::string etag = "\"" + ext + "-" + image->key + "\"";
+    HTTPHeaders headers = {{"ETag", etag},
+                           {"Cache-Control", "max-age=2"},
+                           {"Access-Control-Allow-Origin", "*"}};
+    auto ifNoneMatch = http.headers.get("If-None-Match");
+    if (!ifNoneMatch.empty() && AssetCache::etagMatches(ifNoneMatch, etag))
+    {
+        sendResponse(http, HTTPResponse::notModified(headers));
+        return;
+    }
+
+    headers.set("Content-Type", image->mimeType);
+    sendResponse(http, HTTPResponse::ok(headers, *image->data));
+}
+
 // -----------------------------------
 std::string Servent::getLocalURL(const std::string& hostHeader)
 {
@@ -992,10 +1555,38 @@ bool Servent::handshakeHTTPBasicAuth(HTTP &http)
 // -----------------------------------
 bool Servent::handshakeAuth(HTTP &http, const char *args)
 {
-    std::string user, pass;
-
     http.readHeaders();
 
+    if (isAuthorized(http.headers, args, cookie))
+        return true;
+
+    // Auth failure
+    if (servMgr->authType == ServMgr::AUTH_HTTPBASIC)
+    {
+        http.writeLine(HTTP_SC_UNAUTHORIZED);
+        http.writeLine("WWW-Authenticate: Basic realm=\"PeerCast Admin\"");
+        http.writeLine("");
+    }else if (servMgr->authType == ServMgr::AUTH_COOKIE)
+    {
+        String file = servMgr->htmlPath;
+        file.append("/login.html");
+        if (http.headers.get("X-Requested-With") == "XMLHttpRequest")
+            throw HTTPException(HTTP_SC_FORBIDDEN, 403);
+        else
+        {
+            // XXX
+            handshakeLocalFile(file, http);
+        }
+    }
+
+    return false;
+}
+
+// -----------------------------------
+bool Servent::isAuthorized(const HTTPHeaders& headers, const char* args, Cookie& gotCookie)
+{
+    std::string user, pass;
+
     if (sock->host.isLocalhost())
         return true;
 
@@ -1008,17 +1599,17 @@ bool Servent::handshakeAuth(HTTP &http, const char *args)
     switch (servMgr->authType)
     {
     case ServMgr::AUTH_HTTPBASIC:
-        if (http.headers.get("Authorization") != "") {
-            HTTP::parseAuthorizationHeader(http.headers.get("Authorization"), user, pass);
+        if (headers.get("Authorization") != "") {
+            HTTP::parseAuthorizationHeader(headers.get("Authorization"), user, pass);
             if (strlen(servMgr->password) && pass == servMgr->password) {
                 return true;
             }
         }
         break;
     case ServMgr::AUTH_COOKIE:
-        if (http.headers.get("Cookie") != "")
+        if (headers.get("Cookie") != "")
         {
-            auto arg = http.headers.get("Cookie");
+            auto arg = headers.get("Cookie");
             LOG_TRACE("Got cookie: %s", arg.c_str());
             const std::string idKey = str::STR(servMgr->serverHost.port, "_id");
             auto assignments = str::split(arg, "; ");
@@ -1029,14 +1620,12 @@ bool Servent::handshakeAuth(HTTP &http, const char *args)
                     LOG_ERROR("Invalid Cookie header: expected '='");
                     break;
                 } else if (sides[0] == idKey) {
-                    Cookie gotCookie;
                     gotCookie.set(sides[1].c_str(), sock->host.ip);
-                    cookie = gotCookie;
                     break;
                 }
             }
 
-            if (servMgr->cookieList.contains(cookie)){
+            if (servMgr->cookieList.contains(gotCookie)){
                 LOG_TRACE("Cookie ID found");
                 return true;
             }
@@ -1044,47 +1633,28 @@ bool Servent::handshakeAuth(HTTP &http, const char *args)
         break;
     }
 
-    // Auth failure
-    if (servMgr->authType == ServMgr::AUTH_HTTPBASIC)
-    {
-        http.writeLine(HTTP_SC_UNAUTHORIZED);
-        http.writeLine("WWW-Authenticate: Basic realm=\"PeerCast Admin\"");
-        http.writeLine("");
-    }else if (servMgr->authType == ServMgr::AUTH_COOKIE)
-    {
-        String file = servMgr->htmlPath;
-        file.append("/login.html");
-        if (http.headers.get("X-Requested-With") == "XMLHttpRequest")
-            throw HTTPException(HTTP_SC_FORBIDDEN, 403);
-        else
-        {
-            // XXX
-            handshakeLocalFile(file, http);
-        }
-    }
-
     return false;
 }
 
 // -----------------------------------
-static std::string runProcess(std::function<void(Stream&)> action)
+// 確認は g_portChecks が別のスレッドで行う。応答は始めたかどうかと、前
+// 回の結果。
+static std::string startPortCheck(int ipv)
 {
     StringStream ss;
-    try {
-        assert(AUX_LOG_FUNC_VECTOR != nullptr);
-        AUX_LOG_FUNC_VECTOR->push_back([&](LogBuffer::TYPE type, const char* msg) -> void
-                                      {
-                                          if (type == LogBuffer::T_ERROR)
-                                              ss.writeString("Error: ");
-                                          else if (type == LogBuffer::T_WARN)
-                                              ss.writeString("Warning: ");
-                                          ss.writeLine(msg);
-                                      });
-        Defer defer([]() { AUX_LOG_FUNC_VECTOR->pop_back(); });
-
-        action(ss);
-    } catch(GeneralException& e) {
-        ss.writeLineF("Error: %s", e.what());
+    if (g_portChecks.start(ipv))
+        ss.writeLineF("IPv%d port check started.", ipv);
+    else
+        ss.writeLineF("IPv%d port check is already running.", ipv);
+
+    auto st = g_portChecks.status(ipv);
+    if (st.finishedAt)
+    {
+        const unsigned int ago = sys->getTime() - st.finishedAt;
+        if (st.error.empty())
+            ss.writeLineF("Last result: IPv%d firewall is %s (%u seconds ago)", ipv, st.result.c_str(), ago);
+        else
+            ss.writeLineF("Last result: Error: %s (%u seconds ago)", st.error.c_str(), ago);
     }
     return ss.str();
 }
@@ -1092,30 +1662,14 @@ static std::string runProcess(std::function<void(Stream&)> action)
 // -----------------------------------
 void Servent::CMD_portcheck4(const char* cmd, HTTP& http, String& jumpStr)
 {
-    auto output = runProcess([](Stream& s)
-                             {
-                                 servMgr->setFirewall(4, ServMgr::FW_UNKNOWN);
-                                 servMgr->checkFirewall();
-                                 s.writeLineF("IPv4 firewall is %s",
-                                              ServMgr::getFirewallStateString(servMgr->getFirewall(4)));
-                             });
-
-    auto res = HTTPResponse::ok({ {"Content-Type", "text/plain; charset=UTF-8"} }, output);
+    auto res = HTTPResponse::ok({ {"Content-Type", "text/plain; charset=UTF-8"} }, startPortCheck(4));
     http.send(res);
 }
 
 // -----------------------------------
 void Servent::CMD_portcheck6(const char* cmd, HTTP& http, String& jumpStr)
 {
-    auto output = runProcess([](Stream& s)
-                             {
-                                 servMgr->setFirewall(6, ServMgr::FW_UNKNOWN);
-                                 servMgr->checkFirewallIPv6();
-                                 s.writeLineF("IPv6 firewall is %s",
-                                              ServMgr::getFirewallStateString(servMgr->getFirewall(6)));
-                             });
-
-    auto res = HTTPResponse::ok({ {"Content-Type", "text/plain; charset=UTF-8"} }, output);
+    auto res = HTTPResponse::ok({ {"Content-Type", "text/plain; charset=UTF-8"} }, startPortCheck(6));
     http.send(res);
 }
 
@@ -1157,7 +1711,7 @@ void Servent::CMD_redirect(const char* cmd, HTTP& http, String& jumpStr)
 
 void Servent::CMD_viewxml(const char* cmd, HTTP& http, String& jumpStr)
 {
-    handshakeXML();
+    handshakeXML(http);
 }
 
 void Servent::CMD_customizeApperance(const char* cmd, HTTP& http, String& jumpStr)
@@ -1171,11 +1725,11 @@ void Servent::CMD_customizeApperance(const char* cmd, HTTP& http, String& jumpSt
             continue;
         else if (key == "preferredTheme")
         {
-            std::lock_guard<std::recursive_mutex> cs(servMgr->lock);
+            std::lock_guard<ProfiledMutex> cs(servMgr->lock);
             servMgr->preferredTheme = query.get(key);
         }else if (key == "accentColor")
         {
-            std::lock_guard<std::recursive_mutex> cs(servMgr->lock);
+            std::lock_guard<ProfiledMutex> cs(servMgr->lock);
             servMgr->accentColor = query.get(key);
         }else
             LOG_WARN("Unexpected key `%s`", key.c_str());
@@ -1199,10 +1753,11 @@ void Servent::CMD_chooseLanguage(const char* cmd, HTTP& http, String& jumpStr)
             continue;
         else if (key == "htmlPath")
         {
-            std::lock_guard<std::recursive_mutex> cs(servMgr->lock);
+            std::lock_guard<ProfiledMutex> cs(servMgr->lock);
 
             auto newHtmlPath = "html/" + query.get(key);
-            auto vec = Regexp("html/[^/]+").exec(referer);
+            static const Regexp HTML_PATH_PATTERN("html/[^/]+");
+            auto vec = HTML_PATH_PATTERN.exec(referer);
             if (vec.size())
             {
                 auto pos = referer.find(vec[0]);
@@ -1235,7 +1790,7 @@ void Servent::CMD_clearlog(const char* cmd, HTTP& http, String& jumpStr)
 
 void Servent::CMD_apply(const char* cmd, HTTP& http, String& jumpStr)
 {
-    std::lock_guard<std::recursive_mutex> cs(servMgr->lock);
+    std::lock_guard<ProfiledMutex> cs(servMgr->lock);
 
     servMgr->numFilters = 0;
     ServFilter *currFilter = servMgr->filters;
@@ -1243,7 +1798,7 @@ void Servent::CMD_apply(const char* cmd, HTTP& http, String& jumpStr)
     servMgr->publicDirectoryEnabled = false;
     servMgr->transcodingEnabled = false;
     servMgr->chat = false;
-    servMgr->flags.get("randomizeBroadcastingChannelID") = false;
+    servMgr->flags[ServMgr::F_randomizeBroadcastingChannelID] = false;
 
     bool brRoot = false;
     bool getUpd = false;
@@ -1361,7 +1916,7 @@ void Servent::CMD_apply(const char* cmd, HTTP& http, String& jumpStr)
         else if (strcmp(curr, "chat") == 0)
             servMgr->chat = getCGIargBOOL(arg);
         else if (strcmp(curr, "randomizechid") == 0)
-            servMgr->flags.get("randomizeBroadcastingChannelID") = getCGIargBOOL(arg);
+            servMgr->flags[ServMgr::F_randomizeBroadcastingChannelID] = getCGIargBOOL(arg);
         else if (strcmp(curr, "public_directory") == 0)
             servMgr->publicDirectoryEnabled = true;
         else if (strcmp(curr, "auth") == 0)
@@ -1438,7 +1993,7 @@ void Servent::CMD_apply(const char* cmd, HTTP& http, String& jumpStr)
 
 void Servent::CMD_applyflags(const char* cmd, HTTP& http, String& jumpStr)
 {
-    std::lock_guard<std::recursive_mutex> cs(servMgr->lock);
+    std::lock_guard<ProfiledMutex> cs(servMgr->lock);
 
     cgi::Query query(cmd);
 
@@ -1469,12 +2024,14 @@ void Servent::CMD_fetch(const char* cmd, HTTP& http, String& jumpStr)
     info.genre = str::truncate_utf8(str::valid_utf8(query.get("genre")), 255);
     info.url   = str::truncate_utf8(str::valid_utf8(query.get("contact")), 255);
     info.bitrate = atoi(query.get("bitrate").c_str());
+    info.lowLatency = (query.get("lowlatency") == "1");
     auto type = query.get("type");
     info.setContentType(type.c_str());
 
     // id がセットされていないチャンネルがあるといろいろまずいので、事
     // 前に設定してから登録する。
     setBroadcastIdChannelId(info, chanMgr->broadcastID);
+    ChannelGroup::assign(info, query.get("group"), query.get("rendition"));
 
     auto c = chanMgr->createChannel(info);
     if (c) {
@@ -1485,6 +2042,8 @@ void Servent::CMD_fetch(const char* cmd, HTTP& http, String& jumpStr)
             // YPv6ではIPv6のポートチェックができないのでがんばる。
             servMgr->checkFirewallIPv6();
         }
+        // バッファーの秒数。無ければ全体の設定に従う。
+        c->packetBufferDuration = atoi(query.get("buffer").c_str());
         c->startURL(curl.c_str());
     }
 
@@ -1721,7 +2280,7 @@ void Servent::CMD_control_rtmp(const char* cmd, HTTP& http, String& jumpStr)
 
         uint16_t port = std::atoi(query.get("port").c_str());
         {
-            std::lock_guard<std::recursive_mutex> cs(servMgr->lock);
+            std::lock_guard<ProfiledMutex> cs(servMgr->lock);
             ChanInfo& info = servMgr->defaultChannelInfo;
 
             servMgr->rtmpPort = port;
@@ -1848,11 +2407,11 @@ static std::string dumpTrack(const TrackInfo& track)
 
     std::string b;
 
-    b += STR("contact = ", inspect(track.contact), "\n");
-    b += STR("title = ", inspect(track.title), "\n");
-    b += STR("artist = ", inspect(track.artist), "\n");
-    b += STR("album = ", inspect(track.album), "\n");
-    b += STR("genre = ", inspect(track.genre), "\n");
+    b += STR("contact = ", inspect(track.contact.str()), "\n");
+    b += STR("title = ", inspect(track.title.str()), "\n");
+    b += STR("artist = ", inspect(track.artist.str()), "\n");
+    b += STR("album = ", inspect(track.album.str()), "\n");
+    b += STR("genre = ", inspect(track.genre.str()), "\n");
 
     return "TrackInfo\n" + indent_tab(b);
 }
@@ -1863,13 +2422,13 @@ static std::string dumpChanInfo(const ChanInfo& info)
 
     std::string b;
 
-    b += STR("name = ", inspect(info.name), "\n");
+    b += STR("name = ", inspect(info.name.str()), "\n");
     b += STR("id = ", info.id.str(), "\n");
     b += STR("bcID = ", info.bcID.str(), "\n");
     b += STR("bitrate = ", info.bitrate, "\n");
     b += STR("contentType = ", info.contentType.c_str(), "\n");
-    b += STR("MIMEType = ", inspect(info.MIMEType), "\n");
-    b += STR("streamExt = ", inspect(info.streamExt), "\n");
+    b += STR("MIMEType = ", inspect(info.MIMEType.str()), "\n");
+    b += STR("streamExt = ", inspect(info.streamExt.str()), "\n");
     b += STR("srcProtocol = ", info.srcProtocol, "\n");
     b += STR("lastPlayStart = ", info.lastPlayStart, "\n");
     b += STR("lastPlayEnd = ", info.lastPlayEnd, "\n");
@@ -1880,10 +2439,10 @@ static std::string dumpChanInfo(const ChanInfo& info)
 
     b += dumpTrack(info.track);
 
-    b += STR("desc = ", inspect(info.desc), "\n");
-    b += STR("genre = ", inspect(info.genre), "\n");
-    b += STR("url = ", inspect(info.url), "\n");
-    b += STR("comment = ", inspect(info.comment), "\n");
+    b += STR("desc = ", inspect(info.desc.str()), "\n");
+    b += STR("genre = ", inspect(info.genre.str()), "\n");
+    b += STR("url = ", inspect(info.url.str()), "\n");
+    b += STR("comment = ", inspect(info.comment.str()), "\n");
 
     return "ChanInfo\n" + indent_tab(b);
 }
@@ -1922,7 +2481,7 @@ void Servent::CMD_dump_hitlists(const char* cmd, HTTP& http, String& jumpStr)
     std::string buf;
 
     {
-        std::lock_guard<std::recursive_mutex> cs(chanMgr->lock);
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
 
         int nlists = 0;
         for (auto hitlist = chanMgr->hitlist;
@@ -2195,86 +2754,104 @@ void Servent::handshakeCMD(HTTP& http, const std::string& query)
 }
 
 // -----------------------------------
-static XML::Node *createChannelXML(std::shared_ptr<Channel> c)
+static void writeChannelXML(XMLWriter& w, std::shared_ptr<Channel> c)
 {
-    XML::Node *n = c->info.createChannelXML();
-    n->add(c->createRelayXML(true));
-    n->add(c->info.createTrackXML());
-//  n->add(c->info.createServentXML());
-    return n;
+    char tag[XML::MAX_TAGLEN];
+
+    c->info.getChannelXMLTag(tag, sizeof(tag));
+    w.open("%s", tag);
+    c->getRelayXMLTag(tag, sizeof(tag), true);
+    w.empty("%s", tag);
+    c->info.getTrackXMLTag(tag, sizeof(tag));
+    w.empty("%s", tag);
+    w.close();
 }
 
 // -----------------------------------
-static XML::Node *createChannelXML(std::shared_ptr<ChanHitList> chl)
+static void writeChannelXML(XMLWriter& w, std::shared_ptr<ChanHitList> chl)
 {
-    XML::Node *n = chl->info.createChannelXML();
-    n->add(chl->createXML());
-    n->add(chl->info.createTrackXML());
-//  n->add(chl->info.createServentXML());
-    return n;
+    char tag[XML::MAX_TAGLEN];
+
+    chl->info.getChannelXMLTag(tag, sizeof(tag));
+    w.open("%s", tag);
+
+    chl->getXMLTag(tag, sizeof(tag));
+    w.open("%s", tag);
+    for (auto h = chl->hit; h; h = h->next)
+    {
+        if (!h->host.ip)
+            continue;
+        h->getXMLTag(tag, sizeof(tag));
+        w.empty("%s", tag);
+    }
+    w.close();
+
+    chl->info.getTrackXMLTag(tag, sizeof(tag));
+    w.empty("%s", tag);
+    w.close();
 }
 
 // -----------------------------------
-void Servent::handshakeXML()
+// YP のクローラーが繰り返し取りに来るので、木は組み立てずにソケット
+// へ直接書き出す。
+void Servent::handshakeXML(HTTP &http)
 {
-    XML xml;
+    // 圧縮できるように、先に最後まで書く。
+    StringStream body;
+    XMLWriter w(body);
+    w.declaration();
+    w.open("peercast");
 
-    XML::Node *rn = new XML::Node("peercast");
-    xml.setRoot(rn);
+    w.empty("servent uptime=\"%d\"", servMgr->getUptime());
 
-    rn->add(new XML::Node("servent uptime=\"%d\"", servMgr->getUptime()));
-
-    rn->add(new XML::Node("bandwidth out=\"%d\" in=\"%d\"",
+    w.empty("bandwidth out=\"%d\" in=\"%d\"",
         stats.getPerSecond(Stats::BYTESOUT)-stats.getPerSecond(Stats::LOCALBYTESOUT),
         stats.getPerSecond(Stats::BYTESIN)-stats.getPerSecond(Stats::LOCALBYTESIN)
-        ));
-
-    rn->add(new XML::Node("connections total=\"%d\" relays=\"%d\" direct=\"%d\"", servMgr->totalConnected(), servMgr->numStreams(Servent::T_RELAY, true), servMgr->numStreams(Servent::T_DIRECT, true)));
+        );
 
-    XML::Node *an = new XML::Node("channels_relayed total=\"%d\"", chanMgr->numChannels());
-    rn->add(an);
+    w.empty("connections total=\"%d\" relays=\"%d\" direct=\"%d\"", servMgr->totalConnected(), servMgr->numStreams(Servent::T_RELAY, true), servMgr->numStreams(Servent::T_DIRECT, true));
 
-    auto c = chanMgr->channel;
-    while (c)
     {
-        if (c->isActive())
-            an->add(createChannelXML(c));
-        c = c->next;
+        w.open("channels_relayed total=\"%d\"", chanMgr->numChannels());
+
+        auto c = chanMgr->channel;
+        while (c)
+        {
+            if (c->isActive())
+                writeChannelXML(w, c);
+            c = c->next;
+        }
+        w.close();
     }
 
     // add public channels
     {
-        XML::Node *fn = new XML::Node("channels_found total=\"%d\"", chanMgr->numHitLists());
-        rn->add(fn);
+        w.open("channels_found total=\"%d\"", chanMgr->numHitLists());
 
         auto chl = chanMgr->hitlist;
         while (chl)
         {
             if (chl->isUsed())
-                fn->add(createChannelXML(chl));
+                writeChannelXML(w, chl);
             chl = chl->next;
         }
+        w.close();
     }
 
-    XML::Node *hc = new XML::Node("host_cache");
-    for (int i=0; i<ServMgr::MAX_HOSTCACHE; i++)
-    {
-        ServHost *sh = &servMgr->hostCache[i];
-        if (sh->type != ServHost::T_NONE)
-        {
-            hc->add(new XML::Node("host ip=\"%s\" type=\"%s\" time=\"%d\"", sh->host.str().c_str(), ServHost::getTypeStr(sh->type), sh->time));
-        }
-    }
-    rn->add(hc);
+    w.open("host_cache");
+    servMgr->hostCache.forEach([&](const ServHost& sh)
+                               {
+                                   w.empty("host ip=\"%s\" type=\"%s\" time=\"%d\"", sh.host.str().c_str(), ServHost::getTypeStr(sh.type), sh.time);
+                               });
+    w.close();
 
-    sock->writeLine(HTTP_SC_OK);
-    sock->writeLineF("%s %s", HTTP_HS_SERVER, PCX_AGENT);
-    sock->writeLineF("%s %s", HTTP_HS_CONTENT, MIME_XML);
-    sock->writeLine("Connection: close");
+    w.close();
+    w.flush();
 
-    sock->writeLine("");
-
-    xml.write(*sock);
+    auto res = HTTPResponse::ok({{"Content-Type", MIME_XML}}, body.str());
+    if (servMgr->flags[ServMgr::F_gzipResponses])
+        g_gzipEncoder.compress(http.getRequest(), res);
+    sendResponse(http, res);
 }
 
 // -----------------------------------
@@ -2446,12 +3023,13 @@ void Servent::setBroadcastIdChannelId(ChanInfo& info, const GnuID& broadcastID)
 
     info.bcID = broadcastID;
 
-    if (servMgr->flags.get("randomizeBroadcastingChannelID")) {
+    if (servMgr->flags[ServMgr::F_randomizeBroadcastingChannelID]) {
         info.id = GnuID::random();
     } else {
         info.id = broadcastID;
         info.id.encode(nullptr, info.name, info.genre, info.bitrate);
     }
+    g_prefork.claimID(info.id);
 }
 
 // -----------------------------------
@@ -2471,8 +3049,10 @@ ChanInfo Servent::createChannelInfo(GnuID broadcastID, const String& broadcastMs
     info.url     = query.get("url");
     info.bitrate = atoi(query.get("bitrate").c_str());
     info.comment = query.get("comment").empty() ? broadcastMsg : query.get("comment");
+    info.lowLatency = (query.get("lowlatency") == "1");
 
     setBroadcastIdChannelId(info, broadcastID);
+    ChannelGroup::assign(info, query.get("group"), query.get("rendition"));
 
     return info;
 }
@@ -2497,9 +3077,18 @@ void Servent::handshakeHTTPPush(const std::string& args)
 
     ChanInfo info = createChannelInfo(chanMgr->broadcastID, chanMgr->broadcastMsg, query, http.headers.get("Content-Type"));
 
+    bool chunked = (http.headers.get("Transfer-Encoding") == "chunked");
+
     auto c = chanMgr->findChannelByID(info.id);
     if (c)
     {
+        if (servMgr->flags[ServMgr::F_backupIngest] &&
+            c->addBackupSource(sock, std::make_shared<HTTPPushSource>(chunked),
+                               Channel::SRC_HTTPPUSH, info.contentType))
+        {
+            sock = nullptr;    // socket is taken over by channel, so don`t close it
+            return;
+        }
         LOG_INFO("HTTP Push channel already active, closing old one");
         c->thread.shutdown();
     }
@@ -2509,7 +3098,6 @@ void Servent::handshakeHTTPPush(const std::string& args)
     if (!c)
         throw HTTPException(HTTP_SC_UNAVAILABLE, 503);
 
-    bool chunked = (http.headers.get("Transfer-Encoding") == "chunked");
     if (query.get("ipv") == "6") {
         c->ipVersion = Channel::IP_V6;
         LOG_INFO("Channel IP version set to 6");
@@ -2551,12 +3139,13 @@ void Servent::handshakeICY(Channel::SRC_TYPE type, bool isHTTP)
     // attach channel ID to name, channel ID is also encoded with IP address
     // to help prevent channel hijacking.
 
-    if (servMgr->flags.get("randomizeBroadcastingChannelID")) {
+    if (servMgr->flags[ServMgr::F_randomizeBroadcastingChannelID]) {
         info.id = GnuID::random();
     } else {
         info.id = chanMgr->broadcastID;
         info.id.encode(nullptr, info.name.cstr(), loginMount.cstr(), info.bitrate);
     }
+    g_prefork.claimID(info.id);
 
     LOG_DEBUG("Incoming source: %s : %s", info.name.cstr(), info.getTypeStr());
     if (isHTTP)
@@ -2624,99 +3213,135 @@ static void validFileOrThrow(const char* filePath, const std::string& documentRo
 }
 
 // -----------------------------------
-void Servent::handshakeLocalFile(const char *fn, HTTP& http)
+static std::string documentRootOrThrow()
 {
-    std::string documentRoot;
     try {
-        documentRoot = sys->realPath(peercastApp->getPath()) + sys->getDirectorySeparator();
+        return sys->realPath(peercastApp->getPath()) + sys->getDirectorySeparator();
     } catch (GeneralException &e) {
         LOG_ERROR("documentRoot: %s (%s)", e.what(), sys->fromFilenameEncoding(peercastApp->getPath()).c_str());
         throw HTTPException(HTTP_SC_SERVERERROR, 500);
     }
+}
 
-    String fileName = documentRoot.c_str();
-    fileName.append(fn);
-
-    LOG_TRACE("Writing HTML file: %s", sys->fromFilenameEncoding(fileName.cstr()).c_str());
+// -----------------------------------
+void Servent::handshakeLocalFile(const char *fn, HTTP& http)
+{
+    auto req = http.getRequest();
+
+    // テンプレートのページは描きながらチャンクで送れる。gzip で送る時
+    // は長さが要るので全部描いてから。
+    const char* mimeType = fileNameToMimeType(fn);
+    if (mimeType && strcmp(mimeType, MIME_HTML) == 0 &&
+        servMgr->flags[ServMgr::F_streamTemplates] &&
+        http.protocolVersion == "HTTP/1.1" &&
+        !(servMgr->flags[ServMgr::F_gzipResponses] && GzipEncoder::available() &&
+          GzipEncoder::accepts(req.headers.get("Accept-Encoding"), "gzip")))
+    {
+        auto render = prepareTemplate(fn, req);
+
+        decideKeepAlive(http);
+        http.sendHead("HTTP/1.1", HTTPResponse(200, {{"Content-Type", "text/html; charset=utf-8"},
+                                                     {"Transfer-Encoding", "chunked"},
+                                                     {"Connection", keepAlive ? "keep-alive" : "close"}}));
+        BufferedChunker chunker(http);
+        render(chunker);
+        chunker.close();
+        return;
+    }
 
-    WriteBufferedStream bufferedSock(sock.get());
-    HTML html("", bufferedSock);
+    sendResponse(http, localFileResponse(fn, req));
+}
 
-    const char* mimeType = fileNameToMimeType(fileName);
-    if (mimeType == nullptr)
-        throw HTTPException(HTTP_SC_NOTFOUND, 404);
+// -----------------------------------
+std::function<void(Stream&)> Servent::prepareTemplate(const char *fn, const HTTPRequest& req)
+{
+    const std::string documentRoot = documentRootOrThrow();
 
-    if (strcmp(mimeType, MIME_HTML) == 0)
-    {
-        auto req = http.getRequest();
-        GenericScope locals;
-        HTTPRequestScope reqScope(req);
-        std::vector<Template::Scope*> scopes = { &reqScope, &locals };
+    String fileName = documentRoot.c_str();
+    fileName.append(fn);
 
-        if (str::contains(fn, "/play.html"))
-        {
-            // 視聴ページだった場合はあらかじめチャンネルのリレーを開
-            // 始しておく。
+    auto locals = std::make_shared<GenericScope>();
 
-            auto vec = str::split(fn, "?");
-            if (vec.size() != 2)
-                throw HTTPException(HTTP_SC_BADREQUEST, 400);
+    if (str::contains(fn, "/play.html"))
+    {
+        // 視聴ページだった場合はあらかじめチャンネルのリレーを開
+        // 始しておく。
 
-            String id = cgi::Query(vec[1]).get("id").c_str();
+        std::string id;
+        if (!cgi::Query::lookup(req.queryString, "id", id) || id.empty())
+            throw HTTPException(HTTP_SC_BADREQUEST, 400);
 
-            if (id.isEmpty())
-                throw HTTPException(HTTP_SC_BADREQUEST, 400);
+        String idStr = id.c_str();
+        ChanInfo info;
+        if (!servMgr->getChannel(idStr.cstr(), info, true))
+            throw HTTPException(HTTP_SC_NOTFOUND, 404);
 
-            ChanInfo info;
-            if (!servMgr->getChannel(id.cstr(), info, true))
-                throw HTTPException(HTTP_SC_NOTFOUND, 404);
+        auto ch = chanMgr->findChannelByID(GnuID(id.c_str()));
+        if (!ch)
+            throw HTTPException(HTTP_SC_NOTFOUND, 404);
 
-            auto ch = chanMgr->findChannelByID(GnuID(id.c_str()));
-            if (!ch)
-                throw HTTPException(HTTP_SC_NOTFOUND, 404);
+        locals->vars["channel"] = ch->getState();
+    }else if (str::contains(fn, "/relayinfo.html") || str::contains(fn, "/head.html"))
+    {
+        std::string id;
+        if (!cgi::Query::lookup(req.queryString, "id", id) || id.empty())
+            throw HTTPException(HTTP_SC_BADREQUEST, 400);
 
-            locals.vars["channel"] = ch->getState();
-        }else if (str::contains(fn, "/relayinfo.html") || str::contains(fn, "/head.html"))
+        auto ch = chanMgr->findChannelByID(GnuID(id.c_str()));
+        locals->vars["channel"] = ch ? ch->getState() : nullptr;
+    }else if (str::contains(fn, "connections.html") || str::contains(fn, "editinfo.html"))
+    {
+        std::string id;
+        if (cgi::Query::lookup(req.queryString, "id", id) && !id.empty())
         {
-            auto vec = str::split(fn, "?");
-            if (vec.size() != 2)
-                throw HTTPException(HTTP_SC_BADREQUEST, 400);
+            auto ch = chanMgr->findChannelByID(GnuID(id.c_str()));
+            locals->vars["channel"] = ch ? ch->getState() : nullptr;
+        }
+    }
 
-            String id = cgi::Query(vec[1]).get("id").c_str();
+    char *args = strstr(fileName.cstr(), "?");
+    if (args)
+        *args = '\0';
 
-            if (id.isEmpty())
-                throw HTTPException(HTTP_SC_BADREQUEST, 400);
+    validFileOrThrow(fileName.c_str(), documentRoot);
 
-            auto ch = chanMgr->findChannelByID(GnuID(id.c_str()));
-            locals.vars["channel"] = ch ? ch->getState() : nullptr;
-        }else if (str::contains(fn, "connections.html") || str::contains(fn, "editinfo.html"))
-        {
-            auto vec = str::split(fn, "?");
-            if (vec.size() == 2)
-            {
-                String id = cgi::Query(vec[1]).get("id").c_str();
+    const std::string path = fileName.cstr();
+    return [=](Stream& out)
+    {
+        HTTPRequestScope reqScope(req);
+        std::vector<Template::Scope*> scopes = { &reqScope, locals.get() };
+        HTML html("", out);
+        html.writeTemplate(path.c_str(), req.queryString.c_str(), scopes);
+    };
+}
 
-                if (!id.isEmpty())
-                {
-                    auto ch = chanMgr->findChannelByID(GnuID(id.c_str()));
-                    locals.vars["channel"] = ch ? ch->getState() : nullptr;
-                }
-            }
-        }
+// -----------------------------------
+HTTPResponse Servent::localFileResponse(const char *fn, const HTTPRequest& req)
+{
+    const std::string documentRoot = documentRootOrThrow();
 
-        char *args = strstr(fileName.cstr(), "?");
-        if (args)
-            *args = '\0';
+    String fileName = documentRoot.c_str();
+    fileName.append(fn);
 
+    LOG_TRACE("Writing HTML file: %s", sys->fromFilenameEncoding(fileName.cstr()).c_str());
 
-        validFileOrThrow(fileName.c_str(), documentRoot);
+    const char* mimeType = fileNameToMimeType(fileName);
+    if (mimeType == nullptr)
+        throw HTTPException(HTTP_SC_NOTFOUND, 404);
 
-        html.writeOK("text/html; charset=utf-8");
-        html.writeTemplate(fileName.cstr(), req.queryString.c_str(), scopes);
+    if (strcmp(mimeType, MIME_HTML) == 0)
+    {
+        // 長さを知らせて接続を続けられるように、先に最後まで描く。
+        StringStream body;
+        prepareTemplate(fn, req)(body);
+        auto res = HTTPResponse::ok({{"Content-Type", "text/html; charset=utf-8"}}, body.str());
+        if (servMgr->flags[ServMgr::F_gzipResponses])
+            g_gzipEncoder.compress(req, res);
+        return res;
     }else
     {
         validFileOrThrow(fileName.c_str(), documentRoot);
 
-        html.writeRawFile(fileName.cstr(), mimeType);
+        return g_assetCache.respond(req, fileName.cstr(), mimeType);
     }
 }
@@ -18,8 +18,11 @@
 // GNU General Public License for more details.
 // ------------------------------------------------
 
+#include <algorithm>
+#include <cstdio>
 #include <memory>
 #include <fstream>
+#include <set>
 #include <sstream>
 
 #include "servent.h"
@@ -36,6 +39,29 @@
 #include "portcheck.h"
 #include "json.hpp"
 #include "cgi.h"
+#include "logpipe.h"
+#include "resolver.h"
+#include "relaypolicy.h"
+#include "pingcache.h"
+#include "cgiworker.h"
+#include "membudget.h"
+#include "statshist.h"
+#include "statusfeed.h"
+#include "httpclient.h"
+#include "capacitytuner.h"
+#include "speedtest.h"
+#include "admission.h"
+#include "coldchan.h"
+#include "prefork.h"
+#include "handoff.h"
+#include "ypsession.h"
+#include "trackerhub.h"
+#include "locality.h"
+#include "landisco.h"
+#include "sampleprof.h"
+#include "gzipencoder.h"
+#include "http2.h"
+#include "jrpc.h"
 
 // -----------------------------------
 ServMgr::ServMgr()
@@ -43,6 +69,7 @@ ServMgr::ServMgr()
     , relayBroadcast(30) // オリジナルでは未初期化。
     , channelDirectory(new ChannelDirectory())
     , publicDirectoryEnabled(false)
+    , publicPageCacheInterval(5)
     , uptestServiceRegistry(new UptestServiceRegistry())
 #ifdef WIN32
     , rtmpServerMonitor(std::string(peercastApp->getPath()) + "rtmp-server")
@@ -51,15 +78,12 @@ ServMgr::ServMgr()
 #endif
     , flags(
         {
-            {"randomizeBroadcastingChannelID", "配信するチャンネルのIDをランダムにする。", true },
-            {"sendPortAtomWhenFirewallUnknown", "古いPeerCastStation相手に正常にポートチェックするにはオフにする。", false },
-            {"forceFirewalled", "ファイアーウォール オンであるかの様に振る舞う。", false},
-            {"startPlayingFromKeyFrame", "DIRECT接続でキーフレームまで継続パケットをスキップする。", true},
-            {"banTrackersWhileBroadcasting", "配信中他の配信者による視聴をBANする。", false},
-            {"persistTokenList", "アクセストークンリストを永続化する。", false},
-            {"enableSSLServer", "SSL接続の受け付けを有効にする。", false},
-            {"requireContinuationPacketSupportFromPeer", "継続パケットをサポートしないバージョンのクライアントとリレーしない。", false},
+#define X(name, desc, defaultValue) { #name, desc, defaultValue },
+            SERVMGR_FLAGS(X)
+#undef X
         })
+    , incomingPool(MAX_POOL_WORKERS)
+    , housekeeping("IDLE", 2)
     , preferredTheme("system")
     , accentColor("blue")
 {
@@ -77,6 +101,9 @@ ServMgr::ServMgr()
     useFlowControl = true;
 
     maxServIn = 50;
+    numAcceptors = 1;
+    cgiWorkers = 0;
+    cgiWorkerScripts = "board.cgi,thread.cgi";
 
     lastIncoming = 0;
 
@@ -119,8 +146,10 @@ ServMgr::ServMgr()
 
     totalStreams = 0;
     firewallTimeout = 30;
+    jrpcSnapshotInterval = 1000;
     pauseLog = false;
     m_logLevel = LogBuffer::T_INFO;
+    logRateLimit = 100;
 
     shutdownTimer = 0;
 
@@ -133,6 +162,12 @@ ServMgr::ServMgr()
     ensureCatchallFilters();
 
     servents = nullptr;
+    for (int i = 0; i < NUM_SERVENT_TYPES; i++)
+    {
+        typeStreamsPublic[i] = 0;
+        typeStreamsPrivate[i] = 0;
+        typeServents[i] = 0;
+    }
 
     chanLog="";
 
@@ -151,6 +186,8 @@ ServMgr::ServMgr()
     uptestServiceRegistry->addURL("http://bayonet.ddo.jp/sp/yp4g.xml");
 
     chat = true;
+
+    addHousekeepingTasks();
 }
 
 // -----------------------------------
@@ -164,10 +201,68 @@ ServMgr::~ServMgr()
     }
 }
 
+// ------------------------------------
+std::shared_ptr<Reactor> ServMgr::getReactor(const GnuID& chanID)
+{
+    if (!flags[ServMgr::F_reactorMode])
+        return nullptr;
+
+    const std::string backend = flags[ServMgr::F_ioUringReactor] ? "io_uring" : "";
+
+    std::lock_guard<ProfiledMutex> cs(lock);
+    if (flags[ServMgr::F_channelReactors] && chanID.isSet())
+    {
+        // 一つのチャンネルの送信は一本のスレッドで足りる。チャンネル同
+        // 士は互いに待たされない。
+        auto& r = channelReactors[chanID];
+        if (!r)
+            r = sys->createReactor(backend, 1);
+        return r;
+    }
+
+    if (!reactor)
+        reactor = sys->createReactor(backend);
+    return reactor;
+}
+
+// ------------------------------------
+void ServMgr::releaseChannelReactors()
+{
+    std::vector<GnuID> ids;
+    {
+        std::lock_guard<ProfiledMutex> cs(lock);
+        for (auto& pair : channelReactors)
+            ids.push_back(pair.first);
+    }
+
+    // chanMgr->lock は ServMgr::lock を持たずに取る。
+    ids.erase(std::remove_if(ids.begin(), ids.end(),
+                             [](const GnuID& id) { return chanMgr->findChannelByID(id) != nullptr; }),
+              ids.end());
+    if (ids.empty())
+        return;
+
+    // 止める時はワーカーの終了を待つので、ロックの外で捨てる。
+    std::vector<std::shared_ptr<Reactor>> unused;
+    {
+        std::lock_guard<ProfiledMutex> cs(lock);
+        for (auto& id : ids)
+        {
+            // ここ以外に持ち主がいなければ、もうストリームは無い。
+            auto it = channelReactors.find(id);
+            if (it != channelReactors.end() && it->second.use_count() == 1)
+            {
+                unused.push_back(std::move(it->second));
+                channelReactors.erase(it);
+            }
+        }
+    }
+}
+
 // ------------------------------------
 void ServMgr::updateIPAddress(const IP& newIP)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     auto it = find(serverIPAddresses.begin(), serverIPAddresses.end(), newIP);
     if (it == serverIPAddresses.end()) {
@@ -341,136 +436,44 @@ void ServMgr::ensureCatchallFilters()
 // -----------------------------------
 bool ServMgr::seenHost(Host &h, ServHost::TYPE type, unsigned int time)
 {
-    time = sys->getTime()-time;
-
-    for (int i=0; i<MAX_HOSTCACHE; i++)
-        if (hostCache[i].type == type)
-            if (hostCache[i].host.ip == h.ip)
-                if (hostCache[i].time >= time)
-                    return true;
-    return false;
+    return hostCache.seen(h.ip, type, sys->getTime()-time);
 }
 
 // -----------------------------------
 void ServMgr::addHost(Host &h, ServHost::TYPE type, unsigned int time)
 {
-    if (!h.isValid())
-        return;
-
-    ServHost *sh=nullptr;
-
-    for (int i=0; i<MAX_HOSTCACHE; i++)
-        if (hostCache[i].type == type)
-            if (hostCache[i].host.isSame(h))
-            {
-                sh = &hostCache[i];
-                break;
-            }
-
-    if (!sh)
-        LOG_DEBUG("New host: %s - %s", h.str().c_str(), ServHost::getTypeStr(type));
-    else
-        LOG_DEBUG("Old host: %s - %s", h.str().c_str(), ServHost::getTypeStr(type));
-
-    if (!sh)
-    {
-        // find empty slot
-        for (int i=0; i<MAX_HOSTCACHE; i++)
-            if (hostCache[i].type == ServHost::T_NONE)
-            {
-                sh = &hostCache[i];
-                break;
-            }
-
-        // otherwise, find oldest host and replace
-        if (!sh)
-            for (int i=0; i<MAX_HOSTCACHE; i++)
-                if (hostCache[i].type != ServHost::T_NONE)
-                {
-                    if (sh)
-                    {
-                        if (hostCache[i].time < sh->time)
-                            sh = &hostCache[i];
-                    }else{
-                        sh = &hostCache[i];
-                    }
-                }
-    }
-
-    if (sh)
-        sh->init(h, type, time);
+    hostCache.add(h, type, time);
 }
 
 // -----------------------------------
 void ServMgr::deadHost(Host &h, ServHost::TYPE t)
 {
-    for (int i=0; i<MAX_HOSTCACHE; i++)
-        if (hostCache[i].type == t)
-            if (hostCache[i].host.ip == h.ip)
-                if (hostCache[i].host.port == h.port)
-                    hostCache[i].init();
+    hostCache.remove(h, t);
 }
 
 // -----------------------------------
 void ServMgr::clearHostCache(ServHost::TYPE type)
 {
-    for (int i=0; i<MAX_HOSTCACHE; i++)
-        if ((hostCache[i].type == type) || (type == ServHost::T_NONE))
-            hostCache[i].init();
+    hostCache.clear(type);
 }
 
 // -----------------------------------
 unsigned int ServMgr::numHosts(ServHost::TYPE type)
 {
-    unsigned int cnt = 0;
-    for (int i=0; i<MAX_HOSTCACHE; i++)
-        if ((hostCache[i].type == type) || (type == ServHost::T_NONE))
-            cnt++;
-    return cnt;
+    return hostCache.count(type);
 }
 
 // -----------------------------------
 int ServMgr::getNewestServents(Host *hl, int max, Host &rh)
 {
-    int cnt=0;
-    for (int i=0; i<max; i++)
-    {
-        // find newest host not in list
-        ServHost *sh=nullptr;
-        for (int j=0; j<MAX_HOSTCACHE; j++)
-        {
-            // find newest servent
-            if (hostCache[j].type == ServHost::T_SERVENT)
-                if (!(rh.globalIP() && !hostCache[j].host.globalIP()))
-                {
-                    // and not in list already
-                    bool found=false;
-                    for (int k=0; k<cnt; k++)
-                        if (hl[k].isSame(hostCache[j].host))
-                        {
-                            found=true;
-                            break;
-                        }
-
-                    if (!found)
-                    {
-                        if (!sh)
-                        {
-                            sh = &hostCache[j];
-                        }else{
-                            if (hostCache[j].time > sh->time)
-                                sh = &hostCache[j];
-                        }
-                    }
-                }
-        }
-
-        // add to list
-        if (sh)
-            hl[cnt++]=sh->host;
-    }
-
-    return cnt;
+    auto hosts = hostCache.newest(ServHost::T_SERVENT, max,
+                                  [&](const ServHost& sh)
+                                  {
+                                      return !(rh.globalIP() && !sh.host.globalIP());
+                                  });
+    for (size_t i = 0; i < hosts.size(); i++)
+        hl[i] = hosts[i];
+    return hosts.size();
 }
 
 // -----------------------------------
@@ -494,7 +497,7 @@ Servent *ServMgr::findOldestServent(Servent::TYPE type, bool priv)
 // -----------------------------------
 Servent *ServMgr::findServent(Servent::TYPE type, Host &host, const GnuID &netid)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     Servent *s = servents;
     while (s)
@@ -516,7 +519,7 @@ Servent *ServMgr::findServent(Servent::TYPE type, Host &host, const GnuID &netid
 // -----------------------------------
 Servent *ServMgr::findServent(unsigned int ip, unsigned short port, const GnuID &netid)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
     Host target(ip, port);
 
     Servent *s = servents;
@@ -538,7 +541,7 @@ Servent *ServMgr::findServent(unsigned int ip, unsigned short port, const GnuID
 // -----------------------------------
 Servent *ServMgr::findServent(Servent::TYPE t)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     Servent *s = servents;
     while (s)
@@ -553,7 +556,7 @@ Servent *ServMgr::findServent(Servent::TYPE t)
 // -----------------------------------
 Servent *ServMgr::findServentByIndex(int id)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     Servent *s = servents;
     int cnt = 0;
@@ -572,16 +575,10 @@ Servent *ServMgr::findServentByIndex(int id)
 // -----------------------------------
 Servent *ServMgr::findServentByID(int id)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<std::mutex> st(serventStatsLock);
 
-    Servent *s = servents;
-
-    while (s)
-    {
-        if (s->serventIndex == id)
-            return s;
-        s = s->next;
-    }
+    if (id >= 1 && id <= (int) serventSlab.size())
+        return serventSlab[id - 1];
 
     return nullptr;
 }
@@ -589,23 +586,34 @@ Servent *ServMgr::findServentByID(int id)
 // -----------------------------------
 Servent *ServMgr::allocServent()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
-    Servent *s = servents;
-    while (s)
+    Servent *s = nullptr;
     {
-        if (s->status == Servent::S_FREE)
-            break;
-        s = s->next;
+        std::lock_guard<std::mutex> st(serventStatsLock);
+        while (!freeServents.empty())
+        {
+            auto c = freeServents.back();
+            freeServents.pop_back();
+            c->inFreeList = false;
+            if (c->status == Servent::S_FREE)
+            {
+                s = c;
+                break;
+            }
+        }
     }
 
     if (!s)
     {
         int num = ++serventNum;
-        s = new Servent(num);
+        s = new Servent(num, this);
         s->next = servents;
         servents = s;
 
+        std::lock_guard<std::mutex> st(serventStatsLock);
+        serventSlab.push_back(s);
+
         LOG_TRACE("allocated servent %d", num);
     }else
         LOG_TRACE("reused servent %d", s->serventIndex);
@@ -615,10 +623,133 @@ Servent *ServMgr::allocServent()
     return s;
 }
 
+// -----------------------------------
+void ServMgr::countServent(Servent *s, bool connected)
+{
+    std::lock_guard<std::mutex> st(serventStatsLock);
+
+    if (s->counted)
+    {
+        StreamKey key(s->countedType, s->countedChanID);
+        auto& c = channelStreamCounts[key];
+        if (s->countedPrivate)
+        {
+            c.priv--;
+            typeStreamsPrivate[s->countedType]--;
+        }else
+        {
+            c.pub--;
+            typeStreamsPublic[s->countedType]--;
+        }
+        if (c.pub == 0 && c.priv == 0)
+            channelStreamCounts.erase(key);
+
+        // 最後の要素を空いた位置に移す。
+        auto last = connectedServents.back();
+        connectedServents[s->connectedSlot] = last;
+        last->connectedSlot = s->connectedSlot;
+        connectedServents.pop_back();
+        s->connectedSlot = -1;
+
+        auto& route = serventRoutes[key];
+        last = route.back();
+        route[s->routeSlot] = last;
+        last->routeSlot = s->routeSlot;
+        route.pop_back();
+        s->routeSlot = -1;
+        if (route.empty())
+            serventRoutes.erase(key);
+
+        s->counted = false;
+    }
+
+    if (connected)
+    {
+        // 種類やチャンネルは接続する前に決まっている。
+        s->counted = true;
+        s->countedType = s->type;
+        s->countedChanID = s->chanID;
+        s->countedPrivate = s->isPrivate();
+
+        StreamKey key(s->countedType, s->countedChanID);
+        auto& c = channelStreamCounts[key];
+        if (s->countedPrivate)
+        {
+            c.priv++;
+            typeStreamsPrivate[s->countedType]++;
+        }else
+        {
+            c.pub++;
+            typeStreamsPublic[s->countedType]++;
+        }
+
+        s->connectedSlot = connectedServents.size();
+        connectedServents.push_back(s);
+
+        auto& route = serventRoutes[key];
+        s->routeSlot = route.size();
+        route.push_back(s);
+    }
+}
+
+// -----------------------------------
+void ServMgr::addMuxRoute(Servent *s, const GnuID &chanID)
+{
+    std::lock_guard<std::mutex> st(serventStatsLock);
+    auto& route = muxRoutes[chanID];
+    if (std::find(route.begin(), route.end(), s) == route.end())
+        route.push_back(s);
+}
+
+// -----------------------------------
+void ServMgr::removeMuxRoute(Servent *s, const GnuID &chanID)
+{
+    std::lock_guard<std::mutex> st(serventStatsLock);
+    auto route = muxRoutes.find(chanID);
+    if (!route)
+        return;
+    route->erase(std::remove(route->begin(), route->end(), s), route->end());
+    if (route->empty())
+        muxRoutes.erase(chanID);
+}
+
+// -----------------------------------
+void ServMgr::changeServentType(Servent *s, int from, int to)
+{
+    // T_NONE は割り当てられていないので数えない。
+    if (from != Servent::T_NONE)
+        typeServents[from]--;
+    if (to != Servent::T_NONE)
+        typeServents[to]++;
+}
+
+// -----------------------------------
+void ServMgr::changeServentPort(Servent *s, int from, int to)
+{
+    std::lock_guard<std::mutex> st(serventStatsLock);
+
+    if (from && --portServents[from] == 0)
+        portServents.erase(from);
+    if (to)
+        portServents[to]++;
+}
+
+// -----------------------------------
+void ServMgr::releaseServent(Servent *s)
+{
+    std::lock_guard<std::mutex> st(serventStatsLock);
+
+    if (!s->inFreeList)
+    {
+        s->inFreeList = true;
+        freeServents.push_back(s);
+    }
+}
+
 // --------------------------------------------------
 void    ServMgr::closeConnections(Servent::TYPE type)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     Servent *sv = servents;
     while (sv)
@@ -633,22 +764,21 @@ void    ServMgr::closeConnections(Servent::TYPE type)
 // -----------------------------------
 unsigned int ServMgr::numConnected(int type, bool priv, unsigned int uptime)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    if (uptime == 0)
+        return priv ? typeStreamsPrivate[type].load() : typeStreamsPublic[type].load();
+
+    std::lock_guard<std::mutex> st(serventStatsLock);
 
     unsigned int cnt=0;
 
     unsigned int ctime=sys->getTime();
-    Servent *s = servents;
-    while (s)
+    for (auto s : connectedServents)
     {
         if (s->thread.active())
-            if (s->isConnected())
-                if (s->type == type)
-                    if (s->isPrivate()==priv)
-                        if ((ctime-s->lastConnect) >= uptime)
-                            cnt++;
-
-        s = s->next;
+            if (s->countedType == type)
+                if (s->countedPrivate == priv)
+                    if ((ctime-s->lastConnect) >= uptime)
+                        cnt++;
     }
     return cnt;
 }
@@ -656,107 +786,63 @@ unsigned int ServMgr::numConnected(int type, bool priv, unsigned int uptime)
 // -----------------------------------
 unsigned int ServMgr::numConnected()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
-
-    unsigned int cnt=0;
-
-    Servent *s = servents;
-    while (s)
-    {
-        if (s->thread.active())
-            if (s->isConnected())
-                cnt++;
-
-        s = s->next;
-    }
+    unsigned int cnt = 0;
+    for (int i = 0; i < NUM_SERVENT_TYPES; i++)
+        cnt += typeStreamsPublic[i] + typeStreamsPrivate[i];
     return cnt;
 }
 
 // -----------------------------------
 unsigned int ServMgr::numServents()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<std::mutex> st(serventStatsLock);
 
-    unsigned int cnt = 0;
-
-    Servent *s = servents;
-    while (s)
-    {
-        cnt++;
-        s = s->next;
-    }
-    return cnt;
+    return serventSlab.size();
 }
 
 // -----------------------------------
 unsigned int ServMgr::numUsed(int type)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
-
-    unsigned int cnt=0;
-
-    Servent *s = servents;
-    while (s)
+    if (type == Servent::T_NONE)
     {
-        std::lock_guard<std::recursive_mutex> cs(s->lock);
-        if (s->type == type)
-            cnt++;
-        s = s->next;
+        // 割り当てられていないものと空いているもの。
+        unsigned int used = 0;
+        for (int i = 1; i < NUM_SERVENT_TYPES; i++)
+            used += typeServents[i];
+        return numServents() - used;
     }
-    return cnt;
+    return typeServents[type];
 }
 
 // -----------------------------------
 unsigned int ServMgr::numActiveOnPort(int port)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
-
-    unsigned int cnt=0;
+    std::lock_guard<std::mutex> st(serventStatsLock);
 
-    Servent *s = servents;
-    while (s)
-    {
-        std::lock_guard<std::recursive_mutex> cs(s->lock);
-        if (s->thread.active() && s->sock && (s->servPort == port))
-            cnt++;
-        s = s->next;
-    }
-    return cnt;
+    auto it = portServents.find(port);
+    return (it == portServents.end()) ? 0 : it->second;
 }
 
 // -----------------------------------
 unsigned int ServMgr::numActive(Servent::TYPE tp)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
-
-    unsigned int cnt=0;
-
-    Servent *s = servents;
-    while (s)
-    {
-        std::lock_guard<std::recursive_mutex> cs(s->lock);
-
-        if (s->thread.active() && s->sock && (s->type == tp))
-            cnt++;
-        s = s->next;
-    }
-    return cnt;
+    return numUsed(tp);
 }
 
 // -----------------------------------
 unsigned int ServMgr::totalOutput(bool all)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<std::mutex> st(serventStatsLock);
 
     unsigned int tot = 0;
-    Servent *s = servents;
-    while (s)
+    for (auto s : connectedServents)
     {
-        if (s->isConnected())
-            if (all || !s->isPrivate())
-                if (s->sock)
-                    tot += s->sock->bytesOutPerSec();
-        s = s->next;
+        if (all || !s->countedPrivate)
+        {
+            auto sock = s->sock;
+            if (sock)
+                tot += sock->bytesOutPerSec();
+        }
     }
 
     return tot;
@@ -768,11 +854,17 @@ void ServMgr::quit()
     LOG_DEBUG("ServMgr is quitting..");
 
     serverThread.shutdown();
-    idleThread.shutdown();
+    housekeeping.stop();
+    startupThread.shutdown();
 
     LOG_DEBUG("Disabling RMTP server..");
     rtmpServerMonitor.disable();
 
+    settingsWriter.stop();
+    g_cgiWorkers.stop();
+    g_prefork.stop();
+    g_restartHandoff.stop();
+
     Servent *s = servents;
     while (s)
     {
@@ -839,16 +931,28 @@ void ServMgr::checkFirewall()
     }
 }
 
+// -----------------------------------
+void ServMgr::checkGlobalIP()
+{
+    std::lock_guard<ProfiledMutex> cs(globalIPCheckLock);
+
+    // 待っている間に他のスレッドが調べ終えていれば何もしない。
+    if (serverHost.ip.isGlobal())
+        return;
+
+    checkFirewall();
+}
+
 // -----------------------------------
 ServMgr::FW_STATE ServMgr::getFirewall(int ipv)
 {
     if (ipv != 4 && ipv != 6)
         throw ArgumentException("getFirewall: Invalid IP version");
 
-    if (this->flags.get("forceFirewalled"))
+    if (this->flags[ServMgr::F_forceFirewalled])
         return FW_ON;
         
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
     if (ipv == 4)
         return firewalled;
     else
@@ -876,7 +980,7 @@ void ServMgr::setFirewall(int ipv, FW_STATE state)
     if (ipv != 4 && ipv != 6)
         throw ArgumentException("setFirewall: Invalid IP version");
 
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     auto str = getFirewallStateString(state);
 
@@ -950,7 +1054,7 @@ void ServMgr::checkFirewallIPv6()
 // -----------------------------------
 bool ServMgr::isBlacklisted(const Host& h)
 {
-    if (flags.get("banTrackersWhileBroadcasting") && chanMgr->isBroadcasting())
+    if (flags[ServMgr::F_banTrackersWhileBroadcasting] && chanMgr->isBroadcasting())
     {
         for (auto& entry : channelDirectory->channels())
         {
@@ -971,15 +1075,11 @@ bool ServMgr::isFiltered(int fl, Host &h)
     if ((fl & ServFilter::F_BAN) && isBlacklisted(h))
         return true;
 
-    for (int i=0; i<numFilters; i++)
-        if (filters[i].matches(fl, h))
-            return true;
-
-    return false;
+    return filterEngine.matches(fl, h, filters, numFilters);
 }
 
 // --------------------------------------------------
-static ini::Section writeServHost(ServHost &sh)
+static ini::Section writeServHost(const ServHost &sh)
 {
     return {
         "Host",
@@ -992,6 +1092,10 @@ static ini::Section writeServHost(ServHost &sh)
     };
 }
 
+// --------------------------------------------------
+// RelayChannel に書いておく上流の候補の数。
+static const int MAX_SAVED_HITS = 4;
+
 // --------------------------------------------------
 static ini::Section writeRelayChannel(std::shared_ptr<Channel> c)
 {
@@ -999,16 +1103,16 @@ static ini::Section writeRelayChannel(std::shared_ptr<Channel> c)
     auto& keys = sec.keys;
 
     keys.emplace_back("name", c->getName());
-    keys.emplace_back("desc", c->info.desc);
-    keys.emplace_back("genre", c->info.genre);
-    keys.emplace_back("contactURL", c->info.url);
-    keys.emplace_back("comment", c->info.comment);
+    keys.emplace_back("desc", c->info.desc.str());
+    keys.emplace_back("genre", c->info.genre.str());
+    keys.emplace_back("contactURL", c->info.url.str());
+    keys.emplace_back("comment", c->info.comment.str());
     if (!c->sourceURL.isEmpty())
         keys.emplace_back("sourceURL", c->sourceURL);
     keys.emplace_back("sourceProtocol", ChanInfo::getProtocolStr(c->info.srcProtocol));
     keys.emplace_back("contentType", c->info.getTypeStr());
-    keys.emplace_back("MIMEType", c->info.MIMEType);
-    keys.emplace_back("streamExt", c->info.streamExt);
+    keys.emplace_back("MIMEType", c->info.MIMEType.str());
+    keys.emplace_back("streamExt", c->info.streamExt.str());
     keys.emplace_back("bitrate", c->info.bitrate);
     keys.emplace_back("id", c->info.id.str());
     keys.emplace_back("stayConnected", c->stayConnected);
@@ -1025,81 +1129,120 @@ static ini::Section writeRelayChannel(std::shared_ptr<Channel> c)
         }
     }
 
+    // 上流の候補の書き出し。アドレス,ホップ数,接続時間,受信速度の割合。
+    if (chl && servMgr->flags[ServMgr::F_saveRelayHits])
+    {
+        for (auto& h : chl->goodRelayHits(MAX_SAVED_HITS, g_relayStats))
+        {
+            RelayStats::Entry e;
+            g_relayStats.get(h.host, e);
+            keys.emplace_back("hit", str::format("%s,%u,%.3f,%.3f",
+                                                 h.host.str().c_str(), h.numHops, e.rtt, e.throughput));
+        }
+    }
+
     // トラック情報の書き出し。
-    keys.emplace_back("trackContact", c->info.track.contact);
-    keys.emplace_back("trackTitle", c->info.track.title);
-    keys.emplace_back("trackArtist", c->info.track.artist);
-    keys.emplace_back("trackAlbum", c->info.track.album);
-    keys.emplace_back("trackGenre", c->info.track.genre);
+    keys.emplace_back("trackContact", c->info.track.contact.str());
+    keys.emplace_back("trackTitle", c->info.track.title.str());
+    keys.emplace_back("trackArtist", c->info.track.artist.str());
+    keys.emplace_back("trackAlbum", c->info.track.album.str());
+    keys.emplace_back("trackGenre", c->info.track.genre.str());
 
     keys.emplace_back("ipVersion", c->ipVersion);
+    if (c->packetBufferDuration)
+        keys.emplace_back("packetBufferDuration", c->packetBufferDuration);
 
     return sec;
 }
 
 // --------------------------------------------------
-void ServMgr::saveSettings(const char *fn)
+// 他のワーカーの報告にある [RelayChannel] を、書き直さずにそのまま読む。
+static std::vector<ini::Section> readWorkerRelays(const std::string& path)
 {
-    FileStream iniFile;
-    ini::Document settings = getSettings();
-    std::string tmpname = str::STR(fn, ".tmp");
+    std::vector<ini::Section> secs;
+    IniFile iniFile;
+    if (!iniFile.openReadOnly(path.c_str()))
+        return secs;
 
-    try {
-        iniFile.openWriteReplace(tmpname.c_str());
-    } catch (StreamException&) {
-        LOG_ERROR("Unable to open ini file");
-    }
-    // 改行コードを設定する。
-#if defined(_LINUX) || defined(__APPLE__)
-    iniFile.writeCRLF = false;
-#endif
+    while (iniFile.readNext())
+    {
+        if (!iniFile.isName("[RelayChannel]"))
+            continue;
 
-    LOG_DEBUG("Saving settings to: %s", fn);
-    iniFile.writeString(ini::dump(settings));
-    iniFile.close();
+        ini::Section sec("RelayChannel", {}, "End");
+        while (iniFile.readNext() && !iniFile.isName("[End]"))
+            sec.keys.emplace_back(iniFile.getName(), std::string(iniFile.getStrValue()));
+        secs.push_back(sec);
+    }
+    return secs;
+}
 
-    try {
-        sys->rename(tmpname, fn);
-    } catch (GeneralException& e) {
-        LOG_ERROR("rename failed: %s", e.what());
+// --------------------------------------------------
+// writeRelayChannel が書いた上流の候補を読み、ヒットと測定値を戻す。
+static void readRelayHit(const std::string& value, const GnuID& chanID)
+{
+    auto fields = str::split(value, ",");
+    if (fields.size() != 4)
+    {
+        LOG_ERROR("Invalid relay hit: %s", value.c_str());
+        return;
     }
 
-    this->saveTokenList();
+    ChanHit hit;
+    hit.init();
+    hit.host.fromStrIP(fields[0].c_str(), DEFAULT_PORT);
+    if (!hit.host.ip)
+        return;
+    hit.rhost[0] = hit.host;
+    hit.rhost[1] = hit.host;
+    hit.numHops = atoi(fields[1].c_str());
+    hit.chanID = chanID;
+    hit.recv = true;
+    hit.relay = true;
+    chanMgr->addHit(hit);
+
+    double rtt = atof(fields[2].c_str());
+    double throughput = atof(fields[3].c_str());
+    if (rtt >= 0)
+        g_relayStats.recordConnect(hit.host, rtt);
+    if (throughput >= 0)
+        g_relayStats.recordThroughput(hit.host, throughput);
 }
 
 // --------------------------------------------------
-void ServMgr::saveTokenList()
+// 内容はロックを取って写し取るが、ファイルへの書き込みは
+// settingsWriter に任せるので、呼び出し元はディスクを待たない。
+void ServMgr::saveSettings(const char *fn)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::string text = ini::dump(getSettings());
 
-    if (!this->flags.get("persistTokenList"))
-        return;
+    LOG_DEBUG("Saving settings to: %s", fn);
+    settingsWriter.save(fn, std::move(text));
 
-    std::string tokenListFilename = peercastApp->getTokenListFilename();
-    std::string tmpname = str::STR(tokenListFilename, ".tmp");
+    this->saveTokenList();
+}
 
-    std::ofstream tmp(tmpname);
-    if (tmp.fail())
+// --------------------------------------------------
+void ServMgr::saveTokenList()
+{
+    std::string text;
     {
-        LOG_ERROR("saveTokenList: Failed to open %s for writing", tmpname.c_str());
-        return;
-    }
+        std::lock_guard<ProfiledMutex> cs(lock);
 
-    tmp << this->cookieList.getState().inspect();
-    tmp.close();
+        if (!this->flags[ServMgr::F_persistTokenList])
+            return;
 
-    try {
-        sys->rename(tmpname, tokenListFilename);
-    } catch (GeneralException& e) {
-        LOG_ERROR("rename failed: %s", e.what());
+        text = this->cookieList.getState().inspect();
     }
+
+    settingsWriter.save(peercastApp->getTokenListFilename(), std::move(text));
 }
 
 // --------------------------------------------------
 ini::Document ServMgr::getSettings()
 {
-    std::lock_guard<std::recursive_mutex> cs1(lock);
-    std::lock_guard<std::recursive_mutex> cs2(chanMgr->lock);
+    std::lock_guard<ProfiledMutex> cs1(lock);
+    std::lock_guard<ProfiledMutex> cs2(chanMgr->lock);
 
     ini::Document doc;
 
@@ -1116,19 +1259,45 @@ ini::Document ServMgr::getSettings()
             {"maxRelays", this->maxRelays},
             {"maxDirect", this->maxDirect},
             {"maxRelaysPerChannel", chanMgr->maxRelaysPerChannel},
+            {"packetBufferDuration", chanMgr->packetBufferDuration},
+            {"joinKeyFramesBack", chanMgr->joinKeyFramesBack},
+            {"maxHitsPerChannel", chanMgr->maxHitsPerChannel},
+            {"dvrSize", chanMgr->dvrSize},
+            {"memoryBudget", chanMgr->memoryBudget},
+            {"ingestJitterMsec", chanMgr->ingestJitterMsec},
+            {"dvrDirectory", chanMgr->dvrDirectory},
+            {"recordDirectory", chanMgr->recordDirectory},
+            {"recordSegmentSeconds", chanMgr->recordSegmentSeconds},
             {"firewallTimeout", firewallTimeout},
+            {"jrpcSnapshotInterval", jrpcSnapshotInterval},
             {"forceNormal", forceNormal},
             {"rootMsg", rootMsg},
             {"authType", (this->authType == ServMgr::AUTH_COOKIE) ? "cookie" : "http-basic"},
             {"cookiesExpire", (this->cookieList.neverExpire) ? "never": "session"},
+            {"maxSessions", (unsigned int) this->cookieList.maxCookies},
+            {"sessionTimeout", (unsigned int) this->cookieList.timeout},
             {"htmlPath", this->htmlPath},
             {"maxServIn", this->maxServIn},
+            {"numAcceptors", this->numAcceptors},
+            {"cgiWorkers", this->cgiWorkers},
+            {"cgiWorkerScripts", this->cgiWorkerScripts},
+            {"maxHostCache", (unsigned int) this->hostCache.capacity()},
             {"chanLog", this->chanLog},
             {"publicDirectory", this->publicDirectoryEnabled},
+            {"publicPageCacheInterval", this->publicPageCacheInterval},
             {"networkID", networkID.str()},
         }
     });
 
+    // スレッドの種類ごとの優先度と CPU
+    for (int i = 0; i < ThreadClass::NUM_TYPES; i++)
+    {
+        auto t = (ThreadClass::TYPE) i;
+        auto s = ThreadClass::setting(t);
+        doc.back().keys.push_back({ ThreadClass::priorityKey(t), s.priority });
+        doc.back().keys.push_back({ ThreadClass::affinityKey(t), s.affinity });
+    }
+
     doc.push_back(
     {
         "Broadcast",
@@ -1241,27 +1410,46 @@ ini::Document ServMgr::getSettings()
         {
             {"logLevel", logLevel()},
             {"pauseLog", pauseLog},
+            {"logRateLimit", logRateLimit},
             {"idleSleepTime", sys->idleSleepTime},
         }
     });
 
 
+    std::set<std::string> relayIDs;
     std::shared_ptr<Channel> c = chanMgr->channel;
     while (c)
     {
         if (c->isActive() && c->stayConnected)
+        {
             doc.push_back(writeRelayChannel(c));
+            relayIDs.insert(c->info.id.str());
+        }
 
         c = c->next;
     }
 
-    for (int i = 0; i < ServMgr::MAX_HOSTCACHE; i++)
+    // ワーカーのモードでは、他のワーカーが報告したリレーも書く。
+    if (g_prefork.enabled() && g_prefork.isPrimary())
     {
-        ServHost *sh = &this->hostCache[i];
-        if (sh->type != ServHost::T_NONE)
-            doc.push_back(writeServHost(*sh));
+        for (int i = 1; i < g_prefork.numWorkers(); i++)
+        {
+            for (auto& sec : readWorkerRelays(workerReportPath(i, "ini")))
+            {
+                auto id = std::find_if(sec.keys.begin(), sec.keys.end(),
+                                       [](const ini::Key& k) { return k.first == "id"; });
+                if (id != sec.keys.end() && !relayIDs.insert(id->second.dump()).second)
+                    continue;
+                doc.push_back(sec);
+            }
+        }
     }
 
+    this->hostCache.forEach([&](const ServHost& sh)
+                            {
+                                doc.push_back(writeServHost(sh));
+                            });
+
     std::vector<ini::Key> keys;
     this->flags.forEachFlag([&](Flag& flag)
                             {
@@ -1318,6 +1506,82 @@ void readFilterSettings(IniFileBase &iniFile, ServFilter &sv)
     }
 }
 
+// --------------------------------------------------
+// [RelayChannel] の中身を [End] まで読んで savedRelays に加える。
+void ServMgr::readRelayChannel(IniFileBase& iniFile)
+{
+    ChanInfo info;
+    bool stayConnected=false;
+    String sourceURL;
+    Channel::IP_VERSION ipv = Channel::IP_V4;
+    unsigned int bufferDuration = 0;
+
+    while (iniFile.readNext())
+    {
+        if (iniFile.isName("[End]"))
+            break;
+        else if (iniFile.isName("name"))
+            info.name.set(iniFile.getStrValue());
+        else if (iniFile.isName("desc"))
+            info.desc.set(iniFile.getStrValue());
+        else if (iniFile.isName("genre"))
+            info.genre.set(iniFile.getStrValue());
+        else if (iniFile.isName("contactURL"))
+            info.url.set(iniFile.getStrValue());
+        else if (iniFile.isName("comment"))
+            info.comment.set(iniFile.getStrValue());
+        else if (iniFile.isName("id"))
+            info.id.fromStr(iniFile.getStrValue());
+        else if (iniFile.isName("sourceType"))
+            info.srcProtocol = ChanInfo::getProtocolFromStr(iniFile.getStrValue());
+        else if (iniFile.isName("contentType"))
+            info.contentType = iniFile.getStrValue();
+        else if (iniFile.isName("MIMEType"))
+            info.MIMEType = iniFile.getStrValue();
+        else if (iniFile.isName("streamExt"))
+            info.streamExt = iniFile.getStrValue();
+        else if (iniFile.isName("stayConnected"))
+            stayConnected = iniFile.getBoolValue();
+        else if (iniFile.isName("sourceURL"))
+            sourceURL.set(iniFile.getStrValue());
+        else if (iniFile.isName("bitrate"))
+            info.bitrate = atoi(iniFile.getStrValue());
+        else if (iniFile.isName("tracker"))
+        {
+            ChanHit hit;
+            hit.init();
+            hit.tracker = true;
+            hit.host.fromStrName(iniFile.getStrValue(), DEFAULT_PORT);
+            hit.rhost[0] = hit.host;
+            hit.rhost[1] = hit.host;
+            hit.chanID = info.id;
+            hit.recv = true;
+            chanMgr->addHit(hit);
+        }
+        else if (iniFile.isName("hit"))
+            readRelayHit(iniFile.getStrValue(), info.id);
+        else if (iniFile.isName("trackContact"))
+            info.track.contact = iniFile.getStrValue();
+        else if (iniFile.isName("trackTitle"))
+            info.track.title = iniFile.getStrValue();
+        else if (iniFile.isName("trackArtist"))
+            info.track.artist = iniFile.getStrValue();
+        else if (iniFile.isName("trackAlbum"))
+            info.track.album = iniFile.getStrValue();
+        else if (iniFile.isName("trackGenre"))
+            info.track.genre = iniFile.getStrValue();
+        else if (iniFile.isName("ipVersion"))
+            ipv = (iniFile.getIntValue() == 6) ? Channel::IP_V6 : Channel::IP_V4;
+        else if (iniFile.isName("packetBufferDuration"))
+            bufferDuration = iniFile.getIntValue();
+    }
+    // ワーカーの報告と ini の両方にあれば一つにする。
+    for (auto& r : savedRelays)
+        if (r.info.id.isSame(info.id))
+            return;
+    savedRelays.push_back({ info, stayConnected, sourceURL.str(), ipv, bufferDuration });
+}
+
 // --------------------------------------------------
 void ServMgr::loadSettings(const char *fn)
 {
@@ -1329,10 +1593,10 @@ void ServMgr::loadSettings(const char *fn)
 
     this->numFilters = 0;
 
-    std::lock_guard<std::recursive_mutex> cs(this->uptestServiceRegistry->m_lock);
+    std::lock_guard<ProfiledMutex> cs(this->uptestServiceRegistry->m_lock);
     this->uptestServiceRegistry->clear();
 
-    std::lock_guard<std::recursive_mutex> cs1(this->channelDirectory->m_lock);
+    std::lock_guard<ProfiledMutex> cs1(this->channelDirectory->m_lock);
     this->channelDirectory->clearFeeds();
 
     if (iniFile.openReadOnly(fn))
@@ -1377,9 +1641,29 @@ void ServMgr::loadSettings(const char *fn)
                 chanMgr->maxRelaysPerChannel = iniFile.getIntValue();
             else if (iniFile.isName("maxRelaysPerChannel"))
                 chanMgr->maxRelaysPerChannel = iniFile.getIntValue();
+            else if (iniFile.isName("packetBufferDuration"))
+                chanMgr->packetBufferDuration = iniFile.getIntValue();
+            else if (iniFile.isName("joinKeyFramesBack"))
+                chanMgr->joinKeyFramesBack = iniFile.getIntValue();
+            else if (iniFile.isName("maxHitsPerChannel"))
+                chanMgr->maxHitsPerChannel = iniFile.getIntValue();
+            else if (iniFile.isName("dvrSize"))
+                chanMgr->dvrSize = iniFile.getIntValue();
+            else if (iniFile.isName("memoryBudget"))
+                chanMgr->memoryBudget = iniFile.getIntValue();
+            else if (iniFile.isName("ingestJitterMsec"))
+                chanMgr->ingestJitterMsec = std::min(iniFile.getIntValue(), 10000);
+            else if (iniFile.isName("dvrDirectory"))
+                chanMgr->dvrDirectory = iniFile.getStrValue();
+            else if (iniFile.isName("recordDirectory"))
+                chanMgr->recordDirectory = iniFile.getStrValue();
+            else if (iniFile.isName("recordSegmentSeconds"))
+                chanMgr->recordSegmentSeconds = iniFile.getIntValue();
 
             else if (iniFile.isName("firewallTimeout"))
                 firewallTimeout = iniFile.getIntValue();
+            else if (iniFile.isName("jrpcSnapshotInterval"))
+                jrpcSnapshotInterval = iniFile.getIntValue();
             else if (iniFile.isName("forceNormal"))
                 forceNormal = iniFile.getBoolValue();
             else if (iniFile.isName("broadcastMsgInterval"))
@@ -1392,10 +1676,24 @@ void ServMgr::loadSettings(const char *fn)
                 chanMgr->icyMetaInterval = iniFile.getIntValue();
             else if (iniFile.isName("maxServIn"))
                 this->maxServIn = iniFile.getIntValue();
+            else if (iniFile.isName("numAcceptors"))
+                this->numAcceptors = std::max(1, std::min(iniFile.getIntValue(), (int) MAX_ACCEPTORS));
+            else if (iniFile.isName("cgiWorkers"))
+                this->cgiWorkers = std::max(0, std::min(iniFile.getIntValue(), (int) MAX_CGI_WORKERS));
+            else if (iniFile.isName("cgiWorkerScripts"))
+                this->cgiWorkerScripts = iniFile.getStrValue();
+            else if (iniFile.isName("maxHostCache"))
+                this->hostCache.setCapacity(iniFile.getIntValue());
             else if (iniFile.isName("chanLog"))
                 this->chanLog.set(iniFile.getStrValue(), String::T_ASCII);
             else if (iniFile.isName("publicDirectory"))
                 this->publicDirectoryEnabled = iniFile.getBoolValue();
+            else if (iniFile.isName("publicPageCacheInterval"))
+                this->publicPageCacheInterval = iniFile.getIntValue();
+            else if (ThreadClass::readSetting(iniFile.getName(), iniFile.getStrValue()))
+            {
+                // ingestThreadPriority など。
+            }
 
             else if (iniFile.isName("rootMsg"))
                 rootMsg.set(iniFile.getStrValue());
@@ -1416,6 +1714,10 @@ void ServMgr::loadSettings(const char *fn)
                 else if (Sys::stricmp(t, "session")==0)
                     this->cookieList.neverExpire = false;
             }
+            else if (iniFile.isName("maxSessions"))
+                this->cookieList.maxCookies = std::max(1, iniFile.getIntValue());
+            else if (iniFile.isName("sessionTimeout"))
+                this->cookieList.timeout = std::max(0, iniFile.getIntValue());
 
             // privacy settings
             else if (iniFile.isName("password"))
@@ -1470,6 +1772,8 @@ void ServMgr::loadSettings(const char *fn)
                 logLevel(iniFile.getIntValue());
             else if (iniFile.isName("pauseLog"))
                 pauseLog = iniFile.getBoolValue();
+            else if (iniFile.isName("logRateLimit"))
+                logRateLimit = iniFile.getIntValue();
             else if (iniFile.isName("idleSleepTime"))
                 sys->idleSleepTime = iniFile.getIntValue();
             else if (iniFile.isName("[Server1]"))
@@ -1517,79 +1821,7 @@ void ServMgr::loadSettings(const char *fn)
                 }
             }
             else if (iniFile.isName("[RelayChannel]"))
-            {
-                ChanInfo info;
-                bool stayConnected=false;
-                String sourceURL;
-                Channel::IP_VERSION ipv = Channel::IP_V4;
-
-                while (iniFile.readNext())
-                {
-                    if (iniFile.isName("[End]"))
-                        break;
-                    else if (iniFile.isName("name"))
-                        info.name.set(iniFile.getStrValue());
-                    else if (iniFile.isName("desc"))
-                        info.desc.set(iniFile.getStrValue());
-                    else if (iniFile.isName("genre"))
-                        info.genre.set(iniFile.getStrValue());
-                    else if (iniFile.isName("contactURL"))
-                        info.url.set(iniFile.getStrValue());
-                    else if (iniFile.isName("comment"))
-                        info.comment.set(iniFile.getStrValue());
-                    else if (iniFile.isName("id"))
-                        info.id.fromStr(iniFile.getStrValue());
-                    else if (iniFile.isName("sourceType"))
-                        info.srcProtocol = ChanInfo::getProtocolFromStr(iniFile.getStrValue());
-                    else if (iniFile.isName("contentType"))
-                        info.contentType = iniFile.getStrValue();
-                    else if (iniFile.isName("MIMEType"))
-                        info.MIMEType = iniFile.getStrValue();
-                    else if (iniFile.isName("streamExt"))
-                        info.streamExt = iniFile.getStrValue();
-                    else if (iniFile.isName("stayConnected"))
-                        stayConnected = iniFile.getBoolValue();
-                    else if (iniFile.isName("sourceURL"))
-                        sourceURL.set(iniFile.getStrValue());
-                    else if (iniFile.isName("bitrate"))
-                        info.bitrate = atoi(iniFile.getStrValue());
-                    else if (iniFile.isName("tracker"))
-                    {
-                        ChanHit hit;
-                        hit.init();
-                        hit.tracker = true;
-                        hit.host.fromStrName(iniFile.getStrValue(), DEFAULT_PORT);
-                        hit.rhost[0] = hit.host;
-                        hit.rhost[1] = hit.host;
-                        hit.chanID = info.id;
-                        hit.recv = true;
-                        chanMgr->addHit(hit);
-                    }
-                    else if (iniFile.isName("trackContact"))
-                        info.track.contact = iniFile.getStrValue();
-                    else if (iniFile.isName("trackTitle"))
-                        info.track.title = iniFile.getStrValue();
-                    else if (iniFile.isName("trackArtist"))
-                        info.track.artist = iniFile.getStrValue();
-                    else if (iniFile.isName("trackAlbum"))
-                        info.track.album = iniFile.getStrValue();
-                    else if (iniFile.isName("trackGenre"))
-                        info.track.genre = iniFile.getStrValue();
-                    else if (iniFile.isName("ipVersion"))
-                        ipv = (iniFile.getIntValue() == 6) ? Channel::IP_V6 : Channel::IP_V4;
-                }
-                if (sourceURL.isEmpty())
-                {
-                    chanMgr->createRelay(info, stayConnected);
-                }else
-                {
-                    info.bcID = chanMgr->broadcastID;
-                    auto c = chanMgr->createChannel(info);
-                    c->ipVersion = ipv;
-                    if (c)
-                        c->startURL(sourceURL.cstr());
-                }
-            } else if (iniFile.isName("[Host]"))
+                readRelayChannel(iniFile); else if (iniFile.isName("[Host]"))
             {
                 Host h;
                 ServHost::TYPE type = ServHost::T_NONE;
@@ -1628,15 +1860,20 @@ void ServMgr::loadSettings(const char *fn)
         }
     }
 
+    // 他のワーカーが報告したリレー。前にワーカー 0 が保存した後で変わ
+    // った分もここで拾う。
+    for (int i = 1; i < Prefork::MAX_WORKERS; i++)
+        readWorkerReport(workerReportPath(i, "ini").c_str(), g_prefork.numWorkers());
+
     ensureCatchallFilters();
 }
 
 // --------------------------------------------------
 void ServMgr::loadTokenList()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
-    if (!this->flags.get("persistTokenList"))
+    if (!this->flags[ServMgr::F_persistTokenList])
         return;
 
     try {
@@ -1688,39 +1925,18 @@ void ServMgr::loadTokenList()
 // --------------------------------------------------
 unsigned int ServMgr::numStreams(const GnuID &cid, Servent::TYPE tp, bool all)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<std::mutex> st(serventStatsLock);
 
-    int cnt = 0;
-    Servent *sv = servents;
-    while (sv)
-    {
-        std::lock_guard<std::recursive_mutex> cs(sv->lock);
-        if (sv->isConnected())
-            if (sv->type == tp)
-                if (sv->chanID.isSame(cid))
-                    if (all || !sv->isPrivate())
-                        cnt++;
-        sv=sv->next;
-    }
-    return cnt;
+    auto c = channelStreamCounts.find(StreamKey(tp, cid));
+    if (!c)
+        return 0;
+    return c->pub + (all ? c->priv : 0);
 }
 
 // --------------------------------------------------
 unsigned int ServMgr::numStreams(Servent::TYPE tp, bool all)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
-
-    int cnt = 0;
-    Servent *sv = servents;
-    while (sv)
-    {
-        if (sv->isConnected())
-            if (sv->type == tp)
-                if (all || !sv->isPrivate())
-                    cnt++;
-        sv=sv->next;
-    }
-    return cnt;
+    return typeStreamsPublic[tp] + (all ? typeStreamsPrivate[tp].load() : 0);
 }
 
 // --------------------------------------------------
@@ -1775,16 +1991,13 @@ bool ServMgr::getChannel(char *str, ChanInfo &info, bool relay)
 // --------------------------------------------------
 Servent *ServMgr::findConnection(Servent::TYPE t, const GnuID &sid)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<std::mutex> st(serventStatsLock);
 
-    Servent *sv = servents;
-    while (sv)
+    for (auto sv : connectedServents)
     {
-        if (sv->isConnected())
-            if (sv->type == t)
-                if (sv->remoteID.isSame(sid))
-                    return sv;
-        sv=sv->next;
+        if (sv->countedType == t)
+            if (sv->remoteID.isSame(sid))
+                return sv;
     }
     return nullptr;
 }
@@ -1861,23 +2074,214 @@ bool ServMgr::start()
         }
     }
 
-    checkForceIP();
+    // 他のワーカーから渡された接続を受ける。
+    g_prefork.startReceiver([](std::shared_ptr<ClientSocket> cs)
+    {
+        Servent *ns = servMgr->allocServent();
+        if (!ns)
+        {
+            LOG_ERROR("Out of servents");
+            cs->close();
+            return;
+        }
+        ns->setServPort(servMgr->serverHost.port);
+        ns->networkID = servMgr->networkID;
+        ns->initIncoming(cs, servMgr->allowServer1);
+    });
+
+    // 再起動の時に新しいプロセスに接続を引き継ぐ。ワーカーのモードでは
+    // 待ち受けを共有しているので使わない。
+    if (flags[ServMgr::F_restartHandoff] && !g_prefork.enabled())
+        g_restartHandoff.start(std::string(peercastApp->getStateDirPath()) + "/handoff.sock");
 
+    // 外と通信するものは待たずに、先にサーバーを立てる。
     serverThread.func = ServMgr::serverProc;
     if (!sys->startThread(&serverThread))
         return false;
 
-    idleThread.func = ServMgr::idleProc;
-    if (!sys->startThread(&idleThread))
+    if (!housekeeping.start())
+        return false;
+
+    startupThread.func = ServMgr::startupProc;
+    startupThread.threadClass = ThreadClass::T_BACKGROUND;
+    if (!sys->startThread(&startupThread))
         return false;
 
     return true;
 }
 
+// -----------------------------------
+// forceIP の名前解決を済ませてから、保存されていたリレーを再開する。
+// チャンネルはそれぞれのスレッドで並行して接続する。
+int ServMgr::startupProc(ThreadInfo *thread)
+{
+    sys->setThreadName("STARTUP");
+
+    // 前のプロセスから引き継いだチャンネルを、保存されていたリレーより
+    // 先に受け直す。
+    g_restartHandoff.resume();
+
+    servMgr->checkForceIP();
+    servMgr->restoreRelays();
+
+    return 0;
+}
+
+// -----------------------------------
+void ServMgr::restoreRelays()
+{
+    std::vector<SavedRelay> relays;
+    {
+        std::lock_guard<ProfiledMutex> cs(lock);
+        relays.swap(savedRelays);
+    }
+
+    for (auto& r : relays)
+    {
+        // ワーカーのモードでは、受け持ちのチャンネルだけを再開する。
+        if (!g_prefork.isLocal(r.info.id))
+            continue;
+        // 前のプロセスから引き継いだ。
+        if (chanMgr->findChannelByID(r.info.id))
+            continue;
+
+        if (r.sourceURL.empty())
+        {
+            auto c = chanMgr->createRelay(r.info, r.stayConnected);
+            if (c)
+                c->packetBufferDuration = r.packetBufferDuration;
+        }else
+        {
+            r.info.bcID = chanMgr->broadcastID;
+            auto c = chanMgr->createChannel(r.info);
+            if (c)
+            {
+                c->ipVersion = r.ipVersion;
+                c->packetBufferDuration = r.packetBufferDuration;
+                c->startURL(r.sourceURL.c_str());
+            }
+        }
+    }
+
+    relaysRestored = true;
+}
+
+// -----------------------------------
+std::string ServMgr::workerReportPath(int index, const char* ext)
+{
+    return sys->joinPath({ peercastApp->getStateDirPath(),
+                           str::format("worker%d.%s", index, ext) });
+}
+
+// -----------------------------------
+void ServMgr::saveWorkerReport()
+{
+    // リレーを再開する前に書くと、まだ作っていない分が報告から消える。
+    if (g_prefork.isPrimary() || !relaysRestored)
+        return;
+
+    ini::Document doc;
+    doc.push_back(
+    {
+        "Worker",
+        {
+            {"index", g_prefork.index()},
+            {"numWorkers", g_prefork.numWorkers()},
+        },
+        "End"
+    });
+    for (auto c = chanMgr->channel; c; c = c->next)
+    {
+        if (c->isActive() && c->stayConnected)
+            doc.push_back(writeRelayChannel(c));
+    }
+
+    std::string text = ini::dump(doc);
+    bool changed;
+    {
+        std::lock_guard<ProfiledMutex> cs(lock);
+        changed = (text != lastWorkerReport);
+        if (changed)
+            lastWorkerReport = text;
+    }
+    if (changed)
+        settingsWriter.save(workerReportPath(g_prefork.index(), "ini"), std::move(text));
+
+    settingsWriter.save(workerReportPath(g_prefork.index(), "json"),
+                        JrpcApi().getChannels({}).dump());
+}
+
+// -----------------------------------
+void ServMgr::readWorkerReport(const char* path, int numWorkers)
+{
+    IniFile iniFile;
+    if (!iniFile.openReadOnly(path))
+        return;
+
+    while (iniFile.readNext())
+    {
+        if (iniFile.isName("[Worker]"))
+        {
+            int index = -1, n = 0;
+            while (iniFile.readNext() && !iniFile.isName("[End]"))
+            {
+                if (iniFile.isName("index"))
+                    index = iniFile.getIntValue();
+                else if (iniFile.isName("numWorkers"))
+                    n = iniFile.getIntValue();
+            }
+
+            // このワーカーの受け持ちの全てなので、peercast.ini にあった
+            // 分は古いかもしれない。止めたリレーを生き返らせない。
+            if (n > 1 && n == numWorkers && index > 0 && index < n)
+            {
+                savedRelays.erase(std::remove_if(savedRelays.begin(), savedRelays.end(),
+                                                 [&](const SavedRelay& r)
+                                                 {
+                                                     return Prefork::shardOf(r.info.id, n) == index;
+                                                 }),
+                                  savedRelays.end());
+            }
+        }
+        else if (iniFile.isName("[RelayChannel]"))
+            readRelayChannel(iniFile);
+    }
+}
+
+// -----------------------------------
+void ServMgr::pruneWorkerReports()
+{
+    // 前の報告から再開したリレーを、今のワーカーが報告し直すのを待つ。
+    if (workerReportsPruned || !relaysRestored || getUptime() < 60)
+        return;
+    workerReportsPruned = true;
+
+    std::vector<std::string> stale;
+    for (int i = std::max(g_prefork.numWorkers(), 1); i < Prefork::MAX_WORKERS; i++)
+    {
+        for (auto ext : { "ini", "json" })
+        {
+            auto path = workerReportPath(i, ext);
+            if (std::ifstream(path).good())
+                stale.push_back(path);
+        }
+    }
+    if (stale.empty())
+        return;
+
+    peercastInst->saveSettings();
+    settingsWriter.flush();
+    for (auto& path : stale)
+    {
+        LOG_INFO("Removing old worker report %s", path.c_str());
+        std::remove(path.c_str());
+    }
+}
+
 // -----------------------------------
 bool    ServMgr::acceptGIV(std::shared_ptr<ClientSocket> sock)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     Servent *sv = servents;
     while (sv)
@@ -1963,68 +2367,112 @@ void ServMgr::broadcastRootSettings(bool getUpdate)
 // --------------------------------------------------
 int ServMgr::broadcastPacket(ChanPacket &pack, const GnuID &chanID, const GnuID &srcID, const GnuID &destID, Servent::TYPE type)
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    // 送り先の候補を serventRoutes から集める。サーバントのロックは
+    // serventStatsLock を放してから取る。
+    std::vector<Servent*> targets;
+    {
+        std::lock_guard<std::mutex> st(serventStatsLock);
+        if (chanID.isSet())
+        {
+            auto route = serventRoutes.find(StreamKey(type, chanID));
+            if (route)
+                targets = *route;
 
-    int cnt=0;
+            if (type == Servent::T_RELAY)
+            {
+                auto mux = muxRoutes.find(chanID);
+                if (mux)
+                    targets.insert(targets.end(), mux->begin(), mux->end());
+            }
+        }else
+        {
+            // チャンネルを問わない。
+            serventRoutes.forEach([&](const StreamKey& key, std::vector<Servent*>& route)
+                                  {
+                                      if (key.type == type)
+                                          targets.insert(targets.end(), route.begin(), route.end());
+                                  });
+        }
+    }
 
-    Servent *sv = servents;
-    while (sv)
+    // 条件はサーバントのロックの下で確かめ直す。サーバントは解放され
+    // ないので、候補が切断していても構わない。
+    int cnt=0;
+    for (auto sv : targets)
     {
         if (sv->sendPacket(pack, chanID, srcID, destID, type))
             cnt++;
-        sv=sv->next;
     }
     return cnt;
 }
 
 // --------------------------------------------------
-int ServMgr::idleProc(ThreadInfo *thread)
+// 以前は IDLE スレッドが 500ms ごとに順に行っていた仕事。ネットワーク
+// を待つものは mayBlock にして、他の仕事を遅らせないようにする。
+void ServMgr::addHousekeepingTasks()
 {
-    sys->setThreadName("IDLE");
+    housekeeping.add("stats", 500, []() { stats.update(); });
 
-    unsigned int lastBroadcastConnect = 0;
-    unsigned int lastRootBroadcast = 0;
+    housekeeping.add("flags", 500, []()
+    {
+        LockProfiler::setEnabled(servMgr->flags[ServMgr::F_lockProfiling]);
+        if (servMgr->flags[ServMgr::F_asyncLog])
+            g_logPipeline.start();
+        else
+            g_logPipeline.stop();
+        if (servMgr->flags[ServMgr::F_asyncSettingsSave])
+            servMgr->settingsWriter.start();
+        else
+            servMgr->settingsWriter.stop();
+    }, true);
 
     unsigned int lastForceIPCheck = 0;
-
-    while (thread->active())
+    housekeeping.add("forceIP", 1000, [=]() mutable
     {
-        stats.update();
+        if (servMgr->forceIP.isEmpty())
+            return;
 
         unsigned int ctime = sys->getTime();
-
-        if (!servMgr->forceIP.isEmpty())
+        if ((ctime - lastForceIPCheck) > 60)
         {
-            if ((ctime - lastForceIPCheck) > 60)
-            {
-                if (servMgr->checkForceIP())
-                {
-                    chanMgr->broadcastTrackerUpdate(GnuID(), true);
-                }
-                lastForceIPCheck = ctime;
-            }
+            if (servMgr->checkForceIP())
+                chanMgr->broadcastTrackerUpdate(GnuID(), true);
+            lastForceIPCheck = ctime;
         }
+    }, true);
+
+    unsigned int lastBroadcastConnect = 0;
+    housekeeping.add("broadcaster", 1000, [=]() mutable
+    {
+        if (!chanMgr->isBroadcasting())
+            return;
 
-        if (chanMgr->isBroadcasting())
+        unsigned int ctime = sys->getTime();
+        if ((ctime - lastBroadcastConnect) > 30)
         {
-            if ((ctime - lastBroadcastConnect) > 30)
-            {
-                servMgr->connectBroadcaster();
-                lastBroadcastConnect = ctime;
-            }
+            servMgr->connectBroadcaster();
+            lastBroadcastConnect = ctime;
         }
+    }, true);
 
-        if (servMgr->isRoot)
+    unsigned int lastRootBroadcast = 0;
+    housekeeping.add("rootBroadcast", 1000, [=]() mutable
+    {
+        if (!servMgr->isRoot)
+            return;
+
+        unsigned int ctime = sys->getTime();
+        if ((ctime - lastRootBroadcast) > chanMgr->hostUpdateInterval)
         {
-            if ((ctime - lastRootBroadcast) > chanMgr->hostUpdateInterval)
-            {
-                servMgr->broadcastRootSettings(true);
-                lastRootBroadcast = ctime;
-            }
+            servMgr->broadcastRootSettings(true);
+            lastRootBroadcast = ctime;
         }
+    }, true);
 
-        chanMgr->clearDeadHits(true);
+    housekeeping.add("clearDeadHits", 500, []() { chanMgr->clearDeadHits(true); });
 
+    housekeeping.add("shutdownTimer", 500, []()
+    {
         if (servMgr->shutdownTimer)
         {
             if (--servMgr->shutdownTimer <= 0)
@@ -2034,22 +2482,86 @@ int ServMgr::idleProc(ThreadInfo *thread)
                 sys->exit();
             }
         }
+    });
+
+    // shutdown idle channels
+    housekeeping.add("channelReactors", 1000, []() { servMgr->releaseChannelReactors(); });
 
-        // shutdown idle channels
+    housekeeping.add("idleChannels", 500, []()
+    {
         if (chanMgr->numIdleChannels() > ChanMgr::MAX_IDLE_CHANNELS)
             chanMgr->closeOldestIdle();
+    });
+
+    // メモリーの使用量を見積もり、予算を超えていれば減らす。
+    housekeeping.add("memoryBudget", 1000, []()
+    {
+        g_memoryBudget.enforce((uint64_t) chanMgr->memoryBudget * 1024 * 1024);
+    });
 
-        // チャンネル一覧を取得する。
-        servMgr->channelDirectory->update();
+    // 統計の履歴を記録する。
+    housekeeping.add("statsHistory", 1000, []() { g_statsHistory.sample(sys->getTime()); });
 
-        servMgr->rtmpServerMonitor.update();
+    // フロントエンドに見せる状態の要約を作る。
+    housekeeping.add("statusFeed", 1000, []() { g_statusFeed.sample(sys->getTime()); });
 
-        servMgr->uptestServiceRegistry->update();
+    // 上りの帯域とリレー・直接視聴の数の上限を決め直す。
+    housekeeping.add("capacityTuner", 5000, []() { g_capacityTuner.update(); });
 
-        sys->sleep(500);
-    }
+    // 古くなった冷えたチャンネルを忘れる。
+    housekeeping.add("coldChannels", 60000, []() { g_coldChannels.expire(sys->getTime()); });
+    housekeeping.add("trackerHubs", 60000, []() { g_trackerHubs.expire(sys->getTime()); });
 
-    return 0;
+    // LAN 内のノードと受信中のチャンネルを教え合う。
+    housekeeping.add("lanDiscovery", 1000, []() { g_lanDiscovery.update(); });
+
+    // 指定の秒数が過ぎたプロファイラーを止める。
+    housekeeping.add("samplingProfiler", 1000, []() { g_samplingProfiler.update(); });
+    unsigned int lastLocalityLoad = 0;
+    housekeeping.add("locality", 10000, [=]() mutable
+    {
+        if (!servMgr->flags[ServMgr::F_preferLocalPeers])
+        {
+            lastLocalityLoad = 0;
+            return;
+        }
+
+        unsigned int ctime = sys->getTime();
+        if (!lastLocalityLoad || (ctime - lastLocalityLoad) >= Locality::RELOAD_INTERVAL)
+        {
+            g_locality.loadFile(sys->joinPath({ peercastApp->getStateDirPath(), "locality.txt" }));
+            lastLocalityLoad = ctime;
+        }
+    }, true);
+
+    // 使われなくなった接続の頻度のバケツを消す。
+    housekeeping.add("admission", 10000, []() { g_admission.expire(sys->getMonotonicTime()); });
+
+    // 終わったスピードテストのセッションを消す。
+    housekeeping.add("speedtest", 10000, []() { g_speedtest.expire(sys->getMonotonicTime()); });
+
+    // 使われなくなった外向きの HTTP 接続を閉じる。
+    housekeeping.add("httpClient", 10000, []() { g_httpClient.closeIdle(sys->getTime()); });
+
+    // チャンネル一覧を取得する。
+    housekeeping.add("channelDirectory", 1000, []() { servMgr->channelDirectory->update(); }, true);
+
+    housekeeping.add("rtmpServerMonitor", 1000, []()
+    {
+        // RTMP サーバーは一つだけ起動する。
+        if (g_prefork.isPrimary())
+            servMgr->rtmpServerMonitor.update();
+    }, true);
+
+    housekeeping.add("uptest", 1000, []() { servMgr->uptestServiceRegistry->update(); }, true);
+
+    housekeeping.add("workerReport", 5000, []()
+    {
+        if (g_prefork.isPrimary())
+            servMgr->pruneWorkerReports();
+        else
+            servMgr->saveWorkerReport();
+    }, true);
 }
 
 // --------------------------------------------------
@@ -2057,51 +2569,103 @@ int ServMgr::serverProc(ThreadInfo *thread)
 {
     sys->setThreadName("SERVER");
 
-    Servent *serv = servMgr->allocServent();
+    // 待ち受けサーバント。numAcceptors が 2 以上なら SO_REUSEPORT で同
+    // じポートを複数のソケットで待ち受け、カーネルに接続を振り分けさせ
+    // る。使えなければ 1 つに戻す。
+    std::vector<Servent*> servs;
+    bool reusePortFailed = false;
 
     //unsigned int lastLookupTime=0;
 
-    std::unique_lock<std::recursive_mutex> cs(servMgr->lock, std::defer_lock);
+    std::unique_lock<ProfiledMutex> cs(servMgr->lock, std::defer_lock);
     while (thread->active())
     {
+        // 待ち受けを新しいプロセスに渡している間は何もしない。
+        if (g_restartHandoff.releasing())
+        {
+            sys->sleepIdle();
+            continue;
+        }
+
         cs.lock();
         if (servMgr->restartServer)
         {
-            serv->abort();      // force close
+            for (auto serv : servs)
+                serv->abort();      // force close
 
             servMgr->restartServer = false;
         }
 
         if (servMgr->autoServe)
         {
-            std::lock_guard<std::recursive_mutex> cs1(serv->lock);
+            size_t n = reusePortFailed ? 1 : servMgr->numAcceptors;
+            // ワーカーのモードでは他のプロセスと同じポートを待ち受ける。
+            bool reusePort = n > 1 || g_prefork.enabled();
+
+            while (servs.size() < n)
+                servs.push_back(servMgr->allocServent());
+
+            // 減らされた分は止める。
+            for (size_t i = n; i < servs.size(); i++)
+                servs[i]->abort();
 
-            // サーバーが既に起動している最中に allow を書き換え続ける
-            // の気持ち悪いな。
-            serv->allow = servMgr->allowServer1;
+            bool anyActive = false;
+            for (size_t i = 0; i < n; i++)
+            {
+                std::lock_guard<ProfiledMutex> cs1(servs[i]->lock);
+                if (servs[i]->sock)
+                    anyActive = true;
+            }
 
-            if (!serv->sock)
+            for (size_t i = 0; i < n; i++)
             {
-                LOG_DEBUG("Starting servers");
+                Servent *serv = servs[i];
+                std::lock_guard<ProfiledMutex> cs1(serv->lock);
 
-                if (servMgr->forceNormal)
-                    servMgr->setFirewall(4, ServMgr::FW_OFF);
-                else
-                    servMgr->setFirewall(4, ServMgr::FW_UNKNOWN);
+                // サーバーが既に起動している最中に allow を書き換え続ける
+                // の気持ち悪いな。
+                serv->allow = servMgr->allowServer1;
+
+                if (serv->sock)
+                    continue;
 
                 Host h = servMgr->serverHost;
 
-                if (!serv->sock)
-                    if (!serv->initServer(h))
-                    {
-                        LOG_ERROR("Failed to start server on port %d. Exitting...", h.port);
-                        peercastInst->quit();
-                        sys->exit();
-                    }
+                if (!anyActive)
+                {
+                    LOG_DEBUG("Starting servers");
+
+                    if (servMgr->forceNormal)
+                        servMgr->setFirewall(4, ServMgr::FW_OFF);
+                    else
+                        servMgr->setFirewall(4, ServMgr::FW_UNKNOWN);
+                }
+
+                if (serv->initServer(h, reusePort))
+                {
+                    anyActive = true;
+                    continue;
+                }
+
+                if (reusePort && !anyActive)
+                {
+                    LOG_WARN("SO_REUSEPORT unavailable. Falling back to a single acceptor");
+                    reusePortFailed = true;
+                    if (serv->initServer(h))
+                        break;
+                }
+
+                if (!anyActive)
+                {
+                    LOG_ERROR("Failed to start server on port %d. Exitting...", h.port);
+                    peercastInst->quit();
+                    sys->exit();
+                }
             }
         }else{
             // stop server
-            serv->abort();      // force close
+            for (auto serv : servs)
+                serv->abort();      // force close
 
             // cancel incoming connectuions
             Servent *s = servMgr->servents;
@@ -2123,6 +2687,24 @@ int ServMgr::serverProc(ThreadInfo *thread)
     return 0;
 }
 
+// -----------------------------------
+unsigned int ServMgr::effectiveMaxBitrateOut()
+{
+    return g_capacityTuner.active() ? g_capacityTuner.maxBitrateOut() : maxBitrateOut;
+}
+
+// -----------------------------------
+unsigned int ServMgr::effectiveMaxRelays()
+{
+    return g_capacityTuner.active() ? g_capacityTuner.maxRelays() : maxRelays;
+}
+
+// -----------------------------------
+unsigned int ServMgr::effectiveMaxDirect()
+{
+    return g_capacityTuner.active() ? g_capacityTuner.maxDirect() : maxDirect;
+}
+
 // -----------------------------------
 void    ServMgr::setMaxRelays(int max)
 {
@@ -2172,7 +2754,7 @@ ServHost::TYPE ServHost::getTypeFromStr(const char *s)
 amf0::Value ServMgr::getState()
 {
     using std::to_string;
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
 
     std::vector<amf0::Value> filterArray;
     for (int i = 0; i < this->numFilters; i++)
@@ -2198,6 +2780,16 @@ amf0::Value ServMgr::getState()
             {"numServHosts", to_string(numHosts(ServHost::T_SERVENT))},
             {"numServents", to_string(numServents())},
             {"servents", serventArray},
+            {"incomingPool", incomingPool.getState()},
+            {"housekeeping", housekeeping.getState()},
+            {"resolver", g_resolver.getState()},
+            {"relayStats", g_relayStats.getState()},
+            {"bandwidth", g_bandwidth.getState()},
+            {"pingCache", g_pingCache.getState()},
+            {"cgiWorkers", g_cgiWorkers.getState()},
+            {"memory", g_memoryBudget.getState()},
+            {"prefork", g_prefork.getState()},
+            {"restartHandoff", g_restartHandoff.getState()},
             {"serverName", serverName.c_str()},
             {"serverPort", to_string(serverHost.port)},
             {"serverIP", serverHost.str(false)},
@@ -2252,6 +2844,17 @@ amf0::Value ServMgr::getState()
             {"numChannelFeeds", channelDirectory->numFeeds()},
             {"channelDirectory", channelDirectory->getState()},
             {"uptestServiceRegistry", uptestServiceRegistry->getState()},
+            {"portCheck", g_portChecks.getState()},
+            {"capacityTuner", g_capacityTuner.getState()},
+            {"speedtest", g_speedtest.getState()},
+            {"admission", g_admission.getState()},
+            {"coldChannels", g_coldChannels.getState()},
+            {"ypSession", g_ypSession.getState()},
+            {"trackerHubs", g_trackerHubs.getState()},
+            {"locality", g_locality.getState()},
+            {"lanDiscovery", g_lanDiscovery.getState()},
+            {"gzip", g_gzipEncoder.getState()},
+            {"http2", HTTP2Connection::getState()},
             {"publicDirectoryEnabled", to_string(publicDirectoryEnabled)},
             {"transcodingEnabled", to_string(this->transcodingEnabled)},
             {"preset", this->preset},
@@ -2262,7 +2865,7 @@ amf0::Value ServMgr::getState()
             {"rtmpPort", std::to_string(this->rtmpPort)},
             {"hasUnsafeFilterSettings", std::to_string(this->hasUnsafeFilterSettings())},
             {"chat", to_string(this->chat)},
-            {"randomizeBroadcastingChannelID", to_string(this->flags.get("randomizeBroadcastingChannelID"))},
+            {"randomizeBroadcastingChannelID", to_string(this->flags[ServMgr::F_randomizeBroadcastingChannelID])},
             {"flags", this->flags.getState()},
             {"installationDirectory", []()
                                       {
@@ -25,12 +25,22 @@
 #include "rtmpmonit.h"
 #include "inifile.h"
 #include "servfilter.h"
+#include "filterengine.h"
 #include "chanmgr.h"
 #include "ini.h"
 #include "flag.h"
+#include "threadpool.h"
+#include "hostcache.h"
+#include "settingswriter.h"
+#include "timerwheel.h"
+#include "flatmap.h"
 
 #include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
 #include "ip.h"
+#include "lockprof.h"
 
 // ----------------------------------
 
@@ -43,43 +53,55 @@ const int MIN_TRACKER_RETRY = 10;
 const int MIN_RELAY_RETRY = 5;
 
 // ----------------------------------
-class ServHost
-{
-public:
-    enum TYPE
-    {
-        T_NONE,
-        T_STREAM,
-        T_CHANNEL,
-        T_SERVENT,
-        T_TRACKER
-    };
-
-    ServHost() { init(); }
-    void init()
-    {
-        host.init();
-        time = 0;
-        type = T_NONE;
-    }
-    void init(Host &h, TYPE tp, unsigned int tim)
-    {
-        init();
-        host = h;
-        type = tp;
-        if (tim)
-            time = tim;
-        else
-            time = sys->getTime();
-    }
-
-    static const char   *getTypeStr(TYPE);
-    static TYPE         getTypeFromStr(const char *);
-
-    TYPE            type;
-    Host            host;
-    unsigned int    time;
-};
+// 機能フラグの名前、説明、既定値。この順に ServMgr::flags に登録し、
+// ServMgr::FLAG の番号もこの順になる。
+#define SERVMGR_FLAGS(X) \
+    X(randomizeBroadcastingChannelID, "配信するチャンネルのIDをランダムにする。", true) \
+    X(sendPortAtomWhenFirewallUnknown, "古いPeerCastStation相手に正常にポートチェックするにはオフにする。", false) \
+    X(forceFirewalled, "ファイアーウォール オンであるかの様に振る舞う。", false) \
+    X(startPlayingFromKeyFrame, "DIRECT接続でキーフレームまで継続パケットをスキップする。", true) \
+    X(banTrackersWhileBroadcasting, "配信中他の配信者による視聴をBANする。", false) \
+    X(persistTokenList, "アクセストークンリストを永続化する。", false) \
+    X(enableSSLServer, "SSL接続の受け付けを有効にする。", false) \
+    X(requireContinuationPacketSupportFromPeer, "継続パケットをサポートしないバージョンのクライアントとリレーしない。", false) \
+    X(catchUpLaggingListeners, "遅れたDIRECT接続を最新のキーフレームまで進める。", true) \
+    X(reactorMode, "DIRECT接続のストリームの送信と、PCPでリレーするチャンネルの受信をイベントループでまとめて行う。", false) \
+    X(ioUringReactor, "イベントループに io_uring を使う。reactorMode の前に設定する。(Linuxのみ)", false) \
+    X(splitPCPRelays, "PCPリレー接続で、下流からの受信を送信とは別のスレッドで行う。", true) \
+    X(channelReactors, "reactorMode の時、チャンネルごとに一本のスレッドのイベントループで送信する。", false) \
+    X(threadPool, "受け付けた接続をスレッドプールで処理する。", true) \
+    X(coalesceHostUpdates, "同じホストについてのBCSTホスト情報をまとめて送る。", true) \
+    X(chunkedDirectStream, "HTTP/1.1 のDIRECT接続にストリームを chunked で送る。", false) \
+    X(lockProfiling, "ロックの待ち時間と保持時間を計る。結果は JSON-RPC の getLockProfile で見る。", false) \
+    X(asyncLog, "ログの書き込みを専用のスレッドで行う。", true) \
+    X(packetTracing, "配信するチャンネルのパケットを一秒に一つ選び、中継先での到着と送出を記録させる。結果は JSON-RPC の getPacketTraces で見る。", false) \
+    X(externalRTMPServer, "RTMP サーバーを組み込みのものでなく、別プロセスの rtmp-server で動かす。", false) \
+    X(rtmpSharedMemory, "別プロセスの rtmp-server から、HTTP Push の代わりに共有メモリーで受け取る。(Linuxのみ)", false) \
+    X(standbyUpstream, "リレー受信中、次の候補に控えの接続を張っておき、上流が切れたらすぐに切り替える。", false) \
+    X(weightedRelaySelection, "上流のリレーをホップ数だけでなく、接続時間、受信速度、負荷、失敗の記録から選ぶ。", true) \
+    X(bandwidthScheduling, "maxBitrateOut をリレーと直接視聴に割り振り、接続ごとに実際の送信量を見ながら送る速さを抑える。", false) \
+    X(autoTuneLimits, "スピードテストの結果と下流への送信の様子から、上りの帯域とリレー・直接視聴の数の上限を決め直す。設定値は天井と初めの値になる。", false) \
+    X(speedtestServer, "/speedtest でスピードテストを受け付ける。GET でダウンロード、POST でアップロードを計る。id を付けると並べて張った接続の結果を /speedtest/result にまとめる。", false) \
+    X(tuneSendBuffers, "ストリームを送るソケットの送信バッファーを、チャンネルのビットレートとRTTに見合った大きさにする。詰まりがカーネルに溜まらず、キーフレームへの読み飛ばしが効く。", false) \
+    X(bbrCongestion, "ストリームを送るソケットの輻輳制御を BBR にする。(Linuxのみ)", false) \
+    X(admissionControl, "受け付けた接続を、IPアドレスとサブネットごとの頻度とハンドシェイク中の接続の数で、スレッドを割り当てる前にふるいにかける。LAN内からの接続は除く。", false) \
+    X(warmResume, "アイドルで閉じたリレーチャンネルのヘッダーと上流の候補をしばらく覚えておき、視聴者が来たら検索せずに繋ぎ直す。", false) \
+    X(rebalanceRelayTree, "配信中、リレーの木の深い所にいるリレーに、空きのある浅いリレーへ付け替えるよう勧める。", false) \
+    X(asyncSettingsSave, "設定ファイルの書き込みを専用のスレッドで行う。", true) \
+    X(pcpMultiplex, "同じ上流から受け取る複数のチャンネルを一つのPCP接続にまとめる。", false) \
+    X(cachePingResults, "ファイアウォールチェックの結果をホストごとに覚え、pingを決まった数のスレッドで行う。", true) \
+    X(saveRelayHits, "リレーチャンネルと一緒に上流の候補を保存し、起動時に戻す。", true) \
+    X(backupIngest, "放送中のチャンネルに同じIDで来たHTTP Push・RTMP接続を予備にし、今の接続が切れたらストリームを作り直さずに切り替える。", true) \
+    X(restartHandoff, "--takeover で起動した新しいプロセスに、待ち受けとリレー・視聴の接続を切らずに引き継ぐ。(Linuxのみ)", false) \
+    X(sourceCapture, "放送するチャンネルがソースから読んだデータを、状態ディレクトリーの capture-*.cap に記録する。source-replay で再生できる。", false) \
+    X(ypSession, "YPとのCOUT接続を張りっぱなしにし、切れたら失敗が続くほど間を空けて繋ぎ直す。配信中の全チャンネルのトラッカー更新はまとめて送る。", false) \
+    X(trackerHubs, "配信中のチャンネルのヒットが多くなったら直下のリレーをハブに指名し、下流のヒットの報告をハブにまとめさせる。リレー側では指名を受ける。", false) \
+    X(preferLocalPeers, "状態ディレクトリーの locality.txt の表や測った接続時間で近いとみなしたリレーを上流に選び、リレーを断る時も相手に近いリレーを先に教える。", false) \
+    X(gzipResponses, "JSON-RPC、XML、テンプレートのページの応答を、ブラウザーが受け付けていれば gzip で圧縮して送る。", false) \
+    X(http2, "管理画面と API を HTTP/2 でも受ける。一つの接続の要求を並べてワーカーで処理する。TLS では ALPN で h2 を選ぶ。", false) \
+    X(streamTemplates, "テンプレートのページを描きながらチャンクで送り、ページの頭を先に届ける。gzip で送る時は全部描いてから送る。", false) \
+    X(jpegThumbnails, "/thumb/<ID>.jpg でチャンネルの最新のキーフレームを JPEG にして返す。変換には ffmpeg を使う。", false) \
+    X(lanDiscovery, "受信中のチャンネルを LAN 内にマルチキャストで告知し、他のノードの告知をヒットに加えて、同じ LAN のリレーから受信できるようにする。", false)
 
 // ----------------------------------
 // ServMgr keeps track of Servents
@@ -102,7 +124,6 @@ public:
     };
 
     enum {
-        MAX_HOSTCACHE = 100,        // max. amount of hosts in cache
         MIN_HOSTS   = 3,            // min. amount of hosts that should be kept in cache
 
         MAX_OUTGOING = 3,           // max. number of outgoing servents to use
@@ -110,11 +131,17 @@ public:
         MAX_TRYOUT   = 10,          // max. number of outgoing servents to try connect
         MIN_CONNECTED = 3,          // min. amount of connected hosts that should be kept
         MIN_RELAYS = 2,
+        MAX_ACCEPTORS = 16,         // max. number of SO_REUSEPORT listening sockets
+        MAX_CGI_WORKERS = 16,       // max. number of persistent CGI worker processes
 
         MAX_FILTERS = 50,
 
         MAX_PREVIEWTIME = 300,      // max. seconds preview per channel available (direct connections)
         MAX_PREVIEWWAIT = 300,      // max. seconds wait between previews
+
+        MAX_POOL_WORKERS = 16,      // max. number of pooled threads for incoming connections
+
+        NUM_SERVENT_TYPES = Servent::T_COMMAND + 1,
     };
 
     enum AUTH_TYPE
@@ -123,6 +150,16 @@ public:
         AUTH_HTTPBASIC
     };
 
+    // flags の番号。flags[F_xxx] は名前を探さずに一回のロードで読める
+    // ので、パケットごとに見てよい。
+    enum FLAG
+    {
+#define X(name, desc, defaultValue) F_##name,
+        SERVMGR_FLAGS(X)
+#undef X
+        NUM_FLAGS
+    };
+
     ServMgr();
     ~ServMgr() override;
 
@@ -137,6 +174,18 @@ public:
 
     Servent             *allocServent();
 
+    // Servent::setStatus から呼ばれる。接続した・切れたサーバントを集計
+    // に反映し、空いたサーバントを空きリストに戻す。
+    void                countServent(Servent *, bool connected);
+    void                releaseServent(Servent *);
+    // Servent::setType, setServPort から呼ばれる。
+    void                changeServentType(Servent *, int from, int to);
+    void                changeServentPort(Servent *, int from, int to);
+    // 一つの PCP 接続で他のチャンネルも送る RELAY サーバントを、そのチャ
+    // ンネルの broadcastPacket の宛先に加える・外す。
+    void                addMuxRoute(Servent *, const GnuID &chanID);
+    void                removeMuxRoute(Servent *, const GnuID &chanID);
+
     unsigned int        numUsed(int);
     unsigned int        numStreams(const GnuID &, Servent::TYPE, bool);
     unsigned int        numStreams(Servent::TYPE, bool);
@@ -158,7 +207,7 @@ public:
     Servent             *findConnection(Servent::TYPE, const GnuID &);
 
     static THREAD_PROC  serverProc(ThreadInfo *);
-    static THREAD_PROC  idleProc(ThreadInfo *);
+    static THREAD_PROC  startupProc(ThreadInfo *);
 
     XML::Node           *createServentXML();
 
@@ -169,6 +218,9 @@ public:
     void                closeConnections(Servent::TYPE);
 
     void                checkFirewall();
+    // 自分のグローバル IP が分かっていなければ checkFirewall() する。
+    // 同時に呼ばれても問い合わせは一度だけにする。
+    void                checkGlobalIP();
     void                setFirewall(int, FW_STATE);
     FW_STATE            getFirewall(int);
     void                checkFirewallIPv6();
@@ -186,6 +238,7 @@ public:
     void            saveSettings(const char *);
     ini::Document   getSettings();
     void            loadSettings(const char *);
+    void            readRelayChannel(IniFileBase&);
     int             findChannel(ChanInfo &);
     bool            getChannel(char *, ChanInfo &, bool);
     void            ensureCatchallFilters();
@@ -193,6 +246,15 @@ public:
     bool            acceptGIV(std::shared_ptr<ClientSocket>);
     void            addVersion(unsigned int);
 
+    // DIRECT 接続の送信と PCP のソースの受信に使うイベントループ。
+    // reactorMode フラグが無効な時や使えないプラットフォームでは
+    // nullptr を返す。channelReactors フラグが有効なら chanID のチャン
+    // ネル専用のものを返す。
+    std::shared_ptr<Reactor> getReactor(const GnuID& chanID = GnuID());
+    // チャンネルが無くなり、使うストリームも無くなったイベントループを
+    // 止める。
+    void            releaseChannelReactors();
+
     void            broadcastRootSettings(bool);
     int             broadcastPushRequest(ChanHit &, Host &, const GnuID &, Servent::TYPE);
     void            writeRootAtoms(AtomStream &, bool);
@@ -218,18 +280,36 @@ public:
         return numConnected(Servent::T_CIN) >= maxControl;
     }
 
+    // 実際に使う上限。autoTuneLimits の時は g_capacityTuner が決めた値、
+    // そうでなければ設定値。
+    unsigned int    effectiveMaxBitrateOut();
+    unsigned int    effectiveMaxRelays();
+    unsigned int    effectiveMaxDirect();
+
     bool    relaysFull()
     {
-        return numStreams(Servent::T_RELAY, false) >= maxRelays;
+        return numStreams(Servent::T_RELAY, false) >= effectiveMaxRelays();
     }
     bool    directFull()
     {
-        return numStreams(Servent::T_DIRECT, false) >= maxDirect;
+        return numStreams(Servent::T_DIRECT, false) >= effectiveMaxDirect();
     }
 
     bool    bitrateFull(unsigned int br)
     {
-        return maxBitrateOut ? (BYTES_TO_KBPS(totalOutput(false)) + br) > maxBitrateOut  : false;
+        const unsigned int max = effectiveMaxBitrateOut();
+        return max ? (BYTES_TO_KBPS(totalOutput(false)) + br) > max  : false;
+    }
+
+    // 上りの帯域の残り (kbps)。実際に送っている速さを上限から引く。上
+    // 限が無ければ -1。
+    int     uploadHeadroom()
+    {
+        const unsigned int max = effectiveMaxBitrateOut();
+        if (!max)
+            return -1;
+        unsigned int used = BYTES_TO_KBPS(totalOutput(false));
+        return used >= max ? 0 : (int) (max - used);
     }
 
     void logLevel(int newLevel);
@@ -251,17 +331,95 @@ public:
     void saveTokenList();
 
     ThreadInfo          serverThread;
-    ThreadInfo          idleThread;
+    ThreadInfo          startupThread;
 
-    Servent             *servents;
-    std::recursive_mutex lock;
+    // loadSettings() で読んだリレーチャンネル。start() でサーバーを立
+    // ててから一斉に再開する。
+    struct SavedRelay
+    {
+        ChanInfo            info;
+        bool                stayConnected;
+        std::string         sourceURL;
+        Channel::IP_VERSION ipVersion;
+        unsigned int        packetBufferDuration;   // 0 なら全体の設定
+    };
+    std::vector<SavedRelay> savedRelays;
+    void                restoreRelays();
+    std::atomic<bool>   relaysRestored { false };
+
+    // ワーカーのモードで、ワーカー 1 以降が受け持ちのリレーとチャンネル
+    // の状態をワーカー 0 に伝えるファイル。ext が "ini" ならリレー、
+    // "json" なら getChannels と同じ形のチャンネルの一覧。ワーカー 0
+    // は設定の保存にリレーを含め、API にチャンネルを含める。
+    std::string         workerReportPath(int index, const char* ext);
+    void                saveWorkerReport();
+    // path の報告のリレーを savedRelays に加える。今と同じワーカー数で
+    // 書かれた報告なら、そのワーカーの受け持ちは報告の方を正とする。
+    void                readWorkerReport(const char* path, int numWorkers);
+    // 今のワーカー数では使わない報告を、その分を設定に保存してから消す。
+    void                pruneWorkerReports();
+    std::string         lastWorkerReport;
+    bool                workerReportsPruned = false;
+
+    ProfiledMutex       globalIPCheckLock { "ServMgr::globalIPCheckLock" };
 
-    ServHost            hostCache[MAX_HOSTCACHE];
+    Servent             *servents;
+    ProfiledMutex lock { "ServMgr::lock" };
+
+    // サーバントは serventIndex - 1 の位置に置き、空いたものは
+    // freeServents に積む。接続中のサーバントは connectedServents と、
+    // 種類とチャンネルごとの serventRoutes にも入れ、その数を数えてお
+    // く。種類ごとの数
+    // は読むだけならロックは要らない。それ以外は serventStatsLock で
+    // 保護する。lock やサーバントのロックを持ったまま取ってよいが、逆
+    // は不可。
+    struct StreamCount
+    {
+        StreamCount() : pub(0), priv(0) {}
+        unsigned int pub, priv;
+    };
+    // 種類とチャンネルの組。
+    struct StreamKey
+    {
+        StreamKey() : type(0) {}
+        StreamKey(int type, const GnuID& chanID) : type(type), chanID(chanID) {}
+        int   type;
+        GnuID chanID;
+    };
+    struct StreamKeyHash
+    {
+        size_t operator()(const StreamKey& k) const { return GnuIDHash()(k.chanID) ^ k.type; }
+    };
+    struct StreamKeyEqual
+    {
+        bool operator()(const StreamKey& a, const StreamKey& b) const
+        {
+            return a.type == b.type && a.chanID.isSame(b.chanID);
+        }
+    };
+    template <typename V>
+    using StreamMap = FlatHashMap<StreamKey, V, StreamKeyHash, StreamKeyEqual>;
+    std::mutex          serventStatsLock;
+    std::vector<Servent*> serventSlab;
+    std::vector<Servent*> freeServents;
+    std::vector<Servent*> connectedServents;
+    StreamMap<StreamCount> channelStreamCounts;
+    StreamMap<std::vector<Servent*>> serventRoutes;
+    GnuIDFlatMap<std::vector<Servent*>> muxRoutes;    // チャンネルごとの addMuxRoute されたもの
+    std::map<int, unsigned int> portServents;   // servPort ごとの使用中のサーバントの数
+    std::atomic<unsigned int> typeStreamsPublic[NUM_SERVENT_TYPES];
+    std::atomic<unsigned int> typeStreamsPrivate[NUM_SERVENT_TYPES];
+    std::atomic<unsigned int> typeServents[NUM_SERVENT_TYPES];  // 種類ごとの使用中のサーバントの数
+
+    HostCache           hostCache;
 
     char                password[64];
 
     unsigned int        maxBitrateOut, maxControl, maxRelays, maxDirect;
     unsigned int        maxServIn;
+    unsigned int        numAcceptors;   // 2 以上なら SO_REUSEPORT で同じポートを複数のソケットで待ち受ける
+    unsigned int        cgiWorkers;     // CGI ワーカーの数。0 なら要求ごとにスクリプトを起動する
+    std::string         cgiWorkerScripts;   // ワーカーで処理するスクリプトの名前 (カンマ区切り)
 
     bool                isDisabled;
     std::atomic_bool    isRoot;
@@ -280,9 +438,11 @@ public:
     String              forceIP;
     GnuID               networkID;
     unsigned int        firewallTimeout;
+    unsigned int        jrpcSnapshotInterval;   // ミリ秒。0 なら作り置きしない。
     std::atomic<int>    m_logLevel;
     std::atomic<int>    shutdownTimer;
     bool                pauseLog;
+    unsigned int        logRateLimit;   // 呼び出し元ごとの一秒あたりの行数。0 なら制限しない。
     bool                forceNormal;
     bool                useFlowControl;
     unsigned int        lastIncoming;
@@ -303,6 +463,7 @@ public:
 
     ServFilter          filters[MAX_FILTERS];
     int                 numFilters;
+    FilterEngine        filterEngine;
 
     CookieList          cookieList;
     AUTH_TYPE           authType;
@@ -316,6 +477,7 @@ public:
     const std::unique_ptr<class ChannelDirectory>
                         channelDirectory;
     bool                publicDirectoryEnabled;
+    unsigned int        publicPageCacheInterval;    // 秒。0 なら毎回作る。
 
     const std::unique_ptr<class UptestServiceRegistry>
                         uptestServiceRegistry;
@@ -338,6 +500,19 @@ public:
     bool                chat;
 
     FlagRegistory       flags;
+    std::shared_ptr<Reactor> reactor;
+    std::unordered_map<GnuID, std::shared_ptr<Reactor>, GnuIDHash, GnuIDEqual> channelReactors;
+
+    // 受け付けた接続のハンドシェイクを処理するスレッドプール。ストリー
+    // ムの送信などで長く続く接続は専用スレッドに昇格する。
+    ThreadPool          incomingPool;
+
+    // 設定ファイルとトークンリストを書き出す。
+    SettingsWriter      settingsWriter;
+
+    // 統計の更新やチャンネル一覧の取得など、定期的に行う仕事。
+    TimerWheel          housekeeping;
+    void                addHousekeepingTasks();
     std::string         preferredTheme;
     std::string         accentColor;
 };
@@ -0,0 +1,182 @@
+// ------------------------------------------------
+// File : settingswriter.cpp
+// Desc:
+//      書き込みスレッドは要求が止むのを待ってから、溜まった分をロック
+//      を放して書く。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "settingswriter.h"
+#include "stream.h"
+#include "sys.h"
+#include "str.h"
+
+// ------------------------------------
+SettingsWriter::SettingsWriter()
+    : m_running(false)
+    , m_quit(false)
+    , m_busy(false)
+    , m_flushers(0)
+    , m_numWrites(0)
+{
+}
+
+// ------------------------------------
+SettingsWriter::~SettingsWriter()
+{
+    stop();
+}
+
+// ------------------------------------
+void SettingsWriter::start()
+{
+    std::lock_guard<std::mutex> cs(m_controlLock);
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (m_running)
+            return;
+        m_quit = false;
+        m_running = true;
+    }
+    m_writer = std::thread([this]() { writerMain(); });
+}
+
+// ------------------------------------
+void SettingsWriter::stop()
+{
+    std::lock_guard<std::mutex> cs(m_controlLock);
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (!m_running)
+            return;
+        m_running = false;
+        m_quit = true;
+        m_cond.notify_all();
+    }
+    // 書き込みスレッドは残りを書いてから抜ける。
+    m_writer.join();
+}
+
+// ------------------------------------
+bool SettingsWriter::running()
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_running;
+}
+
+// ------------------------------------
+void SettingsWriter::save(const std::string& path, std::string&& text)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (m_running)
+        {
+            auto now = Clock::now();
+            if (m_pending.empty())
+                m_firstQueued = now;
+            m_lastQueued = now;
+            m_pending[path] = std::move(text);
+            m_cond.notify_all();
+            return;
+        }
+    }
+
+    if (writeFile(path, text))
+        m_numWrites++;
+}
+
+// ------------------------------------
+void SettingsWriter::flush()
+{
+    std::unique_lock<std::mutex> lk(m_mutex);
+    if (!m_running || std::this_thread::get_id() == m_writer.get_id())
+        return;
+
+    m_flushers++;
+    m_cond.notify_all();
+    m_cond.wait(lk, [this]() { return (m_pending.empty() && !m_busy) || !m_running; });
+    m_flushers--;
+}
+
+// ------------------------------------
+void SettingsWriter::writerMain()
+{
+    sys->setThreadName("SETTINGS");
+
+    std::unique_lock<std::mutex> lk(m_mutex);
+    while (true)
+    {
+        if (m_pending.empty())
+        {
+            if (m_quit)
+                break;
+            m_cond.wait(lk);
+            continue;
+        }
+
+        // 止める時と flush() で待たれている時は待たずに書く。
+        if (!m_quit && m_flushers == 0)
+        {
+            auto deadline = std::min(m_lastQueued + std::chrono::milliseconds(DEBOUNCE_MSEC),
+                                     m_firstQueued + std::chrono::milliseconds(MAX_DELAY_MSEC));
+            if (Clock::now() < deadline)
+            {
+                m_cond.wait_until(lk, deadline);
+                continue;
+            }
+        }
+
+        std::map<std::string, std::string> jobs;
+        jobs.swap(m_pending);
+        m_busy = true;
+        lk.unlock();
+
+        for (auto& job : jobs)
+        {
+            if (writeFile(job.first, job.second))
+                m_numWrites++;
+        }
+
+        lk.lock();
+        m_busy = false;
+        m_cond.notify_all();
+    }
+}
+
+// ------------------------------------
+bool SettingsWriter::writeFile(const std::string& path, const std::string& text)
+{
+    std::string tmpname = str::STR(path, ".tmp");
+
+    try
+    {
+        FileStream file;
+        file.openWriteReplace(tmpname.c_str());
+        file.write(text.data(), text.size());
+        file.close();
+    } catch (StreamException& e)
+    {
+        LOG_ERROR("Unable to write %s: %s", tmpname.c_str(), e.what());
+        return false;
+    }
+
+    try
+    {
+        sys->rename(tmpname, path);
+    } catch (GeneralException& e)
+    {
+        LOG_ERROR("rename failed: %s", e.what());
+        return false;
+    }
+    return true;
+}
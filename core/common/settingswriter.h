@@ -0,0 +1,85 @@
+// ------------------------------------------------
+// File : settingswriter.h
+// Desc:
+//      設定ファイルの書き出しを専用のスレッドで行う。呼び出し元は書き
+//      出す内容を文字列にして渡すだけで、ファイルへの書き込みを待たな
+//      い。同じファイルへの続けての要求はまとめて、最後の内容だけを書
+//      く。書き込みは一時ファイルに書いてから rename で置き換える。
+//
+//      start() する前と stop() した後は、呼び出したスレッドでそのまま
+//      書く。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _SETTINGSWRITER_H
+#define _SETTINGSWRITER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// ------------------------------------
+class SettingsWriter
+{
+public:
+    enum
+    {
+        DEBOUNCE_MSEC = 500,    // 最後の要求からこれだけ待って書く
+        MAX_DELAY_MSEC = 5000,  // 要求が続いても最初の要求からこれ以上は待たない
+    };
+
+    SettingsWriter();
+    ~SettingsWriter();
+
+    void    start();
+    void    stop();     // 溜まっている分を書いてから止める
+    bool    running();
+
+    // path に text を書く。書き込みスレッドが動いていなければ、その場
+    // で書く。
+    void    save(const std::string& path, std::string&& text);
+
+    // それまでに save した分が書かれるのを待つ。
+    void    flush();
+
+    uint64_t    numWrites() const { return m_numWrites; }
+
+    // 一時ファイルに書いてから path に rename する。失敗はログに出す。
+    static bool writeFile(const std::string& path, const std::string& text);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    void    writerMain();
+
+    std::mutex                          m_mutex;
+    std::condition_variable             m_cond;
+    std::map<std::string, std::string>  m_pending;  // パス→内容
+    Clock::time_point                   m_firstQueued, m_lastQueued;
+    bool                                m_running;
+    bool                                m_quit;
+    bool                                m_busy;     // 書き込みスレッドが書いている
+    int                                 m_flushers; // flush() で待っている数
+    std::atomic<uint64_t>               m_numWrites;
+
+    std::thread                         m_writer;
+    std::mutex                          m_controlLock;  // start と stop
+};
+
+#endif
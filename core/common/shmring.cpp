@@ -0,0 +1,337 @@
+// ------------------------------------------------
+// File : shmring.cpp
+// Desc:
+//      共有メモリーのリングバッファー。共有メモリーの確保はプラットフォー
+//      ムごとのファイルにある。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <string.h>
+#include <algorithm>
+#include <new>
+
+#include "shmring.h"
+#include "sys.h"
+
+// ------------------------------------
+ShmRing::ShmRing()
+    : inUse(false)
+    , m_map(nullptr)
+    , m_mapSize(0)
+    , m_header(nullptr)
+    , m_data(nullptr)
+    , m_size(0)
+    , m_owner(false)
+{
+}
+
+// ------------------------------------
+std::shared_ptr<ShmRing> ShmRing::create(const std::string& name, uint32_t size)
+{
+    size_t mapSize = sizeof(Header) + size;
+    void* p = mapShared(name, mapSize, true);
+    if (!p)
+        return nullptr;
+
+    std::shared_ptr<ShmRing> ring(new ShmRing());
+    ring->m_name    = name;
+    ring->m_map     = p;
+    ring->m_mapSize = mapSize;
+    ring->m_header  = new (p) Header();
+    ring->m_data    = static_cast<char*>(p) + sizeof(Header);
+    ring->m_size    = size;
+    ring->m_owner   = true;
+
+    ring->m_header->size = size;
+    ring->m_header->writePos = 0;
+    ring->m_header->readPos = 0;
+    ring->m_header->state = S_IDLE;
+    // 送り手が大きさを読むのは magic を見てから。
+    std::atomic_thread_fence(std::memory_order_release);
+    ring->m_header->magic = MAGIC;
+    return ring;
+}
+
+// ------------------------------------
+std::shared_ptr<ShmRing> ShmRing::open(const std::string& name)
+{
+    size_t mapSize = 0;
+    void* p = mapShared(name, mapSize, false);
+    if (!p)
+        return nullptr;
+
+    auto header = static_cast<Header*>(p);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (mapSize < sizeof(Header) || header->magic != MAGIC ||
+        header->size > mapSize - sizeof(Header))
+    {
+        unmapShared(name, p, mapSize, false);
+        return nullptr;
+    }
+
+    std::shared_ptr<ShmRing> ring(new ShmRing());
+    ring->m_name    = name;
+    ring->m_map     = p;
+    ring->m_mapSize = mapSize;
+    ring->m_header  = header;
+    ring->m_data    = static_cast<char*>(p) + sizeof(Header);
+    ring->m_size    = header->size;
+    return ring;
+}
+
+// ------------------------------------
+ShmRing::~ShmRing()
+{
+    unmapShared(m_name, m_map, m_mapSize, m_owner);
+}
+
+// ------------------------------------
+size_t ShmRing::available() const
+{
+    return m_header->writePos.load(std::memory_order_acquire) - m_header->readPos.load(std::memory_order_acquire);
+}
+
+// ------------------------------------
+size_t ShmRing::space() const
+{
+    return m_size - available();
+}
+
+// ------------------------------------
+size_t ShmRing::write(const void* p, size_t len)
+{
+    uint64_t wpos = m_header->writePos.load(std::memory_order_relaxed);
+    uint64_t rpos = m_header->readPos.load(std::memory_order_acquire);
+    len = std::min(len, (size_t) (m_size - (wpos - rpos)));
+
+    size_t off = wpos % m_size;
+    size_t first = std::min(len, (size_t) m_size - off);
+    memcpy(m_data + off, p, first);
+    memcpy(m_data, static_cast<const char*>(p) + first, len - first);
+
+    m_header->writePos.store(wpos + len, std::memory_order_release);
+    return len;
+}
+
+// ------------------------------------
+size_t ShmRing::read(void* p, size_t len)
+{
+    uint64_t rpos = m_header->readPos.load(std::memory_order_relaxed);
+    uint64_t wpos = m_header->writePos.load(std::memory_order_acquire);
+    len = std::min(len, (size_t) (wpos - rpos));
+
+    size_t off = rpos % m_size;
+    size_t first = std::min(len, (size_t) m_size - off);
+    memcpy(p, m_data + off, first);
+    memcpy(static_cast<char*>(p) + first, m_data, len - first);
+
+    m_header->readPos.store(rpos + len, std::memory_order_release);
+    return len;
+}
+
+// ------------------------------------
+void ShmRing::drain()
+{
+    m_header->readPos.store(m_header->writePos.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+// ------------------------------------
+ShmRing::State ShmRing::state() const
+{
+    return (State) m_header->state.load();
+}
+
+// ------------------------------------
+void ShmRing::setState(State s)
+{
+    m_header->state = s;
+}
+
+// ------------------------------------
+bool ShmRing::compareAndSetState(State expected, State s)
+{
+    uint32_t e = expected;
+    return m_header->state.compare_exchange_strong(e, s);
+}
+
+// ------------------------------------
+ShmRingStream::ShmRingStream(std::shared_ptr<ShmRing> ring, bool producer)
+    : m_ring(ring)
+    , m_producer(producer)
+    , m_discard(false)
+    , m_closed(false)
+    , m_readTimeout(30000)
+    , m_writeTimeout(WRITE_TIMEOUT)
+{
+    if (!producer)
+        return;
+
+    // 前のセッションを受け手が読み終わるのを待つ。待ち切れなければ、
+    // 混ざらないようにこのセッションは捨てる。
+    for (int waited = 0; !m_ring->compareAndSetState(ShmRing::S_IDLE, ShmRing::S_OPEN); waited += 10)
+    {
+        if (waited >= OPEN_TIMEOUT)
+        {
+            m_discard = true;
+            break;
+        }
+        sys->sleep(10);
+    }
+}
+
+// ------------------------------------
+ShmRingStream::~ShmRingStream()
+{
+    close();
+}
+
+// ------------------------------------
+// 受け手から見て、このセッションにもう読むものが無いか。
+bool ShmRingStream::finished()
+{
+    return m_ring->state() != ShmRing::S_OPEN && m_ring->available() == 0;
+}
+
+// ------------------------------------
+int ShmRingStream::readSome(void* p, int len)
+{
+    unsigned int waited = 0;
+    while (true)
+    {
+        size_t n = m_ring->read(p, len);
+        if (n > 0)
+        {
+            updateTotals(n, 0);
+            return n;
+        }
+        if (finished())
+            throw EOFException("Shared memory session closed");
+        if (waited >= m_readTimeout)
+            throw TimeoutException();
+        sys->sleep(WAIT_MSEC);
+        waited += WAIT_MSEC;
+    }
+}
+
+// ------------------------------------
+int ShmRingStream::read(void* p, int len)
+{
+    int off = 0;
+    while (off < len)
+        off += readSome(static_cast<char*>(p) + off, len - off);
+    return len;
+}
+
+// ------------------------------------
+void ShmRingStream::write(const void* p, int len)
+{
+    unsigned int waited = 0;
+    while (len > 0)
+    {
+        if (m_discard || m_ring->state() == ShmRing::S_DISCARD)
+            return;
+
+        size_t n = m_ring->write(p, len);
+        p = static_cast<const char*>(p) + n;
+        len -= n;
+        if (n > 0)
+        {
+            updateTotals(0, n);
+            waited = 0;
+            continue;
+        }
+
+        // 受け手が止まっている。エンコーダーを待たせ続けないよう、この
+        // セッションの残りは捨てる。
+        if (waited >= m_writeTimeout)
+        {
+            m_ring->compareAndSetState(ShmRing::S_OPEN, ShmRing::S_DISCARD);
+            return;
+        }
+        sys->sleep(WAIT_MSEC);
+        waited += WAIT_MSEC;
+    }
+}
+
+// ------------------------------------
+bool ShmRingStream::eof()
+{
+    return finished();
+}
+
+// ------------------------------------
+bool ShmRingStream::readReady(int timeoutMilliseconds)
+{
+    for (int waited = 0; ; waited += WAIT_MSEC)
+    {
+        if (m_ring->available() > 0 || finished())
+            return true;
+        if (waited >= timeoutMilliseconds)
+            return false;
+        sys->sleep(WAIT_MSEC);
+    }
+}
+
+// ------------------------------------
+void ShmRingStream::close()
+{
+    if (!m_producer || m_closed)
+        return;
+    m_closed = true;
+
+    if (m_discard)
+        return;
+    if (!m_ring->compareAndSetState(ShmRing::S_OPEN, ShmRing::S_CLOSED))
+        m_ring->compareAndSetState(ShmRing::S_DISCARD, ShmRing::S_CLOSED);
+}
+
+// ------------------------------------
+void ShmRingSource::stream(std::shared_ptr<Channel> ch)
+{
+    try
+    {
+        m_stream = std::make_shared<ShmRingStream>(m_ring, false);
+
+        ch->resetPlayTime();
+
+        ch->setStatus(Channel::S_BROADCASTING);
+
+        std::shared_ptr<ChannelStream> source = ch->createSource();
+        ch->lastSourceStream = source;
+
+        ch->readStream(*m_stream, source);
+    }catch (StreamException &e)
+    {
+        LOG_ERROR("Channel aborted: %s", e.msg);
+    }
+
+    ch->setStatus(Channel::S_CLOSING);
+
+    // 送り手がまだ書いていれば、このセッションの残りは捨てさせる。
+    m_ring->compareAndSetState(ShmRing::S_OPEN, ShmRing::S_DISCARD);
+    m_ring->inUse = false;
+}
+
+// ------------------------------------
+int ShmRingSource::getSourceRate()
+{
+    auto s = m_stream;
+    return s ? s->stat.bytesInPerSec() : 0;
+}
+
+// ------------------------------------
+int ShmRingSource::getSourceRateAvg()
+{
+    auto s = m_stream;
+    return s ? s->stat.bytesInPerSecAvg() : 0;
+}
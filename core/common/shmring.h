@@ -0,0 +1,157 @@
+// ------------------------------------------------
+// File : shmring.h
+// Desc:
+//      同じマシンの別プロセスとバイト列をやりとりする共有メモリーのリ
+//      ングバッファー。外部の rtmp-server が組み立てた FLV を、ループ
+//      バックの HTTP Push の代わりにこれで受け取る。送り手と受け手は
+//      それぞれ一つだけで、位置を進めるのにロックは使わない。
+//
+//      一つのリングで順に複数のセッション (エンコーダーからの接続) を
+//      運ぶ。送り手は S_IDLE を見てから S_OPEN にして書き始め、終わっ
+//      たら S_CLOSED にする。受け手は読み切ったら S_IDLE に戻す。受け
+//      手が途中でやめたら S_DISCARD にし、送り手はそのセッションの残り
+//      を捨てる。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _SHMRING_H
+#define _SHMRING_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "stream.h"
+#include "channel.h"
+
+// ------------------------------------
+class ShmRing
+{
+public:
+    enum
+    {
+        MAGIC        = 0x50435352,      // "PCSR"
+        DEFAULT_SIZE = 4 * 1024 * 1024,
+    };
+
+    enum State
+    {
+        S_IDLE,
+        S_OPEN,
+        S_CLOSED,
+        S_DISCARD,
+    };
+
+    // 受け手が作り、送り手が開く。作ったものは消す時に名前も消す。
+    static std::shared_ptr<ShmRing> create(const std::string& name, uint32_t size = DEFAULT_SIZE);
+    static std::shared_ptr<ShmRing> open(const std::string& name);
+    ~ShmRing();
+
+    // 書けた分、読めた分のバイト数を返す。待たない。
+    size_t  write(const void* p, size_t len);
+    size_t  read(void* p, size_t len);
+    size_t  available() const;
+    size_t  space() const;
+    // 溜まっている分を捨てる。受け手から呼ぶ。
+    void    drain();
+
+    State   state() const;
+    void    setState(State s);
+    bool    compareAndSetState(State expected, State s);
+
+    const std::string& name() const { return m_name; }
+    uint32_t size() const { return m_size; }
+
+    // このプロセスで読んでいるチャンネルがある (受け手のみ)。
+    std::atomic<bool> inUse;
+
+    // プラットフォームごとの実装。create なら size の大きさで作り、そ
+    // うでなければ size に大きさを返す。
+    static void* mapShared(const std::string& name, size_t& size, bool create);
+    static void  unmapShared(const std::string& name, void* p, size_t size, bool remove);
+
+private:
+    struct Header
+    {
+        uint32_t                magic;
+        uint32_t                size;       // データ部のバイト数
+        std::atomic<uint64_t>   writePos;
+        std::atomic<uint64_t>   readPos;
+        std::atomic<uint32_t>   state;
+    };
+
+    ShmRing();
+
+    std::string m_name;
+    void*       m_map;
+    size_t      m_mapSize;
+    Header*     m_header;
+    char*       m_data;
+    uint32_t    m_size;
+    bool        m_owner;
+};
+
+// ------------------------------------
+// ShmRing の一つのセッションを読み書きするストリーム。送り手として作
+// ると S_IDLE になるのを待ってセッションを始め、close で終える。
+class ShmRingStream : public Stream
+{
+public:
+    enum
+    {
+        OPEN_TIMEOUT  = 5000,   // 前のセッションが読み終わるのを待つミリ秒
+        WRITE_TIMEOUT = 10000,  // 受け手が読まない時に待つミリ秒
+        WAIT_MSEC     = 1,
+    };
+
+    ShmRingStream(std::shared_ptr<ShmRing> ring, bool producer);
+    ~ShmRingStream();
+
+    int     read(void* p, int len) override;
+    int     readSome(void* p, int len) override;
+    void    write(const void* p, int len) override;
+    bool    eof() override;
+    bool    readReady(int timeoutMilliseconds) override;
+    void    close() override;
+    void    setReadTimeout(unsigned int msec) override { m_readTimeout = msec; }
+    void    setWriteTimeout(unsigned int msec) override { m_writeTimeout = msec; }
+
+private:
+    bool    finished();
+
+    std::shared_ptr<ShmRing> m_ring;
+    bool            m_producer;
+    bool            m_discard;      // 送り手がこのセッションを捨てている
+    bool            m_closed;
+    unsigned int    m_readTimeout, m_writeTimeout;
+};
+
+// ------------------------------------
+// ShmRing のセッションを FLV として読むチャンネルのソース。
+class ShmRingSource : public ChannelSource
+{
+public:
+    ShmRingSource(std::shared_ptr<ShmRing> ring)
+        : m_ring(ring)
+    {
+    }
+
+    void stream(std::shared_ptr<Channel>) override;
+    int getSourceRate() override;
+    int getSourceRateAvg() override;
+
+    std::shared_ptr<ShmRing>        m_ring;
+    std::shared_ptr<ShmRingStream>  m_stream;
+};
+
+#endif
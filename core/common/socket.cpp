@@ -18,3 +18,59 @@
 // GNU General Public License for more details.
 // ------------------------------------------------
 
+
+#include "socket.h"
+#include "resolver.h"
+#include "sys.h"
+
+#include <algorithm>
+#include <string.h>
+
+// --------------------------------------------------
+// name が nullptr ならこのホストの名前を引く。名前解決は g_resolver
+// のキャッシュを通すので、他の名前を引いているスレッドを待たない。
+unsigned int ClientSocket::getIP(const char *name)
+{
+    std::string hostName;
+
+    if (name)
+        hostName = name;
+    else
+    {
+        try
+        {
+            hostName = sys->getHostname();
+        }catch (GeneralException&)
+        {
+            return 0;
+        }
+    }
+
+    return g_resolver.resolveIPv4(hostName);
+}
+
+// --------------------------------------------------
+int ClientSocket::readBuffered(void *p, int l)
+{
+    if (l <= 0)
+        return 0;
+
+    if (bufferedBytes() == 0)
+    {
+        // バッファーに収まらない読み込みは直接受ける。
+        if (l >= READ_BUF_SIZE)
+            return recvOnce(p, l);
+
+        if (!m_readBuf)
+            m_readBuf.reset(new char[READ_BUF_SIZE]);
+        m_readPos = 0;
+        m_readLen = recvOnce(m_readBuf.get(), READ_BUF_SIZE);
+        if (m_readLen == 0)
+            return 0;
+    }
+
+    int n = std::min(l, bufferedBytes());
+    memcpy(p, m_readBuf.get() + m_readPos, n);
+    m_readPos += n;
+    return n;
+}
@@ -34,6 +34,8 @@ class ClientSocket : public Stream
 public:
 
     ClientSocket()
+        : m_readPos(0)
+        , m_readLen(0)
     {
         readTimeout = 30000;
         writeTimeout = 5000;
@@ -44,6 +46,9 @@ public:
     // required interface
     virtual void            open(const Host &) = 0;
     virtual void            bind(const Host &)       = 0;
+    // SO_REUSEPORT を付けて bind する。同じポートを複数のソケットで待ち
+    // 受けられ、カーネルが接続を振り分ける。
+    virtual void            bindReusePort(const Host &) { throw NotImplementedException(__func__); }
     virtual void            connect()          = 0;
     virtual bool            active()           = 0;
     virtual std::shared_ptr<ClientSocket> accept()          = 0;
@@ -52,6 +57,12 @@ public:
     virtual void setReuse(bool) { throw NotImplementedException(__func__); }
     virtual void setNagle(bool) { throw NotImplementedException(__func__); }
     virtual void setLinger(int) { throw NotImplementedException(__func__); }
+    // SO_SNDBUF
+    virtual void setSendBufferSize(int) { throw NotImplementedException(__func__); }
+    // TCP_NOTSENT_LOWAT。まだ送っていない分がこれを下回るまで書けなくする。
+    virtual void setNotSentLowWatermark(int) { throw NotImplementedException(__func__); }
+    // TCP_CONGESTION。"bbr" など。
+    virtual void setCongestionControl(const char*) { throw NotImplementedException(__func__); }
 
     void    setReadTimeout(unsigned int t) override
     {
@@ -73,10 +84,41 @@ public:
     virtual int getDescriptor() const { throw NotImplementedException(__func__); }
     virtual void detach() { throw NotImplementedException(__func__); }
     virtual char peekChar() { throw NotImplementedException(__func__); }
+    // ブロックせずに書ける分だけ書き、書いたバイト数を返す。
+    virtual int tryWrite(const void *, int) { throw NotImplementedException(__func__); }
+    virtual int tryWriteVector(const IOVec *, int) { throw NotImplementedException(__func__); }
+
+    // カーネルから見た送信の状況。
+    struct TransportInfo
+    {
+        unsigned int unackedBytes = 0;  // 送信キューに残っている (相手に届いていない) バイト数
+        unsigned int rttUsec = 0;       // 平滑化した RTT
+    };
+    // 取れなければ false。
+    virtual bool getTransportInfo(TransportInfo&) { return false; }
 
     Host            host;
 
     unsigned int    readTimeout, writeTimeout;
+
+protected:
+    // readLine などの 1 バイトずつの読み込みが、その度に recv にならな
+    // いよう、受信バッファーを挟む。バッファーはソケットが持つので、ソ
+    // ケットを他に渡しても読みかけのデータは失われない。
+    enum { READ_BUF_SIZE = 8192 };
+
+    // recv を一度だけ行う。1 バイト以上読めるか、相手が閉じて 0 を返す
+    // まで待つ。
+    virtual int recvOnce(void *, int) { throw NotImplementedException(__func__); }
+
+    // 最大 l バイトを返す。バッファーが空の時だけ recvOnce を呼ぶ。相
+    // 手が閉じていれば 0。
+    int     readBuffered(void *p, int l);
+    int     bufferedBytes() const { return m_readLen - m_readPos; }
+    void    clearReadBuffer() { m_readPos = m_readLen = 0; }
+
+    std::unique_ptr<char[]> m_readBuf;
+    int             m_readPos, m_readLen;
 };
 
 #endif
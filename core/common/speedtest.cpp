@@ -0,0 +1,192 @@
+// ------------------------------------------------
+// File : speedtest.cpp
+// Desc:
+//      組み込みのスピードテスト。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "speedtest.h"
+#include "socket.h"
+#include "sys.h"
+
+Speedtest g_speedtest;
+
+// ------------------------------------
+const char* Speedtest::buffer()
+{
+    // 途中で圧縮されないよう乱数で埋める。一度だけ作る。
+    static const std::vector<char> buf = []()
+    {
+        std::vector<char> b(NUM_BLOCKS * BLOCK_SIZE);
+        peercast::Random r;
+        for (size_t i = 0; i + 4 <= b.size(); i += 4)
+        {
+            unsigned int v = r.next();
+            memcpy(&b[i], &v, 4);
+        }
+        return b;
+    }();
+    return buf.data();
+}
+
+// ------------------------------------
+Speedtest::Result Speedtest::send(ClientSocket& sock, double seconds)
+{
+    const char* buf = buffer();
+    const double start = sys->getMonotonicTime();
+    uint64_t sent = 0;
+    int block = 0;
+
+    try
+    {
+        while (sys->getMonotonicTime() - start < seconds)
+        {
+            Stream::IOVec vec[VECTOR_BLOCKS];
+            for (int i = 0; i < VECTOR_BLOCKS; i++)
+            {
+                vec[i] = { buf + block * BLOCK_SIZE, BLOCK_SIZE };
+                block = (block + 1) % NUM_BLOCKS;
+            }
+            sock.writeVector(vec, VECTOR_BLOCKS);
+            sent += VECTOR_BLOCKS * BLOCK_SIZE;
+        }
+    }catch (StreamException&)
+    {
+        // 相手が先に切った。
+    }
+
+    Result res;
+    res.seconds = sys->getMonotonicTime() - start;
+    res.bytes = sent;
+
+    ClientSocket::TransportInfo info;
+    if (sock.getTransportInfo(info))
+    {
+        res.bytes -= std::min<uint64_t>(info.unackedBytes, sent);
+        res.rttUsec = info.rttUsec;
+    }
+    return res;
+}
+
+// ------------------------------------
+Speedtest::Result Speedtest::receive(ClientSocket& sock, int64_t length, double maxSeconds)
+{
+    std::vector<char> buf(BLOCK_SIZE);
+    const double start = sys->getMonotonicTime();
+    uint64_t received = 0;
+
+    try
+    {
+        while ((length < 0 || (int64_t) received < length) &&
+               sys->getMonotonicTime() - start < maxSeconds)
+        {
+            int len = BLOCK_SIZE;
+            if (length >= 0)
+                len = (int) std::min<int64_t>(len, length - received);
+            int r = sock.readSome(buf.data(), len);
+            if (r <= 0)
+                break;
+            received += r;
+        }
+    }catch (StreamException&)
+    {
+    }
+
+    Result res;
+    res.seconds = sys->getMonotonicTime() - start;
+    res.bytes = received;
+
+    ClientSocket::TransportInfo info;
+    if (sock.getTransportInfo(info))
+        res.rttUsec = info.rttUsec;
+    return res;
+}
+
+// ------------------------------------
+bool Speedtest::begin(const std::string& id)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto& s = m_sessions[id];
+    if (s.active >= MAX_STREAMS)
+        return false;
+    s.active++;
+    s.updatedAt = sys->getMonotonicTime();
+    return true;
+}
+
+// ------------------------------------
+void Speedtest::end(const std::string& id, const Result& r)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto& s = m_sessions[id];
+    if (s.active > 0)
+        s.active--;
+    s.streams++;
+    s.bytes += r.bytes;
+    s.seconds = std::max(s.seconds, r.seconds);
+    s.bps += r.bps();
+    s.rttUsec = std::max(s.rttUsec, r.rttUsec);
+    s.updatedAt = sys->getMonotonicTime();
+}
+
+// ------------------------------------
+nlohmann::json Speedtest::result(const std::string& id)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_sessions.find(id);
+    if (it == m_sessions.end())
+        return nullptr;
+
+    auto& s = it->second;
+    return {
+        {"id", id},
+        {"active", s.active},
+        {"streams", s.streams},
+        {"bytes", s.bytes},
+        {"seconds", s.seconds},
+        {"bps", s.bps},
+        {"rttUsec", s.rttUsec},
+    };
+}
+
+// ------------------------------------
+void Speedtest::expire(double now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    for (auto it = m_sessions.begin(); it != m_sessions.end(); )
+    {
+        if (it->second.active == 0 && now - it->second.updatedAt >= SESSION_TTL)
+            it = m_sessions.erase(it);
+        else
+            ++it;
+    }
+}
+
+// ------------------------------------
+amf0::Value Speedtest::getState()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    int active = 0;
+    for (auto& pair : m_sessions)
+        active += pair.second.active;
+    return amf0::Value::object(
+        {
+            {"numSessions", (int) m_sessions.size()},
+            {"activeStreams", active},
+        });
+}
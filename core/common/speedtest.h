@@ -0,0 +1,102 @@
+// ------------------------------------------------
+// File : speedtest.h
+// Desc:
+//      組み込みのスピードテストのエンドポイント (/speedtest) の中身。
+//      ダウンロードは用意しておいた乱数のバッファーを大きな単位でベク
+//      タ書き込みし、アップロードは大きなブロックで読み捨てる。同じ id
+//      で並べて張られた接続の結果はセッションにまとめ、
+//      /speedtest/result で返す。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _SPEEDTEST_H
+#define _SPEEDTEST_H
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "amf0.h"
+#include "json.hpp"
+
+class ClientSocket;
+
+// ------------------------------------
+class Speedtest
+{
+public:
+    enum
+    {
+        BLOCK_SIZE      = 64 * 1024,
+        NUM_BLOCKS      = 16,       // バッファーは 1 MiB
+        VECTOR_BLOCKS   = 4,        // 一度の writeVector で渡すブロック数
+        DEFAULT_SECONDS = 15,
+        MAX_SECONDS     = 30,
+        MAX_STREAMS     = 8,        // 一つのセッションで同時に張れる接続
+        SESSION_TTL     = 60,       // 終わったセッションを残しておく秒数
+    };
+
+    struct Result
+    {
+        uint64_t        bytes = 0;      // 相手に届いた (受け取った) バイト数
+        double          seconds = 0;
+        unsigned int    rttUsec = 0;    // 分からなければ 0
+
+        double bps() const { return (seconds > 0) ? bytes * 8 / seconds : 0; }
+    };
+
+    // 送るデータ。NUM_BLOCKS * BLOCK_SIZE バイトの乱数。
+    static const char* buffer();
+
+    // seconds 秒の間 sock に送り続ける。応答ヘッダーは呼び出し側で書
+    // く。送ったバイト数からカーネルの送信キューに残っている分を引くの
+    // で、バッファーに溜まっただけの分は数えない。相手が閉じればそこま
+    // での結果を返す。
+    static Result send(ClientSocket& sock, double seconds);
+
+    // length バイト (負なら相手が閉じるまで) を最大 maxSeconds 秒読み捨
+    // てる。
+    static Result receive(ClientSocket& sock, int64_t length, double maxSeconds);
+
+    // id のセッションに接続を一つ加える。MAX_STREAMS を超えていれば
+    // false。
+    bool        begin(const std::string& id);
+    void        end(const std::string& id, const Result& r);
+
+    // id のセッションのまとめ。無ければ null。
+    nlohmann::json result(const std::string& id);
+
+    // 終わってから SESSION_TTL 秒経ったセッションを消す。
+    void        expire(double now);
+
+    amf0::Value getState();
+
+private:
+    struct Session
+    {
+        int             active = 0;
+        int             streams = 0;    // 終わった接続の数
+        uint64_t        bytes = 0;
+        double          seconds = 0;    // 一番長かった接続
+        double          bps = 0;        // 接続ごとの速さの和
+        unsigned int    rttUsec = 0;
+        double          updatedAt = 0;
+    };
+
+    std::mutex                      m_lock;
+    std::map<std::string, Session>  m_sessions;
+};
+
+extern Speedtest g_speedtest;
+
+#endif
@@ -4,7 +4,8 @@
 #include "stream.h"
 
 // データストリームを複数のストリームに分岐する。close 時、あるいはデ
-// コンストラクト時に出力先のストリームも close される。
+// コンストラクト時に出力先のストリームも close される。出力先には順に
+// 書くので、待たせたくない出力先は QueuedStream で包んで渡す。
 struct StreamSplitter : public Stream
 {
     StreamSplitter(const std::vector<std::shared_ptr<Stream>>& streams = {})
@@ -38,6 +39,12 @@ struct StreamSplitter : public Stream
             stream->write(data, len);
     }
 
+    void writeVector(const IOVec *vec, int n) override
+    {
+        for (auto& stream : m_streams)
+            stream->writeVector(vec, n);
+    }
+
     void close() override
     {
         for (auto& stream : m_streams)
@@ -16,34 +16,194 @@
 #ifdef WIN32
 #else
 #include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "strerror.h"
 #endif
 #include <unistd.h>
+#include <algorithm>
+#include <map>
 #include "str.h"
 #include "stats.h"
+#include "servmgr.h"
 
 using namespace str;
 
+static void initializeOpenSSL()
+{
+    static std::mutex s_mutex;
+    static bool s_openssl_initialized = false;
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (!s_openssl_initialized)
+    {
+        LOG_DEBUG("Initializing OpenSSL ...");
+        SSL_load_error_strings();
+        SSL_library_init();
+        OpenSSL_add_ssl_algorithms();
+        s_openssl_initialized = true;
+    }
+}
+
+// カーネルが対応していれば、ハンドシェイクの後の暗号化を kTLS に任せる。
+static void enableKTLS(SSL_CTX* ctx)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+}
+
+// ------------------------------------------------
+// クライアントのセッションキャッシュ。"ホスト名:ポート" をキーにして、
+// 最近受け取ったセッションを一つずつ取っておく。
+static const size_t MAX_CACHED_SESSIONS = 64;
+static std::mutex s_sessionLock;
+static std::map<std::string, SSL_SESSION*> s_sessions;
+static int s_socketIndex = -1;
+
 SslClientSocket::SslClientSocket()
     : m_remoteAddr({})
 {
+    initializeOpenSSL();
+
+    m_socket = -1;
+    m_ssl = nullptr;
+}
+
+SSL_CTX* SslClientSocket::clientContext()
+{
+    initializeOpenSSL();
+
     static std::mutex s_mutex;
-    static bool s_openssl_initialized = false;
+    static SSL_CTX* s_ctx = nullptr;
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (!s_ctx)
     {
-        std::lock_guard<std::mutex> lock(s_mutex);
-        if (!s_openssl_initialized)
+        s_ctx = SSL_CTX_new(SSLv23_client_method());
+        assert( s_ctx != nullptr ); // ライブラリが初期化されているから null は返らない。
+
+        if (SSL_CTX_set_default_verify_paths(s_ctx) != 1)
+            LOG_WARN("SSL: could not load the default certificate store");
+
+        // TLS 1.3 ではセッションチケットはハンドシェイクの後に届くので、
+        // コールバックで受け取る。
+        SSL_CTX_set_session_cache_mode(s_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(s_ctx, onNewSession);
+        SSL_CTX_set_mode(s_ctx, SSL_MODE_RELEASE_BUFFERS);
+        enableKTLS(s_ctx);
+
+        s_socketIndex = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    }
+    return s_ctx;
+}
+
+static std::string s_serverCrtPath = "server.crt";
+static std::string s_serverKeyPath = "server.key";
+static std::mutex  s_serverLock;
+static SSL_CTX*    s_serverCtx = nullptr;
+
+// http2 フラグが立っていてクライアントが h2 を挙げていればそれを、そう
+// でなければ http/1.1 を選ぶ。どちらも無ければ ALPN を使わない。
+static int selectALPN(SSL*, const unsigned char** out, unsigned char* outlen,
+                      const unsigned char* in, unsigned int inlen, void*)
+{
+    static const unsigned char h2[] = "\x02h2";
+    static const unsigned char http11[] = "\x08http/1.1";
+
+    auto select = [&](const unsigned char* proto, unsigned int len)
+    {
+        return SSL_select_next_proto((unsigned char**) out, outlen, proto, len, in, inlen) == OPENSSL_NPN_NEGOTIATED;
+    };
+    if (servMgr->flags[ServMgr::F_http2] && select(h2, sizeof(h2) - 1))
+        return SSL_TLSEXT_ERR_OK;
+    if (select(http11, sizeof(http11) - 1))
+        return SSL_TLSEXT_ERR_OK;
+    return SSL_TLSEXT_ERR_NOACK;
+}
+
+SSL_CTX* SslClientSocket::serverContext()
+{
+    initializeOpenSSL();
+
+    std::lock_guard<std::mutex> lock(s_serverLock);
+    if (!s_serverCtx)
+    {
+        SSL_CTX* ctx = SSL_CTX_new(SSLv23_server_method());
+        assert( ctx != nullptr );
+
+        SSL_CTX_set_ecdh_auto(ctx, 1);
+
+        if (SSL_CTX_use_certificate_file(ctx, s_serverCrtPath.c_str(), SSL_FILETYPE_PEM) <= 0) {
+            SSL_CTX_free(ctx);
+            throw GeneralException("Certificate file");
+        }
+
+        if (SSL_CTX_use_PrivateKey_file(ctx, s_serverKeyPath.c_str(), SSL_FILETYPE_PEM) <= 0) {
+            SSL_CTX_free(ctx);
+            throw GeneralException("Private key file");
+        }
+
+        // 既定でサーバー側のキャッシュとセッションチケットは有効。
+        static const unsigned char sid_ctx[] = "peercast";
+        SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+        // キープアライブで待っている接続が、読み書きのバッファーを持ち
+        // 続けないようにする。
+        SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS);
+        enableKTLS(ctx);
+        SSL_CTX_set_alpn_select_cb(ctx, selectALPN, nullptr);
+
+        s_serverCtx = ctx;
+    }
+    return s_serverCtx;
+}
+
+std::string SslClientSocket::sessionKey()
+{
+    if (!m_serverName.empty())
+        return m_serverName + ":" + std::to_string(host.port);
+    else
+        return host.str();
+}
+
+// 新しいセッションを受け取った。1 を返すとこちらが持つ。
+int SslClientSocket::onNewSession(SSL* ssl, SSL_SESSION* session)
+{
+    auto sock = static_cast<SslClientSocket*>(SSL_get_ex_data(ssl, s_socketIndex));
+    if (!sock)
+        return 0;
+
+    std::lock_guard<std::mutex> lock(s_sessionLock);
+    auto key = sock->sessionKey();
+    auto it = s_sessions.find(key);
+    if (it != s_sessions.end())
+    {
+        SSL_SESSION_free(it->second);
+        it->second = session;
+    }else
+    {
+        if (s_sessions.size() >= MAX_CACHED_SESSIONS)
         {
-            LOG_DEBUG("Initializing OpenSSL ...");
-            SSL_load_error_strings();
-            SSL_library_init();
-            OpenSSL_add_ssl_algorithms();
-            s_openssl_initialized = true;
+            SSL_SESSION_free(s_sessions.begin()->second);
+            s_sessions.erase(s_sessions.begin());
         }
+        s_sessions[key] = session;
     }
+    return 1;
+}
 
-    m_socket = -1;
-    m_ctx = nullptr;
-    m_ssl = nullptr;
+void SslClientSocket::clearSessionCache()
+{
+    std::lock_guard<std::mutex> lock(s_sessionLock);
+    for (auto& pair : s_sessions)
+        SSL_SESSION_free(pair.second);
+    s_sessions.clear();
+}
+
+bool SslClientSocket::sessionReused()
+{
+    return m_ssl && SSL_session_reused(m_ssl);
 }
 
 SslClientSocket::~SslClientSocket()
@@ -55,11 +215,6 @@ SslClientSocket::~SslClientSocket()
         SSL_free(m_ssl);
     }
 
-    if (m_ctx)
-    {
-        SSL_CTX_free(m_ctx);
-    }
-
     if (m_socket != -1)
     {
 #ifdef WIN32
@@ -111,10 +266,9 @@ void SslClientSocket::open(const Host &rh)
 
     setTimeoutOptions();
 
-    m_ctx = SSL_CTX_new(SSLv23_client_method());
-    assert( m_ctx != nullptr ); // ライブラリが初期化されているから null は返らない。
-    m_ssl = SSL_new(m_ctx);
+    m_ssl = SSL_new(clientContext());
     assert( m_ssl != nullptr );
+    SSL_set_ex_data(m_ssl, s_socketIndex, this);
 
     host = rh;
 
@@ -144,11 +298,24 @@ void SslClientSocket::connect()
         throw SockException("SSL_set_fd failed");
     }
 
+    if (!m_serverName.empty())
+        SSL_set_tlsext_host_name(m_ssl, m_serverName.c_str());
+
+    {
+        std::lock_guard<std::mutex> lock(s_sessionLock);
+        auto it = s_sessions.find(sessionKey());
+        if (it != s_sessions.end())
+            SSL_set_session(m_ssl, it->second);
+    }
+
     int r;
     r = SSL_connect(m_ssl);
     if (r != 1) {
 	throw SockException("SSL handshake failed");
     }
+
+    LOG_DEBUG("SSL: connected to %s (%s)", sessionKey().c_str(),
+              SSL_session_reused(m_ssl) ? "resumed" : "full handshake");
 }
 
 bool SslClientSocket::active()
@@ -178,6 +345,29 @@ void SslClientSocket::setBlocking(bool)
     throw NotImplementedException("Operation is not supported");
 }
 
+void SslClientSocket::setNagle(bool on)
+{
+    int nodelay = (on==false);
+    if (setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, (const char*) &nodelay, sizeof(nodelay)) != 0)
+        throw SockException("Unable to set NODELAY");
+}
+
+bool SslClientSocket::readReady(int timeoutMilliseconds)
+{
+    if (m_ssl && SSL_pending(m_ssl) > 0)
+        return true;
+
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(m_socket, &fds);
+
+    struct timeval tv;
+    tv.tv_sec = timeoutMilliseconds / 1000;
+    tv.tv_usec = (timeoutMilliseconds % 1000) * 1000;
+
+    return select(m_socket + 1, &fds, nullptr, nullptr, &tv) == 1;
+}
+
 int SslClientSocket::read(void *p, int l)
 {
     int bytesRead = l;
@@ -223,8 +413,68 @@ int SslClientSocket::readUpto(void *p, int l)
     }
 }
 
+int SslClientSocket::readSome(void *p, int l)
+{
+    int r = SSL_read(m_ssl, p, l);
+
+    if (r <= 0) { // error
+        int err = SSL_get_error(m_ssl, r);
+        if (err == SSL_ERROR_ZERO_RETURN) {
+            throw EOFException("Closed on read");
+        } else {
+            throw SockException( format("SSL_read failed, error = %d", err).c_str() );
+        }
+    }
+
+    stats.add(Stats::BYTESIN, r);
+    if (host.localIP())
+        stats.add(Stats::LOCALBYTESIN, r);
+    updateTotals(r, 0);
+    return r;
+}
+
 #include <openssl/err.h>
 
+void SslClientSocket::writeVector(const IOVec *vec, int n)
+{
+    // SSL_write は一回ごとにレコードを作って送るので、ヘッダーと小さ
+    // なパケットが並んでいると、小さなレコードがいくつも出る。
+    // 前の呼び出しが例外で抜けていれば残っているので捨てる。
+    m_record.clear();
+    m_record.reserve(RECORD_SIZE);
+    for (int i = 0; i < n; i++)
+    {
+        const char* p = static_cast<const char*>(vec[i].data);
+        int len = vec[i].len;
+        while (len > 0)
+        {
+            if (m_record.empty() && len >= RECORD_SIZE)
+            {
+                write(p, RECORD_SIZE);
+                p += RECORD_SIZE;
+                len -= RECORD_SIZE;
+                continue;
+            }
+
+            int l = std::min<int>(len, RECORD_SIZE - m_record.size());
+            m_record.insert(m_record.end(), p, p + l);
+            p += l;
+            len -= l;
+            if (m_record.size() == RECORD_SIZE)
+            {
+                write(m_record.data(), m_record.size());
+                m_record.clear();
+            }
+        }
+    }
+
+    if (!m_record.empty())
+    {
+        write(m_record.data(), m_record.size());
+        m_record.clear();
+    }
+}
+
 void SslClientSocket::write(const void *p, int l)
 {
     if (l == 0) // 0バイトの書き込みは常に成功する。
@@ -250,34 +500,29 @@ void SslClientSocket::write(const void *p, int l)
     }
 }
 
-static std::string s_serverCrtPath = "server.crt";
-static std::string s_serverKeyPath = "server.key";
-
+// 次の upgrade でコンテキストを作り直す。接続中のものは前のコンテキ
+// ストを参照で持っている。
 void SslClientSocket::configureServer(const std::string& certificate, const std::string& privatekey)
 {
+    std::lock_guard<std::mutex> lock(s_serverLock);
     s_serverCrtPath = certificate;
     s_serverKeyPath = privatekey;
+    if (s_serverCtx)
+    {
+        SSL_CTX_free(s_serverCtx);
+        s_serverCtx = nullptr;
+    }
 }
 
 std::pair<std::string,std::string> SslClientSocket::getServerConfiguration()
 {
+    std::lock_guard<std::mutex> lock(s_serverLock);
     return { s_serverCrtPath, s_serverKeyPath };
 }
 
 std::shared_ptr<SslClientSocket> SslClientSocket::upgrade(std::shared_ptr<ClientSocket> rawsock)
 {
-    SSL_CTX* ctx = SSL_CTX_new(SSLv23_server_method());
-    assert( ctx != nullptr );
-
-    SSL_CTX_set_ecdh_auto(ctx, 1);
-
-    if (SSL_CTX_use_certificate_file(ctx, s_serverCrtPath.c_str(), SSL_FILETYPE_PEM) <= 0) {
-        throw GeneralException("Certificate file");
-    }
-
-    if (SSL_CTX_use_PrivateKey_file(ctx, s_serverKeyPath.c_str(), SSL_FILETYPE_PEM) <= 0) {
-        throw GeneralException("Private key file");
-    }
+    SSL_CTX* ctx = serverContext();
 
     rawsock->setBlocking(true);
 
@@ -286,10 +531,12 @@ std::shared_ptr<SslClientSocket> SslClientSocket::upgrade(std::shared_ptr<Client
     int ret;
     ret = SSL_set_fd(ssl, rawsock->getDescriptor());
     if (ret != 1) {
+        SSL_free(ssl);
         throw StreamException(str::format("%s: SSL_set_fd", __func__));
     }
     if ((ret = SSL_accept(ssl)) <= 0) {
         int code = SSL_get_error(ssl, ret);
+        SSL_free(ssl);
         throw StreamException(str::format("%s: SSL_accept: ret = %d, code = %d", __func__, ret, code));
     } else {
         auto sock = std::make_shared<SslClientSocket>();
@@ -298,7 +545,6 @@ std::shared_ptr<SslClientSocket> SslClientSocket::upgrade(std::shared_ptr<Client
         sock->m_remoteAddr.sin6_port = htons(rawsock->host.port);
         sock->m_remoteAddr.sin6_addr = rawsock->host.ip.serialize();
         sock->m_socket = rawsock->getDescriptor();
-        sock->m_ctx = ctx;
         sock->m_ssl = ssl;
         sock->host = rawsock->host;
         sock->setTimeoutOptions();
@@ -14,6 +14,7 @@
 #define _SSLCLIENTSOCKET_H
 
 #include <utility> // std::pair
+#include <vector>
 #include <openssl/ssl.h>
 
 #include "socket.h"
@@ -36,22 +37,51 @@ public:
     std::shared_ptr<ClientSocket> accept() override;
     Host getLocalHost() override;
     void setBlocking(bool) override;
+    void setNagle(bool) override;
 
     // Stream interface
     int read(void *, int) override;
     int readUpto(void *, int) override;
+    int readSome(void *, int) override;
     void write(const void *, int) override;
+    // 小さなバッファーは TLS レコード一つ分にまとめてから送る。
+    void writeVector(const IOVec *, int) override;
+    // SSL が復号して溜めている分も読めるものとして数える。
+    bool readReady(int timeoutMilliseconds) override;
 
     static std::shared_ptr<SslClientSocket> upgrade(std::shared_ptr<ClientSocket>);
     void setTimeoutOptions();
 
+    // SNI で送るホスト名。connect の前に呼ぶ。セッションの再開もこの
+    // 名前とポートごとに行う。
+    void setServerName(const std::string& name) { m_serverName = name; }
+
+    // 前のセッションを再開して接続した。
+    bool sessionReused();
+
     static void configureServer(const std::string& certificate, const std::string& privatekey);
     static std::pair<std::string,std::string> getServerConfiguration();
 
+    // プロセスで共有するコンテキスト。証明書ストアの読み込みやセッショ
+    // ンキャッシュは一度だけ作る。
+    static SSL_CTX* clientContext();
+    static SSL_CTX* serverContext();
+
+    // 再開用に取っておいたクライアントのセッションを捨てる。
+    static void clearSessionCache();
+
     struct sockaddr_in6 m_remoteAddr;
     int m_socket;
-    SSL_CTX* m_ctx;
     SSL* m_ssl;
+    std::string m_serverName;
+
+private:
+    // writeVector でまとめるバッファー。TLS の平文の最大レコード長。
+    enum { RECORD_SIZE = 16384 };
+    std::vector<char> m_record;
+
+    std::string sessionKey();
+    static int onNewSession(SSL* ssl, SSL_SESSION* session);
 };
 
 #endif
@@ -12,6 +12,7 @@ public:
     StringStream(const std::string&);
 
     int  read(void *, int) override;
+    int  readSome(void *p, int l) override { return read(p, l); }
     void write(const void *, int) override;
     bool eof() override;
     void rewind() override;
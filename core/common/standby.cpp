@@ -0,0 +1,128 @@
+// ------------------------------------------------
+// File : standby.cpp
+// Desc:
+//      控えの上流接続。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "standby.h"
+#include "sys.h"
+
+// ------------------------------------
+StandbyUpstream::StandbyUpstream(std::function<bool(ChanHit&)> pick)
+    : connect([](const ChanHit& hit)
+              {
+                  auto sock = sys->createSocket();
+                  if (!sock)
+                      throw StreamException("Can`t create socket");
+                  sock->open(hit.host);
+                  sock->connect();
+                  return sock;
+              })
+    , refreshInterval(REFRESH_INTERVAL)
+    , retryInterval(RETRY_INTERVAL)
+    , m_pick(pick)
+    , m_stopping(false)
+{
+}
+
+// ------------------------------------
+StandbyUpstream::~StandbyUpstream()
+{
+    stop();
+}
+
+// ------------------------------------
+void StandbyUpstream::start()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    if (m_thread.joinable())
+        return;
+    m_stopping = false;
+    m_thread = std::thread([this]() { main(); });
+}
+
+// ------------------------------------
+void StandbyUpstream::stop()
+{
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        m_stopping = true;
+        m_changed.notify_all();
+    }
+    if (m_thread.joinable())
+        m_thread.join();
+
+    replace(ChanHit(), nullptr);
+}
+
+// ------------------------------------
+bool StandbyUpstream::take(ChanHit& hit, std::shared_ptr<ClientSocket>& sock)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    if (!m_sock)
+        return false;
+
+    hit = m_hit;
+    sock = m_sock;
+    m_sock = nullptr;
+    m_changed.notify_all();   // すぐに次の控えを張る
+    return true;
+}
+
+// ------------------------------------
+void StandbyUpstream::replace(const ChanHit& hit, std::shared_ptr<ClientSocket> sock)
+{
+    std::shared_ptr<ClientSocket> old;
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        old = m_sock;
+        m_hit = hit;
+        m_sock = sock;
+    }
+    if (old)
+        old->close();
+}
+
+// ------------------------------------
+void StandbyUpstream::main()
+{
+    sys->setThreadName("STANDBY");
+
+    while (true)
+    {
+        unsigned int wait = retryInterval;
+
+        ChanHit hit;
+        if (m_pick(hit))
+        {
+            try
+            {
+                auto sock = connect(hit);
+                LOG_DEBUG("Standby upstream connected to %s", hit.host.str().c_str());
+                replace(hit, sock);
+                wait = refreshInterval;
+            }catch (StreamException& e)
+            {
+                LOG_DEBUG("Standby upstream %s: %s", hit.host.str().c_str(), e.msg);
+            }
+        }
+
+        std::unique_lock<std::mutex> cs(m_lock);
+        bool taken = !m_sock;
+        m_changed.wait_for(cs, std::chrono::milliseconds(wait),
+                           [&]() { return m_stopping || (!taken && !m_sock); });
+        if (m_stopping)
+            return;
+    }
+}
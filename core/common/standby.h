@@ -0,0 +1,74 @@
+// ------------------------------------------------
+// File : standby.h
+// Desc:
+//      控えの上流接続。チャンネルを受信している間、次に良い候補へ TCP
+//      接続を張っておき、上流が切れたら探し直さずにそれを使う。相手は
+//      要求を待ったまま読み込みタイムアウト (30秒) で切るので、それより
+//      短い間隔で張り直す。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _STANDBY_H
+#define _STANDBY_H
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "chanhit.h"
+#include "socket.h"
+
+// ------------------------------------
+class StandbyUpstream
+{
+public:
+    enum
+    {
+        REFRESH_INTERVAL = 20000,   // 控えの接続を張り直すミリ秒数
+        RETRY_INTERVAL   = 5000,    // 候補が無いか接続に失敗した時に待つミリ秒数
+    };
+
+    // pick は控えにする候補を選ぶ。無ければ false。
+    StandbyUpstream(std::function<bool(ChanHit&)> pick);
+    ~StandbyUpstream();
+
+    void    start();
+    void    stop();
+
+    // 張ってある控えの接続を取り出す。無ければ false。
+    bool    take(ChanHit& hit, std::shared_ptr<ClientSocket>& sock);
+
+    // 候補に接続する関数。テストで差し替える。
+    std::function<std::shared_ptr<ClientSocket>(const ChanHit&)> connect;
+
+    unsigned int refreshInterval;   // ミリ秒
+    unsigned int retryInterval;     // ミリ秒
+
+private:
+    void    main();
+    void    replace(const ChanHit& hit, std::shared_ptr<ClientSocket> sock);
+
+    std::function<bool(ChanHit&)> m_pick;
+
+    std::mutex              m_lock;
+    std::condition_variable m_changed;
+    bool                    m_stopping;
+    std::thread             m_thread;
+
+    ChanHit                 m_hit;
+    std::shared_ptr<ClientSocket> m_sock;
+};
+
+#endif
@@ -25,32 +25,57 @@
 
 Stats stats;
 
+// ------------------------------------
+Stats::Stats()
+{
+    clear();
+}
+
 // ------------------------------------
 void Stats::clear()
 {
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
     for (int i=0; i<Stats::MAX; i++)
     {
-        current[i] = 0;
+        clear((STAT) i);
         last[i] = 0;
         perSec[i] = 0;
     }
     lastUpdate = 0;
 }
 
+// ------------------------------------
+unsigned int Stats::shardIndex()
+{
+    // スレッドが初めて数える時に順番に割り振る。
+    static std::atomic<unsigned int> next(0);
+    static thread_local unsigned int index = next++ & (NUM_SHARDS - 1);
+    return index;
+}
+
+// ------------------------------------
+unsigned int Stats::getCurrent(STAT s) const
+{
+    unsigned int sum = 0;
+    for (auto& shard : shards)
+        sum += shard.counters[s].load(std::memory_order_relaxed);
+    return sum;
+}
+
 // ------------------------------------
 void    Stats::update()
 {
     unsigned int ctime = sys->getTime();
 
-    std::lock_guard<std::recursive_mutex> cs(lock);
+    std::lock_guard<ProfiledMutex> cs(lock);
     unsigned int diff = ctime - lastUpdate;
     if (diff >= 5)
     {
         for (int i=0; i<Stats::MAX; i++)
         {
-            perSec[i] = (current[i]-last[i])/diff;
-            last[i] = current[i];
+            unsigned int current = getCurrent((STAT) i);
+            perSec[i] = (current-last[i])/diff;
+            last[i] = current;
         }
 
         lastUpdate = ctime;
@@ -3,6 +3,8 @@
 // Date: 4-apr-2002
 // Author: giles
 // Desc:
+//      カウンターはスレッドごとに割り当てた区画の atomic に足し込むので、
+//      add はロックを取らない。毎秒の値は update で全区画を合計して出す。
 //
 // (c) 2002 peercast.org
 // ------------------------------------------------
@@ -20,6 +22,8 @@
 #ifndef _STATS_H
 #define _STATS_H
 
+#include <atomic>
+
 #include "varwriter.h"
 #include "threading.h"
 
@@ -27,6 +31,7 @@
 class Stats : public VariableWriter
 {
 public:
+    Stats();
 
     void    clear();
     void    update();
@@ -66,38 +71,49 @@ public:
         MAX
     };
 
+    enum
+    {
+        NUM_SHARDS = 16,    // 2 のべき乗
+    };
+
     amf0::Value    getState() override;
 
     void    clearRange(STAT s, STAT e)
     {
-        std::lock_guard<std::recursive_mutex> cs(lock);
         for (int i=s; i<=e; i++)
-            current[i] = 0;
+            clear((STAT) i);
     }
     void    clear(STAT s)
     {
-        std::lock_guard<std::recursive_mutex> cs(lock);
-        current[s] = 0;
+        for (auto& shard : shards)
+            shard.counters[s].store(0, std::memory_order_relaxed);
     }
     void    add(STAT s, int n=1)
     {
-        std::lock_guard<std::recursive_mutex> cs(lock);
-        current[s] += n;
+        shards[shardIndex()].counters[s].fetch_add(n, std::memory_order_relaxed);
     }
     unsigned int getPerSecond(STAT s) const
     {
-        std::lock_guard<std::recursive_mutex> cs(lock);
-        return perSec[s];
+        return perSec[s].load(std::memory_order_relaxed);
     }
-    unsigned int getCurrent(STAT s) const
+    // 全区画の合計。
+    unsigned int getCurrent(STAT s) const;
+
+    // 呼び出したスレッドに割り当てた区画。
+    static unsigned int shardIndex();
+
+    // キャッシュラインを他の区画と共有しないようにする。
+    struct alignas(64) Shard
     {
-        std::lock_guard<std::recursive_mutex> cs(lock);
-        return current[s];
-    }
+        std::atomic<unsigned int> counters[Stats::MAX];
+    };
 
-    unsigned int    current[Stats::MAX], last[Stats::MAX], perSec[Stats::MAX];
+    Shard           shards[NUM_SHARDS];
+    // 以下は update が書く。
+    unsigned int    last[Stats::MAX];
+    std::atomic<unsigned int> perSec[Stats::MAX];
     unsigned int    lastUpdate;
-    mutable std::recursive_mutex lock;
+    mutable ProfiledMutex lock { "Stats::lock" };
 };
 
 extern Stats stats;
@@ -0,0 +1,245 @@
+// ------------------------------------------------
+// File : statshist.cpp
+// Desc:
+//      リングの添字は時刻をリングの長さで割った余り。記録の間が空いた
+//      ら、その間の枠を NaN にしてから書く。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "statshist.h"
+#include "chanmgr.h"
+#include "channel.h"
+#include "stats.h"
+
+StatsHistory g_statsHistory;
+
+static const float NO_VALUE = std::numeric_limits<float>::quiet_NaN();
+
+// ------------------------------------
+TimeSeries::TimeSeries()
+    : m_firstSecond(0)
+    , m_lastSecond(0)
+    , m_minuteSum(0)
+    , m_minuteCount(0)
+{
+    m_seconds.fill(NO_VALUE);
+    m_minutes.fill(NO_VALUE);
+}
+
+// ------------------------------------
+void TimeSeries::closeMinute(unsigned int minute)
+{
+    m_minutes[minute % NUM_MINUTES] = m_minuteCount ? (float) (m_minuteSum / m_minuteCount) : NO_VALUE;
+    m_minuteSum = 0;
+    m_minuteCount = 0;
+}
+
+// ------------------------------------
+void TimeSeries::add(unsigned int time, float value)
+{
+    if (time == 0 || time < m_lastSecond)
+        return;
+
+    if (m_lastSecond == 0)
+    {
+        m_firstSecond = time;
+    }else if (time == m_lastSecond)
+    {
+        float& old = m_seconds[time % NUM_SECONDS];
+        if (!std::isnan(old))
+        {
+            m_minuteSum -= old;
+            m_minuteCount--;
+        }
+    }else
+    {
+        // 間の秒を空ける。リングを一周すれば全部空いている。
+        unsigned int gap = std::min<unsigned int>(time - m_lastSecond - 1, NUM_SECONDS);
+        for (unsigned int i = 1; i <= gap; i++)
+            m_seconds[(m_lastSecond + i) % NUM_SECONDS] = NO_VALUE;
+
+        const unsigned int lastMinute = m_lastSecond / 60;
+        const unsigned int minute = time / 60;
+        if (minute != lastMinute)
+        {
+            closeMinute(lastMinute);
+            unsigned int mgap = std::min<unsigned int>(minute - lastMinute - 1, NUM_MINUTES);
+            for (unsigned int i = 1; i <= mgap; i++)
+                m_minutes[(lastMinute + i) % NUM_MINUTES] = NO_VALUE;
+        }
+    }
+
+    m_seconds[time % NUM_SECONDS] = value;
+    m_lastSecond = time;
+    if (!std::isnan(value))
+    {
+        m_minuteSum += value;
+        m_minuteCount++;
+    }
+}
+
+// ------------------------------------
+TimeSeries::Range TimeSeries::range(Resolution res) const
+{
+    Range r;
+    if (m_lastSecond == 0)
+        return r;
+
+    if (res == R_SECOND)
+    {
+        unsigned int first = std::max(m_firstSecond, m_lastSecond - (NUM_SECONDS - 1));
+        r.start = first;
+        r.interval = 1;
+        for (unsigned int t = first; t <= m_lastSecond; t++)
+            r.values.push_back(m_seconds[t % NUM_SECONDS]);
+    }else
+    {
+        // 今の分はまだ済んでいない。
+        const unsigned int current = m_lastSecond / 60;
+        unsigned int first = std::max(m_firstSecond / 60, current - std::min<unsigned int>(current, NUM_MINUTES));
+        r.start = first * 60;
+        r.interval = 60;
+        for (unsigned int m = first; m < current; m++)
+            r.values.push_back(m_minutes[m % NUM_MINUTES]);
+    }
+    return r;
+}
+
+// ------------------------------------
+void StatsHistory::sample(unsigned int now)
+{
+    std::vector<std::shared_ptr<Channel>> chs;
+    {
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+        for (auto ch = chanMgr->channel; ch; ch = ch->next)
+            if (ch->isActive())
+                chs.push_back(ch);
+    }
+
+    // 視聴者数などはヒットリストを見るので chanMgr->lock の外で。
+    std::vector<GnuID> ids;
+    for (auto& ch : chs)
+    {
+        auto source = ch->sourceData;
+        recordChannel(ch->info.id, now,
+                      source ? BYTES_TO_KBPS(source->getSourceRate()) : 0,
+                      ch->totalListeners(),
+                      ch->totalRelays(),
+                      ch->numSkips);
+        ids.push_back(ch->info.id);
+    }
+    retain(ids);
+
+    recordNode(now,
+               BYTES_TO_KBPS(stats.getPerSecond(Stats::BYTESIN)),
+               BYTES_TO_KBPS(stats.getPerSecond(Stats::BYTESOUT)));
+}
+
+// ------------------------------------
+void StatsHistory::recordChannel(const GnuID& id, unsigned int now, float bitrate,
+                                 int listeners, int relays, unsigned int skips)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    auto it = m_channels.find(id);
+    if (it == m_channels.end())
+    {
+        if (m_channels.size() >= MAX_CHANNELS)
+            return;
+        it = m_channels.emplace(id, std::unique_ptr<ChannelSeries>(new ChannelSeries())).first;
+        it->second->lastSkips = skips;
+    }
+
+    auto& s = *it->second;
+    s.bitrate.add(now, bitrate);
+    s.listeners.add(now, listeners);
+    s.relays.add(now, relays);
+    s.skips.add(now, skips - s.lastSkips);
+    s.lastSkips = skips;
+}
+
+// ------------------------------------
+void StatsHistory::recordNode(unsigned int now, float bandwidthIn, float bandwidthOut)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    m_node.bandwidthIn.add(now, bandwidthIn);
+    m_node.bandwidthOut.add(now, bandwidthOut);
+}
+
+// ------------------------------------
+void StatsHistory::retain(const std::vector<GnuID>& ids)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    for (auto it = m_channels.begin(); it != m_channels.end(); )
+    {
+        bool found = std::any_of(ids.begin(), ids.end(),
+                                 [&](const GnuID& id) { return id.isSame(it->first); });
+        if (found)
+            ++it;
+        else
+            it = m_channels.erase(it);
+    }
+}
+
+// ------------------------------------
+std::vector<std::pair<std::string, TimeSeries::Range>>
+StatsHistory::query(const GnuID& id, TimeSeries::Resolution res)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    if (!id.isSet())
+    {
+        return {
+            { "bandwidthIn", m_node.bandwidthIn.range(res) },
+            { "bandwidthOut", m_node.bandwidthOut.range(res) },
+        };
+    }
+
+    auto it = m_channels.find(id);
+    if (it == m_channels.end())
+        return {};
+
+    auto& s = *it->second;
+    return {
+        { "bitrate", s.bitrate.range(res) },
+        { "listeners", s.listeners.range(res) },
+        { "relays", s.relays.range(res) },
+        { "skips", s.skips.range(res) },
+    };
+}
+
+// ------------------------------------
+std::vector<GnuID> StatsHistory::channels()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    std::vector<GnuID> ids;
+    for (auto& p : m_channels)
+        ids.push_back(p.first);
+    return ids;
+}
+
+// ------------------------------------
+void StatsHistory::clear()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+
+    m_channels.clear();
+    m_node = NodeSeries();
+}
@@ -0,0 +1,128 @@
+// ------------------------------------------------
+// File : statshist.h
+// Desc:
+//      チャンネルとノードの統計の履歴。一秒ごとの値を 10 分、一分ごと
+//      の平均を 24 時間分、決まった大きさのリングに持つ。housekeeping
+//      から一秒に一度 sample を呼び、JSON-RPC の getStatsHistory で返
+//      す。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _STATSHIST_H
+#define _STATSHIST_H
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gnuid.h"
+
+// ------------------------------------
+// 一つの値の履歴。記録の無かった時刻は NaN で埋める。
+class TimeSeries
+{
+public:
+    enum
+    {
+        NUM_SECONDS = 600,      // 一秒ごとの値を 10 分
+        NUM_MINUTES = 1440,     // 一分ごとの平均を 24 時間
+    };
+
+    enum Resolution
+    {
+        R_SECOND,
+        R_MINUTE,
+    };
+
+    // start から interval 秒おきの値。古い順。R_MINUTE では済んだ分だ
+    // けを返す。
+    struct Range
+    {
+        unsigned int        start = 0;
+        unsigned int        interval = 1;
+        std::vector<float>  values;
+    };
+
+    TimeSeries();
+
+    // time (UNIX 時刻の秒) の値を記録する。同じ秒に二度記録すると後の
+    // ものが勝つ。過去の時刻は無視する。
+    void    add(unsigned int time, float value);
+
+    Range   range(Resolution res) const;
+
+private:
+    void    closeMinute(unsigned int minute);
+
+    std::array<float, NUM_SECONDS>  m_seconds;
+    std::array<float, NUM_MINUTES>  m_minutes;
+    unsigned int    m_firstSecond;  // 最初に記録した秒
+    unsigned int    m_lastSecond;   // 最後に記録した秒。0 なら無し
+    double          m_minuteSum;    // 今の分の合計
+    unsigned int    m_minuteCount;
+};
+
+// ------------------------------------
+class StatsHistory
+{
+public:
+    enum
+    {
+        MAX_CHANNELS = 100,     // 履歴を持つチャンネルの数の上限
+    };
+
+    struct ChannelSeries
+    {
+        TimeSeries      bitrate;    // 受信している kbps
+        TimeSeries      listeners;  // 全体の視聴者数
+        TimeSeries      relays;     // 全体のリレー数
+        TimeSeries      skips;      // 送信でパケットを飛ばした回数 (一秒あたり)
+        unsigned int    lastSkips = 0;
+    };
+
+    struct NodeSeries
+    {
+        TimeSeries      bandwidthIn;    // kbps
+        TimeSeries      bandwidthOut;   // kbps
+    };
+
+    // chanMgr と stats から今の値を読んで記録する。無くなったチャンネル
+    // の履歴は捨てる。
+    void    sample(unsigned int now);
+
+    // 一つのチャンネルの値を記録する。skips は通算の回数。
+    void    recordChannel(const GnuID& id, unsigned int now, float bitrate,
+                          int listeners, int relays, unsigned int skips);
+    void    recordNode(unsigned int now, float bandwidthIn, float bandwidthOut);
+    // ids に無いチャンネルの履歴を捨てる。
+    void    retain(const std::vector<GnuID>& ids);
+
+    // 名前と範囲の組。id が空ならノードの履歴。無ければ空。
+    std::vector<std::pair<std::string, TimeSeries::Range>>
+            query(const GnuID& id, TimeSeries::Resolution res);
+    std::vector<GnuID> channels();
+
+    void    clear();
+
+private:
+    std::mutex  m_lock;
+    std::unordered_map<GnuID, std::unique_ptr<ChannelSeries>, GnuIDHash, GnuIDEqual> m_channels;
+    NodeSeries  m_node;
+};
+
+extern StatsHistory g_statsHistory;
+
+#endif
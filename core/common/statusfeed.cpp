@@ -0,0 +1,169 @@
+// ------------------------------------------------
+// File : statusfeed.cpp
+// Desc:
+//      シーケンスロック。書く側は m_seq を奇数にしてから語を書き、偶数
+//      に戻す。読む側は前後で m_seq が同じ偶数なら写しが揃っている。
+//      語は atomic なので、重なって読んでも未定義動作にはならない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "statusfeed.h"
+#include "chanmgr.h"
+#include "channel.h"
+#include "servmgr.h"
+#include "stats.h"
+
+StatusFeed g_statusFeed;
+
+static_assert(sizeof(StatusBlock) % sizeof(uint64_t) == 0, "StatusBlock must consist of 64-bit words");
+
+// ------------------------------------
+StatusFeed::StatusFeed()
+    : m_seq(0)
+    , m_serial(0)
+{
+    for (auto& w : m_words)
+        w.store(0, std::memory_order_relaxed);
+}
+
+// ------------------------------------
+void StatusFeed::publish(const StatusBlock& block)
+{
+    uint64_t words[NUM_WORDS];
+    memcpy(words, &block, sizeof(words));
+    words[0] = ++m_serial;
+
+    const uint32_t seq = m_seq.load(std::memory_order_relaxed);
+    m_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (int i = 0; i < NUM_WORDS; i++)
+        m_words[i].store(words[i], std::memory_order_relaxed);
+
+    m_seq.store(seq + 2, std::memory_order_release);
+}
+
+// ------------------------------------
+bool StatusFeed::read(StatusBlock& block) const
+{
+    uint64_t words[NUM_WORDS];
+    while (true)
+    {
+        const uint32_t before = m_seq.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+
+        for (int i = 0; i < NUM_WORDS; i++)
+            words[i] = m_words[i].load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_seq.load(std::memory_order_relaxed) == before)
+            break;
+    }
+
+    if (words[0] == 0)
+        return false;
+
+    memcpy(&block, words, sizeof(words));
+    return true;
+}
+
+// ------------------------------------
+void StatusFeed::sample(unsigned int now)
+{
+    StatusBlock b;
+    b.time              = now;
+    b.uptime            = servMgr->getUptime();
+    b.serverPort        = servMgr->serverHost.port;
+    b.firewall          = servMgr->getFirewall(4);
+    b.firewallIPv6      = servMgr->getFirewall(6);
+    b.numDirect         = servMgr->numStreams(Servent::T_DIRECT, true);
+    b.numRelays         = servMgr->numStreams(Servent::T_RELAY, true);
+    b.numCIN            = servMgr->numConnected(Servent::T_CIN);
+    b.numCOUT           = servMgr->numConnected(Servent::T_COUT);
+    b.numIncoming       = servMgr->numActive(Servent::T_INCOMING);
+    b.bytesInPerSec     = stats.getPerSecond(Stats::BYTESIN);
+    b.bytesOutPerSec    = stats.getPerSecond(Stats::BYTESOUT);
+
+    std::vector<std::shared_ptr<Channel>> chs;
+    {
+        std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+        for (auto ch = chanMgr->channel; ch; ch = ch->next)
+            if (ch->isActive())
+                chs.push_back(ch);
+    }
+
+    // 視聴者数などはヒットリストを見るので chanMgr->lock の外で。
+    for (auto& ch : chs)
+    {
+        b.numChannels++;
+        if (ch->isBroadcasting())
+            b.numBroadcasting++;
+        b.totalListeners += std::max(0, ch->totalListeners());
+        b.totalRelays    += std::max(0, ch->totalRelays());
+    }
+
+    publish(b);
+}
+
+// ------------------------------------
+static void putLE(std::string& out, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        out += (char) ((v >> (8 * i)) & 0xff);
+}
+
+// ------------------------------------
+static uint64_t getLE(const std::string& in, size_t pos, int bytes)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++)
+        v |= (uint64_t) (unsigned char) in[pos + i] << (8 * i);
+    return v;
+}
+
+// ------------------------------------
+std::string StatusFeed::serialize(const StatusBlock& block)
+{
+    uint64_t words[NUM_WORDS];
+    memcpy(words, &block, sizeof(words));
+
+    std::string out;
+    out.reserve(SERIALIZED_SIZE);
+    out += "PCST";
+    putLE(out, VERSION, 4);
+    for (auto w : words)
+        putLE(out, w, 8);
+    return out;
+}
+
+// ------------------------------------
+bool StatusFeed::deserialize(const std::string& data, StatusBlock& block)
+{
+    if (data.size() < 8 || data.compare(0, 4, "PCST") != 0)
+        return false;
+    if (getLE(data, 4, 4) != VERSION || data.size() != SERIALIZED_SIZE)
+        return false;
+
+    uint64_t words[NUM_WORDS];
+    for (int i = 0; i < NUM_WORDS; i++)
+        words[i] = getLE(data, 8 + i * 8, 8);
+    memcpy(&block, words, sizeof(words));
+    return true;
+}
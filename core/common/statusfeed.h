@@ -0,0 +1,89 @@
+// ------------------------------------------------
+// File : statusfeed.h
+// Desc:
+//      フロントエンド (GUI やトレイ) が表示する状態の要約。housekeeping
+//      が一秒に一度 ServMgr と ChanMgr から集めて publish し、読む側は
+//      ロックを取らずに read で写しを得る。プロセスの外に渡す時は
+//      serialize で決まった長さのバイト列にする。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _STATUSFEED_H
+#define _STATUSFEED_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+// ------------------------------------
+// 全てのフィールドを uint64_t にして、語単位で写せるようにしてある。
+// 後ろに足すことはあっても、並びは変えない。
+struct StatusBlock
+{
+    uint64_t    serial = 0;         // publish の通し番号。1 から
+    uint64_t    time = 0;           // 集めた時刻 (UNIX 時刻の秒)
+    uint64_t    uptime = 0;         // 秒
+    uint64_t    serverPort = 0;
+    uint64_t    firewall = 0;       // ServMgr::FW_STATE (IPv4)
+    uint64_t    firewallIPv6 = 0;   // ServMgr::FW_STATE (IPv6)
+    uint64_t    numDirect = 0;      // 視聴中の直接接続
+    uint64_t    numRelays = 0;      // 中継中のリレー接続
+    uint64_t    numCIN = 0;
+    uint64_t    numCOUT = 0;
+    uint64_t    numIncoming = 0;
+    uint64_t    numChannels = 0;    // アクティブなチャンネル
+    uint64_t    numBroadcasting = 0;
+    uint64_t    totalListeners = 0; // 全チャンネルの視聴者数の和
+    uint64_t    totalRelays = 0;
+    uint64_t    bytesInPerSec = 0;
+    uint64_t    bytesOutPerSec = 0;
+};
+
+// ------------------------------------
+class StatusFeed
+{
+public:
+    enum
+    {
+        NUM_WORDS = sizeof(StatusBlock) / sizeof(uint64_t),
+        SERIALIZED_SIZE = 8 + NUM_WORDS * 8,    // マジック、版、本体
+        VERSION = 1,
+    };
+
+    StatusFeed();
+
+    // 書くのは一つのスレッドだけ。serial は publish が振る。
+    void    publish(const StatusBlock& block);
+
+    // 最新の写しを block に入れる。まだ一度も publish されていなければ
+    // false。書き込みと重なったら読み直すので、ロックは取らない。
+    bool    read(StatusBlock& block) const;
+
+    // servMgr, chanMgr, stats から集めて publish する。
+    void    sample(unsigned int now);
+
+    // "PCST"、版 (32 ビット)、各フィールド (64 ビット) をリトルエン
+    // ディアンで並べたもの。
+    static std::string serialize(const StatusBlock& block);
+    static bool        deserialize(const std::string& data, StatusBlock& block);
+
+private:
+    // 奇数の間は書き込み中。
+    std::atomic<uint32_t>   m_seq;
+    std::atomic<uint64_t>   m_words[NUM_WORDS];
+    uint64_t                m_serial;
+};
+
+extern StatusFeed g_statusFeed;
+
+#endif
@@ -8,6 +8,10 @@
 
 #include "common.h" // FormatException
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace str
 {
 
@@ -419,6 +423,17 @@ int count(const std::string& haystack, const std::string& needle)
     return n;
 }
 
+bool secure_equals(const std::string& a, const std::string& b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    unsigned char diff = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
 std::string rstrip(const std::string& str)
 {
     std::string res = str;
@@ -517,50 +532,69 @@ std::string indent_tab(const std::string& text, int n)
     return join("", lines);
 }
 
+size_t ascii_span(const char* p, size_t len)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16)
+    {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#else
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        if (word & 0x8080808080808080ULL)
+            break;
+    }
+#endif
+
+    while (i < len && (p[i] & 0x80) == 0)
+        i++;
+    return i;
+}
+
 bool validate_utf8(const std::string& str)
 {
-    auto it = str.begin();
-    while (it != str.end())
+    return validate_utf8(str.data(), str.size());
+}
+
+// ASCII の続くところはまとめて飛ばし、多バイト文字だけを 1 バイトず
+// つ調べる。
+bool validate_utf8(const char* p, size_t len)
+{
+    size_t i = 0;
+    while (i < len)
     {
-        if ((*it & 0x80) == 0) // 0xxx xxxx
-        {
-            it++;
-            continue;
-        }else if ((*it & 0xE0) == 0xC0) // 110x xxxx
+        i += ascii_span(p + i, len - i);
+        if (i == len)
+            break;
+
+        const unsigned char c = p[i];
+        int trail;
+        if ((c & 0xE0) == 0xC0) // 110x xxxx
+            trail = 1;
+        else if ((c & 0xF0) == 0xE0) // 1110 xxxx
+            trail = 2;
+        else if ((c & 0xF8) == 0xF0) // 1111 0xxx
+            trail = 3;
+        else
+            return false;
+
+        i++;
+        for (int j = 0; j < trail; ++j)
         {
-            it++;
-            if (it == str.end())
+            if (i == len)
                 return false;
-            if ((*it & 0xC0) == 0x80)
-                it++;
+            if ((p[i] & 0xC0) == 0x80)
+                i++;
             else
                 return false;
-        }else if ((*it & 0xF0) == 0xE0) // 1110 xxxx
-        {
-            it++;
-            for (int i = 0; i < 2; ++i)
-            {
-                if (it == str.end())
-                    return false;
-                if ((*it & 0xC0) == 0x80)
-                    it++;
-                else
-                    return false;
-            }
-        }else if ((*it & 0xF8) == 0xF0) // 1111 0xxx
-        {
-            it++;
-            for (int i = 0; i < 3; ++i)
-            {
-                if (it == str.end())
-                    return false;
-                if ((*it & 0xC0) == 0x80)
-                    it++;
-                else
-                    return false;
-            }
-        }else
-            return false;
+        }
     }
     return true;
 }
@@ -36,6 +36,9 @@ namespace str
     // Throws std::domain_error if `needle` is an empty string.
     int         count(const std::string& haystack, const std::string& needle);
 
+    // 内容によらず同じ時間で比べる。認証のトークンの比較用。
+    bool        secure_equals(const std::string& a, const std::string& b);
+
     std::string rstrip(const std::string& str);
     std::string strip(const std::string&);
     std::string escapeshellarg_unix(const std::string& str);
@@ -62,6 +65,11 @@ namespace str
     }
 
     bool validate_utf8(const std::string& str);
+    bool validate_utf8(const char* p, size_t len);
+
+    // p から続く ASCII (最上位ビットが 0) のバイトの数。一度に 16 バ
+    // イトずつ調べる。
+    size_t ascii_span(const char* p, size_t len);
     // Truncate the UTF-8 string str to the maximum size of length bytes.
     std::string truncate_utf8(const std::string& str, size_t length);
 
@@ -23,6 +23,9 @@
 // -------------------------------------
 
 #include <stdarg.h>
+#include <string.h>
+#include <memory>
+#include <vector>
 #include "common.h"
 #include "sys.h"
 #include "id.h"
@@ -43,7 +46,25 @@ public:
 
     virtual int readUpto(void *, int) { return 0; }
     virtual int read(void *, int) = 0;
+
+    // 少なくとも 1 バイト、多くて l バイトを読む。ソケットのように届
+    // いている分だけを返せるストリームは上書きする。
+    virtual int readSome(void *p, int l) { return read(p, 1); }
     virtual void write(const void *, int) = 0;
+
+    // writeVector に渡すバッファー。
+    struct IOVec
+    {
+        const void  *data;
+        int         len;
+    };
+
+    // n 個のバッファーを順に書き込む。ソケットはこれをまとめて送る。
+    virtual void writeVector(const IOVec *vec, int n)
+    {
+        for (int i = 0; i < n; i++)
+            write(vec[i].data, vec[i].len);
+    }
     virtual bool eof()
     {
         throw StreamException("Stream can`t eof");
@@ -242,7 +263,7 @@ public:
 
         void update(unsigned int in, unsigned int out)
         {
-            std::lock_guard<std::recursive_mutex> cs(m_lock);
+            std::lock_guard<ProfiledMutex> cs(m_lock);
 
             double now = sys->getDTime();
 
@@ -275,50 +296,50 @@ public:
 
         unsigned int    totalBytesIn()
         {
-            std::lock_guard<std::recursive_mutex> cs(m_lock);
+            std::lock_guard<ProfiledMutex> cs(m_lock);
             update();
             return m_totalBytesIn;
         }
         unsigned int    totalBytesOut()
         {
-            std::lock_guard<std::recursive_mutex> cs(m_lock);
+            std::lock_guard<ProfiledMutex> cs(m_lock);
             update();
             return m_totalBytesOut;
         }
         unsigned int    lastBytesIn()
         {
-            std::lock_guard<std::recursive_mutex> cs(m_lock);
+            std::lock_guard<ProfiledMutex> cs(m_lock);
             update();
             return m_lastBytesIn;
         }
         unsigned int    lastBytesOut()
         {
-            std::lock_guard<std::recursive_mutex> cs(m_lock);
+            std::lock_guard<ProfiledMutex> cs(m_lock);
             update();
             return m_lastBytesOut;
         }
         unsigned int    bytesInPerSec()
         {
-            std::lock_guard<std::recursive_mutex> cs(m_lock);
+            std::lock_guard<ProfiledMutex> cs(m_lock);
             update();
             return m_bytesInPerSec;
         }
         unsigned int    bytesOutPerSec()
         {
-            std::lock_guard<std::recursive_mutex> cs(m_lock);
+            std::lock_guard<ProfiledMutex> cs(m_lock);
             update();
             return m_bytesOutPerSec;
         }
 
         unsigned int    bytesInPerSecAvg()
         {
-            std::lock_guard<std::recursive_mutex> cs(m_lock);
+            std::lock_guard<ProfiledMutex> cs(m_lock);
             update();
             return m_bytesInPerSecAvg;
         }
         unsigned int    bytesOutPerSecAvg()
         {
-            std::lock_guard<std::recursive_mutex> cs(m_lock);
+            std::lock_guard<ProfiledMutex> cs(m_lock);
             update();
             return m_bytesOutPerSecAvg;
         }
@@ -333,7 +354,7 @@ public:
         double          m_lastUpdate;
         double          m_startTime;
 
-        std::recursive_mutex m_lock;
+        ProfiledMutex m_lock { "Stream::Stat::m_lock" };
     };
 
     Stat stat;
@@ -540,7 +561,12 @@ class WriteBufferedStream : public IndirectStream
     static const int kBufSize = 64 * 1024;
 
 public:
-    WriteBufferedStream(Stream *s)
+    // 溜まったデータが threshold バイト以上になったら自動的に flush す
+    // る。
+    WriteBufferedStream(Stream *s, int threshold = kBufSize)
+        : used(0)
+        , pending(0)
+        , threshold(threshold)
     {
         init(s);
     }
@@ -565,11 +591,18 @@ public:
 
     void flush()
     {
-        if (buf.size() > 0)
-        {
-            stream->write(buf.c_str(), buf.size());
-            buf.clear();
-        }
+        if (segs.empty())
+            return;
+
+        if (segs.size() == 1)
+            stream->write(segs[0].data, segs[0].len);
+        else
+            stream->writeVector(segs.data(), segs.size());
+
+        segs.clear();
+        owners.clear();
+        used = 0;
+        pending = 0;
     }
 
     void write(const void *p, int l) override
@@ -578,25 +611,63 @@ public:
         {
             flush();
             stream->write(p, l);
-        } else if (buf.size() + l > kBufSize)
-        {
-            for (int i = 0; i < l; i++)
-                buf.push_back(static_cast<const char*>(p)[i]);
-            flush();
-        } else
-        {
-            for (int i = 0; i < l; i++)
-                buf.push_back(static_cast<const char*>(p)[i]);
+            return;
         }
+
+        if (used + l > kBufSize)
+            flush();
+        if (!buf)
+            buf.reset(new char[kBufSize]);
+
+        char *dest = buf.get() + used;
+        memcpy(dest, p, l);
+        used += l;
+
+        // 直前もバッファー上のデータなら一つにまとめる。
+        if (!segs.empty() && static_cast<const char*>(segs.back().data) + segs.back().len == dest)
+            segs.back().len += l;
+        else
+            segs.push_back({ dest, l });
+
+        append(l);
+    }
+
+    // p からの l バイトをコピーせずに送る。owner は flush まで保持され
+    // るので、その間 p が指すデータを生かしておける。
+    void writeRef(const void *p, int l, std::shared_ptr<const void> owner)
+    {
+        if (l == 0)
+            return;
+
+        segs.push_back({ p, l });
+        owners.push_back(std::move(owner));
+        append(l);
     }
 
+    // まだ送っていないデータ。flush するまで有効。
+    const std::vector<IOVec>& pendingData() const { return segs; }
+    int pendingBytes() const { return pending; }
+
     void close() override
     {
         flush();
         stream->close();
     }
 
-    std::string buf;
+private:
+    void append(int l)
+    {
+        pending += l;
+        if (pending >= threshold)
+            flush();
+    }
+
+    std::unique_ptr<char[]> buf;    // kBufSize バイトの固定長バッファー
+    int         used;
+    std::vector<IOVec> segs;
+    std::vector<std::shared_ptr<const void>> owners;
+    int         pending;
+    const int   threshold;
 };
 #endif
 
@@ -26,6 +26,9 @@
 #include "stream.h"
 #include "socket.h"
 #include "defer.h"
+#include "threadacct.h"
+#include "threadclass.h"
+#include "sampleprof.h"
 #include <chrono>
 #include <sstream>
 
@@ -48,6 +51,22 @@ void Sys::sleep(int ms)
     std::this_thread::sleep_for(std::chrono::milliseconds(ms));
 }
 
+// ------------------------------------------
+double Sys::getMonotonicTime()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// ------------------------------------------
+void Sys::sleepUntil(double deadline)
+{
+    using namespace std::chrono;
+    double remaining = deadline - getMonotonicTime();
+    if (remaining > 0)
+        std::this_thread::sleep_until(steady_clock::now() + duration_cast<steady_clock::duration>(duration<double>(remaining)));
+}
+
 // ------------------------------------------
 void Sys::sleepIdle()
 {
@@ -242,9 +261,12 @@ bool    Sys::startWaitableThread(ThreadInfo *info)
                       {
                           AUX_LOG_FUNC_VECTOR = new std::vector<std::function<void(LogBuffer::TYPE type, const char*)>>();
                           Defer defer([](){ delete AUX_LOG_FUNC_VECTOR; });
+                          std::atomic_store(&info->account, ThreadAccount::attach());
+                          Defer detach([](){ ThreadAccount::detach(); });
                           try
                           {
                               sys->setThreadName("new thread");
+                              ThreadClass::apply(info->threadClass);
                               info->func(info);
                           }catch (GeneralException &e)
                           {
@@ -293,6 +315,13 @@ void Sys::waitThread(ThreadInfo* info)
     }
 }
 
+// ---------------------------------
+void Sys::setThreadName(const char* name)
+{
+    ThreadAccount::setCurrentName(name);
+    SamplingProfiler::setThreadName(name);
+}
+
 // ---------------------------------
 std::string Sys::getThreadIdString()
 {
@@ -20,6 +20,8 @@
 #ifndef _SYS_H
 #define _SYS_H
 
+#include <stdint.h>
+
 #include <string>
 #include <vector>
 #include <memory>
@@ -70,12 +72,21 @@ public:
     virtual ~Sys();
 
     virtual std::shared_ptr<class ClientSocket>  createSocket() = 0;
+    // イベントループ。使えないプラットフォームでは nullptr を返す。
+    // backend は実装の希望 ("io_uring" など)。使えなければ既定のもの
+    // を返す。numWorkers が 0 ならスレッドの数は CPU の数から決める。
+    virtual std::shared_ptr<class Reactor>       createReactor(const std::string& backend = "", int numWorkers = 0) { return nullptr; }
     virtual bool            startThread(class ThreadInfo *);
     virtual bool            startWaitableThread(class ThreadInfo *);
     virtual void            waitThread(ThreadInfo *);
     virtual void            sleep(int);
     virtual unsigned int    getTime();
     virtual double          getDTime() = 0;
+    // 単調増加する時計 (秒)。getDTime と違って時計合わせで飛ばないので、
+    // 期限を決めて待つのに使う。
+    virtual double          getMonotonicTime();
+    // getMonotonicTime() が deadline に達するまで眠る。
+    virtual void            sleepUntil(double deadline);
     virtual unsigned int    rnd() = 0;
     virtual void            getURL(const char *) = 0;
     virtual void            exit() = 0;
@@ -84,10 +95,24 @@ public:
     virtual void            executeFile(const char *) = 0;
     void                    executeFile(const std::string& file) { executeFile(file.c_str()); }
 
-    virtual void            setThreadName(const char* name) {}
+    // 上書きする時は Sys::setThreadName も呼ぶ。
+    virtual void            setThreadName(const char* name);
     virtual std::string     getThreadName() { return ""; }
     std::string             getThreadIdString();
 
+    // 呼び出したスレッドの CPU 時間を、他のスレッドから
+    // getThreadCPUSeconds で読むための値を返す。使えなければ false。
+    virtual bool            getThreadCPUClock(int64_t& clock) { return false; }
+    // 分からなければ負の値を返す。
+    virtual double          getThreadCPUSeconds(int64_t clock) { return -1; }
+
+    // 呼び出したスレッドの優先度を、プロセスの元の優先度からの nice 値
+    // の差にする。0 で元に戻る。出来なければ false。
+    virtual bool            setThreadPriority(int niceDelta) { return false; }
+    // 呼び出したスレッドを cpus の CPU でだけ動かす。空なら元に戻す。出
+    // 来なければ false。
+    virtual bool            setThreadAffinity(const std::vector<int>& cpus) { return false; }
+
     virtual std::string     getHostname() { return "localhost"; }
     virtual std::vector<std::string> getIPAddresses(const std::string& name) { return {}; }
     virtual std::vector<std::string> getAllIPAddresses() { return {}; }
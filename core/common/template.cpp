@@ -19,6 +19,10 @@
 // ------------------------------------------------
 
 #include <cctype>
+#include <mutex>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "template.h"
 
@@ -693,9 +697,9 @@ amf0::Value Template::evalForm(const amf0::Value& exp)
         } else if (name == "!=") {
             return evalExpression(arr.at(1)) != evalExpression(arr.at(2));
         } else if (name == "=~") {
-            return Regexp(evalExpression(arr.at(2)).string()).matches(evalExpression(arr.at(1)).string());
+            return Regexp::cached(evalExpression(arr.at(2)).string())->matches(evalExpression(arr.at(1)).string());
         } else if (name == "!~") {
-            return !Regexp(evalExpression(arr.at(2)).string()).matches(evalExpression(arr.at(1)).string());
+            return !Regexp::cached(evalExpression(arr.at(2)).string())->matches(evalExpression(arr.at(1)).string());
         } else if (name == "!") {
             return !isTruish(evalExpression(arr.at(1)));
         } else if (name == "quote") {
@@ -921,13 +925,76 @@ amf0::Value Template::evalExpression(const amf0::Value& exp)
 }
 
 // --------------------------------------
-amf0::Value Template::evalExpression(const string& str)
+// 構文解析の結果のキャッシュ。テンプレートの式は決まった文字列なので、
+// 一度解析すれば後は使い回せる。
+namespace {
+struct CompiledExpression
+{
+    amf0::Value exp;
+    std::string rest;  // 式の後に残ったトークン
+};
+
+std::mutex s_compileLock;
+std::unordered_map<std::string, CompiledExpression> s_expressions;
+std::unordered_map<std::string, std::vector<std::pair<std::string,amf0::Value>>> s_letSpecs;
+}
+
+// --------------------------------------
+amf0::Value Template::compileExpression(const string& str, std::string* rest)
 {
+    {
+        std::lock_guard<std::mutex> cs(s_compileLock);
+        auto it = s_expressions.find(str);
+        if (it != s_expressions.end())
+        {
+            if (rest)
+                *rest = it->second.rest;
+            return it->second.exp;
+        }
+    }
+
+    std::list<std::string> tokens = tokenize(str);
+    CompiledExpression c;
+    c.exp = parse(tokens);
+    if (tokens.size())
+        c.rest = tokens.front();
+    if (rest)
+        *rest = c.rest;
+
+    std::lock_guard<std::mutex> cs(s_compileLock);
+    if (s_expressions.size() >= MAX_CACHED_EXPRESSIONS)
+        s_expressions.clear();
+    s_expressions[str] = c;
+    return c.exp;
+}
+
+// --------------------------------------
+std::vector<std::pair<std::string,amf0::Value>> Template::compileLetSpec(const string& str)
+{
+    {
+        std::lock_guard<std::mutex> cs(s_compileLock);
+        auto it = s_letSpecs.find(str);
+        if (it != s_letSpecs.end())
+            return it->second;
+    }
+
     std::list<std::string> tokens = tokenize(str);
+    auto letspec = parseLetSpec(tokens);
 
-    auto exp = parse(tokens);
-    if (tokens.size()) {
-        throw GeneralException(str::STR("Unexpected token ", tokens.front()));
+    std::lock_guard<std::mutex> cs(s_compileLock);
+    if (s_letSpecs.size() >= MAX_CACHED_EXPRESSIONS)
+        s_letSpecs.clear();
+    s_letSpecs[str] = letspec;
+    return letspec;
+}
+
+// --------------------------------------
+amf0::Value Template::evalExpression(const string& str)
+{
+    std::string rest;
+    auto exp = compileExpression(str, &rest);
+    if (!rest.empty()) {
+        throw GeneralException(str::STR("Unexpected token ", rest));
     }
     return evalExpression(exp);
 }
@@ -1029,8 +1096,7 @@ void    Template::readForeach(Stream &in, Stream *outp)
     if (!readUntil(in, var, [](char c){ return c == '}'; }))
         return;
 
-    std::list<std::string> tokens = tokenize(var.c_str());
-    amf0::Value value = evalExpression(parse(tokens));
+    amf0::Value value = evalExpression(compileExpression(var));
     if (!value.isStrictArray())
         throw GeneralException(str::STR(var, " is not a strictArray. Value: ", value.inspect()));
 
@@ -1126,8 +1192,7 @@ void    Template::readLet(Stream &in, Stream *outp)
     if (!readUntil(in, var, [](char c){ return c == '}'; }))
         return;
 
-    std::list<std::string> tokens = tokenize(var.c_str());
-    std::vector<std::pair<std::string,amf0::Value>> letspec = parseLetSpec(tokens);
+    std::vector<std::pair<std::string,amf0::Value>> letspec = compileLetSpec(var);
 
     GenericScope newScope;
     prependScope(newScope);
@@ -1285,6 +1350,47 @@ int Template::readTemplate(Stream &in, Stream *outp)
     return TMPL_END;
 }
 
+// --------------------------------------
+namespace {
+struct CachedTemplate
+{
+    time_t mtime;
+    off_t size;
+    std::shared_ptr<const std::string> data;
+};
+
+std::mutex s_templateLock;
+std::map<std::string, CachedTemplate> s_templates;
+}
+
+// --------------------------------------
+std::shared_ptr<const std::string> Template::loadTemplate(const std::string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1)
+        throw StreamException("Unable to open file");
+
+    {
+        std::lock_guard<std::mutex> cs(s_templateLock);
+        auto it = s_templates.find(path);
+        if (it != s_templates.end() &&
+            it->second.mtime == st.st_mtime &&
+            it->second.size == st.st_size)
+            return it->second.data;
+    }
+
+    FileStream file;
+    StringStream mem;
+    file.openReadOnly(path.c_str());
+    file.writeTo(mem, file.length());
+    file.close();
+    auto data = std::make_shared<const std::string>(mem.str());
+
+    std::lock_guard<std::mutex> cs(s_templateLock);
+    s_templates[path] = { st.st_mtime, st.st_size, data };
+    return data;
+}
+
 // --------------------------------------
 bool HTTPRequestScope::writeVariable(amf0::Value& out, const String& varName)
 {
@@ -1376,15 +1482,15 @@ bool GenericScope::writeVariable(amf0::Value& out, const String& varName)
 }
 
 RootObjectScope::RootObjectScope()
-    : m_objects(
+    : m_producers(
         {
-            {"servMgr" , servMgr->getState()},
-            {"chanMgr" , chanMgr->getState()},
-            {"stats"   , stats.getState()},
-            {"notificationBuffer" , g_notificationBuffer.getState()},
-            {"sys"     , sys->getState()},
-            {"app"     , peercastApp->getState()},
-            {"ypList"  , g_ypList->getState()},
+            {"servMgr" , []() { return servMgr->getState(); }},
+            {"chanMgr" , []() { return chanMgr->getState(); }},
+            {"stats"   , []() { return stats.getState(); }},
+            {"notificationBuffer" , []() { return g_notificationBuffer.getState(); }},
+            {"sys"     , []() { return sys->getState(); }},
+            {"app"     , []() { return peercastApp->getState(); }},
+            {"ypList"  , []() { return g_ypList->getState(); }},
         })
 {
 }
@@ -21,6 +21,7 @@
 #define _TEMPLATE_H
 
 #include <list>
+#include <memory>
 #include "stream.h"
 #include "varwriter.h"
 #include <functional>
@@ -50,9 +51,19 @@ public:
         TMPL_LET
     };
 
+    enum
+    {
+        // 構文解析済みの式をこれ以上溜めたら捨てる。
+        MAX_CACHED_EXPRESSIONS = 4096,
+    };
+
     Template(const std::string& args);
     ~Template();
 
+    // テンプレートファイルの内容。更新時刻と大きさが変わっていなけれ
+    // ば前回読んだものを返す。
+    static std::shared_ptr<const std::string> loadTemplate(const std::string& path);
+
     void initVariableWriters();
 
     Template& prependScope(Scope& scope)
@@ -94,10 +105,14 @@ public:
     amf0::Value evalForm(const amf0::Value&);
     amf0::Value evalExpression(const amf0::Value&);
     amf0::Value evalExpression(const std::string&);
-    std::list<std::string> tokenize(const std::string& input);
+    // 式を構文解析する。結果は式の文字列ごとに覚えておく。残ったトー
+    // クンがあれば最初のものを *rest に入れる。
+    static amf0::Value compileExpression(const std::string&, std::string* rest = nullptr);
+    static std::vector<std::pair<std::string,amf0::Value>> compileLetSpec(const std::string&);
+    static std::list<std::string> tokenize(const std::string& input);
     static amf0::Value parse(std::list<std::string>& tokens_);
     static std::vector<std::pair<std::string,amf0::Value>> parseLetSpec(std::list<std::string>& tokens);
-    std::pair<std::string,std::string> readStringLiteral(const std::string& input);
+    static std::pair<std::string,std::string> readStringLiteral(const std::string& input);
     static std::string evalStringLiteral(const std::string& input);
     std::string getStringVariable(const std::string& varName);
     amf0::Value apply(const amf0::Value& lambda, const std::vector<amf0::Value>& arr);
@@ -138,7 +153,7 @@ class RootObjectScope : public Template::Scope
 public:
     RootObjectScope();
 
-    bool writeObjectProperty(amf0::Value& out, const String& varName, amf0::Value& obj)
+    bool writeObjectProperty(amf0::Value& out, const String& varName, const amf0::Value& obj)
     {
         auto names = str::split(varName.str(), ".");
 
@@ -146,8 +161,7 @@ public:
         {
             try
             {
-                auto value = obj.object().at(varName.str());
-                out = value;
+                out = obj.object().at(varName.str());
                 return true;
             }catch (std::out_of_range&)
             {
@@ -156,7 +170,7 @@ public:
         }else{
             try
             {
-                auto value = obj.object().at(names[0]);
+                const auto& value = obj.object().at(names[0]);
                 if (value.isArray())
                 {
                     return false;
@@ -178,24 +192,36 @@ public:
     bool writeVariable(amf0::Value& out, const String& varName) override
     {
         const std::string v = varName;
-        if (m_objects.count(v))
+        auto obj = object(v.substr(0, v.find('.')));
+        if (!obj)
+            return false;
+        if (v.find('.') == std::string::npos)
         {
-            out =  m_objects[v];
+            out = *obj;
             return true;
-        }else{
-            auto idx = v.find('.');
-            if (idx != std::string::npos)
-            {
-                auto qual = v.substr(0, idx);
-                if (m_objects.count(qual))
-                {
-                    auto obj = m_objects[qual];
-                    return writeObjectProperty(out, varName + qual.size() + 1, obj);
-                }
-            }
-            return false;
         }
+        return writeObjectProperty(out, varName + v.find('.') + 1, *obj);
+    }
+
+    // name のオブジェクトを返す。初めて参照された時に getState() を呼
+    // んで作り、このスコープが生きている間 (リクエスト一回分) は使い回
+    // す。ページが使わないオブジェクトは作らない。無い名前なら nullptr。
+    const amf0::Value* object(const std::string& name)
+    {
+        auto it = m_objects.find(name);
+        if (it != m_objects.end())
+            return &it->second;
+
+        auto prod = m_producers.find(name);
+        if (prod == m_producers.end())
+            return nullptr;
+        return &(m_objects[name] = prod->second());
     }
+
+    // 作られたオブジェクトの数。
+    size_t numMaterialized() const { return m_objects.size(); }
+
+    std::map<std::string,std::function<amf0::Value()>> m_producers;
     std::map<std::string,amf0::Value> m_objects;
 };
 
@@ -0,0 +1,252 @@
+// ------------------------------------------------
+// File : threadacct.cpp
+// Desc:
+//      確保の数は各スレッドが自分のカウンターにだけ書くので、不可分
+//      な加算は要らない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <new>
+
+#include "threadacct.h"
+#include "threadclass.h"
+#include "sys.h"
+#include "threading.h"
+
+namespace
+{
+    struct Registry
+    {
+        std::mutex lock;
+        std::vector<std::shared_ptr<ThreadAccount>> accounts;
+    };
+
+    Registry& registry()
+    {
+        static Registry* r = new Registry();
+        return *r;
+    }
+
+    // operator new から触るので、初期化の要らない生のポインタにする。
+    thread_local ThreadAccount* t_account = nullptr;
+    thread_local std::shared_ptr<ThreadAccount>* t_self = nullptr;
+}
+
+// ------------------------------------
+#ifndef NO_ALLOC_ACCOUNTING
+static inline void countAllocation(size_t size)
+{
+    ThreadAccount* a = t_account;
+    if (a)
+    {
+        a->allocations.store(a->allocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        a->allocatedBytes.store(a->allocatedBytes.load(std::memory_order_relaxed) + size, std::memory_order_relaxed);
+    }
+}
+
+static void* allocate(size_t size)
+{
+    countAllocation(size);
+    if (size == 0)
+        size = 1;
+    void* p;
+    while (!(p = malloc(size)))
+    {
+        auto handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+    return p;
+}
+
+static void* allocate(size_t size, const std::nothrow_t&) noexcept
+{
+    try {
+        return allocate(size);
+    } catch (std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void* operator new(size_t size, const std::nothrow_t& nt) noexcept { return allocate(size, nt); }
+void* operator new[](size_t size, const std::nothrow_t& nt) noexcept { return allocate(size, nt); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+#endif
+
+// ------------------------------------
+bool ThreadAccount::allocationCountingAvailable()
+{
+#ifdef NO_ALLOC_ACCOUNTING
+    return false;
+#else
+    return true;
+#endif
+}
+
+// ------------------------------------
+ThreadAccount::ThreadAccount()
+    : allocations(0)
+    , allocatedBytes(0)
+    , m_startTime(0)
+    , m_hasCPUClock(false)
+    , m_cpuClock(0)
+    , m_running(false)
+    , m_class(ThreadClass::T_CONTROL)
+    , m_finalCPUSeconds(-1)
+{
+}
+
+// ------------------------------------
+std::shared_ptr<ThreadAccount> ThreadAccount::attach()
+{
+    if (t_self)
+        return *t_self;
+
+    auto a = std::make_shared<ThreadAccount>();
+    a->m_id = sys->getThreadIdString();
+    a->m_startTime = sys->getTime();
+    a->m_hasCPUClock = sys->getThreadCPUClock(a->m_cpuClock);
+    a->m_running = true;
+
+    {
+        auto& r = registry();
+        std::lock_guard<std::mutex> cs(r.lock);
+        r.accounts.push_back(a);
+    }
+
+    t_self = new std::shared_ptr<ThreadAccount>(a);
+    t_account = a.get();
+    return a;
+}
+
+// ------------------------------------
+void ThreadAccount::detach()
+{
+    if (!t_self)
+        return;
+
+    t_account = nullptr;
+    std::shared_ptr<ThreadAccount> a = *t_self;
+    delete t_self;
+    t_self = nullptr;
+
+    // 終わった後のスレッドの CPU 時刻は読めないので、ここで覚える。
+    a->m_finalCPUSeconds = a->cpuSeconds();
+    a->m_running = false;
+
+    auto& r = registry();
+    std::lock_guard<std::mutex> cs(r.lock);
+    r.accounts.erase(std::remove(r.accounts.begin(), r.accounts.end(), a), r.accounts.end());
+}
+
+// ------------------------------------
+std::shared_ptr<ThreadAccount> ThreadAccount::current()
+{
+    return t_self ? *t_self : nullptr;
+}
+
+// ------------------------------------
+void ThreadAccount::setCurrentName(const char* name)
+{
+    ThreadAccount* a = t_account;
+    if (!a)
+        return;
+    std::lock_guard<std::mutex> cs(a->m_lock);
+    a->m_name = name;
+}
+
+// ------------------------------------
+void ThreadAccount::setCurrentClass(int threadClass)
+{
+    ThreadAccount* a = t_account;
+    if (a)
+        a->m_class = threadClass;
+}
+
+// ------------------------------------
+double ThreadAccount::cpuSeconds()
+{
+    if (!m_running)
+        return m_finalCPUSeconds;
+    if (!m_hasCPUClock)
+        return -1;
+    return sys->getThreadCPUSeconds(m_cpuClock);
+}
+
+// ------------------------------------
+ThreadAccount::Snapshot ThreadAccount::snapshot()
+{
+    Snapshot s;
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        s.name = m_name;
+    }
+    s.id             = m_id;
+    s.threadClass    = ThreadClass::name((ThreadClass::TYPE) m_class.load());
+    s.running        = m_running;
+    s.cpuSeconds     = cpuSeconds();
+    s.allocations    = allocations.load(std::memory_order_relaxed);
+    s.allocatedBytes = allocatedBytes.load(std::memory_order_relaxed);
+    s.startTime      = m_startTime;
+    return s;
+}
+
+// ------------------------------------
+std::vector<ThreadAccount::Snapshot> ThreadAccount::all()
+{
+    std::vector<std::shared_ptr<ThreadAccount>> accounts;
+    {
+        auto& r = registry();
+        std::lock_guard<std::mutex> cs(r.lock);
+        accounts = r.accounts;
+    }
+
+    std::vector<Snapshot> res;
+    for (auto& a : accounts)
+        res.push_back(a->snapshot());
+    std::sort(res.begin(), res.end(),
+              [](const Snapshot& a, const Snapshot& b) { return a.cpuSeconds > b.cpuSeconds; });
+    return res;
+}
+
+// ------------------------------------
+amf0::Value ThreadAccount::getState()
+{
+    auto s = snapshot();
+    return amf0::Value::object(
+        {
+            {"name", s.name},
+            {"id", s.id},
+            {"class", s.threadClass},
+            {"running", s.running},
+            {"cpuSeconds", s.cpuSeconds},
+            {"allocations", (double) s.allocations},
+            {"allocatedBytes", (double) s.allocatedBytes},
+        });
+}
+
+// ------------------------------------
+amf0::Value ThreadAccount::stateOf(ThreadInfo& info)
+{
+    auto a = std::atomic_load(&info.account);
+    return a ? a->getState() : amf0::Value(nullptr);
+}
@@ -0,0 +1,94 @@
+// ------------------------------------------------
+// File : threadacct.h
+// Desc:
+//      スレッドごとの CPU 時間と operator new で確保したメモリの量。
+//      sys->startThread で起動したスレッドは自動的に登録される。CPU
+//      時間は Sys::getThreadCPUClock が使えるプラットフォームでだけ分
+//      かる。
+//
+//      NO_ALLOC_ACCOUNTING を定義してビルドすると operator new を置き
+//      換えず、確保の量は数えない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _THREADACCT_H
+#define _THREADACCT_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "amf0.h"
+
+// ------------------------------------
+class ThreadAccount
+{
+public:
+    struct Snapshot
+    {
+        std::string     name;
+        std::string     id;
+        std::string     threadClass;    // ThreadClass::name
+        double          cpuSeconds;     // 分からなければ負
+        uint64_t        allocations;
+        uint64_t        allocatedBytes;
+        unsigned int    startTime;
+        bool            running;
+    };
+
+    ThreadAccount();
+
+    // 呼び出したスレッドを登録する。スレッドの終わりに detach を呼ぶ。
+    static std::shared_ptr<ThreadAccount> attach();
+    static void detach();
+
+    // 呼び出したスレッドのもの。登録されていなければ nullptr。
+    static std::shared_ptr<ThreadAccount> current();
+    static void setCurrentName(const char* name);
+    // ThreadClass::apply から呼ぶ。
+    static void setCurrentClass(int threadClass);
+
+    // 動いているスレッド全部。CPU 時間の長い順。
+    static std::vector<Snapshot> all();
+
+    static bool allocationCountingAvailable();
+
+    Snapshot    snapshot();
+    amf0::Value getState();
+
+    // info->func を実行しているスレッドの getState。まだ無ければ null。
+    static amf0::Value stateOf(class ThreadInfo& info);
+
+    // 以下は登録したスレッドだけが書く。
+    std::atomic<uint64_t>   allocations;
+    std::atomic<uint64_t>   allocatedBytes;
+
+private:
+    double      cpuSeconds();
+
+    std::mutex              m_lock;
+    std::string             m_name;
+    std::string             m_id;
+    unsigned int            m_startTime;
+    bool                    m_hasCPUClock;
+    int64_t                 m_cpuClock;
+    std::atomic<bool>       m_running;
+    std::atomic<int>        m_class;
+    double                  m_finalCPUSeconds;  // 終了した時の CPU 時間
+};
+
+#endif
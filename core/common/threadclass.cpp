@@ -0,0 +1,191 @@
+// ------------------------------------------------
+// File : threadclass.cpp
+// Desc:
+//      スレッドの種類と、種類ごとの OS の優先度と CPU。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#include "threadclass.h"
+#include "threadacct.h"
+#include "str.h"
+#include "sys.h"
+
+namespace
+{
+    const int MAX_CPU = 1024;
+
+    std::mutex s_lock;
+    ThreadClass::Setting s_settings[ThreadClass::NUM_TYPES];
+    // 出来なかった時の警告は種類ごとに一度だけ。
+    std::atomic<bool> s_warned[ThreadClass::NUM_TYPES];
+
+    // このスレッドに当てたもの。OS に頼んだ値と同じに保つ。
+    thread_local ThreadClass::TYPE t_class = ThreadClass::T_CONTROL;
+    thread_local int t_priority = 0;
+    thread_local std::string t_affinity;
+
+    bool parseInt(const std::string& s, int& out)
+    {
+        if (s.empty() || s.size() > 4 || !std::all_of(s.begin(), s.end(), ::isdigit))
+            return false;
+        out = atoi(s.c_str());
+        return true;
+    }
+}
+
+// ------------------------------------
+const char* ThreadClass::name(TYPE t)
+{
+    switch (t)
+    {
+    case T_INGEST:      return "ingest";
+    case T_DATA:        return "data";
+    case T_CONTROL:     return "control";
+    case T_BACKGROUND:  return "background";
+    default:            return "unknown";
+    }
+}
+
+// ------------------------------------
+bool ThreadClass::fromName(const std::string& n, TYPE& t)
+{
+    for (int i = 0; i < NUM_TYPES; i++)
+    {
+        if (n == name((TYPE) i))
+        {
+            t = (TYPE) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ------------------------------------
+bool ThreadClass::parseCPUList(const std::string& spec, std::vector<int>& cpus)
+{
+    std::vector<int> res;
+    if (!spec.empty())
+    {
+        for (auto& item : str::split(spec, ","))
+        {
+            auto range = str::split(item, "-", 2);
+            int first, last;
+            if (!parseInt(range[0], first))
+                return false;
+            if (range.size() == 1)
+                last = first;
+            else if (!parseInt(range[1], last) || last < first)
+                return false;
+            if (last >= MAX_CPU)
+                return false;
+            for (int c = first; c <= last; c++)
+                res.push_back(c);
+        }
+        std::sort(res.begin(), res.end());
+        res.erase(std::unique(res.begin(), res.end()), res.end());
+    }
+    cpus = res;
+    return true;
+}
+
+// ------------------------------------
+ThreadClass::Setting ThreadClass::setting(TYPE t)
+{
+    std::lock_guard<std::mutex> cs(s_lock);
+    return s_settings[t];
+}
+
+// ------------------------------------
+bool ThreadClass::setSetting(TYPE t, const Setting& s)
+{
+    std::vector<int> cpus;
+    if (!parseCPUList(s.affinity, cpus))
+        return false;
+
+    std::lock_guard<std::mutex> cs(s_lock);
+    s_settings[t].priority = std::max(-20, std::min(s.priority, 19));
+    s_settings[t].affinity = s.affinity;
+    s_warned[t] = false;
+    return true;
+}
+
+// ------------------------------------
+std::string ThreadClass::priorityKey(TYPE t)
+{
+    return std::string(name(t)) + "ThreadPriority";
+}
+
+// ------------------------------------
+std::string ThreadClass::affinityKey(TYPE t)
+{
+    return std::string(name(t)) + "ThreadAffinity";
+}
+
+// ------------------------------------
+bool ThreadClass::readSetting(const std::string& key, const std::string& value)
+{
+    for (int i = 0; i < NUM_TYPES; i++)
+    {
+        auto t = (TYPE) i;
+        auto s = setting(t);
+        if (key == priorityKey(t))
+            s.priority = atoi(value.c_str());
+        else if (key == affinityKey(t))
+            s.affinity = value;
+        else
+            continue;
+
+        if (!setSetting(t, s))
+            LOG_ERROR("Invalid CPU list for %s: %s", key.c_str(), value.c_str());
+        return true;
+    }
+    return false;
+}
+
+// ------------------------------------
+void ThreadClass::apply(TYPE t)
+{
+    auto s = setting(t);
+    t_class = t;
+    ThreadAccount::setCurrentClass(t);
+
+    bool ok = true;
+    if (s.priority != t_priority)
+    {
+        ok = sys->setThreadPriority(s.priority) && ok;
+        t_priority = s.priority;
+    }
+    if (s.affinity != t_affinity)
+    {
+        std::vector<int> cpus;
+        parseCPUList(s.affinity, cpus);
+        ok = sys->setThreadAffinity(cpus) && ok;
+        t_affinity = s.affinity;
+    }
+
+    if (!ok && !s_warned[t].exchange(true))
+        LOG_WARN("Cannot set priority %d, CPUs \"%s\" for %s threads",
+                 s.priority, s.affinity.c_str(), name(t));
+}
+
+// ------------------------------------
+ThreadClass::TYPE ThreadClass::current()
+{
+    return t_class;
+}
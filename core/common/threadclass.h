@@ -0,0 +1,80 @@
+// ------------------------------------------------
+// File : threadclass.h
+// Desc:
+//      スレッドの種類と、種類ごとの OS の優先度と CPU。受信 (ingest)、
+//      配信 (data)、管理 (control)、裏方 (background) に分け、ini の
+//      "ingestThreadPriority" や "dataThreadAffinity" で決める。
+//
+//      種類は ThreadInfo::threadClass に入れておけばスレッドの始まり
+//      に apply される。途中で役目が変わるスレッド (プールのワーカーや
+//      ストリームを流し始めたサーヴァント) は自分で apply を呼ぶ。優先度
+//      と CPU は Sys::setThreadPriority と Sys::setThreadAffinity で変
+//      えるので、使えないプラットフォームでは種類を記録するだけになる。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _THREADCLASS_H
+#define _THREADCLASS_H
+
+#include <string>
+#include <vector>
+
+// ------------------------------------
+class ThreadClass
+{
+public:
+    enum TYPE
+    {
+        T_INGEST,       // チャンネルの受信
+        T_DATA,         // リレーとダイレクトへの配信
+        T_CONTROL,      // 管理画面、API、PCP の制御の接続など
+        T_BACKGROUND,   // タイマーや起動時の処理
+        NUM_TYPES
+    };
+
+    struct Setting
+    {
+        Setting() : priority(0) {}
+
+        // プロセスの元の優先度からの nice 値の差。負で高く、正で低くな
+        // る。上げるには大抵は権限が要る。
+        int         priority;
+        // "0-3,6" のような CPU 番号の並び。空なら制限しない。
+        std::string affinity;
+    };
+
+    static const char*  name(TYPE t);
+    static bool         fromName(const std::string& name, TYPE& t);
+
+    // "0-3,6" を {0, 1, 2, 3, 6} にする。空なら空。書式が違えば false。
+    static bool         parseCPUList(const std::string& spec, std::vector<int>& cpus);
+
+    static Setting      setting(TYPE t);
+    // 優先度は -20 から 19 に収める。affinity が読めなければ false で、
+    // 何も変えない。新しく apply されるスレッドから効く。
+    static bool         setSetting(TYPE t, const Setting& s);
+
+    // ini の名前。
+    static std::string  priorityKey(TYPE t);
+    static std::string  affinityKey(TYPE t);
+    // key が priorityKey か affinityKey のどれかならその値を設定する。
+    static bool         readSetting(const std::string& key, const std::string& value);
+
+    // 呼び出したスレッドを t の種類にして、設定の優先度と CPU にする。
+    // 前に当てたものと同じなら OS には頼まない。
+    static void         apply(TYPE t);
+    // 呼び出したスレッドの種類。apply されていなければ T_CONTROL。
+    static TYPE         current();
+};
+
+#endif
@@ -25,6 +25,9 @@
 #include <thread>
 #include <memory>
 
+#include "lockprof.h"
+#include "threadclass.h"
+
 // ------------------------------------
 class ThreadInfo;
 typedef int (*THREAD_FUNC)(ThreadInfo *);
@@ -37,6 +40,7 @@ public:
     ThreadInfo()
         : m_active(false)
         , channel(nullptr)
+        , threadClass(ThreadClass::T_CONTROL)
     {
         func         = nullptr;
         data         = nullptr;
@@ -52,6 +56,10 @@ public:
     THREAD_FUNC     func;
     void            *data;
     std::shared_ptr<class Channel> channel;
+    // func を実行しているスレッドの ThreadAccount。std::atomic_load で読む。
+    std::shared_ptr<class ThreadAccount> account;
+    // スレッドの始まりに ThreadClass::apply する。
+    ThreadClass::TYPE threadClass;
 
     THREAD_HANDLE   handle;
 };
@@ -0,0 +1,259 @@
+// ------------------------------------------------
+// File : threadpool.cpp
+// Desc:
+//      ワーカーの数と待っているタスクの数は State::lock の下で数える。
+//      タスクをキューに入れる時に空いているワーカーが足りなければ、上
+//      限まで新しいワーカーを起動する。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "threadpool.h"
+#include "waitablequeue.h"
+#include "sys.h"
+#include "threadacct.h"
+
+// ------------------------------------
+struct ThreadPool::State
+{
+    State(int max)
+        : maxWorkers(max)
+        , workers(0)
+        , idle(0)
+        , queued(0)
+        , promoted(0)
+        , completed(0)
+    {
+    }
+
+    WaitableQueue<ThreadInfo*> queue;   // nullptr はワーカーへの終了要求
+
+    std::mutex      lock;
+    const int       maxWorkers;
+    int             workers;    // 昇格していないワーカーの数
+    int             idle;       // キューを待っているワーカーの数
+    int             queued;     // キューにあってまだ取り出されていないタスクの数
+    unsigned int    promoted;
+    unsigned int    completed;
+};
+
+// ------------------------------------
+struct Worker
+{
+    std::shared_ptr<ThreadPool::State> state;
+    ThreadInfo thread;
+};
+
+// このスレッドが属しているプールと、昇格したかどうか。
+static thread_local Worker* t_worker = nullptr;
+static thread_local bool t_promoted = false;
+
+static bool startWorker(const std::shared_ptr<ThreadPool::State>& state);
+
+// ------------------------------------
+static THREAD_PROC workerProc(ThreadInfo *thread)
+{
+    std::unique_ptr<Worker> w(static_cast<Worker*>(thread->data));
+    auto& st = *w->state;
+
+    t_worker = w.get();
+    sys->setThreadName("POOL");
+
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> cs(st.lock);
+            st.idle++;
+        }
+
+        ThreadInfo *task = nullptr;
+        bool got = st.queue.dequeue(task, ThreadPool::IDLE_TIMEOUT);
+        {
+            std::lock_guard<std::mutex> cs(st.lock);
+            st.idle--;
+            if (got)
+                st.queued--;
+            else if (st.queued == 0)
+            {
+                // 暇なのでやめる。
+                st.workers--;
+                break;
+            }
+        }
+
+        if (!got)
+            continue;
+        if (!task)
+            break;
+
+        t_promoted = false;
+        std::atomic_store(&task->account, ThreadAccount::current());
+        ThreadClass::apply(task->threadClass);
+        try
+        {
+            task->func(task);
+        }catch (GeneralException &e)
+        {
+            LOG_ERROR("Unexpected exception: %s", e.what());
+        }catch (std::exception &e)
+        {
+            LOG_ERROR("Unexpected exception: %s", e.what());
+        }
+
+        {
+            std::lock_guard<std::mutex> cs(st.lock);
+            st.completed++;
+        }
+        // 昇格したスレッドはもうプールに数えられていない。
+        if (t_promoted)
+            break;
+        sys->setThreadName("POOL");
+        ThreadClass::apply(thread->threadClass);
+    }
+
+    t_worker = nullptr;
+    return 0;
+}
+
+// ------------------------------------
+ThreadPool::ThreadPool(int maxWorkers)
+    : m_state(std::make_shared<State>(maxWorkers))
+{
+}
+
+// ------------------------------------
+ThreadPool::~ThreadPool()
+{
+    // ワーカーは State を共有しているので待たずに終了を頼むだけでよい。
+    int n;
+    {
+        std::lock_guard<std::mutex> cs(m_state->lock);
+        n = m_state->workers;
+        m_state->queued += n;
+    }
+    for (int i = 0; i < n; i++)
+        m_state->queue.enqueue(nullptr);
+}
+
+// ------------------------------------
+static bool startWorker(const std::shared_ptr<ThreadPool::State>& state)
+{
+    auto w = new Worker();
+    w->state = state;
+    w->thread.func = workerProc;
+    w->thread.data = w;
+    if (!sys->startThread(&w->thread))
+    {
+        delete w;
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------
+bool ThreadPool::submit(ThreadInfo *info)
+{
+    auto& st = *m_state;
+
+    bool spawn;
+    {
+        std::lock_guard<std::mutex> cs(st.lock);
+        st.queued++;
+        spawn = (st.queued > st.idle) && (st.workers < st.maxWorkers);
+        if (spawn)
+            st.workers++;
+    }
+
+    if (spawn && !startWorker(m_state))
+    {
+        std::lock_guard<std::mutex> cs(st.lock);
+        st.workers--;
+        if (st.workers == 0)
+        {
+            st.queued--;
+            return false;
+        }
+    }
+
+    info->m_active.store(true);
+    st.queue.enqueue(info);
+    return true;
+}
+
+// ------------------------------------
+void ThreadPool::promote()
+{
+    if (!t_worker || t_promoted)
+        return;
+
+    auto& st = *t_worker->state;
+    bool spawn;
+    {
+        std::lock_guard<std::mutex> cs(st.lock);
+        st.workers--;
+        st.promoted++;
+        t_promoted = true;
+
+        // 待っているタスクがあれば抜けた分のワーカーを補う。
+        spawn = (st.queued > st.idle);
+        if (spawn)
+            st.workers++;
+    }
+
+    if (spawn && !startWorker(t_worker->state))
+    {
+        std::lock_guard<std::mutex> cs(st.lock);
+        st.workers--;
+    }
+}
+
+// ------------------------------------
+int ThreadPool::maxWorkers()
+{
+    return m_state->maxWorkers;
+}
+
+// ------------------------------------
+int ThreadPool::numWorkers()
+{
+    std::lock_guard<std::mutex> cs(m_state->lock);
+    return m_state->workers;
+}
+
+// ------------------------------------
+int ThreadPool::numIdle()
+{
+    std::lock_guard<std::mutex> cs(m_state->lock);
+    return m_state->idle;
+}
+
+// ------------------------------------
+int ThreadPool::numQueued()
+{
+    std::lock_guard<std::mutex> cs(m_state->lock);
+    return m_state->queued;
+}
+
+// ------------------------------------
+amf0::Value ThreadPool::getState()
+{
+    std::lock_guard<std::mutex> cs(m_state->lock);
+    return amf0::Value::object(
+        {
+            {"maxWorkers", m_state->maxWorkers},
+            {"numWorkers", m_state->workers},
+            {"numIdle", m_state->idle},
+            {"numQueued", m_state->queued},
+            {"numPromoted", m_state->promoted},
+            {"numCompleted", m_state->completed},
+        });
+}
@@ -0,0 +1,65 @@
+// ------------------------------------------------
+// File : threadpool.h
+// Desc:
+//      短時間で終わる接続の処理を使い回しのワーカースレッドで実行する
+//      スレッドプール。長く続く処理は promote() で専用スレッドに昇格さ
+//      せ、プールの枠を空ける。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+#include <memory>
+
+#include "threading.h"
+#include "amf0.h"
+
+// ------------------------------------
+class ThreadPool
+{
+public:
+    enum
+    {
+        // この時間 (ミリ秒) 仕事が無かったワーカーは終了する。
+        IDLE_TIMEOUT = 60 * 1000,
+    };
+
+    ThreadPool(int maxWorkers);
+    ~ThreadPool();
+
+    // info->func(info) をワーカーで実行する。sys->startThread と同じ
+    // く info->m_active は true になる。空いているワーカーが無く、上
+    // 限に達していればキューで待つ。ワーカーを一つも起動できなければ
+    // false を返す。
+    bool    submit(ThreadInfo *info);
+
+    // 実行中のタスクがこの後長く続くことを知らせる。呼び出したスレッ
+    // ドはプールから外れ、タスクが終わると終了する。プールのワーカー
+    // 以外から呼んだ場合は何もしない。
+    static void promote();
+
+    int     maxWorkers();
+    int     numWorkers();
+    int     numIdle();
+    int     numQueued();
+
+    amf0::Value getState();
+
+    struct State;
+
+private:
+    std::shared_ptr<State> m_state;
+};
+
+#endif
@@ -0,0 +1,215 @@
+// ------------------------------------------------
+// File : thumbnail.cpp
+// Desc:
+//      チャンネルのプレビュー。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <stdlib.h>
+
+#include "thumbnail.h"
+#include "channel.h"
+#include "flv.h"
+#include "http.h"
+#include "subprog.h"
+#include "str.h"
+#include "sys.h"
+
+// ------------------------------------
+ThumbnailCache::ThumbnailCache()
+    : m_converting(false)
+    , m_numConversions(0)
+    , m_converter(extractJPEG)
+{
+}
+
+// ------------------------------------
+ThumbnailCache::~ThumbnailCache()
+{
+    if (m_job.joinable())
+        m_job.join();
+}
+
+// ------------------------------------
+void ThumbnailCache::setConverter(Converter converter)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_converter = converter;
+}
+
+// ------------------------------------
+unsigned int ThumbnailCache::numConversions()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_numConversions;
+}
+
+// ------------------------------------
+std::shared_ptr<const ThumbnailCache::Image> ThumbnailCache::keyFrame(std::shared_ptr<Channel> ch)
+{
+    if (ch->info.contentType != ChanInfo::T_FLV)
+        return nullptr;
+
+    // 最新のキーフレームの続きがまだ届いていなければ、一つ前のものを使う。
+    for (unsigned int n = 0; n <= 1; n++)
+    {
+        unsigned int pos = ch->rawData.getNonContinuationPos(n);
+        if (!pos)
+            break;
+
+        std::string key = str::format("%u-%u", ch->streamIndex, pos);
+        {
+            std::lock_guard<std::mutex> cs(m_lock);
+            if (m_keyFrame && m_keyFrame->key == key)
+                return m_keyFrame;
+        }
+
+        auto image = assemble(ch, pos);
+        if (image)
+        {
+            std::lock_guard<std::mutex> cs(m_lock);
+            m_keyFrame = image;
+            return image;
+        }
+    }
+    return nullptr;
+}
+
+// ------------------------------------
+// pos から始まるキーフレームのタグを、続きのパケットから集めてヘッダー
+// パケットの後ろに付ける。
+std::shared_ptr<const ThumbnailCache::Image> ThumbnailCache::assemble(std::shared_ptr<Channel> ch, unsigned int pos)
+{
+    std::shared_ptr<const ChanPacketSlab> pack;
+    if (!ch->rawData.findPacket(pos, pack) || pack->pos != pos || pack->cont || pack->len < 11)
+        return nullptr;
+
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(pack->data);
+    size_t size = (p[1] << 16) | (p[2] << 8) | p[3];
+    size_t need = 11 + size + 4;
+    if ((p[0] & 0x1f) != FLVTag::T_VIDEO || need > MAX_KEYFRAME)
+        return nullptr;
+
+    std::string tag(pack->data, pack->len);
+    unsigned int next = pack->pos + pack->len;
+    while (tag.size() < need)
+    {
+        if (!ch->rawData.findPacket(next, pack) || pack->pos != next || !pack->cont)
+            return nullptr;
+        tag.append(pack->data, pack->len);
+        next = pack->pos + pack->len;
+    }
+    tag.resize(need);
+
+    if (!FLVTag::isVideoKeyFrame(reinterpret_cast<const unsigned char*>(tag.data()) + 11, (int) size))
+        return nullptr;
+
+    auto image = std::make_shared<Image>();
+    image->key = str::format("%u-%u", ch->streamIndex, pos);
+    image->mimeType = MIME_FLV;
+    image->data = std::make_shared<const std::string>(std::string(ch->headPack.data, ch->headPack.len) + tag);
+    return image;
+}
+
+// ------------------------------------
+std::shared_ptr<const ThumbnailCache::Image> ThumbnailCache::jpeg(std::shared_ptr<Channel> ch, int waitMsec)
+{
+    auto key = keyFrame(ch);
+
+    std::unique_lock<std::mutex> lk(m_lock);
+    if (!key || (m_jpeg && m_jpeg->key == key->key))
+        return m_jpeg;
+
+    // 同じキーフレームで失敗したものはやり直さない。
+    if (!m_converting && m_lastAttempt != key->key)
+    {
+        if (m_job.joinable())
+            m_job.join();
+        m_converting = true;
+        m_lastAttempt = key->key;
+        m_job = std::thread([this, key]() { convert(key); });
+    }
+
+    m_cond.wait_for(lk, std::chrono::milliseconds(waitMsec), [this]() { return !m_converting; });
+    return m_jpeg;
+}
+
+// ------------------------------------
+void ThumbnailCache::convert(std::shared_ptr<const Image> key)
+{
+    sys->setThreadName("THUMBNAIL");
+
+    Converter converter;
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        converter = m_converter;
+    }
+
+    std::string out;
+    bool ok = converter(*key->data, out);
+    if (!ok)
+        LOG_ERROR("Thumbnail: cannot convert key frame %s", key->key.c_str());
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    if (ok && !out.empty())
+    {
+        auto image = std::make_shared<Image>();
+        image->key = key->key;
+        image->mimeType = "image/jpeg";
+        image->data = std::make_shared<const std::string>(std::move(out));
+        m_jpeg = image;
+        m_numConversions++;
+    }
+    m_converting = false;
+    m_cond.notify_all();
+}
+
+// ------------------------------------
+bool ThumbnailCache::extractJPEG(const std::string& flv, std::string& jpeg)
+{
+    Environment env;
+    if (getenv("PATH"))
+        env.set("PATH", getenv("PATH"));
+    if (getenv("SYSTEMROOT"))
+        env.set("SYSTEMROOT", getenv("SYSTEMROOT"));
+
+    Subprogram ffmpeg("ffmpeg");
+    if (!ffmpeg.start({ "-v", "quiet", "-timelimit", "10",
+                        "-f", "flv", "-i", "pipe:0",
+                        "-frames:v", "1", "-f", "image2", "-c:v", "mjpeg", "pipe:1" }, env))
+        return false;
+
+    // 出力のパイプが詰まらないように、入力は別のスレッドで書く。
+    auto in = ffmpeg.outputStream();
+    std::thread feeder([&]()
+                       {
+                           try
+                           {
+                               in->write(flv.data(), (int) flv.size());
+                           }catch (StreamException&) {}
+                           in->close();
+                       });
+
+    auto out = ffmpeg.inputStream();
+    char buf[8192];
+    try
+    {
+        while (!out->eof())
+            jpeg.append(buf, out->read(buf, sizeof(buf)));
+    }catch (StreamException&) {}
+    out->close();
+    feeder.join();
+
+    int status;
+    return ffmpeg.wait(&status) && status == 0 && !jpeg.empty();
+}
@@ -0,0 +1,89 @@
+// ------------------------------------------------
+// File : thumbnail.h
+// Desc:
+//      チャンネルのプレビュー (/thumb/<ID>.flv と /thumb/<ID>.jpg)。
+//      FLV チャンネルの最新のキーフレームをヘッダーパケットに続けた短
+//      い FLV にして、キーフレームが変わるまで使い回す。JPEG は
+//      jpegThumbnails フラグが立っている時だけ、裏のスレッドで ffmpeg
+//      に作らせる。
+//
+//      ストリームの接続ではないので、視聴者やリレーの数には数えない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _THUMBNAIL_H
+#define _THUMBNAIL_H
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class Channel;
+
+// ------------------------------------
+class ThumbnailCache
+{
+public:
+    enum
+    {
+        MAX_KEYFRAME    = 4 * 1024 * 1024,  // これより大きいキーフレームは扱わない
+        JPEG_WAIT       = 5000,             // JPEG が出来るのを要求が待つミリ秒
+    };
+
+    struct Image
+    {
+        std::string key;        // 元のキーフレーム (ストリームの番号とポジション)
+        std::string mimeType;
+        std::shared_ptr<const std::string> data;
+    };
+
+    // キーフレームの FLV から JPEG を作る。出来なければ false。
+    typedef std::function<bool(const std::string& flv, std::string& jpeg)> Converter;
+
+    ThumbnailCache();
+    ~ThumbnailCache();
+
+    // ch の最新の、全部届いているキーフレーム。無ければ nullptr。
+    std::shared_ptr<const Image> keyFrame(std::shared_ptr<Channel> ch);
+
+    // 最新のキーフレームの JPEG。まだなら裏で作り始めて waitMsec まで
+    // 待つ。間に合わなければ前のキーフレームのものを返す。
+    std::shared_ptr<const Image> jpeg(std::shared_ptr<Channel> ch, int waitMsec = JPEG_WAIT);
+
+    // 変換を差し替える (テスト用)。
+    void    setConverter(Converter converter);
+
+    // ffmpeg で最初の映像フレームを JPEG にする。
+    static bool extractJPEG(const std::string& flv, std::string& jpeg);
+
+    unsigned int numConversions();
+
+private:
+    std::shared_ptr<const Image> assemble(std::shared_ptr<Channel> ch, unsigned int pos);
+    void    convert(std::shared_ptr<const Image> key);
+
+    std::mutex          m_lock;
+    std::condition_variable m_cond;
+    std::shared_ptr<const Image> m_keyFrame;
+    std::shared_ptr<const Image> m_jpeg;
+    std::string         m_lastAttempt;      // 最後に変換を試したキーフレームの etag
+    bool                m_converting;
+    unsigned int        m_numConversions;
+    Converter           m_converter;
+    std::thread         m_job;
+};
+
+#endif
@@ -0,0 +1,260 @@
+// ------------------------------------------------
+// File : timerwheel.cpp
+// Desc:
+//      時計のスレッドは目盛りごとに針を一つ進め、その目盛りで期限の来
+//      た仕事をワーカーのキューに移すだけ。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "timerwheel.h"
+#include "sys.h"
+#include "str.h"
+
+// ------------------------------------
+TimerWheel::TimerWheel(const char *name, int numBlockingWorkers)
+    : m_name(name)
+    , m_numBlockingWorkers(std::max(1, numBlockingWorkers))
+    , m_slots(NUM_SLOTS)
+    , m_cursor(0)
+    , m_running(false)
+    , m_quit(false)
+{
+}
+
+// ------------------------------------
+TimerWheel::~TimerWheel()
+{
+    stop();
+}
+
+// ------------------------------------
+void TimerWheel::add(const char *name, unsigned int periodMsec, Task fn, bool mayBlock)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+
+    Entry e;
+    e.name = name;
+    e.periodTicks = std::max(1u, (periodMsec + TICK_MSEC - 1) / TICK_MSEC);
+    e.fn = fn;
+    e.mayBlock = mayBlock;
+    e.rounds = 0;
+    e.runs = 0;
+    e.lastMsec = 0;
+    e.maxLateMsec = 0;
+    m_entries.push_back(e);
+
+    schedule(m_entries.size() - 1, 1);
+}
+
+// ------------------------------------
+// 今の針から ticks 目盛り先に置く。m_mutex を持って呼ぶ。
+void TimerWheel::schedule(int id, unsigned int ticks)
+{
+    ticks = std::max(1u, ticks);
+    m_entries[id].rounds = (ticks - 1) / NUM_SLOTS;
+    m_slots[(m_cursor + ticks) % NUM_SLOTS].push_back(id);
+}
+
+// ------------------------------------
+bool TimerWheel::start()
+{
+    std::lock_guard<std::mutex> cs(m_controlLock);
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (m_running)
+            return true;
+        m_running = true;
+        m_quit = false;
+    }
+
+    m_threads.clear();
+    bool ok = startThread(tickerProc) && startThread(fastWorkerProc);
+    for (int i = 0; ok && i < m_numBlockingWorkers; i++)
+        ok = startThread(blockingWorkerProc);
+    return ok;
+}
+
+// ------------------------------------
+bool TimerWheel::startThread(THREAD_FUNC func)
+{
+    auto t = std::unique_ptr<ThreadInfo>(new ThreadInfo());
+    t->func = func;
+    t->data = this;
+    t->threadClass = ThreadClass::T_BACKGROUND;
+    if (!sys->startWaitableThread(t.get()))
+        return false;
+    m_threads.push_back(std::move(t));
+    return true;
+}
+
+// ------------------------------------
+THREAD_PROC TimerWheel::tickerProc(ThreadInfo *thread)
+{
+    static_cast<TimerWheel*>(thread->data)->tickerMain();
+    return 0;
+}
+
+// ------------------------------------
+THREAD_PROC TimerWheel::fastWorkerProc(ThreadInfo *thread)
+{
+    static_cast<TimerWheel*>(thread->data)->workerMain(FAST);
+    return 0;
+}
+
+// ------------------------------------
+THREAD_PROC TimerWheel::blockingWorkerProc(ThreadInfo *thread)
+{
+    static_cast<TimerWheel*>(thread->data)->workerMain(BLOCKING);
+    return 0;
+}
+
+// ------------------------------------
+void TimerWheel::stop()
+{
+    std::lock_guard<std::mutex> cs(m_controlLock);
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (!m_running)
+            return;
+        m_running = false;
+        m_quit = true;
+        m_tickCond.notify_all();
+        m_workCond[FAST].notify_all();
+        m_workCond[BLOCKING].notify_all();
+    }
+
+    // 仕事の中から呼ばれた時、そのスレッドは待たずに切り離され、今の
+    // 仕事が終われば抜ける。
+    for (auto& t : m_threads)
+        sys->waitThread(t.get());
+
+    // キューに残っていた仕事は輪に戻して、次の start() で走らせる。
+    std::lock_guard<std::mutex> lk(m_mutex);
+    for (auto& q : m_ready)
+    {
+        for (int id : q)
+            schedule(id, 1);
+        q.clear();
+    }
+}
+
+// ------------------------------------
+bool TimerWheel::running()
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_running;
+}
+
+// ------------------------------------
+void TimerWheel::tickerMain()
+{
+    sys->setThreadName(m_name.c_str());
+
+    auto next = Clock::now();
+    std::unique_lock<std::mutex> lk(m_mutex);
+    while (!m_quit)
+    {
+        next += std::chrono::milliseconds(TICK_MSEC);
+        auto now = Clock::now();
+        if (next < now - std::chrono::seconds(1))
+            next = now;     // 眠っていたなどで大きく遅れたら追い付こうとしない
+        if (m_tickCond.wait_until(lk, next, [this]() { return m_quit; }))
+            break;
+
+        m_cursor = (m_cursor + 1) % NUM_SLOTS;
+
+        std::vector<int> waiting;
+        for (int id : m_slots[m_cursor])
+        {
+            Entry& e = m_entries[id];
+            if (e.rounds > 0)
+            {
+                e.rounds--;
+                waiting.push_back(id);
+                continue;
+            }
+
+            e.due = next;
+            const int lane = e.mayBlock ? BLOCKING : FAST;
+            m_ready[lane].push_back(id);
+            m_workCond[lane].notify_one();
+        }
+        m_slots[m_cursor].swap(waiting);
+    }
+}
+
+// ------------------------------------
+void TimerWheel::workerMain(int lane)
+{
+    sys->setThreadName(str::format("%s%s", m_name.c_str(), (lane == FAST) ? "" : " BLOCKING").c_str());
+
+    std::unique_lock<std::mutex> lk(m_mutex);
+    while (true)
+    {
+        m_workCond[lane].wait(lk, [&]() { return m_quit || !m_ready[lane].empty(); });
+        if (m_quit)
+            break;
+
+        const int id = m_ready[lane].front();
+        m_ready[lane].pop_front();
+
+        // 走っている間は m_entries の他のところは触られない。
+        Entry& e = m_entries[id];
+        Task fn = e.fn;
+        auto started = Clock::now();
+        double late = std::chrono::duration<double, std::milli>(started - e.due).count();
+        if (late > e.maxLateMsec)
+            e.maxLateMsec = late;
+        lk.unlock();
+
+        try
+        {
+            fn();
+        } catch (std::exception& ex)
+        {
+            LOG_ERROR("%s: %s: %s", m_name.c_str(), e.name.c_str(), ex.what());
+        }
+
+        double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - started).count();
+        lk.lock();
+        e.runs++;
+        e.lastMsec = elapsed;
+        schedule(id, e.periodTicks);
+    }
+}
+
+// ------------------------------------
+amf0::Value TimerWheel::getState()
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+
+    std::vector<amf0::Value> tasks;
+    for (auto& e : m_entries)
+    {
+        tasks.push_back(amf0::Value::object(
+            {
+                {"name", e.name},
+                {"periodMsec", (int) (e.periodTicks * TICK_MSEC)},
+                {"mayBlock", e.mayBlock},
+                {"runs", (double) e.runs},
+                {"lastMsec", e.lastMsec},
+                {"maxLateMsec", e.maxLateMsec},
+            }));
+    }
+
+    return amf0::Value::object(
+        {
+            {"running", m_running},
+            {"tasks", tasks},
+        });
+}
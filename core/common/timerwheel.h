@@ -0,0 +1,115 @@
+// ------------------------------------------------
+// File : timerwheel.h
+// Desc:
+//      決まった間隔で繰り返す仕事を、目盛りの付いた輪 (タイマーホイー
+//      ル) で管理して、少数のワーカースレッドで実行する。
+//
+//      仕事は短く終わるものと、ネットワークを待つなどして止まりうるも
+//      のに分けて登録する。短いものは専用のワーカー一本で、止まりうる
+//      ものは別のワーカーで走らせるので、後者が前者を遅らせることは無
+//      い。同じ仕事は重ねて走らせず、終わってから次の時刻を決める。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _TIMERWHEEL_H
+#define _TIMERWHEEL_H
+
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "amf0.h"
+#include "threading.h"
+
+// ------------------------------------
+class TimerWheel
+{
+public:
+    enum
+    {
+        TICK_MSEC = 100,    // 一目盛りの長さ
+        NUM_SLOTS = 64,     // 輪の目盛りの数
+    };
+
+    typedef std::function<void()> Task;
+
+    // numBlockingWorkers は止まりうる仕事を走らせるワーカーの数。
+    TimerWheel(const char *name, int numBlockingWorkers);
+    ~TimerWheel();
+
+    // periodMsec ごとに fn を実行する。最初は start() の次の目盛りで
+    // 走る。start() の前に登録する。
+    void    add(const char *name, unsigned int periodMsec, Task fn, bool mayBlock = false);
+
+    bool    start();
+    // 走っている仕事が終わるのを待ってから止める。仕事の中から呼んだ
+    // 時は待たない。
+    void    stop();
+    bool    running();
+
+    amf0::Value getState();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry
+    {
+        std::string         name;
+        unsigned int        periodTicks;
+        Task                fn;
+        bool                mayBlock;
+
+        unsigned int        rounds;     // 輪をあと何周待つか
+        Clock::time_point   due;        // キューに入れた時刻
+        uint64_t            runs;
+        double              lastMsec;   // 前回かかった時間
+        double              maxLateMsec;// 期限から走り始めるまでの最大
+    };
+
+    enum { FAST, BLOCKING };
+
+    void    schedule(int id, unsigned int ticks);
+    void    tickerMain();
+    void    workerMain(int lane);
+
+    static THREAD_PROC  tickerProc(ThreadInfo *);
+    static THREAD_PROC  fastWorkerProc(ThreadInfo *);
+    static THREAD_PROC  blockingWorkerProc(ThreadInfo *);
+    bool    startThread(THREAD_FUNC func);
+
+    std::string                 m_name;
+    int                         m_numBlockingWorkers;
+
+    std::mutex                  m_mutex;
+    std::condition_variable     m_tickCond;
+    std::condition_variable     m_workCond[2];
+
+    std::vector<Entry>          m_entries;
+    std::vector<std::vector<int>> m_slots;
+    unsigned int                m_cursor;
+    std::deque<int>             m_ready[2];
+
+    bool                        m_running;
+    bool                        m_quit;
+    std::vector<std::unique_ptr<ThreadInfo>> m_threads;    // 時計とワーカー
+    std::mutex                  m_controlLock;  // start と stop
+};
+
+#endif
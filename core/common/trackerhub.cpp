@@ -0,0 +1,151 @@
+// ------------------------------------------------
+// File : trackerhub.cpp
+// Desc:
+//      トラッカーの負荷を分けるハブの指名と、ハブが取り込んだ下流の集計。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+
+#include "trackerhub.h"
+
+TrackerHubs g_trackerHubs;
+
+// ------------------------------------
+std::vector<ChanHit> TrackerHubs::pickHubs(ChanHitList& hitList, int max)
+{
+    std::vector<ChanHit> hubs;
+    if (hitList.numHits() < MIN_HITS)
+        return hubs;
+
+    // 直下にいて、他から繋げるリレー。
+    for (auto h = hitList.hit; h; h = h->next)
+    {
+        if (h->host.ip && !h->dead && h->recv && h->relay && !h->firewalled &&
+            !h->tracker && h->numHops == 1 && h->sessionID.isSet())
+            hubs.push_back(*h);
+    }
+
+    std::stable_sort(hubs.begin(), hubs.end(),
+                     [](const ChanHit& a, const ChanHit& b)
+                     {
+                         if (a.numRelays != b.numRelays)
+                             return a.numRelays > b.numRelays;
+                         return a.upTime > b.upTime;
+                     });
+    if ((int) hubs.size() > max)
+        hubs.resize(max);
+    for (auto& h : hubs)
+        h.next = nullptr;
+    return hubs;
+}
+
+// ------------------------------------
+void TrackerHubs::assign(const GnuID& chanID, unsigned int lease, unsigned int now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto& hub = m_hubs[chanID];
+    hub.until = now + std::min<unsigned int>(lease, LEASE);
+}
+
+// ------------------------------------
+bool TrackerHubs::isHub(const GnuID& chanID, unsigned int now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_hubs.find(chanID);
+    return it != m_hubs.end() && now < it->second.until;
+}
+
+// ------------------------------------
+void TrackerHubs::absorb(const GnuID& chanID, const ChanHit& hit, unsigned int now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_hubs.find(chanID);
+    if (it == m_hubs.end())
+        return;
+
+    auto& hub = it->second;
+    hub.numAbsorbed++;
+    if (!hit.recv)
+    {
+        hub.children.erase(hit.sessionID);
+        return;
+    }
+
+    // 下流のハブがまとめた分も足す。
+    auto& c = hub.children[hit.sessionID];
+    c.numListeners = hit.numListeners + (hit.hub ? hit.hubListeners : 0);
+    c.numRelays = hit.numRelays + (hit.hub ? hit.hubRelays : 0);
+    c.lastSeen = now;
+}
+
+// ------------------------------------
+TrackerHubs::Summary TrackerHubs::summary(const GnuID& chanID, unsigned int now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    Summary s;
+    auto it = m_hubs.find(chanID);
+    if (it == m_hubs.end())
+        return s;
+
+    for (auto& pair : it->second.children)
+    {
+        if (now - pair.second.lastSeen >= CHILD_TTL)
+            continue;
+        s.numHits++;
+        s.numListeners += pair.second.numListeners;
+        s.numRelays += pair.second.numRelays;
+    }
+    return s;
+}
+
+// ------------------------------------
+void TrackerHubs::expire(unsigned int now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    for (auto it = m_hubs.begin(); it != m_hubs.end(); )
+    {
+        auto& children = it->second.children;
+        for (auto c = children.begin(); c != children.end(); )
+        {
+            if (now - c->second.lastSeen >= CHILD_TTL)
+                c = children.erase(c);
+            else
+                ++c;
+        }
+
+        if (now >= it->second.until)
+            it = m_hubs.erase(it);
+        else
+            ++it;
+    }
+}
+
+// ------------------------------------
+amf0::Value TrackerHubs::getState()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    int numChildren = 0;
+    int numAbsorbed = 0;
+    for (auto& pair : m_hubs)
+    {
+        numChildren += pair.second.children.size();
+        numAbsorbed += pair.second.numAbsorbed;
+    }
+    return amf0::Value::object(
+        {
+            {"numChannels", (int) m_hubs.size()},
+            {"numChildren", numChildren},
+            {"numAbsorbed", numAbsorbed},
+        });
+}
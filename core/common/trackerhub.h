@@ -0,0 +1,91 @@
+// ------------------------------------------------
+// File : trackerhub.h
+// Desc:
+//      トラッカーの負荷を分けるハブ (trackerHubs フラグ)。ヒットが多く
+//      なったトラッカーは直下のリレーのいくつかをハブに指名する。ハブ
+//      は下流から上がってくるヒットの報告をトラッカーへ流さずに取り込
+//      み、自分の報告に下流の視聴者数とリレー数の合計を載せる。指名は
+//      LEASE 秒で切れるので、トラッカーは続けて指名し直す。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _TRACKERHUB_H
+#define _TRACKERHUB_H
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "amf0.h"
+#include "chanhit.h"
+#include "gnuid.h"
+
+// ------------------------------------
+class TrackerHubs
+{
+public:
+    enum
+    {
+        MIN_HITS        = 100,  // ヒットがこれより少なければ指名しない
+        MAX_HUBS        = 4,
+        ASSIGN_INTERVAL = 60,   // トラッカーが指名し直す秒数
+        LEASE           = 180,  // 指名が切れるまでの秒数
+        CHILD_TTL       = 180,  // 報告の途絶えた下流を数えなくなる秒数
+    };
+
+    struct Summary
+    {
+        unsigned int numHits = 0;
+        unsigned int numListeners = 0;
+        unsigned int numRelays = 0;
+    };
+
+    // トラッカー側。hitList から直下のリレーをリレー数の多い順に max
+    // 個まで選ぶ。chanMgr->lock を取って呼ぶ。
+    static std::vector<ChanHit> pickHubs(ChanHitList& hitList, int max);
+
+    // ハブ側。chanID のハブを lease 秒任された。
+    void        assign(const GnuID& chanID, unsigned int lease, unsigned int now);
+    bool        isHub(const GnuID& chanID, unsigned int now);
+
+    // 下流からのヒットを取り込む。recv でなければ数えるのを止める。
+    void        absorb(const GnuID& chanID, const ChanHit& hit, unsigned int now);
+    Summary     summary(const GnuID& chanID, unsigned int now);
+
+    // 指名の切れたチャンネルと報告の途絶えた下流を消す。
+    void        expire(unsigned int now);
+
+    amf0::Value getState();
+
+private:
+    struct Child
+    {
+        unsigned int numListeners = 0;
+        unsigned int numRelays = 0;
+        unsigned int lastSeen = 0;
+    };
+
+    struct Hub
+    {
+        unsigned int                until = 0;
+        std::unordered_map<GnuID, Child, GnuIDHash, GnuIDEqual> children;   // セッション ID ごと
+        unsigned int                numAbsorbed = 0;
+    };
+
+    std::mutex                  m_lock;
+    std::unordered_map<GnuID, Hub, GnuIDHash, GnuIDEqual> m_hubs;
+};
+
+extern TrackerHubs g_trackerHubs;
+
+#endif
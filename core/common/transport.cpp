@@ -0,0 +1,130 @@
+// ------------------------------------------------
+// File : transport.cpp
+// Desc:
+//      PCP の接続に使うトランスポートの差し替え口。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+
+#include "transport.h"
+#include "socket.h"
+#include "sys.h"
+
+TransportRegistry g_transports;
+
+static const char* const kTCP = "tcp";
+
+// ------------------------------------
+TransportRegistry::TransportRegistry()
+{
+    m_transports.push_back({ kTCP, []() { return sys->createSocket(); } });
+}
+
+// ------------------------------------
+void TransportRegistry::add(const std::string& name, Factory factory)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_transports.erase(std::remove_if(m_transports.begin(), m_transports.end(),
+                                      [&](const std::pair<std::string, Factory>& t) { return t.first == name; }),
+                       m_transports.end());
+    m_transports.push_back({ name, factory });
+}
+
+// ------------------------------------
+void TransportRegistry::remove(const std::string& name)
+{
+    if (name == kTCP)
+        return;
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_transports.erase(std::remove_if(m_transports.begin(), m_transports.end(),
+                                      [&](const std::pair<std::string, Factory>& t) { return t.first == name; }),
+                       m_transports.end());
+}
+
+// ------------------------------------
+std::vector<std::string> TransportRegistry::namesLocked()
+{
+    std::vector<std::string> res;
+    for (auto it = m_transports.rbegin(); it != m_transports.rend(); ++it)
+        res.push_back(it->first);
+    return res;
+}
+
+// ------------------------------------
+std::vector<std::string> TransportRegistry::names()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return namesLocked();
+}
+
+// ------------------------------------
+void TransportRegistry::remember(const Host& host, const std::string& name)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    if (name.empty() || name == kTCP)
+    {
+        m_hosts.erase(host);
+        return;
+    }
+
+    if (m_hosts.size() >= MAX_HOSTS && !m_hosts.count(host))
+    {
+        auto oldest = std::min_element(m_hosts.begin(), m_hosts.end(),
+                                       [](const std::pair<const Host, Entry>& a, const std::pair<const Host, Entry>& b)
+                                       { return a.second.time < b.second.time; });
+        m_hosts.erase(oldest);
+    }
+    m_hosts[host] = { name, sys->getTime() };
+}
+
+// ------------------------------------
+void TransportRegistry::forget(const Host& host)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_hosts.erase(host);
+}
+
+// ------------------------------------
+std::string TransportRegistry::select(const Host& host)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_hosts.find(host);
+    if (it == m_hosts.end())
+        return kTCP;
+
+    auto names = namesLocked();
+    if (sys->getTime() - it->second.time > REMEMBER_SECS ||
+        std::find(names.begin(), names.end(), it->second.name) == names.end())
+    {
+        m_hosts.erase(it);
+        return kTCP;
+    }
+    return it->second.name;
+}
+
+// ------------------------------------
+std::shared_ptr<ClientSocket> TransportRegistry::createSocket(const Host& host)
+{
+    auto name = select(host);
+
+    Factory factory;
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        for (auto& t : m_transports)
+            if (t.first == name)
+                factory = t.second;
+    }
+    return factory();
+}
@@ -0,0 +1,84 @@
+// ------------------------------------------------
+// File : transport.h
+// Desc:
+//      PCP の接続に使うトランスポートの差し替え口。ClientSocket を作る
+//      関数を名前を付けて登録しておき、相手も対応していると分かってい
+//      るホストにはそれで接続する。組み込みは "tcp" だけで、他のもの
+//      (QUIC など) は登録した時に使われるようになる。
+//
+//      相手が対応しているかを知る方法 (HELO の拡張など) は、TCP 以外
+//      のトランスポートを実装する時に、それと一緒に決める。それまでは
+//      remember() で教えたホストだけがそれを使う。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _TRANSPORT_H
+#define _TRANSPORT_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "host.h"
+
+class ClientSocket;
+
+// ------------------------------------
+class TransportRegistry
+{
+public:
+    enum
+    {
+        MAX_HOSTS       = 1024, // これを超えたら一番古いものを忘れる
+        REMEMBER_SECS   = 3600, // 覚えたものを使う時間
+    };
+
+    typedef std::function<std::shared_ptr<ClientSocket>()> Factory;
+
+    TransportRegistry();
+
+    // 後から登録したものほど優先する。同じ名前なら置き換える。
+    void    add(const std::string& name, Factory factory);
+    void    remove(const std::string& name);
+
+    // 登録されている名前。優先する順。
+    std::vector<std::string> names();
+
+    // host が name に対応していると覚える。空か "tcp" なら忘れる。
+    void    remember(const Host& host, const std::string& name);
+    void    forget(const Host& host);
+
+    // host に接続するのに使うトランスポートの名前。
+    std::string select(const Host& host);
+    std::shared_ptr<ClientSocket> createSocket(const Host& host);
+
+private:
+    struct Entry
+    {
+        std::string  name;
+        unsigned int time;
+    };
+
+    std::vector<std::string> namesLocked();
+
+    std::mutex                  m_lock;
+    std::vector<std::pair<std::string, Factory>> m_transports;  // 優先しない順
+    std::map<Host, Entry>       m_hosts;
+};
+
+extern TransportRegistry g_transports;
+
+#endif
@@ -4,7 +4,7 @@
 #include "threading.h"
 #include "socket.h"
 #include "version2.h"
-#include "xml.h"
+#include "xmlreader.h"
 #include "sstream.h"
 #include <algorithm>
 
@@ -12,7 +12,7 @@
 
 std::pair<bool,std::string> UptestServiceRegistry::addURL(const std::string& url)
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
 
     URI uri(url);
     if (!uri.isValid())
@@ -33,7 +33,7 @@ bool UptestServiceRegistry::isIndexValid(int index) const
 
 std::pair<bool,std::string> UptestServiceRegistry::deleteByIndex(int index)
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
 
     if (!isIndexValid(index))
         return std::make_pair(false, "index out of range");
@@ -44,7 +44,7 @@ std::pair<bool,std::string> UptestServiceRegistry::deleteByIndex(int index)
 
 std::pair<bool,std::string> UptestServiceRegistry::takeSpeedtest(int index)
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
 
     if (!isIndexValid(index))
         return std::make_pair(false, "index out of range");
@@ -54,7 +54,7 @@ std::pair<bool,std::string> UptestServiceRegistry::takeSpeedtest(int index)
 
 std::vector<std::string> UptestServiceRegistry::getURLs() const
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
     std::vector<std::string> res;
     for (auto provider : m_providers)
         res.push_back(provider.url);
@@ -63,7 +63,7 @@ std::vector<std::string> UptestServiceRegistry::getURLs() const
 
 void UptestServiceRegistry::clear()
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
     m_providers.clear();
 }
 
@@ -84,7 +84,7 @@ static std::string textStatus(int status)
 
 amf0::Value UptestServiceRegistry::getState()
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
     std::vector<amf0::Value> providers;
 
     for (size_t i = 0; i < m_providers.size(); i++)
@@ -95,41 +95,89 @@ amf0::Value UptestServiceRegistry::getState()
                 {"speed", m_providers[i].m_info.speed},
                 {"over", m_providers[i].m_info.over},
                 {"checkable", m_providers[i].m_info.checkable},
+                {"lastTriedAt", std::to_string(m_providers[i].lastTriedAt)},
             });
 
     return amf0::Value::object(
         {
-            {"providers", providers}
+            {"providers", providers},
+            {"updating", std::to_string(m_updating)},
         });
 }
 
-void UptestServiceRegistry::update()
+UptestServiceRegistry::~UptestServiceRegistry()
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    if (m_worker.joinable())
+        m_worker.join();
+}
 
-    for (auto& provider : m_providers)
+// ダウンロードは m_lock を持たずに行い、結果を書き戻す時だけ取る。
+// 呼び出し元の idle スレッドは待たない。
+void UptestServiceRegistry::update()
+{
+    std::vector<std::string> urls;
     {
-        if (provider.status != UptestEndpoint::kSuccess)
+        std::lock_guard<ProfiledMutex> cs(m_lock);
+
+        if (m_updating)
+            return;
+
+        for (auto& provider : m_providers)
         {
-            if (provider.isReady())
-                provider.update();
-            else
-                LOG_TRACE("%s not ready to download", provider.url.c_str());
+            if (m_forceUpdate)
+                urls.push_back(provider.url);
+            else if (provider.status != UptestEndpoint::kSuccess)
+            {
+                if (provider.isReady())
+                    urls.push_back(provider.url);
+                else
+                    LOG_TRACE("%s not ready to download", provider.url.c_str());
+            }
         }
+
+        m_forceUpdate = false;
+        if (urls.empty())
+            return;
+        m_updating = true;
     }
+
+    // 前の取得のスレッドは m_updating を下ろした後は終わるだけ。
+    if (m_worker.joinable())
+        m_worker.join();
+    m_worker = std::thread([this, urls]()
+    {
+        for (auto& url : urls)
+        {
+            UptestEndpoint endpoint(url);
+            endpoint.update();
+
+            // 取得している間に消されていれば捨てる。
+            std::lock_guard<ProfiledMutex> cs(m_lock);
+            for (auto& provider : m_providers)
+            {
+                if (provider.url == url)
+                    provider = endpoint;
+            }
+        }
+
+        std::lock_guard<ProfiledMutex> cs(m_lock);
+        m_updating = false;
+    });
 }
 
+// 取得中なら、それが終わった後の update() で全て取り直す。
 void UptestServiceRegistry::forceUpdate()
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
-
-    for (auto& provider : m_providers)
-        provider.update();
+    {
+        std::lock_guard<ProfiledMutex> cs(m_lock);
+        m_forceUpdate = true;
+    }
+    update();
 }
 
 std::pair<bool,std::string> UptestServiceRegistry::getXML(int index, std::string& out) const
 {
-    std::lock_guard<std::recursive_mutex> cs(m_lock);
+    std::lock_guard<ProfiledMutex> cs(m_lock);
 
     if (!isIndexValid(index))
         return std::make_pair(false, "index out of range");
@@ -141,6 +189,19 @@ std::pair<bool,std::string> UptestServiceRegistry::getXML(int index, std::string
     return std::make_pair(true, "");
 }
 
+unsigned int UptestServiceRegistry::measuredUploadKbps() const
+{
+    std::lock_guard<ProfiledMutex> cs(m_lock);
+
+    unsigned int kbps = 0;
+    for (auto& provider : m_providers)
+    {
+        if (provider.status == UptestEndpoint::kSuccess)
+            kbps = std::max(kbps, (unsigned int) std::max(0, atoi(provider.m_info.speed.c_str())));
+    }
+    return kbps;
+}
+
 // -------- class UptestEndpoint --------
 
 bool UptestEndpoint::isReady()
@@ -174,24 +235,7 @@ std::string UptestEndpoint::download(const std::string& url)
     if (uri.scheme() != "http")
         throw std::runtime_error("unsupported protocol");
 
-    Host host;
-    host.fromStrName(uri.host().c_str(), uri.port());
-
-    if (!host.ip)
-        throw std::runtime_error("could not resolve host name");
-
-    auto rsock = sys->createSocket();
-    rsock->open(host);
-    rsock->connect();
-
-    HTTP http(*rsock);
-    HTTPRequest req("GET", uri.path(), "HTTP/1.0",
-                    {
-                        { "Host", uri.host() },
-                        { "Connection", "close" },
-                        { "User-Agent", PCX_AGENT }
-                    });
-    HTTPResponse res = http.send(req);
+    HTTPResponse res = http::getResponse(url, {});
 
     if (res.statusCode != 200)
         throw std::runtime_error(str::format("unexpected status code %d", res.statusCode));
@@ -199,42 +243,60 @@ std::string UptestEndpoint::download(const std::string& url)
     return res.body;
 }
 
-#define nonNull(p)                                                      \
-    (((p) == nullptr) ?                                                 \
-     throw std::runtime_error(                                          \
-         str::format("non-null assertion failed on line %d in file %s", \
-                     __LINE__, __FILE__))                               \
-     : (p))
+// r が指している要素の属性 name を読む。無ければ例外。
+static std::string requireAttr(const XMLReader& r, const char* name)
+{
+    std::string value;
+    if (!r.attr(name, value))
+        throw std::runtime_error(str::format("attribute %s not found in <%s>", name, r.name().c_str()));
+    return value;
+}
 
+// 木は作らずに、頭から読んでいって要る要素の属性だけを拾う。同じ名前
+// の要素が複数あれば最初のものを使う。
 UptestInfo UptestEndpoint::readInfo(const std::string& body)
 {
     UptestInfo info;
-    XML xml;
-    StringStream mem(body);
-
-    xml.read(mem);
-
-    XML::Node* yp = nonNull(xml.findNode("yp"));
-    info.name      = nonNull(yp->findAttr("name"));
-
-    XML::Node* host = nonNull(xml.findNode("host"));
-    info.ip        = nonNull(host->findAttr("ip"));
-    info.port_open = nonNull(host->findAttr("port_open"));
-    info.speed     = nonNull(host->findAttr("speed"));
-    info.over      = nonNull(host->findAttr("over"));
-
-    XML::Node* uptest = nonNull(xml.findNode("uptest"));
-    info.checkable = nonNull(uptest->findAttr("checkable"));
-    info.remain    = nonNull(uptest->findAttr("remain"));
-
-    XML::Node* uptest_srv = nonNull(xml.findNode("uptest_srv"));
-    info.addr      = nonNull(uptest_srv->findAttr("addr"));
-    info.port      = nonNull(uptest_srv->findAttr("port"));
-    info.object    = nonNull(uptest_srv->findAttr("object"));
-    info.post_size = nonNull(uptest_srv->findAttr("post_size"));
-    info.limit     = nonNull(uptest_srv->findAttr("limit"));
-    info.interval  = nonNull(uptest_srv->findAttr("interval"));
-    info.enabled   = nonNull(uptest_srv->findAttr("enabled"));
+    bool yp = false, host = false, uptest = false, uptest_srv = false;
+
+    XMLReader r(body);
+    XMLReader::Token t;
+    while ((t = r.next()) != XMLReader::T_EOF)
+    {
+        if (t != XMLReader::T_START)
+            continue;
+
+        if (!yp && r.nameIs("yp"))
+        {
+            info.name      = requireAttr(r, "name");
+            yp = true;
+        }else if (!host && r.nameIs("host"))
+        {
+            info.ip        = requireAttr(r, "ip");
+            info.port_open = requireAttr(r, "port_open");
+            info.speed     = requireAttr(r, "speed");
+            info.over      = requireAttr(r, "over");
+            host = true;
+        }else if (!uptest && r.nameIs("uptest"))
+        {
+            info.checkable = requireAttr(r, "checkable");
+            info.remain    = requireAttr(r, "remain");
+            uptest = true;
+        }else if (!uptest_srv && r.nameIs("uptest_srv"))
+        {
+            info.addr      = requireAttr(r, "addr");
+            info.port      = requireAttr(r, "port");
+            info.object    = requireAttr(r, "object");
+            info.post_size = requireAttr(r, "post_size");
+            info.limit     = requireAttr(r, "limit");
+            info.interval  = requireAttr(r, "interval");
+            info.enabled   = requireAttr(r, "enabled");
+            uptest_srv = true;
+        }
+    }
+
+    if (!(yp && host && uptest && uptest_srv))
+        throw std::runtime_error("missing element in uptest XML");
 
     return info;
 }
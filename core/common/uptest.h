@@ -3,6 +3,7 @@
 
 #include "varwriter.h"
 #include <vector>
+#include <thread>
 #include "threading.h"
 #include "http.h"
 #include "uri.h"
@@ -81,6 +82,8 @@ public:
 class UptestServiceRegistry : public VariableWriter
 {
 public:
+    ~UptestServiceRegistry();
+
     std::pair<bool,std::string> addURL(const std::string&);
     std::vector<std::string> getURLs() const;
     std::pair<bool,std::string> deleteByIndex(int index);
@@ -90,13 +93,24 @@ public:
 
     amf0::Value getState() override;
 
+    // 取得が要るエンドポイントを別のスレッドで取得する。
     void update();
+    // 全てのエンドポイントを取り直す。取得は update() と同じく別のス
+    // レッドで行い、終わるのを待たない。
     void forceUpdate();
 
     bool isIndexValid(int index) const;
 
-    mutable std::recursive_mutex m_lock;
+    // 取得できたスピードテストの結果 (kbps) のうち最大のもの。無ければ 0。
+    unsigned int measuredUploadKbps() const;
+
+    mutable ProfiledMutex m_lock { "UptestServiceRegistry::m_lock" };
     std::vector<UptestEndpoint> m_providers;
+
+private:
+    bool m_updating = false;    // 取得中。m_lock で保護される。
+    bool m_forceUpdate = false; // 次の update() で全て取り直す。
+    std::thread m_worker;       // update() の取得をするスレッド
 };
 
 #endif
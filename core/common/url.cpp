@@ -25,10 +25,9 @@
 #include "version2.h"
 #include "playlist.h"
 #include "gnutella.h"
-#ifdef WITH_RTMP
-#include "rtmp.h"
-#endif
+#include "rtmpingest.h"
 #include "dechunker.h"
+#include "prefork.h"
 
 // ------------------------------------------------
 void URLSource::stream(std::shared_ptr<Channel> ch)
@@ -250,19 +249,29 @@ ChanInfo::PROTOCOL URLSource::getSourceProtocol(char*& fileName)
             }
         }else if (ch->info.srcProtocol == ChanInfo::SP_RTMP)
         {
-#ifdef WITH_RTMP
             LOG_INFO("Channel source is RTMP");
 
-            std::shared_ptr<RTMPClientStream> rs(new RTMPClientStream());
-            rs->open(url);
-            inputStream = rs;
+            std::string hostName, app, streamName;
+            if (!RTMPSession::splitURL(fileName, hostName, app, streamName))
+                throw StreamException("Bad RTMP URL");
 
-            ch->info.setContentType(ChanInfo::T_FLV);
-#else
-            LOG_ERROR("Not compiled with RTMP support");
+            std::shared_ptr<ClientSocket> inputSocket(sys->createSocket());
+            if (!inputSocket)
+                throw StreamException("Channel cannot create socket");
 
-            throw StreamException("Unsupported URL");
-#endif
+            inputStream = inputSocket;
+
+            Host host;
+            host.fromStrName(hostName.c_str(), 1935);
+            inputSocket->open(host);
+            inputSocket->connect();
+
+            auto session = std::make_shared<RTMPSession>(*inputSocket);
+            session->clientHandshake();
+            session->play(app, "rtmp://" + hostName + "/" + app, streamName);
+
+            ch->info.setContentType(ChanInfo::T_FLV);
+            source = std::make_shared<RTMPStream>(session);
         }else if (ch->info.srcProtocol == ChanInfo::SP_FILE)
         {
             LOG_INFO("Channel source is FILE");
@@ -344,6 +353,7 @@ ChanInfo::PROTOCOL URLSource::getSourceProtocol(char*& fileName)
             {
                 ch->info.id = chanMgr->broadcastID;
                 ch->info.id.encode(nullptr, ch->info.name.cstr(), ch->info.genre, ch->info.bitrate);
+                g_prefork.claimID(ch->info.id);
             }
 
             if (ch->info.contentType == ChanInfo::T_ASX)
@@ -353,7 +363,8 @@ ChanInfo::PROTOCOL URLSource::getSourceProtocol(char*& fileName)
 
             inputStream->setReadTimeout(60000);    // use longer read timeout
 
-            source = ch->createSource();
+            if (!source)
+                source = ch->createSource();
 
             if (chunkedStream) {
                 Dechunker dechunker(*inputStream);
@@ -13,6 +13,7 @@
 #define _WAITABLEQUEUE_H
 
 #include <queue>
+#include <chrono>
 #include <condition_variable>
 
 template <typename T>
@@ -37,6 +38,18 @@ public:
         return t;
     }
 
+    // timeoutMs ミリ秒待っても要素が無ければ false を返す。
+    bool dequeue(T& t, int timeoutMs)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_cv.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                           [this]() { return !m_queue.empty(); }))
+            return false;
+        t = m_queue.front();
+        m_queue.pop();
+        return true;
+    }
+
 private:
     std::mutex m_mutex;
     std::condition_variable m_cv;
@@ -0,0 +1,85 @@
+// ------------------------------------------------
+// File : websocket.cpp
+// Desc:
+//      WebSocket (RFC 6455) のサーバー側の送信。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include "websocket.h"
+
+// ------------------------------------
+std::string WebSocketFramer::frameHeader(OPCODE opcode, size_t length)
+{
+    std::string h;
+    h.push_back((char) (0x80 | opcode));
+    if (length < 126)
+    {
+        h.push_back((char) length);
+    }else if (length <= 0xffff)
+    {
+        h.push_back(126);
+        h.push_back((char) (length >> 8));
+        h.push_back((char) length);
+    }else
+    {
+        h.push_back(127);
+        for (int i = 7; i >= 0; i--)
+            h.push_back((char) ((uint64_t) length >> (i * 8)));
+    }
+    return h;
+}
+
+// ------------------------------------
+void WebSocketFramer::write(const void *buf, int size)
+{
+    if (size == 0)
+        return;
+    auto h = frameHeader(OP_BINARY, size);
+    m_stream.write(h.data(), (int) h.size());
+    m_stream.write(buf, size);
+}
+
+// ------------------------------------
+void WebSocketFramer::writeRef(const void *buf, int size, std::shared_ptr<const void> owner)
+{
+    if (size == 0)
+        return;
+    auto h = frameHeader(OP_BINARY, size);
+    m_stream.write(h.data(), (int) h.size());
+    m_stream.writeRef(buf, size, std::move(owner));
+}
+
+// ------------------------------------
+void WebSocketFramer::close()
+{
+    static const char payload[] = { 0x03, (char) 0xe8 };   // 1000
+    auto h = frameHeader(OP_CLOSE, sizeof(payload));
+    m_stream.write(h.data(), (int) h.size());
+    m_stream.write(payload, sizeof(payload));
+}
+
+// ------------------------------------
+std::string WebSocketFramer::acceptKey(const std::string& key)
+{
+    std::string s = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char*>(s.data()), s.size(), digest);
+
+    unsigned char out[4 * ((SHA_DIGEST_LENGTH + 2) / 3) + 1];
+    int n = EVP_EncodeBlock(out, digest, SHA_DIGEST_LENGTH);
+    return std::string(reinterpret_cast<char*>(out), n);
+}
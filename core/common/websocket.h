@@ -0,0 +1,70 @@
+// ------------------------------------------------
+// File : websocket.h
+// Desc:
+//      WebSocket (RFC 6455) のサーバー側の送信。ストリームをバイナリー
+//      メッセージに包んで送る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _WEBSOCKET_H
+#define _WEBSOCKET_H
+
+#include <memory>
+#include <string>
+
+#include "stream.h"
+
+// ------------------------------------
+// 書き込みごとに一つのバイナリーフレームにする。サーバーからのフレー
+// ムはマスクしない。
+class WebSocketFramer : public Stream
+{
+public:
+    enum OPCODE
+    {
+        OP_CONTINUATION = 0x0,
+        OP_TEXT         = 0x1,
+        OP_BINARY       = 0x2,
+        OP_CLOSE        = 0x8,
+        OP_PING         = 0x9,
+        OP_PONG         = 0xa,
+    };
+
+    WebSocketFramer(WriteBufferedStream& aStream)
+        : m_stream(aStream)
+    {
+    }
+
+    int read(void *buf, int size) override
+    {
+        throw StreamException("Stream can`t read");
+    }
+
+    void write(const void *buf, int size) override;
+
+    // buf をコピーせずに送る。owner は flush まで保持される。
+    void writeRef(const void *buf, int size, std::shared_ptr<const void> owner);
+
+    // 正常終了 (1000) の close フレームを送る。
+    void close() override;
+
+    // FIN を立てたフレームのヘッダー。
+    static std::string frameHeader(OPCODE opcode, size_t length);
+
+    // Sec-WebSocket-Key に対する Sec-WebSocket-Accept の値。
+    static std::string acceptKey(const std::string& key);
+
+    WriteBufferedStream& m_stream;
+};
+
+#endif
@@ -14,19 +14,34 @@ void WMHTTPStream::readHeader(Stream &, std::shared_ptr<Channel>)
 // ------------------------------------------
 int WMHTTPStream::readPacket(Stream &in, std::shared_ptr<Channel> ch)
 {
-    WMHTTPChunk c;
+    const int H = MMSStream::CHUNK_HEADER_LEN;
 
-    c.read(in);
+    char type[2];
+    in.read(type, 2);
+    uint16_t len = in.readShort();
 
-    if (c.type == "$E") // End of stream
+    if (len > sizeof(m_pack.data) - H)
+        throw StreamException("WMHTTP chunk too big");
+
+    // ASF チャンクのヘッダーの後ろに直接読み込む。
+    if (len)
+        in.read(m_pack.data + H, len);
+
+    if (type[0] == '$' && type[1] == 'E') // End of stream
     {
         return 1;
     }
-    if (c.type != "$H" && c.type != "$D")
+    if (type[0] != '$' || (type[1] != 'H' && type[1] != 'D'))
         return 0;
 
-    ASFChunk chunk = c.getASFChunk(m_seqno++);
+    MMSStream::writeChunkHeader(m_pack.data,
+                                type[0] | (type[1] << 8),
+                                len + 8,
+                                m_seqno++,
+                                (type[1] == 'H') ? 0x0c00 : 0x0000,
+                                len + 8);
+    m_pack.len = H + len;
 
-    MMSStream::processChunk(in, ch, chunk);
+    MMSStream::processChunk(ch, m_pack);
     return 0;
 }
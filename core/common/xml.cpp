@@ -228,7 +228,7 @@ XML::Node::Node(const char *fmt, ...)
     va_list ap;
     va_start(ap, fmt);
 
-    char tmp[8192];
+    char tmp[MAX_TAGLEN];
     vsnprintf(tmp, sizeof(tmp), fmt, ap);
     setAttributes(tmp);
 
@@ -31,6 +31,9 @@ class Stream;
 class XML
 {
 public:
+    // 名前と属性を並べたタグの長さの上限
+    static const int MAX_TAGLEN = 8192;
+
     class Node
     {
     public:
@@ -0,0 +1,183 @@
+// ------------------------------------------------
+// File : xmlreader.cpp
+// Desc:
+//      文法の扱いは XML::read() と XML::Node::setAttributes() に合わせ
+//      ている。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <cstring>
+
+#include "xmlreader.h"
+#include "common.h"
+#include "sys.h"
+
+// ------------------------------------
+static inline bool isWhiteSpace(char c)
+{
+    return (c == ' ') || (c == '\r') || (c == '\n') || (c == '\t');
+}
+
+// ------------------------------------
+XMLReader::XMLReader(const char *data, size_t len)
+    : m_p(data)
+    , m_end(data + len)
+    , m_token(T_EOF)
+    , m_name(nullptr), m_nameLen(0)
+    , m_attrs(nullptr), m_attrsLen(0)
+    , m_pendingEnd(false)
+{
+}
+
+// ------------------------------------
+XMLReader::XMLReader(const std::string& data)
+    : XMLReader(data.data(), data.size())
+{
+}
+
+// ------------------------------------
+XMLReader::Token XMLReader::next()
+{
+    if (m_pendingEnd)
+    {
+        m_pendingEnd = false;
+        return m_token = T_END;
+    }
+
+    while (m_p < m_end)
+    {
+        if (*m_p != '<')
+        {
+            const char *start = m_p;
+            const char *lt = static_cast<const char*>(memchr(m_p, '<', m_end - m_p));
+            m_p = lt ? lt : m_end;
+
+            m_name = start;
+            m_nameLen = m_p - start;
+            return m_token = T_TEXT;
+        }
+
+        // 次の '>' まで
+        const char *start = ++m_p;
+        const char *gt = static_cast<const char*>(memchr(m_p, '>', m_end - m_p));
+        const char *end = gt ? gt : m_end;
+        m_p = gt ? gt + 1 : m_end;
+
+        if (start == end)
+            continue;
+
+        if (*start == '!')                  // comment
+            continue;
+
+        if (*start == '?')                  // doc type
+        {
+            if (end - start < 5 || Sys::strnicmp(start + 1, "xml ", 4))
+                throw StreamException("Not XML document");
+            continue;
+        }
+
+        Token token = T_START;
+        if (*start == '/')                  // end tag
+        {
+            token = T_END;
+            start++;
+        }else if (end[-1] == '/')           // single tag
+        {
+            m_pendingEnd = true;
+            end--;
+        }
+
+        const char *p = start;
+        while (p < end && !isWhiteSpace(*p))
+            p++;
+
+        // XML::read() と同じく名前の無いタグは飛ばす。
+        if (p == start && token == T_START)
+        {
+            m_pendingEnd = false;
+            continue;
+        }
+
+        m_name = start;
+        m_nameLen = p - start;
+        m_attrs = p;
+        m_attrsLen = end - p;
+        return m_token = token;
+    }
+
+    return m_token = T_EOF;
+}
+
+// ------------------------------------
+bool XMLReader::nameIs(const char *name) const
+{
+    return strlen(name) == m_nameLen && Sys::strnicmp(m_name, name, m_nameLen) == 0;
+}
+
+// ------------------------------------
+std::string XMLReader::name() const
+{
+    return std::string(m_name, m_nameLen);
+}
+
+// ------------------------------------
+std::string XMLReader::text() const
+{
+    return std::string(m_name, m_nameLen);
+}
+
+// ------------------------------------
+bool XMLReader::attr(const char *name, std::string& value) const
+{
+    if (m_token != T_START)
+        return false;
+
+    const size_t len = strlen(name);
+    const char *p = m_attrs;
+    const char *end = m_attrs + m_attrsLen;
+
+    while (p < end)
+    {
+        if (isWhiteSpace(*p))
+        {
+            p++;
+            continue;
+        }
+
+        // 名前は空白か '=' まで
+        const char *an = p;
+        while (p < end && *p != '=' && !isWhiteSpace(*p))
+            p++;
+        const size_t anLen = p - an;
+
+        while (p < end && (isWhiteSpace(*p) || *p == '='))
+            p++;
+
+        if (p == end || *p != '\"')
+            throw StreamException("Bad tag value");
+
+        const char *av = ++p;
+        while (p < end && *p != '\"')
+            p++;
+        const size_t avLen = p - av;
+        if (p < end)
+            p++;
+
+        if (anLen == len && Sys::strnicmp(an, name, len) == 0)
+        {
+            value.assign(av, avLen);
+            return true;
+        }
+    }
+    return false;
+}
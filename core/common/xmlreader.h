@@ -0,0 +1,67 @@
+// ------------------------------------------------
+// File : xmlreader.h
+// Desc:
+//      文字列から XML を先頭から順に読む。XML::read() と違って木を作
+//      らず、next() で一つずつタグと本文を返す。名前と属性は元の文字
+//      列を指したまま調べるので、読むだけなら確保は起こらない。
+//
+//      受け付ける文法は XML::read() と同じで、属性の値は二重引用符で
+//      囲まれていなければならない。文字実体参照の解決はしない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _XMLREADER_H
+#define _XMLREADER_H
+
+#include <cstddef>
+#include <string>
+
+// ------------------------------------
+class XMLReader
+{
+public:
+    enum Token
+    {
+        T_EOF,
+        T_START,    // <name ...> と <name .../>
+        T_END,      // </name>。<name .../> の後にも返す。
+        T_TEXT,
+    };
+
+    XMLReader(const char *data, size_t len);
+    XMLReader(const std::string& data);
+    XMLReader(std::string&&) = delete;  // 読んでいる間 data は生きていなければならない
+
+    // 次のタグか本文を読む。おかしなところがあれば StreamException。
+    Token       next();
+
+    // T_START と T_END の名前を大文字小文字を区別せずに比べる。
+    bool        nameIs(const char *name) const;
+    std::string name() const;
+
+    // T_TEXT の本文。
+    std::string text() const;
+
+    // T_START の属性を value に入れる。無ければ false。
+    bool        attr(const char *name, std::string& value) const;
+
+private:
+    const char  *m_p, *m_end;
+
+    Token       m_token;
+    const char  *m_name;    size_t m_nameLen;   // 名前か本文
+    const char  *m_attrs;   size_t m_attrsLen;  // 名前に続く属性の部分
+    bool        m_pendingEnd;                   // <name/> の T_END がまだ
+};
+
+#endif
@@ -0,0 +1,137 @@
+// ------------------------------------------------
+// File : xmlwriter.cpp
+// Desc:
+//      書式は XML::Node::write() に合わせている。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <stdio.h>
+
+#include "xmlwriter.h"
+#include "stream.h"
+
+// バッファがこれを超えたら Stream に流す。
+static const size_t FLUSH_THRESHOLD = 16 * 1024;
+
+// ------------------------------------
+XMLWriter::XMLWriter(Stream& out)
+    : m_out(out)
+    , m_inStartTag(false)
+{
+    m_buf.reserve(FLUSH_THRESHOLD * 2);
+}
+
+// ------------------------------------
+void XMLWriter::declaration()
+{
+    m_buf += "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n";
+}
+
+// ------------------------------------
+// 親の開始タグを閉じてから子を書く。
+void XMLWriter::endStartTag()
+{
+    if (m_inStartTag)
+    {
+        m_buf += ">\n";
+        m_inStartTag = false;
+    }
+}
+
+// ------------------------------------
+// "<" に続けて、書式を展開した名前と属性を書く。名前の位置を返す。
+size_t XMLWriter::tag(const char *fmt, va_list ap)
+{
+    va_list aq;
+    va_copy(aq, ap);
+
+    endStartTag();
+    m_buf += '<';
+    const size_t start = m_buf.size();
+    char tmp[1024];
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    if (n < 0)
+        n = 0;
+    if ((size_t) n < sizeof(tmp))
+        m_buf.append(tmp, n);
+    else
+    {
+        m_buf.resize(start + n + 1);
+        vsnprintf(&m_buf[start], n + 1, fmt, aq);
+        m_buf.resize(start + n);
+    }
+    va_end(aq);
+    return start;
+}
+
+// ------------------------------------
+void XMLWriter::open(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    const size_t start = tag(fmt, ap);
+    va_end(ap);
+
+    // 名前は最初の空白まで。
+    size_t end = m_buf.find_first_of(" \t\r\n", start);
+    if (end == std::string::npos)
+        end = m_buf.size();
+    m_names.push_back(m_buf.substr(start, end - start));
+    m_inStartTag = true;
+}
+
+// ------------------------------------
+void XMLWriter::close()
+{
+    if (m_names.empty())
+        throw StreamException("XMLWriter: close() without open()");
+
+    if (m_inStartTag)
+    {
+        m_buf += "/>\n";
+        m_inStartTag = false;
+    }else
+    {
+        m_buf += "</";
+        m_buf += m_names.back();
+        m_buf += ">\n";
+    }
+    m_names.pop_back();
+
+    if (m_buf.size() >= FLUSH_THRESHOLD)
+        flush();
+}
+
+// ------------------------------------
+void XMLWriter::empty(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    tag(fmt, ap);
+    va_end(ap);
+
+    m_buf += "/>\n";
+
+    if (m_buf.size() >= FLUSH_THRESHOLD)
+        flush();
+}
+
+// ------------------------------------
+void XMLWriter::flush()
+{
+    if (m_buf.empty())
+        return;
+
+    m_out.write(m_buf.data(), m_buf.size());
+    m_buf.clear();
+}
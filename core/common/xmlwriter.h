@@ -0,0 +1,65 @@
+// ------------------------------------------------
+// File : xmlwriter.h
+// Desc:
+//      XML を Stream に直接書き出す。XML::Node の木を組み立ててから
+//      write() する代わりに使う。出力は XML::write() と同じ書式になる。
+//
+//      タグは XML::Node のコンストラクタと同じく、名前と属性を並べた
+//      書式文字列で与える。書いたものは一つのバッファに溜めて、ある程
+//      度溜まったところで Stream に流す。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _XMLWRITER_H
+#define _XMLWRITER_H
+
+#include <stdarg.h>
+#include <string>
+#include <vector>
+
+class Stream;
+
+// ------------------------------------
+class XMLWriter
+{
+public:
+    XMLWriter(Stream& out);
+
+    // <?xml ... ?> の宣言を書く。
+    void    declaration();
+
+    // 要素を開く。close() で閉じる。子を書かずに閉じれば <name .../>
+    // になる。
+    void    open(const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+    void    close();
+
+    // 子を持たない要素を書く。
+    void    empty(const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+
+    // 溜まっているものを Stream に書く。最後に必ず呼ぶ。
+    void    flush();
+
+    // 全ての要素を閉じた。
+    bool    done() const { return m_names.empty(); }
+
+private:
+    size_t  tag(const char *fmt, va_list ap);
+    void    endStartTag();
+
+    Stream&                     m_out;
+    std::string                 m_buf;
+    std::vector<std::string>    m_names;    // 開いている要素の名前
+    bool                        m_inStartTag;   // 開いた要素の '>' がまだ
+};
+
+#endif
@@ -0,0 +1,147 @@
+// ------------------------------------------------
+// File : ypsession.cpp
+// Desc:
+//      YP との COUT 接続の繋ぎ直しの間隔と、トラッカー更新のまとめ方。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <algorithm>
+
+#include "ypsession.h"
+
+YPSession g_ypSession;
+
+// ------------------------------------
+YPSession::YPSession()
+{
+    reset();
+}
+
+// ------------------------------------
+void YPSession::reset()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_failures = 0;
+    m_lastAttempt = 0;
+    m_connected = false;
+    m_connectedAt = 0;
+    m_pending = false;
+    m_forced = false;
+    m_requestedAt = 0;
+    m_lastUpdate = 0;
+    m_numRequests = 0;
+    m_numUpdates = 0;
+    m_numConnects = 0;
+}
+
+// ------------------------------------
+// 失敗が続いた回数から待ち時間を決める。
+static unsigned int backoffFor(unsigned int failures)
+{
+    unsigned int delay = YPSession::MIN_BACKOFF;
+    for (unsigned int i = 0; i < failures && delay < YPSession::MAX_BACKOFF; i++)
+        delay *= 2;
+    return std::min<unsigned int>(delay, YPSession::MAX_BACKOFF);
+}
+
+// ------------------------------------
+unsigned int YPSession::backoff()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return backoffFor(m_failures);
+}
+
+// ------------------------------------
+bool YPSession::canConnect(unsigned int now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    if (m_connected)
+        return false;
+    return m_lastAttempt == 0 || now - m_lastAttempt >= backoffFor(m_failures);
+}
+
+// ------------------------------------
+void YPSession::onConnecting(unsigned int now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_lastAttempt = now;
+}
+
+// ------------------------------------
+void YPSession::onConnected(unsigned int now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_connected = true;
+    m_connectedAt = now;
+    m_numConnects++;
+}
+
+// ------------------------------------
+void YPSession::onDisconnected(unsigned int now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    // 繋がってすぐ切られるのは失敗と同じに数える。
+    if (m_connected && now - m_connectedAt >= STABLE_SECONDS)
+        m_failures = 0;
+    else if (backoffFor(m_failures) < MAX_BACKOFF)
+        m_failures++;
+    m_connected = false;
+    // 待ち時間は切れた時から数える。
+    m_lastAttempt = now;
+}
+
+// ------------------------------------
+void YPSession::requestUpdate(bool force, unsigned int now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    m_numRequests++;
+    m_pending = true;
+    if (force && !m_forced)
+    {
+        m_forced = true;
+        m_requestedAt = now;
+    }
+}
+
+// ------------------------------------
+bool YPSession::takeUpdate(unsigned int now)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    const bool due =
+        (m_forced && now - m_requestedAt >= COALESCE_SECONDS) ||
+        (m_pending && now - m_lastUpdate >= UPDATE_INTERVAL);
+    if (!due)
+        return false;
+
+    m_pending = false;
+    m_forced = false;
+    m_lastUpdate = now;
+    m_numUpdates++;
+    return true;
+}
+
+// ------------------------------------
+amf0::Value YPSession::getState()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return amf0::Value::object(
+        {
+            {"connected", m_connected},
+            {"failures", (int) m_failures},
+            {"backoff", (int) backoffFor(m_failures)},
+            {"pending", m_pending},
+            {"numConnects", (int) m_numConnects},
+            {"numRequests", (int) m_numRequests},
+            {"numUpdates", (int) m_numUpdates},
+        });
+}
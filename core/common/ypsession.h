@@ -0,0 +1,81 @@
+// ------------------------------------------------
+// File : ypsession.h
+// Desc:
+//      YP (ルートサーバー) との COUT 接続を張りっぱなしにする時の制御
+//      (ypSession フラグ)。繋ぎ直しの間隔は失敗が続くと倍々に延ばし、
+//      しばらく続いた接続が切れたら元に戻す。配信中の全チャンネルの
+//      トラッカー更新は一つの要求にまとめ、COUT のスレッドがまとめて
+//      送る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _YPSESSION_H
+#define _YPSESSION_H
+
+#include <mutex>
+
+#include "amf0.h"
+
+// ------------------------------------
+class YPSession
+{
+public:
+    enum
+    {
+        MIN_BACKOFF         = 5,    // 秒
+        MAX_BACKOFF         = 600,
+        STABLE_SECONDS      = 60,   // これより長く続いた接続は成功とみなす
+        UPDATE_INTERVAL     = 30,   // 定期の更新の間隔
+        COALESCE_SECONDS    = 2,    // 急ぎの更新を待ってまとめる秒数
+    };
+
+    YPSession();
+
+    // 繋ぎに行ってよいか。
+    bool            canConnect(unsigned int now);
+
+    void            onConnecting(unsigned int now);
+    void            onConnected(unsigned int now);
+    // 接続が切れた、あるいは繋がらなかった。
+    void            onDisconnected(unsigned int now);
+
+    // 今の失敗の回数での待ち時間。
+    unsigned int    backoff();
+
+    // トラッカー更新を頼む。force なら間隔を待たずに送る。
+    void            requestUpdate(bool force, unsigned int now);
+    // 頼まれている更新を今送るべきなら true を返し、送ったことにする。
+    bool            takeUpdate(unsigned int now);
+
+    void            reset();
+
+    amf0::Value     getState();
+
+private:
+    std::mutex      m_lock;
+    unsigned int    m_failures;
+    unsigned int    m_lastAttempt;
+    bool            m_connected;
+    unsigned int    m_connectedAt;
+    bool            m_pending;
+    bool            m_forced;
+    unsigned int    m_requestedAt;      // 急ぎの更新を最初に頼まれた時刻
+    unsigned int    m_lastUpdate;
+    unsigned int    m_numRequests;
+    unsigned int    m_numUpdates;
+    unsigned int    m_numConnects;
+};
+
+extern YPSession g_ypSession;
+
+#endif
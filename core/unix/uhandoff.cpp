@@ -0,0 +1,176 @@
+// ------------------------------------------------
+// File : uhandoff.cpp
+// Desc:
+//      RestartHandoff のソケットの送受信。古いプロセスと新しいプロセス
+//      は AF_UNIX のストリームソケットでつなぎ、fd は Prefork と同じ
+//      SCM_RIGHTS で送る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "handoff.h"
+#include "usocket.h"
+
+// ------------------------------------
+static bool makeAddress(const std::string& path, sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+    strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+// ------------------------------------
+int RestartHandoff::listenPath(const std::string& path)
+{
+    sockaddr_un addr;
+    if (!makeAddress(path, addr))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    // 前に落ちたプロセスが残したもの。
+    unlink(path.c_str());
+    if (bind(fd, (sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 1) != 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+    // 接続を丸ごと渡すので、同じユーザーにしかつながせない。
+    chmod(path.c_str(), 0600);
+    return fd;
+}
+
+// ------------------------------------
+int RestartHandoff::acceptPath(int fd, int timeoutMsec)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, timeoutMsec) <= 0)
+        return -1;
+
+    int conn = accept(fd, nullptr, nullptr);
+    if (conn >= 0)
+        fcntl(conn, F_SETFD, FD_CLOEXEC);
+    return conn;
+}
+
+// ------------------------------------
+int RestartHandoff::connectPath(const std::string& path)
+{
+    sockaddr_un addr;
+    if (!makeAddress(path, addr))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (connect(fd, (sockaddr*) &addr, sizeof(addr)) != 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// ------------------------------------
+void RestartHandoff::closeFd(int fd)
+{
+    ::close(fd);
+}
+
+// ------------------------------------
+bool RestartHandoff::sendMessage(int fd, const std::string& data)
+{
+    std::string buf = std::to_string(data.size()) + "\n" + data;
+    size_t off = 0;
+    while (off < buf.size())
+    {
+        ssize_t n = send(fd, buf.data() + off, buf.size() - off, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        off += n;
+    }
+    return true;
+}
+
+// ------------------------------------
+// fd が付いて来る後続のバイトを読んでしまわないように、ちょうどの長さ
+// だけ読む。
+static bool readExactly(int fd, char* buf, size_t len, int timeoutMsec)
+{
+    size_t off = 0;
+    while (off < len)
+    {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeoutMsec) <= 0)
+            return false;
+
+        ssize_t n = recv(fd, buf + off, len - off, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        off += n;
+    }
+    return true;
+}
+
+// ------------------------------------
+bool RestartHandoff::recvMessage(int fd, std::string& data, int timeoutMsec)
+{
+    std::string head;
+    char c;
+    while (true)
+    {
+        if (!readExactly(fd, &c, 1, timeoutMsec))
+            return false;
+        if (c == '\n')
+            break;
+        if (!isdigit((unsigned char) c) || head.size() > 10)
+            return false;
+        head += c;
+    }
+
+    size_t len = strtoul(head.c_str(), nullptr, 10);
+    data.resize(len);
+    return len == 0 || readExactly(fd, &data[0], len, timeoutMsec);
+}
+
+// ------------------------------------
+std::shared_ptr<ClientSocket> RestartHandoff::adoptListener(int fd, const Host& host)
+{
+    auto cs = std::make_shared<UClientSocket>();
+    cs->sockNum = fd;
+    cs->host = host;
+    cs->setBlocking(false);
+    return cs;
+}
@@ -0,0 +1,235 @@
+// ------------------------------------------------
+// File : uprefork.cpp
+// Desc:
+//      Prefork の fork とソケットの受け渡し。ワーカーごとに AF_UNIX の
+//      データグラムソケットの組を作っておき、SCM_RIGHTS で fd を送る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "prefork.h"
+#include "usocket.h"
+
+// ------------------------------------
+int Prefork::run(int n, std::function<bool()> quitRequested)
+{
+    if (n > MAX_WORKERS)
+        n = MAX_WORKERS;
+    if (n <= 1)
+        return 0;
+
+    m_recv.assign(n, -1);
+    m_send.assign(n, -1);
+    for (int i = 0; i < n; i++)
+    {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) != 0)
+        {
+            perror("socketpair");
+            return -1;
+        }
+        // CGI などの子プロセスには渡さない。
+        fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+        fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+        m_recv[i] = sv[0];
+        m_send[i] = sv[1];
+    }
+
+    std::vector<pid_t> pids(n, -1);
+    for (int i = 0; i < n; i++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            m_index = i;
+            m_numWorkers = n;
+            return i;
+        }
+        if (pid < 0)
+            perror("fork");
+        pids[i] = pid;
+    }
+    fprintf(stderr, "Started %d worker processes\n", n);
+
+    while (!quitRequested())
+    {
+        int status;
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+        if (pid <= 0)
+        {
+            usleep(100 * 1000);
+            continue;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            if (pids[i] != pid)
+                continue;
+
+            fprintf(stderr, "Worker %d (pid %d) exited with status %d. Restarting\n", i, (int) pid, status);
+            pids[i] = -1;
+            // すぐに落ちるワーカーを起動し続けないように。
+            sleep(1);
+            if (quitRequested())
+                break;
+
+            pid_t npid = fork();
+            if (npid == 0)
+            {
+                m_index = i;
+                m_numWorkers = n;
+                return i;
+            }
+            if (npid < 0)
+                perror("fork");
+            pids[i] = npid;
+        }
+    }
+
+    for (auto pid : pids)
+        if (pid > 0)
+            kill(pid, SIGTERM);
+    for (auto pid : pids)
+        if (pid > 0)
+            waitpid(pid, nullptr, 0);
+    return -1;
+}
+
+// ------------------------------------
+bool Prefork::sendSocket(int chan, int fd)
+{
+    char dummy = 0;
+    struct iovec iov = { &dummy, 1 };
+
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    if (sendmsg(chan, &msg, MSG_DONTWAIT) != 1)
+        return false;
+
+    // 受け取った側が同じ接続を持っているので、shutdown せずに閉じる。
+    ::close(fd);
+    return true;
+}
+
+// ------------------------------------
+int Prefork::recvSocket(int chan, int timeoutMsec)
+{
+    struct pollfd pfd = { chan, POLLIN, 0 };
+    if (poll(&pfd, 1, timeoutMsec) <= 0)
+        return -1;
+
+    char dummy;
+    struct iovec iov = { &dummy, 1 };
+
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    if (recvmsg(chan, &msg, MSG_DONTWAIT) != 1)
+        return -1;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        return -1;
+
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+// ------------------------------------
+std::string Prefork::peekLine(int fd, int timeoutMsec)
+{
+    char buf[PEEK_MAX];
+    int waited = 0;
+
+    while (true)
+    {
+        ssize_t len = recv(fd, buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
+        if (len > 0)
+        {
+            auto end = (const char*) memchr(buf, '\n', len);
+            if (end)
+            {
+                std::string line((const char*) buf, end);
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                return line;
+            }
+            if (len == (ssize_t) sizeof(buf))
+                return std::string(buf, len);
+        }else if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            return "";
+
+        // 覗いたデータは読み出さないので、poll では次のデータを待て
+        // ない。少しずつ待つ。
+        if (waited >= timeoutMsec)
+            return len > 0 ? std::string(buf, len) : "";
+        usleep(10 * 1000);
+        waited += 10;
+    }
+}
+
+// ------------------------------------
+std::shared_ptr<ClientSocket> Prefork::adoptSocket(int fd)
+{
+    sockaddr_in6 from = {};
+    socklen_t fromSize = sizeof(from);
+    if (getpeername(fd, (sockaddr*) &from, &fromSize) != 0)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    auto cs = std::make_shared<UClientSocket>();
+    cs->sockNum = fd;
+    cs->host.port = ntohs(from.sin6_port);
+    cs->host.ip = IP(from.sin6_addr);
+    cs->setBlocking(false);
+    return cs;
+}
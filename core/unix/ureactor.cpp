@@ -0,0 +1,369 @@
+// ------------------------------------------------
+// File : ureactor.cpp
+// Desc:
+//      Reactor の Unix 実装。
+//
+//      ファイル記述子はワンショットで登録し、ハンドラーの実行が終わっ
+//      てから再び有効にする。これで同じハンドルのイベントが複数のワー
+//      カーに同時に配られることがなくなる。post() されたハンドルはキュー
+//      に積んでパイプでワーカーを起こす。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#ifdef __APPLE__
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#else
+#include <sys/epoll.h>
+#endif
+
+#include "ureactor.h"
+#include "sys.h"
+#include "str.h"
+#include "strerror.h"
+#include "common.h"
+
+// wake パイプの読み出し側に付けるハンドル。
+static const uint64_t WAKE_ID = 0;
+
+static const int MAX_EVENTS = 64;
+
+// ------------------------------------
+UReactor::UReactor(int numWorkers)
+    : m_nextID(1)
+    , m_lastTick(std::chrono::steady_clock::now())
+    , m_running(true)
+{
+    if (pipe(m_wakeFds) == -1)
+        throw GeneralException(str::format("pipe: %s", str::strerror(errno).c_str()));
+    for (int fd : m_wakeFds)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+#ifdef __APPLE__
+    m_pollfd = kqueue();
+    if (m_pollfd == -1)
+        throw GeneralException(str::format("kqueue: %s", str::strerror(errno).c_str()));
+
+    struct kevent kev;
+    EV_SET(&kev, m_wakeFds[0], EVFILT_READ, EV_ADD, 0, 0, (void*) (uintptr_t) WAKE_ID);
+    kevent(m_pollfd, &kev, 1, nullptr, 0, nullptr);
+#else
+    m_pollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_pollfd == -1)
+        throw GeneralException(str::format("epoll_create1: %s", str::strerror(errno).c_str()));
+
+    // wake パイプはレベルトリガーにして、終了時に全ワーカーを起こす。
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = WAKE_ID;
+    epoll_ctl(m_pollfd, EPOLL_CTL_ADD, m_wakeFds[0], &ev);
+#endif
+
+    for (int i = 0; i < numWorkers; i++)
+    {
+        auto t = std::unique_ptr<ThreadInfo>(new ThreadInfo());
+        t->func = workerProc;
+        t->data = this;
+        t->threadClass = ThreadClass::T_DATA;
+        if (!sys->startWaitableThread(t.get()))
+            break;
+        m_workers.push_back(std::move(t));
+    }
+}
+
+// ------------------------------------
+UReactor::~UReactor()
+{
+    m_running = false;
+    wake();
+    for (auto& t : m_workers)
+        sys->waitThread(t.get());
+
+    close(m_pollfd);
+    close(m_wakeFds[0]);
+    close(m_wakeFds[1]);
+}
+
+// ------------------------------------
+THREAD_PROC UReactor::workerProc(ThreadInfo *thread)
+{
+    sys->setThreadName("REACTOR");
+    static_cast<UReactor*>(thread->data)->run();
+    return 0;
+}
+
+// ------------------------------------
+void UReactor::run()
+{
+    while (m_running)
+    {
+#ifdef __APPLE__
+        struct kevent evs[MAX_EVENTS];
+        struct timespec timeout = { 1, 0 };
+        int n = kevent(m_pollfd, nullptr, 0, evs, MAX_EVENTS, &timeout);
+#else
+        struct epoll_event evs[MAX_EVENTS];
+        int n = epoll_wait(m_pollfd, evs, MAX_EVENTS, 1000);
+#endif
+        if (!m_running)
+            break;
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("Reactor: %s", str::strerror(errno).c_str());
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+#ifdef __APPLE__
+            uint64_t id = (uint64_t) (uintptr_t) evs[i].udata;
+            int events = 0;
+            if (evs[i].filter == EVFILT_READ)
+                events |= EV_READ;
+            if (evs[i].filter == EVFILT_WRITE)
+                events |= EV_WRITE;
+            if (evs[i].flags & (EV_EOF | EV_ERROR))
+                events |= EV_ERROR;
+#else
+            uint64_t id = evs[i].data.u64;
+            int events = 0;
+            if (evs[i].events & EPOLLIN)
+                events |= EV_READ;
+            if (evs[i].events & EPOLLOUT)
+                events |= EV_WRITE;
+            if (evs[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+                events |= EV_ERROR;
+#endif
+            if (id == WAKE_ID)
+                drainWake();
+            else
+                dispatch(id, events);
+        }
+
+        tick();
+
+        uint64_t id;
+        int events;
+        while (m_running && popPosted(id, events))
+            dispatch(id, events);
+    }
+}
+
+// ------------------------------------
+void UReactor::dispatch(uint64_t id, int events)
+{
+    auto e = find(id);
+    if (!e)
+        return;
+
+    std::lock_guard<std::mutex> running(e->running);
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        if (e->removed)
+            return;
+        if (events & EV_WAKE)
+            e->posted = false;
+    }
+
+    try
+    {
+        e->handler(events);
+    }catch (std::exception& ex)
+    {
+        LOG_ERROR("Reactor handler: %s", ex.what());
+    }
+
+    // ポーリングで届いたイベントはワンショットなので有効にし直す。
+    if (events & (EV_READ | EV_WRITE | EV_ERROR))
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        if (!e->removed)
+            arm(*e, false);
+    }
+}
+
+// ------------------------------------
+void UReactor::arm(const Entry& e, bool first)
+{
+#ifdef __APPLE__
+    struct kevent kev[2];
+    void* udata = (void*) (uintptr_t) e.id;
+
+    EV_SET(&kev[0], e.fd, EVFILT_READ,
+           (e.events & EV_READ) ? (EV_ADD | EV_DISPATCH) : EV_DELETE, 0, 0, udata);
+    EV_SET(&kev[1], e.fd, EVFILT_WRITE,
+           (e.events & EV_WRITE) ? (EV_ADD | EV_DISPATCH) : EV_DELETE, 0, 0, udata);
+    // 登録されていないフィルターの EV_DELETE は失敗するので、一つずつ
+    // 適用して結果は無視する。
+    kevent(m_pollfd, &kev[0], 1, nullptr, 0, nullptr);
+    kevent(m_pollfd, &kev[1], 1, nullptr, 0, nullptr);
+    (void) first;
+#else
+    struct epoll_event ev = {};
+    ev.events = EPOLLONESHOT | EPOLLRDHUP;
+    if (e.events & EV_READ)
+        ev.events |= EPOLLIN;
+    if (e.events & EV_WRITE)
+        ev.events |= EPOLLOUT;
+    ev.data.u64 = e.id;
+    if (epoll_ctl(m_pollfd, first ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, e.fd, &ev) == -1)
+        LOG_ERROR("epoll_ctl(%d): %s", e.fd, str::strerror(errno).c_str());
+#endif
+}
+
+// ------------------------------------
+void UReactor::disarm(const Entry& e)
+{
+#ifdef __APPLE__
+    struct kevent kev[2];
+    EV_SET(&kev[0], e.fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+    EV_SET(&kev[1], e.fd, EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
+    kevent(m_pollfd, &kev[0], 1, nullptr, 0, nullptr);
+    kevent(m_pollfd, &kev[1], 1, nullptr, 0, nullptr);
+#else
+    epoll_ctl(m_pollfd, EPOLL_CTL_DEL, e.fd, nullptr);
+#endif
+}
+
+// ------------------------------------
+uint64_t UReactor::add(int fd, int events, Handler handler)
+{
+    auto e = std::make_shared<Entry>();
+    e->fd = fd;
+    e->events = events;
+    e->handler = handler;
+    e->removed = false;
+    e->posted = false;
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    e->id = m_nextID++;
+    m_entries[e->id] = e;
+    arm(*e, true);
+    return e->id;
+}
+
+// ------------------------------------
+void UReactor::modify(uint64_t id, int events)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_entries.find(id);
+    if (it == m_entries.end())
+        return;
+
+    it->second->events = events;
+    arm(*it->second, false);
+}
+
+// ------------------------------------
+void UReactor::remove(uint64_t id)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_entries.find(id);
+    if (it == m_entries.end())
+        return;
+
+    it->second->removed = true;
+    disarm(*it->second);
+    m_entries.erase(it);
+}
+
+// ------------------------------------
+void UReactor::post(uint64_t id)
+{
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        auto it = m_entries.find(id);
+        if (it == m_entries.end() || it->second->posted)
+            return;
+
+        it->second->posted = true;
+        m_posted.push_back({ id, EV_WAKE });
+    }
+    wake();
+}
+
+// ------------------------------------
+size_t UReactor::numHandlers()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_entries.size();
+}
+
+// ------------------------------------
+std::shared_ptr<UReactor::Entry> UReactor::find(uint64_t id)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_entries.find(id);
+    if (it == m_entries.end())
+        return nullptr;
+    return it->second;
+}
+
+// ------------------------------------
+bool UReactor::popPosted(uint64_t& id, int& events)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    if (m_posted.empty())
+        return false;
+
+    id = m_posted.front().first;
+    events = m_posted.front().second;
+    m_posted.pop_front();
+    return true;
+}
+
+// ------------------------------------
+void UReactor::tick()
+{
+    auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        if (now - m_lastTick < std::chrono::seconds(1))
+            return;
+
+        m_lastTick = now;
+        for (auto& it : m_entries)
+            m_posted.push_back({ it.first, EV_TICK });
+        if (m_posted.empty())
+            return;
+    }
+    wake();
+}
+
+// ------------------------------------
+void UReactor::wake()
+{
+    char c = 0;
+    // パイプが一杯なら既に起こされているので失敗してよい。
+    if (write(m_wakeFds[1], &c, 1) == -1 && errno != EAGAIN)
+        LOG_ERROR("Reactor wake: %s", str::strerror(errno).c_str());
+}
+
+// ------------------------------------
+void UReactor::drainWake()
+{
+    char buf[256];
+    while (read(m_wakeFds[0], buf, sizeof(buf)) > 0)
+        ;
+}
@@ -0,0 +1,84 @@
+// ------------------------------------------------
+// File : ureactor.h
+// Desc:
+//      Reactor の Unix 実装。Linux では epoll、macOS では kqueue を使う。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _UREACTOR_H
+#define _UREACTOR_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "reactor.h"
+#include "threading.h"
+
+// ------------------------------------
+class UReactor : public Reactor
+{
+public:
+    UReactor(int numWorkers);
+    ~UReactor();
+
+    uint64_t    add(int fd, int events, Handler handler) override;
+    void        modify(uint64_t id, int events) override;
+    void        remove(uint64_t id) override;
+    void        post(uint64_t id) override;
+
+    size_t      numHandlers() override;
+    int         numWorkers() override { return (int) m_workers.size(); }
+
+private:
+    struct Entry
+    {
+        uint64_t    id;
+        int         fd;
+        int         events;
+        Handler     handler;
+        std::mutex  running;    // ハンドラーの実行中に保持する
+        bool        removed;
+        bool        posted;     // EV_WAKE が m_posted に入っている
+    };
+
+    static THREAD_PROC workerProc(ThreadInfo *thread);
+    void    run();
+    void    dispatch(uint64_t id, int events);
+    void    arm(const Entry& e, bool first);
+    void    disarm(const Entry& e);
+    void    wake();
+    void    drainWake();
+    void    tick();
+
+    std::shared_ptr<Entry> find(uint64_t id);
+    bool    popPosted(uint64_t& id, int& events);
+
+    int                 m_pollfd;       // epoll または kqueue
+    int                 m_wakeFds[2];   // post() と終了通知のためのパイプ
+
+    std::mutex          m_lock;
+    std::map<uint64_t, std::shared_ptr<Entry>> m_entries;
+    uint64_t            m_nextID;
+    std::deque<std::pair<uint64_t,int>> m_posted;
+    std::chrono::steady_clock::time_point m_lastTick;
+
+    std::atomic<bool>   m_running;
+    std::vector<std::unique_ptr<ThreadInfo>> m_workers;
+};
+
+#endif
@@ -0,0 +1,594 @@
+// ------------------------------------------------
+// File : uringreactor.cpp
+// Desc:
+//      Reactor の io_uring 実装。
+//
+//      ポーリングスレッドが一本だけリングの完了を刈り取り、準備ので
+//      きたハンドルをキューに積んでワーカーに配る。監視は UReactor と
+//      同じくワンショットの POLL_ADD で、ハンドラーが終わってから出し
+//      直す。ワーカーは SQE を書くだけで、カーネルへの提出はポーリング
+//      スレッドが次に待つ時にまとめて行う。待っている最中なら eventfd
+//      で起こす。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "uringreactor.h"
+#include "sys.h"
+#include "str.h"
+#include "strerror.h"
+#include "common.h"
+
+// POLL_ADD 以外の SQE に付ける user_data。ハンドルのトークンはこれより
+// 大きい。
+static const uint64_t WAKE_TAG = 1;     // eventfd の POLL_ADD
+static const uint64_t TICK_TAG = 2;     // 1 秒ごとの TIMEOUT
+static const uint64_t CANCEL_TAG = 3;   // POLL_REMOVE
+static const uint64_t FIRST_TOKEN = 16;
+
+// ------------------------------------
+static int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+// ------------------------------------
+static int io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+// ------------------------------------
+static uint32_t pollMask(uint32_t mask)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    mask = (mask << 16) | (mask >> 16);
+#endif
+    return mask;
+}
+
+// ------------------------------------
+UringReactor::UringReactor(int numWorkers)
+    : m_ringfd(-1)
+    , m_eventfd(-1)
+    , m_sqPtr(MAP_FAILED)
+    , m_cqPtr(MAP_FAILED)
+    , m_sqes(nullptr)
+    , m_sqLocalTail(0)
+    , m_toSubmit(0)
+    , m_pollerWaiting(false)
+    , m_eventfdValue(0)
+    , m_nextID(1)
+    , m_nextToken(FIRST_TOKEN)
+    , m_lastTick(std::chrono::steady_clock::now())
+    , m_running(true)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_ringfd = io_uring_setup(RING_ENTRIES, &p);
+    if (m_ringfd == -1)
+        throw GeneralException(str::format("io_uring_setup: %s", str::strerror(errno).c_str()));
+
+    m_sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+
+    m_sqPtr = mmap(nullptr, m_sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQ_RING);
+    if (m_sqPtr == MAP_FAILED)
+    {
+        int err = errno;
+        close(m_ringfd);
+        throw GeneralException(str::format("mmap(SQ): %s", str::strerror(err).c_str()));
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        m_cqPtr = m_sqPtr;
+    else
+    {
+        m_cqPtr = mmap(nullptr, m_cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_CQ_RING);
+        if (m_cqPtr == MAP_FAILED)
+        {
+            int err = errno;
+            munmap(m_sqPtr, m_sqSize);
+            close(m_ringfd);
+            throw GeneralException(str::format("mmap(CQ): %s", str::strerror(err).c_str()));
+        }
+    }
+
+    m_sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        int err = errno;
+        if (m_cqPtr != m_sqPtr)
+            munmap(m_cqPtr, m_cqSize);
+        munmap(m_sqPtr, m_sqSize);
+        close(m_ringfd);
+        throw GeneralException(str::format("mmap(SQEs): %s", str::strerror(err).c_str()));
+    }
+    m_sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(m_sqPtr);
+    m_sqHead  = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    m_sqTail  = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    m_sqMask  = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    char* cq = static_cast<char*>(m_cqPtr);
+    m_cqHead  = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    m_cqTail  = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    m_cqMask  = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    m_cqes    = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+    m_sqLocalTail = *m_sqTail;
+
+    m_eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_eventfd == -1)
+    {
+        int err = errno;
+        munmap(m_sqes, m_sqesSize);
+        if (m_cqPtr != m_sqPtr)
+            munmap(m_cqPtr, m_cqSize);
+        munmap(m_sqPtr, m_sqSize);
+        close(m_ringfd);
+        throw GeneralException(str::format("eventfd: %s", str::strerror(err).c_str()));
+    }
+
+    m_tickTimeout.tv_sec = 1;
+    m_tickTimeout.tv_nsec = 0;
+    {
+        std::lock_guard<std::mutex> cs(m_sqLock);
+        armInternal(WAKE_TAG, m_eventfd, POLLIN);
+        armTimeout();
+    }
+
+    m_poller = std::unique_ptr<ThreadInfo>(new ThreadInfo());
+    m_poller->func = pollerProc;
+    m_poller->data = this;
+    m_poller->threadClass = ThreadClass::T_DATA;
+    if (!sys->startWaitableThread(m_poller.get()))
+        m_poller = nullptr;
+
+    for (int i = 0; i < numWorkers; i++)
+    {
+        auto t = std::unique_ptr<ThreadInfo>(new ThreadInfo());
+        t->func = workerProc;
+        t->data = this;
+        t->threadClass = ThreadClass::T_DATA;
+        if (!sys->startWaitableThread(t.get()))
+            break;
+        m_workers.push_back(std::move(t));
+    }
+}
+
+// ------------------------------------
+UringReactor::~UringReactor()
+{
+    m_running = false;
+    wakePoller();
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        m_readyCond.notify_all();
+    }
+    if (m_poller)
+        sys->waitThread(m_poller.get());
+    for (auto& t : m_workers)
+        sys->waitThread(t.get());
+
+    // リングを閉じれば出している POLL_ADD も取り消される。
+    close(m_ringfd);
+    close(m_eventfd);
+    munmap(m_sqes, m_sqesSize);
+    if (m_cqPtr != m_sqPtr)
+        munmap(m_cqPtr, m_cqSize);
+    munmap(m_sqPtr, m_sqSize);
+}
+
+// ------------------------------------
+THREAD_PROC UringReactor::pollerProc(ThreadInfo *thread)
+{
+    sys->setThreadName("REACTOR POLL");
+    static_cast<UringReactor*>(thread->data)->poll();
+    return 0;
+}
+
+// ------------------------------------
+THREAD_PROC UringReactor::workerProc(ThreadInfo *thread)
+{
+    sys->setThreadName("REACTOR");
+    static_cast<UringReactor*>(thread->data)->work();
+    return 0;
+}
+
+// ------------------------------------
+void UringReactor::poll()
+{
+    while (m_running)
+    {
+        submitAndWait(true);
+        if (!m_running)
+            break;
+        reap();
+    }
+}
+
+// ------------------------------------
+// 溜まった SQE を提出し、wait なら完了が一つ以上届くまで待つ。
+void UringReactor::submitAndWait(bool wait)
+{
+    // 先に待つ印を付けてから数えるので、その後に書かれた SQE は
+    // wakePoller() で知らされる。
+    if (wait)
+        m_pollerWaiting = true;
+
+    unsigned n;
+    {
+        std::lock_guard<std::mutex> cs(m_sqLock);
+        n = m_toSubmit;
+        m_toSubmit = 0;
+    }
+
+    int r = io_uring_enter(m_ringfd, n, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+    m_pollerWaiting = false;
+
+    unsigned submitted = (r >= 0) ? std::min((unsigned) r, n) : 0;
+    if (submitted < n)
+    {
+        std::lock_guard<std::mutex> cs(m_sqLock);
+        m_toSubmit += n - submitted;
+    }
+    if (r == -1 && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+        LOG_ERROR("io_uring_enter: %s", str::strerror(errno).c_str());
+}
+
+// ------------------------------------
+void UringReactor::reap()
+{
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+
+    std::vector<std::pair<uint64_t,int>> ready;
+    bool ticked = false;
+    for (; head != tail; head++)
+    {
+        const struct io_uring_cqe& cqe = m_cqes[head & *m_cqMask];
+        uint64_t tag = cqe.user_data;
+        int res = cqe.res;
+
+        if (tag == WAKE_TAG)
+        {
+            while (read(m_eventfd, &m_eventfdValue, sizeof(m_eventfdValue)) > 0)
+                ;
+            std::lock_guard<std::mutex> cs(m_sqLock);
+            armInternal(WAKE_TAG, m_eventfd, POLLIN);
+        }else if (tag == TICK_TAG)
+        {
+            ticked = true;
+            std::lock_guard<std::mutex> cs(m_sqLock);
+            armTimeout();
+        }else if (tag >= FIRST_TOKEN)
+        {
+            std::lock_guard<std::mutex> cs(m_lock);
+            auto it = m_tokens.find(tag);
+            if (it == m_tokens.end())
+                continue;
+            uint64_t id = it->second;
+            m_tokens.erase(it);
+
+            // 取り消した、または出し直した後の古い完了は捨てる。
+            auto eit = m_entries.find(id);
+            if (eit == m_entries.end() || eit->second->token != tag)
+                continue;
+            eit->second->token = 0;
+
+            int events = 0;
+            if (res < 0)
+                events |= EV_ERROR;
+            else
+            {
+                if (res & POLLIN)
+                    events |= EV_READ;
+                if (res & POLLOUT)
+                    events |= EV_WRITE;
+                if (res & (POLLERR | POLLHUP | POLLRDHUP))
+                    events |= EV_ERROR;
+            }
+            ready.push_back({ id, events });
+        }
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+
+    if (!ready.empty())
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        m_ready.insert(m_ready.end(), ready.begin(), ready.end());
+        m_readyCond.notify_all();
+    }
+    if (ticked)
+        tick();
+}
+
+// ------------------------------------
+void UringReactor::work()
+{
+    while (true)
+    {
+        uint64_t id;
+        int events;
+        {
+            std::unique_lock<std::mutex> cs(m_lock);
+            m_readyCond.wait(cs, [this]() { return !m_running || !m_ready.empty(); });
+            if (!m_running)
+                break;
+            id = m_ready.front().first;
+            events = m_ready.front().second;
+            m_ready.pop_front();
+        }
+        dispatch(id, events);
+    }
+}
+
+// ------------------------------------
+void UringReactor::dispatch(uint64_t id, int events)
+{
+    auto e = find(id);
+    if (!e)
+        return;
+
+    std::lock_guard<std::mutex> running(e->running);
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        if (e->removed)
+            return;
+        if (events & EV_WAKE)
+            e->posted = false;
+    }
+
+    try
+    {
+        e->handler(events);
+    }catch (std::exception& ex)
+    {
+        LOG_ERROR("Reactor handler: %s", ex.what());
+    }
+
+    // ポーリングで届いたイベントはワンショットなので出し直す。
+    if (events & (EV_READ | EV_WRITE | EV_ERROR))
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        if (!e->removed)
+            arm(*e);
+    }
+}
+
+// ------------------------------------
+// m_sqLock を持って呼ぶ。空きが無ければその場で提出する。
+io_uring_sqe* UringReactor::getSQE()
+{
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (m_sqLocalTail - head > *m_sqMask)
+    {
+        int r = io_uring_enter(m_ringfd, m_toSubmit, 0, 0);
+        if (r > 0)
+            m_toSubmit -= std::min((unsigned) r, m_toSubmit);
+        head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if (m_sqLocalTail - head > *m_sqMask)
+            return nullptr;
+    }
+
+    unsigned index = m_sqLocalTail & *m_sqMask;
+    io_uring_sqe* sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqArray[index] = index;
+    return sqe;
+}
+
+// ------------------------------------
+// m_sqLock を持って呼ぶ。fd の mask をワンショットで監視する。
+void UringReactor::armInternal(uint64_t userData, int fd, uint32_t mask)
+{
+    io_uring_sqe* sqe = getSQE();
+    if (!sqe)
+    {
+        LOG_ERROR("Reactor: submission queue full");
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = pollMask(mask);
+    sqe->user_data = userData;
+
+    __atomic_store_n(m_sqTail, ++m_sqLocalTail, __ATOMIC_RELEASE);
+    m_toSubmit++;
+}
+
+// ------------------------------------
+// m_sqLock を持って呼ぶ。
+void UringReactor::armTimeout()
+{
+    io_uring_sqe* sqe = getSQE();
+    if (!sqe)
+    {
+        LOG_ERROR("Reactor: submission queue full");
+        return;
+    }
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t) (uintptr_t) &m_tickTimeout;
+    sqe->len = 1;
+    sqe->user_data = TICK_TAG;
+
+    __atomic_store_n(m_sqTail, ++m_sqLocalTail, __ATOMIC_RELEASE);
+    m_toSubmit++;
+}
+
+// ------------------------------------
+// m_lock を持って呼ぶ。
+void UringReactor::arm(Entry& e)
+{
+    if (e.token)
+    {
+        if (e.armedEvents == e.events)
+            return;
+        cancel(e);
+    }
+
+    uint32_t mask = POLLRDHUP;
+    if (e.events & EV_READ)
+        mask |= POLLIN;
+    if (e.events & EV_WRITE)
+        mask |= POLLOUT;
+
+    e.token = m_nextToken++;
+    e.armedEvents = e.events;
+    m_tokens[e.token] = e.id;
+    {
+        std::lock_guard<std::mutex> cs(m_sqLock);
+        armInternal(e.token, e.fd, mask);
+    }
+    if (m_pollerWaiting)
+        wakePoller();
+}
+
+// ------------------------------------
+// m_lock を持って呼ぶ。出している POLL_ADD を取り消す。取り消さないと
+// カーネルがファイルを掴んだままになる。
+void UringReactor::cancel(Entry& e)
+{
+    if (!e.token)
+        return;
+
+    {
+        std::lock_guard<std::mutex> cs(m_sqLock);
+        io_uring_sqe* sqe = getSQE();
+        if (sqe)
+        {
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = e.token;
+            sqe->user_data = CANCEL_TAG;
+            __atomic_store_n(m_sqTail, ++m_sqLocalTail, __ATOMIC_RELEASE);
+            m_toSubmit++;
+        }else
+            LOG_ERROR("Reactor: submission queue full");
+    }
+    e.token = 0;
+    if (m_pollerWaiting)
+        wakePoller();
+}
+
+// ------------------------------------
+uint64_t UringReactor::add(int fd, int events, Handler handler)
+{
+    auto e = std::make_shared<Entry>();
+    e->fd = fd;
+    e->events = events;
+    e->handler = handler;
+    e->removed = false;
+    e->posted = false;
+    e->token = 0;
+    e->armedEvents = 0;
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    e->id = m_nextID++;
+    m_entries[e->id] = e;
+    arm(*e);
+    return e->id;
+}
+
+// ------------------------------------
+void UringReactor::modify(uint64_t id, int events)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_entries.find(id);
+    if (it == m_entries.end())
+        return;
+
+    it->second->events = events;
+    arm(*it->second);
+}
+
+// ------------------------------------
+void UringReactor::remove(uint64_t id)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_entries.find(id);
+    if (it == m_entries.end())
+        return;
+
+    it->second->removed = true;
+    cancel(*it->second);
+    m_entries.erase(it);
+}
+
+// ------------------------------------
+void UringReactor::post(uint64_t id)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_entries.find(id);
+    if (it == m_entries.end() || it->second->posted)
+        return;
+
+    it->second->posted = true;
+    m_ready.push_back({ id, EV_WAKE });
+    m_readyCond.notify_one();
+}
+
+// ------------------------------------
+size_t UringReactor::numHandlers()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_entries.size();
+}
+
+// ------------------------------------
+std::shared_ptr<UringReactor::Entry> UringReactor::find(uint64_t id)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_entries.find(id);
+    if (it == m_entries.end())
+        return nullptr;
+    return it->second;
+}
+
+// ------------------------------------
+void UringReactor::tick()
+{
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> cs(m_lock);
+    if (now - m_lastTick < std::chrono::milliseconds(900))
+        return;
+
+    m_lastTick = now;
+    for (auto& it : m_entries)
+        m_ready.push_back({ it.first, EV_TICK });
+    m_readyCond.notify_all();
+}
+
+// ------------------------------------
+void UringReactor::wakePoller()
+{
+    uint64_t one = 1;
+    if (write(m_eventfd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+        LOG_ERROR("Reactor wake: %s", str::strerror(errno).c_str());
+}
+
+#endif // __linux__
@@ -0,0 +1,134 @@
+// ------------------------------------------------
+// File : uringreactor.h
+// Desc:
+//      Reactor の io_uring 実装 (Linux のみ)。
+//
+//      監視の登録・変更は、ポーリングスレッドが完了を待つ時にまとめて
+//      カーネルに渡すので、epoll_ctl のようにイベントごとにシステムコー
+//      ルを呼ばない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _URINGREACTOR_H
+#define _URINGREACTOR_H
+
+#ifdef __linux__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <linux/time_types.h>
+
+#include "reactor.h"
+#include "threading.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// ------------------------------------
+class UringReactor : public Reactor
+{
+public:
+    // io_uring が使えなければ GeneralException を投げる。
+    UringReactor(int numWorkers);
+    ~UringReactor();
+
+    uint64_t    add(int fd, int events, Handler handler) override;
+    void        modify(uint64_t id, int events) override;
+    void        remove(uint64_t id) override;
+    void        post(uint64_t id) override;
+
+    size_t      numHandlers() override;
+    int         numWorkers() override { return (int) m_workers.size(); }
+
+private:
+    enum { RING_ENTRIES = 1024 };
+
+    struct Entry
+    {
+        uint64_t    id;
+        int         fd;
+        int         events;
+        Handler     handler;
+        std::mutex  running;    // ハンドラーの実行中に保持する
+        bool        removed;
+        bool        posted;     // EV_WAKE が m_ready に入っている
+        uint64_t    token;      // 出している POLL_ADD の user_data。0 なら無い
+        int         armedEvents;
+    };
+
+    static THREAD_PROC pollerProc(ThreadInfo *thread);
+    static THREAD_PROC workerProc(ThreadInfo *thread);
+    void    poll();
+    void    work();
+    void    dispatch(uint64_t id, int events);
+    void    arm(Entry& e);
+    void    cancel(Entry& e);
+    void    tick();
+
+    io_uring_sqe* getSQE();
+    void    submitAndWait(bool wait);
+    void    armInternal(uint64_t userData, int fd, uint32_t mask);
+    void    armTimeout();
+    void    wakePoller();
+    void    reap();
+
+    std::shared_ptr<Entry> find(uint64_t id);
+
+    // リング
+    int                 m_ringfd;
+    int                 m_eventfd;      // 追加の SQE や終了をポーリングスレッドに知らせる
+    void*               m_sqPtr;
+    size_t              m_sqSize;
+    void*               m_cqPtr;
+    size_t              m_cqSize;
+    io_uring_sqe*       m_sqes;
+    size_t              m_sqesSize;
+    unsigned*           m_sqHead;
+    unsigned*           m_sqTail;
+    unsigned*           m_sqMask;
+    unsigned*           m_sqArray;
+    unsigned*           m_cqHead;
+    unsigned*           m_cqTail;
+    unsigned*           m_cqMask;
+    io_uring_cqe*       m_cqes;
+    unsigned            m_sqLocalTail;
+    unsigned            m_toSubmit;     // 書いたがまだ提出していない SQE の数
+    std::mutex          m_sqLock;
+    std::atomic<bool>   m_pollerWaiting;
+    uint64_t            m_eventfdValue; // 読み出し先
+    struct __kernel_timespec m_tickTimeout;
+
+    std::mutex          m_lock;
+    std::condition_variable m_readyCond;
+    std::map<uint64_t, std::shared_ptr<Entry>> m_entries;
+    uint64_t            m_nextID;
+    uint64_t            m_nextToken;
+    std::map<uint64_t, uint64_t> m_tokens;  // 完了待ちの POLL_ADD → ハンドル
+    std::deque<std::pair<uint64_t,int>> m_ready;
+    std::chrono::steady_clock::time_point m_lastTick;
+
+    std::atomic<bool>   m_running;
+    std::unique_ptr<ThreadInfo> m_poller;
+    std::vector<std::unique_ptr<ThreadInfo>> m_workers;
+};
+
+#endif // __linux__
+
+#endif
@@ -0,0 +1,74 @@
+// ------------------------------------------------
+// File : ushmring.cpp
+// Desc:
+//      ShmRing の共有メモリーを POSIX の shm_open と mmap で確保する。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmring.h"
+
+// ------------------------------------
+void* ShmRing::mapShared(const std::string& name, size_t& size, bool create)
+{
+    int fd;
+    if (create)
+    {
+        // 前に落ちたプロセスが残したもの。
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0)
+            return nullptr;
+        if (ftruncate(fd, size) != 0)
+        {
+            ::close(fd);
+            shm_unlink(name.c_str());
+            return nullptr;
+        }
+    }else
+    {
+        fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0)
+            return nullptr;
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            return nullptr;
+        }
+        size = st.st_size;
+    }
+
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        if (create)
+            shm_unlink(name.c_str());
+        return nullptr;
+    }
+    return p;
+}
+
+// ------------------------------------
+void ShmRing::unmapShared(const std::string& name, void* p, size_t size, bool remove)
+{
+    if (p)
+        munmap(p, size);
+    if (remove)
+        shm_unlink(name.c_str());
+}
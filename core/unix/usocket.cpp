@@ -24,6 +24,10 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <algorithm>
 #include <errno.h>
 #include "usocket.h"
 #include "stats.h"
@@ -49,41 +53,6 @@ void UClientSocket::init()
     LOG_DEBUG("LStartup:  OK");
 }
 
-// --------------------------------------------------
-// gethostbyname/gethostbyaddr のデータへのアクセスをシリアライズするためのロック。
-static std::recursive_mutex staticDataLock;
-
-// --------------------------------------------------
-unsigned int ClientSocket::getIP(const char *name)
-{
-    std::lock_guard<std::recursive_mutex> cs(staticDataLock);
-
-    char szHostName[256];
-
-    if (!name)
-    {
-        if (gethostname(szHostName, sizeof(szHostName))==0)
-            name = szHostName;
-        else
-            return 0;
-    }
-
-    hostent *he = UClientSocket::resolveHost(name);
-
-    if (!he)
-        return 0;
-
-    char* lpAddr = he->h_addr_list[0];
-    if (lpAddr)
-    {
-        struct in_addr  inAddr;
-        memmove (&inAddr, lpAddr, 4);
-
-        return ntohl(inAddr.s_addr);
-    }
-    return 0;
-}
-
 // --------------------------------------------------
 void UClientSocket::setLinger(int sec)
 {
@@ -103,6 +72,35 @@ void UClientSocket::setNagle(bool on)
         throw SockException("Unable to set NODELAY");
 }
 
+// --------------------------------------------------
+void UClientSocket::setSendBufferSize(int size)
+{
+    if (setsockopt(sockNum, SOL_SOCKET, SO_SNDBUF, (void*) &size, sizeof(size)) < 0)
+        throw SockException("Unable to set SNDBUF");
+}
+
+// --------------------------------------------------
+void UClientSocket::setNotSentLowWatermark(int bytes)
+{
+#ifdef TCP_NOTSENT_LOWAT
+    if (setsockopt(sockNum, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (void*) &bytes, sizeof(bytes)) < 0)
+        throw SockException("Unable to set NOTSENT_LOWAT");
+#else
+    throw NotImplementedException(__func__);
+#endif
+}
+
+// --------------------------------------------------
+void UClientSocket::setCongestionControl(const char* name)
+{
+#ifdef TCP_CONGESTION
+    if (setsockopt(sockNum, IPPROTO_TCP, TCP_CONGESTION, name, strlen(name)) < 0)
+        throw SockException(std::string("Unable to set congestion control ") + name);
+#else
+    throw NotImplementedException(__func__);
+#endif
+}
+
 // --------------------------------------------------
 void UClientSocket::setBlocking(bool block)
 {
@@ -125,26 +123,6 @@ void UClientSocket::setReuse(bool yes)
         throw SockException("Unable to set REUSE");
 }
 
-// --------------------------------------------------
-hostent *UClientSocket::resolveHost(const char *hostName)
-{
-    hostent *he;
-
-    if ((he = gethostbyname(hostName)) == nullptr)
-    {
-        // if failed, try using gethostbyaddr instead
-
-        unsigned long ip = inet_addr(hostName);
-
-        if (ip == INADDR_NONE)
-            return nullptr;
-
-        if ((he = gethostbyaddr((char *)&ip, sizeof(ip), AF_INET)) == nullptr)
-            return nullptr;
-    }
-    return he;
-}
-
 // --------------------------------------------------
 void UClientSocket::open(const Host &rh)
 {
@@ -178,46 +156,24 @@ void UClientSocket::checkTimeout(bool r, bool w)
     {
         //LOG("checktimeout %d %d", (int)r, (int)w);
 
-        timeval timeout;
-        fd_set read_fds;
-        fd_set write_fds;
-        fd_set except_fds;
-
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 0;
+        // select() は FD_SETSIZE 以上の記述子を扱えないので poll() を使う。
+        struct pollfd pfd = {};
+        pfd.fd = sockNum;
+        pfd.events = w ? POLLOUT : POLLIN;
 
-        FD_ZERO(&write_fds);
-        FD_ZERO(&read_fds);
-        FD_ZERO(&except_fds);
-
-        if (w)
-        {
-            timeout.tv_sec = this->writeTimeout/1000;
-            timeout.tv_usec = this->writeTimeout%1000*1000;
-            FD_SET(sockNum, &write_fds);
-        }
+        unsigned int t = w ? this->writeTimeout : this->readTimeout;
+        int timeout = (t != 0) ? (int) t : -1;
 
-        if (r)
+        int r;
+        do
         {
-            timeout.tv_sec = this->readTimeout/1000;
-            timeout.tv_usec = this->readTimeout%1000*1000;
-            FD_SET(sockNum, &read_fds);
-        }
-
-        FD_SET(sockNum, &except_fds);
-
-        timeval *tp;
-        if (timeout.tv_sec != 0  || timeout.tv_usec != 0)
-            tp = &timeout;
-        else
-            tp = nullptr;
-
-        int r = select(sockNum+1, &read_fds, &write_fds, &except_fds, tp);
+            r = poll(&pfd, 1, timeout);
+        } while (r == SOCKET_ERROR && errno == EINTR);
 
         if (r == 0)
             throw TimeoutException();
         else if (r == SOCKET_ERROR)
-            throw SockException("select failed.");
+            throw SockException("poll failed.");
         else{
             int err;
             socklen_t size = sizeof(int);
@@ -240,30 +196,42 @@ void UClientSocket::connect()
 }
 
 // --------------------------------------------------
-int UClientSocket::read(void *p, int l)
+int UClientSocket::recvOnce(void *p, int l)
 {
-    int bytesRead=0;
-    while (l)
+    while (true)
     {
         int r = recv(sockNum, (char *)p, l, MSG_NOSIGNAL);
         if (r == SOCKET_ERROR)
         {
             // non-blocking sockets always fall through to here
             checkTimeout(true, false);
-        }else if (r == 0)
-        {
-            throw EOFException("Closed on read");
         }else
         {
-            stats.add(Stats::BYTESIN, r);
-            if (host.localIP())
-                stats.add(Stats::LOCALBYTESIN, r);
-            updateTotals(r, 0);
-            bytesRead+=r;
-            l -= r;
-            p = (char *)p+r;
+            if (r > 0)
+            {
+                stats.add(Stats::BYTESIN, r);
+                if (host.localIP())
+                    stats.add(Stats::LOCALBYTESIN, r);
+                updateTotals(r, 0);
+            }
+            return r;
         }
     }
+}
+
+// --------------------------------------------------
+int UClientSocket::read(void *p, int l)
+{
+    int bytesRead=0;
+    while (l)
+    {
+        int r = readBuffered(p, l);
+        if (r == 0)
+            throw EOFException("Closed on read");
+        bytesRead+=r;
+        l -= r;
+        p = (char *)p+r;
+    }
 
     return bytesRead;
 }
@@ -274,57 +242,171 @@ int UClientSocket::readUpto(void *p, int l)
     int bytesRead=0;
     while (l)
     {
-        int r = recv(sockNum, (char *)p, l, MSG_NOSIGNAL);
+        int r = readBuffered(p, l);
+        if (r == 0)
+            break;
+        bytesRead+=r;
+        l -= r;
+        p = (char *)p+r;
+    }
+
+    return bytesRead;
+}
+
+// --------------------------------------------------
+int UClientSocket::readSome(void *p, int l)
+{
+    int r = readBuffered(p, l);
+    if (r == 0)
+        throw EOFException("Closed on read");
+    return r;
+}
+
+// --------------------------------------------------
+void UClientSocket::write(const void *p, int l)
+{
+    while (l)
+    {
+        int r = send(sockNum, (char *)p, l, MSG_DONTWAIT|MSG_NOSIGNAL);
         if (r == SOCKET_ERROR)
         {
             // non-blocking sockets always fall through to here
-            checkTimeout(true, false);
+            checkTimeout(false, true);
         }else if (r == 0)
         {
-            break;
+            throw SockException("Closed on write");
         }else
         {
-            stats.add(Stats::BYTESIN, r);
+            // LOG_DEBUG("UClientSocket: write %d bytes", r);
+            stats.add(Stats::BYTESOUT, r);
             if (host.localIP())
-                stats.add(Stats::LOCALBYTESIN, r);
-            updateTotals(r, 0);
-            bytesRead+=r;
+                stats.add(Stats::LOCALBYTESOUT, r);
+            updateTotals(0, r);
             l -= r;
             p = (char *)p+r;
         }
     }
+}
 
-    return bytesRead;
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// --------------------------------------------------
+// iov の先頭から一度の sendmsg で送り、送ったバイト数を返す。
+static ssize_t sendVector(int sockNum, struct iovec *iov, size_t n)
+{
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = std::min(n, (size_t) IOV_MAX);
+    return sendmsg(sockNum, &msg, MSG_DONTWAIT|MSG_NOSIGNAL);
 }
 
 // --------------------------------------------------
-void UClientSocket::write(const void *p, int l)
+// 送った r バイト分 iov を進める。
+static void advanceVector(std::vector<struct iovec>& iov, size_t& i, size_t r)
 {
-    while (l)
+    while (r > 0)
     {
-        int r = send(sockNum, (char *)p, l, MSG_DONTWAIT|MSG_NOSIGNAL);
+        if (r >= iov[i].iov_len)
+        {
+            r -= iov[i].iov_len;
+            i++;
+        }else
+        {
+            iov[i].iov_base = (char *)iov[i].iov_base + r;
+            iov[i].iov_len -= r;
+            r = 0;
+        }
+    }
+}
+
+// --------------------------------------------------
+static std::vector<struct iovec> toIovec(const Stream::IOVec *vec, int n)
+{
+    std::vector<struct iovec> iov;
+    iov.reserve(n);
+    for (int i = 0; i < n; i++)
+        if (vec[i].len > 0)
+            iov.push_back({ const_cast<void*>(vec[i].data), (size_t) vec[i].len });
+    return iov;
+}
+
+// --------------------------------------------------
+void UClientSocket::writeVector(const IOVec *vec, int n)
+{
+    auto iov = toIovec(vec, n);
+    size_t i = 0;
+    while (i < iov.size())
+    {
+        ssize_t r = sendVector(sockNum, &iov[i], iov.size() - i);
         if (r == SOCKET_ERROR)
         {
-            // non-blocking sockets always fall through to here
             checkTimeout(false, true);
         }else if (r == 0)
         {
             throw SockException("Closed on write");
         }else
         {
-            // LOG_DEBUG("UClientSocket: write %d bytes", r);
             stats.add(Stats::BYTESOUT, r);
             if (host.localIP())
                 stats.add(Stats::LOCALBYTESOUT, r);
             updateTotals(0, r);
-            l -= r;
-            p = (char *)p+r;
+            advanceVector(iov, i, r);
         }
     }
 }
 
+// --------------------------------------------------
+int UClientSocket::tryWrite(const void *p, int l)
+{
+    IOVec vec = { p, l };
+    return tryWriteVector(&vec, 1);
+}
+
+// --------------------------------------------------
+int UClientSocket::tryWriteVector(const IOVec *vec, int n)
+{
+    auto iov = toIovec(vec, n);
+    if (iov.empty())
+        return 0;
+
+    ssize_t r = sendVector(sockNum, iov.data(), iov.size());
+    if (r == SOCKET_ERROR)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
+        throw SockException(str::strerror(errno).c_str());
+    }else if (r == 0)
+    {
+        throw SockException("Closed on write");
+    }
+
+    stats.add(Stats::BYTESOUT, r);
+    if (host.localIP())
+        stats.add(Stats::LOCALBYTESOUT, r);
+    updateTotals(0, r);
+    return r;
+}
+
 // --------------------------------------------------
 void UClientSocket::bind(const Host &h)
+{
+    bindInternal(h, false);
+}
+
+// --------------------------------------------------
+void UClientSocket::bindReusePort(const Host &h)
+{
+#ifdef SO_REUSEPORT
+    bindInternal(h, true);
+#else
+    throw NotImplementedException(__func__);
+#endif
+}
+
+// --------------------------------------------------
+void UClientSocket::bindInternal(const Host &h, bool reusePort)
 {
     struct sockaddr_in6 localAddr = {};
 
@@ -337,6 +419,15 @@ void UClientSocket::bind(const Host &h)
     setReuse(true);
     setBlocking(false);
 
+#ifdef SO_REUSEPORT
+    if (reusePort)
+    {
+        int op = 1;
+        if (setsockopt(sockNum, SOL_SOCKET, SO_REUSEPORT, (char *)&op, sizeof(op)) < 0)
+            throw SockException("Unable to set REUSEPORT");
+    }
+#endif
+
     memset(&localAddr, 0, sizeof(localAddr));
     localAddr.sin6_family = AF_INET6;
     localAddr.sin6_port = htons(h.port);
@@ -412,22 +503,27 @@ void UClientSocket::close()
         ::close(sockNum);
 
         sockNum = -1;
+        clearReadBuffer();
     }
 }
 
 // --------------------------------------------------
 bool    UClientSocket::readReady(int timeoutMilliseconds)
 {
-    timeval timeout;
-    fd_set read_fds;
+    if (bufferedBytes() > 0)
+        return true;
 
-    timeout.tv_sec = timeoutMilliseconds / 1000;
-    timeout.tv_usec = (timeoutMilliseconds % 1000) * 1000;
+    struct pollfd pfd = {};
+    pfd.fd = sockNum;
+    pfd.events = POLLIN;
 
-    FD_ZERO (&read_fds);
-    FD_SET (sockNum, &read_fds);
+    int r;
+    do
+    {
+        r = poll(&pfd, 1, timeoutMilliseconds);
+    } while (r == SOCKET_ERROR && errno == EINTR);
 
-    return select (sockNum+1, &read_fds, nullptr, nullptr, &timeout) == 1;
+    return r == 1;
 }
 
 // --------------------------------------------------
@@ -438,12 +534,36 @@ int UClientSocket::numPending()
     if (ioctl( sockNum, FIONREAD, (char *)&len ) < 0)
         throw StreamException("numPending");
 
-    return (int)len;
+    return bufferedBytes() + (int)len;
+}
+
+// --------------------------------------------------
+bool UClientSocket::getTransportInfo(TransportInfo& info)
+{
+#if defined(__linux__) && defined(TCP_INFO)
+    int queued;
+    if (ioctl(sockNum, TIOCOUTQ, &queued) < 0)
+        return false;
+
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+    if (getsockopt(sockNum, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0)
+        return false;
+
+    info.unackedBytes = queued;
+    info.rttUsec = ti.tcpi_rtt;
+    return true;
+#else
+    return false;
+#endif
 }
 
 // --------------------------------------------------
 char UClientSocket::peekChar()
 {
+    if (bufferedBytes() > 0)
+        return m_readBuf[m_readPos];
+
     char c;
 
     ssize_t ret;
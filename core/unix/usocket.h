@@ -52,22 +52,30 @@ public:
     void    open(const Host &) override;
     int     read(void *, int) override;
     int     readUpto(void *, int) override;
+    int     readSome(void *, int) override;
     void    write(const void *, int) override;
+    void    writeVector(const IOVec *, int) override;
+    int     tryWrite(const void *, int) override;
+    int     tryWriteVector(const IOVec *, int) override;
     void    bind(const Host &) override;
+    void    bindReusePort(const Host &) override;
     void    connect() override;
     void    close() override;
     std::shared_ptr<ClientSocket> accept() override;
     bool    active() override { return sockNum != -1; }
     bool    readReady(int milliSeconds = 0) override;
     int     numPending() override;
+    bool    getTransportInfo(TransportInfo&) override;
 
     Host    getLocalHost() override;
     void    setBlocking(bool) override;
     void    setReuse(bool) override;
     void    setNagle(bool) override;
     void    setLinger(int) override;
+    void    setSendBufferSize(int) override;
+    void    setNotSentLowWatermark(int) override;
+    void    setCongestionControl(const char*) override;
 
-    static hostent  *resolveHost(const char *);
 
     void    checkTimeout(bool, bool);
 
@@ -76,9 +84,18 @@ public:
     {
         sockNum = -1;
         remoteAddr = {};
+        clearReadBuffer();
     }
     char peekChar() override;
 
+protected:
+    int     recvOnce(void *, int) override;
+
+private:
+    void    bindInternal(const Host &, bool reusePort);
+
+public:
+
     int sockNum;
     struct sockaddr_in6 remoteAddr;
 };
@@ -23,14 +23,22 @@
 #endif
 #include <CoreFoundation/CoreFoundation.h>
 #include <ApplicationServices/ApplicationServices.h>
+#include <mach/mach.h>
 #endif
 
 #include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/wait.h> // WIFEXITED, WEXITSTATUS
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 #include <thread>
+#include <algorithm>
 #include <stdio.h>
 #include <limits.h>
 
@@ -38,6 +46,8 @@
 #include "str.h"
 #include "usocket.h"
 #include "usys.h"
+#include "ureactor.h"
+#include "uringreactor.h"
 #include "subprog.h"
 #include "strerror.h"
 
@@ -66,6 +76,18 @@ USys::USys()
     }
     signal(SIGPIPE, SIG_IGN);
     signal(SIGABRT, SIG_IGN);
+
+    // 作られるスレッドはこれを受け継ぐ。
+    m_baseNice = getpriority(PRIO_PROCESS, 0);
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int c = 0; c < CPU_SETSIZE; c++)
+            if (CPU_ISSET(c, &set))
+                m_baseCPUs.push_back(c);
+    }
+#endif
 }
 
 // ---------------------------------
@@ -83,9 +105,32 @@ std::shared_ptr<ClientSocket> USys::createSocket()
     return std::make_shared<UClientSocket>();
 }
 
+// ---------------------------------
+std::shared_ptr<Reactor> USys::createReactor(const std::string& backend, int numWorkers)
+{
+    int n = numWorkers;
+    if (n <= 0)
+        n = std::max(2, std::min<int>(std::thread::hardware_concurrency(), 8));
+#ifdef __linux__
+    if (backend == "io_uring")
+    {
+        try
+        {
+            return std::make_shared<UringReactor>(n);
+        }catch (GeneralException& e)
+        {
+            LOG_WARN("io_uring unavailable, falling back to epoll: %s", e.what());
+        }
+    }
+#endif
+    return std::make_shared<UReactor>(n);
+}
+
 // ---------------------------------
 void    USys::setThreadName(const char* name)
 {
+    Sys::setThreadName(name);
+
 #ifdef _GNU_SOURCE
     char buf[16];
     snprintf(buf, 16, "%s", name);
@@ -113,6 +158,78 @@ std::string USys::getThreadName()
 #endif
 }
 
+// ---------------------------------
+bool USys::getThreadCPUClock(int64_t& clock)
+{
+#ifdef __APPLE__
+    clock = pthread_mach_thread_np(pthread_self());
+    return true;
+#else
+    clockid_t cid;
+    if (pthread_getcpuclockid(pthread_self(), &cid) != 0)
+        return false;
+    clock = cid;
+    return true;
+#endif
+}
+
+// ---------------------------------
+double USys::getThreadCPUSeconds(int64_t clock)
+{
+#ifdef __APPLE__
+    thread_basic_info_data_t info;
+    mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+    if (thread_info((thread_act_t) clock, THREAD_BASIC_INFO, (thread_info_t) &info, &count) != KERN_SUCCESS)
+        return -1;
+    return info.user_time.seconds + info.user_time.microseconds / 1e6 +
+        info.system_time.seconds + info.system_time.microseconds / 1e6;
+#else
+    struct timespec ts;
+    if (clock_gettime((clockid_t) clock, &ts) != 0)
+        return -1;
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+// ---------------------------------
+// Linux では nice 値がスレッドごとにある。他ではプロセス全体に効いて
+// しまうので何もしない。
+bool USys::setThreadPriority(int niceDelta)
+{
+#ifdef __linux__
+    int nice = std::max(-20, std::min(m_baseNice + niceDelta, 19));
+    if (setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), nice) != 0)
+    {
+        LOG_DEBUG("setpriority(%d): %s", nice, str::strerror(errno).c_str());
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+// ---------------------------------
+bool USys::setThreadAffinity(const std::vector<int>& cpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus.empty() ? m_baseCPUs : cpus)
+        if (c >= 0 && c < CPU_SETSIZE)
+            CPU_SET(c, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0)
+    {
+        LOG_DEBUG("pthread_setaffinity_np: %s", str::strerror(err).c_str());
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 // ---------------------------------
 bool USys::hasGUI()
 {
@@ -32,6 +32,7 @@ public:
     USys();
 
     std::shared_ptr<ClientSocket> createSocket() override;
+    std::shared_ptr<Reactor> createReactor(const std::string& backend = "", int numWorkers = 0) override;
     double          getDTime() override;
     unsigned int    rnd() override { return rndGen.next(); }
     void            getURL(const char *) override;
@@ -42,6 +43,10 @@ public:
 
     void            setThreadName(const char* name) override;
     std::string     getThreadName() override;
+    bool            getThreadCPUClock(int64_t& clock) override;
+    double          getThreadCPUSeconds(int64_t clock) override;
+    bool            setThreadPriority(int niceDelta) override;
+    bool            setThreadAffinity(const std::vector<int>& cpus) override;
 
     std::string     getHostname() override;
     std::vector<std::string> getIPAddresses(const std::string& name) override;
@@ -62,6 +67,10 @@ public:
 private:
 
     void openURL( const char* url );
+
+    // 起動した時の優先度と CPU。スレッドの設定を元に戻す時に使う。
+    int              m_baseNice;
+    std::vector<int> m_baseCPUs;
 };
 
 // ------------------------------------
@@ -0,0 +1,61 @@
+// ------------------------------------------------
+// File : whandoff.cpp
+// Desc:
+//      Windows ではソケットを SCM_RIGHTS で渡せないので、RestartHandoff
+//      は使えない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "handoff.h"
+#include "socket.h"
+
+// ------------------------------------
+int RestartHandoff::listenPath(const std::string& path)
+{
+    return -1;
+}
+
+// ------------------------------------
+int RestartHandoff::acceptPath(int fd, int timeoutMsec)
+{
+    return -1;
+}
+
+// ------------------------------------
+int RestartHandoff::connectPath(const std::string& path)
+{
+    return -1;
+}
+
+// ------------------------------------
+void RestartHandoff::closeFd(int fd)
+{
+}
+
+// ------------------------------------
+bool RestartHandoff::sendMessage(int fd, const std::string& data)
+{
+    return false;
+}
+
+// ------------------------------------
+bool RestartHandoff::recvMessage(int fd, std::string& data, int timeoutMsec)
+{
+    return false;
+}
+
+// ------------------------------------
+std::shared_ptr<ClientSocket> RestartHandoff::adoptListener(int fd, const Host& host)
+{
+    return nullptr;
+}
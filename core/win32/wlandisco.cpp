@@ -0,0 +1,41 @@
+// ------------------------------------------------
+// File : wlandisco.cpp
+// Desc:
+//      Windows ではまだ LAN 内の告知をしない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "landisco.h"
+
+// ------------------------------------
+int LANDiscovery::openSocket()
+{
+    return -1;
+}
+
+// ------------------------------------
+void LANDiscovery::closeSocket(int fd)
+{
+}
+
+// ------------------------------------
+bool LANDiscovery::send(int fd, const std::string& data)
+{
+    return false;
+}
+
+// ------------------------------------
+bool LANDiscovery::receive(int fd, std::string& data, IP& from)
+{
+    return false;
+}
@@ -0,0 +1,49 @@
+// ------------------------------------------------
+// File : wprefork.cpp
+// Desc:
+//      Windows には fork が無いので、Prefork は使えない。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "prefork.h"
+#include "socket.h"
+
+// ------------------------------------
+int Prefork::run(int n, std::function<bool()> quitRequested)
+{
+    return (n <= 1) ? 0 : -1;
+}
+
+// ------------------------------------
+bool Prefork::sendSocket(int chan, int fd)
+{
+    return false;
+}
+
+// ------------------------------------
+int Prefork::recvSocket(int chan, int timeoutMsec)
+{
+    return -1;
+}
+
+// ------------------------------------
+std::string Prefork::peekLine(int fd, int timeoutMsec)
+{
+    return "";
+}
+
+// ------------------------------------
+std::shared_ptr<ClientSocket> Prefork::adoptSocket(int fd)
+{
+    return nullptr;
+}
@@ -0,0 +1,434 @@
+// ------------------------------------------------
+// File : wreactor.cpp
+// Desc:
+//      Reactor の Windows 実装。
+//
+//      完了ポートには Op (OVERLAPPED を継承) を積み、ワーカーが取り出し
+//      てイベントに直してハンドラーを呼ぶ。post() や 1 秒ごとの呼び出し
+//      も Op にして同じポートに積む。ハンドルが削除されても Op はハンド
+//      ルの ID しか持たないので、遅れて届いた完了は捨てるだけでよい。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <string.h>
+#include <algorithm>
+
+#include "wreactor.h"
+#include "socket.h"
+#include "sys.h"
+#include "str.h"
+#include "common.h"
+
+// ------------------------------------
+struct WReactor::Op : OVERLAPPED
+{
+    enum KIND { RECV, SEND, EVENTS };
+
+    Op(KIND k, uint64_t i)
+        : kind(k)
+        , id(i)
+        , events(0)
+    {
+        memset(static_cast<OVERLAPPED*>(this), 0, sizeof(OVERLAPPED));
+        buf.buf = nullptr;
+        buf.len = 0;
+    }
+
+    KIND                kind;
+    uint64_t            id;
+    int                 events;     // EVENTS の時に渡すイベント
+    std::vector<char>   data;       // SEND の時に送るデータ
+    WSABUF              buf;
+};
+
+// 登録されているソケット。WSAClientSocket::tryWriteVector から引く。
+static std::mutex s_socketsLock;
+static std::map<SOCKET, std::shared_ptr<void>> s_sockets;
+
+// ------------------------------------
+WReactor::WReactor(int numWorkers)
+    : m_nextID(1)
+    , m_lastTick(std::chrono::steady_clock::now())
+    , m_running(true)
+{
+    m_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, numWorkers);
+    if (m_port == nullptr)
+        throw GeneralException(str::format("CreateIoCompletionPort: error %lu", GetLastError()));
+
+    for (int i = 0; i < numWorkers; i++)
+    {
+        auto t = std::unique_ptr<ThreadInfo>(new ThreadInfo());
+        t->func = workerProc;
+        t->data = this;
+        if (!sys->startWaitableThread(t.get()))
+            break;
+        m_workers.push_back(std::move(t));
+    }
+}
+
+// ------------------------------------
+WReactor::~WReactor()
+{
+    m_running = false;
+    for (size_t i = 0; i < m_workers.size(); i++)
+        PostQueuedCompletionStatus(m_port, 0, 0, nullptr);
+    for (auto& t : m_workers)
+        sys->waitThread(t.get());
+
+    // 残っている Op を片付ける。
+    while (true)
+    {
+        DWORD bytes;
+        ULONG_PTR key;
+        OVERLAPPED* ov = nullptr;
+        GetQueuedCompletionStatus(m_port, &bytes, &key, &ov, 0);
+        if (ov == nullptr)
+            break;
+        delete static_cast<Op*>(ov);
+    }
+
+    CloseHandle(m_port);
+}
+
+// ------------------------------------
+THREAD_PROC WReactor::workerProc(ThreadInfo *thread)
+{
+    sys->setThreadName("REACTOR");
+    static_cast<WReactor*>(thread->data)->run();
+    return 0;
+}
+
+// ------------------------------------
+void WReactor::run()
+{
+    while (m_running)
+    {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* ov = nullptr;
+        BOOL ok = GetQueuedCompletionStatus(m_port, &bytes, &key, &ov, 1000);
+
+        if (ov == nullptr)
+        {
+            if (!ok && GetLastError() != WAIT_TIMEOUT)
+            {
+                LOG_ERROR("Reactor: GetQueuedCompletionStatus: error %lu", GetLastError());
+                break;
+            }
+        }else if (!m_running)
+        {
+            delete static_cast<Op*>(ov);
+            break;
+        }else
+            complete(static_cast<Op*>(ov), bytes, ok != FALSE);
+
+        tick();
+    }
+}
+
+// ------------------------------------
+void WReactor::complete(Op* op, DWORD bytes, bool ok)
+{
+    std::unique_ptr<Op> hold(op);
+    int events = 0;
+
+    switch (op->kind)
+    {
+    case Op::EVENTS:
+        events = op->events;
+        break;
+
+    case Op::RECV:
+    {
+        SOCKET fd;
+        bool wantRead;
+        {
+            std::lock_guard<std::mutex> cs(m_lock);
+            auto it = m_entries.find(op->id);
+            if (it == m_entries.end())
+                return;
+            it->second->recvPending = false;
+            fd = it->second->fd;
+            wantRead = (it->second->events & EV_READ) != 0;
+        }
+
+        if (!ok)
+            events = EV_ERROR;
+        else
+        {
+            // 0 バイトの受信はデータが来ても相手が閉じても完了するので、
+            // 覗いて区別する。
+            char c;
+            int r = recv(fd, &c, 1, MSG_PEEK);
+            if (r == 0 || (r == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK))
+                events = EV_ERROR;
+            else if (r > 0)
+            {
+                // 読まないハンドルに届いたデータは、送信の失敗で切断に
+                // 気付くまで放っておく。
+                if (!wantRead)
+                    return;
+                events = EV_READ;
+            }else
+            {
+                std::lock_guard<std::mutex> cs(m_lock);
+                auto it = m_entries.find(op->id);
+                if (it != m_entries.end())
+                    arm(*it->second);
+                return;
+            }
+        }
+        break;
+    }
+
+    case Op::SEND:
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        auto it = m_entries.find(op->id);
+        if (it == m_entries.end())
+            return;
+        auto& e = *it->second;
+        e.inflight -= (int) op->data.size();
+        if (!ok || bytes < op->data.size())
+        {
+            e.sendError = true;
+            events = EV_ERROR;
+        }else if ((e.events & EV_WRITE) && e.inflight < SEND_WINDOW)
+            events = EV_WRITE;
+        else
+            return;
+        break;
+    }
+    }
+
+    dispatch(op->id, events);
+}
+
+// ------------------------------------
+void WReactor::dispatch(uint64_t id, int events)
+{
+    auto e = find(id);
+    if (!e)
+        return;
+
+    std::lock_guard<std::mutex> running(e->running);
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        if (e->removed)
+            return;
+        if (events & EV_WAKE)
+            e->posted = false;
+    }
+
+    try
+    {
+        e->handler(events);
+    }catch (std::exception& ex)
+    {
+        LOG_ERROR("Reactor handler: %s", ex.what());
+    }
+
+    // 準備完了の通知はワンショットなので、有効にし直す。
+    if (events & (EV_READ | EV_WRITE | EV_ERROR))
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        if (!e->removed)
+            arm(*e);
+    }
+}
+
+// ------------------------------------
+// m_lock を持って呼ぶ。
+void WReactor::arm(Entry& e)
+{
+    if (!e.recvPending)
+    {
+        Op* op = new Op(Op::RECV, e.id);
+        DWORD flags = 0;
+        if (WSARecv(e.fd, &op->buf, 1, nullptr, &flags, op, nullptr) == SOCKET_ERROR &&
+            WSAGetLastError() != WSA_IO_PENDING)
+        {
+            delete op;
+            postEvents(e.id, EV_ERROR);
+            return;
+        }
+        e.recvPending = true;
+    }
+
+    if ((e.events & EV_WRITE) && !e.sendError && e.inflight < SEND_WINDOW)
+        postEvents(e.id, EV_WRITE);
+}
+
+// ------------------------------------
+void WReactor::postEvents(uint64_t id, int events)
+{
+    Op* op = new Op(Op::EVENTS, id);
+    op->events = events;
+    if (!PostQueuedCompletionStatus(m_port, 0, 0, op))
+    {
+        LOG_ERROR("Reactor: PostQueuedCompletionStatus: error %lu", GetLastError());
+        delete op;
+    }
+}
+
+// ------------------------------------
+uint64_t WReactor::add(int fd, int events, Handler handler)
+{
+    auto e = std::make_shared<Entry>();
+    e->fd = (SOCKET) fd;
+    e->events = events;
+    e->handler = handler;
+    e->removed = false;
+    e->posted = false;
+    e->recvPending = false;
+    e->inflight = 0;
+    e->sendError = false;
+    e->reactor = this;
+
+    // ソケットを完了ポートに結び付けられるのは一度だけ。既に結び付い
+    // ていれば失敗するが、同じポートなら問題ない。
+    if (CreateIoCompletionPort((HANDLE) e->fd, m_port, 0, 0) == nullptr)
+        LOG_DEBUG("Reactor: CreateIoCompletionPort(%d): error %lu", fd, GetLastError());
+
+    {
+        std::lock_guard<std::mutex> cs(s_socketsLock);
+        s_sockets[e->fd] = e;
+    }
+
+    std::lock_guard<std::mutex> cs(m_lock);
+    e->id = m_nextID++;
+    m_entries[e->id] = e;
+    arm(*e);
+    return e->id;
+}
+
+// ------------------------------------
+void WReactor::modify(uint64_t id, int events)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_entries.find(id);
+    if (it == m_entries.end())
+        return;
+
+    it->second->events = events;
+    arm(*it->second);
+}
+
+// ------------------------------------
+void WReactor::remove(uint64_t id)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_entries.find(id);
+    if (it == m_entries.end())
+        return;
+
+    auto& e = *it->second;
+    e.removed = true;
+    {
+        std::lock_guard<std::mutex> cs1(s_socketsLock);
+        s_sockets.erase(e.fd);
+    }
+    // 出している受信を取り消す。完了は ID が見つからないので捨てられる。
+    CancelIoEx((HANDLE) e.fd, nullptr);
+    m_entries.erase(it);
+}
+
+// ------------------------------------
+void WReactor::post(uint64_t id)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_entries.find(id);
+    if (it == m_entries.end() || it->second->posted)
+        return;
+
+    it->second->posted = true;
+    postEvents(id, EV_WAKE);
+}
+
+// ------------------------------------
+size_t WReactor::numHandlers()
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    return m_entries.size();
+}
+
+// ------------------------------------
+std::shared_ptr<WReactor::Entry> WReactor::find(uint64_t id)
+{
+    std::lock_guard<std::mutex> cs(m_lock);
+    auto it = m_entries.find(id);
+    if (it == m_entries.end())
+        return nullptr;
+    return it->second;
+}
+
+// ------------------------------------
+void WReactor::tick()
+{
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> cs(m_lock);
+    if (now - m_lastTick < std::chrono::seconds(1))
+        return;
+
+    m_lastTick = now;
+    for (auto& it : m_entries)
+        postEvents(it.first, EV_TICK);
+}
+
+// ------------------------------------
+int WReactor::trySend(SOCKET fd, const Stream::IOVec *vec, int n)
+{
+    std::shared_ptr<Entry> e;
+    {
+        std::lock_guard<std::mutex> cs(s_socketsLock);
+        auto it = s_sockets.find(fd);
+        if (it == s_sockets.end())
+            return -1;
+        e = std::static_pointer_cast<Entry>(it->second);
+    }
+
+    std::lock_guard<std::mutex> cs(e->reactor->m_lock);
+    if (e->removed)
+        return -1;
+    if (e->sendError)
+        throw SockException("Closed on write");
+
+    int room = SEND_WINDOW - e->inflight;
+    if (room <= 0)
+        return 0;
+
+    // 送り終わるまでデータを持っていないといけないので、コピーする。
+    std::unique_ptr<Op> op(new Op(Op::SEND, e->id));
+    for (int i = 0; i < n && room > 0; i++)
+    {
+        int len = std::min(vec[i].len, room);
+        const char* p = static_cast<const char*>(vec[i].data);
+        op->data.insert(op->data.end(), p, p + len);
+        room -= len;
+    }
+    if (op->data.empty())
+        return 0;
+
+    int len = (int) op->data.size();
+    op->buf.buf = op->data.data();
+    op->buf.len = (ULONG) len;
+    if (WSASend(fd, &op->buf, 1, nullptr, 0, op.get(), nullptr) == SOCKET_ERROR)
+    {
+        int err = WSAGetLastError();
+        if (err != WSA_IO_PENDING)
+            throw SockException(str::format("WSASend: error %d", err).c_str());
+    }
+    op.release();   // 完了ポートから戻ってきたら complete() で消す
+    e->inflight += len;
+    return len;
+}
@@ -0,0 +1,102 @@
+// ------------------------------------------------
+// File : wreactor.h
+// Desc:
+//      Reactor の Windows 実装。I/O 完了ポートを少数のワーカーで待つ。
+//
+//      読み込みと切断は 0 バイトの WSARecv の完了で知る。送信は
+//      WSAClientSocket::tryWriteVector が登録済みのソケットについて
+//      trySend を呼び、パケットをコピーして重ねた WSASend で送る。送信
+//      中のバイト数が SEND_WINDOW を下回っている間を「書き込み可能」と
+//      する。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _WREACTOR_H
+#define _WREACTOR_H
+
+#include <winsock2.h>
+#include <windows.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "reactor.h"
+#include "stream.h"
+#include "threading.h"
+
+// ------------------------------------
+class WReactor : public Reactor
+{
+public:
+    enum { SEND_WINDOW = 256 * 1024 };  // ソケットごとの送信中の上限
+
+    WReactor(int numWorkers);
+    ~WReactor();
+
+    uint64_t    add(int fd, int events, Handler handler) override;
+    void        modify(uint64_t id, int events) override;
+    void        remove(uint64_t id) override;
+    void        post(uint64_t id) override;
+
+    size_t      numHandlers() override;
+    int         numWorkers() override { return (int) m_workers.size(); }
+
+    // fd がいずれかの WReactor に登録されていれば、vec の先頭から送信
+    // の窓に収まる分を重ねた WSASend で送り、そのバイト数を返す。登録
+    // されていなければ -1。
+    static int  trySend(SOCKET fd, const Stream::IOVec *vec, int n);
+
+private:
+    struct Op;
+
+    struct Entry
+    {
+        uint64_t    id;
+        SOCKET      fd;
+        int         events;
+        Handler     handler;
+        std::mutex  running;    // ハンドラーの実行中に保持する
+        bool        removed;
+        bool        posted;     // EV_WAKE をポートに積んである
+        bool        recvPending;// 0 バイトの WSARecv を出している
+        int         inflight;   // 送信中のバイト数
+        bool        sendError;
+        WReactor*   reactor;
+    };
+
+    static THREAD_PROC workerProc(ThreadInfo *thread);
+    void    run();
+    void    complete(Op* op, DWORD bytes, bool ok);
+    void    dispatch(uint64_t id, int events);
+    void    arm(Entry& e);
+    void    postEvents(uint64_t id, int events);
+    void    tick();
+
+    std::shared_ptr<Entry> find(uint64_t id);
+
+    HANDLE              m_port;
+
+    std::mutex          m_lock;
+    std::map<uint64_t, std::shared_ptr<Entry>> m_entries;
+    uint64_t            m_nextID;
+    std::chrono::steady_clock::time_point m_lastTick;
+
+    std::atomic<bool>   m_running;
+    std::vector<std::unique_ptr<ThreadInfo>> m_workers;
+};
+
+#endif
@@ -0,0 +1,29 @@
+// ------------------------------------------------
+// File : wshmring.cpp
+// Desc:
+//      Windows では ShmRing を使わず、今まで通り HTTP Push で受け取る。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include "shmring.h"
+
+// ------------------------------------
+void* ShmRing::mapShared(const std::string& name, size_t& size, bool create)
+{
+    return nullptr;
+}
+
+// ------------------------------------
+void ShmRing::unmapShared(const std::string& name, void* p, size_t size, bool remove)
+{
+}
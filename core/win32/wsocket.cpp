@@ -25,6 +25,7 @@
 #include <windows.h>
 #include <stdio.h>
 #include "wsocket.h"
+#include "wreactor.h"
 #include "stats.h"
 
 #include "config.h"
@@ -60,38 +61,6 @@ void WSAClientSocket::init()
     //LOG4("WSAStartup:  OK");
 }
 
-// --------------------------------------------------
-unsigned int ClientSocket::getIP(const char *name)
-{
-    char szHostName[256];
-
-    if (!name)
-    {
-        if (gethostname(szHostName, sizeof(szHostName))==0)
-            name = szHostName;
-        else
-            return 0;
-    }
-
-    HOSTENT *he = WSAClientSocket::resolveHost(name);
-
-    if (!he)
-        return 0;
-
-    LPSTR lpAddr = he->h_addr_list[0];
-    if (lpAddr)
-    {
-        struct in_addr  inAddr;
-        memmove(&inAddr, lpAddr, 4);
-
-        return inAddr.S_un.S_un_b.s_b1<<24 |
-               inAddr.S_un.S_un_b.s_b2<<16 |
-               inAddr.S_un.S_un_b.s_b3<<8 |
-               inAddr.S_un.S_un_b.s_b4;
-    }
-    return 0;
-}
-
 // --------------------------------------------------
 void WSAClientSocket::setLinger(int sec)
 {
@@ -128,26 +97,6 @@ void WSAClientSocket::setReuse(bool yes)
         throw SockException("Unable to set REUSE");
 }
 
-// --------------------------------------------------
-HOSTENT *WSAClientSocket::resolveHost(const char *hostName)
-{
-    HOSTENT *he;
-
-    if ((he = gethostbyname(hostName)) == nullptr)
-    {
-        // if failed, try using gethostbyaddr instead
-
-        unsigned long ip = inet_addr(hostName);
-
-        if (ip == INADDR_NONE)
-            return nullptr;
-
-        if ((he = gethostbyaddr((char *)&ip,sizeof(ip),AF_INET)) == nullptr)
-            return nullptr;
-    }
-    return he;
-}
-
 // --------------------------------------------------
 void WSAClientSocket::open(const Host &rh)
 {
@@ -264,30 +213,84 @@ void WSAClientSocket::connect()
 }
 
 // --------------------------------------------------
-int WSAClientSocket::read(void *p, int l)
+int WSAClientSocket::tryWrite(const void *p, int l)
 {
-    int bytesRead = 0;
-    while (l)
+    IOVec vec = { p, l };
+    return tryWriteVector(&vec, 1);
+}
+
+// --------------------------------------------------
+// リアクターに登録されていれば重ねた送信に任せる。そうでなければノン
+// ブロッキングで送れる分だけ送る。
+int WSAClientSocket::tryWriteVector(const IOVec *vec, int n)
+{
+    int r = WReactor::trySend(sockNum, vec, n);
+    if (r < 0)
+    {
+        std::vector<WSABUF> bufs;
+        for (int i = 0; i < n; i++)
+            if (vec[i].len > 0)
+                bufs.push_back({ (ULONG) vec[i].len, (CHAR *) vec[i].data });
+        if (bufs.empty())
+            return 0;
+
+        DWORD sent = 0;
+        if (WSASend(sockNum, bufs.data(), (DWORD) bufs.size(), &sent, 0, nullptr, nullptr) == SOCKET_ERROR)
+        {
+            int err = WSAGetLastError();
+            if (err == WSAEWOULDBLOCK)
+                return 0;
+            throw SockException(("send failed" + wsStrError(err)).c_str());
+        }
+        if (sent == 0)
+            throw SockException("Closed on write");
+        r = (int) sent;
+    }
+
+    stats.add(Stats::BYTESOUT,r);
+    if (host.localIP())
+        stats.add(Stats::LOCALBYTESOUT,r);
+    updateTotals(0,r);
+    return r;
+}
+
+// --------------------------------------------------
+int WSAClientSocket::recvOnce(void *p, int l)
+{
+    while (true)
     {
         int r = recv(sockNum, (char *)p, l, 0);
         if (r == SOCKET_ERROR)
         {
             // non-blocking sockets always fall through to here
             checkTimeout(true,false);
-        }else if (r == 0)
-        {
-            throw EOFException("Closed on read");
         }else
         {
-            stats.add(Stats::BYTESIN,r);
-            if (host.localIP())
-                stats.add(Stats::LOCALBYTESIN,r);
-            updateTotals(r,0);
-            bytesRead += r;
-            l -= r;
-            p = (char *)p+r;
+            if (r > 0)
+            {
+                stats.add(Stats::BYTESIN,r);
+                if (host.localIP())
+                    stats.add(Stats::LOCALBYTESIN,r);
+                updateTotals(r,0);
+            }
+            return r;
         }
     }
+}
+
+// --------------------------------------------------
+int WSAClientSocket::read(void *p, int l)
+{
+    int bytesRead = 0;
+    while (l)
+    {
+        int r = readBuffered(p, l);
+        if (r == 0)
+            throw EOFException("Closed on read");
+        bytesRead += r;
+        l -= r;
+        p = (char *)p+r;
+    }
     return bytesRead;
 }
 
@@ -297,29 +300,25 @@ int WSAClientSocket::readUpto(void *p, int l)
     int bytesRead = 0;
     while (l)
     {
-        int r = recv(sockNum, (char *)p, l, 0);
-        if (r == SOCKET_ERROR)
-        {
-            // non-blocking sockets always fall through to here
-            checkTimeout(true,false);
-
-        }else if (r == 0)
-        {
+        int r = readBuffered(p, l);
+        if (r == 0)
             break;
-        }else
-        {
-            stats.add(Stats::BYTESIN,r);
-            if (host.localIP())
-                stats.add(Stats::LOCALBYTESIN,r);
-            updateTotals(r,0);
-            bytesRead += r;
-            l -= r;
-            p = (char *)p+r;
-        }
+        bytesRead += r;
+        l -= r;
+        p = (char *)p+r;
     }
     return bytesRead;
 }
 
+// --------------------------------------------------
+int WSAClientSocket::readSome(void *p, int l)
+{
+    int r = readBuffered(p, l);
+    if (r == 0)
+        throw EOFException("Closed on read");
+    return r;
+}
+
 // --------------------------------------------------
 void WSAClientSocket::write(const void *p, int l)
 {
@@ -348,6 +347,52 @@ void WSAClientSocket::write(const void *p, int l)
     }
 }
 
+// --------------------------------------------------
+void WSAClientSocket::writeVector(const IOVec *vec, int n)
+{
+    std::vector<WSABUF> bufs;
+    for (int i = 0; i < n; i++)
+        if (vec[i].len > 0)
+            bufs.push_back({ (ULONG) vec[i].len, (CHAR *) vec[i].data });
+
+    size_t i = 0;
+    while (i < bufs.size())
+    {
+        DWORD r = 0;
+        if (WSASend(sockNum, &bufs[i], (DWORD) (bufs.size() - i), &r, 0, nullptr, nullptr) == SOCKET_ERROR)
+        {
+            checkTimeout(false,true);
+        }
+        else if (r == 0)
+        {
+            throw SockException("Closed on write");
+        }
+        else
+        {
+            stats.add(Stats::BYTESOUT,r);
+            if (host.localIP())
+                stats.add(Stats::LOCALBYTESOUT,r);
+
+            updateTotals(0,r);
+
+            // 送った分だけ進める。
+            while (r > 0)
+            {
+                if (r >= bufs[i].len)
+                {
+                    r -= bufs[i].len;
+                    i++;
+                }else
+                {
+                    bufs[i].buf += r;
+                    bufs[i].len -= r;
+                    r = 0;
+                }
+            }
+        }
+    }
+}
+
 // --------------------------------------------------
 void WSAClientSocket::bind(const Host &h)
 {
@@ -422,12 +467,16 @@ void WSAClientSocket::close()
             LOG_ERROR("closesocket() error");
 
         sockNum = INVALID_SOCKET;
+        clearReadBuffer();
     }
 }
 
 // --------------------------------------------------
 bool    WSAClientSocket::readReady(int timeoutMilliseconds)
 {
+    if (bufferedBytes() > 0)
+        return true;
+
     timeval timeout;
     fd_set read_fds;
 
@@ -448,6 +497,9 @@ bool    WSAClientSocket::readReady(int timeoutMilliseconds)
 // --------------------------------------------------
 char WSAClientSocket::peekChar()
 {
+    if (bufferedBytes() > 0)
+        return m_readBuf[m_readPos];
+
     char c;
 
     if (recv(sockNum, &c, 1, MSG_PEEK) != 1) {
@@ -43,7 +43,11 @@ public:
     void    open(const Host &) override;
     int     read(void *, int) override;
     int     readUpto(void *, int) override;
+    int     readSome(void *, int) override;
     void    write(const void *, int) override;
+    void    writeVector(const IOVec *, int) override;
+    int     tryWrite(const void *, int) override;
+    int     tryWriteVector(const IOVec *, int) override;
     void    bind(const Host &) override;
     void    connect() override;
     void    close() override;
@@ -56,14 +60,18 @@ public:
     void    setNagle(bool) override;
     void    setLinger(int) override;
 
-    static  HOSTENT     *resolveHost(const char *);
 
     void    checkTimeout(bool,bool);
 
     int getDescriptor() const override { return sockNum; }
-    void detach() override { sockNum = INVALID_SOCKET; remoteAddr = {}; }
+    void detach() override { sockNum = INVALID_SOCKET; remoteAddr = {}; clearReadBuffer(); }
     char peekChar() override;
 
+protected:
+    int     recvOnce(void *, int) override;
+
+public:
+
     SOCKET sockNum;
     struct sockaddr_in6 remoteAddr;
 };
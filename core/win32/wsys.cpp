@@ -22,6 +22,8 @@
 #include <time.h>
 #include "wsys.h"
 #include "wsocket.h"
+#include "wreactor.h"
+#include <thread>
 #include <windows.h>
 #include "stats.h"
 #include "peercast.h"
@@ -55,6 +57,15 @@ std::shared_ptr<ClientSocket> WSys::createSocket()
     return std::make_shared<WSAClientSocket>();
 }
 
+// --------------------------------------------------
+std::shared_ptr<Reactor> WSys::createReactor(const std::string& backend, int numWorkers)
+{
+    int n = numWorkers;
+    if (n <= 0)
+        n = std::max(2, std::min<int>(std::thread::hardware_concurrency(), 8));
+    return std::make_shared<WReactor>(n);
+}
+
 // --------------------------------------------------
 void WSys::callLocalURL(const char *str,int port)
 {
@@ -86,6 +97,73 @@ void WSys::executeFile(const char *file)
     ShellExecuteA(nullptr, "open", file, nullptr, nullptr, SW_SHOWNORMAL);
 }
 
+// --------------------------------------------------
+bool WSys::getThreadCPUClock(int64_t& clock)
+{
+    clock = GetCurrentThreadId();
+    return true;
+}
+
+// --------------------------------------------------
+double WSys::getThreadCPUSeconds(int64_t clock)
+{
+    HANDLE h = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, (DWORD) clock);
+    if (!h)
+        return -1;
+
+    FILETIME creation, exit, kernel, user;
+    BOOL ok = GetThreadTimes(h, &creation, &exit, &kernel, &user);
+    CloseHandle(h);
+    if (!ok)
+        return -1;
+
+    // 100 ナノ秒単位。
+    auto seconds = [](const FILETIME& ft)
+        {
+            ULARGE_INTEGER li;
+            li.LowPart = ft.dwLowDateTime;
+            li.HighPart = ft.dwHighDateTime;
+            return li.QuadPart / 1e7;
+        };
+    return seconds(kernel) + seconds(user);
+}
+
+// --------------------------------------------------
+// nice 値の差を THREAD_PRIORITY_* の段階に丸める。
+bool WSys::setThreadPriority(int niceDelta)
+{
+    int p;
+    if (niceDelta <= -10)
+        p = THREAD_PRIORITY_HIGHEST;
+    else if (niceDelta < 0)
+        p = THREAD_PRIORITY_ABOVE_NORMAL;
+    else if (niceDelta == 0)
+        p = THREAD_PRIORITY_NORMAL;
+    else if (niceDelta < 10)
+        p = THREAD_PRIORITY_BELOW_NORMAL;
+    else
+        p = THREAD_PRIORITY_LOWEST;
+    return SetThreadPriority(GetCurrentThread(), p) != 0;
+}
+
+// --------------------------------------------------
+bool WSys::setThreadAffinity(const std::vector<int>& cpus)
+{
+    DWORD_PTR mask = 0;
+    if (cpus.empty())
+    {
+        DWORD_PTR system;
+        if (!GetProcessAffinityMask(GetCurrentProcess(), &mask, &system))
+            return false;
+    }else
+    {
+        for (int c : cpus)
+            if (c >= 0 && c < (int) (sizeof(DWORD_PTR) * 8))
+                mask |= (DWORD_PTR) 1 << c;
+    }
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+}
+
 // --------------------------------------------------
 std::string WSys::getHostname()
 {
@@ -34,6 +34,7 @@ public:
     WSys(HWND);
 
     std::shared_ptr<ClientSocket> createSocket() override;
+    std::shared_ptr<Reactor> createReactor(const std::string& backend = "", int numWorkers = 0) override;
     double          getDTime() override;
     unsigned int    rnd() override { return rndGen.next(); }
     void            getURL(const char *) override;
@@ -42,6 +43,11 @@ public:
     void            callLocalURL(const char *str, int port) override;
     void            executeFile(const char *) override;
 
+    bool            getThreadCPUClock(int64_t& clock) override;
+    double          getThreadCPUSeconds(int64_t clock) override;
+    bool            setThreadPriority(int niceDelta) override;
+    bool            setThreadAffinity(const std::vector<int>& cpus) override;
+
     std::string     getHostname() override;
     std::vector<std::string> getIPAddresses(const std::string& name) override;
     std::vector<std::string> getAllIPAddresses() override;
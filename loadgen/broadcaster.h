@@ -0,0 +1,152 @@
+// ------------------------------------------------
+// File : broadcaster.h
+// Desc:
+//      合成 FLV を HTTP Push で配信元に流し続ける。切れたら一秒おいて
+//      つなぎ直す。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _LOADGEN_BROADCASTER_H
+#define _LOADGEN_BROADCASTER_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "sys.h"
+#include "socket.h"
+#include "cgi.h"
+#include "flvgen.h"
+
+namespace loadgen
+{
+    class Broadcaster
+    {
+    public:
+        struct Options
+        {
+            std::string host;
+            int         port;
+            std::string name;
+            int         kbps;
+            int         fps;
+            double      keyInterval;    // 秒
+        };
+
+        Broadcaster(const Options& opts)
+            : framesSent(0)
+            , bytesSent(0)
+            , reconnects(0)
+            , m_opts(opts)
+            , m_running(false)
+        {
+        }
+
+        ~Broadcaster()
+        {
+            stop();
+        }
+
+        void start()
+        {
+            m_running = true;
+            m_thread = std::thread([this]() { run(); });
+        }
+
+        void stop()
+        {
+            if (!m_running)
+                return;
+            m_running = false;
+            m_thread.join();
+        }
+
+        std::string lastError()
+        {
+            std::lock_guard<std::mutex> cs(m_lock);
+            return m_lastError;
+        }
+
+        std::atomic<uint64_t> framesSent;
+        std::atomic<uint64_t> bytesSent;
+        std::atomic<uint64_t> reconnects;
+
+    private:
+        void run()
+        {
+            // 通し番号は接続をまたいで続ける。飛びは視聴者側で欠落に数える。
+            uint32_t seq = 0;
+            while (m_running)
+            {
+                try
+                {
+                    push(seq);
+                }catch (StreamException& e)
+                {
+                    std::lock_guard<std::mutex> cs(m_lock);
+                    m_lastError = e.what();
+                }
+                if (!m_running)
+                    break;
+                reconnects++;
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+            }
+        }
+
+        void push(uint32_t& seq)
+        {
+            auto sock = sys->createSocket();
+            Host host;
+            host.fromStrName(m_opts.host.c_str(), m_opts.port);
+            if (!host.ip)
+                throw StreamException("Could not resolve host");
+            sock->open(host);
+            sock->connect();
+
+            sock->writeString("POST /?name=" + cgi::escape(m_opts.name) + "&type=FLV HTTP/1.0\r\n"
+                              "Content-Type: video/x-flv\r\n"
+                              "\r\n");
+            send(*sock, fileHeader() + metaDataTag(m_opts.kbps) + sequenceHeaderTag());
+
+            const int fps = std::max(1, m_opts.fps);
+            const int frameSize = std::max<int>(STAMP_OFFSET + STAMP_SIZE, m_opts.kbps * 1000 / 8 / fps - 15);
+            const int keyEvery = std::max(1, (int) (m_opts.keyInterval * fps));
+            const auto start = std::chrono::steady_clock::now();
+
+            for (int i = 0; m_running; i++)
+            {
+                auto due = start + std::chrono::microseconds((int64_t) i * 1000000 / fps);
+                std::this_thread::sleep_until(due);
+
+                uint32_t timestamp = (uint32_t) ((int64_t) i * 1000 / fps);
+                send(*sock, frameTag(seq++, timestamp, i % keyEvery == 0, frameSize, nowMicros()));
+                framesSent++;
+            }
+        }
+
+        void send(ClientSocket& sock, const std::string& data)
+        {
+            sock.write(data.data(), data.size());
+            bytesSent += data.size();
+        }
+
+        Options             m_opts;
+        std::atomic<bool>   m_running;
+        std::thread         m_thread;
+
+        std::mutex          m_lock;
+        std::string         m_lastError;
+    };
+}
+
+#endif
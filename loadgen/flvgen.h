@@ -0,0 +1,220 @@
+// ------------------------------------------------
+// File : flvgen.h
+// Desc:
+//      負荷試験用の合成 FLV ストリーム。映像タグのペイロードに通し番号
+//      と送出時刻を埋め込み、受け取った側で遅延と欠落を数えられるよう
+//      にする。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _LOADGEN_FLVGEN_H
+#define _LOADGEN_FLVGEN_H
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include "amf0.h"
+
+namespace loadgen
+{
+    enum
+    {
+        TT_VIDEO  = 9,
+        TT_SCRIPT = 18,
+
+        // 映像タグのペイロード: フレーム種別とコーデック (1)、AVC パケッ
+        // ト種別 (1)、コンポジション時刻 (3) の後にスタンプを置く。
+        STAMP_OFFSET = 5,
+        STAMP_SIZE   = 16,   // マジック (4)、通し番号 (4)、送出時刻 (8)
+
+        MAX_TAG_SIZE = 1024 * 1024,
+    };
+
+    static const char STAMP_MAGIC[4] = { 'P', 'C', 'L', 'G' };
+
+    // プロセス内で共通の単調時計。マイクロ秒。
+    inline uint64_t nowMicros()
+    {
+        using namespace std::chrono;
+        return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    inline void putBE(std::string& out, uint64_t v, int bytes)
+    {
+        for (int i = bytes - 1; i >= 0; i--)
+            out += (char) ((v >> (8 * i)) & 0xff);
+    }
+
+    inline uint64_t getBE(const unsigned char* p, int bytes)
+    {
+        uint64_t v = 0;
+        for (int i = 0; i < bytes; i++)
+            v = (v << 8) | p[i];
+        return v;
+    }
+
+    inline std::string fileHeader()
+    {
+        // 映像のみ。
+        return std::string({ 'F', 'L', 'V', 1, 1, 0, 0, 0, 9, 0, 0, 0, 0 });
+    }
+
+    inline std::string tag(int type, uint32_t timestamp, const std::string& payload)
+    {
+        std::string out;
+        out += (char) type;
+        putBE(out, payload.size(), 3);
+        putBE(out, timestamp & 0xffffff, 3);
+        out += (char) ((timestamp >> 24) & 0xff);
+        putBE(out, 0, 3); // stream id
+        out += payload;
+        putBE(out, 11 + payload.size(), 4);
+        return out;
+    }
+
+    // PeerCast がビットレートを知るための onMetaData。
+    inline std::string metaDataTag(int kbps)
+    {
+        auto payload = amf0::Value::string("onMetaData").serialize() +
+            amf0::Value::object(
+                {
+                    { "videodatarate", (double) kbps },
+                    { "encoder", "relay-load" },
+                }).serialize();
+        return tag(TT_SCRIPT, 0, payload);
+    }
+
+    // 最初の映像タグは AVC ヘッダーとしてヘッドパケットに入る。
+    inline std::string sequenceHeaderTag()
+    {
+        return tag(TT_VIDEO, 0, std::string({ 0x17, 0x00, 0, 0, 0 }));
+    }
+
+    // size バイトのペイロードを持つ映像タグ。
+    inline std::string frameTag(uint32_t seq, uint32_t timestamp, bool key, int size, uint64_t sendTime)
+    {
+        std::string payload = { (char) (key ? 0x17 : 0x27), 0x01, 0, 0, 0 };
+        payload.append(STAMP_MAGIC, 4);
+        putBE(payload, seq, 4);
+        putBE(payload, sendTime, 8);
+        if ((int) payload.size() < size)
+            payload.append(size - payload.size(), '\0');
+        return tag(TT_VIDEO, timestamp, payload);
+    }
+
+    struct Stamp
+    {
+        uint32_t seq;
+        uint64_t sendTime;
+    };
+
+    // 映像タグのペイロードからスタンプを読む。無ければ false。
+    inline bool readStamp(const unsigned char* payload, size_t size, Stamp& out)
+    {
+        if (size < STAMP_OFFSET + STAMP_SIZE)
+            return false;
+        const unsigned char* p = payload + STAMP_OFFSET;
+        if (memcmp(p, STAMP_MAGIC, 4) != 0)
+            return false;
+        out.seq = (uint32_t) getBE(p + 4, 4);
+        out.sendTime = getBE(p + 8, 8);
+        return true;
+    }
+
+    // 受信したバイト列をタグに切り分ける。リレーがキーフレームまで飛
+    // ばすと分割されたタグの途中で途切れることがあるので、タグとして読
+    // めなくなったら次のスタンプを探して同期をとり直す。
+    class FLVReader
+    {
+    public:
+        FLVReader()
+            : numResyncs(0)
+            , m_gotFileHeader(false)
+        {
+        }
+
+        // 読めたスタンプごとに onStamp(const Stamp&) を呼ぶ。
+        template <typename F>
+        void feed(const char* data, size_t len, F onStamp)
+        {
+            m_buf.append(data, len);
+
+            size_t pos = 0;
+            if (!m_gotFileHeader)
+            {
+                if (m_buf.size() < 13)
+                    return;
+                if (m_buf.compare(0, 3, "FLV") != 0)
+                {
+                    resync(pos);
+                    if (pos == std::string::npos)
+                        return;
+                }else
+                    pos = 13;
+                m_gotFileHeader = true;
+            }
+
+            while (pos + 11 <= m_buf.size())
+            {
+                auto p = reinterpret_cast<const unsigned char*>(m_buf.data() + pos);
+                int type = p[0];
+                size_t size = getBE(p + 1, 3);
+
+                if ((type != TT_VIDEO && type != TT_SCRIPT && type != 8) || size > MAX_TAG_SIZE)
+                {
+                    resync(pos);
+                    if (pos == std::string::npos)
+                        return;
+                    continue;
+                }
+                if (pos + 11 + size + 4 > m_buf.size())
+                    break;
+
+                Stamp stamp;
+                if (type == TT_VIDEO && readStamp(p + 11, size, stamp))
+                    onStamp(stamp);
+                pos += 11 + size + 4;
+            }
+            m_buf.erase(0, pos);
+        }
+
+        int numResyncs;
+
+    private:
+        // pos より後ろで最初のスタンプ付きタグの先頭を探す。見つからな
+        // ければ末尾の数バイトを残してバッファーを捨て、pos を npos に
+        // する。
+        void resync(size_t& pos)
+        {
+            numResyncs++;
+            const size_t back = 11 + STAMP_OFFSET;
+            size_t found = m_buf.find(std::string(STAMP_MAGIC, 4), pos + 1 + back);
+            if (found == std::string::npos)
+            {
+                size_t keep = std::min(m_buf.size(), back + 3);
+                m_buf.erase(0, m_buf.size() - keep);
+                pos = std::string::npos;
+                return;
+            }
+            pos = found - back;
+        }
+
+        std::string m_buf;
+        bool        m_gotFileHeader;
+    };
+}
+
+#endif
@@ -0,0 +1,298 @@
+// ------------------------------------------------
+// File : listeners.h
+// Desc:
+//      視聴者の群れ。接続は制御スレッドが一つずつ張り、受信は Reactor
+//      のワーカーでまとめて読むので、数千の視聴者でもスレッドは増えな
+//      い。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _LOADGEN_LISTENERS_H
+#define _LOADGEN_LISTENERS_H
+
+#include <sys/socket.h>
+#include <errno.h>
+
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "sys.h"
+#include "socket.h"
+#include "reactor.h"
+#include "metrics.h"
+#include "str.h"
+#include "flvgen.h"
+
+namespace loadgen
+{
+    // 視聴者をつなぐノード。tip が空でなければそこから中継させる。
+    struct Node
+    {
+        std::string host;
+        int         port;
+        std::string tip;
+        std::string netem;  // tip への接続に掛ける NetProfile の設定
+    };
+
+    class ListenerPool
+    {
+    public:
+        struct Options
+        {
+            std::string         channelID;
+            std::vector<Node>   nodes;          // 視聴者は順番に割り振る
+            int                 numListeners;
+            int                 rampPerSec;     // 1 秒に新しく張る接続の数
+            int                 churnPerSec;    // 1 秒に切って張り直す接続の数
+        };
+
+        struct Counters
+        {
+            std::atomic<uint64_t> bytes { 0 };
+            std::atomic<uint64_t> frames { 0 };
+            std::atomic<uint64_t> missedFrames { 0 };    // 通し番号の飛び
+            std::atomic<uint64_t> resyncs { 0 };
+            std::atomic<uint64_t> connects { 0 };
+            std::atomic<uint64_t> connectFailures { 0 };
+            std::atomic<uint64_t> disconnects { 0 };
+            std::atomic<int>      connected { 0 };
+        };
+
+        ListenerPool(std::shared_ptr<Reactor> reactor, Metrics::Histogram& latency)
+            : m_reactor(reactor)
+            , m_latency(latency)
+            , m_running(false)
+        {
+        }
+
+        ~ListenerPool()
+        {
+            stop();
+        }
+
+        void start(const Options& opts)
+        {
+            m_opts = opts;
+            for (int i = 0; i < opts.numListeners; i++)
+            {
+                auto l = std::make_shared<Listener>();
+                l->node = opts.nodes[i % opts.nodes.size()];
+                m_listeners.push_back(l);
+            }
+            m_running = true;
+            m_control = std::thread([this]() { control(); });
+        }
+
+        void stop()
+        {
+            if (!m_running)
+                return;
+            m_running = false;
+            m_control.join();
+
+            for (auto& l : m_listeners)
+                if (l->active)
+                {
+                    l->closeRequested = true;
+                    m_reactor->post(l->handle);
+                }
+            while (counters.connected.load() > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        // 最後に失敗した接続の理由。
+        std::string lastError()
+        {
+            std::lock_guard<std::mutex> cs(m_lock);
+            return m_lastError;
+        }
+
+        Counters counters;
+
+    private:
+        struct Listener
+        {
+            Node                            node;
+            std::shared_ptr<ClientSocket>   sock;
+            uint64_t                        handle = 0;
+            FLVReader                       reader;
+            bool                            haveSeq = false;
+            uint32_t                        lastSeq = 0;
+            std::atomic<bool>               active { false };
+            std::atomic<bool>               closeRequested { false };
+        };
+
+        // 足りない接続を張り、churnPerSec の分だけ切る。
+        void control()
+        {
+            std::mt19937 rng(1);
+            const int stepsPerSec = 10;
+            double connectBudget = 0, churnBudget = 0;
+
+            while (m_running)
+            {
+                connectBudget = std::min<double>(connectBudget + (double) m_opts.rampPerSec / stepsPerSec,
+                                                 std::max(1, m_opts.rampPerSec));
+                churnBudget += (double) m_opts.churnPerSec / stepsPerSec;
+
+                for (auto& l : m_listeners)
+                {
+                    if (connectBudget < 1 || !m_running)
+                        break;
+                    if (l->active)
+                        continue;
+                    connectBudget -= 1;
+                    connect(l);
+                }
+
+                while (churnBudget >= 1 && counters.connected.load() > 0)
+                {
+                    churnBudget -= 1;
+                    auto& l = m_listeners[rng() % m_listeners.size()];
+                    if (l->active && !l->closeRequested)
+                    {
+                        l->closeRequested = true;
+                        m_reactor->post(l->handle);
+                    }
+                }
+                if (counters.connected.load() == 0)
+                    churnBudget = 0;
+
+                std::this_thread::sleep_for(std::chrono::milliseconds(1000 / stepsPerSec));
+            }
+        }
+
+        void connect(std::shared_ptr<Listener> l)
+        {
+            try
+            {
+                auto sock = sys->createSocket();
+                Host host;
+                host.fromStrName(l->node.host.c_str(), l->node.port);
+                if (!host.ip)
+                    throw StreamException("Could not resolve host");
+                sock->open(host);
+                sock->connect();
+
+                std::string path = "/stream/" + m_opts.channelID + ".flv";
+                if (!l->node.tip.empty())
+                    path += "?tip=" + l->node.tip;
+                sock->writeString("GET " + path + " HTTP/1.0\r\n"
+                                  "User-Agent: relay-load\r\n"
+                                  "\r\n");
+
+                // 応答ヘッダーは一バイトずつ読んで、ストリームを先読みしない。
+                std::string head;
+                char c;
+                while (head.size() < 8192 &&
+                       (head.size() < 4 || head.compare(head.size() - 4, 4, "\r\n\r\n") != 0))
+                {
+                    sock->read(&c, 1);
+                    head += c;
+                }
+                if (head.compare(0, 9, "HTTP/1.0 ") != 0 && head.compare(0, 9, "HTTP/1.1 ") != 0)
+                    throw StreamException("Bad response");
+                if (head.compare(9, 3, "200") != 0)
+                    throw StreamException(head.substr(0, head.find('\r')).c_str());
+
+                sock->setBlocking(false);
+                l->sock = sock;
+                l->reader = FLVReader();
+                l->haveSeq = false;
+                l->closeRequested = false;
+                l->active = true;
+                counters.connected++;
+                counters.connects++;
+                l->handle = m_reactor->add(sock->getDescriptor(), Reactor::EV_READ,
+                                           [this, l](int events) { onEvent(*l, events); });
+            }catch (StreamException& e)
+            {
+                counters.connectFailures++;
+                std::lock_guard<std::mutex> cs(m_lock);
+                m_lastError = str::format("%s:%d: %s", l->node.host.c_str(), l->node.port, e.what());
+            }
+        }
+
+        void onEvent(Listener& l, int events)
+        {
+            if (l.closeRequested)
+            {
+                close(l);
+                return;
+            }
+            if (!(events & (Reactor::EV_READ | Reactor::EV_ERROR)))
+                return;
+
+            static thread_local char buf[64 * 1024];
+            // 一人で読み続けて他の視聴者を待たせないよう、回数を限る。
+            for (int i = 0; i < 16; i++)
+            {
+                ssize_t r = recv(l.sock->getDescriptor(), buf, sizeof(buf), 0);
+                if (r > 0)
+                {
+                    counters.bytes += r;
+                    receive(l, buf, r);
+                }else if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                {
+                    return;
+                }else
+                {
+                    close(l);
+                    return;
+                }
+            }
+        }
+
+        void receive(Listener& l, const char* data, size_t len)
+        {
+            const uint64_t now = nowMicros();
+            int before = l.reader.numResyncs;
+            l.reader.feed(data, len,
+                          [&](const Stamp& stamp)
+                          {
+                              counters.frames++;
+                              if (stamp.sendTime <= now)
+                                  m_latency.observe((now - stamp.sendTime) / 1000000.0);
+                              if (l.haveSeq && stamp.seq > l.lastSeq + 1)
+                                  counters.missedFrames += stamp.seq - l.lastSeq - 1;
+                              l.haveSeq = true;
+                              l.lastSeq = stamp.seq;
+                          });
+            counters.resyncs += l.reader.numResyncs - before;
+        }
+
+        void close(Listener& l)
+        {
+            m_reactor->remove(l.handle);
+            l.sock->close();
+            l.sock = nullptr;
+            counters.connected--;
+            counters.disconnects++;
+            l.active = false;
+        }
+
+        std::shared_ptr<Reactor>                m_reactor;
+        Metrics::Histogram&                     m_latency;
+        Options                                 m_opts;
+        std::vector<std::shared_ptr<Listener>>  m_listeners;
+        std::atomic<bool>                       m_running;
+        std::thread                             m_control;
+        std::mutex                              m_lock;
+        std::string                             m_lastError;
+    };
+}
+
+#endif
@@ -0,0 +1,196 @@
+// ------------------------------------------------
+// File : netem.h
+// Desc:
+//      ネットワークの模型。片方向のリンクの遅延、揺らぎ、帯域、損失、
+//      切断を、書き込みの塊ごとに「いつ届くか」として決める。乱数は種
+//      から作るので、同じ設定なら何度でも同じ結果になる。
+//
+//      テストの NetemClientSocket と relay-load の --netem が使う。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _LOADGEN_NETEM_H
+#define _LOADGEN_NETEM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+namespace loadgen
+{
+    // 片方向のリンクの性質。時間は秒。
+    struct NetProfile
+    {
+        double      delay       = 0;    // 片道の遅延
+        double      jitter      = 0;    // 遅延に足す一様乱数の幅
+        int         kbps        = 0;    // 帯域。0 なら無制限
+        int         buffer      = 0;    // 送り切れていない分がこのバイト数を超えたら書き込みを待たせる。0 なら待たせない
+        double      loss        = 0;    // 書き込みごとの損失率。TCP なので再送の分だけ遅れて届く
+        double      cutAfter    = 0;    // 最初の書き込みからこの秒数で切断する。0 なら切らない
+        uint64_t    cutAfterBytes = 0;  // これだけ送ったところで切断する。0 なら切らない
+        uint32_t    seed        = 1;
+
+        // "delay=50ms,jitter=10ms,kbps=2000,buffer=65536,loss=0.01,cut=30s,cutbytes=1000000,seed=7"
+        // 時間の単位は ms か s で、省略すれば秒。解釈できなければ
+        // std::invalid_argument を投げる。
+        static NetProfile parse(const std::string& spec)
+        {
+            NetProfile p;
+            size_t start = 0;
+            while (start < spec.size())
+            {
+                size_t end = spec.find(',', start);
+                if (end == std::string::npos)
+                    end = spec.size();
+                std::string item = spec.substr(start, end - start);
+                start = end + 1;
+                if (item.empty())
+                    continue;
+
+                auto eq = item.find('=');
+                if (eq == std::string::npos)
+                    throw std::invalid_argument("netem: key=value expected: " + item);
+                std::string key = item.substr(0, eq);
+                std::string val = item.substr(eq + 1);
+
+                if (key == "delay")             p.delay = parseSeconds(val);
+                else if (key == "jitter")       p.jitter = parseSeconds(val);
+                else if (key == "kbps")         p.kbps = (int) parseNumber(val);
+                else if (key == "buffer")       p.buffer = (int) parseNumber(val);
+                else if (key == "loss")         p.loss = parseNumber(val);
+                else if (key == "cut")          p.cutAfter = parseSeconds(val);
+                else if (key == "cutbytes")     p.cutAfterBytes = (uint64_t) parseNumber(val);
+                else if (key == "seed")         p.seed = (uint32_t) parseNumber(val);
+                else
+                    throw std::invalid_argument("netem: unknown key " + key);
+            }
+            if (p.delay < 0 || p.jitter < 0 || p.kbps < 0 || p.buffer < 0 ||
+                p.loss < 0 || p.loss > 1 || p.cutAfter < 0)
+                throw std::invalid_argument("netem: value out of range: " + spec);
+            return p;
+        }
+
+        static double parseNumber(const std::string& s)
+        {
+            char* end;
+            double v = strtod(s.c_str(), &end);
+            if (s.empty() || *end)
+                throw std::invalid_argument("netem: number expected: " + s);
+            return v;
+        }
+
+        static double parseSeconds(const std::string& s)
+        {
+            if (s.size() > 2 && s.compare(s.size() - 2, 2, "ms") == 0)
+                return parseNumber(s.substr(0, s.size() - 2)) / 1000;
+            if (s.size() > 1 && s.back() == 's')
+                return parseNumber(s.substr(0, s.size() - 1));
+            return parseNumber(s);
+        }
+    };
+
+    // 片方向のリンク。スレッドセーフではないので、使う側で排他する。
+    class NetLink
+    {
+    public:
+        explicit NetLink(const NetProfile& profile)
+            : profile(profile)
+            , bytesSent(0)
+            , numLost(0)
+            , m_rand(profile.seed)
+            , m_start(-1)
+            , m_busyUntil(0)
+            , m_lastDelivery(0)
+            , m_cut(false)
+        {
+        }
+
+        // now に len バイト書いた時に相手に届く時刻。切断されていれば
+        // 負の値。届く順番は書いた順番のまま。
+        double send(size_t len, double now)
+        {
+            if (m_start < 0)
+                m_start = now;
+            if (isCut(now))
+                return -1;
+            if (profile.cutAfterBytes && bytesSent + len > profile.cutAfterBytes)
+            {
+                m_cut = true;
+                return -1;
+            }
+            bytesSent += len;
+
+            // 帯域の分だけ前の塊の後ろに並ぶ。
+            double start = std::max(now, m_busyUntil);
+            m_busyUntil = start + (profile.kbps ? len * 8.0 / (profile.kbps * 1000.0) : 0);
+
+            std::uniform_real_distribution<double> uniform(0, 1);
+            double t = m_busyUntil + profile.delay + profile.jitter * uniform(m_rand);
+            if (uniform(m_rand) < profile.loss)
+            {
+                t += retransmitTimeout();
+                numLost++;
+            }
+
+            // 後ろの塊は前の塊を追い越せない。
+            t = std::max(t, m_lastDelivery);
+            m_lastDelivery = t;
+            return t;
+        }
+
+        // 次の書き込みが出来るようになる時刻。buffer を超えた分が送り
+        // 出されるまで待たせる。
+        double writableAt(double now) const
+        {
+            if (!profile.kbps || !profile.buffer)
+                return now;
+            return std::max(now, m_busyUntil - profile.buffer * 8.0 / (profile.kbps * 1000.0));
+        }
+
+        bool isCut(double now) const
+        {
+            if (m_cut)
+                return true;
+            return profile.cutAfter > 0 && m_start >= 0 && now - m_start >= profile.cutAfter;
+        }
+
+        // 切断する。以後の send は負を返す。
+        void cut()
+        {
+            m_cut = true;
+        }
+
+        // 損失した塊が届くまでの遅れ。Linux と同じく最小 200ms。
+        double retransmitTimeout() const
+        {
+            return std::max(0.2, 2 * (2 * profile.delay + profile.jitter));
+        }
+
+        const NetProfile profile;
+        uint64_t    bytesSent;
+        uint64_t    numLost;
+
+    private:
+        std::mt19937 m_rand;
+        double      m_start;
+        double      m_busyUntil;        // 帯域を使い終わる時刻
+        double      m_lastDelivery;
+        bool        m_cut;
+    };
+}
+
+#endif
@@ -0,0 +1,302 @@
+// ------------------------------------------------
+// File : netproxy.h
+// Desc:
+//      netem.h の模型を掛ける TCP の中継。relay-load はノードの tip を
+//      これに差し替えて、ノード間のリレーの接続に遅延、帯域、損失、切
+//      断を与える。接続ごとに向き一つにつき一つのスレッドを使うので、
+//      数の少ないリレーの接続向け。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _LOADGEN_NETPROXY_H
+#define _LOADGEN_NETPROXY_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "netem.h"
+
+namespace loadgen
+{
+    class NetemProxy
+    {
+    public:
+        struct Counters
+        {
+            std::atomic<uint64_t> connections { 0 };
+            std::atomic<uint64_t> bytes { 0 };
+            std::atomic<uint64_t> lost { 0 };       // 再送の遅れを足した塊
+            std::atomic<uint64_t> cuts { 0 };
+        };
+
+        // target ("HOST:PORT") への接続を中継する。up はノードから
+        // target へ、down はその逆の向き。
+        NetemProxy(const std::string& target, const NetProfile& up, const NetProfile& down)
+            : m_target(target)
+            , m_up(up)
+            , m_down(down)
+            , m_listenFD(-1)
+            , m_port(0)
+            , m_running(false)
+            , m_numAccepted(0)
+        {
+        }
+
+        ~NetemProxy()
+        {
+            stop();
+        }
+
+        // 127.0.0.1 の空いているポートで待ち受けを始める。出来なけれ
+        // ば std::runtime_error を投げる。
+        void start()
+        {
+            m_targetAddr = resolve(m_target);
+
+            m_listenFD = socket(AF_INET, SOCK_STREAM, 0);
+            if (m_listenFD < 0)
+                throw std::runtime_error("netem proxy: socket failed");
+            sockaddr_in sin = {};
+            sin.sin_family = AF_INET;
+            sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t len = sizeof(sin);
+            if (bind(m_listenFD, (sockaddr*) &sin, sizeof(sin)) != 0 ||
+                listen(m_listenFD, 16) != 0 ||
+                getsockname(m_listenFD, (sockaddr*) &sin, &len) != 0)
+                throw std::runtime_error("netem proxy: cannot listen");
+            m_port = ntohs(sin.sin_port);
+
+            m_running = true;
+            m_acceptThread = std::thread([this]() { acceptLoop(); });
+        }
+
+        void stop()
+        {
+            if (!m_running)
+                return;
+            m_running = false;
+            m_acceptThread.join();
+            ::close(m_listenFD);
+
+            std::lock_guard<std::mutex> cs(m_lock);
+            for (auto& c : m_conns)
+                c->close();
+            m_conns.clear();
+        }
+
+        // ノードに tip として渡すアドレス。
+        std::string address() const
+        {
+            return "127.0.0.1:" + std::to_string(m_port);
+        }
+
+        Counters counters;
+
+    private:
+        struct Connection
+        {
+            int     nodeFD  = -1;
+            int     tipFD   = -1;
+            std::thread up, down;
+
+            void shutdownBoth()
+            {
+                shutdown(nodeFD, SHUT_RDWR);
+                shutdown(tipFD, SHUT_RDWR);
+            }
+
+            void close()
+            {
+                shutdownBoth();
+                up.join();
+                down.join();
+                ::close(nodeFD);
+                ::close(tipFD);
+            }
+
+            std::atomic<int> numDone { 0 };
+        };
+
+        static double now()
+        {
+            using namespace std::chrono;
+            return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+        }
+
+        static sockaddr_in resolve(const std::string& spec)
+        {
+            auto colon = spec.rfind(':');
+            if (colon == std::string::npos)
+                throw std::runtime_error("netem proxy: HOST:PORT expected: " + spec);
+            addrinfo hints = {}, *res;
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_STREAM;
+            if (getaddrinfo(spec.substr(0, colon).c_str(), spec.substr(colon + 1).c_str(), &hints, &res) != 0)
+                throw std::runtime_error("netem proxy: cannot resolve " + spec);
+            sockaddr_in addr = *(sockaddr_in*) res->ai_addr;
+            freeaddrinfo(res);
+            return addr;
+        }
+
+        void acceptLoop()
+        {
+            while (m_running)
+            {
+                reapFinished();
+
+                pollfd pfd = { m_listenFD, POLLIN, 0 };
+                if (poll(&pfd, 1, 200) <= 0)
+                    continue;
+                int fd = accept(m_listenFD, nullptr, nullptr);
+                if (fd < 0)
+                    continue;
+
+                int tip = socket(AF_INET, SOCK_STREAM, 0);
+                if (tip < 0 || connect(tip, (sockaddr*) &m_targetAddr, sizeof(m_targetAddr)) != 0)
+                {
+                    // 相手につながらなければ、ノードにもそう見せる。
+                    if (tip >= 0)
+                        ::close(tip);
+                    ::close(fd);
+                    continue;
+                }
+
+                // 接続ごとに種をずらして、向きと接続の組ごとに決まった
+                // 乱数にする。
+                unsigned int n = m_numAccepted++;
+                NetProfile up = m_up, down = m_down;
+                up.seed += 2 * n;
+                down.seed += 2 * n + 1;
+
+                auto c = std::make_shared<Connection>();
+                c->nodeFD = fd;
+                c->tipFD = tip;
+                c->up = std::thread([this, c, up]() { pump(*c, c->nodeFD, c->tipFD, up); });
+                c->down = std::thread([this, c, down]() { pump(*c, c->tipFD, c->nodeFD, down); });
+                counters.connections++;
+
+                std::lock_guard<std::mutex> cs(m_lock);
+                m_conns.push_back(c);
+            }
+        }
+
+        void reapFinished()
+        {
+            std::lock_guard<std::mutex> cs(m_lock);
+            for (auto it = m_conns.begin(); it != m_conns.end(); )
+            {
+                if ((*it)->numDone == 2)
+                {
+                    (*it)->close();
+                    it = m_conns.erase(it);
+                }else
+                    ++it;
+            }
+        }
+
+        // from から読んだものを、模型の決めた時刻に to へ書く。
+        void pump(Connection& c, int from, int to, const NetProfile& profile)
+        {
+            NetLink link(profile);
+            std::deque<std::pair<double, std::string>> queue;
+            bool eof = false;
+            char buf[16 * 1024];
+
+            while (true)
+            {
+                double t = now();
+                bool failed = false;
+                while (!queue.empty() && queue.front().first <= t)
+                {
+                    auto& data = queue.front().second;
+                    if (send(to, data.data(), data.size(), MSG_NOSIGNAL) != (ssize_t) data.size())
+                    {
+                        failed = true;
+                        break;
+                    }
+                    counters.bytes += data.size();
+                    queue.pop_front();
+                }
+                if (failed)
+                {
+                    c.shutdownBoth();
+                    break;
+                }
+                if (eof && queue.empty())
+                {
+                    shutdown(to, SHUT_WR);
+                    break;
+                }
+
+                // 次の塊が届く時刻か、書けるようになる時刻まで待つ。
+                double wake = queue.empty() ? t + 0.1 : queue.front().first;
+                bool canRead = !eof && link.writableAt(t) <= t;
+                if (!eof && !canRead)
+                    wake = std::min(wake, link.writableAt(t));
+                pollfd pfd = { from, (short) (canRead ? POLLIN : 0), 0 };
+                poll(&pfd, 1, std::max(0, (int) ceil((wake - t) * 1000)));
+                if (!canRead || !(pfd.revents & (POLLIN | POLLHUP | POLLERR)))
+                    continue;
+
+                ssize_t r = recv(from, buf, sizeof(buf), 0);
+                if (r < 0 && errno == EINTR)
+                    continue;
+                if (r <= 0)
+                {
+                    eof = true;
+                    continue;
+                }
+                uint64_t lost = link.numLost;
+                double at = link.send(r, now());
+                if (at < 0)
+                {
+                    counters.cuts++;
+                    c.shutdownBoth();
+                    break;
+                }
+                counters.lost += link.numLost - lost;
+                queue.push_back({ at, std::string(buf, r) });
+            }
+            c.numDone++;
+        }
+
+        const std::string   m_target;
+        const NetProfile    m_up, m_down;
+        sockaddr_in         m_targetAddr;
+        int                 m_listenFD;
+        int                 m_port;
+        std::atomic<bool>   m_running;
+        unsigned int        m_numAccepted;
+        std::thread         m_acceptThread;
+        std::mutex          m_lock;
+        std::list<std::shared_ptr<Connection>> m_conns;
+    };
+}
+
+#endif
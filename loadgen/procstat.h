@@ -0,0 +1,77 @@
+// ------------------------------------------------
+// File : procstat.h
+// Desc:
+//      /proc から測定対象のプロセスの CPU 時間と常駐メモリを読む。
+//      Linux 以外では読めないものとして扱う。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _LOADGEN_PROCSTAT_H
+#define _LOADGEN_PROCSTAT_H
+
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace loadgen
+{
+    struct ProcSample
+    {
+        bool    ok = false;
+        double  cpuSeconds = 0;     // ユーザーとシステムの合計
+        long    rssKB = 0;
+    };
+
+    // pid が 0 なら自分自身。
+    inline ProcSample sampleProcess(int pid)
+    {
+        ProcSample s;
+        const std::string dir = pid ? "/proc/" + std::to_string(pid) : std::string("/proc/self");
+
+        std::ifstream stat(dir + "/stat");
+        std::string line;
+        if (!std::getline(stat, line))
+            return s;
+
+        // comm には空白や括弧が入りうるので、最後の ')' の後から数える。
+        auto rparen = line.rfind(')');
+        if (rparen == std::string::npos)
+            return s;
+        std::istringstream fields(line.substr(rparen + 2));
+        std::string f;
+        unsigned long utime = 0, stime = 0;
+        // state が 3 番目で、utime と stime は 14、15 番目。
+        for (int i = 3; i <= 15 && fields >> f; i++)
+        {
+            if (i == 14) utime = std::stoul(f);
+            if (i == 15) stime = std::stoul(f);
+        }
+        s.cpuSeconds = (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+
+        std::ifstream status(dir + "/status");
+        while (std::getline(status, line))
+        {
+            if (line.compare(0, 6, "VmRSS:") == 0)
+            {
+                s.rssKB = std::stol(line.substr(6));
+                break;
+            }
+        }
+        s.ok = true;
+        return s;
+    }
+}
+
+#endif
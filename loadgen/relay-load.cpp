@@ -0,0 +1,456 @@
+// ------------------------------------------------
+// File : relay-load.cpp
+// Desc:
+//      リレーの負荷試験。合成 FLV を配信元に HTTP Push し、一つ以上の
+//      ノードに大量の視聴者をつないで、受信量、遅延、フレームの欠落、
+//      ノード側のスキップ数、プロセスの CPU とメモリを定期的に表示する。
+//      PeerCast のプロセスの起動とリレーの木の組み立ては soak.rb が行う。
+//
+//      relay-load --origin 127.0.0.1:7144 --node 127.0.0.1:7145 \
+//          --via 127.0.0.1:7144 --listeners 2000 --duration 600
+//
+//      --netem を付けたノードの tip への接続は NetemProxy を通すので、
+//      一台の上でも遅延や帯域の細いリレーの木を作れる。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/resource.h>
+
+#include <iostream>
+#include <map>
+
+#include "usys.h"
+#include "json.hpp"
+#include "str.h"
+
+#include "broadcaster.h"
+#include "listeners.h"
+#include "netproxy.h"
+#include "procstat.h"
+
+using namespace loadgen;
+
+namespace
+{
+    struct Config
+    {
+        Node                origin      { "127.0.0.1", 7144, "" };
+        std::vector<Node>   nodes;
+        std::string         name        = "relay-load";
+        std::string         channelID;      // 指定されたら配信しない
+        int                 kbps        = 500;
+        int                 fps         = 30;
+        double              keyInterval = 2;
+        int                 listeners   = 100;
+        int                 ramp        = 50;
+        int                 churn       = 0;
+        int                 duration    = 60;
+        int                 interval    = 5;
+        std::vector<int>    pids;
+        double              maxP99      = 0;    // 0 なら判定しない
+        double              maxMissed   = -1;   // 欠落率。負なら判定しない
+    };
+
+    void die(const std::string& message)
+    {
+        std::cerr << "relay-load: " << message << std::endl;
+        exit(2);
+    }
+
+    void usage()
+    {
+        std::cerr <<
+            "Usage: relay-load [options]\n"
+            "  --origin HOST:PORT     node to push to and ask for the channel ID (127.0.0.1:7144)\n"
+            "  --node HOST:PORT       node to attach listeners to; repeatable (origin)\n"
+            "  --via HOST:PORT        make the preceding --node relay from this tip\n"
+            "  --netem SPEC           emulate the preceding --node's link to its tip, e.g.\n"
+            "                         delay=50ms,jitter=10ms,kbps=2000,buffer=65536,loss=0.01,cut=30s,seed=1\n"
+            "  --channel ID           listen to an existing channel instead of pushing one\n"
+            "  --name NAME            channel name to push (relay-load)\n"
+            "  --bitrate KBPS         stream bitrate (500)\n"
+            "  --fps N                video frames per second (30)\n"
+            "  --keyint SEC           keyframe interval (2)\n"
+            "  --listeners N          simulated listeners (100)\n"
+            "  --ramp N               new connections per second (50)\n"
+            "  --churn N              listeners dropped and reconnected per second (0)\n"
+            "  --duration SEC         run time (60)\n"
+            "  --interval SEC         report interval (5)\n"
+            "  --pid PID              process to sample CPU and memory of; repeatable\n"
+            "  --max-p99 SEC          fail if the final p99 latency exceeds SEC\n"
+            "  --max-missed RATIO     fail if the missed frame ratio exceeds RATIO\n";
+        exit(2);
+    }
+
+    Node parseNode(const std::string& spec)
+    {
+        auto colon = spec.rfind(':');
+        if (colon == std::string::npos)
+            die("HOST:PORT expected: " + spec);
+        return { spec.substr(0, colon), std::stoi(spec.substr(colon + 1)), "" };
+    }
+
+    Config parseArgs(int argc, char* argv[])
+    {
+        Config cfg;
+        for (int i = 1; i < argc; i++)
+        {
+            std::string opt = argv[i];
+            if (opt == "-h" || opt == "--help")
+                usage();
+            if (i + 1 >= argc)
+                die("no value for option " + opt);
+            std::string val = argv[++i];
+
+            if (opt == "--origin")          cfg.origin = parseNode(val);
+            else if (opt == "--node")       cfg.nodes.push_back(parseNode(val));
+            else if (opt == "--via")
+            {
+                if (cfg.nodes.empty())
+                    die("--via must follow --node");
+                cfg.nodes.back().tip = val;
+            }
+            else if (opt == "--netem")
+            {
+                if (cfg.nodes.empty() || cfg.nodes.back().tip.empty())
+                    die("--netem must follow --via");
+                try
+                {
+                    NetProfile::parse(val);
+                }catch (std::invalid_argument& e)
+                {
+                    die(e.what());
+                }
+                cfg.nodes.back().netem = val;
+            }
+            else if (opt == "--channel")    cfg.channelID = val;
+            else if (opt == "--name")       cfg.name = val;
+            else if (opt == "--bitrate")    cfg.kbps = std::stoi(val);
+            else if (opt == "--fps")        cfg.fps = std::stoi(val);
+            else if (opt == "--keyint")     cfg.keyInterval = std::stod(val);
+            else if (opt == "--listeners")  cfg.listeners = std::stoi(val);
+            else if (opt == "--ramp")       cfg.ramp = std::stoi(val);
+            else if (opt == "--churn")      cfg.churn = std::stoi(val);
+            else if (opt == "--duration")   cfg.duration = std::stoi(val);
+            else if (opt == "--interval")   cfg.interval = std::max(1, std::stoi(val));
+            else if (opt == "--pid")        cfg.pids.push_back(std::stoi(val));
+            else if (opt == "--max-p99")    cfg.maxP99 = std::stod(val);
+            else if (opt == "--max-missed") cfg.maxMissed = std::stod(val);
+            else
+                die("unknown option " + opt);
+        }
+        if (cfg.nodes.empty())
+            cfg.nodes.push_back(cfg.origin);
+        return cfg;
+    }
+
+    // Connection: close で一往復する。(ステータスコード, 本文) を返す。
+    std::pair<int,std::string> request(const Node& node, const std::string& method,
+                                       const std::string& path, const std::string& body = "")
+    {
+        auto sock = sys->createSocket();
+        Host host;
+        host.fromStrName(node.host.c_str(), node.port);
+        if (!host.ip)
+            throw StreamException("Could not resolve " + node.host);
+        sock->setReadTimeout(5000);
+        sock->open(host);
+        sock->connect();
+
+        std::string req = method + " " + path + " HTTP/1.0\r\n"
+            "Connection: close\r\n";
+        if (!body.empty())
+            req += "Content-Type: application/json\r\n"
+                "X-Requested-With: XMLHttpRequest\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n";
+        req += "\r\n" + body;
+        sock->writeString(req);
+
+        std::string res;
+        char buf[4096];
+        int r;
+        while ((r = sock->readUpto(buf, sizeof(buf))) > 0)
+            res.append(buf, r);
+        sock->close();
+
+        auto end = res.find("\r\n\r\n");
+        if (res.compare(0, 5, "HTTP/") != 0 || end == std::string::npos)
+            throw StreamException("Bad response from " + node.host);
+        int status = atoi(res.c_str() + res.find(' ') + 1);
+        return { status, res.substr(end + 4) };
+    }
+
+    // 配信元の JSON-RPC で名前が name のチャンネルの ID を探す。
+    std::string findChannelID(const Node& origin, const std::string& name, int timeoutSec)
+    {
+        for (int i = 0; i < timeoutSec * 5; i++)
+        {
+            try
+            {
+                auto res = request(origin, "POST", "/api/1",
+                                   R"({"jsonrpc":"2.0","method":"getChannels","params":[],"id":1})");
+                if (res.first == 200)
+                {
+                    auto json = nlohmann::json::parse(res.second);
+                    for (auto& ch : json.at("result"))
+                        if (ch.at("info").at("name").get<std::string>() == name)
+                            return ch.at("channelId").get<std::string>();
+                }else
+                    die(str::format("getChannels: HTTP %d", res.first));
+            }catch (StreamException&)
+            {
+            }catch (std::exception& e)
+            {
+                die(std::string("getChannels: ") + e.what());
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+        die("channel " + name + " did not appear on the origin");
+        return "";
+    }
+
+    // ノードの /metrics から name で始まる系列の値を合計する。読めなけ
+    // れば -1。
+    double scrapeSum(const Node& node, const std::string& name)
+    {
+        try
+        {
+            auto res = request(node, "GET", "/metrics");
+            if (res.first != 200)
+                return -1;
+            double sum = 0;
+            for (auto& line : str::split(res.second, "\n"))
+            {
+                if (line.compare(0, name.size(), name) != 0)
+                    continue;
+                char next = line[name.size()];
+                if (next != '{' && next != ' ')
+                    continue;
+                sum += atof(line.c_str() + line.rfind(' ') + 1);
+            }
+            return sum;
+        }catch (StreamException&)
+        {
+            return -1;
+        }
+    }
+
+    // counts は Metrics::Histogram::counts() の差分。
+    double quantile(const std::vector<double>& bounds, const std::vector<uint64_t>& counts, double q)
+    {
+        uint64_t total = 0;
+        for (auto c : counts)
+            total += c;
+        if (total == 0)
+            return 0;
+        uint64_t rank = (uint64_t) (q * total);
+        uint64_t acc = 0;
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            acc += counts[i];
+            if (acc > rank)
+                return bounds[std::min(i, bounds.size() - 1)];
+        }
+        return bounds.back();
+    }
+
+    std::string formatSeconds(double s)
+    {
+        if (s < 1)
+            return str::format("%.0fms", s * 1000);
+        return str::format("%.2fs", s);
+    }
+
+    void raiseFileLimit()
+    {
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+        {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    sys = new USys();
+    signal(SIGPIPE, SIG_IGN);
+    raiseFileLimit();
+
+    Config cfg = parseArgs(argc, argv);
+
+    std::unique_ptr<Broadcaster> source;
+    std::string channelID = cfg.channelID;
+    if (channelID.empty())
+    {
+        source.reset(new Broadcaster({ cfg.origin.host, cfg.origin.port, cfg.name,
+                                       cfg.kbps, cfg.fps, cfg.keyInterval }));
+        source->start();
+        channelID = findChannelID(cfg.origin, cfg.name, 10);
+        printf("channel %s\n", channelID.c_str());
+    }
+
+    // ノードが tip につなぐ前に、間に模型を挟む。
+    std::vector<std::unique_ptr<NetemProxy>> proxies;
+    for (auto& node : cfg.nodes)
+    {
+        if (node.netem.empty())
+            continue;
+        auto profile = NetProfile::parse(node.netem);
+        proxies.emplace_back(new NetemProxy(node.tip, profile, profile));
+        try
+        {
+            proxies.back()->start();
+        }catch (std::runtime_error& e)
+        {
+            die(e.what());
+        }
+        printf("netem %s:%d -> %s via %s (%s)\n", node.host.c_str(), node.port, node.tip.c_str(),
+               proxies.back()->address().c_str(), node.netem.c_str());
+        node.tip = proxies.back()->address();
+    }
+
+    auto reactor = sys->createReactor();
+    if (!reactor)
+        die("no reactor on this platform");
+
+    // 1 ms から 1.25 倍ずつ、およそ 36 秒まで。
+    Metrics::Histogram latency(Metrics::Histogram::exponentialBounds(0.001, 1.25, 48));
+    ListenerPool pool(reactor, latency);
+    pool.start({ channelID, cfg.nodes, cfg.listeners, cfg.ramp, cfg.churn });
+
+    std::vector<ProcSample> lastProc;
+    for (int pid : cfg.pids)
+        lastProc.push_back(sampleProcess(pid));
+
+    auto& c = pool.counters;
+    uint64_t lastBytes = 0, lastFrames = 0, lastMissed = 0;
+    std::vector<uint64_t> lastCounts = latency.counts();
+    uint64_t lastFailures = 0;
+    double lastSkips = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int t = cfg.interval; t <= cfg.duration; t += cfg.interval)
+    {
+        std::this_thread::sleep_until(start + std::chrono::seconds(t));
+
+        uint64_t bytes = c.bytes, frames = c.frames, missed = c.missedFrames;
+        auto counts = latency.counts();
+        std::vector<uint64_t> delta(counts.size());
+        for (size_t i = 0; i < counts.size(); i++)
+            delta[i] = counts[i] - lastCounts[i];
+
+        std::string line = str::format("t=%ds listeners=%d/%d rx=%.1fMbps frames=%llu missed=%llu",
+                                       t, c.connected.load(), cfg.listeners,
+                                       (bytes - lastBytes) * 8.0 / cfg.interval / 1e6,
+                                       (unsigned long long) (frames - lastFrames),
+                                       (unsigned long long) (missed - lastMissed));
+        line += str::format(" lat p50=%s p99=%s p999=%s",
+                            formatSeconds(quantile(latency.bounds(), delta, 0.5)).c_str(),
+                            formatSeconds(quantile(latency.bounds(), delta, 0.99)).c_str(),
+                            formatSeconds(quantile(latency.bounds(), delta, 0.999)).c_str());
+
+        double skips = 0;
+        bool haveSkips = false;
+        for (auto& node : cfg.nodes)
+        {
+            double s = scrapeSum(node, "peercast_connection_skips_total");
+            if (s >= 0)
+            {
+                skips += s;
+                haveSkips = true;
+            }
+        }
+        if (haveSkips)
+        {
+            // 接続が切れると系列が消えるので、減った時は 0 とする。
+            line += str::format(" skips=%.0f", std::max(0.0, skips - lastSkips));
+            lastSkips = skips;
+        }
+
+        for (size_t i = 0; i < cfg.pids.size(); i++)
+        {
+            auto s = sampleProcess(cfg.pids[i]);
+            if (s.ok && lastProc[i].ok)
+                line += str::format(" [%d cpu=%.1f%% rss=%ldMB]", cfg.pids[i],
+                                    (s.cpuSeconds - lastProc[i].cpuSeconds) * 100 / cfg.interval,
+                                    s.rssKB / 1024);
+            lastProc[i] = s;
+        }
+        auto self = sampleProcess(0);
+        line += str::format(" [self rss=%ldMB]", self.rssKB / 1024);
+
+        puts(line.c_str());
+        if (c.connectFailures > lastFailures)
+            printf("  %llu connect failures, last: %s\n",
+                   (unsigned long long) (c.connectFailures - lastFailures), pool.lastError().c_str());
+        if (source && !source->lastError().empty())
+            printf("  source: %s (%llu reconnects)\n",
+                   source->lastError().c_str(), (unsigned long long) source->reconnects.load());
+        fflush(stdout);
+
+        lastBytes = bytes;
+        lastFrames = frames;
+        lastMissed = missed;
+        lastCounts = counts;
+        lastFailures = c.connectFailures;
+    }
+
+    pool.stop();
+    if (source)
+        source->stop();
+    for (auto& proxy : proxies)
+        proxy->stop();
+
+    // 全体の集計と合否。
+    const double p99 = latency.quantile(0.99);
+    const double missedRatio = c.frames + c.missedFrames ?
+        (double) c.missedFrames / (c.frames + c.missedFrames) : 0;
+    printf("total: connects=%llu failures=%llu disconnects=%llu frames=%llu missed=%llu (%.4f%%) resyncs=%llu\n",
+           (unsigned long long) c.connects.load(), (unsigned long long) c.connectFailures.load(),
+           (unsigned long long) c.disconnects.load(), (unsigned long long) c.frames.load(),
+           (unsigned long long) c.missedFrames.load(), missedRatio * 100,
+           (unsigned long long) c.resyncs.load());
+    for (auto& proxy : proxies)
+        printf("netem %s: connections=%llu bytes=%llu lost=%llu cuts=%llu\n",
+               proxy->address().c_str(),
+               (unsigned long long) proxy->counters.connections.load(),
+               (unsigned long long) proxy->counters.bytes.load(),
+               (unsigned long long) proxy->counters.lost.load(),
+               (unsigned long long) proxy->counters.cuts.load());
+    printf("latency: p50=%s p90=%s p99=%s p999=%s\n",
+           formatSeconds(latency.quantile(0.5)).c_str(), formatSeconds(latency.quantile(0.9)).c_str(),
+           formatSeconds(p99).c_str(), formatSeconds(latency.quantile(0.999)).c_str());
+
+    bool failed = false;
+    if (cfg.maxP99 > 0 && p99 > cfg.maxP99)
+    {
+        printf("FAIL: p99 latency %s exceeds %s\n", formatSeconds(p99).c_str(), formatSeconds(cfg.maxP99).c_str());
+        failed = true;
+    }
+    if (cfg.maxMissed >= 0 && missedRatio > cfg.maxMissed)
+    {
+        printf("FAIL: missed frame ratio %.4f exceeds %.4f\n", missedRatio, cfg.maxMissed);
+        failed = true;
+    }
+    if (c.frames == 0)
+    {
+        printf("FAIL: no frames received\n");
+        failed = true;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,59 @@
+#!/usr/bin/env ruby
+# 配信元と中継ノードの PeerCast を起動して relay-load を走らせる。
+#
+#   ruby soak.rb --bin ../build [--relays N] [--fanout F] [--port P] [--netem SPEC] -- [relay-load の引数]
+#
+# ノード 0 が配信元。ノード i (1..N) はノード (i-1)/F から中継するので、
+# F 分木ができる。視聴者は全てのノードに割り振る。relay-load の終了ステー
+# タスをそのまま返す。--netem を付けると、全てのリレーの接続にその模型を
+# 掛ける。
+require 'fileutils'
+require 'optparse'
+require 'tmpdir'
+
+opts = { bin: '.', relays: 0, fanout: 2, port: 7144 }
+parser = OptionParser.new do |o|
+  o.on('--bin DIR', 'directory with peercast and relay-load') { |v| opts[:bin] = v }
+  o.on('--relays N', Integer) { |v| opts[:relays] = v }
+  o.on('--fanout F', Integer) { |v| opts[:fanout] = v }
+  o.on('--port P', Integer, 'port of the origin; relays use the following ones') { |v| opts[:port] = v }
+  o.on('--netem SPEC', 'network emulation for every relay link') { |v| opts[:netem] = v }
+end
+load_args = parser.parse(ARGV)
+
+master = File.read(File.join(__dir__, '..', 'bvt', 'peercast.ini.master'))
+
+def spawn_node(dir, ini, bin)
+  FileUtils.mkdir_p(dir)
+  File.write(File.join(dir, 'peercast.ini'), ini)
+  pid = spawn(File.expand_path(File.join(bin, 'peercast')), '-i', 'peercast.ini', '-P', '.',
+              chdir: dir, out: File.join(dir, 'stdout.log'), err: [:child, :out])
+  at_exit { Process.kill(9, pid) rescue nil }
+  pid
+end
+
+Dir.mktmpdir('peercast-soak') do |tmp|
+  nodes = (0..opts[:relays]).map do |i|
+    port = opts[:port] + i
+    # 負荷試験なので接続数の上限は外す。
+    ini = master.sub(/^serverPort = .*$/, "serverPort = #{port}")
+                .sub(/^maxRelays = .*$/, 'maxRelays = 1000')
+                .sub(/^maxDirect = .*$/, 'maxDirect = 100000')
+                .sub(/^maxServIn = .*$/, 'maxServIn = 100000')
+    { port: port, pid: spawn_node(File.join(tmp, "node#{i}"), ini, opts[:bin]) }
+  end
+  sleep 1.0
+  fail 'peercast died immediately after spawn' if Process.wait(-1, Process::WNOHANG)
+
+  args = ['--origin', "127.0.0.1:#{nodes[0][:port]}"]
+  nodes.each_with_index do |n, i|
+    args += ['--node', "127.0.0.1:#{n[:port]}"]
+    next if i == 0
+    args += ['--via', "127.0.0.1:#{nodes[(i - 1) / opts[:fanout]][:port]}"]
+    args += ['--netem', opts[:netem]] if opts[:netem]
+  end
+  nodes.each { |n| args += ['--pid', n[:pid].to_s] }
+
+  system(File.expand_path(File.join(opts[:bin], 'relay-load')), *args, *load_args)
+  exit($?.exitstatus || 1)
+end
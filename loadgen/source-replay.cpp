@@ -0,0 +1,268 @@
+// ------------------------------------------------
+// File : source-replay.cpp
+// Desc:
+//      sourceCapture フラグで記録した取り込みを、記録した時と同じ種類
+//      の ChannelStream に readHeader/readPacket で読ませ直し、パケット
+//      の数、読んだ量、確保の回数と量、CPU 時間を表示する。既定では待
+//      たずに全速で読み、--realtime を付けると記録した時刻に合わせて渡
+//      す。
+//
+//      source-replay [--realtime] [--repeat N] [--json] capture-*.cap ...
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <iostream>
+
+#include "usys.h"
+#include "json.hpp"
+#include "str.h"
+
+#include "capture.h"
+#include "channel.h"
+#include "chanmgr.h"
+#include "servmgr.h"
+#include "peercast.h"
+#include "gnutella.h"
+#include "threadacct.h"
+
+namespace
+{
+    struct Config
+    {
+        std::vector<std::string> files;
+        bool    realTime    = false;
+        int     repeat      = 1;
+        bool    json        = false;
+        bool    verbose     = false;
+    };
+
+    struct Result
+    {
+        std::string     file;
+        std::string     contentType;
+        bool            ok = false;
+        std::string     error;
+        uint64_t        packets = 0;
+        uint64_t        bytes = 0;
+        double          seconds = 0;
+        double          cpuSeconds = -1;
+        uint64_t        allocations = 0;
+        uint64_t        allocatedBytes = 0;
+    };
+
+    class ReplayInst : public PeercastInstance
+    {
+    public:
+        Sys* APICALL createSys() override { return new USys(); }
+    };
+
+    class ReplayApp : public PeercastApplication
+    {
+    public:
+        ReplayApp(bool verbose) : m_verbose(verbose) {}
+
+        const char* APICALL getClientTypeOS() override { return PCX_OS_LINUX; }
+
+        void APICALL printLog(LogBuffer::TYPE t, const char* str) override
+        {
+            if (m_verbose)
+                fprintf(stderr, "%s %s\n", LogBuffer::getTypeStr(t), str);
+        }
+
+        bool m_verbose;
+    };
+
+    void die(const std::string& message)
+    {
+        std::cerr << "source-replay: " << message << std::endl;
+        exit(2);
+    }
+
+    void usage()
+    {
+        std::cerr <<
+            "Usage: source-replay [options] FILE...\n"
+            "  --realtime             feed data at the pace it was captured\n"
+            "  --repeat N             replay each file N times (1)\n"
+            "  --json                 print one JSON object per run\n"
+            "  --verbose              print log messages\n";
+        exit(2);
+    }
+
+    Config parseArgs(int argc, char* argv[])
+    {
+        Config cfg;
+        for (int i = 1; i < argc; i++)
+        {
+            std::string opt = argv[i];
+            if (opt == "-h" || opt == "--help")
+                usage();
+            else if (opt == "--realtime")   cfg.realTime = true;
+            else if (opt == "--json")       cfg.json = true;
+            else if (opt == "--verbose")    cfg.verbose = true;
+            else if (opt == "--repeat")
+            {
+                if (i + 1 >= argc)
+                    die("no value for option " + opt);
+                cfg.repeat = std::max(1, atoi(argv[++i]));
+            }
+            else if (opt.compare(0, 2, "--") == 0)
+                die("unknown option " + opt);
+            else
+                cfg.files.push_back(opt);
+        }
+        if (cfg.files.empty())
+            usage();
+        return cfg;
+    }
+
+    Result replay(const std::string& path, bool realTime)
+    {
+        Result res;
+        res.file = path;
+
+        FileStream file;
+        try
+        {
+            file.openReadOnly(path);
+        }catch (StreamException& e)
+        {
+            res.error = e.what();
+            return res;
+        }
+
+        CaptureReader reader(file);
+        if (!reader.readHeader())
+        {
+            res.error = "not a capture file";
+            return res;
+        }
+        res.contentType = reader.header.contentType;
+
+        auto ch = std::make_shared<Channel>();
+        ch->info.contentType = ChanInfo::getTypeFromStr(reader.header.contentType.c_str());
+        ch->info.srcProtocol = ChanInfo::getProtocolFromStr(reader.header.protocol.c_str());
+        ch->info.name = reader.header.name;
+        ch->icyMetaInterval = reader.header.icyMetaInterval;
+
+        ReplayStream in(reader, realTime);
+        auto account = ThreadAccount::current();
+        auto before = account->snapshot();
+        const double start = sys->getMonotonicTime();
+        const unsigned int serial = ch->rawData.getWriteSerial();
+
+        try
+        {
+            auto source = ch->createSource();
+            source->readHeader(in, ch);
+            while (!in.eof())
+            {
+                if (source->readPacket(in, ch))
+                    break;
+            }
+            res.ok = true;
+        }catch (EOFException&)
+        {
+            // 記録の途中で切れたパケットは数えない。
+            res.ok = true;
+        }catch (StreamException& e)
+        {
+            res.error = e.what();
+        }
+
+        auto after = account->snapshot();
+        res.seconds = sys->getMonotonicTime() - start;
+        res.packets = ch->rawData.getWriteSerial() - serial;
+        res.bytes = in.bytesRead();
+        if (before.cpuSeconds >= 0 && after.cpuSeconds >= 0)
+            res.cpuSeconds = after.cpuSeconds - before.cpuSeconds;
+        res.allocations = after.allocations - before.allocations;
+        res.allocatedBytes = after.allocatedBytes - before.allocatedBytes;
+        return res;
+    }
+
+    void print(const Result& r, bool asJSON)
+    {
+        const double secs = std::max(r.seconds, 1e-9);
+        if (asJSON)
+        {
+            nlohmann::json j = {
+                { "file", r.file },
+                { "contentType", r.contentType },
+                { "ok", r.ok },
+                { "error", r.error },
+                { "packets", r.packets },
+                { "bytes", r.bytes },
+                { "seconds", r.seconds },
+                { "packetsPerSecond", r.packets / secs },
+                { "cpuSeconds", r.cpuSeconds },
+                { "allocations", r.allocations },
+                { "allocatedBytes", r.allocatedBytes },
+            };
+            puts(j.dump().c_str());
+            return;
+        }
+
+        if (!r.ok)
+        {
+            printf("%s: FAIL %s\n", r.file.c_str(), r.error.c_str());
+            return;
+        }
+        std::string cpu = r.cpuSeconds >= 0 ? str::format("%.3fs", r.cpuSeconds) : std::string("n/a");
+        printf("%s: %s packets=%llu (%.0f/s) %.1fMB/s time=%.3fs cpu=%s allocs=%llu (%.1f/packet) allocated=%.1fMB\n",
+               r.file.c_str(), r.contentType.c_str(),
+               (unsigned long long) r.packets, r.packets / secs,
+               r.bytes / secs / 1e6, r.seconds, cpu.c_str(),
+               (unsigned long long) r.allocations,
+               r.packets ? (double) r.allocations / r.packets : 0.0,
+               r.allocatedBytes / 1e6);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Config cfg = parseArgs(argc, argv);
+
+    // ServMgr::start は呼ばないので、待ち受けやスレッドは作らない。
+    peercastApp = new ReplayApp(cfg.verbose);
+    peercastInst = new ReplayInst();
+    sys = peercastInst->createSys();
+    servMgr = new ServMgr();
+    chanMgr = new ChanMgr();
+
+    ThreadAccount::attach();
+    if (!ThreadAccount::allocationCountingAvailable())
+        fprintf(stderr, "source-replay: allocation counting is not available in this build\n");
+
+    bool failed = false;
+    for (auto& path : cfg.files)
+    {
+        for (int i = 0; i < cfg.repeat; i++)
+        {
+            auto r = replay(path, cfg.realTime);
+            print(r, cfg.json);
+            fflush(stdout);
+            if (!r.ok)
+            {
+                failed = true;
+                break;
+            }
+        }
+    }
+
+    ThreadAccount::detach();
+    return failed ? 1 : 0;
+}
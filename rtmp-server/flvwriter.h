@@ -93,21 +93,25 @@ namespace rtmpserver
                       char timestamp_extended, 
                       const std::string& data)
         {
-            // write previous tag size
-            out.writeString(to_bytes_big_endian(previous_tag_size, 4));
-
-            // write tag header
-            out.writeString(
-                std::string({(char)tag_type}) +
-                to_bytes_big_endian(data.size(), 3) +
-                to_bytes_big_endian(timestamp, 3) +
-                std::string({timestamp_extended}) +
-                to_bytes_big_endian(STREAM_ID, 3));
-
-            // write payload
-            out.writeString(data);
-
-            previous_tag_size = data.size() + 11;
+            // previous tag size and tag header, followed by the payload
+            // as a separate buffer so that it is never copied.
+            const int size = data.size();
+            uint8_t header[15] = {
+                (uint8_t)(previous_tag_size >> 24), (uint8_t)(previous_tag_size >> 16),
+                (uint8_t)(previous_tag_size >> 8),  (uint8_t)previous_tag_size,
+                (uint8_t)tag_type,
+                (uint8_t)(size >> 16), (uint8_t)(size >> 8), (uint8_t)size,
+                (uint8_t)(timestamp >> 16), (uint8_t)(timestamp >> 8), (uint8_t)timestamp,
+                (uint8_t)timestamp_extended,
+                (uint8_t)(STREAM_ID >> 16), (uint8_t)(STREAM_ID >> 8), (uint8_t)STREAM_ID,
+            };
+            const Stream::IOVec vec[] = {
+                { header, sizeof(header) },
+                { data.data(), size },
+            };
+            out.writeVector(vec, 2);
+
+            previous_tag_size = size + 11;
         }
 
     };
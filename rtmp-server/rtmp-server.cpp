@@ -15,7 +15,9 @@
 #include "iohelpers.h"
 #include "session.h"
 #include "splitter.h"
+#include "queuedstream.h"
 #include "defer.h"
+#include "shmring.h"
 
 namespace rtmpserver
 {
@@ -27,6 +29,15 @@ namespace rtmpserver
 
     std::shared_ptr<Stream> openUri(const std::string& spec)
     {
+        // PeerCast が作った共有メモリーのリング。
+        if (spec.compare(0, 4, "shm:") == 0)
+        {
+            auto ring = ShmRing::open(spec.substr(4));
+            if (!ring)
+                throw std::runtime_error("Cannot open shared memory " + spec.substr(4));
+            return std::make_shared<ShmRingStream>(ring, true);
+        }
+
         URI uri(spec);
 
         if (uri.scheme() == "http")
@@ -66,10 +77,10 @@ namespace rtmpserver
         int wi = 1;
         while (argv[ri] != nullptr)
         {
-            if (argv[ri] == std::string("-p"))
+            if (argv[ri] == std::string("-p") || argv[ri] == std::string("-s"))
             {
                 if (argv[ri + 1] == nullptr)
-                    throw std::runtime_error("no value for option -p");
+                    throw std::runtime_error(std::string("no value for option ") + argv[ri]);
                 opts[argv[ri]] = argv[ri+1];
                 ri += 2;
             }else
@@ -137,9 +148,19 @@ int main(int argc, char* argv[])
     Session::test();
     rtmpserver::test();
 
-    // コマンドラインから -p PORT を受け取る。
+    // コマンドラインから -p PORT と、出力先が詰まった時の扱い -s
+    // disconnect|drop を受け取る。
     std::map<std::string,std::string> opts = optparse(&argc, argv);
     unsigned int rtmp_port = opts.count("-p") ? std::stoi(opts["-p"]) : 1935;
+    QueuedStream::Policy policy = QueuedStream::P_DISCONNECT;
+    try
+    {
+        if (opts.count("-s"))
+            policy = QueuedStream::policyFromString(opts["-s"]);
+    }catch (ArgumentException& e)
+    {
+        die(e.what());
+    }
 
     if (argc == 1)
         die("no URL supplied");
@@ -156,8 +177,10 @@ int main(int argc, char* argv[])
 
         auto client = server->accept();
 
+        // 出力先ごとにキューを挟み、遅い出力先がセッションと他の出力
+        // 先を待たせないようにする。
         for (int i = 1; i < argc; ++i)
-            streams.push_back(openUri(argv[i]));
+            streams.push_back(std::make_shared<QueuedStream>(openUri(argv[i]), policy));
 
         StreamSplitter splitter(streams);
 
@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+
+#include "aacextract.h"
+#include "flv.h"
+
+class AACExtractorFixture : public ::testing::Test {
+public:
+    static std::string tag(FLVTag::TYPE type, int32_t timestamp, const std::string& payload)
+    {
+        FLVTag t;
+        t.set(type, timestamp, payload.data(), (int) payload.size());
+        return std::string(reinterpret_cast<char*>(t.packet), t.packetSize);
+    }
+
+    static std::string fileHeader()
+    {
+        return std::string("FLV\x01\x05\x00\x00\x00\x09\x00\x00\x00\x00", 13);
+    }
+
+    // AAC LC、44.1kHz、ステレオ
+    static std::string aacConfig()
+    {
+        return tag(FLVTag::T_AUDIO, 0, std::string("\xaf\x00\x12\x10", 4));
+    }
+
+    static std::string aacFrame(int32_t timestamp, char fill = '\x21')
+    {
+        return tag(FLVTag::T_AUDIO, timestamp, std::string("\xaf\x01", 2) + std::string(100, fill));
+    }
+
+    static std::string videoFrame(int32_t timestamp)
+    {
+        return tag(FLVTag::T_VIDEO, timestamp, std::string("\x17\x01\x00\x00\x00", 5) + std::string(1000, 'v'));
+    }
+
+    void put(const std::string& s)
+    {
+        aac.put(s.data(), (int) s.size());
+    }
+
+    std::string readAll(unsigned int& pos)
+    {
+        std::vector<AACExtractor::Chunk> chunks;
+        aac.read(pos, chunks);
+        std::string out;
+        for (auto& c : chunks)
+            out += *c;
+        return out;
+    }
+
+    AACExtractor aac;
+};
+
+TEST_F(AACExtractorFixture, extractsADTS)
+{
+    put(fileHeader() + aacConfig());
+    ASSERT_TRUE(aac.hasAudioConfig());
+
+    put(videoFrame(0) + aacFrame(0) + videoFrame(40) + aacFrame(23));
+
+    unsigned int pos = aac.joinPosition();
+    auto out = readAll(pos);
+    // 映像は落とし、AAC のフレームごとに 7 バイトの ADTS ヘッダーが付く。
+    ASSERT_EQ(2 * (7 + 100), out.size());
+    ASSERT_EQ('\xff', out[0]);
+    ASSERT_EQ('\xf1', out[1]);
+    ASSERT_EQ((char) ((1 << 6) | (4 << 2) | 0), out[2]);  // LC, 44.1kHz
+    int frameLength = ((out[3] & 3) << 11) | ((unsigned char) out[4] << 3) | ((unsigned char) out[5] >> 5);
+    ASSERT_EQ(107, frameLength);
+    ASSERT_EQ(std::string(100, '\x21'), out.substr(7, 100));
+    ASSERT_EQ(2 * 107, aac.bytesProduced());
+}
+
+TEST_F(AACExtractorFixture, tagsSplitAcrossPuts)
+{
+    std::string data = fileHeader() + aacConfig() + aacFrame(0) + aacFrame(23);
+    for (size_t i = 0; i < data.size(); i += 10)
+        put(data.substr(i, 10));
+
+    unsigned int pos = 0;
+    ASSERT_EQ(2 * 107, readAll(pos).size());
+}
+
+TEST_F(AACExtractorFixture, noFramesBeforeConfig)
+{
+    put(fileHeader() + aacFrame(0));
+    ASSERT_FALSE(aac.hasAudioConfig());
+
+    unsigned int pos = 0;
+    ASSERT_EQ("", readAll(pos));
+}
+
+TEST_F(AACExtractorFixture, listenersShareChunks)
+{
+    put(fileHeader() + aacConfig());
+    for (int i = 0; i < 20; i++)
+        put(aacFrame(i * 23));
+
+    // 新しい聴取者は直近の JOIN_CHUNKS 個から始める。
+    unsigned int a = aac.joinPosition();
+    ASSERT_EQ(AACExtractor::JOIN_CHUNKS * 107, readAll(a).size());
+    ASSERT_EQ("", readAll(a));
+
+    unsigned int b = aac.joinPosition();
+    put(aacFrame(1000));
+    ASSERT_EQ(107, readAll(a).size());
+    ASSERT_EQ((AACExtractor::JOIN_CHUNKS + 1) * 107, readAll(b).size());
+}
+
+TEST_F(AACExtractorFixture, laggingListenerSkipsAhead)
+{
+    put(fileHeader() + aacConfig());
+    unsigned int pos = aac.joinPosition();
+    for (int i = 0; i < AACExtractor::MAX_CHUNKS + 5; i++)
+        put(aacFrame(i * 23));
+
+    // 消えた 5 個は飛ばして、残っている分だけ読む。
+    ASSERT_EQ(AACExtractor::MAX_CHUNKS * 107, readAll(pos).size());
+    ASSERT_EQ(AACExtractor::MAX_CHUNKS + 5, pos);
+}
+
+TEST_F(AACExtractorFixture, lostTagBoundary)
+{
+    put(fileHeader() + aacConfig());
+    put(std::string(20, '\x55'));
+    // 境目を見失ったら、次の put から読み直す。
+    aac.discontinuity();
+    put(aacFrame(0));
+
+    unsigned int pos = 0;
+    ASSERT_EQ(107, readAll(pos).size());
+}
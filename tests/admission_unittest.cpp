@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include "admission.h"
+#include "mockclientsocket.h"
+
+class AdmissionControlFixture : public ::testing::Test {
+};
+
+static IP ipv4(const char* s)
+{
+    IP ip;
+    EXPECT_TRUE(IP::tryParse(s, ip));
+    return ip;
+}
+
+TEST_F(AdmissionControlFixture, limitsRatePerAddress)
+{
+    AdmissionControl ac;
+    auto ip = ipv4("203.0.113.5");
+
+    for (int i = 0; i < AdmissionControl::IP_BURST; i++)
+        ASSERT_EQ(AdmissionControl::D_ADMIT, ac.admit(ip, 0, 100.0));
+    ASSERT_EQ(AdmissionControl::D_RATE_IP, ac.admit(ip, 0, 100.0));
+
+    // 他のアドレスは別に数える。
+    ASSERT_EQ(AdmissionControl::D_ADMIT, ac.admit(ipv4("203.0.113.6"), 0, 100.0));
+
+    // 時間が経てば戻る。
+    ASSERT_EQ(AdmissionControl::D_ADMIT, ac.admit(ip, 0, 100.0 + 1.0 / AdmissionControl::IP_RATE));
+    ASSERT_EQ(AdmissionControl::D_RATE_IP, ac.admit(ip, 0, 100.0 + 1.0 / AdmissionControl::IP_RATE));
+}
+
+TEST_F(AdmissionControlFixture, limitsRatePerSubnet)
+{
+    AdmissionControl ac;
+    int admitted = 0;
+    AdmissionControl::Decision last = AdmissionControl::D_ADMIT;
+    for (int i = 1; i < 250; i++)
+    {
+        last = ac.admit(ipv4(str::format("198.51.100.%d", i).c_str()), 0, 0.0);
+        if (last != AdmissionControl::D_ADMIT)
+            break;
+        admitted++;
+    }
+    ASSERT_EQ(AdmissionControl::SUBNET_BURST, admitted);
+    ASSERT_EQ(AdmissionControl::D_RATE_SUBNET, last);
+
+    ASSERT_EQ(ipv4("198.51.100.0"), AdmissionControl::subnetOf(ipv4("198.51.100.77")));
+}
+
+TEST_F(AdmissionControlFixture, pendingAndLocal)
+{
+    AdmissionControl ac;
+    ASSERT_EQ(AdmissionControl::D_BUSY, ac.admit(ipv4("203.0.113.5"), AdmissionControl::MAX_PENDING, 0.0));
+
+    // LAN 内とループバックは数えない。
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_EQ(AdmissionControl::D_ADMIT, ac.admit(ipv4("127.0.0.1"), AdmissionControl::MAX_PENDING, 0.0));
+        ASSERT_EQ(AdmissionControl::D_ADMIT, ac.admit(ipv4("192.168.0.2"), 0, 0.0));
+    }
+
+    auto state = ac.getState();
+    ASSERT_EQ(200, state.at("numAdmitted").number());
+    ASSERT_EQ(1, state.at("numBusy").number());
+}
+
+TEST_F(AdmissionControlFixture, expire)
+{
+    AdmissionControl ac;
+    ac.admit(ipv4("203.0.113.5"), 0, 0.0);
+    ASSERT_EQ(1, ac.getState().at("numAddresses").number());
+    ac.expire(AdmissionControl::IDLE_SECONDS - 1);
+    ASSERT_EQ(1, ac.getState().at("numAddresses").number());
+    ac.expire(AdmissionControl::IDLE_SECONDS);
+    ASSERT_EQ(0, ac.getState().at("numAddresses").number());
+    ASSERT_EQ(0, ac.getState().at("numSubnets").number());
+}
+
+namespace
+{
+    class PeekSocket : public MockClientSocket
+    {
+    public:
+        bool readReady(int) override { return incoming.getLength() > incoming.getPosition(); }
+        char peekChar() override { return incoming.str()[incoming.getPosition()]; }
+        int tryWrite(const void *p, int len) override { write(p, len); return len; }
+    };
+}
+
+TEST_F(AdmissionControlFixture, rejectReplies)
+{
+    PeekSocket http;
+    http.incoming.str("GET / HTTP/1.1\r\n");
+    AdmissionControl::reject(http);
+    ASSERT_EQ(0, http.outgoing.str().find("HTTP/1.0 503 Service Unavailable\r\n"));
+
+    PeekSocket pcp;
+    pcp.incoming.str(std::string("pcp\n\4\0\0\0\1\0\0\0", 12));
+    AdmissionControl::reject(pcp);
+    ASSERT_EQ(std::string("quit\4\0\0\0\xeb\3\0\0", 12), pcp.outgoing.str());
+
+    // 何も来ていなければ何も書かない。
+    PeekSocket empty;
+    AdmissionControl::reject(empty);
+    ASSERT_EQ("", empty.outgoing.str());
+}
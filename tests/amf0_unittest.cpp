@@ -134,6 +134,16 @@ TEST_F(amf0Fixture, Date)
               d.inspect());
 }
 
+TEST_F(amf0Fixture, serialize_Bool)
+{
+    ASSERT_EQ(std::string({ 0x01, 0x01 }), Value::boolean(true).serialize());
+    ASSERT_EQ(std::string({ 0x01, 0x00 }), Value::boolean(false).serialize());
+
+    amf0::Deserializer d;
+    StringStream mem(Value::boolean(true).serialize());
+    ASSERT_EQ(Value::boolean(true), d.readValue(mem));
+}
+
 TEST_F(amf0Fixture, Deserializer_String)
 {
     amf0::Deserializer d;
@@ -364,3 +374,51 @@ TEST_F(amf0Fixture, Number_precision)
         ASSERT_EQ(std::stod(amf0::Value::number(v).inspect()), v);
     }
 }
+
+TEST_F(amf0Fixture, Object_sortedAndLastKeyWins)
+{
+    Value obj = Value::object({ {"b", 1}, {"a", 2}, {"b", 3} });
+
+    ASSERT_EQ(2, obj.object().size());
+    ASSERT_EQ("a", obj.object().begin()->first);
+    ASSERT_EQ(3, obj.at("b").number());
+    ASSERT_EQ("{\"a\":2,\"b\":3}", obj.inspect());
+}
+
+TEST_F(amf0Fixture, Object_mapLikeAccess)
+{
+    Object obj;
+    obj["c"] = 1;
+    obj["a"] = 2;
+    obj["c"] = 3;
+
+    ASSERT_EQ(2, obj.size());
+    ASSERT_EQ(1, obj.count("a"));
+    ASSERT_EQ(0, obj.count("b"));
+    ASSERT_EQ(obj.end(), obj.find("b"));
+    ASSERT_THROW(obj.at("b"), std::out_of_range);
+
+    ASSERT_EQ(1, obj.erase("a"));
+    ASSERT_EQ(0, obj.erase("a"));
+
+    std::map<std::string,Value> map = obj;
+    ASSERT_EQ(Value(map), Value(obj));
+}
+
+TEST_F(amf0Fixture, assignFromChild)
+{
+    Value v = Value::object({ {"child", Value::strictArray({ "x", 1 })} });
+    v = v.at("child");
+    ASSERT_EQ(Value::strictArray({ "x", 1 }), v);
+
+    v = v.at(0);
+    ASSERT_EQ("x", v.string());
+}
+
+TEST_F(amf0Fixture, moveLeavesNull)
+{
+    Value a = std::string("hello");
+    Value b = std::move(a);
+    ASSERT_EQ("hello", b.string());
+    ASSERT_TRUE(a.isNull());
+}
@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <string>
+#include <thread>
+
+#include "arena.h"
+#include "http.h"
+#include "cgi.h"
+
+class ArenaFixture : public ::testing::Test {
+};
+
+typedef std::map<int, int, std::less<int>, ArenaAllocator<std::pair<const int, int> > > IntMap;
+
+TEST_F(ArenaFixture, allocatesFromCurrentArena)
+{
+    Arena arena;
+    {
+        Arena::Scope scope(arena);
+        ASSERT_EQ(&arena, Arena::current());
+
+        IntMap m;
+        for (int i = 0; i < 100; i++)
+            m[i] = i;
+        ASSERT_EQ(1, arena.numChunks());
+    }
+    ASSERT_EQ(nullptr, Arena::current());
+
+    // 全部返されたので使い直す。
+    {
+        Arena::Scope scope(arena);
+        IntMap m;
+        m[1] = 1;
+        ASSERT_EQ(1, arena.numChunks());
+        ASSERT_EQ(1, arena.numReused());
+    }
+}
+
+TEST_F(ArenaFixture, survivorsKeepChunkAlive)
+{
+    Arena arena;
+    std::unique_ptr<IntMap> survivor;
+    {
+        Arena::Scope scope(arena);
+        survivor.reset(new IntMap);
+        (*survivor)[1] = 1;
+    }
+
+    // 残っているものがあるチャンクは手放して、新しいチャンクを使う。
+    {
+        Arena::Scope scope(arena);
+        IntMap m;
+        m[2] = 2;
+        ASSERT_EQ(2, arena.numChunks());
+        ASSERT_EQ(0, arena.numReused());
+    }
+
+    // 据えられていないスレッドからの確保はヒープから。
+    std::thread([&]() { (*survivor)[3] = 3; }).join();
+    ASSERT_EQ(2, survivor->size());
+    ASSERT_EQ(1, survivor->at(1));
+    survivor.reset();
+}
+
+TEST_F(ArenaFixture, largeAndCopiedGoToHeap)
+{
+    Arena arena;
+    Arena::Scope scope(arena);
+
+    ArenaAllocator<char> alloc;
+    char* big = alloc.allocate(Arena::MAX_SMALL + 1);
+    ASSERT_EQ(0, arena.numChunks());
+    alloc.deallocate(big, Arena::MAX_SMALL + 1);
+
+    IntMap m;
+    m[1] = 1;
+    IntMap copy(m);
+    ASSERT_EQ(&arena, m.get_allocator().arena());
+    ASSERT_EQ(nullptr, copy.get_allocator().arena());
+}
+
+TEST_F(ArenaFixture, headersAndQuery)
+{
+    Arena arena;
+    Arena::Scope scope(arena);
+
+    HTTPHeaders headers;
+    headers.set("Content-Type", "text/plain");
+    ASSERT_EQ("text/plain", headers.get("content-type"));
+
+    cgi::Query query("a=1&b=2&a=3");
+    ASSERT_EQ(2, query.getAll("a").size());
+    ASSERT_EQ(1, arena.numChunks());
+}
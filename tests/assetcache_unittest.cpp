@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "assetcache.h"
+
+class AssetCacheFixture : public ::testing::Test {
+public:
+    void SetUp()
+    {
+        char tmpl[] = "/tmp/assetcacheXXXXXX";
+        int fd = mkstemp(tmpl);
+        ASSERT_NE(-1, fd);
+        close(fd);
+        path = tmpl;
+        writeFile(path, "body { color: red }");
+    }
+
+    void TearDown()
+    {
+        unlink(path.c_str());
+        unlink((path + ".gz").c_str());
+    }
+
+    static void writeFile(const std::string& p, const std::string& contents)
+    {
+        FILE* fp = fopen(p.c_str(), "wb");
+        fwrite(contents.data(), 1, contents.size(), fp);
+        fclose(fp);
+    }
+
+    static HTTPRequest request(const HTTPHeaders& headers = {})
+    {
+        return HTTPRequest("GET", "/assets/style.css", "HTTP/1.1", headers);
+    }
+
+    AssetCache cache;
+    std::string path;
+};
+
+TEST_F(AssetCacheFixture, getIsCached)
+{
+    auto a = cache.get(path);
+    ASSERT_EQ("body { color: red }", *a->identity.body);
+    ASSERT_EQ(a, cache.get(path));
+    ASSERT_EQ(1, cache.numEntries());
+    ASSERT_EQ(a->identity.body->size(), cache.totalSize());
+    ASSERT_EQ(nullptr, a->gzip.body);
+
+    // 大きさが変われば読み直す。
+    writeFile(path, "body { color: blue; }");
+    auto b = cache.get(path);
+    ASSERT_EQ("body { color: blue; }", *b->identity.body);
+    ASSERT_NE(a->identity.etag, b->identity.etag);
+    ASSERT_EQ(b->identity.body->size(), cache.totalSize());
+
+    unlink(path.c_str());
+    ASSERT_THROW(cache.get(path), StreamException);
+}
+
+TEST_F(AssetCacheFixture, respondWithETag)
+{
+    auto res = cache.respond(request(), path, "text/css");
+    ASSERT_EQ(200, res.statusCode);
+    ASSERT_EQ("body { color: red }", res.body);
+    ASSERT_EQ("text/css", res.headers.get("Content-Type"));
+    auto etag = res.headers.get("ETag");
+    ASSERT_FALSE(etag.empty());
+
+    res = cache.respond(request({{"If-None-Match", "\"other\", " + etag}}), path, "text/css");
+    ASSERT_EQ(304, res.statusCode);
+    ASSERT_EQ("", res.body);
+    ASSERT_EQ(etag, res.headers.get("ETag"));
+
+    res = cache.respond(request({{"If-None-Match", "\"other\""}}), path, "text/css");
+    ASSERT_EQ(200, res.statusCode);
+
+    ASSERT_EQ(404, cache.respond(request(), path + ".none", "text/css").statusCode);
+}
+
+TEST_F(AssetCacheFixture, respondWithPrecompressedVariant)
+{
+    writeFile(path + ".gz", "GZIPPED");
+
+    auto res = cache.respond(request({{"Accept-Encoding", "gzip, deflate, br"}}), path, "text/css");
+    ASSERT_EQ(200, res.statusCode);
+    ASSERT_EQ("GZIPPED", res.body);
+    ASSERT_EQ("gzip", res.headers.get("Content-Encoding"));
+    ASSERT_EQ("Accept-Encoding", res.headers.get("Vary"));
+    auto gzipTag = res.headers.get("ETag");
+
+    res = cache.respond(request({{"Accept-Encoding", "gzip;q=0"}}), path, "text/css");
+    ASSERT_EQ("body { color: red }", res.body);
+    ASSERT_EQ("", res.headers.get("Content-Encoding"));
+    ASSERT_NE(gzipTag, res.headers.get("ETag"));
+
+    // 変種ごとに ETag が違う。
+    res = cache.respond(request({{"If-None-Match", gzipTag}}), path, "text/css");
+    ASSERT_EQ(200, res.statusCode);
+}
+
+TEST_F(AssetCacheFixture, chooseEncoding)
+{
+    AssetCache::Entry e;
+    e.brotli.body = std::make_shared<const std::string>("br");
+    ASSERT_EQ("br", AssetCache::chooseEncoding("gzip, br", e));
+    ASSERT_EQ("", AssetCache::chooseEncoding("gzip", e));
+    ASSERT_EQ("", AssetCache::chooseEncoding("br;q=0", e));
+    ASSERT_EQ("br", AssetCache::chooseEncoding("BR;q=0.5", e));
+}
+
+TEST_F(AssetCacheFixture, etagMatches)
+{
+    ASSERT_TRUE(AssetCache::etagMatches("*", "\"a\""));
+    ASSERT_TRUE(AssetCache::etagMatches("W/\"a\"", "\"a\""));
+    ASSERT_TRUE(AssetCache::etagMatches("\"b\", \"a\"", "\"a\""));
+    ASSERT_FALSE(AssetCache::etagMatches("\"b\"", "\"a\""));
+}
@@ -92,3 +92,36 @@ TEST_F(AtomStreamFixture, readAddress16)
     ASSERT_EQ(16, size);
     ASSERT_EQ(ip, a.readAddress());
 }
+
+TEST_F(AtomStreamFixture, copyAtom)
+{
+    StringStream out;
+    AtomStream w(out);
+    w.writeParent("host", 2);
+        w.writeInt("ip", 127<<24|1);
+        w.writeParent("chan", 1);
+            w.writeString("name", "abc");
+    std::string wire = out.str();
+
+    StringStream in(wire);
+    AtomStream a(in);
+    int numc, dlen;
+    ID4 id = a.read(numc, dlen);
+    ASSERT_EQ(2, numc);
+
+    char buf[64];
+    ASSERT_EQ(wire.size(), a.copyAtom(id, numc, dlen, buf, sizeof(buf)));
+    ASSERT_EQ(wire, std::string(buf, wire.size()));
+    ASSERT_TRUE(in.eof());
+}
+
+TEST_F(AtomStreamFixture, copyAtomTooLarge)
+{
+    StringStream in(std::string({ 'i','p',0,0, 4,0,0,0, 1,0,0,127 }));
+    AtomStream a(in);
+    int numc, dlen;
+    ID4 id = a.read(numc, dlen);
+
+    char buf[10];
+    ASSERT_THROW(a.copyAtom(id, numc, dlen, buf, sizeof(buf)), StreamException);
+}
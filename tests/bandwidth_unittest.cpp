@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include "bandwidth.h"
+#include "mocksys.h"
+
+class BandwidthSchedulerFixture : public ::testing::Test {
+public:
+    void SetUp()
+    {
+        mock = dynamic_cast<MockSys*>(sys);
+        dtime_ = mock->dtime;
+        mock->dtime = 1000.0;
+
+        kbps = 800;     // 100000 バイト/秒
+        sched.capacity = [this]() { return kbps; };
+
+        ch1.fromStr("00000000000000000000000000000001");
+        ch2.fromStr("00000000000000000000000000000002");
+    }
+
+    void TearDown()
+    {
+        mock->dtime = dtime_;
+    }
+
+    // 各バケツから一秒あたり rate バイト送ろうとするのを seconds 秒続
+    // ける。実際に送れた量を返す。
+    std::vector<double> run(std::vector<std::shared_ptr<BandwidthScheduler::Bucket>> buckets,
+                            std::vector<double> rate, double seconds)
+    {
+        std::vector<double> sent(buckets.size(), 0);
+        std::vector<double> wakeUp(buckets.size(), mock->dtime);
+        const double step = 0.01;
+        for (double t = 0; t < seconds; t += step)
+        {
+            mock->dtime += step;
+            for (size_t i = 0; i < buckets.size(); i++)
+            {
+                if (mock->dtime < wakeUp[i])
+                    continue;
+                size_t bytes = (size_t) (rate[i] * step);
+                unsigned int ms = sched.consume(*buckets[i], bytes);
+                sent[i] += bytes;
+                wakeUp[i] = mock->dtime + ms / 1000.0;
+            }
+        }
+        return sent;
+    }
+
+    MockSys* mock;
+    double dtime_;
+    unsigned int kbps;
+    BandwidthScheduler sched;
+    GnuID ch1, ch2;
+};
+
+TEST_F(BandwidthSchedulerFixture, unlimitedWithoutCapacity)
+{
+    kbps = 0;
+    auto b = sched.open(BandwidthScheduler::C_DIRECT, ch1);
+    mock->dtime += 1;
+    ASSERT_EQ(0, sched.consume(*b, 10000000));
+    mock->dtime += 1;
+    ASSERT_EQ(0, sched.consume(*b, 10000000));
+    ASSERT_TRUE(sched.ready(*b));
+    ASSERT_TRUE(sched.canAdmit(BandwidthScheduler::C_DIRECT, 100000));
+}
+
+TEST_F(BandwidthSchedulerFixture, localIsNotLimited)
+{
+    auto b = sched.open(BandwidthScheduler::C_LOCAL, ch1);
+    auto sent = run({ b }, { 1000000 }, 5);
+    ASSERT_GT(sent[0], 4000000);
+    ASSERT_TRUE(sched.canAdmit(BandwidthScheduler::C_LOCAL, 100000));
+}
+
+TEST_F(BandwidthSchedulerFixture, singleStreamGetsWholeCapacity)
+{
+    auto b = sched.open(BandwidthScheduler::C_DIRECT, ch1);
+    auto sent = run({ b }, { 1000000 }, 10);
+
+    // 保証は 30% だが、他に誰もいなければ全部使える。
+    ASSERT_GT(sent[0] / 10, 80000);
+    ASSERT_LT(sent[0] / 10, 130000);
+}
+
+TEST_F(BandwidthSchedulerFixture, directCannotStarveRelay)
+{
+    auto direct = sched.open(BandwidthScheduler::C_DIRECT, ch1);
+    auto relay = sched.open(BandwidthScheduler::C_RELAY, ch1);
+
+    run({ direct }, { 1000000 }, 5);
+    auto sent = run({ direct, relay }, { 1000000, 60000 }, 20);
+
+    // リレーは欲しい分 (保証の範囲内) を送れる。
+    ASSERT_GT(sent[1] / 20, 50000);
+    // 合わせて上限を大きく超えない。
+    ASSERT_LT((sent[0] + sent[1]) / 20, 130000);
+}
+
+TEST_F(BandwidthSchedulerFixture, fairAcrossChannels)
+{
+    auto a = sched.open(BandwidthScheduler::C_RELAY, ch1);
+    auto b = sched.open(BandwidthScheduler::C_RELAY, ch2);
+
+    auto sent = run({ a, b }, { 1000000, 1000000 }, 20);
+
+    ASSERT_NEAR(sent[0], sent[1], sent[0] * 0.2);
+}
+
+TEST_F(BandwidthSchedulerFixture, canAdmit)
+{
+    auto direct = sched.open(BandwidthScheduler::C_DIRECT, ch1);
+    run({ direct }, { 1000000 }, 5);
+
+    // 直接視聴が帯域を使い切っていても、リレーは保証の分まで入れる。
+    ASSERT_TRUE(sched.canAdmit(BandwidthScheduler::C_RELAY, 500));
+    ASSERT_FALSE(sched.canAdmit(BandwidthScheduler::C_RELAY, 800));
+    ASSERT_FALSE(sched.canAdmit(BandwidthScheduler::C_DIRECT, 100));
+}
+
+TEST_F(BandwidthSchedulerFixture, closedBucketsAreForgotten)
+{
+    {
+        auto b = sched.open(BandwidthScheduler::C_DIRECT, ch1);
+        run({ b }, { 1000000 }, 2);
+    }
+    mock->dtime += 10;
+    ASSERT_TRUE(sched.canAdmit(BandwidthScheduler::C_DIRECT, 700));
+}
@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+
+#include "capacitytuner.h"
+#include "servmgr.h"
+
+class CapacityTunerFixture : public ::testing::Test {
+};
+
+TEST_F(CapacityTunerFixture, keepsSettingsWithoutCeiling)
+{
+    CapacityTuner t;
+    CapacityTuner::Sample s;
+    s.configuredRelays = 3;
+    s.configuredDirect = 5;
+
+    auto l = t.step(s);
+    ASSERT_EQ(0, l.maxBitrateOut);
+    ASSERT_EQ(3, l.maxRelays);
+    ASSERT_EQ(5, l.maxDirect);
+}
+
+TEST_F(CapacityTunerFixture, growsTowardsMeasuredCapacity)
+{
+    CapacityTuner t;
+    CapacityTuner::Sample s;
+    s.configuredKbps = 1000;
+    s.configuredRelays = 2;
+    s.configuredDirect = 1;
+    s.measuredKbps = 10000;     // 天井は 8000
+    s.streamKbps = 500;
+
+    // 使っていなければ設定値のまま。
+    auto l = t.step(s);
+    ASSERT_EQ(1000, l.maxBitrateOut);
+    ASSERT_EQ(2, l.maxRelays);      // 700 / 500 は MIN_RELAYS まで上げる
+    ASSERT_EQ(1, l.maxDirect);
+
+    // 上限近くまで使っていれば天井の 5% ずつ上げる。
+    s.outKbps = 900;
+    l = t.step(s);
+    ASSERT_EQ(1400, l.maxBitrateOut);
+
+    for (int i = 0; i < 100; i++)
+    {
+        s.outKbps = l.maxBitrateOut;
+        l = t.step(s);
+    }
+    ASSERT_EQ(8000, l.maxBitrateOut);
+    ASSERT_EQ(11, l.maxRelays);     // 8000 * 70% / 500
+    ASSERT_EQ(4, l.maxDirect);      // 8000 * 30% / 500
+}
+
+TEST_F(CapacityTunerFixture, backsOffOnLag)
+{
+    CapacityTuner t;
+    CapacityTuner::Sample s;
+    s.configuredKbps = 4000;
+    s.configuredRelays = 8;
+    s.streamKbps = 400;
+
+    auto l = t.step(s);
+    ASSERT_EQ(4000, l.maxBitrateOut);
+    ASSERT_EQ(7, l.maxRelays);
+    // 直接視聴を断る設定はそのまま。
+    ASSERT_EQ(0, l.maxDirect);
+
+    s.skips = 2;
+    l = t.step(s);
+    ASSERT_EQ(3000, l.maxBitrateOut);
+
+    s.skips = 0;
+    s.lagMsec = CapacityTuner::LAG_LIMIT_MSEC + 1;
+    l = t.step(s);
+    ASSERT_EQ(2250, l.maxBitrateOut);
+
+    for (int i = 0; i < 100; i++)
+        l = t.step(s);
+    ASSERT_EQ(CapacityTuner::MIN_KBPS, l.maxBitrateOut);
+    ASSERT_EQ(ServMgr::MIN_RELAYS, l.maxRelays);
+
+    auto state = t.getState();
+    ASSERT_EQ(102, state.at("numDecreases").number());
+}
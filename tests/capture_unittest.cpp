@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+
+#include "capture.h"
+#include "sstream.h"
+
+class CaptureFixture : public ::testing::Test {
+public:
+    // out を書き出し先とする CaptureWriter。
+    static std::shared_ptr<CaptureWriter> writerTo(StringStream*& out)
+    {
+        out = new StringStream();
+        SourceCapture::Header h;
+        h.contentType = "FLV";
+        h.protocol = "HTTP";
+        h.icyMetaInterval = 0;
+        h.name = "test";
+        h.startTime = 1500000000;
+        return std::make_shared<CaptureWriter>(std::unique_ptr<Stream>(out), h);
+    }
+};
+
+TEST_F(CaptureFixture, header)
+{
+    SourceCapture::Header h;
+    h.contentType = "MP3";
+    h.protocol = "HTTP";
+    h.icyMetaInterval = 8192;
+    h.name = "日本語";
+    h.startTime = 123;
+
+    SourceCapture::Header h2;
+    ASSERT_TRUE(SourceCapture::parseHeader(SourceCapture::serializeHeader(h), h2));
+    ASSERT_EQ("MP3", h2.contentType);
+    ASSERT_EQ("HTTP", h2.protocol);
+    ASSERT_EQ(8192, h2.icyMetaInterval);
+    ASSERT_EQ("日本語", h2.name);
+    ASSERT_EQ(123, h2.startTime);
+
+    ASSERT_FALSE(SourceCapture::parseHeader("{}", h2));
+    ASSERT_FALSE(SourceCapture::parseHeader("garbage", h2));
+}
+
+TEST_F(CaptureFixture, captureStreamTeesReads)
+{
+    StringStream* out;
+    auto writer = writerTo(out);
+
+    StringStream src("hello world");
+    CaptureStream cs(src, writer);
+
+    char buf[6];
+    ASSERT_EQ(5, cs.read(buf, 5));
+    ASSERT_EQ(1, cs.readSome(buf, 1));
+    ASSERT_EQ(5, cs.read(buf, 5));
+    ASSERT_TRUE(cs.eof());
+    ASSERT_EQ(11, writer->bytesWritten());
+
+    StringStream in(out->str());
+    CaptureReader reader(in);
+    ASSERT_TRUE(reader.readHeader());
+    ASSERT_EQ("FLV", reader.header.contentType);
+    ASSERT_EQ("test", reader.header.name);
+
+    SourceCapture::Record r;
+    std::string all;
+    int n = 0;
+    while (reader.next(r))
+    {
+        all += r.data;
+        n++;
+    }
+    ASSERT_EQ(3, n);
+    ASSERT_EQ("hello world", all);
+}
+
+TEST_F(CaptureFixture, replayStream)
+{
+    StringStream* out;
+    auto writer = writerTo(out);
+    writer->write("abc", 3, 0);
+    writer->write("defg", 4, 10);
+
+    StringStream in(out->str());
+    CaptureReader reader(in);
+    ASSERT_TRUE(reader.readHeader());
+
+    ReplayStream replay(reader, false);
+    char buf[5] = {};
+    // 記録の境目をまたいで読める。
+    ASSERT_EQ(5, replay.read(buf, 5));
+    ASSERT_EQ("abcde", std::string(buf, 5));
+    ASSERT_FALSE(replay.eof());
+    ASSERT_EQ(2, replay.read(buf, 2));
+    ASSERT_TRUE(replay.eof());
+    ASSERT_THROW(replay.read(buf, 1), EOFException);
+    ASSERT_EQ(7, replay.bytesRead());
+}
+
+TEST_F(CaptureFixture, truncatedCapture)
+{
+    StringStream* out;
+    auto writer = writerTo(out);
+    writer->write("abc", 3, 0);
+    writer->write("defg", 4, 10);
+
+    // 最後の記録の途中で切れている。
+    std::string data = out->str();
+    StringStream in(data.substr(0, data.size() - 2));
+    CaptureReader reader(in);
+    ASSERT_TRUE(reader.readHeader());
+
+    SourceCapture::Record r;
+    ASSERT_TRUE(reader.next(r));
+    ASSERT_EQ("abc", r.data);
+    ASSERT_FALSE(reader.next(r));
+}
+
+TEST_F(CaptureFixture, notACapture)
+{
+    StringStream in("FLV\x01\x05");
+    CaptureReader reader(in);
+    ASSERT_FALSE(reader.readHeader());
+}
+
+TEST_F(CaptureFixture, writerStopsAfterClose)
+{
+    StringStream* out;
+    auto writer = writerTo(out);
+    writer->write("abc", 3, 0);
+    writer->close();
+    writer->write("def", 3, 0);
+    ASSERT_EQ(3, writer->bytesWritten());
+    ASSERT_TRUE(writer->failed());
+}
@@ -103,6 +103,22 @@ TEST_F(cgiFixture, parseHttpDate_epoch)
     ASSERT_EQ(0, cgi::parseHttpDate("Thu, 01 Jan 1970 00:00:00 UTC"));
 }
 
+TEST_F(cgiFixture, parseHttpDate_rfc1036Weekdays)
+{
+    ASSERT_EQ(784284577, cgi::parseHttpDate("Tuesday, 08-Nov-94 08:49:37 GMT"));
+    ASSERT_EQ(784370977, cgi::parseHttpDate("Wednesday, 09-Nov-94 08:49:37 GMT"));
+}
+
+TEST_F(cgiFixture, parseHttpDate_invalid)
+{
+    ASSERT_EQ(-1, cgi::parseHttpDate(""));
+    ASSERT_EQ(-1, cgi::parseHttpDate("Sun, 06 Nov 1994 08:49:37"));
+    ASSERT_EQ(-1, cgi::parseHttpDate("Sun, 06 Nov 1994 08:49:37 GMT "));
+    ASSERT_EQ(-1, cgi::parseHttpDate("Sun, 06 Foo 1994 08:49:37 GMT"));
+    ASSERT_EQ(-1, cgi::parseHttpDate("Sun, 06 Nov 99999999999999 08:49:37 GMT"));
+    ASSERT_EQ(-1, cgi::parseHttpDate("Sun Nov  6 08:49:37"));
+}
+
 TEST_F(cgiFixture, escape_html)
 {
     ASSERT_STREQ("", escape_html("").c_str());
@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <thread>
+
+#include "cgiworker.h"
+
+#ifndef WIN32
+// 要求の環境変数の長さを本文にして返すワーカー。
+static const char* kWorkerScript =
+    "#!/bin/sh\n"
+    "while read id len; do\n"
+    "  dd bs=1 count=\"$len\" 2>/dev/null >/dev/null\n"
+    "  body=\"Content-Type: text/plain\n\nlen=$len\"\n"
+    "  printf '%s %d\\n%s\\n' \"$id\" \"${#body}\" \"$body\"\n"
+    "done\n";
+
+class CGIWorkerPoolFixture : public ::testing::Test {
+public:
+    void SetUp()
+    {
+        path = "/tmp/cgiworker_unittest.sh";
+        FILE* fp = fopen(path.c_str(), "w");
+        ASSERT_NE(nullptr, fp);
+        fputs(kWorkerScript, fp);
+        fclose(fp);
+        chmod(path.c_str(), 0755);
+
+        Environment env;
+        env.set("PATH", "/bin:/usr/bin");
+        pool.setProgram(path, env);
+    }
+
+    void TearDown()
+    {
+        pool.stop();
+        remove(path.c_str());
+    }
+
+    std::string path;
+    CGIWorkerPool pool;
+};
+
+TEST_F(CGIWorkerPoolFixture, disabledBySize)
+{
+    Environment env;
+    env.set("A", "1");
+    std::string output;
+    ASSERT_FALSE(pool.run(env, output));
+}
+
+TEST_F(CGIWorkerPoolFixture, run)
+{
+    pool.setSize(1);
+
+    Environment env;
+    env.set("QUERY_STRING", "abc");   // "QUERY_STRING=abc\0"
+    std::string output;
+    ASSERT_TRUE(pool.run(env, output));
+    ASSERT_EQ("Content-Type: text/plain\n\nlen=17", output);
+
+    // 同じワーカーが続けて使われる。
+    ASSERT_TRUE(pool.run(env, output));
+    ASSERT_EQ("Content-Type: text/plain\n\nlen=17", output);
+    ASSERT_EQ(1, pool.getState().at("workers").number());
+    ASSERT_EQ(1, pool.getState().at("started").number());
+}
+
+TEST_F(CGIWorkerPoolFixture, concurrent)
+{
+    pool.setSize(2);
+
+    std::vector<std::thread> threads;
+    std::vector<std::string> outputs(8);
+    std::vector<int> oks(8);
+    for (int i = 0; i < 8; i++)
+    {
+        threads.emplace_back([&, i]()
+                             {
+                                 Environment env;
+                                 env.set("X", std::string(i + 1, 'x'));
+                                 std::string output;
+                                 oks[i] = pool.run(env, output);
+                                 outputs[i] = output;
+                             });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    for (int i = 0; i < 8; i++)
+    {
+        ASSERT_TRUE(oks[i]);
+        ASSERT_EQ("Content-Type: text/plain\n\nlen=" + std::to_string(i + 4), outputs[i]);
+    }
+    ASSERT_GE(2, pool.getState().at("started").number());
+}
+
+TEST_F(CGIWorkerPoolFixture, workerExits)
+{
+    Environment env;
+    env.set("PATH", "/bin:/usr/bin");
+    pool.setProgram("/bin/true", env);
+    pool.setSize(1);
+
+    std::string output;
+    ASSERT_FALSE(pool.run(env, output));
+}
+#endif
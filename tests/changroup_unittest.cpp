@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include "changroup.h"
+
+class ChannelGroupFixture : public ::testing::Test {
+public:
+    static ChannelGroup::Rendition rendition(const char* id, const char* name, int bitrate, bool local = false)
+    {
+        return { GnuID(id), name, bitrate, local };
+    }
+
+    std::vector<ChannelGroup::Rendition> renditions {
+        rendition("00000000000000000000000000000001", "1080p", 6000),
+        rendition("00000000000000000000000000000002", "720p", 3000),
+        rendition("00000000000000000000000000000003", "360p", 800),
+    };
+};
+
+TEST_F(ChannelGroupFixture, makeID)
+{
+    GnuID bcid("0123456789abcdef0123456789abcdef");
+    GnuID a = ChannelGroup::makeID(bcid, "show");
+    ASSERT_TRUE(a.isSet());
+    ASSERT_TRUE(a.isSame(ChannelGroup::makeID(bcid, "show")));
+    ASSERT_FALSE(a.isSame(ChannelGroup::makeID(bcid, "other")));
+    ASSERT_FALSE(a.isSame(ChannelGroup::makeID(GnuID("fedcba9876543210fedcba9876543210"), "show")));
+}
+
+TEST_F(ChannelGroupFixture, select)
+{
+    ASSERT_EQ(0, ChannelGroup::select(renditions, -1));
+    ASSERT_EQ(0, ChannelGroup::select(renditions, 6000));
+    ASSERT_EQ(1, ChannelGroup::select(renditions, 5999));
+    ASSERT_EQ(2, ChannelGroup::select(renditions, 1000));
+    // どれも収まらなければ一番低いもの。
+    ASSERT_EQ(2, ChannelGroup::select(renditions, 100));
+    ASSERT_EQ(-1, ChannelGroup::select({}, 1000));
+}
+
+TEST_F(ChannelGroupFixture, selectPrefersLocal)
+{
+    renditions.push_back(rendition("00000000000000000000000000000004", "720p-b", 3000, true));
+    ASSERT_EQ(3, ChannelGroup::select(renditions, 4000));
+}
+
+TEST_F(ChannelGroupFixture, masterPlaylist)
+{
+    renditions[2].name = "";
+    ASSERT_EQ("#EXTM3U\n"
+              "#EXT-X-STREAM-INF:BANDWIDTH=6000000,NAME=\"1080p\"\n"
+              "/hls/00000000000000000000000000000001/index.m3u8?auth=x\n"
+              "#EXT-X-STREAM-INF:BANDWIDTH=3000000,NAME=\"720p\"\n"
+              "/hls/00000000000000000000000000000002/index.m3u8?auth=x\n"
+              "#EXT-X-STREAM-INF:BANDWIDTH=800000,NAME=\"800k\"\n"
+              "/hls/00000000000000000000000000000003/index.m3u8?auth=x\n",
+              ChannelGroup::masterPlaylist(renditions, "auth=x"));
+}
@@ -241,6 +241,34 @@ TEST_F(ChanHitFixture, writeAtom100)
     ASSERT_EQ(169 + 24, mem.pos);
 }
 
+TEST_F(ChanHitFixture, writeAtomHeadroom)
+{
+    MemoryStream mem(1024);
+    AtomStream writer(mem);
+    GnuID chid;
+    chid.clear();
+    hit->versionExNumber = 0;
+    hit->uphost.ip = 0;
+    hit->headroom = 1500;
+    hit->writeAtoms(writer, chid);
+    ASSERT_EQ(169 + 12, mem.pos);
+}
+
+TEST_F(ChanHitFixture, writeAtomHub)
+{
+    MemoryStream mem(1024);
+    AtomStream writer(mem);
+    GnuID chid;
+    chid.clear();
+    hit->versionExNumber = 0;
+    hit->uphost.ip = 0;
+    hit->hub = true;
+    hit->hubListeners = 100;
+    hit->hubRelays = 20;
+    hit->writeAtoms(writer, chid);
+    ASSERT_EQ(169 + 24, mem.pos);
+}
+
 #include "atom2.h"
 #include "pcp.h"
 
@@ -310,6 +338,41 @@ TEST_F(ChanHitFixture, writeAtomIPv6)
     ASSERT_EQ(expectation.serialize(), ss.str());
 }
 
+TEST_F(ChanHitFixture, writeAtomCache)
+{
+    GnuID chid;
+    chid.fromStr("FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF");
+
+    StringStream ss1;
+    AtomStream w1(ss1);
+    hit->writeAtoms(w1, chid);
+    auto cache = hit->atomCache;
+    ASSERT_NE(nullptr, cache);
+
+    // 値が同じなら書き直さない。コピーしたヒットも同じものを使う。
+    ChanHit copy = *hit;
+    StringStream ss2;
+    AtomStream w2(ss2);
+    copy.writeAtoms(w2, chid);
+    ASSERT_EQ(cache, copy.atomCache);
+    ASSERT_EQ(ss1.str(), ss2.str());
+
+    // 値が変われば書き直す。
+    copy.numListeners = 5;
+    StringStream ss3;
+    AtomStream w3(ss3);
+    copy.writeAtoms(w3, chid);
+    ASSERT_NE(cache, copy.atomCache);
+
+    ChanHit fresh = copy;
+    fresh.atomCache = nullptr;
+    StringStream ss4;
+    AtomStream w4(ss4);
+    fresh.writeAtoms(w4, chid);
+    ASSERT_EQ(ss4.str(), ss3.str());
+    ASSERT_NE(ss1.str(), ss3.str());
+}
+
 TEST_F(ChanHitFixture, initLocal)
 {
     Channel channel;
@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
 
+#include <set>
+
 #include "channel.h"
+#include "mocksys.h"
+#include "str.h"
 
 class ChanHitListFixture : public ::testing::Test {
 public:
@@ -71,10 +75,77 @@ TEST_F(ChanHitListFixture, addHit)
 
 TEST_F(ChanHitListFixture, delHit)
 {
+    hitlist->addHit(hit);
+    ASSERT_EQ(1, hitlist->numHits());
+
+    hitlist->delHit(hit);
+    ASSERT_EQ(0, hitlist->numHits());
+    ASSERT_EQ(0, listCount(hitlist->hit));
 }
 
 TEST_F(ChanHitListFixture, deadHit)
 {
+    hit.numListeners = 3;
+    hitlist->addHit(hit);
+    ASSERT_EQ(3, hitlist->numListeners());
+
+    // 死んだヒットはリストに残るが数えられない。
+    hitlist->deadHit(hit);
+    ASSERT_EQ(0, hitlist->numHits());
+    ASSERT_EQ(0, hitlist->numListeners());
+    ASSERT_EQ(1, listCount(hitlist->hit));
+    ASSERT_TRUE(hitlist->hit->dead);
+
+    // 死んだヒットは更新されずに新しいヒットが加わる。
+    hitlist->addHit(hit);
+    ASSERT_EQ(1, hitlist->numHits());
+    ASSERT_EQ(2, listCount(hitlist->hit));
+}
+
+TEST_F(ChanHitListFixture, addHitsMatchesAddHit)
+{
+    auto make = [&](const char* ip, const char* session, int listeners)
+                {
+                    ChanHit h = hit;
+                    h.rhost[0].fromStrIP(ip, 7144);
+                    h.rhost[1].init();
+                    h.host = h.rhost[0];
+                    h.sessionID.fromStr(session);
+                    h.numListeners = listeners;
+                    return h;
+                };
+    const char* s1 = "11111111111111111111111111111111";
+    const char* s2 = "22222222222222222222222222222222";
+    const char* s3 = "33333333333333333333333333333333";
+
+    std::vector<ChanHit> hits = {
+        make("192.0.2.1", s1, 1),
+        make("192.0.2.2", s2, 2),
+        make("192.0.2.2", s2, 3),   // 同じホストの更新
+        make("192.0.2.3", s1, 4),   // アドレスが変わった
+        make("192.0.2.4", s3, 5),
+    };
+
+    // 一つずつ加えたものと同じになる。
+    auto old = make("192.0.2.9", s3, 9);
+    auto seq = std::make_shared<ChanHitList>();
+    seq->addHit(old);
+    for (auto h : hits)
+        seq->addHit(h);
+
+    hitlist->addHit(old);
+    ASSERT_EQ(3, hitlist->addHits(hits.begin(), hits.end()));
+
+    auto dump = [](std::shared_ptr<ChanHitList> list)
+                {
+                    std::set<std::string> out;
+                    for (auto h = list->hit; h; h = h->next)
+                        out.insert(h->rhost[0].str() + "/" + std::to_string(h->numListeners));
+                    return out;
+                };
+    ASSERT_EQ(dump(seq), dump(hitlist));
+    ASSERT_EQ(3, hitlist->numHits());
+    ASSERT_EQ(3 + 4 + 5, hitlist->numListeners());
 }
 
 TEST_F(ChanHitListFixture, clearHits)
@@ -83,10 +154,32 @@ TEST_F(ChanHitListFixture, clearHits)
 
 TEST_F(ChanHitListFixture, numHits)
 {
+    ASSERT_EQ(0, hitlist->numHits());
+    hitlist->addHit(hit);
+    ASSERT_EQ(1, hitlist->numHits());
+
+    // host が無いヒットは数えない。
+    ChanHit h;
+    h.rhost[0].fromStrIP("0.0.0.1", 7144);
+    hitlist->addHit(h);
+    ASSERT_EQ(1, hitlist->numHits());
+    ASSERT_EQ(2, listCount(hitlist->hit));
 }
 
 TEST_F(ChanHitListFixture, numListeners)
 {
+    hit.numListeners = 3;
+    hit.numRelays = 2;
+    hitlist->addHit(hit);
+    ASSERT_EQ(3, hitlist->numListeners());
+    ASSERT_EQ(2, hitlist->numRelays());
+
+    // 同じホストの更新は置き換わる。
+    hit.numListeners = 5;
+    hit.numRelays = 1;
+    hitlist->addHit(hit);
+    ASSERT_EQ(5, hitlist->numListeners());
+    ASSERT_EQ(1, hitlist->numRelays());
 }
 
 TEST_F(ChanHitListFixture, numClaps)
@@ -103,6 +196,74 @@ TEST_F(ChanHitListFixture, numFirewalled)
 
 TEST_F(ChanHitListFixture, numTrackers)
 {
+    hit.tracker = true;
+    hit.firewalled = true;
+    hitlist->addHit(hit);
+    ASSERT_EQ(1, hitlist->numTrackers());
+    ASSERT_EQ(1, hitlist->numFirewalled());
+
+    hitlist->deleteHit(hitlist->hit);
+    ASSERT_EQ(0, hitlist->numTrackers());
+    ASSERT_EQ(0, hitlist->numFirewalled());
+}
+
+TEST_F(ChanHitListFixture, maxHitsEvictsLeastRecentlyUpdated)
+{
+    hitlist->used = true;
+    hitlist->maxHits = 2;
+
+    ChanHit h1 = hit, h2 = hit, h3 = hit;
+    h1.rhost[0].fromStrIP("0.0.0.1", 7144);
+    h2.rhost[0].fromStrIP("0.0.0.2", 7144);
+    h3.rhost[0].fromStrIP("0.0.0.3", 7144);
+
+    hitlist->addHit(h1);
+    hitlist->addHit(h2);
+    // h1 を更新したので、一番古いのは h2 になる。
+    hitlist->addHit(h1);
+    hitlist->addHit(h3);
+
+    ASSERT_EQ(2, listCount(hitlist->hit));
+    ASSERT_EQ(2, hitlist->numHits());
+    int count = 0;
+    bool found2 = false;
+    hitlist->forEachHit([&](ChanHit* h)
+                        {
+                            count++;
+                            if (h->rhost[0].isSame(h2.rhost[0]))
+                                found2 = true;
+                        });
+    ASSERT_EQ(2, count);
+    ASSERT_FALSE(found2);
+}
+
+TEST_F(ChanHitListFixture, trimHits)
+{
+    hitlist->used = true;
+
+    ChanHit h1 = hit, h2 = hit, h3 = hit;
+    h1.rhost[0].fromStrIP("0.0.0.1", 7144);
+    h2.rhost[0].fromStrIP("0.0.0.2", 7144);
+    h3.rhost[0].fromStrIP("0.0.0.3", 7144);
+
+    hitlist->addHit(h1);
+    hitlist->addHit(h2);
+    hitlist->addHit(h3);
+    size_t before = hitlist->memoryUsage();
+
+    // 一番古い h1 が捨てられる。
+    ASSERT_EQ(1, hitlist->trimHits(2));
+    ASSERT_EQ(2, hitlist->numHits());
+    ASSERT_EQ(before - (before - sizeof(ChanHitList)) / 3, hitlist->memoryUsage());
+    ASSERT_EQ(0, hitlist->trimHits(2));
+
+    bool found1 = false;
+    hitlist->forEachHit([&](ChanHit* h)
+                        {
+                            if (h->rhost[0].isSame(h1.rhost[0]))
+                                found1 = true;
+                        });
+    ASSERT_FALSE(found1);
 }
 
 TEST_F(ChanHitListFixture, closestHit)
@@ -125,6 +286,64 @@ TEST_F(ChanHitListFixture, pickSourceHits)
 {
 }
 
+TEST_F(ChanHitListFixture, rankHits)
+{
+    auto add = [&](const char* wan, const char* lan, int hops, bool tracker, const char* id)
+    {
+        ChanHit h;
+        h.init();
+        h.host = h.rhost[0] = Host::fromString(wan);
+        if (lan)
+            h.rhost[1] = Host::fromString(lan);
+        h.numHops = hops;
+        h.tracker = tracker;
+        h.sessionID.fromStr(id);
+        return hitlist->addHit(h);
+    };
+
+    add("210.210.210.210:7144", "192.168.0.2:7144", 2, false, "00000000000000000000000000000001");
+    add("210.210.210.210:7145", "192.168.0.3:7144", 1, false, "00000000000000000000000000000002");
+    add("211.211.211.211:7144", nullptr, 3, false, "00000000000000000000000000000003");
+    add("212.212.212.212:7144", nullptr, 0, true, "00000000000000000000000000000004");
+    add("213.213.213.213:7144", nullptr, 1, false, "00000000000000000000000000000005")->dead = true;
+
+    ChanHitRanking r;
+    r.matchHost = Host::fromString("210.210.210.210:0");
+    ASSERT_EQ(6, hitlist->rankHits(r));
+
+    auto& local = r.candidates[ChanHitRanking::LOCAL_RELAY];
+    ASSERT_EQ(2, local.size());
+    ASSERT_EQ("192.168.0.3:7144", local[0].hit.host.str());
+    ASSERT_EQ("192.168.0.2:7144", local[1].hit.host.str());
+
+    auto& global = r.candidates[ChanHitRanking::GLOBAL_RELAY];
+    ASSERT_EQ(3, global.size());
+    ASSERT_EQ("210.210.210.210:7145", global[0].hit.host.str());
+    ASSERT_EQ("211.211.211.211:7144", global[2].hit.host.str());
+
+    ASSERT_EQ(0, r.candidates[ChanHitRanking::LOCAL_TRACKER].size());
+    ASSERT_EQ(1, r.candidates[ChanHitRanking::GLOBAL_TRACKER].size());
+
+    auto all = r.ordered();
+    ASSERT_EQ(6, all.size());
+    ASSERT_EQ("192.168.0.3:7144", all[0].hit.host.str());
+    ASSERT_EQ("212.212.212.212:7144", all[5].hit.host.str());
+
+    // 上限。
+    r.maxPerCategory = 1;
+    ASSERT_EQ(3, hitlist->rankHits(r));
+
+    // 最近接続したヒットは除く。
+    r.maxPerCategory = 8;
+    r.relayWait = 5;
+    auto mock = dynamic_cast<MockSys*>(sys);
+    auto time = mock->time;
+    mock->time = 1000;
+    all[0].entry->lastContact = 998;
+    ASSERT_EQ(4, hitlist->rankHits(r));
+    mock->time = time;
+}
+
 TEST_F(ChanHitListFixture, isUsed)
 {
     ASSERT_EQ(false, hitlist->isUsed());
@@ -132,6 +351,52 @@ TEST_F(ChanHitListFixture, isUsed)
 
 TEST_F(ChanHitListFixture, clearDeadHits)
 {
+    auto mock = dynamic_cast<MockSys*>(sys);
+    auto time = mock->time;
+
+    ChanHit hits[4];
+    for (int i = 0; i < 4; i++)
+    {
+        hits[i] = hit;
+        hits[i].rhost[0].fromStrIP(str::format("209.209.209.%d", i + 1).c_str(), 7144);
+        hits[i].host = hits[i].rhost[0];
+    }
+    hits[3].tracker = true;
+
+    mock->time = 1000;
+    hitlist->addHit(hits[0]);
+    hitlist->addHit(hits[3]);
+    mock->time = 1100;
+    hitlist->addHit(hits[1]);
+    hitlist->addHit(hits[2]);
+    ASSERT_EQ(4, hitlist->numHits());
+
+    // まだ古くない。
+    mock->time = 1180;
+    ASSERT_EQ(4, hitlist->clearDeadHits(180, true));
+
+    // トラッカーは残す。
+    mock->time = 1181;
+    ASSERT_EQ(3, hitlist->clearDeadHits(180, false));
+    ASSERT_EQ(1, hitlist->numTrackers());
+
+    // 更新されたヒットは残る。
+    hitlist->addHit(hits[1]);
+    hitlist->addHit(hits[2]);
+    mock->time = 1281;
+    ASSERT_EQ(2, hitlist->clearDeadHits(180, true));
+    ASSERT_EQ(0, hitlist->numTrackers());
+
+    // 死んだヒットは古くなくても消える。
+    hitlist->deadHit(hits[1]);
+    ASSERT_EQ(1, hitlist->numHits());
+    ASSERT_EQ(1, hitlist->clearDeadHits(180, true));
+
+    ASSERT_NE(nullptr, hitlist->hit);
+    ASSERT_EQ(nullptr, hitlist->hit->next);
+    ASSERT_EQ("209.209.209.3:7144", hitlist->hit->host.str());
+
+    mock->time = time;
 }
 
 TEST_F(ChanHitListFixture, createXML)
@@ -231,3 +496,141 @@ TEST_F(ChanHitListFixture, forEachHit)
     hitlist->forEachHit([&](ChanHit*) { count++; });
     ASSERT_EQ(3, count);
 }
+
+#include "relaypolicy.h"
+
+TEST_F(ChanHitListFixture, goodRelayHits)
+{
+    RelayStats stats;
+    ChanHit hits[4];
+    for (int i = 0; i < 4; i++)
+    {
+        hits[i] = hit;
+        hits[i].rhost[0].fromStrIP(str::format("209.209.209.%d", i + 1).c_str(), 7144);
+        hits[i].host = hits[i].rhost[0];
+        hits[i].numHops = 4 - i;
+        hitlist->addHit(hits[i]);
+    }
+    ASSERT_EQ(4, hitlist->numHits());
+
+    // ファイアウォール越しとトラッカーは入れない。
+    hits[2].firewalled = true;
+    hitlist->addHit(hits[2]);
+    hits[1].tracker = true;
+    hitlist->addHit(hits[1]);
+
+    auto res = hitlist->goodRelayHits(4, stats);
+    ASSERT_EQ(2, res.size());
+    ASSERT_EQ("209.209.209.4:7144", res[0].host.str());
+    ASSERT_EQ("209.209.209.1:7144", res[1].host.str());
+
+    // 最近失敗したものも入れない。
+    stats.recordFailure(res[0].host);
+    res = hitlist->goodRelayHits(4, stats);
+    ASSERT_EQ(1, res.size());
+    ASSERT_EQ("209.209.209.1:7144", res[0].host.str());
+
+    ASSERT_EQ(0, hitlist->goodRelayHits(0, stats).size());
+}
+
+TEST_F(ChanHitListFixture, pickAlternates)
+{
+    auto mock = dynamic_cast<MockSys*>(sys);
+    auto time = mock->time;
+    mock->time = 1000;
+
+    auto add = [&](const char* wan, const char* lan, int hops)
+    {
+        ChanHit h = hit;
+        h.rhost[0].fromStrIP(wan, 7144);
+        h.rhost[1].fromStrIP(lan, 7144);
+        h.host = h.rhost[0];
+        h.numHops = hops;
+        return h;
+    };
+
+    ChanHit h1 = add("209.209.209.1", "192.168.0.1", 3);
+    ChanHit h2 = add("209.209.209.2", "192.168.0.2", 1);
+    h2.firewalled = true;
+    ChanHit h3 = add("100.0.0.1", "192.168.0.3", 2);
+    ChanHit h4 = add("209.209.209.4", "192.168.0.4", 1);
+    h4.tracker = true;
+    ChanHit h5 = add("209.209.209.5", "192.168.0.5", 2);
+    ChanHit h6 = add("209.209.209.6", "192.168.0.6", 1);
+    h6.relay = false;
+    for (auto h : { &h1, &h2, &h3, &h4, &h5, &h6 })
+        hitlist->addHit(*h);
+
+    GnuID self("ffffffffffffffffffffffffffffffff");
+    Host serverHost, rhost;
+    serverHost.fromStrIP("100.0.0.1", 7144);
+    rhost.fromStrIP("192.168.0.9", 7144);
+
+    // LAN 内のものを LAN のアドレスで先に、その後はホップ数の順。
+    ChanHit out[8];
+    ASSERT_EQ(3, hitlist->pickAlternates(rhost, serverHost, self, 2, out, 8));
+    ASSERT_EQ("192.168.0.3:7144", out[0].host.str());
+    ASSERT_EQ("209.209.209.5:7144", out[1].host.str());
+    ASSERT_EQ("209.209.209.1:7144", out[2].host.str());
+
+    // 続けては教えない。
+    ASSERT_EQ(0, hitlist->pickAlternates(rhost, serverHost, self, 2, out, 8));
+
+    // 数を制限する。
+    mock->time = 1002;
+    ASSERT_EQ(1, hitlist->pickAlternates(rhost, serverHost, self, 2, out, 1));
+    ASSERT_EQ("192.168.0.3:7144", out[0].host.str());
+
+    // ヒットが変われば候補を作り直す。
+    mock->time = 1004;
+    ChanHit h7 = add("209.209.209.7", "192.168.0.7", 0);
+    hitlist->addHit(h7);
+    Host wan;
+    wan.fromStrIP("210.0.0.1", 7144);
+    ASSERT_EQ(4, hitlist->pickAlternates(wan, serverHost, self, 2, out, 8));
+    ASSERT_EQ("209.209.209.7:7144", out[0].host.str());
+    // ホップ数が同じなら後から加えたものが先。
+    ASSERT_EQ("209.209.209.5:7144", out[1].host.str());
+    ASSERT_EQ("100.0.0.1:7144", out[2].host.str());
+
+    mock->time = time;
+}
+
+#include "locality.h"
+
+TEST_F(ChanHitListFixture, pickAlternatesPrefersSameRegion)
+{
+    auto mock = dynamic_cast<MockSys*>(sys);
+    auto time = mock->time;
+    mock->time = 1000;
+
+    auto add = [&](const char* wan, int hops)
+    {
+        ChanHit h = hit;
+        h.rhost[0].fromStrIP(wan, 7144);
+        h.rhost[1].init();
+        h.host = h.rhost[0];
+        h.numHops = hops;
+        hitlist->addHit(h);
+    };
+    add("209.209.209.1", 1);
+    add("203.0.113.2", 3);
+    add("209.209.209.3", 2);
+
+    Locality loc;
+    loc.load("203.0.113.0/24 AS64500\n");
+
+    GnuID self("ffffffffffffffffffffffffffffffff");
+    Host serverHost, rhost;
+    serverHost.fromStrIP("100.0.0.1", 7144);
+    rhost.fromStrIP("203.0.113.50", 7144);
+
+    // 同じ地域のものを先に、その後はホップ数の順。
+    ChanHit out[8];
+    ASSERT_EQ(3, hitlist->pickAlternates(rhost, serverHost, self, 2, out, 8, &loc));
+    ASSERT_EQ("203.0.113.2:7144", out[0].host.str());
+    ASSERT_EQ("209.209.209.1:7144", out[1].host.str());
+    ASSERT_EQ("209.209.209.3:7144", out[2].host.str());
+
+    mock->time = time;
+}
@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 
 #include "chaninfo.h"
+#include "atom.h"
+#include "pcp.h"
 
 class ChanInfoFixture : public ::testing::Test {
 public:
@@ -47,6 +49,72 @@ TEST_F(ChanInfoFixture, writeInfoAtoms)
     ASSERT_EQ(81, mem.getPosition());
 }
 
+// 低遅延モードは有効な時だけアトムを書き、読み戻せる。
+TEST_F(ChanInfoFixture, lowLatencyAtom)
+{
+    MemoryStream mem(1024);
+    AtomStream atom(mem);
+
+    info.lowLatency = true;
+    info.writeInfoAtoms(atom);
+    ASSERT_EQ(81 + 9, mem.getPosition());
+
+    mem.rewind();
+    int c, d;
+    ASSERT_EQ(PCP_CHAN_INFO, atom.read(c, d));
+    ChanInfo info2;
+    info2.readInfoAtoms(atom, c);
+    ASSERT_TRUE(info2.lowLatency);
+}
+
+// サイマル配信のグループは設定されている時だけアトムを書く。
+TEST_F(ChanInfoFixture, groupAtoms)
+{
+    MemoryStream mem(1024);
+    AtomStream atom(mem);
+
+    info.groupID = GnuID("0123456789abcdef0123456789abcdef");
+    info.rendition = "720p";
+    info.writeInfoAtoms(atom);
+    ASSERT_EQ(81 + (8 + 16) + (8 + 5), mem.getPosition());
+
+    mem.rewind();
+    int c, d;
+    ASSERT_EQ(PCP_CHAN_INFO, atom.read(c, d));
+    ChanInfo info2;
+    info2.readInfoAtoms(atom, c);
+    ASSERT_TRUE(info2.groupID.isSame(info.groupID));
+    ASSERT_STREQ("720p", info2.rendition.cstr());
+}
+
+// 差分は変わった項目だけを書き、前の情報に重ねて読むと元に戻る。
+TEST_F(ChanInfoFixture, writeDeltaAtoms)
+{
+    MemoryStream mem(1024);
+    AtomStream atom(mem);
+
+    ChanInfo prev = info;
+    ASSERT_EQ(0, info.writeDeltaAtoms(atom, prev));
+    ASSERT_EQ(0, mem.getPosition());
+
+    info.track.title = "new title";
+    info.lowLatency = !prev.lowLatency;
+    ASSERT_EQ(2, info.writeDeltaAtoms(atom, prev));
+    // info (8) + lowl (9) + trck (8) + titl (8 + 10)
+    ASSERT_EQ(8 + 9 + 8 + 8 + 10, mem.getPosition());
+
+    mem.rewind();
+    ChanInfo info2 = prev;
+    int c, d;
+    ASSERT_EQ(PCP_CHAN_INFO, atom.read(c, d));
+    info2.readInfoAtoms(atom, c);
+    ASSERT_EQ(PCP_CHAN_TRACK, atom.read(c, d));
+    info2.readTrackAtoms(atom, c);
+    ASSERT_STREQ("new title", info2.track.title.cstr());
+    ASSERT_EQ(info.lowLatency, info2.lowLatency);
+    ASSERT_STREQ(prev.name.cstr(), info2.name.cstr());
+}
+
 TEST_F(ChanInfoFixture, writeTrackAtoms)
 {
     MemoryStream mem(1024);
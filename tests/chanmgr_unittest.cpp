@@ -3,6 +3,7 @@
 #include "version2.h"
 #include "md5.h"
 #include "chanmgr.h"
+#include "mocksys.h"
 
 class ChanMgrFixture : public ::testing::Test {
 public:
@@ -57,6 +58,9 @@ TEST_F(ChanMgrFixture, initialState)
     EXPECT_EQ(0, x->icyIndex);
     EXPECT_EQ(120, x->hostUpdateInterval);
     EXPECT_EQ(5, x->bufferTime);
+    EXPECT_EQ(0, x->packetBufferDuration);
+    EXPECT_EQ(0, x->joinKeyFramesBack);
+    EXPECT_EQ(1000, x->maxHitsPerChannel);
     EXPECT_TRUE(id.isSame(x->currFindAndPlayChannel));
 }
 
@@ -70,8 +74,55 @@ TEST_F(ChanMgrFixture, createChannel)
 
     ASSERT_TRUE(c != nullptr); // ASSERT_TRUE(c) と書くとエラーになるコンパイラがある。
     ASSERT_EQ(c, x->channel);
+    ASSERT_FALSE(c->closed);
 
     x->deleteChannel(c);
+    ASSERT_TRUE(c->closed);
+}
+
+TEST_F(ChanMgrFixture, findChannelByID)
+{
+    ChanInfo info;
+    info.id = "00112233445566778899aabbccddeeff";
+    auto c = x->createChannel(info);
+    ASSERT_EQ(c, x->findChannelByID(info.id));
+    ASSERT_EQ(1, x->channelIndex.size());
+
+    // 作った後で ID を付けたチャンネルも見付かる。
+    ChanInfo noid;
+    auto d = x->createChannel(noid);
+    GnuID id("ffeeddccbbaa99887766554433221100");
+    d->info.id = id;
+    ASSERT_EQ(d, x->findChannelByID(id));
+    ASSERT_EQ(2, x->channelIndex.size());
+
+    x->deleteChannel(c);
+    ASSERT_EQ(nullptr, x->findChannelByID(info.id));
+    x->deleteChannel(d);
+    ASSERT_EQ(nullptr, x->findChannelByID(id));
+    ASSERT_EQ(0, x->channelIndex.size());
+}
+
+TEST_F(ChanMgrFixture, addHitReusesHitList)
+{
+    ChanHit hit;
+    hit.init();
+    hit.chanID = "00112233445566778899aabbccddeeff";
+    hit.host.fromStrIP("192.168.0.1", 7144);
+    hit.rhost[0] = hit.host;
+    x->addHit(hit);
+    auto chl = x->findHitListByID(hit.chanID);
+    ASSERT_TRUE(chl != nullptr);
+
+    hit.host.fromStrIP("192.168.0.2", 7144);
+    hit.rhost[0] = hit.host;
+    x->addHit(hit);
+    ASSERT_EQ(chl, x->findHitListByID(hit.chanID));
+    ASSERT_EQ(1, x->numHitLists());
+    ASSERT_EQ(2, chl->numHits());
+
+    x->clearHitLists();
+    ASSERT_EQ(nullptr, x->findHitListByID(hit.chanID));
 }
 
 TEST_F(ChanMgrFixture, authSecret)
@@ -84,3 +135,37 @@ TEST_F(ChanMgrFixture, authToken)
     ASSERT_STREQ("44d5299e57ad9274fee7960a9fa60bfd", x->authToken("01234567890123456789012345678901").c_str());
     ASSERT_STREQ("44d5299e57ad9274fee7960a9fa60bfd", md5::hexdigest("00151515151515151515151515151515:01234567890123456789012345678901").c_str());
 }
+
+TEST_F(ChanMgrFixture, authTokenFollowsBroadcastID)
+{
+    GnuID id("01234567890123456789012345678901");
+    ASSERT_EQ("44d5299e57ad9274fee7960a9fa60bfd", x->authToken(id));
+
+    x->broadcastID = GnuID("00000000000000000000000000000001");
+    ASSERT_EQ(md5::hexdigest(x->authSecret(id)), x->authToken(id));
+    ASSERT_NE("44d5299e57ad9274fee7960a9fa60bfd", x->authToken(id));
+}
+
+TEST_F(ChanMgrFixture, expiringAuthToken)
+{
+    GnuID id("01234567890123456789012345678901");
+    // HMAC-SHA256(broadcastID, "<チャンネル ID>:<期限>")
+    ASSERT_EQ("9e2c8c04dd2e1d381532e2e0d83777caa38d0dfac1fd2709f2c5c5aec19f7716",
+              x->expiringAuthToken(id, 2000000000));
+
+    auto msys = static_cast<MockSys*>(sys);
+    auto saved = msys->time;
+    msys->time = 1999999999;
+
+    auto token = x->expiringAuthToken(id, 2000000000);
+    ASSERT_TRUE(x->isValidAuthToken(id, token, "2000000000"));
+    ASSERT_FALSE(x->isValidAuthToken(id, token, "2000000001"));
+    ASSERT_FALSE(x->isValidAuthToken(id, token, "2000000000x"));
+    ASSERT_FALSE(x->isValidAuthToken(id, token, ""));
+    ASSERT_TRUE(x->isValidAuthToken(id, x->authToken(id), ""));
+
+    msys->time = 2000000001;
+    ASSERT_FALSE(x->isValidAuthToken(id, token, "2000000000"));
+
+    msys->time = saved;
+}
@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 
 #include "channel.h"
+#include "chanmgr.h"
+#include "mocksys.h"
 
 class ChannelFixture : public ::testing::Test {
 public:
@@ -50,6 +52,8 @@ TEST_F(ChannelFixture, initialState)
     // bool                bump, stayConnected;
     ASSERT_FALSE(c.bump);
     ASSERT_FALSE(c.stayConnected);
+    // unsigned int        packetBufferDuration;
+    ASSERT_EQ(0, c.packetBufferDuration);
     // int                 icyMetaInterval;
     ASSERT_EQ(0, c.icyMetaInterval);
     // unsigned int        streamPos;
@@ -80,11 +84,12 @@ TEST_F(ChannelFixture, initialState)
 
     // unsigned int        lastTrackerUpdate;
     ASSERT_EQ(0, c.lastTrackerUpdate);
-    // unsigned int        lastMetaUpdate;
-    ASSERT_EQ(0, c.lastMetaUpdate);
+    // bool                metaPending;
+    ASSERT_FALSE(c.metaPending);
 
     // double              startTime;
     ASSERT_EQ(0, c.startTime);
+    ASSERT_EQ(0, c.readDelayDeadline);
 
     // Channel             *next;
     ASSERT_EQ(nullptr, c.next);
@@ -244,3 +249,252 @@ TEST_F(ChannelFixture, writeVariable)
     ASSERT_TRUE(c.writeVariable(mem, "plsExt"));
     ASSERT_STREQ(".m3u", mem.str().c_str());
 }
+
+TEST_F(ChannelFixture, updateBitrate)
+{
+    auto tmp = chanMgr;
+    chanMgr = new ChanMgr();
+
+    auto ch = std::make_shared<Channel>();
+    ch->info.id.fromStr("01234567890123456789012345678901");
+    ch->info.name = "test";
+    ch->info.bitrate = 500;
+
+    ASSERT_FALSE(ch->updateBitrate(500));
+    ASSERT_TRUE(ch->updateBitrate(800));
+    ASSERT_EQ(800, ch->info.bitrate);
+    ASSERT_STREQ("test", ch->info.name.cstr());
+
+    delete chanMgr;
+    chanMgr = tmp;
+}
+
+// チャンネルの設定が無ければ全体の設定を使う。
+TEST_F(ChannelFixture, effectiveBufferDuration)
+{
+    auto tmp = chanMgr;
+    chanMgr = new ChanMgr();
+
+    Channel c;
+    ASSERT_EQ(0, c.effectiveBufferDuration());
+
+    chanMgr->packetBufferDuration = 10;
+    ASSERT_EQ(10, c.effectiveBufferDuration());
+
+    c.packetBufferDuration = 30;
+    ASSERT_EQ(30, c.effectiveBufferDuration());
+
+    delete chanMgr;
+    chanMgr = tmp;
+}
+
+// 配信中の情報の変更は溜めておき、flushMetadata でまとめて送る。
+TEST_F(ChannelFixture, metadataChangesAreCoalesced)
+{
+    auto tmp = chanMgr;
+    chanMgr = new ChanMgr();
+
+    auto ch = std::make_shared<Channel>();
+    ch->info.id.fromStr("01234567890123456789012345678901");
+    ch->info.name = "test";
+    ch->status = Channel::S_BROADCASTING;
+
+    ChanInfo info = ch->info;
+    info.track.title = "song 1";
+    ASSERT_TRUE(ch->updateInfo(info));
+    info.track.title = "song 2";
+    ASSERT_TRUE(ch->updateInfo(info));
+
+    ASSERT_TRUE(ch->metaPending);
+    ASSERT_STREQ("", ch->metaSentInfo.track.title.cstr());
+    ASSERT_STREQ("song 2", ch->info.track.title.cstr());
+
+    // 変わったばかりなので、まだ送らない。
+    ch->flushMetadata();
+    ASSERT_TRUE(ch->metaPending);
+
+    ch->flushMetadata(true);
+    ASSERT_FALSE(ch->metaPending);
+
+    // 次の変更は送った後の情報からの差分になる。
+    info.track.title = "song 3";
+    ASSERT_TRUE(ch->updateInfo(info));
+    ASSERT_STREQ("song 2", ch->metaSentInfo.track.title.cstr());
+
+    delete chanMgr;
+    chanMgr = tmp;
+}
+
+TEST_F(ChannelFixture, checkReadDelayAccumulatesDeadline)
+{
+    auto mock = dynamic_cast<MockSys*>(sys);
+    double dtime = mock->dtime;
+    mock->dtime = 1000.0;
+    mock->lastSleepUntil = 0;
+
+    Channel c;
+    c.info.bitrate = 8;     // 1024 バイト/秒
+
+    c.checkReadDelay(1024);
+    ASSERT_EQ(0, mock->lastSleepUntil); // readDelay でなければ待たない
+
+    c.readDelay = true;
+    c.checkReadDelay(1024);
+    ASSERT_DOUBLE_EQ(1001.0, mock->lastSleepUntil);
+
+    // 処理に時間がかかっても、期限は読んだ量だけで決まる。
+    mock->dtime = 1000.5;
+    c.checkReadDelay(512);
+    ASSERT_DOUBLE_EQ(1001.5, mock->lastSleepUntil);
+
+    // 大きく遅れたら今から数え直す。
+    mock->dtime = 1010.0;
+    c.checkReadDelay(1024);
+    ASSERT_DOUBLE_EQ(1011.0, mock->lastSleepUntil);
+
+    mock->dtime = dtime;
+}
+
+TEST_F(ChannelFixture, sleepUntil)
+{
+    auto mock = dynamic_cast<MockSys*>(sys);
+    double dtime = mock->dtime;
+    mock->dtime = 1000.0;
+    mock->lastSleepUntil = 0;
+
+    Channel c;
+    c.sleepUntil(1.0);
+    ASSERT_EQ(0, mock->lastSleepUntil); // readDelay でなければ待たない
+
+    c.readDelay = true;
+    c.sleepUntil(0.0);
+    ASSERT_DOUBLE_EQ(1000.0, mock->lastSleepUntil);
+    c.sleepUntil(2.5);
+    ASSERT_DOUBLE_EQ(1002.5, mock->lastSleepUntil);
+
+    // 60秒より先までは待たない。
+    c.sleepUntil(100.0);
+    ASSERT_DOUBLE_EQ(1060.0, mock->lastSleepUntil);
+
+    // 時刻が戻ったら基準を取り直す。
+    mock->dtime = 1100.0;
+    c.sleepUntil(1.0);
+    ASSERT_DOUBLE_EQ(1100.0, mock->lastSleepUntil);
+    c.sleepUntil(3.0);
+    ASSERT_DOUBLE_EQ(1102.0, mock->lastSleepUntil);
+
+    mock->dtime = dtime;
+}
+
+TEST_F(ChannelFixture, getIcyMetaBlock)
+{
+    Channel c;
+    auto block = c.getIcyMetaBlock("title", "http://example.com/");
+
+    std::string body = "StreamTitle='title';StreamUrl='http://example.com/';";
+    ASSERT_EQ((body.size() + 16) / 16, (size_t)(*block)[0]);
+    ASSERT_EQ(1 + (*block)[0] * 16, block->size());
+    ASSERT_EQ(body, block->substr(1, body.size()));
+    ASSERT_EQ(std::string(block->size() - 1 - body.size(), '\0'), block->substr(1 + body.size()));
+
+    // 同じ内容なら同じブロックを返す。
+    ASSERT_EQ(block, c.getIcyMetaBlock("title", "http://example.com/"));
+    ASSERT_NE(block, c.getIcyMetaBlock("other", "http://example.com/"));
+    ASSERT_EQ(block, c.getIcyMetaBlock("title", "http://example.com/"));
+}
+
+#ifdef _UNIX
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "atom.h"
+#include "pcp.h"
+#include "servmgr.h"
+#include "usocket.h"
+#include "realsysfixture.h"
+
+// PCP のソースの受信をリアクターに任せる。
+class ChannelReactorFixture : public RealSysFixture {
+public:
+    // リアクターから戻った続きのスレッドで呼ばれる。
+    class ResumeSource : public ChannelSource
+    {
+    public:
+        ResumeSource() : resumed(false), error(-1) {}
+
+        void stream(std::shared_ptr<Channel> ch) override
+        {
+            error = ch->reactorSource ? ch->reactorSource->error : -1;
+            ch->reactorSource = nullptr;
+            ch->thread.shutdown();
+            resumed = true;
+        }
+
+        std::atomic<bool> resumed;
+        std::atomic<int> error;
+    };
+
+    void SetUp() override
+    {
+        RealSysFixture::SetUp();
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        servMgr->flags[ServMgr::F_reactorMode] = true;
+        m_chanMgr = chanMgr;
+        chanMgr = new ChanMgr();
+    }
+
+    void TearDown() override
+    {
+        servMgr->reactor = nullptr;
+        servMgr->flags[ServMgr::F_reactorMode] = false;
+        // fds[0] はチャンネルのソケットが閉じる。
+        close(fds[1]);
+        delete chanMgr;
+        chanMgr = m_chanMgr;
+        RealSysFixture::TearDown();
+    }
+
+    int fds[2];
+    ChanMgr* m_chanMgr;
+};
+
+TEST_F(ChannelReactorFixture, readsUntilQuit)
+{
+    auto source = std::make_shared<ResumeSource>();
+    auto ch = std::make_shared<Channel>();
+    ch->info.id.fromStr("01234567890123456789012345678901");
+    ch->stayConnected = true;
+    ch->sourceData = source;
+    auto sock = std::make_shared<UClientSocket>();
+    sock->sockNum = fds[0];
+    ch->sock = sock;
+
+    // PCP でなければスレッドで読む。
+    ch->sourceStream = std::make_shared<RawStream>();
+    ASSERT_FALSE(ch->prepareReactorSource());
+
+    ch->sourceStream = std::make_shared<PCPStream>(GnuID());
+    ASSERT_TRUE(ch->prepareReactorSource());
+    ch->thread.m_active = true;
+    ASSERT_TRUE(ch->startReactorSource());
+
+    StringStream mem;
+    AtomStream atom(mem);
+    atom.writeInt(PCP_QUIT, PCP_ERROR_QUIT + PCP_ERROR_OFFAIR);
+    auto quit = mem.str();
+
+    // アトムの途中までではスレッドを待たせずに貯めておく。
+    ASSERT_EQ(6, write(fds[1], quit.data(), 6));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_FALSE(source->resumed);
+
+    ASSERT_EQ((ssize_t) quit.size() - 6, write(fds[1], quit.data() + 6, quit.size() - 6));
+    ASSERT_TRUE(waitUntil([&]() { return source->resumed.load(); }));
+    ASSERT_EQ(PCP_ERROR_QUIT + PCP_ERROR_OFFAIR, source->error);
+
+    // 続きのスレッドがチャンネルを閉じて、参照を手放す。
+    ASSERT_TRUE(waitUntil([&]() { return ch.use_count() == 1; }));
+    ASSERT_TRUE(ch->closed);
+    ASSERT_EQ(nullptr, ch->sock);
+}
+#endif
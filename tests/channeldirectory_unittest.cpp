@@ -128,3 +128,113 @@ TEST_F(ChannelDirectoryFixture, channels)
 {
     ASSERT_TRUE(dir.channels().empty());
 }
+
+static ChannelEntry makeEntry(const std::string& name, int numDirects, const std::string& feedUrl)
+{
+    return ChannelEntry({ name, "01234567890123456789012345678901", "", "", "", "", std::to_string(numDirects), "0", "0", "", "", "", "", "", "", "", "", "", "0" }, feedUrl);
+}
+
+TEST_F(ChannelDirectoryFixture, merge)
+{
+    const std::string a = "http://a.example.com/index.txt";
+    const std::string b = "http://b.example.com/index.txt";
+    ASSERT_TRUE(dir.addFeed(a));
+    ASSERT_TRUE(dir.addFeed(b));
+    dir.m_channels = { makeEntry("A1", 1, a), makeEntry("B1", 5, b) };
+
+    std::map<std::string, ChannelDirectory::FetchResult> results;
+    // a は変わっていない。
+    results[a].status = ChannelFeed::Status::kOk;
+    results[a].notModified = true;
+    results[a].lastModified = "Sun, 06 Nov 1994 08:49:37 GMT";
+    // b は新しいリストに置き換わる。
+    results[b].status = ChannelFeed::Status::kOk;
+    results[b].channels = { makeEntry("B2", 0, b), makeEntry("B3", 10, b) };
+    results[b].etag = "\"b\"";
+    dir.merge(results);
+
+    auto channels = dir.channels();
+    ASSERT_EQ(3, channels.size());
+    // 視聴者数の多い順。
+    ASSERT_EQ("B3", channels[0].name);
+    ASSERT_EQ("A1", channels[1].name);
+    ASSERT_EQ("B2", channels[2].name);
+
+    auto feeds = dir.feeds();
+    ASSERT_EQ("Sun, 06 Nov 1994 08:49:37 GMT", feeds[0].lastModified);
+    ASSERT_EQ("\"b\"", feeds[1].etag);
+    ASSERT_EQ(ChannelFeed::Status::kOk, feeds[1].status);
+
+    // 結果の無いフィードは前のチャンネルを残す。失敗したフィードは空になる。
+    results.erase(a);
+    results[b] = ChannelDirectory::FetchResult();
+    results[b].status = ChannelFeed::Status::kError;
+    dir.merge(results);
+    channels = dir.channels();
+    ASSERT_EQ(1, channels.size());
+    ASSERT_EQ("A1", channels[0].name);
+    ASSERT_EQ("", dir.feeds()[1].etag);
+}
+
+TEST_F(ChannelDirectoryFixture, query)
+{
+    const std::string a = "http://a.example.com/index.txt";
+    const std::string b = "http://b.example.com/index.txt";
+    auto entry = [](const std::string& name, const std::string& genre, int numDirects, const std::string& feedUrl)
+                 {
+                     auto e = makeEntry(name, numDirects, feedUrl);
+                     e.genre = genre;
+                     return e;
+                 };
+    dir.m_channels = {
+        entry("Alpha", "Game", 3, a),
+        entry("Bravo", "game music", 10, b),
+        entry("Charlie", "Talk", 3, a),
+        entry("Delta", "Music", 0, b),
+    };
+
+    ChannelDirectory::Query q;
+    auto page = dir.query(q);
+    ASSERT_EQ(4, page.total);
+    // 視聴者数の多い順、同じなら名前の順。
+    ASSERT_EQ("Bravo", page.channels[0].name);
+    ASSERT_EQ("Alpha", page.channels[1].name);
+    ASSERT_EQ("Charlie", page.channels[2].name);
+
+    // 語は全て含むもの。大文字と小文字は区別しない。
+    q.text = "GAME  music";
+    page = dir.query(q);
+    ASSERT_EQ(1, page.total);
+    ASSERT_EQ("Bravo", page.channels[0].name);
+
+    q.text = "";
+    q.yellowPage = a;
+    q.sort = "-name";
+    page = dir.query(q);
+    ASSERT_EQ(2, page.total);
+    ASSERT_EQ("Charlie", page.channels[0].name);
+
+    // ページに分けても total は絞り込んだ数。
+    q.yellowPage = "";
+    q.sort = "name";
+    q.offset = 1;
+    q.limit = 2;
+    page = dir.query(q);
+    ASSERT_EQ(4, page.total);
+    ASSERT_EQ(2, page.channels.size());
+    ASSERT_EQ("Bravo", page.channels[0].name);
+    ASSERT_EQ("Charlie", page.channels[1].name);
+
+    q.sort = "popularity";
+    ASSERT_THROW(dir.query(q), std::invalid_argument);
+
+    // リストが入れ替われば索引も作り直す。
+    std::map<std::string, ChannelDirectory::FetchResult> results;
+    results[a].status = ChannelFeed::Status::kOk;
+    results[a].channels = { entry("Echo", "", 1, a) };
+    dir.addFeed(a);
+    dir.merge(results);
+    q = ChannelDirectory::Query();
+    q.text = "echo";
+    ASSERT_EQ(1, dir.query(q).total);
+}
@@ -3,6 +3,9 @@
 #include "chanpacket.h"
 #include "sys.h"
 #include "mocksys.h"
+#include "atom.h"
+#include "pcp.h"
+#include "sstream.h"
 
 class ChanPacketBufferFixture : public ::testing::Test {
 public:
@@ -35,6 +38,24 @@ TEST_F(ChanPacketBufferFixture, init)
     ASSERT_EQ(0, data.numPending());
 }
 
+TEST_F(ChanPacketBufferFixture, memoryUsage)
+{
+    uint64_t empty = data.memoryUsage();
+
+    ChanPacket packet;
+    packet.type = ChanPacket::T_DATA;
+    packet.len = 8192;
+    packet.pos = 0;
+    data.writePacket(packet);
+    ASSERT_EQ(empty + sizeof(ChanPacketSlab) + 8192, data.memoryUsage());
+
+    // スロットを増やすと、その分だけ増える。
+    data.setCapacity(ChanPacketBuffer::MAX_PACKETS * 2);
+    ASSERT_EQ(empty + sizeof(ChanPacketSlab) + 8192 +
+              ChanPacketBuffer::MAX_PACKETS * sizeof(std::shared_ptr<const ChanPacketSlab>),
+              data.memoryUsage());
+}
+
 TEST_F(ChanPacketBufferFixture, addPacket)
 {
 
@@ -356,3 +377,361 @@ TEST_F(ChanPacketBufferFixture, updateReadPos_false)
     ASSERT_EQ(data.numPending(), 1);
 }
 
+
+TEST_F(ChanPacketBufferFixture, findPacket_sharesPayload)
+{
+    ChanPacket packet;
+
+    packet.type = ChanPacket::T_DATA;
+    packet.len = 4;
+    packet.pos = 0;
+    memcpy(packet.data, "HELLO", 4);
+
+    ASSERT_TRUE( data.writePacket(packet) );
+
+    std::shared_ptr<const ChanPacketSlab> p1, p2;
+    ASSERT_TRUE( data.findPacket(0, p1) );
+    ASSERT_TRUE( data.findPacket(0, p2) );
+
+    ASSERT_EQ(p1.get(), p2.get());
+    ASSERT_EQ(0, p1->sync);
+    ASSERT_EQ(4, p1->len);
+    ASSERT_EQ(0, memcmp(p1->data, "HELLO", 4));
+
+    // バッファーが初期化されても読み出し側のハンドルは有効なまま。
+    data.init();
+    ASSERT_EQ(0, memcmp(p1->data, "HELLO", 4));
+    ASSERT_FALSE( data.findPacket(0, p2) );
+}
+
+// 線形探索と同じ結果になることを確かめる。
+static bool findPacketLinear(ChanPacketBuffer& buf, unsigned int spos, unsigned int& result)
+{
+    bool found = false;
+    for (unsigned int i = buf.firstPos; i <= buf.lastPos; i++)
+    {
+        unsigned int pos = buf.packetAt(i)->pos;
+        if (pos >= spos && (!found || pos < result))
+        {
+            result = pos;
+            found = true;
+        }
+    }
+    return found;
+}
+
+TEST_F(ChanPacketBufferFixture, findPacket_matchesLinearScanAcrossOverflow)
+{
+    ChanPacket pack;
+    std::shared_ptr<const ChanPacketSlab> out;
+
+    pack.type = ChanPacket::T_DATA;
+    pack.len = 1000;
+    pack.pos = 4294967295U - 40 * 1000;
+
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_TRUE( data.writePacket(pack, true) );
+        pack.pos += pack.len;
+
+        for (unsigned int spos : { 0U, 1U, 500U, 4294967295U - 30500U, 4294967295U, data.getLatestPos(), data.getOldestPos() })
+        {
+            unsigned int expected = 0;
+            bool found = findPacketLinear(data, spos, expected);
+            ASSERT_EQ(found, data.findPacket(spos, out));
+            if (found)
+                ASSERT_EQ(expected, out->pos);
+        }
+    }
+}
+
+TEST_F(ChanPacketBufferFixture, findPacket_unorderedPositions)
+{
+    ChanPacket pack;
+    std::shared_ptr<const ChanPacketSlab> out;
+
+    pack.type = ChanPacket::T_DATA;
+    pack.len = 10;
+
+    for (unsigned int pos : { 50, 10, 40, 20, 30 })
+    {
+        pack.pos = pos;
+        ASSERT_TRUE( data.writePacket(pack) );
+    }
+
+    ASSERT_TRUE( data.findPacket(15, out) );
+    ASSERT_EQ(20, out->pos);
+    ASSERT_TRUE( data.findPacket(41, out) );
+    ASSERT_EQ(50, out->pos);
+    ASSERT_FALSE( data.findPacket(51, out) );
+}
+
+TEST_F(ChanPacketBufferFixture, setCapacity_keepsPackets)
+{
+    ChanPacket pack;
+    std::shared_ptr<const ChanPacketSlab> out;
+
+    pack.type = ChanPacket::T_DATA;
+    pack.len = 100;
+    pack.pos = 0;
+
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_TRUE( data.writePacket(pack, true) );
+        pack.pos += pack.len;
+    }
+    ASSERT_EQ(36, data.firstPos);
+    ASSERT_EQ(3600, data.getOldestPos());
+
+    data.setCapacity(256);
+    ASSERT_EQ(256, data.capacity);
+    ASSERT_EQ(36, data.firstPos);
+    ASSERT_EQ(3600, data.getOldestPos());
+    ASSERT_EQ(9900, data.getLatestPos());
+    ASSERT_EQ(6400, data.totalBytes);
+
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_TRUE( data.writePacket(pack, true) );
+        pack.pos += pack.len;
+    }
+    // 古いパケットが捨てられていない。
+    ASSERT_EQ(36, data.firstPos);
+    ASSERT_TRUE( data.findPacket(3600, out) );
+    ASSERT_EQ(3600, out->pos);
+    ASSERT_EQ(16400, data.totalBytes);
+
+    data.setCapacity(10);
+    ASSERT_EQ(190, data.firstPos);
+    ASSERT_EQ(19000, data.getOldestPos());
+    ASSERT_EQ(19900, data.getLatestPos());
+    ASSERT_EQ(1000, data.totalBytes);
+}
+
+TEST_F(ChanPacketBufferFixture, adjustCapacity)
+{
+    ChanPacket pack;
+
+    pack.type = ChanPacket::T_DATA;
+    pack.len = 1000;
+    pack.pos = 0;
+
+    ASSERT_TRUE( data.writePacket(pack, true) );
+
+    // 1000 バイトのパケットが 500 個入るように。
+    data.adjustCapacity(500 * 1000);
+    ASSERT_EQ(625, data.capacity);
+
+    // 少し減っただけでは縮めない。
+    data.adjustCapacity(400 * 1000);
+    ASSERT_EQ(625, data.capacity);
+
+    data.adjustCapacity(100 * 1000);
+    ASSERT_EQ(100, data.capacity);
+
+    data.adjustCapacity(0);
+    ASSERT_EQ(ChanPacketBuffer::MAX_PACKETS, data.capacity);
+}
+
+TEST_F(ChanPacketBufferFixture, arena_packsSmallPackets)
+{
+    ChanPacket pack;
+    std::shared_ptr<const ChanPacketSlab> p1, p2;
+
+    pack.type = ChanPacket::T_DATA;
+    pack.len = 10;
+    pack.pos = 0;
+    memcpy(pack.data, "0123456789", 10);
+    ASSERT_TRUE( data.writePacket(pack) );
+
+    pack.pos = 10;
+    memcpy(pack.data, "abcdefghij", 10);
+    ASSERT_TRUE( data.writePacket(pack) );
+
+    ASSERT_TRUE( data.findPacket(0, p1) );
+    ASSERT_TRUE( data.findPacket(10, p2) );
+
+    // 同じチャンクの中に隣り合って置かれる。
+    ASSERT_LT(p1->data, p2->data);
+    ASSERT_LE(p2->data - p1->data, (ptrdiff_t) sizeof(ChanPacketSlab) + 16);
+    ASSERT_EQ(0, memcmp(p1->data, "0123456789", 10));
+    ASSERT_EQ(0, memcmp(p2->data, "abcdefghij", 10));
+    ASSERT_EQ(1, p2->sync);
+}
+
+TEST_F(ChanPacketBufferFixture, arena_largePackets)
+{
+    ChanPacket pack, out;
+
+    pack.type = ChanPacket::T_DATA;
+    pack.len = ChanPacket::MAX_DATALEN;
+    for (int i = 0; i < 20; i++)
+    {
+        memset(pack.data, 'a' + i, pack.len);
+        pack.pos = i * pack.len;
+        ASSERT_TRUE( data.writePacket(pack, true) );
+    }
+
+    for (int i = 0; i < 20; i++)
+    {
+        ASSERT_TRUE( data.findPacket(i * pack.len, out) );
+        ASSERT_EQ(ChanPacket::MAX_DATALEN, out.len);
+        ASSERT_EQ('a' + i, out.data[0]);
+        ASSERT_EQ('a' + i, out.data[out.len - 1]);
+    }
+}
+
+TEST_F(ChanPacketBufferFixture, lockFreeReadersSeeConsistentPackets)
+{
+    const int NUM_PACKETS = 20000;
+    std::atomic<bool> done(false);
+    std::atomic<int> errors(0);
+
+    std::function<void(void)> readerProc = [&] {
+        unsigned int spos = 0;
+        std::shared_ptr<const ChanPacketSlab> p;
+        while (!done)
+        {
+            if (data.findPacket(spos, p))
+            {
+                // データの先頭にポジションを書いてある。
+                unsigned int written;
+                memcpy(&written, p->data, sizeof(written));
+                if (p->pos < spos || written != p->pos || p->len != 100)
+                    errors++;
+                spos = p->pos + p->len;
+            }
+            data.getLatestPos();
+            data.getOldestPos();
+        }
+    };
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; i++)
+        readers.push_back(std::thread(readerProc));
+
+    ChanPacket pack;
+    pack.type = ChanPacket::T_DATA;
+    pack.len = 100;
+    pack.pos = 0;
+    for (int i = 0; i < NUM_PACKETS; i++)
+    {
+        memcpy(pack.data, &pack.pos, sizeof(pack.pos));
+        ASSERT_TRUE( data.writePacket(pack, true) );
+        pack.pos += pack.len;
+        if (i == NUM_PACKETS / 2)
+            data.setCapacity(256);
+    }
+    done = true;
+
+    for (auto& t : readers)
+        t.join();
+
+    ASSERT_EQ(0, errors);
+}
+
+TEST_F(ChanPacketBufferFixture, waitForWrite)
+{
+    unsigned int serial = data.getWriteSerial();
+
+    // 書き込みが無ければタイムアウトする。
+    ASSERT_FALSE( data.waitForWrite(serial, 10) );
+
+    ChanPacket packet;
+    packet.type = ChanPacket::T_DATA;
+    packet.len = 4;
+    packet.pos = 0;
+    memcpy(packet.data, "HELLO", 4);
+
+    std::thread writer([&] {
+        data.writePacket(packet, true);
+    });
+
+    // 長いタイムアウトでも書き込みがあればすぐに戻る。
+    ASSERT_TRUE( data.waitForWrite(serial, 60 * 1000) );
+    writer.join();
+
+    ASSERT_NE(serial, data.getWriteSerial());
+    // 既に書き込まれていれば待たない。
+    ASSERT_TRUE( data.waitForWrite(serial, 60 * 1000) );
+}
+
+TEST_F(ChanPacketBufferFixture, pcpFrame)
+{
+    GnuID chanID;
+    chanID.fromStr("0123456789abcdef0123456789abcdef");
+
+    ChanPacket pack;
+    pack.type = ChanPacket::T_DATA;
+    pack.len = 5;
+    memcpy(pack.data, "hello", 5);
+
+    for (bool cont : { false, true })
+    {
+        pack.pos = cont ? 5 : 0;
+        pack.cont = cont;
+        ASSERT_TRUE( data.writePacket(pack) );
+
+        std::shared_ptr<const ChanPacketSlab> slab;
+        ASSERT_TRUE( data.findPacket(pack.pos, slab) );
+
+        const char *frame;
+        int len;
+        ASSERT_TRUE( slab->pcpFrame(chanID, frame, len) );
+
+        // AtomStream で組み立てたものと同じになる。
+        StringStream mem;
+        AtomStream atom(mem);
+        atom.writeParent(PCP_CHAN, 2);
+            atom.writeBytes(PCP_CHAN_ID, chanID.id, 16);
+            atom.writeParent(PCP_CHAN_PKT, cont ? 4 : 3);
+                atom.writeID4(PCP_CHAN_PKT_TYPE, PCP_CHAN_PKT_DATA);
+                atom.writeInt(PCP_CHAN_PKT_POS, pack.pos);
+                if (cont)
+                    atom.writeChar(PCP_CHAN_PKT_CONTINUATION, true);
+                atom.writeBytes(PCP_CHAN_PKT_DATA, "hello", 5);
+        ASSERT_EQ(mem.str(), std::string(frame, len));
+
+        // 二度目は同じものを返す。
+        const char *frame2;
+        int len2;
+        ASSERT_TRUE( slab->pcpFrame(chanID, frame2, len2) );
+        ASSERT_EQ(frame, frame2);
+        ASSERT_EQ(len, len2);
+
+        // 違うチャンネル ID では使えない。
+        GnuID other;
+        other.fromStr("ffffffffffffffffffffffffffffffff");
+        ASSERT_FALSE( slab->pcpFrame(other, frame2, len2) );
+    }
+}
+
+TEST_F(ChanPacketBufferFixture, getNonContinuationPos)
+{
+    ASSERT_EQ(0, data.getNonContinuationPos(0));
+
+    ChanPacket pack;
+    pack.type = ChanPacket::T_DATA;
+    pack.len = 10;
+
+    // 3 個ごとにキーフレーム。スロット数を超えて書き込む。
+    for (int i = 0; i < 100; i++)
+    {
+        pack.pos = i * 10;
+        pack.cont = (i % 3) != 0;
+        ASSERT_TRUE( data.writePacket(pack, true) );
+    }
+
+    // バッファーには 36..99 が残っていて、キーフレームは 36, 39, ..., 99。
+    ASSERT_EQ(990, data.getNonContinuationPos(0));
+    ASSERT_EQ(960, data.getNonContinuationPos(1));
+    ASSERT_EQ(930, data.getNonContinuationPos(2));
+    ASSERT_EQ(360, data.getNonContinuationPos(21));
+    ASSERT_EQ(360, data.getNonContinuationPos(1000));
+
+    ASSERT_EQ(990, data.getLatestNonContinuationPos());
+    ASSERT_EQ(360, data.getOldestNonContinuationPos());
+
+    data.init();
+    ASSERT_EQ(0, data.getLatestNonContinuationPos());
+}
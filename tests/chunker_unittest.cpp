@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+
+#include "chunker.h"
+#include "sstream.h"
+
+class ChunkerFixture : public ::testing::Test {
+};
+
+TEST_F(ChunkerFixture, chunker)
+{
+    StringStream mem;
+    Chunker chunker(mem);
+    chunker.writeString("hello");
+    chunker.write("", 0);
+    chunker.close();
+    ASSERT_EQ("5\r\nhello\r\n0\r\n\r\n", mem.str());
+}
+
+TEST_F(ChunkerFixture, bufferedChunkerCollectsWrites)
+{
+    StringStream mem;
+    BufferedChunker chunker(mem, 8, 60 * 1000);
+
+    chunker.writeString("abc");
+    ASSERT_EQ("", mem.str());
+    chunker.writeString("defgh");
+    ASSERT_EQ("8\r\nabcdefgh\r\n", mem.str());
+
+    chunker.writeString("xy");
+    chunker.close();
+    ASSERT_EQ("8\r\nabcdefgh\r\n2\r\nxy\r\n0\r\n\r\n", mem.str());
+    ASSERT_EQ(2, chunker.numChunks());
+}
+
+TEST_F(ChunkerFixture, bufferedChunkerFlushesAfterInterval)
+{
+    StringStream mem;
+    BufferedChunker chunker(mem, 8192, 0);
+
+    chunker.writeString("<head>");
+    ASSERT_EQ("6\r\n<head>\r\n", mem.str());
+
+    // 空の flush ではチャンクを作らない。
+    chunker.flush();
+    chunker.close();
+    ASSERT_EQ("6\r\n<head>\r\n0\r\n\r\n", mem.str());
+    ASSERT_EQ(1, chunker.numChunks());
+}
@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+
+#include "coldchan.h"
+#include "channel.h"
+#include "chanmgr.h"
+#include "mocksys.h"
+
+class ColdChannelsFixture : public ::testing::Test {
+};
+
+static ChanHit hit(const char* ip, bool firewalled, unsigned int lastContact)
+{
+    ChanHit h;
+    h.init();
+    h.host = Host(IP::parse(ip), 7144);
+    h.rhost[0] = h.host;
+    h.firewalled = firewalled;
+    h.relay = true;
+    h.lastContact = lastContact;
+    return h;
+}
+
+TEST_F(ColdChannelsFixture, bestHits)
+{
+    std::vector<ChanHit> hits = {
+        hit("192.0.2.1", true, 300),
+        hit("192.0.2.2", false, 100),
+        hit("192.0.2.3", false, 200),
+        hit("192.0.2.4", false, 400),
+    };
+    hits[3].dead = true;
+
+    auto best = ColdChannels::bestHits(hits, 2);
+    ASSERT_EQ(2, best.size());
+    ASSERT_EQ("192.0.2.3:7144", best[0].host.str());
+    ASSERT_EQ("192.0.2.2:7144", best[1].host.str());
+}
+
+TEST_F(ColdChannelsFixture, keepsNewestEntries)
+{
+    ColdChannels cold;
+    for (int i = 0; i < ColdChannels::MAX_ENTRIES + 2; i++)
+    {
+        ColdChannels::Entry e;
+        e.info.id.fromStr(str::format("%032x", i + 1).c_str());
+        e.storedAt = 1000 + i;
+        cold.store(e);
+    }
+    ASSERT_EQ(ColdChannels::MAX_ENTRIES, cold.size());
+
+    GnuID oldest;
+    oldest.fromStr(str::format("%032x", 1).c_str());
+    ColdChannels::Entry e;
+    ASSERT_FALSE(cold.take(oldest, e));
+
+    GnuID newest;
+    newest.fromStr(str::format("%032x", ColdChannels::MAX_ENTRIES + 2).c_str());
+    ASSERT_TRUE(cold.take(newest, e));
+    ASSERT_FALSE(cold.take(newest, e));
+    ASSERT_EQ(ColdChannels::MAX_ENTRIES - 1, cold.size());
+
+    // 1002 から 1004 に覚えたものが古くなる。
+    cold.expire(1004 + ColdChannels::TTL);
+    ASSERT_EQ(ColdChannels::MAX_ENTRIES - 4, cold.size());
+
+    while (cold.evictOldest())
+        ;
+    ASSERT_EQ(0, cold.size());
+}
+
+TEST_F(ColdChannelsFixture, storeAndRestore)
+{
+    auto tmp = chanMgr;
+    chanMgr = new ChanMgr();
+
+    ColdChannels cold;
+    GnuID id;
+    id.fromStr("01234567890123456789012345678901");
+
+    {
+        Channel ch;
+        ch.type = Channel::T_RELAY;
+        ch.info.id = id;
+        ch.info.name = "test";
+        ch.info.bitrate = 500;
+        ch.headPack.init(ChanPacket::T_HEAD, "FLV\1", 4, 0);
+        ch.streamPos = 12345;
+        ch.sourceHost = hit("192.0.2.9", false, 0);
+
+        ChanInfo info;
+        info.id = id;
+        auto h = hit("192.0.2.1", false, 100);
+        h.chanID = id;
+        chanMgr->addHitList(info);
+        chanMgr->addHit(h);
+
+        cold.store(ch);
+    }
+    ASSERT_EQ(1, cold.size());
+    chanMgr->clearHitLists();
+
+    // 名前の分からない要求から作り直す。
+    Channel ch;
+    ch.info.id = id;
+    ASSERT_TRUE(cold.restore(ch));
+    ASSERT_STREQ("test", ch.info.name.cstr());
+    ASSERT_EQ(500, ch.info.bitrate);
+    ASSERT_EQ(ChanPacket::T_HEAD, ch.headPack.type);
+    ASSERT_EQ(4, ch.headPack.len);
+    ASSERT_EQ(0, memcmp("FLV\1", ch.headPack.data, 4));
+    ASSERT_EQ(12345, ch.streamPos);
+
+    auto chl = chanMgr->findHitListByID(id);
+    ASSERT_TRUE(chl);
+    ASSERT_EQ(2, chl->numHits());
+    ASSERT_EQ(0, cold.size());
+    ASSERT_FALSE(cold.restore(ch));
+
+    delete chanMgr;
+    chanMgr = tmp;
+}
+
+TEST_F(ColdChannelsFixture, ignoresNonRelay)
+{
+    ColdChannels cold;
+    Channel ch;
+    ch.type = Channel::T_BROADCAST;
+    ch.info.id.fromStr("01234567890123456789012345678901");
+    ch.headPack.init(ChanPacket::T_HEAD, "FLV\1", 4, 0);
+    cold.store(ch);
+    ASSERT_EQ(0, cold.size());
+}
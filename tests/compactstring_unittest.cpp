@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include "compactstring.h"
+#include "chaninfo.h"
+
+class CompactStringFixture : public ::testing::Test {
+};
+
+TEST_F(CompactStringFixture, initialState)
+{
+    CompactString s;
+    ASSERT_TRUE(s.isEmpty());
+    ASSERT_EQ(0, s.size());
+    ASSERT_EQ(String::T_UNKNOWN, s.type);
+    ASSERT_STREQ("", s.cstr());
+}
+
+TEST_F(CompactStringFixture, truncatesLikeString)
+{
+    std::string longer(1000, 'a');
+    CompactString s = longer.c_str();
+    String t = longer.c_str();
+
+    ASSERT_EQ(CompactString::MAX_LEN - 1, s.size());
+    ASSERT_STREQ(t.cstr(), s.cstr());
+
+    // 入りきらなければ足さない。
+    s.append("b");
+    ASSERT_EQ(CompactString::MAX_LEN - 1, s.size());
+
+    s = "x";
+    s.prepend(longer.c_str());
+    ASSERT_EQ(CompactString::MAX_LEN - 1, s.size());
+}
+
+TEST_F(CompactStringFixture, keepsTypeFromString)
+{
+    String t("a%20b", String::T_ESC);
+    CompactString s = t;
+    ASSERT_EQ(String::T_ESC, s.type);
+
+    s.convertTo(String::T_ASCII);
+    ASSERT_STREQ("a b", s.cstr());
+    ASSERT_EQ(String::T_ASCII, s.type);
+
+    String back = s.toString();
+    ASSERT_STREQ("a b", back.cstr());
+    ASSERT_EQ(String::T_ASCII, back.type);
+}
+
+TEST_F(CompactStringFixture, compare)
+{
+    CompactString s = "Hello";
+    ASSERT_TRUE(s.isSame("Hello"));
+    ASSERT_TRUE(s == "Hello");
+    ASSERT_TRUE(s != "hello");
+    ASSERT_TRUE(s.isSame(String("Hello")));
+    ASSERT_TRUE(s.contains("ELL"));
+    ASSERT_TRUE(s.startsWith("He"));
+    ASSERT_EQ("Hello", std::string(s));
+}
+
+TEST_F(CompactStringFixture, moveAndCopy)
+{
+    CompactString a = std::string(100, 'z').c_str();
+    CompactString b = a;
+    CompactString c = std::move(a);
+    ASSERT_TRUE(b.isSame(c));
+    ASSERT_EQ(100, c.size());
+}
+
+TEST_F(CompactStringFixture, setFromString)
+{
+    CompactString s;
+    s.setFromString("\"quoted text\" rest");
+    ASSERT_STREQ("quoted text", s.cstr());
+
+    s.setUnquote("[abc]");
+    ASSERT_STREQ("abc", s.cstr());
+
+    s.sprintf("%d-%s", 1, "x");
+    ASSERT_STREQ("1-x", s.cstr());
+}
+
+TEST_F(CompactStringFixture, chanInfoIsSmall)
+{
+    ASSERT_LT(sizeof(ChanInfo), 12 * sizeof(String));
+}
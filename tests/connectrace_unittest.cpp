@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "connectrace.h"
+#include "mockclientsocket.h"
+
+// 接続先のポートをミリ秒として、その時間だけ待ってから繋がる。ポート
+// が奇数なら失敗する。
+class SlowConnectSocket : public MockClientSocket
+{
+public:
+    SlowConnectSocket(std::atomic<int>& closed) : m_closed(closed) {}
+
+    void open(const Host& h) override
+    {
+        host = h;
+    }
+
+    void connect() override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(host.port));
+        if (host.port % 2)
+            throw SockException("Connection refused");
+    }
+
+    void close() override
+    {
+        m_closed++;
+    }
+
+    std::atomic<int>& m_closed;
+};
+
+class ConnectRaceFixture : public ::testing::Test {
+public:
+    ConnectRaceFixture()
+        : closed(0)
+    {
+        race.stagger = 20;
+        race.createSocket = [this](const Host&) { return std::make_shared<SlowConnectSocket>(closed); };
+    }
+
+    static Host host(int port)
+    {
+        return Host(IP::parse("192.0.2.1"), port);
+    }
+
+    std::atomic<int> closed;
+    ConnectRace race;
+};
+
+TEST_F(ConnectRaceFixture, single)
+{
+    int winner = -1;
+    auto sock = race.connect({ host(0) }, winner);
+    ASSERT_TRUE(sock);
+    ASSERT_EQ(0, winner);
+    ASSERT_EQ(0, sock->host.port);
+}
+
+TEST_F(ConnectRaceFixture, singleFailure)
+{
+    int winner = -1;
+    ASSERT_THROW(race.connect({ host(1) }, winner), StreamException);
+    ASSERT_EQ(1, closed);
+}
+
+// 最初の候補が遅ければ、後から始めた候補が勝つ。
+TEST_F(ConnectRaceFixture, fasterAlternateWins)
+{
+    int winner = -1;
+    auto sock = race.connect({ host(400), host(0) }, winner);
+    ASSERT_EQ(1, winner);
+    ASSERT_EQ(0, sock->host.port);
+
+    // 負けた方は繋がり次第閉じられる。
+    for (int i = 0; i < 100 && closed == 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_EQ(1, closed);
+}
+
+// 失敗すれば待たずに次を始める。
+TEST_F(ConnectRaceFixture, failureStartsNextAttempt)
+{
+    race.stagger = 10000;
+    auto start = std::chrono::steady_clock::now();
+    int winner = -1;
+    auto sock = race.connect({ host(1), host(3), host(0) }, winner);
+    ASSERT_EQ(2, winner);
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+}
+
+TEST_F(ConnectRaceFixture, allFail)
+{
+    int winner = -1;
+    ASSERT_THROW(race.connect({ host(1), host(3) }, winner), StreamException);
+}
+
+TEST_F(ConnectRaceFixture, prepare)
+{
+    std::vector<int> prepared;
+    std::mutex lock;
+    race.prepare = [&](ClientSocket& s, int i)
+    {
+        std::lock_guard<std::mutex> cs(lock);
+        prepared.push_back(i);
+        s.setWriteTimeout(1234);
+    };
+    int winner = -1;
+    auto sock = race.connect({ host(0) }, winner);
+    ASSERT_EQ(std::vector<int>({ 0 }), prepared);
+    ASSERT_EQ(1234, sock->writeTimeout);
+}
@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <thread>
+
 #include "cookie.h"
+#include "mocksys.h"
 
 class CookieListFixture : public ::testing::Test {
 public:
@@ -71,24 +75,103 @@ TEST_F(CookieListFixture, containsDifferentIDs)
 
 TEST_F(CookieListFixture, maxCookies)
 {
-    for (int i = 1; i <= CookieList::MAX_COOKIES; ++i) {
+    for (int i = 1; i <= CookieList::DEFAULT_MAX_COOKIES; ++i) {
         Cookie c;
-        c.set("12345678901234567890123456789012", IP::parse("192.168.0." + std::to_string(i)));
+        c.set("12345678901234567890123456789012", IP::parse("10.0." + std::to_string(i / 256) + "." + std::to_string(i % 256)));
         ls.add(c);
     }
     Cookie c;
-    c.set("12345678901234567890123456789012", IP::parse("192.168.0.1"));
+    c.set("12345678901234567890123456789012", IP::parse("10.0.0.1"));
     ASSERT_TRUE(ls.contains(c));
 }
 
 TEST_F(CookieListFixture, maxPlus1Cookies)
 {
-    for (int i = 1; i <= CookieList::MAX_COOKIES + 1; ++i) {
+    for (int i = 1; i <= CookieList::DEFAULT_MAX_COOKIES + 1; ++i) {
         Cookie c;
-        c.set("12345678901234567890123456789012", IP::parse("192.168.0." + std::to_string(i)));
+        c.set("12345678901234567890123456789012", IP::parse("10.0." + std::to_string(i / 256) + "." + std::to_string(i % 256)));
         ls.add(c);
     }
+    Cookie c;
+    c.set("12345678901234567890123456789012", IP::parse("10.0.0.1"));
+    ASSERT_FALSE(ls.contains(c));
+    ASSERT_EQ(CookieList::DEFAULT_MAX_COOKIES, ls.size());
+}
+
+TEST_F(CookieListFixture, evictsLeastRecentlyUsed)
+{
+    ls.maxCookies = 2;
+
+    Cookie a, b, c;
+    a.set("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", IP::parse("192.168.0.1"));
+    b.set("bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb", IP::parse("192.168.0.1"));
+    c.set("cccccccccccccccccccccccccccccccc", IP::parse("192.168.0.2"));
+
+    ASSERT_TRUE(ls.add(a));
+    ASSERT_TRUE(ls.add(b));
+    // a を使ったので、溢れた時に捨てられるのは b。
+    ASSERT_TRUE(ls.contains(a));
+    ASSERT_TRUE(ls.add(c));
+    ASSERT_TRUE(ls.contains(a));
+    ASSERT_FALSE(ls.contains(b));
+    ASSERT_TRUE(ls.contains(c));
+}
+
+TEST_F(CookieListFixture, slidingExpiry)
+{
+    auto msys = static_cast<MockSys*>(sys);
+    auto saved = msys->time;
+    msys->time = 1000;
+    ls.timeout = 60;
+
+    Cookie c;
+    c.set("12345678901234567890123456789012", IP::parse("192.168.0.1"));
+    ASSERT_TRUE(ls.add(c));
+
+    // 使うたびに期限が延びる。
+    msys->time = 1050;
+    ASSERT_TRUE(ls.contains(c));
+    msys->time = 1100;
+    ASSERT_TRUE(ls.contains(c));
+
+    msys->time = 1161;
+    ASSERT_FALSE(ls.contains(c));
+    ASSERT_EQ(0, ls.size());
+
+    msys->time = saved;
+}
+
+TEST_F(CookieListFixture, remove)
+{
     Cookie c;
     c.set("12345678901234567890123456789012", IP::parse("192.168.0.1"));
+    ASSERT_TRUE(ls.add(c));
+    ASSERT_FALSE(ls.add(c));
+    ls.remove(c);
     ASSERT_FALSE(ls.contains(c));
+    ASSERT_EQ(0, ls.size());
+}
+
+TEST_F(CookieListFixture, concurrentAddsDoNotDuplicate)
+{
+    Cookie c;
+    c.set("12345678901234567890123456789012", IP::parse("192.168.0.1"));
+
+    std::atomic<int> added(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; i++)
+        threads.emplace_back([&]()
+                             {
+                                 for (int j = 0; j < 1000; j++)
+                                 {
+                                     Cookie d = c;
+                                     if (ls.add(d))
+                                         added++;
+                                 }
+                             });
+    for (auto& t : threads)
+        t.join();
+
+    ASSERT_EQ(1, added);
+    ASSERT_EQ(1, ls.size());
 }
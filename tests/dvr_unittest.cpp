@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "dvr.h"
+#include "chanpacket.h"
+#include "mocksys.h"
+
+class ChanPacketArchiveFixture : public ::testing::Test {
+public:
+    ChanPacketArchiveFixture()
+    {
+        char tmpl[] = "/tmp/dvrXXXXXX";
+        int fd = mkstemp(tmpl);
+        close(fd);
+        path = tmpl;
+
+        dtime_ = dynamic_cast<MockSys*>(sys)->dtime;
+    }
+
+    ~ChanPacketArchiveFixture()
+    {
+        dynamic_cast<MockSys*>(sys)->dtime = dtime_;
+        unlink(path.c_str());
+    }
+
+    void write(ChanPacketBuffer& buf, unsigned int pos, unsigned int len, bool cont, double time = 0)
+    {
+        dynamic_cast<MockSys*>(sys)->dtime = time;
+
+        std::string data(len, (char) ('a' + (pos / len) % 26));
+        ChanPacket p;
+        p.init(ChanPacket::T_DATA, data.data(), len, pos);
+        p.cont = cont;
+        buf.writePacket(p, true);
+    }
+
+    std::string path;
+    double dtime_;
+};
+
+TEST_F(ChanPacketArchiveFixture, read)
+{
+    auto a = std::make_shared<ChanPacketArchive>();
+    a->open(path, 1024);
+    ChanPacketBuffer buf;
+    buf.setArchive(a);
+
+    write(buf, 0, 100, false);
+    write(buf, 100, 100, true);
+    write(buf, 200, 100, true);
+    ASSERT_EQ(3, a->numPackets());
+
+    ChanPacket p;
+    ASSERT_TRUE(a->read(0, p));
+    ASSERT_EQ(0, p.pos);
+    ASSERT_EQ(100, p.len);
+    ASSERT_FALSE(p.cont);
+    ASSERT_EQ(std::string(100, 'a'), std::string(p.data, p.len));
+
+    ASSERT_TRUE(a->read(150, p));
+    ASSERT_EQ(200, p.pos);
+    ASSERT_TRUE(p.cont);
+    ASSERT_EQ(std::string(100, 'c'), std::string(p.data, p.len));
+
+    ASSERT_FALSE(a->read(250, p));
+}
+
+TEST_F(ChanPacketArchiveFixture, wrap)
+{
+    auto a = std::make_shared<ChanPacketArchive>();
+    a->open(path, 250);
+    ChanPacketBuffer buf;
+    buf.setArchive(a);
+
+    write(buf, 0, 100, false);
+    write(buf, 100, 100, false);
+    // 終わりに入らないので先頭に書き、最初のパケットが消える。
+    write(buf, 200, 100, false);
+
+    ASSERT_EQ(2, a->numPackets());
+    ASSERT_FALSE(a->contains(0));
+    ASSERT_TRUE(a->contains(100));
+    ASSERT_TRUE(a->contains(299));
+    ASSERT_FALSE(a->contains(300));
+
+    ChanPacket p;
+    ASSERT_TRUE(a->read(100, p));
+    ASSERT_EQ(std::string(100, 'b'), std::string(p.data, p.len));
+    ASSERT_TRUE(a->read(200, p));
+    ASSERT_EQ(std::string(100, 'c'), std::string(p.data, p.len));
+}
+
+TEST_F(ChanPacketArchiveFixture, newStreamClears)
+{
+    auto a = std::make_shared<ChanPacketArchive>();
+    a->open(path, 1024);
+    ChanPacketBuffer buf;
+    buf.setArchive(a);
+
+    write(buf, 1000, 100, false);
+    write(buf, 1100, 100, false);
+    buf.init();
+    write(buf, 0, 100, false);
+
+    ASSERT_EQ(1, a->numPackets());
+    ASSERT_FALSE(a->contains(1000));
+}
+
+TEST_F(ChanPacketArchiveFixture, findKeyPos)
+{
+    auto a = std::make_shared<ChanPacketArchive>();
+    a->open(path, 4096);
+    ChanPacketBuffer buf;
+    buf.setArchive(a);
+
+    unsigned int pos;
+    ASSERT_FALSE(a->findKeyPos(0, pos));
+
+    write(buf, 0, 100, false, 10.0);
+    write(buf, 100, 100, true, 11.0);
+    write(buf, 200, 100, false, 12.0);
+    write(buf, 300, 100, true, 13.0);
+    write(buf, 400, 100, false, 14.0);
+
+    ASSERT_TRUE(a->findKeyPos(13.5, pos));
+    ASSERT_EQ(200, pos);
+    ASSERT_TRUE(a->findKeyPos(14.0, pos));
+    ASSERT_EQ(400, pos);
+    // そこまで古いものが無ければ一番古いキーフレーム。
+    ASSERT_TRUE(a->findKeyPos(1.0, pos));
+    ASSERT_EQ(0, pos);
+    ASSERT_DOUBLE_EQ(4.0, a->getDuration());
+}
+
+TEST_F(ChanPacketArchiveFixture, findArchivedPacket)
+{
+    auto a = std::make_shared<ChanPacketArchive>();
+    a->open(path, 1024 * 1024);
+    ChanPacketBuffer buf;
+
+    ChanPacket p;
+    ASSERT_FALSE(buf.findArchivedPacket(0, p));
+
+    buf.setArchive(a);
+    for (int i = 0; i < 100; i++)
+        write(buf, i * 100, 100, false);
+
+    unsigned int oldest = buf.getOldestPos();
+    ASSERT_EQ(3600, oldest);
+
+    ASSERT_TRUE(buf.findArchivedPacket(0, p));
+    ASSERT_EQ(0, p.pos);
+    ASSERT_TRUE(buf.findArchivedPacket(3500, p));
+    ASSERT_EQ(3500, p.pos);
+    // バッファーにあるものはアーカイブから読まない。
+    ASSERT_FALSE(buf.findArchivedPacket(3600, p));
+    ASSERT_FALSE(buf.findArchivedPacket(3550, p));
+}
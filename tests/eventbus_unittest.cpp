@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+
+#include "eventbus.h"
+#include "notif.h"
+
+TEST(EventBusTest, publishWithoutSubscribers)
+{
+    EventBus bus;
+    ASSERT_FALSE(bus.hasSubscribers());
+    bus.publish("test", amf0::Value::object({}));
+}
+
+TEST(EventBusTest, subscribeAndPublish)
+{
+    EventBus bus;
+    auto sub = bus.subscribe();
+    ASSERT_TRUE(bus.hasSubscribers());
+
+    EventBus::Event ev;
+    ASSERT_FALSE(sub->wait(ev, 0));
+
+    bus.publish("channelStatus", amf0::Value::object({{"status", "Idle"}}));
+    bus.publish("channelStatus", amf0::Value::object({{"status", "Receiving"}}));
+    ASSERT_EQ(2, sub->numQueued());
+
+    ASSERT_TRUE(sub->wait(ev, 0));
+    ASSERT_EQ("channelStatus", ev.type);
+    ASSERT_EQ("{\"status\":\"Idle\"}", ev.data);
+    auto first = ev.id;
+    ASSERT_TRUE(sub->wait(ev, 0));
+    ASSERT_EQ("{\"status\":\"Receiving\"}", ev.data);
+    ASSERT_EQ(first + 1, ev.id);
+
+    sub = nullptr;
+    ASSERT_FALSE(bus.hasSubscribers());
+}
+
+TEST(EventBusTest, overflowTurnsIntoResync)
+{
+    EventBus bus;
+    auto sub = bus.subscribe();
+
+    for (int i = 0; i < EventBus::Subscription::MAX_QUEUED + 1; i++)
+        bus.publish("test", amf0::Value::object({}));
+    ASSERT_EQ(EventBus::Subscription::MAX_QUEUED, sub->numQueued());
+
+    EventBus::Event ev;
+    ASSERT_TRUE(sub->wait(ev, 0));
+    ASSERT_EQ("resync", ev.type);
+    ASSERT_EQ(0, sub->numQueued());
+    ASSERT_FALSE(sub->wait(ev, 0));
+}
+
+TEST(EventBusTest, notificationIsPublished)
+{
+    auto sub = g_eventBus.subscribe();
+
+    NotificationBuffer buf;
+    buf.addNotification(Notification(1, ServMgr::NT_PEERCAST, "hello"));
+
+    EventBus::Event ev;
+    ASSERT_TRUE(sub->wait(ev, 0));
+    ASSERT_EQ("notification", ev.type);
+    ASSERT_EQ("{\"message\":\"hello\",\"time\":1,\"type\":\"Peercast\"}", ev.data);
+}
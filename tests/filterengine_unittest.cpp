@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+
+#include "filterengine.h"
+#include "resolver.h"
+#include "mocksys.h"
+
+class FilterEngineFixture : public ::testing::Test {
+public:
+    FilterEngineFixture()
+        : n(0)
+    {
+    }
+
+    void add(const char* pattern, unsigned int flags)
+    {
+        filters[n].init();
+        filters[n].setPattern(pattern);
+        filters[n].flags = flags;
+        n++;
+    }
+
+    bool matches(int fl, const char* ip)
+    {
+        return engine.matches(fl, Host(IP::parse(ip), 0), filters, n);
+    }
+
+    // 全てのフィルターを順に試した結果。
+    bool linear(int fl, const char* ip)
+    {
+        for (int i = 0; i < n; i++)
+            if (filters[i].matches(fl, Host(IP::parse(ip), 0)))
+                return true;
+        return false;
+    }
+
+    ServFilter   filters[10];
+    int          n;
+    FilterEngine engine;
+};
+
+TEST_F(FilterEngineFixture, empty)
+{
+    ASSERT_FALSE(matches(ServFilter::F_BAN, "192.168.0.1"));
+    ASSERT_FALSE(matches(ServFilter::F_BAN, "::1"));
+}
+
+TEST_F(FilterEngineFixture, sameAsLinearSearch)
+{
+    add("255.255.255.255", ServFilter::F_NETWORK|ServFilter::F_DIRECT);
+    add("::/0", ServFilter::F_NETWORK);
+    add("192.168.255.255", ServFilter::F_PRIVATE);
+    add("10.0.0.0/8", ServFilter::F_PRIVATE|ServFilter::F_DIRECT);
+    add("127.255.0.1", ServFilter::F_BAN);
+    add("203.0.113.5", ServFilter::F_BAN);
+    add("fc00::/7", ServFilter::F_PRIVATE);
+    add("2001:db8::1", ServFilter::F_BAN);
+    add("::ffff:198.51.100.1", ServFilter::F_BAN);
+    add("0.0.0.0/0", ServFilter::F_DIRECT);
+
+    const char* addrs[] = {
+        "192.168.0.1", "192.169.0.1", "10.1.2.3", "11.0.0.1",
+        "127.0.0.1", "127.3.0.1", "127.0.1.1", "203.0.113.5", "203.0.113.6",
+        "198.51.100.1", "fd00::1", "fe80::1", "2001:db8::1", "2001:db8::2", "::1",
+    };
+    const int flags[] = { ServFilter::F_PRIVATE, ServFilter::F_BAN,
+                          ServFilter::F_NETWORK, ServFilter::F_DIRECT };
+
+    for (auto ip : addrs)
+        for (auto fl : flags)
+            ASSERT_EQ(linear(fl, ip), matches(fl, ip)) << ip << " " << fl;
+}
+
+TEST_F(FilterEngineFixture, noMatchWithoutFlag)
+{
+    add("192.168.0.1", ServFilter::F_BAN);
+    ASSERT_TRUE(matches(ServFilter::F_BAN, "192.168.0.1"));
+    ASSERT_FALSE(matches(ServFilter::F_DIRECT, "192.168.0.1"));
+}
+
+TEST_F(FilterEngineFixture, zeroNetmaskMatchesAnyIPv4)
+{
+    add("0.0.0.0/0", ServFilter::F_BAN);
+    ASSERT_TRUE(matches(ServFilter::F_BAN, "192.168.0.1"));
+    ASSERT_FALSE(matches(ServFilter::F_BAN, "::1"));
+    ASSERT_TRUE(linear(ServFilter::F_BAN, "192.168.0.1"));
+}
+
+// フィルター表を直接書き換えても反映される。
+TEST_F(FilterEngineFixture, recompilesWhenFiltersChange)
+{
+    add("192.168.0.1", ServFilter::F_BAN);
+    ASSERT_TRUE(matches(ServFilter::F_BAN, "192.168.0.1"));
+
+    filters[0].flags = ServFilter::F_DIRECT;
+    ASSERT_FALSE(matches(ServFilter::F_BAN, "192.168.0.1"));
+
+    filters[0].setPattern("192.168.0.2");
+    ASSERT_TRUE(matches(ServFilter::F_DIRECT, "192.168.0.2"));
+
+    n = 0;
+    ASSERT_FALSE(matches(ServFilter::F_DIRECT, "192.168.0.2"));
+}
+
+TEST_F(FilterEngineFixture, suffixResultIsCached)
+{
+    auto reverseLookup = g_resolver.reverseLookup;
+    int calls = 0;
+    g_resolver.clear();
+    g_resolver.reverseLookup = [&](const IP& ip, std::string& out)
+    {
+        calls++;
+        out = (ip.str() == "192.0.2.1") ? "host.example.jp" : "host.example.com";
+        return true;
+    };
+
+    add(".jp", ServFilter::F_BAN);
+    add("192.0.2.255", ServFilter::F_DIRECT);
+
+    ASSERT_TRUE(matches(ServFilter::F_BAN, "192.0.2.1"));
+    ASSERT_FALSE(matches(ServFilter::F_BAN, "192.0.2.2"));
+    ASSERT_EQ(2, calls);
+
+    // 名前解決のキャッシュを消しても、判定を覚えているので引かない。
+    g_resolver.clear();
+    ASSERT_TRUE(matches(ServFilter::F_BAN, "192.0.2.1"));
+    ASSERT_FALSE(matches(ServFilter::F_BAN, "192.0.2.2"));
+    // アドレスのルールだけで決まるものは引かない。
+    ASSERT_TRUE(matches(ServFilter::F_DIRECT, "192.0.2.3"));
+    ASSERT_EQ(2, calls);
+
+    dynamic_cast<MockSys*>(sys)->dtime += FilterEngine::CACHE_TTL + 1;
+    ASSERT_TRUE(matches(ServFilter::F_BAN, "192.0.2.1"));
+    ASSERT_EQ(3, calls);
+
+    g_resolver.reverseLookup = reverseLookup;
+    g_resolver.clear();
+}
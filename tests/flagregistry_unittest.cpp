@@ -43,3 +43,12 @@ TEST_F(FlagRegistoryFixture, forEachFlag)
     ASSERT_EQ(2, count);
     ASSERT_TRUE(str == "flag1flag2" || str == "flag2flag1");
 }
+
+TEST_F(FlagRegistoryFixture, index)
+{
+    ASSERT_EQ("flag1", reg[0].name);
+    ASSERT_EQ("flag2", reg[1].name);
+
+    reg[1] = true;
+    ASSERT_TRUE(reg.get("flag2"));
+}
@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include <map>
+
+#include "flatmap.h"
+
+static GnuID makeID(int i)
+{
+    GnuID id;
+    memcpy(id.id, &i, sizeof(i));
+    memcpy(id.id + 12, &i, sizeof(i));
+    return id;
+}
+
+TEST(FlatHashMapTest, insertFindErase)
+{
+    GnuIDFlatMap<int> map;
+    GnuID a("00112233445566778899aabbccddeeff");
+    GnuID b("ffeeddccbbaa99887766554433221100");
+
+    ASSERT_EQ(nullptr, map.find(a));
+    ASSERT_FALSE(map.erase(a));
+
+    map[a] = 1;
+    map[b] = 2;
+    ASSERT_EQ(2, map.size());
+    ASSERT_EQ(1, *map.find(a));
+    ASSERT_EQ(2, *map.find(b));
+
+    map[a] = 3;
+    ASSERT_EQ(2, map.size());
+    ASSERT_EQ(3, *map.find(a));
+
+    ASSERT_TRUE(map.erase(a));
+    ASSERT_EQ(nullptr, map.find(a));
+    ASSERT_EQ(2, *map.find(b));
+    ASSERT_EQ(1, map.size());
+
+    map.clear();
+    ASSERT_TRUE(map.empty());
+    ASSERT_EQ(nullptr, map.find(b));
+}
+
+// 増やしたり消したりを繰り返しても std::map と同じ内容になる。
+TEST(FlatHashMapTest, matchesStdMap)
+{
+    GnuIDFlatMap<int> map;
+    std::map<std::string, int> ref;
+    std::vector<GnuID> ids;
+
+    for (int i = 0; i < 1000; i++)
+        ids.push_back(makeID(i));
+
+    for (int round = 0; round < 3; round++)
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            map[ids[i]] = i + round;
+            ref[ids[i].str()] = i + round;
+        }
+        // 3 つに 2 つを消す。
+        for (int i = round; i < 1000; i += 3)
+        {
+            ASSERT_TRUE(map.erase(ids[i]));
+            ref.erase(ids[i].str());
+            if (i + 1 < 1000)
+            {
+                ASSERT_TRUE(map.erase(ids[i + 1]));
+                ref.erase(ids[i + 1].str());
+            }
+        }
+
+        ASSERT_EQ(ref.size(), map.size());
+        for (int i = 0; i < 1000; i++)
+        {
+            auto it = ref.find(ids[i].str());
+            auto p = map.find(ids[i]);
+            if (it == ref.end())
+                ASSERT_EQ(nullptr, p);
+            else
+            {
+                ASSERT_NE(nullptr, p);
+                ASSERT_EQ(it->second, *p);
+            }
+        }
+    }
+
+    size_t n = 0;
+    map.forEach([&](const GnuID& id, int& v)
+                {
+                    ASSERT_EQ(ref[id.str()], v);
+                    n++;
+                });
+    ASSERT_EQ(ref.size(), n);
+}
+
+// 先頭 8 バイトが同じ ID も区別する。
+TEST(FlatHashMapTest, sameHashDifferentID)
+{
+    GnuIDFlatMap<int> map;
+    GnuID a("00112233445566778899aabbccddeeff");
+    GnuID b("0011223344556677ffffffffffffffff");
+
+    map[a] = 1;
+    map[b] = 2;
+    ASSERT_EQ(2, map.size());
+    ASSERT_EQ(1, *map.find(a));
+    ASSERT_EQ(2, *map.find(b));
+
+    ASSERT_TRUE(map.erase(a));
+    ASSERT_EQ(nullptr, map.find(a));
+    ASSERT_EQ(2, *map.find(b));
+}
+
+TEST(FlatHashMapTest, stdHash)
+{
+    GnuID a("00112233445566778899aabbccddeeff");
+    ASSERT_EQ(GnuIDHash()(a), std::hash<GnuID>()(a));
+}
@@ -2,6 +2,8 @@
 
 #include "flv.h"
 #include "amf0.h"
+#include "sstream.h"
+#include "chanmgr.h"
 
 class FLVStreamFixture : public ::testing::Test {
 public:
@@ -108,3 +110,171 @@ TEST_F(FLVStreamFixture, readMetaData_neitherRateIsSupplied)
 
     ASSERT_FALSE(success);
 }
+
+// type 型、ペイロード payload のタグ。
+static std::string flvTag(int type, const std::string& payload, int timestamp = 0)
+{
+    int size = payload.size();
+    std::string tag = { (char) type, (char) (size >> 16), (char) (size >> 8), (char) size,
+                        (char) (timestamp >> 16), (char) (timestamp >> 8), (char) timestamp, (char) (timestamp >> 24),
+                        0, 0, 0 };
+    int prevSize = 11 + size;
+    return tag + payload + std::string({ (char) (prevSize >> 24), (char) (prevSize >> 16),
+                                         (char) (prevSize >> 8), (char) prevSize });
+}
+
+TEST_F(FLVStreamFixture, readPacket_consecutiveTagsWithoutRecursion)
+{
+    auto tmp = chanMgr;
+    chanMgr = new ChanMgr();
+
+    const std::string fileHeader = { 'F','L','V',1,5,0,0,0,9,0,0,0,0 };
+    // AVC ヘッダーの後にキーフレームでないタグが続く。
+    std::string data = fileHeader + flvTag(FLVTag::T_VIDEO, std::string({0x17,0x00}));
+    for (int i = 0; i < 10000; i++)
+        data += flvTag(FLVTag::T_VIDEO, std::string({0x27,0x01}));
+    StringStream mem(data);
+
+    auto ch = std::make_shared<Channel>();
+    FLVStream flv;
+    flv.readHeader(mem, ch);
+    flv.readPacket(mem, ch);
+    ASSERT_EQ(ChanPacket::T_HEAD, ch->headPack.type);
+    ASSERT_EQ(13 + 17, ch->headPack.len);
+
+    // タイムスタンプが進まないので、MAX_OUTGOING_PACKET_SIZE まで溜め
+    // てから一つのパケットで送る。
+    flv.readPacket(mem, ch);
+    auto stat = ch->rawData.getStatistics();
+    ASSERT_EQ(2, stat.packetLengths.size());
+    ASSERT_EQ(13 + 17, stat.packetLengths[0]);
+    ASSERT_EQ(FLVTagBuffer::MAX_OUTGOING_PACKET_SIZE / 17 * 17, stat.packetLengths[1]);
+    ASSERT_EQ(17, flv.m_buffer.m_mem.pos);
+
+    // 最後まで読むと例外になるが、スタックは伸びない。
+    ASSERT_THROW({ while (true) flv.readPacket(mem, ch); }, StreamException);
+
+    delete chanMgr;
+    chanMgr = tmp;
+}
+
+// TARGET_PACKET_MSEC 分のタグを一つのパケットにする。キーフレームは一つで送る。
+TEST_F(FLVStreamFixture, readPacket_packetsByDuration)
+{
+    auto tmp = chanMgr;
+    chanMgr = new ChanMgr();
+
+    const std::string fileHeader = { 'F','L','V',1,1,0,0,0,9,0,0,0,0 };
+    std::string data = fileHeader + flvTag(FLVTag::T_VIDEO, std::string({0x17,0x00}));
+    for (int t = 0; t < 240; t += 40)
+        data += flvTag(FLVTag::T_VIDEO, std::string({(char) (t ? 0x27 : 0x17), 0x01}), t);
+    data += flvTag(FLVTag::T_VIDEO, std::string({0x17,0x01}), 240);
+    StringStream mem(data);
+
+    auto ch = std::make_shared<Channel>();
+    FLVStream flv;
+    flv.readHeader(mem, ch);
+    ASSERT_THROW({ while (true) flv.readPacket(mem, ch); }, StreamException);
+
+    // キーフレーム 0、[40, 80, 120]、[160, 200]、キーフレーム 240 に分かれる。
+    auto stat = ch->rawData.getStatistics();
+    std::vector<unsigned int> lens = { 13 + 17, 17, 17 * 3, 17 * 2, 17 };
+    ASSERT_EQ(lens, stat.packetLengths);
+    ASSERT_EQ(2, stat.continuations);
+    ASSERT_EQ(0, flv.m_buffer.m_mem.pos);
+
+    delete chanMgr;
+    chanMgr = tmp;
+}
+
+// 予備のソースに切り替えても、シーケンスヘッダーが同じならストリームを
+// 作り直さず、キーフレームからタイムスタンプを続けて送る。
+TEST_F(FLVStreamFixture, continueFrom)
+{
+    auto tmp = chanMgr;
+    chanMgr = new ChanMgr();
+
+    const std::string fileHeader = { 'F','L','V',1,1,0,0,0,9,0,0,0,0 };
+    const std::string seqHeader = { 0x17, 0x00, 1, 2, 3 };
+    auto ch = std::make_shared<Channel>();
+    ch->info.lowLatency = true;
+
+    std::string data = fileHeader + flvTag(FLVTag::T_VIDEO, seqHeader) +
+        flvTag(FLVTag::T_VIDEO, std::string({0x17,0x01}), 0) +
+        flvTag(FLVTag::T_VIDEO, std::string({0x27,0x01}), 40);
+    StringStream mem(data);
+    auto primary = std::make_shared<FLVStream>();
+    primary->readHeader(mem, ch);
+    ASSERT_THROW({ while (true) primary->readPacket(mem, ch); }, StreamException);
+
+    unsigned int index = ch->streamIndex;
+    unsigned int pos = ch->streamPos;
+
+    data = fileHeader + flvTag(FLVTag::T_VIDEO, seqHeader) +
+        flvTag(FLVTag::T_VIDEO, std::string({0x27,0x01}), 1000) +   // キーフレームまで捨てる
+        flvTag(FLVTag::T_VIDEO, std::string({0x17,0x01}), 1010) +
+        flvTag(FLVTag::T_VIDEO, std::string({0x27,0x01}), 1050);
+    StringStream mem2(data);
+    auto backup = std::make_shared<FLVStream>();
+    ASSERT_TRUE(backup->continueFrom(*primary));
+    backup->readHeader(mem2, ch);
+    ASSERT_THROW({ while (true) backup->readPacket(mem2, ch); }, StreamException);
+
+    ASSERT_EQ(index, ch->streamIndex);
+    ASSERT_EQ(pos + 17 * 2, ch->streamPos);
+
+    // 41 ミリ秒、81 ミリ秒のタグになっている。
+    ChanPacket pack;
+    ASSERT_TRUE(ch->rawData.findPacket(pos, pack));
+    ASSERT_EQ(FLVTag::T_VIDEO, pack.data[0]);
+    ASSERT_EQ(41, (int) (uint8_t) pack.data[6]);
+    ASSERT_TRUE(ch->rawData.findPacket(pos + 17, pack));
+    ASSERT_EQ(81, (int) (uint8_t) pack.data[6]);
+
+    // シーケンスヘッダーが変われば新しいストリームになる。
+    data = fileHeader + flvTag(FLVTag::T_VIDEO, std::string({0x17, 0x00, 4, 5, 6}));
+    StringStream mem3(data);
+    auto other = std::make_shared<FLVStream>();
+    ASSERT_TRUE(other->continueFrom(*backup));
+    other->readHeader(mem3, ch);
+    ASSERT_THROW({ while (true) other->readPacket(mem3, ch); }, StreamException);
+    ASSERT_EQ(index + 1, ch->streamIndex);
+
+    delete chanMgr;
+    chanMgr = tmp;
+}
+
+// Enhanced RTMP の HEVC では、シーケンスヘッダーをヘッダーパケットに入
+// れ、変わった時だけ送り直す。
+TEST_F(FLVStreamFixture, putTag_enhancedSequenceHeader)
+{
+    auto tmp = chanMgr;
+    chanMgr = new ChanMgr();
+
+    const std::string fileHeader = { 'F','L','V',1,1,0,0,0,9,0,0,0,0 };
+    const std::string interFrame = { (char) 0xa1, 'h','v','c','1', 0,0,0, 'i' };
+    const std::string seqStart1  = { (char) 0x90, 'h','v','c','1', 1 };
+    const std::string seqStart2  = { (char) 0x90, 'h','v','c','1', 2 };
+    std::string data = fileHeader;
+    // ヘッダーの前のフレームはヘッダーにしない。
+    data += flvTag(FLVTag::T_VIDEO, interFrame);
+    data += flvTag(FLVTag::T_VIDEO, seqStart1);
+    data += flvTag(FLVTag::T_VIDEO, seqStart1);
+    data += flvTag(FLVTag::T_VIDEO, seqStart2);
+    StringStream mem(data);
+
+    auto ch = std::make_shared<Channel>();
+    FLVStream flv;
+    flv.readHeader(mem, ch);
+
+    unsigned int index = ch->streamIndex;
+    ASSERT_THROW({ while (true) flv.readPacket(mem, ch); }, StreamException);
+
+    // 同じヘッダーが続いても送り直さない。
+    ASSERT_EQ(index + 2, ch->streamIndex);
+    ASSERT_EQ(std::string((char*) flv.videoHeader.data, flv.videoHeader.size), seqStart2);
+    ASSERT_EQ(13 + 11 + (int) seqStart2.size() + 4, ch->headPack.len);
+
+    delete chanMgr;
+    chanMgr = tmp;
+}
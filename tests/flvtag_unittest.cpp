@@ -70,3 +70,76 @@ TEST_F(FLVTagFixture, timestamp)
     ASSERT_FALSE(tag.isKeyFrame());
     ASSERT_EQ(FLVTag::T_SCRIPT, tag.type);
 }
+
+TEST_F(FLVTagFixture, copySharesBufferUntilNextRead)
+{
+    // data には直前タグサイズの 4 バイトが無いので補う。
+    std::string packet = std::string((char*)data, (char*)data+283) + std::string(5, '\0');
+    StringStream mem(packet + packet);
+
+    tag.read(mem);
+    FLVTag header = tag;
+    ASSERT_EQ(tag.packet, header.packet);
+
+    // 共有中に読むと別のバッファに読み込み、取っておいた方は変わらない。
+    header.setTimestamp(1);
+    tag.read(mem);
+    ASSERT_NE(tag.packet, header.packet);
+    ASSERT_EQ(1, header.getTimestamp());
+    ASSERT_EQ(0, tag.getTimestamp());
+
+    // 共有していなければバッファを使い回す。
+    unsigned char *p = tag.packet;
+    StringStream mem2( std::string((char*)data, (char*)data+283) );
+    tag.read(mem2);
+    ASSERT_EQ(p, tag.packet);
+}
+
+TEST_F(FLVTagFixture, enhancedRTMPVideo)
+{
+    // IsExHeader | KeyFrame | SequenceStart, 'hvc1'
+    const unsigned char seqStart[] = { 0x90, 'h', 'v', 'c', '1', 0x01 };
+    // IsExHeader | KeyFrame | CodedFramesX
+    const unsigned char keyFrame[] = { 0x93, 'a', 'v', '0', '1', 0xff };
+    // IsExHeader | InterFrame | CodedFrames
+    const unsigned char interFrame[] = { 0xa1, 'h', 'v', 'c', '1', 0, 0, 0, 0xff };
+
+    tag.set(FLVTag::T_VIDEO, 0, seqStart, sizeof(seqStart));
+    ASSERT_TRUE(tag.isSequenceHeader());
+    ASSERT_TRUE(tag.isKeyFrame());
+    ASSERT_TRUE(tag.hasSequenceHeaders());
+    ASSERT_EQ("hvc1", tag.getCodecName());
+
+    tag.set(FLVTag::T_VIDEO, 0, keyFrame, sizeof(keyFrame));
+    ASSERT_FALSE(tag.isSequenceHeader());
+    ASSERT_TRUE(tag.isKeyFrame());
+    ASSERT_EQ("av01", tag.getCodecName());
+
+    tag.set(FLVTag::T_VIDEO, 0, interFrame, sizeof(interFrame));
+    ASSERT_FALSE(tag.isSequenceHeader());
+    ASSERT_FALSE(tag.isKeyFrame());
+}
+
+TEST_F(FLVTagFixture, legacySequenceHeaders)
+{
+    const unsigned char avcHeader[] = { 0x17, 0x00, 0, 0, 0 };
+    const unsigned char avcFrame[] = { 0x17, 0x01, 0, 0, 0 };
+    const unsigned char aacHeader[] = { 0xaf, 0x00, 0x12, 0x10 };
+    const unsigned char mp3Frame[] = { 0x2f, 0xff };
+
+    tag.set(FLVTag::T_VIDEO, 0, avcHeader, sizeof(avcHeader));
+    ASSERT_TRUE(tag.isSequenceHeader());
+    ASSERT_EQ("AVC", tag.getCodecName());
+
+    tag.set(FLVTag::T_VIDEO, 0, avcFrame, sizeof(avcFrame));
+    ASSERT_FALSE(tag.isSequenceHeader());
+    ASSERT_TRUE(tag.isKeyFrame());
+
+    tag.set(FLVTag::T_AUDIO, 0, aacHeader, sizeof(aacHeader));
+    ASSERT_TRUE(tag.isSequenceHeader());
+    ASSERT_EQ("AAC", tag.getCodecName());
+
+    tag.set(FLVTag::T_AUDIO, 0, mp3Frame, sizeof(mp3Frame));
+    ASSERT_FALSE(tag.isSequenceHeader());
+    ASSERT_FALSE(tag.hasSequenceHeaders());
+}
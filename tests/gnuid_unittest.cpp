@@ -139,3 +139,48 @@ TEST_F(GnuIDFixture, encode_prefixSharingSalts)
     id2.encode(NULL, "ナガイナマエ(立て直し)", NULL, 0);
     ASSERT_FALSE(id.isSame(id2));
 }
+
+TEST_F(GnuIDFixture, GnuIDList)
+{
+    GnuIDList list(2);
+    GnuID a("0000000000000000000000000000000a");
+    GnuID b("0000000000000000000000000000000b");
+    GnuID c("0000000000000000000000000000000c");
+
+    ASSERT_FALSE(list.contains(a));
+    list.add(a);
+    list.add(b);
+    ASSERT_TRUE(list.contains(a));
+    ASSERT_EQ(2, list.numUsed());
+
+    // a を見直したので、いっぱいになると b が忘れられる。
+    list.add(a);
+    list.add(c);
+    ASSERT_TRUE(list.contains(a));
+    ASSERT_FALSE(list.contains(b));
+    ASSERT_TRUE(list.contains(c));
+    ASSERT_EQ(2, list.numUsed());
+
+    list.clear();
+    ASSERT_EQ(0, list.numUsed());
+    ASSERT_FALSE(list.contains(a));
+}
+
+TEST_F(GnuIDFixture, fromStr)
+{
+    GnuID a("0123456789abcdefABCDEF0123456789");
+    ASSERT_EQ("0123456789ABCDEFABCDEF0123456789", a.str());
+
+    // 短すぎる文字列は全部 0。
+    GnuID b("0123");
+    ASSERT_FALSE(b.isSet());
+
+    // 数字でない所で読むのをやめる。
+    GnuID c("1z0000000000000000000000000000zz");
+    ASSERT_EQ(0x01, c.id[0]);
+    ASSERT_EQ(0x00, c.id[15]);
+
+    // 32 文字より後ろは見ない。
+    GnuID d("00000000000000000000000000000001XYZ");
+    ASSERT_EQ("00000000000000000000000000000001", d.str());
+}
@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+
+#include "gzipencoder.h"
+#include "httpclient.h"
+
+class GzipEncoderFixture : public ::testing::Test {
+};
+
+TEST_F(GzipEncoderFixture, accepts)
+{
+    ASSERT_TRUE(GzipEncoder::accepts("gzip, deflate, br", "gzip"));
+    ASSERT_TRUE(GzipEncoder::accepts("GZIP;q=0.5", "gzip"));
+    ASSERT_FALSE(GzipEncoder::accepts("gzip;q=0", "gzip"));
+    ASSERT_FALSE(GzipEncoder::accepts("deflate", "gzip"));
+    ASSERT_FALSE(GzipEncoder::accepts("", "gzip"));
+}
+
+TEST_F(GzipEncoderFixture, compress)
+{
+    if (!GzipEncoder::available())
+        return;
+
+    GzipEncoder enc;
+    HTTPRequest req("GET", "/", "HTTP/1.1", {{"Accept-Encoding", "gzip"}});
+
+    // 小さいものはそのまま。
+    auto small = HTTPResponse::ok({{"Content-Type", "application/json"}}, "[]");
+    ASSERT_FALSE(enc.compress(req, small));
+    ASSERT_EQ("[]", small.body);
+
+    std::string body;
+    for (int i = 0; i < 200; i++)
+        body += "{\"name\":\"channel\",\"listeners\":" + std::to_string(i) + "},";
+    auto res = HTTPResponse::ok({{"Content-Type", "application/json"}}, body);
+    ASSERT_TRUE(enc.compress(req, res));
+    ASSERT_EQ("gzip", res.headers.get("Content-Encoding"));
+    ASSERT_EQ("Accept-Encoding", res.headers.get("Vary"));
+    ASSERT_LT(res.body.size(), body.size() / 4);
+    ASSERT_EQ(body, HTTPClient::decode(res.body, "gzip"));
+
+    // 同じスレッドの圧縮器を使い回しても同じ結果。
+    ASSERT_EQ(res.body, GzipEncoder::encode(body));
+
+    // 受け付けなければ圧縮しない。
+    HTTPRequest plain("GET", "/", "HTTP/1.1", {});
+    auto res2 = HTTPResponse::ok({{"Content-Type", "application/json"}}, body);
+    ASSERT_FALSE(enc.compress(plain, res2));
+    ASSERT_EQ(body, res2.body);
+    ASSERT_EQ("Accept-Encoding", res2.headers.get("Vary"));
+
+    ASSERT_EQ(1, enc.getState().at("numCompressed").number());
+}
@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#ifndef WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "handoff.h"
+#include "prefork.h"
+
+TEST(RestartHandoffTest, serialize)
+{
+    RestartHandoff::State state;
+
+    RestartHandoff::Connection listener;
+    listener.listener = true;
+    listener.port = 7144;
+    state.connections.push_back(listener);
+
+    RestartHandoff::Connection stream;
+    stream.type = 4;
+    stream.protocol = 2;
+    stream.chanID = GnuID("00112233445566778899aabbccddeeff");
+    stream.remoteID = GnuID("ffeeddccbbaa99887766554433221100");
+    stream.streamPos = 123456789;
+    state.connections.push_back(stream);
+
+    RestartHandoff::ChannelState ch;
+    ch.id = stream.chanID;
+    ch.name = "テスト";
+    ch.contentType = "FLV";
+    ch.MIMEType = "video/x-flv";
+    ch.streamExt = ".flv";
+    ch.bitrate = 500;
+    ch.upstream.fromStrIP("192.168.0.1", 7145);
+    state.channels.push_back(ch);
+
+    RestartHandoff::State out;
+    ASSERT_TRUE(RestartHandoff::deserialize(RestartHandoff::serialize(state), out));
+
+    ASSERT_EQ(2, out.connections.size());
+    ASSERT_TRUE(out.connections[0].listener);
+    ASSERT_EQ(7144, out.connections[0].port);
+    ASSERT_FALSE(out.connections[1].listener);
+    ASSERT_EQ(4, out.connections[1].type);
+    ASSERT_EQ(2, out.connections[1].protocol);
+    ASSERT_TRUE(out.connections[1].chanID.isSame(stream.chanID));
+    ASSERT_TRUE(out.connections[1].remoteID.isSame(stream.remoteID));
+    ASSERT_EQ(123456789, out.connections[1].streamPos);
+    // fd は送らない。
+    ASSERT_EQ(-1, out.connections[1].fd);
+
+    ASSERT_EQ(1, out.channels.size());
+    ASSERT_TRUE(out.channels[0].id.isSame(ch.id));
+    ASSERT_EQ("テスト", out.channels[0].name);
+    ASSERT_EQ("FLV", out.channels[0].contentType);
+    ASSERT_EQ(".flv", out.channels[0].streamExt);
+    ASSERT_EQ(500, out.channels[0].bitrate);
+    ASSERT_EQ("192.168.0.1:7145", out.channels[0].upstream.str());
+}
+
+TEST(RestartHandoffTest, deserializeBroken)
+{
+    RestartHandoff::State out;
+    ASSERT_FALSE(RestartHandoff::deserialize("", out));
+    ASSERT_FALSE(RestartHandoff::deserialize("{}", out));
+    ASSERT_FALSE(RestartHandoff::deserialize("{\"connections\":[{}],\"channels\":[]}", out));
+}
+
+TEST(RestartHandoffTest, takeListenerWithoutTakeover)
+{
+    RestartHandoff handoff;
+    ASSERT_EQ(-1, handoff.takeListener(7144));
+}
+
+#ifndef WIN32
+TEST(RestartHandoffTest, messageAndSocket)
+{
+    std::string path = "/tmp/handoff_unittest.sock";
+    int lfd = RestartHandoff::listenPath(path);
+    ASSERT_LE(0, lfd);
+
+    int client = RestartHandoff::connectPath(path);
+    ASSERT_LE(0, client);
+    int server = RestartHandoff::acceptPath(lfd, 1000);
+    ASSERT_LE(0, server);
+
+    int conn[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, conn));
+
+    // 状態に続けて fd を送っても、状態を読む時に fd を落とさない。
+    ASSERT_TRUE(RestartHandoff::sendMessage(server, "hello"));
+    ASSERT_TRUE(Prefork::sendSocket(server, conn[0]));
+
+    std::string data;
+    ASSERT_TRUE(RestartHandoff::recvMessage(client, data, 1000));
+    ASSERT_EQ("hello", data);
+    int fd = Prefork::recvSocket(client, 1000);
+    ASSERT_LE(0, fd);
+
+    ASSERT_EQ(3, write(conn[1], "abc", 3));
+    char buf[4];
+    ASSERT_EQ(3, read(fd, buf, sizeof(buf)));
+    ASSERT_EQ("abc", std::string(buf, 3));
+
+    close(fd);
+    close(conn[1]);
+    close(client);
+    close(server);
+    close(lfd);
+    unlink(path.c_str());
+}
+#endif
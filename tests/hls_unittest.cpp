@@ -0,0 +1,224 @@
+#include <gtest/gtest.h>
+
+#include "hls.h"
+#include "channel.h"
+#include "flv.h"
+#include "str.h"
+
+class HLSSegmenterFixture : public ::testing::Test {
+public:
+    static std::string tag(FLVTag::TYPE type, int32_t timestamp, const std::string& payload)
+    {
+        FLVTag t;
+        t.set(type, timestamp, payload.data(), (int) payload.size());
+        return std::string(reinterpret_cast<char*>(t.packet), t.packetSize);
+    }
+
+    static std::string fileHeader()
+    {
+        return std::string("FLV\x01\x05\x00\x00\x00\x09\x00\x00\x00\x00", 13);
+    }
+
+    // SPS と PPS が一つずつの AVCDecoderConfigurationRecord。
+    static std::string avcConfig()
+    {
+        return tag(FLVTag::T_VIDEO, 0, std::string("\x17\x00\x00\x00\x00"
+                                                   "\x01\x64\x00\x1f\xff\xe1\x00\x04\x67\x64\x00\x1f"
+                                                   "\x01\x00\x04\x68\xee\x3c\x80", 24));
+    }
+
+    static std::string avcFrame(int32_t timestamp, bool keyFrame)
+    {
+        std::string nal = keyFrame ? std::string("\x65\x88\x84\x00", 4) : std::string("\x41\x9a\x02\x00", 4);
+        std::string payload = keyFrame ? "\x17\x01" : "\x27\x01";
+        payload += std::string("\x00\x00\x00", 3);
+        payload += std::string("\x00\x00\x00\x04", 4) + nal;
+        return tag(FLVTag::T_VIDEO, timestamp, payload);
+    }
+
+    static std::string aacConfig()
+    {
+        return tag(FLVTag::T_AUDIO, 0, std::string("\xaf\x00\x12\x10", 4));
+    }
+
+    static std::string aacFrame(int32_t timestamp)
+    {
+        return tag(FLVTag::T_AUDIO, timestamp, std::string("\xaf\x01", 2) + std::string(100, '\x21'));
+    }
+
+    // 25fps で毎秒キーフレームの映像を from から to ミリ秒まで入れる。
+    void putVideo(int from, int to)
+    {
+        for (int t = from; t < to; t += 40)
+        {
+            auto s = avcFrame(t, t % 1000 == 0);
+            hls.put(s.data(), (int) s.size());
+        }
+    }
+
+    void putHeader(bool video, bool audio)
+    {
+        std::string s = fileHeader();
+        if (audio)
+            s += aacConfig();
+        if (video)
+            s += avcConfig();
+        hls.put(s.data(), (int) s.size());
+    }
+
+    HLSSegmenter hls;
+};
+
+TEST_F(HLSSegmenterFixture, noSegmentsInitially)
+{
+    ASSERT_FALSE(hls.hasSegments());
+    ASSERT_EQ("", hls.playlist());
+}
+
+TEST_F(HLSSegmenterFixture, cutsAtKeyFrames)
+{
+    putHeader(true, false);
+    putVideo(0, 7000);
+
+    ASSERT_TRUE(hls.hasSegments());
+    ASSERT_TRUE(hls.isReady(2, -1));
+    ASSERT_FALSE(hls.isReady(3, -1));
+
+    auto pl = hls.playlist();
+    ASSERT_TRUE(str::contains(pl, "#EXTM3U\n"));
+    ASSERT_TRUE(str::contains(pl, "#EXT-X-TARGETDURATION:2\n"));
+    ASSERT_TRUE(str::contains(pl, "#EXT-X-MEDIA-SEQUENCE:0\n"));
+    ASSERT_TRUE(str::contains(pl, "#EXTINF:2.000,\nseg0.ts\n"));
+    ASSERT_TRUE(str::contains(pl, "#EXTINF:2.000,\nseg2.ts\n"));
+    ASSERT_FALSE(str::contains(pl, "seg3.ts"));
+    ASSERT_TRUE(str::contains(pl, "#EXT-X-PART-INF:PART-TARGET=0.500\n"));
+    ASSERT_TRUE(str::contains(pl, "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part3.2.ts\"\n"));
+
+    std::string seg;
+    ASSERT_TRUE(hls.getSegment(1, seg));
+    ASSERT_EQ(0, seg.size() % 188);
+    ASSERT_EQ(0x47, (uint8_t) seg[0]);
+    ASSERT_FALSE(hls.getSegment(3, seg));    // 作りかけ
+}
+
+TEST_F(HLSSegmenterFixture, partsMakeUpSegment)
+{
+    putHeader(true, false);
+    putVideo(0, 2500);
+
+    std::string seg;
+    ASSERT_TRUE(hls.getSegment(0, seg));
+
+    std::string joined, part;
+    unsigned int i = 0;
+    while (hls.getPart(0, i, part))
+    {
+        joined += part;
+        i++;
+    }
+    // 40ms のフレームで 500ms を超えないように区切るので 480ms ずつ。
+    ASSERT_EQ(5, i);
+    ASSERT_EQ(seg, joined);
+
+    auto pl = hls.playlist();
+    ASSERT_TRUE(str::contains(pl, "#EXT-X-PART:DURATION=0.480,URI=\"part0.0.ts\",INDEPENDENT=YES\n"));
+    ASSERT_TRUE(str::contains(pl, "#EXT-X-PART:DURATION=0.480,URI=\"part0.1.ts\"\n"));
+    ASSERT_TRUE(str::contains(pl, "#EXT-X-PART:DURATION=0.080,URI=\"part0.4.ts\"\n"));
+    ASSERT_TRUE(str::contains(pl, "#EXT-X-PART:DURATION=0.480,URI=\"part1.0.ts\",INDEPENDENT=YES\n"));
+}
+
+TEST_F(HLSSegmenterFixture, waitsForKeyFrame)
+{
+    putHeader(true, false);
+    putVideo(40, 1000);     // キーフレームが無い
+    ASSERT_FALSE(hls.isReady(0, 0));
+
+    putVideo(1000, 3500);
+    std::string seg;
+    ASSERT_TRUE(hls.getSegment(0, seg));
+    ASSERT_TRUE(str::contains(hls.playlist(), "#EXTINF:2.000,\nseg0.ts\n"));
+}
+
+TEST_F(HLSSegmenterFixture, splitTags)
+{
+    putHeader(true, false);
+
+    // タグがパケットの境目で切れていてもよい。
+    std::string s;
+    for (int t = 0; t < 2500; t += 40)
+        s += avcFrame(t, t % 1000 == 0);
+    for (size_t i = 0; i < s.size(); i += 7)
+        hls.put(s.data() + i, (int) std::min<size_t>(7, s.size() - i));
+
+    ASSERT_TRUE(hls.isReady(0, -1));
+}
+
+TEST_F(HLSSegmenterFixture, discontinuity)
+{
+    putHeader(true, false);
+    putVideo(0, 2500);
+    hls.discontinuity();
+    putVideo(10000, 12500);
+
+    auto pl = hls.playlist();
+    ASSERT_TRUE(str::contains(pl, "#EXT-X-DISCONTINUITY\n"));
+    ASSERT_TRUE(str::contains(pl, "seg1.ts"));
+    ASSERT_TRUE(str::contains(pl, "seg2.ts"));
+}
+
+TEST_F(HLSSegmenterFixture, audioOnly)
+{
+    putHeader(false, true);
+    for (int t = 0; t < 2500; t += 23)
+    {
+        auto s = aacFrame(t);
+        hls.put(s.data(), (int) s.size());
+    }
+
+    std::string seg;
+    ASSERT_TRUE(hls.getSegment(0, seg));
+    ASSERT_EQ(0, seg.size() % 188);
+    // ADTS の同期語
+    ASSERT_NE(std::string::npos, seg.find("\xff\xf1"));
+}
+
+TEST_F(HLSSegmenterFixture, oldSegmentsAreDropped)
+{
+    putHeader(true, true);
+    putVideo(0, 2000 * (HLSSegmenter::MAX_SEGMENTS + 3));
+
+    std::string seg;
+    ASSERT_FALSE(hls.getSegment(0, seg));
+    ASSERT_TRUE(hls.isReady(0, -1));    // もう待っても出来ない
+    ASSERT_FALSE(str::contains(hls.playlist(), "seg0.ts"));
+    ASSERT_TRUE(str::contains(hls.playlist(), "#EXT-X-MEDIA-SEQUENCE:3\n"));
+}
+
+TEST_F(HLSSegmenterFixture, queryIsAppended)
+{
+    putHeader(true, false);
+    putVideo(0, 2500);
+    ASSERT_TRUE(str::contains(hls.playlist("auth=abc"), "seg0.ts?auth=abc\n"));
+}
+
+TEST_F(HLSSegmenterFixture, updateFromChannel)
+{
+    auto ch = std::make_shared<Channel>();
+    std::string head = fileHeader() + avcConfig();
+    ch->headPack.init(ChanPacket::T_HEAD, head.data(), (unsigned int) head.size(), 0);
+
+    unsigned int pos = (unsigned int) head.size();
+    for (int t = 0; t < 2500; t += 40)
+    {
+        auto s = avcFrame(t, t % 1000 == 0);
+        ChanPacket pack;
+        pack.init(ChanPacket::T_DATA, s.data(), (unsigned int) s.size(), pos);
+        pack.cont = (t % 1000 != 0);
+        ASSERT_TRUE(ch->rawData.writePacket(pack));
+        pos += (unsigned int) s.size();
+    }
+
+    hls.update(ch);
+    std::string seg;
+    ASSERT_TRUE(hls.getSegment(0, seg));
+}
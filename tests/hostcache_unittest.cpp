@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+
+#include "hostcache.h"
+
+class HostCacheFixture : public ::testing::Test {
+public:
+    HostCacheFixture()
+        : cache(3)
+    {
+    }
+
+    static Host host(const char* ip, int port = 7144)
+    {
+        Host h;
+        h.fromStrIP(ip, port);
+        return h;
+    }
+
+    HostCache cache;
+};
+
+TEST_F(HostCacheFixture, addAndSeen)
+{
+    Host h = host("192.0.2.1");
+    cache.add(h, ServHost::T_SERVENT, 100);
+
+    ASSERT_EQ(1, cache.count(ServHost::T_SERVENT));
+    ASSERT_EQ(0, cache.count(ServHost::T_TRACKER));
+    ASSERT_TRUE(cache.seen(h.ip, ServHost::T_SERVENT, 100));
+    ASSERT_FALSE(cache.seen(h.ip, ServHost::T_SERVENT, 101));
+    ASSERT_FALSE(cache.seen(h.ip, ServHost::T_TRACKER, 0));
+
+    // ポートは見ない。
+    ASSERT_TRUE(cache.seen(host("192.0.2.1", 8144).ip, ServHost::T_SERVENT, 0));
+}
+
+TEST_F(HostCacheFixture, addReplacesSameHost)
+{
+    Host h = host("192.0.2.1");
+    cache.add(h, ServHost::T_SERVENT, 100);
+    cache.add(h, ServHost::T_SERVENT, 200);
+    cache.add(h, ServHost::T_TRACKER, 300);
+
+    ASSERT_EQ(1, cache.count(ServHost::T_SERVENT));
+    ASSERT_EQ(2, cache.count(ServHost::T_NONE));
+    ASSERT_TRUE(cache.seen(h.ip, ServHost::T_SERVENT, 200));
+}
+
+TEST_F(HostCacheFixture, invalidHostIgnored)
+{
+    Host h;
+    cache.add(h, ServHost::T_SERVENT, 100);
+    ASSERT_EQ(0, cache.count(ServHost::T_NONE));
+}
+
+TEST_F(HostCacheFixture, evictsLeastRecentlyAdded)
+{
+    Host a = host("192.0.2.1"), b = host("192.0.2.2"), c = host("192.0.2.3"), d = host("192.0.2.4");
+    cache.add(a, ServHost::T_SERVENT, 100);
+    cache.add(b, ServHost::T_SERVENT, 100);
+    cache.add(c, ServHost::T_SERVENT, 100);
+    cache.add(a, ServHost::T_SERVENT, 100);    // a を前に戻す
+    cache.add(d, ServHost::T_SERVENT, 100);
+
+    ASSERT_EQ(3, cache.count(ServHost::T_NONE));
+    ASSERT_TRUE(cache.seen(a.ip, ServHost::T_SERVENT, 0));
+    ASSERT_FALSE(cache.seen(b.ip, ServHost::T_SERVENT, 0));
+
+    cache.setCapacity(1);
+    ASSERT_EQ(1, cache.count(ServHost::T_NONE));
+    ASSERT_TRUE(cache.seen(d.ip, ServHost::T_SERVENT, 0));
+}
+
+TEST_F(HostCacheFixture, remove)
+{
+    Host a = host("192.0.2.1"), a2 = host("192.0.2.1", 8144);
+    cache.add(a, ServHost::T_SERVENT, 100);
+    cache.add(a2, ServHost::T_SERVENT, 100);
+
+    cache.remove(a, ServHost::T_TRACKER);
+    ASSERT_EQ(2, cache.count(ServHost::T_SERVENT));
+
+    cache.remove(a, ServHost::T_SERVENT);
+    ASSERT_EQ(1, cache.count(ServHost::T_SERVENT));
+    ASSERT_TRUE(cache.seen(a.ip, ServHost::T_SERVENT, 0));
+
+    cache.remove(a2, ServHost::T_SERVENT);
+    ASSERT_FALSE(cache.seen(a.ip, ServHost::T_SERVENT, 0));
+}
+
+TEST_F(HostCacheFixture, clear)
+{
+    Host a = host("192.0.2.1"), b = host("192.0.2.2");
+    cache.add(a, ServHost::T_SERVENT, 100);
+    cache.add(b, ServHost::T_TRACKER, 100);
+
+    cache.clear(ServHost::T_SERVENT);
+    ASSERT_EQ(0, cache.count(ServHost::T_SERVENT));
+    ASSERT_EQ(1, cache.count(ServHost::T_TRACKER));
+
+    cache.clear(ServHost::T_NONE);
+    ASSERT_EQ(0, cache.count(ServHost::T_NONE));
+}
+
+TEST_F(HostCacheFixture, newest)
+{
+    HostCache big;
+    Host a = host("192.0.2.1"), b = host("10.0.0.2"), c = host("192.0.2.3"), t = host("192.0.2.4");
+    big.add(a, ServHost::T_SERVENT, 300);
+    big.add(b, ServHost::T_SERVENT, 200);
+    big.add(c, ServHost::T_SERVENT, 100);
+    big.add(t, ServHost::T_TRACKER, 400);
+
+    auto all = big.newest(ServHost::T_SERVENT, 10, [](const ServHost&) { return true; });
+    ASSERT_EQ(3, all.size());
+    ASSERT_EQ("192.0.2.1:7144", all[0].str());
+    ASSERT_EQ("10.0.0.2:7144", all[1].str());
+    ASSERT_EQ("192.0.2.3:7144", all[2].str());
+
+    auto global = big.newest(ServHost::T_SERVENT, 1, [](const ServHost& sh) { return sh.host.globalIP(); });
+    ASSERT_EQ(1, global.size());
+    ASSERT_EQ("192.0.2.1:7144", global[0].str());
+}
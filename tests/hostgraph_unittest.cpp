@@ -178,3 +178,113 @@ TEST_F(HostGraphFixture, localRelay)
     ASSERT_EQ(relayTree[0]["children"][0]["port"].get<int>(), 8144);
     ASSERT_EQ(relayTree[0]["children"][0]["isFirewalled"].get<bool>(), false);
 }
+
+TEST_F(HostGraphFixture, cachedRelayTree)
+{
+    HostGraph::clearCache();
+    auto hitList = std::make_shared<ChanHitList>();
+
+    auto tree = HostGraph::getCachedRelayTree(self, hitList);
+    ASSERT_EQ(1, tree.size());
+    ASSERT_EQ(0, tree[0]["children"].size());
+
+    // ヒットが増えれば作り直す。
+    unsigned int gen = hitList->generation();
+    {
+        ChanHit hit;
+
+        hit.rhost[0].fromStrIP("8.8.8.8", 7144);
+        hit.rhost[1].fromStrIP("192.168.0.1", 7144);
+        hit.host = hit.rhost[0];
+        hit.uphost = Host("127.0.0.1", 0);
+
+        hitList->addHit(hit);
+    }
+    ASSERT_NE(gen, hitList->generation());
+
+    tree = HostGraph::getCachedRelayTree(self, hitList);
+    ASSERT_EQ(1, tree.size());
+    ASSERT_EQ(1, tree[0]["children"].size());
+
+    // 自分の状態が変わっても作り直す。
+    ChanHit self2 = self;
+    self2.numListeners = 5;
+    tree = HostGraph::getCachedRelayTree(self2, hitList);
+    ASSERT_EQ(5, tree[0]["localDirects"].get<int>());
+
+    // 消えれば子も無くなる。
+    {
+        ChanHit hit;
+
+        hit.rhost[0].fromStrIP("8.8.8.8", 7144);
+        hit.rhost[1].fromStrIP("192.168.0.1", 7144);
+        hitList->delHit(hit);
+    }
+    tree = HostGraph::getCachedRelayTree(self2, hitList);
+    ASSERT_EQ(0, tree[0]["children"].size());
+}
+
+TEST_F(HostGraphFixture, circularity)
+{
+    auto hitList = std::make_shared<ChanHitList>();
+
+    // A と B が互いを上流だと言っている。
+    ChanHit a, b;
+    a.rhost[0].fromStrIP("8.8.8.8", 7144);
+    a.uphost = Host("8.8.4.4", 7144);
+    a.sessionID.fromStr("00000000000000000000000000000001");
+    b.rhost[0].fromStrIP("8.8.4.4", 7144);
+    b.uphost = Host("8.8.8.8", 7144);
+    b.sessionID.fromStr("00000000000000000000000000000002");
+    hitList->addHit(a);
+    hitList->addHit(b);
+
+    HostGraph graph(self, hitList.get());
+    auto tree = graph.getRelayTree();
+
+    // どちらも根にならないので木には出てこないが、止まること。
+    ASSERT_EQ(1, tree.size());
+}
+
+TEST_F(HostGraphFixture, findShallowerParents)
+{
+    auto hitList = std::make_shared<ChanHitList>();
+
+    self.rhost[0].port = 7144;
+    self.firewalled = false;
+    self.relay = true;
+
+    // 自分 - A - B - C - D - E と一列に繋がっている。
+    const char* ips[] = { "8.8.8.1", "8.8.8.2", "8.8.8.3", "8.8.8.4", "8.8.8.5" };
+    Host up = self.rhost[0];
+    for (int i = 0; i < 5; i++)
+    {
+        ChanHit hit;
+        hit.init();
+        hit.rhost[0].fromStrIP(ips[i], 7144);
+        hit.host = hit.rhost[0];
+        hit.uphost = up;
+        hit.relay = true;
+        hit.recv = true;
+        hit.sessionID.fromStr((std::string("0000000000000000000000000000000") + std::to_string(i + 1)).c_str());
+        hitList->addHit(hit);
+        up = hit.rhost[0];
+    }
+
+    HostGraph graph(self, hitList.get());
+
+    auto moves = graph.findShallowerParents(3, 4);
+
+    // 深い方から、二段以上浅くなる空いた親へ。
+    ASSERT_EQ(2, moves.size());
+    ASSERT_EQ("8.8.8.5", moves[0].hit.rhost[0].ip.str());
+    ASSERT_EQ(5, moves[0].depth);
+    ASSERT_EQ(0, moves[0].parentDepth);
+    ASSERT_EQ("8.8.8.4", moves[1].hit.rhost[0].ip.str());
+    ASSERT_EQ(4, moves[1].depth);
+    ASSERT_EQ("8.8.8.1", moves[1].parent.rhost[0].ip.str());
+    ASSERT_EQ(1, moves[1].parentDepth);
+
+    ASSERT_EQ(1, graph.findShallowerParents(3, 1).size());
+    ASSERT_EQ(0, graph.findShallowerParents(5, 4).size());
+}
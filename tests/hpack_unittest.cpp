@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+
+#include "hpack.h"
+
+class HPACKFixture : public ::testing::Test {
+};
+
+static std::string unhex(const std::string& hex)
+{
+    std::string out;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2)
+        out += (char) std::stoi(hex.substr(i, 2), nullptr, 16);
+    return out;
+}
+
+TEST_F(HPACKFixture, huffmanDecode)
+{
+    // RFC 7541 付録 C の例
+    ASSERT_EQ("www.example.com", hpack::huffmanDecode(unhex("f1e3c2e5f23a6ba0ab90f4ff")));
+    ASSERT_EQ("no-cache", hpack::huffmanDecode(unhex("a8eb10649cbf")));
+    ASSERT_EQ("custom-value", hpack::huffmanDecode(unhex("25a849e95bb8e8b4bf")));
+    ASSERT_EQ("302", hpack::huffmanDecode(unhex("6402")));
+    ASSERT_EQ("Mon, 21 Oct 2013 20:13:21 GMT",
+              hpack::huffmanDecode(unhex("d07abe941054d444a8200595040b8166e082a62d1bff")));
+    ASSERT_EQ("https://www.example.com", hpack::huffmanDecode(unhex("9d29ad171863c78f0b97c8e9ae82ae43d3")));
+    ASSERT_EQ("", hpack::huffmanDecode(""));
+
+    // 詰め物が 0 や 8 ビット以上なのは誤り。
+    ASSERT_EQ("3", hpack::huffmanDecode(unhex("67")));
+    ASSERT_THROW(hpack::huffmanDecode(unhex("64")), hpack::Error);
+    ASSERT_THROW(hpack::huffmanDecode(unhex("6402ff")), hpack::Error);
+}
+
+TEST_F(HPACKFixture, decodeRequests)
+{
+    // C.3: ハフマン符号なしの 3 つの要求。動的表を引き継ぐ。
+    hpack::Decoder d;
+
+    auto h = d.decode(unhex("828684410f7777772e6578616d706c652e636f6d"));
+    ASSERT_EQ(hpack::HeaderList({{":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+                                 {":authority", "www.example.com"}}), h);
+    ASSERT_EQ(57, d.tableSize());
+
+    h = d.decode(unhex("828684be58086e6f2d6361636865"));
+    ASSERT_EQ(hpack::HeaderList({{":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+                                 {":authority", "www.example.com"}, {"cache-control", "no-cache"}}), h);
+    ASSERT_EQ(110, d.tableSize());
+
+    h = d.decode(unhex("828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565"));
+    ASSERT_EQ(hpack::HeaderList({{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"},
+                                 {":authority", "www.example.com"}, {"custom-key", "custom-value"}}), h);
+    ASSERT_EQ(164, d.tableSize());
+    ASSERT_EQ(3, d.numEntries());
+
+    // C.4.1: ハフマン符号つき
+    hpack::Decoder d2;
+    h = d2.decode(unhex("828684418cf1e3c2e5f23a6ba0ab90f4ff"));
+    ASSERT_EQ("www.example.com", h[3].second);
+}
+
+TEST_F(HPACKFixture, tableSizeUpdate)
+{
+    hpack::Decoder d;
+    d.decode(unhex("828684410f7777772e6578616d706c652e636f6d"));
+    ASSERT_EQ(1, d.numEntries());
+
+    // 0 にすると表は空になる。
+    d.decode(unhex("20"));
+    ASSERT_EQ(0, d.numEntries());
+    // 知らせた上限より大きくはできない。
+    ASSERT_THROW(d.decode(unhex("3fe21f")), hpack::Error);
+    // 見出しの後には置けない。
+    ASSERT_THROW(d.decode(unhex("8220")), hpack::Error);
+}
+
+TEST_F(HPACKFixture, invalidBlocks)
+{
+    hpack::Decoder d;
+    ASSERT_THROW(d.decode(unhex("80")), hpack::Error);      // 索引 0
+    ASSERT_THROW(d.decode(unhex("be")), hpack::Error);      // 空の動的表
+    ASSERT_THROW(d.decode(unhex("410f7777")), hpack::Error); // 短すぎる文字列
+    ASSERT_THROW(d.decode(unhex("ff")), hpack::Error);      // 途切れた整数
+}
+
+TEST_F(HPACKFixture, encodeRoundTrip)
+{
+    hpack::HeaderList headers = {
+        {":status", "200"},
+        {":status", "418"},
+        {"content-type", "application/json"},
+        {"x-long-name", std::string(300, 'a')},
+        {"vary", ""},
+    };
+
+    hpack::Encoder e;
+    auto block = e.encode(headers);
+    ASSERT_EQ((char) 0x88, block[0]);   // :status 200 は静的表の 8 番
+
+    hpack::Decoder d;
+    ASSERT_EQ(headers, d.decode(block));
+    ASSERT_EQ(0, d.numEntries());
+}
@@ -0,0 +1,274 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <thread>
+
+#include "http2.h"
+#include "mockclientsocket.h"
+
+class HTTP2ConnectionFixture : public ::testing::Test {
+public:
+    struct Frame
+    {
+        int type;
+        int flags;
+        unsigned int id;
+        std::string payload;
+    };
+
+    static std::string frame(int type, int flags, unsigned int id, const std::string& payload)
+    {
+        std::string f;
+        f += (char) (payload.size() >> 16);
+        f += (char) (payload.size() >> 8);
+        f += (char) payload.size();
+        f += (char) type;
+        f += (char) flags;
+        f += (char) (id >> 24);
+        f += (char) (id >> 16);
+        f += (char) (id >> 8);
+        f += (char) id;
+        return f + payload;
+    }
+
+    static std::vector<Frame> parse(const std::string& data)
+    {
+        std::vector<Frame> frames;
+        size_t pos = 0;
+        while (pos + 9 <= data.size())
+        {
+            auto h = reinterpret_cast<const unsigned char*>(data.data() + pos);
+            Frame f;
+            size_t len = (h[0] << 16) | (h[1] << 8) | h[2];
+            f.type = h[3];
+            f.flags = h[4];
+            f.id = (h[5] << 24) | (h[6] << 16) | (h[7] << 8) | h[8];
+            f.payload = data.substr(pos + 9, len);
+            frames.push_back(f);
+            pos += 9 + len;
+        }
+        return frames;
+    }
+
+    std::string headers(const hpack::HeaderList& list)
+    {
+        return encoder.encode(list);
+    }
+
+    // 要求を順に全部受け取ってから、応答を送らせる。
+    std::vector<Frame> run(const std::string& input)
+    {
+        MockClientSocket sock;
+        sock.incoming.str(std::string("\r\nSM\r\n\r\n") + input);
+        HTTP2Connection conn(sock,
+                             [this](const HTTPRequest& req)
+                             {
+                                 requests.push_back(req);
+                                 if (req.path == "/stream")
+                                     return HTTP2Connection::http11Required();
+                                 auto res = HTTPResponse::ok({{"Content-Type", "text/plain"}, {"Connection", "close"}},
+                                                             req.method + " " + req.path + " " + req.body);
+                                 return res;
+                             },
+                             [](std::function<void()> task)
+                             {
+                                 task();
+                                 return true;
+                             });
+        conn.run();
+        return parse(sock.outgoing.str());
+    }
+
+    hpack::Encoder encoder;
+    std::vector<HTTPRequest> requests;
+};
+
+TEST_F(HTTP2ConnectionFixture, preface)
+{
+    ASSERT_TRUE(HTTP2Connection::isPrefaceLine("PRI * HTTP/2.0"));
+    ASSERT_FALSE(HTTP2Connection::isPrefaceLine("GET / HTTP/1.1"));
+}
+
+TEST_F(HTTP2ConnectionFixture, multiplexedRequests)
+{
+    using C = HTTP2Connection;
+    std::string in;
+    in += frame(C::FRAME_SETTINGS, 0, 0, "");
+    in += frame(C::FRAME_HEADERS, C::FLAG_END_HEADERS | C::FLAG_END_STREAM, 1,
+                headers({{":method", "GET"}, {":scheme", "http"}, {":path", "/api/1"}, {":authority", "localhost"},
+                         {"cookie", "a=1"}, {"cookie", "b=2"}}));
+    // 3 番はヘッダーを CONTINUATION に分け、本体を後から送る。
+    auto block = headers({{":method", "POST"}, {":scheme", "http"}, {":path", "/api/1"}});
+    in += frame(C::FRAME_HEADERS, 0, 3, block.substr(0, 2));
+    in += frame(C::FRAME_CONTINUATION, C::FLAG_END_HEADERS, 3, block.substr(2));
+    in += frame(C::FRAME_DATA, 0, 3, "{\"a\":");
+    in += frame(C::FRAME_DATA, C::FLAG_END_STREAM, 3, "1}");
+    in += frame(C::FRAME_HEADERS, C::FLAG_END_HEADERS | C::FLAG_END_STREAM, 5,
+                headers({{":method", "GET"}, {":scheme", "http"}, {":path", "/stream"}}));
+    in += frame(C::FRAME_PING, 0, 0, "12345678");
+
+    auto frames = run(in);
+
+    ASSERT_EQ(3, requests.size());
+    ASSERT_EQ("localhost", requests[0].headers.get("Host"));
+    ASSERT_EQ("a=1; b=2", requests[0].headers.get("Cookie"));
+    ASSERT_EQ("HTTP/2.0", requests[0].protocolVersion);
+    ASSERT_EQ("POST", requests[1].method);
+    ASSERT_EQ("{\"a\":1}", requests[1].body);
+
+    // 設定、設定の ACK、PING の ACK が先に返る。
+    ASSERT_EQ(C::FRAME_SETTINGS, frames[0].type);
+    ASSERT_EQ(0, frames[0].flags);
+    bool settingsAck = false, pingAck = false, reset = false;
+    std::map<unsigned int, std::string> bodies;
+    std::map<unsigned int, hpack::HeaderList> responseHeaders;
+    hpack::Decoder decoder;
+    for (auto& f : frames)
+    {
+        if (f.type == C::FRAME_SETTINGS && f.flags == C::FLAG_ACK)
+            settingsAck = true;
+        else if (f.type == C::FRAME_PING)
+        {
+            ASSERT_EQ(C::FLAG_ACK, f.flags);
+            ASSERT_EQ("12345678", f.payload);
+            pingAck = true;
+        }else if (f.type == C::FRAME_RST_STREAM)
+        {
+            ASSERT_EQ(5, f.id);
+            ASSERT_EQ((char) C::ERR_HTTP_1_1_REQUIRED, f.payload[3]);
+            reset = true;
+        }else if (f.type == C::FRAME_HEADERS)
+            responseHeaders[f.id] = decoder.decode(f.payload);
+        else if (f.type == C::FRAME_DATA)
+            bodies[f.id] += f.payload;
+    }
+    ASSERT_TRUE(settingsAck);
+    ASSERT_TRUE(pingAck);
+    ASSERT_TRUE(reset);
+
+    ASSERT_EQ("GET /api/1 ", bodies[1]);
+    ASSERT_EQ("POST /api/1 {\"a\":1}", bodies[3]);
+    ASSERT_EQ(0, bodies.count(5));
+
+    // 接続についてのヘッダーは落とし、長さを付ける。
+    auto& h = responseHeaders[3];
+    ASSERT_EQ(hpack::Header(":status", "200"), h[0]);
+    ASSERT_EQ(0, std::count_if(h.begin(), h.end(), [](const hpack::Header& x) { return x.first == "connection"; }));
+    ASSERT_EQ(1, std::count(h.begin(), h.end(), hpack::Header("content-length", "19")));
+}
+
+TEST_F(HTTP2ConnectionFixture, flowControl)
+{
+    using C = HTTP2Connection;
+    std::string in;
+    // 送信ウィンドウを 4 バイトにして始める。
+    std::string settings = std::string("\x00\x04\x00\x00\x00\x04", 6);
+    in += frame(C::FRAME_SETTINGS, 0, 0, settings);
+    in += frame(C::FRAME_HEADERS, C::FLAG_END_HEADERS | C::FLAG_END_STREAM, 1,
+                headers({{":method", "GET"}, {":scheme", "http"}, {":path", "/x"}}));
+
+    auto frames = run(in);
+
+    std::string body;
+    for (auto& f : frames)
+        if (f.type == C::FRAME_DATA)
+            body += f.payload;
+    // ウィンドウの分だけ送って待つ。
+    ASSERT_EQ("GET ", body);
+}
+
+TEST_F(HTTP2ConnectionFixture, protocolErrors)
+{
+    using C = HTTP2Connection;
+
+    // 偶数のストリームはクライアントからは開けない。
+    auto frames = run(frame(C::FRAME_HEADERS, C::FLAG_END_HEADERS | C::FLAG_END_STREAM, 2,
+                            headers({{":method", "GET"}, {":path", "/"}})));
+    ASSERT_EQ(C::FRAME_GOAWAY, frames.back().type);
+    ASSERT_EQ((char) C::ERR_PROTOCOL, frames.back().payload[7]);
+    ASSERT_EQ(0, requests.size());
+
+    // 壊れたヘッダーブロック
+    frames = run(frame(C::FRAME_HEADERS, C::FLAG_END_HEADERS | C::FLAG_END_STREAM, 1, "\x80"));
+    ASSERT_EQ(C::FRAME_GOAWAY, frames.back().type);
+    ASSERT_EQ((char) C::ERR_COMPRESSION, frames.back().payload[7]);
+}
+
+// HEADERS と RST_STREAM を繰り返されても、ワーカープールに積む要求は増
+// え続けない。
+TEST_F(HTTP2ConnectionFixture, rapidReset)
+{
+    using C = HTTP2Connection;
+    std::string in;
+    for (unsigned int id = 1; id < 2000; id += 2)
+    {
+        in += frame(C::FRAME_HEADERS, C::FLAG_END_HEADERS | C::FLAG_END_STREAM, id,
+                    headers({{":method", "GET"}, {":scheme", "http"}, {":path", "/"}}));
+        in += frame(C::FRAME_RST_STREAM, 0, id, std::string("\x00\x00\x00\x08", 4));
+    }
+
+    // 要求はゆっくり片付く。
+    std::mutex lock;
+    std::deque<std::function<void()>> queue;
+    int submitted = 0, inFlight = 0, maxInFlight = 0;
+    std::atomic<bool> done(false);
+    std::thread worker([&]()
+                       {
+                           while (true)
+                           {
+                               std::function<void()> task;
+                               {
+                                   std::lock_guard<std::mutex> cs(lock);
+                                   if (!queue.empty())
+                                   {
+                                       task = queue.front();
+                                       queue.pop_front();
+                                   }
+                               }
+                               if (task)
+                               {
+                                   std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                                   task();
+                                   std::lock_guard<std::mutex> cs(lock);
+                                   inFlight--;
+                               }else if (done)
+                                   break;
+                               else
+                                   std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                           }
+                       });
+
+    MockClientSocket sock;
+    sock.incoming.str(std::string("\r\nSM\r\n\r\n") + in);
+    HTTP2Connection conn(sock,
+                         [](const HTTPRequest& req)
+                         {
+                             return HTTPResponse::ok({{"Content-Type", "text/plain"}}, "ok");
+                         },
+                         [&](std::function<void()> task)
+                         {
+                             std::lock_guard<std::mutex> cs(lock);
+                             queue.push_back(task);
+                             submitted++;
+                             maxInFlight = std::max(maxInFlight, ++inFlight);
+                             return true;
+                         });
+    conn.run();
+    done = true;
+    worker.join();
+
+    ASSERT_LE(maxInFlight, (int) C::MAX_STREAMS);
+    ASSERT_LE(submitted, (int) C::MAX_RESETS + 1);
+
+    auto frames = parse(sock.outgoing.str());
+    int refused = 0;
+    for (auto& f : frames)
+        if (f.type == C::FRAME_RST_STREAM && f.payload[3] == (char) C::ERR_REFUSED_STREAM)
+            refused++;
+    ASSERT_GT(refused, 0);
+    ASSERT_EQ(C::FRAME_GOAWAY, frames.back().type);
+    ASSERT_EQ((char) C::ERR_ENHANCE_YOUR_CALM, frames.back().payload[7]);
+}
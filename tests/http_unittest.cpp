@@ -76,6 +76,48 @@ TEST_F(HTTPFixture, nextHeader)
     ASSERT_STREQ("close", http.headers.get("Connection").c_str());
 }
 
+TEST_F(HTTPFixture, readHeaders)
+{
+    mem.str("GET /index.html HTTP/1.0\r\n"
+        "Host: localhost\r\n"
+        "Content-Length: 4\r\n"
+        "\r\n"
+        "body");
+
+    http.readRequest();
+    http.readHeaders();
+    ASSERT_EQ(2, http.headers.size());
+    ASSERT_EQ("localhost", http.headers.get("Host"));
+    ASSERT_EQ("4", http.headers.get("Content-Length"));
+    ASSERT_EQ(NULL, http.arg);
+
+    // 本体は読まずに残す。
+    char buf[5] = {};
+    mem.read(buf, 4);
+    ASSERT_STREQ("body", buf);
+
+    // 二度目は何もしない。
+    http.readHeaders();
+    ASSERT_EQ(2, http.headers.size());
+}
+
+TEST_F(HTTPFixture, readHeadersTooLarge)
+{
+    mem.str("GET / HTTP/1.0\r\n"
+            "X-Long: " + std::string(10000, 'a') + "\r\n"
+            "\r\n");
+
+    http.readRequest();
+    try
+    {
+        http.readHeaders();
+        FAIL() << "HTTPException expected";
+    } catch (HTTPException& e)
+    {
+        ASSERT_EQ(431, e.code);
+    }
+}
+
 TEST_F(HTTPFixture, isHeader)
 {
     mem.str("GET /index.html HTTP/1.0\r\n"
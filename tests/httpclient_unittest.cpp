@@ -0,0 +1,237 @@
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "httpclient.h"
+#include "sstream.h"
+#include "mocksys.h"
+#include "mockclientsocket.h"
+
+class HTTPClientFixture : public ::testing::Test {
+};
+
+TEST_F(HTTPClientFixture, readResponseContentLength)
+{
+    StringStream s("HTTP/1.1 200 OK\r\n"
+                   "Content-Length: 5\r\n"
+                   "\r\n"
+                   "helloHTTP/1.1");
+    bool keepAlive = false;
+    auto res = HTTPClient::readResponse(s, keepAlive);
+    ASSERT_EQ(200, res.statusCode);
+    ASSERT_EQ("hello", res.body);
+    ASSERT_TRUE(keepAlive);
+    // 次の応答の頭は残っている。
+    ASSERT_EQ(5 + 38, s.getPosition());
+}
+
+TEST_F(HTTPClientFixture, readResponseChunked)
+{
+    StringStream s("HTTP/1.1 200 OK\r\n"
+                   "Transfer-Encoding: chunked\r\n"
+                   "\r\n"
+                   "5;name=value\r\n"
+                   "hello\r\n"
+                   "6\r\n"
+                   " world\r\n"
+                   "0\r\n"
+                   "X-Trailer: 1\r\n"
+                   "\r\n");
+    bool keepAlive = false;
+    auto res = HTTPClient::readResponse(s, keepAlive);
+    ASSERT_EQ("hello world", res.body);
+    ASSERT_TRUE(keepAlive);
+    ASSERT_TRUE(s.eof());
+}
+
+TEST_F(HTTPClientFixture, readResponseConnectionClose)
+{
+    StringStream s("HTTP/1.1 200 OK\r\n"
+                   "Connection: close\r\n"
+                   "Content-Length: 2\r\n"
+                   "\r\n"
+                   "ok");
+    bool keepAlive = true;
+    HTTPClient::readResponse(s, keepAlive);
+    ASSERT_FALSE(keepAlive);
+}
+
+TEST_F(HTTPClientFixture, readResponseHTTP10)
+{
+    StringStream s1("HTTP/1.0 200 OK\r\n"
+                    "Content-Length: 2\r\n"
+                    "\r\n"
+                    "ok");
+    bool keepAlive = true;
+    HTTPClient::readResponse(s1, keepAlive);
+    ASSERT_FALSE(keepAlive);
+
+    StringStream s2("HTTP/1.0 200 OK\r\n"
+                    "Connection: Keep-Alive\r\n"
+                    "Content-Length: 2\r\n"
+                    "\r\n"
+                    "ok");
+    HTTPClient::readResponse(s2, keepAlive);
+    ASSERT_TRUE(keepAlive);
+}
+
+TEST_F(HTTPClientFixture, readResponseUntilClose)
+{
+    StringStream s("HTTP/1.1 200 OK\r\n"
+                   "\r\n"
+                   "all the rest");
+    bool keepAlive = true;
+    auto res = HTTPClient::readResponse(s, keepAlive);
+    ASSERT_EQ("all the rest", res.body);
+    ASSERT_FALSE(keepAlive);
+}
+
+TEST_F(HTTPClientFixture, readResponseNotModified)
+{
+    StringStream s("HTTP/1.1 100 Continue\r\n"
+                   "\r\n"
+                   "HTTP/1.1 304 Not Modified\r\n"
+                   "ETag: \"x\"\r\n"
+                   "\r\n");
+    bool keepAlive = false;
+    auto res = HTTPClient::readResponse(s, keepAlive);
+    ASSERT_EQ(304, res.statusCode);
+    ASSERT_EQ("\"x\"", res.headers.get("ETag"));
+    ASSERT_EQ("", res.body);
+    ASSERT_TRUE(keepAlive);
+}
+
+TEST_F(HTTPClientFixture, decodeIdentity)
+{
+    ASSERT_EQ("abc", HTTPClient::decode("abc", ""));
+    ASSERT_EQ("abc", HTTPClient::decode("abc", "identity"));
+    ASSERT_THROW(HTTPClient::decode("abc", "br"), StreamException);
+}
+
+#ifdef HAVE_ZLIB
+static std::string compress(const std::string& in, int windowBits)
+{
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&z, in.size()), '\0');
+    z.next_in = (Bytef*) in.data();
+    z.avail_in = in.size();
+    z.next_out = (Bytef*) &out[0];
+    z.avail_out = out.size();
+    deflate(&z, Z_FINISH);
+    out.resize(z.total_out);
+    deflateEnd(&z);
+    return out;
+}
+
+TEST_F(HTTPClientFixture, decodeCompressed)
+{
+    std::string text;
+    for (int i = 0; i < 1000; i++)
+        text += "name<>id<>127.0.0.1:7144<>\n";
+
+    ASSERT_EQ(text, HTTPClient::decode(compress(text, 15 + 16), "gzip"));
+    ASSERT_EQ(text, HTTPClient::decode(compress(text, 15), "deflate"));
+    ASSERT_EQ(text, HTTPClient::decode(compress(text, -15), "deflate"));
+
+    auto truncated = compress(text, 15 + 16);
+    truncated.resize(truncated.size() / 2);
+    ASSERT_THROW(HTTPClient::decode(truncated, "gzip"), StreamException);
+
+    ASSERT_EQ("gzip, deflate", HTTPClient::acceptEncoding());
+}
+#endif
+
+namespace
+{
+    class PooledSocket : public MockClientSocket
+    {
+    public:
+        // 相手が閉じたかどうかは closed で決める。
+        bool readReady(int) override { return closed; }
+        bool closed = false;
+    };
+
+    class SocketSys : public MockSys
+    {
+    public:
+        std::shared_ptr<ClientSocket> createSocket() override
+        {
+            auto sock = std::make_shared<PooledSocket>();
+            sock->incoming.str(nextResponse);
+            sockets.push_back(sock);
+            return sock;
+        }
+
+        std::string nextResponse;
+        std::vector<std::shared_ptr<PooledSocket>> sockets;
+    };
+}
+
+TEST_F(HTTPClientFixture, reusesConnections)
+{
+    SocketSys ssys;
+    auto tmp = sys;
+    sys = &ssys;
+
+    HTTPClient client;
+    ssys.nextResponse = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\none";
+    auto res = client.get("http://127.0.0.1:7144/index.txt");
+    ASSERT_EQ("one", res.body);
+    ASSERT_EQ(1, ssys.sockets.size());
+    ASSERT_EQ(1, client.numIdle());
+
+    auto req = ssys.sockets[0]->outgoing.str();
+    ASSERT_EQ(0, req.find("GET /index.txt HTTP/1.1\r\n"));
+    ASSERT_NE(std::string::npos, req.find("Host: 127.0.0.1:7144\r\n"));
+    ASSERT_NE(std::string::npos, req.find("Connection: keep-alive\r\n"));
+
+    // 二つ目は同じ接続で。
+    ssys.sockets[0]->incoming.str("HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 3\r\n\r\ntwo");
+    res = client.get("http://127.0.0.1:7144/index.txt?host=localhost");
+    ASSERT_EQ("two", res.body);
+    ASSERT_EQ(1, ssys.sockets.size());
+    ASSERT_NE(std::string::npos, ssys.sockets[0]->outgoing.str().find("GET /index.txt?host=localhost HTTP/1.1\r\n"));
+
+    // Connection: close だったのでプールには戻さない。
+    ASSERT_EQ(0, client.numIdle());
+
+    sys = tmp;
+}
+
+TEST_F(HTTPClientFixture, retriesStaleConnection)
+{
+    SocketSys ssys;
+    auto tmp = sys;
+    sys = &ssys;
+
+    HTTPClient client;
+    ssys.nextResponse = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\none";
+    client.get("http://127.0.0.1:7144/");
+    ASSERT_EQ(1, client.numIdle());
+
+    // プールにある接続は応答を返さずに閉じられる。閉じたと分からなく
+    // ても、新しい接続でやり直す。
+    ssys.nextResponse = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\ntwo";
+    auto res = client.get("http://127.0.0.1:7144/");
+    ASSERT_EQ("two", res.body);
+    ASSERT_EQ(2, ssys.sockets.size());
+    ASSERT_EQ(1, client.numIdle());
+
+    // 閉じたと分かっている接続は使わない。
+    ssys.sockets[1]->closed = true;
+    client.get("http://127.0.0.1:7144/");
+    ASSERT_EQ(3, ssys.sockets.size());
+
+    // 古くなった接続は閉じる。
+    ssys.time += HTTPClient::IDLE_TIMEOUT;
+    client.closeIdle(sys->getTime());
+    ASSERT_EQ(0, client.numIdle());
+
+    sys = tmp;
+}
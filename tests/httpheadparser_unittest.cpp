@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include "httpparser.h"
+
+class HTTPHeadParserFixture : public ::testing::Test {
+public:
+    HTTPHeadParser parser;
+};
+
+TEST_F(HTTPHeadParserFixture, initialState)
+{
+    ASSERT_EQ(HTTPHeadParser::S_INCOMPLETE, parser.state());
+    ASSERT_EQ(nullptr, parser.error());
+    ASSERT_EQ(0, parser.numFields());
+    ASSERT_TRUE(parser.startLine().empty());
+}
+
+TEST_F(HTTPHeadParserFixture, request)
+{
+    const char* head =
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: localhost:7144\r\n"
+        "User-Agent:  Mozilla/5.0 (X11)  \r\n"
+        "\r\n";
+    ASSERT_EQ(strlen(head), parser.feed(head, strlen(head)));
+    ASSERT_EQ(HTTPHeadParser::S_DONE, parser.state());
+
+    ASSERT_TRUE(parser.startLine().equals("GET /index.html HTTP/1.1"));
+    ASSERT_TRUE(parser.startLinePart(0).equals("GET"));
+    ASSERT_TRUE(parser.startLinePart(1).equals("/index.html"));
+    ASSERT_TRUE(parser.startLinePart(2).equals("HTTP/1.1"));
+
+    ASSERT_EQ(2, parser.numFields());
+    ASSERT_EQ("Host", parser.field(0).name.str());
+    ASSERT_EQ("localhost:7144", parser.field(0).value.str());
+    ASSERT_EQ("Mozilla/5.0 (X11)", parser.get("user-agent").str());
+    ASSERT_TRUE(parser.get("Accept").empty());
+}
+
+TEST_F(HTTPHeadParserFixture, responseReason)
+{
+    const char* head = "HTTP/1.0 404 Not Found\n\n";
+    parser.feed(head, strlen(head));
+    ASSERT_EQ(HTTPHeadParser::S_DONE, parser.state());
+    ASSERT_TRUE(parser.startLinePart(1).equals("404"));
+    ASSERT_TRUE(parser.startLinePart(2).equals("Not Found"));
+}
+
+TEST_F(HTTPHeadParserFixture, stopsAtEndOfHead)
+{
+    std::string data = "GET / HTTP/1.0\r\nContent-Length: 4\r\n\r\nbody";
+
+    // 一バイトずつ与えても、空行の後は使わない。
+    size_t used = 0;
+    while (parser.state() == HTTPHeadParser::S_INCOMPLETE)
+        used += parser.feed(data.data() + used, 1);
+
+    ASSERT_EQ(HTTPHeadParser::S_DONE, parser.state());
+    ASSERT_EQ("body", data.substr(used));
+    ASSERT_EQ("4", parser.get("Content-Length").str());
+
+    // まとめて与えても同じところで止まる。
+    parser.reset();
+    ASSERT_EQ(data.size() - 4, parser.feed(data.data(), data.size()));
+    ASSERT_EQ(HTTPHeadParser::S_DONE, parser.state());
+}
+
+TEST_F(HTTPHeadParserFixture, headersOnly)
+{
+    HTTPHeadParser p(false);
+    const char* head = "icy-name: test\r\n\r\n";
+    p.feed(head, strlen(head));
+    ASSERT_EQ(HTTPHeadParser::S_DONE, p.state());
+    ASSERT_TRUE(p.startLine().empty());
+    ASSERT_EQ("test", p.get("ICY-NAME").str());
+}
+
+TEST_F(HTTPHeadParserFixture, skipsMalformedLines)
+{
+    const char* head =
+        "GET / HTTP/1.0\r\n"
+        "no colon here\r\n"
+        ": no name\r\n"
+        "Bad Name: x\r\n"
+        " folded continuation\r\n"
+        "Good: y\r\n"
+        "\r\n";
+    parser.feed(head, strlen(head));
+    ASSERT_EQ(HTTPHeadParser::S_DONE, parser.state());
+    ASSERT_EQ(1, parser.numFields());
+    ASSERT_EQ("y", parser.get("good").str());
+}
+
+TEST_F(HTTPHeadParserFixture, emptyStartLine)
+{
+    parser.feed("\r\n", 2);
+    ASSERT_EQ(HTTPHeadParser::S_ERROR, parser.state());
+    ASSERT_FALSE(parser.tooLarge());
+}
+
+TEST_F(HTTPHeadParserFixture, headTooLarge)
+{
+    std::string data = "GET / HTTP/1.0\r\nX-Long: " + std::string(HTTPHeadParser::MAX_HEAD_SIZE, 'a') + "\r\n\r\n";
+    size_t used = parser.feed(data.data(), data.size());
+    ASSERT_EQ(HTTPHeadParser::S_ERROR, parser.state());
+    ASSERT_TRUE(parser.tooLarge());
+    ASSERT_EQ((size_t) HTTPHeadParser::MAX_HEAD_SIZE, used);
+}
+
+TEST_F(HTTPHeadParserFixture, tooManyFields)
+{
+    std::string data = "GET / HTTP/1.0\r\n";
+    for (int i = 0; i <= HTTPHeadParser::MAX_FIELDS; i++)
+        data += "X-" + std::to_string(i) + ": v\r\n";
+    data += "\r\n";
+    parser.feed(data.data(), data.size());
+    ASSERT_EQ(HTTPHeadParser::S_ERROR, parser.state());
+    ASSERT_TRUE(parser.tooLarge());
+}
+
+TEST_F(HTTPHeadParserFixture, parseField)
+{
+    HTTPHeadParser::Field f;
+    const char* line = "Content-Type:text/html \t";
+    ASSERT_TRUE(HTTPHeadParser::parseField(line, strlen(line), f));
+    ASSERT_EQ("Content-Type", f.name.str());
+    ASSERT_EQ("text/html", f.value.str());
+
+    line = "Empty:";
+    ASSERT_TRUE(HTTPHeadParser::parseField(line, strlen(line), f));
+    ASSERT_TRUE(f.value.empty());
+
+    line = "nocolon";
+    ASSERT_FALSE(HTTPHeadParser::parseField(line, strlen(line), f));
+}
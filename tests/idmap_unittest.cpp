@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+
+#include "idmap.h"
+
+TEST(ShardedIDMapTest, insertFindErase)
+{
+    ShardedIDMap<int> map;
+    GnuID a("00112233445566778899aabbccddeeff");
+    GnuID b("ffeeddccbbaa99887766554433221100");
+    auto pa = std::make_shared<int>(1);
+    auto pb = std::make_shared<int>(2);
+
+    ASSERT_EQ(nullptr, map.find(a));
+    map.insert(a, pa);
+    map.insert(b, pb);
+    ASSERT_EQ(pa, map.find(a));
+    ASSERT_EQ(pb, map.find(b));
+    ASSERT_EQ(2, map.size());
+
+    // 別の要素を指定した erase は何もしない。
+    map.erase(a, pb);
+    ASSERT_EQ(pa, map.find(a));
+
+    map.erase(a, pa);
+    ASSERT_EQ(nullptr, map.find(a));
+    ASSERT_EQ(1, map.size());
+
+    map.clear();
+    ASSERT_EQ(0, map.size());
+}
+
+TEST(ShardedIDMapTest, insertReplaces)
+{
+    ShardedIDMap<int> map;
+    GnuID a("00112233445566778899aabbccddeeff");
+    auto p1 = std::make_shared<int>(1);
+    auto p2 = std::make_shared<int>(2);
+
+    map.insert(a, p1);
+    map.insert(a, p2);
+    ASSERT_EQ(p2, map.find(a));
+    ASSERT_EQ(1, map.size());
+
+    // 置き換わった古い要素を外そうとしても新しいほうは残る。
+    map.erase(a, p1);
+    ASSERT_EQ(p2, map.find(a));
+}
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include "jrpc.h"
+#include "mocksys.h"
 
 using json = nlohmann::json;
 
@@ -59,6 +60,36 @@ TEST_F(JrpcApiFixture, getStatus)
     ASSERT_EQ(expected.dump(), result.dump());
 }
 
+TEST_F(JrpcApiFixture, getLatencyHistograms)
+{
+    json result = api.getLatencyHistograms(json::array());
+
+    ASSERT_TRUE(result.count("packetAge"));
+    ASSERT_TRUE(result.count("streamHandshake"));
+    auto& h = result["packetAge"];
+    ASSERT_EQ(h["bounds"].size() + 1, h["counts"].size());
+    ASSERT_TRUE(h["p99"].is_number());
+}
+
+TEST_F(JrpcApiFixture, getLockProfile)
+{
+    json result = api.getLockProfile(json::array());
+
+    ASSERT_TRUE(result["available"].is_boolean());
+    ASSERT_FALSE(result["enabled"].get<bool>());
+    ASSERT_TRUE(result["locks"].is_array());
+
+    ASSERT_TRUE(api.resetLockProfile(json::array()).is_null());
+}
+
+TEST_F(JrpcApiFixture, getThreadStats)
+{
+    json result = api.getThreadStats(json::array());
+
+    ASSERT_TRUE(result["allocationCounting"].is_boolean());
+    ASSERT_TRUE(result["threads"].is_array());
+}
+
 TEST_F(JrpcApiFixture, getChannelRelayTree)
 {
     ASSERT_THROW(api.getChannelRelayTree({"hoge"}), JrpcApi::application_error);
@@ -130,6 +161,28 @@ TEST_F(JrpcApiFixture, call_noIdKey)
     ASSERT_TRUE(str::contains(res, "Invalid Request"));
 }
 
+TEST_F(JrpcApiFixture, call_batch)
+{
+    auto res = api.call("[{\"jsonrpc\": \"2.0\", \"method\": \"getNewVersions\", \"id\": 1},"
+                        " {\"jsonrpc\": \"2.0\", \"method\": \"nonexistentMethod\", \"id\": 2},"
+                        " \"hoge\"]");
+    json r = json::parse(res);
+    ASSERT_TRUE(r.is_array());
+    ASSERT_EQ(3, r.size());
+    ASSERT_EQ(1, r[0]["id"]);
+    ASSERT_TRUE(json::array() == r[0]["result"]);
+    ASSERT_EQ(2, r[1]["id"]);
+    ASSERT_EQ(-32601, r[1]["error"]["code"].get<int>());
+    ASSERT_EQ(-32600, r[2]["error"]["code"].get<int>());
+}
+
+TEST_F(JrpcApiFixture, call_emptyBatch)
+{
+    json r = json::parse(api.call("[]"));
+    ASSERT_TRUE(r.is_object());
+    ASSERT_EQ(-32600, r["error"]["code"].get<int>());
+}
+
 TEST_F(JrpcApiFixture, call_methodNotAvailable)
 {
     auto res = api.call("{\"jsonrpc\": \"2.0\", \"method\": \"nonexistentMethod\", \"id\": 1234}");
@@ -221,3 +274,125 @@ TEST_F(JrpcApiFixture, getYellowPages_whenYpIsNonEmpty)
     delete servMgr;
     servMgr = back;
 }
+
+TEST_F(JrpcApiFixture, getChannelsIsServedFromSnapshot)
+{
+    auto oldChanMgr = chanMgr;
+    chanMgr = new ChanMgr();
+    auto msys = static_cast<MockSys*>(sys);
+    msys->dtime = 100.0;
+    JrpcApi::clearSnapshots();
+
+    const std::string request = "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"getChannels\"}";
+    ASSERT_EQ("{\"id\":1,\"jsonrpc\":\"2.0\",\"result\":[]}", api.call(request));
+
+    ChanInfo info;
+    info.id = "00112233445566778899aabbccddeeff";
+    info.name = "test";
+    auto c = chanMgr->createChannel(info);
+
+    // 間隔の間は前の結果を返す。
+    json r = json::parse(api.call(request));
+    ASSERT_EQ(0, r["result"].size());
+
+    msys->dtime += servMgr->jrpcSnapshotInterval / 1000.0;
+    r = json::parse(api.call(request));
+    ASSERT_EQ(1, r["result"].size());
+    ASSERT_EQ(1, r["id"]);
+
+    // 状態を変えるメソッドの後は作り直す。
+    chanMgr->deleteChannel(c);
+    api.call("{\"jsonrpc\":\"2.0\",\"id\":2,\"method\":\"stopChannel\",\"params\":[\"00112233445566778899aabbccddeeff\"]}");
+    r = json::parse(api.call(request));
+    ASSERT_EQ(0, r["result"].size());
+
+    JrpcApi::clearSnapshots();
+    msys->dtime = 0.0;
+    delete chanMgr;
+    chanMgr = oldChanMgr;
+}
+
+TEST_F(JrpcApiFixture, writerMethodsMatchDump)
+{
+    auto oldChanMgr = chanMgr;
+    chanMgr = new ChanMgr();
+
+    ChanInfo info;
+    info.id = "00112233445566778899aabbccddeeff";
+    info.name = "テスト \"quoted\"\n";
+    info.genre = "genre";
+    info.bitrate = 500;
+    info.track.artist = "artist";
+    auto c = chanMgr->createChannel(info);
+
+    for (auto& pair : api.m_writerMethods)
+    {
+        json params = json::array();
+        if (pair.first == "getChannelConnections")
+            params.push_back("00112233445566778899aabbccddeeff");
+        ASSERT_EQ(api.dispatch(pair.first, params).dump(), api.render(pair.first, params)) << pair.first;
+    }
+
+    // 引数の扱いも dispatch と同じ。
+    ASSERT_THROW(api.render("getChannelConnections", json::array()), JrpcApi::invalid_params);
+    ASSERT_THROW(api.render("getChannelConnections", json::array({ "ffffffffffffffffffffffffffffffff" })), JrpcApi::application_error);
+
+    chanMgr->deleteChannel(c);
+    delete chanMgr;
+    chanMgr = oldChanMgr;
+}
+
+TEST_F(JrpcApiFixture, getConnections)
+{
+    GnuID a("00112233445566778899aabbccddeeff");
+    GnuID b("ffeeddccbbaa99887766554433221100");
+    std::vector<Servent*> servents;
+    auto add = [&](Servent::TYPE type, Servent::STATUS status, const GnuID& id)
+               {
+                   auto s = servMgr->allocServent();
+                   s->type = type;
+                   s->status = status;
+                   s->chanID = id;
+                   servents.push_back(s);
+                   return s;
+               };
+    add(Servent::T_RELAY, Servent::S_CONNECTED, a);
+    add(Servent::T_RELAY, Servent::S_CONNECTED, a);
+    add(Servent::T_DIRECT, Servent::S_CONNECTED, a);
+    add(Servent::T_RELAY, Servent::S_CONNECTING, b);
+
+    auto call = [&](json params)
+                {
+                    return api.dispatch("getConnections", params);
+                };
+
+    json r = call({ a.str(), nullptr, nullptr, nullptr, nullptr, nullptr });
+    ASSERT_EQ(3, r["total"]);
+    ASSERT_EQ(3, r["connections"].size());
+
+    r = call({ { "type", "relay" }, { "limit", 1 }, { "offset", 1 } });
+    ASSERT_EQ(3, r["total"]);
+    ASSERT_EQ(1, r["connections"].size());
+    ASSERT_EQ("relay", r["connections"][0]["type"]);
+
+    r = call({ { "type", "relay" }, { "status", "CONNECTING" } });
+    ASSERT_EQ(1, r["total"]);
+    ASSERT_EQ(b.str(), r["connections"][0]["channelId"]);
+
+    // 集計だけ。
+    r = call({ { "channelId", a.str() }, { "summary", true } });
+    ASSERT_EQ(3, r["total"]);
+    ASSERT_EQ(2, r["types"]["relay"]);
+    ASSERT_EQ(1, r["types"]["direct"]);
+    ASSERT_EQ(3, r["statuses"]["CONNECTED"]);
+    ASSERT_TRUE(r.find("connections") == r.end());
+
+    ASSERT_THROW(call({ { "limit", -1 } }), JrpcApi::invalid_params);
+
+    for (auto s : servents)
+    {
+        s->type = Servent::T_NONE;
+        s->status = Servent::S_FREE;
+        s->chanID.clear();
+    }
+}
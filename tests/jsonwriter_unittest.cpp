@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+
+#include "jsonwriter.h"
+
+using json = nlohmann::json;
+
+class JsonWriterFixture : public ::testing::Test {
+public:
+    JsonWriterFixture()
+        : w(out)
+    {
+    }
+
+    std::string out;
+    JsonWriter w;
+};
+
+TEST_F(JsonWriterFixture, nested)
+{
+    w.beginObject()
+        .member("a", 1)
+        .member("b", "x");
+    w.key("c").beginArray()
+        .value(true)
+        .value(nullptr)
+        .beginObject().endObject()
+        .beginArray().endArray()
+        .endArray();
+    w.endObject();
+
+    ASSERT_TRUE(w.done());
+    ASSERT_EQ("{\"a\":1,\"b\":\"x\",\"c\":[true,null,{},[]]}", out);
+}
+
+TEST_F(JsonWriterFixture, scalarsMatchDump)
+{
+    w.beginArray()
+        .value(-1)
+        .value(4294967295u)
+        .value(0.0)
+        .value(0.1)
+        .value(1e300)
+        .endArray();
+
+    ASSERT_EQ(json({ -1, 4294967295u, 0.0, 0.1, 1e300 }).dump(), out);
+}
+
+TEST_F(JsonWriterFixture, stringsMatchDump)
+{
+    std::string s = "\"\\/\b\f\n\r\t";
+    s += '\x01';
+    s += '\x1f';
+    s += '\x7f';
+    s += "日本語";
+
+    w.value(s);
+    ASSERT_EQ(json(s).dump(), out);
+}
+
+TEST_F(JsonWriterFixture, invalidUTF8)
+{
+    ASSERT_THROW(w.value("\xff"), std::invalid_argument);
+}
+
+TEST_F(JsonWriterFixture, embedJson)
+{
+    w.beginArray().value(json({ {"b", 2}, {"a", 1} })).value(1).endArray();
+    ASSERT_EQ("[{\"a\":1,\"b\":2},1]", out);
+}
@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+
+#include "landisco.h"
+#include "str.h"
+
+class LANDiscoveryFixture : public ::testing::Test {
+public:
+    static ChanHit hit(int n, const IP& wan)
+    {
+        ChanHit h;
+        h.sessionID = GnuID("00112233445566778899aabbccddeeff");
+        h.chanID = GnuID(str::format("%032x", n));
+        h.rhost[0] = Host(wan, wan ? 7144 : 0);
+        h.rhost[1] = Host(IP::parse("192.168.0.2"), 7144);
+        h.numListeners = n;
+        h.relay = true;
+        h.recv = true;
+        return h;
+    }
+
+    IP lan = IP::parse("192.168.0.10");
+    IP wan = IP::parse("203.0.113.1");
+};
+
+TEST_F(LANDiscoveryFixture, roundTrip)
+{
+    std::vector<ChanHit> hits = { hit(1, wan), hit(2, wan) };
+    auto datagrams = LANDiscovery::encode(hits);
+    ASSERT_EQ(1, datagrams.size());
+
+    auto got = LANDiscovery::decode(datagrams[0], lan, wan);
+    ASSERT_EQ(2, got.size());
+    ASSERT_TRUE(got[0].chanID.isSame(hits[0].chanID));
+    ASSERT_TRUE(got[1].chanID.isSame(hits[1].chanID));
+    ASSERT_TRUE(got[0].sessionID.isSame(hits[0].sessionID));
+    ASSERT_EQ(2, got[1].numListeners);
+    ASSERT_TRUE(got[0].relay);
+    ASSERT_TRUE(got[0].recv);
+    ASSERT_EQ(1, got[0].numHops);
+
+    // LAN のアドレスは送り元のものにする。
+    ASSERT_EQ("192.168.0.10:7144", got[0].rhost[1].str());
+    ASSERT_EQ("203.0.113.1:7144", got[0].rhost[0].str());
+    ASSERT_EQ(got[0].rhost[1], got[0].host);
+}
+
+TEST_F(LANDiscoveryFixture, splitIntoDatagrams)
+{
+    std::vector<ChanHit> hits;
+    for (int i = 1; i <= 40; i++)
+        hits.push_back(hit(i, wan));
+
+    auto datagrams = LANDiscovery::encode(hits);
+    ASSERT_LT(1, datagrams.size());
+
+    size_t total = 0;
+    for (auto& d : datagrams)
+    {
+        ASSERT_GE((size_t) LANDiscovery::MAX_DATAGRAM, d.size());
+        total += LANDiscovery::decode(d, lan, wan).size();
+    }
+    ASSERT_EQ(40, total);
+}
+
+TEST_F(LANDiscoveryFixture, unknownWANAddress)
+{
+    std::vector<ChanHit> hits = { hit(1, IP()) };
+    auto datagrams = LANDiscovery::encode(hits);
+
+    // 受け手の WAN のアドレスを使うが、外からは繋がるか分からない。
+    auto got = LANDiscovery::decode(datagrams[0], lan, wan);
+    ASSERT_EQ(1, got.size());
+    ASSERT_EQ("203.0.113.1", got[0].rhost[0].ip.str());
+    ASSERT_TRUE(got[0].firewalled);
+
+    // 受け手も知らなければ LAN のアドレスだけ。
+    got = LANDiscovery::decode(datagrams[0], lan, IP());
+    ASSERT_EQ(1, got.size());
+    ASSERT_EQ(got[0].rhost[1], got[0].rhost[0]);
+}
+
+TEST_F(LANDiscoveryFixture, rejectsGarbage)
+{
+    ASSERT_EQ(0, LANDiscovery::decode("", lan, wan).size());
+    ASSERT_EQ(0, LANDiscovery::decode("hello, world", lan, wan).size());
+
+    std::vector<ChanHit> hits = { hit(1, wan) };
+    auto d = LANDiscovery::encode(hits)[0];
+    ASSERT_EQ(0, LANDiscovery::decode(d.substr(0, d.size() - 3), lan, wan).size());
+}
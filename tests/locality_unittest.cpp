@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+
+#include "locality.h"
+#include "chanhit.h"
+
+class LocalityFixture : public ::testing::Test {
+};
+
+TEST_F(LocalityFixture, longestPrefixWins)
+{
+    Locality loc;
+    ASSERT_EQ(4, loc.load(
+                  "# コメント\n"
+                  "203.0.113.0/24 AS64500\n"
+                  "203.0.113.128/25 AS64501  # 一部だけ別\n"
+                  "198.51.100.0/24\n"       // ラベルが無い
+                  "2001:db8::/32 tokyo\n"
+                  "10.0.0.0/8 lan\n"
+                  "bogus/8 x\n"));
+
+    ASSERT_EQ("AS64500", loc.regionOf(IP::parse("203.0.113.5")));
+    ASSERT_EQ("AS64501", loc.regionOf(IP::parse("203.0.113.200")));
+    ASSERT_EQ("tokyo", loc.regionOf(IP::parse("2001:db8:1::1")));
+    ASSERT_EQ("", loc.regionOf(IP::parse("198.51.100.1")));
+    ASSERT_EQ("", loc.regionOf(IP::parse("2001:db9::1")));
+
+    ASSERT_TRUE(loc.sameRegion(IP::parse("203.0.113.1"), IP::parse("203.0.113.2")));
+    ASSERT_FALSE(loc.sameRegion(IP::parse("203.0.113.1"), IP::parse("203.0.113.129")));
+    ASSERT_FALSE(loc.sameRegion(IP::parse("192.0.2.1"), IP::parse("192.0.2.2")));
+
+    // 読み直すと置き換わる。
+    ASSERT_EQ(0, loc.load(""));
+    ASSERT_EQ("", loc.regionOf(IP::parse("203.0.113.5")));
+}
+
+TEST_F(LocalityFixture, nearByTableOrRTT)
+{
+    Locality loc;
+    RelayStats stats;
+    loc.load("203.0.113.0/24 AS64500\n198.51.100.0/24 AS64502\n");
+
+    const IP self = IP::parse("203.0.113.1");
+    ASSERT_TRUE(loc.isNear(self, Host(IP::parse("203.0.113.9"), 7144), stats));
+    ASSERT_FALSE(loc.isNear(self, Host(IP::parse("198.51.100.9"), 7144), stats));
+
+    // 表に無ければ接続時間で。
+    Host fast(IP::parse("192.0.2.1"), 7144), slow(IP::parse("192.0.2.2"), 7144);
+    ASSERT_FALSE(loc.isNear(self, fast, stats));
+    stats.recordConnect(fast, 0.005);
+    stats.recordConnect(slow, 0.1);
+    ASSERT_TRUE(loc.isNear(self, fast, stats));
+    ASSERT_FALSE(loc.isNear(self, slow, stats));
+}
+
+TEST_F(LocalityFixture, policyAddsRemoteCost)
+{
+    Locality loc;
+    loc.load("203.0.113.0/24 AS64500\n");
+
+    HopCountPolicy base;
+    LocalityPolicy policy(base, IP::parse("203.0.113.1"), loc);
+    policy.remoteCost = 3;
+
+    ChanHit hit;
+    hit.numHops = 2;
+    ASSERT_EQ(2, policy.cost(hit, Host(IP::parse("203.0.113.9"), 7144)));
+    ASSERT_EQ(5, policy.cost(hit, Host(IP::parse("192.0.2.9"), 7144)));
+    // LAN 内は近い。
+    ASSERT_EQ(2, policy.cost(hit, Host(IP::parse("192.168.0.2"), 7144)));
+}
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+#include "lockprof.h"
+
+class LockProfilerFixture : public ::testing::Test {
+public:
+    void SetUp()
+    {
+        LockProfiler::reset();
+        LockProfiler::setEnabled(true);
+    }
+
+    void TearDown()
+    {
+        LockProfiler::setEnabled(false);
+        LockProfiler::reset();
+    }
+
+    static LockProfiler::Report find(const std::string& name)
+    {
+        for (auto& r : LockProfiler::report())
+            if (r.name == name)
+                return r;
+        return LockProfiler::Report();
+    }
+};
+
+TEST_F(LockProfilerFixture, disabledCountsNothing)
+{
+    LockProfiler::setEnabled(false);
+    ProfiledMutex m("LockProfilerTest::disabled");
+    { std::lock_guard<ProfiledMutex> cs(m); }
+    ASSERT_EQ("", find("LockProfilerTest::disabled").name);
+}
+
+#ifndef NO_LOCK_PROFILING
+TEST_F(LockProfilerFixture, sameNameSharesEntry)
+{
+    ProfiledMutex a("LockProfilerTest::shared"), b("LockProfilerTest::shared");
+    ASSERT_EQ(LockProfiler::entry("LockProfilerTest::shared"), LockProfiler::entry(a.name()));
+    ASSERT_STREQ("LockProfilerTest::shared", b.name());
+
+    { std::lock_guard<ProfiledMutex> cs(a); }
+    { std::lock_guard<ProfiledMutex> cs(b); }
+    ASSERT_EQ(2, find("LockProfilerTest::shared").acquisitions);
+}
+
+TEST_F(LockProfilerFixture, recursiveLockIsOneAcquisition)
+{
+    ProfiledMutex m("LockProfilerTest::recursive");
+    {
+        std::lock_guard<ProfiledMutex> cs(m);
+        std::lock_guard<ProfiledMutex> cs2(m);
+        ASSERT_TRUE(m.try_lock());
+        m.unlock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    auto r = find("LockProfilerTest::recursive");
+    ASSERT_EQ(1, r.acquisitions);
+    ASSERT_EQ(0, r.contended);
+    ASSERT_GE(r.holdSeconds, 0.004);
+    ASSERT_EQ(r.holdSeconds, r.maxHoldSeconds);
+}
+
+TEST_F(LockProfilerFixture, enablingWhileHeld)
+{
+    LockProfiler::setEnabled(false);
+    ProfiledMutex m("LockProfilerTest::enablingWhileHeld");
+    m.lock();
+    LockProfiler::setEnabled(true);
+    m.lock();
+    m.unlock();
+    m.unlock();
+
+    // 有効になる前に取ったロックの保持時間は数えない。
+    ASSERT_EQ("", find("LockProfilerTest::enablingWhileHeld").name);
+
+    { std::lock_guard<ProfiledMutex> cs(m); }
+    ASSERT_EQ(1, find("LockProfilerTest::enablingWhileHeld").acquisitions);
+}
+
+TEST_F(LockProfilerFixture, contention)
+{
+    ProfiledMutex m("LockProfilerTest::contention");
+
+    m.lock();
+    std::thread t([&]()
+                  {
+                      std::lock_guard<ProfiledMutex> cs(m);
+                  });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    m.unlock();
+    t.join();
+
+    auto r = find("LockProfilerTest::contention");
+    ASSERT_EQ(2, r.acquisitions);
+    ASSERT_EQ(1, r.contended);
+    ASSERT_GE(r.waitSeconds, 0.01);
+    ASSERT_EQ(r.waitSeconds, r.maxWaitSeconds);
+    ASSERT_EQ(1, r.sites.size());
+    ASSERT_EQ(1, r.sites[0].count);
+    ASSERT_FALSE(r.sites[0].function.empty());
+}
+
+TEST_F(LockProfilerFixture, reportIsSortedByWait)
+{
+    ProfiledMutex busy("LockProfilerTest::busy"), idle("LockProfilerTest::idle");
+    { std::lock_guard<ProfiledMutex> cs(idle); }
+
+    busy.lock();
+    std::thread t([&]() { std::lock_guard<ProfiledMutex> cs(busy); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    busy.unlock();
+    t.join();
+
+    int busyIndex = -1, idleIndex = -1;
+    auto reports = LockProfiler::report();
+    for (size_t i = 0; i < reports.size(); i++)
+    {
+        if (reports[i].name == "LockProfilerTest::busy") busyIndex = i;
+        if (reports[i].name == "LockProfilerTest::idle") idleIndex = i;
+    }
+    ASSERT_NE(-1, busyIndex);
+    ASSERT_NE(-1, idleIndex);
+    ASSERT_LT(busyIndex, idleIndex);
+
+    LockProfiler::reset();
+    ASSERT_EQ("", find("LockProfilerTest::busy").name);
+}
+#endif
@@ -129,3 +129,56 @@ TEST_F(LogBufferFixture, copy_utf8)
     ASSERT_EQ(LogBuffer::copy_utf8(dest, "プログラミング", 4), 3);
     ASSERT_STREQ(dest, "プ");
 }
+
+TEST_F(LogBufferFixture, linesFrom)
+{
+    LogBuffer small(3, 100);
+    small.write("a", LogBuffer::T_ERROR, 1);
+    small.write("b", LogBuffer::T_ERROR, 1);
+
+    auto lines = small.linesFrom(0, 10);
+    ASSERT_EQ(2, lines.size());
+    ASSERT_EQ(0, lines[0].seq);
+    ASSERT_EQ("a", lines[0].text);
+    ASSERT_EQ(1, lines[1].seq);
+    ASSERT_EQ(LogBuffer::T_ERROR, lines[1].type);
+
+    // 溢れた行は返さない。
+    small.write("c", LogBuffer::T_ERROR, 1);
+    small.write("d", LogBuffer::T_ERROR, 1);
+    lines = small.linesFrom(0, 10);
+    ASSERT_EQ(3, lines.size());
+    ASSERT_EQ(1, lines[0].seq);
+    ASSERT_EQ("d", lines[2].text);
+
+    lines = small.linesFrom(2, 1);
+    ASSERT_EQ(1, lines.size());
+    ASSERT_EQ("c", lines[0].text);
+
+    ASSERT_TRUE(small.linesFrom(4, 10).empty());
+}
+
+TEST_F(LogBufferFixture, clearKeepsSequence)
+{
+    lb.write("a", LogBuffer::T_ERROR, 1);
+    lb.write("b", LogBuffer::T_ERROR, 1);
+    lb.clear();
+
+    uint64_t first, end;
+    lb.range(first, end);
+    ASSERT_EQ(2, first);
+    ASSERT_EQ(2, end);
+
+    lb.write("c", LogBuffer::T_ERROR, 1);
+    auto lines = lb.linesFrom(0, 10);
+    ASSERT_EQ(1, lines.size());
+    ASSERT_EQ(2, lines[0].seq);
+    ASSERT_EQ("c", lines[0].text);
+}
+
+TEST_F(LogBufferFixture, lineRendererText)
+{
+    auto s = LogBuffer::lineRendererText(0, LogBuffer::T_ERROR, "hello");
+    ASSERT_TRUE(str::contains(s, " [EROR] hello"));
+    ASSERT_EQ("continued", LogBuffer::lineRendererText(0, LogBuffer::T_NONE, "continued"));
+}
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "logpipe.h"
+
+class LogPipelineFixture : public ::testing::Test {
+public:
+    LogPipelineFixture()
+        : pipe([this](unsigned int time, LogBuffer::TYPE type, const char* line)
+               {
+                   std::lock_guard<std::mutex> cs(lock);
+                   lines.push_back(line);
+                   threads.push_back(std::this_thread::get_id());
+               })
+    {
+    }
+
+    std::vector<std::string> received()
+    {
+        std::lock_guard<std::mutex> cs(lock);
+        return lines;
+    }
+
+    std::mutex lock;
+    std::vector<std::string> lines;
+    std::vector<std::thread::id> threads;
+    LogPipeline pipe;
+};
+
+TEST_F(LogPipelineFixture, deliversSynchronouslyWhenNotStarted)
+{
+    ASSERT_FALSE(pipe.running());
+    pipe.push(1, LogBuffer::T_INFO, "hello");
+    ASSERT_EQ(std::vector<std::string>({ "hello" }), received());
+    ASSERT_EQ(std::this_thread::get_id(), threads[0]);
+}
+
+TEST_F(LogPipelineFixture, deliversInOrderOnWriterThread)
+{
+    pipe.start();
+    ASSERT_TRUE(pipe.running());
+    for (int i = 0; i < 100; i++)
+        pipe.push(1, LogBuffer::T_INFO, std::to_string(i));
+    pipe.flush();
+
+    auto r = received();
+    ASSERT_EQ(100, r.size());
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(std::to_string(i), r[i]);
+    ASSERT_NE(std::this_thread::get_id(), threads[0]);
+
+    pipe.stop();
+    ASSERT_FALSE(pipe.running());
+}
+
+TEST_F(LogPipelineFixture, manyProducers)
+{
+    pipe.start();
+
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; t++)
+        producers.emplace_back([this, t]()
+                               {
+                                   for (int i = 0; i < 1000; i++)
+                                       pipe.push(1, LogBuffer::T_DEBUG, std::to_string(t * 1000 + i));
+                               });
+    for (auto& t : producers)
+        t.join();
+    pipe.stop();
+
+    // スレッドごとの順序は保たれる。
+    auto r = received();
+    ASSERT_EQ(4000, r.size());
+    ASSERT_EQ(0, pipe.numDropped());
+    std::vector<int> last(4, -1);
+    for (auto& line : r)
+    {
+        int n = std::stoi(line);
+        ASSERT_LT(last[n / 1000], n % 1000);
+        last[n / 1000] = n % 1000;
+    }
+}
+
+TEST_F(LogPipelineFixture, rateLimitPerSite)
+{
+    static const char* siteA = "site A %d";
+    static const char* siteB = "site B %d";
+
+    int admittedA = 0, admittedB = 0;
+    for (int i = 0; i < 10; i++)
+    {
+        if (pipe.admit(siteA, 3, 100)) admittedA++;
+        if (pipe.admit(siteB, 5, 100)) admittedB++;
+    }
+    ASSERT_EQ(3, admittedA);
+    ASSERT_EQ(5, admittedB);
+    ASSERT_EQ(12, pipe.numSuppressed());
+    ASSERT_EQ(0, received().size());
+
+    // 次の秒になると抑えた数を知らせてから数え直す。
+    ASSERT_TRUE(pipe.admit(siteA, 3, 101));
+    ASSERT_EQ(std::vector<std::string>({ "7 similar log lines suppressed: site A %d" }), received());
+}
+
+TEST_F(LogPipelineFixture, zeroLimitIsUnlimited)
+{
+    for (int i = 0; i < 1000; i++)
+        ASSERT_TRUE(pipe.admit("unlimited", 0, 100));
+    ASSERT_EQ(0, pipe.numSuppressed());
+}
+
+TEST_F(LogPipelineFixture, stopDeliversPending)
+{
+    pipe.start();
+    for (int i = 0; i < 10; i++)
+        pipe.push(1, LogBuffer::T_INFO, "x");
+    pipe.stop();
+    ASSERT_EQ(10, received().size());
+
+    // 止めた後は同期で配送する。
+    pipe.push(1, LogBuffer::T_INFO, "y");
+    ASSERT_EQ(11, received().size());
+}
@@ -26,3 +26,11 @@ TEST_F(md5Fixture, test)
     auto out = md5::hexdigest("hello");
     ASSERT_STREQ("5d41402abc4b2a76b9719d911017c592", out.c_str());
 }
+
+TEST_F(md5Fixture, multipleBlocks)
+{
+    // 一ブロック (64 バイト) をまたぐ入力と空の入力。
+    ASSERT_EQ("d41d8cd98f00b204e9800998ecf8427e", md5::hexdigest(""));
+    ASSERT_EQ("57edf4a22be3c955ac49da2e2107b67a",
+              md5::hexdigest("12345678901234567890123456789012345678901234567890123456789012345678901234567890"));
+}
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+
+#include "metrics.h"
+#include "str.h"
+
+TEST(MetricsTest, histogram)
+{
+    Metrics::Histogram h({ 0.1, 1 });
+    h.observe(0.05);
+    h.observe(0.5);
+    h.observe(0.5);
+    h.observe(3);
+    ASSERT_EQ(4, h.count());
+
+    std::string out;
+    h.write(out, "test_seconds", "Test.");
+    ASSERT_EQ("# HELP test_seconds Test.\n"
+              "# TYPE test_seconds histogram\n"
+              "test_seconds_bucket{le=\"0.1\"} 1\n"
+              "test_seconds_bucket{le=\"1\"} 3\n"
+              "test_seconds_bucket{le=\"+Inf\"} 4\n"
+              "test_seconds_sum 4.050000\n"
+              "test_seconds_count 4\n",
+              out);
+}
+
+TEST(MetricsTest, escapeLabelValue)
+{
+    ASSERT_EQ("plain", Metrics::escapeLabelValue("plain"));
+    ASSERT_EQ("a\\\"b\\\\c\\nd", Metrics::escapeLabelValue("a\"b\\c\nd"));
+}
+
+TEST(MetricsTest, render)
+{
+    Metrics metrics;
+    metrics.handshakeLatency.observe(0.02);
+
+    auto out = metrics.render();
+    ASSERT_TRUE(str::contains(out, "# TYPE peercast_bytes_out_total counter\n"));
+    ASSERT_TRUE(str::contains(out, "peercast_handshake_duration_seconds_count 1\n"));
+    ASSERT_TRUE(str::contains(out, "peercast_handshake_duration_seconds_bucket{le=\"0.025\"} 1\n"));
+
+    // 行はどれもコメントか "名前 値" の形。
+    for (auto& line : str::split(out, "\n"))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        ASSERT_EQ(2, str::split(line, " ").size()) << line;
+    }
+}
+
+TEST(MetricsTest, exponentialBounds)
+{
+    auto bounds = Metrics::Histogram::exponentialBounds(0.001, 2, 4);
+    ASSERT_EQ(4, bounds.size());
+    ASSERT_DOUBLE_EQ(0.001, bounds[0]);
+    ASSERT_DOUBLE_EQ(0.008, bounds[3]);
+}
+
+TEST(MetricsTest, quantile)
+{
+    Metrics::Histogram h({ 0.01, 0.1, 1 });
+    ASSERT_EQ(0, h.quantile(0.5));
+
+    for (int i = 0; i < 90; i++)
+        h.observe(0.005);
+    for (int i = 0; i < 9; i++)
+        h.observe(0.05);
+    h.observe(5);
+
+    ASSERT_DOUBLE_EQ(0.01, h.quantile(0.5));
+    ASSERT_DOUBLE_EQ(0.1, h.quantile(0.95));
+    // 上限を超えた分は最後の上限で表す。
+    ASSERT_DOUBLE_EQ(1, h.quantile(1.0));
+
+    auto counts = h.counts();
+    ASSERT_EQ(4, counts.size());
+    ASSERT_EQ(90, counts[0]);
+    ASSERT_EQ(1, counts[3]);
+}
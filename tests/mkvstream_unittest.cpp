@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include "mkv.h"
+#include "chanmgr.h"
 
 class MKVStreamFixture : public ::testing::Test {
 public:
@@ -27,3 +28,88 @@ TEST_F(MKVStreamFixture, unpackUnsignedInt)
     ASSERT_EQ(1, MKVStream::unpackUnsignedInt("\x01"));
     ASSERT_EQ(258, MKVStream::unpackUnsignedInt("\x01\x02"));
 }
+
+// トラック 1 の SimpleBlock。size はペイロードの大きさ。timecode はク
+// ラスターからの相対時刻。
+static std::string simpleBlock(int size, bool key, int timecode = 0)
+{
+    std::string payload = { (char) 0x81, (char) (timecode >> 8), (char) timecode, (char) (key ? 0x80 : 0) };
+    payload += std::string(size - payload.size(), '\0');
+    return std::string({ (char) 0xA3, (char) 0x20, (char) (size >> 8), (char) size }) + payload;
+}
+
+static std::string cluster(const std::string& body)
+{
+    int size = body.size();
+    return std::string({ 0x1F, 0x43, (char) 0xB6, 0x75,
+                         0x10, (char) (size >> 16), (char) (size >> 8), (char) size }) + body;
+}
+
+TEST_F(MKVStreamFixture, hasKeyFrame)
+{
+    MKVStream mkv;
+    std::string timecode = { (char) 0xE7, (char) 0x81, 0 };
+
+    auto c = cluster(timecode + simpleBlock(100, false));
+    ASSERT_FALSE(mkv.hasKeyFrame((const uint8_t*) c.data(), c.size()));
+    ASSERT_FALSE(mkv.m_hasKeyFrame);
+
+    c = cluster(timecode + simpleBlock(100, false) + simpleBlock(100, true));
+    ASSERT_TRUE(mkv.hasKeyFrame((const uint8_t*) c.data(), c.size()));
+    ASSERT_TRUE(mkv.m_hasKeyFrame);
+
+    // 途中で切れたクラスター。
+    ASSERT_THROW(mkv.hasKeyFrame((const uint8_t*) c.data(), c.size() - 1), std::runtime_error);
+}
+
+TEST_F(MKVStreamFixture, sendCluster_splitsAtElementBoundaries)
+{
+    auto tmp = chanMgr;
+    chanMgr = new ChanMgr();
+
+    auto ch = std::make_shared<Channel>();
+    MKVStream mkv;
+    std::string timecode = { (char) 0xE7, (char) 0x81, 0 };
+    auto c = cluster(timecode +
+                     simpleBlock(6000, true) +
+                     simpleBlock(6000, false) +
+                     simpleBlock(6000, false) +
+                     simpleBlock(20000, false));
+    mkv.sendCluster((const uint8_t*) c.data(), c.size(), ch);
+
+    // 溜められるだけ溜め、大きな要素は MAX_PACKET_SIZE で分割する。
+    auto stat = ch->rawData.getStatistics();
+    std::vector<unsigned int> lens = { 8 + 3 + 6004 * 2, 6004, MKVStream::MAX_PACKET_SIZE, 20004 - MKVStream::MAX_PACKET_SIZE };
+    ASSERT_EQ(lens, stat.packetLengths);
+    ASSERT_EQ(1, stat.nonContinuations);
+    ASSERT_EQ(3, stat.continuations);
+    ASSERT_EQ(c.size(), ch->streamPos);
+
+    delete chanMgr;
+    chanMgr = tmp;
+}
+
+TEST_F(MKVStreamFixture, sendCluster_splitsByDuration)
+{
+    auto tmp = chanMgr;
+    chanMgr = new ChanMgr();
+
+    auto ch = std::make_shared<Channel>();
+    MKVStream mkv;
+    std::string timecode = { (char) 0xE7, (char) 0x81, 0 };
+    std::string body = timecode;
+    for (int t = 0; t < 240; t += 40)
+        body += simpleBlock(100, t == 0, t);
+    auto c = cluster(body);
+    mkv.sendCluster((const uint8_t*) c.data(), c.size(), ch);
+
+    // TARGET_PACKET_MSEC 経った SimpleBlock から次のパケットにする。
+    auto stat = ch->rawData.getStatistics();
+    std::vector<unsigned int> lens = { 8 + 3 + 104 * 3, 104 * 3 };
+    ASSERT_EQ(lens, stat.packetLengths);
+    ASSERT_EQ(1, stat.nonContinuations);
+    ASSERT_EQ(1, stat.continuations);
+
+    delete chanMgr;
+    chanMgr = tmp;
+}
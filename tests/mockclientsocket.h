@@ -49,6 +49,11 @@ public:
         return incoming.read(p, len);
     }
 
+    int readSome(void *p, int len) override
+    {
+        return incoming.readSome(p, len);
+    }
+
     void write(const void *p, int len) override
     {
         outgoing.write(p, len);
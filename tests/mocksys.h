@@ -9,6 +9,7 @@ public:
     MockSys()
         : time(0)
         , dtime(0.0)
+        , lastSleepUntil(0.0)
     {
     }
 
@@ -41,6 +42,16 @@ public:
         return dtime;
     }
 
+    double getMonotonicTime() override
+    {
+        return dtime;
+    }
+
+    void sleepUntil(double deadline) override
+    {
+        lastSleepUntil = deadline;
+    }
+
     unsigned int rnd() override
     {
         return 123456789;
@@ -143,6 +154,7 @@ public:
 
     unsigned int time;
     double dtime;
+    double lastSleepUntil;  // 最後に sleepUntil された期限
 };
 
 #endif
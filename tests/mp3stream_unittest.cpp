@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+
+#include "mp3.h"
+#include "sstream.h"
+
+class MP3StreamFixture : public ::testing::Test {
+public:
+    MP3StreamFixture()
+    {
+    }
+
+    void SetUp()
+    {
+    }
+
+    void TearDown()
+    {
+    }
+
+    ~MP3StreamFixture()
+    {
+    }
+};
+
+// MPEG-1 Layer III 128kbps 44.1kHz のフレーム。パディング無しで 417 バイト。
+static std::string mp3Frame()
+{
+    std::string frame(417, '\0');
+    frame[0] = (char) 0xff;
+    frame[1] = (char) 0xfb;
+    frame[2] = (char) 0x90;
+    return frame;
+}
+
+TEST_F(MP3StreamFixture, frameLength)
+{
+    auto frame = mp3Frame();
+    auto p = reinterpret_cast<const unsigned char*>(frame.data());
+    ASSERT_EQ(417, MP3Stream::frameLength(p, frame.size()));
+    ASSERT_EQ(0, MP3Stream::frameLength(p, 3));
+
+    // パディングあり。
+    frame[2] = (char) 0x92;
+    ASSERT_EQ(418, MP3Stream::frameLength(p, frame.size()));
+
+    // MPEG-2 Layer III 64kbps 22.05kHz
+    frame[1] = (char) 0xf3;
+    frame[2] = (char) 0x80;
+    ASSERT_EQ(208, MP3Stream::frameLength(p, frame.size()));
+
+    // 予約されたバージョン、フリーフォーマット、不正なビットレート。
+    frame[1] = (char) 0xeb;
+    frame[2] = (char) 0x90;
+    ASSERT_EQ(0, MP3Stream::frameLength(p, frame.size()));
+    frame[1] = (char) 0xfb;
+    frame[2] = (char) 0x00;
+    ASSERT_EQ(0, MP3Stream::frameLength(p, frame.size()));
+    frame[2] = (char) 0xf0;
+    ASSERT_EQ(0, MP3Stream::frameLength(p, frame.size()));
+}
+
+TEST_F(MP3StreamFixture, findFrame)
+{
+    // 同期ワードに見えない 0xff を読み飛ばす。
+    std::string data = std::string({ 0x00, (char) 0xff, 0x00, (char) 0xff }) + mp3Frame();
+    auto p = reinterpret_cast<const unsigned char*>(data.data());
+    ASSERT_EQ(4, MP3Stream::findFrame(p, data.size()));
+    ASSERT_EQ(-1, MP3Stream::findFrame(p, 3));
+}
+
+TEST_F(MP3StreamFixture, findCutPoint)
+{
+    std::string data = "xx" + mp3Frame() + mp3Frame();
+    auto p = reinterpret_cast<const unsigned char*>(data.data());
+
+    // フレームがちょうど終わっていれば全部。
+    ASSERT_EQ(data.size(), MP3Stream::findCutPoint(p, data.size()));
+    // 途中で切れていれば、そのフレームの前まで。
+    ASSERT_EQ(2 + 417, MP3Stream::findCutPoint(p, data.size() - 1));
+    // フレームが無ければ全部。
+    ASSERT_EQ(2, MP3Stream::findCutPoint(p, 2));
+}
+
+TEST_F(MP3StreamFixture, packetsStartAtFrames)
+{
+    auto tmp = chanMgr;
+    chanMgr = new ChanMgr();
+
+    std::string data;
+    while (data.size() < 3 * ChanMgr::MAX_METAINT)
+        data += mp3Frame();
+    StringStream mem(data);
+
+    auto ch = std::make_shared<Channel>();
+    MP3Stream mp3;
+    mp3.readHeader(mem, ch);
+    mp3.readPacket(mem, ch);
+    mp3.readPacket(mem, ch);
+
+    auto stat = ch->rawData.getStatistics();
+    ASSERT_EQ(2, stat.packetLengths.size());
+    for (auto len : stat.packetLengths)
+        ASSERT_EQ(0, len % 417);
+    // 読んだ分のうち、最後の不完全なフレームだけが残る。
+    ASSERT_EQ(2 * ChanMgr::MAX_METAINT / 417 * 417, ch->streamPos);
+
+    delete chanMgr;
+    chanMgr = tmp;
+}
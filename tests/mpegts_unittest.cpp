@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+#include "mpegts.h"
+
+class MPEGTSWriterFixture : public ::testing::Test {
+public:
+    static int pid(const std::string& data, size_t i)
+    {
+        return ((data[i * 188 + 1] & 0x1f) << 8) | (uint8_t) data[i * 188 + 2];
+    }
+
+    MPEGTSWriter w;
+};
+
+TEST_F(MPEGTSWriterFixture, crc32)
+{
+    // PMT の PID が 0x1000 の PAT。
+    const uint8_t pat[] = { 0x00, 0xb0, 0x0d, 0x00, 0x01, 0xc1, 0x00, 0x00, 0x00, 0x01, 0xf0, 0x00 };
+    ASSERT_EQ(0x2ab104b2, MPEGTSWriter::crc32(pat, sizeof(pat)));
+}
+
+TEST_F(MPEGTSWriterFixture, writeTables)
+{
+    std::string out;
+    w.setStreams(true, true);
+    w.writeTables(out);
+
+    ASSERT_EQ(2 * 188, out.size());
+    ASSERT_EQ(0x47, (uint8_t) out[0]);
+    ASSERT_EQ(MPEGTSWriter::PID_PAT, pid(out, 0));
+    ASSERT_EQ(MPEGTSWriter::PID_PMT, pid(out, 1));
+
+    // PMT のセクションの長さ: 13 + ストリーム 2 本
+    ASSERT_EQ(13 + 10, (uint8_t) out[188 + 7]);
+    ASSERT_EQ(MPEGTSWriter::STREAM_TYPE_H264, out[188 + 5 + 12]);
+    ASSERT_EQ(MPEGTSWriter::STREAM_TYPE_AAC, out[188 + 5 + 17]);
+}
+
+TEST_F(MPEGTSWriterFixture, writeVideo)
+{
+    std::string out;
+    w.setStreams(true, false);
+    w.writeVideo(out, 9000, 6000, true, std::string(1000, 'x'));
+
+    ASSERT_EQ(0, out.size() % 188);
+    size_t n = out.size() / 188;
+    ASSERT_EQ(6, n);
+    for (size_t i = 0; i < n; i++)
+    {
+        ASSERT_EQ(0x47, (uint8_t) out[i * 188]);
+        ASSERT_EQ(MPEGTSWriter::PID_VIDEO, pid(out, i));
+        ASSERT_EQ(i == 0, (out[i * 188 + 1] & 0x40) != 0);     // payload_unit_start_indicator
+        ASSERT_EQ(i, out[i * 188 + 3] & 0x0f);                  // continuity_counter
+    }
+
+    // 最初のパケットは PCR とランダムアクセスの印を持つ。
+    ASSERT_EQ(0x30, out[3] & 0x30);
+    ASSERT_EQ(0x50, (uint8_t) out[5]);
+
+    // PES は PTS と DTS を持つ。
+    size_t pes = 4 + 1 + (uint8_t) out[4];
+    ASSERT_EQ(std::string("\x00\x00\x01\xe0", 4), out.substr(pes, 4));
+    ASSERT_EQ(0xc0, (uint8_t) out[pes + 7]);
+
+    // 本体が全部入っている。
+    ASSERT_EQ(1000, std::count(out.begin(), out.end(), 'x'));
+}
+
+TEST_F(MPEGTSWriterFixture, writeAudioStuffing)
+{
+    std::string out;
+    w.setStreams(false, true);
+    // PES ヘッダーと合わせて 1 パケットに 1 バイト足りない長さ。
+    w.writeAudio(out, 0, std::string(188 - 4 - 8 - 14 - 1, 'a'));
+
+    ASSERT_EQ(188, out.size());
+    ASSERT_EQ(MPEGTSWriter::PID_AUDIO, pid(out, 0));
+}
@@ -0,0 +1,225 @@
+#include <gtest/gtest.h>
+
+#include "netemclientsocket.h"
+
+using namespace loadgen;
+
+TEST(NetProfileTest, parse)
+{
+    auto p = NetProfile::parse("delay=50ms,jitter=0.01,kbps=2000,buffer=65536,loss=0.5,cut=30s,cutbytes=1000,seed=7");
+    ASSERT_DOUBLE_EQ(0.05, p.delay);
+    ASSERT_DOUBLE_EQ(0.01, p.jitter);
+    ASSERT_EQ(2000, p.kbps);
+    ASSERT_EQ(65536, p.buffer);
+    ASSERT_DOUBLE_EQ(0.5, p.loss);
+    ASSERT_DOUBLE_EQ(30, p.cutAfter);
+    ASSERT_EQ(1000, p.cutAfterBytes);
+    ASSERT_EQ(7, p.seed);
+
+    auto d = NetProfile::parse("");
+    ASSERT_EQ(0, d.delay);
+    ASSERT_EQ(0, d.kbps);
+
+    ASSERT_THROW(NetProfile::parse("delay"), std::invalid_argument);
+    ASSERT_THROW(NetProfile::parse("delay=fast"), std::invalid_argument);
+    ASSERT_THROW(NetProfile::parse("latency=1"), std::invalid_argument);
+    ASSERT_THROW(NetProfile::parse("loss=2"), std::invalid_argument);
+}
+
+TEST(NetLinkTest, delayAndBandwidth)
+{
+    NetProfile p;
+    p.delay = 0.1;
+    p.kbps = 8;     // 1 秒に 1000 バイト
+    NetLink link(p);
+
+    ASSERT_DOUBLE_EQ(1.1, link.send(1000, 0));
+    // 前の塊を送り終わるまで待たされる。
+    ASSERT_DOUBLE_EQ(1.6, link.send(500, 0.5));
+    // 回線が空いていれば遅延だけ。
+    ASSERT_DOUBLE_EQ(10.6, link.send(500, 10));
+    ASSERT_EQ(2000, link.bytesSent);
+}
+
+TEST(NetLinkTest, jitterKeepsOrderAndIsReproducible)
+{
+    NetProfile p;
+    p.delay = 0.05;
+    p.jitter = 0.2;
+    p.seed = 42;
+    NetLink a(p), b(p);
+
+    double last = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        double t = a.send(100, i * 0.01);
+        ASSERT_GE(t, last);
+        ASSERT_GE(t, i * 0.01 + p.delay);
+        ASSERT_DOUBLE_EQ(t, b.send(100, i * 0.01));
+        last = t;
+    }
+}
+
+TEST(NetLinkTest, lossDelaysByRetransmitTimeout)
+{
+    NetProfile p;
+    p.delay = 0.01;
+    p.loss = 1;
+    NetLink link(p);
+
+    ASSERT_DOUBLE_EQ(0.2, link.retransmitTimeout());
+    ASSERT_DOUBLE_EQ(0.21, link.send(10, 0));
+    ASSERT_EQ(1, link.numLost);
+
+    p.loss = 0.1;
+    NetLink sometimes(p);
+    for (int i = 0; i < 1000; i++)
+        sometimes.send(10, i);
+    ASSERT_GT(sometimes.numLost, 50);
+    ASSERT_LT(sometimes.numLost, 150);
+}
+
+TEST(NetLinkTest, cut)
+{
+    NetProfile p;
+    p.cutAfterBytes = 1000;
+    NetLink byBytes(p);
+    ASSERT_GE(byBytes.send(1000, 0), 0);
+    ASSERT_LT(byBytes.send(1, 0), 0);
+    ASSERT_TRUE(byBytes.isCut(0));
+
+    NetProfile q;
+    q.cutAfter = 5;
+    NetLink byTime(q);
+    ASSERT_FALSE(byTime.isCut(100));    // 最初の書き込みから数える
+    ASSERT_GE(byTime.send(10, 100), 0);
+    ASSERT_GE(byTime.send(10, 104.9), 0);
+    ASSERT_LT(byTime.send(10, 105), 0);
+}
+
+TEST(NetLinkTest, writableAtLimitsBuffer)
+{
+    NetProfile p;
+    p.kbps = 8;
+    p.buffer = 500;
+    NetLink link(p);
+
+    ASSERT_DOUBLE_EQ(0, link.writableAt(0));
+    link.send(2000, 0);     // 2 秒かかる
+    // 残りが 500 バイト (0.5 秒分) になるまで待たされる。
+    ASSERT_DOUBLE_EQ(1.5, link.writableAt(0));
+    ASSERT_DOUBLE_EQ(1.7, link.writableAt(1.7));
+}
+
+class NetemClientSocketFixture : public ::testing::Test {
+public:
+    NetemClientSocketFixture()
+        : now(0)
+    {
+    }
+
+    std::pair<NetemClientSocket::Ptr, NetemClientSocket::Ptr> pair(const std::string& spec)
+    {
+        auto p = NetProfile::parse(spec);
+        auto s = NetemClientSocket::pair(p, p, [this]() { return now; });
+        s.first->setReadTimeout(50);
+        s.second->setReadTimeout(50);
+        return s;
+    }
+
+    double now;
+};
+
+TEST_F(NetemClientSocketFixture, deliversAfterDelay)
+{
+    auto s = pair("delay=100ms");
+    s.first->writeString("hello");
+
+    char buf[5];
+    ASSERT_FALSE(s.second->readReady(0));
+    ASSERT_THROW(s.second->read(buf, 5), TimeoutException);
+
+    ClientSocket::TransportInfo info;
+    ASSERT_TRUE(s.first->getTransportInfo(info));
+    ASSERT_EQ(5, info.unackedBytes);
+    ASSERT_EQ(200000, info.rttUsec);
+
+    now = 0.1;
+    ASSERT_TRUE(s.second->readReady(0));
+    ASSERT_EQ(5, s.second->read(buf, 5));
+    ASSERT_EQ("hello", std::string(buf, 5));
+    ASSERT_TRUE(s.first->getTransportInfo(info));
+    ASSERT_EQ(0, info.unackedBytes);
+
+    // 逆向きも同じ性質。
+    s.second->writeString("ok");
+    now = 0.15;
+    ASSERT_THROW(s.first->read(buf, 2), TimeoutException);
+    now = 0.2;
+    ASSERT_EQ(2, s.first->read(buf, 2));
+}
+
+TEST_F(NetemClientSocketFixture, readSomeReturnsDeliveredPart)
+{
+    auto s = pair("kbps=8");
+    s.first->writeString("abc");    // 3ms
+    now = 0.003;
+    s.first->writeString("def");    // 6ms に届く
+
+    char buf[6];
+    ASSERT_EQ(3, s.second->readSome(buf, 6));
+    ASSERT_EQ("abc", std::string(buf, 3));
+    now = 0.006;
+    ASSERT_EQ(3, s.second->readSome(buf, 6));
+    ASSERT_EQ("def", std::string(buf, 3));
+}
+
+TEST_F(NetemClientSocketFixture, closeGivesEOFAfterData)
+{
+    auto s = pair("");
+    s.first->writeString("bye");
+    s.first->close();
+
+    ASSERT_TRUE(s.second->active());
+    char buf[4];
+    ASSERT_EQ(3, s.second->readSome(buf, 4));
+    ASSERT_FALSE(s.second->active());
+    ASSERT_THROW(s.second->read(buf, 1), EOFException);
+    ASSERT_THROW(s.second->writeString("x"), SockException);
+}
+
+TEST_F(NetemClientSocketFixture, cutDropsDataInFlight)
+{
+    auto s = pair("delay=1,cutbytes=10");
+    s.first->writeString("0123456789");
+    ASSERT_THROW(s.first->writeString("x"), SockException);
+
+    // 届く前に切れたので何も読めない。
+    now = 5;
+    char buf[1];
+    ASSERT_FALSE(s.second->active());
+    ASSERT_THROW(s.second->read(buf, 1), SockException);
+}
+
+TEST_F(NetemClientSocketFixture, writeBlocksOnFullBuffer)
+{
+    auto s = pair("kbps=8,buffer=100");
+    s.first->setWriteTimeout(50);
+    s.first->write(std::string(1000, 'x').data(), 1000);
+    // 送り切れていない分が buffer を超えているので書けない。
+    ASSERT_THROW(s.first->writeString("y"), TimeoutException);
+
+    now = 0.9;
+    s.first->writeString("y");
+}
+
+TEST(NetemClientSocketTest, realClock)
+{
+    auto s = NetemClientSocket::pair(NetProfile::parse("delay=50ms"), NetProfile());
+    auto start = std::chrono::steady_clock::now();
+    s.first->writeString("ping");
+
+    char buf[4];
+    s.second->read(buf, 4);
+    ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+}
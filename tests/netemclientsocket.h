@@ -0,0 +1,275 @@
+// ------------------------------------------------
+// File : netemclientsocket.h
+// Desc:
+//      loadgen/netem.h の模型を通してつながった、メモリ上のソケットの
+//      対。遅延、帯域、損失、切断のあるリンクでのリレーの振る舞いを、
+//      実際のネットワークなしに試す。
+//
+//      時計は差し替えられる。手で進める時計を渡せば、届く時刻を決めて
+//      確かめられる。読み書きの待ちのタイムアウトは実時間で数える。
+//
+// ------------------------------------------------
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// ------------------------------------------------
+
+#ifndef _NETEMCLIENTSOCKET_H
+#define _NETEMCLIENTSOCKET_H
+
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "mockclientsocket.h"
+#include "../loadgen/netem.h"
+
+// ------------------------------------
+// 片方向の流れ。書いた塊を届く時刻まで持っておく。
+class NetemPipe
+{
+public:
+    typedef std::function<double()> Clock;
+
+    static double realClock()
+    {
+        using namespace std::chrono;
+        return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    NetemPipe(const loadgen::NetProfile& profile, Clock clock)
+        : link(profile)
+        , m_clock(clock)
+        , m_closed(false)
+        , m_reset(false)
+        , m_frontPos(0)
+    {
+    }
+
+    void write(const void* p, int len, unsigned int timeoutMsec)
+    {
+        std::unique_lock<std::mutex> lk(m_lock);
+        bool ok = waitUntil(lk, timeoutMsec,
+                            [this](double now) { return m_closed || checkCut(now) || link.writableAt(now) <= now; });
+        if (!ok)
+            throw TimeoutException();
+        if (m_closed)
+            throw SockException("Closed on write");
+        if (m_reset)
+            throw SockException("Connection reset");
+
+        double now = m_clock();
+        double t = link.send(len, now);
+        if (t < 0)
+        {
+            reset(now);
+            throw SockException("Connection reset");
+        }
+        m_queue.push_back({ t, std::string(static_cast<const char*>(p), len) });
+        m_cond.notify_all();
+    }
+
+    // some なら届いている分だけ、そうでなければ len バイト全部読む。
+    int read(void* p, int len, bool some, unsigned int timeoutMsec)
+    {
+        std::unique_lock<std::mutex> lk(m_lock);
+        int got = 0;
+        while (got < len)
+        {
+            bool ok = waitUntil(lk, timeoutMsec,
+                                [this](double now) { return deliverable(now) || m_closed || checkCut(now); });
+            if (!ok)
+                throw TimeoutException();
+
+            double now = m_clock();
+            while (got < len && deliverable(now))
+            {
+                auto& front = m_queue.front();
+                int n = std::min(len - got, (int) (front.second.size() - m_frontPos));
+                memcpy(static_cast<char*>(p) + got, front.second.data() + m_frontPos, n);
+                got += n;
+                m_frontPos += n;
+                if (m_frontPos == front.second.size())
+                {
+                    m_queue.pop_front();
+                    m_frontPos = 0;
+                }
+            }
+            if (got && some)
+                break;
+            if (got < len && !deliverable(now))
+            {
+                if (m_reset)
+                    throw SockException("Connection reset");
+                if (m_closed && m_queue.empty())
+                    throw EOFException("Closed on read");
+            }
+        }
+        return got;
+    }
+
+    // timeoutMsec のうちに読めるものが届けば true。
+    bool readReady(int timeoutMsec)
+    {
+        std::unique_lock<std::mutex> lk(m_lock);
+        waitUntil(lk, timeoutMsec,
+                  [this](double now) { return deliverable(now) || m_closed || checkCut(now); });
+        return deliverable(m_clock());
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        m_closed = true;
+        m_cond.notify_all();
+    }
+
+    // 閉じられるか切れるかして、もう読めるものが無い。
+    bool finished()
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        return (m_closed && m_queue.empty()) || checkCut(m_clock());
+    }
+
+    // 書いたがまだ届いていないバイト数。
+    unsigned int inFlight()
+    {
+        std::lock_guard<std::mutex> cs(m_lock);
+        double now = m_clock();
+        size_t n = 0;
+        for (auto& chunk : m_queue)
+            if (chunk.first > now)
+                n += chunk.second.size();
+        return (unsigned int) n;
+    }
+
+    loadgen::NetLink link;
+
+private:
+    // タイムアウトは実時間。時計は差し替えられているかもしれないので
+    // 細かく見直す。
+    template <typename Pred>
+    bool waitUntil(std::unique_lock<std::mutex>& lk, unsigned int timeoutMsec, Pred pred)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMsec);
+        while (!pred(m_clock()))
+        {
+            if (std::chrono::steady_clock::now() >= deadline)
+                return false;
+            m_cond.wait_for(lk, std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    bool deliverable(double now)
+    {
+        return !m_queue.empty() && m_queue.front().first <= now;
+    }
+
+    // 切れていれば、まだ届いていない塊を捨てる。
+    bool checkCut(double now)
+    {
+        if (!m_reset && link.isCut(now))
+            reset(now);
+        return m_reset;
+    }
+
+    void reset(double now)
+    {
+        link.cut();
+        m_reset = true;
+        while (!m_queue.empty() && m_queue.back().first > now)
+            m_queue.pop_back();
+        m_cond.notify_all();
+    }
+
+    std::mutex          m_lock;
+    std::condition_variable m_cond;
+    Clock               m_clock;
+    bool                m_closed;
+    bool                m_reset;
+    std::deque<std::pair<double, std::string>> m_queue;    // (届く時刻, データ)
+    size_t              m_frontPos;
+};
+
+// ------------------------------------
+class NetemClientSocket : public MockClientSocket
+{
+public:
+    typedef std::shared_ptr<NetemClientSocket> Ptr;
+
+    NetemClientSocket(std::shared_ptr<NetemPipe> in, std::shared_ptr<NetemPipe> out)
+        : m_in(in)
+        , m_out(out)
+    {
+    }
+
+    // a から b へは aToB、b から a へは bToA の性質でつながった対。
+    static std::pair<Ptr, Ptr> pair(const loadgen::NetProfile& aToB,
+                                    const loadgen::NetProfile& bToA,
+                                    NetemPipe::Clock clock = NetemPipe::realClock)
+    {
+        auto ab = std::make_shared<NetemPipe>(aToB, clock);
+        auto ba = std::make_shared<NetemPipe>(bToA, clock);
+        return { std::make_shared<NetemClientSocket>(ba, ab),
+                 std::make_shared<NetemClientSocket>(ab, ba) };
+    }
+
+    bool active() override
+    {
+        return !m_in->finished();
+    }
+
+    int read(void *p, int len) override
+    {
+        return m_in->read(p, len, false, readTimeout);
+    }
+
+    int readSome(void *p, int len) override
+    {
+        return m_in->read(p, len, true, readTimeout);
+    }
+
+    void write(const void *p, int len) override
+    {
+        m_out->write(p, len, writeTimeout);
+    }
+
+    bool readReady(int timeoutMilliseconds) override
+    {
+        return m_in->readReady(timeoutMilliseconds);
+    }
+
+    void close() override
+    {
+        m_in->close();
+        m_out->close();
+    }
+
+    bool getTransportInfo(TransportInfo& info) override
+    {
+        auto& p = m_out->link.profile;
+        info.unackedBytes = m_out->inFlight();
+        info.rttUsec = (unsigned int) ((2 * p.delay + p.jitter) * 1000000);
+        return true;
+    }
+
+    // こちらから書いた向きのリンク。
+    loadgen::NetLink& outgoingLink() { return m_out->link; }
+
+private:
+    std::shared_ptr<NetemPipe> m_in, m_out;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+
+#include "ogg.h"
+#include "sstream.h"
+#include "chanmgr.h"
+
+class OggPageFixture : public ::testing::Test {
+public:
+    OggPageFixture()
+    {
+    }
+
+    void SetUp()
+    {
+    }
+
+    void TearDown()
+    {
+    }
+
+    ~OggPageFixture()
+    {
+    }
+
+    OggPage page;
+};
+
+// body を一つのパケットとして持つページ。
+static std::string oggPage(const std::string& body, unsigned int serial = 1, int flags = 0)
+{
+    std::string page = { 'O','g','g','S', 0, (char) flags };
+    page += std::string(8, '\0');   // granule position
+    page += std::string({ (char) serial, 0, 0, 0 });
+    page += std::string(4, '\0');   // page sequence number
+    page += std::string(4, '\0');   // CRC
+
+    std::string segs;
+    size_t n = body.size();
+    while (n >= 255)
+    {
+        segs += (char) 255;
+        n -= 255;
+    }
+    segs += (char) n;
+    page += (char) segs.size();
+    page += segs + body;
+
+    unsigned int crc = OggPage::calcCRC((const unsigned char*) page.data(), page.size());
+    for (int i = 0; i < 4; i++)
+        page[22 + i] = (char) (crc >> (8 * i));
+    return page;
+}
+
+TEST_F(OggPageFixture, calcCRC)
+{
+    // CRC-32 (MSB ファースト、初期値 0) のチェック値。
+    ASSERT_EQ(0x89a1897f, OggPage::calcCRC((const unsigned char*) "123456789", 9));
+
+    // 8 バイト単位の処理と 1 バイトずつの処理が一致する。
+    std::string data;
+    for (int i = 0; i < 1000; i++)
+        data += (char) (i * 7);
+    auto p = (const unsigned char*) data.data();
+    unsigned int crc = 0;
+    for (size_t i = 0; i < data.size(); i++)
+        crc = OggPage::calcCRC(p + i, 1, crc);
+    ASSERT_EQ(crc, OggPage::calcCRC(p, data.size()));
+
+    // CRC フィールドは下位バイトから入る。
+    auto page = oggPage("abc");
+    ASSERT_EQ(std::string({ (char) 0xb1, (char) 0x86, 0x10, (char) 0xd1 }), page.substr(22, 4));
+}
+
+TEST_F(OggPageFixture, readSkipsGarbageAndBadPages)
+{
+    auto bad = oggPage("bad");
+    bad[bad.size() - 1] = 'x';
+    StringStream mem("garbageOg" + bad + oggPage("good"));
+
+    page.read(mem);
+    ASSERT_EQ(28, page.headLen);
+    ASSERT_EQ(4, page.bodyLen);
+    ASSERT_EQ("good", std::string((char*) page.data + page.headLen, page.bodyLen));
+    ASSERT_TRUE(page.checkCRC());
+}
+
+TEST_F(OggPageFixture, largePageIsSplitIntoContinuations)
+{
+    auto tmp = chanMgr;
+    chanMgr = new ChanMgr();
+
+    auto ch = std::make_shared<Channel>();
+    auto data = oggPage(std::string(20000, 'A'));
+    StringStream mem(data);
+
+    OGGStream ogg;
+    ogg.readHeader(mem, ch);
+    ogg.readPacket(mem, ch);
+
+    auto stat = ch->rawData.getStatistics();
+    std::vector<unsigned int> lens = { ChanPacket::MAX_DATALEN, (unsigned int) data.size() - ChanPacket::MAX_DATALEN };
+    ASSERT_EQ(lens, stat.packetLengths);
+    ASSERT_EQ(1, stat.nonContinuations);
+    ASSERT_EQ(1, stat.continuations);
+
+    delete chanMgr;
+    chanMgr = tmp;
+}
+
+static std::string le32(unsigned int v)
+{
+    return std::string({ (char) v, (char) (v >> 8), (char) (v >> 16), (char) (v >> 24) });
+}
+
+TEST_F(OggPageFixture, opusHeadersAndJoinPoints)
+{
+    auto tmp = chanMgr;
+    chanMgr = new ChanMgr();
+
+    auto ch = std::make_shared<Channel>();
+    // updateInfo は ID と名前が無いと何もしない。
+    ch->info.id.fromStr("01234567890123456789012345678901");
+    ch->info.name = "test";
+    std::string head = std::string("OpusHead") + std::string({ 1, 2, 0x38, 0x01 }) + le32(48000) + std::string(3, '\0');
+    std::string tags = std::string("OpusTags") + le32(4) + "test" + le32(1) + le32(9) + "TITLE=foo";
+    std::string mem = oggPage(head, 1, 0x02) + oggPage(tags) +
+        oggPage("first") +              // パケットの頭から始まる
+        oggPage("second", 1, 0x01);     // 前のページの続き
+    StringStream in(mem);
+
+    OGGStream ogg;
+    ogg.readHeader(in, ch);
+    ogg.readPacket(in, ch);
+    ASSERT_TRUE(ogg.opus.needHeader());
+    ogg.readPacket(in, ch);
+    ASSERT_FALSE(ogg.opus.needHeader());
+    ASSERT_EQ(0x138, ogg.opus.preSkip);
+    ASSERT_EQ(ChanPacket::T_HEAD, ch->headPack.type);
+    ASSERT_EQ(oggPage(head).size() + oggPage(tags).size(), ch->headPack.len);
+    ASSERT_STREQ("foo", ch->info.track.title.cstr());
+
+    ogg.readPacket(in, ch);
+    ogg.readPacket(in, ch);
+
+    auto stat = ch->rawData.getStatistics();
+    ASSERT_EQ(3, stat.packetLengths.size());
+    ASSERT_EQ(2, stat.nonContinuations); // ヘッドパケットと "first"
+    ASSERT_EQ(1, stat.continuations);
+
+    delete chanMgr;
+    chanMgr = tmp;
+}
@@ -0,0 +1,144 @@
+#include <gtest/gtest.h>
+
+#include "pacer.h"
+#include "chanpacket.h"
+#include "mocksys.h"
+
+class OutputPacerFixture : public ::testing::Test {
+public:
+    OutputPacerFixture()
+    {
+        m_dtime = dynamic_cast<MockSys*>(sys)->dtime;
+    }
+
+    ~OutputPacerFixture()
+    {
+        dynamic_cast<MockSys*>(sys)->dtime = m_dtime;
+    }
+
+    // 100 バイトのパケットを n 個書く。keyEvery 個ごとに継続パケット
+    // でないものを置く。
+    void writePackets(int n, int keyEvery)
+    {
+        ChanPacket pack;
+        pack.type = ChanPacket::T_DATA;
+        pack.len = 100;
+        for (int i = 0; i < n; i++)
+        {
+            pack.pos = i * 100;
+            pack.cont = (i % keyEvery) != 0;
+            ASSERT_TRUE(buf.writePacket(pack, true));
+        }
+    }
+
+    ChanPacketBuffer buf;
+    OutputPacer pacer;
+    double m_dtime;
+};
+
+TEST_F(OutputPacerFixture, measuresLag)
+{
+    writePackets(10, 5);
+
+    // 最新のパケットは 900 から。
+    ASSERT_EQ(800, pacer.update(buf, 800, true));
+    ASSERT_EQ(100, pacer.lagBytes);
+    ASSERT_EQ(0, pacer.numCatchUps);
+}
+
+TEST_F(OutputPacerFixture, catchesUpToKeyFrame)
+{
+    writePackets(10, 5);
+
+    // バッファーの 75 % を超えて遅れていれば、最新のキーフレーム (500)
+    // まで進める。
+    ASSERT_EQ(500, pacer.update(buf, 100, true));
+    ASSERT_EQ(1, pacer.numCatchUps);
+    ASSERT_EQ(400, pacer.skippedBytes);
+    ASSERT_EQ(400, pacer.lagBytes);
+
+    // 追いつかせた直後の sync の飛びは数えない。
+    unsigned int syncPos = 2;
+    ASSERT_FALSE(pacer.checkSync(syncPos, 5));
+    ASSERT_EQ(6, syncPos);
+    ASSERT_TRUE(pacer.checkSync(syncPos, 8));
+    ASSERT_EQ(1, pacer.numSkips);
+}
+
+TEST_F(OutputPacerFixture, catchUpDisabled)
+{
+    writePackets(10, 5);
+
+    ASSERT_EQ(100, pacer.update(buf, 100, false));
+    ASSERT_EQ(800, pacer.lagBytes);
+    ASSERT_EQ(800, pacer.maxLagBytes);
+    ASSERT_EQ(0, pacer.numCatchUps);
+}
+
+TEST_F(OutputPacerFixture, drainRate)
+{
+    writePackets(10, 5);
+
+    dynamic_cast<MockSys*>(sys)->dtime = 10.0;
+    pacer.update(buf, 0, false);
+    dynamic_cast<MockSys*>(sys)->dtime = 11.0;
+    pacer.update(buf, 1000, false);
+    ASSERT_EQ(300, pacer.drainRate);
+}
+
+TEST_F(OutputPacerFixture, hopLatency)
+{
+    writePackets(1, 1);
+    std::shared_ptr<const ChanPacketSlab> pack;
+    ASSERT_TRUE(buf.findPacket(0, pack));
+
+    // バッファーに書かれてから 0.5 秒後に送った。
+    dynamic_cast<MockSys*>(sys)->dtime += 0.5;
+    pacer.sent(pack->time);
+    ASSERT_EQ(50, pacer.hopLatency);
+    ASSERT_EQ(500, pacer.maxHopLatency);
+}
+
+TEST(IngestPacerTest, delaysByTimestamp)
+{
+    IngestPacer pacer;
+
+    // 最初のデータは待たない。
+    ASSERT_EQ(0, pacer.delay(0.0, 1.0, 100.0));
+    // 0.5 秒分のデータがまとめて届いた。
+    ASSERT_NEAR(0.25, pacer.delay(0.25, 1.0, 100.0), 1e-6);
+    ASSERT_NEAR(0.5, pacer.delay(0.5, 1.0, 100.0), 1e-6);
+    ASSERT_EQ(500, pacer.delayMsec);
+    ASSERT_EQ(2, pacer.numDelayed);
+}
+
+TEST(IngestPacerTest, lateDataResetsBase)
+{
+    IngestPacer pacer;
+
+    ASSERT_EQ(0, pacer.delay(0.0, 1.0, 100.0));
+    // 0.3 秒遅れて届いたのですぐ送り、それを基準にする。
+    ASSERT_EQ(0, pacer.delay(1.0, 1.0, 101.3));
+    ASSERT_NEAR(0.1, pacer.delay(1.1, 1.0, 101.3), 1e-6);
+}
+
+TEST(IngestPacerTest, limitsDelay)
+{
+    IngestPacer pacer;
+
+    ASSERT_EQ(0, pacer.delay(0.0, 0.2, 100.0));
+    // 上限より長くは待たない。
+    ASSERT_NEAR(0.2, pacer.delay(1.0, 0.2, 100.0), 1e-6);
+    ASSERT_NEAR(0.2, pacer.delay(1.1, 0.2, 100.0), 1e-6);
+    // 待った後は間隔どおり。
+    ASSERT_NEAR(0.1, pacer.delay(1.2, 0.2, 100.2), 1e-6);
+}
+
+TEST(IngestPacerTest, timestampJump)
+{
+    IngestPacer pacer;
+
+    ASSERT_EQ(0, pacer.delay(0.0, 1.0, 100.0));
+    ASSERT_EQ(0, pacer.delay(3600.0, 1.0, 100.0));
+    ASSERT_NEAR(0.1, pacer.delay(3600.1, 1.0, 100.0), 1e-6);
+}
@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include "pcpmux.h"
+#include "pcp.h"
+#include "atom.h"
+#include "sstream.h"
+
+class PCPMuxFixture : public ::testing::Test {
+public:
+    PCPMuxFixture()
+        : host(IP::parse("192.168.0.1"), 7144)
+        , parentID("00000000000000000000000000000001")
+        , chanID("00000000000000000000000000000002")
+        , stream(std::make_shared<PCPStream>(GnuID()))
+    {
+    }
+
+    Host host;
+    GnuID parentID, chanID;
+    std::shared_ptr<PCPStream> stream;
+};
+
+TEST_F(PCPMuxFixture, subscribeAtomCallsHandler)
+{
+    StringStream mem;
+    AtomStream out(mem);
+    out.writeParent(PCP_MUX_SUB, 2);
+        out.writeBytes(PCP_CHAN_ID, chanID.id, 16);
+        out.writeInt(PCP_CHAN_PKT_POS, 1234);
+    out.writeParent(PCP_MUX_UNSUB, 1);
+        out.writeBytes(PCP_CHAN_ID, chanID.id, 16);
+    mem.rewind();
+
+    std::vector<std::pair<bool, unsigned int>> calls;
+    stream->muxHandler = [&](bool subscribe, const GnuID& id, unsigned int pos)
+    {
+        ASSERT_TRUE(id.isSame(chanID));
+        calls.push_back({ subscribe, pos });
+    };
+
+    AtomStream atom(mem);
+    BroadcastState bcs;
+    ASSERT_EQ(0, stream->readAtom(atom, bcs));
+    ASSERT_EQ(0, stream->readAtom(atom, bcs));
+
+    ASSERT_EQ(2, calls.size());
+    ASSERT_TRUE(calls[0].first);
+    ASSERT_EQ(1234, calls[0].second);
+    ASSERT_FALSE(calls[1].first);
+}
+
+TEST_F(PCPMuxFixture, subscribeAtomIsIgnoredWithoutHandler)
+{
+    StringStream mem;
+    AtomStream out(mem);
+    out.writeParent(PCP_MUX_SUB, 1);
+        out.writeBytes(PCP_CHAN_ID, chanID.id, 16);
+    mem.rewind();
+
+    AtomStream atom(mem);
+    BroadcastState bcs;
+    ASSERT_NO_THROW(stream->readAtom(atom, bcs));
+}
+
+TEST_F(PCPMuxFixture, subscribeQueuesRequest)
+{
+    PCPMuxSession session(host, parentID, GnuID(), stream);
+
+    session.subscribe(chanID, 100);
+    ASSERT_TRUE(session.isSubscribed(chanID));
+    ASSERT_EQ(1, session.numSubscribed());
+
+    StringStream out;
+    stream->writePending(out, PCPStream::MAX_WRITE_BATCH);
+    out.rewind();
+
+    AtomStream atom(out);
+    int numc, dlen;
+    ASSERT_TRUE(atom.read(numc, dlen) == PCP_MUX_SUB);
+    ASSERT_EQ(2, numc);
+
+    session.unsubscribe(chanID);
+    ASSERT_FALSE(session.isSubscribed(chanID));
+    ASSERT_TRUE(stream->hasPendingOutput());
+}
+
+TEST_F(PCPMuxFixture, registryFindsUsableSession)
+{
+    PCPMuxRegistry registry;
+    auto session = std::make_shared<PCPMuxSession>(host, parentID, GnuID(), stream);
+    registry.add(session);
+
+    ASSERT_EQ(session, registry.find(host, chanID));
+    // 接続を持つチャンネル自身や他のホストには使わない。
+    ASSERT_EQ(nullptr, registry.find(host, parentID));
+    ASSERT_EQ(nullptr, registry.find(Host(IP::parse("192.168.0.2"), 7144), chanID));
+
+    session->rejected(chanID);
+    ASSERT_EQ(nullptr, registry.find(host, chanID));
+    ASSERT_EQ(session, registry.find(host, GnuID("00000000000000000000000000000003")));
+
+    session->close();
+    ASSERT_EQ(nullptr, registry.find(host, GnuID("00000000000000000000000000000003")));
+
+    registry.remove(session);
+    ASSERT_EQ(0, registry.numSessions());
+}
@@ -4,6 +4,8 @@
 #include "atom.h"
 #include "sstream.h"
 #include "channel.h"
+#include "chanmgr.h"
+#include "pkttrace.h"
 
 class PCPStreamFixture : public ::testing::Test {
 public:
@@ -52,3 +54,314 @@ TEST_F(PCPStreamFixture, bigDataPacket)
 
     ASSERT_THROW(m_pcp.readPktAtoms(ch, atom, numc, bcs), StreamException);
 }
+
+TEST_F(PCPStreamFixture, tracedDataPacket)
+{
+    auto ch = std::make_shared<Channel>();
+    ch->info.id = GnuID("0123456789abcdef0123456789abcdef");
+
+    StringStream mem;
+    AtomStream out(mem);
+    out.writeID4(PCP_CHAN_PKT_TYPE, PCP_CHAN_PKT_DATA);
+    out.writeInt(PCP_CHAN_PKT_POS, 0);
+    out.writeParent(PCP_CHAN_PKT_TRACE, 4);
+        out.writeInt(PCP_TRACE_ID, 42);
+        out.writeInt(PCP_TRACE_TIME, 1234);
+        out.writeInt(PCP_TRACE_HOPS, 1);
+        out.writeInt(PCP_TRACE_RESIDENCE, 500);
+    out.writeBytes(PCP_CHAN_PKT_DATA, "hello", 5);
+    mem.rewind();
+
+    AtomStream atom(mem);
+    BroadcastState bcs;
+    ASSERT_NO_THROW(m_pcp.readPktAtoms(ch, atom, 4, bcs));
+
+    std::shared_ptr<const ChanPacketSlab> slab;
+    ASSERT_TRUE(ch->rawData.findPacket(0, slab));
+    ASSERT_EQ(42, slab->trace.id);
+    ASSERT_EQ(1234, slab->trace.originTime);
+    ASSERT_EQ(2, slab->trace.hops);
+    ASSERT_EQ(500, slab->trace.residence);
+}
+
+static void readPkt(PCPStream& pcp, std::shared_ptr<Channel> ch, bool head, unsigned int pos, const std::string& data)
+{
+    StringStream mem;
+    AtomStream out(mem);
+    out.writeID4(PCP_CHAN_PKT_TYPE, head ? PCP_CHAN_PKT_HEAD : PCP_CHAN_PKT_DATA);
+    out.writeInt(PCP_CHAN_PKT_POS, pos);
+    out.writeBytes(PCP_CHAN_PKT_DATA, data.data(), data.size());
+    mem.rewind();
+
+    AtomStream atom(mem);
+    BroadcastState bcs;
+    pcp.readPktAtoms(ch, atom, 3, bcs);
+}
+
+// 繋ぎ直した上流が同じヘッダーと古いパケットから送ってきても、ストリー
+// ムを続ける。
+TEST_F(PCPStreamFixture, resumeAfterReconnect)
+{
+    auto ch = std::make_shared<Channel>();
+
+    readPkt(m_pcp, ch, true, 0, "HEAD");
+    ASSERT_EQ(1, ch->streamIndex);
+    readPkt(m_pcp, ch, false, 4, "aaaa");
+    readPkt(m_pcp, ch, false, 8, "bbbb");
+    ASSERT_EQ(12, ch->streamPos);
+    ASSERT_EQ(3, ch->rawData.writePos);
+
+    // 新しい上流。
+    readPkt(m_pcp, ch, true, 0, "HEAD");
+    readPkt(m_pcp, ch, false, 8, "bbbb");
+    ASSERT_EQ(1, ch->streamIndex);
+    ASSERT_EQ(12, ch->streamPos);
+    ASSERT_EQ(8, ch->rawData.getLatestPos());
+
+    readPkt(m_pcp, ch, false, 12, "cccc");
+    ASSERT_EQ(16, ch->streamPos);
+    ASSERT_EQ(12, ch->rawData.getLatestPos());
+    ASSERT_EQ(4, ch->rawData.writePos);
+}
+
+// ヘッダーが変われば始めからやり直す。
+TEST_F(PCPStreamFixture, restartOnNewHeader)
+{
+    auto ch = std::make_shared<Channel>();
+
+    readPkt(m_pcp, ch, true, 0, "HEAD");
+    readPkt(m_pcp, ch, false, 4, "aaaa");
+
+    readPkt(m_pcp, ch, true, 0, "NEWHEAD");
+    ASSERT_EQ(2, ch->streamIndex);
+    ASSERT_EQ(7, ch->streamPos);
+    ASSERT_EQ(0, ch->rawData.getLatestPos());
+    ASSERT_EQ("NEWHEAD", std::string(ch->headPack.data, ch->headPack.len));
+}
+
+static ChanPacket hostUpdatePacket(const GnuID& hostID, int numl)
+{
+    ChanPacket pack;
+    MemoryStream mem(pack.data, sizeof(pack.data));
+    AtomStream atom(mem);
+    atom.writeParent(PCP_BCST, 4);
+        atom.writeChar(PCP_BCST_GROUP, PCP_BCST_GROUP_TRACKERS);
+        atom.writeChar(PCP_BCST_TTL, 7);
+        atom.writeBytes(PCP_BCST_CHANID, GnuID("00112233445566778899aabbccddeeff").id, 16);
+        atom.writeParent(PCP_HOST, 2);
+            atom.writeBytes(PCP_HOST_ID, hostID.id, 16);
+            atom.writeInt(PCP_HOST_NUML, numl);
+    pack.len = mem.pos;
+    pack.type = ChanPacket::T_PCP;
+    return pack;
+}
+
+TEST_F(PCPStreamFixture, hostUpdatesAreCoalesced)
+{
+    GnuID a("0000000000000000000000000000000a");
+    GnuID b("0000000000000000000000000000000b");
+    auto a1 = hostUpdatePacket(a, 1);
+    auto a2 = hostUpdatePacket(a, 2);
+    auto b1 = hostUpdatePacket(b, 1);
+
+    ASSERT_TRUE(m_pcp.sendPacket(a1, GnuID()));
+    ASSERT_TRUE(m_pcp.sendPacket(b1, GnuID()));
+    ASSERT_TRUE(m_pcp.sendPacket(a2, GnuID()));
+    ASSERT_EQ(0, m_pcp.outData.numPending());
+    ASSERT_EQ(1, m_pcp.numHostUpdatesDropped);
+
+    // a の古い更新は捨てられ、残りは一つのパケットで送られる。
+    m_pcp.releaseHostUpdates(true);
+    ASSERT_EQ(1, m_pcp.outData.numPending());
+    ChanPacket out;
+    m_pcp.outData.readPacket(out);
+    ASSERT_EQ(a2.len + b1.len, out.len);
+    ASSERT_EQ(std::string(a2.data, a2.len) + std::string(b1.data, b1.len),
+              std::string(out.data, out.len));
+}
+
+TEST_F(PCPStreamFixture, nonHostBroadcastIsNotCoalesced)
+{
+    ChanPacket pack;
+    MemoryStream mem(pack.data, sizeof(pack.data));
+    AtomStream atom(mem);
+    atom.writeParent(PCP_BCST, 1);
+        atom.writeChar(PCP_BCST_TTL, 7);
+    pack.len = mem.pos;
+    pack.type = ChanPacket::T_PCP;
+
+    std::string key;
+    ASSERT_FALSE(PCPStream::hostUpdateKey(pack, key));
+    ASSERT_TRUE(m_pcp.sendPacket(pack, GnuID()));
+    ASSERT_EQ(1, m_pcp.outData.numPending());
+}
+
+TEST_F(PCPStreamFixture, priorityLaneIsSentFirst)
+{
+    ChanPacket bcst;
+    {
+        MemoryStream mem(bcst.data, sizeof(bcst.data));
+        AtomStream atom(mem);
+        atom.writeParent(PCP_BCST, 1);
+            atom.writeChar(PCP_BCST_TTL, 7);
+        bcst.len = mem.pos;
+        bcst.type = ChanPacket::T_PCP;
+    }
+    ChanPacket quit;
+    {
+        MemoryStream mem(quit.data, sizeof(quit.data));
+        AtomStream atom(mem);
+        atom.writeInt(PCP_QUIT, 1000);
+        quit.len = mem.pos;
+        quit.type = ChanPacket::T_PCP;
+    }
+
+    ASSERT_FALSE(PCPStream::isPriorityPacket(bcst));
+    ASSERT_TRUE(PCPStream::isPriorityPacket(quit));
+
+    ASSERT_TRUE(m_pcp.sendPacket(bcst, GnuID()));
+    ASSERT_TRUE(m_pcp.sendPacket(quit, GnuID()));
+    ASSERT_EQ(bcst.len, m_pcp.outBytes);
+    ASSERT_TRUE(m_pcp.hasPendingOutput());
+
+    StringStream out;
+    ASSERT_EQ(quit.len + bcst.len, m_pcp.writePending(out, PCPStream::MAX_WRITE_BATCH));
+    ASSERT_EQ(std::string(quit.data, quit.len) + std::string(bcst.data, bcst.len), out.str());
+    ASSERT_FALSE(m_pcp.hasPendingOutput());
+    ASSERT_EQ(0, m_pcp.outBytes);
+}
+
+TEST_F(PCPStreamFixture, completeAtomSize)
+{
+    std::string s;
+    {
+        StringStream mem;
+        AtomStream atom(mem);
+        atom.writeParent(PCP_BCST, 2);
+            atom.writeChar(PCP_BCST_TTL, 7);
+            atom.writeInt(PCP_BCST_HOPS, 1);
+        s = mem.str();
+    }
+    ASSERT_EQ(8 + 9 + 12, s.size());
+
+    for (size_t i = 0; i < s.size(); i++)
+        ASSERT_EQ(0, PCPStream::completeAtomSize(s.data(), i));
+    ASSERT_EQ(s.size(), PCPStream::completeAtomSize(s.data(), s.size()));
+    ASSERT_EQ(s.size(), PCPStream::completeAtomSize((s + "xyz").data(), s.size() + 3));
+
+    // ChanPacket に収まらない大きさは、全部届く前に分かる。
+    std::string big = std::string("data") + std::string("\x01\x00\x01\x00", 4);
+    ASSERT_THROW(PCPStream::completeAtomSize(big.data(), big.size()), StreamException);
+}
+
+TEST_F(PCPStreamFixture, readAvailableAssemblesAtoms)
+{
+    GnuID chanID("00000000000000000000000000000002");
+    StringStream mem;
+    AtomStream out(mem);
+    out.writeParent(PCP_MUX_SUB, 2);
+        out.writeBytes(PCP_CHAN_ID, chanID.id, 16);
+        out.writeInt(PCP_CHAN_PKT_POS, 1234);
+    out.writeParent(PCP_MUX_UNSUB, 1);
+        out.writeBytes(PCP_CHAN_ID, chanID.id, 16);
+
+    std::vector<std::pair<bool, unsigned int>> calls;
+    m_pcp.muxHandler = [&](bool subscribe, const GnuID& id, unsigned int pos)
+    {
+        calls.push_back({ subscribe, pos });
+    };
+
+    // 7 バイトずつ届けるので、アトムは何度かに分かれる。
+    const std::string data = mem.str();
+    std::string buf;
+    BroadcastState bcs;
+    for (size_t pos = 0; pos < data.size(); pos += 7)
+    {
+        StringStream chunk(data.substr(pos, 7));
+        ASSERT_EQ(0, m_pcp.readAvailable(chunk, buf, bcs));
+        if (pos + 7 < data.size() && calls.size() < 2)
+            ASSERT_FALSE(buf.empty());
+    }
+    ASSERT_TRUE(buf.empty());
+
+    ASSERT_EQ(2, calls.size());
+    ASSERT_TRUE(calls[0].first);
+    ASSERT_EQ(1234, calls[0].second);
+    ASSERT_FALSE(calls[1].first);
+
+    // 読めなくなったらエラー。
+    StringStream empty;
+    ASSERT_NE(0, m_pcp.readAvailable(empty, buf, bcs));
+}
+
+TEST_F(PCPStreamFixture, readAvailableBatchesHits)
+{
+    GnuID chanID("00000000000000000000000000000003");
+    StringStream mem;
+    AtomStream out(mem);
+    for (int i = 1; i <= 3; i++)
+    {
+        out.writeParent(PCP_HOST, 5);
+            out.writeBytes(PCP_HOST_CHANID, chanID.id, 16);
+            out.writeInt(PCP_HOST_IP, (192 << 24) | (2 << 8) | i);
+            out.writeShort(PCP_HOST_PORT, 7144);
+            out.writeInt(PCP_HOST_NUML, i);
+            out.writeChar(PCP_HOST_FLAGS1, PCP_HOST_FLAGS1_RECV | PCP_HOST_FLAGS1_RELAY);
+    }
+    // 3 番目は消える。
+    out.writeParent(PCP_HOST, 4);
+        out.writeBytes(PCP_HOST_CHANID, chanID.id, 16);
+        out.writeInt(PCP_HOST_IP, (192 << 24) | (2 << 8) | 3);
+        out.writeShort(PCP_HOST_PORT, 7144);
+        out.writeChar(PCP_HOST_FLAGS1, 0);
+
+    StringStream in(mem.str());
+    std::string buf;
+    BroadcastState bcs;
+    ASSERT_EQ(0, m_pcp.readAvailable(in, buf, bcs));
+    ASSERT_TRUE(m_pcp.pendingHits.empty());
+
+    auto hl = chanMgr->findHitListByID(chanID);
+    ASSERT_TRUE(hl != nullptr);
+    int numHits = hl->numHits();
+    int numListeners = hl->numListeners();
+    chanMgr->clearHitLists();
+    ASSERT_EQ(2, numHits);
+    ASSERT_EQ(1 + 2, numListeners);
+}
+
+TEST_F(PCPStreamFixture, writeOutput)
+{
+    ChanPacket quit;
+    {
+        MemoryStream mem(quit.data, sizeof(quit.data));
+        AtomStream atom(mem);
+        atom.writeInt(PCP_QUIT, 1000);
+        quit.len = mem.pos;
+        quit.type = ChanPacket::T_PCP;
+    }
+    ASSERT_TRUE(m_pcp.sendPacket(quit, GnuID()));
+
+    StringStream out;
+    WriteBufferedStream bout(&out);
+    ASSERT_EQ(0, m_pcp.writeOutput(bout));
+    bout.flush();
+    ASSERT_EQ(std::string(quit.data, quit.len), out.str());
+    ASSERT_FALSE(m_pcp.hasPendingOutput());
+}
+
+TEST_F(PCPStreamFixture, hasUpstreamOutput)
+{
+    ASSERT_FALSE(m_pcp.hasUpstreamOutput());
+
+    // 貯めているだけのホスト情報も、送るものとして数える。
+    auto a1 = hostUpdatePacket(GnuID("0000000000000000000000000000000a"), 1);
+    ASSERT_TRUE(m_pcp.sendPacket(a1, GnuID()));
+    ASSERT_FALSE(m_pcp.hasPendingOutput());
+    ASSERT_TRUE(m_pcp.hasUpstreamOutput());
+
+    StringStream out;
+    m_pcp.flush(out);
+    ASSERT_FALSE(m_pcp.hasUpstreamOutput());
+    ASSERT_EQ(a1.len, out.str().size());
+}
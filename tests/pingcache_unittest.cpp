@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "pingcache.h"
+#include "mocksys.h"
+
+class PingCacheFixture : public ::testing::Test {
+public:
+    PingCacheFixture()
+        : host(IP::parse("203.0.113.1"), 7144)
+        , sid("00000000000000000000000000000001")
+        , pings(0)
+        , result(true)
+        , cache([this](const Host&, const GnuID&) { pings++; return result.load(); })
+    {
+        mock = dynamic_cast<MockSys*>(sys);
+        savedTime = mock->time;
+        mock->time = 1000;
+    }
+
+    ~PingCacheFixture()
+    {
+        mock->time = savedTime;
+    }
+
+    Host host;
+    GnuID sid;
+    std::atomic<int> pings;
+    std::atomic<bool> result;
+    PingCache cache;
+    MockSys* mock;
+    unsigned int savedTime;
+};
+
+TEST_F(PingCacheFixture, remembersResult)
+{
+    ASSERT_TRUE(cache.verify(host, sid));
+    ASSERT_TRUE(cache.verify(host, sid));
+    ASSERT_EQ(1, pings);
+    ASSERT_EQ(1, cache.numHits());
+
+    bool ok;
+    ASSERT_TRUE(cache.lookup(host, sid, ok));
+    ASSERT_TRUE(ok);
+}
+
+TEST_F(PingCacheFixture, expires)
+{
+    ASSERT_TRUE(cache.verify(host, sid));
+
+    mock->time += PingCache::OK_TTL + 1;
+    result = false;
+    ASSERT_FALSE(cache.verify(host, sid));
+    ASSERT_EQ(2, pings);
+
+    // 失敗は短い間だけ覚えておく。
+    mock->time += PingCache::FAIL_TTL;
+    ASSERT_FALSE(cache.verify(host, sid));
+    ASSERT_EQ(2, pings);
+    mock->time += 1;
+    result = true;
+    ASSERT_TRUE(cache.verify(host, sid));
+    ASSERT_EQ(3, pings);
+}
+
+TEST_F(PingCacheFixture, differentNodeIsPingedAgain)
+{
+    ASSERT_TRUE(cache.verify(host, sid));
+    result = false;
+    ASSERT_FALSE(cache.verify(host, GnuID("00000000000000000000000000000002")));
+    ASSERT_FALSE(cache.verify(Host(IP::parse("203.0.113.1"), 7145), sid));
+    ASSERT_EQ(3, pings);
+}
+
+TEST_F(PingCacheFixture, concurrentRequestsShareOnePing)
+{
+    std::mutex gate;
+    std::unique_lock<std::mutex> held(gate);
+    PingCache slow([&](const Host&, const GnuID&)
+                   {
+                       std::lock_guard<std::mutex> wait(gate);
+                       pings++;
+                       return true;
+                   });
+
+    std::vector<std::thread> threads;
+    std::atomic<int> oks(0);
+    for (int i = 0; i < 4; i++)
+        threads.emplace_back([&]() { if (slow.verify(host, sid)) oks++; });
+
+    // 全員が待ちに入るまで待つ。
+    while (slow.numHits() < 3)
+        std::this_thread::yield();
+    held.unlock();
+
+    for (auto& t : threads)
+        t.join();
+    ASSERT_EQ(4, oks);
+    ASSERT_EQ(1, pings);
+    ASSERT_EQ(1, slow.numPings());
+}
+
+TEST_F(PingCacheFixture, stoppedCacheDoesNotPing)
+{
+    cache.stop();
+    ASSERT_FALSE(cache.verify(host, sid));
+    ASSERT_EQ(0, pings);
+}
@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+
+#include "pkttrace.h"
+#include "atom.h"
+#include "pcp.h"
+#include "sstream.h"
+#include "mocksys.h"
+
+class PacketTracerFixture : public ::testing::Test {
+public:
+    void SetUp()
+    {
+        dtime_ = dynamic_cast<MockSys*>(sys)->dtime;
+        dynamic_cast<MockSys*>(sys)->dtime = 1000.0;
+        chanID.fromStr("0123456789abcdef0123456789abcdef");
+    }
+
+    void TearDown()
+    {
+        dynamic_cast<MockSys*>(sys)->dtime = dtime_;
+    }
+
+    static ChanPacket dataPacket(unsigned int pos)
+    {
+        ChanPacket pack;
+        pack.type = ChanPacket::T_DATA;
+        pack.pos = pos;
+        pack.len = 5;
+        memcpy(pack.data, "hello", 5);
+        return pack;
+    }
+
+    double dtime_;
+    GnuID chanID;
+    PacketTracer tracer;
+};
+
+TEST_F(PacketTracerFixture, samplesOncePerInterval)
+{
+    unsigned int last = 0;
+
+    auto a = dataPacket(0);
+    tracer.sample(chanID, a, last);
+    ASSERT_NE(0, a.trace.id);
+    ASSERT_EQ(1000000, a.trace.originTime);
+    ASSERT_EQ(0, a.trace.hops);
+
+    dynamic_cast<MockSys*>(sys)->dtime = 1000.5;
+    auto b = dataPacket(5);
+    tracer.sample(chanID, b, last);
+    ASSERT_EQ(0, b.trace.id);
+
+    dynamic_cast<MockSys*>(sys)->dtime = 1001.0;
+    auto c = dataPacket(10);
+    tracer.sample(chanID, c, last);
+    ASSERT_NE(0, c.trace.id);
+
+    // ヘッダーには付けない。
+    ChanPacket head = dataPacket(15);
+    head.type = ChanPacket::T_HEAD;
+    last = 0;
+    tracer.sample(chanID, head, last);
+    ASSERT_EQ(0, head.trace.id);
+
+    auto events = tracer.events(GnuID());
+    ASSERT_EQ(2, events.size());
+    ASSERT_EQ(PacketTracer::K_INGEST, events[0].kind);
+    ASSERT_EQ(0, events[0].pos);
+    ASSERT_EQ(10, events[1].pos);
+}
+
+TEST_F(PacketTracerFixture, initClearsTrace)
+{
+    unsigned int last = 0;
+    auto pack = dataPacket(0);
+    tracer.sample(chanID, pack, last);
+    ASSERT_NE(0, pack.trace.id);
+
+    pack.init(ChanPacket::T_DATA, "x", 1, 5);
+    ASSERT_EQ(0, pack.trace.id);
+}
+
+TEST_F(PacketTracerFixture, traceAtomRoundTrip)
+{
+    ChanPacketBuffer buf;
+    auto pack = dataPacket(0);
+    pack.trace = { 42, 999000, 2, 1500 };
+    ASSERT_TRUE(buf.writePacket(pack));
+
+    std::shared_ptr<const ChanPacketSlab> slab;
+    ASSERT_TRUE(buf.findPacket(0, slab));
+    ASSERT_EQ(42, slab->trace.id);
+
+    // 印の付いたパケットは共有のフレームを使わない。
+    const char *frame;
+    int len;
+    ASSERT_FALSE(slab->pcpFrame(chanID, frame, len));
+
+    // このノードに 0.25 秒居たことにする。
+    dynamic_cast<MockSys*>(sys)->dtime = slab->time + 0.25;
+
+    StringStream mem;
+    AtomStream atom(mem);
+    PacketTracer::writeTraceAtom(atom, *slab);
+
+    mem.rewind();
+    int c, d;
+    ASSERT_EQ(PCP_CHAN_PKT_TRACE, atom.read(c, d));
+    PacketTrace trace = {};
+    PacketTracer::readTraceAtoms(atom, c, trace);
+    ASSERT_EQ(42, trace.id);
+    ASSERT_EQ(999000, trace.originTime);
+    ASSERT_EQ(2, trace.hops);
+    ASSERT_NEAR(1500 + 250000, trace.residence, 1);
+}
+
+TEST_F(PacketTracerFixture, receivedAndSent)
+{
+    auto pack = dataPacket(100);
+    pack.trace = { 7, 999800, 0, 3000 };
+
+    tracer.received(chanID, pack, "192.168.0.1:7144");
+    ASSERT_EQ(1, pack.trace.hops);
+
+    ChanPacketBuffer buf;
+    ASSERT_TRUE(buf.writePacket(pack));
+    std::shared_ptr<const ChanPacketSlab> slab;
+    ASSERT_TRUE(buf.findPacket(100, slab));
+
+    dynamic_cast<MockSys*>(sys)->dtime = slab->time + 0.01;
+    tracer.sent(chanID, *slab, "192.168.0.2:7144");
+
+    auto events = tracer.events(chanID);
+    ASSERT_EQ(2, events.size());
+
+    ASSERT_EQ(PacketTracer::K_RECV, events[0].kind);
+    ASSERT_EQ(7, events[0].traceID);
+    ASSERT_EQ(1, events[0].hops);
+    ASSERT_EQ(200, events[0].age);
+    ASSERT_EQ(3000, events[0].upstreamResidence);
+    ASSERT_EQ("192.168.0.1:7144", events[0].peer);
+
+    ASSERT_EQ(PacketTracer::K_SEND, events[1].kind);
+    ASSERT_NEAR(10000, events[1].residence, 1);
+    ASSERT_EQ("192.168.0.2:7144", events[1].peer);
+
+    GnuID other;
+    other.fromStr("ffffffffffffffffffffffffffffffff");
+    ASSERT_EQ(0, tracer.events(other).size());
+
+    tracer.clear();
+    ASSERT_EQ(0, tracer.events(GnuID()).size());
+}
@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+
+#include <condition_variable>
+#include <mutex>
+
+#include "portcheck.h"
+#include "common.h"
+
+class PortCheckJobsFixture : public ::testing::Test {
+};
+
+TEST_F(PortCheckJobsFixture, runsInBackground)
+{
+    std::mutex m;
+    std::condition_variable cv;
+    bool release = false;
+
+    PortCheckJobs jobs([&](int ipv) -> std::string
+    {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&]() { return release; });
+        return (ipv == 4) ? "OFF" : "ON";
+    });
+
+    ASSERT_EQ(0, jobs.status(4).finishedAt);
+    ASSERT_TRUE(jobs.start(4));
+    ASSERT_TRUE(jobs.status(4).running);
+    // 走っている間は重ねて始めない。
+    ASSERT_FALSE(jobs.start(4));
+    ASSERT_FALSE(jobs.status(6).running);
+
+    {
+        std::lock_guard<std::mutex> lock(m);
+        release = true;
+    }
+    cv.notify_all();
+    jobs.wait();
+
+    auto st = jobs.status(4);
+    ASSERT_FALSE(st.running);
+    ASSERT_EQ("OFF", st.result);
+    ASSERT_EQ("", st.error);
+
+    ASSERT_TRUE(jobs.start(6));
+    jobs.wait();
+    ASSERT_EQ("ON", jobs.status(6).result);
+
+    auto state = jobs.getState();
+    ASSERT_EQ("0", state.at("ipv4").at("running").string());
+    ASSERT_EQ("OFF", state.at("ipv4").at("result").string());
+    ASSERT_EQ("ON", state.at("ipv6").at("result").string());
+}
+
+TEST_F(PortCheckJobsFixture, keepsLastResultOnError)
+{
+    bool fail = false;
+    PortCheckJobs jobs([&](int) -> std::string
+    {
+        if (fail)
+            throw GeneralException("network unreachable");
+        return "OFF";
+    });
+
+    jobs.start(4);
+    jobs.wait();
+    fail = true;
+    jobs.start(4);
+    jobs.wait();
+
+    auto st = jobs.status(4);
+    ASSERT_EQ("OFF", st.result);
+    ASSERT_EQ("network unreachable", st.error);
+}
+
+TEST_F(PortCheckJobsFixture, invalidVersion)
+{
+    PortCheckJobs jobs([](int) { return std::string("OFF"); });
+    ASSERT_THROW(jobs.start(5), ArgumentException);
+}
@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+
+#ifndef WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "prefork.h"
+
+TEST(PreforkTest, shardOf)
+{
+    GnuID id("00112233445566778899aabbccddeeff");
+
+    ASSERT_EQ(0, Prefork::shardOf(id, 0));
+    ASSERT_EQ(0, Prefork::shardOf(id, 1));
+
+    // 全てのワーカーに振り分けられる。
+    std::vector<int> counts(4);
+    for (int i = 0; i < 256; i++)
+    {
+        id.id[0] = i;
+        int s = Prefork::shardOf(id, 4);
+        ASSERT_LE(0, s);
+        ASSERT_GT(4, s);
+        counts[s]++;
+    }
+    for (auto n : counts)
+        ASSERT_LT(0, n);
+}
+
+TEST(PreforkTest, ownerOf)
+{
+    GnuID id("00112233445566778899aabbccddeeff");
+    int shard = Prefork::shardOf(id, 4);
+
+    ASSERT_EQ(shard, Prefork::ownerOf("GET /stream/00112233445566778899AABBCCDDEEFF.flv HTTP/1.1", 4));
+    ASSERT_EQ(shard, Prefork::ownerOf("GET /channel/00112233445566778899aabbccddeeff HTTP/1.0", 4));
+    ASSERT_EQ(shard, Prefork::ownerOf("GET /pls/00112233445566778899aabbccddeeff.m3u HTTP/1.1", 4));
+    ASSERT_EQ(shard, Prefork::ownerOf("GET /hls/00112233445566778899aabbccddeeff/playlist.m3u8 HTTP/1.1", 4));
+
+    // チャンネルを含まない要求はワーカー 0。
+    ASSERT_EQ(0, Prefork::ownerOf("GET /html/en/index.html HTTP/1.1", 4));
+    ASSERT_EQ(0, Prefork::ownerOf("POST /api/1 HTTP/1.1", 4));
+    ASSERT_EQ(0, Prefork::ownerOf("GET /stream/xyz HTTP/1.1", 4));
+
+    // PCP などはどのワーカーでもよい。
+    ASSERT_EQ(-1, Prefork::ownerOf("pcp", 4));
+    ASSERT_EQ(-1, Prefork::ownerOf("", 4));
+}
+
+TEST(PreforkTest, claimIDDisabled)
+{
+    Prefork prefork;
+    GnuID id("00112233445566778899aabbccddeeff");
+    GnuID orig = id;
+
+    prefork.claimID(id);
+    ASSERT_TRUE(id.isSame(orig));
+    ASSERT_TRUE(prefork.isPrimary());
+    ASSERT_TRUE(prefork.isLocal(id));
+    ASSERT_FALSE(prefork.handOff(nullptr));
+}
+
+#ifndef WIN32
+TEST(PreforkTest, sendRecvSocket)
+{
+    int chan[2], conn[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, chan));
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, conn));
+
+    ASSERT_EQ(-1, Prefork::recvSocket(chan[0], 0));
+
+    ASSERT_EQ(7, write(conn[1], "GET / \n", 7));
+    // 覗いただけなので、渡した先でも読める。
+    ASSERT_EQ("GET / ", Prefork::peekLine(conn[0], 0));
+
+    ASSERT_TRUE(Prefork::sendSocket(chan[1], conn[0]));
+    int fd = Prefork::recvSocket(chan[0], 1000);
+    ASSERT_LE(0, fd);
+
+    char buf[8];
+    ASSERT_EQ(7, read(fd, buf, sizeof(buf)));
+    ASSERT_EQ("GET / \n", std::string(buf, 7));
+
+    close(fd);
+    close(conn[1]);
+    close(chan[0]);
+    close(chan[1]);
+}
+#endif
@@ -79,3 +79,40 @@ TEST_F(PublicControllerFixture, jsonToAmf)
     ASSERT_EQ(obj.size(), 3);
     ASSERT_TRUE(jsonToAmf(nullptr).isNull());
 }
+
+#include "eventbus.h"
+#include "mocksys.h"
+#include "servmgr.h"
+
+TEST_F(PublicControllerFixture, renderPageIsCached)
+{
+    PublicController::clearPageCache();
+    auto msys = static_cast<MockSys*>(sys);
+    auto oldTime = msys->time;
+    msys->time = 1000;
+
+    int calls = 0;
+    auto render = [&](Stream& out) { calls++; out.writeString("page" + std::to_string(calls)); };
+    HTTPRequest req("GET", "/public/index.html", "HTTP/1.1", {{"Host", "localhost:7144"}});
+
+    auto res = PublicController::renderPage(req, "index.html.ja", "ja", render);
+    ASSERT_EQ(200, res.statusCode);
+    ASSERT_EQ("page1", res.body);
+    ASSERT_EQ("ja", res.headers.get("Content-Language"));
+    ASSERT_EQ("page1", PublicController::renderPage(req, "index.html.ja", "ja", render).body);
+    ASSERT_EQ(1, calls);
+
+    // 言語が違えば別のページ。
+    ASSERT_EQ("page2", PublicController::renderPage(req, "index.html.en", "en", render).body);
+
+    // 状態が変われば描き直す。
+    g_eventBus.publish("channelStatus", amf0::Value::object({}));
+    ASSERT_EQ("page3", PublicController::renderPage(req, "index.html.ja", "ja", render).body);
+
+    // 時間が経っても描き直す。
+    msys->time += servMgr->publicPageCacheInterval;
+    ASSERT_EQ("page4", PublicController::renderPage(req, "index.html.ja", "ja", render).body);
+
+    PublicController::clearPageCache();
+    msys->time = oldTime;
+}
@@ -54,3 +54,32 @@ TEST_F(QueryFixture, add)
     query1.add("b b", "2 2");
     ASSERT_EQ("a+a=1+1&b+b=2+2", query1.str());
 }
+
+TEST_F(QueryFixture, escapedValues)
+{
+    Query q("name=%E3%81%82+b&url=http%3A%2F%2Fexample.com%2F%3Fa%3D1&bad=%zz%4");
+    ASSERT_EQ("あ b", q.get("name"));
+    ASSERT_EQ("http://example.com/?a=1", q.get("url"));
+    // 壊れたエスケープはそのまま。
+    ASSERT_EQ("%zz%4", q.get("bad"));
+}
+
+TEST_F(QueryFixture, valueContainingEquals)
+{
+    Query q("a=b=c&&d=");
+    ASSERT_EQ("b=c", q.get("a"));
+    ASSERT_TRUE(q.hasKey("d"));
+    ASSERT_EQ(1, q.getAll("d").size());
+    ASSERT_EQ("", q.get("d"));
+}
+
+TEST_F(QueryFixture, lookup)
+{
+    std::string v;
+    ASSERT_TRUE(Query::lookup("a=1&id=%41B&id=2", "id", v));
+    ASSERT_EQ("AB", v);
+    ASSERT_TRUE(Query::lookup("a=1&c", "c", v));
+    ASSERT_EQ("", v);
+    ASSERT_FALSE(Query::lookup("a=1&ab=2", "b", v));
+    ASSERT_FALSE(Query::lookup("", "a", v));
+}
@@ -0,0 +1,61 @@
+#ifndef REALSYSFIXTURE_H
+#define REALSYSFIXTURE_H
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+#include "sys.h"
+#ifdef _UNIX
+#include "usys.h"
+#endif
+
+// MockSys はスレッドを起動しないので、スレッドを使うテストはこれを継い
+// で本物の sys に差し替える。_UNIX 以外では飛ばす。継いだクラスの
+// SetUp と TearDown はこちらのものを呼ぶ。
+class RealSysFixture : public ::testing::Test {
+public:
+    RealSysFixture()
+        : m_sys(nullptr)
+    {
+    }
+
+    void SetUp() override
+    {
+#ifdef _UNIX
+        m_sys = sys;
+        sys = new USys();
+#else
+        GTEST_SKIP();
+#endif
+    }
+
+    void TearDown() override
+    {
+        if (m_sys)
+        {
+            delete sys;
+            sys = m_sys;
+            m_sys = nullptr;
+        }
+    }
+
+    // cond が真になるまで最大 timeoutMsec ミリ秒待つ。
+    template <typename F>
+    static bool waitUntil(F cond, int timeoutMsec = 1000)
+    {
+        for (int i = 0; i < timeoutMsec / 10; i++)
+        {
+            if (cond())
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return cond();
+    }
+
+private:
+    Sys* m_sys;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "recorder.h"
+#include "mocksys.h"
+
+class ChannelRecorderFixture : public ::testing::Test {
+public:
+    ChannelRecorderFixture()
+    {
+        char tmpl[] = "/tmp/recorderXXXXXX";
+        prefix = mkdtemp(tmpl);
+        prefix += "/rec";
+
+        dtime_ = dynamic_cast<MockSys*>(sys)->dtime;
+    }
+
+    ~ChannelRecorderFixture()
+    {
+        dynamic_cast<MockSys*>(sys)->dtime = dtime_;
+        for (int i = 1; i <= 3; i++)
+            unlink(str::format("%s-%03d.flv", prefix.c_str(), i).c_str());
+        rmdir(prefix.substr(0, prefix.size() - 4).c_str());
+    }
+
+    std::shared_ptr<const ChanPacketSlab> packet(ChanPacket::TYPE type, const std::string& data,
+                                                 bool cont, double time = 0)
+    {
+        dynamic_cast<MockSys*>(sys)->dtime = time;
+
+        ChanPacket p;
+        p.init(type, data.data(), data.size(), pos);
+        p.cont = cont;
+        pos += data.size();
+        return arena.allocate(p);
+    }
+
+    static std::string readFile(const std::string& path)
+    {
+        FileStream f;
+        f.openReadOnly(path);
+        std::string s(f.length(), '\0');
+        f.read(&s[0], s.size());
+        return s;
+    }
+
+    std::string prefix;
+    ChanPacketArena arena;
+    unsigned int pos = 0;
+    double dtime_;
+};
+
+TEST_F(ChannelRecorderFixture, segmentPath)
+{
+    ChannelRecorder rec(prefix, ".flv", 0);
+    ASSERT_EQ(prefix + "-001.flv", rec.segmentPath(1));
+    ASSERT_EQ(prefix + "-012.flv", rec.segmentPath(12));
+}
+
+TEST_F(ChannelRecorderFixture, record)
+{
+    ChannelRecorder rec(prefix, ".flv", 0);
+    ChanPacket head;
+    head.init(ChanPacket::T_HEAD, "HEAD", 4, 0);
+    rec.setHeader(head);
+
+    // キーフレームまでは捨てる。
+    rec.put(packet(ChanPacket::T_DATA, "xx", true));
+    rec.put(packet(ChanPacket::T_DATA, "aaaa", false));
+    rec.put(packet(ChanPacket::T_DATA, "bbbb", true));
+    rec.start();
+    rec.put(packet(ChanPacket::T_DATA, "cccc", false));
+    rec.stop();
+
+    ASSERT_EQ(1, rec.numDropped());
+    ASSERT_EQ(1, rec.numSegments());
+    ASSERT_EQ(16, rec.bytesWritten());
+    ASSERT_EQ("HEADaaaabbbbcccc", readFile(rec.segmentPath(1)));
+
+    // 止めた後は積まない。
+    rec.put(packet(ChanPacket::T_DATA, "dddd", false));
+    ASSERT_EQ(16, rec.bytesWritten());
+}
+
+TEST_F(ChannelRecorderFixture, rotate)
+{
+    ChannelRecorder rec(prefix, ".flv", 10);
+
+    rec.put(packet(ChanPacket::T_HEAD, "HEAD", false, 0));
+    rec.put(packet(ChanPacket::T_DATA, "aaaa", false, 0));
+    rec.put(packet(ChanPacket::T_DATA, "bbbb", true, 11));
+    rec.put(packet(ChanPacket::T_DATA, "cccc", false, 12));
+    rec.put(packet(ChanPacket::T_DATA, "dddd", true, 13));
+    rec.start();
+    rec.stop();
+
+    ASSERT_EQ(2, rec.numSegments());
+    ASSERT_EQ("HEADaaaabbbb", readFile(rec.segmentPath(1)));
+    ASSERT_EQ("HEADccccdddd", readFile(rec.segmentPath(2)));
+}
+
+TEST_F(ChannelRecorderFixture, overflowSkipsToKeyFrame)
+{
+    ChannelRecorder rec(prefix, ".flv", 0, 8);
+
+    rec.put(packet(ChanPacket::T_DATA, "aaaa", false));
+    rec.put(packet(ChanPacket::T_DATA, "bbbb", true));
+    // 溢れたので次のキーフレームまで捨てる。
+    rec.put(packet(ChanPacket::T_DATA, "cccc", true));
+    rec.start();
+    rec.stop();
+    ASSERT_EQ(1, rec.numDropped());
+    ASSERT_EQ("aaaabbbb", readFile(rec.segmentPath(1)));
+}
@@ -148,3 +148,14 @@ TEST_F(RegexpFixture, grep)
     ASSERT_EQ(Regexp::grep(Regexp("a"), { "a", "ab", "bc" }),
               std::vector<std::string>({"a", "ab"}));
 }
+
+TEST_F(RegexpFixture, cached)
+{
+    auto r1 = Regexp::cached("^a+$");
+    auto r2 = Regexp::cached("^a+$");
+    ASSERT_EQ(r1.get(), r2.get());
+    ASSERT_TRUE(r1->matches("aaa"));
+    ASSERT_NE(r1.get(), Regexp::cached("^b+$").get());
+
+    ASSERT_THROW(Regexp::cached("("), std::regex_error);
+}
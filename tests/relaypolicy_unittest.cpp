@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+
+#include "channel.h"
+#include "relaypolicy.h"
+#include "mocksys.h"
+#include "str.h"
+
+class RelayPolicyFixture : public ::testing::Test {
+public:
+    RelayPolicyFixture()
+        : hitlist(std::make_shared<ChanHitList>())
+        , policy(stats)
+        , numHits(0)
+    {
+    }
+
+    void addHit(const char* ip, int hops, int relays = 0, bool relay = true, int headroom = -1)
+    {
+        ChanHit hit;
+        hit.init();
+        hit.host = hit.rhost[0] = Host(IP::parse(ip), 7144);
+        hit.numHops = hops;
+        hit.numRelays = relays;
+        hit.relay = relay;
+        hit.headroom = headroom;
+        hit.sessionID.fromStr(str::format("%032x", ++numHits).c_str());
+        hitlist->addHit(hit);
+    }
+
+    std::string pick(const RelayPolicy* p)
+    {
+        ChanHitSearch chs;
+        chs.policy = p;
+        if (!hitlist->pickHits(chs))
+            return "";
+        return chs.best[0].host.str();
+    }
+
+    static Host host(const char* ip)
+    {
+        return Host(IP::parse(ip), 7144);
+    }
+
+    std::shared_ptr<ChanHitList> hitlist;
+    RelayStats stats;
+    WeightedRelayPolicy policy;
+    int numHits;
+};
+
+TEST_F(RelayPolicyFixture, hopCountPicksFewestHops)
+{
+    addHit("192.0.2.1", 3);
+    addHit("192.0.2.2", 1, 10);
+    addHit("192.0.2.3", 1);
+
+    HopCountPolicy hops;
+    ASSERT_NE("192.0.2.1:7144", pick(&hops));
+    ASSERT_EQ(pick(nullptr), pick(&hops));
+
+    // 負荷を見れば空いている方になる。
+    ASSERT_EQ("192.0.2.3:7144", pick(&policy));
+}
+
+TEST_F(RelayPolicyFixture, prefersIdleRelay)
+{
+    addHit("192.0.2.1", 1, 12);
+    addHit("192.0.2.2", 2, 0);
+
+    ASSERT_EQ("192.0.2.2:7144", pick(&policy));
+}
+
+TEST_F(RelayPolicyFixture, avoidsFullRelay)
+{
+    addHit("192.0.2.1", 1, 0, false);
+    addHit("192.0.2.2", 3, 0, true);
+
+    ASSERT_EQ("192.0.2.2:7144", pick(&policy));
+}
+
+TEST_F(RelayPolicyFixture, prefersNearbyRelay)
+{
+    addHit("192.0.2.1", 1);
+    addHit("192.0.2.2", 2);
+
+    stats.recordConnect(host("192.0.2.1"), 0.4);
+    stats.recordConnect(host("192.0.2.2"), 0.02);
+    ASSERT_EQ("192.0.2.2:7144", pick(&policy));
+}
+
+TEST_F(RelayPolicyFixture, failuresExpire)
+{
+    addHit("192.0.2.1", 1);
+    addHit("192.0.2.2", 2);
+
+    stats.recordFailure(host("192.0.2.1"));
+    ASSERT_EQ("192.0.2.2:7144", pick(&policy));
+
+    dynamic_cast<MockSys*>(sys)->dtime += WeightedRelayPolicy::FAILURE_WINDOW + 1;
+    ASSERT_EQ("192.0.2.1:7144", pick(&policy));
+
+    stats.recordFailure(host("192.0.2.1"));
+    stats.recordSuccess(host("192.0.2.1"));
+    ASSERT_EQ("192.0.2.1:7144", pick(&policy));
+}
+
+TEST_F(RelayPolicyFixture, avoidsSlowRelay)
+{
+    addHit("192.0.2.1", 1);
+    addHit("192.0.2.2", 2);
+
+    stats.recordThroughput(host("192.0.2.1"), 0.5);
+    ASSERT_EQ("192.0.2.2:7144", pick(&policy));
+}
+
+TEST_F(RelayPolicyFixture, prefersRelayWithHeadroom)
+{
+    addHit("192.0.2.1", 1, 0, true, 100);
+    addHit("192.0.2.2", 2, 0, true, 5000);
+    addHit("192.0.2.3", 3, 0, true);
+
+    // ビットレートが分からなければ上りの残りは見ない。
+    ASSERT_EQ("192.0.2.1:7144", pick(&policy));
+
+    policy.bitrate = 1000;
+    ASSERT_EQ("192.0.2.2:7144", pick(&policy));
+}
+
+TEST_F(RelayPolicyFixture, statsAreSmoothed)
+{
+    RelayStats::Entry e;
+    ASSERT_FALSE(stats.get(host("192.0.2.1"), e));
+
+    stats.recordConnect(host("192.0.2.1"), 1.0);
+    stats.recordConnect(host("192.0.2.1"), 0.0);
+    stats.recordThroughput(host("192.0.2.1"), 2.0);
+    ASSERT_TRUE(stats.get(host("192.0.2.1"), e));
+    ASSERT_DOUBLE_EQ(0.7, e.rtt);
+    ASSERT_DOUBLE_EQ(1.0, e.throughput);
+    ASSERT_EQ(0, e.failures);
+
+    stats.clear();
+    ASSERT_FALSE(stats.get(host("192.0.2.1"), e));
+}
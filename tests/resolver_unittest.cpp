@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+#include "resolver.h"
+#include "mocksys.h"
+
+class ResolverFixture : public ::testing::Test {
+public:
+    void SetUp()
+    {
+        dtime_ = dynamic_cast<MockSys*>(sys)->dtime;
+        dynamic_cast<MockSys*>(sys)->dtime = 1000.0;
+
+        forwardCalls = 0;
+        reverseCalls = 0;
+        resolver.forwardLookup = [this](const std::string& name) -> std::vector<IP>
+        {
+            forwardCalls++;
+            if (name == "bad.example")
+                throw GeneralException("getaddrinfo err = -2");
+            if (name == "empty.example")
+                return {};
+            return { IP::parse("2001:db8::1"), IP::parse("192.0.2." + std::to_string(forwardCalls.load())) };
+        };
+        resolver.reverseLookup = [this](const IP& ip, std::string& out)
+        {
+            reverseCalls++;
+            if (ip.str() != "192.0.2.1")
+                return false;
+            out = "host.example";
+            return true;
+        };
+    }
+
+    void TearDown()
+    {
+        dynamic_cast<MockSys*>(sys)->dtime = dtime_;
+    }
+
+    double dtime_;
+    std::atomic<int> forwardCalls;
+    std::atomic<int> reverseCalls;
+    Resolver resolver;
+};
+
+TEST_F(ResolverFixture, cachesUntilTTL)
+{
+    auto a = resolver.resolve("www.example");
+    ASSERT_EQ(2, a.size());
+    ASSERT_EQ("192.0.2.1", a[1].str());
+    ASSERT_EQ((192u << 24) | (2 << 8) | 1, resolver.resolveIPv4("www.example"));
+    ASSERT_EQ(1, forwardCalls);
+
+    // ワーカーを起こせない MockSys では、期限が切れるとその場で引き直す。
+    dynamic_cast<MockSys*>(sys)->dtime += Resolver::POSITIVE_TTL + 1;
+    ASSERT_EQ("192.0.2.2", resolver.resolve("www.example")[1].str());
+    ASSERT_EQ(2, forwardCalls);
+}
+
+TEST_F(ResolverFixture, ipAddressIsNotLookedUp)
+{
+    auto a = resolver.resolve("198.51.100.7");
+    ASSERT_EQ(1, a.size());
+    ASSERT_EQ("198.51.100.7", a[0].str());
+    ASSERT_EQ(0, forwardCalls);
+}
+
+TEST_F(ResolverFixture, negativeCaching)
+{
+    ASSERT_THROW(resolver.resolve("bad.example"), GeneralException);
+    ASSERT_THROW(resolver.resolve("bad.example"), GeneralException);
+    ASSERT_EQ(0, resolver.resolveIPv4("bad.example"));
+    ASSERT_EQ(0, resolver.resolve("empty.example").size());
+    ASSERT_EQ(2, forwardCalls);
+
+    dynamic_cast<MockSys*>(sys)->dtime += Resolver::NEGATIVE_TTL + 1;
+    ASSERT_THROW(resolver.resolve("bad.example"), GeneralException);
+    ASSERT_EQ(3, forwardCalls);
+}
+
+TEST_F(ResolverFixture, reverse)
+{
+    std::string name;
+    ASSERT_TRUE(resolver.reverse(IP::parse("192.0.2.1"), name));
+    ASSERT_EQ("host.example", name);
+    ASSERT_TRUE(resolver.reverse(IP::parse("192.0.2.1"), name));
+    ASSERT_FALSE(resolver.reverse(IP::parse("192.0.2.9"), name));
+    ASSERT_FALSE(resolver.reverse(IP::parse("192.0.2.9"), name));
+    ASSERT_EQ("", name);
+    ASSERT_EQ(2, reverseCalls);
+
+    resolver.clear();
+    ASSERT_TRUE(resolver.reverse(IP::parse("192.0.2.1"), name));
+    ASSERT_EQ(3, reverseCalls);
+}
+
+// 同じ名前を同時に引くと、後から来た方は最初の結果を待つ。
+TEST_F(ResolverFixture, concurrentLookupsShareResult)
+{
+    std::atomic<bool> release(false);
+    auto lookup = resolver.forwardLookup;
+    resolver.forwardLookup = [&](const std::string& name)
+    {
+        while (!release)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return lookup(name);
+    };
+
+    std::vector<IP> a, b;
+    std::thread t1([&]() { a = resolver.resolve("www.example"); });
+    while (resolver.getState().object().at("misses").number() < 1)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::thread t2([&]() { b = resolver.resolve("www.example"); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    release = true;
+    t1.join();
+    t2.join();
+
+    ASSERT_EQ(1, forwardCalls);
+    ASSERT_EQ(a, b);
+}
@@ -0,0 +1,348 @@
+#include <gtest/gtest.h>
+
+#include "rtmpingest.h"
+#include "amf0.h"
+#include "chanmgr.h"
+#include "mockclientsocket.h"
+#include "rtmpmonit.h"
+#include "servmgr.h"
+
+using amf0::Value;
+
+class RTMPIngestFixture : public ::testing::Test, public RTMPSession::Listener {
+public:
+    void onMetaData(int32_t timestamp, const std::string& data, bool hasAudio, bool hasVideo) override
+    {
+        events.push_back("meta " + std::to_string(hasAudio) + std::to_string(hasVideo));
+        metaData = data;
+    }
+
+    void onAudio(int32_t timestamp, const std::string& data) override
+    {
+        events.push_back("audio " + std::to_string(timestamp) + " " + std::to_string(data.size()));
+    }
+
+    void onVideo(int32_t timestamp, const std::string& data) override
+    {
+        events.push_back("video " + std::to_string(timestamp) + " " + std::to_string(data.size()));
+    }
+
+    static std::string bigEndian(int value, int nbytes)
+    {
+        std::string res;
+        for (int i = nbytes - 1; i >= 0; i--)
+            res += (char) ((value >> (i * 8)) & 0xff);
+        return res;
+    }
+
+    // クライアントから送る C0 から C2。
+    static std::string handshake()
+    {
+        return std::string(1, 3) + std::string(1536, 'A') + std::string(1536, 'B');
+    }
+
+    // fmt 0 のチャンクで始まり、残りを fmt 3 で続けるメッセージ。
+    static std::string message(int csID, int32_t timestamp, int type, int streamID,
+                               const std::string& data, int chunkSize = 128)
+    {
+        std::string res;
+        res += (char) csID;
+        res += bigEndian(timestamp, 3);
+        res += bigEndian(data.size(), 3);
+        res += (char) type;
+        res += std::string({ (char) streamID, 0, 0, 0 });
+        for (size_t pos = 0; pos < data.size(); pos += chunkSize)
+        {
+            if (pos > 0)
+                res += (char) (0xc0 | csID);
+            res += data.substr(pos, chunkSize);
+        }
+        return res;
+    }
+
+    static std::string command(const std::vector<Value>& values)
+    {
+        std::string res;
+        for (auto& v : values)
+            res += v.serialize();
+        return res;
+    }
+
+    static std::string metaDataMessage()
+    {
+        return command({ Value("@setDataFrame"), Value("onMetaData"),
+                         Value::object({ {"videocodecid", 7}, {"videodatarate", 1000}, {"audiodatarate", 128} }) });
+    }
+
+    static std::string flvTag(FLVTag::TYPE type, int32_t timestamp, const std::string& payload)
+    {
+        FLVTag tag;
+        tag.set(type, timestamp, payload.data(), payload.size());
+        return std::string(tag.packet, tag.packet + tag.packetSize);
+    }
+
+    MockClientSocket sock;
+    std::vector<std::string> events;
+    std::string metaData;
+};
+
+TEST_F(RTMPIngestFixture, handshake)
+{
+    sock.incoming.str(handshake());
+
+    RTMPSession session(sock, this);
+    session.handshake();
+
+    auto out = sock.outgoing.str();
+    ASSERT_EQ(1 + 1536 + 1536, out.size());
+    ASSERT_EQ(3, out[0]);
+    // S2 は C1 の時刻と乱数を返す。
+    ASSERT_EQ(std::string(4, 'A'), out.substr(1 + 1536, 4));
+    ASSERT_EQ(std::string(1528, 'A'), out.substr(1 + 1536 + 8));
+}
+
+TEST_F(RTMPIngestFixture, publishSession)
+{
+    std::string in = handshake();
+    in += message(3, 0, RTMPSession::MT_COMMAND_AMF0, 0,
+                  command({ Value("connect"), Value(1), Value::object({ {"app", "live"} }) }));
+    in += message(3, 0, RTMPSession::MT_COMMAND_AMF0, 0,
+                  command({ Value("publish"), Value(5), Value(nullptr), Value("mystream"), Value("live") }));
+    // チャンクサイズを変えてから大きなメッセージを送る。
+    in += message(2, 0, RTMPSession::MT_SET_CHUNK_SIZE, 0, bigEndian(4096, 4));
+    in += message(4, 0, RTMPSession::MT_DATA_AMF0, 1, metaDataMessage(), 4096);
+    in += message(6, 40, RTMPSession::MT_VIDEO, 1, std::string(5000, 'v'), 4096);
+    // fmt 2 は時刻差だけを変え、続く fmt 3 は同じ時刻差で次のメッセージになる。
+    in += message(7, 10, RTMPSession::MT_AUDIO, 1, std::string(10, 'a'), 4096);
+    in += std::string(1, (char) (0x80 | 7)) + bigEndian(20, 3) + std::string(10, 'a');
+    in += std::string(1, (char) (0xc0 | 7)) + std::string(10, 'a');
+    in += message(3, 0, RTMPSession::MT_COMMAND_AMF0, 0,
+                  command({ Value("deleteStream"), Value(6), Value(nullptr), Value(1) }));
+    sock.incoming.str(in);
+
+    RTMPSession session(sock, this);
+    session.handshake();
+    while (!session.isClosed())
+        session.readChunk();
+
+    ASSERT_EQ("mystream", session.streamName());
+    ASSERT_EQ(std::vector<std::string>({ "meta 01", "video 40 5000", "audio 10 10", "audio 30 10", "audio 50 10" }), events);
+    // @setDataFrame を除いた onMetaData から。
+    ASSERT_EQ(command({ Value("onMetaData") }), metaData.substr(0, 13));
+
+    // connect に _result、publish に onStatus を返している。
+    auto out = sock.outgoing.str();
+    ASSERT_NE(std::string::npos, out.find("NetConnection.Connect.Success"));
+    ASSERT_NE(std::string::npos, out.find("NetStream.Publish.Start"));
+}
+
+TEST_F(RTMPIngestFixture, readUntilPublish)
+{
+    std::string in = handshake();
+    in += message(3, 0, RTMPSession::MT_COMMAND_AMF0, 0,
+                  command({ Value("connect"), Value(1), Value::object({ {"app", "live"} }) }));
+    in += message(3, 0, RTMPSession::MT_COMMAND_AMF0, 0,
+                  command({ Value("publish"), Value(5), Value(nullptr), Value("key1"), Value("live") }));
+    in += message(6, 0, RTMPSession::MT_VIDEO, 1, std::string(10, 'v'));
+    sock.incoming.str(in);
+
+    // 受け取り手が居ない間のメッセージは捨てる。publish の後は読まない。
+    RTMPSession session(sock);
+    session.handshake();
+    session.readUntilPublish();
+    ASSERT_TRUE(session.isPublishing());
+    ASSERT_EQ("key1", session.streamName());
+
+    session.setListener(this);
+    session.readChunk();
+    ASSERT_EQ(std::vector<std::string>({ "video 0 10" }), events);
+}
+
+TEST_F(RTMPIngestFixture, play)
+{
+    std::string in = std::string(1, 3) + std::string(1536, 'S') + std::string(1536, 'T');
+    in += message(2, 0, RTMPSession::MT_WINDOW_ACK_SIZE, 0, bigEndian(2500000, 4));
+    in += message(3, 0, RTMPSession::MT_COMMAND_AMF0, 0,
+                  command({ Value("_result"), Value(1), Value(nullptr),
+                            Value::object({ {"code", "NetConnection.Connect.Success"} }) }));
+    in += message(3, 0, RTMPSession::MT_COMMAND_AMF0, 0,
+                  command({ Value("_result"), Value(2), Value(nullptr), Value(5) }));
+    // Ping Request には Ping Response を返す。
+    in += message(2, 0, RTMPSession::MT_USER_CONTROL, 0, bigEndian(6, 2) + bigEndian(1234, 4));
+    in += message(5, 0, RTMPSession::MT_COMMAND_AMF0, 5,
+                  command({ Value("onStatus"), Value(0), Value(nullptr),
+                            Value::object({ {"level", "status"}, {"code", "NetStream.Play.Start"} }) }));
+    in += message(6, 0, RTMPSession::MT_VIDEO, 5, std::string(10, 'v'));
+    in += message(5, 0, RTMPSession::MT_COMMAND_AMF0, 5,
+                  command({ Value("onStatus"), Value(0), Value(nullptr),
+                            Value::object({ {"level", "status"}, {"code", "NetStream.Play.Stop"} }) }));
+    sock.incoming.str(in);
+
+    RTMPSession session(sock);
+    session.clientHandshake();
+    session.play("live", "rtmp://example.com/live", "feed");
+    ASSERT_TRUE(session.isPlaying());
+
+    session.setListener(this);
+    while (!session.isClosed())
+        session.readChunk();
+    ASSERT_EQ(std::vector<std::string>({ "video 0 10" }), events);
+
+    auto out = sock.outgoing.str();
+    ASSERT_EQ(3, out[0]);
+    // C2 は S1 を返す。
+    ASSERT_EQ(std::string(1536, 'S'), out.substr(1 + 1536, 1536));
+    ASSERT_NE(std::string::npos, out.find(command({ Value("connect"), Value(1) })));
+    ASSERT_NE(std::string::npos, out.find(command({ Value("createStream"), Value(2) })));
+    ASSERT_NE(std::string::npos, out.find(command({ Value("play"), Value(0), Value(nullptr), Value("feed") })));
+    ASSERT_NE(std::string::npos, out.find(bigEndian(7, 2) + bigEndian(1234, 4)));
+}
+
+TEST_F(RTMPIngestFixture, playNotFound)
+{
+    std::string in = std::string(1, 3) + std::string(3072, 'S');
+    in += message(3, 0, RTMPSession::MT_COMMAND_AMF0, 0,
+                  command({ Value("_result"), Value(1), Value(nullptr), Value(nullptr) }));
+    in += message(3, 0, RTMPSession::MT_COMMAND_AMF0, 0,
+                  command({ Value("_result"), Value(2), Value(nullptr), Value(1) }));
+    in += message(5, 0, RTMPSession::MT_COMMAND_AMF0, 1,
+                  command({ Value("onStatus"), Value(0), Value(nullptr),
+                            Value::object({ {"level", "error"}, {"code", "NetStream.Play.StreamNotFound"} }) }));
+    sock.incoming.str(in);
+
+    RTMPSession session(sock);
+    session.clientHandshake();
+    ASSERT_THROW(session.play("live", "rtmp://example.com/live", "nothing"), StreamException);
+}
+
+TEST_F(RTMPIngestFixture, splitURL)
+{
+    std::string host, app, stream;
+    ASSERT_TRUE(RTMPSession::splitURL("example.com:1936/live/feed/hd?token=x", host, app, stream));
+    ASSERT_EQ("example.com:1936", host);
+    ASSERT_EQ("live", app);
+    ASSERT_EQ("feed/hd?token=x", stream);
+
+    ASSERT_FALSE(RTMPSession::splitURL("example.com/live", host, app, stream));
+    ASSERT_FALSE(RTMPSession::splitURL("example.com/live/", host, app, stream));
+    ASSERT_FALSE(RTMPSession::splitURL("/live/feed", host, app, stream));
+}
+
+TEST_F(RTMPIngestFixture, channelInfoFor)
+{
+    {
+        std::lock_guard<ProfiledMutex> cs(servMgr->lock);
+        servMgr->defaultChannelInfo.name = "default";
+        servMgr->defaultChannelInfo.genre = "game";
+    }
+
+    // キーを混ぜるので、同じ名前でもキーごとに別のチャンネルになる。
+    auto a = RTMPServerMonitor::channelInfoFor("key1");
+    auto b = RTMPServerMonitor::channelInfoFor("key2");
+    ASSERT_STREQ("default", a.name.cstr());
+    ASSERT_EQ(ChanInfo::T_FLV, a.contentType);
+    ASSERT_FALSE(a.id.isSame(b.id));
+    ASSERT_TRUE(a.id.isSame(RTMPServerMonitor::channelInfoFor("key1").id));
+
+    // クエリーの形なら HTTP Push と同じ項目を読む。
+    auto c = RTMPServerMonitor::channelInfoFor("name=foo&desc=bar");
+    ASSERT_STREQ("foo", c.name.cstr());
+    ASSERT_STREQ("bar", c.desc.cstr());
+    ASSERT_STREQ("game", c.genre.cstr());
+
+    std::lock_guard<ProfiledMutex> cs(servMgr->lock);
+    servMgr->defaultChannelInfo = ChanInfo();
+}
+
+// 既定の 128 バイトのチャンクに分かれた大きなメッセージ。バッファーの
+// 大きさより長いものも組み立てられる。
+TEST_F(RTMPIngestFixture, largeMessages)
+{
+    std::string frame1, frame2;
+    for (int i = 0; i < 200000; i++)
+        frame1 += (char) (i % 251);
+    for (int i = 0; i < 1000; i++)
+        frame2 += (char) (i % 13);
+
+    std::string in = handshake();
+    in += message(6, 0, RTMPSession::MT_VIDEO, 1, frame1);
+    in += message(6, 33, RTMPSession::MT_VIDEO, 1, frame2);
+    sock.incoming.str(in);
+
+    struct Frames : public RTMPSession::Listener
+    {
+        void onMetaData(int32_t, const std::string&, bool, bool) override {}
+        void onAudio(int32_t, const std::string&) override {}
+        void onVideo(int32_t timestamp, const std::string& data) override { frames.push_back(data); }
+        std::vector<std::string> frames;
+    } listener;
+
+    RTMPSession session(sock, &listener);
+    session.handshake();
+    ASSERT_TRUE(session.hasBufferedInput());
+    while (listener.frames.size() < 2)
+        session.readChunk();
+
+    ASSERT_EQ(frame1, listener.frames[0]);
+    ASSERT_EQ(frame2, listener.frames[1]);
+    ASSERT_FALSE(session.hasBufferedInput());
+}
+
+TEST_F(RTMPIngestFixture, unstartedChunkStream)
+{
+    sock.incoming.str(std::string(1, (char) (0xc0 | 5)) + "xxxx");
+
+    RTMPSession session(sock, this);
+    ASSERT_THROW(session.readChunk(), StreamException);
+}
+
+// RTMP で受けたものは、同じタグを FLV で受けた時と同じパケットになる。
+TEST_F(RTMPIngestFixture, streamMatchesFLV)
+{
+    auto tmp = chanMgr;
+    chanMgr = new ChanMgr();
+
+    const std::string avcHeader({ 0x17, 0x00, 0x00, 0x00, 0x00 });
+    const std::string keyFrame = std::string({ 0x17, 0x01 }) + std::string(100, 'k');
+
+    std::string in = handshake();
+    in += message(4, 0, RTMPSession::MT_DATA_AMF0, 1, metaDataMessage());
+    in += message(6, 0, RTMPSession::MT_VIDEO, 1, avcHeader);
+    // キーフレームより前の映像は捨てる。
+    in += message(6, 16, RTMPSession::MT_VIDEO, 1, std::string({ 0x27, 0x01 }) + "p");
+    in += message(6, 33, RTMPSession::MT_VIDEO, 1, keyFrame);
+    sock.incoming.str(in);
+
+    auto rtmpCh = std::make_shared<Channel>();
+    RTMPStream rtmp;
+    rtmp.readHeader(sock, rtmpCh);
+    rtmp.readPacket(sock, rtmpCh);  // メタデータでヘッダー
+    rtmp.readPacket(sock, rtmpCh);  // AVC ヘッダーでヘッダー
+    rtmp.readPacket(sock, rtmpCh);  // キーフレーム
+
+    std::string flvData = { 'F','L','V',1,1,0,0,0,9,0,0,0,0 };
+    flvData += flvTag(FLVTag::T_SCRIPT, 0, metaDataMessage().substr(16));
+    flvData += flvTag(FLVTag::T_VIDEO, 0, avcHeader);
+    flvData += flvTag(FLVTag::T_VIDEO, 33, keyFrame);
+    StringStream mem(flvData);
+
+    auto flvCh = std::make_shared<Channel>();
+    FLVStream flv;
+    flv.readHeader(mem, flvCh);
+    flv.readPacket(mem, flvCh);
+    flv.readPacket(mem, flvCh);
+    flv.readPacket(mem, flvCh);
+
+    ASSERT_EQ(ChanPacket::T_HEAD, rtmpCh->headPack.type);
+    ASSERT_EQ(std::string(flvCh->headPack.data, flvCh->headPack.len),
+              std::string(rtmpCh->headPack.data, rtmpCh->headPack.len));
+    ASSERT_EQ(flvCh->info.bitrate, rtmpCh->info.bitrate);
+
+    ASSERT_EQ(flvCh->streamPos, rtmpCh->streamPos);
+    auto a = rtmpCh->rawData.getStatistics();
+    auto b = flvCh->rawData.getStatistics();
+    ASSERT_EQ(b.packetLengths, a.packetLengths);
+
+    delete chanMgr;
+    chanMgr = tmp;
+}
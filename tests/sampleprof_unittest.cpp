@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "sampleprof.h"
+
+TEST(SamplingProfilerTest, collapse)
+{
+    std::vector<SamplingProfiler::Stack> stacks = {
+        { "SERVENT", { "main", "Servent::process", "read" } },
+        { "SERVENT", { "main", "Servent::process", "write" } },
+        { "SERVENT", { "main", "Servent::process", "write" } },
+        { "(unnamed)", { "main" } },
+    };
+
+    ASSERT_EQ("SERVENT;main;Servent::process;write 2\n"
+              "(unnamed);main 1\n"
+              "SERVENT;main;Servent::process;read 1\n",
+              SamplingProfiler::collapse(stacks));
+    ASSERT_EQ("", SamplingProfiler::collapse({}));
+}
+
+TEST(SamplingProfilerTest, rejectsBadArguments)
+{
+    SamplingProfiler prof;
+    std::string error;
+    ASSERT_FALSE(prof.start(0, 99, error));
+    ASSERT_FALSE(prof.start(SamplingProfiler::MAX_SECONDS + 1, 99, error));
+    ASSERT_FALSE(prof.start(1, SamplingProfiler::MAX_HZ + 1, error));
+    ASSERT_FALSE(prof.status().running);
+}
+
+TEST(SamplingProfilerTest, samplesNamedThread)
+{
+    if (!SamplingProfiler::available())
+        return;
+
+    std::string error;
+    ASSERT_TRUE(g_samplingProfiler.start(10, 1000, error)) << error;
+    ASSERT_FALSE(g_samplingProfiler.start(10, 1000, error));
+    ASSERT_EQ("Already running", error);
+
+    std::thread busy([]()
+                     {
+                         SamplingProfiler::setThreadName("BUSY");
+                         auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+                         volatile uint64_t x = 0;
+                         while (std::chrono::steady_clock::now() < end)
+                             x = x + 1;
+                     });
+    busy.join();
+
+    ASSERT_TRUE(g_samplingProfiler.status().running);
+    ASSERT_EQ("", g_samplingProfiler.collapsed());
+    g_samplingProfiler.stop();
+
+    auto s = g_samplingProfiler.status();
+    ASSERT_FALSE(s.running);
+    ASSERT_GT(s.samples, 0);
+    ASSERT_EQ(0, s.dropped);
+
+    auto out = g_samplingProfiler.collapsed();
+    ASSERT_NE(std::string::npos, out.find("\nBUSY;")) << out;
+}
@@ -0,0 +1,37 @@
+#include <gtest/gtest.h>
+
+#include "sendtuning.h"
+
+class SendTuningFixture : public ::testing::Test {
+};
+
+TEST_F(SendTuningFixture, sizedFromBitrateAndRtt)
+{
+    // 2000 kbps = 250000 B/s。RTT 100 ms + 250 ms。
+    auto t = SendTuning::compute(SendTuning::C_DIRECT, 2000, 100000, false);
+    ASSERT_EQ(87500, t.sendBufferSize);
+    ASSERT_EQ(16 * 1024, t.notSentLowat);
+
+    // リレーは余裕を多めに。
+    t = SendTuning::compute(SendTuning::C_RELAY, 2000, 100000, false);
+    ASSERT_EQ(150000, t.sendBufferSize);
+
+    // 低遅延モードは少なめに。
+    t = SendTuning::compute(SendTuning::C_RELAY, 2000, 100000, true);
+    ASSERT_EQ(50000, t.sendBufferSize);
+}
+
+TEST_F(SendTuningFixture, defaultsAndLimits)
+{
+    // 分からなければ 1000 kbps、RTT 100 ms として。
+    auto t = SendTuning::compute(SendTuning::C_DIRECT, 0, 0, false);
+    ASSERT_EQ(43750, t.sendBufferSize);
+
+    t = SendTuning::compute(SendTuning::C_DIRECT, 100, 1000, true);
+    ASSERT_EQ(SendTuning::MIN_SNDBUF, t.sendBufferSize);
+    ASSERT_EQ(SendTuning::MIN_SNDBUF / 2, t.notSentLowat);
+
+    t = SendTuning::compute(SendTuning::C_RELAY, 100000, 2000000, false);
+    ASSERT_EQ(SendTuning::MAX_SNDBUF, t.sendBufferSize);
+    ASSERT_EQ(625000, t.notSentLowat);
+}
@@ -281,6 +281,14 @@ TEST_F(ServentFixture, hasValidAuthToken)
     ASSERT_FALSE(s.hasValidAuthToken("?auth=44d5299e57ad9274fee7960a9fa60bfd"));
 }
 
+TEST_F(ServentFixture, hasValidAuthToken_expiring)
+{
+    auto token = chanMgr->expiringAuthToken("01234567890123456789012345678901", 2000000000);
+    ASSERT_TRUE(s.hasValidAuthToken("01234567890123456789012345678901.flv?auth=" + token + "&expires=2000000000"));
+    ASSERT_FALSE(s.hasValidAuthToken("01234567890123456789012345678901.flv?auth=" + token + "&expires=2000000001"));
+    ASSERT_FALSE(s.hasValidAuthToken("01234567890123456789012345678901.flv?auth=" + token));
+}
+
 TEST_F(ServentFixture, handshakeHTTPBasicAuth_nonlocal_correctpass)
 {
     ASSERT_EQ(0, s.sock->host.ip);
@@ -461,6 +469,13 @@ TEST_F(ServentFixture, handshakeStream_returnResponse_channelNotReady_direct)
     delete chl;
 }
 
+TEST_F(ServentFixture, refreshChannel_keepsLiveChannel)
+{
+    auto ch = std::make_shared<Channel>();
+    // 閉じられていなければ ChanMgr を引かずにそのまま使う。
+    ASSERT_EQ(ch, s.refreshChannel(ch));
+}
+
 TEST_F(ServentFixture, handshakeStream_returnResponse_channelReady_relay)
 {
     bool gotPCP = true;
@@ -965,3 +980,62 @@ TEST_F(ServentFixture, continuationPacketSupportStatus)
     ASSERT_EQ(Servent::continuationPacketSupportStatus("PeerCast/0.1218 (YT16)"), Servent::SupportStatus::Supported);
 }
 
+
+TEST_F(ServentFixture, sendResponseKeepAlive)
+{
+    HTTP http(*mock);
+    http.initRequest("GET /assets/style.css HTTP/1.1");
+    s.numRequests = 1;
+
+    s.sendResponse(http, HTTPResponse::ok({{"Content-Type", "text/css"}}, "body"));
+    ASSERT_TRUE(s.keepAlive);
+    ASSERT_TRUE(str::contains(mock->outgoing.str(), "Connection: keep-alive\r\n"));
+    ASSERT_TRUE(str::contains(mock->outgoing.str(), "Content-Length: 4\r\n"));
+
+    // 要求の数が上限に達したら閉じる。
+    s.numRequests = Servent::MAX_KEEPALIVE_REQUESTS;
+    mock->outgoing.str("");
+    s.sendResponse(http, HTTPResponse::ok({}, "body"));
+    ASSERT_FALSE(s.keepAlive);
+    ASSERT_TRUE(str::contains(mock->outgoing.str(), "Connection: close\r\n"));
+}
+
+TEST_F(ServentFixture, decideKeepAlive)
+{
+    HTTP http(*mock);
+    s.numRequests = 1;
+
+    http.initRequest("GET / HTTP/1.1");
+    http.headers.set("Connection", "close");
+    ASSERT_FALSE(s.decideKeepAlive(http));
+
+    http.reset();
+    http.initRequest("GET / HTTP/1.0");
+    ASSERT_FALSE(s.decideKeepAlive(http));
+    http.headers.set("Connection", "Keep-Alive");
+    ASSERT_TRUE(s.decideKeepAlive(http));
+    ASSERT_TRUE(s.keepAlive);
+}
+
+// ヘッダーと最新のキーフレームからのパケットをまとめて送る。
+TEST_F(ServentFixture, sendJoinBurst)
+{
+    auto ch = std::make_shared<Channel>();
+    ch->headPack.init(ChanPacket::T_HEAD, "HEAD", 4, 0);
+
+    const char* payloads[] = { "aaaa", "bbbb", "cccc", "dddd" };
+    for (int i = 0; i < 4; i++)
+    {
+        ChanPacket pack;
+        pack.init(ChanPacket::T_DATA, payloads[i], 4, 4 + i * 4);
+        pack.cont = (i % 2 == 1);
+        ASSERT_TRUE(ch->rawData.writePacket(pack));
+    }
+
+    bool skipContinuation = true;
+    s.sendJoinBurst(ch, skipContinuation);
+
+    ASSERT_EQ("HEADccccdddd", mock->outgoing.str());
+    ASSERT_EQ(20, s.streamPos);
+    ASSERT_FALSE(skipContinuation);
+}
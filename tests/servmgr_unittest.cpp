@@ -14,7 +14,7 @@ TEST_F(ServMgrFixture, initialState)
     // Servent             *servents;
     ASSERT_EQ(nullptr, m.servents);
     // WLock               lock;
-    // ServHost            hostCache[MAX_HOSTCACHE];
+    // HostCache           hostCache;
     // char                password[64];
     ASSERT_STREQ("", m.password);
     // bool                allowGnutella;
@@ -133,6 +133,14 @@ TEST_F(ServMgrFixture, initialState)
     ASSERT_FALSE(m.defaultChannelInfo.id.isSet());
 }
 
+TEST_F(ServMgrFixture, flagIndices)
+{
+    ASSERT_EQ(ServMgr::NUM_FLAGS, m.flags.m_flags.size());
+    ASSERT_EQ("randomizeBroadcastingChannelID", m.flags[ServMgr::F_randomizeBroadcastingChannelID].name);
+    ASSERT_EQ("startPlayingFromKeyFrame", m.flags[ServMgr::F_startPlayingFromKeyFrame].name);
+    ASSERT_EQ(&m.flags.get("packetTracing"), &m.flags[ServMgr::F_packetTracing]);
+}
+
 TEST_F(ServMgrFixture, writeVariable)
 {
     StringStream mem;
@@ -365,7 +373,7 @@ TEST_F(ServMgrFixture, numStreams_connectedRelaysAreCounted)
     ASSERT_EQ(s, m.servents);
     s->type = Servent::T_RELAY;
     ASSERT_EQ(0, m.numStreams(Servent::T_RELAY, false));
-    s->status = Servent::S_CONNECTED;
+    s->setStatus(Servent::S_CONNECTED);
     ASSERT_EQ(1, m.numStreams(Servent::T_RELAY, false));
 }
 
@@ -377,10 +385,109 @@ TEST_F(ServMgrFixture, numStreams_connectedDirectsAreCounted)
     ASSERT_EQ(s, m.servents);
     s->type = Servent::T_DIRECT;
     ASSERT_EQ(0, m.numStreams(Servent::T_DIRECT, false));
-    s->status = Servent::S_CONNECTED;
+    s->setStatus(Servent::S_CONNECTED);
     ASSERT_EQ(1, m.numStreams(Servent::T_DIRECT, false));
 }
 
+TEST_F(ServMgrFixture, numStreams_perChannel)
+{
+    GnuID id("0123456789abcdef0123456789abcdef");
+
+    Servent *s = m.allocServent();
+    s->type = Servent::T_RELAY;
+    s->chanID = id;
+    s->setStatus(Servent::S_CONNECTED);
+    ASSERT_EQ(1, m.numStreams(id, Servent::T_RELAY, false));
+    ASSERT_EQ(0, m.numStreams(id, Servent::T_DIRECT, false));
+    ASSERT_EQ(0, m.numStreams(GnuID(), Servent::T_RELAY, false));
+    ASSERT_EQ(1, m.numConnected());
+
+    // 切れたら集計から外れる。
+    s->setStatus(Servent::S_CLOSING);
+    ASSERT_EQ(0, m.numStreams(id, Servent::T_RELAY, false));
+    ASSERT_EQ(0, m.numStreams(Servent::T_RELAY, false));
+    ASSERT_EQ(0, m.numConnected());
+}
+
+TEST_F(ServMgrFixture, broadcastPacket_routesByTypeAndChannel)
+{
+    GnuID id("0123456789abcdef0123456789abcdef");
+    GnuID other("ffffffffffffffffffffffffffffffff");
+
+    Servent *relay = m.allocServent();
+    relay->type = Servent::T_RELAY;
+    relay->chanID = id;
+    relay->pcpStream = new PCPStream(GnuID());
+    relay->setStatus(Servent::S_CONNECTED);
+
+    Servent *direct = m.allocServent();
+    direct->type = Servent::T_DIRECT;
+    direct->chanID = id;
+    direct->setStatus(Servent::S_CONNECTED);
+
+    ChanPacket pack;
+    pack.type = ChanPacket::T_PCP;
+    pack.len = 8;
+    memcpy(pack.data, "quit\x00\x00\x00\x00", 8);
+
+    ASSERT_EQ(1, m.broadcastPacket(pack, id, GnuID(), GnuID(), Servent::T_RELAY));
+    ASSERT_EQ(1, m.broadcastPacket(pack, GnuID(), GnuID(), GnuID(), Servent::T_RELAY));
+    ASSERT_EQ(0, m.broadcastPacket(pack, other, GnuID(), GnuID(), Servent::T_RELAY));
+    ASSERT_EQ(0, m.broadcastPacket(pack, id, GnuID(), GnuID(), Servent::T_COUT));
+    ASSERT_EQ(2, relay->pcpStream->outPriority.numPending());
+
+    // 切れたら送り先から外れる。
+    relay->setStatus(Servent::S_CLOSING);
+    ASSERT_EQ(0, m.broadcastPacket(pack, id, GnuID(), GnuID(), Servent::T_RELAY));
+    ASSERT_EQ(1, m.serventRoutes.size()); // direct の分だけ残る。
+
+    delete relay->pcpStream;
+    relay->pcpStream = nullptr;
+}
+
+TEST_F(ServMgrFixture, numUsedAndActiveOnPort)
+{
+    Servent *s = m.allocServent();
+    s->setServPort(7144);
+    s->setType(Servent::T_INCOMING);
+    ASSERT_EQ(1, m.numUsed(Servent::T_INCOMING));
+    ASSERT_EQ(1, m.numActive(Servent::T_INCOMING));
+    ASSERT_EQ(1, m.numActiveOnPort(7144));
+    ASSERT_EQ(0, m.numActiveOnPort(7145));
+
+    s->setType(Servent::T_DIRECT);
+    ASSERT_EQ(0, m.numUsed(Servent::T_INCOMING));
+    ASSERT_EQ(1, m.numUsed(Servent::T_DIRECT));
+
+    // reset で数えられなくなる。
+    s->reset();
+    ASSERT_EQ(0, m.numUsed(Servent::T_DIRECT));
+    ASSERT_EQ(0, m.numActiveOnPort(7144));
+    ASSERT_EQ(1, m.numUsed(Servent::T_NONE));
+}
+
+// 空いたサーバントは空きリストから再利用される。
+TEST_F(ServMgrFixture, allocServent_reusesFreed)
+{
+    Servent *s1 = m.allocServent();
+    Servent *s2 = m.allocServent();
+    ASSERT_EQ(2, m.numServents());
+    ASSERT_EQ(s1, m.findServentByID(1));
+    ASSERT_EQ(s2, m.findServentByID(2));
+    ASSERT_EQ(nullptr, m.findServentByID(3));
+
+    s1->setStatus(Servent::S_FREE);
+    s1->setStatus(Servent::S_CLOSING);
+    s1->setStatus(Servent::S_FREE);
+    ASSERT_EQ(s1, m.allocServent());
+    ASSERT_EQ(Servent::S_NONE, s1->status);
+
+    Servent *s3 = m.allocServent();
+    ASSERT_NE(s1, s3);
+    ASSERT_NE(s2, s3);
+    ASSERT_EQ(3, m.numServents());
+}
+
 TEST_F(ServMgrFixture, isFiltered)
 {
     Host h;
@@ -409,6 +516,9 @@ TEST_F(ServMgrFixture, getSettings)
            {"maxRelays", "2"},
            {"maxDirect", "0"},
            {"maxRelaysPerChannel", "0"},
+           {"packetBufferDuration", "0"},
+           {"joinKeyFramesBack", "0"},
+           {"maxHitsPerChannel", "1000"},
            {"firewallTimeout", "30"},
            {"forceNormal", "No"},
            {"rootMsg", ""},
@@ -538,3 +648,139 @@ TEST_F(ServMgrFixture, procConnectArgs_tip)
     delete mock;
     chanMgr = tmp;
 }
+
+#include "mocksys.h"
+#include "reactor.h"
+
+namespace
+{
+    class FakeReactor : public Reactor
+    {
+    public:
+        FakeReactor(int n) : workers(n) {}
+        uint64_t    add(int, int, Handler) override { return 1; }
+        void        modify(uint64_t, int) override {}
+        void        remove(uint64_t) override {}
+        void        post(uint64_t) override {}
+        size_t      numHandlers() override { return 0; }
+        int         numWorkers() override { return workers; }
+        int         workers;
+    };
+
+    class ReactorSys : public MockSys
+    {
+    public:
+        std::shared_ptr<Reactor> createReactor(const std::string&, int numWorkers) override
+        {
+            return std::make_shared<FakeReactor>(numWorkers ? numWorkers : 4);
+        }
+    };
+}
+
+TEST_F(ServMgrFixture, channelReactors)
+{
+    ReactorSys rsys;
+    auto tmp = sys;
+    sys = &rsys;
+
+    GnuID a, b;
+    a.fromStr("0123456789abcdef0123456789abcdef");
+    b.fromStr("fedcba9876543210fedcba9876543210");
+
+    ASSERT_EQ(nullptr, m.getReactor(a));
+
+    m.flags[ServMgr::F_reactorMode] = true;
+    auto shared = m.getReactor(a);
+    ASSERT_NE(nullptr, shared);
+    ASSERT_EQ(4, shared->numWorkers());
+    ASSERT_EQ(shared, m.getReactor(b));
+
+    // チャンネルごとに一本のスレッドのものを返す。
+    m.flags[ServMgr::F_channelReactors] = true;
+    auto ra = m.getReactor(a);
+    ASSERT_EQ(1, ra->numWorkers());
+    ASSERT_NE(shared, ra);
+    ASSERT_EQ(ra, m.getReactor(a));
+    ASSERT_NE(ra, m.getReactor(b));
+    ASSERT_EQ(shared, m.getReactor(GnuID()));
+    ASSERT_EQ(2, m.channelReactors.size());
+
+    // まだ使っている a のものは残す。
+    m.releaseChannelReactors();
+    ASSERT_EQ(1, m.channelReactors.size());
+    ASSERT_EQ(ra, m.getReactor(a));
+
+    ra = nullptr;
+    m.releaseChannelReactors();
+    ASSERT_EQ(0, m.channelReactors.size());
+
+    sys = tmp;
+}
+
+#include "prefork.h"
+#include <fstream>
+#include <unistd.h>
+
+TEST_F(ServMgrFixture, readWorkerReport)
+{
+    // ワーカー 2 つのそれぞれの受け持ちになる ID。
+    unsigned char next = 0;
+    auto idFor = [&](int shard)
+    {
+        GnuID id;
+        do
+            id.id[15] = ++next;
+        while (Prefork::shardOf(id, 2) != shard);
+        return id;
+    };
+    GnuID ids[2] = { idFor(0), idFor(1) };
+    GnuID reported = idFor(1);
+
+    auto saved = [&]()
+    {
+        m.savedRelays.clear();
+        for (auto& id : ids)
+        {
+            ChanInfo info;
+            info.id = id;
+            m.savedRelays.push_back({ info, true, "", Channel::IP_V4, 0 });
+        }
+    };
+    auto has = [&](const GnuID& id)
+    {
+        for (auto& r : m.savedRelays)
+            if (r.info.id.isSame(id))
+                return true;
+        return false;
+    };
+
+    char tmpl[] = "/tmp/workerreportXXXXXX";
+    int fd = mkstemp(tmpl);
+    ASSERT_NE(-1, fd);
+    close(fd);
+    std::ofstream(tmpl) << ini::dump({
+        { "Worker", { {"index", 1}, {"numWorkers", 2} }, "End" },
+        { "RelayChannel", { {"name", "reported"}, {"id", reported.str()}, {"stayConnected", true}, {"packetBufferDuration", 30} }, "End" },
+    });
+
+    // 同じワーカー数なら、ワーカー 1 の受け持ちは報告の方だけになる。
+    saved();
+    m.readWorkerReport(tmpl, 2);
+    ASSERT_EQ(2, m.savedRelays.size());
+    ASSERT_TRUE(has(ids[0]));
+    ASSERT_FALSE(has(ids[1]));
+    ASSERT_TRUE(has(reported));
+    ASSERT_EQ(30, m.savedRelays.back().packetBufferDuration);
+
+    // ワーカー数が変わっていれば足すだけ。
+    saved();
+    m.readWorkerReport(tmpl, 3);
+    ASSERT_EQ(3, m.savedRelays.size());
+    ASSERT_TRUE(has(reported));
+
+    // 同じリレーは二つにしない。
+    m.readWorkerReport(tmpl, 3);
+    ASSERT_EQ(3, m.savedRelays.size());
+
+    unlink(tmpl);
+}
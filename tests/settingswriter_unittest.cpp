@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "settingswriter.h"
+#include "realsysfixture.h"
+
+// MockSys の rename は何もしないので、本物の sys で試す。
+class SettingsWriterFixture : public RealSysFixture {
+public:
+    void SetUp() override
+    {
+        RealSysFixture::SetUp();
+        if (IsSkipped())
+            return;
+        char tmpl[] = "/tmp/settingswriterXXXXXX";
+        int fd = mkstemp(tmpl);
+        ASSERT_NE(-1, fd);
+        close(fd);
+        path = tmpl;
+    }
+
+    void TearDown() override
+    {
+        w.stop();
+        unlink(path.c_str());
+        unlink((path + ".tmp").c_str());
+        RealSysFixture::TearDown();
+    }
+
+    static std::string readFile(const std::string& p)
+    {
+        std::string contents;
+        FILE* fp = fopen(p.c_str(), "rb");
+        if (!fp)
+            return contents;
+        char buf[256];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+            contents.append(buf, n);
+        fclose(fp);
+        return contents;
+    }
+
+    SettingsWriter w;
+    std::string path;
+};
+
+TEST_F(SettingsWriterFixture, writesInPlaceWhenStopped)
+{
+    ASSERT_FALSE(w.running());
+
+    w.save(path, "a=1\n");
+    ASSERT_EQ("a=1\n", readFile(path));
+    ASSERT_EQ(1, w.numWrites());
+    ASSERT_NE(0, access((path + ".tmp").c_str(), F_OK));
+}
+
+TEST_F(SettingsWriterFixture, coalescesRequests)
+{
+    w.start();
+    ASSERT_TRUE(w.running());
+
+    w.save(path, "a=1\n");
+    w.save(path, "a=2\n");
+    w.save(path, "a=3\n");
+    w.flush();
+
+    ASSERT_EQ("a=3\n", readFile(path));
+    ASSERT_EQ(1, w.numWrites());
+}
+
+TEST_F(SettingsWriterFixture, stopWritesPending)
+{
+    w.start();
+    w.save(path, "b=1\n");
+    w.stop();
+
+    ASSERT_FALSE(w.running());
+    ASSERT_EQ("b=1\n", readFile(path));
+}
+
+TEST_F(SettingsWriterFixture, writeFileFailure)
+{
+    ASSERT_FALSE(SettingsWriter::writeFile("/nonexistent/dir/peercast.ini", "x"));
+}
@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+
+#include "shmring.h"
+
+#ifndef WIN32
+class ShmRingFixture : public ::testing::Test {
+public:
+    void SetUp()
+    {
+        ring = ShmRing::create("/shmring_unittest", 16);
+        ASSERT_NE(nullptr, ring);
+        peer = ShmRing::open("/shmring_unittest");
+        ASSERT_NE(nullptr, peer);
+    }
+
+    std::shared_ptr<ShmRing> ring, peer;
+};
+
+TEST_F(ShmRingFixture, openMissing)
+{
+    ASSERT_EQ(nullptr, ShmRing::open("/shmring_unittest_missing"));
+}
+
+TEST_F(ShmRingFixture, readWrite)
+{
+    ASSERT_EQ(16, peer->size());
+    ASSERT_EQ(0, ring->available());
+    ASSERT_EQ(16, peer->space());
+
+    ASSERT_EQ(10, peer->write("0123456789", 10));
+    ASSERT_EQ(10, ring->available());
+
+    char buf[16];
+    ASSERT_EQ(6, ring->read(buf, 6));
+    ASSERT_EQ("012345", std::string(buf, 6));
+
+    // 端を回り込む。入り切らない分は書かない。
+    ASSERT_EQ(12, peer->write("abcdefghijklmn", 14));
+    ASSERT_EQ(0, peer->space());
+    ASSERT_EQ(16, ring->read(buf, sizeof(buf)));
+    ASSERT_EQ("6789abcdefghijkl", std::string(buf, 16));
+    ASSERT_EQ(0, ring->read(buf, sizeof(buf)));
+}
+
+TEST_F(ShmRingFixture, session)
+{
+    {
+        ShmRingStream out(peer, true);
+        ASSERT_EQ(ShmRing::S_OPEN, ring->state());
+        out.writeString("hello");
+
+        ShmRingStream in(ring, false);
+        ASSERT_TRUE(in.readReady(0));
+        ASSERT_FALSE(in.eof());
+        char buf[5];
+        in.read(buf, 5);
+        ASSERT_EQ("hello", std::string(buf, 5));
+        ASSERT_FALSE(in.readReady(0));
+    }
+    // 送り手のストリームが消えるとセッションが閉じる。
+    ASSERT_EQ(ShmRing::S_CLOSED, ring->state());
+
+    ShmRingStream in(ring, false);
+    ASSERT_TRUE(in.eof());
+    char c;
+    ASSERT_THROW(in.read(&c, 1), EOFException);
+}
+
+TEST_F(ShmRingFixture, discard)
+{
+    ShmRingStream out(peer, true);
+    out.writeString("abc");
+
+    // 受け手がやめたら、残りは捨てられる。
+    ring->compareAndSetState(ShmRing::S_OPEN, ShmRing::S_DISCARD);
+    ring->drain();
+    out.writeString("def");
+    ASSERT_EQ(0, ring->available());
+
+    out.close();
+    ASSERT_EQ(ShmRing::S_CLOSED, ring->state());
+}
+
+TEST_F(ShmRingFixture, busy)
+{
+    // 前のセッションを読み終えていなければ、次のセッションは捨てる。
+    ring->setState(ShmRing::S_CLOSED);
+    ShmRingStream out(peer, true);
+    out.writeString("abc");
+    ASSERT_EQ(0, ring->available());
+    out.close();
+    ASSERT_EQ(ShmRing::S_CLOSED, ring->state());
+}
+#endif
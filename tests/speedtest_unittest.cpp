@@ -0,0 +1,147 @@
+#include <gtest/gtest.h>
+
+#include "speedtest.h"
+#include "mocksys.h"
+#include "mockclientsocket.h"
+
+class SpeedtestFixture : public ::testing::Test {
+};
+
+namespace
+{
+    // 書いた量だけ数えて捨てる。書く度に時計を進める。
+    class CountingSocket : public MockClientSocket
+    {
+    public:
+        CountingSocket(MockSys& s) : msys(s) {}
+
+        void writeVector(const IOVec *vec, int n) override
+        {
+            if (closeAfter && written >= closeAfter)
+                throw SockException("Closed on write");
+            for (int i = 0; i < n; i++)
+                written += vec[i].len;
+            numCalls++;
+            msys.dtime += 0.5;
+        }
+
+        int readSome(void *, int l) override
+        {
+            msys.dtime += 0.5;
+            int r = std::min<int64_t>(l, available);
+            available -= r;
+            return r;
+        }
+
+        bool getTransportInfo(TransportInfo& info) override
+        {
+            info.unackedBytes = unacked;
+            info.rttUsec = 20000;
+            return true;
+        }
+
+        MockSys& msys;
+        uint64_t written = 0;
+        uint64_t closeAfter = 0;
+        int64_t available = 0;
+        int numCalls = 0;
+        unsigned int unacked = 0;
+    };
+}
+
+TEST_F(SpeedtestFixture, sendCountsAckedBytes)
+{
+    MockSys msys;
+    auto tmp = sys;
+    sys = &msys;
+
+    CountingSocket sock(msys);
+    sock.unacked = 1000;
+    auto r = Speedtest::send(sock, 2.0);
+
+    // 0.5 秒ごとに 256 KiB を 4 回。
+    ASSERT_EQ(4, sock.numCalls);
+    ASSERT_EQ(4 * Speedtest::VECTOR_BLOCKS * Speedtest::BLOCK_SIZE, sock.written);
+    ASSERT_EQ(sock.written - 1000, r.bytes);
+    ASSERT_DOUBLE_EQ(2.0, r.seconds);
+    ASSERT_EQ(20000, r.rttUsec);
+    ASSERT_DOUBLE_EQ(r.bytes * 8 / 2.0, r.bps());
+
+    sys = tmp;
+}
+
+TEST_F(SpeedtestFixture, sendStopsWhenClosed)
+{
+    MockSys msys;
+    auto tmp = sys;
+    sys = &msys;
+
+    CountingSocket sock(msys);
+    sock.closeAfter = Speedtest::VECTOR_BLOCKS * Speedtest::BLOCK_SIZE;
+    auto r = Speedtest::send(sock, 10.0);
+    ASSERT_EQ(1, sock.numCalls);
+    ASSERT_EQ(sock.written, r.bytes);
+
+    sys = tmp;
+}
+
+TEST_F(SpeedtestFixture, receiveReadsUpToLength)
+{
+    MockSys msys;
+    auto tmp = sys;
+    sys = &msys;
+
+    CountingSocket sock(msys);
+    sock.available = 200000;
+    auto r = Speedtest::receive(sock, 150000, 30);
+    ASSERT_EQ(150000, r.bytes);
+    ASSERT_EQ(50000, sock.available);
+
+    // 長さが無ければ相手が閉じるまで。
+    r = Speedtest::receive(sock, -1, 30);
+    ASSERT_EQ(50000, r.bytes);
+
+    sys = tmp;
+}
+
+TEST_F(SpeedtestFixture, bufferIsNotCompressible)
+{
+    const char* buf = Speedtest::buffer();
+    ASSERT_NE(0, memcmp(buf, buf + Speedtest::BLOCK_SIZE, Speedtest::BLOCK_SIZE));
+}
+
+TEST_F(SpeedtestFixture, sessions)
+{
+    MockSys msys;
+    auto tmp = sys;
+    sys = &msys;
+
+    Speedtest st;
+    ASSERT_TRUE(st.result("abc").is_null());
+
+    for (int i = 0; i < Speedtest::MAX_STREAMS; i++)
+        ASSERT_TRUE(st.begin("abc"));
+    ASSERT_FALSE(st.begin("abc"));
+    ASSERT_EQ(Speedtest::MAX_STREAMS, st.result("abc")["active"]);
+
+    Speedtest::Result r;
+    r.bytes = 1000;
+    r.seconds = 2;
+    r.rttUsec = 100;
+    for (int i = 0; i < Speedtest::MAX_STREAMS; i++)
+        st.end("abc", r);
+
+    auto res = st.result("abc");
+    ASSERT_EQ(0, res["active"]);
+    ASSERT_EQ(Speedtest::MAX_STREAMS, res["streams"]);
+    ASSERT_EQ(1000 * Speedtest::MAX_STREAMS, res["bytes"]);
+    ASSERT_DOUBLE_EQ(4000.0 * Speedtest::MAX_STREAMS, res["bps"].get<double>());
+
+    // 終わってしばらくすると消える。
+    st.expire(msys.dtime + Speedtest::SESSION_TTL - 1);
+    ASSERT_FALSE(st.result("abc").is_null());
+    st.expire(msys.dtime + Speedtest::SESSION_TTL);
+    ASSERT_TRUE(st.result("abc").is_null());
+
+    sys = tmp;
+}
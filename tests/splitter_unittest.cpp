@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+
+#include <condition_variable>
+
+#include "splitter.h"
+#include "queuedstream.h"
+#include "sstream.h"
+
+TEST(StreamSplitterTest, writeVector)
+{
+    auto a = std::make_shared<StringStream>();
+    auto b = std::make_shared<StringStream>();
+    StreamSplitter splitter({ a, b });
+
+    Stream::IOVec vec[] = { { "head", 4 }, { "payload", 7 } };
+    splitter.writeVector(vec, 2);
+    splitter.writeString("!");
+
+    ASSERT_EQ("headpayload!", a->str());
+    ASSERT_EQ("headpayload!", b->str());
+}
+
+// open() されるまで書き込みを止める出力先
+class GatedStream : public StringStream
+{
+public:
+    void write(const void *data, int len) override
+    {
+        std::unique_lock<std::mutex> lk(mutex);
+        cond.wait(lk, [this]() { return opened; });
+        if (fail)
+            throw StreamException("write failed");
+        StringStream::write(data, len);
+    }
+
+    void open()
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        opened = true;
+        cond.notify_all();
+    }
+
+    void close() override
+    {
+        closed = true;
+    }
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool opened = false;
+    bool fail = false;
+    std::atomic<bool> closed { false };
+};
+
+TEST(QueuedStreamTest, writesInOrder)
+{
+    auto a = std::make_shared<GatedStream>();
+    a->open();
+    auto q = std::make_shared<QueuedStream>(a);
+    StreamSplitter splitter({ q });
+
+    Stream::IOVec vec[] = { { "head", 4 }, { "payload", 7 } };
+    splitter.writeVector(vec, 2);
+    splitter.writeString("!");
+    splitter.close();
+
+    ASSERT_EQ("headpayload!", a->str());
+    ASSERT_TRUE(a->closed);
+    ASSERT_EQ(12, q->bytesWritten());
+    ASSERT_EQ(0, q->numDropped());
+}
+
+TEST(QueuedStreamTest, slowOutputDisconnected)
+{
+    auto slow = std::make_shared<GatedStream>();
+    auto fast = std::make_shared<GatedStream>();
+    fast->open();
+    auto qslow = std::make_shared<QueuedStream>(slow, QueuedStream::P_DISCONNECT, 10);
+    auto qfast = std::make_shared<QueuedStream>(fast, QueuedStream::P_DISCONNECT, 1000);
+    StreamSplitter splitter({ qslow, qfast });
+
+    // 遅い方が止まっていても書き手は待たない。
+    for (int i = 0; i < 10; i++)
+        splitter.writeString("abcd");
+    ASSERT_TRUE(qslow->isDisconnected());
+    ASSERT_FALSE(qfast->isDisconnected());
+
+    slow->open();
+    splitter.close();
+    ASSERT_EQ(40, fast->str().size());
+    ASSERT_TRUE(slow->closed);
+    ASSERT_LE(slow->str().size(), 4u);
+}
+
+TEST(QueuedStreamTest, slowOutputDrops)
+{
+    auto slow = std::make_shared<GatedStream>();
+    QueuedStream q(slow, QueuedStream::P_DROP, 8);
+
+    // 最初の一つは書き手が持って行くので、数えるのはキューが
+    // 空になってから。
+    q.writeString("0123");
+    while (q.queuedBytes() > 0)
+        sys->sleep(1);
+    q.writeString("abcd");
+    q.writeString("efgh");
+    q.writeString("ijkl");   // 溢れる
+    ASSERT_EQ(1, q.numDropped());
+    ASSERT_FALSE(q.isDisconnected());
+
+    slow->open();
+    q.close();
+    ASSERT_EQ("0123abcdefgh", slow->str());
+    ASSERT_TRUE(slow->closed);
+}
+
+TEST(QueuedStreamTest, writeErrorDisconnects)
+{
+    auto a = std::make_shared<GatedStream>();
+    a->fail = true;
+    a->open();
+    QueuedStream q(a);
+
+    q.writeString("abcd");
+    while (!q.isDisconnected())
+        sys->sleep(1);
+    q.writeString("efgh");   // 捨てられる
+    q.close();
+    ASSERT_TRUE(a->closed);
+    ASSERT_EQ(0, q.bytesWritten());
+}
+
+TEST(QueuedStreamTest, policyFromString)
+{
+    ASSERT_EQ(QueuedStream::P_DROP, QueuedStream::policyFromString("drop"));
+    ASSERT_EQ(QueuedStream::P_DISCONNECT, QueuedStream::policyFromString("disconnect"));
+    ASSERT_THROW(QueuedStream::policyFromString("block"), ArgumentException);
+}
@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "standby.h"
+#include "mockclientsocket.h"
+
+class CountingSocket : public MockClientSocket
+{
+public:
+    CountingSocket(std::atomic<int>& closed) : m_closed(closed) {}
+
+    void close() override
+    {
+        m_closed++;
+        isClosed = true;
+    }
+
+    std::atomic<int>& m_closed;
+    std::atomic<bool> isClosed { false };
+};
+
+class StandbyUpstreamFixture : public ::testing::Test {
+public:
+    StandbyUpstreamFixture()
+        : picks(0)
+        , connects(0)
+        , closed(0)
+        , available(true)
+        , standby([this](ChanHit& hit)
+                  {
+                      picks++;
+                      if (!available)
+                          return false;
+                      hit.init();
+                      hit.host = Host(IP::parse("192.0.2.1"), 7144);
+                      return true;
+                  })
+    {
+        standby.refreshInterval = 50;
+        standby.retryInterval = 10;
+        standby.connect = [this](const ChanHit& hit)
+        {
+            connects++;
+            auto sock = std::make_shared<CountingSocket>(closed);
+            sock->host = hit.host;
+            return std::shared_ptr<ClientSocket>(sock);
+        };
+    }
+
+    bool waitFor(std::function<bool()> cond)
+    {
+        for (int i = 0; i < 200; i++)
+        {
+            if (cond())
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+
+    std::atomic<int> picks;
+    std::atomic<int> connects;
+    std::atomic<int> closed;
+    std::atomic<bool> available;
+    StandbyUpstream standby;
+};
+
+TEST_F(StandbyUpstreamFixture, nothingBeforeStart)
+{
+    ChanHit hit;
+    std::shared_ptr<ClientSocket> sock;
+    ASSERT_FALSE(standby.take(hit, sock));
+    ASSERT_EQ(0, picks);
+}
+
+TEST_F(StandbyUpstreamFixture, takeConnection)
+{
+    standby.start();
+
+    ChanHit hit;
+    std::shared_ptr<ClientSocket> sock;
+    ASSERT_TRUE(waitFor([&]() { return standby.take(hit, sock); }));
+    ASSERT_TRUE(sock);
+    ASSERT_EQ("192.0.2.1:7144", hit.host.str());
+
+    // 取り出した接続は閉じられない。取り出した後に張り直した控えは閉
+    // じられてよい。
+    standby.stop();
+    ASSERT_FALSE(std::static_pointer_cast<CountingSocket>(sock)->isClosed);
+}
+
+// 古くなった接続は張り直して閉じる。
+TEST_F(StandbyUpstreamFixture, refresh)
+{
+    standby.start();
+    ASSERT_TRUE(waitFor([&]() { return connects >= 3; }));
+    standby.stop();
+    ASSERT_EQ(connects.load(), closed.load());
+}
+
+TEST_F(StandbyUpstreamFixture, retryWhenNoCandidate)
+{
+    available = false;
+    standby.start();
+    ASSERT_TRUE(waitFor([&]() { return picks >= 3; }));
+    ASSERT_EQ(0, connects);
+
+    ChanHit hit;
+    std::shared_ptr<ClientSocket> sock;
+    ASSERT_FALSE(standby.take(hit, sock));
+
+    available = true;
+    ASSERT_TRUE(waitFor([&]() { return standby.take(hit, sock); }));
+}
+
+TEST_F(StandbyUpstreamFixture, connectFailure)
+{
+    std::atomic<int> failures(0);
+    standby.connect = [&](const ChanHit&) -> std::shared_ptr<ClientSocket>
+    {
+        failures++;
+        throw SockException("Connection refused");
+    };
+    standby.start();
+    ASSERT_TRUE(waitFor([&]() { return failures >= 2; }));
+
+    ChanHit hit;
+    std::shared_ptr<ClientSocket> sock;
+    ASSERT_FALSE(standby.take(hit, sock));
+}
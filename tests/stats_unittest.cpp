@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "stats.h"
+#include "mocksys.h"
+
+class StatsFixture : public ::testing::Test {
+public:
+    void SetUp()
+    {
+        m_sys = dynamic_cast<MockSys*>(sys);
+        m_time = m_sys->time;
+        m_sys->time = 1000;
+    }
+
+    void TearDown()
+    {
+        m_sys->time = m_time;
+    }
+
+    Stats s;
+    MockSys* m_sys;
+    unsigned int m_time;
+};
+
+TEST_F(StatsFixture, initialState)
+{
+    for (int i = 0; i < Stats::MAX; i++)
+    {
+        ASSERT_EQ(0, s.getCurrent((Stats::STAT) i));
+        ASSERT_EQ(0, s.getPerSecond((Stats::STAT) i));
+    }
+}
+
+TEST_F(StatsFixture, addFromManyThreads)
+{
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 32; i++)
+        threads.push_back(std::thread([this]()
+                                      {
+                                          for (int j = 0; j < 1000; j++)
+                                              s.add(Stats::BYTESOUT, 2);
+                                          s.add(Stats::NUMPACKETSOUT);
+                                      }));
+    for (auto& t : threads)
+        t.join();
+
+    ASSERT_EQ(32 * 1000 * 2, s.getCurrent(Stats::BYTESOUT));
+    ASSERT_EQ(32, s.getCurrent(Stats::NUMPACKETSOUT));
+    ASSERT_EQ(0, s.getCurrent(Stats::BYTESIN));
+}
+
+TEST_F(StatsFixture, update)
+{
+    s.update();
+    s.add(Stats::BYTESIN, 5000);
+
+    // 5 秒経つまでは計算し直さない。
+    m_sys->time += 4;
+    s.update();
+    ASSERT_EQ(0, s.getPerSecond(Stats::BYTESIN));
+
+    m_sys->time += 1;
+    s.update();
+    ASSERT_EQ(1000, s.getPerSecond(Stats::BYTESIN));
+}
+
+TEST_F(StatsFixture, clearRange)
+{
+    s.add(Stats::NUMQUERYIN, 3);
+    s.add(Stats::NUMHITIN, 4);
+    s.add(Stats::BYTESIN, 5);
+    s.clearRange(Stats::PACKETSSTART, Stats::PACKETSEND);
+    ASSERT_EQ(0, s.getCurrent(Stats::NUMQUERYIN));
+    ASSERT_EQ(0, s.getCurrent(Stats::NUMHITIN));
+    ASSERT_EQ(5, s.getCurrent(Stats::BYTESIN));
+}
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+#include "statshist.h"
+
+// 分の境目。
+static const unsigned int T0 = 1500000000 / 60 * 60;
+
+class TimeSeriesFixture : public ::testing::Test {
+};
+
+TEST_F(TimeSeriesFixture, empty)
+{
+    TimeSeries ts;
+    ASSERT_TRUE(ts.range(TimeSeries::R_SECOND).values.empty());
+    ASSERT_TRUE(ts.range(TimeSeries::R_MINUTE).values.empty());
+}
+
+TEST_F(TimeSeriesFixture, secondsWithGap)
+{
+    TimeSeries ts;
+    ts.add(T0, 1);
+    ts.add(T0 + 1, 2);
+    ts.add(T0 + 4, 5);
+
+    auto r = ts.range(TimeSeries::R_SECOND);
+    ASSERT_EQ(T0, r.start);
+    ASSERT_EQ(1, r.interval);
+    ASSERT_EQ(5, r.values.size());
+    ASSERT_EQ(1, r.values[0]);
+    ASSERT_EQ(2, r.values[1]);
+    ASSERT_TRUE(std::isnan(r.values[2]));
+    ASSERT_TRUE(std::isnan(r.values[3]));
+    ASSERT_EQ(5, r.values[4]);
+
+    // 過去の時刻は無視する。
+    ts.add(T0 + 2, 100);
+    ASSERT_TRUE(std::isnan(ts.range(TimeSeries::R_SECOND).values[2]));
+}
+
+TEST_F(TimeSeriesFixture, secondsWrapAround)
+{
+    TimeSeries ts;
+    for (unsigned int i = 0; i < 1000; i++)
+        ts.add(T0 + i, i);
+
+    auto r = ts.range(TimeSeries::R_SECOND);
+    ASSERT_EQ(TimeSeries::NUM_SECONDS, r.values.size());
+    ASSERT_EQ(T0 + 400, r.start);
+    ASSERT_EQ(400, r.values.front());
+    ASSERT_EQ(999, r.values.back());
+
+    // リングより長く空くと全部空になる。
+    ts.add(T0 + 5000, 1);
+    r = ts.range(TimeSeries::R_SECOND);
+    ASSERT_EQ(TimeSeries::NUM_SECONDS, r.values.size());
+    for (size_t i = 0; i + 1 < r.values.size(); i++)
+        ASSERT_TRUE(std::isnan(r.values[i]));
+    ASSERT_EQ(1, r.values.back());
+}
+
+TEST_F(TimeSeriesFixture, minuteAverages)
+{
+    TimeSeries ts;
+    for (unsigned int i = 0; i < 60; i++)
+        ts.add(T0 + i, i < 30 ? 10 : 20);
+
+    // 今の分はまだ返さない。
+    ASSERT_TRUE(ts.range(TimeSeries::R_MINUTE).values.empty());
+
+    ts.add(T0 + 60, 0);
+    // 三分後。間の分は空く。
+    ts.add(T0 + 180, 0);
+
+    auto r = ts.range(TimeSeries::R_MINUTE);
+    ASSERT_EQ(T0, r.start);
+    ASSERT_EQ(60, r.interval);
+    ASSERT_EQ(3, r.values.size());
+    ASSERT_FLOAT_EQ(15, r.values[0]);
+    ASSERT_FLOAT_EQ(0, r.values[1]);
+    ASSERT_TRUE(std::isnan(r.values[2]));
+}
+
+TEST_F(TimeSeriesFixture, overwriteSameSecond)
+{
+    TimeSeries ts;
+    ts.add(T0, 10);
+    ts.add(T0, 30);
+    ts.add(T0 + 60, 0);
+
+    auto r = ts.range(TimeSeries::R_MINUTE);
+    ASSERT_EQ(1, r.values.size());
+    ASSERT_FLOAT_EQ(30, r.values[0]);
+}
+
+TEST_F(TimeSeriesFixture, channelHistory)
+{
+    StatsHistory h;
+    GnuID id("0123456789abcdef0123456789abcdef");
+
+    h.recordChannel(id, T0, 500, 3, 1, 7);
+    h.recordChannel(id, T0 + 1, 510, 4, 2, 10);
+
+    auto q = h.query(id, TimeSeries::R_SECOND);
+    ASSERT_EQ(4, q.size());
+    ASSERT_EQ("bitrate", q[0].first);
+    ASSERT_EQ(510, q[0].second.values[1]);
+    ASSERT_EQ("listeners", q[1].first);
+    ASSERT_EQ(4, q[1].second.values[1]);
+    // 飛ばした回数は前の記録との差。
+    ASSERT_EQ("skips", q[3].first);
+    ASSERT_EQ(0, q[3].second.values[0]);
+    ASSERT_EQ(3, q[3].second.values[1]);
+
+    h.recordNode(T0, 100, 200);
+    auto node = h.query(GnuID(), TimeSeries::R_SECOND);
+    ASSERT_EQ(2, node.size());
+    ASSERT_EQ("bandwidthOut", node[1].first);
+    ASSERT_EQ(200, node[1].second.values[0]);
+
+    // 無くなったチャンネルは捨てる。
+    h.retain({});
+    ASSERT_TRUE(h.query(id, TimeSeries::R_SECOND).empty());
+    ASSERT_TRUE(h.channels().empty());
+}
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "statusfeed.h"
+
+class StatusFeedFixture : public ::testing::Test {
+};
+
+TEST_F(StatusFeedFixture, emptyUntilPublished)
+{
+    StatusFeed feed;
+    StatusBlock b;
+    ASSERT_FALSE(feed.read(b));
+}
+
+TEST_F(StatusFeedFixture, publishAndRead)
+{
+    StatusFeed feed;
+    StatusBlock in;
+    in.uptime = 100;
+    in.numRelays = 3;
+    in.bytesOutPerSec = 12345;
+    feed.publish(in);
+
+    StatusBlock out;
+    ASSERT_TRUE(feed.read(out));
+    ASSERT_EQ(1, out.serial);
+    ASSERT_EQ(100, out.uptime);
+    ASSERT_EQ(3, out.numRelays);
+    ASSERT_EQ(12345, out.bytesOutPerSec);
+
+    feed.publish(in);
+    ASSERT_TRUE(feed.read(out));
+    ASSERT_EQ(2, out.serial);
+}
+
+TEST_F(StatusFeedFixture, serialize)
+{
+    StatusBlock in;
+    in.serial = 7;
+    in.time = 0x0102030405060708;
+    in.bytesOutPerSec = 42;
+
+    std::string data = StatusFeed::serialize(in);
+    ASSERT_EQ(StatusFeed::SERIALIZED_SIZE, data.size());
+    ASSERT_EQ("PCST", data.substr(0, 4));
+    ASSERT_EQ(std::string("\x01\0\0\0", 4), data.substr(4, 4));
+    ASSERT_EQ(std::string("\x08\x07\x06\x05\x04\x03\x02\x01", 8), data.substr(16, 8));
+
+    StatusBlock out;
+    ASSERT_TRUE(StatusFeed::deserialize(data, out));
+    ASSERT_EQ(7, out.serial);
+    ASSERT_EQ(0x0102030405060708, out.time);
+    ASSERT_EQ(42, out.bytesOutPerSec);
+
+    ASSERT_FALSE(StatusFeed::deserialize(data.substr(0, data.size() - 1), out));
+    ASSERT_FALSE(StatusFeed::deserialize("XXXX" + data.substr(4), out));
+}
+
+// 書き込みと重なっても、読めた写しは一回の publish のものに揃っている。
+TEST_F(StatusFeedFixture, readsAreConsistent)
+{
+    StatusFeed feed;
+    const int N = 20000;
+
+    std::thread writer([&]()
+    {
+        for (int i = 1; i <= N; i++)
+        {
+            StatusBlock b;
+            b.uptime = b.numDirect = b.numRelays = b.bytesOutPerSec = i;
+            feed.publish(b);
+        }
+    });
+
+    uint64_t last = 0;
+    bool consistent = true;
+    while (consistent && last < (uint64_t) N)
+    {
+        StatusBlock b;
+        if (!feed.read(b))
+            continue;
+        consistent = b.serial == b.uptime &&
+            b.uptime == b.numDirect &&
+            b.uptime == b.numRelays &&
+            b.uptime == b.bytesOutPerSec &&
+            b.serial >= last;
+        last = b.serial;
+    }
+    writer.join();
+    ASSERT_TRUE(consistent);
+}
@@ -242,6 +242,15 @@ TEST_F(strFixture, count)
     ASSERT_EQ(3, str::count("  ab   ab   ab  ", "ab"));
 }
 
+TEST_F(strFixture, secure_equals)
+{
+    ASSERT_TRUE(str::secure_equals("", ""));
+    ASSERT_TRUE(str::secure_equals("abc", "abc"));
+    ASSERT_FALSE(str::secure_equals("abc", "abd"));
+    ASSERT_FALSE(str::secure_equals("abc", "ab"));
+    ASSERT_FALSE(str::secure_equals(std::string("a\0b", 3), std::string("a\0c", 3)));
+}
+
 TEST_F(strFixture, rstrip)
 {
     ASSERT_EQ("", str::rstrip(""));
@@ -332,6 +341,30 @@ TEST_F(strFixture, validate_utf8)
     ASSERT_FALSE(validate_utf8("\xB1"));     // ｱ; HALFWIDTH KATAKANA LETTER A
 }
 
+TEST_F(strFixture, validate_utf8_longRuns)
+{
+    // 16 バイトずつ調べる境目の前後に多バイト文字を置く。
+    for (size_t pad = 0; pad < 40; pad++)
+    {
+        std::string ascii(pad, 'a');
+        ASSERT_TRUE(validate_utf8(ascii + "あ" + ascii));
+        ASSERT_FALSE(validate_utf8(ascii + "\xe3\x81" + ascii));
+        ASSERT_FALSE(validate_utf8(ascii + "\x8A\xBF"));
+        ASSERT_FALSE(validate_utf8(ascii + "\xe3"));
+    }
+}
+
+TEST_F(strFixture, ascii_span)
+{
+    ASSERT_EQ(0, str::ascii_span("", 0));
+    for (size_t pad = 0; pad < 40; pad++)
+    {
+        std::string s = std::string(pad, 'a') + "\xff" + std::string(20, 'b');
+        ASSERT_EQ(pad, str::ascii_span(s.data(), s.size()));
+        ASSERT_EQ(pad, str::ascii_span(s.data(), pad));
+    }
+}
+
 TEST_F(strFixture, strip)
 {
     ASSERT_EQ("", str::strip(""));
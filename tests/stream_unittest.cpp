@@ -553,3 +553,56 @@ TEST_F(StreamFixture, readLineStdString)
     mem.str("abc\rdef\r\n");
     ASSERT_EQ("abcdef", mem.readLine(1000));
 }
+
+TEST_F(StreamFixture, WriteBufferedStream_writeRef)
+{
+    StringStream out;
+    auto data = std::make_shared<std::string>("payload");
+
+    {
+        WriteBufferedStream bsock(&out);
+        bsock.writeString("head:");
+        bsock.writeRef(data->data(), data->size(), data);
+        bsock.writeString(":tail");
+        ASSERT_EQ("", out.str());
+
+        // flush まで参照を保持する。
+        ASSERT_EQ(2, data.use_count());
+        bsock.flush();
+        ASSERT_EQ(1, data.use_count());
+        ASSERT_EQ("head:payload:tail", out.str());
+
+        bsock.writeString("!");
+    }
+    ASSERT_EQ("head:payload:tail!", out.str());
+}
+
+TEST_F(StreamFixture, WriteBufferedStream_threshold)
+{
+    StringStream out;
+    WriteBufferedStream bsock(&out, 8);
+
+    bsock.writeString("abcd");
+    bsock.writeString("efg");
+    ASSERT_EQ("", out.str());
+    ASSERT_EQ(7, bsock.pendingBytes());
+    // 続けて書いたデータは一つのバッファーにまとめられる。
+    ASSERT_EQ(1, bsock.pendingData().size());
+
+    bsock.writeString("h");
+    ASSERT_EQ("abcdefgh", out.str());
+    ASSERT_EQ(0, bsock.pendingBytes());
+}
+
+TEST_F(StreamFixture, WriteBufferedStream_largeWrite)
+{
+    StringStream out;
+    WriteBufferedStream bsock(&out);
+
+    std::string big(100 * 1024, 'x');
+    bsock.writeString("a");
+    bsock.writeString(big);
+    bsock.writeString("b");
+    bsock.flush();
+    ASSERT_EQ("a" + big + "b", out.str());
+}
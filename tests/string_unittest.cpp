@@ -113,6 +113,28 @@ TEST(StringTest, sjisToUtf8)
     ASSERT_STREQ("4日目", tmp.cstr());
 }
 
+TEST(StringTest, sjisToUtf8LongASCII)
+{
+    String tmp = "0123456789abcdefghij\x93\xFA<&>0123456789abcdefghij";
+    tmp.convertTo(String::T_UNICODESAFE);
+    ASSERT_STREQ("0123456789abcdefghij日&lt;&amp;&gt;0123456789abcdefghij", tmp.cstr());
+
+    tmp = "0123456789abcdefghij\x93\xFA<&>";
+    tmp.convertTo(String::T_UNICODE);
+    ASSERT_STREQ("0123456789abcdefghij日<&>", tmp.cstr());
+}
+
+TEST(StringTest, unicodeTruncates)
+{
+    String tmp = std::string(String::MAX_LEN - 1, 'a').c_str();
+    tmp.convertTo(String::T_UNICODE);
+    ASSERT_EQ(String::MAX_LEN - 1, strlen(tmp.cstr()));
+
+    tmp = (std::string(String::MAX_LEN - 3, 'a') + "&").c_str();
+    tmp.convertTo(String::T_UNICODESAFE);
+    ASSERT_EQ(std::string(String::MAX_LEN - 3, 'a'), tmp.str());
+}
+
 TEST(StringTest, setUnquote)
 {
     String s = "xyz";
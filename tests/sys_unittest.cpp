@@ -252,3 +252,15 @@ TEST_F(SysFixture, fromFilenameEncoding)
     ASSERT_EQ(m_sys->fromFilenameEncoding("C:\\Program Files"), "C:\\Program Files");
     ASSERT_EQ(m_sys->fromFilenameEncoding("/usr/bin"), "/usr/bin");
 }
+
+TEST_F(SysFixture, sleepUntil)
+{
+    double start = m_sys->getMonotonicTime();
+    m_sys->sleepUntil(start + 0.05);
+    double end = m_sys->getMonotonicTime();
+    ASSERT_GE(end - start, 0.05);
+
+    // 過ぎた期限では眠らない。
+    m_sys->sleepUntil(end - 1.0);
+    ASSERT_LT(m_sys->getMonotonicTime() - end, 0.5);
+}
@@ -6,6 +6,8 @@
 #include "str.h"
 #include "servmgr.h"
 
+#include <unistd.h>
+
 class TemplateFixture : public ::testing::Test {
 public:
     TemplateFixture()
@@ -387,3 +389,76 @@ TEST_F(TemplateFixture, parse)
     val = Template::parse(tok);
     ASSERT_EQ(val.inspect(), "[\"array\"]");
 }
+
+TEST_F(TemplateFixture, compileExpressionIsCached)
+{
+    std::string rest;
+    auto exp = Template::compileExpression("servMgr.version == \"v0.1218\" extra", &rest);
+    ASSERT_EQ("extra", rest);
+
+    // 二回目も同じ結果と残りトークンを返す。
+    rest.clear();
+    ASSERT_EQ(exp, Template::compileExpression("servMgr.version == \"v0.1218\" extra", &rest));
+    ASSERT_EQ("extra", rest);
+
+    ASSERT_THROW(temp.evalExpression(std::string("servMgr.version == \"v0.1218\" extra")), GeneralException);
+    ASSERT_TRUE(temp.evalCondition("servMgr.version == \"v0.1218\""));
+}
+
+TEST_F(TemplateFixture, foreachReusesCompiledExpressions)
+{
+    locals.vars["items"] = std::vector<amf0::Value>({ "a", "b", "c" });
+
+    StringStream in, out;
+    in.writeString("{@foreach items}{@let x = this}{$x}{@end}{@end}");
+    in.rewind();
+    temp.readTemplate(in, &out);
+    ASSERT_EQ("abc", out.str());
+}
+
+TEST_F(TemplateFixture, loadTemplate)
+{
+    char path[] = "/tmp/templateXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+    ASSERT_EQ(3, write(fd, "abc", 3));
+    close(fd);
+
+    auto a = Template::loadTemplate(path);
+    ASSERT_EQ("abc", *a);
+    // 変わっていなければ同じものを返す。
+    ASSERT_EQ(a, Template::loadTemplate(path));
+
+    // 大きさが変われば読み直す。
+    FILE* fp = fopen(path, "w");
+    fputs("abcd", fp);
+    fclose(fp);
+    auto b = Template::loadTemplate(path);
+    ASSERT_EQ("abcd", *b);
+
+    unlink(path);
+    ASSERT_THROW(Template::loadTemplate(path), StreamException);
+}
+
+TEST_F(TemplateFixture, rootObjectScopeIsLazy)
+{
+    RootObjectScope globals;
+    int calls = 0;
+    globals.m_producers["test"] = [&]() { calls++; return amf0::Value::object({ {"a", "1"}, {"b", "2"} }); };
+    ASSERT_EQ(0, globals.numMaterialized());
+
+    amf0::Value v;
+    ASSERT_TRUE(globals.writeVariable(v, "test.a"));
+    ASSERT_EQ("1", v.string());
+    ASSERT_TRUE(globals.writeVariable(v, "test.b"));
+    ASSERT_EQ("2", v.string());
+    ASSERT_TRUE(globals.writeVariable(v, "test"));
+    ASSERT_TRUE(v.isObject());
+    // 何度参照しても作るのは一度だけ。他のオブジェクトは作らない。
+    ASSERT_EQ(1, calls);
+    ASSERT_EQ(1, globals.numMaterialized());
+
+    ASSERT_FALSE(globals.writeVariable(v, "test.c"));
+    ASSERT_FALSE(globals.writeVariable(v, "nothing.a"));
+    ASSERT_EQ(1, globals.numMaterialized());
+}
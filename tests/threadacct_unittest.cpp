@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+#include "threadacct.h"
+#include "threading.h"
+#include "defer.h"
+#include "realsysfixture.h"
+
+static std::atomic<bool> s_ready(false);
+static std::atomic<bool> s_release(false);
+
+// 名前を付け、確保して CPU を使ってから、s_release が立つまで待つ。
+static int accountedTask(ThreadInfo *info)
+{
+    sys->setThreadName("ACCT TEST");
+
+    std::vector<std::unique_ptr<int>> v;
+    for (int i = 0; i < 100; i++)
+        v.emplace_back(new int(i));
+
+    // 混んだ機械でも足りるように、自分の CPU 時間で測る。
+    auto account = ThreadAccount::current();
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    volatile unsigned int x = 0;
+    while (account && account->snapshot().cpuSeconds < 0.05 &&
+           std::chrono::steady_clock::now() < until)
+    {
+        for (int i = 0; i < 100000; i++)
+            x = x + 1;
+    }
+
+    s_ready = true;
+    while (!s_release)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return 0;
+}
+
+class ThreadAccountFixture : public RealSysFixture {
+public:
+    void SetUp() override
+    {
+        RealSysFixture::SetUp();
+        s_ready = false;
+        s_release = false;
+    }
+};
+
+TEST_F(ThreadAccountFixture, unregisteredThread)
+{
+    ASSERT_EQ(nullptr, ThreadAccount::current());
+
+    ThreadInfo info;
+    ASSERT_TRUE(ThreadAccount::stateOf(info).isNull());
+}
+
+TEST_F(ThreadAccountFixture, countsStartedThread)
+{
+    ThreadInfo info;
+    // 途中で失敗しても、info を壊す前にスレッドを終わらせる。
+    Defer release([]() { s_release = true; });
+    info.func = accountedTask;
+    info.threadClass = ThreadClass::T_BACKGROUND;
+    ASSERT_TRUE(sys->startWaitableThread(&info));
+    ASSERT_TRUE(waitUntil([]() { return s_ready.load(); }, 2000));
+
+    auto account = std::atomic_load(&info.account);
+    ASSERT_NE(nullptr, account);
+
+    auto s = account->snapshot();
+    ASSERT_EQ("ACCT TEST", s.name);
+    ASSERT_EQ("background", s.threadClass);
+    ASSERT_TRUE(s.running);
+    ASSERT_GE(s.cpuSeconds, 0.03);
+    if (ThreadAccount::allocationCountingAvailable())
+    {
+        ASSERT_GE(s.allocations, 100);
+        ASSERT_GE(s.allocatedBytes, 100 * sizeof(int));
+    }
+
+    bool listed = false;
+    for (auto& t : ThreadAccount::all())
+        if (t.id == s.id)
+            listed = true;
+    ASSERT_TRUE(listed);
+
+    s_release = true;
+    sys->waitThread(&info);
+
+    // 終わったスレッドは一覧から消えるが、CPU 時間は残る。
+    s = account->snapshot();
+    ASSERT_FALSE(s.running);
+    ASSERT_GE(s.cpuSeconds, 0.03);
+    for (auto& t : ThreadAccount::all())
+        ASSERT_NE(s.id, t.id);
+
+    auto state = ThreadAccount::stateOf(info);
+    ASSERT_EQ("ACCT TEST", state.object().at("name").string());
+}
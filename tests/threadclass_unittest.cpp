@@ -0,0 +1,147 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "threadclass.h"
+#include "sys.h"
+
+#include "mocksys.h"
+
+TEST(ThreadClassTest, names)
+{
+    ThreadClass::TYPE t;
+    for (int i = 0; i < ThreadClass::NUM_TYPES; i++)
+    {
+        ASSERT_TRUE(ThreadClass::fromName(ThreadClass::name((ThreadClass::TYPE) i), t));
+        ASSERT_EQ(i, t);
+    }
+    ASSERT_FALSE(ThreadClass::fromName("realtime", t));
+
+    ASSERT_EQ("ingestThreadPriority", ThreadClass::priorityKey(ThreadClass::T_INGEST));
+    ASSERT_EQ("backgroundThreadAffinity", ThreadClass::affinityKey(ThreadClass::T_BACKGROUND));
+}
+
+TEST(ThreadClassTest, parseCPUList)
+{
+    std::vector<int> cpus = { 9 };
+    ASSERT_TRUE(ThreadClass::parseCPUList("", cpus));
+    ASSERT_EQ(std::vector<int>(), cpus);
+
+    ASSERT_TRUE(ThreadClass::parseCPUList("6,0-3,2", cpus));
+    ASSERT_EQ(std::vector<int>({ 0, 1, 2, 3, 6 }), cpus);
+
+    ASSERT_FALSE(ThreadClass::parseCPUList("a", cpus));
+    ASSERT_FALSE(ThreadClass::parseCPUList("1,,2", cpus));
+    ASSERT_FALSE(ThreadClass::parseCPUList("3-1", cpus));
+    ASSERT_FALSE(ThreadClass::parseCPUList("1-2-3", cpus));
+    ASSERT_FALSE(ThreadClass::parseCPUList("-1", cpus));
+    ASSERT_FALSE(ThreadClass::parseCPUList("0-5000", cpus));
+}
+
+namespace
+{
+    // 頼まれた優先度と CPU を覚える。
+    class RecordingSys : public MockSys
+    {
+    public:
+        bool setThreadPriority(int niceDelta) override
+        {
+            priorities.push_back(niceDelta);
+            return true;
+        }
+        bool setThreadAffinity(const std::vector<int>& cpus) override
+        {
+            affinities.push_back(cpus);
+            return true;
+        }
+
+        std::vector<int> priorities;
+        std::vector<std::vector<int>> affinities;
+    };
+}
+
+class ThreadClassFixture : public ::testing::Test {
+public:
+    void SetUp() override
+    {
+        m_sys = sys;
+        sys = &rsys;
+    }
+
+    void TearDown() override
+    {
+        sys = m_sys;
+        for (int i = 0; i < ThreadClass::NUM_TYPES; i++)
+            ThreadClass::setSetting((ThreadClass::TYPE) i, ThreadClass::Setting());
+    }
+
+    // 何も当てていないスレッドで f を呼ぶ。
+    static void inNewThread(std::function<void()> f)
+    {
+        std::thread t(f);
+        t.join();
+    }
+
+    RecordingSys rsys;
+    Sys* m_sys;
+};
+
+TEST_F(ThreadClassFixture, setSetting)
+{
+    ThreadClass::Setting s;
+    s.priority = -100;
+    s.affinity = "0-1";
+    ASSERT_TRUE(ThreadClass::setSetting(ThreadClass::T_DATA, s));
+    ASSERT_EQ(-20, ThreadClass::setting(ThreadClass::T_DATA).priority);
+    ASSERT_EQ("0-1", ThreadClass::setting(ThreadClass::T_DATA).affinity);
+
+    // 読めない CPU の並びでは何も変えない。
+    s.priority = 5;
+    s.affinity = "x";
+    ASSERT_FALSE(ThreadClass::setSetting(ThreadClass::T_DATA, s));
+    ASSERT_EQ(-20, ThreadClass::setting(ThreadClass::T_DATA).priority);
+
+    ASSERT_TRUE(ThreadClass::readSetting("backgroundThreadPriority", "10"));
+    ASSERT_TRUE(ThreadClass::readSetting("backgroundThreadAffinity", "3"));
+    ASSERT_EQ(10, ThreadClass::setting(ThreadClass::T_BACKGROUND).priority);
+    ASSERT_EQ("3", ThreadClass::setting(ThreadClass::T_BACKGROUND).affinity);
+    ASSERT_FALSE(ThreadClass::readSetting("maxRelays", "10"));
+}
+
+TEST_F(ThreadClassFixture, defaultsLeaveThreadAlone)
+{
+    inNewThread([]()
+                {
+                    ASSERT_EQ(ThreadClass::T_CONTROL, ThreadClass::current());
+                    ThreadClass::apply(ThreadClass::T_INGEST);
+                    ASSERT_EQ(ThreadClass::T_INGEST, ThreadClass::current());
+                });
+    ASSERT_TRUE(rsys.priorities.empty());
+    ASSERT_TRUE(rsys.affinities.empty());
+}
+
+TEST_F(ThreadClassFixture, appliesOnlyChanges)
+{
+    ThreadClass::Setting data;
+    data.priority = -5;
+    data.affinity = "2-3";
+    ThreadClass::setSetting(ThreadClass::T_DATA, data);
+    ThreadClass::Setting bg;
+    bg.priority = 10;
+    bg.affinity = "2-3";
+    ThreadClass::setSetting(ThreadClass::T_BACKGROUND, bg);
+
+    inNewThread([]()
+                {
+                    ThreadClass::apply(ThreadClass::T_DATA);
+                    ThreadClass::apply(ThreadClass::T_DATA);
+                    ThreadClass::apply(ThreadClass::T_BACKGROUND);
+                    // プールのワーカーが戻る時のように元に戻す。
+                    ThreadClass::apply(ThreadClass::T_CONTROL);
+                });
+
+    ASSERT_EQ(std::vector<int>({ -5, 10, 0 }), rsys.priorities);
+    ASSERT_EQ(2, rsys.affinities.size());
+    ASSERT_EQ(std::vector<int>({ 2, 3 }), rsys.affinities[0]);
+    ASSERT_EQ(std::vector<int>(), rsys.affinities[1]);
+}
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "threadpool.h"
+#include "realsysfixture.h"
+
+static std::atomic<int> s_started(0);
+static std::atomic<int> s_finished(0);
+static std::atomic<bool> s_release(false);
+
+// s_release が立つまで戻らないタスク。data が真なら先に昇格する。
+static int blockingTask(ThreadInfo *info)
+{
+    if (info->data)
+        ThreadPool::promote();
+    s_started++;
+    while (!s_release)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    s_finished++;
+    return 0;
+}
+
+class ThreadPoolFixture : public RealSysFixture {
+public:
+    void SetUp() override
+    {
+        RealSysFixture::SetUp();
+        s_started = 0;
+        s_finished = 0;
+        s_release = false;
+    }
+
+    void TearDown() override
+    {
+        s_release = true;
+        waitUntil([]() { return s_finished == s_started; });
+        RealSysFixture::TearDown();
+    }
+};
+
+TEST_F(ThreadPoolFixture, queuesBeyondMaxWorkers)
+{
+    ThreadPool pool(2);
+    ThreadInfo tasks[3];
+    for (auto& t : tasks)
+    {
+        t.func = blockingTask;
+        ASSERT_TRUE(pool.submit(&t));
+        ASSERT_TRUE(t.active());
+    }
+
+    ASSERT_TRUE(waitUntil([]() { return s_started == 2; }));
+    ASSERT_EQ(2, pool.numWorkers());
+    ASSERT_EQ(1, pool.numQueued());
+
+    s_release = true;
+    ASSERT_TRUE(waitUntil([]() { return s_finished == 3; }));
+    // ワーカーは終わった後も残って次を待つ。
+    ASSERT_TRUE(waitUntil([&]() { return pool.numIdle() == 2; }));
+    ASSERT_EQ(2, pool.numWorkers());
+}
+
+TEST_F(ThreadPoolFixture, promoteFreesSlot)
+{
+    ThreadPool pool(1);
+    ThreadInfo longTask, shortTask;
+    longTask.func = blockingTask;
+    longTask.data = &longTask;
+    shortTask.func = blockingTask;
+
+    ASSERT_TRUE(pool.submit(&longTask));
+    ASSERT_TRUE(waitUntil([]() { return s_started == 1; }));
+    ASSERT_EQ(0, pool.numWorkers());
+
+    // 昇格したタスクが走っていても、次のタスクは新しいワーカーで動く。
+    ASSERT_TRUE(pool.submit(&shortTask));
+    ASSERT_TRUE(waitUntil([]() { return s_started == 2; }));
+    ASSERT_EQ(1, pool.numWorkers());
+
+    // 昇格したスレッドはプールに戻らない。
+    s_release = true;
+    ASSERT_TRUE(waitUntil([&]() { return pool.numIdle() == 1; }));
+    ASSERT_EQ(1, pool.numWorkers());
+}
+
+TEST_F(ThreadPoolFixture, promoteOutsidePoolDoesNothing)
+{
+    ThreadPool pool(1);
+    ThreadPool::promote();
+    ASSERT_EQ(0, pool.numWorkers());
+}
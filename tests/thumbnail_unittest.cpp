@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+
+#include "thumbnail.h"
+#include "channel.h"
+#include "flv.h"
+
+class ThumbnailCacheFixture : public ::testing::Test {
+public:
+    ThumbnailCacheFixture()
+        : ch(std::make_shared<Channel>())
+        , pos(0)
+    {
+        ch->info.contentType = ChanInfo::T_FLV;
+        head = std::string("FLV\x01\x01\x00\x00\x00\x09\x00\x00\x00\x00", 13);
+        ch->headPack.init(ChanPacket::T_HEAD, head.data(), (unsigned int) head.size(), 0);
+        pos = (unsigned int) head.size();
+    }
+
+    static std::string tag(FLVTag::TYPE type, int32_t timestamp, const std::string& payload)
+    {
+        FLVTag t;
+        t.set(type, timestamp, payload.data(), (int) payload.size());
+        return std::string(reinterpret_cast<char*>(t.packet), t.packetSize);
+    }
+
+    static std::string videoFrame(int32_t timestamp, bool keyFrame, size_t size, char fill)
+    {
+        return tag(FLVTag::T_VIDEO, timestamp, std::string(keyFrame ? "\x17\x01" : "\x27\x01", 2) + std::string(size, fill));
+    }
+
+    // FLVTagBuffer と同じく 15KB ごとのパケットに分けて書く。
+    void write(const std::string& s, bool keyFrame)
+    {
+        for (size_t off = 0; off < s.size(); off += 15 * 1024)
+        {
+            auto chunk = s.substr(off, 15 * 1024);
+            ChanPacket pack;
+            pack.init(ChanPacket::T_DATA, chunk.data(), (unsigned int) chunk.size(), pos);
+            pack.cont = !(keyFrame && off == 0);
+            ASSERT_TRUE(ch->rawData.writePacket(pack));
+            pos += (unsigned int) chunk.size();
+        }
+    }
+
+    std::shared_ptr<Channel> ch;
+    std::string head;
+    unsigned int pos;
+    ThumbnailCache thumbs;
+};
+
+TEST_F(ThumbnailCacheFixture, keyFrameSpanningPackets)
+{
+    auto key = videoFrame(0, true, 40000, 'k');
+    write(key, true);
+    write(videoFrame(40, false, 100, 'p'), false);
+
+    auto image = thumbs.keyFrame(ch);
+    ASSERT_TRUE(image != nullptr);
+    ASSERT_EQ(head + key, *image->data);
+    ASSERT_EQ("video/x-flv", image->mimeType);
+
+    // キーフレームが変わらなければ同じものを返す。
+    write(videoFrame(80, false, 100, 'p'), false);
+    ASSERT_EQ(image, thumbs.keyFrame(ch));
+
+    auto key2 = videoFrame(1000, true, 100, 'K');
+    write(key2, true);
+    auto image2 = thumbs.keyFrame(ch);
+    ASSERT_NE(image->key, image2->key);
+    ASSERT_EQ(head + key2, *image2->data);
+}
+
+TEST_F(ThumbnailCacheFixture, incompleteKeyFrameUsesPrevious)
+{
+    auto key = videoFrame(0, true, 100, 'k');
+    write(key, true);
+
+    // 次のキーフレームは最初のパケットしか届いていない。
+    auto key2 = videoFrame(1000, true, 40000, 'K');
+    write(key2.substr(0, 15 * 1024), true);
+
+    auto image = thumbs.keyFrame(ch);
+    ASSERT_TRUE(image != nullptr);
+    ASSERT_EQ(head + key, *image->data);
+}
+
+TEST_F(ThumbnailCacheFixture, notFLV)
+{
+    write(videoFrame(0, true, 100, 'k'), true);
+    ch->info.contentType = ChanInfo::T_MKV;
+    ASSERT_TRUE(thumbs.keyFrame(ch) == nullptr);
+}
+
+TEST_F(ThumbnailCacheFixture, jpegConvertedOncePerKeyFrame)
+{
+    thumbs.setConverter([](const std::string& flv, std::string& jpeg)
+                        {
+                            jpeg = "JPEG" + std::to_string(flv.size());
+                            return true;
+                        });
+
+    ASSERT_TRUE(thumbs.jpeg(ch, 1000) == nullptr);
+
+    auto key = videoFrame(0, true, 100, 'k');
+    write(key, true);
+    auto image = thumbs.jpeg(ch, 5000);
+    ASSERT_TRUE(image != nullptr);
+    ASSERT_EQ("image/jpeg", image->mimeType);
+    ASSERT_EQ("JPEG" + std::to_string(head.size() + key.size()), *image->data);
+
+    ASSERT_EQ(image, thumbs.jpeg(ch, 5000));
+    ASSERT_EQ(1, thumbs.numConversions());
+
+    write(videoFrame(1000, true, 200, 'K'), true);
+    auto image2 = thumbs.jpeg(ch, 5000);
+    ASSERT_NE(image->key, image2->key);
+    ASSERT_EQ(2, thumbs.numConversions());
+}
+
+TEST_F(ThumbnailCacheFixture, failedConversionNotRetried)
+{
+    int calls = 0;
+    thumbs.setConverter([&](const std::string&, std::string&)
+                        {
+                            calls++;
+                            return false;
+                        });
+
+    write(videoFrame(0, true, 100, 'k'), true);
+    ASSERT_TRUE(thumbs.jpeg(ch, 5000) == nullptr);
+    ASSERT_TRUE(thumbs.jpeg(ch, 5000) == nullptr);
+    ASSERT_EQ(1, calls);
+}
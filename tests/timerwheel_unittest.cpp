@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "timerwheel.h"
+#include "realsysfixture.h"
+
+class TimerWheelFixture : public RealSysFixture {
+public:
+    void TearDown() override
+    {
+        w.stop();
+        RealSysFixture::TearDown();
+    }
+
+    TimerWheel w { "TEST", 1 };
+};
+
+TEST_F(TimerWheelFixture, notRunningInitially)
+{
+    ASSERT_FALSE(w.running());
+}
+
+TEST_F(TimerWheelFixture, runsPeriodically)
+{
+    std::atomic<int> count(0);
+    w.add("count", 100, [&]() { count++; });
+
+    ASSERT_TRUE(w.start());
+    ASSERT_TRUE(w.running());
+    std::this_thread::sleep_for(std::chrono::milliseconds(750));
+    w.stop();
+    ASSERT_FALSE(w.running());
+
+    int n = count;
+    ASSERT_GE(n, 3);
+    ASSERT_LE(n, 8);
+
+    // 止めた後は走らない。
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    ASSERT_EQ(n, count);
+}
+
+TEST_F(TimerWheelFixture, periodLongerThanWheel)
+{
+    std::atomic<int> count(0);
+    // 輪を一周以上待つ仕事。
+    w.add("slow", (TimerWheel::NUM_SLOTS + 1) * TimerWheel::TICK_MSEC, [&]() { count++; });
+
+    ASSERT_TRUE(w.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(400));
+    w.stop();
+    ASSERT_EQ(1, count);
+}
+
+TEST_F(TimerWheelFixture, doesNotOverlap)
+{
+    std::atomic<int> active(0);
+    std::atomic<int> maxActive(0);
+    w.add("long", 100, [&]()
+    {
+        int n = ++active;
+        if (n > maxActive)
+            maxActive = n;
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        active--;
+    }, true);
+
+    ASSERT_TRUE(w.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(700));
+    w.stop();
+    ASSERT_EQ(1, maxActive);
+}
+
+TEST_F(TimerWheelFixture, blockingTaskDoesNotDelayFastTasks)
+{
+    std::atomic<int> fast(0);
+    w.add("block", 100, []() { std::this_thread::sleep_for(std::chrono::milliseconds(800)); }, true);
+    w.add("fast", 100, [&]() { fast++; });
+
+    ASSERT_TRUE(w.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(650));
+    int n = fast;
+    w.stop();
+    ASSERT_GE(n, 3);
+}
+
+TEST_F(TimerWheelFixture, exceptionIsCaught)
+{
+    std::atomic<int> count(0);
+    w.add("throw", 100, [&]() { count++; throw std::runtime_error("oops"); });
+
+    ASSERT_TRUE(w.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(450));
+    w.stop();
+    ASSERT_GE(count, 2);
+}
+
+TEST_F(TimerWheelFixture, stopFromTask)
+{
+    std::atomic<int> count(0);
+    w.add("stopper", 100, [&]() { count++; w.stop(); });
+
+    ASSERT_TRUE(w.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(400));
+    ASSERT_FALSE(w.running());
+    ASSERT_EQ(1, count);
+}
+
+TEST_F(TimerWheelFixture, getState)
+{
+    w.add("a", 500, []() {});
+    w.add("b", 1000, []() {}, true);
+
+    auto state = w.getState();
+    ASSERT_FALSE(state.at("running").boolean());
+    auto tasks = state.at("tasks").strictArray();
+    ASSERT_EQ(2, tasks.size());
+    ASSERT_EQ("a", tasks[0].at("name").string());
+    ASSERT_EQ(500, tasks[0].at("periodMsec").number());
+    ASSERT_TRUE(tasks[1].at("mayBlock").boolean());
+}
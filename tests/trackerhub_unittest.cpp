@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+
+#include "trackerhub.h"
+#include "servmgr.h"
+
+class TrackerHubsFixture : public ::testing::Test {
+};
+
+namespace
+{
+    ChanHit makeHit(int i, int numHops, int numRelays)
+    {
+        ChanHit hit;
+        hit.rhost[0].fromStrIP(("209.209.209." + std::to_string(i % 250 + 1)).c_str(), 7144 + i);
+        hit.host = hit.rhost[0];
+        hit.sessionID.clear();
+        hit.sessionID.id[0] = 0xff;
+        hit.sessionID.id[15] = i;
+        hit.numHops = numHops;
+        hit.numListeners = 1;
+        hit.numRelays = numRelays;
+        hit.relay = true;
+        return hit;
+    }
+}
+
+TEST_F(TrackerHubsFixture, pickHubs)
+{
+    ChanHitList chl;
+
+    // ヒットが少なければ指名しない。
+    for (int i = 0; i < TrackerHubs::MIN_HITS - 1; i++)
+    {
+        auto hit = makeHit(i, (i < 10) ? 1 : 2, i);
+        chl.addHit(hit);
+    }
+    ASSERT_EQ(0, TrackerHubs::pickHubs(chl, TrackerHubs::MAX_HUBS).size());
+
+    auto hit = makeHit(TrackerHubs::MIN_HITS, 1, 0);
+    hit.firewalled = true;
+    chl.addHit(hit);
+
+    // 直下のリレーをリレー数の多い順に。
+    auto hubs = TrackerHubs::pickHubs(chl, TrackerHubs::MAX_HUBS);
+    ASSERT_EQ(TrackerHubs::MAX_HUBS, hubs.size());
+    ASSERT_EQ(9, hubs[0].numRelays);
+    ASSERT_EQ(6, hubs[3].numRelays);
+    for (auto& h : hubs)
+        ASSERT_EQ(1, h.numHops);
+}
+
+TEST_F(TrackerHubsFixture, leaseExpires)
+{
+    TrackerHubs hubs;
+    GnuID chanID;
+    chanID.fromStr("0123456789abcdef0123456789abcdef");
+    const unsigned int t = 1000;
+
+    ASSERT_FALSE(hubs.isHub(chanID, t));
+    // 長すぎる指名は LEASE で切る。
+    hubs.assign(chanID, 100000, t);
+    ASSERT_TRUE(hubs.isHub(chanID, t + TrackerHubs::LEASE - 1));
+    ASSERT_FALSE(hubs.isHub(chanID, t + TrackerHubs::LEASE));
+
+    hubs.expire(t + TrackerHubs::LEASE);
+    ASSERT_EQ(0, hubs.getState().at("numChannels").number());
+}
+
+TEST_F(TrackerHubsFixture, summarizesChildren)
+{
+    TrackerHubs hubs;
+    GnuID chanID;
+    chanID.fromStr("0123456789abcdef0123456789abcdef");
+    const unsigned int t = 1000;
+
+    auto a = makeHit(1, 2, 3);
+    auto b = makeHit(2, 3, 0);
+    b.numListeners = 5;
+
+    // 指名されていなければ数えない。
+    hubs.absorb(chanID, a, t);
+    ASSERT_EQ(0, hubs.summary(chanID, t).numHits);
+
+    hubs.assign(chanID, TrackerHubs::LEASE, t);
+    hubs.absorb(chanID, a, t);
+    hubs.absorb(chanID, a, t);      // 同じホストは一度だけ
+    hubs.absorb(chanID, b, t + 10);
+    auto s = hubs.summary(chanID, t + 10);
+    ASSERT_EQ(2, s.numHits);
+    ASSERT_EQ(6, s.numListeners);
+    ASSERT_EQ(3, s.numRelays);
+
+    // 下流のハブのまとめも足す。
+    b.hub = true;
+    b.hubListeners = 100;
+    b.hubRelays = 10;
+    hubs.absorb(chanID, b, t + 20);
+    s = hubs.summary(chanID, t + 20);
+    ASSERT_EQ(106, s.numListeners);
+    ASSERT_EQ(13, s.numRelays);
+
+    // 報告の途絶えた下流は数えない。
+    s = hubs.summary(chanID, t + TrackerHubs::CHILD_TTL);
+    ASSERT_EQ(1, s.numHits);
+
+    // 受信を止めた下流は消す。
+    b.recv = false;
+    hubs.absorb(chanID, b, t + 30);
+    ASSERT_EQ(1, hubs.summary(chanID, t + 30).numHits);
+}
+
+TEST_F(TrackerHubsFixture, hitListCountsHubTotals)
+{
+    ChanHitList chl;
+    auto hit = makeHit(1, 1, 2);
+    hit.numListeners = 3;
+    hit.hub = true;
+    hit.hubListeners = 1000;
+    hit.hubRelays = 50;
+    chl.addHit(hit);
+
+    ASSERT_EQ(1003, chl.getTotalListeners());
+    ASSERT_EQ(52, chl.getTotalRelays());
+}
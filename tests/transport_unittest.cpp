@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+
+#include "transport.h"
+#include "socket.h"
+
+class TransportRegistryFixture : public ::testing::Test {
+public:
+    TransportRegistryFixture()
+        : host(IP::parse("192.168.0.1"), 7144)
+        , created(0)
+    {
+    }
+
+    void addQUIC()
+    {
+        registry.add("quic", [this]() { created++; return std::shared_ptr<ClientSocket>(); });
+    }
+
+    TransportRegistry registry;
+    Host host;
+    int created;
+};
+
+TEST_F(TransportRegistryFixture, onlyTCPByDefault)
+{
+    ASSERT_EQ(std::vector<std::string>({ "tcp" }), registry.names());
+    ASSERT_EQ("tcp", registry.select(host));
+}
+
+TEST_F(TransportRegistryFixture, laterTransportsArePreferred)
+{
+    addQUIC();
+    ASSERT_EQ(std::vector<std::string>({ "quic", "tcp" }), registry.names());
+}
+
+TEST_F(TransportRegistryFixture, rememberedHostUsesTransport)
+{
+    addQUIC();
+
+    registry.remember(host, "quic");
+    ASSERT_EQ("quic", registry.select(host));
+    ASSERT_EQ("tcp", registry.select(Host(IP::parse("192.168.0.2"), 7144)));
+
+    registry.createSocket(host);
+    ASSERT_EQ(1, created);
+
+    registry.forget(host);
+    ASSERT_EQ("tcp", registry.select(host));
+
+    // 空か TCP を教えられたら忘れる。
+    registry.remember(host, "quic");
+    registry.remember(host, "tcp");
+    ASSERT_EQ("tcp", registry.select(host));
+}
+
+TEST_F(TransportRegistryFixture, removedTransportIsNotSelected)
+{
+    addQUIC();
+    registry.remember(host, "quic");
+
+    registry.remove("quic");
+    registry.remove("tcp");
+    ASSERT_EQ(std::vector<std::string>({ "tcp" }), registry.names());
+    ASSERT_EQ("tcp", registry.select(host));
+}
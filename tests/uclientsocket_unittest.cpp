@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+
+#ifdef _UNIX
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+
+#include "usocket.h"
+
+class UClientSocketFixture : public ::testing::Test {
+public:
+    void SetUp()
+    {
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    }
+
+    void TearDown()
+    {
+        sock.detach();
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    int fds[2];
+    UClientSocket sock;
+};
+
+TEST_F(UClientSocketFixture, readReady)
+{
+    sock.sockNum = fds[0];
+
+    ASSERT_FALSE(sock.readReady(0));
+    ASSERT_EQ(1, write(fds[1], "x", 1));
+    ASSERT_TRUE(sock.readReady(100));
+}
+
+// FD_SETSIZE を超える記述子でも待てる。
+TEST_F(UClientSocketFixture, largeDescriptor)
+{
+    int highfd = dup2(fds[0], FD_SETSIZE + 10);
+    if (highfd == -1)
+        GTEST_SKIP() << "cannot allocate descriptor above FD_SETSIZE";
+    close(fds[0]);
+    fds[0] = highfd;
+    sock.sockNum = highfd;
+
+    ASSERT_FALSE(sock.readReady(0));
+    ASSERT_EQ(1, write(fds[1], "x", 1));
+    ASSERT_TRUE(sock.readReady(100));
+
+    char c;
+    ASSERT_EQ(1, sock.read(&c, 1));
+    ASSERT_EQ('x', c);
+
+    // データが無ければ readTimeout で TimeoutException になる。
+    sock.setReadTimeout(50);
+    ASSERT_THROW(sock.read(&c, 1), TimeoutException);
+}
+
+TEST_F(UClientSocketFixture, writeVector)
+{
+    sock.sockNum = fds[0];
+
+    Stream::IOVec vec[] = { { "abc", 3 }, { "", 0 }, { "defg", 4 } };
+    sock.writeVector(vec, 3);
+    ASSERT_EQ(7, sock.tryWriteVector(vec, 3));
+
+    char buf[32] = {};
+    ASSERT_EQ(14, ::read(fds[1], buf, sizeof(buf)));
+    ASSERT_STREQ("abcdefgabcdefg", buf);
+}
+
+// 小さな読み込みはまとめて受けたバッファーから返す。
+TEST_F(UClientSocketFixture, readBuffered)
+{
+    sock.sockNum = fds[0];
+
+    const char data[] = "GET / HTTP/1.0\r\nHost: x\r\n\r\nBODY";
+    ASSERT_EQ(sizeof(data) - 1, write(fds[1], data, sizeof(data) - 1));
+
+    char line[64];
+    ASSERT_EQ(14, sock.readLine(line, sizeof(line)));
+    ASSERT_STREQ("GET / HTTP/1.0", line);
+
+    // 全部受け取り済みなので、ソケットにはもう何も無い。
+    char c;
+    ASSERT_EQ(-1, recv(fds[0], &c, 1, MSG_PEEK | MSG_DONTWAIT));
+
+    ASSERT_EQ(7, sock.readLine(line, sizeof(line)));
+    ASSERT_STREQ("Host: x", line);
+    ASSERT_EQ(0, sock.readLine(line, sizeof(line)));
+
+    ASSERT_TRUE(sock.readReady(0));
+    ASSERT_EQ(4, sock.numPending());
+    ASSERT_EQ('B', sock.peekChar());
+
+    char body[5] = {};
+    ASSERT_EQ(4, sock.read(body, 4));
+    ASSERT_STREQ("BODY", body);
+    ASSERT_FALSE(sock.readReady(0));
+}
+
+TEST_F(UClientSocketFixture, readLargeAndEOF)
+{
+    sock.sockNum = fds[0];
+
+    std::string data(20000, 'a');
+    data[0] = 'x';
+    ASSERT_EQ(data.size(), write(fds[1], data.data(), data.size()));
+    close(fds[1]);
+    fds[1] = -1;
+
+    char c;
+    ASSERT_EQ(1, sock.read(&c, 1));
+    ASSERT_EQ('x', c);
+
+    std::string rest(30000, '\0');
+    ASSERT_EQ(data.size() - 1, sock.readUpto(&rest[0], rest.size()));
+    ASSERT_EQ(data.substr(1), rest.substr(0, data.size() - 1));
+
+    ASSERT_THROW(sock.read(&c, 1), EOFException);
+}
+
+#ifdef SO_REUSEPORT
+// 同じポートを SO_REUSEPORT で複数のソケットが待ち受けられる。
+TEST(UClientSocketReusePort, bindTwice)
+{
+    UClientSocket a, b, c;
+    a.bindReusePort(Host(0, 0));
+
+    struct sockaddr_in6 addr = {};
+    socklen_t len = sizeof(addr);
+    ASSERT_EQ(0, getsockname(a.sockNum, (sockaddr *)&addr, &len));
+    Host h(0, ntohs(addr.sin6_port));
+
+    ASSERT_NO_THROW(b.bindReusePort(h));
+    ASSERT_THROW(c.bind(h), SockException);
+    c.close();
+    b.close();
+    a.close();
+}
+#endif
+#endif
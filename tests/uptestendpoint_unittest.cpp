@@ -57,6 +57,17 @@ TEST_F(UptestEndpointFixture, readInfo)
     ASSERT_EQ("1", info.enabled);
 }
 
+TEST_F(UptestEndpointFixture, readInfo_missing)
+{
+    std::string xml = "<yp4g>"
+        "<yp name=\"YP\"/>"
+        "<host ip=\"192.168.0.1\" port_open=\"1\" speed=\"999\"/>"
+        "</yp4g>";
+
+    ASSERT_THROW(UptestEndpoint::readInfo(xml), std::runtime_error);
+    ASSERT_THROW(UptestEndpoint::readInfo("<yp4g><yp name=\"YP\"/></yp4g>"), std::runtime_error);
+}
+
 TEST_F(UptestEndpointFixture, isReady)
 {
     ASSERT_EQ(UptestEndpoint::kUntried, e.status);
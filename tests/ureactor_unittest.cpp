@@ -0,0 +1,206 @@
+#include <gtest/gtest.h>
+
+#ifdef _UNIX
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thread>
+
+#include "ureactor.h"
+#include "uringreactor.h"
+#include "realsysfixture.h"
+
+// UReactor と UringReactor に同じテストを掛ける。
+template <typename T>
+class ReactorFixture : public RealSysFixture {
+public:
+    void SetUp() override
+    {
+        RealSysFixture::SetUp();
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    }
+
+    void TearDown() override
+    {
+        close(fds[0]);
+        close(fds[1]);
+        RealSysFixture::TearDown();
+    }
+
+    // カーネルや seccomp で io_uring が使えない環境では nullptr を返す
+    // ので、テストを飛ばす。
+    static std::unique_ptr<Reactor> create(int numWorkers)
+    {
+        try
+        {
+            return std::unique_ptr<Reactor>(new T(numWorkers));
+        }catch (GeneralException&)
+        {
+            return nullptr;
+        }
+    }
+
+    int fds[2];
+};
+
+#ifdef __linux__
+typedef ::testing::Types<UReactor, UringReactor> ReactorTypes;
+#else
+typedef ::testing::Types<UReactor> ReactorTypes;
+#endif
+TYPED_TEST_SUITE(ReactorFixture, ReactorTypes);
+
+TYPED_TEST(ReactorFixture, readEvent)
+{
+    auto r = TestFixture::create(2);
+    if (!r)
+        GTEST_SKIP() << "reactor unavailable";
+    Reactor& reactor = *r;
+    ASSERT_EQ(2, reactor.numWorkers());
+
+    std::atomic<int> events(0);
+    auto id = reactor.add(this->fds[0], Reactor::EV_READ,
+                          [&](int ev)
+                          {
+                              if (ev & Reactor::EV_READ)
+                              {
+                                  char c;
+                                  ASSERT_EQ(1, read(this->fds[0], &c, 1));
+                              }
+                              events |= ev;
+                          });
+    ASSERT_NE(0, id);
+    ASSERT_EQ(1, reactor.numHandlers());
+
+    ASSERT_EQ(1, write(this->fds[1], "x", 1));
+    ASSERT_TRUE(this->waitUntil([&]() { return (events & Reactor::EV_READ) != 0; }));
+
+    // ワンショットで登録しても、ハンドラーの後で有効にし直される。
+    events = 0;
+    ASSERT_EQ(1, write(this->fds[1], "y", 1));
+    ASSERT_TRUE(this->waitUntil([&]() { return (events & Reactor::EV_READ) != 0; }));
+}
+
+TYPED_TEST(ReactorFixture, post)
+{
+    auto r = TestFixture::create(2);
+    if (!r)
+        GTEST_SKIP() << "reactor unavailable";
+    Reactor& reactor = *r;
+
+    std::atomic<int> wakes(0);
+    auto id = reactor.add(this->fds[0], 0,
+                          [&](int ev)
+                          {
+                              if (ev & Reactor::EV_WAKE)
+                                  wakes++;
+                          });
+
+    reactor.post(id);
+    ASSERT_TRUE(this->waitUntil([&]() { return wakes > 0; }));
+}
+
+TYPED_TEST(ReactorFixture, removeFromHandler)
+{
+    auto r = TestFixture::create(2);
+    if (!r)
+        GTEST_SKIP() << "reactor unavailable";
+    Reactor& reactor = *r;
+
+    std::atomic<int> calls(0);
+    uint64_t id = 0;
+    std::atomic<bool> ready(false);
+    id = reactor.add(this->fds[0], Reactor::EV_WRITE,
+                     [&](int ev)
+                     {
+                         while (!ready)
+                             std::this_thread::yield();
+                         calls++;
+                         reactor.remove(id);
+                     });
+    ready = true;
+
+    ASSERT_TRUE(this->waitUntil([&]() { return reactor.numHandlers() == 0; }));
+    ASSERT_EQ(1, calls);
+
+    // 削除したハンドルへの post は無視される。
+    reactor.post(id);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_EQ(1, calls);
+}
+
+TYPED_TEST(ReactorFixture, errorOnPeerClose)
+{
+    auto r = TestFixture::create(1);
+    if (!r)
+        GTEST_SKIP() << "reactor unavailable";
+    Reactor& reactor = *r;
+
+    std::atomic<int> events(0);
+    auto id = reactor.add(this->fds[0], 0,
+                          [&](int ev)
+                          {
+                              events |= ev;
+                          });
+    (void) id;
+
+    close(this->fds[1]);
+    this->fds[1] = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_TRUE(this->waitUntil([&]() { return (events & Reactor::EV_ERROR) != 0; }));
+}
+
+// ハンドラーの中で監視するイベントを変えられる。
+TYPED_TEST(ReactorFixture, modifyFromHandler)
+{
+    auto r = TestFixture::create(2);
+    if (!r)
+        GTEST_SKIP() << "reactor unavailable";
+    Reactor& reactor = *r;
+
+    std::atomic<int> writes(0);
+    std::atomic<int> reads(0);
+    uint64_t id = 0;
+    std::atomic<bool> ready(false);
+    id = reactor.add(this->fds[0], Reactor::EV_WRITE,
+                     [&](int ev)
+                     {
+                         while (!ready)
+                             std::this_thread::yield();
+                         if (ev & Reactor::EV_WRITE)
+                         {
+                             writes++;
+                             reactor.modify(id, Reactor::EV_READ);
+                         }
+                         if (ev & Reactor::EV_READ)
+                         {
+                             char c;
+                             ASSERT_EQ(1, read(this->fds[0], &c, 1));
+                             reads++;
+                         }
+                     });
+    ready = true;
+
+    ASSERT_TRUE(this->waitUntil([&]() { return writes > 0; }));
+    ASSERT_EQ(1, write(this->fds[1], "x", 1));
+    ASSERT_TRUE(this->waitUntil([&]() { return reads > 0; }));
+    ASSERT_EQ(1, writes);
+}
+
+TYPED_TEST(ReactorFixture, tick)
+{
+    auto r = TestFixture::create(1);
+    if (!r)
+        GTEST_SKIP() << "reactor unavailable";
+    Reactor& reactor = *r;
+
+    std::atomic<int> ticks(0);
+    reactor.add(this->fds[0], 0,
+                [&](int ev)
+                {
+                    if (ev & Reactor::EV_TICK)
+                        ticks++;
+                });
+
+    // 約 1 秒ごとなので、2 回分まで待つ。
+    ASSERT_TRUE(this->waitUntil([&]() { return ticks > 0; }) || this->waitUntil([&]() { return ticks > 0; }));
+}
+#endif
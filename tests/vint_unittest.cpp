@@ -41,5 +41,24 @@ TEST_F(VIntFixture, constructor)
 
 TEST_F(VIntFixture, idToName)
 {
-    ASSERT_STREQ("EBML", VInt({0x1A,0x45,0xDF,0xA3}).toName().c_str());
+    ASSERT_STREQ("EBML", VInt({0x1A,0x45,0xDF,0xA3}).toName());
+    ASSERT_STREQ("Cluster", idToName(ID_CLUSTER));
+    ASSERT_STREQ("Unknown", VInt({0x81}).toName());
+}
+
+TEST_F(VIntFixture, fromBytes)
+{
+    const uint8_t data[] = { 0x42, 0x86, 0x81, 0x01 };
+    VInt id(data, sizeof(data));
+    ASSERT_EQ(2, id.size());
+    ASSERT_EQ(ID_EBMLVERSION, id.id());
+    ASSERT_EQ(0x286, id.uint());
+
+    VInt size(data + 2, 2);
+    ASSERT_EQ(1, size.size());
+    ASSERT_EQ(1, size.uint());
+    ASSERT_EQ(byte_string({0x81}), size.bytes());
+
+    // 長さのバイトが足りない。
+    ASSERT_THROW(VInt(data, 1), std::runtime_error);
 }
@@ -118,3 +118,13 @@ TEST_F(WaitableQueueFixture, multipleConsumers)
     p1.join(); p2.join(); p3.join();
     ASSERT_EQ(total, 60000);
 }
+
+TEST_F(WaitableQueueFixture, dequeueWithTimeout)
+{
+    WaitableQueue<int> q;
+    int v = 0;
+    ASSERT_FALSE(q.dequeue(v, 10));
+    q.enqueue(7);
+    ASSERT_TRUE(q.dequeue(v, 10));
+    ASSERT_EQ(7, v);
+}
@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+
+#include "websocket.h"
+#include "sstream.h"
+
+class WebSocketFramerFixture : public ::testing::Test {
+public:
+    WebSocketFramerFixture()
+        : bs(&mem)
+        , framer(bs)
+    {
+    }
+
+    StringStream mem;
+    WriteBufferedStream bs;
+    WebSocketFramer framer;
+};
+
+TEST_F(WebSocketFramerFixture, acceptKey)
+{
+    // RFC 6455 の例。
+    ASSERT_EQ("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=", WebSocketFramer::acceptKey("dGhlIHNhbXBsZSBub25jZQ=="));
+}
+
+TEST_F(WebSocketFramerFixture, frameHeader)
+{
+    ASSERT_EQ(std::string("\x82\x00", 2), WebSocketFramer::frameHeader(WebSocketFramer::OP_BINARY, 0));
+    ASSERT_EQ(std::string("\x82\x7d", 2), WebSocketFramer::frameHeader(WebSocketFramer::OP_BINARY, 125));
+    ASSERT_EQ(std::string("\x82\x7e\x00\x7e", 4), WebSocketFramer::frameHeader(WebSocketFramer::OP_BINARY, 126));
+    ASSERT_EQ(std::string("\x82\x7e\xff\xff", 4), WebSocketFramer::frameHeader(WebSocketFramer::OP_BINARY, 65535));
+    ASSERT_EQ(std::string("\x82\x7f\x00\x00\x00\x00\x00\x01\x00\x00", 10), WebSocketFramer::frameHeader(WebSocketFramer::OP_BINARY, 65536));
+}
+
+TEST_F(WebSocketFramerFixture, write)
+{
+    framer.write("abc", 3);
+    auto data = std::make_shared<std::string>("defg");
+    framer.writeRef(data->data(), data->size(), data);
+    bs.flush();
+
+    ASSERT_EQ(std::string("\x82\x03" "abc" "\x82\x04" "defg", 11), mem.str());
+}
+
+TEST_F(WebSocketFramerFixture, close)
+{
+    framer.close();
+    bs.flush();
+
+    ASSERT_EQ(std::string("\x88\x02\x03\xe8", 4), mem.str());
+}
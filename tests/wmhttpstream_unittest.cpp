@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+
+#include "wmhttp.h"
+#include "sstream.h"
+#include "chanmgr.h"
+
+class WMHTTPStreamFixture : public ::testing::Test {
+public:
+    WMHTTPStreamFixture()
+    {
+    }
+
+    void SetUp()
+    {
+        m_chanMgr = chanMgr;
+        chanMgr = new ChanMgr();
+        ch = std::make_shared<Channel>();
+    }
+
+    void TearDown()
+    {
+        delete chanMgr;
+        chanMgr = m_chanMgr;
+    }
+
+    ~WMHTTPStreamFixture()
+    {
+    }
+
+    // ASFChunk::write で書いたのと同じバイト列。
+    static std::string asfChunk(unsigned short type, unsigned int seq, unsigned short v1, const std::string& data)
+    {
+        ASFChunk chunk;
+        chunk.type = type;
+        chunk.len = data.size() + 8;
+        chunk.seq = seq;
+        chunk.v1 = v1;
+        chunk.v2 = data.size() + 8;
+        chunk.dataLen = data.size();
+        memcpy(chunk.data, data.data(), data.size());
+
+        StringStream mem;
+        chunk.write(mem);
+        return mem.str();
+    }
+
+    ChanMgr* m_chanMgr;
+    std::shared_ptr<Channel> ch;
+};
+
+TEST_F(WMHTTPStreamFixture, dataChunkBecomesASFChunk)
+{
+    StringStream mem(std::string({ '$', 'D', 5, 0 }) + "hello" +
+                     std::string({ '$', 'D', 3, 0 }) + "abc" +
+                     std::string({ '$', 'E', 0, 0 }));
+    WMHTTPStream wmhttp;
+    ASSERT_EQ(0, wmhttp.readPacket(mem, ch));
+    ASSERT_EQ(0, wmhttp.readPacket(mem, ch));
+    ASSERT_EQ(1, wmhttp.readPacket(mem, ch));
+
+    ChanPacket pack;
+    ASSERT_TRUE(ch->rawData.findPacket(0, pack));
+    ASSERT_EQ(asfChunk(0x4424, 0, 0, "hello"), std::string(pack.data, pack.len));
+    ASSERT_TRUE(ch->rawData.findPacket(pack.pos + pack.len, pack));
+    ASSERT_EQ(asfChunk(0x4424, 1, 0, "abc"), std::string(pack.data, pack.len));
+}
+
+TEST_F(WMHTTPStreamFixture, mmsReadsChunkIntoPacket)
+{
+    auto chunk = asfChunk(0x4424, 7, 0, "payload");
+    StringStream mem(chunk);
+    MMSStream mms;
+    mms.readPacket(mem, ch);
+
+    ChanPacket pack;
+    ASSERT_TRUE(ch->rawData.findPacket(0, pack));
+    ASSERT_EQ(ChanPacket::T_DATA, pack.type);
+    ASSERT_EQ(chunk, std::string(pack.data, pack.len));
+}
+
+TEST_F(WMHTTPStreamFixture, mmsRejectsBadLength)
+{
+    StringStream mem(std::string({ 0x24, 0x44, 4, 0 }) + std::string(8, '\0'));
+    MMSStream mms;
+    ASSERT_THROW(mms.readPacket(mem, ch), StreamException);
+}
@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+
+#include "xmlreader.h"
+#include "common.h"
+
+class XMLReaderFixture : public ::testing::Test {
+public:
+};
+
+TEST_F(XMLReaderFixture, tokens)
+{
+    std::string data = "<?xml version=\"1.0\"?><!-- comment --><a x=\"1\">text<b/></a>";
+    XMLReader r(data);
+
+    ASSERT_EQ(XMLReader::T_START, r.next());
+    ASSERT_TRUE(r.nameIs("a"));
+    ASSERT_TRUE(r.nameIs("A"));
+    ASSERT_FALSE(r.nameIs("ab"));
+
+    ASSERT_EQ(XMLReader::T_TEXT, r.next());
+    ASSERT_EQ("text", r.text());
+
+    ASSERT_EQ(XMLReader::T_START, r.next());
+    ASSERT_EQ("b", r.name());
+    ASSERT_EQ(XMLReader::T_END, r.next());
+    ASSERT_EQ("b", r.name());
+
+    ASSERT_EQ(XMLReader::T_END, r.next());
+    ASSERT_EQ("a", r.name());
+
+    ASSERT_EQ(XMLReader::T_EOF, r.next());
+    ASSERT_EQ(XMLReader::T_EOF, r.next());
+}
+
+TEST_F(XMLReaderFixture, attributes)
+{
+    std::string data = "<host ip=\"254.254.254.254\" port_open=\"1\"  port = \"7144\" empty=\"\" />";
+    XMLReader r(data);
+
+    ASSERT_EQ(XMLReader::T_START, r.next());
+    ASSERT_EQ("host", r.name());
+
+    std::string v;
+    ASSERT_TRUE(r.attr("ip", v));
+    ASSERT_EQ("254.254.254.254", v);
+    ASSERT_TRUE(r.attr("PORT", v));
+    ASSERT_EQ("7144", v);
+    ASSERT_TRUE(r.attr("port_open", v));
+    ASSERT_EQ("1", v);
+    ASSERT_TRUE(r.attr("empty", v));
+    ASSERT_EQ("", v);
+    ASSERT_FALSE(r.attr("po", v));
+
+    ASSERT_EQ(XMLReader::T_END, r.next());
+    ASSERT_FALSE(r.attr("ip", v));
+}
+
+TEST_F(XMLReaderFixture, notXML)
+{
+    std::string data = "<?php ?>";
+    XMLReader r(data);
+    ASSERT_THROW(r.next(), StreamException);
+}
+
+TEST_F(XMLReaderFixture, singleQuotes)
+{
+    std::string data = "<b id='123'></b>"; // XML::read() と同じく単一引用符は動かない
+    XMLReader r(data);
+
+    ASSERT_EQ(XMLReader::T_START, r.next());
+    std::string v;
+    ASSERT_THROW(r.attr("id", v), StreamException);
+}
+
+TEST_F(XMLReaderFixture, unterminated)
+{
+    std::string data = "<a x=\"1\"";
+    XMLReader r(data);
+
+    ASSERT_EQ(XMLReader::T_START, r.next());
+    ASSERT_EQ("a", r.name());
+    ASSERT_EQ(XMLReader::T_EOF, r.next());
+}
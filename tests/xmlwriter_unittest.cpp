@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+
+#include "sstream.h"
+#include "xml.h"
+#include "xmlwriter.h"
+
+class XMLWriterFixture : public ::testing::Test {
+public:
+    XMLWriterFixture()
+        : w(mem)
+    {
+    }
+
+    StringStream mem;
+    XMLWriter w;
+};
+
+TEST_F(XMLWriterFixture, sameAsNodeWrite)
+{
+    XML xml;
+    XML::Node *rn = new XML::Node("peercast");
+    xml.setRoot(rn);
+    rn->add(new XML::Node("servent uptime=\"%d\"", 10));
+    XML::Node *cn = new XML::Node("channels_relayed total=\"%d\"", 1);
+    rn->add(cn);
+    XML::Node *hn = new XML::Node("hits hosts=\"%d\"", 1);
+    cn->add(hn);
+    hn->add(new XML::Node("host ip=\"%s\"", "127.0.0.1:7144"));
+    rn->add(new XML::Node("channels_found total=\"%d\"", 0));
+
+    StringStream expected;
+    xml.write(expected);
+
+    w.declaration();
+    w.open("peercast");
+    w.empty("servent uptime=\"%d\"", 10);
+    w.open("channels_relayed total=\"%d\"", 1);
+    w.open("hits hosts=\"%d\"", 1);
+    w.empty("host ip=\"%s\"", "127.0.0.1:7144");
+    w.close();
+    w.close();
+    w.open("channels_found total=\"%d\"", 0);
+    w.close();
+    w.close();
+    ASSERT_TRUE(w.done());
+    w.flush();
+
+    ASSERT_EQ(expected.str(), mem.str());
+}
+
+TEST_F(XMLWriterFixture, nothingWrittenUntilFlush)
+{
+    w.open("a");
+    w.close();
+    ASSERT_EQ("", mem.str());
+
+    w.flush();
+    ASSERT_EQ("<a/>\n", mem.str());
+}
+
+TEST_F(XMLWriterFixture, longTag)
+{
+    std::string value(5000, 'x');
+    w.empty("a v=\"%s\"", value.c_str());
+    w.flush();
+    ASSERT_EQ("<a v=\"" + value + "\"/>\n", mem.str());
+}
+
+TEST_F(XMLWriterFixture, flushesLargeDocument)
+{
+    w.open("list");
+    for (int i = 0; i < 10000; i++)
+        w.empty("item n=\"%d\"", i);
+    ASSERT_NE("", mem.str());
+    w.close();
+    w.flush();
+
+    XML xml;
+    mem.rewind();
+    xml.read(mem);
+    ASSERT_STREQ("list", xml.root->getName());
+}
+
+TEST_F(XMLWriterFixture, closeWithoutOpen)
+{
+    ASSERT_THROW(w.close(), StreamException);
+}
@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include "ypsession.h"
+
+class YPSessionFixture : public ::testing::Test {
+};
+
+TEST_F(YPSessionFixture, backsOffOnFailures)
+{
+    YPSession s;
+    const unsigned int t = 1000;
+
+    ASSERT_TRUE(s.canConnect(t));
+    s.onConnecting(t);
+    s.onDisconnected(t + 1);    // 繋がらなかった
+    ASSERT_EQ(YPSession::MIN_BACKOFF * 2, s.backoff());
+    ASSERT_FALSE(s.canConnect(t + 1 + YPSession::MIN_BACKOFF * 2 - 1));
+    ASSERT_TRUE(s.canConnect(t + 1 + YPSession::MIN_BACKOFF * 2));
+
+    // すぐに切れる接続も失敗に数える。
+    s.onConnecting(t + 20);
+    s.onConnected(t + 20);
+    ASSERT_FALSE(s.canConnect(t + 1000));
+    s.onDisconnected(t + 21);
+    ASSERT_EQ(YPSession::MIN_BACKOFF * 4, s.backoff());
+
+    for (int i = 0; i < 20; i++)
+        s.onDisconnected(t + 30);
+    ASSERT_EQ(YPSession::MAX_BACKOFF, s.backoff());
+
+    // しばらく続いた接続の後は元に戻る。
+    s.onConnected(t + 100);
+    s.onDisconnected(t + 100 + YPSession::STABLE_SECONDS);
+    ASSERT_EQ(YPSession::MIN_BACKOFF, s.backoff());
+}
+
+TEST_F(YPSessionFixture, coalescesUpdates)
+{
+    YPSession s;
+    const unsigned int t = 1000;
+
+    ASSERT_FALSE(s.takeUpdate(t));
+
+    // 定期の更新は間隔が空いていれば一度だけ。
+    for (int i = 0; i < 10; i++)
+        s.requestUpdate(false, t);
+    ASSERT_TRUE(s.takeUpdate(t));
+    ASSERT_FALSE(s.takeUpdate(t));
+
+    s.requestUpdate(false, t + 1);
+    ASSERT_FALSE(s.takeUpdate(t + YPSession::UPDATE_INTERVAL - 1));
+    ASSERT_TRUE(s.takeUpdate(t + YPSession::UPDATE_INTERVAL));
+
+    // 急ぎの更新は最初に頼まれてから COALESCE_SECONDS 待ってまとめる。
+    const unsigned int u = t + YPSession::UPDATE_INTERVAL + 1;
+    s.requestUpdate(true, u);
+    s.requestUpdate(true, u + 1);
+    s.requestUpdate(false, u + 1);
+    ASSERT_FALSE(s.takeUpdate(u + YPSession::COALESCE_SECONDS - 1));
+    ASSERT_TRUE(s.takeUpdate(u + YPSession::COALESCE_SECONDS));
+    ASSERT_FALSE(s.takeUpdate(u + YPSession::COALESCE_SECONDS + 1));
+
+    auto state = s.getState();
+    ASSERT_EQ(14, state.at("numRequests").number());
+    ASSERT_EQ(3, state.at("numUpdates").number());
+}
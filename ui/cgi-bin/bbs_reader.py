@@ -1,5 +1,16 @@
 # -*- coding: utf-8 -*-
 import configparser, re, urllib.request, html
+import hashlib, os, tempfile, time
+
+try:
+  import fcntl
+except ImportError:
+  fcntl = None
+
+# 取ってきた板・スレッドのデータを置く所。プロセスの間で共有する。
+CACHE_DIR = os.path.join(tempfile.gettempdir(), "peercast-bbs-cache")
+# この秒数の間はキャッシュをそのまま使い、取りに行かない。
+CACHE_TTL = 5
 
 def print_bad_request(message):
   print("Status: 400 Bad Request")
@@ -63,8 +74,9 @@ class Board:
     return threads
 
   def download(self, url):
-    response = urllib.request.urlopen(url)
-    return response.read()
+    # 2ch 互換の dat は後ろに足されるだけなので、差分だけを取る。
+    append_only = not self.shitaraba and url.endswith(".dat")
+    return cached_download(url, append_only)
 
   def __parse_settings(self, string):
     config = configparser.ConfigParser()
@@ -121,3 +133,92 @@ class Thread:
       url = self.dat_url()
       lines = self.board.download(url).decode(self.board.external_encoding, 'replace').splitlines()
       return "".join(map(lambda line: line + "\n", lines[r.start-1:]))
+
+class _CacheLock:
+
+  def __init__(self, path):
+    self.path = path
+
+  def __enter__(self):
+    self.file = open(self.path, "a")
+    if fcntl:
+      fcntl.flock(self.file, fcntl.LOCK_EX)
+    return self
+
+  def __exit__(self, *args):
+    if fcntl:
+      fcntl.flock(self.file, fcntl.LOCK_UN)
+    self.file.close()
+
+def _read_cache(path):
+  try:
+    with open(path + ".meta", "r") as f:
+      last_modified = f.read()
+    with open(path, "rb") as f:
+      return f.read(), last_modified, os.path.getmtime(path + ".meta")
+  except OSError:
+    return None, "", 0
+
+def _write_cache(path, data, last_modified):
+  tmp = "%s.%d" % (path, os.getpid())
+  with open(tmp, "wb") as f:
+    f.write(data)
+  os.replace(tmp, path)
+  _touch_cache(path, last_modified)
+
+def _touch_cache(path, last_modified):
+  tmp = "%s.meta.%d" % (path, os.getpid())
+  with open(tmp, "w") as f:
+    f.write(last_modified or "")
+  os.replace(tmp, path + ".meta")
+
+def _fetch(url, headers):
+  try:
+    response = urllib.request.urlopen(urllib.request.Request(url, headers = headers))
+    return response.status, response.read(), response.headers.get("Last-Modified", "")
+  except urllib.error.HTTPError as e:
+    if e.code in (304, 416):
+      return e.code, b"", ""
+    raise
+
+# url の内容。CACHE_TTL 秒以内に取ったものがあればそれを返す。古ければ
+# If-Modified-Since を付けて取り直す。append_only なら最後の 1 バイトか
+# ら後ろだけを Range で取り、それが改行で始まらなければ全体を取り直す。
+# 同じ url を同時に取りに行くのは一つのプロセスだけ。
+def cached_download(url, append_only = False):
+  try:
+    os.makedirs(CACHE_DIR, exist_ok = True)
+  except OSError:
+    return urllib.request.urlopen(url).read()
+  path = os.path.join(CACHE_DIR, hashlib.sha1(url.encode("utf-8")).hexdigest())
+
+  data, last_modified, mtime = _read_cache(path)
+  if data is not None and time.time() - mtime < CACHE_TTL:
+    return data
+
+  with _CacheLock(path + ".lock"):
+    # 待っている間に他のプロセスが取ってきたかもしれない。
+    data, last_modified, mtime = _read_cache(path)
+    if data is not None and time.time() - mtime < CACHE_TTL:
+      return data
+
+    headers = {}
+    if data is not None and last_modified:
+      headers["If-Modified-Since"] = last_modified
+    if data and append_only:
+      headers["Range"] = "bytes=%d-" % (len(data) - 1)
+
+    status, body, new_modified = _fetch(url, headers)
+    if status in (304, 416):
+      _touch_cache(path, last_modified)
+      return data
+    if status == 206:
+      if body[:1] == b"\n":
+        data = data + body[1:]
+      else:
+        # 書き換えられている (あぼーん)。
+        status, data, new_modified = _fetch(url, {})
+    else:
+      data = body
+    _write_cache(path, data, new_modified)
+    return data
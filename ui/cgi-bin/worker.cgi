@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+#
+# CGI スクリプトを続けて実行するワーカー。PeerCast から起動され、標準
+# 入力から要求を読み、スクリプトの出力を標準出力へ返す。
+#
+#   要求: "<番号> <長さ>\n" に続けて "名前=値\0" を並べた環境変数
+#   応答: "<番号> <長さ>\n" に続けてスクリプトの出力と "\n"
+#
+# スクリプトは同じインタープリターの中で実行するので、import したモ
+# ジュールは次の要求でもそのまま使われる。
+import io, os, runpy, sys
+
+if "GATEWAY_INTERFACE" in os.environ:
+  # CGI として直接呼ばれた。
+  sys.stdout.write("Status: 404 Not Found\r\nContent-Type: text/plain\r\n\r\nNot Found\n")
+  sys.exit()
+
+if os.name == "nt":
+  # Windows では標準エラー出力が標準出力とつながっているので捨てる。
+  sys.stderr = open(os.devnull, "w")
+
+stdin = sys.stdin.buffer
+stdout = sys.stdout.buffer
+base_environ = dict(os.environ)
+base_path = list(sys.path)
+
+def run(env):
+  os.environ.clear()
+  os.environ.update(base_environ)
+  os.environ.update(env)
+  sys.argv = [env.get("SCRIPT_FILENAME", "")]
+  sys.path[:] = base_path
+
+  buf = io.BytesIO()
+  out = io.TextIOWrapper(buf, encoding="utf-8", newline="")
+  saved = sys.stdout
+  sys.stdout = out
+  try:
+    runpy.run_path(env["SCRIPT_FILENAME"], run_name="__main__")
+  except SystemExit:
+    pass
+  except Exception as e:
+    print(e, file=sys.stderr)
+    out.flush()
+    if not buf.getvalue():
+      out.write("Status: 500 Internal Server Error\r\n\r\n")
+  finally:
+    sys.stdout = saved
+  out.flush()
+  return buf.getvalue()
+
+while True:
+  head = stdin.readline()
+  if not head:
+    break
+  id, length = head.split()
+  payload = stdin.read(int(length))
+
+  env = {}
+  for var in payload.split(b"\0"):
+    if b"=" in var:
+      k, v = var.decode("utf-8", "replace").split("=", 1)
+      env[k] = v
+
+  data = run(env)
+  stdout.write(b"%d %d\n" % (int(id), len(data)) + data + b"\n")
+  stdout.flush()
@@ -36,6 +36,8 @@
 #include <libgen.h> // dirname
 #include "gnutella.h"
 #include "notif.h"
+#include "prefork.h"
+#include "handoff.h"
 #include <string.h> // strdup
 
 // ----------------------------------
@@ -54,6 +56,8 @@ static std::string s_stateDirPath;
 static std::string s_cacheDirPath;
 static std::string s_settingsDirPath;
 static bool s_enableNotifySend = false;
+static int s_numWorkers = 0;
+static bool s_takeover = false;
 
 // ---------------------------------
 class MyPeercastInst : public PeercastInstance
@@ -371,6 +375,8 @@ int main(int argc, char* argv[])
             printf("-P, --path <path>            set path to html files\n");
             printf("-d, --daemon                 fork in background\n");
             printf("-p, --pidfile <pidfile>      specify pid file\n");
+            printf("-w, --workers <n>            run n worker processes on the same port\n");
+            printf("--takeover                   take over connections from the running peercast\n");
             printf("--enable-notify-send         enable notification through notify-send command\n");
             printf("-h, --help                   show this help\n");
             return 0;
@@ -383,6 +389,12 @@ int main(int argc, char* argv[])
             }
         } else if (!strcmp(argv[i], "--enable-notify-send")) {
             s_enableNotifySend = true;
+        } else if (!strcmp(argv[i], "--workers") || !strcmp(argv[i], "-w")) {
+            if (++i < argc) {
+                s_numWorkers = atoi(argv[i]);
+            }
+        } else if (!strcmp(argv[i], "--takeover")) {
+            s_takeover = true;
         } else {
             printf("Invalid argument %s\n", argv[i]);
             return 1;
@@ -412,6 +424,29 @@ int main(int argc, char* argv[])
         free(tmp);
     }
 
+    signal(SIGINT, sigProc);
+    signal(SIGTERM, sigProc);
+    signal(SIGHUP, sigProc);
+
+    // ワーカーのモードでは、このプロセスはワーカーを見張るだけになる。
+    if (s_numWorkers > 1) {
+        if (g_prefork.run(s_numWorkers, []() { return quit; }) < 0) {
+            if (setPidFile) unlink(pidFileName);
+            return 0;
+        }
+    }
+
+    // 動いているプロセスから待ち受けと接続を受け取る。設定はそのプロセ
+    // スが書いてから渡してくれる。
+    if (s_takeover && s_numWorkers <= 1) {
+        if (g_restartHandoff.takeover(s_stateDirPath + "/handoff.sock"))
+            fprintf(stderr, "Took over from the running process\n");
+        else
+            fprintf(stderr, "Nothing to take over\n");
+    }
+    // 新しいプロセスに引き継いだら終わる。
+    g_restartHandoff.onComplete = []() { quit = true; };
+
     peercastInst = new MyPeercastInst();
     peercastApp = new MyPeercastApp();
 
@@ -422,10 +457,8 @@ int main(int argc, char* argv[])
         LOG_INFO("Log file: %s", logFileName.c_str());
     if (setPidFile)
         LOG_INFO("PID file: %s", pidFileName.c_str());
-
-    signal(SIGINT, sigProc);
-    signal(SIGTERM, sigProc);
-    signal(SIGHUP, sigProc);
+    if (g_prefork.enabled())
+        LOG_INFO("Worker %d of %d", g_prefork.index(), g_prefork.numWorkers());
 
     while (!quit) {
         sys->sleep(1000);
@@ -436,7 +469,10 @@ int main(int argc, char* argv[])
         }
     }
 
-    peercastInst->saveSettings();
+    // 引き継いだ時は渡す前に書いてある。新しいプロセスの設定を上書きし
+    // ない。
+    if (!g_restartHandoff.handedOver())
+        peercastInst->saveSettings();
 
     peercastInst->quit();
 
@@ -447,7 +483,7 @@ int main(int argc, char* argv[])
         fclose(logfile);
         // Log might continue but will only be written to stdout.
     }
-    if (setPidFile) unlink(pidFileName);
+    if (setPidFile && !g_prefork.enabled() && !g_restartHandoff.handedOver()) unlink(pidFileName);
 
     return 0;
 }
@@ -32,6 +32,7 @@
 
 #include <windows.h>
 #include <shellapi.h>
+#include <commctrl.h>
 
 #define MAX_LOADSTRING 100
 
@@ -527,8 +528,13 @@ void	APICALL MyPeercastApp::notifyMessage(ServMgr::NOTIFY_TYPE type, const char
 //
 void createGUI(HWND hWnd)
 {
-    if (!guiWnd)
+    if (!guiWnd) {
+        // 接続とチャンネルの一覧はリストビュー。
+        INITCOMMONCONTROLSEX icc = { sizeof(icc), ICC_LISTVIEW_CLASSES };
+        InitCommonControlsEx(&icc);
+
         guiWnd = CreateDialog(hInst, (LPCTSTR)IDD_MAINWINDOW, hWnd, (DLGPROC)GUIProc);
+    }
     ShowWindow(guiWnd, SW_SHOWNORMAL);
 }
 
@@ -32,8 +32,16 @@
 #include "servmgr.h"
 #include "peercast.h"
 #include "simple.h"
+#include "chanmgr.h"
+#include "eventbus.h"
+#include "str.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #include <windows.h>
+#include <commctrl.h>
 
 ThreadInfo guiThread;
 
@@ -93,15 +101,6 @@ void setEditInt(int id, int v)
     SendDlgItemMessageA(guiWnd, id, WM_SETTEXT, 0, (LPARAM)str);
 }
 
-// --------------------------------------------------
-void *getListBoxSelData(int id)
-{
-    int sel = SendDlgItemMessage(guiWnd, id, LB_GETCURSEL, 0, 0);
-    if (sel >= 0)
-        return (void *)SendDlgItemMessage(guiWnd, id, LB_GETITEMDATA, sel, 0);
-    return NULL;
-}
-
 // --------------------------------------------------
 void setButtonState(int id, bool on)
 {
@@ -148,97 +147,219 @@ void ADDLOG2(const char *fmt, va_list ap, int id, bool sel, void *data, LogBuffe
 }
 
 // --------------------------------------------------
-void ADDCHAN(void *d, const char *fmt, ...)
+// 接続とチャンネルの一覧の一行。data は行が指すサーバントかチャンネル。
+struct ListRow
 {
-    va_list ap;
-    va_start(ap, fmt);
-    ADDLOG2(fmt, ap, chanID, false, d, LogBuffer::T_NONE);
-    va_end(ap);
-}
+    void        *data;
+    std::string text;
+
+    bool operator == (const ListRow& o) const { return data == o.data && text == o.text; }
+    bool operator != (const ListRow& o) const { return !(*this == o); }
+};
+
+// --------------------------------------------------
+// 接続とチャンネルの一覧は LVS_OWNERDATA のリストビューで、コントロー
+// ルは行を持たない。行はここに置き、見えている行の文字列だけを
+// LVN_GETDISPINFO で渡す。どちらも GUI のスレッドだけが触る。
+static std::vector<ListRow> s_connRows, s_chanRows;
+
+// 状態のスレッドから新しい行を渡すメッセージ。wParam はコントロールの
+// ID、lParam は std::vector<ListRow>*。SendMessage で送るので、返るま
+// で lParam は生きている。
+static const UINT WM_SETROWS = WM_APP + 1;
 
 // --------------------------------------------------
-void ADDCONN(void *d, const char *fmt, ...)
+static std::vector<ListRow>& rowsOf(int id)
 {
-    va_list ap;
-    va_start(ap, fmt);
-    ADDLOG2(fmt, ap, statusID, false, d, LogBuffer::T_NONE);
-    va_end(ap);
+    return (id == statusID) ? s_connRows : s_chanRows;
 }
 
 // --------------------------------------------------
-THREAD_PROC showConnections(ThreadInfo *thread)
+static void initListView(int id)
 {
-    //	thread->lock();
-    while (thread->active()) {
-        int sel, top, i;
-        sel = SendDlgItemMessage(guiWnd, statusID, LB_GETCURSEL, 0, 0);
-        top = SendDlgItemMessage(guiWnd, statusID, LB_GETTOPINDEX, 0, 0);
+    HWND list = GetDlgItem(guiWnd, id);
+    ListView_SetExtendedListViewStyle(list, LVS_EX_FULLROWSELECT);
 
-        SendDlgItemMessage(guiWnd, statusID, LB_RESETCONTENT, 0, 0);
+    RECT rc;
+    GetClientRect(list, &rc);
 
-        for (auto s = servMgr->servents; s; s = s->next) {
-            if (s->type == Servent::T_NONE)
-                continue;
+    LVCOLUMN col = {};
+    col.mask = LVCF_WIDTH;
+    col.cx = rc.right - rc.left - GetSystemMetrics(SM_CXVSCROLL);
+    ListView_InsertColumn(list, 0, &col);
+}
 
-            Host h = s->getHost();
+// --------------------------------------------------
+void *getListViewSelData(int id)
+{
+    auto& rows = rowsOf(id);
+    int sel = ListView_GetNextItem(GetDlgItem(guiWnd, id), -1, LVNI_SELECTED);
+    if (sel >= 0 && sel < (int)rows.size())
+        return rows[sel].data;
+    return NULL;
+}
 
-            unsigned int tnum = 0;
-            char tdef = 's';
-            if (s->lastConnect)
-                tnum = sys->getTime()-s->lastConnect;
+// --------------------------------------------------
+// 行を入れ替えて、数が変わればそれを伝え、違う行だけを描き直させる。
+// 選択とスクロールの位置は行番号のまま残る。
+static void setListViewRows(int id, std::vector<ListRow>& rows)
+{
+    auto& shown = rowsOf(id);
+    if (rows == shown)
+        return;
 
-            if ((s->type == Servent::T_RELAY) || (s->type == Servent::T_DIRECT)) {
-                ADDCONN(s, "%s-%s-%d%c  -  %s  -  %d ",
-                        s->getTypeStr(), s->getStatusStr(), tnum, tdef,
-                        h.str().c_str(),
-                        s->syncPos
-                        );
-            }else{
-                ADDCONN(s, "%s-%s-%d%c  -  %s",
-                        s->getTypeStr(), s->getStatusStr(), tnum, tdef,
-                        h.str().c_str()
-                        );
-            }
+    HWND list = GetDlgItem(guiWnd, id);
+
+    int first = -1, last = -1;
+    const size_t common = std::min(rows.size(), shown.size());
+    for (size_t i = 0; i < common; i++) {
+        if (rows[i] != shown[i]) {
+            if (first < 0)
+                first = (int)i;
+            last = (int)i;
         }
+    }
+    const bool resized = (rows.size() != shown.size());
+    if (resized) {
+        if (first < 0)
+            first = (int)common;
+        last = (int)std::max(rows.size(), shown.size()) - 1;
+    }
 
-        if (sel >= 0)
-            SendDlgItemMessage(guiWnd, statusID, LB_SETCURSEL, sel, 0);
-        if (top >= 0)
-            SendDlgItemMessage(guiWnd, statusID, LB_SETTOPINDEX, top, 0);
+    shown.swap(rows);
 
-        {
-            sel = SendDlgItemMessage(guiWnd, chanID, LB_GETCURSEL, 0, 0);
-            top = SendDlgItemMessage(guiWnd, chanID, LB_GETTOPINDEX, 0, 0);
-            SendDlgItemMessage(guiWnd, chanID, LB_RESETCONTENT, 0, 0);
+    if (resized)
+        ListView_SetItemCountEx(list, (int)shown.size(), LVSICF_NOINVALIDATEALL | LVSICF_NOSCROLL);
+    if (first >= 0)
+        ListView_RedrawItems(list, first, last);
+}
 
-            for (auto c = chanMgr->channel; c; c = c->next) {
-                if (c->isActive()) {
-                    ADDCHAN(c.get(), "%s - %d kb/s - %s", c->getName(), c->getBitrate(), c->getStatusStr());
-                }
-            }
+// --------------------------------------------------
+static void getListViewText(NMLVDISPINFO* di)
+{
+    if (!(di->item.mask & LVIF_TEXT) || di->item.cchTextMax <= 0)
+        return;
+
+    auto& rows = rowsOf((int)di->hdr.idFrom);
+    if (di->item.iItem < 0 || di->item.iItem >= (int)rows.size()) {
+        di->item.pszText[0] = 0;
+        return;
+    }
 
-            if (sel >= 0)
-                SendDlgItemMessage(guiWnd, chanID, LB_SETCURSEL, sel, 0);
-            if (top >= 0)
-                SendDlgItemMessage(guiWnd, chanID, LB_SETTOPINDEX, top, 0);
+    const std::string& text = rows[di->item.iItem].text;
+#ifdef _UNICODE
+    int n = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, di->item.pszText, di->item.cchTextMax);
+    if (n == 0)
+        di->item.pszText[di->item.cchTextMax - 1] = 0;
+#else
+    lstrcpynA(di->item.pszText, text.c_str(), di->item.cchTextMax);
+#endif
+}
+
+// --------------------------------------------------
+// ロックを持っている間は文字列を作るだけにして、ウィンドウへのメッセー
+// ジはロックを放してから送る。
+static std::vector<ListRow> connectionRows()
+{
+    std::vector<ListRow> rows;
+    std::lock_guard<ProfiledMutex> cs(servMgr->lock);
+
+    const unsigned int now = sys->getTime();
+    for (auto s = servMgr->servents; s; s = s->next) {
+        if (s->type == Servent::T_NONE)
+            continue;
+
+        Host h = s->getHost();
+
+        unsigned int tnum = 0;
+        char tdef = 's';
+        if (s->lastConnect)
+            tnum = now - s->lastConnect;
+
+        if ((s->type == Servent::T_RELAY) || (s->type == Servent::T_DIRECT)) {
+            rows.push_back({ s, str::format("%s-%s-%d%c  -  %s  -  %d ",
+                                            s->getTypeStr(), s->getStatusStr(), tnum, tdef,
+                                            h.str().c_str(),
+                                            s->syncPos) });
+        }else{
+            rows.push_back({ s, str::format("%s-%s-%d%c  -  %s",
+                                            s->getTypeStr(), s->getStatusStr(), tnum, tdef,
+                                            h.str().c_str()) });
         }
+    }
+    return rows;
+}
 
-        switch (servMgr->getFirewall(4)) {
-        case ServMgr::FW_ON:
-            SendDlgItemMessage(guiWnd, IDC_EDIT4, WM_SETTEXT, 0, (LPARAM)"Firewalled");
-            break;
-        case ServMgr::FW_UNKNOWN:
-            SendDlgItemMessage(guiWnd, IDC_EDIT4, WM_SETTEXT, 0, (LPARAM)"Unknown");
-            break;
-        case ServMgr::FW_OFF:
-            SendDlgItemMessage(guiWnd, IDC_EDIT4, WM_SETTEXT, 0, (LPARAM)"Normal");
-            break;
+// --------------------------------------------------
+static std::vector<ListRow> channelRows()
+{
+    std::vector<ListRow> rows;
+    std::lock_guard<ProfiledMutex> cs(chanMgr->lock);
+
+    for (auto c = chanMgr->channel; c; c = c->next) {
+        if (c->isActive()) {
+            rows.push_back({ c.get(), str::format("%s - %d kb/s - %s",
+                                                  c->getName(), c->getBitrate(), c->getStatusStr()) });
         }
+    }
+    return rows;
+}
 
-        // sleep for 1 second .. check every 1/10th for shutdown
-        for(i=0; i<10; i++) {
-            if (!thread->active())
-                break;
+// --------------------------------------------------
+THREAD_PROC showConnections(ThreadInfo *thread)
+{
+    std::vector<ListRow> shownConns, shownChans;
+    ServMgr::FW_STATE shownFirewall = (ServMgr::FW_STATE) -1;
+
+    // チャンネルやサーバントの状態が変わった時だけ描き直す。接続時間の
+    // 表示があるので、何も起きなくても一秒に一度は作り直す。
+    auto sub = g_eventBus.subscribe();
+    unsigned int lastRefresh = 0;
+    bool dirty = true;
+
+    //	thread->lock();
+    while (thread->active()) {
+        EventBus::Event ev;
+        while (sub->wait(ev, 0))
+            dirty = true;
+
+        const unsigned int now = sys->getTime();
+        if (dirty || now != lastRefresh) {
+            dirty = false;
+            lastRefresh = now;
+
+            auto conns = connectionRows();
+            if (conns != shownConns) {
+                shownConns = conns;
+                SendMessage(guiWnd, WM_SETROWS, statusID, (LPARAM)&conns);
+            }
+            auto chans = channelRows();
+            if (chans != shownChans) {
+                shownChans = chans;
+                SendMessage(guiWnd, WM_SETROWS, chanID, (LPARAM)&chans);
+            }
+
+            auto fw = servMgr->getFirewall(4);
+            if (fw != shownFirewall) {
+                shownFirewall = fw;
+                switch (fw) {
+                case ServMgr::FW_ON:
+                    SendDlgItemMessage(guiWnd, IDC_EDIT4, WM_SETTEXT, 0, (LPARAM)"Firewalled");
+                    break;
+                case ServMgr::FW_UNKNOWN:
+                    SendDlgItemMessage(guiWnd, IDC_EDIT4, WM_SETTEXT, 0, (LPARAM)"Unknown");
+                    break;
+                case ServMgr::FW_OFF:
+                    SendDlgItemMessage(guiWnd, IDC_EDIT4, WM_SETTEXT, 0, (LPARAM)"Normal");
+                    break;
+                }
+            }
+        }
+
+        // 次のイベントか 1/10 秒を待つ。終了の確認もこの間隔で行う。イ
+        // ベントが続けて来る時は 1/10 秒分まとめて一度に描き直す。
+        if (sub->wait(ev, 100)) {
+            dirty = true;
             sys->sleep(100);
         }
     }
@@ -288,6 +409,9 @@ LRESULT CALLBACK GUIProc (HWND hwnd, UINT message,
     case WM_INITDIALOG:
         guiWnd = hwnd;
 
+        initListView(statusID);
+        initListView(chanID);
+
         enableControl(IDC_BUTTON8, false);
         enableControl(IDC_BUTTON11, false);
         enableControl(IDC_BUTTON10, false);
@@ -392,7 +516,7 @@ LRESULT CALLBACK GUIProc (HWND hwnd, UINT message,
             break;
         case IDC_BUTTON8:		// play selected
             {
-                Channel *c = (Channel *)getListBoxSelData(chanID);
+                Channel *c = (Channel *)getListViewSelData(chanID);
                 if (c)
                     chanMgr->playChannel(c->info);
             }
@@ -402,14 +526,14 @@ LRESULT CALLBACK GUIProc (HWND hwnd, UINT message,
             break;
         case IDC_BUTTON6:		// servent disconnect
             {
-                Servent *s = (Servent *)getListBoxSelData(statusID);
+                Servent *s = (Servent *)getListViewSelData(statusID);
                 if (s)
                     s->thread.m_active = false;
             }
             break;
         case IDC_BUTTON5:		// chan disconnect
             {
-                Channel *c = (Channel *)getListBoxSelData(chanID);
+                Channel *c = (Channel *)getListViewSelData(chanID);
                 if (c)
                     c->thread.m_active = false;
             }
@@ -417,7 +541,7 @@ LRESULT CALLBACK GUIProc (HWND hwnd, UINT message,
             break;
         case IDC_BUTTON3:		// chan bump
             {
-                Channel *c = (Channel *)getListBoxSelData(chanID);
+                Channel *c = (Channel *)getListViewSelData(chanID);
                 if (c)
                     c->bump = true;
             }
@@ -431,6 +555,15 @@ LRESULT CALLBACK GUIProc (HWND hwnd, UINT message,
         }
         break;
 
+    case WM_SETROWS:
+        setListViewRows((int)wParam, *(std::vector<ListRow>*)lParam);
+        break;
+
+    case WM_NOTIFY:
+        if (((LPNMHDR)lParam)->code == LVN_GETDISPINFO)
+            getListViewText((NMLVDISPINFO*)lParam);
+        break;
+
     case WM_CLOSE:
         DestroyWindow( hwnd );
         break;
@@ -438,6 +571,8 @@ LRESULT CALLBACK GUIProc (HWND hwnd, UINT message,
     case WM_DESTROY:
         guiThread.m_active = false;
         guiWnd = NULL;
+        s_connRows.clear();
+        s_chanRows.clear();
         EndDialog(hwnd, LOWORD(wParam));
         break;
     }
@@ -18,6 +18,7 @@
 // GNU General Public License for more details.
 // ------------------------------------------------
 #include "osxapp.h"
+#include "statusfeed.h"
 #include <string>
 
 enum {
@@ -519,22 +520,24 @@ OSStatus OSXPeercastApp::redisplayInfo()
 
 void OSXPeercastApp::showStationStats()
 {
-	if( !servMgr || !chanMgr )
+	// read the summary the core publishes every second; takes no ServMgr locks
+	StatusBlock status;
+	if( !g_statusFeed.read( status ) )
 		return;
 
 	char workBuffer[256];
 	String upTimeString;
 
-	upTimeString.setFromStopwatch(servMgr->getUptime());
+	upTimeString.setFromStopwatch( (unsigned int) status.uptime );
 	mUpTime.setText( mWindowRef, upTimeString.cstr() );
 
-	mDirectConnections.setIntValue( mWindowRef, servMgr->numStreams( Servent::T_DIRECT, true ) );
-	mRelayConnections.setIntValue( mWindowRef, servMgr->numStreams( Servent::T_RELAY, true ) );
+	mDirectConnections.setIntValue( mWindowRef, (int) status.numDirect );
+	mRelayConnections.setIntValue( mWindowRef, (int) status.numRelays );
 
-	sprintf( workBuffer, "%d / %d", servMgr->numConnected(Servent::T_CIN), servMgr->numConnected(Servent::T_COUT) );
+	sprintf( workBuffer, "%d / %d", (int) status.numCIN, (int) status.numCOUT );
 	mCinCoutConnections.setText( mWindowRef, workBuffer );
-	mPGNUConnections.setIntValue( mWindowRef, servMgr->numConnected(Servent::T_PGNU) );
-	mIncomingConnections.setIntValue( mWindowRef, servMgr->numActive(Servent::T_INCOMING));
+	mPGNUConnections.setIntValue( mWindowRef, 0 );	// PGNU connections no longer exist
+	mIncomingConnections.setIntValue( mWindowRef, (int) status.numIncoming );
 }
 
 void OSXPeercastApp::handleButtonEvent( TButtonCallback fButtonCallback )